@@ -0,0 +1,155 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * benchmark.cpp - libcamera microbenchmark base class
+ */
+
+#include "benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <stdlib.h>
+
+/*
+ * The benchmarks print one JSON object per line on the standard output, to be
+ * consumed by scripts comparing the results of different builds:
+ *
+ * {"suite": "controls", "benchmark": "set", "iterations": 1048576,
+ *  "repetitions": 5, "ns_per_op": {"min": 21.4, "median": 21.9, "max": 23.0}}
+ *
+ * The number of iterations is calibrated for each benchmark to run for at
+ * least the minimum time, and the measurement is then repeated to report the
+ * spread of the results.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint64_t kDefaultMinTime = 100;
+constexpr unsigned int kDefaultRepetitions = 5;
+constexpr unsigned int kMaxIterations = 1U << 30;
+
+uint64_t measure(const Benchmark::Function &function, unsigned int iterations)
+{
+	Clock::time_point start = Clock::now();
+	function(iterations);
+	Clock::time_point end = Clock::now();
+
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+} /* namespace */
+
+Benchmark::Benchmark(const std::string &suite)
+	: suite_(suite), minTime_(kDefaultMinTime),
+	  repetitions_(kDefaultRepetitions)
+{
+}
+
+Benchmark::~Benchmark()
+{
+}
+
+int Benchmark::execute(int argc, char *argv[])
+{
+	int ret = parseOptions(argc, argv);
+	if (ret)
+		return ret;
+
+	ret = init();
+	if (ret)
+		return ret;
+
+	for (const Case &benchmark : cases_) {
+		if (benchmark.name.find(filter_) == std::string::npos)
+			continue;
+
+		run(benchmark);
+	}
+
+	cleanup();
+
+	return BenchmarkPass;
+}
+
+/*
+ * Register a benchmark \a function with a \a name. Benchmarks are run in the
+ * order they are added.
+ */
+void Benchmark::add(const std::string &name, Function function)
+{
+	cases_.push_back({ name, std::move(function) });
+}
+
+int Benchmark::parseOptions(int argc, char *argv[])
+{
+	static const struct option options[] = {
+		{ "min-time", required_argument, nullptr, 't' },
+		{ "repetitions", required_argument, nullptr, 'r' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 },
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "t:r:h", options, nullptr)) != -1) {
+		switch (opt) {
+		case 't':
+			minTime_ = strtoul(optarg, nullptr, 10);
+			break;
+		case 'r':
+			repetitions_ = std::max(1UL, strtoul(optarg, nullptr, 10));
+			break;
+		default:
+			std::cerr << "Usage: " << argv[0]
+				  << " [--min-time ms] [--repetitions count] [filter]"
+				  << std::endl;
+			return opt == 'h' ? BenchmarkSkip : BenchmarkFail;
+		}
+	}
+
+	if (optind < argc)
+		filter_ = argv[optind];
+
+	return 0;
+}
+
+void Benchmark::run(const Case &benchmark)
+{
+	const uint64_t minTime = minTime_ * 1000000;
+	unsigned int iterations = 1;
+
+	/* Scale the number of iterations until the run is long enough. */
+	while (iterations < kMaxIterations) {
+		uint64_t time = measure(benchmark.function, iterations);
+		if (time >= minTime)
+			break;
+
+		uint64_t next = time ? iterations * minTime * 5 / 4 / time
+				     : iterations * 10ULL;
+		next = std::clamp<uint64_t>(next, iterations * 2ULL, iterations * 100ULL);
+		iterations = std::min<uint64_t>(next, kMaxIterations);
+	}
+
+	std::vector<double> results;
+	for (unsigned int i = 0; i < repetitions_; ++i)
+		results.push_back(static_cast<double>(measure(benchmark.function, iterations)) /
+				  iterations);
+
+	std::sort(results.begin(), results.end());
+
+	std::cout << std::fixed << std::setprecision(1)
+		  << "{\"suite\": \"" << suite_ << "\", "
+		  << "\"benchmark\": \"" << benchmark.name << "\", "
+		  << "\"iterations\": " << iterations << ", "
+		  << "\"repetitions\": " << repetitions_ << ", "
+		  << "\"ns_per_op\": {"
+		  << "\"min\": " << results.front() << ", "
+		  << "\"median\": " << results[results.size() / 2] << ", "
+		  << "\"max\": " << results.back() << "}}"
+		  << std::endl;
+}
@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * benchmark.h - libcamera microbenchmark base class
+ */
+#ifndef __BENCHMARK_BENCHMARK_H__
+#define __BENCHMARK_BENCHMARK_H__
+
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+enum BenchmarkStatus {
+	BenchmarkPass = 0,
+	BenchmarkFail = -1,
+	BenchmarkSkip = 77,
+};
+
+class Benchmark
+{
+public:
+	/*
+	 * A benchmark function runs the measured operation \a iterations
+	 * times. Looping inside the function keeps the cost of the call out of
+	 * the measurement.
+	 */
+	using Function = std::function<void(unsigned int iterations)>;
+
+	Benchmark(const std::string &suite);
+	virtual ~Benchmark();
+
+	int execute(int argc, char *argv[]);
+
+protected:
+	virtual int init() = 0;
+	virtual void cleanup() {}
+
+	void add(const std::string &name, Function function);
+
+private:
+	struct Case {
+		std::string name;
+		Function function;
+	};
+
+	int parseOptions(int argc, char *argv[]);
+	void run(const Case &benchmark);
+
+	std::string suite_;
+	std::vector<Case> cases_;
+
+	std::string filter_;
+	uint64_t minTime_;
+	unsigned int repetitions_;
+};
+
+/* Prevent the compiler from optimizing away the computation of \a value. */
+template<typename T>
+inline void doNotOptimize(const T &value)
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#define BENCHMARK_REGISTER(klass)					\
+int main(int argc, char *argv[])					\
+{									\
+	return klass().execute(argc, argv);				\
+}
+
+#endif /* __BENCHMARK_BENCHMARK_H__ */
@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * controls.cpp - ControlList benchmarks
+ */
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "benchmark.h"
+
+using namespace libcamera;
+
+class ControlsBenchmark : public Benchmark
+{
+public:
+	ControlsBenchmark()
+		: Benchmark("controls")
+	{
+	}
+
+protected:
+	int init() override
+	{
+		/* A list shaped like the per-frame controls of an IPA. */
+		list_ = ControlList(controls::controls);
+		list_.set(controls::AeEnable, true);
+		list_.set(controls::ExposureTime, 10000);
+		list_.set(controls::AnalogueGain, 2.0f);
+		list_.set(controls::Brightness, 0.5f);
+		list_.set(controls::Contrast, 1.2f);
+		list_.set(controls::Saturation, 0.8f);
+		list_.set(controls::ColourGains, Span<const float>({ 1.5f, 1.8f }));
+		list_.set(controls::FrameDurationLimits, Span<const int64_t>({ 33333, 33333 }));
+
+		add("set", [this](unsigned int iterations) {
+			ControlList &list = list_;
+			for (unsigned int i = 0; i < iterations; ++i)
+				list.set(controls::ExposureTime, static_cast<int32_t>(i));
+			doNotOptimize(list);
+		});
+
+		add("set-array", [this](unsigned int iterations) {
+			ControlList &list = list_;
+			for (unsigned int i = 0; i < iterations; ++i)
+				list.set(controls::ColourGains,
+					 Span<const float>({ 1.0f, static_cast<float>(i) }));
+			doNotOptimize(list);
+		});
+
+		add("get", [this](unsigned int iterations) {
+			const ControlList &list = list_;
+			for (unsigned int i = 0; i < iterations; ++i)
+				doNotOptimize(list.get(controls::AnalogueGain));
+		});
+
+		add("get-array", [this](unsigned int iterations) {
+			const ControlList &list = list_;
+			for (unsigned int i = 0; i < iterations; ++i)
+				doNotOptimize(list.get(controls::ColourGains)[0]);
+		});
+
+		add("contains", [this](unsigned int iterations) {
+			const ControlList &list = list_;
+			for (unsigned int i = 0; i < iterations; ++i)
+				doNotOptimize(list.contains(controls::AE_ENABLE));
+		});
+
+		add("copy", [this](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; ++i) {
+				ControlList copy(list_);
+				doNotOptimize(copy);
+			}
+		});
+
+		add("merge", [this](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; ++i) {
+				ControlList list(controls::controls);
+				list.merge(list_);
+				doNotOptimize(list);
+			}
+		});
+
+		return BenchmarkPass;
+	}
+
+private:
+	ControlList list_;
+};
+
+BENCHMARK_REGISTER(ControlsBenchmark)
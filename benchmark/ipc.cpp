@@ -0,0 +1,129 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipc.cpp - IPC socket round trip benchmarks
+ */
+
+#include <iostream>
+
+#include <libcamera/object.h>
+
+#include "libcamera/internal/event_dispatcher.h"
+#include "libcamera/internal/ipc_unixsocket.h"
+#include "libcamera/internal/thread.h"
+
+#include "benchmark.h"
+
+using namespace libcamera;
+
+/*
+ * Send back all messages received on the socket. The socket is bound from the
+ * echo thread, to process its events there.
+ */
+class Echo : public Object
+{
+public:
+	int bind(int fd)
+	{
+		socket_.readyRead.connect(this, &Echo::readyRead);
+		return socket_.bind(fd);
+	}
+
+	void close()
+	{
+		socket_.close();
+	}
+
+private:
+	void readyRead(IPCUnixSocket *socket)
+	{
+		IPCUnixSocket::Payload payload;
+
+		if (!socket->receive(&payload))
+			socket->send(payload);
+	}
+
+	IPCUnixSocket socket_;
+};
+
+class IPCBenchmark : public Benchmark
+{
+public:
+	IPCBenchmark()
+		: Benchmark("ipc"), received_(false)
+	{
+	}
+
+protected:
+	int init() override
+	{
+		int fd = socket_.create();
+		if (fd < 0) {
+			std::cerr << "Failed to create IPC socket" << std::endl;
+			return BenchmarkFail;
+		}
+
+		socket_.readyRead.connect(this, &IPCBenchmark::readyRead);
+
+		echo_.moveToThread(&thread_);
+		thread_.start();
+
+		int ret = echo_.invokeMethod(&Echo::bind, ConnectionTypeBlocking, fd);
+		if (ret) {
+			std::cerr << "Failed to bind IPC socket" << std::endl;
+			return BenchmarkFail;
+		}
+
+		add("unixsocket-round-trip-small", [this](unsigned int iterations) {
+			roundTrip(16, iterations);
+		});
+
+		add("unixsocket-round-trip-large", [this](unsigned int iterations) {
+			roundTrip(4096, iterations);
+		});
+
+		return BenchmarkPass;
+	}
+
+	void cleanup() override
+	{
+		echo_.invokeMethod(&Echo::close, ConnectionTypeBlocking);
+
+		thread_.exit(0);
+		thread_.wait();
+	}
+
+private:
+	/* Send a message and wait for the echo, like a synchronous IPA call. */
+	void roundTrip(size_t size, unsigned int iterations)
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		IPCUnixSocket::Payload message;
+		message.data.resize(size);
+
+		for (unsigned int i = 0; i < iterations; ++i) {
+			received_ = false;
+			socket_.send(message);
+
+			while (!received_)
+				dispatcher->processEvents();
+		}
+	}
+
+	void readyRead(IPCUnixSocket *socket)
+	{
+		IPCUnixSocket::Payload payload;
+
+		if (!socket->receive(&payload))
+			received_ = true;
+	}
+
+	Thread thread_;
+	Echo echo_;
+
+	IPCUnixSocket socket_;
+	bool received_;
+};
+
+BENCHMARK_REGISTER(IPCBenchmark)
@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * object.cpp - Object::invokeMethod() benchmarks
+ */
+
+#include <atomic>
+#include <thread>
+
+#include <libcamera/object.h>
+
+#include "libcamera/internal/thread.h"
+
+#include "benchmark.h"
+
+using namespace libcamera;
+
+class Target : public Object
+{
+public:
+	Target()
+		: count_(0)
+	{
+	}
+
+	void method(unsigned int value)
+	{
+		doNotOptimize(value);
+		count_.fetch_add(1, std::memory_order_release);
+	}
+
+	unsigned int count() const
+	{
+		return count_.load(std::memory_order_acquire);
+	}
+
+private:
+	std::atomic<unsigned int> count_;
+};
+
+class ObjectBenchmark : public Benchmark
+{
+public:
+	ObjectBenchmark()
+		: Benchmark("object")
+	{
+	}
+
+protected:
+	int init() override
+	{
+		threadTarget_.moveToThread(&thread_);
+		thread_.start();
+
+		add("invoke-direct", [this](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; ++i)
+				localTarget_.invokeMethod(&Target::method,
+							  ConnectionTypeDirect, i);
+		});
+
+		add("invoke-queued", [this](unsigned int iterations) {
+			unsigned int target = threadTarget_.count() + iterations;
+
+			for (unsigned int i = 0; i < iterations; ++i)
+				threadTarget_.invokeMethod(&Target::method,
+							   ConnectionTypeQueued, i);
+
+			while (threadTarget_.count() != target)
+				std::this_thread::yield();
+		});
+
+		/* Measure the latency of a call to another thread and back. */
+		add("invoke-blocking", [this](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; ++i)
+				threadTarget_.invokeMethod(&Target::method,
+							   ConnectionTypeBlocking, i);
+		});
+
+		return BenchmarkPass;
+	}
+
+	void cleanup() override
+	{
+		thread_.exit(0);
+		thread_.wait();
+	}
+
+private:
+	Thread thread_;
+
+	Target localTarget_;
+	Target threadTarget_;
+};
+
+BENCHMARK_REGISTER(ObjectBenchmark)
@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * pixel_format.cpp - PixelFormatInfo benchmarks
+ */
+
+#include <vector>
+
+#include <libcamera/formats.h>
+
+#include "libcamera/internal/formats.h"
+#include "libcamera/internal/v4l2_pixelformat.h"
+
+#include "benchmark.h"
+
+using namespace libcamera;
+
+class PixelFormatBenchmark : public Benchmark
+{
+public:
+	PixelFormatBenchmark()
+		: Benchmark("pixel-format")
+	{
+	}
+
+protected:
+	int init() override
+	{
+		formats_ = {
+			formats::NV12,
+			formats::YUYV,
+			formats::ARGB8888,
+			formats::MJPEG,
+			formats::SBGGR10_CSI2P,
+			formats::SRGGB12,
+		};
+
+		for (const PixelFormat &format : formats_)
+			v4l2Formats_.push_back(PixelFormatInfo::info(format).v4l2Format);
+
+		add("info", [this](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; ++i) {
+				const PixelFormat &format = formats_[i % formats_.size()];
+				doNotOptimize(PixelFormatInfo::info(format).bitsPerPixel);
+			}
+		});
+
+		add("info-v4l2", [this](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; ++i) {
+				const V4L2PixelFormat &format = v4l2Formats_[i % v4l2Formats_.size()];
+				doNotOptimize(PixelFormatInfo::info(format).bitsPerPixel);
+			}
+		});
+
+		add("info-name", [](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; ++i)
+				doNotOptimize(PixelFormatInfo::info("NV12").bitsPerPixel);
+		});
+
+		return BenchmarkPass;
+	}
+
+private:
+	std::vector<PixelFormat> formats_;
+	std::vector<V4L2PixelFormat> v4l2Formats_;
+};
+
+BENCHMARK_REGISTER(PixelFormatBenchmark)
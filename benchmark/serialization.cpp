@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * serialization.cpp - ControlSerializer and IPADataSerializer benchmarks
+ */
+
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "libcamera/internal/byte_stream_buffer.h"
+#include "libcamera/internal/control_serializer.h"
+#include "libcamera/internal/ipa_data_serializer.h"
+
+#include "benchmark.h"
+
+using namespace libcamera;
+
+class SerializationBenchmark : public Benchmark
+{
+public:
+	SerializationBenchmark()
+		: Benchmark("serialization"),
+		  infoMap_({
+			  { &controls::AeEnable, ControlInfo(false, true) },
+			  { &controls::ExposureTime, ControlInfo(0, 66666) },
+			  { &controls::AnalogueGain, ControlInfo(1.0f, 16.0f) },
+			  { &controls::Brightness, ControlInfo(-1.0f, 1.0f) },
+			  { &controls::Contrast, ControlInfo(0.0f, 2.0f) },
+			  { &controls::Saturation, ControlInfo(0.0f, 2.0f) },
+		  }),
+		  list_(infoMap_)
+	{
+	}
+
+protected:
+	int init() override
+	{
+		list_.set(controls::AeEnable, true);
+		list_.set(controls::ExposureTime, 10000);
+		list_.set(controls::AnalogueGain, 2.0f);
+		list_.set(controls::Brightness, 0.5f);
+		list_.set(controls::Contrast, 1.2f);
+		list_.set(controls::Saturation, 0.8f);
+
+		/*
+		 * Transfer the info map once, as done when configuring an IPA,
+		 * to only measure the per-frame serialization of the list.
+		 */
+		std::vector<uint8_t> data;
+		std::tie(data, std::ignore) =
+			IPADataSerializer<ControlList>::serialize(list_, &serializer_);
+		ControlList initial =
+			IPADataSerializer<ControlList>::deserialize(data, &deserializer_);
+		if (initial.size() != list_.size()) {
+			std::cerr << "Failed to deserialize control list" << std::endl;
+			return BenchmarkFail;
+		}
+
+		add("control-list-round-trip", [this](unsigned int iterations) {
+			std::vector<uint8_t> buffer;
+
+			for (unsigned int i = 0; i < iterations; ++i) {
+				ByteStreamBuffer out(&buffer);
+				serializer_.serialize(list_, out);
+
+				ByteStreamBuffer in(const_cast<const uint8_t *>(buffer.data()),
+						    buffer.size());
+				ControlList list = deserializer_.deserialize<ControlList>(in);
+				doNotOptimize(list);
+			}
+		});
+
+		add("ipa-control-list-round-trip", [this](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; ++i) {
+				std::vector<uint8_t> buffer;
+				std::tie(buffer, std::ignore) =
+					IPADataSerializer<ControlList>::serialize(list_, &serializer_);
+				ControlList list =
+					IPADataSerializer<ControlList>::deserialize(buffer, &deserializer_);
+				doNotOptimize(list);
+			}
+		});
+
+		std::vector<uint32_t> ids(16);
+		std::iota(ids.begin(), ids.end(), 0);
+
+		add("ipa-vector-round-trip", [ids](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; ++i) {
+				std::vector<uint8_t> buffer;
+				std::tie(buffer, std::ignore) =
+					IPADataSerializer<std::vector<uint32_t>>::serialize(ids);
+				std::vector<uint32_t> out =
+					IPADataSerializer<std::vector<uint32_t>>::deserialize(buffer);
+				doNotOptimize(out);
+			}
+		});
+
+		return BenchmarkPass;
+	}
+
+private:
+	ControlInfoMap infoMap_;
+	ControlList list_;
+
+	ControlSerializer serializer_;
+	ControlSerializer deserializer_;
+};
+
+BENCHMARK_REGISTER(SerializationBenchmark)
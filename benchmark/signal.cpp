@@ -0,0 +1,130 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * signal.cpp - Signal emission benchmarks
+ */
+
+#include <atomic>
+#include <thread>
+
+#include <libcamera/object.h>
+#include <libcamera/signal.h>
+
+#include "libcamera/internal/thread.h"
+
+#include "benchmark.h"
+
+using namespace libcamera;
+
+class Receiver : public Object
+{
+public:
+	Receiver()
+		: count_(0)
+	{
+	}
+
+	void slot(unsigned int value)
+	{
+		doNotOptimize(value);
+		count_.fetch_add(1, std::memory_order_release);
+	}
+
+	unsigned int count() const
+	{
+		return count_.load(std::memory_order_acquire);
+	}
+
+private:
+	std::atomic<unsigned int> count_;
+};
+
+namespace {
+
+void staticSlot(unsigned int value)
+{
+	doNotOptimize(value);
+}
+
+} /* namespace */
+
+class SignalBenchmark : public Benchmark
+{
+public:
+	SignalBenchmark()
+		: Benchmark("signal")
+	{
+	}
+
+protected:
+	int init() override
+	{
+		direct_.connect(&directReceiver_, &Receiver::slot);
+		static_.connect(&staticSlot);
+
+		for (Receiver &receiver : multiReceivers_)
+			multi_.connect(&receiver, &Receiver::slot);
+
+		queuedReceiver_.moveToThread(&thread_);
+		queued_.connect(&queuedReceiver_, &Receiver::slot);
+		thread_.start();
+
+		add("emit-direct", [this](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; ++i)
+				direct_.emit(i);
+		});
+
+		add("emit-static", [this](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; ++i)
+				static_.emit(i);
+		});
+
+		add("emit-multi", [this](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; ++i)
+				multi_.emit(i);
+		});
+
+		add("emit-disconnected", [this](unsigned int iterations) {
+			for (unsigned int i = 0; i < iterations; ++i)
+				disconnected_.emit(i);
+		});
+
+		/*
+		 * Measure the throughput of queued signals, from emission to the
+		 * execution of the slot in the receiver thread.
+		 */
+		add("emit-queued", [this](unsigned int iterations) {
+			unsigned int target = queuedReceiver_.count() + iterations;
+
+			for (unsigned int i = 0; i < iterations; ++i)
+				queued_.emit(i);
+
+			while (queuedReceiver_.count() != target)
+				std::this_thread::yield();
+		});
+
+		return BenchmarkPass;
+	}
+
+	void cleanup() override
+	{
+		thread_.exit(0);
+		thread_.wait();
+	}
+
+private:
+	Thread thread_;
+
+	Receiver directReceiver_;
+	Receiver multiReceivers_[4];
+	Receiver queuedReceiver_;
+
+	Signal<unsigned int> direct_;
+	Signal<unsigned int> static_;
+	Signal<unsigned int> multi_;
+	Signal<unsigned int> disconnected_;
+	Signal<unsigned int> queued_;
+};
+
+BENCHMARK_REGISTER(SignalBenchmark)
@@ -0,0 +1,88 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * v4l2_buffer_cache.cpp - V4L2BufferCache benchmarks
+ */
+
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/buffer.h>
+#include <libcamera/file_descriptor.h>
+
+#include "libcamera/internal/v4l2_videodevice.h"
+
+#include "benchmark.h"
+
+using namespace libcamera;
+
+class V4L2BufferCacheBenchmark : public Benchmark
+{
+public:
+	V4L2BufferCacheBenchmark()
+		: Benchmark("v4l2-buffer-cache")
+	{
+	}
+
+protected:
+	static constexpr unsigned int kNumBuffers = 8;
+	static constexpr unsigned int kNumPlanes = 3;
+
+	int init() override
+	{
+		/*
+		 * The cache only compares the file descriptors and lengths of
+		 * the planes, any file descriptor can stand in for a dmabuf.
+		 */
+		int fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			std::cerr << "Failed to open /dev/null" << std::endl;
+			return BenchmarkFail;
+		}
+
+		for (unsigned int i = 0; i < 2 * kNumBuffers; ++i) {
+			std::vector<FrameBuffer::Plane> planes;
+			for (unsigned int j = 0; j < kNumPlanes; ++j)
+				planes.push_back({ FileDescriptor(fd), 4096 });
+
+			buffers_.push_back(std::make_unique<FrameBuffer>(planes));
+		}
+
+		close(fd);
+
+		/* Queue the same buffers over and over, the common case. */
+		add("get-hit", [this](unsigned int iterations) {
+			V4L2BufferCache cache(kNumBuffers);
+
+			for (unsigned int i = 0; i < iterations; ++i) {
+				int index = cache.get(*buffers_[i % kNumBuffers]);
+				cache.put(index);
+			}
+
+			doNotOptimize(cache.hits());
+		});
+
+		/* Cycle through more buffers than the cache can hold. */
+		add("get-miss", [this](unsigned int iterations) {
+			V4L2BufferCache cache(kNumBuffers);
+
+			for (unsigned int i = 0; i < iterations; ++i) {
+				int index = cache.get(*buffers_[i % buffers_.size()]);
+				cache.put(index);
+			}
+
+			doNotOptimize(cache.misses());
+		});
+
+		return BenchmarkPass;
+	}
+
+private:
+	std::vector<std::unique_ptr<FrameBuffer>> buffers_;
+};
+
+BENCHMARK_REGISTER(V4L2BufferCacheBenchmark)
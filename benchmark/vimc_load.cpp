@@ -0,0 +1,388 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * vimc_load.cpp - Framework overhead regression harness based on vimc
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/camera.h>
+#include <libcamera/camera_manager.h>
+#include <libcamera/framebuffer_allocator.h>
+#include <libcamera/object.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+
+#include "libcamera/internal/event_dispatcher.h"
+#include "libcamera/internal/thread.h"
+#include "libcamera/internal/timer.h"
+
+#include "benchmark.h"
+
+/*
+ * Capture from the vimc virtual camera with a synthetic load, to measure the
+ * overhead of the framework independently of real hardware. The application
+ * queues requests at a fixed frame rate, and the vimc IPA simulates the
+ * computation time of algorithms for every frame. The run prints one JSON
+ * object with the per-frame CPU time of the process and the request latency
+ * percentiles:
+ *
+ * {"suite": "vimc-load", "benchmark": "1920x1080@30 ipa 2000+-500us",
+ *  "frames": 300, "dropped": 0, "starved": 0, "cpu_us_per_frame": 412.3,
+ *  "latency_us": {"p50": 35210, "p90": 36987, "p99": 38456, "max": 39012}}
+ *
+ * The CPU time includes all threads of the process, including the IPA when it
+ * runs in a thread. All random jitter is seeded to make runs reproducible.
+ */
+
+using namespace libcamera;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+	Size size = { 1920, 1080 };
+	unsigned int fps = 30;
+	unsigned int frames = 300;
+	unsigned int warmup = 30;
+	unsigned int computeTime = 0;
+	unsigned int computeJitter = 0;
+	unsigned int seed = 1;
+};
+
+uint64_t cpuTime()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ULL +
+	       usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+uint64_t percentile(std::vector<uint64_t> samples, unsigned int percent)
+{
+	if (samples.empty())
+		return 0;
+
+	size_t index = std::min(samples.size() - 1, samples.size() * percent / 100);
+	std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+
+	return samples[index];
+}
+
+} /* namespace */
+
+class VimcLoad : public Object
+{
+public:
+	VimcLoad(const Options &options)
+		: options_(options), done_(false), completed_(0), dropped_(0),
+		  starved_(0), lastSequence_(0), cpuStart_(0)
+	{
+	}
+
+	int run(std::shared_ptr<Camera> camera);
+
+private:
+	void tick(Timer *timer);
+	void requestComplete(Request *request);
+
+	const Options &options_;
+	std::shared_ptr<Camera> camera_;
+
+	Timer timer_;
+	Clock::time_point deadline_;
+	bool done_;
+
+	std::vector<std::unique_ptr<Request>> requests_;
+	std::vector<Request *> freeRequests_;
+	std::map<const Request *, Clock::time_point> queueTimes_;
+
+	unsigned int completed_;
+	unsigned int dropped_;
+	unsigned int starved_;
+	unsigned int lastSequence_;
+	uint64_t cpuStart_;
+	std::vector<uint64_t> latencies_;
+};
+
+int VimcLoad::run(std::shared_ptr<Camera> camera)
+{
+	camera_ = camera;
+
+	std::unique_ptr<CameraConfiguration> config =
+		camera_->generateConfiguration({ StreamRole::VideoRecording });
+	if (!config)
+		return BenchmarkFail;
+
+	StreamConfiguration &cfg = config->at(0);
+	cfg.size = options_.size;
+	if (config->validate() == CameraConfiguration::Invalid ||
+	    camera_->configure(config.get())) {
+		std::cerr << "Failed to configure camera" << std::endl;
+		return BenchmarkFail;
+	}
+
+	FrameBufferAllocator allocator(camera_);
+	Stream *stream = cfg.stream();
+	if (allocator.allocate(stream) < 0) {
+		std::cerr << "Failed to allocate buffers" << std::endl;
+		return BenchmarkFail;
+	}
+
+	for (const std::unique_ptr<FrameBuffer> &buffer : allocator.buffers(stream)) {
+		std::unique_ptr<Request> request = camera_->createRequest();
+		if (!request || request->addBuffer(stream, buffer.get()))
+			return BenchmarkFail;
+
+		freeRequests_.push_back(request.get());
+		requests_.push_back(std::move(request));
+	}
+
+	camera_->requestCompleted.connect(this, &VimcLoad::requestComplete);
+	timer_.timeout.connect(this, &VimcLoad::tick);
+
+	if (camera_->start()) {
+		std::cerr << "Failed to start camera" << std::endl;
+		return BenchmarkFail;
+	}
+
+	if (!options_.warmup)
+		cpuStart_ = cpuTime();
+
+	deadline_ = Clock::now();
+	tick(&timer_);
+
+	EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+	while (!done_)
+		dispatcher->processEvents();
+
+	uint64_t cpu = cpuTime() - cpuStart_;
+
+	timer_.stop();
+	camera_->stop();
+	camera_->requestCompleted.disconnect(this, &VimcLoad::requestComplete);
+
+	std::stringstream name;
+	name << cfg.size.toString() << "@" << options_.fps
+	     << " ipa " << options_.computeTime << "+-" << options_.computeJitter
+	     << "us";
+
+	std::cout << std::fixed << std::setprecision(1)
+		  << "{\"suite\": \"vimc-load\", "
+		  << "\"benchmark\": \"" << name.str() << "\", "
+		  << "\"frames\": " << latencies_.size() << ", "
+		  << "\"dropped\": " << dropped_ << ", "
+		  << "\"starved\": " << starved_ << ", "
+		  << "\"cpu_us_per_frame\": "
+		  << static_cast<double>(cpu) / latencies_.size() << ", "
+		  << "\"latency_us\": {"
+		  << "\"p50\": " << percentile(latencies_, 50) << ", "
+		  << "\"p90\": " << percentile(latencies_, 90) << ", "
+		  << "\"p99\": " << percentile(latencies_, 99) << ", "
+		  << "\"max\": " << *std::max_element(latencies_.begin(), latencies_.end())
+		  << "}}" << std::endl;
+
+	return BenchmarkPass;
+}
+
+/*
+ * Queue one request per frame period. When all requests are in flight the
+ * tick is counted as starved, the pipeline doesn't keep up with the rate.
+ */
+void VimcLoad::tick([[maybe_unused]] Timer *timer)
+{
+	if (freeRequests_.empty()) {
+		starved_++;
+	} else {
+		Request *request = freeRequests_.back();
+		freeRequests_.pop_back();
+
+		queueTimes_[request] = Clock::now();
+		camera_->queueRequest(request);
+	}
+
+	deadline_ += std::chrono::microseconds(1000000 / options_.fps);
+	timer_.start(deadline_);
+}
+
+void VimcLoad::requestComplete(Request *request)
+{
+	if (request->status() == Request::RequestCancelled || done_)
+		return;
+
+	Clock::time_point now = Clock::now();
+	const FrameMetadata &metadata = request->buffers().begin()->second->metadata();
+
+	completed_++;
+	if (completed_ == options_.warmup) {
+		cpuStart_ = cpuTime();
+		starved_ = 0;
+	} else if (completed_ > options_.warmup) {
+		latencies_.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+			now - queueTimes_[request]).count());
+
+		/* vimc only produces frames for queued buffers, gaps are losses. */
+		if (metadata.sequence > lastSequence_ + 1)
+			dropped_ += metadata.sequence - lastSequence_ - 1;
+	}
+
+	lastSequence_ = metadata.sequence;
+
+	if (completed_ >= options_.warmup + options_.frames) {
+		done_ = true;
+		return;
+	}
+
+	request->reuse(Request::ReuseBuffers);
+	freeRequests_.push_back(request);
+}
+
+namespace {
+
+int parseOptions(int argc, char *argv[], Options *options)
+{
+	static const struct option longOptions[] = {
+		{ "size", required_argument, nullptr, 's' },
+		{ "fps", required_argument, nullptr, 'f' },
+		{ "frames", required_argument, nullptr, 'n' },
+		{ "warmup", required_argument, nullptr, 'w' },
+		{ "ipa-compute-us", required_argument, nullptr, 'c' },
+		{ "ipa-jitter-us", required_argument, nullptr, 'j' },
+		{ "seed", required_argument, nullptr, 'r' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 },
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "s:f:n:w:c:j:r:h", longOptions, nullptr)) != -1) {
+		switch (opt) {
+		case 's':
+			if (sscanf(optarg, "%ux%u", &options->size.width,
+				   &options->size.height) != 2)
+				return BenchmarkFail;
+			break;
+		case 'f':
+			options->fps = std::max(1UL, strtoul(optarg, nullptr, 10));
+			break;
+		case 'n':
+			options->frames = std::max(1UL, strtoul(optarg, nullptr, 10));
+			break;
+		case 'w':
+			options->warmup = strtoul(optarg, nullptr, 10);
+			break;
+		case 'c':
+			options->computeTime = strtoul(optarg, nullptr, 10);
+			break;
+		case 'j':
+			options->computeJitter = strtoul(optarg, nullptr, 10);
+			break;
+		case 'r':
+			options->seed = strtoul(optarg, nullptr, 10);
+			break;
+		default:
+			std::cerr << "Usage: " << argv[0]
+				  << " [--size WxH] [--fps fps] [--frames count]"
+				  << " [--warmup count] [--ipa-compute-us us]"
+				  << " [--ipa-jitter-us us] [--seed seed]"
+				  << std::endl;
+			return opt == 'h' ? BenchmarkSkip : BenchmarkFail;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Point the vimc IPA to a configuration file describing the synthetic load.
+ * This must be done before the camera manager starts and loads the IPA.
+ */
+int writeIPAConfiguration(const Options &options, std::string *dir)
+{
+	char path[] = "/tmp/libcamera-vimc-load-XXXXXX";
+	if (!mkdtemp(path))
+		return BenchmarkFail;
+
+	*dir = path;
+	if (mkdir((*dir + "/vimc").c_str(), 0700))
+		return BenchmarkFail;
+
+	std::ofstream file(*dir + "/vimc/vimc.conf");
+	file << "compute_time_us = " << options.computeTime << std::endl
+	     << "compute_jitter_us = " << options.computeJitter << std::endl
+	     << "seed = " << options.seed << std::endl;
+	if (!file)
+		return BenchmarkFail;
+
+	setenv("LIBCAMERA_IPA_CONFIG_PATH", dir->c_str(), 1);
+
+	return 0;
+}
+
+void removeIPAConfiguration(const std::string &dir)
+{
+	unlink((dir + "/vimc/vimc.conf").c_str());
+	rmdir((dir + "/vimc").c_str());
+	rmdir(dir.c_str());
+}
+
+} /* namespace */
+
+int main(int argc, char *argv[])
+{
+	Options options;
+	int ret = parseOptions(argc, argv, &options);
+	if (ret)
+		return ret;
+
+	std::string confDir;
+	ret = writeIPAConfiguration(options, &confDir);
+	if (ret) {
+		std::cerr << "Failed to write the IPA configuration" << std::endl;
+		return ret;
+	}
+
+	CameraManager cm;
+	if (cm.start()) {
+		removeIPAConfiguration(confDir);
+		return BenchmarkFail;
+	}
+
+	std::shared_ptr<Camera> camera = cm.get("platform/vimc.0 Sensor B");
+	if (!camera || camera->acquire()) {
+		std::cerr << "vimc camera not available" << std::endl;
+		cm.stop();
+		removeIPAConfiguration(confDir);
+		return BenchmarkSkip;
+	}
+
+	{
+		VimcLoad load(options);
+		ret = load.run(camera);
+	}
+
+	camera->release();
+	camera.reset();
+	cm.stop();
+
+	removeIPAConfiguration(confDir);
+
+	return ret;
+}
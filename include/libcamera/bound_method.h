@@ -8,6 +8,9 @@
 #define __LIBCAMERA_BOUND_METHOD_H__
 
 #include <memory>
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
 #include <tuple>
 #include <type_traits>
 #include <utility>
@@ -27,6 +30,42 @@ class BoundMethodPackBase
 {
 public:
 	virtual ~BoundMethodPackBase() = default;
+
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr) noexcept;
+};
+
+template<typename T>
+class BoundMethodPoolAllocator
+{
+public:
+	using value_type = T;
+
+	BoundMethodPoolAllocator() noexcept = default;
+	template<typename U>
+	BoundMethodPoolAllocator(const BoundMethodPoolAllocator<U> &) noexcept {}
+
+	T *allocate(size_t n)
+	{
+		if constexpr (alignof(T) > alignof(max_align_t))
+			return static_cast<T *>(::operator new(n * sizeof(T),
+							       std::align_val_t(alignof(T))));
+		else
+			return static_cast<T *>(BoundMethodPackBase::operator new(n * sizeof(T)));
+	}
+
+	void deallocate(T *ptr, [[maybe_unused]] size_t n) noexcept
+	{
+		if constexpr (alignof(T) > alignof(max_align_t))
+			::operator delete(ptr, std::align_val_t(alignof(T)));
+		else
+			BoundMethodPackBase::operator delete(ptr);
+	}
+
+	template<typename U>
+	bool operator==(const BoundMethodPoolAllocator<U> &) const noexcept { return true; }
+	template<typename U>
+	bool operator!=(const BoundMethodPoolAllocator<U> &) const noexcept { return false; }
 };
 
 template<typename R, typename... Args>
@@ -63,6 +102,9 @@ public:
 	}
 	virtual ~BoundMethodBase() = default;
 
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr) noexcept;
+
 	template<typename T, typename std::enable_if_t<!std::is_same<Object, T>::value> * = nullptr>
 	bool match(T *obj) { return obj == obj_; }
 	bool match(Object *object) { return object == object_; }
@@ -158,7 +200,8 @@ public:
 			return (obj->*func_)(args...);
 		}
 
-		auto pack = std::make_shared<PackType>(args...);
+		auto pack = std::allocate_shared<PackType>(BoundMethodPoolAllocator<PackType>(),
+							   args...);
 		bool sync = BoundMethodBase::activatePack(pack, deleteMethod);
 		return sync ? pack->ret_ : R();
 	}
@@ -194,7 +237,8 @@ public:
 			return (obj->*func_)(args...);
 		}
 
-		auto pack = std::make_shared<PackType>(args...);
+		auto pack = std::allocate_shared<PackType>(BoundMethodPoolAllocator<PackType>(),
+							   args...);
 		BoundMethodBase::activatePack(pack, deleteMethod);
 	}
 
@@ -7,11 +7,13 @@
 #ifndef __LIBCAMERA_BUFFER_H__
 #define __LIBCAMERA_BUFFER_H__
 
+#include <array>
 #include <stdint.h>
 #include <vector>
 
 #include <libcamera/class.h>
 #include <libcamera/file_descriptor.h>
+#include <libcamera/span.h>
 
 namespace libcamera {
 
@@ -24,18 +26,36 @@ struct FrameMetadata {
 		FrameCancelled,
 	};
 
+	enum Flag {
+		FlagKeyFrame = (1 << 0),
+	};
+
 	struct Plane {
 		unsigned int bytesused;
 	};
 
+	static constexpr unsigned int kMaxPlanes = 4;
+
 	Status status;
 	unsigned int sequence;
 	uint64_t timestamp;
-	std::vector<Plane> planes;
+	uint64_t dequeueTimestamp;
+	unsigned int flags;
+
+	Span<Plane> planes() { return { planes_.data(), numPlanes_ }; }
+	Span<const Plane> planes() const { return { planes_.data(), numPlanes_ }; }
+
+private:
+	friend class FrameBuffer;
+
+	std::array<Plane, kMaxPlanes> planes_;
+	unsigned int numPlanes_;
 };
 
-class FrameBuffer final
+class FrameBuffer final : public Extensible
 {
+	LIBCAMERA_DECLARE_PRIVATE()
+
 public:
 	struct Plane {
 		FileDescriptor fd;
@@ -48,22 +68,26 @@ public:
 
 	Request *request() const { return request_; }
 	void setRequest(Request *request) { request_ = request; }
-	const FrameMetadata &metadata() const { return metadata_; }
+	const FrameMetadata &metadata() const;
 
 	unsigned int cookie() const { return cookie_; }
 	void setCookie(unsigned int cookie) { cookie_ = cookie; }
 
-	void cancel() { metadata_.status = FrameMetadata::FrameCancelled; }
+	void cancel();
+
+	FileDescriptor releaseFence();
+
+#ifndef __DOXYGEN__
+	Private *_d();
+	const Private *_d() const;
+#endif
 
 private:
 	LIBCAMERA_DISABLE_COPY_AND_MOVE(FrameBuffer)
 
-	friend class V4L2VideoDevice; /* Needed to update metadata_. */
-
 	std::vector<Plane> planes_;
 
 	Request *request_;
-	FrameMetadata metadata_;
 
 	unsigned int cookie_;
 };
@@ -15,13 +15,16 @@
 #include <libcamera/class.h>
 #include <libcamera/controls.h>
 #include <libcamera/object.h>
+#include <libcamera/performance.h>
 #include <libcamera/request.h>
 #include <libcamera/signal.h>
+#include <libcamera/span.h>
 #include <libcamera/stream.h>
 #include <libcamera/transform.h>
 
 namespace libcamera {
 
+class CompletionQueue;
 class FrameBuffer;
 class FrameBufferAllocator;
 class PipelineHandler;
@@ -39,6 +42,13 @@ public:
 	using iterator = std::vector<StreamConfiguration>::iterator;
 	using const_iterator = std::vector<StreamConfiguration>::const_iterator;
 
+	struct Bandwidth {
+		std::vector<uint64_t> streams;
+		uint64_t internal;
+
+		uint64_t total() const;
+	};
+
 	virtual ~CameraConfiguration();
 
 	void addConfiguration(const StreamConfiguration &cfg);
@@ -63,11 +73,22 @@ public:
 	bool empty() const;
 	std::size_t size() const;
 
+	Bandwidth bandwidth(double frameRate) const;
+	virtual unsigned int minRequestDepth() const;
+	virtual unsigned int frameLatency() const;
+
 	Transform transform;
+	int64_t maxFrameDuration;
+	unsigned int zslDepth;
+	bool lowLatency;
 
 protected:
 	CameraConfiguration();
 
+	virtual uint64_t internalFrameTraffic() const;
+	static uint64_t frameSize(const StreamConfiguration &cfg);
+	static bool adjustStrideAlign(StreamConfiguration *cfg);
+
 	std::vector<StreamConfiguration> config_;
 };
 
@@ -84,6 +105,7 @@ public:
 	const std::string &id() const;
 
 	Signal<Request *, FrameBuffer *> bufferCompleted;
+	Signal<Request *, FrameBuffer *, const ControlList &> partialResultAvailable;
 	Signal<Request *> requestCompleted;
 	Signal<Camera *> disconnected;
 
@@ -99,10 +121,16 @@ public:
 
 	std::unique_ptr<Request> createRequest(uint64_t cookie = 0);
 	int queueRequest(Request *request);
+	int queueRequests(Span<Request *const> requests);
+
+	int setCompletionQueue(CompletionQueue *queue);
 
 	int start(const ControlList *controls = nullptr);
 	int stop();
 
+	CameraPerformance performance() const;
+	CameraMemoryUsage memoryUsage() const;
+
 private:
 	LIBCAMERA_DISABLE_COPY(Camera)
 
@@ -117,6 +145,7 @@ private:
 	friend class FrameBufferAllocator;
 	int exportFrameBuffers(Stream *stream,
 			       std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+	void releaseFrameBuffers(std::vector<std::unique_ptr<FrameBuffer>> *buffers);
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * camera_group.h - Synchronised capture from multiple cameras
+ */
+#ifndef __LIBCAMERA_CAMERA_GROUP_H__
+#define __LIBCAMERA_CAMERA_GROUP_H__
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <libcamera/class.h>
+#include <libcamera/object.h>
+#include <libcamera/signal.h>
+
+namespace libcamera {
+
+class Camera;
+class ControlList;
+class Request;
+
+class CameraGroup : public Object, public Extensible
+{
+	LIBCAMERA_DECLARE_PRIVATE()
+
+public:
+	~CameraGroup();
+
+	const std::vector<std::shared_ptr<Camera>> &cameras() const;
+
+	void setTolerance(std::chrono::nanoseconds tolerance);
+	std::chrono::nanoseconds tolerance() const;
+
+	int start(const ControlList *controls = nullptr);
+	int stop();
+
+	Signal<const std::vector<Request *> &> requestsCompleted;
+	Signal<Request *> requestUnmatched;
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(CameraGroup)
+
+	friend class CameraManager;
+	CameraGroup(const std::vector<std::shared_ptr<Camera>> &cameras);
+
+	void requestComplete(Request *request);
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_CAMERA_GROUP_H__ */
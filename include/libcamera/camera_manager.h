@@ -7,6 +7,7 @@
 #ifndef __LIBCAMERA_CAMERA_MANAGER_H__
 #define __LIBCAMERA_CAMERA_MANAGER_H__
 
+#include <chrono>
 #include <memory>
 #include <string>
 #include <sys/types.h>
@@ -14,11 +15,13 @@
 
 #include <libcamera/class.h>
 #include <libcamera/object.h>
+#include <libcamera/performance.h>
 #include <libcamera/signal.h>
 
 namespace libcamera {
 
 class Camera;
+class CameraGroup;
 
 class CameraManager : public Object, public Extensible
 {
@@ -27,12 +30,22 @@ public:
 	CameraManager();
 	~CameraManager();
 
-	int start();
+	enum StartMode {
+		StartBlocking,
+		StartAsync,
+	};
+
+	int start(StartMode mode = StartBlocking);
 	void stop();
 
 	std::vector<std::shared_ptr<Camera>> cameras() const;
 	std::shared_ptr<Camera> get(const std::string &name);
 	std::shared_ptr<Camera> get(dev_t devnum);
+	std::shared_ptr<Camera> waitForCamera(const std::string &id,
+					      std::chrono::milliseconds timeout);
+
+	std::unique_ptr<CameraGroup>
+	createGroup(const std::vector<std::shared_ptr<Camera>> &cameras);
 
 	void addCamera(std::shared_ptr<Camera> camera,
 		       const std::vector<dev_t> &devnums);
@@ -40,6 +53,8 @@ public:
 
 	static const std::string &version() { return version_; }
 
+	CameraManagerPerformance performance() const;
+
 	Signal<std::shared_ptr<Camera>> cameraAdded;
 	Signal<std::shared_ptr<Camera>> cameraRemoved;
 
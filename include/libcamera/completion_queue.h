@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * completion_queue.h - Request completion queue
+ */
+#ifndef __LIBCAMERA_COMPLETION_QUEUE_H__
+#define __LIBCAMERA_COMPLETION_QUEUE_H__
+
+#include <libcamera/class.h>
+
+namespace libcamera {
+
+class Camera;
+class Request;
+
+class CompletionQueue : public Extensible
+{
+	LIBCAMERA_DECLARE_PRIVATE()
+
+public:
+	CompletionQueue();
+	~CompletionQueue();
+
+	bool isValid() const;
+	int fd() const;
+
+	Request *pop();
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(CompletionQueue)
+
+	friend class Camera;
+	void push(Request *request);
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_COMPLETION_QUEUE_H__ */
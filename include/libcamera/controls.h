@@ -9,6 +9,7 @@
 #define __LIBCAMERA_CONTROLS_H__
 
 #include <assert.h>
+#include <memory>
 #include <stdint.h>
 #include <string>
 #include <unordered_map>
@@ -125,6 +126,8 @@ public:
 
 	ControlValue(const ControlValue &other);
 	ControlValue &operator=(const ControlValue &other);
+	ControlValue(ControlValue &&other) noexcept;
+	ControlValue &operator=(ControlValue &&other) noexcept;
 
 	ControlType type() const { return type_; }
 	bool isNone() const { return type_ == ControlTypeNone; }
@@ -199,7 +202,7 @@ private:
 	bool isArray_;
 	std::size_t numElements_ : 32;
 	union {
-		uint64_t value_;
+		alignas(uint64_t) uint8_t value_[40];
 		void *storage_;
 	};
 
@@ -298,12 +301,12 @@ private:
 
 using ControlIdMap = std::unordered_map<unsigned int, const ControlId *>;
 
-class ControlInfoMap : private std::unordered_map<const ControlId *, ControlInfo>
+class ControlInfoMap
 {
 public:
 	using Map = std::unordered_map<const ControlId *, ControlInfo>;
 
-	ControlInfoMap() = default;
+	ControlInfoMap();
 	ControlInfoMap(const ControlInfoMap &other) = default;
 	ControlInfoMap(std::initializer_list<Map::value_type> init);
 	ControlInfoMap(Map &&info);
@@ -312,41 +315,49 @@ public:
 	ControlInfoMap &operator=(std::initializer_list<Map::value_type> init);
 	ControlInfoMap &operator=(Map &&info);
 
-	using Map::key_type;
-	using Map::mapped_type;
-	using Map::value_type;
-	using Map::size_type;
-	using Map::iterator;
-	using Map::const_iterator;
-
-	using Map::begin;
-	using Map::cbegin;
-	using Map::end;
-	using Map::cend;
-	using Map::at;
-	using Map::empty;
-	using Map::size;
-	using Map::count;
-	using Map::find;
-
-	mapped_type &at(unsigned int key);
+	using key_type = Map::key_type;
+	using mapped_type = Map::mapped_type;
+	using value_type = Map::value_type;
+	using size_type = Map::size_type;
+	using iterator = Map::const_iterator;
+	using const_iterator = Map::const_iterator;
+
+	const_iterator begin() const { return data_->map.begin(); }
+	const_iterator cbegin() const { return data_->map.cbegin(); }
+	const_iterator end() const { return data_->map.end(); }
+	const_iterator cend() const { return data_->map.cend(); }
+
+	bool empty() const { return data_->map.empty(); }
+	size_type size() const { return data_->map.size(); }
+
+	const mapped_type &at(const key_type &key) const { return data_->map.at(key); }
+	size_type count(const key_type &key) const { return data_->map.count(key); }
+	const_iterator find(const key_type &key) const { return data_->map.find(key); }
+
 	const mapped_type &at(unsigned int key) const;
 	size_type count(unsigned int key) const;
-	iterator find(unsigned int key);
 	const_iterator find(unsigned int key) const;
 
-	const ControlIdMap &idmap() const { return idmap_; }
+	const ControlIdMap &idmap() const { return data_->idmap; }
 
 private:
-	void generateIdmap();
+	friend class ControlSerializer; /* Needed to cache maps by identity. */
+
+	struct Data {
+		Map map;
+		ControlIdMap idmap;
+		std::vector<Map::const_iterator> index;
+	};
+
+	static std::shared_ptr<const Data> createData(Map &&entries);
 
-	ControlIdMap idmap_;
+	std::shared_ptr<const Data> data_;
 };
 
 class ControlList
 {
 private:
-	using ControlListMap = std::unordered_map<unsigned int, ControlValue>;
+	using ControlListMap = std::vector<std::pair<unsigned int, ControlValue>>;
 
 public:
 	ControlList();
@@ -408,6 +419,8 @@ public:
 private:
 	const ControlValue *find(unsigned int id) const;
 	ControlValue *find(unsigned int id);
+	ControlListMap::const_iterator lowerBound(unsigned int id) const;
+	ControlListMap::iterator lowerBound(unsigned int id);
 
 	ControlValidator *validator_;
 	const ControlIdMap *idmap_;
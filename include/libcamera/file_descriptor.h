@@ -27,17 +27,26 @@ public:
 	int fd() const { return fd_ ? fd_->fd() : -1; }
 	FileDescriptor dup() const;
 
+	static FileDescriptor borrow(int fd);
+
 private:
 	class Descriptor
 	{
 	public:
-		Descriptor(int fd, bool duplicate);
+		enum Mode {
+			Duplicate,
+			Adopt,
+			Borrow,
+		};
+
+		Descriptor(int fd, Mode mode);
 		~Descriptor();
 
 		int fd() const { return fd_; }
 
 	private:
 		int fd_;
+		bool owned_;
 	};
 
 	std::shared_ptr<Descriptor> fd_;
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * bayer_unpack.h - Unpacking of raw Bayer lines
+ */
+#ifndef __LIBCAMERA_INTERNAL_BAYER_UNPACK_H__
+#define __LIBCAMERA_INTERNAL_BAYER_UNPACK_H__
+
+#include <stdint.h>
+
+namespace libcamera {
+
+class BayerFormat;
+
+namespace bayer {
+
+using UnpackFunction = void (*)(uint16_t *dst, const uint8_t *src,
+				unsigned int width);
+
+void unpackRaw8(uint16_t *dst, const uint8_t *src, unsigned int width);
+void unpackRaw16(uint16_t *dst, const uint8_t *src, unsigned int width);
+void unpackCSI2P10(uint16_t *dst, const uint8_t *src, unsigned int width);
+void unpackCSI2P12(uint16_t *dst, const uint8_t *src, unsigned int width);
+void unpackCSI2P14(uint16_t *dst, const uint8_t *src, unsigned int width);
+void unpackIPU3(uint16_t *dst, const uint8_t *src, unsigned int width);
+
+UnpackFunction unpackFunction(const BayerFormat &format);
+
+} /* namespace bayer */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_BAYER_UNPACK_H__ */
@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * bound_method_pool.h - Method invocation memory pool
+ */
+#ifndef __LIBCAMERA_INTERNAL_BOUND_METHOD_POOL_H__
+#define __LIBCAMERA_INTERNAL_BOUND_METHOD_POOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace libcamera {
+
+class BoundMethodPool
+{
+public:
+	static void *allocate(size_t size);
+	static void deallocate(void *ptr) noexcept;
+};
+
+struct BoundMethodPoolStatistics {
+	uint64_t allocations;
+	uint64_t heapAllocations;
+	uint64_t outstanding;
+	uint64_t peakOutstanding;
+
+	static BoundMethodPoolStatistics current();
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_BOUND_METHOD_POOL_H__ */
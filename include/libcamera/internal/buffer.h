@@ -7,20 +7,72 @@
 #ifndef __LIBCAMERA_INTERNAL_BUFFER_H__
 #define __LIBCAMERA_INTERNAL_BUFFER_H__
 
+#include <list>
+#include <memory>
 #include <sys/mman.h>
+#include <sys/types.h>
+#include <tuple>
 #include <vector>
 
 #include <libcamera/class.h>
 #include <libcamera/buffer.h>
+#include <libcamera/file_descriptor.h>
 #include <libcamera/span.h>
 
 namespace libcamera {
 
+class FrameBuffer::Private : public Extensible::Private
+{
+	LIBCAMERA_DECLARE_PUBLIC(FrameBuffer)
+
+public:
+	Private(FrameBuffer *buffer);
+
+	FrameMetadata &metadata() { return metadata_; }
+
+	const FileDescriptor &fence() const { return fence_; }
+	void setFence(const FileDescriptor &fence) { fence_ = fence; }
+
+private:
+	FrameMetadata metadata_;
+	FileDescriptor fence_;
+};
+
+#ifndef __DOXYGEN__
+inline FrameBuffer::Private *FrameBuffer::_d()
+{
+	return Extensible::_d<Private>();
+}
+
+inline const FrameBuffer::Private *FrameBuffer::_d() const
+{
+	return Extensible::_d<Private>();
+}
+#endif
+
 class MappedBuffer
 {
 public:
 	using Plane = Span<uint8_t>;
 
+	class CpuAccess
+	{
+	public:
+		CpuAccess(const MappedBuffer *buffer, int flags);
+		~CpuAccess();
+
+		int error() const { return error_; }
+
+	private:
+		LIBCAMERA_DISABLE_COPY_AND_MOVE(CpuAccess)
+
+		int sync(uint64_t flags);
+
+		const MappedBuffer *buffer_;
+		uint64_t flags_;
+		int error_;
+	};
+
 	~MappedBuffer();
 
 	MappedBuffer(MappedBuffer &&other);
@@ -29,12 +81,15 @@ public:
 	bool isValid() const { return error_ == 0; }
 	int error() const { return error_; }
 	const std::vector<Plane> &maps() const { return maps_; }
+	size_t pageSize(unsigned int plane) const;
 
 protected:
 	MappedBuffer();
 
 	int error_;
 	std::vector<Plane> maps_;
+	std::vector<FileDescriptor> fds_;
+	std::vector<size_t> pageSizes_;
 
 private:
 	LIBCAMERA_DISABLE_COPY(MappedBuffer)
@@ -46,6 +101,32 @@ public:
 	MappedFrameBuffer(const FrameBuffer *buffer, int flags);
 };
 
+class MappedBufferCache
+{
+public:
+	MappedBufferCache(unsigned int capacity = 8);
+
+	const MappedBuffer *map(const FrameBuffer *buffer, int flags);
+	void clear();
+
+	unsigned int capacity() const { return capacity_; }
+	std::size_t size() const { return entries_.size(); }
+
+private:
+	LIBCAMERA_DISABLE_COPY(MappedBufferCache)
+
+	using Key = std::vector<std::tuple<dev_t, ino_t, unsigned int>>;
+
+	struct Entry {
+		Key key;
+		int flags;
+		std::unique_ptr<MappedFrameBuffer> mapping;
+	};
+
+	unsigned int capacity_;
+	std::list<Entry> entries_;
+};
+
 } /* namespace libcamera */
 
 #endif /* __LIBCAMERA_INTERNAL_BUFFER_H__ */
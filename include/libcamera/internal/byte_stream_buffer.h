@@ -10,6 +10,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <type_traits>
+#include <vector>
 
 #include <libcamera/class.h>
 #include <libcamera/span.h>
@@ -21,6 +22,7 @@ class ByteStreamBuffer
 public:
 	ByteStreamBuffer(const uint8_t *base, size_t size);
 	ByteStreamBuffer(uint8_t *base, size_t size);
+	ByteStreamBuffer(std::vector<uint8_t> *storage);
 	ByteStreamBuffer(ByteStreamBuffer &&other);
 	ByteStreamBuffer &operator=(ByteStreamBuffer &&other);
 
@@ -31,6 +33,7 @@ public:
 
 	ByteStreamBuffer carveOut(size_t size);
 	int skip(size_t size);
+	void reserve(size_t size);
 
 	template<typename T>
 	int read(T *t)
@@ -69,12 +72,14 @@ private:
 	LIBCAMERA_DISABLE_COPY(ByteStreamBuffer)
 
 	void setOverflow();
+	bool grow(size_t size);
 
 	int read(uint8_t *data, size_t size);
 	const uint8_t *read(size_t size, size_t count);
 	int write(const uint8_t *data, size_t size);
 
 	ByteStreamBuffer *parent_;
+	std::vector<uint8_t> *storage_;
 
 	const uint8_t *base_;
 	size_t size_;
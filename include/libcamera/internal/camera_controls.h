@@ -12,6 +12,7 @@
 namespace libcamera {
 
 class Camera;
+class ControlInfoMap;
 
 class CameraControlValidator final : public ControlValidator
 {
@@ -23,6 +24,7 @@ public:
 
 private:
 	Camera *camera_;
+	const ControlInfoMap *controls_;
 };
 
 } /* namespace libcamera */
@@ -7,6 +7,7 @@
 #ifndef __LIBCAMERA_INTERNAL_CAMERA_SENSOR_H__
 #define __LIBCAMERA_INTERNAL_CAMERA_SENSOR_H__
 
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
@@ -25,6 +26,17 @@ namespace libcamera {
 class BayerFormat;
 class MediaEntity;
 
+struct CameraSensorMode {
+	V4L2SubdeviceFormat format;
+	Rectangle analogCrop;
+	Size binning;
+	uint64_t minFrameDuration;
+	float fieldOfView;
+
+	uint64_t frameBits() const;
+	double maxFrameRate() const;
+};
+
 class CameraSensor : protected Loggable
 {
 public:
@@ -42,13 +54,21 @@ public:
 
 	V4L2SubdeviceFormat getFormat(const std::vector<unsigned int> &mbusCodes,
 				      const Size &size) const;
+	const std::vector<CameraSensorMode> &modes() const { return modes_; }
+	const CameraSensorMode *findMode(const std::vector<unsigned int> &mbusCodes,
+					 const Size &size, double frameRate = 0.0,
+					 float fieldOfView = 0.0f) const;
 	int setFormat(V4L2SubdeviceFormat *format);
 
 	const ControlInfoMap &controls() const;
 	ControlList getControls(const std::vector<uint32_t> &ids);
 	int setControls(ControlList *ctrls);
 
+	const std::vector<ControlValue> &syncModes() const { return syncModes_; }
+	int setSyncMode(int32_t mode);
+
 	V4L2Subdevice *device() { return subdev_.get(); }
+	V4L2Subdevice *focusLens() { return focusLens_.get(); }
 
 	const ControlList &properties() const { return properties_; }
 	int sensorInfo(IPACameraSensorInfo *info) const;
@@ -66,9 +86,12 @@ private:
 	void initVimcDefaultProperties();
 	void initStaticProperties();
 	int initProperties();
+	void initFocusLens();
+	void initModes();
 
 	const MediaEntity *entity_;
 	std::unique_ptr<V4L2Subdevice> subdev_;
+	std::unique_ptr<V4L2Subdevice> focusLens_;
 	unsigned int pad_;
 
 	std::string model_;
@@ -77,12 +100,17 @@ private:
 	V4L2Subdevice::Formats formats_;
 	std::vector<unsigned int> mbusCodes_;
 	std::vector<Size> sizes_;
+	std::vector<CameraSensorMode> modes_;
 
 	Size pixelArraySize_;
 	Rectangle activeArea_;
 	const BayerFormat *bayerFormat_;
 
 	ControlList properties_;
+
+	uint32_t syncControl_;
+	std::map<int32_t, int32_t> syncValues_;
+	std::vector<ControlValue> syncModes_;
 };
 
 } /* namespace libcamera */
@@ -7,6 +7,8 @@
 #ifndef __LIBCAMERA_SENSOR_CAMERA_SENSOR_PROPERTIES_H__
 #define __LIBCAMERA_SENSOR_CAMERA_SENSOR_PROPERTIES_H__
 
+#include <map>
+#include <stdint.h>
 #include <string>
 
 #include <libcamera/geometry.h>
@@ -17,6 +19,8 @@ struct CameraSensorProperties {
 	static const CameraSensorProperties *get(const std::string &sensor);
 
 	Size unitCellSize;
+	uint32_t syncControl;
+	std::map<int32_t, int32_t> syncModes;
 };
 
 } /* namespace libcamera */
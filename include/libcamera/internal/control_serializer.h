@@ -9,6 +9,7 @@
 
 #include <map>
 #include <memory>
+#include <utility>
 #include <vector>
 
 #include <libcamera/controls.h>
@@ -35,7 +36,14 @@ public:
 
 	bool isCached(const ControlInfoMap &infoMap);
 
+	bool failed() const { return failed_; }
+
 private:
+	struct ListState {
+		ControlList list;
+		uint32_t sequence = 0;
+	};
+
 	static size_t binarySize(const ControlValue &value);
 	static size_t binarySize(const ControlInfo &info);
 
@@ -47,9 +55,15 @@ private:
 	ControlInfo loadControlInfo(ControlType type, ByteStreamBuffer &buffer);
 
 	unsigned int serial_;
+	bool failed_;
 	std::vector<std::unique_ptr<ControlId>> controlIds_;
 	std::map<unsigned int, ControlInfoMap> infoMaps_;
-	std::map<const ControlInfoMap *, unsigned int> infoMapHandles_;
+	std::map<const ControlInfoMap::Data *, unsigned int> infoMapHandles_;
+	std::map<unsigned int, ControlInfoMap> handleInfoMaps_;
+
+	std::map<unsigned int, ListState> sentLists_;
+	std::map<unsigned int, ListState> receivedLists_;
+	std::vector<std::pair<unsigned int, const ControlValue *>> delta_;
 };
 
 } /* namespace libcamera */
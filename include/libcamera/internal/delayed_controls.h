@@ -7,8 +7,12 @@
 #ifndef __LIBCAMERA_INTERNAL_DELAYED_CONTROLS_H__
 #define __LIBCAMERA_INTERNAL_DELAYED_CONTROLS_H__
 
+#include <array>
 #include <stdint.h>
 #include <unordered_map>
+#include <vector>
+
+#include <linux/videodev2.h>
 
 #include <libcamera/controls.h>
 
@@ -32,22 +36,20 @@ public:
 	bool push(const ControlList &controls);
 	ControlList get(uint32_t sequence);
 
+	int setBracket(uint32_t id, const std::vector<double> &gains);
+	int bracketIndex(uint32_t sequence) const;
+
 	void applyControls(uint32_t sequence);
 
 private:
-	class Info : public ControlValue
-	{
-	public:
-		Info()
-			: updated(false)
-		{
-		}
-
-		Info(const ControlValue &v, bool updated_ = true)
-			: ControlValue(v), updated(updated_)
-		{
-		}
-
+	/*
+	 * Only integer controls are supported, store their value unboxed to
+	 * keep the per-frame bookkeeping free of ControlValue copies.
+	 */
+	struct Info {
+		int64_t value;
+		int64_t requested;
+		int bracket;
 		bool updated;
 	};
 
@@ -67,9 +69,19 @@ private:
 		}
 	};
 
+	struct Control {
+		const ControlId *id;
+		ControlParams params;
+		ControlRingBuffer values;
+	};
+
+	Control *findControl(unsigned int id);
+	ControlValue controlValue(const Control &ctrl, const Info &info) const;
+	void fillControl(struct v4l2_ext_control *v4l2Ctrl, const Control &ctrl,
+			 const Info &info) const;
+
 	V4L2Device *device_;
-	/* \todo Evaluate if we should index on ControlId * or unsigned int */
-	std::unordered_map<const ControlId *, ControlParams> controlParams_;
+	std::vector<Control> controls_;
 	unsigned int maxDelay_;
 
 	bool running_;
@@ -77,8 +89,14 @@ private:
 
 	uint32_t queueCount_;
 	uint32_t writeCount_;
-	/* \todo Evaluate if we should index on ControlId * or unsigned int */
-	std::unordered_map<const ControlId *, ControlRingBuffer> values_;
+
+	/* Preallocated storage for the controls written at frame start. */
+	std::vector<struct v4l2_ext_control> batch_;
+
+	/* Gains applied in turn to the values of the bracketed control. */
+	Control *bracketControl_;
+	std::vector<double> bracketGains_;
+	unsigned int bracketPosition_;
 };
 
 } /* namespace libcamera */
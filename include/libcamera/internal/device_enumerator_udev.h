@@ -13,8 +13,10 @@
 #include <set>
 #include <string>
 #include <sys/types.h>
+#include <vector>
 
 #include "libcamera/internal/device_enumerator.h"
+#include "libcamera/internal/timer.h"
 
 struct udev;
 struct udev_device;
@@ -54,17 +56,25 @@ private:
 		DependencyMap deps_;
 	};
 
+	void addUdevDevices(const std::vector<struct udev_device *> &devices);
 	int addUdevDevice(struct udev_device *dev);
+	int addMediaDevice(std::unique_ptr<MediaDevice> media);
 	int populateMediaDevice(MediaDevice *media, DependencyMap *deps);
 	std::string lookupDeviceNode(dev_t devnum);
 
 	int addV4L2Device(dev_t devnum);
 	void udevNotify(EventNotifier *notifier);
+	void flushHotplug();
+	void hotplugTimeout(Timer *timer);
 
 	struct udev *udev_;
 	struct udev_monitor *monitor_;
 	EventNotifier *notifier_;
 
+	Timer hotplugTimer_;
+	std::vector<struct udev_device *> hotplugDevices_;
+	bool added_;
+
 	std::set<dev_t> orphans_;
 	std::list<MediaDeviceDeps> pending_;
 	std::map<dev_t, MediaDeviceDeps *> devMap_;
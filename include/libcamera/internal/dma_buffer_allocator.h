@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * dma_buffer_allocator.h - Frame buffer allocator based on dma-heaps
+ */
+#ifndef __LIBCAMERA_INTERNAL_DMA_BUFFER_ALLOCATOR_H__
+#define __LIBCAMERA_INTERNAL_DMA_BUFFER_ALLOCATOR_H__
+
+#include <map>
+#include <memory>
+#include <stddef.h>
+#include <sys/types.h>
+#include <vector>
+
+#include <libcamera/class.h>
+#include <libcamera/file_descriptor.h>
+
+#include "libcamera/internal/dma_heaps.h"
+
+namespace libcamera {
+
+class FrameBuffer;
+
+class DmaBufferAllocator
+{
+public:
+	explicit DmaBufferAllocator(unsigned int heapTypes = DmaHeap::Contiguous | DmaHeap::System);
+
+	bool isValid() const { return heap_.isValid(); }
+
+	int exportBuffers(unsigned int count,
+			  const std::vector<unsigned int> &planeSizes,
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+	void recycle(std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+	void clear();
+
+	size_t pooled() const { return pool_.size(); }
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(DmaBufferAllocator)
+
+	FileDescriptor get(size_t size);
+
+	DmaHeap heap_;
+
+	std::multimap<size_t, FileDescriptor> pool_;
+	std::map<ino_t, size_t> allocations_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_DMA_BUFFER_ALLOCATOR_H__ */
@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Raspberry Pi (Trading) Limited
+ *
+ * dma_heaps.h - Helper class for dma-heap allocations.
+ */
+#ifndef __LIBCAMERA_INTERNAL_DMA_HEAPS_H__
+#define __LIBCAMERA_INTERNAL_DMA_HEAPS_H__
+
+#include <stddef.h>
+
+#include <libcamera/class.h>
+#include <libcamera/file_descriptor.h>
+
+namespace libcamera {
+
+class DmaHeap
+{
+public:
+	enum Type {
+		Contiguous = 1 << 0,
+		System = 1 << 1,
+		Memfd = 1 << 2,
+	};
+
+	explicit DmaHeap(unsigned int types = Contiguous | System);
+	~DmaHeap();
+
+	bool isValid() const { return dmaHeapHandle_ > -1 || type_ == Memfd; }
+	Type type() const { return type_; }
+
+	FileDescriptor alloc(const char *name, std::size_t size);
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(DmaHeap)
+
+	FileDescriptor allocMemfd(const char *name, std::size_t size);
+
+	int dmaHeapHandle_;
+	Type type_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_DMA_HEAPS_H__ */
@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * event_dispatcher_epoll.h - Epoll-based event dispatcher
+ */
+#ifndef __LIBCAMERA_INTERNAL_EVENT_DISPATCHER_EPOLL_H__
+#define __LIBCAMERA_INTERNAL_EVENT_DISPATCHER_EPOLL_H__
+
+#include <map>
+#include <stdint.h>
+
+#include "libcamera/internal/event_dispatcher.h"
+#include "libcamera/internal/timer_queue.h"
+
+struct epoll_event;
+
+namespace libcamera {
+
+class EventNotifier;
+class Timer;
+
+class EventDispatcherEpoll final : public EventDispatcher
+{
+public:
+	EventDispatcherEpoll();
+	~EventDispatcherEpoll();
+
+	void registerEventNotifier(EventNotifier *notifier);
+	void unregisterEventNotifier(EventNotifier *notifier);
+
+	void registerTimer(Timer *timer);
+	void unregisterTimer(Timer *timer);
+
+	void processEvents();
+	void interrupt();
+
+private:
+	struct EventNotifierSetEpoll {
+		uint32_t events() const;
+		EventNotifier *notifiers[3];
+	};
+
+	int wait(struct epoll_event *events, int maxEvents);
+	int update(int fd, uint32_t oldEvents, uint32_t newEvents);
+	void processInterrupt();
+	void processNotifier(const struct epoll_event &event);
+	void processTimers();
+
+	std::map<int, EventNotifierSetEpoll> notifiers_;
+	TimerQueue timers_;
+	int epollfd_;
+	int eventfd_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_EVENT_DISPATCHER_EPOLL_H__ */
@@ -7,11 +7,11 @@
 #ifndef __LIBCAMERA_INTERNAL_EVENT_DISPATCHER_POLL_H__
 #define __LIBCAMERA_INTERNAL_EVENT_DISPATCHER_POLL_H__
 
-#include <list>
 #include <map>
 #include <vector>
 
 #include "libcamera/internal/event_dispatcher.h"
+#include "libcamera/internal/timer_queue.h"
 
 struct pollfd;
 
@@ -47,7 +47,7 @@ private:
 	void processTimers();
 
 	std::map<int, EventNotifierSetPoll> notifiers_;
-	std::list<Timer *> timers_;
+	TimerQueue timers_;
 	int eventfd_;
 
 	bool processingEvents_;
@@ -22,6 +22,8 @@ public:
 	enum MapFlag {
 		MapNoOption = 0,
 		MapPrivate = (1 << 0),
+		MapPopulate = (1 << 1),
+		MapWillNeed = (1 << 2),
 	};
 
 	enum OpenMode {
@@ -59,6 +59,12 @@ T readPOD(std::vector<uint8_t> &vec, size_t pos)
 	return readPOD<T>(vec.cbegin(), pos, vec.end());
 }
 
+template<typename T>
+constexpr bool isPackedType()
+{
+	return std::is_arithmetic_v<T> && !std::is_same_v<T, bool>;
+}
+
 } /* namespace */
 
 template<typename T>
@@ -87,7 +93,12 @@ public:
 #ifndef __DOXYGEN__
 
 /*
- * Serialization format for vector of type V:
+ * Serialization format for vector of arithmetic type V, except bool:
+ *
+ * 4 bytes - uint32_t Length of vector, in number of elements
+ * X bytes - Elements, packed in host order
+ *
+ * Serialization format for vector of any other type V:
  *
  * 4 bytes - uint32_t Length of vector, in number of elements
  *
@@ -113,6 +124,16 @@ public:
 		uint32_t vecLen = data.size();
 		appendPOD<uint32_t>(dataVec, vecLen);
 
+		/* Serialize arrays of arithmetic types in one go. */
+		if constexpr (isPackedType<V>()) {
+			size_t size = vecLen * sizeof(V);
+			dataVec.resize(dataVec.size() + size);
+			if (size)
+				memcpy(&*(dataVec.end() - size), data.data(), size);
+
+			return { dataVec, fdsVec };
+		}
+
 		/* Serialize the members. */
 		for (auto const &it : data) {
 			std::vector<uint8_t> dvec;
@@ -156,6 +177,24 @@ public:
 					  [[maybe_unused]] std::vector<int32_t>::const_iterator fdsEnd,
 					  ControlSerializer *cs = nullptr)
 	{
+		if constexpr (isPackedType<V>()) {
+			uint32_t arrayLen = readPOD<uint32_t>(dataBegin, 0, dataEnd);
+			size_t size = static_cast<size_t>(arrayLen) * sizeof(V);
+
+			if (static_cast<size_t>(dataEnd - dataBegin) < sizeof(uint32_t) + size) {
+				LOG(IPADataSerializer, Error)
+					<< "Failed to deserialize vector: buffer overflow";
+				return {};
+			}
+
+			/* The serialized elements may not be aligned, copy them. */
+			std::vector<V> ret(arrayLen);
+			if (size)
+				memcpy(ret.data(), &*(dataBegin + sizeof(uint32_t)), size);
+
+			return ret;
+		}
+
 		uint32_t vecLen = readPOD<uint32_t>(dataBegin, 0, dataEnd);
 		std::vector<V> ret(vecLen);
 
@@ -7,7 +7,12 @@
 #ifndef __LIBCAMERA_INTERNAL_IPA_MANAGER_H__
 #define __LIBCAMERA_INTERNAL_IPA_MANAGER_H__
 
+#include <map>
+#include <memory>
 #include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <utility>
 #include <vector>
 
 #include <libcamera/ipa/ipa_interface.h>
@@ -22,6 +27,8 @@ namespace libcamera {
 
 LOG_DECLARE_CATEGORY(IPAManager)
 
+class IPCPipeRing;
+
 class IPAManager
 {
 public:
@@ -33,15 +40,7 @@ public:
 					    uint32_t maxVersion,
 					    uint32_t minVersion)
 	{
-		IPAModule *m = nullptr;
-
-		for (IPAModule *module : self_->modules_) {
-			if (module->match(pipe, minVersion, maxVersion)) {
-				m = module;
-				break;
-			}
-		}
-
+		IPAModule *m = self_->module(pipe, minVersion, maxVersion);
 		if (!m)
 			return nullptr;
 
@@ -54,18 +53,42 @@ public:
 		return proxy;
 	}
 
+	static std::unique_ptr<IPCPipeRing> createWorker(const IPAModule *ipam,
+							 const std::string &workerPath);
+
 private:
 	static IPAManager *self_;
 
 	void parseDir(const char *libDir, unsigned int maxDepth,
 		      std::vector<std::string> &files);
 	unsigned int addDir(const char *libDir, unsigned int maxDepth = 0);
+	void discover();
 
-	bool isSignatureValid(IPAModule *ipa) const;
+	IPAModule *module(PipelineHandler *pipe, uint32_t minVersion,
+			  uint32_t maxVersion);
 
+	bool isSignatureValid(IPAModule *ipa);
+
+	bool discovered_;
+	std::vector<std::string> files_;
+	unsigned int filesLoaded_;
 	std::vector<IPAModule *> modules_;
 
+	std::map<std::pair<std::string, std::string>,
+		 std::unique_ptr<IPCPipeRing>> workers_;
+
 #if HAVE_IPA_PUBKEY
+	struct VerifiedModule {
+		dev_t dev;
+		ino_t ino;
+		off_t size;
+		struct timespec mtime;
+		std::vector<uint8_t> signature;
+		bool valid;
+	};
+
+	std::map<std::string, VerifiedModule> verifiedModules_;
+
 	static const uint8_t publicKeyData_[];
 	static const PubKey pubKey_;
 #endif
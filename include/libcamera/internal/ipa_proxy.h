@@ -39,7 +39,6 @@ protected:
 	bool valid_;
 	ProxyState state_;
 
-private:
 	IPAModule *ipam_;
 };
 
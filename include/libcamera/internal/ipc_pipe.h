@@ -27,6 +27,7 @@ public:
 	IPCMessage(uint32_t cmd);
 	IPCMessage(const Header &header);
 	IPCMessage(const IPCUnixSocket::Payload &payload);
+	IPCMessage(IPCUnixSocket::Payload &&payload);
 
 	IPCUnixSocket::Payload payload() const;
 
@@ -59,6 +60,7 @@ public:
 	virtual int sendAsync(const IPCMessage &data) = 0;
 
 	Signal<const IPCMessage &> recv;
+	Signal<> disconnected;
 
 protected:
 	bool connected_;
@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipc_pipe_process.h - Image Processing Algorithm IPC module for proxy workers
+ */
+#ifndef __LIBCAMERA_INTERNAL_IPA_IPC_PROCESS_H__
+#define __LIBCAMERA_INTERNAL_IPA_IPC_PROCESS_H__
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "libcamera/internal/ipc_pipe.h"
+#include "libcamera/internal/process.h"
+
+namespace libcamera {
+
+template<typename Transport>
+class IPCPipeProcess : public IPCPipe
+{
+public:
+	~IPCPipeProcess();
+
+	int sendSync(const IPCMessage &in,
+		     IPCMessage *out = nullptr) override;
+
+	int sendAsync(const IPCMessage &data) override;
+
+protected:
+	using Payload = typename Transport::Payload;
+
+	IPCPipeProcess();
+
+	void start(const char *ipaModulePath, const char *ipaProxyWorkerPath,
+		   const std::vector<int> &fds);
+	void disconnect();
+
+	std::unique_ptr<Process> proc_;
+	std::unique_ptr<Transport> transport_;
+
+private:
+	struct CallData {
+		Payload *response;
+		bool done;
+	};
+
+	void processFinished(Process *process, enum Process::ExitStatus exitStatus,
+			     int exitCode);
+	void readyRead(Transport *transport);
+	int call(const Payload &message, Payload *response, uint32_t seq);
+
+	std::map<uint32_t, CallData> callData_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_IPA_IPC_PROCESS_H__ */
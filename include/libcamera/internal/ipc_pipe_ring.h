@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipc_pipe_ring.h - Image Processing Algorithm IPC module using shared memory rings
+ */
+#ifndef __LIBCAMERA_INTERNAL_IPA_IPC_RING_H__
+#define __LIBCAMERA_INTERNAL_IPA_IPC_RING_H__
+
+#include "libcamera/internal/ipc_pipe_process.h"
+#include "libcamera/internal/ipc_ring.h"
+
+namespace libcamera {
+
+class IPCPipeRing : public IPCPipeProcess<IPCRing>
+{
+public:
+	IPCPipeRing(const char *ipaModulePath, const char *ipaProxyWorkerPath);
+
+private:
+	void ringDisconnected(IPCRing *ring);
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_IPA_IPC_RING_H__ */
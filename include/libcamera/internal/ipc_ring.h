@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipc_ring.h - IPC mechanism based on shared memory rings
+ */
+
+#ifndef __LIBCAMERA_INTERNAL_IPC_RING_H__
+#define __LIBCAMERA_INTERNAL_IPC_RING_H__
+
+#include <deque>
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+
+#include <libcamera/signal.h>
+
+#include "libcamera/internal/ipc_unixsocket.h"
+
+namespace libcamera {
+
+class EventNotifier;
+
+class IPCRing
+{
+public:
+	using Payload = IPCUnixSocket::Payload;
+
+	static constexpr size_t RingSize = 256 * 1024;
+
+	IPCRing();
+	~IPCRing();
+
+	std::vector<int> create();
+	int bind(const std::vector<int> &fds);
+	void close();
+	bool isBound() const;
+
+	int send(const Payload &payload);
+	int receive(Payload *payload);
+
+	Signal<IPCRing *> readyRead;
+	Signal<IPCRing *> disconnected;
+
+private:
+	struct Control;
+	struct Record;
+
+	int map(int memfd, unsigned int txIndex);
+
+	int waitForSpace(size_t size);
+
+	int peek(Record *record);
+	void consume(const Record &record);
+	void advanceTail(size_t size);
+	void dispatch();
+	void drop(const char *reason);
+
+	void doorbellNotifier(EventNotifier *notifier);
+	void socketReadyRead(IPCUnixSocket *socket);
+
+	IPCUnixSocket socket_;
+	std::deque<Payload> socketPayloads_;
+
+	int memfd_;
+	void *mem_;
+
+	Control *tx_;
+	uint8_t *txData_;
+	Control *rx_;
+	uint8_t *rxData_;
+
+	uint32_t txHead_;
+	uint32_t rxHead_;
+	uint32_t rxTail_;
+
+	int txDoorbell_;
+	int rxDoorbell_;
+	EventNotifier *notifier_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_IPC_RING_H__ */
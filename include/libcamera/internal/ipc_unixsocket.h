@@ -8,6 +8,7 @@
 #ifndef __LIBCAMERA_INTERNAL_IPC_UNIXSOCKET_H__
 #define __LIBCAMERA_INTERNAL_IPC_UNIXSOCKET_H__
 
+#include <deque>
 #include <stdint.h>
 #include <sys/types.h>
 #include <vector>
@@ -45,15 +46,15 @@ private:
 		uint8_t fds;
 	};
 
-	int sendData(const void *buffer, size_t length, const int32_t *fds, unsigned int num);
-	int recvData(void *buffer, size_t length, int32_t *fds, unsigned int num);
+	int sendData(const Header &header, const void *buffer,
+		     const int32_t *fds);
+	int recvData(Payload *payload);
 
 	void dataNotifier(EventNotifier *notifier);
 
 	int fd_;
-	bool headerReceived_;
-	struct Header header_;
 	EventNotifier *notifier_;
+	std::deque<Payload> payloads_;
 };
 
 } /* namespace libcamera */
@@ -8,7 +8,9 @@
 #define __LIBCAMERA_INTERNAL_LOG_H__
 
 #include <chrono>
+#include <mutex>
 #include <sstream>
+#include <string>
 
 #include <libcamera/class.h>
 
@@ -25,6 +27,13 @@ enum LogSeverity {
 	LogFatal,
 };
 
+#ifdef LIBCAMERA_LOG_MIN_SEVERITY
+static constexpr LogSeverity LogMinSeverity =
+	static_cast<LogSeverity>(LIBCAMERA_LOG_MIN_SEVERITY);
+#else
+static constexpr LogSeverity LogMinSeverity = LogDebug;
+#endif
+
 class LogCategory
 {
 public:
@@ -52,11 +61,33 @@ const LogCategory &_LOG_CATEGORY(name)()				\
 	return category;						\
 }
 
+class LogMessage;
+
+class LogRateLimit
+{
+public:
+	LogRateLimit();
+
+	bool admit(const utils::time_point &time);
+	bool filter(const LogMessage &msg, std::string *summary);
+
+private:
+	std::mutex mutex_;
+	utils::time_point windowStart_;
+	unsigned int count_;
+	unsigned int suppressed_;
+
+	std::string last_;
+	utils::time_point lastTime_;
+	unsigned int repeated_;
+};
+
 class LogMessage
 {
 public:
 	LogMessage(const char *fileName, unsigned int line,
-		   const LogCategory &category, LogSeverity severity);
+		   const LogCategory &category, LogSeverity severity,
+		   LogRateLimit *rateLimit = nullptr);
 
 	LogMessage(LogMessage &&);
 	~LogMessage();
@@ -66,7 +97,9 @@ public:
 	const utils::time_point &timestamp() const { return timestamp_; }
 	LogSeverity severity() const { return severity_; }
 	const LogCategory &category() const { return category_; }
-	const std::string &fileInfo() const { return fileInfo_; }
+	const char *fileName() const { return fileName_; }
+	unsigned int line() const { return line_; }
+	std::string fileInfo() const;
 	const std::string msg() const { return msgStream_.str(); }
 
 private:
@@ -78,7 +111,9 @@ private:
 	const LogCategory &category_;
 	LogSeverity severity_;
 	utils::time_point timestamp_;
-	std::string fileInfo_;
+	const char *fileName_;
+	unsigned int line_;
+	LogRateLimit *rateLimit_;
 };
 
 class Loggable
@@ -92,19 +127,43 @@ protected:
 	LogMessage _log(const LogCategory *category, LogSeverity severity,
 			const char *fileName = __builtin_FILE(),
 			unsigned int line = __builtin_LINE()) const;
+	LogMessage _log(const LogCategory *category, LogSeverity severity,
+			LogRateLimit *rateLimit,
+			const char *fileName = __builtin_FILE(),
+			unsigned int line = __builtin_LINE()) const;
 };
 
 LogMessage _log(const LogCategory *category, LogSeverity severity,
 		const char *fileName = __builtin_FILE(),
 		unsigned int line = __builtin_LINE());
+LogMessage _log(const LogCategory *category, LogSeverity severity,
+		LogRateLimit *rateLimit,
+		const char *fileName = __builtin_FILE(),
+		unsigned int line = __builtin_LINE());
 
 #ifndef __DOXYGEN__
+class LogVoidify
+{
+public:
+	void operator&([[maybe_unused]] std::ostream &stream) {}
+};
+
 #define _LOG_CATEGORY(name) logCategory##name
 
+/*
+ * Messages below the minimum compiled-in severity are removed at compile time,
+ * and messages below the category severity skip the stream expression. Fatal
+ * messages are always logged.
+ */
+#define _LOG_ENABLED(cat, sev) \
+	((sev) == LogFatal || ((sev) >= LogMinSeverity && (sev) >= (cat).severity()))
+
 #define _LOG1(severity) \
-	_log(nullptr, Log##severity).stream()
+	!_LOG_ENABLED(LogCategory::defaultCategory(), Log##severity) ? (void)0 : \
+	LogVoidify() & _log(nullptr, Log##severity).stream()
 #define _LOG2(category, severity) \
-	_log(&_LOG_CATEGORY(category)(), Log##severity).stream()
+	!_LOG_ENABLED(_LOG_CATEGORY(category)(), Log##severity) ? (void)0 : \
+	LogVoidify() & _log(&_LOG_CATEGORY(category)(), Log##severity).stream()
 
 /*
  * Expand the LOG() macro to _LOG1() or _LOG2() based on the number of
@@ -112,8 +171,18 @@ LogMessage _log(const LogCategory *category, LogSeverity severity,
  */
 #define _LOG_MACRO(_1, _2, NAME, ...) NAME
 #define LOG(...) _LOG_MACRO(__VA_ARGS__, _LOG2, _LOG1)(__VA_ARGS__)
+
+/* Each lambda has a distinct type, giving each call site its own state. */
+#define _LOG_RATELIMIT() \
+	([]() { static LogRateLimit rateLimit; return &rateLimit; })()
+
+#define LOG_RATELIMITED(category, severity) \
+	!_LOG_ENABLED(_LOG_CATEGORY(category)(), Log##severity) ? (void)0 : \
+	LogVoidify() & _log(&_LOG_CATEGORY(category)(), Log##severity, \
+			    _LOG_RATELIMIT()).stream()
 #else /* __DOXYGEN___ */
 #define LOG(category, severity)
+#define LOG_RATELIMITED(category, severity)
 #endif /* __DOXYGEN__ */
 
 #ifndef NDEBUG
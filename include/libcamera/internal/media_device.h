@@ -8,6 +8,7 @@
 #define __LIBCAMERA_INTERNAL_MEDIA_DEVICE_H__
 
 #include <map>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -18,6 +19,8 @@
 
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/media_object.h"
+#include "libcamera/internal/media_request.h"
+#include "libcamera/internal/media_topology_cache.h"
 
 namespace libcamera {
 
@@ -52,6 +55,12 @@ public:
 			const MediaEntity *sink, unsigned int sinkIdx);
 	MediaLink *link(const MediaPad *source, const MediaPad *sink);
 	int disableLinks();
+	int setupLinks(const std::vector<MediaLink *> &links);
+	unsigned int linkSequence() const { return linkSequence_; }
+	unsigned int formatSequence() const { return formatSequence_; }
+	void formatChanged() const { formatSequence_++; }
+
+	std::unique_ptr<MediaRequest> allocateRequest();
 
 	Signal<MediaDevice *> disconnected;
 
@@ -66,11 +75,16 @@ private:
 	bool addObject(MediaObject *object);
 	void clear();
 
+	int fetchTopology(MediaTopologyCache::Topology *topo);
+	bool refreshTopology(MediaTopologyCache::Topology *topo);
+	bool populateTopology(const MediaTopologyCache::Topology &topo);
+
 	struct media_v2_interface *findInterface(const struct media_v2_topology &topology,
 						 unsigned int entityId);
 	bool populateEntities(const struct media_v2_topology &topology);
 	bool populatePads(const struct media_v2_topology &topology);
 	bool populateLinks(const struct media_v2_topology &topology);
+	int updateLinkFlags();
 	void fixupEntityFlags(struct media_v2_entity *entity);
 
 	friend int MediaLink::setEnabled(bool enable);
@@ -86,6 +100,10 @@ private:
 	bool valid_;
 	bool acquired_;
 	bool lockOwner_;
+	bool linkFlagsValid_;
+	unsigned int linkSequence_;
+	/* Tracks the formats of the devices, not the state of the graph. */
+	mutable unsigned int formatSequence_;
 
 	std::map<unsigned int, MediaObject *> objects_;
 	std::vector<MediaEntity *> entities_;
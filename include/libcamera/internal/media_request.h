@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * media_request.h - Media Controller request
+ */
+#ifndef __LIBCAMERA_INTERNAL_MEDIA_REQUEST_H__
+#define __LIBCAMERA_INTERNAL_MEDIA_REQUEST_H__
+
+#include <libcamera/class.h>
+#include <libcamera/signal.h>
+
+namespace libcamera {
+
+class EventNotifier;
+
+class MediaRequest
+{
+public:
+	enum Status {
+		Idle,
+		Queued,
+		Complete,
+	};
+
+	explicit MediaRequest(int fd);
+	~MediaRequest();
+
+	int fd() const { return fd_; }
+	Status status() const { return status_; }
+
+	int queue();
+	int reinit();
+
+	Signal<MediaRequest *> completed;
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(MediaRequest)
+
+	void requestComplete(EventNotifier *notifier);
+
+	int fd_;
+	Status status_;
+	EventNotifier *notifier_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_MEDIA_REQUEST_H__ */
@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * media_topology_cache.h - On-disk cache of media graph topologies
+ */
+#ifndef __LIBCAMERA_INTERNAL_MEDIA_TOPOLOGY_CACHE_H__
+#define __LIBCAMERA_INTERNAL_MEDIA_TOPOLOGY_CACHE_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <linux/media.h>
+
+namespace libcamera {
+
+class MediaTopologyCache
+{
+public:
+	struct Topology {
+		uint64_t version;
+		std::vector<struct media_v2_entity> entities;
+		std::vector<struct media_v2_interface> interfaces;
+		std::vector<struct media_v2_pad> pads;
+		std::vector<struct media_v2_link> links;
+	};
+
+	MediaTopologyCache();
+	explicit MediaTopologyCache(const std::string &directory);
+
+	bool isEnabled() const { return !directory_.empty(); }
+	const std::string &directory() const { return directory_; }
+
+	int load(const std::string &key, Topology *topology) const;
+	int store(const std::string &key, const Topology &topology) const;
+
+	static std::string key(const struct media_device_info &info);
+
+private:
+	std::string path(const std::string &key) const;
+
+	std::string directory_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_MEDIA_TOPOLOGY_CACHE_H__ */
@@ -11,6 +11,8 @@
 
 #include <libcamera/bound_method.h>
 
+#include "libcamera/internal/bound_method_pool.h"
+
 namespace libcamera {
 
 class BoundMethodBase;
@@ -38,10 +40,12 @@ public:
 	static Type registerMessageType();
 
 private:
+	friend class MessageQueue;
 	friend class Thread;
 
 	Type type_;
 	Object *receiver_;
+	Message *next_;
 
 	static std::atomic_uint nextUserType_;
 };
@@ -55,6 +59,9 @@ public:
 		      bool deleteMethod = false);
 	~InvokeMessage();
 
+	static void *operator new(size_t size) { return BoundMethodPool::allocate(size); }
+	static void operator delete(void *ptr) { BoundMethodPool::deallocate(ptr); }
+
 	Semaphore *semaphore() const { return semaphore_; }
 
 	void invoke();
@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * performance.h - Performance counters recording
+ */
+#ifndef __LIBCAMERA_INTERNAL_PERFORMANCE_H__
+#define __LIBCAMERA_INTERNAL_PERFORMANCE_H__
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <stdint.h>
+#include <string>
+
+#include <libcamera/performance.h>
+
+#include "libcamera/internal/thread.h"
+#include "libcamera/internal/utils.h"
+
+namespace libcamera {
+
+class IPACallProfiler;
+
+class PerformanceRecorder
+{
+public:
+	static PerformanceRecorder *instance();
+
+	void bufferCacheAccess(bool hit)
+	{
+		if (hit)
+			bufferCacheHits_.fetch_add(1, std::memory_order_relaxed);
+		else
+			bufferCacheMisses_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void bufferMapped(int64_t size)
+	{
+		mappedBufferMemory_.fetch_add(size, std::memory_order_relaxed);
+	}
+
+	void ipcRoundTrip(uint64_t duration);
+	void ipaCall(const IPACallProfiler &call);
+
+	CameraManagerPerformance snapshot() const;
+
+private:
+	PerformanceRecorder() = default;
+
+	std::atomic<uint64_t> bufferCacheHits_{ 0 };
+	std::atomic<uint64_t> bufferCacheMisses_{ 0 };
+	std::atomic<uint64_t> mappedBufferMemory_{ 0 };
+
+	mutable Mutex mutex_;
+	PerformanceHistogram ipcRoundTrip_;
+	std::map<std::string, IPAMethodPerformance, std::less<>> ipaMethods_;
+};
+
+class IPACallProfiler
+{
+public:
+	enum Phase {
+		Serialization,
+		Transit,
+		Execution,
+	};
+
+	IPACallProfiler(const char *method, Phase phase);
+	~IPACallProfiler();
+
+	void enter(Phase phase);
+
+private:
+	friend class PerformanceRecorder;
+
+	static constexpr unsigned int kNumPhases = Execution + 1;
+
+	void update();
+
+	const char *method_;
+	Phase phase_;
+	utils::time_point last_;
+	std::array<uint64_t, kNumPhases> durations_;
+	std::array<bool, kNumPhases> entered_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_PERFORMANCE_H__ */
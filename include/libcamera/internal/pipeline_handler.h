@@ -7,6 +7,7 @@
 #ifndef __LIBCAMERA_INTERNAL_PIPELINE_HANDLER_H__
 #define __LIBCAMERA_INTERNAL_PIPELINE_HANDLER_H__
 
+#include <atomic>
 #include <list>
 #include <map>
 #include <memory>
@@ -16,11 +17,15 @@
 #include <vector>
 
 #include <libcamera/class.h>
+#include <libcamera/control_ids.h>
 #include <libcamera/controls.h>
 #include <libcamera/object.h>
+#include <libcamera/performance.h>
 #include <libcamera/stream.h>
 
 #include "libcamera/internal/ipa_proxy.h"
+#include "libcamera/internal/thread.h"
+#include "libcamera/internal/zsl_ring.h"
 
 namespace libcamera {
 
@@ -29,29 +34,60 @@ class CameraConfiguration;
 class CameraManager;
 class DeviceEnumerator;
 class DeviceMatch;
+class DmaBufferAllocator;
+class EventNotifier;
 class FrameBuffer;
 class MediaDevice;
 class PipelineHandler;
 class Request;
+class Timer;
 
 class CameraData
 {
 public:
 	explicit CameraData(PipelineHandler *pipe)
-		: pipe_(pipe), requestSequence_(0)
+		: pipe_(pipe), requestSequence_(0),
+		  frameDropReason_(controls::FrameDropPipelineLate),
+		  starved_(false), sequenceValid_(false), lastSequence_(0),
+		  internalMemory_(0), zslMemory_(0)
 	{
 	}
 	virtual ~CameraData() = default;
 
+	void accountInternalBuffer(const FrameBuffer *buffer);
+	void clearInternalBuffers();
+
 	PipelineHandler *pipe_;
 	std::list<Request *> queuedRequests_;
 	ControlInfoMap controlInfo_;
 	ControlList properties_;
 
 	uint32_t requestSequence_;
+	int32_t frameDropReason_;
 
 private:
 	LIBCAMERA_DISABLE_COPY(CameraData)
+
+	friend class PipelineHandler;
+
+	struct WaitingRequest {
+		Request *request;
+		std::vector<EventNotifier *> notifiers;
+		Timer *timer;
+		unsigned int pendingFences;
+		bool failed;
+	};
+
+	std::list<WaitingRequest> waitingRequests_;
+
+	bool starved_;
+	bool sequenceValid_;
+	uint32_t lastSequence_;
+
+	ZslRing zslRing_;
+
+	std::atomic<uint64_t> internalMemory_;
+	std::atomic<uint64_t> zslMemory_;
 };
 
 class PipelineHandler : public std::enable_shared_from_this<PipelineHandler>,
@@ -68,21 +104,32 @@ public:
 	bool lock();
 	void unlock();
 
+	virtual void releaseDevice(Camera *camera);
+
+	bool enterStandby(Camera *camera);
+	bool resumeStandby(Camera *camera);
+
 	const ControlInfoMap &controls(const Camera *camera) const;
 	const ControlList &properties(const Camera *camera) const;
+	CameraMemoryUsage memoryUsage(const Camera *camera) const;
 
 	virtual CameraConfiguration *generateConfiguration(Camera *camera,
 		const StreamRoles &roles) = 0;
 	virtual int configure(Camera *camera, CameraConfiguration *config) = 0;
+	int configureZsl(Camera *camera, const CameraConfiguration *config);
+	void releaseZsl(Camera *camera);
 
 	virtual int exportFrameBuffers(Camera *camera, Stream *stream,
 				       std::vector<std::unique_ptr<FrameBuffer>> *buffers) = 0;
+	void releaseFrameBuffers(std::vector<std::unique_ptr<FrameBuffer>> *buffers);
 
 	virtual int start(Camera *camera, const ControlList *controls) = 0;
 	virtual void stop(Camera *camera) = 0;
 	bool hasPendingRequests(const Camera *camera) const;
 
 	void queueRequest(Request *request);
+	void queueRequests(const std::vector<Request *> &requests);
+	void cancelWaitingRequests(Camera *camera);
 
 	bool completeBuffer(Request *request, FrameBuffer *buffer);
 	void completeRequest(Request *request);
@@ -99,16 +146,40 @@ protected:
 	CameraData *cameraData(const Camera *camera);
 	const CameraData *cameraData(const Camera *camera) const;
 
+	int allocateFrameBuffers(unsigned int count,
+				 const std::vector<unsigned int> &planeSizes,
+				 std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+
 	CameraManager *manager_;
 
 private:
 	void mediaDeviceDisconnected(MediaDevice *media);
 	virtual void disconnect();
 
+	void doQueueRequest(Request *request);
+	void doQueueRequests(CameraData *data);
+	void cancelRequest(Request *request);
+	void fenceSignalled(EventNotifier *notifier);
+	void fenceTimeout(Timer *timer);
+	void releaseWaitingRequest(CameraData::WaitingRequest &waiting,
+				   bool deferred);
+	void reportFrameDrop(CameraData *data, Request *request);
+	void reportTimestamps(Request *request);
+	void endStandby();
+	void standbyTimeout(Timer *timer);
+
 	std::vector<std::shared_ptr<MediaDevice>> mediaDevices_;
 	std::vector<std::weak_ptr<Camera>> cameras_;
 	std::map<const Camera *, std::unique_ptr<CameraData>> cameraData_;
 
+	Mutex allocatorLock_;
+	std::unique_ptr<DmaBufferAllocator> allocator_;
+	bool locked_;
+
+	bool standby_;
+	std::weak_ptr<Camera> standbyCamera_;
+	std::unique_ptr<Timer> standbyTimer_;
+
 	const char *name_;
 
 	friend class PipelineHandlerFactory;
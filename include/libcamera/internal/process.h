@@ -16,6 +16,7 @@
 namespace libcamera {
 
 class EventNotifier;
+class Thread;
 
 class Process final
 {
@@ -60,6 +61,7 @@ public:
 	~ProcessManager();
 
 	void registerProcess(Process *proc);
+	void moveToThread(Thread *thread);
 
 	static ProcessManager *instance();
 
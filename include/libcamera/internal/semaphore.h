@@ -7,9 +7,7 @@
 #ifndef __LIBCAMERA_INTERNAL_SEMAPHORE_H__
 #define __LIBCAMERA_INTERNAL_SEMAPHORE_H__
 
-#include <condition_variable>
-
-#include "libcamera/internal/thread.h"
+#include <atomic>
 
 namespace libcamera {
 
@@ -24,9 +22,8 @@ public:
 	void release(unsigned int n = 1);
 
 private:
-	Mutex mutex_;
-	std::condition_variable cv_;
-	unsigned int available_;
+	std::atomic<unsigned int> available_;
+	std::atomic<unsigned int> waiters_;
 };
 
 } /* namespace libcamera */
@@ -9,8 +9,10 @@
 
 #include <memory>
 #include <mutex>
+#include <string>
 #include <sys/types.h>
 #include <thread>
+#include <vector>
 
 #include <libcamera/signal.h>
 
@@ -40,6 +42,12 @@ public:
 
 	bool isRunning();
 
+	void setName(const std::string &name);
+	const std::string &name() const;
+
+	int setAffinity(const std::vector<unsigned int> &cpus);
+	int setRealtimePriority(int priority);
+
 	Signal<Thread *> finished;
 
 	static Thread *current();
@@ -56,8 +64,10 @@ protected:
 private:
 	void startThread();
 	void finishThread();
+	void applyPolicy();
 
 	void postMessage(std::unique_ptr<Message> msg, Object *receiver);
+	void postDeferredDelete(Object *object);
 	void removeMessages(Object *receiver);
 
 	friend class Object;
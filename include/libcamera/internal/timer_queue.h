@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * timer_queue.h - Deadline-ordered queue of timers
+ */
+#ifndef __LIBCAMERA_INTERNAL_TIMER_QUEUE_H__
+#define __LIBCAMERA_INTERNAL_TIMER_QUEUE_H__
+
+#include <chrono>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+namespace libcamera {
+
+class Timer;
+
+class TimerQueue
+{
+public:
+	TimerQueue();
+
+	void insert(Timer *timer);
+	void remove(Timer *timer);
+
+	Timer *next();
+	void pop();
+
+	std::size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+
+private:
+	struct Entry {
+		std::chrono::steady_clock::time_point deadline;
+		uint64_t sequence;
+		Timer *timer;
+
+		bool operator>(const Entry &other) const
+		{
+			return deadline > other.deadline ||
+			       (deadline == other.deadline && sequence > other.sequence);
+		}
+	};
+
+	bool isLive(const Entry &entry) const;
+	void compact();
+
+	std::vector<Entry> heap_;
+	std::unordered_map<Timer *, uint64_t> sequences_;
+	uint64_t sequence_;
+	std::size_t size_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_TIMER_QUEUE_H__ */
@@ -71,6 +71,7 @@ using time_point = std::chrono::steady_clock::time_point;
 
 struct timespec duration_to_timespec(const duration &value);
 std::string time_point_to_string(const time_point &time);
+uint64_t boottime();
 
 #ifndef __DOXYGEN__
 struct _hex {
@@ -22,6 +22,7 @@
 namespace libcamera {
 
 class EventNotifier;
+class MediaRequest;
 
 class V4L2Device : protected Loggable
 {
@@ -32,7 +33,9 @@ public:
 	const ControlInfoMap &controls() const { return controls_; }
 
 	ControlList getControls(const std::vector<uint32_t> &ids);
-	int setControls(ControlList *ctrls);
+	int setControls(ControlList *ctrls, MediaRequest *request = nullptr);
+	int setControls(Span<struct v4l2_ext_control> v4l2Ctrls,
+			MediaRequest *request = nullptr);
 
 	const struct v4l2_query_ext_ctrl *controlInfo(uint32_t id) const;
 
@@ -54,9 +57,11 @@ protected:
 	int ioctl(unsigned long request, void *argp);
 
 	int fd() const { return fd_; }
+	unsigned int layoutSequence() const { return layoutSequence_; }
 
 private:
 	void listControls();
+	Span<v4l2_ext_control> prepareControls(std::size_t count);
 	void updateControls(ControlList *ctrls,
 			    Span<const v4l2_ext_control> v4l2Ctrls);
 
@@ -65,8 +70,10 @@ private:
 	std::map<unsigned int, struct v4l2_query_ext_ctrl> controlInfo_;
 	std::vector<std::unique_ptr<ControlId>> controlIds_;
 	ControlInfoMap controls_;
+	std::vector<v4l2_ext_control> v4l2Ctrls_;
 	std::string deviceNode_;
 	int fd_;
+	unsigned int layoutSequence_;
 
 	EventNotifier *fdEventNotifier_;
 	bool frameStartEnabled_;
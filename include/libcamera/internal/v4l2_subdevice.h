@@ -7,6 +7,7 @@
 #ifndef __LIBCAMERA_INTERNAL_V4L2_SUBDEVICE_H__
 #define __LIBCAMERA_INTERNAL_V4L2_SUBDEVICE_H__
 
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
@@ -74,6 +75,16 @@ private:
 					    unsigned int code);
 
 	const MediaEntity *entity_;
+
+	std::map<unsigned int, Formats> formats_;
+	unsigned int formatsLinkSequence_;
+	unsigned int formatsFormatSequence_;
+	unsigned int formatsLayoutSequence_;
+
+	/* Requested and applied active formats, indexed by pad. */
+	std::map<unsigned int, std::pair<V4L2SubdeviceFormat, V4L2SubdeviceFormat>> activeFormats_;
+	unsigned int activeLinkSequence_;
+	unsigned int activeLayoutSequence_;
 };
 
 } /* namespace libcamera */
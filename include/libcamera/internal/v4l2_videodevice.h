@@ -12,6 +12,7 @@
 #include <memory>
 #include <stdint.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <linux/videodev2.h>
@@ -33,6 +34,7 @@ class EventNotifier;
 class FileDescriptor;
 class MediaDevice;
 class MediaEntity;
+class MediaRequest;
 
 struct V4L2Capability final : v4l2_capability {
 	const char *driver() const
@@ -120,6 +122,9 @@ public:
 	int get(const FrameBuffer &buffer);
 	void put(unsigned int index);
 
+	unsigned int hits() const { return hitCounter_; }
+	unsigned int misses() const { return missCounter_; }
+
 private:
 	class Entry
 	{
@@ -129,6 +134,8 @@ private:
 
 		bool operator==(const FrameBuffer &buffer) const;
 
+		int key() const { return planes_.empty() ? -1 : planes_[0].fd; }
+
 		bool free_;
 		uint64_t lastUsed_;
 
@@ -146,9 +153,14 @@ private:
 		std::vector<Plane> planes_;
 	};
 
+	static int key(const FrameBuffer &buffer);
+
+	void update(unsigned int index, const FrameBuffer &buffer);
+
 	std::atomic<uint64_t> lastUsedCounter_;
 	std::vector<Entry> cache_;
-	/* \todo Expose the miss counter through an instrumentation API. */
+	std::unordered_map<int, unsigned int> index_;
+	unsigned int hitCounter_;
 	unsigned int missCounter_;
 };
 
@@ -166,6 +178,7 @@ public:
 	std::array<Plane, 3> planes;
 	unsigned int planesCount = 0;
 
+	void alignStride(unsigned int align);
 	const std::string toString() const;
 };
 
@@ -202,8 +215,11 @@ public:
 	int importBuffers(unsigned int count);
 	int releaseBuffers();
 
-	int queueBuffer(FrameBuffer *buffer);
+	void setCpuAccess(bool cpuAccess);
+
+	int queueBuffer(FrameBuffer *buffer, MediaRequest *request = nullptr);
 	Signal<FrameBuffer *> bufferReady;
+	Signal<> bufferBatchReady;
 
 	int streamOn();
 	int streamOff();
@@ -241,6 +257,12 @@ private:
 	FrameBuffer *dequeueBuffer();
 
 	V4L2Capability caps_;
+	const MediaDevice *media_;
+
+	std::map<uint32_t, Formats> formats_;
+	unsigned int formatsLinkSequence_;
+	unsigned int formatsFormatSequence_;
+	unsigned int formatsLayoutSequence_;
 
 	enum v4l2_buf_type bufferType_;
 	enum v4l2_memory memoryType_;
@@ -248,6 +270,9 @@ private:
 	V4L2BufferCache *cache_;
 	std::map<unsigned int, FrameBuffer *> queuedBuffers_;
 
+	bool cpuAccess_;
+	bool cacheHints_;
+
 	EventNotifier *fdBufferNotifier_;
 
 	bool streaming_;
@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * zsl_ring.h - Ring of recently captured frames for zero shutter lag capture
+ */
+#ifndef __LIBCAMERA_INTERNAL_ZSL_RING_H__
+#define __LIBCAMERA_INTERNAL_ZSL_RING_H__
+
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/buffer.h>
+#include <libcamera/class.h>
+#include <libcamera/controls.h>
+
+#include "libcamera/internal/buffer.h"
+
+namespace libcamera {
+
+class Request;
+class Stream;
+
+class ZslRing
+{
+public:
+	ZslRing();
+	~ZslRing();
+
+	void configure(unsigned int depth);
+	int addStream(const Stream *stream,
+		      std::vector<std::unique_ptr<FrameBuffer>> &&buffers);
+	std::vector<std::unique_ptr<FrameBuffer>> release();
+
+	unsigned int depth() const { return slots_.size(); }
+
+	void store(Request *request);
+	bool claim(Request *request, int64_t timestamp);
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(ZslRing)
+
+	struct Frame {
+		std::unique_ptr<FrameBuffer> buffer;
+		std::unique_ptr<MappedFrameBuffer> map;
+		FrameMetadata metadata;
+		std::vector<size_t> lengths;
+		bool valid;
+	};
+
+	struct Slot {
+		int64_t timestamp;
+		ControlList metadata;
+		std::map<const Stream *, Frame> frames;
+	};
+
+	bool storeFrame(Frame *frame, const FrameBuffer *buffer);
+	bool loadFrame(const Frame &frame, FrameBuffer *buffer);
+
+	std::vector<Slot> slots_;
+	unsigned int next_;
+
+	MappedBufferCache cache_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_INTERNAL_ZSL_RING_H__ */
@@ -13,7 +13,9 @@
 extern "C" {
 #endif
 
-#define IPA_CONTROLS_FORMAT_VERSION	1
+#define IPA_CONTROLS_FORMAT_VERSION	2
+
+#define IPA_CONTROLS_FLAG_DELTA		(1 << 0)
 
 struct ipa_controls_header {
 	uint32_t version;
@@ -21,7 +23,9 @@ struct ipa_controls_header {
 	uint32_t entries;
 	uint32_t size;
 	uint32_t data_offset;
-	uint32_t reserved[3];
+	uint32_t flags;
+	uint32_t sequence;
+	uint32_t reserved[1];
 };
 
 struct ipa_control_value_entry {
@@ -35,6 +35,7 @@ static const ControlInfoMap Controls = {
 	{ &controls::AeConstraintMode, ControlInfo(controls::AeConstraintModeValues) },
 	{ &controls::AeExposureMode, ControlInfo(controls::AeExposureModeValues) },
 	{ &controls::ExposureValue, ControlInfo(0.0f, 16.0f) },
+	{ &controls::ExposureBracket, ControlInfo(-8.0f, 8.0f) },
 	{ &controls::AwbEnable, ControlInfo(false, true) },
 	{ &controls::ColourGains, ControlInfo(0.0f, 32.0f) },
 	{ &controls::AwbMode, ControlInfo(controls::AwbModeValues) },
@@ -45,7 +46,12 @@ static const ControlInfoMap Controls = {
 	{ &controls::ColourCorrectionMatrix, ControlInfo(-16.0f, 16.0f) },
 	{ &controls::ScalerCrop, ControlInfo(Rectangle{}, Rectangle(65535, 65535, 65535, 65535), Rectangle{}) },
 	{ &controls::FrameDurationLimits, ControlInfo(INT64_C(1000), INT64_C(1000000000)) },
+	{ &controls::AdaptiveFrameRate, ControlInfo(false, true) },
+	{ &controls::AdaptiveFrameRateBoost, ControlInfo(false, true) },
+	{ &controls::AlgorithmRates, ControlInfo(0, 1024) },
+	{ &controls::StatisticsEnable, ControlInfo(false, true) },
 	{ &controls::draft::NoiseReductionMode, ControlInfo(controls::draft::NoiseReductionModeValues) },
+	{ &controls::draft::AfTrigger, ControlInfo(controls::draft::AfTriggerValues) },
 };
 
 } /* namespace RPi */
@@ -7,6 +7,8 @@
 #ifndef __LIBCAMERA_LOGGING_H__
 #define __LIBCAMERA_LOGGING_H__
 
+#include <stdint.h>
+
 namespace libcamera {
 
 enum LoggingTarget {
@@ -14,13 +16,24 @@ enum LoggingTarget {
 	LoggingTargetSyslog,
 	LoggingTargetFile,
 	LoggingTargetStream,
+	LoggingTargetBinaryFile,
+};
+
+enum LoggingDropPolicy {
+	LoggingDropNone,
+	LoggingDropNewest,
+	LoggingDropBelowWarning,
 };
 
 int logSetFile(const char *path);
+int logSetBinaryFile(const char *path);
 int logSetStream(std::ostream *stream);
 int logSetTarget(LoggingTarget target);
 void logSetLevel(const char *category, const char *level);
 
+int logSetAsync(bool enable, LoggingDropPolicy policy = LoggingDropNewest);
+uint64_t logDroppedMessages();
+
 } /* namespace libcamera */
 
 #endif /* __LIBCAMERA_LOGGING_H__ */
@@ -0,0 +1,88 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * performance.h - Performance counters
+ */
+#ifndef __LIBCAMERA_PERFORMANCE_H__
+#define __LIBCAMERA_PERFORMANCE_H__
+
+#include <array>
+#include <map>
+#include <stdint.h>
+#include <string>
+
+namespace libcamera {
+
+class PerformanceHistogram
+{
+public:
+	static constexpr unsigned int kWindowSize = 256;
+
+	PerformanceHistogram();
+
+	void add(uint64_t value);
+	void reset();
+
+	uint64_t count() const { return count_; }
+	uint64_t min() const;
+	uint64_t max() const;
+	uint64_t mean() const;
+	uint64_t percentile(unsigned int percent) const;
+
+	std::string toString() const;
+
+private:
+	unsigned int size() const;
+
+	std::array<uint64_t, kWindowSize> samples_;
+	uint64_t count_;
+};
+
+struct CameraPerformance {
+	PerformanceHistogram frameInterval;
+	PerformanceHistogram requestLatency;
+	uint64_t requestsCompleted = 0;
+	uint64_t requestsCancelled = 0;
+	uint64_t framesDropped = 0;
+	uint64_t framesDroppedNoRequest = 0;
+	uint64_t framesDroppedLate = 0;
+
+	std::string toString() const;
+};
+
+struct CameraMemoryUsage {
+	uint64_t applicationBuffers = 0;
+	uint64_t internalBuffers = 0;
+	uint64_t zslBuffers = 0;
+
+	uint64_t total() const
+	{
+		return applicationBuffers + internalBuffers + zslBuffers;
+	}
+
+	std::string toString() const;
+};
+
+struct IPAMethodPerformance {
+	uint64_t calls = 0;
+	PerformanceHistogram serialization;
+	PerformanceHistogram transit;
+	PerformanceHistogram execution;
+
+	std::string toString() const;
+};
+
+struct CameraManagerPerformance {
+	PerformanceHistogram ipcRoundTrip;
+	std::map<std::string, IPAMethodPerformance> ipaMethods;
+	uint64_t bufferCacheHits = 0;
+	uint64_t bufferCacheMisses = 0;
+	uint64_t mappedBufferMemory = 0;
+
+	std::string toString() const;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_PERFORMANCE_H__ */
@@ -7,14 +7,16 @@
 #ifndef __LIBCAMERA_REQUEST_H__
 #define __LIBCAMERA_REQUEST_H__
 
-#include <map>
+#include <chrono>
 #include <memory>
 #include <stdint.h>
 #include <string>
-#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include <libcamera/class.h>
 #include <libcamera/controls.h>
+#include <libcamera/file_descriptor.h>
 #include <libcamera/signal.h>
 
 namespace libcamera {
@@ -38,7 +40,31 @@ public:
 		ReuseBuffers = (1 << 0),
 	};
 
-	using BufferMap = std::map<const Stream *, FrameBuffer *>;
+	class BufferMap
+	{
+	public:
+		using value_type = std::pair<const Stream *, FrameBuffer *>;
+		using const_iterator = std::vector<value_type>::const_iterator;
+
+		const_iterator begin() const { return entries_.begin(); }
+		const_iterator end() const { return entries_.end(); }
+
+		bool empty() const { return entries_.empty(); }
+		std::size_t size() const { return entries_.size(); }
+
+		const_iterator find(const Stream *stream) const;
+		std::size_t count(const Stream *stream) const;
+		FrameBuffer *at(const Stream *stream) const;
+
+	private:
+		friend class Request;
+
+		void reserve(std::size_t size) { entries_.reserve(size); }
+		void clear() { entries_.clear(); }
+		void insert(const Stream *stream, FrameBuffer *buffer);
+
+		std::vector<value_type> entries_;
+	};
 
 	Request(Camera *camera, uint64_t cookie = 0);
 	~Request();
@@ -48,7 +74,8 @@ public:
 	ControlList &controls() { return *controls_; }
 	ControlList &metadata() { return *metadata_; }
 	const BufferMap &buffers() const { return bufferMap_; }
-	int addBuffer(const Stream *stream, FrameBuffer *buffer);
+	int addBuffer(const Stream *stream, FrameBuffer *buffer,
+		      const FileDescriptor &fence = FileDescriptor());
 	FrameBuffer *findBuffer(const Stream *stream) const;
 
 	uint32_t sequence() const { return sequence_; }
@@ -62,6 +89,8 @@ public:
 private:
 	LIBCAMERA_DISABLE_COPY(Request)
 
+	friend class Camera;
+	friend class CameraGroup;
 	friend class PipelineHandler;
 
 	void complete();
@@ -73,9 +102,10 @@ private:
 	ControlList *controls_;
 	ControlList *metadata_;
 	BufferMap bufferMap_;
-	std::unordered_set<FrameBuffer *> pending_;
+	std::vector<FrameBuffer *> pending_;
 
 	uint32_t sequence_;
+	std::chrono::steady_clock::time_point queueTime_;
 	const uint64_t cookie_;
 	Status status_;
 	bool cancelled_;
@@ -7,6 +7,7 @@
 #ifndef __LIBCAMERA_STREAM_H__
 #define __LIBCAMERA_STREAM_H__
 
+#include <functional>
 #include <map>
 #include <memory>
 #include <string>
@@ -24,8 +25,11 @@ class Stream;
 class StreamFormats
 {
 public:
+	using FormatsMap = std::map<PixelFormat, std::vector<SizeRange>>;
+
 	StreamFormats();
-	StreamFormats(const std::map<PixelFormat, std::vector<SizeRange>> &formats);
+	StreamFormats(const FormatsMap &formats);
+	StreamFormats(std::function<FormatsMap()> generator);
 
 	std::vector<PixelFormat> pixelformats() const;
 	std::vector<Size> sizes(const PixelFormat &pixelformat) const;
@@ -33,7 +37,11 @@ public:
 	SizeRange range(const PixelFormat &pixelformat) const;
 
 private:
-	std::map<PixelFormat, std::vector<SizeRange>> formats_;
+	struct Data;
+
+	const FormatsMap &formats() const;
+
+	std::shared_ptr<Data> data_;
 };
 
 struct StreamConfiguration {
@@ -42,7 +50,9 @@ struct StreamConfiguration {
 
 	PixelFormat pixelFormat;
 	Size size;
+	Rectangle crop;
 	unsigned int stride;
+	unsigned int strideAlign;
 	unsigned int frameSize;
 
 	unsigned int bufferCount;
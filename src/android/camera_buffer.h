@@ -27,6 +27,9 @@ public:
 	libcamera::Span<const uint8_t> plane(unsigned int plane) const;
 	libcamera::Span<uint8_t> plane(unsigned int plane);
 
+	int fd(unsigned int plane) const;
+	unsigned int stride(unsigned int plane) const;
+
 	size_t jpegBufferSize(size_t maxJpegBufferSize) const;
 };
 
@@ -58,6 +61,16 @@ Span<uint8_t> CameraBuffer::plane(unsigned int plane)			\
 	Private *const d = LIBCAMERA_D_PTR();				\
 	return d->plane(plane);						\
 }									\
+int CameraBuffer::fd(unsigned int plane) const				\
+{									\
+	const Private *const d = LIBCAMERA_D_PTR();			\
+	return d->fd(plane);						\
+}									\
+unsigned int CameraBuffer::stride(unsigned int plane) const		\
+{									\
+	const Private *const d = LIBCAMERA_D_PTR();			\
+	return d->stride(plane);					\
+}									\
 size_t CameraBuffer::jpegBufferSize(size_t maxJpegBufferSize) const	\
 {									\
 	const Private *const d = LIBCAMERA_D_PTR();			\
@@ -13,11 +13,15 @@
 #include <array>
 #include <cmath>
 #include <fstream>
+#include <set>
+#include <sstream>
+#include <stdio.h>
 #include <sys/mman.h>
 #include <tuple>
 #include <unistd.h>
 #include <vector>
 
+#include <libcamera/camera_manager.h>
 #include <libcamera/control_ids.h>
 #include <libcamera/controls.h>
 #include <libcamera/formats.h>
@@ -35,6 +39,51 @@ LOG_DECLARE_CATEGORY(HAL)
 
 namespace {
 
+/*
+ * Number of post-processing worker threads. Post-processors of different
+ * streams run concurrently, while each stream processes its frames in order.
+ */
+constexpr unsigned int kNumPostProcessors = 2;
+
+/*
+ * Directory storing the stream configurations cache, unless overridden by the
+ * LIBCAMERA_HAL_CACHE_DIR environment variable.
+ */
+constexpr const char *kStreamConfigurationsCacheDir = "/var/cache/camera";
+
+/*
+ * Initial capacity of the result metadata containers. The fixed result
+ * metadata currently holds 40 entries and 156 bytes, with room reserved for
+ * the JPEG metadata set by the post-processor:
+ * ANDROID_JPEG_GPS_COORDINATES (double x 3) = 24 bytes
+ * ANDROID_JPEG_GPS_PROCESSING_METHOD (byte x 32) = 32 bytes
+ * ANDROID_JPEG_GPS_TIMESTAMP (int64) = 8 bytes
+ * ANDROID_JPEG_SIZE (int32_t) = 4 bytes
+ * ANDROID_JPEG_QUALITY (byte) = 1 byte
+ * ANDROID_JPEG_ORIENTATION (int32_t) = 4 bytes
+ * ANDROID_JPEG_THUMBNAIL_QUALITY (byte) = 1 byte
+ * ANDROID_JPEG_THUMBNAIL_SIZE (int32 x 2) = 8 bytes
+ * Total bytes for JPEG metadata: 82
+ *
+ * The metadata pools grow the capacity to the usage observed at runtime, so
+ * the values only need to be a reasonable first guess.
+ */
+constexpr size_t kResultEntryCapacity = 44;
+constexpr size_t kResultDataCapacity = 166;
+
+/* Initial capacity of the request settings containers. */
+constexpr size_t kSettingsEntryCapacity = 64;
+constexpr size_t kSettingsDataCapacity = 512;
+
+/*
+ * Frame rates probed for the constrained high speed video mode, up to a
+ * 1920x1080 resolution. The camera service submits high speed requests in
+ * batches, at the rate of kHighSpeedBatchRate batches per second.
+ */
+constexpr int32_t kHighSpeedFrameRates[] = { 120, 240 };
+constexpr int32_t kHighSpeedBatchRate = 30;
+const Size kHighSpeedMaxSize{ 1920, 1080 };
+
 /*
  * \var camera3Resolutions
  * \brief The list of image resolutions defined as mandatory to be supported by
@@ -361,33 +410,35 @@ bool validateCropRotate(const camera3_stream_configuration_t &streamList)
  *
  * A utility structure that groups information about a capture request to be
  * later re-used at request complete time to notify the framework.
+ *
+ * Descriptors are preallocated in a ring when streams are configured, along
+ * with their CaptureRequest, and reused for every capture request.
  */
 
-CameraDevice::Camera3RequestDescriptor::Camera3RequestDescriptor(
-	Camera *camera, const camera3_capture_request_t *camera3Request)
+void CameraDevice::Camera3RequestDescriptor::reset(
+	const camera3_capture_request_t *camera3Request)
 {
 	frameNumber_ = camera3Request->frame_number;
 
 	/* Copy the camera3 request stream information for later access. */
 	const uint32_t numBuffers = camera3Request->num_output_buffers;
-	buffers_.resize(numBuffers);
-	for (uint32_t i = 0; i < numBuffers; i++)
-		buffers_[i] = camera3Request->output_buffers[i];
+	buffers_.assign(camera3Request->output_buffers,
+			camera3Request->output_buffers + numBuffers);
 
 	/*
 	 * FrameBuffer instances created by wrapping a camera3 provided dmabuf
 	 * are emplaced in this vector of unique_ptr<> for lifetime management.
 	 */
+	frameBuffers_.clear();
 	frameBuffers_.reserve(numBuffers);
+	internalBuffers_.clear();
 
-	/* Clone the controls associated with the camera3 request. */
-	settings_ = CameraMetadata(camera3Request->settings);
+	request_->reuse();
 
-	/*
-	 * Create the CaptureRequest, stored as a unique_ptr<> to tie its
-	 * lifetime to the descriptor.
-	 */
-	request_ = std::make_unique<CaptureRequest>(camera);
+	status_ = CAMERA3_BUFFER_STATUS_OK;
+	sources_.clear();
+	bufferStates_.clear();
+	metadataSent_ = false;
 }
 
 /*
@@ -405,7 +456,10 @@ CameraDevice::Camera3RequestDescriptor::Camera3RequestDescriptor(
 
 CameraDevice::CameraDevice(unsigned int id, std::shared_ptr<Camera> camera)
 	: id_(id), running_(false), camera_(std::move(camera)),
-	  facing_(CAMERA_FACING_FRONT), orientation_(0)
+	  postProcessors_(kNumPostProcessors),
+	  settingsPool_(kSettingsEntryCapacity, kSettingsDataCapacity),
+	  resultMetadataPool_(kResultEntryCapacity, kResultDataCapacity),
+	  facing_(CAMERA_FACING_FRONT), orientation_(0), batchSize_(1)
 {
 	camera_->requestCompleted.connect(this, &CameraDevice::requestComplete);
 
@@ -530,6 +584,8 @@ int CameraDevice::initialize(const CameraConfigData *cameraConfigData)
 	}
 
 	ret = initializeStreamConfigurations();
+	if (!ret)
+		initializeHighSpeedConfigurations();
 	camera_->release();
 	return ret;
 }
@@ -597,6 +653,17 @@ int CameraDevice::initializeStreamConfigurations()
 	const Size maxRes = cfg.size;
 	LOG(HAL, Debug) << "Maximum supported resolution: " << maxRes.toString();
 
+	/*
+	 * Probing the supported formats and resolutions requires validating
+	 * many configurations. Reuse the results of a previous run if the
+	 * camera hasn't changed.
+	 */
+	const std::string cacheKey = streamConfigurationsKey(cfg);
+	if (!loadStreamConfigurations(cacheKey)) {
+		LOG(HAL, Debug) << "Loaded stream configurations from cache";
+		return 0;
+	}
+
 	/*
 	 * Build the list of supported image resolutions.
 	 *
@@ -757,9 +824,210 @@ int CameraDevice::initializeStreamConfigurations()
 		LOG(HAL, Debug) << "{ " << entry.resolution.toString() << " - "
 				<< utils::hex(entry.androidFormat) << " }";
 
+	saveStreamConfigurations(cacheKey);
+
+	return 0;
+}
+
+/*
+ * Collect the resolutions at which the camera can capture video at high frame
+ * rates, for the constrained high speed video mode. Pipeline handlers select
+ * the sensor mode according to the maximum frame duration of the
+ * configuration, and validate() raises it when no sensor mode can reach the
+ * requested frame rate at the requested resolution.
+ */
+void CameraDevice::initializeHighSpeedConfigurations()
+{
+	const ControlInfoMap &controlsInfo = camera_->controls();
+	const auto frameDurationsInfo = controlsInfo.find(&controls::FrameDurationLimits);
+	if (frameDurationsInfo == controlsInfo.end())
+		return;
+
+	const int64_t minFrameDuration =
+		frameDurationsInfo->second.min().get<int64_t>();
+
+	std::unique_ptr<CameraConfiguration> cameraConfig =
+		camera_->generateConfiguration({ StreamRole::VideoRecording });
+	if (!cameraConfig)
+		return;
+
+	StreamConfiguration &cfg = cameraConfig->at(0);
+	const PixelFormat pixelFormat =
+		toPixelFormat(HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED);
+
+	for (const Camera3StreamConfiguration &entry : streamConfigurations_) {
+		const Size &res = entry.resolution;
+		if (entry.androidFormat != HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED ||
+		    res.width > kHighSpeedMaxSize.width ||
+		    res.height > kHighSpeedMaxSize.height)
+			continue;
+
+		int32_t maxFps = 0;
+		for (int32_t fps : kHighSpeedFrameRates) {
+			const int64_t frameDuration = 1000000 / fps;
+			if (frameDuration < minFrameDuration)
+				break;
+
+			cfg.pixelFormat = pixelFormat;
+			cfg.size = res;
+			cameraConfig->maxFrameDuration = frameDuration;
+
+			CameraConfiguration::Status status = cameraConfig->validate();
+			if (status == CameraConfiguration::Invalid ||
+			    cfg.size != res ||
+			    cameraConfig->maxFrameDuration != frameDuration)
+				break;
+
+			maxFps = fps;
+		}
+
+		if (!maxFps)
+			continue;
+
+		LOG(HAL, Debug) << "High speed video supported at "
+				<< res.toString() << " up to " << maxFps << " fps";
+
+		highSpeedConfigurations_.push_back({ res, maxFps });
+	}
+}
+
+/*
+ * Build the key identifying the stream configurations of the camera in the
+ * cache. The key covers the libcamera version, the camera ID, and the formats
+ * and sizes reported by the pipeline handler for still capture, to invalidate
+ * the cache when any of them changes.
+ */
+std::string CameraDevice::streamConfigurationsKey(const StreamConfiguration &cfg) const
+{
+	std::stringstream key;
+	key << CameraManager::version() << " " << camera_->id() << " "
+	    << cfg.size.toString();
+
+	const StreamFormats &formats = cfg.formats();
+	for (const PixelFormat &pixelFormat : formats.pixelformats()) {
+		key << " " << pixelFormat.toString() << ":"
+		    << formats.range(pixelFormat).toString();
+
+		for (const Size &size : formats.sizes(pixelFormat))
+			key << "," << size.toString();
+	}
+
+	return key.str();
+}
+
+std::string CameraDevice::streamConfigurationsCachePath() const
+{
+	const char *dir = utils::secure_getenv("LIBCAMERA_HAL_CACHE_DIR");
+	std::string path = dir ? dir : kStreamConfigurationsCacheDir;
+
+	/* Camera IDs may contain characters not valid in file names. */
+	std::string name = camera_->id();
+	std::replace_if(name.begin(), name.end(),
+			[](char c) { return !isalnum(c) && c != '-' && c != '.'; },
+			'_');
+
+	return path + "/libcamera-streams-" + name;
+}
+
+/*
+ * Load the format map and stream configurations from the cache file, if it
+ * has been stored with the same \a key.
+ */
+int CameraDevice::loadStreamConfigurations(const std::string &key)
+{
+	std::ifstream file(streamConfigurationsCachePath());
+	if (!file.is_open())
+		return -ENOENT;
+
+	std::string line;
+	if (!std::getline(file, line) || line != key)
+		return -EINVAL;
+
+	std::map<int, PixelFormat> formatsMap;
+	std::vector<Camera3StreamConfiguration> streamConfigurations;
+	unsigned int maxJpegBufferSize = 0;
+
+	while (std::getline(file, line)) {
+		std::istringstream entry(line);
+		std::string type;
+		int androidFormat;
+
+		entry >> type;
+
+		if (type == "format") {
+			uint32_t fourcc;
+			uint64_t modifier;
+
+			entry >> androidFormat >> fourcc >> modifier;
+			formatsMap[androidFormat] = PixelFormat(fourcc, modifier);
+		} else if (type == "stream") {
+			Size resolution;
+
+			entry >> androidFormat >> resolution.width >> resolution.height;
+			streamConfigurations.push_back({ resolution, androidFormat });
+		} else if (type == "jpeg") {
+			entry >> maxJpegBufferSize;
+		} else {
+			return -EINVAL;
+		}
+
+		if (entry.fail())
+			return -EINVAL;
+	}
+
+	if (formatsMap.empty() || streamConfigurations.empty())
+		return -EINVAL;
+
+	formatsMap_ = std::move(formatsMap);
+	streamConfigurations_ = std::move(streamConfigurations);
+	maxJpegBufferSize_ = maxJpegBufferSize;
+
 	return 0;
 }
 
+/*
+ * Store the format map and stream configurations in the cache file. The file
+ * is written to a temporary location and renamed, to never expose a partial
+ * cache to concurrent readers. Failures are not fatal, the configurations
+ * will be probed again on the next run.
+ */
+void CameraDevice::saveStreamConfigurations(const std::string &key) const
+{
+	const std::string path = streamConfigurationsCachePath();
+	const std::string tmpPath = path + ".tmp";
+
+	{
+		std::ofstream file(tmpPath, std::ios::trunc);
+		if (!file.is_open()) {
+			LOG(HAL, Debug) << "Can't create cache file " << tmpPath;
+			return;
+		}
+
+		file << key << "\n";
+
+		for (const auto &[androidFormat, pixelFormat] : formatsMap_)
+			file << "format " << androidFormat << " "
+			     << pixelFormat.fourcc() << " "
+			     << pixelFormat.modifier() << "\n";
+
+		for (const auto &entry : streamConfigurations_)
+			file << "stream " << entry.androidFormat << " "
+			     << entry.resolution.width << " "
+			     << entry.resolution.height << "\n";
+
+		file << "jpeg " << maxJpegBufferSize_ << "\n";
+
+		if (!file.good()) {
+			LOG(HAL, Debug) << "Failed to write cache file " << tmpPath;
+			unlink(tmpPath.c_str());
+			return;
+		}
+	}
+
+	if (rename(tmpPath.c_str(), path.c_str()) < 0)
+		unlink(tmpPath.c_str());
+}
+
 /*
  * Open a camera device. The static information on the camera shall have been
  * initialized with a call to CameraDevice::initialize().
@@ -790,10 +1058,10 @@ int CameraDevice::open(const hw_module_t *hardwareModule)
 
 void CameraDevice::close()
 {
-	streams_.clear();
-
 	stop();
 
+	streams_.clear();
+
 	camera_->release();
 }
 
@@ -802,10 +1070,30 @@ void CameraDevice::stop()
 	if (!running_)
 		return;
 
+	/*
+	 * Queue the requests of an incomplete batch, for them to be cancelled
+	 * and completed like all other pending requests.
+	 */
+	if (!batch_.empty()) {
+		worker_.queueRequests(batch_);
+		batch_.clear();
+	}
+
 	worker_.stop();
 	camera_->stop();
 
-	descriptors_.clear();
+	/*
+	 * Wait for post-processing to complete, all results have then been
+	 * returned to the framework.
+	 */
+	postProcessors_.flush();
+
+	for (Camera3RequestDescriptor &descriptor : descriptors_) {
+		if (descriptor.active_)
+			releaseDescriptor(descriptor);
+	}
+
+	results_.clear();
 	running_ = false;
 }
 
@@ -1290,6 +1578,32 @@ const camera_metadata_t *CameraDevice::getStaticMetadata()
 		}
 	}
 
+	/*
+	 * Report the constrained high speed video configurations, with a
+	 * variable frame rate range for preview and a fixed one for recording
+	 * at each resolution. The batch size matches the number of requests
+	 * the camera service submits together.
+	 */
+	if (!highSpeedConfigurations_.empty()) {
+		std::vector<int32_t> highSpeedVideoConfigurations;
+		highSpeedVideoConfigurations.reserve(highSpeedConfigurations_.size() * 10);
+		for (const auto &entry : highSpeedConfigurations_) {
+			const int32_t batchSize = entry.maxFps / kHighSpeedBatchRate;
+
+			for (int32_t minFps : { kHighSpeedBatchRate, entry.maxFps }) {
+				highSpeedVideoConfigurations.push_back(entry.resolution.width);
+				highSpeedVideoConfigurations.push_back(entry.resolution.height);
+				highSpeedVideoConfigurations.push_back(minFps);
+				highSpeedVideoConfigurations.push_back(entry.maxFps);
+				highSpeedVideoConfigurations.push_back(batchSize);
+			}
+		}
+		staticMetadata_->addEntry(ANDROID_CONTROL_AVAILABLE_HIGH_SPEED_VIDEO_CONFIGURATIONS,
+					  highSpeedVideoConfigurations);
+
+		availableCapabilities.push_back(ANDROID_REQUEST_AVAILABLE_CAPABILITIES_CONSTRAINED_HIGH_SPEED_VIDEO);
+	}
+
 	/* Number of { RAW, YUV, JPEG } supported output streams */
 	int32_t numOutStreams[] = { rawStreamAvailable, 2, 1 };
 	staticMetadata_->addEntry(ANDROID_REQUEST_MAX_NUM_OUTPUT_STREAMS,
@@ -1350,6 +1664,8 @@ const camera_metadata_t *CameraDevice::getStaticMetadata()
 		ANDROID_STATISTICS_INFO_MAX_FACE_COUNT,
 		ANDROID_SYNC_MAX_LATENCY,
 	};
+	if (!highSpeedConfigurations_.empty())
+		availableCharacteristicsKeys.push_back(ANDROID_CONTROL_AVAILABLE_HIGH_SPEED_VIDEO_CONFIGURATIONS);
 	staticMetadata_->addEntry(ANDROID_REQUEST_AVAILABLE_CHARACTERISTICS_KEYS,
 				  availableCharacteristicsKeys);
 
@@ -1648,6 +1964,43 @@ int CameraDevice::configureStreams(camera3_stream_configuration_t *stream_list)
 		return -EINVAL;
 #endif
 
+	/*
+	 * In constrained high speed mode, the configuration holds one or two
+	 * preview and video streams of the same size, captured at the highest
+	 * frame rate supported for that size.
+	 */
+	const Camera3HighSpeedConfiguration *highSpeed = nullptr;
+	batchSize_ = 1;
+
+	if (stream_list->operation_mode ==
+	    CAMERA3_STREAM_CONFIGURATION_CONSTRAINED_HIGH_SPEED_MODE) {
+		const camera3_stream_t *stream = stream_list->streams[0];
+		Size size(stream->width, stream->height);
+
+		auto it = std::find_if(highSpeedConfigurations_.begin(),
+				       highSpeedConfigurations_.end(),
+				       [&](const Camera3HighSpeedConfiguration &entry) {
+					       return entry.resolution == size;
+				       });
+		bool valid = it != highSpeedConfigurations_.end() &&
+			     stream_list->num_streams <= 2;
+
+		for (unsigned int i = 0; i < stream_list->num_streams; ++i) {
+			stream = stream_list->streams[i];
+			if (stream->format == HAL_PIXEL_FORMAT_BLOB ||
+			    Size(stream->width, stream->height) != size)
+				valid = false;
+		}
+
+		if (!valid) {
+			LOG(HAL, Error)
+				<< "Unsupported constrained high speed configuration";
+			return -EINVAL;
+		}
+
+		highSpeed = &*it;
+	}
+
 	/*
 	 * Generate an empty configuration, and construct a StreamConfiguration
 	 * for each camera3_stream to add to it.
@@ -1658,6 +2011,9 @@ int CameraDevice::configureStreams(camera3_stream_configuration_t *stream_list)
 		return -EINVAL;
 	}
 
+	if (highSpeed)
+		config_->maxFrameDuration = 1000000 / highSpeed->maxFps;
+
 	/*
 	 * Clear and remove any existing configuration from previous calls, and
 	 * ensure the required entries are available without further
@@ -1841,6 +2197,44 @@ int CameraDevice::configureStreams(camera3_stream_configuration_t *stream_list)
 		}
 	}
 
+	/*
+	 * Requests are queued to the camera in batches in constrained high
+	 * speed mode. Let the framework keep two batches in flight, one being
+	 * captured while the next one is accumulated.
+	 */
+	if (highSpeed) {
+		batchSize_ = highSpeed->maxFps / kHighSpeedBatchRate;
+
+		for (unsigned int i = 0; i < stream_list->num_streams; ++i) {
+			camera3_stream_t *stream = stream_list->streams[i];
+			stream->max_buffers = std::max(stream->max_buffers,
+						       2 * batchSize_);
+		}
+
+		LOG(HAL, Info) << "Constrained high speed mode at "
+			       << highSpeed->maxFps << " fps, batches of "
+			       << batchSize_ << " requests";
+	}
+
+	unsigned int maxRequests = 0;
+	for (unsigned int i = 0; i < stream_list->num_streams; ++i)
+		maxRequests += stream_list->streams[i]->max_buffers;
+
+	/*
+	 * Allocate the request descriptors. Every request holds at least one
+	 * buffer, the number of requests in flight is thus bounded by the
+	 * number of buffers of all streams. As results are returned in frame
+	 * number order, the frame numbers of the requests in flight are
+	 * consecutive, and can index the ring without collisions.
+	 */
+	descriptors_ = std::vector<Camera3RequestDescriptor>(std::max(maxRequests, 1u));
+	for (unsigned int i = 0; i < descriptors_.size(); ++i)
+		descriptors_[i].request_ =
+			std::make_unique<CaptureRequest>(camera_.get(), i);
+
+	results_.clear();
+	results_.reserve(descriptors_.size());
+
 	return 0;
 }
 
@@ -1876,7 +2270,7 @@ FrameBuffer *CameraDevice::createFrameBuffer(const buffer_handle_t camera3buffer
 
 int CameraDevice::processControls(Camera3RequestDescriptor *descriptor)
 {
-	const CameraMetadata &settings = descriptor->settings_;
+	const CameraMetadata &settings = *descriptor->settings_;
 	if (!settings.isValid())
 		return 0;
 
@@ -1891,6 +2285,20 @@ int CameraDevice::processControls(Camera3RequestDescriptor *descriptor)
 		controls.set(controls::ScalerCrop, cropRegion);
 	}
 
+	/*
+	 * \todo Translate the AE target frame rate range in normal mode too.
+	 * It's only needed in constrained high speed mode for now, to switch
+	 * between the preview and recording frame rates.
+	 */
+	if (batchSize_ > 1 &&
+	    settings.getEntry(ANDROID_CONTROL_AE_TARGET_FPS_RANGE, &entry)) {
+		const int32_t *data = entry.data.i32;
+		ControlList &controls = descriptor->request_->controls();
+		controls.set(controls::FrameDurationLimits,
+			     { static_cast<int64_t>(1000000 / data[1]),
+			       static_cast<int64_t>(1000000 / data[0]) });
+	}
+
 	return 0;
 }
 
@@ -1913,24 +2321,44 @@ int CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Reques
 	}
 
 	/*
-	 * Save the request descriptors for use at completion time.
-	 * The descriptor and the associated memory reserved here are freed
-	 * at request complete time.
+	 * Save the request descriptors for use at completion time. The
+	 * descriptor is released once the capture result has been returned to
+	 * the framework.
 	 */
-	Camera3RequestDescriptor descriptor(camera_.get(), camera3Request);
+	if (descriptors_.empty()) {
+		LOG(HAL, Error) << "Streams not configured";
+		return -EINVAL;
+	}
+
+	Camera3RequestDescriptor &descriptor =
+		descriptors_[camera3Request->frame_number % descriptors_.size()];
+	if (descriptor.active_.load(std::memory_order_acquire)) {
+		LOG(HAL, Error) << "Too many requests in flight";
+		return -EBUSY;
+	}
+
+	descriptor.reset(camera3Request);
+	descriptor.active_ = true;
 
 	/*
 	 * \todo The Android request model is incremental, settings passed in
 	 * previous requests are to be effective until overridden explicitly in
 	 * a new request. Do we need to cache settings incrementally here, or is
 	 * it handled by the Android camera service ?
+	 *
+	 * In constrained high speed mode the settings of the first request of
+	 * a batch apply to the whole batch.
 	 */
-	if (camera3Request->settings)
-		lastSettings_ = camera3Request->settings;
-	else
-		descriptor.settings_ = lastSettings_;
+	if (camera3Request->settings && batch_.empty()) {
+		lastSettings_.clear();
+		lastSettings_.append(camera3Request->settings);
+	}
+
+	/* Copy the settings to a container reused across requests. */
+	descriptor.settings_ = settingsPool_.acquire();
+	descriptor.settings_->append(lastSettings_.get());
 
-	LOG(HAL, Debug) << "Queueing request " << descriptor.request_->cookie()
+	LOG(HAL, Debug) << "Queueing request " << descriptor.frameNumber_
 			<< " with " << descriptor.buffers_.size() << " streams";
 	for (unsigned int i = 0; i < descriptor.buffers_.size(); ++i) {
 		const camera3_stream_buffer_t &camera3Buffer = descriptor.buffers_[i];
@@ -1965,6 +2393,11 @@ int CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Reques
 			 * associate it with the Camera3RequestDescriptor for
 			 * lifetime management only.
 			 */
+			if (!cameraStream->isImportable(*camera3Buffer.buffer)) {
+				releaseDescriptor(descriptor);
+				return -EINVAL;
+			}
+
 			buffer = createFrameBuffer(*camera3Buffer.buffer);
 			descriptor.frameBuffers_.emplace_back(buffer);
 			LOG(HAL, Debug) << ss.str() << " (direct)";
@@ -1976,15 +2409,20 @@ int CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Reques
 			 * buffer pool.
 			 *
 			 * The buffer has to be returned to the CameraStream
-			 * once it has been processed.
+			 * once it has been processed, which is done when the
+			 * descriptor is released.
 			 */
 			buffer = cameraStream->getBuffer();
+			if (buffer)
+				descriptor.internalBuffers_.emplace_back(cameraStream,
+									 buffer);
 			LOG(HAL, Debug) << ss.str() << " (internal)";
 			break;
 		}
 
 		if (!buffer) {
 			LOG(HAL, Error) << "Failed to create buffer";
+			releaseDescriptor(descriptor);
 			return -ENOMEM;
 		}
 
@@ -1997,14 +2435,21 @@ int CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Reques
 	 * to the CameraWorker thread.
 	 */
 	int ret = processControls(&descriptor);
-	if (ret)
+	if (ret) {
+		releaseDescriptor(descriptor);
 		return ret;
+	}
 
-	worker_.queueRequest(descriptor.request_.get());
+	if (batchSize_ == 1) {
+		worker_.queueRequest(descriptor.request_.get());
+		return 0;
+	}
 
-	{
-		std::scoped_lock<std::mutex> lock(mutex_);
-		descriptors_[descriptor.request_->cookie()] = std::move(descriptor);
+	/* Queue the requests once the batch is complete. */
+	batch_.push_back(descriptor.request_.get());
+	if (batch_.size() == batchSize_) {
+		worker_.queueRequests(batch_);
+		batch_.clear();
 	}
 
 	return 0;
@@ -2013,36 +2458,67 @@ int CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Reques
 void CameraDevice::requestComplete(Request *request)
 {
 	camera3_buffer_status status = CAMERA3_BUFFER_STATUS_OK;
-	std::unique_ptr<CameraMetadata> resultMetadata;
 
-	decltype(descriptors_)::node_type node;
-	{
-		std::scoped_lock<std::mutex> lock(mutex_);
-		auto it = descriptors_.find(request->cookie());
-		if (it == descriptors_.end()) {
-			LOG(HAL, Fatal)
-				<< "Unknown request: " << request->cookie();
-			status = CAMERA3_BUFFER_STATUS_ERROR;
-			return;
-		}
-
-		node = descriptors_.extract(it);
+	if (request->cookie() >= descriptors_.size() ||
+	    !descriptors_[request->cookie()].active_) {
+		LOG(HAL, Fatal) << "Unknown request: " << request->cookie();
+		return;
 	}
-	Camera3RequestDescriptor &descriptor = node.mapped();
+
+	Camera3RequestDescriptor &descriptor = descriptors_[request->cookie()];
 
 	if (request->status() != Request::RequestComplete) {
-		LOG(HAL, Error) << "Request not successfully completed: "
-				<< request->status();
+		LOG_RATELIMITED(HAL, Error)
+			<< "Request not successfully completed: "
+			<< request->status();
 		status = CAMERA3_BUFFER_STATUS_ERROR;
 	}
 
-	LOG(HAL, Debug) << "Request " << request->cookie() << " completed with "
+	LOG(HAL, Debug) << "Request " << descriptor.frameNumber_ << " completed with "
 			<< descriptor.buffers_.size() << " streams";
 
-	resultMetadata = getResultMetadata(descriptor);
+	descriptor.resultMetadata_ = getResultMetadata(descriptor);
+	if (!descriptor.resultMetadata_)
+		status = CAMERA3_BUFFER_STATUS_ERROR;
 
-	/* Handle any JPEG compression. */
+	descriptor.status_ = status;
 	for (camera3_stream_buffer_t &buffer : descriptor.buffers_) {
+		buffer.acquire_fence = -1;
+		buffer.release_fence = -1;
+		buffer.status = status;
+	}
+
+	const size_t numBuffers = descriptor.buffers_.size();
+	descriptor.sources_.assign(numBuffers, nullptr);
+	descriptor.bufferStates_.assign(numBuffers,
+					Camera3RequestDescriptor::BufferState::Ready);
+
+	if (status == CAMERA3_BUFFER_STATUS_OK) {
+		uint64_t timestamp =
+			static_cast<uint64_t>(request->metadata()
+					      .get(controls::SensorTimestamp));
+		notifyShutter(descriptor.frameNumber_, timestamp);
+	} else {
+		/*
+		 * \todo Improve error handling. Make sure the error path plays
+		 * well with the camera stack state machine.
+		 */
+		notifyError(descriptor.frameNumber_,
+			    descriptor.buffers_[0].stream);
+
+		/* No metadata is returned for failed requests. */
+		descriptor.metadataSent_ = true;
+	}
+
+	/*
+	 * Locate the buffers that need JPEG compression, and hold them along
+	 * with the buffers of the libcamera streams they are produced from
+	 * until post-processing completes.
+	 */
+	std::vector<CameraStream *> processedStreams;
+
+	for (size_t i = 0; status == CAMERA3_BUFFER_STATUS_OK && i < numBuffers; ++i) {
+		camera3_stream_buffer_t &buffer = descriptor.buffers_[i];
 		CameraStream *cameraStream =
 			static_cast<CameraStream *>(buffer.stream->priv);
 
@@ -2052,59 +2528,162 @@ void CameraDevice::requestComplete(Request *request)
 		FrameBuffer *src = request->findBuffer(cameraStream->stream());
 		if (!src) {
 			LOG(HAL, Error) << "Failed to find a source stream buffer";
+			buffer.status = CAMERA3_BUFFER_STATUS_ERROR;
 			continue;
 		}
 
-		int ret = cameraStream->process(*src,
-						*buffer.buffer,
-						descriptor.settings_,
-						resultMetadata.get());
-		if (ret) {
-			status = CAMERA3_BUFFER_STATUS_ERROR;
-			continue;
+		descriptor.sources_[i] = src;
+		processedStreams.push_back(cameraStream);
+
+		for (size_t j = 0; j < numBuffers; ++j) {
+			CameraStream *stream =
+				static_cast<CameraStream *>(descriptor.buffers_[j].stream->priv);
+			if (j == i || stream->stream() == cameraStream->stream())
+				descriptor.bufferStates_[j] =
+					Camera3RequestDescriptor::BufferState::Processing;
 		}
+	}
 
-		/*
-		 * Return the FrameBuffer to the CameraStream now that we're
-		 * done processing it.
-		 */
-		if (cameraStream->type() == CameraStream::Type::Internal)
-			cameraStream->putBuffer(src);
+	Camera3RequestDescriptor *pending = &descriptor;
+
+	{
+		std::scoped_lock<std::mutex> lock(resultsMutex_);
+		results_.push_back(&descriptor);
+		sendCaptureResults();
 	}
 
-	/* Prepare to call back the Android camera stack. */
-	camera3_capture_result_t captureResult = {};
-	captureResult.frame_number = descriptor.frameNumber_;
-	captureResult.num_output_buffers = descriptor.buffers_.size();
-	for (camera3_stream_buffer_t &buffer : descriptor.buffers_) {
-		buffer.acquire_fence = -1;
-		buffer.release_fence = -1;
-		buffer.status = status;
+	if (!processedStreams.empty())
+		postProcessors_.queue(processedStreams,
+				      [this, pending]() { postProcess(pending); });
+}
+
+/*
+ * Run the post-processors of a request. This is called from the
+ * post-processing worker threads.
+ */
+void CameraDevice::postProcess(Camera3RequestDescriptor *descriptor)
+{
+	for (size_t i = 0; i < descriptor->buffers_.size(); ++i) {
+		FrameBuffer *src = descriptor->sources_[i];
+		if (!src)
+			continue;
+
+		camera3_stream_buffer_t &buffer = descriptor->buffers_[i];
+		CameraStream *cameraStream =
+			static_cast<CameraStream *>(buffer.stream->priv);
+
+		int ret = cameraStream->process(*src, *buffer.buffer,
+						*descriptor->settings_,
+						descriptor->resultMetadata_.get());
+		if (ret)
+			buffer.status = CAMERA3_BUFFER_STATUS_ERROR;
 	}
-	captureResult.output_buffers = descriptor.buffers_.data();
 
-	if (status == CAMERA3_BUFFER_STATUS_OK) {
-		uint64_t timestamp =
-			static_cast<uint64_t>(request->metadata()
-					      .get(controls::SensorTimestamp));
-		notifyShutter(descriptor.frameNumber_, timestamp);
+	std::scoped_lock<std::mutex> lock(resultsMutex_);
 
-		captureResult.partial_result = 1;
-		captureResult.result = resultMetadata->get();
+	for (auto &state : descriptor->bufferStates_) {
+		if (state == Camera3RequestDescriptor::BufferState::Processing)
+			state = Camera3RequestDescriptor::BufferState::Ready;
 	}
 
-	if (status == CAMERA3_BUFFER_STATUS_ERROR || !captureResult.result) {
-		/* \todo Improve error handling. In case we notify an error
-		 * because the metadata generation fails, a shutter event has
-		 * already been notified for this frame number before the error
-		 * is here signalled. Make sure the error path plays well with
-		 * the camera stack state machine.
-		 */
-		notifyError(descriptor.frameNumber_,
-			    descriptor.buffers_[0].stream);
+	sendCaptureResults();
+}
+
+/*
+ * Return the ready buffers and metadata of the completed requests to the
+ * framework. Buffers of a stream are returned in frame number order, and so is
+ * the result metadata, which is only complete once post-processing is done.
+ * Buffers that don't depend on post-processing are thus returned without
+ * waiting for it. Must be called with the resultsMutex_ held.
+ */
+void CameraDevice::sendCaptureResults()
+{
+	using BufferState = Camera3RequestDescriptor::BufferState;
+
+	/* Streams with buffers not returned yet for earlier frames. */
+	std::set<const camera3_stream_t *> blockedStreams;
+	bool metadataBlocked = false;
+
+	for (auto it = results_.begin(); it != results_.end();) {
+		Camera3RequestDescriptor &descriptor = **it;
+		std::vector<camera3_stream_buffer_t> buffers;
+		bool processing = false;
+		bool complete = true;
+
+		for (size_t i = 0; i < descriptor.buffers_.size(); ++i) {
+			BufferState &state = descriptor.bufferStates_[i];
+			camera3_stream_buffer_t &buffer = descriptor.buffers_[i];
+
+			if (state == BufferState::Sent)
+				continue;
+
+			if (state == BufferState::Processing)
+				processing = true;
+
+			if (state == BufferState::Processing ||
+			    blockedStreams.count(buffer.stream)) {
+				blockedStreams.insert(buffer.stream);
+				complete = false;
+				continue;
+			}
+
+			/* Report post-processing failures on the buffer only. */
+			if (buffer.status == CAMERA3_BUFFER_STATUS_ERROR &&
+			    descriptor.status_ == CAMERA3_BUFFER_STATUS_OK)
+				notifyError(descriptor.frameNumber_, buffer.stream,
+					    CAMERA3_MSG_ERROR_BUFFER);
+
+			buffers.push_back(buffer);
+			state = BufferState::Sent;
+		}
+
+		camera3_capture_result_t captureResult = {};
+		captureResult.frame_number = descriptor.frameNumber_;
+		captureResult.num_output_buffers = buffers.size();
+		captureResult.output_buffers = buffers.data();
+
+		if (!descriptor.metadataSent_ && !metadataBlocked && !processing) {
+			captureResult.partial_result = 1;
+			captureResult.result = descriptor.resultMetadata_->get();
+			descriptor.metadataSent_ = true;
+		}
+
+		if (!descriptor.metadataSent_) {
+			metadataBlocked = true;
+			complete = false;
+		}
+
+		if (!buffers.empty() || captureResult.result)
+			callbacks_->process_capture_result(callbacks_, &captureResult);
+
+		if (complete) {
+			releaseDescriptor(descriptor);
+			it = results_.erase(it);
+		} else {
+			++it;
+		}
 	}
+}
 
-	callbacks_->process_capture_result(callbacks_, &captureResult);
+/*
+ * Return the settings and result metadata of a request to their pools, and
+ * make the descriptor available for a new request.
+ *
+ * The internal buffers are returned to their CameraStream here, whether the
+ * request completed, failed, was cancelled or never got queued, as the
+ * descriptor is released once post-processing, if any, is done with them.
+ */
+void CameraDevice::releaseDescriptor(Camera3RequestDescriptor &descriptor)
+{
+	for (auto &[cameraStream, buffer] : descriptor.internalBuffers_)
+		cameraStream->putBuffer(buffer);
+	descriptor.internalBuffers_.clear();
+
+	settingsPool_.release(std::move(descriptor.settings_));
+	resultMetadataPool_.release(std::move(descriptor.resultMetadata_));
+	descriptor.frameBuffers_.clear();
+
+	descriptor.active_.store(false, std::memory_order_release);
 }
 
 std::string CameraDevice::logPrefix() const
@@ -2123,7 +2702,8 @@ void CameraDevice::notifyShutter(uint32_t frameNumber, uint64_t timestamp)
 	callbacks_->notify(callbacks_, &notify);
 }
 
-void CameraDevice::notifyError(uint32_t frameNumber, camera3_stream_t *stream)
+void CameraDevice::notifyError(uint32_t frameNumber, camera3_stream_t *stream,
+			       camera3_error_msg_code code)
 {
 	camera3_notify_msg_t notify = {};
 
@@ -2131,13 +2711,14 @@ void CameraDevice::notifyError(uint32_t frameNumber, camera3_stream_t *stream)
 	 * \todo Report and identify the stream number or configuration to
 	 * clarify the stream that failed.
 	 */
-	LOG(HAL, Error) << "Error occurred on frame " << frameNumber << " ("
-			<< toPixelFormat(stream->format).toString() << ")";
+	LOG_RATELIMITED(HAL, Error)
+		<< "Error occurred on frame " << frameNumber << " ("
+		<< toPixelFormat(stream->format).toString() << ")";
 
 	notify.type = CAMERA3_MSG_ERROR;
 	notify.message.error.error_stream = stream;
 	notify.message.error.frame_number = frameNumber;
-	notify.message.error.error_code = CAMERA3_MSG_ERROR_REQUEST;
+	notify.message.error.error_code = code;
 
 	callbacks_->notify(callbacks_, &notify);
 }
@@ -2146,31 +2727,19 @@ void CameraDevice::notifyError(uint32_t frameNumber, camera3_stream_t *stream)
  * Produce a set of fixed result metadata.
  */
 std::unique_ptr<CameraMetadata>
-CameraDevice::getResultMetadata(const Camera3RequestDescriptor &descriptor) const
+CameraDevice::getResultMetadata(const Camera3RequestDescriptor &descriptor)
 {
 	const ControlList &metadata = descriptor.request_->metadata();
-	const CameraMetadata &settings = descriptor.settings_;
+	const CameraMetadata &settings = *descriptor.settings_;
 	camera_metadata_ro_entry_t entry;
 	bool found;
 
 	/*
-	 * \todo Keep this in sync with the actual number of entries.
-	 * Currently: 40 entries, 156 bytes
-	 *
-	 * Reserve more space for the JPEG metadata set by the post-processor.
-	 * Currently:
-	 * ANDROID_JPEG_GPS_COORDINATES (double x 3) = 24 bytes
-	 * ANDROID_JPEG_GPS_PROCESSING_METHOD (byte x 32) = 32 bytes
-	 * ANDROID_JPEG_GPS_TIMESTAMP (int64) = 8 bytes
-	 * ANDROID_JPEG_SIZE (int32_t) = 4 bytes
-	 * ANDROID_JPEG_QUALITY (byte) = 1 byte
-	 * ANDROID_JPEG_ORIENTATION (int32_t) = 4 bytes
-	 * ANDROID_JPEG_THUMBNAIL_QUALITY (byte) = 1 byte
-	 * ANDROID_JPEG_THUMBNAIL_SIZE (int32 x 2) = 8 bytes
-	 * Total bytes for JPEG metadata: 82
+	 * The container comes from a pool sized from the usage of previous
+	 * results, see kResultEntryCapacity for the initial capacity.
 	 */
 	std::unique_ptr<CameraMetadata> resultMetadata =
-		std::make_unique<CameraMetadata>(44, 166);
+		resultMetadataPool_.acquire();
 	if (!resultMetadata->isValid()) {
 		LOG(HAL, Error) << "Failed to allocate result metadata";
 		return nullptr;
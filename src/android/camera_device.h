@@ -7,10 +7,12 @@
 #ifndef __ANDROID_CAMERA_DEVICE_H__
 #define __ANDROID_CAMERA_DEVICE_H__
 
+#include <atomic>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <tuple>
+#include <utility>
 #include <vector>
 
 #include <hardware/camera3.h>
@@ -26,9 +28,11 @@
 #include "libcamera/internal/message.h"
 
 #include "camera_metadata.h"
+#include "camera_metadata_pool.h"
 #include "camera_stream.h"
 #include "camera_worker.h"
 #include "jpeg/encoder.h"
+#include "post_processor_pool.h"
 
 struct CameraConfigData;
 class CameraDevice : protected libcamera::Loggable
@@ -71,17 +75,30 @@ private:
 	CameraDevice(unsigned int id, std::shared_ptr<libcamera::Camera> camera);
 
 	struct Camera3RequestDescriptor {
-		Camera3RequestDescriptor() = default;
-		~Camera3RequestDescriptor() = default;
-		Camera3RequestDescriptor(libcamera::Camera *camera,
-					 const camera3_capture_request_t *camera3Request);
-		Camera3RequestDescriptor &operator=(Camera3RequestDescriptor &&) = default;
+		void reset(const camera3_capture_request_t *camera3Request);
+
+		enum class BufferState {
+			Processing,
+			Ready,
+			Sent,
+		};
 
 		uint32_t frameNumber_ = 0;
 		std::vector<camera3_stream_buffer_t> buffers_;
 		std::vector<std::unique_ptr<libcamera::FrameBuffer>> frameBuffers_;
-		CameraMetadata settings_;
+		std::vector<std::pair<CameraStream *, libcamera::FrameBuffer *>> internalBuffers_;
+		std::unique_ptr<CameraMetadata> settings_;
 		std::unique_ptr<CaptureRequest> request_;
+
+		/* Post-processing and capture result delivery state. */
+		camera3_buffer_status status_ = CAMERA3_BUFFER_STATUS_OK;
+		std::vector<libcamera::FrameBuffer *> sources_;
+		std::vector<BufferState> bufferStates_;
+		std::unique_ptr<CameraMetadata> resultMetadata_;
+		bool metadataSent_ = false;
+
+		/* Set while the descriptor is used by an in-flight request. */
+		std::atomic<bool> active_ = false;
 	};
 
 	struct Camera3StreamConfiguration {
@@ -89,25 +106,39 @@ private:
 		int androidFormat;
 	};
 
+	struct Camera3HighSpeedConfiguration {
+		libcamera::Size resolution;
+		int32_t maxFps;
+	};
+
 	void stop();
 
 	int initializeStreamConfigurations();
+	void initializeHighSpeedConfigurations();
 	std::vector<libcamera::Size>
 	getYUVResolutions(libcamera::CameraConfiguration *cameraConfig,
 			  const libcamera::PixelFormat &pixelFormat,
 			  const std::vector<libcamera::Size> &resolutions);
 	std::vector<libcamera::Size>
 	getRawResolutions(const libcamera::PixelFormat &pixelFormat);
+	std::string streamConfigurationsKey(const libcamera::StreamConfiguration &cfg) const;
+	std::string streamConfigurationsCachePath() const;
+	int loadStreamConfigurations(const std::string &key);
+	void saveStreamConfigurations(const std::string &key) const;
 
 	libcamera::FrameBuffer *createFrameBuffer(const buffer_handle_t camera3buffer);
 	void notifyShutter(uint32_t frameNumber, uint64_t timestamp);
-	void notifyError(uint32_t frameNumber, camera3_stream_t *stream);
+	void notifyError(uint32_t frameNumber, camera3_stream_t *stream,
+			 camera3_error_msg_code code = CAMERA3_MSG_ERROR_REQUEST);
+	void postProcess(Camera3RequestDescriptor *descriptor);
+	void sendCaptureResults();
 	std::unique_ptr<CameraMetadata> requestTemplatePreview();
 	std::unique_ptr<CameraMetadata> requestTemplateVideo();
 	libcamera::PixelFormat toPixelFormat(int format) const;
 	int processControls(Camera3RequestDescriptor *descriptor);
 	std::unique_ptr<CameraMetadata> getResultMetadata(
-		const Camera3RequestDescriptor &descriptor) const;
+		const Camera3RequestDescriptor &descriptor);
+	void releaseDescriptor(Camera3RequestDescriptor &descriptor);
 
 	unsigned int id_;
 	camera3_device_t camera3Device_;
@@ -123,11 +154,29 @@ private:
 	const camera3_callback_ops_t *callbacks_;
 
 	std::vector<Camera3StreamConfiguration> streamConfigurations_;
+	std::vector<Camera3HighSpeedConfiguration> highSpeedConfigurations_;
 	std::map<int, libcamera::PixelFormat> formatsMap_;
 	std::vector<CameraStream> streams_;
 
-	std::mutex mutex_; /* Protect descriptors_ */
-	std::map<uint64_t, Camera3RequestDescriptor> descriptors_;
+	/*
+	 * Ring of request descriptors, indexed by frame number modulo the ring
+	 * size. The libcamera request of each descriptor uses the descriptor
+	 * index as its cookie.
+	 */
+	std::vector<Camera3RequestDescriptor> descriptors_;
+
+	/*
+	 * Completed requests whose buffers or metadata haven't all been
+	 * returned to the framework yet, in frame number order.
+	 */
+	std::mutex resultsMutex_; /* Protect results_ */
+	std::vector<Camera3RequestDescriptor *> results_;
+
+	PostProcessorPool postProcessors_;
+
+	/* Per-request settings and result metadata, recycled across requests. */
+	CameraMetadataPool settingsPool_;
+	CameraMetadataPool resultMetadataPool_;
 
 	std::string maker_;
 	std::string model_;
@@ -138,6 +187,13 @@ private:
 	unsigned int maxJpegBufferSize_;
 
 	CameraMetadata lastSettings_;
+
+	/*
+	 * Number of requests queued together in constrained high speed mode,
+	 * 1 otherwise, and requests of the batch being accumulated.
+	 */
+	unsigned int batchSize_;
+	std::vector<CaptureRequest *> batch_;
 };
 
 #endif /* __ANDROID_CAMERA_DEVICE_H__ */
@@ -14,19 +14,45 @@ namespace filesystem = std::experimental::filesystem;
 #else
 #include <filesystem>
 #endif
+#include <fstream>
+#include <sstream>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <yaml.h>
 
 #include <hardware/camera3.h>
 
+#include <libcamera/camera_manager.h>
+
 #include "libcamera/internal/log.h"
+#include "libcamera/internal/utils.h"
 
 using namespace libcamera;
 
 LOG_DEFINE_CATEGORY(HALConfig)
 
+namespace {
+
+/*
+ * Directory storing the parsed configuration cache, unless overridden by the
+ * LIBCAMERA_HAL_CACHE_DIR environment variable. This is shared with the
+ * stream configurations cache of the camera devices.
+ */
+constexpr const char *kConfigurationCacheDir = "/var/cache/camera";
+
+std::string configurationCachePath()
+{
+	const char *dir = utils::secure_getenv("LIBCAMERA_HAL_CACHE_DIR");
+	std::string path = dir ? dir : kConfigurationCacheDir;
+
+	return path + "/libcamera-hal-config";
+}
+
+} /* namespace */
+
 class CameraHalConfig::Private : public Extensible::Private
 {
 	LIBCAMERA_DECLARE_PUBLIC(CameraHalConfig)
@@ -375,11 +401,34 @@ int CameraHalConfig::parseConfigurationFile()
 
 	exists_ = true;
 
-	Private *const d = LIBCAMERA_D_PTR();
-	int ret = d->parseConfigFile(fh, &cameras_);
-	fclose(fh);
-	if (ret)
-		return -EINVAL;
+	/*
+	 * Skip parsing if the cache has been stored for the same version of
+	 * the configuration file. The file is identified by its modification
+	 * time and size.
+	 */
+	std::string key;
+	struct stat st;
+	if (!fstat(fileno(fh), &st)) {
+		std::stringstream ss;
+		ss << CameraManager::version() << " " << st.st_mtim.tv_sec << "."
+		   << st.st_mtim.tv_nsec << " " << st.st_size << " "
+		   << filePath.string();
+		key = ss.str();
+	}
+
+	if (!key.empty() && !loadCache(key)) {
+		fclose(fh);
+		LOG(HALConfig, Debug) << "Loaded configuration from cache";
+	} else {
+		Private *const d = LIBCAMERA_D_PTR();
+		int ret = d->parseConfigFile(fh, &cameras_);
+		fclose(fh);
+		if (ret)
+			return -EINVAL;
+
+		if (!key.empty())
+			saveCache(key);
+	}
 
 	valid_ = true;
 
@@ -394,6 +443,78 @@ int CameraHalConfig::parseConfigurationFile()
 	return 0;
 }
 
+/*
+ * Load the camera configuration data from the cache file, if it has been
+ * stored with the same \a key.
+ */
+int CameraHalConfig::loadCache(const std::string &key)
+{
+	std::ifstream file(configurationCachePath());
+	if (!file.is_open())
+		return -ENOENT;
+
+	std::string line;
+	if (!std::getline(file, line) || line != key)
+		return -EINVAL;
+
+	std::map<std::string, CameraConfigData> cameras;
+
+	while (std::getline(file, line)) {
+		std::istringstream entry(line);
+		CameraConfigData cameraConfigData;
+		std::string cameraId;
+
+		/* The camera ID may contain spaces, store it last. */
+		entry >> cameraConfigData.facing >> cameraConfigData.rotation;
+		entry.ignore(1);
+		std::getline(entry, cameraId);
+
+		if (entry.fail() || cameraId.empty())
+			return -EINVAL;
+
+		cameras[cameraId] = cameraConfigData;
+	}
+
+	cameras_ = std::move(cameras);
+
+	return 0;
+}
+
+/*
+ * Store the camera configuration data in the cache file. The file is written
+ * to a temporary location and renamed, to never expose a partial cache to
+ * concurrent readers. Failures are not fatal, the configuration file will be
+ * parsed again on the next run.
+ */
+void CameraHalConfig::saveCache(const std::string &key) const
+{
+	const std::string path = configurationCachePath();
+	const std::string tmpPath = path + ".tmp";
+
+	{
+		std::ofstream file(tmpPath, std::ios::trunc);
+		if (!file.is_open()) {
+			LOG(HALConfig, Debug) << "Can't create cache file " << tmpPath;
+			return;
+		}
+
+		file << key << "\n";
+
+		for (const auto &[cameraId, camera] : cameras_)
+			file << camera.facing << " " << camera.rotation << " "
+			     << cameraId << "\n";
+
+		if (!file.good()) {
+			LOG(HALConfig, Debug) << "Failed to write cache file " << tmpPath;
+			unlink(tmpPath.c_str());
+			return;
+		}
+	}
+
+	if (rename(tmpPath.c_str(), path.c_str()) < 0)
+		unlink(tmpPath.c_str());
+}
+
 const CameraConfigData *CameraHalConfig::cameraConfigData(const std::string &cameraId) const
 {
 	const auto &it = cameras_.find(cameraId);
@@ -35,5 +35,7 @@ private:
 	std::map<std::string, CameraConfigData> cameras_;
 
 	int parseConfigurationFile();
+	int loadCache(const std::string &key);
+	void saveCache(const std::string &key) const;
 };
 #endif /* __ANDROID_CAMERA_HAL_CONFIG_H__ */
@@ -7,6 +7,8 @@
 
 #include "camera_metadata.h"
 
+#include <algorithm>
+
 #include "libcamera/internal/log.h"
 
 using namespace libcamera;
@@ -57,6 +59,64 @@ CameraMetadata &CameraMetadata::operator=(const CameraMetadata &other)
 	return *this;
 }
 
+/*
+ * \brief Remove all entries from the container
+ *
+ * The entries are reset in place, preserving the allocated capacity, to allow
+ * reusing the container without reallocating memory.
+ */
+void CameraMetadata::clear()
+{
+	if (!metadata_)
+		return;
+
+	size_t entryCapacity = get_camera_metadata_entry_capacity(metadata_);
+	size_t dataCapacity = get_camera_metadata_data_capacity(metadata_);
+	camera_metadata_t *metadata =
+		place_camera_metadata(metadata_, get_camera_metadata_size(metadata_),
+				      entryCapacity, dataCapacity);
+
+	valid_ = metadata != nullptr;
+	resized_ = false;
+}
+
+/*
+ * \brief Append all entries of \a other to the container
+ * \param[in] other The metadata to copy the entries from
+ *
+ * The container is allocated or resized if needed. Entries are copied as-is,
+ * \a other shall thus not contain tags already present in the container.
+ *
+ * \return True if the entries were appended successfully, false otherwise
+ */
+bool CameraMetadata::append(const camera_metadata_t *other)
+{
+	if (!other)
+		return valid_;
+
+	size_t count = get_camera_metadata_entry_count(other);
+	size_t size = get_camera_metadata_data_count(other);
+
+	if (!metadata_) {
+		metadata_ = allocate_camera_metadata(count, size);
+		valid_ = metadata_ != nullptr;
+	}
+
+	if (!resize(count, size)) {
+		LOG(CameraMetadata, Error) << "Failed to resize";
+		valid_ = false;
+		return false;
+	}
+
+	if (append_camera_metadata(metadata_, other)) {
+		LOG(CameraMetadata, Error) << "Failed to append metadata";
+		valid_ = false;
+		return false;
+	}
+
+	return true;
+}
+
 std::tuple<size_t, size_t> CameraMetadata::usage() const
 {
 	size_t currentEntryCount = get_camera_metadata_entry_count(metadata_);
@@ -65,6 +125,14 @@ std::tuple<size_t, size_t> CameraMetadata::usage() const
 	return { currentEntryCount, currentDataCount };
 }
 
+std::tuple<size_t, size_t> CameraMetadata::capacity() const
+{
+	size_t entryCapacity = get_camera_metadata_entry_capacity(metadata_);
+	size_t dataCapacity = get_camera_metadata_data_capacity(metadata_);
+
+	return { entryCapacity, dataCapacity };
+}
+
 bool CameraMetadata::getEntry(uint32_t tag, camera_metadata_ro_entry_t *entry) const
 {
 	if (find_camera_metadata_ro_entry(metadata_, tag, entry))
@@ -90,12 +158,14 @@ bool CameraMetadata::resize(size_t count, size_t size)
 	size_t currentEntryCount = get_camera_metadata_entry_count(metadata_);
 	size_t currentEntryCapacity = get_camera_metadata_entry_capacity(metadata_);
 	size_t newEntryCapacity = currentEntryCapacity < currentEntryCount + count ?
-				  currentEntryCapacity * 2 : currentEntryCapacity;
+				  std::max(currentEntryCapacity * 2, currentEntryCount + count) :
+				  currentEntryCapacity;
 
 	size_t currentDataCount = get_camera_metadata_data_count(metadata_);
 	size_t currentDataCapacity = get_camera_metadata_data_capacity(metadata_);
 	size_t newDataCapacity = currentDataCapacity < currentDataCount + size ?
-				 currentDataCapacity * 2 : currentDataCapacity;
+				 std::max(currentDataCapacity * 2, currentDataCount + size) :
+				 currentDataCapacity;
 
 	if (newEntryCapacity > currentEntryCapacity ||
 	    newDataCapacity > currentDataCapacity) {
@@ -23,7 +23,11 @@ public:
 
 	CameraMetadata &operator=(const CameraMetadata &other);
 
+	void clear();
+	bool append(const camera_metadata_t *other);
+
 	std::tuple<size_t, size_t> usage() const;
+	std::tuple<size_t, size_t> capacity() const;
 	bool resized() const { return resized_; }
 
 	bool isValid() const { return valid_; }
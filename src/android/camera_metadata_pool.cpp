@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * camera_metadata_pool.cpp - Pool of reusable Android metadata buffers
+ */
+
+#include "camera_metadata_pool.h"
+
+#include <algorithm>
+
+/*
+ * \class CameraMetadataPool
+ * \brief Recycle CameraMetadata containers across requests
+ *
+ * Per-request metadata, such as the capture settings and results, have a
+ * nearly constant size from frame to frame. The pool keeps released containers
+ * to hand them out again, cleared, for later requests.
+ *
+ * The capacity of newly allocated containers starts from the initial guess
+ * passed to the constructor, and grows to the largest usage observed when
+ * containers are released. Released containers too small for the observed
+ * usage are freed instead of being reused, so that after the first few frames
+ * all containers in the pool hold their content without reallocation.
+ */
+
+CameraMetadataPool::CameraMetadataPool(size_t entryCapacity, size_t dataCapacity)
+	: entryCapacity_(entryCapacity), dataCapacity_(dataCapacity)
+{
+}
+
+/*
+ * \brief Get an empty metadata container
+ *
+ * The returned container may be invalid if memory allocation failed, callers
+ * shall check it with CameraMetadata::isValid().
+ */
+std::unique_ptr<CameraMetadata> CameraMetadataPool::acquire()
+{
+	size_t entryCapacity;
+	size_t dataCapacity;
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+
+		if (!free_.empty()) {
+			std::unique_ptr<CameraMetadata> metadata = std::move(free_.back());
+			free_.pop_back();
+			return metadata;
+		}
+
+		entryCapacity = entryCapacity_;
+		dataCapacity = dataCapacity_;
+	}
+
+	return std::make_unique<CameraMetadata>(entryCapacity, dataCapacity);
+}
+
+/*
+ * \brief Return a container acquired from the pool
+ * \param[in] metadata The container
+ */
+void CameraMetadataPool::release(std::unique_ptr<CameraMetadata> metadata)
+{
+	if (!metadata || !metadata->isValid())
+		return;
+
+	auto [entryCount, dataCount] = metadata->usage();
+	auto [entryCapacity, dataCapacity] = metadata->capacity();
+
+	metadata->clear();
+
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	entryCapacity_ = std::max(entryCapacity_, entryCount);
+	dataCapacity_ = std::max(dataCapacity_, dataCount);
+
+	if (entryCapacity < entryCapacity_ || dataCapacity < dataCapacity_)
+		return;
+
+	free_.push_back(std::move(metadata));
+}
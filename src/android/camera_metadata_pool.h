@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * camera_metadata_pool.h - Pool of reusable Android metadata buffers
+ */
+#ifndef __ANDROID_CAMERA_METADATA_POOL_H__
+#define __ANDROID_CAMERA_METADATA_POOL_H__
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "camera_metadata.h"
+
+class CameraMetadataPool
+{
+public:
+	CameraMetadataPool(size_t entryCapacity, size_t dataCapacity);
+
+	std::unique_ptr<CameraMetadata> acquire();
+	void release(std::unique_ptr<CameraMetadata> metadata);
+
+private:
+	/* Protects all the members below. */
+	std::mutex mutex_;
+	size_t entryCapacity_;
+	size_t dataCapacity_;
+	std::vector<std::unique_ptr<CameraMetadata>> free_;
+};
+
+#endif /* __ANDROID_CAMERA_METADATA_POOL_H__ */
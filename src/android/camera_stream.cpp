@@ -7,6 +7,9 @@
 
 #include "camera_stream.h"
 
+#include <algorithm>
+#include <sys/stat.h>
+
 #include "camera_buffer.h"
 #include "camera_device.h"
 #include "camera_metadata.h"
@@ -81,6 +84,8 @@ int CameraStream::configure()
 			return ret;
 	}
 
+	mappings_.clear();
+
 	if (allocator_) {
 		int ret = allocator_->allocate(stream());
 		if (ret < 0)
@@ -104,17 +109,85 @@ int CameraStream::process(const libcamera::FrameBuffer &source,
 	if (!postProcessor_)
 		return 0;
 
-	/*
-	 * \todo Buffer mapping and processing should be moved to a
-	 * separate thread.
-	 */
-	CameraBuffer dest(camera3Dest, PROT_READ | PROT_WRITE);
-	if (!dest.isValid()) {
+	CameraBuffer *dest = mapBuffer(camera3Dest);
+	if (!dest) {
 		LOG(HAL, Error) << "Failed to map android blob buffer";
 		return -EINVAL;
 	}
 
-	return postProcessor_->process(source, &dest, requestMetadata, resultMetadata);
+	return postProcessor_->process(source, dest, requestMetadata, resultMetadata);
+}
+
+/*
+ * Map a destination buffer, reusing the mapping created for a previous frame
+ * when the framework provides the same buffer again. As buffer handles may be
+ * reused for different buffers, buffers are identified by the inode of their
+ * first dmabuf in addition to their handle.
+ */
+CameraBuffer *CameraStream::mapBuffer(buffer_handle_t camera3Buffer)
+{
+	struct stat st;
+	if (camera3Buffer->numFds < 1 || fstat(camera3Buffer->data[0], &st) < 0)
+		return nullptr;
+
+	auto it = std::find_if(mappings_.begin(), mappings_.end(),
+			       [&](const MappedCameraBuffer &mapping) {
+				       return mapping.handle == camera3Buffer &&
+					      mapping.inode == st.st_ino;
+			       });
+	if (it != mappings_.end()) {
+		mappings_.splice(mappings_.begin(), mappings_, it);
+		return mappings_.front().buffer.get();
+	}
+
+	auto buffer = std::make_unique<CameraBuffer>(camera3Buffer,
+						     PROT_READ | PROT_WRITE);
+	if (!buffer->isValid())
+		return nullptr;
+
+	mappings_.push_front({ camera3Buffer, st.st_ino, std::move(buffer) });
+
+	/* Keep at most one mapping per buffer the stream can use. */
+	while (mappings_.size() > std::max(camera3Stream_->max_buffers, 1u))
+		mappings_.pop_back();
+
+	return mappings_.front().buffer.get();
+}
+
+/*
+ * Check if a gralloc buffer matches the layout of the frames produced by the
+ * libcamera stream, and can thus be imported for direct capture. The buffer
+ * must be large enough to hold a frame and, when the gralloc backend reports
+ * it, use the same line stride as the stream.
+ */
+bool CameraStream::isImportable(buffer_handle_t camera3Buffer)
+{
+	const StreamConfiguration &cfg = configuration();
+
+	CameraBuffer *buffer = mapBuffer(camera3Buffer);
+	if (!buffer)
+		return false;
+
+	unsigned int stride = buffer->stride(0);
+	if (stride && stride != cfg.stride) {
+		LOG(HAL, Error)
+			<< "Buffer stride " << stride
+			<< " doesn't match stream stride " << cfg.stride;
+		return false;
+	}
+
+	size_t size = 0;
+	for (unsigned int i = 0; i < buffer->numPlanes(); ++i)
+		size += buffer->plane(i).size();
+
+	if (size < cfg.frameSize) {
+		LOG(HAL, Error)
+			<< "Buffer size " << size
+			<< " too small for stream frame size " << cfg.frameSize;
+		return false;
+	}
+
+	return true;
 }
 
 FrameBuffer *CameraStream::getBuffer()
@@ -125,7 +198,7 @@ FrameBuffer *CameraStream::getBuffer()
 	std::lock_guard<std::mutex> locker(*mutex_);
 
 	if (buffers_.empty()) {
-		LOG(HAL, Error) << "Buffer underrun";
+		LOG_RATELIMITED(HAL, Error) << "Buffer underrun";
 		return nullptr;
 	}
 
@@ -7,8 +7,10 @@
 #ifndef __ANDROID_CAMERA_STREAM_H__
 #define __ANDROID_CAMERA_STREAM_H__
 
+#include <list>
 #include <memory>
 #include <mutex>
+#include <sys/types.h>
 #include <vector>
 
 #include <hardware/camera3.h>
@@ -21,6 +23,8 @@
 
 #include "libcamera/internal/buffer.h"
 
+#include "camera_buffer.h"
+
 class CameraDevice;
 class CameraMetadata;
 class PostProcessor;
@@ -125,8 +129,17 @@ public:
 		    CameraMetadata *resultMetadata);
 	libcamera::FrameBuffer *getBuffer();
 	void putBuffer(libcamera::FrameBuffer *buffer);
+	bool isImportable(buffer_handle_t camera3Buffer);
 
 private:
+	struct MappedCameraBuffer {
+		buffer_handle_t handle;
+		ino_t inode;
+		std::unique_ptr<CameraBuffer> buffer;
+	};
+
+	CameraBuffer *mapBuffer(buffer_handle_t camera3Buffer);
+
 	CameraDevice *const cameraDevice_;
 	const libcamera::CameraConfiguration *config_;
 	const Type type_;
@@ -141,6 +154,12 @@ private:
 	 */
 	std::unique_ptr<std::mutex> mutex_;
 	std::unique_ptr<PostProcessor> postProcessor_;
+
+	/*
+	 * Destination buffers, or imported buffers for direct streams, mapped
+	 * by previous frames, most recent first.
+	 */
+	std::list<MappedCameraBuffer> mappings_;
 };
 
 #endif /* __ANDROID_CAMERA_STREAM__ */
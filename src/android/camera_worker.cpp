@@ -7,11 +7,6 @@
 
 #include "camera_worker.h"
 
-#include <errno.h>
-#include <string.h>
-#include <sys/poll.h>
-#include <unistd.h>
-
 #include "camera_device.h"
 
 using namespace libcamera;
@@ -24,19 +19,22 @@ LOG_DECLARE_CATEGORY(HAL)
  *
  * A CaptureRequest is constructed by the CameraDevice, filled with
  * buffers and fences provided by the camera3 framework and then processed
- * by the CameraWorker which queues it to the libcamera::Camera after handling
- * fences.
+ * by the CameraWorker which queues it to the libcamera::Camera. The fences are
+ * handed to libcamera, which waits for them before using the buffers.
  */
-CaptureRequest::CaptureRequest(libcamera::Camera *camera)
+CaptureRequest::CaptureRequest(libcamera::Camera *camera, uint64_t cookie)
 	: camera_(camera)
 {
-	request_ = camera_->createRequest(reinterpret_cast<uint64_t>(this));
+	request_ = camera_->createRequest(cookie);
 }
 
 void CaptureRequest::addBuffer(Stream *stream, FrameBuffer *buffer, int fence)
 {
-	request_->addBuffer(stream, buffer);
-	acquireFences_.push_back(fence);
+	/*
+	 * The HAL owns the acquire fence, transfer the ownership to libcamera.
+	 * A -1 fence results in an invalid FileDescriptor.
+	 */
+	request_->addBuffer(stream, buffer, FileDescriptor(std::move(fence)));
 }
 
 void CaptureRequest::queue()
@@ -44,6 +42,15 @@ void CaptureRequest::queue()
 	camera_->queueRequest(request_.get());
 }
 
+/*
+ * Reset the request to its initial state, removing all buffers and fences, to
+ * use it for a new capture.
+ */
+void CaptureRequest::reuse()
+{
+	request_->reuse();
+}
+
 /*
  * \class CameraWorker
  * \brief Process a CaptureRequest on an internal thread
@@ -53,6 +60,7 @@ void CaptureRequest::queue()
  */
 CameraWorker::CameraWorker()
 {
+	setName("CameraWorker");
 	worker_.moveToThread(this);
 }
 
@@ -81,49 +89,36 @@ void CameraWorker::queueRequest(CaptureRequest *request)
 }
 
 /*
- * \class CameraWorker::Worker
- * \brief Process a CaptureRequest handling acquisition fences
+ * Queue a batch of requests to the camera at once, for the constrained high
+ * speed mode where the camera service submits requests in batches.
  */
-int CameraWorker::Worker::waitFence(int fence)
+void CameraWorker::queueRequests(const std::vector<CaptureRequest *> &requests)
 {
-	/*
-	 * \todo Better characterize the timeout. Currently equal to the one
-	 * used by the Rockchip Camera HAL on ChromeOS.
-	 */
-	constexpr unsigned int timeoutMs = 300;
-	struct pollfd fds = { fence, POLLIN, 0 };
-
-	do {
-		int ret = poll(&fds, 1, timeoutMs);
-		if (ret == 0)
-			return -ETIME;
-
-		if (ret > 0) {
-			if (fds.revents & (POLLERR | POLLNVAL))
-				return -EINVAL;
-
-			return 0;
-		}
-	} while (errno == EINTR || errno == EAGAIN);
-
-	return -errno;
+	worker_.invokeMethod(&Worker::processRequests, ConnectionTypeQueued,
+			     requests);
 }
 
+/*
+ * \class CameraWorker::Worker
+ * \brief Queue a CaptureRequest to the camera
+ *
+ * Acquisition fences are waited for by libcamera, which queues requests to the
+ * device in order as soon as their fences have signalled.
+ */
 void CameraWorker::Worker::processRequest(CaptureRequest *request)
 {
-	/* Wait on all fences before queuing the Request. */
-	for (int fence : request->fences()) {
-		if (fence == -1)
-			continue;
-
-		int ret = waitFence(fence);
-		close(fence);
-		if (ret < 0) {
-			LOG(HAL, Error) << "Failed waiting for fence: "
-					<< fence << ": " << strerror(-ret);
-			return;
-		}
-	}
-
 	request->queue();
 }
+
+void CameraWorker::Worker::processRequests(const std::vector<CaptureRequest *> &requests)
+{
+	if (requests.empty())
+		return;
+
+	std::vector<Request *> batch;
+	batch.reserve(requests.size());
+	for (CaptureRequest *request : requests)
+		batch.push_back(request->request());
+
+	requests.front()->camera()->queueRequests(batch);
+}
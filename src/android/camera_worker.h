@@ -8,6 +8,7 @@
 #define __ANDROID_CAMERA_WORKER_H__
 
 #include <memory>
+#include <vector>
 
 #include <libcamera/buffer.h>
 #include <libcamera/camera.h>
@@ -22,23 +23,24 @@ class CameraDevice;
 class CaptureRequest
 {
 public:
-	CaptureRequest(libcamera::Camera *camera);
+	CaptureRequest(libcamera::Camera *camera, uint64_t cookie);
 
-	const std::vector<int> &fences() const { return acquireFences_; }
 	libcamera::ControlList &controls() { return request_->controls(); }
 	const libcamera::ControlList &metadata() const
 	{
 		return request_->metadata();
 	}
 	unsigned long cookie() const { return request_->cookie(); }
+	libcamera::Camera *camera() const { return camera_; }
+	libcamera::Request *request() const { return request_.get(); }
 
 	void addBuffer(libcamera::Stream *stream,
 		       libcamera::FrameBuffer *buffer, int fence);
 	void queue();
+	void reuse();
 
 private:
 	libcamera::Camera *camera_;
-	std::vector<int> acquireFences_;
 	std::unique_ptr<libcamera::Request> request_;
 };
 
@@ -51,6 +53,7 @@ public:
 	void stop();
 
 	void queueRequest(CaptureRequest *request);
+	void queueRequests(const std::vector<CaptureRequest *> &requests);
 
 protected:
 	void run() override;
@@ -60,9 +63,7 @@ private:
 	{
 	public:
 		void processRequest(CaptureRequest *request);
-
-	private:
-		int waitFence(int fence);
+		void processRequests(const std::vector<CaptureRequest *> &requests);
 	};
 
 	Worker worker_;
@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * encoder.cpp - Image encoding interface
+ */
+
+#include "encoder.h"
+
+#include <errno.h>
+#include <string.h>
+
+using namespace libcamera;
+
+namespace {
+
+constexpr uint8_t kMarkerSOI = 0xd8;
+constexpr uint8_t kMarkerAPP1 = 0xe1;
+
+/* Size of the APP1 marker and length fields preceding the Exif data. */
+constexpr unsigned int kApp1HeaderSize = 4;
+
+} /* namespace */
+
+/*
+ * \brief Insert Exif data in an encoded JPEG stream
+ * \param[in] destination The buffer storing the JPEG stream
+ * \param[in] size The size of the JPEG stream
+ * \param[in] exifData The Exif data
+ *
+ * Store \a exifData in a JPEG_APP1 data block right after the SOI marker of
+ * the JPEG stream, moving the rest of the stream towards the end of
+ * \a destination. This allows encoding the image before the Exif data is
+ * available.
+ *
+ * \return The size of the JPEG stream including the Exif data, or a negative
+ * error code if the Exif data doesn't fit in \a destination or the stream is
+ * invalid
+ */
+int Encoder::insertExif(Span<uint8_t> destination, size_t size,
+			Span<const uint8_t> exifData)
+{
+	if (exifData.empty())
+		return size;
+
+	if (exifData.size() > 0xffff - 2)
+		return -EINVAL;
+
+	size_t exifSize = exifData.size() + kApp1HeaderSize;
+	if (size + exifSize > destination.size())
+		return -ENOSPC;
+
+	uint8_t *data = destination.data();
+	if (size < 2 || data[0] != 0xff || data[1] != kMarkerSOI)
+		return -EIO;
+
+	memmove(data + 2 + exifSize, data + 2, size - 2);
+
+	data[2] = 0xff;
+	data[3] = kMarkerAPP1;
+	data[4] = (exifData.size() + 2) >> 8;
+	data[5] = (exifData.size() + 2) & 0xff;
+	memcpy(data + 2 + kApp1HeaderSize, exifData.data(), exifData.size());
+
+	return size + exifSize;
+}
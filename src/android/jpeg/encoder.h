@@ -11,6 +11,8 @@
 #include <libcamera/span.h>
 #include <libcamera/stream.h>
 
+class CameraBuffer;
+
 class Encoder
 {
 public:
@@ -18,9 +20,12 @@ public:
 
 	virtual int configure(const libcamera::StreamConfiguration &cfg) = 0;
 	virtual int encode(const libcamera::FrameBuffer &source,
-			   libcamera::Span<uint8_t> destination,
+			   CameraBuffer *destination,
 			   libcamera::Span<const uint8_t> exifData,
 			   unsigned int quality) = 0;
+
+	static int insertExif(libcamera::Span<uint8_t> destination, size_t size,
+			      libcamera::Span<const uint8_t> exifData);
 };
 
 #endif /* __ANDROID_JPEG_ENCODER_H__ */
@@ -7,12 +7,15 @@
 
 #include "encoder_libjpeg.h"
 
+#include <algorithm>
 #include <fcntl.h>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <thread>
 #include <unistd.h>
 #include <vector>
 
@@ -23,12 +26,26 @@
 #include "libcamera/internal/formats.h"
 #include "libcamera/internal/log.h"
 
+#include "../camera_buffer.h"
+
 using namespace libcamera;
 
 LOG_DECLARE_CATEGORY(JPEG)
 
 namespace {
 
+/*
+ * Images are split in at most kMaxStrips horizontal strips, encoded in
+ * parallel. Each MCU row is a restart interval, and strips are made of a
+ * multiple of the 8 restart markers cycle, so that the markers of each strip
+ * are numbered correctly once the strips are concatenated.
+ */
+constexpr unsigned int kMaxStrips = 4;
+constexpr unsigned int kRestartCycle = 8;
+
+constexpr uint8_t kMarkerSOF0 = 0xc0;
+constexpr uint8_t kMarkerSOS = 0xda;
+
 struct JPEGPixelFormatInfo {
 	J_COLOR_SPACE colorSpace;
 	const PixelFormatInfo &pixelFormatInfo;
@@ -65,8 +82,47 @@ const struct JPEGPixelFormatInfo &findPixelInfo(const PixelFormat &format)
 	return iter->second;
 }
 
+/*
+ * Find the first marker segment of the given type in the headers of a JPEG
+ * stream, and return its offset, or 0 if not found before the scan data.
+ */
+size_t findMarker(const uint8_t *data, size_t size, uint8_t marker)
+{
+	/* Skip the SOI marker, which has no payload. */
+	size_t pos = 2;
+
+	while (pos + 4 <= size) {
+		if (data[pos] != 0xff)
+			return 0;
+
+		if (data[pos + 1] == marker)
+			return pos;
+
+		if (data[pos + 1] == kMarkerSOS)
+			return 0;
+
+		pos += 2 + ((data[pos + 2] << 8) | data[pos + 3]);
+	}
+
+	return 0;
+}
+
 } /* namespace */
 
+EncoderLibJpeg::Strip::Strip()
+	: firstRow(0), buffer(nullptr), capacity(0), size(0)
+{
+	compress.err = jpeg_std_error(&jerr);
+
+	jpeg_create_compress(&compress);
+}
+
+EncoderLibJpeg::Strip::~Strip()
+{
+	jpeg_destroy_compress(&compress);
+	free(buffer);
+}
+
 EncoderLibJpeg::EncoderLibJpeg()
 {
 	/* \todo Expand error handling coverage with a custom handler. */
@@ -86,108 +142,269 @@ int EncoderLibJpeg::configure(const StreamConfiguration &cfg)
 	if (info.colorSpace == JCS_UNKNOWN)
 		return -ENOTSUP;
 
-	compress_.image_width = cfg.size.width;
-	compress_.image_height = cfg.size.height;
-	compress_.in_color_space = info.colorSpace;
-
-	compress_.input_components = info.colorSpace == JCS_GRAYSCALE ? 1 : 3;
-
-	jpeg_set_defaults(&compress_);
+	width_ = cfg.size.width;
+	height_ = cfg.size.height;
+	colorSpace_ = info.colorSpace;
 
 	pixelFormatInfo_ = &info.pixelFormatInfo;
 
 	nv_ = pixelFormatInfo_->numPlanes() == 2;
 	nvSwap_ = info.nvSwap;
 
+	if (nv_) {
+		unsigned int c_stride = pixelFormatInfo_->stride(width_, 1);
+
+		horzSubSample_ = 2 * width_ / c_stride;
+		vertSubSample_ = pixelFormatInfo_->planes[1].verticalSubSampling;
+	}
+
+	/*
+	 * Split the image in strips. Small images are encoded in a single
+	 * strip, without restart markers.
+	 */
+	strips_.clear();
+
+	setup(&compress_, height_);
+
+	unsigned int mcuHeight = compress_.comp_info[0].v_samp_factor * DCTSIZE;
+	unsigned int mcuRows = (height_ + mcuHeight - 1) / mcuHeight;
+	unsigned int numStrips = std::min({ std::max(std::thread::hardware_concurrency(), 1u),
+					     kMaxStrips, mcuRows / kRestartCycle });
+
+	if (numStrips > 1) {
+		stripMcuRows_ = (mcuRows + numStrips - 1) / numStrips;
+		stripMcuRows_ = (stripMcuRows_ + kRestartCycle - 1) / kRestartCycle * kRestartCycle;
+		stripHeight_ = stripMcuRows_ * mcuHeight;
+		numStrips = (mcuRows + stripMcuRows_ - 1) / stripMcuRows_;
+	}
+
+	if (numStrips > 1) {
+		setup(&compress_, stripHeight_);
+
+		for (unsigned int i = 1; i < numStrips; ++i) {
+			std::unique_ptr<Strip> strip = std::make_unique<Strip>();
+			strip->firstRow = i * stripHeight_;
+			setup(&strip->compress,
+			      std::min(stripHeight_, height_ - strip->firstRow));
+			strips_.push_back(std::move(strip));
+		}
+	}
+
+	mappings_.clear();
+
 	return 0;
 }
 
-void EncoderLibJpeg::compressRGB(Span<const uint8_t> frame)
+/*
+ * Configure a compressor for a strip of the given height. The strips share
+ * the image width, format and encoding parameters, and use one restart
+ * interval per MCU row when the image is split.
+ */
+void EncoderLibJpeg::setup(struct jpeg_compress_struct *compress,
+			   unsigned int height)
+{
+	compress->image_width = width_;
+	compress->image_height = height;
+	compress->in_color_space = colorSpace_;
+
+	compress->input_components = colorSpace_ == JCS_GRAYSCALE ? 1 : 3;
+
+	jpeg_set_defaults(compress);
+
+	/*
+	 * NV formats are passed to libjpeg as raw, already downsampled, data.
+	 * The sampling factors must match the subsampling of the chroma plane.
+	 */
+	if (nv_) {
+		compress->raw_data_in = TRUE;
+
+		compress->comp_info[0].h_samp_factor = horzSubSample_;
+		compress->comp_info[0].v_samp_factor = vertSubSample_;
+		for (unsigned int i = 1; i < 3; ++i) {
+			compress->comp_info[i].h_samp_factor = 1;
+			compress->comp_info[i].v_samp_factor = 1;
+		}
+	}
+
+	if (height < height_)
+		compress->restart_in_rows = 1;
+}
+
+void EncoderLibJpeg::compressRGB(struct jpeg_compress_struct *compress,
+				 Span<const uint8_t> frame,
+				 unsigned int firstRow)
 {
 	unsigned char *src = const_cast<unsigned char *>(frame.data());
 	/* \todo Stride information should come from buffer configuration. */
-	unsigned int stride = pixelFormatInfo_->stride(compress_.image_width, 0);
+	unsigned int stride = pixelFormatInfo_->stride(width_, 0);
 
 	JSAMPROW row_pointer[1];
 
-	while (compress_.next_scanline < compress_.image_height) {
-		row_pointer[0] = &src[compress_.next_scanline * stride];
-		jpeg_write_scanlines(&compress_, row_pointer, 1);
+	while (compress->next_scanline < compress->image_height) {
+		row_pointer[0] = &src[(firstRow + compress->next_scanline) * stride];
+		jpeg_write_scanlines(compress, row_pointer, 1);
 	}
 }
 
 /*
  * Compress the incoming buffer from a supported NV format.
- * This naively unpacks the semi-planar NV12 to a YUV888 format for libjpeg.
+ *
+ * The luma rows are given to libjpeg in place, and only the interleaved chroma
+ * samples of each iMCU row are unpacked to separate Cb and Cr buffers, padded
+ * to a whole number of blocks. Rows past the bottom of the image replicate the
+ * last one.
  */
-void EncoderLibJpeg::compressNV(Span<const uint8_t> frame)
+void EncoderLibJpeg::compressNV(struct jpeg_compress_struct *compress,
+				Span<const uint8_t> frame,
+				unsigned int firstRow)
 {
-	uint8_t tmprowbuf[compress_.image_width * 3];
+	unsigned int y_stride = pixelFormatInfo_->stride(width_, 0);
+	unsigned int c_stride = pixelFormatInfo_->stride(width_, 1);
 
-	/*
-	 * \todo Use the raw api, and only unpack the cb/cr samples to new line
-	 * buffers. If possible, see if we can set appropriate pixel strides
-	 * too to save even that copy.
-	 *
-	 * Possible hints at:
-	 * https://sourceforge.net/p/libjpeg/mailman/message/30815123/
-	 */
-	unsigned int y_stride = pixelFormatInfo_->stride(compress_.image_width, 0);
-	unsigned int c_stride = pixelFormatInfo_->stride(compress_.image_width, 1);
-
-	unsigned int horzSubSample = 2 * compress_.image_width / c_stride;
-	unsigned int vertSubSample = pixelFormatInfo_->planes[1].verticalSubSampling;
-
-	unsigned int c_inc = horzSubSample == 1 ? 2 : 0;
+	unsigned int c_width = width_ / horzSubSample_;
+	unsigned int c_padded = (c_width + DCTSIZE - 1) / DCTSIZE * DCTSIZE;
 	unsigned int cb_pos = nvSwap_ ? 1 : 0;
 	unsigned int cr_pos = nvSwap_ ? 0 : 1;
 
-	const unsigned char *src = frame.data();
-	const unsigned char *src_c = src + y_stride * compress_.image_height;
+	unsigned int mcuHeight = vertSubSample_ * DCTSIZE;
+	unsigned int height = compress->image_height;
+	unsigned int c_height = (height + vertSubSample_ - 1) / vertSubSample_;
 
-	JSAMPROW row_pointer[1];
-	row_pointer[0] = &tmprowbuf[0];
-
-	for (unsigned int y = 0; y < compress_.image_height; y++) {
-		unsigned char *dst = &tmprowbuf[0];
-
-		const unsigned char *src_y = src + y * compress_.image_width;
-		const unsigned char *src_cb = src_c + (y / vertSubSample) * c_stride + cb_pos;
-		const unsigned char *src_cr = src_c + (y / vertSubSample) * c_stride + cr_pos;
-
-		for (unsigned int x = 0; x < compress_.image_width; x += 2) {
-			dst[0] = *src_y;
-			dst[1] = *src_cb;
-			dst[2] = *src_cr;
-			src_y++;
-			src_cb += c_inc;
-			src_cr += c_inc;
-			dst += 3;
-
-			dst[0] = *src_y;
-			dst[1] = *src_cb;
-			dst[2] = *src_cr;
-			src_y++;
-			src_cb += 2;
-			src_cr += 2;
-			dst += 3;
+	unsigned char *src = const_cast<unsigned char *>(frame.data());
+	const unsigned char *src_c = src + y_stride * height_ +
+				     firstRow / vertSubSample_ * c_stride;
+
+	std::vector<uint8_t> chroma(2 * DCTSIZE * c_padded);
+
+	JSAMPROW y_rows[2 * DCTSIZE];
+	JSAMPROW cb_rows[DCTSIZE];
+	JSAMPROW cr_rows[DCTSIZE];
+	JSAMPARRAY planes[3] = { y_rows, cb_rows, cr_rows };
+
+	for (unsigned int i = 0; i < DCTSIZE; i++) {
+		cb_rows[i] = &chroma[i * c_padded];
+		cr_rows[i] = &chroma[(DCTSIZE + i) * c_padded];
+	}
+
+	for (unsigned int row = 0; row < height; row += mcuHeight) {
+		for (unsigned int i = 0; i < mcuHeight; i++) {
+			unsigned int y = std::min(row + i, height - 1);
+			y_rows[i] = src + (firstRow + y) * y_stride;
+		}
+
+		for (unsigned int i = 0; i < DCTSIZE; i++) {
+			unsigned int y = std::min(row / vertSubSample_ + i, c_height - 1);
+			const unsigned char *src_cbcr = src_c + y * c_stride;
+			unsigned char *cb = cb_rows[i];
+			unsigned char *cr = cr_rows[i];
+
+			for (unsigned int x = 0; x < c_width; x++) {
+				cb[x] = src_cbcr[2 * x + cb_pos];
+				cr[x] = src_cbcr[2 * x + cr_pos];
+			}
+
+			std::fill(cb + c_width, cb + c_padded, cb[c_width - 1]);
+			std::fill(cr + c_width, cr + c_padded, cr[c_width - 1]);
 		}
 
-		jpeg_write_scanlines(&compress_, row_pointer, 1);
+		jpeg_write_raw_data(compress, planes, mcuHeight);
+	}
+}
+
+void EncoderLibJpeg::encodeStrip(Strip *strip, Span<const uint8_t> frame,
+				 unsigned int quality)
+{
+	unsigned char *buffer = strip->buffer;
+	unsigned long size = strip->capacity;
+
+	jpeg_set_quality(&strip->compress, quality, TRUE);
+	jpeg_mem_dest(&strip->compress, &buffer, &size);
+
+	jpeg_start_compress(&strip->compress, TRUE);
+
+	if (nv_)
+		compressNV(&strip->compress, frame, strip->firstRow);
+	else
+		compressRGB(&strip->compress, frame, strip->firstRow);
+
+	jpeg_finish_compress(&strip->compress);
+
+	/* libjpeg allocates a new buffer when the current one is too small. */
+	if (buffer != strip->buffer) {
+		free(strip->buffer);
+		strip->buffer = buffer;
+		strip->capacity = size;
 	}
+
+	strip->size = size;
 }
 
-int EncoderLibJpeg::encode(const FrameBuffer &source, Span<uint8_t> dest,
+/*
+ * Append the scan data of the strips to the JPEG stream of the first strip,
+ * stored in the destination with the given size, separated by restart
+ * markers. Return the size of the resulting stream.
+ */
+int EncoderLibJpeg::stitch(Span<uint8_t> destination, unsigned long size)
+{
+	uint8_t *data = destination.data();
+
+	/* Update the image height in the frame header. */
+	size_t sof = findMarker(data, size, kMarkerSOF0);
+	if (!sof) {
+		LOG(JPEG, Error) << "Frame header not found";
+		return -EINVAL;
+	}
+
+	data[sof + 5] = height_ >> 8;
+	data[sof + 6] = height_ & 0xff;
+
+	/* Drop the EOI marker, and replace it once all strips are added. */
+	size -= 2;
+
+	for (unsigned int i = 0; i < strips_.size(); ++i) {
+		const Strip *strip = strips_[i].get();
+
+		size_t sos = findMarker(strip->buffer, strip->size, kMarkerSOS);
+		if (!sos) {
+			LOG(JPEG, Error) << "Scan header not found in strip " << i + 1;
+			return -EINVAL;
+		}
+
+		size_t offset = sos + 2 + ((strip->buffer[sos + 2] << 8) |
+					   strip->buffer[sos + 3]);
+		size_t length = strip->size - 2 - offset;
+
+		if (size + 2 + length + 2 > destination.size()) {
+			LOG(JPEG, Error) << "Destination buffer too small";
+			return -ENOSPC;
+		}
+
+		unsigned int intervals = (i + 1) * stripMcuRows_;
+
+		data[size++] = 0xff;
+		data[size++] = JPEG_RST0 + (intervals - 1) % kRestartCycle;
+
+		memcpy(&data[size], &strip->buffer[offset], length);
+		size += length;
+	}
+
+	data[size++] = 0xff;
+	data[size++] = JPEG_EOI;
+
+	return size;
+}
+
+int EncoderLibJpeg::encode(const FrameBuffer &source, CameraBuffer *destination,
 			   Span<const uint8_t> exifData, unsigned int quality)
 {
-	MappedFrameBuffer frame(&source, PROT_READ);
-	if (!frame.isValid()) {
-		LOG(JPEG, Error) << "Failed to map FrameBuffer : "
-				 << strerror(frame.error());
-		return frame.error();
+	const MappedBuffer *frame = mappings_.map(&source, PROT_READ);
+	if (!frame) {
+		LOG(JPEG, Error) << "Failed to map FrameBuffer";
+		return -EINVAL;
 	}
 
-	return encode(frame.maps()[0], dest, exifData, quality);
+	MappedBuffer::CpuAccess access(frame, PROT_READ);
+	return encode(frame->maps()[0], destination->plane(0), exifData, quality);
 }
 
 int EncoderLibJpeg::encode(Span<const uint8_t> src, Span<uint8_t> dest,
@@ -196,6 +413,11 @@ int EncoderLibJpeg::encode(Span<const uint8_t> src, Span<uint8_t> dest,
 	unsigned char *destination = dest.data();
 	unsigned long size = dest.size();
 
+	std::vector<std::thread> threads;
+	for (std::unique_ptr<Strip> &strip : strips_)
+		threads.emplace_back(&EncoderLibJpeg::encodeStrip, this,
+				     strip.get(), src, quality);
+
 	jpeg_set_quality(&compress_, quality, TRUE);
 
 	/*
@@ -216,15 +438,27 @@ int EncoderLibJpeg::encode(Span<const uint8_t> src, Span<uint8_t> dest,
 				  static_cast<const JOCTET *>(exifData.data()),
 				  exifData.size());
 
-	LOG(JPEG, Debug) << "JPEG Encode Starting:" << compress_.image_width
-			 << "x" << compress_.image_height;
+	LOG(JPEG, Debug) << "JPEG Encode Starting:" << width_ << "x" << height_
+			 << " in " << strips_.size() + 1 << " strips";
 
 	if (nv_)
-		compressNV(src);
+		compressNV(&compress_, src, 0);
 	else
-		compressRGB(src);
+		compressRGB(&compress_, src, 0);
 
 	jpeg_finish_compress(&compress_);
 
-	return size;
+	for (std::thread &thread : threads)
+		thread.join();
+
+	if (strips_.empty())
+		return size;
+
+	if (destination != dest.data()) {
+		LOG(JPEG, Error) << "Destination buffer too small";
+		free(destination);
+		return -ENOSPC;
+	}
+
+	return stitch(dest, size);
 }
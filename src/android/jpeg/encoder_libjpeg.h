@@ -9,6 +9,9 @@
 
 #include "encoder.h"
 
+#include <memory>
+#include <vector>
+
 #include "libcamera/internal/buffer.h"
 #include "libcamera/internal/formats.h"
 
@@ -22,7 +25,7 @@ public:
 
 	int configure(const libcamera::StreamConfiguration &cfg) override;
 	int encode(const libcamera::FrameBuffer &source,
-		   libcamera::Span<uint8_t> destination,
+		   CameraBuffer *destination,
 		   libcamera::Span<const uint8_t> exifData,
 		   unsigned int quality) override;
 	int encode(libcamera::Span<const uint8_t> source,
@@ -31,16 +34,51 @@ public:
 		   unsigned int quality);
 
 private:
-	void compressRGB(libcamera::Span<const uint8_t> frame);
-	void compressNV(libcamera::Span<const uint8_t> frame);
+	struct Strip {
+		Strip();
+		~Strip();
+
+		struct jpeg_compress_struct compress;
+		struct jpeg_error_mgr jerr;
+
+		unsigned int firstRow;
+		unsigned char *buffer;
+		unsigned long capacity;
+		unsigned long size;
+	};
+
+	void setup(struct jpeg_compress_struct *compress, unsigned int height);
+	void encodeStrip(Strip *strip, libcamera::Span<const uint8_t> frame,
+			 unsigned int quality);
+	int stitch(libcamera::Span<uint8_t> destination, unsigned long size);
+
+	void compressRGB(struct jpeg_compress_struct *compress,
+			 libcamera::Span<const uint8_t> frame,
+			 unsigned int firstRow);
+	void compressNV(struct jpeg_compress_struct *compress,
+			libcamera::Span<const uint8_t> frame,
+			unsigned int firstRow);
 
 	struct jpeg_compress_struct compress_;
 	struct jpeg_error_mgr jerr_;
 
 	const libcamera::PixelFormatInfo *pixelFormatInfo_;
 
+	unsigned int width_;
+	unsigned int height_;
+	J_COLOR_SPACE colorSpace_;
+
 	bool nv_;
 	bool nvSwap_;
+	unsigned int horzSubSample_;
+	unsigned int vertSubSample_;
+
+	/* Strips following the first one, encoded concurrently. */
+	std::vector<std::unique_ptr<Strip>> strips_;
+	unsigned int stripHeight_;
+	unsigned int stripMcuRows_;
+
+	libcamera::MappedBufferCache mappings_;
 };
 
 #endif /* __ANDROID_JPEG_ENCODER_LIBJPEG_H__ */
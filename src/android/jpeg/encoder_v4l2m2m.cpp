@@ -0,0 +1,376 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * encoder_v4l2m2m.cpp - JPEG encoding using a V4L2 memory-to-memory encoder
+ */
+
+#include "encoder_v4l2m2m.h"
+
+#include <chrono>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/buffer.h>
+
+#include "libcamera/internal/formats.h"
+#include "libcamera/internal/log.h"
+#include "libcamera/internal/v4l2_videodevice.h"
+
+#include "../camera_buffer.h"
+
+using namespace libcamera;
+using namespace std::chrono_literals;
+
+LOG_DECLARE_CATEGORY(JPEG)
+
+namespace {
+
+/*
+ * Maximum time to encode a frame. Encoders take a few tens of milliseconds
+ * for the largest images, a longer delay indicates a hung device.
+ */
+constexpr auto kEncodeTimeout = 1000ms;
+
+constexpr uint8_t kMarkerSOI = 0xd8;
+
+/* Size of the APP1 marker and length fields preceding the Exif data. */
+constexpr unsigned int kApp1HeaderSize = 4;
+
+} /* namespace */
+
+/*
+ * \class EncoderV4L2M2M
+ * \brief JPEG encoder backed by a V4L2 memory-to-memory device
+ *
+ * The encoder imports the dmabuf of the source frame buffer on the V4L2
+ * output queue, and the dmabuf of the gralloc blob buffer on the V4L2 capture
+ * queue, so that neither the image nor the compressed stream is copied by the
+ * CPU. The Exif data is then inserted after the SOI marker of the JPEG stream
+ * produced by the device.
+ *
+ * The V4L2 devices deliver completion events to the thread that opened them.
+ * As encoding is requested from the post-processing workers, which don't run
+ * an event loop, the device is operated from an internal thread, and encode()
+ * waits for the buffers to complete.
+ */
+
+EncoderV4L2M2M::EncoderV4L2M2M()
+	: quality_(0), frameSize_(0), queuedBuffers_(0)
+{
+	thread_.start();
+	moveToThread(&thread_);
+}
+
+EncoderV4L2M2M::~EncoderV4L2M2M()
+{
+	invokeMethod(&EncoderV4L2M2M::close, ConnectionTypeBlocking);
+
+	thread_.exit();
+	thread_.wait();
+}
+
+int EncoderV4L2M2M::configure(const StreamConfiguration &cfg)
+{
+	return invokeMethod(&EncoderV4L2M2M::open, ConnectionTypeBlocking, &cfg);
+}
+
+/*
+ * Search for a V4L2 memory-to-memory device able to encode the configured
+ * format to JPEG. Devices are not registered with the libcamera device
+ * enumerator, the video device nodes are probed directly.
+ */
+int EncoderV4L2M2M::open(const StreamConfiguration *cfg)
+{
+	close();
+
+	DIR *dir = opendir("/dev");
+	if (!dir)
+		return -errno;
+
+	std::vector<std::string> nodes;
+	while (struct dirent *entry = readdir(dir)) {
+		if (!strncmp(entry->d_name, "video", 5))
+			nodes.push_back(std::string("/dev/") + entry->d_name);
+	}
+
+	closedir(dir);
+
+	for (const std::string &node : nodes) {
+		if (!openDevice(node, *cfg)) {
+			LOG(JPEG, Info) << "Using hardware JPEG encoder " << node;
+			return 0;
+		}
+	}
+
+	return -ENODEV;
+}
+
+int EncoderV4L2M2M::openDevice(const std::string &deviceNode,
+			       const StreamConfiguration &cfg)
+{
+	/* Skip non-M2M devices without logging errors from V4L2VideoDevice. */
+	int fd = ::open(deviceNode.c_str(), O_RDWR | O_NONBLOCK);
+	if (fd < 0)
+		return -errno;
+
+	V4L2Capability caps;
+	int ret = ioctl(fd, VIDIOC_QUERYCAP, &caps);
+	::close(fd);
+
+	if (ret < 0 || !caps.isM2M())
+		return -ENODEV;
+
+	m2m_ = std::make_unique<V4L2M2MDevice>(deviceNode);
+
+	ret = m2m_->open();
+	if (ret < 0) {
+		m2m_.reset();
+		return ret;
+	}
+
+	V4L2VideoDevice *output = m2m_->output();
+	V4L2VideoDevice *capture = m2m_->capture();
+
+	/* Encoders produce either of the JPEG and Motion-JPEG 4CCs. */
+	V4L2VideoDevice::Formats captureFormats = capture->formats();
+	for (uint32_t fourcc : { V4L2_PIX_FMT_JPEG, V4L2_PIX_FMT_MJPEG }) {
+		if (captureFormats.count(V4L2PixelFormat(fourcc))) {
+			outputFormat_ = V4L2PixelFormat(fourcc);
+			break;
+		}
+	}
+
+	V4L2PixelFormat inputFormat = output->toV4L2PixelFormat(cfg.pixelFormat);
+
+	if (!outputFormat_.isValid() || !output->formats().count(inputFormat)) {
+		close();
+		return -ENODEV;
+	}
+
+	/*
+	 * The source buffers are produced with the natural stride of the
+	 * format. Devices requiring a larger alignment can't import them.
+	 */
+	V4L2DeviceFormat format;
+	format.fourcc = inputFormat;
+	format.size = cfg.size;
+
+	ret = output->setFormat(&format);
+	if (ret < 0 || format.fourcc != inputFormat || format.size != cfg.size ||
+	    format.planesCount != 1 ||
+	    format.planes[0].bpl != PixelFormatInfo::info(cfg.pixelFormat).stride(cfg.size.width, 0)) {
+		LOG(JPEG, Debug)
+			<< "Encoder " << deviceNode << " doesn't support "
+			<< cfg.toString();
+		close();
+		return -EINVAL;
+	}
+
+	frameSize_ = format.planes[0].size;
+
+	format = {};
+	format.fourcc = outputFormat_;
+	format.size = cfg.size;
+
+	ret = capture->setFormat(&format);
+	if (ret < 0 || format.fourcc != outputFormat_ || format.size != cfg.size) {
+		LOG(JPEG, Debug)
+			<< "Encoder " << deviceNode << " doesn't support "
+			<< cfg.size.toString() << " JPEG output";
+		close();
+		return -EINVAL;
+	}
+
+	output->bufferReady.connect(this, &EncoderV4L2M2M::encoderInputDone);
+	capture->bufferReady.connect(this, &EncoderV4L2M2M::encoderOutputDone);
+
+	ret = output->importBuffers(1);
+	if (ret < 0) {
+		close();
+		return ret;
+	}
+
+	ret = capture->importBuffers(1);
+	if (ret < 0) {
+		close();
+		return ret;
+	}
+
+	ret = restart();
+	if (ret < 0) {
+		close();
+		return ret;
+	}
+
+	quality_ = 0;
+
+	return 0;
+}
+
+void EncoderV4L2M2M::close()
+{
+	if (!m2m_)
+		return;
+
+	m2m_->capture()->streamOff();
+	m2m_->output()->streamOff();
+	m2m_->capture()->releaseBuffers();
+	m2m_->output()->releaseBuffers();
+
+	m2m_.reset();
+	outputFormat_ = {};
+}
+
+/*
+ * Stop and restart streaming, to return the queued buffers and recover from
+ * errors.
+ */
+int EncoderV4L2M2M::restart()
+{
+	m2m_->capture()->streamOff();
+	m2m_->output()->streamOff();
+
+	int ret = m2m_->output()->streamOn();
+	if (ret < 0)
+		return ret;
+
+	return m2m_->capture()->streamOn();
+}
+
+int EncoderV4L2M2M::queueBuffers(FrameBuffer *input, FrameBuffer *output,
+				 unsigned int quality)
+{
+	if (quality != quality_) {
+		const ControlInfoMap &controls = m2m_->capture()->controls();
+		if (controls.find(V4L2_CID_JPEG_COMPRESSION_QUALITY) != controls.end()) {
+			ControlList ctrls(controls);
+			ctrls.set(V4L2_CID_JPEG_COMPRESSION_QUALITY,
+				  static_cast<int32_t>(quality));
+			m2m_->capture()->setControls(&ctrls);
+		}
+
+		quality_ = quality;
+	}
+
+	int ret = m2m_->output()->queueBuffer(input);
+	if (ret < 0)
+		return ret;
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		queuedBuffers_++;
+	}
+
+	ret = m2m_->capture()->queueBuffer(output);
+	if (ret < 0) {
+		restart();
+		return ret;
+	}
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		queuedBuffers_++;
+	}
+
+	return 0;
+}
+
+void EncoderV4L2M2M::encoderInputDone([[maybe_unused]] FrameBuffer *buffer)
+{
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		queuedBuffers_--;
+	}
+
+	cond_.notify_one();
+}
+
+void EncoderV4L2M2M::encoderOutputDone([[maybe_unused]] FrameBuffer *buffer)
+{
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		queuedBuffers_--;
+	}
+
+	cond_.notify_one();
+}
+
+int EncoderV4L2M2M::encode(const FrameBuffer &source, CameraBuffer *destination,
+			   Span<const uint8_t> exifData, unsigned int quality)
+{
+	Span<uint8_t> dest = destination->plane(0);
+	size_t exifSize = exifData.size() ? exifData.size() + kApp1HeaderSize : 0;
+
+	if (exifData.size() > 0xffff - 2) {
+		LOG(JPEG, Error) << "Exif data too large";
+		return -EINVAL;
+	}
+
+	/*
+	 * Wrap the dmabufs of the source and destination in single-plane frame
+	 * buffers, as the source planes are stored contiguously, and leave room
+	 * for the Exif data in the destination.
+	 */
+	const FrameBuffer::Plane &sourcePlane = source.planes()[0];
+	if (sourcePlane.length < frameSize_ || destination->fd(0) < 0 ||
+	    dest.size() <= exifSize) {
+		LOG(JPEG, Debug) << "Buffers can't be imported by the encoder";
+		return -EINVAL;
+	}
+
+	FrameBuffer::Plane inputPlane;
+	inputPlane.fd = sourcePlane.fd;
+	inputPlane.length = frameSize_;
+
+	FrameBuffer::Plane outputPlane;
+	outputPlane.fd = FileDescriptor::borrow(destination->fd(0));
+	outputPlane.length = dest.size() - exifSize;
+
+	FrameBuffer input({ inputPlane });
+	FrameBuffer output({ outputPlane });
+
+	int ret = invokeMethod(&EncoderV4L2M2M::queueBuffers,
+			       ConnectionTypeBlocking, &input, &output, quality);
+	if (ret < 0) {
+		LOG(JPEG, Error) << "Failed to queue buffers: " << strerror(-ret);
+		return ret;
+	}
+
+	bool completed;
+	{
+		std::unique_lock<std::mutex> locker(mutex_);
+		completed = cond_.wait_for(locker, kEncodeTimeout,
+					   [&]() { return !queuedBuffers_; });
+	}
+
+	if (!completed) {
+		LOG(JPEG, Error) << "Encoding timed out";
+		invokeMethod(&EncoderV4L2M2M::restart, ConnectionTypeBlocking);
+		return -ETIMEDOUT;
+	}
+
+	const FrameMetadata &metadata = output.metadata();
+	if (metadata.status != FrameMetadata::FrameSuccess ||
+	    metadata.planes().empty()) {
+		LOG(JPEG, Error) << "Encoding failed";
+		return -EIO;
+	}
+
+	size_t size = metadata.planes()[0].bytesused;
+	uint8_t *data = dest.data();
+
+	if (size < 2 || data[0] != 0xff || data[1] != kMarkerSOI) {
+		LOG(JPEG, Error) << "Encoder produced an invalid JPEG stream";
+		return -EIO;
+	}
+
+	/* Store Exif data in the JPEG_APP1 data block, after the SOI marker. */
+	return insertExif(dest, size, exifData);
+}
@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * encoder_v4l2m2m.h - JPEG encoding using a V4L2 memory-to-memory encoder
+ */
+#ifndef __ANDROID_JPEG_ENCODER_V4L2M2M_H__
+#define __ANDROID_JPEG_ENCODER_V4L2M2M_H__
+
+#include "encoder.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <libcamera/object.h>
+
+#include "libcamera/internal/thread.h"
+#include "libcamera/internal/v4l2_pixelformat.h"
+
+namespace libcamera {
+class V4L2M2MDevice;
+} /* namespace libcamera */
+
+class EncoderV4L2M2M : public Encoder, public libcamera::Object
+{
+public:
+	EncoderV4L2M2M();
+	~EncoderV4L2M2M();
+
+	int configure(const libcamera::StreamConfiguration &cfg) override;
+	int encode(const libcamera::FrameBuffer &source,
+		   CameraBuffer *destination,
+		   libcamera::Span<const uint8_t> exifData,
+		   unsigned int quality) override;
+
+private:
+	int open(const libcamera::StreamConfiguration *cfg);
+	int openDevice(const std::string &deviceNode,
+		       const libcamera::StreamConfiguration &cfg);
+	void close();
+	int restart();
+
+	int queueBuffers(libcamera::FrameBuffer *input,
+			 libcamera::FrameBuffer *output,
+			 unsigned int quality);
+	void encoderInputDone(libcamera::FrameBuffer *buffer);
+	void encoderOutputDone(libcamera::FrameBuffer *buffer);
+
+	libcamera::Thread thread_;
+
+	/* Accessed in the encoder thread only. */
+	std::unique_ptr<libcamera::V4L2M2MDevice> m2m_;
+	libcamera::V4L2PixelFormat outputFormat_;
+	unsigned int quality_;
+
+	unsigned int frameSize_;
+
+	/* Protects the number of buffers queued to the encoder. */
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	unsigned int queuedBuffers_;
+};
+
+#endif /* __ANDROID_JPEG_ENCODER_V4L2M2M_H__ */
@@ -41,6 +41,11 @@ enum class _ExifTag {
  * Calls to generate() must check the return code to determine if any error
  * occurred during the construction of the Exif data, and if successful the
  * data can be obtained using the data() method.
+ *
+ * An instance can be reused to generate the Exif data of multiple images.
+ * Properties that stay constant are then set once, and properties that vary
+ * between images are updated before each call to generate(). Entries whose
+ * size doesn't change are updated in place without any memory allocation.
  */
 Exif::Exif()
 	: valid_(false), data_(nullptr), order_(EXIF_BYTE_ORDER_INTEL),
@@ -125,8 +130,17 @@ ExifEntry *Exif::createEntry(ExifIfd ifd, ExifTag tag, ExifFormat format,
 {
 	ExifContent *content = data_->ifd[ifd];
 
-	/* Replace any existing entry with the same tag. */
+	/*
+	 * Reuse any existing entry with the same tag and layout, or replace
+	 * it otherwise.
+	 */
 	ExifEntry *existing = exif_content_get_entry(content, tag);
+	if (existing && existing->format == format &&
+	    existing->components == components && existing->size == size) {
+		exif_entry_ref(existing);
+		return existing;
+	}
+
 	exif_content_remove_entry(content, existing);
 
 	ExifEntry *entry = exif_entry_new_mem(mem_);
@@ -155,6 +169,14 @@ ExifEntry *Exif::createEntry(ExifIfd ifd, ExifTag tag, ExifFormat format,
 	return entry;
 }
 
+void Exif::removeEntry(ExifIfd ifd, ExifTag tag)
+{
+	ExifContent *content = data_->ifd[ifd];
+	ExifEntry *entry = exif_content_get_entry(content, tag);
+	if (entry)
+		exif_content_remove_entry(content, entry);
+}
+
 void Exif::setByte(ExifIfd ifd, ExifTag tag, uint8_t item)
 {
 	ExifEntry *entry = createEntry(ifd, tag, EXIF_FORMAT_BYTE, 1, 1);
@@ -355,6 +377,12 @@ void Exif::setGPSDateTimestamp(time_t timestamp)
 		    ts);
 }
 
+void Exif::removeGPSDateTimestamp()
+{
+	removeEntry(EXIF_IFD_GPS, static_cast<ExifTag>(EXIF_TAG_GPS_DATE_STAMP));
+	removeEntry(EXIF_IFD_GPS, static_cast<ExifTag>(EXIF_TAG_GPS_TIME_STAMP));
+}
+
 std::tuple<int, int, int> Exif::degreesToDMS(double decimalDegrees)
 {
 	int degrees = std::trunc(decimalDegrees);
@@ -402,12 +430,27 @@ void Exif::setGPSLocation(const double *coords)
 		    ExifRational{ static_cast<ExifLong>(std::abs(coords[2])), 1 });
 }
 
+void Exif::removeGPSLocation()
+{
+	removeEntry(EXIF_IFD_GPS, static_cast<ExifTag>(EXIF_TAG_GPS_LATITUDE_REF));
+	removeEntry(EXIF_IFD_GPS, static_cast<ExifTag>(EXIF_TAG_GPS_LATITUDE));
+	removeEntry(EXIF_IFD_GPS, static_cast<ExifTag>(EXIF_TAG_GPS_LONGITUDE_REF));
+	removeEntry(EXIF_IFD_GPS, static_cast<ExifTag>(EXIF_TAG_GPS_LONGITUDE));
+	removeEntry(EXIF_IFD_GPS, static_cast<ExifTag>(EXIF_TAG_GPS_ALTITUDE_REF));
+	removeEntry(EXIF_IFD_GPS, static_cast<ExifTag>(EXIF_TAG_GPS_ALTITUDE));
+}
+
 void Exif::setGPSMethod(const std::string &method)
 {
 	setString(EXIF_IFD_GPS, static_cast<ExifTag>(EXIF_TAG_GPS_PROCESSING_METHOD),
 		  EXIF_FORMAT_UNDEFINED, method, NoEncoding);
 }
 
+void Exif::removeGPSMethod()
+{
+	removeEntry(EXIF_IFD_GPS, static_cast<ExifTag>(EXIF_TAG_GPS_PROCESSING_METHOD));
+}
+
 void Exif::setOrientation(int orientation)
 {
 	int value;
@@ -444,6 +487,14 @@ void Exif::setThumbnail(Span<const unsigned char> thumbnail,
 	setShort(EXIF_IFD_0, EXIF_TAG_COMPRESSION, compression);
 }
 
+void Exif::removeThumbnail()
+{
+	data_->data = nullptr;
+	data_->size = 0;
+
+	removeEntry(EXIF_IFD_0, EXIF_TAG_COMPRESSION);
+}
+
 void Exif::setFocalLength(float length)
 {
 	ExifRational rational = { static_cast<ExifLong>(length * 1000), 1000 };
@@ -462,6 +513,11 @@ void Exif::setAperture(float size)
 	setRational(EXIF_IFD_EXIF, EXIF_TAG_FNUMBER, rational);
 }
 
+void Exif::removeAperture()
+{
+	removeEntry(EXIF_IFD_EXIF, EXIF_TAG_FNUMBER);
+}
+
 void Exif::setISO(uint16_t iso)
 {
 	setShort(EXIF_IFD_EXIF, EXIF_TAG_ISO_SPEED_RATINGS, iso);
@@ -510,6 +566,7 @@ std::u16string Exif::utf8ToUtf16(const std::string &str)
 	if (exifData_) {
 		free(exifData_);
 		exifData_ = nullptr;
+		size_ = 0;
 	}
 
 	if (!valid_) {
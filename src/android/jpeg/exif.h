@@ -61,15 +61,20 @@ public:
 	void setSize(const libcamera::Size &size);
 	void setThumbnail(libcamera::Span<const unsigned char> thumbnail,
 			  Compression compression);
+	void removeThumbnail();
 	void setTimestamp(time_t timestamp, std::chrono::milliseconds msec);
 
 	void setGPSDateTimestamp(time_t timestamp);
+	void removeGPSDateTimestamp();
 	void setGPSLocation(const double *coords);
+	void removeGPSLocation();
 	void setGPSMethod(const std::string &method);
+	void removeGPSMethod();
 
 	void setFocalLength(float length);
 	void setExposureTime(uint64_t nsec);
 	void setAperture(float size);
+	void removeAperture();
 	void setISO(uint16_t iso);
 	void setFlash(Flash flash);
 	void setWhiteBalance(WhiteBalance wb);
@@ -81,6 +86,7 @@ private:
 	ExifEntry *createEntry(ExifIfd ifd, ExifTag tag);
 	ExifEntry *createEntry(ExifIfd ifd, ExifTag tag, ExifFormat format,
 			       unsigned long components, unsigned int size);
+	void removeEntry(ExifIfd ifd, ExifTag tag);
 
 	void setByte(ExifIfd ifd, ExifTag tag, uint8_t item);
 	void setShort(ExifIfd ifd, ExifTag tag, uint16_t item);
@@ -7,11 +7,15 @@
 
 #include "post_processor_jpeg.h"
 
+#include <algorithm>
 #include <chrono>
+#include <functional>
+#include <thread>
 
 #include "../camera_device.h"
 #include "../camera_metadata.h"
 #include "encoder_libjpeg.h"
+#include "encoder_v4l2m2m.h"
 #include "exif.h"
 
 #include <libcamera/formats.h>
@@ -28,6 +32,8 @@ PostProcessorJpeg::PostProcessorJpeg(CameraDevice *const device)
 {
 }
 
+PostProcessorJpeg::~PostProcessorJpeg() = default;
+
 int PostProcessorJpeg::configure(const StreamConfiguration &inCfg,
 				 const StreamConfiguration &outCfg)
 {
@@ -44,6 +50,32 @@ int PostProcessorJpeg::configure(const StreamConfiguration &inCfg,
 	streamSize_ = outCfg.size;
 
 	thumbnailer_.configure(inCfg.size, inCfg.pixelFormat);
+	thumbnailSize_ = {};
+
+	/*
+	 * Set the EXIF fields that don't change between frames once, process()
+	 * only updates the per-frame fields in place.
+	 */
+	exif_ = std::make_unique<Exif>();
+	exif_->setMake(cameraDevice_->maker());
+	exif_->setModel(cameraDevice_->model());
+	exif_->setSize(streamSize_);
+	exif_->setISO(100);
+	exif_->setFlash(Exif::Flash::FlashNotPresent);
+	exif_->setWhiteBalance(Exif::WhiteBalance::Auto);
+	exif_->setFocalLength(1.0);
+
+	/*
+	 * Prefer a hardware encoder when available, and keep the libjpeg
+	 * encoder to fall back to if the hardware fails to encode a frame.
+	 */
+	fallbackEncoder_.reset();
+
+	encoder_ = std::make_unique<EncoderV4L2M2M>();
+	if (!encoder_->configure(inCfg)) {
+		fallbackEncoder_ = std::make_unique<EncoderLibJpeg>();
+		return fallbackEncoder_->configure(inCfg);
+	}
 
 	encoder_ = std::make_unique<EncoderLibJpeg>();
 
@@ -55,26 +87,34 @@ void PostProcessorJpeg::generateThumbnail(const FrameBuffer &source,
 					  unsigned int quality,
 					  std::vector<unsigned char> *thumbnail)
 {
-	/* Stores the raw scaled-down thumbnail bytes. */
-	std::vector<unsigned char> rawThumbnail;
+	thumbnail->clear();
 
-	thumbnailer_.createThumbnail(source, targetSize, &rawThumbnail);
+	/*
+	 * Store the raw scaled-down thumbnail bytes in a buffer reused across
+	 * frames, to avoid allocating it for every capture.
+	 */
+	thumbnailer_.createThumbnail(source, targetSize, &rawThumbnail_);
 
-	StreamConfiguration thCfg;
-	thCfg.size = targetSize;
-	thCfg.pixelFormat = thumbnailer_.pixelFormat();
-	int ret = thumbnailEncoder_.configure(thCfg);
+	if (targetSize != thumbnailSize_) {
+		StreamConfiguration thCfg;
+		thCfg.size = targetSize;
+		thCfg.pixelFormat = thumbnailer_.pixelFormat();
+		if (thumbnailEncoder_.configure(thCfg))
+			return;
+
+		thumbnailSize_ = targetSize;
+	}
 
-	if (!rawThumbnail.empty() && !ret) {
+	if (!rawThumbnail_.empty()) {
 		/*
 		 * \todo Avoid value-initialization of all elements of the
 		 * vector.
 		 */
-		thumbnail->resize(rawThumbnail.size());
+		thumbnail->resize(rawThumbnail_.size());
 
-		int jpeg_size = thumbnailEncoder_.encode(rawThumbnail,
+		int jpeg_size = thumbnailEncoder_.encode(rawThumbnail_,
 							 *thumbnail, {}, quality);
-		thumbnail->resize(jpeg_size);
+		thumbnail->resize(std::max(jpeg_size, 0));
 
 		LOG(JPEG, Debug)
 			<< "Thumbnail compress returned "
@@ -95,10 +135,8 @@ int PostProcessorJpeg::process(const FrameBuffer &source,
 	camera_metadata_ro_entry_t entry;
 	int ret;
 
-	/* Set EXIF metadata for various tags. */
-	Exif exif;
-	exif.setMake(cameraDevice_->maker());
-	exif.setModel(cameraDevice_->model());
+	/* Update the per-frame EXIF metadata. */
+	Exif &exif = *exif_;
 
 	ret = requestMetadata.getEntry(ANDROID_JPEG_ORIENTATION, &entry);
 
@@ -106,7 +144,6 @@ int PostProcessorJpeg::process(const FrameBuffer &source,
 	resultMetadata->addEntry(ANDROID_JPEG_ORIENTATION, jpegOrientation);
 	exif.setOrientation(jpegOrientation);
 
-	exif.setSize(streamSize_);
 	/*
 	 * We set the frame's EXIF timestamp as the time of encode.
 	 * Since the precision we need for EXIF timestamp is only one
@@ -119,19 +156,26 @@ int PostProcessorJpeg::process(const FrameBuffer &source,
 	ret = requestMetadata.getEntry(ANDROID_LENS_APERTURE, &entry);
 	if (ret)
 		exif.setAperture(*entry.data.f);
-	exif.setISO(100);
-	exif.setFlash(Exif::Flash::FlashNotPresent);
-	exif.setWhiteBalance(Exif::WhiteBalance::Auto);
-
-	exif.setFocalLength(1.0);
+	else
+		exif.removeAperture();
 
 	ret = requestMetadata.getEntry(ANDROID_JPEG_GPS_TIMESTAMP, &entry);
 	if (ret) {
 		exif.setGPSDateTimestamp(*entry.data.i64);
 		resultMetadata->addEntry(ANDROID_JPEG_GPS_TIMESTAMP,
 					 *entry.data.i64);
+	} else {
+		exif.removeGPSDateTimestamp();
 	}
 
+	exif.removeThumbnail();
+
+	/*
+	 * The thumbnail is generated and compressed in a separate thread,
+	 * concurrently with the encoding of the main image.
+	 */
+	std::thread thumbnailThread;
+
 	ret = requestMetadata.getEntry(ANDROID_JPEG_THUMBNAIL_SIZE, &entry);
 	if (ret) {
 		const int32_t *data = entry.data.i32;
@@ -142,12 +186,11 @@ int PostProcessorJpeg::process(const FrameBuffer &source,
 		uint8_t quality = ret ? *entry.data.u8 : 95;
 		resultMetadata->addEntry(ANDROID_JPEG_THUMBNAIL_QUALITY, quality);
 
-		if (thumbnailSize != Size(0, 0)) {
-			std::vector<unsigned char> thumbnail;
-			generateThumbnail(source, thumbnailSize, quality, &thumbnail);
-			if (!thumbnail.empty())
-				exif.setThumbnail(thumbnail, Exif::Compression::JPEG);
-		}
+		if (thumbnailSize != Size(0, 0))
+			thumbnailThread = std::thread(&PostProcessorJpeg::generateThumbnail,
+						      this, std::cref(source),
+						      thumbnailSize, quality,
+						      &thumbnail_);
 
 		resultMetadata->addEntry(ANDROID_JPEG_THUMBNAIL_SIZE, data, 2);
 	}
@@ -157,6 +200,8 @@ int PostProcessorJpeg::process(const FrameBuffer &source,
 		exif.setGPSLocation(entry.data.d);
 		resultMetadata->addEntry(ANDROID_JPEG_GPS_COORDINATES,
 					 entry.data.d, 3);
+	} else {
+		exif.removeGPSLocation();
 	}
 
 	ret = requestMetadata.getEntry(ANDROID_JPEG_GPS_PROCESSING_METHOD, &entry);
@@ -165,26 +210,61 @@ int PostProcessorJpeg::process(const FrameBuffer &source,
 		exif.setGPSMethod(method);
 		resultMetadata->addEntry(ANDROID_JPEG_GPS_PROCESSING_METHOD,
 					 entry.data.u8, entry.count);
+	} else {
+		exif.removeGPSMethod();
 	}
 
-	if (exif.generate() != 0)
-		LOG(JPEG, Error) << "Failed to generate valid EXIF data";
-
 	ret = requestMetadata.getEntry(ANDROID_JPEG_QUALITY, &entry);
 	const uint8_t quality = ret ? *entry.data.u8 : 95;
 	resultMetadata->addEntry(ANDROID_JPEG_QUALITY, quality);
 
-	int jpeg_size = encoder_->encode(source, destination->plane(0),
-					 exif.data(), quality);
+	/*
+	 * When a thumbnail is being generated, encode the main image without
+	 * EXIF data, and insert the EXIF data in the JPEG stream once the
+	 * thumbnail is available.
+	 */
+	const bool deferExif = thumbnailThread.joinable();
+	Span<const uint8_t> exifData;
+
+	if (!deferExif) {
+		if (exif.generate() != 0)
+			LOG(JPEG, Error) << "Failed to generate valid EXIF data";
+		exifData = exif.data();
+	}
+
+	int jpeg_size = encoder_->encode(source, destination, exifData,
+					 quality);
+	if (jpeg_size < 0 && fallbackEncoder_) {
+		LOG(JPEG, Warning) << "Hardware encoding failed, using libjpeg";
+		jpeg_size = fallbackEncoder_->encode(source, destination,
+						     exifData, quality);
+	}
+
+	size_t jpegBufferSize =
+		destination->jpegBufferSize(cameraDevice_->maxJpegBufferSize())
+		- sizeof(struct camera3_jpeg_blob);
+
+	if (deferExif) {
+		thumbnailThread.join();
+
+		if (!thumbnail_.empty())
+			exif.setThumbnail(thumbnail_, Exif::Compression::JPEG);
+
+		if (exif.generate() != 0) {
+			LOG(JPEG, Error) << "Failed to generate valid EXIF data";
+		} else if (jpeg_size >= 0) {
+			Span<uint8_t> dest = destination->plane(0).first(jpegBufferSize);
+			jpeg_size = Encoder::insertExif(dest, jpeg_size, exif.data());
+		}
+	}
+
 	if (jpeg_size < 0) {
 		LOG(JPEG, Error) << "Failed to encode stream image";
 		return jpeg_size;
 	}
 
 	/* Fill in the JPEG blob header. */
-	uint8_t *resultPtr = destination->plane(0).data()
-			   + destination->jpegBufferSize(cameraDevice_->maxJpegBufferSize())
-			   - sizeof(struct camera3_jpeg_blob);
+	uint8_t *resultPtr = destination->plane(0).data() + jpegBufferSize;
 	auto *blob = reinterpret_cast<struct camera3_jpeg_blob *>(resultPtr);
 	blob->jpeg_blob_id = CAMERA3_JPEG_BLOB_ID;
 	blob->jpeg_size = jpeg_size;
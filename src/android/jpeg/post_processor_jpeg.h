@@ -16,11 +16,13 @@
 #include "libcamera/internal/buffer.h"
 
 class CameraDevice;
+class Exif;
 
 class PostProcessorJpeg : public PostProcessor
 {
 public:
 	PostProcessorJpeg(CameraDevice *const device);
+	~PostProcessorJpeg();
 
 	int configure(const libcamera::StreamConfiguration &incfg,
 		      const libcamera::StreamConfiguration &outcfg) override;
@@ -37,9 +39,18 @@ private:
 
 	CameraDevice *const cameraDevice_;
 	std::unique_ptr<Encoder> encoder_;
+	std::unique_ptr<Encoder> fallbackEncoder_;
 	libcamera::Size streamSize_;
 	EncoderLibJpeg thumbnailEncoder_;
+	libcamera::Size thumbnailSize_;
 	Thumbnailer thumbnailer_;
+
+	/* EXIF data, with the fields constant for the stream set once. */
+	std::unique_ptr<Exif> exif_;
+
+	/* Thumbnail buffers, reused across frames. */
+	std::vector<unsigned char> rawThumbnail_;
+	std::vector<unsigned char> thumbnail_;
 };
 
 #endif /* __ANDROID_POST_PROCESSOR_JPEG_H__ */
@@ -7,6 +7,8 @@
 
 #include "thumbnailer.h"
 
+#include <libyuv/scale.h>
+
 #include <libcamera/formats.h>
 
 #include "libcamera/internal/log.h"
@@ -24,6 +26,7 @@ void Thumbnailer::configure(const Size &sourceSize, PixelFormat pixelFormat)
 {
 	sourceSize_ = sourceSize;
 	pixelFormat_ = pixelFormat;
+	mappings_.clear();
 
 	if (pixelFormat_ != formats::NV12) {
 		LOG(Thumbnailer, Error)
@@ -39,11 +42,9 @@ void Thumbnailer::createThumbnail(const FrameBuffer &source,
 				  const Size &targetSize,
 				  std::vector<unsigned char> *destination)
 {
-	MappedFrameBuffer frame(&source, PROT_READ);
-	if (!frame.isValid()) {
-		LOG(Thumbnailer, Error)
-			<< "Failed to map FrameBuffer : "
-			<< strerror(frame.error());
+	const MappedBuffer *frame = mappings_.map(&source, PROT_READ);
+	if (!frame) {
+		LOG(Thumbnailer, Error) << "Failed to map FrameBuffer";
 		return;
 	}
 
@@ -59,35 +60,27 @@ void Thumbnailer::createThumbnail(const FrameBuffer &source,
 
 	ASSERT(tw % 2 == 0 && th % 2 == 0);
 
-	/* Image scaling block implementing nearest-neighbour algorithm. */
-	unsigned char *src = static_cast<unsigned char *>(frame.maps()[0].data());
-	unsigned char *srcC = src + sh * sw;
-	unsigned char *srcCb, *srcCr;
-	unsigned char *dstY, *srcY;
+	MappedBuffer::CpuAccess access(frame, PROT_READ);
+
+	/*
+	 * Scale with a box filter, which averages all the source pixels
+	 * covered by each destination pixel for large downscaling ratios.
+	 * The destination is resized in place, and reuses the memory of the
+	 * previous thumbnail when the size hasn't changed.
+	 */
+	const uint8_t *src = frame->maps()[0].data();
+	const uint8_t *srcC = src + sh * sw;
 
 	size_t dstSize = (th * tw) + ((th / 2) * tw);
 	destination->resize(dstSize);
-	unsigned char *dst = destination->data();
-	unsigned char *dstC = dst + th * tw;
-
-	for (unsigned int y = 0; y < th; y += 2) {
-		unsigned int sourceY = (sh * y + th / 2) / th;
-
-		dstY = dst + y * tw;
-		srcY = src + sw * sourceY;
-		srcCb = srcC + (sourceY / 2) * sw + 0;
-		srcCr = srcC + (sourceY / 2) * sw + 1;
-
-		for (unsigned int x = 0; x < tw; x += 2) {
-			unsigned int sourceX = (sw * x + tw / 2) / tw;
-
-			dstY[x] = srcY[sourceX];
-			dstY[tw + x] = srcY[sw + sourceX];
-			dstY[x + 1] = srcY[sourceX + 1];
-			dstY[tw + x + 1] = srcY[sw + sourceX + 1];
-
-			dstC[(y / 2) * tw + x + 0] = srcCb[(sourceX / 2) * 2];
-			dstC[(y / 2) * tw + x + 1] = srcCr[(sourceX / 2) * 2];
-		}
+	uint8_t *dst = destination->data();
+	uint8_t *dstC = dst + th * tw;
+
+	int ret = libyuv::NV12Scale(src, sw, srcC, sw, sw, sh,
+				    dst, tw, dstC, tw, tw, th,
+				    libyuv::FilterMode::kFilterBox);
+	if (ret) {
+		LOG(Thumbnailer, Error) << "Failed to scale thumbnail: " << ret;
+		destination->clear();
 	}
 }
@@ -29,6 +29,8 @@ private:
 	libcamera::Size sourceSize_;
 
 	bool valid_;
+
+	libcamera::MappedBufferCache mappings_;
 };
 
 #endif /* __ANDROID_JPEG_THUMBNAILER_H__ */
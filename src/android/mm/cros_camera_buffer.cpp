@@ -30,6 +30,9 @@ public:
 
 	Span<uint8_t> plane(unsigned int plane);
 
+	int fd(unsigned int plane) const;
+	unsigned int stride(unsigned int plane) const;
+
 	size_t jpegBufferSize(size_t maxJpegBufferSize) const;
 
 private:
@@ -129,6 +132,22 @@ Span<uint8_t> CameraBuffer::Private::plane(unsigned int plane)
 		 bufferManager_->GetPlaneSize(handle_, plane) };
 }
 
+int CameraBuffer::Private::fd(unsigned int plane) const
+{
+	if (plane >= static_cast<unsigned int>(handle_->numFds))
+		return -1;
+
+	return handle_->data[plane];
+}
+
+unsigned int CameraBuffer::Private::stride(unsigned int plane) const
+{
+	if (plane >= numPlanes_)
+		return 0;
+
+	return bufferManager_->GetPlaneStride(handle_, plane);
+}
+
 size_t CameraBuffer::Private::jpegBufferSize([[maybe_unused]] size_t maxJpegBufferSize) const
 {
 	return bufferManager_->GetPlaneSize(handle_, 0);
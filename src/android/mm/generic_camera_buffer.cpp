@@ -11,6 +11,7 @@
 
 #include "libcamera/internal/buffer.h"
 #include "libcamera/internal/log.h"
+#include "libcamera/internal/performance.h"
 
 using namespace libcamera;
 
@@ -30,12 +31,18 @@ public:
 
 	Span<uint8_t> plane(unsigned int plane);
 
+	int fd(unsigned int plane) const;
+	unsigned int stride(unsigned int plane) const;
+
 	size_t jpegBufferSize(size_t maxJpegBufferSize) const;
+
+private:
+	buffer_handle_t handle_;
 };
 
 CameraBuffer::Private::Private(CameraBuffer *cameraBuffer,
 			       buffer_handle_t camera3Buffer, int flags)
-	: Extensible::Private(cameraBuffer)
+	: Extensible::Private(cameraBuffer), handle_(camera3Buffer)
 {
 	maps_.reserve(camera3Buffer->numFds);
 	error_ = 0;
@@ -61,6 +68,7 @@ CameraBuffer::Private::Private(CameraBuffer *cameraBuffer,
 
 		maps_.emplace_back(static_cast<uint8_t *>(address),
 				   static_cast<size_t>(length));
+		PerformanceRecorder::instance()->bufferMapped(length);
 	}
 }
 
@@ -81,6 +89,23 @@ Span<uint8_t> CameraBuffer::Private::plane(unsigned int plane)
 	return maps_[plane];
 }
 
+int CameraBuffer::Private::fd(unsigned int plane) const
+{
+	if (plane >= static_cast<unsigned int>(handle_->numFds))
+		return -1;
+
+	return handle_->data[plane];
+}
+
+/*
+ * The generic gralloc buffer handles are opaque, the stride of the planes
+ * can't be queried and is reported as unknown.
+ */
+unsigned int CameraBuffer::Private::stride([[maybe_unused]] unsigned int plane) const
+{
+	return 0;
+}
+
 size_t CameraBuffer::Private::jpegBufferSize(size_t maxJpegBufferSize) const
 {
 	return std::min<unsigned int>(maps_[0].size(),
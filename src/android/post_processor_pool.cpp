@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * post_processor_pool.cpp - Run post-processing tasks on worker threads
+ */
+
+#include "post_processor_pool.h"
+
+#include <algorithm>
+
+/*
+ * \class PostProcessorPool
+ * \brief Run post-processing tasks outside of the camera manager thread
+ *
+ * Post-processing, such as JPEG encoding, takes much longer than a frame
+ * interval for large images. The PostProcessorPool runs the post-processing
+ * tasks on a set of worker threads, to avoid delaying the completion of the
+ * requests that don't need it.
+ *
+ * Each task is associated with the CameraStream instances it processes, whose
+ * post-processors are not thread-safe. Tasks sharing a stream are run one at a
+ * time, in the order they have been queued, while tasks using different
+ * streams run concurrently.
+ */
+
+PostProcessorPool::PostProcessorPool(unsigned int numWorkers)
+	: running_(0), stopping_(false)
+{
+	workers_.resize(std::max(numWorkers, 1u));
+	for (std::thread &thread : workers_)
+		thread = std::thread(&PostProcessorPool::worker, this);
+}
+
+PostProcessorPool::~PostProcessorPool()
+{
+	flush();
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		stopping_ = true;
+	}
+
+	cond_.notify_all();
+
+	for (std::thread &thread : workers_)
+		thread.join();
+}
+
+void PostProcessorPool::queue(const std::vector<CameraStream *> &streams,
+			      std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		tasks_.push_back({ streams, std::move(task) });
+	}
+
+	cond_.notify_one();
+}
+
+/*
+ * Wait until all the queued tasks have completed.
+ */
+void PostProcessorPool::flush()
+{
+	std::unique_lock<std::mutex> locker(mutex_);
+	idle_.wait(locker, [&]() { return tasks_.empty() && !running_; });
+}
+
+/*
+ * Find the first task whose streams are neither used by a running task nor
+ * by a task queued before it. Must be called with the mutex held.
+ */
+std::list<PostProcessorPool::Task>::iterator PostProcessorPool::nextTask()
+{
+	std::set<CameraStream *> blocked = busy_;
+
+	for (auto it = tasks_.begin(); it != tasks_.end(); ++it) {
+		bool runnable = std::none_of(it->streams.begin(), it->streams.end(),
+					     [&](CameraStream *stream) {
+						     return blocked.count(stream);
+					     });
+		if (runnable)
+			return it;
+
+		blocked.insert(it->streams.begin(), it->streams.end());
+	}
+
+	return tasks_.end();
+}
+
+void PostProcessorPool::worker()
+{
+	std::unique_lock<std::mutex> locker(mutex_);
+
+	while (true) {
+		auto it = tasks_.end();
+
+		cond_.wait(locker, [&]() {
+			it = nextTask();
+			return it != tasks_.end() || stopping_;
+		});
+
+		if (it == tasks_.end())
+			break;
+
+		Task task = std::move(*it);
+		tasks_.erase(it);
+
+		busy_.insert(task.streams.begin(), task.streams.end());
+		running_++;
+
+		locker.unlock();
+		task.run();
+		locker.lock();
+
+		for (CameraStream *stream : task.streams)
+			busy_.erase(stream);
+		running_--;
+
+		/* Tasks waiting for the streams may now run. */
+		cond_.notify_all();
+
+		if (tasks_.empty() && !running_)
+			idle_.notify_all();
+	}
+}
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * post_processor_pool.h - Run post-processing tasks on worker threads
+ */
+#ifndef __ANDROID_POST_PROCESSOR_POOL_H__
+#define __ANDROID_POST_PROCESSOR_POOL_H__
+
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+class CameraStream;
+
+class PostProcessorPool
+{
+public:
+	PostProcessorPool(unsigned int numWorkers);
+	~PostProcessorPool();
+
+	void queue(const std::vector<CameraStream *> &streams,
+		   std::function<void()> task);
+	void flush();
+
+private:
+	struct Task {
+		std::vector<CameraStream *> streams;
+		std::function<void()> run;
+	};
+
+	void worker();
+	std::list<Task>::iterator nextTask();
+
+	std::vector<std::thread> workers_;
+
+	/* Protects all the members below. */
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	std::condition_variable idle_;
+	std::list<Task> tasks_;
+	std::set<CameraStream *> busy_;
+	unsigned int running_;
+	bool stopping_;
+};
+
+#endif /* __ANDROID_POST_PROCESSOR_POOL_H__ */
@@ -7,6 +7,10 @@
 
 #include "post_processor_yuv.h"
 
+#include <algorithm>
+#include <numeric>
+
+#include <libyuv/planar_functions.h>
 #include <libyuv/scale.h>
 
 #include <libcamera/formats.h>
@@ -20,13 +24,55 @@ using namespace libcamera;
 
 LOG_DEFINE_CATEGORY(YUV)
 
+namespace {
+
+/* Maximum number of threads scaling bands of a frame, including the caller. */
+constexpr unsigned int kMaxWorkers = 4;
+
+/* Number of bands per thread, to balance the load at the end of frames. */
+constexpr unsigned int kBandsPerWorker = 2;
+
+} /* namespace */
+
+/*
+ * \class PostProcessorYuv
+ * \brief Scale and convert YUV frames with libyuv
+ *
+ * The post-processor produces NV12 or NV21 frames from NV12, NV21 or YUYV
+ * frames of the same or a larger size. Frames are split in bands of rows,
+ * scaled in parallel by the calling thread and a set of worker threads.
+ *
+ * Bands start on rows where the scaling ratio maps a whole number of source
+ * rows to a whole number of destination rows, such that box filtering each
+ * band separately gives the same result as filtering the whole frame.
+ */
+
+PostProcessorYuv::PostProcessorYuv()
+	: sourcePlanes_(0), job_(nullptr), stopping_(false)
+{
+}
+
+PostProcessorYuv::~PostProcessorYuv()
+{
+	stopWorkers();
+}
+
 int PostProcessorYuv::configure(const StreamConfiguration &inCfg,
 				const StreamConfiguration &outCfg)
 {
-	if (inCfg.pixelFormat != outCfg.pixelFormat) {
-		LOG(YUV, Error) << "Pixel format conversion is not supported"
-				<< " (from " << inCfg.pixelFormat.toString()
-				<< " to " << outCfg.pixelFormat.toString() << ")";
+	if (inCfg.pixelFormat != formats::NV12 &&
+	    inCfg.pixelFormat != formats::NV21 &&
+	    inCfg.pixelFormat != formats::YUYV) {
+		LOG(YUV, Error) << "Unsupported source format " << inCfg.pixelFormat
+				<< " (only NV12, NV21 and YUYV are supported)";
+		return -EINVAL;
+	}
+
+	if (outCfg.pixelFormat != formats::NV12 &&
+	    outCfg.pixelFormat != formats::NV21) {
+		LOG(YUV, Error) << "Unsupported destination format "
+				<< outCfg.pixelFormat
+				<< " (only NV12 and NV21 are supported)";
 		return -EINVAL;
 	}
 
@@ -37,13 +83,21 @@ int PostProcessorYuv::configure(const StreamConfiguration &inCfg,
 		return -EINVAL;
 	}
 
-	if (inCfg.pixelFormat != formats::NV12) {
-		LOG(YUV, Error) << "Unsupported format " << inCfg.pixelFormat
-				<< " (only NV12 is supported)";
-		return -EINVAL;
-	}
+	stopWorkers();
+
+	sourceFormat_ = inCfg.pixelFormat;
+	destinationFormat_ = outCfg.pixelFormat;
+	sourcePlanes_ = PixelFormatInfo::info(sourceFormat_).numPlanes();
 
 	calculateLengths(inCfg, outCfg);
+
+	unsigned int numWorkers =
+		std::min(std::max(std::thread::hardware_concurrency(), 1u),
+			 kMaxWorkers);
+	calculateBands(numWorkers);
+	startWorkers(std::min<unsigned int>(numWorkers, bands_.size()) - 1);
+
+	sourceMappings_.clear();
 	return 0;
 }
 
@@ -55,36 +109,170 @@ int PostProcessorYuv::process(const FrameBuffer &source,
 	if (!isValidBuffers(source, *destination))
 		return -EINVAL;
 
-	const MappedFrameBuffer sourceMapped(&source, PROT_READ);
-	if (!sourceMapped.isValid()) {
+	const MappedBuffer *sourceMapped = sourceMappings_.map(&source, PROT_READ);
+	if (!sourceMapped) {
 		LOG(YUV, Error) << "Failed to mmap camera frame buffer";
 		return -EINVAL;
 	}
 
-	int ret = libyuv::NV12Scale(sourceMapped.maps()[0].data(),
-				    sourceStride_[0],
-				    sourceMapped.maps()[1].data(),
-				    sourceStride_[1],
-				    sourceSize_.width, sourceSize_.height,
-				    destination->plane(0).data(),
-				    destinationStride_[0],
-				    destination->plane(1).data(),
-				    destinationStride_[1],
-				    destinationSize_.width,
-				    destinationSize_.height,
-				    libyuv::FilterMode::kFilterBilinear);
-	if (ret) {
-		LOG(YUV, Error) << "Failed NV12 scaling: " << ret;
-		return -EINVAL;
+	MappedBuffer::CpuAccess access(sourceMapped, PROT_READ);
+
+	Job job;
+	for (unsigned int i = 0; i < 2; i++) {
+		job.source[i] = i < sourcePlanes_ ? sourceMapped->maps()[i].data()
+						  : nullptr;
+		job.destination[i] = destination->plane(i).data();
 	}
+	job.nextBand = 0;
+	job.pendingBands = bands_.size();
+
+	std::unique_lock<std::mutex> locker(mutex_);
+
+	job_ = &job;
+	cond_.notify_all();
+
+	processBands(locker, &scratch_);
+
+	done_.wait(locker, [&]() { return !job.pendingBands; });
+	job_ = nullptr;
 
 	return 0;
 }
 
+void PostProcessorYuv::startWorkers(unsigned int numWorkers)
+{
+	stopping_ = false;
+
+	workers_.resize(numWorkers);
+	for (std::thread &thread : workers_)
+		thread = std::thread(&PostProcessorYuv::worker, this);
+}
+
+void PostProcessorYuv::stopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		stopping_ = true;
+	}
+
+	cond_.notify_all();
+
+	for (std::thread &thread : workers_)
+		thread.join();
+
+	workers_.clear();
+}
+
+void PostProcessorYuv::worker()
+{
+	/* Scratch memory for the conversion of YUYV bands. */
+	std::vector<uint8_t> scratch;
+
+	std::unique_lock<std::mutex> locker(mutex_);
+
+	while (true) {
+		cond_.wait(locker, [&]() {
+			return stopping_ || (job_ && job_->nextBand < bands_.size());
+		});
+
+		if (stopping_)
+			break;
+
+		processBands(locker, &scratch);
+	}
+}
+
+/*
+ * Process bands of the current job until all have been picked. Must be called
+ * with the mutex held.
+ */
+void PostProcessorYuv::processBands(std::unique_lock<std::mutex> &locker,
+				    std::vector<uint8_t> *scratch)
+{
+	Job *job = job_;
+
+	while (job->nextBand < bands_.size()) {
+		const Band &band = bands_[job->nextBand++];
+
+		locker.unlock();
+		processBand(*job, band, scratch);
+		locker.lock();
+
+		if (!--job->pendingBands)
+			done_.notify_all();
+	}
+}
+
+void PostProcessorYuv::processBand(const Job &job, const Band &band,
+				   std::vector<uint8_t> *scratch)
+{
+	const unsigned int sw = sourceSize_.width;
+	const unsigned int dw = destinationSize_.width;
+
+	uint8_t *dstY = job.destination[0] +
+			band.destinationY * destinationStride_[0];
+	uint8_t *dstUV = job.destination[1] +
+			 band.destinationY / 2 * destinationStride_[1];
+
+	const uint8_t *srcY = nullptr;
+	const uint8_t *srcUV = nullptr;
+	unsigned int srcStrideY = 0;
+	unsigned int srcStrideUV = 0;
+	bool swapUV;
+
+	if (sourceFormat_ == formats::YUYV) {
+		const uint8_t *src = job.source[0] + band.sourceY * sourceStride_[0];
+
+		swapUV = destinationFormat_ == formats::NV21;
+
+		if (sourceSize_ == destinationSize_) {
+			libyuv::YUY2ToNV12(src, sourceStride_[0],
+					   dstY, destinationStride_[0],
+					   dstUV, destinationStride_[1],
+					   dw, band.destinationHeight);
+		} else {
+			/* Convert the band to NV12 before scaling it. */
+			scratch->resize(sw * band.sourceHeight * 3 / 2);
+
+			uint8_t *y = scratch->data();
+			uint8_t *uv = y + sw * band.sourceHeight;
+
+			libyuv::YUY2ToNV12(src, sourceStride_[0], y, sw, uv, sw,
+					   sw, band.sourceHeight);
+
+			srcY = y;
+			srcUV = uv;
+			srcStrideY = sw;
+			srcStrideUV = sw;
+		}
+	} else {
+		srcY = job.source[0] + band.sourceY * sourceStride_[0];
+		srcUV = job.source[1] + band.sourceY / 2 * sourceStride_[1];
+		srcStrideY = sourceStride_[0];
+		srcStrideUV = sourceStride_[1];
+
+		swapUV = sourceFormat_ != destinationFormat_;
+	}
+
+	/* The chroma order doesn't matter for scaling. */
+	if (srcY)
+		libyuv::NV12Scale(srcY, srcStrideY, srcUV, srcStrideUV,
+				  sw, band.sourceHeight,
+				  dstY, destinationStride_[0],
+				  dstUV, destinationStride_[1],
+				  dw, band.destinationHeight,
+				  libyuv::FilterMode::kFilterBox);
+
+	if (swapUV)
+		libyuv::SwapUVPlane(dstUV, destinationStride_[1],
+				    dstUV, destinationStride_[1],
+				    dw / 2, band.destinationHeight / 2);
+}
+
 bool PostProcessorYuv::isValidBuffers(const FrameBuffer &source,
 				      const CameraBuffer &destination) const
 {
-	if (source.planes().size() != 2) {
+	if (source.planes().size() != sourcePlanes_) {
 		LOG(YUV, Error) << "Invalid number of source planes: "
 				<< source.planes().size();
 		return false;
@@ -96,11 +284,11 @@ bool PostProcessorYuv::isValidBuffers(const FrameBuffer &source,
 	}
 
 	if (source.planes()[0].length < sourceLength_[0] ||
-	    source.planes()[1].length < sourceLength_[1]) {
+	    (sourcePlanes_ > 1 && source.planes()[1].length < sourceLength_[1])) {
 		LOG(YUV, Error)
 			<< "The source planes lengths are too small, actual size: {"
 			<< source.planes()[0].length << ", "
-			<< source.planes()[1].length
+			<< source.planes().back().length
 			<< "}, expected size: {"
 			<< sourceLength_[0] << ", "
 			<< sourceLength_[1] << "}";
@@ -140,3 +328,42 @@ void PostProcessorYuv::calculateLengths(const StreamConfiguration &inCfg,
 			((destinationSize_.height + vertSubSample - 1) / vertSubSample);
 	}
 }
+
+void PostProcessorYuv::calculateBands(unsigned int numWorkers)
+{
+	const unsigned int sh = sourceSize_.height;
+	const unsigned int dh = destinationSize_.height;
+
+	/*
+	 * Compute the smallest number of rows that scale exactly, rounded to
+	 * an even number of rows for the chroma subsampling.
+	 */
+	unsigned int gcd = std::gcd(sh, dh);
+	unsigned int sourceUnit = sh / gcd;
+	unsigned int destinationUnit = dh / gcd;
+	if (sourceUnit % 2 || destinationUnit % 2) {
+		sourceUnit *= 2;
+		destinationUnit *= 2;
+	}
+
+	bands_.clear();
+
+	unsigned int units = dh / destinationUnit;
+	if (units < 2) {
+		bands_.push_back({ 0, sh, 0, dh });
+		return;
+	}
+
+	unsigned int numBands = std::min(numWorkers * kBandsPerWorker, units);
+	unsigned int bandUnits = (units + numBands - 1) / numBands;
+
+	for (unsigned int y = 0; y < dh; y += bandUnits * destinationUnit) {
+		Band band;
+		band.sourceY = y / destinationUnit * sourceUnit;
+		band.destinationY = y;
+		band.destinationHeight = std::min(bandUnits * destinationUnit, dh - y);
+		band.sourceHeight = y + band.destinationHeight < dh
+				  ? bandUnits * sourceUnit : sh - band.sourceY;
+		bands_.push_back(band);
+	}
+}
@@ -9,14 +9,23 @@
 
 #include "../post_processor.h"
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+
+#include "libcamera/internal/buffer.h"
 
 class CameraDevice;
 
 class PostProcessorYuv : public PostProcessor
 {
 public:
-	PostProcessorYuv() = default;
+	PostProcessorYuv();
+	~PostProcessorYuv();
 
 	int configure(const libcamera::StreamConfiguration &incfg,
 		      const libcamera::StreamConfiguration &outcfg) override;
@@ -26,10 +35,38 @@ public:
 		    CameraMetadata *metadata) override;
 
 private:
+	/* A band of rows, scaled independently of the other bands. */
+	struct Band {
+		unsigned int sourceY;
+		unsigned int sourceHeight;
+		unsigned int destinationY;
+		unsigned int destinationHeight;
+	};
+
+	struct Job {
+		const uint8_t *source[2];
+		uint8_t *destination[2];
+		unsigned int nextBand;
+		unsigned int pendingBands;
+	};
+
 	bool isValidBuffers(const libcamera::FrameBuffer &source,
 			    const CameraBuffer &destination) const;
 	void calculateLengths(const libcamera::StreamConfiguration &inCfg,
 			      const libcamera::StreamConfiguration &outCfg);
+	void calculateBands(unsigned int numWorkers);
+
+	void startWorkers(unsigned int numWorkers);
+	void stopWorkers();
+	void worker();
+	void processBands(std::unique_lock<std::mutex> &locker,
+			  std::vector<uint8_t> *scratch);
+	void processBand(const Job &job, const Band &band,
+			 std::vector<uint8_t> *scratch);
+
+	libcamera::PixelFormat sourceFormat_;
+	libcamera::PixelFormat destinationFormat_;
+	unsigned int sourcePlanes_;
 
 	libcamera::Size sourceSize_;
 	libcamera::Size destinationSize_;
@@ -37,6 +74,19 @@ private:
 	unsigned int destinationLength_[2] = {};
 	unsigned int sourceStride_[2] = {};
 	unsigned int destinationStride_[2] = {};
+
+	libcamera::MappedBufferCache sourceMappings_;
+
+	std::vector<Band> bands_;
+	std::vector<std::thread> workers_;
+	std::vector<uint8_t> scratch_;
+
+	/* Protects the current job and the stopping flag. */
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	std::condition_variable done_;
+	Job *job_;
+	bool stopping_;
 };
 
 #endif /* __ANDROID_POST_PROCESSOR_YUV_H__ */
@@ -0,0 +1,292 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * benchmark.cpp - Capture performance statistics
+ */
+
+#include "benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <errno.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+
+#include <libcamera/control_ids.h>
+
+using namespace libcamera;
+
+/*
+ * The benchmark measures the request round-trip latency, the regularity of
+ * the frames delivered by the camera, the frames dropped by the pipeline as
+ * gaps in the sequence numbers, and the CPU time consumed by the whole process
+ * per frame, including the libcamera internal threads. When a capture script
+ * sets controls per frame, it also verifies that the metadata of each frame
+ * reports the values requested for that frame.
+ *
+ * All functions are called from the event loop thread, except the completion
+ * time which is sampled by the caller in the request completion handler.
+ */
+
+void Benchmark::Histogram::sort()
+{
+	std::sort(samples_.begin(), samples_.end());
+}
+
+/* The samples must have been sorted. */
+uint64_t Benchmark::Histogram::percentile(unsigned int percent) const
+{
+	if (samples_.empty())
+		return 0;
+
+	size_t index = (samples_.size() - 1) * percent / 100;
+	return samples_[index];
+}
+
+double Benchmark::Histogram::mean() const
+{
+	if (samples_.empty())
+		return 0.0;
+
+	double sum = std::accumulate(samples_.begin(), samples_.end(), 0.0);
+	return sum / samples_.size();
+}
+
+double Benchmark::Histogram::stddev() const
+{
+	if (samples_.size() < 2)
+		return 0.0;
+
+	double avg = mean();
+	double sum = 0.0;
+	for (uint64_t sample : samples_)
+		sum += (sample - avg) * (sample - avg);
+
+	return std::sqrt(sum / (samples_.size() - 1));
+}
+
+uint64_t Benchmark::cpuTime(const struct rusage &usage)
+{
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ULL +
+	       usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+void Benchmark::start()
+{
+	queued_.clear();
+	latency_ = {};
+	requests_ = 0;
+	streams_.clear();
+	controls_.clear();
+
+	getrusage(RUSAGE_SELF, &startUsage_);
+	startTime_ = Clock::now();
+}
+
+void Benchmark::stop()
+{
+	stopTime_ = Clock::now();
+	getrusage(RUSAGE_SELF, &stopUsage_);
+
+	latency_.sort();
+	for (auto &iter : streams_)
+		iter.second.interval.sort();
+}
+
+void Benchmark::requestQueued(const Request *request)
+{
+	queued_[request] = Clock::now();
+}
+
+void Benchmark::requestCompleted(const Request *request, Clock::time_point time)
+{
+	auto iter = queued_.find(request);
+	if (iter == queued_.end())
+		return;
+
+	latency_.add(std::chrono::duration_cast<std::chrono::microseconds>(
+			     time - iter->second).count());
+	queued_.erase(iter);
+	requests_++;
+}
+
+void Benchmark::bufferCompleted(const std::string &streamName,
+				const FrameMetadata &metadata)
+{
+	StreamStats &stats = streams_[streamName];
+
+	if (metadata.status != FrameMetadata::FrameSuccess) {
+		stats.errors++;
+		return;
+	}
+
+	if (stats.frames) {
+		if (metadata.sequence > stats.lastSequence + 1)
+			stats.dropped += metadata.sequence - stats.lastSequence - 1;
+
+		if (metadata.timestamp > stats.lastTimestamp)
+			stats.interval.add((metadata.timestamp - stats.lastTimestamp) / 1000);
+	}
+
+	stats.lastSequence = metadata.sequence;
+	stats.lastTimestamp = metadata.timestamp;
+	stats.frames++;
+}
+
+/*
+ * Numerical values reported in metadata are quantized by the device, to lines
+ * of exposure time or to gain steps. Accept a small relative difference for
+ * them.
+ */
+bool Benchmark::matches(const ControlValue &requested, const ControlValue &reported)
+{
+	if (requested.type() != reported.type() || requested.isArray() ||
+	    reported.isArray())
+		return requested == reported;
+
+	double expected;
+	double actual;
+
+	switch (requested.type()) {
+	case ControlTypeInteger32:
+		expected = requested.get<int32_t>();
+		actual = reported.get<int32_t>();
+		break;
+	case ControlTypeInteger64:
+		expected = requested.get<int64_t>();
+		actual = reported.get<int64_t>();
+		break;
+	case ControlTypeFloat:
+		expected = requested.get<float>();
+		actual = reported.get<float>();
+		break;
+	default:
+		return requested == reported;
+	}
+
+	return std::abs(actual - expected) <= std::abs(expected) * 0.02;
+}
+
+void Benchmark::controlsCompleted(const ControlList &controls,
+				  const ControlList &metadata)
+{
+	for (const auto &[id, value] : controls) {
+		const ControlInfoMap *infoMap = controls.infoMap();
+		const std::string &name = infoMap
+					? infoMap->idmap().at(id)->name()
+					: controls::controls.at(id)->name();
+		ControlStats &stats = controls_[name];
+
+		stats.requested++;
+
+		if (!metadata.contains(id))
+			stats.unreported++;
+		else if (matches(value, metadata.get(id)))
+			stats.applied++;
+		else
+			stats.mismatched++;
+	}
+}
+
+void Benchmark::report(std::ostream &out) const
+{
+	double duration = std::chrono::duration<double>(stopTime_ - startTime_).count();
+	uint64_t cpu = cpuTime(stopUsage_) - cpuTime(startUsage_);
+
+	out << std::fixed << std::setprecision(2);
+	out << "Benchmark: " << requests_ << " requests in " << duration << " s"
+	    << std::endl;
+
+	out << "  request latency (us): p50 " << latency_.percentile(50)
+	    << " p90 " << latency_.percentile(90)
+	    << " p99 " << latency_.percentile(99)
+	    << " max " << latency_.percentile(100) << std::endl;
+
+	out << "  cpu: " << (duration ? cpu / 10000.0 / duration : 0.0) << " %, "
+	    << (requests_ ? cpu / requests_ : 0) << " us/frame" << std::endl;
+
+	for (const auto &[name, stats] : streams_) {
+		out << "  " << name << ": " << stats.frames << " frames, "
+		    << stats.dropped << " dropped, " << stats.errors << " errors"
+		    << std::endl;
+		out << "    frame interval (us): p50 " << stats.interval.percentile(50)
+		    << " p90 " << stats.interval.percentile(90)
+		    << " p99 " << stats.interval.percentile(99)
+		    << " max " << stats.interval.percentile(100)
+		    << " jitter " << stats.interval.stddev() << std::endl;
+	}
+
+	for (const auto &[name, stats] : controls_)
+		out << "  control " << name << ": " << stats.requested
+		    << " frames, " << stats.applied << " applied, "
+		    << stats.mismatched << " mismatched, " << stats.unreported
+		    << " unreported" << std::endl;
+}
+
+/* Write the results as JSON, to be compared across runs by scripts. */
+int Benchmark::writeSummary(const std::string &filename) const
+{
+	std::ofstream file(filename);
+	if (!file.is_open()) {
+		std::cerr << "Failed to open " << filename << std::endl;
+		return -EIO;
+	}
+
+	double duration = std::chrono::duration<double>(stopTime_ - startTime_).count();
+	uint64_t cpu = cpuTime(stopUsage_) - cpuTime(startUsage_);
+
+	auto writeHistogram = [&](const Histogram &histogram) {
+		file << "{ \"count\": " << histogram.count()
+		     << ", \"mean\": " << histogram.mean()
+		     << ", \"stddev\": " << histogram.stddev()
+		     << ", \"p50\": " << histogram.percentile(50)
+		     << ", \"p90\": " << histogram.percentile(90)
+		     << ", \"p99\": " << histogram.percentile(99)
+		     << ", \"max\": " << histogram.percentile(100) << " }";
+	};
+
+	file << std::fixed << std::setprecision(3);
+	file << "{" << std::endl;
+	file << "\t\"duration_s\": " << duration << "," << std::endl;
+	file << "\t\"requests\": " << requests_ << "," << std::endl;
+	file << "\t\"cpu_us\": " << cpu << "," << std::endl;
+	file << "\t\"cpu_us_per_frame\": " << (requests_ ? cpu / requests_ : 0)
+	     << "," << std::endl;
+	file << "\t\"latency_us\": ";
+	writeHistogram(latency_);
+	file << "," << std::endl;
+
+	file << "\t\"streams\": {" << std::endl;
+	for (auto iter = streams_.begin(); iter != streams_.end(); ++iter) {
+		const StreamStats &stats = iter->second;
+
+		file << "\t\t\"" << iter->first << "\": {" << std::endl;
+		file << "\t\t\t\"frames\": " << stats.frames << "," << std::endl;
+		file << "\t\t\t\"dropped\": " << stats.dropped << "," << std::endl;
+		file << "\t\t\t\"errors\": " << stats.errors << "," << std::endl;
+		file << "\t\t\t\"interval_us\": ";
+		writeHistogram(stats.interval);
+		file << std::endl << "\t\t}"
+		     << (std::next(iter) != streams_.end() ? "," : "") << std::endl;
+	}
+	file << "\t}," << std::endl;
+
+	file << "\t\"controls\": {" << std::endl;
+	for (auto iter = controls_.begin(); iter != controls_.end(); ++iter) {
+		const ControlStats &stats = iter->second;
+
+		file << "\t\t\"" << iter->first << "\": { "
+		     << "\"frames\": " << stats.requested
+		     << ", \"applied\": " << stats.applied
+		     << ", \"mismatched\": " << stats.mismatched
+		     << ", \"unreported\": " << stats.unreported << " }"
+		     << (std::next(iter) != controls_.end() ? "," : "") << std::endl;
+	}
+	file << "\t}" << std::endl;
+	file << "}" << std::endl;
+
+	return file.good() ? 0 : -EIO;
+}
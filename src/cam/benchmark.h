@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * benchmark.h - Capture performance statistics
+ */
+#ifndef __CAM_BENCHMARK_H__
+#define __CAM_BENCHMARK_H__
+
+#include <chrono>
+#include <map>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+#include <libcamera/buffer.h>
+#include <libcamera/controls.h>
+#include <libcamera/request.h>
+
+class Benchmark
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	void start();
+	void stop();
+
+	void requestQueued(const libcamera::Request *request);
+	void requestCompleted(const libcamera::Request *request,
+			      Clock::time_point time);
+	void bufferCompleted(const std::string &streamName,
+			     const libcamera::FrameMetadata &metadata);
+	void controlsCompleted(const libcamera::ControlList &controls,
+			       const libcamera::ControlList &metadata);
+
+	void report(std::ostream &out) const;
+	int writeSummary(const std::string &filename) const;
+
+private:
+	class Histogram
+	{
+	public:
+		void add(uint64_t value) { samples_.push_back(value); }
+		void sort();
+
+		size_t count() const { return samples_.size(); }
+		uint64_t percentile(unsigned int percent) const;
+		double mean() const;
+		double stddev() const;
+
+	private:
+		std::vector<uint64_t> samples_;
+	};
+
+	struct StreamStats {
+		/* Interval between frames from the sensor timestamps, in µs. */
+		Histogram interval;
+		uint64_t lastTimestamp = 0;
+		unsigned int lastSequence = 0;
+		unsigned int frames = 0;
+		unsigned int dropped = 0;
+		unsigned int errors = 0;
+	};
+
+	struct ControlStats {
+		/* Frames the control has been set for. */
+		unsigned int requested = 0;
+		/* Frames whose metadata reports the requested value. */
+		unsigned int applied = 0;
+		/* Frames whose metadata reports a different value. */
+		unsigned int mismatched = 0;
+		/* Frames whose metadata doesn't report the control. */
+		unsigned int unreported = 0;
+	};
+
+	static uint64_t cpuTime(const struct rusage &usage);
+	static bool matches(const libcamera::ControlValue &requested,
+			    const libcamera::ControlValue &reported);
+
+	Clock::time_point startTime_;
+	Clock::time_point stopTime_;
+	struct rusage startUsage_;
+	struct rusage stopUsage_;
+
+	std::map<const libcamera::Request *, Clock::time_point> queued_;
+	/* Time from queueing a request to its completion, in µs. */
+	Histogram latency_;
+	unsigned int requests_ = 0;
+
+	std::map<std::string, StreamStats> streams_;
+	std::map<std::string, ControlStats> controls_;
+};
+
+#endif /* __CAM_BENCHMARK_H__ */
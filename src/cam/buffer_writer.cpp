@@ -10,87 +10,187 @@
 #include <iostream>
 #include <sstream>
 #include <string.h>
-#include <sys/mman.h>
 #include <unistd.h>
 
 #include "buffer_writer.h"
 
 using namespace libcamera;
 
+/*
+ * Frames are written to disk by a dedicated thread, to keep storage latency
+ * away from the event loop that queues requests. The thread queues the writes
+ * of all pending frames to the FrameRecorder at once, which batches them with
+ * io_uring when available. The caller must not reuse a buffer until the done
+ * function passed to write() has been called.
+ */
 BufferWriter::BufferWriter(const std::string &pattern)
-	: pattern_(pattern)
+	: pattern_(pattern), containerFd_(-1), containerOffset_(0),
+	  stopping_(false)
 {
+	thread_ = std::thread(&BufferWriter::run, this);
 }
 
 BufferWriter::~BufferWriter()
 {
-	for (auto &iter : mappedBuffers_) {
-		void *memory = iter.second.first;
-		unsigned int length = iter.second.second;
-		munmap(memory, length);
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		stopping_ = true;
 	}
-	mappedBuffers_.clear();
+
+	cond_.notify_one();
+	thread_.join();
+
+	if (containerFd_ != -1)
+		close(containerFd_);
 }
 
+/*
+ * Buffers shall be mapped before the first call to write(), the recorder isn't
+ * accessed by the writer thread until then.
+ */
 void BufferWriter::mapBuffer(FrameBuffer *buffer)
 {
-	for (const FrameBuffer::Plane &plane : buffer->planes()) {
-		void *memory = mmap(NULL, plane.length, PROT_READ, MAP_SHARED,
-				    plane.fd.fd(), 0);
+	std::lock_guard<std::mutex> locker(mutex_);
 
-		mappedBuffers_[plane.fd.fd()] =
-			std::make_pair(memory, plane.length);
-	}
+	int ret = recorder_.addBuffer(buffer);
+	if (ret < 0)
+		std::cerr << "failed to map buffer: " << strerror(-ret)
+			  << std::endl;
 }
-
-int BufferWriter::write(FrameBuffer *buffer, const std::string &streamName)
+void BufferWriter::write(FrameBuffer *buffer, const std::string &streamName,
+			 DoneFunc done)
 {
-	std::string filename;
-	size_t pos;
-	int fd, ret = 0;
-
-	filename = pattern_;
-	pos = filename.find_first_of('#');
+	std::string filename = pattern_;
+	size_t pos = filename.find_first_of('#');
 	if (pos != std::string::npos) {
 		std::stringstream ss;
 		ss << streamName << "-" << std::setw(6)
 		   << std::setfill('0') << buffer->metadata().sequence;
 		filename.replace(pos, 1, ss.str());
+	} else {
+		filename.clear();
+	}
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		jobs_.push({ buffer, std::move(filename), std::move(done) });
+	}
+
+	cond_.notify_one();
+}
+
+void BufferWriter::run()
+{
+	std::unique_lock<std::mutex> locker(mutex_);
+
+	while (true) {
+		/*
+		 * Sleep only when no write is in flight, otherwise wait for
+		 * writes to complete below and pick up the frames queued in the
+		 * meantime on the next iteration.
+		 */
+		if (!recorder_.pending())
+			cond_.wait(locker, [&]() { return stopping_ || !jobs_.empty(); });
+
+		/* Flush all pending frames before stopping. */
+		if (jobs_.empty() && !recorder_.pending())
+			return;
+
+		std::queue<Job> jobs;
+		jobs.swap(jobs_);
+
+		locker.unlock();
+
+		for (; !jobs.empty(); jobs.pop()) {
+			if (writeBuffer(jobs.front()) < 0)
+				jobs.front().done();
+		}
+
+		recorder_.complete(true);
+
+		locker.lock();
 	}
+}
 
-	fd = open(filename.c_str(), O_CREAT | O_WRONLY |
-		  (pos == std::string::npos ? O_APPEND : O_TRUNC),
-		  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
-	if (fd == -1)
-		return -errno;
+int BufferWriter::writeBuffer(const Job &job)
+{
+	FrameBuffer *buffer = job.buffer;
+	off_t offset = 0;
+	int fd;
+
+	if (job.filename.empty()) {
+		/* Append all frames to a single file, kept open. */
+		if (containerFd_ == -1) {
+			containerFd_ = open(pattern_.c_str(), O_CREAT | O_WRONLY,
+					    S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+			if (containerFd_ == -1) {
+				int ret = -errno;
+				std::cerr << "failed to open " << pattern_ << ": "
+					  << strerror(-ret) << std::endl;
+				return ret;
+			}
+
+			containerOffset_ = lseek(containerFd_, 0, SEEK_END);
+		}
+
+		fd = containerFd_;
+		offset = containerOffset_;
+	} else {
+		fd = open(job.filename.c_str(), O_CREAT | O_WRONLY | O_TRUNC,
+			  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+		if (fd == -1) {
+			int ret = -errno;
+			std::cerr << "failed to open " << job.filename << ": "
+				  << strerror(-ret) << std::endl;
+			return ret;
+		}
+
+		/*
+		 * Reserve the space for the whole frame upfront to limit
+		 * fragmentation. Failures are harmless, the file grows as it's
+		 * written.
+		 */
+		off_t size = 0;
+		for (const FrameMetadata::Plane &meta : buffer->metadata().planes())
+			size += meta.bytesused;
+		fallocate(fd, 0, 0, size);
+	}
 
 	for (unsigned int i = 0; i < buffer->planes().size(); ++i) {
 		const FrameBuffer::Plane &plane = buffer->planes()[i];
-		const FrameMetadata::Plane &meta = buffer->metadata().planes[i];
-
-		void *data = mappedBuffers_[plane.fd.fd()].first;
-		unsigned int length = std::min(meta.bytesused, plane.length);
+		const FrameMetadata::Plane &meta = buffer->metadata().planes()[i];
 
 		if (meta.bytesused > plane.length)
 			std::cerr << "payload size " << meta.bytesused
 				  << " larger than plane size " << plane.length
 				  << std::endl;
+	}
+
+	bool container = fd == containerFd_;
+	DoneFunc done = job.done;
 
-		ret = ::write(fd, data, length);
-		if (ret < 0) {
-			ret = -errno;
-			std::cerr << "write error: " << strerror(-ret)
+	auto complete = [fd, container, done](int status) {
+		if (status < 0)
+			std::cerr << "write error: " << strerror(-status)
 				  << std::endl;
-			break;
-		} else if (ret != (int)length) {
-			std::cerr << "write error: only " << ret
-				  << " bytes written instead of "
-				  << length << std::endl;
-			break;
-		}
+
+		if (!container)
+			close(fd);
+
+		done();
+	};
+
+	int ret = recorder_.write(buffer, fd, offset, complete);
+	if (ret < 0) {
+		std::cerr << "failed to write buffer: " << strerror(-ret)
+			  << std::endl;
+		if (!container)
+			close(fd);
+		return ret;
 	}
 
-	close(fd);
+	if (container)
+		containerOffset_ += ret;
 
-	return ret;
+	return 0;
 }
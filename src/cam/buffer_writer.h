@@ -7,25 +7,57 @@
 #ifndef __CAM_BUFFER_WRITER_H__
 #define __CAM_BUFFER_WRITER_H__
 
-#include <map>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
 #include <string>
+#include <sys/types.h>
+#include <thread>
 
 #include <libcamera/buffer.h>
 
+#include "frame_recorder.h"
+
 class BufferWriter
 {
 public:
+	using DoneFunc = std::function<void()>;
+
 	BufferWriter(const std::string &pattern = "frame-#.bin");
 	~BufferWriter();
 
 	void mapBuffer(libcamera::FrameBuffer *buffer);
 
-	int write(libcamera::FrameBuffer *buffer,
-		  const std::string &streamName);
+	void write(libcamera::FrameBuffer *buffer,
+		   const std::string &streamName, DoneFunc done);
 
 private:
+	struct Job {
+		libcamera::FrameBuffer *buffer;
+		std::string filename;
+		DoneFunc done;
+	};
+
+	void run();
+	int writeBuffer(const Job &job);
+
 	std::string pattern_;
-	std::map<int, std::pair<void *, unsigned int>> mappedBuffers_;
+
+	/* Only accessed from the writer thread once started. */
+	FrameRecorder recorder_;
+
+	/* File all frames are appended to when the pattern has no '#'. */
+	int containerFd_;
+	off_t containerOffset_;
+
+	std::thread thread_;
+
+	/* Protects the jobs queue and the stopping flag. */
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	std::queue<Job> jobs_;
+	bool stopping_;
 };
 
 #endif /* __CAM_BUFFER_WRITER_H__ */
@@ -18,14 +18,27 @@
 using namespace libcamera;
 
 Capture::Capture(std::shared_ptr<Camera> camera, CameraConfiguration *config,
-		 EventLoop *loop)
-	: camera_(camera), config_(config), writer_(nullptr), last_(0), loop_(loop),
+		 EventLoop *loop, const std::string &name)
+	: camera_(camera), config_(config), name_(name), allocator_(nullptr),
+	  writer_(nullptr), last_(0), loop_(loop), running_(false),
 	  queueCount_(0), captureCount_(0), captureLimit_(0),
-	  printMetadata_(false)
+	  printMetadata_(false), benchmark_(nullptr)
 {
 }
 
-int Capture::run(const OptionsParser::Options &options)
+Capture::~Capture()
+{
+	stop();
+}
+
+/*
+ * Configure and start the camera and prepare the requests. The requests are
+ * queued separately by queueRequests(), to start all cameras before capturing
+ * when several cameras are used concurrently. The done function is called from
+ * the event loop when the capture limit is reached.
+ */
+int Capture::start(const OptionsParser::Options &options, Benchmark *benchmark,
+		   DoneFunc done)
 {
 	int ret;
 
@@ -33,6 +46,8 @@ int Capture::run(const OptionsParser::Options &options)
 	captureCount_ = 0;
 	captureLimit_ = options[OptCapture].toInteger();
 	printMetadata_ = options.isSet(OptMetadata);
+	benchmark_ = benchmark;
+	done_ = std::move(done);
 
 	if (!camera_) {
 		std::cout << "Can't capture without a camera" << std::endl;
@@ -48,7 +63,17 @@ int Capture::run(const OptionsParser::Options &options)
 	streamName_.clear();
 	for (unsigned int index = 0; index < config_->size(); ++index) {
 		StreamConfiguration &cfg = config_->at(index);
-		streamName_[cfg.stream()] = "stream" + std::to_string(index);
+		std::string name = "stream" + std::to_string(index);
+		streamName_[cfg.stream()] = name_.empty() ? name : name_ + "-" + name;
+	}
+
+	if (options.isSet(OptScript)) {
+		script_ = std::make_unique<CaptureScript>(camera_,
+							  options[OptScript]);
+		if (!script_->valid()) {
+			script_.reset();
+			return -EINVAL;
+		}
 	}
 
 	camera_->requestCompleted.connect(this, &Capture::requestComplete);
@@ -60,40 +85,104 @@ int Capture::run(const OptionsParser::Options &options)
 			writer_ = new BufferWriter();
 	}
 
+	allocator_ = new FrameBufferAllocator(camera_);
 
-	FrameBufferAllocator *allocator = new FrameBufferAllocator(camera_);
+	ret = createRequests();
+	if (ret < 0) {
+		stop();
+		return ret;
+	}
 
-	ret = capture(allocator);
+	ret = camera_->start();
+	if (ret) {
+		std::cout << "Failed to start capture" << std::endl;
+		stop();
+		return ret;
+	}
 
-	if (options.isSet(OptFile)) {
-		delete writer_;
-		writer_ = nullptr;
+	running_ = true;
+
+	return 0;
+}
+
+int Capture::queueRequests()
+{
+	std::vector<Request *> requests;
+
+	for (std::unique_ptr<Request> &request : requests_) {
+		if (captureLimit_ && queueCount_ >= captureLimit_)
+			break;
+
+		applyScript(request.get());
+		queueCount_++;
+
+		if (benchmark_)
+			benchmark_->requestQueued(request.get());
+
+		requests.push_back(request.get());
+	}
+
+	int ret = camera_->queueRequests(requests);
+	if (ret < 0) {
+		std::cerr << "Can't queue requests" << std::endl;
+		return ret;
+	}
+
+	return 0;
+}
+
+int Capture::stop()
+{
+	int ret = 0;
+
+	if (running_) {
+		ret = camera_->stop();
+		if (ret)
+			std::cout << "Failed to stop capture" << std::endl;
+
+		running_ = false;
 	}
 
+	if (allocator_)
+		camera_->requestCompleted.disconnect(this, &Capture::requestComplete);
+
+	/* Wait for the pending frames to be written before freeing buffers. */
+	delete writer_;
+	writer_ = nullptr;
+
+	pendingWrites_.clear();
+
 	requests_.clear();
+	script_.reset();
 
-	delete allocator;
+	delete allocator_;
+	allocator_ = nullptr;
 
 	return ret;
 }
 
-int Capture::capture(FrameBufferAllocator *allocator)
+int Capture::createRequests()
 {
 	int ret;
 
 	/* Identify the stream with the least number of buffers. */
 	unsigned int nbuffers = UINT_MAX;
 	for (StreamConfiguration &cfg : *config_) {
-		ret = allocator->allocate(cfg.stream());
+		ret = allocator_->allocate(cfg.stream());
 		if (ret < 0) {
 			std::cerr << "Can't allocate buffers" << std::endl;
 			return -ENOMEM;
 		}
 
-		unsigned int allocated = allocator->buffers(cfg.stream()).size();
+		unsigned int allocated = allocator_->buffers(cfg.stream()).size();
 		nbuffers = std::min(nbuffers, allocated);
 	}
 
+	if (nbuffers < config_->minRequestDepth())
+		std::cerr << "Warning: " << nbuffers
+			  << " requests are not enough to avoid frame drops, "
+			  << config_->minRequestDepth() << " needed" << std::endl;
+
 	/*
 	 * TODO: make cam tool smarter to support still capture by for
 	 * example pushing a button. For now run all streams all the time.
@@ -109,7 +198,7 @@ int Capture::capture(FrameBufferAllocator *allocator)
 		for (StreamConfiguration &cfg : *config_) {
 			Stream *stream = cfg.stream();
 			const std::vector<std::unique_ptr<FrameBuffer>> &buffers =
-				allocator->buffers(stream);
+				allocator_->buffers(stream);
 			const std::unique_ptr<FrameBuffer> &buffer = buffers[i];
 
 			ret = request->addBuffer(stream, buffer.get());
@@ -126,35 +215,21 @@ int Capture::capture(FrameBufferAllocator *allocator)
 		requests_.push_back(std::move(request));
 	}
 
-	ret = camera_->start();
-	if (ret) {
-		std::cout << "Failed to start capture" << std::endl;
-		return ret;
-	}
-
-	for (std::unique_ptr<Request> &request : requests_) {
-		ret = queueRequest(request.get());
-		if (ret < 0) {
-			std::cerr << "Can't queue request" << std::endl;
-			camera_->stop();
-			return ret;
-		}
-	}
-
-	if (captureLimit_)
-		std::cout << "Capture " << captureLimit_ << " frames" << std::endl;
-	else
-		std::cout << "Capture until user interrupts by SIGINT" << std::endl;
+	return 0;
+}
 
-	ret = loop_->exec();
-	if (ret)
-		std::cout << "Failed to run capture loop" << std::endl;
+/* Set the controls of the capture script for the next frame in the request. */
+void Capture::applyScript(Request *request)
+{
+	if (!script_)
+		return;
 
-	ret = camera_->stop();
-	if (ret)
-		std::cout << "Failed to stop capture" << std::endl;
+	const ControlList *controls = script_->frameControls(queueCount_);
+	if (!controls)
+		return;
 
-	return ret;
+	for (const auto &[id, value] : *controls)
+		request->controls().set(id, value);
 }
 
 int Capture::queueRequest(Request *request)
@@ -162,8 +237,12 @@ int Capture::queueRequest(Request *request)
 	if (captureLimit_ && queueCount_ >= captureLimit_)
 		return 0;
 
+	applyScript(request);
 	queueCount_++;
 
+	if (benchmark_)
+		benchmark_->requestQueued(request);
+
 	return camera_->queueRequest(request);
 }
 
@@ -174,9 +253,15 @@ void Capture::requestComplete(Request *request)
 
 	/*
 	 * Defer processing of the completed request to the event loop, to avoid
-	 * blocking the camera manager thread.
+	 * blocking the camera manager thread. The completion time is sampled
+	 * here to keep the event loop latency out of the benchmark.
 	 */
-	loop_->callLater([=]() { processRequest(request); });
+	Benchmark::Clock::time_point completed = Benchmark::Clock::now();
+	loop_->callLater([=]() {
+		if (benchmark_)
+			benchmark_->requestCompleted(request, completed);
+		processRequest(request);
+	});
 }
 
 void Capture::processRequest(Request *request)
@@ -193,6 +278,8 @@ void Capture::processRequest(Request *request)
 	last_ = ts;
 
 	std::stringstream info;
+	if (!name_.empty())
+		info << name_ << ": ";
 	info << ts / 1000000000 << "."
 	     << std::setw(6) << std::setfill('0') << ts / 1000 % 1000000
 	     << " (" << std::fixed << std::setprecision(2) << fps << " fps)";
@@ -204,22 +291,39 @@ void Capture::processRequest(Request *request)
 
 		const FrameMetadata &metadata = buffer->metadata();
 
+		if (benchmark_)
+			benchmark_->bufferCompleted(name, metadata);
+
 		info << " " << name
 		     << " seq: " << std::setw(6) << std::setfill('0') << metadata.sequence
 		     << " bytesused: ";
 
 		unsigned int nplane = 0;
-		for (const FrameMetadata::Plane &plane : metadata.planes) {
+		for (const FrameMetadata::Plane &plane : metadata.planes()) {
 			info << plane.bytesused;
-			if (++nplane < metadata.planes.size())
+			if (++nplane < metadata.planes().size())
 				info << "/";
 		}
 
-		if (writer_)
-			writer_->write(buffer, name);
+		if (metadata.flags & FrameMetadata::FlagKeyFrame)
+			info << " keyframe";
+
+		if (writer_) {
+			pendingWrites_[request]++;
+			writer_->write(buffer, name, [this, request]() {
+				loop_->callLater([=]() { bufferWritten(request); });
+			});
+		}
 	}
 
-	std::cout << info.str() << std::endl;
+	/* Verify that the scripted controls have been applied to the frame. */
+	if (benchmark_ && script_)
+		benchmark_->controlsCompleted(request->controls(),
+					      request->metadata());
+
+	/* Keep the console output out of the benchmark measurements. */
+	if (!benchmark_)
+		std::cout << info.str() << std::endl;
 
 	if (printMetadata_) {
 		const ControlList &requestMetadata = request->metadata();
@@ -232,10 +336,30 @@ void Capture::processRequest(Request *request)
 
 	captureCount_++;
 	if (captureLimit_ && captureCount_ >= captureLimit_) {
-		loop_->exit(0);
+		if (captureCount_ == captureLimit_ && done_)
+			done_();
 		return;
 	}
 
+	/* Requeue the request once its buffers have been written to disk. */
+	if (pendingWrites_.count(request))
+		return;
+
+	request->reuse(Request::ReuseBuffers);
+	queueRequest(request);
+}
+
+void Capture::bufferWritten(Request *request)
+{
+	auto iter = pendingWrites_.find(request);
+	if (iter == pendingWrites_.end() || --iter->second)
+		return;
+
+	pendingWrites_.erase(iter);
+
+	if (captureLimit_ && captureCount_ >= captureLimit_)
+		return;
+
 	request->reuse(Request::ReuseBuffers);
 	queueRequest(request);
 }
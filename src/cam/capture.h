@@ -7,8 +7,10 @@
 #ifndef __CAM_CAPTURE_H__
 #define __CAM_CAPTURE_H__
 
+#include <functional>
 #include <memory>
 #include <stdint.h>
+#include <string>
 #include <vector>
 
 #include <libcamera/buffer.h>
@@ -17,38 +19,56 @@
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
+#include "benchmark.h"
 #include "buffer_writer.h"
+#include "capture_script.h"
 #include "event_loop.h"
 #include "options.h"
 
 class Capture
 {
 public:
+	using DoneFunc = std::function<void()>;
+
 	Capture(std::shared_ptr<libcamera::Camera> camera,
 		libcamera::CameraConfiguration *config,
-		EventLoop *loop);
+		EventLoop *loop, const std::string &name = "");
+	~Capture();
 
-	int run(const OptionsParser::Options &options);
+	int start(const OptionsParser::Options &options, Benchmark *benchmark,
+		  DoneFunc done);
+	int queueRequests();
+	int stop();
 private:
-	int capture(libcamera::FrameBufferAllocator *allocator);
+	int createRequests();
 
+	void applyScript(libcamera::Request *request);
 	int queueRequest(libcamera::Request *request);
 	void requestComplete(libcamera::Request *request);
 	void processRequest(libcamera::Request *request);
+	void bufferWritten(libcamera::Request *request);
 
 	std::shared_ptr<libcamera::Camera> camera_;
 	libcamera::CameraConfiguration *config_;
+	std::string name_;
 
 	std::map<const libcamera::Stream *, std::string> streamName_;
+	libcamera::FrameBufferAllocator *allocator_;
 	BufferWriter *writer_;
+	std::map<libcamera::Request *, unsigned int> pendingWrites_;
 	uint64_t last_;
 
 	EventLoop *loop_;
+	bool running_;
 	unsigned int queueCount_;
 	unsigned int captureCount_;
 	unsigned int captureLimit_;
 	bool printMetadata_;
 
+	Benchmark *benchmark_;
+	std::unique_ptr<CaptureScript> script_;
+	DoneFunc done_;
+
 	std::vector<std::unique_ptr<libcamera::Request>> requests_;
 };
 
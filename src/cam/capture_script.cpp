@@ -0,0 +1,242 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * capture_script.cpp - Capture session configuration script
+ */
+
+#include "capture_script.h"
+
+#include <errno.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include <libcamera/geometry.h>
+
+using namespace libcamera;
+
+/*
+ * A capture script is a timeline of controls to apply to the requests, keyed
+ * by frame number. Frames are numbered from 0 in the order the requests are
+ * queued. Each line lists the controls of one frame:
+ *
+ *   # Strobe the exposure time every other frame
+ *   loop 2
+ *   0: ExposureTime=10000 AnalogueGain=2.0
+ *   1: ExposureTime=20000
+ *
+ * The optional "loop" line repeats the timeline with the given period in
+ * frames. Array controls take comma-separated values, rectangles use the
+ * "(x,y)/wxh" notation and sizes the "wxh" notation. Lines starting with '#'
+ * are comments.
+ */
+
+CaptureScript::CaptureScript(std::shared_ptr<Camera> camera,
+			     const std::string &fileName)
+	: camera_(camera), loop_(0), valid_(false)
+{
+	std::ifstream file(fileName);
+	if (!file.is_open()) {
+		std::cerr << "Failed to open capture script " << fileName
+			  << std::endl;
+		return;
+	}
+
+	valid_ = !parse(file);
+}
+
+/* Retrieve the controls to apply to a frame, or nullptr if there are none. */
+const ControlList *CaptureScript::frameControls(unsigned int frame) const
+{
+	if (loop_)
+		frame %= loop_;
+
+	auto iter = frameControls_.find(frame);
+	if (iter == frameControls_.end())
+		return nullptr;
+
+	return &iter->second;
+}
+
+int CaptureScript::parse(std::istream &input)
+{
+	std::string line;
+	unsigned int lineNumber = 0;
+
+	while (std::getline(input, line)) {
+		lineNumber++;
+
+		size_t start = line.find_first_not_of(" \t");
+		if (start == std::string::npos || line[start] == '#')
+			continue;
+
+		line = line.substr(start);
+
+		int ret;
+		unsigned int value;
+		char separator;
+
+		std::istringstream ss(line);
+		if (line.compare(0, 5, "loop ") == 0) {
+			std::string keyword;
+			ss >> keyword >> value;
+			ret = ss && value ? 0 : -EINVAL;
+			loop_ = value;
+		} else if (ss >> value >> separator && separator == ':') {
+			std::string controls;
+			std::getline(ss, controls);
+			ret = parseFrame(value, controls);
+		} else {
+			ret = -EINVAL;
+		}
+
+		if (ret) {
+			std::cerr << "Invalid capture script line " << lineNumber
+				  << ": " << line << std::endl;
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+int CaptureScript::parseFrame(unsigned int frame, const std::string &line)
+{
+	const ControlInfoMap &infoMap = camera_->controls();
+	ControlList &controls =
+		frameControls_.try_emplace(frame, infoMap).first->second;
+
+	std::istringstream ss(line);
+	std::string entry;
+
+	while (ss >> entry) {
+		size_t pos = entry.find('=');
+		if (pos == std::string::npos)
+			return -EINVAL;
+
+		std::string name = entry.substr(0, pos);
+		const ControlId *id = nullptr;
+		for (const auto &ctrl : infoMap) {
+			if (ctrl.first->name() == name) {
+				id = ctrl.first;
+				break;
+			}
+		}
+
+		if (!id) {
+			std::cerr << "Control " << name
+				  << " not supported by the camera" << std::endl;
+			return -EINVAL;
+		}
+
+		ControlValue value = parseValue(id, entry.substr(pos + 1));
+		if (value.isNone()) {
+			std::cerr << "Invalid value for control " << name
+				  << std::endl;
+			return -EINVAL;
+		}
+
+		controls.set(id->id(), value);
+	}
+
+	return 0;
+}
+
+namespace {
+
+/* Parse comma-separated numbers, returning an empty vector on error. */
+template<typename T>
+std::vector<T> parseNumbers(const std::string &value)
+{
+	std::vector<T> values;
+	std::istringstream ss(value);
+	std::string token;
+
+	while (std::getline(ss, token, ',')) {
+		std::istringstream ts(token);
+		T number;
+		if (!(ts >> number) || !ts.eof())
+			return {};
+
+		values.push_back(number);
+	}
+
+	return values;
+}
+
+template<typename T>
+ControlValue toControlValue(const std::vector<T> &values)
+{
+	if (values.empty())
+		return {};
+
+	if (values.size() == 1)
+		return values[0];
+
+	return Span<const T>(values);
+}
+
+} /* namespace */
+
+ControlValue CaptureScript::parseValue(const ControlId *id,
+				       const std::string &value) const
+{
+	switch (id->type()) {
+	case ControlTypeBool:
+		if (value == "true" || value == "1")
+			return true;
+		if (value == "false" || value == "0")
+			return false;
+		return {};
+
+	case ControlTypeByte: {
+		std::vector<uint8_t> bytes;
+		for (unsigned int byte : parseNumbers<unsigned int>(value)) {
+			if (byte > UINT8_MAX)
+				return {};
+			bytes.push_back(byte);
+		}
+
+		return toControlValue(bytes);
+	}
+
+	case ControlTypeInteger32:
+		return toControlValue(parseNumbers<int32_t>(value));
+
+	case ControlTypeInteger64:
+		return toControlValue(parseNumbers<int64_t>(value));
+
+	case ControlTypeFloat:
+		return toControlValue(parseNumbers<float>(value));
+
+	case ControlTypeString:
+		return value;
+
+	case ControlTypeRectangle: {
+		Rectangle rect;
+		char end;
+		if (sscanf(value.c_str(), "(%d,%d)/%ux%u%c", &rect.x, &rect.y,
+			   &rect.width, &rect.height, &end) != 4)
+			return {};
+
+		return rect;
+	}
+
+	case ControlTypeSize: {
+		Size size;
+		char end;
+		if (sscanf(value.c_str(), "%ux%u%c", &size.width, &size.height,
+			   &end) != 2)
+			return {};
+
+		return size;
+	}
+
+	default:
+		return {};
+	}
+}
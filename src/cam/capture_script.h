@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * capture_script.h - Capture session configuration script
+ */
+#ifndef __CAM_CAPTURE_SCRIPT_H__
+#define __CAM_CAPTURE_SCRIPT_H__
+
+#include <istream>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <libcamera/camera.h>
+#include <libcamera/controls.h>
+
+class CaptureScript
+{
+public:
+	CaptureScript(std::shared_ptr<libcamera::Camera> camera,
+		      const std::string &fileName);
+
+	bool valid() const { return valid_; }
+
+	const libcamera::ControlList *frameControls(unsigned int frame) const;
+
+private:
+	int parse(std::istream &input);
+	int parseFrame(unsigned int frame, const std::string &line);
+	libcamera::ControlValue parseValue(const libcamera::ControlId *id,
+					   const std::string &value) const;
+
+	std::shared_ptr<libcamera::Camera> camera_;
+	std::map<unsigned int, libcamera::ControlList> frameControls_;
+	unsigned int loop_;
+	bool valid_;
+};
+
+#endif /* __CAM_CAPTURE_SCRIPT_H__ */
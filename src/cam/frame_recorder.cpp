@@ -0,0 +1,510 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * frame_recorder.cpp - Asynchronous frame buffer writes to files
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <iostream>
+#include <linux/dma-buf.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#include "frame_recorder.h"
+
+using namespace libcamera;
+
+/*
+ * The FrameRecorder class streams the planes of FrameBuffer instances to files
+ * without blocking the caller on storage. Writes are queued to an io_uring
+ * submission ring with write(), and all writes queued since the last call are
+ * submitted to the kernel with a single system call by complete(), which also
+ * reaps the writes that have completed and calls their completion functions.
+ * Writes of multiple planes and multiple frames are thus batched, and a single
+ * thread can sustain the bandwidth of fast storage.
+ *
+ * Buffers shall be added to the recorder with addBuffer() before being written.
+ * Their planes are mapped once, and registered with the ring when possible to
+ * avoid pinning the pages for every write. Registration isn't possible for all
+ * memory types, in which case the recorder silently falls back to unregistered
+ * writes. The CPU caches of dmabuf memory are synchronized with the device for
+ * the whole duration of the writes of a frame.
+ *
+ * When io_uring isn't supported by the system, write() falls back to
+ * synchronous writes and calls the completion function before returning. The
+ * isAsync() function reports which of the two modes is in use.
+ *
+ * The FrameRecorder class isn't thread-safe, all its functions shall be called
+ * from the same thread, and completion functions are called from that thread.
+ * The completion functions receive 0 when the frame has been fully written, or
+ * a negative error code otherwise.
+ *
+ * The depth is the maximum number of plane writes in flight.
+ */
+FrameRecorder::FrameRecorder(unsigned int depth)
+	: ringFd_(-1), sqRing_(MAP_FAILED), sqRingSize_(0), cqRing_(MAP_FAILED),
+	  cqRingSize_(0), sqes_(nullptr), sqesSize_(0), sqEntries_(0), queued_(0),
+	  inflight_(0), pending_(0), registered_(false), registrationDirty_(false)
+{
+	/* Fall back to synchronous writes if io_uring isn't available. */
+	if (setup(depth) < 0 && ringFd_ >= 0) {
+		close(ringFd_);
+		ringFd_ = -1;
+	}
+}
+
+/*
+ * All pending writes are completed, and their completion functions called,
+ * before the recorder is destroyed.
+ */
+FrameRecorder::~FrameRecorder()
+{
+	while (pending_)
+		complete(true);
+
+	for (auto &[buffer, mapping] : buffers_)
+		unmap(mapping);
+
+	if (cqRing_ != MAP_FAILED && cqRing_ != sqRing_)
+		munmap(cqRing_, cqRingSize_);
+	if (sqRing_ != MAP_FAILED)
+		munmap(sqRing_, sqRingSize_);
+	if (sqes_)
+		munmap(sqes_, sqesSize_);
+
+	if (ringFd_ >= 0)
+		close(ringFd_);
+}
+
+/*
+ * Map the planes of a buffer in memory. Buffers shall be added before being
+ * passed to write(), ideally all at once when they are allocated, as the
+ * registration of the buffers with the ring is updated on the next write.
+ */
+int FrameRecorder::addBuffer(const FrameBuffer *buffer)
+{
+	if (buffers_.count(buffer))
+		return 0;
+
+	Mapping mapping{ {}, {}, -1 };
+
+	for (const FrameBuffer::Plane &plane : buffer->planes()) {
+		/*
+		 * The memory is never written to, but registration pins the
+		 * pages for writing and fails for read-only mappings. All
+		 * buffers allocated by libcamera can be mapped for writing.
+		 */
+		void *address = mmap(nullptr, plane.length, PROT_READ | PROT_WRITE,
+				     MAP_SHARED, plane.fd.fd(), 0);
+		if (address == MAP_FAILED) {
+			int ret = -errno;
+			unmap(mapping);
+			return ret;
+		}
+
+		mapping.maps.emplace_back(static_cast<uint8_t *>(address),
+					  plane.length);
+		mapping.fds.push_back(plane.fd.fd());
+	}
+
+	buffers_[buffer] = std::move(mapping);
+	registrationDirty_ = true;
+
+	return 0;
+}
+
+/* Remove a buffer from the recorder. The buffer shall not have pending writes. */
+void FrameRecorder::removeBuffer(const FrameBuffer *buffer)
+{
+	auto iter = buffers_.find(buffer);
+	if (iter == buffers_.end())
+		return;
+
+	unmap(iter->second);
+	buffers_.erase(iter);
+	registrationDirty_ = true;
+}
+
+/*
+ * Queue the write of a buffer previously added with addBuffer() to the file
+ * descriptor fd at offset. The planes are written consecutively, each plane
+ * contributing the number of bytes used according to the buffer metadata. The
+ * write is submitted to the kernel by the next call to complete(), and done is
+ * called from complete() once all planes have been written. The buffer and the
+ * file descriptor shall stay valid until then.
+ *
+ * When the recorder isn't asynchronous, the buffer is written and done is
+ * called before this function returns.
+ *
+ * Return the number of bytes to be written on success, or a negative error
+ * code if the write couldn't be queued, in which case done isn't called.
+ */
+int FrameRecorder::write(const FrameBuffer *buffer, int fd, off_t offset,
+			 DoneFunc done)
+{
+	auto iter = buffers_.find(buffer);
+	if (iter == buffers_.end()) {
+		std::cerr << "Buffer hasn't been added to the recorder"
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	const Mapping &mapping = iter->second;
+	Span<const FrameMetadata::Plane> metadata = buffer->metadata().planes();
+	const std::vector<FrameBuffer::Plane> &planes = buffer->planes();
+
+	size_t length = 0;
+	for (unsigned int i = 0; i < planes.size() && i < metadata.size(); ++i)
+		length += std::min<size_t>(metadata[i].bytesused, planes[i].length);
+
+	if (!isAsync()) {
+		done(writeSync(mapping, buffer, fd, offset));
+		return length;
+	}
+
+	/*
+	 * Buffers can only be registered when no write is in flight, as the
+	 * registration is replaced as a whole.
+	 */
+	if (registrationDirty_) {
+		while (pending_)
+			complete(true);
+
+		registerBuffers();
+	}
+
+	/*
+	 * Hold a reference on the frame while queuing its planes, as waiting
+	 * for a free entry in the ring may complete the planes already queued.
+	 */
+	Frame *frame = new Frame{ std::move(done), &mapping, 1, length, 0, 0 };
+	sync(mapping, DMA_BUF_SYNC_START);
+	pending_++;
+
+	for (unsigned int i = 0; i < planes.size() && i < metadata.size(); ++i) {
+		unsigned int size = std::min<size_t>(metadata[i].bytesused,
+						     planes[i].length);
+		if (!size)
+			continue;
+
+		struct io_uring_sqe *entry = sqe();
+		while (!entry) {
+			/* The ring is full, wait for writes to complete. */
+			complete(true);
+			entry = sqe();
+		}
+
+#if HAVE_IO_URING
+		const Span<uint8_t> &plane = mapping.maps[i];
+		int index = mapping.index;
+
+		entry->opcode = index >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+		entry->fd = fd;
+		entry->off = offset;
+		entry->addr = reinterpret_cast<uintptr_t>(plane.data());
+		entry->len = size;
+		entry->buf_index = index >= 0 ? index + i : 0;
+		entry->user_data = reinterpret_cast<uintptr_t>(frame);
+#endif
+
+		offset += size;
+		frame->remaining++;
+	}
+
+	if (!--frame->remaining)
+		completeFrame(frame);
+
+	return length;
+}
+
+/*
+ * Submit all writes queued by write() to the kernel, and call the completion
+ * function of all frames whose writes have completed. If wait is true and
+ * writes are pending, block until at least one write completes.
+ *
+ * Return the number of frames that have completed.
+ */
+unsigned int FrameRecorder::complete(bool wait)
+{
+	if (!isAsync())
+		return 0;
+
+	int ret = enter(wait && (queued_ || inflight_) ? 1 : 0);
+	if (ret < 0) {
+		std::cerr << "Failed to submit writes: " << strerror(-ret)
+			  << std::endl;
+		return 0;
+	}
+
+	return reap();
+}
+
+int FrameRecorder::setup(unsigned int depth)
+{
+#if HAVE_IO_URING && defined(__NR_io_uring_setup)
+	struct io_uring_params params = {};
+
+	int ret = syscall(__NR_io_uring_setup, depth, &params);
+	if (ret < 0)
+		return -errno;
+
+	ringFd_ = ret;
+
+	sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+
+	sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING);
+	if (sqRing_ == MAP_FAILED)
+		return -errno;
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		cqRing_ = sqRing_;
+	} else {
+		cqRing_ = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE,
+			       MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_CQ_RING);
+		if (cqRing_ == MAP_FAILED)
+			return -errno;
+	}
+
+	sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+	void *sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		return -errno;
+
+	sqes_ = static_cast<struct io_uring_sqe *>(sqes);
+
+	uint8_t *sq = static_cast<uint8_t *>(sqRing_);
+	sqHead_ = reinterpret_cast<unsigned int *>(sq + params.sq_off.head);
+	sqTail_ = reinterpret_cast<unsigned int *>(sq + params.sq_off.tail);
+	sqMask_ = *reinterpret_cast<unsigned int *>(sq + params.sq_off.ring_mask);
+	sqArray_ = reinterpret_cast<unsigned int *>(sq + params.sq_off.array);
+	sqEntries_ = params.sq_entries;
+
+	uint8_t *cq = static_cast<uint8_t *>(cqRing_);
+	cqHead_ = reinterpret_cast<unsigned int *>(cq + params.cq_off.head);
+	cqTail_ = reinterpret_cast<unsigned int *>(cq + params.cq_off.tail);
+	cqMask_ = *reinterpret_cast<unsigned int *>(cq + params.cq_off.ring_mask);
+	cqes_ = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+	return 0;
+#else
+	return -ENOSYS;
+#endif
+}
+
+void FrameRecorder::registerBuffers()
+{
+	registrationDirty_ = false;
+
+#if HAVE_IO_URING
+	if (registered_) {
+		syscall(__NR_io_uring_register, ringFd_,
+			IORING_UNREGISTER_BUFFERS, nullptr, 0);
+		registered_ = false;
+	}
+
+	std::vector<struct iovec> iovecs;
+
+	for (auto &[buffer, mapping] : buffers_) {
+		mapping.index = iovecs.size();
+
+		for (const Span<uint8_t> &plane : mapping.maps)
+			iovecs.push_back({ plane.data(), plane.size() });
+	}
+
+	if (iovecs.empty())
+		return;
+
+	int ret = syscall(__NR_io_uring_register, ringFd_,
+			  IORING_REGISTER_BUFFERS, iovecs.data(), iovecs.size());
+	if (ret == 0) {
+		registered_ = true;
+		return;
+	}
+
+	/*
+	 * Memory that can't be pinned, such as some dmabuf mappings, can't be
+	 * registered. Fall back to unregistered writes.
+	 */
+	for (auto &[buffer, mapping] : buffers_)
+		mapping.index = -1;
+#endif
+}
+
+void FrameRecorder::unmap(Mapping &mapping)
+{
+	for (const Span<uint8_t> &plane : mapping.maps)
+		munmap(plane.data(), plane.size());
+
+	mapping.maps.clear();
+	mapping.fds.clear();
+}
+
+/*
+ * Signal the start or end of CPU reads to the exporters of dmabuf memory.
+ * Memory not backed by a dmabuf needs no synchronization.
+ */
+void FrameRecorder::sync(const Mapping &mapping, uint64_t flags)
+{
+	struct dma_buf_sync sync = {};
+	sync.flags = DMA_BUF_SYNC_READ | flags;
+
+	for (int fd : mapping.fds) {
+		int ret;
+
+		do {
+			ret = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+		} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+	}
+}
+
+int FrameRecorder::writeSync(const Mapping &mapping, const FrameBuffer *buffer,
+			     int fd, off_t offset)
+{
+	Span<const FrameMetadata::Plane> metadata = buffer->metadata().planes();
+	const std::vector<FrameBuffer::Plane> &planes = buffer->planes();
+	int status = 0;
+
+	sync(mapping, DMA_BUF_SYNC_START);
+
+	for (unsigned int i = 0; i < planes.size() && i < metadata.size(); ++i) {
+		const uint8_t *data = mapping.maps[i].data();
+		size_t size = std::min<size_t>(metadata[i].bytesused,
+					       planes[i].length);
+
+		while (size) {
+			ssize_t ret = pwrite(fd, data, size, offset);
+			if (ret < 0) {
+				if (errno == EINTR)
+					continue;
+				status = -errno;
+				break;
+			}
+
+			data += ret;
+			size -= ret;
+			offset += ret;
+		}
+
+		if (status)
+			break;
+	}
+
+	sync(mapping, DMA_BUF_SYNC_END);
+
+	return status;
+}
+
+struct io_uring_sqe *FrameRecorder::sqe()
+{
+#if HAVE_IO_URING
+	/*
+	 * Limit the number of writes in flight to the size of the submission
+	 * ring, the completion ring is twice as large and can't overflow.
+	 */
+	if (queued_ + inflight_ >= sqEntries_)
+		return nullptr;
+
+	unsigned int tail = *sqTail_;
+	unsigned int index = tail & sqMask_;
+
+	struct io_uring_sqe *entry = &sqes_[index];
+	memset(entry, 0, sizeof(*entry));
+	sqArray_[index] = index;
+
+	__atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+	queued_++;
+
+	return entry;
+#else
+	return nullptr;
+#endif
+}
+
+int FrameRecorder::enter(unsigned int wait)
+{
+#if HAVE_IO_URING
+	if (!queued_ && !wait)
+		return 0;
+
+	int ret;
+	do {
+		ret = syscall(__NR_io_uring_enter, ringFd_, queued_, wait,
+			      wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return -errno;
+
+	queued_ -= ret;
+	inflight_ += ret;
+
+	return ret;
+#else
+	return -ENOSYS;
+#endif
+}
+
+unsigned int FrameRecorder::reap()
+{
+	unsigned int completed = 0;
+
+#if HAVE_IO_URING
+	/*
+	 * Completion functions may queue new writes and call complete()
+	 * recursively, reload the ring head for every completion.
+	 */
+	while (true) {
+		unsigned int head = *cqHead_;
+		if (head == __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE))
+			break;
+
+		const struct io_uring_cqe *cqe = &cqes_[head & cqMask_];
+		Frame *frame = reinterpret_cast<Frame *>(cqe->user_data);
+		int res = cqe->res;
+
+		__atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+		inflight_--;
+
+		if (res < 0)
+			frame->status = res;
+		else
+			frame->written += res;
+
+		if (--frame->remaining)
+			continue;
+
+		completeFrame(frame);
+		completed++;
+	}
+#endif
+
+	return completed;
+}
+
+void FrameRecorder::completeFrame(Frame *frame)
+{
+	if (!frame->status && frame->written != frame->length)
+		frame->status = -EIO;
+
+	pending_--;
+
+	sync(*frame->mapping, DMA_BUF_SYNC_END);
+	frame->done(frame->status);
+	delete frame;
+}
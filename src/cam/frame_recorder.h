@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * frame_recorder.h - Asynchronous frame buffer writes to files
+ */
+#ifndef __CAM_FRAME_RECORDER_H__
+#define __CAM_FRAME_RECORDER_H__
+
+#include <functional>
+#include <map>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+
+#include <libcamera/buffer.h>
+#include <libcamera/class.h>
+#include <libcamera/span.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+class FrameRecorder
+{
+public:
+	using DoneFunc = std::function<void(int status)>;
+
+	explicit FrameRecorder(unsigned int depth = 64);
+	~FrameRecorder();
+
+	bool isAsync() const { return ringFd_ >= 0; }
+
+	int addBuffer(const libcamera::FrameBuffer *buffer);
+	void removeBuffer(const libcamera::FrameBuffer *buffer);
+
+	int write(const libcamera::FrameBuffer *buffer, int fd, off_t offset,
+		  DoneFunc done);
+	unsigned int complete(bool wait);
+
+	unsigned int pending() const { return pending_; }
+
+private:
+	LIBCAMERA_DISABLE_COPY_AND_MOVE(FrameRecorder)
+
+	struct Mapping {
+		std::vector<libcamera::Span<uint8_t>> maps;
+		std::vector<int> fds;
+		int index;
+	};
+
+	struct Frame {
+		DoneFunc done;
+		const Mapping *mapping;
+		unsigned int remaining;
+		size_t length;
+		size_t written;
+		int status;
+	};
+
+	int setup(unsigned int depth);
+	void registerBuffers();
+
+	static void unmap(Mapping &mapping);
+	static void sync(const Mapping &mapping, uint64_t flags);
+	int writeSync(const Mapping &mapping, const libcamera::FrameBuffer *buffer,
+		      int fd, off_t offset);
+
+	struct io_uring_sqe *sqe();
+	int enter(unsigned int wait);
+	unsigned int reap();
+	void completeFrame(Frame *frame);
+
+	int ringFd_;
+
+	void *sqRing_;
+	size_t sqRingSize_;
+	void *cqRing_;
+	size_t cqRingSize_;
+	struct io_uring_sqe *sqes_;
+	size_t sqesSize_;
+
+	unsigned int *sqHead_;
+	unsigned int *sqTail_;
+	unsigned int sqMask_;
+	unsigned int *sqArray_;
+	unsigned int sqEntries_;
+
+	unsigned int *cqHead_;
+	unsigned int *cqTail_;
+	unsigned int cqMask_;
+	struct io_uring_cqe *cqes_;
+
+	unsigned int queued_;
+	unsigned int inflight_;
+	unsigned int pending_;
+
+	std::map<const libcamera::FrameBuffer *, Mapping> buffers_;
+	bool registered_;
+	bool registrationDirty_;
+};
+
+#endif /* __CAM_FRAME_RECORDER_H__ */
@@ -8,6 +8,7 @@
 #include <iomanip>
 #include <iostream>
 #include <signal.h>
+#include <sstream>
 #include <string.h>
 
 #include <libcamera/libcamera.h>
@@ -39,10 +40,12 @@ private:
 	void cameraAdded(std::shared_ptr<Camera> cam);
 	void cameraRemoved(std::shared_ptr<Camera> cam);
 	int parseOptions(int argc, char *argv[]);
-	int prepareConfig();
+	int prepareConfig(unsigned int index);
 	int listControls();
 	int listProperties();
 	int infoConfiguration();
+	int listBandwidth();
+	int capture();
 	int run();
 
 	std::string const cameraName(const Camera *camera);
@@ -50,8 +53,8 @@ private:
 	static CamApp *app_;
 	OptionsParser::Options options_;
 	CameraManager *cm_;
-	std::shared_ptr<Camera> camera_;
-	std::unique_ptr<libcamera::CameraConfiguration> config_;
+	std::vector<std::shared_ptr<Camera>> cameras_;
+	std::vector<std::unique_ptr<libcamera::CameraConfiguration>> configs_;
 	EventLoop loop_;
 
 	bool strictFormats_;
@@ -60,8 +63,7 @@ private:
 CamApp *CamApp::app_ = nullptr;
 
 CamApp::CamApp()
-	: cm_(nullptr), camera_(nullptr), config_(nullptr),
-	  strictFormats_(false)
+	: cm_(nullptr), strictFormats_(false)
 {
 	CamApp::app_ = this;
 }
@@ -96,32 +98,35 @@ int CamApp::init(int argc, char **argv)
 		return ret;
 	}
 
-	if (options_.isSet(OptCamera)) {
-		const std::string &cameraId = options_[OptCamera];
+	for (const OptionValue &value : options_[OptCamera].toArray()) {
+		const std::string &cameraId = value.toString();
+		std::shared_ptr<Camera> camera;
 		char *endptr;
 		unsigned long index = strtoul(cameraId.c_str(), &endptr, 10);
 		if (*endptr == '\0' && index > 0 && index <= cm_->cameras().size())
-			camera_ = cm_->cameras()[index - 1];
+			camera = cm_->cameras()[index - 1];
 		else
-			camera_ = cm_->get(cameraId);
+			camera = cm_->get(cameraId);
 
-		if (!camera_) {
-			std::cout << "Camera "
-				  << std::string(options_[OptCamera])
-				  << " not found" << std::endl;
+		if (!camera) {
+			std::cout << "Camera " << cameraId << " not found"
+				  << std::endl;
 			cleanup();
 			return -ENODEV;
 		}
 
-		if (camera_->acquire()) {
-			std::cout << "Failed to acquire camera" << std::endl;
+		if (camera->acquire()) {
+			std::cout << "Failed to acquire camera " << camera->id()
+				  << std::endl;
 			cleanup();
 			return -EINVAL;
 		}
 
-		std::cout << "Using camera " << camera_->id() << std::endl;
+		std::cout << "Using camera " << camera->id() << std::endl;
+
+		cameras_.push_back(camera);
 
-		ret = prepareConfig();
+		ret = prepareConfig(cameras_.size() - 1);
 		if (ret) {
 			cleanup();
 			return ret;
@@ -139,12 +144,11 @@ int CamApp::init(int argc, char **argv)
 
 void CamApp::cleanup()
 {
-	if (camera_) {
-		camera_->release();
-		camera_.reset();
-	}
+	for (std::shared_ptr<Camera> &camera : cameras_)
+		camera->release();
 
-	config_.reset();
+	cameras_.clear();
+	configs_.clear();
 
 	cm_->stop();
 }
@@ -170,14 +174,16 @@ int CamApp::parseOptions(int argc, char *argv[])
 
 	OptionsParser parser;
 	parser.addOption(OptCamera, OptionString,
-			 "Specify which camera to operate on, by id or by index", "camera",
-			 ArgumentRequired, "camera");
+			 "Specify which camera to operate on, by id or by index\n"
+			 "Several cameras can be specified to capture from all of them concurrently.",
+			 "camera", ArgumentRequired, "camera", true);
 	parser.addOption(OptCapture, OptionInteger,
 			 "Capture until interrupted by user or until <count> frames captured",
 			 "capture", ArgumentOptional, "count");
 	parser.addOption(OptFile, OptionString,
 			 "Write captured frames to disk\n"
 			 "The first '#' character in the file name is expanded to the stream name and frame sequence number.\n"
+			 "If the file name contains no '#', all frames are appended to a single file.\n"
 			 "The default file name is 'frame-#.bin'.",
 			 "file", ArgumentOptional, "filename");
 	parser.addOption(OptStream, &streamKeyValue,
@@ -191,15 +197,32 @@ int CamApp::parseOptions(int argc, char *argv[])
 			 "list-controls");
 	parser.addOption(OptListProperties, OptionNone, "List cameras properties",
 			 "list-properties");
+	parser.addOption(OptListBandwidth, OptionInteger,
+			 "List the memory bandwidth of the stream(s) configuration at <fps> frames per second\n"
+			 "The frame rate defaults to the frame duration limit of the configuration, or 30 fps.",
+			 "list-bandwidth", ArgumentOptional, "fps");
 	parser.addOption(OptMonitor, OptionNone,
 			 "Monitor for hotplug and unplug camera events",
 			 "monitor");
 	parser.addOption(OptStrictFormats, OptionNone,
 			 "Do not allow requested stream format(s) to be adjusted",
 			 "strict-formats");
+	parser.addOption(OptLowLatency, OptionNone,
+			 "Configure the camera(s) for the lowest capture latency",
+			 "low-latency");
 	parser.addOption(OptMetadata, OptionNone,
 			 "Print the metadata for completed requests",
 			 "metadata");
+	parser.addOption(OptBenchmark, OptionString,
+			 "Measure the capture performance instead of printing every frame\n"
+			 "Report request latency, frame interval, dropped frames and CPU usage at the end of the capture, "
+			 "and write them in JSON format to <filename> if specified.",
+			 "benchmark", ArgumentOptional, "filename");
+	parser.addOption(OptScript, OptionString,
+			 "Apply the per-frame controls of a capture script to the requests\n"
+			 "Each line of the script lists the controls of a frame as '<frame>: <Control>=<value> ...'. "
+			 "A 'loop <frames>' line repeats the script with the given period.",
+			 "script", ArgumentRequired, "filename");
 
 	options_ = parser.parse(argc, argv);
 	if (!options_.valid())
@@ -213,59 +236,72 @@ int CamApp::parseOptions(int argc, char *argv[])
 	return 0;
 }
 
-int CamApp::prepareConfig()
+int CamApp::prepareConfig(unsigned int index)
 {
-	StreamRoles roles = StreamKeyValueParser::roles(options_[OptStream]);
+	OptionValue streams = StreamKeyValueParser::cameraStreams(options_[OptStream],
+								  index);
+	StreamRoles roles = StreamKeyValueParser::roles(streams);
 
-	config_ = camera_->generateConfiguration(roles);
-	if (!config_ || config_->size() != roles.size()) {
+	std::unique_ptr<CameraConfiguration> config =
+		cameras_[index]->generateConfiguration(roles);
+	if (!config || config->size() != roles.size()) {
 		std::cerr << "Failed to get default stream configuration"
 			  << std::endl;
 		return -EINVAL;
 	}
 
 	/* Apply configuration if explicitly requested. */
-	if (StreamKeyValueParser::updateConfiguration(config_.get(),
-						      options_[OptStream])) {
+	if (StreamKeyValueParser::updateConfiguration(config.get(), streams)) {
 		std::cerr << "Failed to update configuration" << std::endl;
 		return -EINVAL;
 	}
 
-	switch (config_->validate()) {
+	config->lowLatency = options_.isSet(OptLowLatency);
+
+	switch (config->validate()) {
 	case CameraConfiguration::Valid:
 		break;
 	case CameraConfiguration::Adjusted:
 		if (strictFormats_) {
 			std::cout << "Adjusting camera configuration disallowed by --strict-formats argument"
 				  << std::endl;
-			config_.reset();
 			return -EINVAL;
 		}
 		std::cout << "Camera configuration adjusted" << std::endl;
 		break;
 	case CameraConfiguration::Invalid:
 		std::cout << "Camera configuration invalid" << std::endl;
-		config_.reset();
 		return -EINVAL;
 	}
 
+	if (config->lowLatency)
+		std::cout << "Expected capture latency: "
+			  << config->frameLatency() << " frames" << std::endl;
+
+	configs_.push_back(std::move(config));
+
 	return 0;
 }
 
 int CamApp::listControls()
 {
-	if (!camera_) {
+	if (cameras_.empty()) {
 		std::cout << "Cannot list controls without a camera"
 			  << std::endl;
 		return -EINVAL;
 	}
 
-	for (const auto &ctrl : camera_->controls()) {
-		const ControlId *id = ctrl.first;
-		const ControlInfo &info = ctrl.second;
+	for (const std::shared_ptr<Camera> &camera : cameras_) {
+		if (cameras_.size() > 1)
+			std::cout << "Camera " << camera->id() << ":" << std::endl;
 
-		std::cout << "Control: " << id->name() << ": "
-			  << info.toString() << std::endl;
+		for (const auto &ctrl : camera->controls()) {
+			const ControlId *id = ctrl.first;
+			const ControlInfo &info = ctrl.second;
+
+			std::cout << "Control: " << id->name() << ": "
+				  << info.toString() << std::endl;
+		}
 	}
 
 	return 0;
@@ -273,18 +309,23 @@ int CamApp::listControls()
 
 int CamApp::listProperties()
 {
-	if (!camera_) {
+	if (cameras_.empty()) {
 		std::cout << "Cannot list properties without a camera"
 			  << std::endl;
 		return -EINVAL;
 	}
 
-	for (const auto &prop : camera_->properties()) {
-		const ControlId *id = properties::properties.at(prop.first);
-		const ControlValue &value = prop.second;
+	for (const std::shared_ptr<Camera> &camera : cameras_) {
+		if (cameras_.size() > 1)
+			std::cout << "Camera " << camera->id() << ":" << std::endl;
 
-		std::cout << "Property: " << id->name() << " = "
-			  << value.toString() << std::endl;
+		for (const auto &prop : camera->properties()) {
+			const ControlId *id = properties::properties.at(prop.first);
+			const ControlValue &value = prop.second;
+
+			std::cout << "Property: " << id->name() << " = "
+				  << value.toString() << std::endl;
+		}
 	}
 
 	return 0;
@@ -292,31 +333,84 @@ int CamApp::listProperties()
 
 int CamApp::infoConfiguration()
 {
-	if (!config_) {
+	if (configs_.empty()) {
 		std::cout << "Cannot print stream information without a camera"
 			  << std::endl;
 		return -EINVAL;
 	}
 
-	unsigned int index = 0;
-	for (const StreamConfiguration &cfg : *config_) {
-		std::cout << index << ": " << cfg.toString() << std::endl;
+	for (unsigned int i = 0; i < configs_.size(); i++) {
+		if (configs_.size() > 1)
+			std::cout << "Camera " << cameras_[i]->id() << ":" << std::endl;
 
-		const StreamFormats &formats = cfg.formats();
-		for (PixelFormat pixelformat : formats.pixelformats()) {
-			std::cout << " * Pixelformat: "
-				  << pixelformat.toString() << " "
-				  << formats.range(pixelformat).toString()
-				  << std::endl;
+		unsigned int index = 0;
+		for (const StreamConfiguration &cfg : *configs_[i]) {
+			std::cout << index << ": " << cfg.toString() << std::endl;
 
-			for (const Size &size : formats.sizes(pixelformat))
-				std::cout << "  - " << size.toString()
+			const StreamFormats &formats = cfg.formats();
+			for (PixelFormat pixelformat : formats.pixelformats()) {
+				std::cout << " * Pixelformat: "
+					  << pixelformat.toString() << " "
+					  << formats.range(pixelformat).toString()
 					  << std::endl;
+
+				for (const Size &size : formats.sizes(pixelformat))
+					std::cout << "  - " << size.toString()
+						  << std::endl;
+			}
+
+			index++;
 		}
+	}
+
+	return 0;
+}
 
-		index++;
+int CamApp::listBandwidth()
+{
+	if (configs_.empty()) {
+		std::cout << "Cannot list bandwidth without a camera"
+			  << std::endl;
+		return -EINVAL;
 	}
 
+	auto toMBps = [](uint64_t bandwidth) {
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(1)
+		   << bandwidth / 1000000.0 << " MB/s";
+		return ss.str();
+	};
+
+	uint64_t total = 0;
+
+	for (unsigned int i = 0; i < configs_.size(); i++) {
+		const CameraConfiguration *config = configs_[i].get();
+
+		double frameRate = options_[OptListBandwidth].toInteger();
+		if (!frameRate)
+			frameRate = config->maxFrameDuration
+				  ? 1000000.0 / config->maxFrameDuration : 30.0;
+
+		std::cout << "Camera " << cameras_[i]->id() << " at "
+			  << frameRate << " fps:" << std::endl;
+
+		CameraConfiguration::Bandwidth bandwidth =
+			config->bandwidth(frameRate);
+
+		for (unsigned int index = 0; index < config->size(); index++)
+			std::cout << index << ": " << config->at(index).toString()
+				  << ": " << toMBps(bandwidth.streams[index])
+				  << std::endl;
+
+		std::cout << "Internal: " << toMBps(bandwidth.internal) << std::endl
+			  << "Total: " << toMBps(bandwidth.total()) << std::endl;
+
+		total += bandwidth.total();
+	}
+
+	if (configs_.size() > 1)
+		std::cout << "All cameras: " << toMBps(total) << std::endl;
+
 	return 0;
 }
 
@@ -330,6 +424,97 @@ void CamApp::cameraRemoved(std::shared_ptr<Camera> cam)
 	std::cout << "Camera Removed: " << cam->id() << std::endl;
 }
 
+/*
+ * Capture from all the selected cameras concurrently, sharing the event loop.
+ * The capture stops when all cameras have captured the requested number of
+ * frames. The benchmark, if enabled, aggregates the statistics of all cameras.
+ */
+int CamApp::capture()
+{
+	if (cameras_.empty()) {
+		std::cout << "Can't capture without a camera" << std::endl;
+		return -ENODEV;
+	}
+
+	std::unique_ptr<Benchmark> benchmark;
+	if (options_.isSet(OptBenchmark))
+		benchmark = std::make_unique<Benchmark>();
+
+	std::vector<std::unique_ptr<Capture>> captures;
+	unsigned int running = cameras_.size();
+	auto done = [&]() {
+		if (!--running)
+			loop_.exit(0);
+	};
+
+	for (unsigned int i = 0; i < cameras_.size(); i++) {
+		std::string name = cameras_.size() > 1 ? "cam" + std::to_string(i) : "";
+		std::unique_ptr<Capture> capture =
+			std::make_unique<Capture>(cameras_[i], configs_[i].get(),
+						  &loop_, name);
+
+		int ret = capture->start(options_, benchmark.get(), done);
+		if (ret)
+			return ret;
+
+		captures.push_back(std::move(capture));
+	}
+
+	if (benchmark)
+		benchmark->start();
+
+	for (std::unique_ptr<Capture> &capture : captures) {
+		int ret = capture->queueRequests();
+		if (ret)
+			return ret;
+	}
+
+	unsigned int captureLimit = options_[OptCapture].toInteger();
+	if (captureLimit)
+		std::cout << "Capture " << captureLimit << " frames" << std::endl;
+	else
+		std::cout << "Capture until user interrupts by SIGINT" << std::endl;
+
+	int ret = loop_.exec();
+	if (ret)
+		std::cout << "Failed to run capture loop" << std::endl;
+
+	if (benchmark)
+		benchmark->stop();
+
+	/* Sample the memory usage before the buffers are freed. */
+	std::vector<CameraMemoryUsage> memoryUsage;
+	if (benchmark) {
+		for (const std::shared_ptr<Camera> &camera : cameras_)
+			memoryUsage.push_back(camera->memoryUsage());
+	}
+
+	for (std::unique_ptr<Capture> &capture : captures) {
+		int err = capture->stop();
+		if (err)
+			ret = err;
+	}
+
+	if (benchmark && !ret) {
+		benchmark->report(std::cout);
+
+		/* Complement the statistics with the counters of libcamera. */
+		for (unsigned int i = 0; i < cameras_.size(); ++i)
+			std::cout << "libcamera counters for " << cameras_[i]->id()
+				  << ":" << std::endl
+				  << cameras_[i]->performance().toString() << std::endl
+				  << memoryUsage[i].toString() << std::endl;
+		std::cout << "libcamera global counters:" << std::endl
+			  << cm_->performance().toString() << std::endl;
+
+		const std::string &summary = options_[OptBenchmark].toString();
+		if (!summary.empty())
+			ret = benchmark->writeSummary(summary);
+	}
+
+	return ret;
+}
+
 int CamApp::run()
 {
 	int ret;
@@ -362,11 +547,15 @@ int CamApp::run()
 			return ret;
 	}
 
-	if (options_.isSet(OptCapture)) {
-		Capture capture(camera_, config_.get(), &loop_);
-		return capture.run(options_);
+	if (options_.isSet(OptListBandwidth)) {
+		ret = listBandwidth();
+		if (ret)
+			return ret;
 	}
 
+	if (options_.isSet(OptCapture))
+		return capture();
+
 	if (options_.isSet(OptMonitor)) {
 		std::cout << "Press Ctrl-C to interrupt" << std::endl;
 		ret = loop_.exec();
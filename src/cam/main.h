@@ -20,6 +20,10 @@ enum {
 	OptListControls = 256,
 	OptStrictFormats = 257,
 	OptMetadata = 258,
+	OptBenchmark = 259,
+	OptListBandwidth = 260,
+	OptLowLatency = 261,
+	OptScript = 262,
 };
 
 #endif /* __CAM_MAIN_H__ */
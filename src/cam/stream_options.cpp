@@ -21,6 +21,12 @@ StreamKeyValueParser::StreamKeyValueParser()
 		  ArgumentRequired);
 	addOption("pixelformat", OptionString, "Pixel format name",
 		  ArgumentRequired);
+	addOption("stride-align", OptionInteger,
+		  "Alignment of the line stride in bytes, for zero-copy import in other devices",
+		  ArgumentRequired);
+	addOption("camera", OptionInteger,
+		  "Index of the camera the stream applies to, in the order of the --camera options, starting at 0 (default: all cameras)",
+		  ArgumentRequired);
 }
 
 KeyValueParser::Options StreamKeyValueParser::parse(const char *arguments)
@@ -38,6 +44,27 @@ KeyValueParser::Options StreamKeyValueParser::parse(const char *arguments)
 	return options;
 }
 
+/*
+ * Select the stream options that apply to a camera, when capturing from
+ * multiple cameras. Streams without a camera key apply to all cameras.
+ */
+OptionValue StreamKeyValueParser::cameraStreams(const OptionValue &values,
+						unsigned int camera)
+{
+	OptionValue streams;
+
+	for (const OptionValue &value : values.toArray()) {
+		KeyValueParser::Options opts = value.toKeyValues();
+		if (opts.isSet("camera") &&
+		    opts["camera"].toInteger() != static_cast<int>(camera))
+			continue;
+
+		streams.addValue(value);
+	}
+
+	return streams;
+}
+
 StreamRoles StreamKeyValueParser::roles(const OptionValue &values)
 {
 	const std::vector<OptionValue> &streamParameters = values.toArray();
@@ -97,6 +124,9 @@ int StreamKeyValueParser::updateConfiguration(CameraConfiguration *config,
 
 		if (opts.isSet("pixelformat"))
 			cfg.pixelFormat = PixelFormat::fromString(opts["pixelformat"].toString());
+
+		if (opts.isSet("stride-align"))
+			cfg.strideAlign = opts["stride-align"].toInteger();
 	}
 
 	return 0;
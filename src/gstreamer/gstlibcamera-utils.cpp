@@ -8,6 +8,8 @@
 
 #include "gstlibcamera-utils.h"
 
+#include <algorithm>
+
 #include <libcamera/formats.h>
 
 using namespace libcamera;
@@ -17,6 +19,8 @@ static struct {
 	PixelFormat format;
 } format_map[] = {
 	{ GST_VIDEO_FORMAT_ENCODED, formats::MJPEG },
+	{ GST_VIDEO_FORMAT_ENCODED, formats::H264 },
+	{ GST_VIDEO_FORMAT_ENCODED, formats::HEVC },
 	{ GST_VIDEO_FORMAT_RGB, formats::BGR888 },
 	{ GST_VIDEO_FORMAT_BGR, formats::RGB888 },
 	{ GST_VIDEO_FORMAT_ARGB, formats::BGRA8888 },
@@ -69,11 +73,25 @@ bare_structure_from_format(const PixelFormat &format)
 	switch (format) {
 	case formats::MJPEG:
 		return gst_structure_new_empty("image/jpeg");
+	case formats::H264:
+		return gst_structure_new("video/x-h264",
+					 "stream-format", G_TYPE_STRING, "byte-stream",
+					 "alignment", G_TYPE_STRING, "au", nullptr);
+	case formats::HEVC:
+		return gst_structure_new("video/x-h265",
+					 "stream-format", G_TYPE_STRING, "byte-stream",
+					 "alignment", G_TYPE_STRING, "au", nullptr);
 	default:
 		return nullptr;
 	}
 }
 
+bool
+gst_libcamera_pixel_format_is_encoded(const PixelFormat &format)
+{
+	return pixel_format_to_gst_format(format) == GST_VIDEO_FORMAT_ENCODED;
+}
+
 GstCaps *
 gst_libcamera_stream_formats_to_caps(const StreamFormats &formats)
 {
@@ -157,6 +175,10 @@ gst_libcamera_configure_stream_from_caps(StreamConfiguration &stream_cfg,
 		stream_cfg.pixelFormat = gst_format_to_pixel_format(gst_format);
 	} else if (gst_structure_has_name(s, "image/jpeg")) {
 		stream_cfg.pixelFormat = formats::MJPEG;
+	} else if (gst_structure_has_name(s, "video/x-h264")) {
+		stream_cfg.pixelFormat = formats::H264;
+	} else if (gst_structure_has_name(s, "video/x-h265")) {
+		stream_cfg.pixelFormat = formats::HEVC;
 	} else {
 		g_critical("Unsupported media type: %s", gst_structure_get_name(s));
 	}
@@ -168,6 +190,70 @@ gst_libcamera_configure_stream_from_caps(StreamConfiguration &stream_cfg,
 	stream_cfg.size.height = height;
 }
 
+bool
+gst_libcamera_stream_configuration_to_video_info(const StreamConfiguration &stream_cfg,
+						 GstCaps *caps, GstVideoInfo *info)
+{
+	if (!gst_video_info_from_caps(info, caps) ||
+	    GST_VIDEO_INFO_FORMAT(info) == GST_VIDEO_FORMAT_ENCODED)
+		return false;
+
+	guint default_stride = GST_VIDEO_INFO_PLANE_STRIDE(info, 0);
+	if (!stream_cfg.stride || !default_stride)
+		return true;
+
+	/*
+	 * Replace the default GStreamer layout with the one of the libcamera
+	 * buffers. Only the stride of the first plane is reported by libcamera,
+	 * the stride of the other planes is scaled accordingly, and planes are
+	 * stored contiguously.
+	 */
+	const GstVideoFormatInfo *finfo = info->finfo;
+	gsize offset = 0;
+
+	for (guint plane = 0; plane < GST_VIDEO_INFO_N_PLANES(info); plane++) {
+		guint stride = GST_VIDEO_INFO_PLANE_STRIDE(info, plane)
+			     * stream_cfg.stride / default_stride;
+		guint height = 0;
+
+		for (guint comp = 0; comp < GST_VIDEO_INFO_N_COMPONENTS(info); comp++) {
+			if (GST_VIDEO_FORMAT_INFO_PLANE(finfo, comp) == plane) {
+				height = GST_VIDEO_INFO_COMP_HEIGHT(info, comp);
+				break;
+			}
+		}
+
+		GST_VIDEO_INFO_PLANE_STRIDE(info, plane) = stride;
+		GST_VIDEO_INFO_PLANE_OFFSET(info, plane) = offset;
+		offset += stride * height;
+	}
+
+	GST_VIDEO_INFO_SIZE(info) = std::max<gsize>(offset, stream_cfg.frameSize);
+
+	return true;
+}
+
+bool
+gst_libcamera_video_info_has_default_layout(const GstVideoInfo *info)
+{
+	GstVideoInfo default_info;
+
+	gst_video_info_init(&default_info);
+	gst_video_info_set_format(&default_info, GST_VIDEO_INFO_FORMAT(info),
+				  GST_VIDEO_INFO_WIDTH(info),
+				  GST_VIDEO_INFO_HEIGHT(info));
+
+	for (guint plane = 0; plane < GST_VIDEO_INFO_N_PLANES(info); plane++) {
+		if (GST_VIDEO_INFO_PLANE_STRIDE(info, plane) !=
+		    GST_VIDEO_INFO_PLANE_STRIDE(&default_info, plane) ||
+		    GST_VIDEO_INFO_PLANE_OFFSET(info, plane) !=
+		    GST_VIDEO_INFO_PLANE_OFFSET(&default_info, plane))
+			return false;
+	}
+
+	return true;
+}
+
 void
 gst_libcamera_resume_task(GstTask *task)
 {
@@ -178,3 +264,31 @@ gst_libcamera_resume_task(GstTask *task)
 		GST_TASK_SIGNAL(task);
 	}
 }
+
+G_LOCK_DEFINE_STATIC(cm_singleton_lock);
+static std::weak_ptr<CameraManager> cm_singleton_ptr;
+
+/*
+ * libcamera supports a single CameraManager per process. Share it between all
+ * the elements, it is stopped when the last reference is dropped.
+ */
+std::shared_ptr<CameraManager>
+gst_libcamera_get_camera_manager(int &ret)
+{
+	std::shared_ptr<CameraManager> cm;
+
+	G_LOCK(cm_singleton_lock);
+
+	cm = cm_singleton_ptr.lock();
+	if (!cm) {
+		cm = std::make_shared<CameraManager>();
+		cm_singleton_ptr = cm;
+		ret = cm->start();
+	} else {
+		ret = 0;
+	}
+
+	G_UNLOCK(cm_singleton_lock);
+
+	return cm;
+}
@@ -12,13 +12,21 @@
 #include <gst/gst.h>
 #include <gst/video/video.h>
 
+#include <memory>
+
+#include <libcamera/camera_manager.h>
 #include <libcamera/stream.h>
 
+bool gst_libcamera_pixel_format_is_encoded(const libcamera::PixelFormat &format);
 GstCaps *gst_libcamera_stream_formats_to_caps(const libcamera::StreamFormats &formats);
 GstCaps *gst_libcamera_stream_configuration_to_caps(const libcamera::StreamConfiguration &stream_cfg);
 void gst_libcamera_configure_stream_from_caps(libcamera::StreamConfiguration &stream_cfg,
 					      GstCaps *caps);
+bool gst_libcamera_stream_configuration_to_video_info(const libcamera::StreamConfiguration &stream_cfg,
+						      GstCaps *caps, GstVideoInfo *info);
+bool gst_libcamera_video_info_has_default_layout(const GstVideoInfo *info);
 void gst_libcamera_resume_task(GstTask *task);
+std::shared_ptr<libcamera::CameraManager> gst_libcamera_get_camera_manager(int &ret);
 
 /**
  * \class GLibLocker
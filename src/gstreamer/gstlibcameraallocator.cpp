@@ -26,11 +26,17 @@ static gboolean gst_libcamera_allocator_release(GstMiniObject *mini_object);
  * This wrapper maintains a count of the outstanding GstMemory (there may be
  * multiple GstMemory per FrameBuffer), and give back the FrameBuffer to the
  * allocator pool when all memory objects have returned.
+ *
+ * When the FrameBuffer wraps the dmabufs of a buffer imported from a
+ * downstream pool, the wrapper owns the FrameBuffer and holds a reference to
+ * the imported buffer until it is destroyed.
  */
 
 struct FrameWrap {
 	FrameWrap(GstAllocator *allocator, FrameBuffer *buffer,
 		  gpointer stream);
+	FrameWrap(GstAllocator *allocator, std::unique_ptr<FrameBuffer> buffer,
+		  GstBuffer *imported, gpointer stream);
 	~FrameWrap();
 
 	void acquirePlane() { ++outstandingPlanes_; }
@@ -42,6 +48,9 @@ struct FrameWrap {
 	FrameBuffer *buffer_;
 	std::vector<GstMemory *> planes_;
 	gint outstandingPlanes_;
+
+	std::unique_ptr<FrameBuffer> importedFrame_;
+	GstBuffer *importedBuffer_ = nullptr;
 };
 
 FrameWrap::FrameWrap(GstAllocator *allocator, FrameBuffer *buffer,
@@ -61,6 +70,14 @@ FrameWrap::FrameWrap(GstAllocator *allocator, FrameBuffer *buffer,
 	}
 }
 
+FrameWrap::FrameWrap(GstAllocator *allocator, std::unique_ptr<FrameBuffer> buffer,
+		     GstBuffer *imported, gpointer stream)
+	: FrameWrap(allocator, buffer.get(), stream)
+{
+	importedFrame_ = std::move(buffer);
+	importedBuffer_ = imported;
+}
+
 FrameWrap::~FrameWrap()
 {
 	for (GstMemory *mem : planes_) {
@@ -68,6 +85,9 @@ FrameWrap::~FrameWrap()
 		g_object_ref(mem->allocator);
 		gst_memory_unref(mem);
 	}
+
+	if (importedBuffer_)
+		gst_buffer_unref(importedBuffer_);
 }
 
 GQuark FrameWrap::getQuark()
@@ -182,9 +202,31 @@ gst_libcamera_allocator_class_init(GstLibcameraAllocatorClass *klass)
 	allocator_class->alloc = nullptr;
 }
 
+/*
+ * Wrap the dmabufs of a downstream buffer in a FrameBuffer, with one plane per
+ * memory. The file descriptors are duplicated by the FrameBuffer.
+ */
+static std::unique_ptr<FrameBuffer>
+gst_libcamera_allocator_import_buffer(GstBuffer *buffer)
+{
+	std::vector<FrameBuffer::Plane> planes;
+
+	for (guint i = 0; i < gst_buffer_n_memory(buffer); i++) {
+		GstMemory *mem = gst_buffer_peek_memory(buffer, i);
+		FrameBuffer::Plane plane;
+
+		plane.fd = FileDescriptor(gst_dmabuf_memory_get_fd(mem));
+		plane.length = mem->size;
+		planes.push_back(std::move(plane));
+	}
+
+	return std::make_unique<FrameBuffer>(planes);
+}
+
 GstLibcameraAllocator *
 gst_libcamera_allocator_new(std::shared_ptr<Camera> camera,
-			    CameraConfiguration *config_)
+			    CameraConfiguration *config_,
+			    const std::map<Stream *, std::vector<GstBuffer *>> &imported)
 {
 	auto *self = GST_LIBCAMERA_ALLOCATOR(g_object_new(GST_TYPE_LIBCAMERA_ALLOCATOR,
 							  nullptr));
@@ -194,6 +236,21 @@ gst_libcamera_allocator_new(std::shared_ptr<Camera> camera,
 		Stream *stream = streamCfg.stream();
 		gint ret;
 
+		/* Use the buffers imported from downstream if any. */
+		auto it = imported.find(stream);
+		if (it != imported.end() && !it->second.empty()) {
+			GQueue *pool = g_queue_new();
+			for (GstBuffer *buffer : it->second) {
+				auto *fb = new FrameWrap(GST_ALLOCATOR(self),
+							 gst_libcamera_allocator_import_buffer(buffer),
+							 buffer, stream);
+				g_queue_push_tail(pool, fb);
+			}
+
+			g_hash_table_insert(self->pools, stream, pool);
+			continue;
+		}
+
 		ret = self->fb_allocator->allocate(stream);
 		if (ret == 0)
 			return nullptr;
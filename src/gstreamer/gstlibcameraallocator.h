@@ -12,6 +12,9 @@
 #include <gst/gst.h>
 #include <gst/allocators/allocators.h>
 
+#include <map>
+#include <vector>
+
 #include <libcamera/camera.h>
 #include <libcamera/stream.h>
 
@@ -20,7 +23,8 @@ G_DECLARE_FINAL_TYPE(GstLibcameraAllocator, gst_libcamera_allocator,
 		     GST_LIBCAMERA, ALLOCATOR, GstDmaBufAllocator)
 
 GstLibcameraAllocator *gst_libcamera_allocator_new(std::shared_ptr<libcamera::Camera> camera,
-						   libcamera::CameraConfiguration *config_);
+						   libcamera::CameraConfiguration *config_,
+						   const std::map<libcamera::Stream *, std::vector<GstBuffer *>> &imported);
 
 bool gst_libcamera_allocator_prepare_buffer(GstLibcameraAllocator *self,
 					    libcamera::Stream *stream,
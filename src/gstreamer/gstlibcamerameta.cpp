@@ -0,0 +1,173 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * gstlibcamerameta.cpp - GStreamer meta carrying the libcamera request metadata
+ */
+
+#include "gstlibcamerameta.h"
+
+#include <string.h>
+
+#include <libcamera/control_ids.h>
+
+using namespace libcamera;
+
+/**
+ * \struct GstLibcameraMeta
+ * \brief Per-frame libcamera metadata attached to the outgoing buffers
+ *
+ * The meta gives downstream elements access to the metadata ControlList of
+ * the request that captured the buffer. The list isn't copied, the meta holds
+ * a reference to its owner, and controls are only looked up when requested.
+ */
+
+GType
+gst_libcamera_meta_api_get_type()
+{
+	static gsize type = 0;
+	static const gchar *tags[] = { nullptr };
+
+	if (g_once_init_enter(&type)) {
+		GType api = gst_meta_api_type_register("GstLibcameraMetaAPI", tags);
+		g_once_init_leave(&type, api);
+	}
+
+	return type;
+}
+
+static gboolean
+gst_libcamera_meta_init(GstMeta *meta, [[maybe_unused]] gpointer params,
+			[[maybe_unused]] GstBuffer *buffer)
+{
+	auto *lmeta = reinterpret_cast<GstLibcameraMeta *>(meta);
+
+	lmeta->source = nullptr;
+
+	return TRUE;
+}
+
+static void
+gst_libcamera_meta_free(GstMeta *meta, [[maybe_unused]] GstBuffer *buffer)
+{
+	auto *lmeta = reinterpret_cast<GstLibcameraMeta *>(meta);
+
+	if (lmeta->source)
+		lmeta->source->unref();
+}
+
+/* The metadata describes the captured frame, keep it on all transformations. */
+static gboolean
+gst_libcamera_meta_transform(GstBuffer *dest, GstMeta *meta,
+			     [[maybe_unused]] GstBuffer *buffer,
+			     [[maybe_unused]] GQuark type,
+			     [[maybe_unused]] gpointer data)
+{
+	auto *lmeta = reinterpret_cast<GstLibcameraMeta *>(meta);
+
+	return gst_buffer_add_libcamera_meta(dest, lmeta->source) != nullptr;
+}
+
+const GstMetaInfo *
+gst_libcamera_meta_get_info()
+{
+	static const GstMetaInfo *info = nullptr;
+
+	if (g_once_init_enter(&info)) {
+		const GstMetaInfo *meta_info =
+			gst_meta_register(GST_LIBCAMERA_META_API_TYPE, "GstLibcameraMeta",
+					  sizeof(GstLibcameraMeta),
+					  gst_libcamera_meta_init,
+					  gst_libcamera_meta_free,
+					  gst_libcamera_meta_transform);
+		g_once_init_leave(&info, meta_info);
+	}
+
+	return info;
+}
+
+GstLibcameraMeta *
+gst_buffer_add_libcamera_meta(GstBuffer *buffer, GstLibcameraMetaSource *source)
+{
+	auto *meta = reinterpret_cast<GstLibcameraMeta *>(gst_buffer_add_meta(buffer,
+									      GST_LIBCAMERA_META_INFO,
+									      nullptr));
+	if (!meta)
+		return nullptr;
+
+	source->ref();
+	meta->source = source;
+
+	return meta;
+}
+
+void
+gst_libcamera_meta_copy(GstBuffer *dest, GstBuffer *src)
+{
+	GstLibcameraMeta *meta = gst_buffer_get_libcamera_meta(src);
+
+	if (meta)
+		gst_buffer_add_libcamera_meta(dest, meta->source);
+}
+
+const ControlList &
+gst_libcamera_meta_get_metadata(GstLibcameraMeta *meta)
+{
+	return meta->source->metadata();
+}
+
+/*
+ * Retrieve the value of a control by name, such as "ExposureTime". Scalar
+ * and string controls are supported, FALSE is returned for other array
+ * controls and for controls missing from the metadata.
+ */
+gboolean
+gst_libcamera_meta_get_control(GstLibcameraMeta *meta, const gchar *name,
+			       GValue *value)
+{
+	const ControlList &metadata = meta->source->metadata();
+
+	for (const auto &ctrl : metadata) {
+		auto id = controls::controls.find(ctrl.first);
+		if (id == controls::controls.end() ||
+		    strcmp(id->second->name().c_str(), name))
+			continue;
+
+		const ControlValue &val = ctrl.second;
+		if (val.type() == ControlTypeString) {
+			g_value_init(value, G_TYPE_STRING);
+			g_value_set_string(value, val.get<std::string>().c_str());
+			return TRUE;
+		}
+
+		if (val.isArray())
+			return FALSE;
+
+		switch (val.type()) {
+		case ControlTypeBool:
+			g_value_init(value, G_TYPE_BOOLEAN);
+			g_value_set_boolean(value, val.get<bool>());
+			return TRUE;
+		case ControlTypeByte:
+			g_value_init(value, G_TYPE_UCHAR);
+			g_value_set_uchar(value, val.get<uint8_t>());
+			return TRUE;
+		case ControlTypeInteger32:
+			g_value_init(value, G_TYPE_INT);
+			g_value_set_int(value, val.get<int32_t>());
+			return TRUE;
+		case ControlTypeInteger64:
+			g_value_init(value, G_TYPE_INT64);
+			g_value_set_int64(value, val.get<int64_t>());
+			return TRUE;
+		case ControlTypeFloat:
+			g_value_init(value, G_TYPE_FLOAT);
+			g_value_set_float(value, val.get<float>());
+			return TRUE;
+		default:
+			return FALSE;
+		}
+	}
+
+	return FALSE;
+}
@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * gstlibcamerameta.h - GStreamer meta carrying the libcamera request metadata
+ */
+
+#ifndef __GST_LIBCAMERA_META_H__
+#define __GST_LIBCAMERA_META_H__
+
+#include <gst/gst.h>
+
+#include <libcamera/controls.h>
+
+/**
+ * \class GstLibcameraMetaSource
+ * \brief Reference counted owner of the metadata referenced by the meta
+ *
+ * The meta doesn't copy the metadata ControlList, it references the source
+ * that owns it, which must keep the list unmodified until all its references
+ * have been released.
+ */
+class GstLibcameraMetaSource
+{
+public:
+	virtual const libcamera::ControlList &metadata() const = 0;
+	virtual void ref() = 0;
+	virtual void unref() = 0;
+
+protected:
+	~GstLibcameraMetaSource() = default;
+};
+
+struct GstLibcameraMeta {
+	GstMeta meta;
+	GstLibcameraMetaSource *source;
+};
+
+#define GST_LIBCAMERA_META_API_TYPE gst_libcamera_meta_api_get_type()
+#define GST_LIBCAMERA_META_INFO gst_libcamera_meta_get_info()
+
+GType gst_libcamera_meta_api_get_type();
+const GstMetaInfo *gst_libcamera_meta_get_info();
+
+#define gst_buffer_get_libcamera_meta(b) \
+	((GstLibcameraMeta *)gst_buffer_get_meta((b), GST_LIBCAMERA_META_API_TYPE))
+
+GstLibcameraMeta *gst_buffer_add_libcamera_meta(GstBuffer *buffer,
+						GstLibcameraMetaSource *source);
+void gst_libcamera_meta_copy(GstBuffer *dest, GstBuffer *src);
+
+const libcamera::ControlList &gst_libcamera_meta_get_metadata(GstLibcameraMeta *meta);
+gboolean gst_libcamera_meta_get_control(GstLibcameraMeta *meta, const gchar *name,
+					GValue *value);
+
+#endif /* __GST_LIBCAMERA_META_H__ */
@@ -8,9 +8,14 @@
 
 #include "gstlibcamerapad.h"
 
+#include <vector>
+
+#include <gst/base/base.h>
+
 #include <libcamera/stream.h>
 
 #include "gstlibcamera-utils.h"
+#include "gstlibcamerameta.h"
 
 using namespace libcamera;
 
@@ -18,8 +23,16 @@ struct _GstLibcameraPad {
 	GstPad parent;
 	StreamRole role;
 	GstLibcameraPool *pool;
-	GQueue pending_buffers;
+	GstQueueArray *pending_buffers;
 	GstClockTime latency;
+
+	/* Layout of the libcamera buffers, valid if has_info is true. */
+	GstVideoInfo info;
+	bool has_info;
+
+	/* Used to copy frames when downstream can't handle the layout. */
+	GstBufferPool *copy_pool;
+	GstVideoInfo copy_info;
 };
 
 enum {
@@ -81,6 +94,22 @@ static void
 gst_libcamera_pad_init(GstLibcameraPad *self)
 {
 	GST_PAD_QUERYFUNC(self) = gst_libcamera_pad_query;
+
+	/* The array grows to the number of buffers in flight and is reused. */
+	self->pending_buffers = gst_queue_array_new(4);
+}
+
+static void
+gst_libcamera_pad_finalize(GObject *object)
+{
+	auto *self = GST_LIBCAMERA_PAD(object);
+	GstBuffer *buffer;
+
+	while ((buffer = GST_BUFFER(gst_queue_array_pop_head(self->pending_buffers))))
+		gst_buffer_unref(buffer);
+	gst_queue_array_free(self->pending_buffers);
+
+	G_OBJECT_CLASS(gst_libcamera_pad_parent_class)->finalize(object);
 }
 
 static GType
@@ -107,6 +136,7 @@ gst_libcamera_pad_class_init(GstLibcameraPadClass *klass)
 
 	object_class->set_property = gst_libcamera_pad_set_property;
 	object_class->get_property = gst_libcamera_pad_get_property;
+	object_class->finalize = gst_libcamera_pad_finalize;
 
 	auto *spec = g_param_spec_enum("stream-role", "Stream Role",
 				       "The selected stream role",
@@ -161,7 +191,99 @@ gst_libcamera_pad_queue_buffer(GstPad *pad, GstBuffer *buffer)
 	auto *self = GST_LIBCAMERA_PAD(pad);
 	GLibLocker lock(GST_OBJECT(self));
 
-	g_queue_push_head(&self->pending_buffers, buffer);
+	gst_queue_array_push_tail(self->pending_buffers, buffer);
+}
+
+/*
+ * The meta is flagged as pooled, it is kept when the buffer returns to the
+ * GstLibcameraPool and only needs to be added once per buffer.
+ */
+static void
+gst_libcamera_pad_add_video_meta(GstLibcameraPad *self, GstBuffer *buffer)
+{
+	GstVideoInfo *info = &self->info;
+	guint n_planes = GST_VIDEO_INFO_N_PLANES(info);
+	guint n_memory = gst_buffer_n_memory(buffer);
+	gsize offset[GST_VIDEO_MAX_PLANES];
+	gint stride[GST_VIDEO_MAX_PLANES];
+	gsize mem_offset = 0;
+
+	for (guint i = 0; i < n_planes; i++) {
+		stride[i] = GST_VIDEO_INFO_PLANE_STRIDE(info, i);
+
+		/* Planes stored in separate memories start at their boundaries. */
+		if (n_memory == n_planes) {
+			offset[i] = mem_offset;
+			mem_offset += gst_buffer_peek_memory(buffer, i)->size;
+		} else {
+			offset[i] = GST_VIDEO_INFO_PLANE_OFFSET(info, i);
+		}
+	}
+
+	GstVideoMeta *meta =
+		gst_buffer_add_video_meta_full(buffer, GST_VIDEO_FRAME_FLAG_NONE,
+					       GST_VIDEO_INFO_FORMAT(info),
+					       GST_VIDEO_INFO_WIDTH(info),
+					       GST_VIDEO_INFO_HEIGHT(info),
+					       n_planes, offset, stride);
+	GST_META_FLAG_SET(meta, GST_META_FLAG_POOLED);
+}
+
+/*
+ * Describe the layout of the buffer with a GstVideoMeta, or copy it to a
+ * buffer using the default layout if downstream doesn't support the meta.
+ */
+static GstBuffer *
+gst_libcamera_pad_prepare_buffer(GstLibcameraPad *self, GstBuffer *buffer)
+{
+	GstVideoInfo *info = &self->info;
+	GstVideoMeta *meta = gst_buffer_get_video_meta(buffer);
+
+	/* Buffers reused after renegotiation carry the meta of the old layout. */
+	if (meta && (meta->format != GST_VIDEO_INFO_FORMAT(info) ||
+		     meta->width != GST_VIDEO_INFO_WIDTH(info) ||
+		     meta->height != GST_VIDEO_INFO_HEIGHT(info))) {
+		gst_buffer_remove_meta(buffer, GST_META_CAST(meta));
+		meta = nullptr;
+	}
+
+	if (!meta)
+		gst_libcamera_pad_add_video_meta(self, buffer);
+
+	if (!self->copy_pool)
+		return buffer;
+
+	GstBuffer *copy;
+	if (gst_buffer_pool_acquire_buffer(self->copy_pool, &copy, nullptr) != GST_FLOW_OK) {
+		gst_buffer_unref(buffer);
+		return nullptr;
+	}
+
+	GstVideoFrame src_frame, dst_frame;
+	bool copied = false;
+
+	if (gst_video_frame_map(&src_frame, info, buffer, GST_MAP_READ)) {
+		if (gst_video_frame_map(&dst_frame, &self->copy_info, copy, GST_MAP_WRITE)) {
+			copied = gst_video_frame_copy(&dst_frame, &src_frame);
+			gst_video_frame_unmap(&dst_frame);
+		}
+		gst_video_frame_unmap(&src_frame);
+	}
+
+	gst_buffer_copy_into(copy, buffer,
+			     (GstBufferCopyFlags)(GST_BUFFER_COPY_FLAGS |
+						  GST_BUFFER_COPY_TIMESTAMPS),
+			     0, -1);
+	gst_libcamera_meta_copy(copy, buffer);
+	gst_buffer_unref(buffer);
+
+	if (!copied) {
+		GST_ERROR_OBJECT(self, "Failed to copy frame");
+		gst_buffer_unref(copy);
+		return nullptr;
+	}
+
+	return copy;
 }
 
 GstFlowReturn
@@ -172,21 +294,44 @@ gst_libcamera_pad_push_pending(GstPad *pad)
 
 	{
 		GLibLocker lock(GST_OBJECT(self));
-		buffer = GST_BUFFER(g_queue_pop_tail(&self->pending_buffers));
+		buffer = GST_BUFFER(gst_queue_array_pop_head(self->pending_buffers));
 	}
 
 	if (!buffer)
 		return GST_FLOW_OK;
 
+	if (self->has_info) {
+		buffer = gst_libcamera_pad_prepare_buffer(self, buffer);
+		if (!buffer)
+			return GST_FLOW_ERROR;
+	}
+
 	return gst_pad_push(pad, buffer);
 }
 
+void
+gst_libcamera_pad_drop_pending(GstPad *pad)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+	std::vector<GstBuffer *> buffers;
+
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		while (!gst_queue_array_is_empty(self->pending_buffers))
+			buffers.push_back(GST_BUFFER(gst_queue_array_pop_head(self->pending_buffers)));
+	}
+
+	/* Releasing the buffers takes the element lock, don't hold the pad lock. */
+	for (GstBuffer *buffer : buffers)
+		gst_buffer_unref(buffer);
+}
+
 bool
 gst_libcamera_pad_has_pending(GstPad *pad)
 {
 	auto *self = GST_LIBCAMERA_PAD(pad);
 	GLibLocker lock(GST_OBJECT(self));
-	return self->pending_buffers.length > 0;
+	return !gst_queue_array_is_empty(self->pending_buffers);
 }
 
 void
@@ -196,3 +341,37 @@ gst_libcamera_pad_set_latency(GstPad *pad, GstClockTime latency)
 	GLibLocker lock(GST_OBJECT(self));
 	self->latency = latency;
 }
+
+void
+gst_libcamera_pad_set_video_info(GstPad *pad, const GstVideoInfo *info,
+				 bool video_meta)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+
+	if (self->copy_pool) {
+		gst_buffer_pool_set_active(self->copy_pool, FALSE);
+		gst_object_unref(self->copy_pool);
+		self->copy_pool = nullptr;
+	}
+
+	self->has_info = info != nullptr;
+	if (!info)
+		return;
+
+	self->info = *info;
+
+	if (video_meta || gst_libcamera_video_info_has_default_layout(info))
+		return;
+
+	GST_INFO_OBJECT(self, "Downstream lacks GstVideoMeta support, frames will be copied");
+
+	g_autoptr(GstCaps) caps = gst_video_info_to_caps(&self->info);
+	gst_video_info_from_caps(&self->copy_info, caps);
+
+	self->copy_pool = gst_video_buffer_pool_new();
+	GstStructure *config = gst_buffer_pool_get_config(self->copy_pool);
+	gst_buffer_pool_config_set_params(config, caps,
+					  GST_VIDEO_INFO_SIZE(&self->copy_info), 0, 0);
+	gst_buffer_pool_set_config(self->copy_pool, config);
+	gst_buffer_pool_set_active(self->copy_pool, TRUE);
+}
@@ -12,6 +12,7 @@
 #include "gstlibcamerapool.h"
 
 #include <gst/gst.h>
+#include <gst/video/video.h>
 
 #include <libcamera/stream.h>
 
@@ -30,8 +31,13 @@ void gst_libcamera_pad_queue_buffer(GstPad *pad, GstBuffer *buffer);
 
 GstFlowReturn gst_libcamera_pad_push_pending(GstPad *pad);
 
+void gst_libcamera_pad_drop_pending(GstPad *pad);
+
 bool gst_libcamera_pad_has_pending(GstPad *pad);
 
 void gst_libcamera_pad_set_latency(GstPad *pad, GstClockTime latency);
 
+void gst_libcamera_pad_set_video_info(GstPad *pad, const GstVideoInfo *info,
+				      bool video_meta);
+
 #endif /* __GST_LIBCAMERA_PAD_H__ */
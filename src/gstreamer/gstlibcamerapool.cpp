@@ -134,6 +134,12 @@ gst_libcamera_pool_get_stream(GstLibcameraPool *self)
 	return self->stream;
 }
 
+bool
+gst_libcamera_pool_is_empty(GstLibcameraPool *self)
+{
+	return gst_atomic_queue_length(self->queue) == 0;
+}
+
 Stream *
 gst_libcamera_buffer_get_stream(GstBuffer *buffer)
 {
@@ -26,6 +26,8 @@ GstLibcameraPool *gst_libcamera_pool_new(GstLibcameraAllocator *allocator,
 
 libcamera::Stream *gst_libcamera_pool_get_stream(GstLibcameraPool *self);
 
+bool gst_libcamera_pool_is_empty(GstLibcameraPool *self);
+
 libcamera::Stream *gst_libcamera_buffer_get_stream(GstBuffer *buffer);
 
 libcamera::FrameBuffer *gst_libcamera_buffer_get_frame_buffer(GstBuffer *buffer);
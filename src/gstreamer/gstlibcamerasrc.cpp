@@ -12,19 +12,18 @@
  *    + Allowing application to send EOS
  *    + Allowing application to use FLUSH/FLUSH_STOP
  *    + Prevent the main thread from accessing streaming thread
- *  - Implement renegotiation (even if slow)
  *  - Implement GstElement::request-new-pad (multi stream)
  *    + Evaluate if a single streaming thread is fine
  *  - Add application driven request (snapshot)
  *  - Add framerate control
- *  - Add buffer importation support
+ *  - Align sync group frames using hardware triggers when available
  *
  *  Requires new libcamera API:
  *  - Add framerate negotiation support
  *  - Add colorimetry support
  *  - Add timestamp support
  *  - Use unique names to select the camera devices
- *  - Add GstVideoMeta support (strides and offsets)
+ *  - Reconfigure streams without stopping the camera
  *
  * \todo libcamera UVC drivers picks the lowest possible resolution first, this
  * should be fixed so that we get a decent resolution and framerate for the
@@ -33,88 +32,127 @@
 
 #include "gstlibcamerasrc.h"
 
-#include <queue>
+#include <algorithm>
 #include <vector>
 
+#include <gst/allocators/allocators.h>
 #include <gst/base/base.h>
+#include <gst/video/video.h>
 
 #include <libcamera/camera.h>
 #include <libcamera/camera_manager.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/formats.h>
 
 #include "gstlibcameraallocator.h"
+#include "gstlibcamerameta.h"
 #include "gstlibcamerapad.h"
 #include "gstlibcamerapool.h"
 #include "gstlibcamera-utils.h"
+#include "gstlibcamerasyncgroup.h"
 
 using namespace libcamera;
 
 GST_DEBUG_CATEGORY_STATIC(source_debug);
 #define GST_CAT_DEFAULT source_debug
 
-struct RequestWrap {
-	RequestWrap(std::unique_ptr<Request> request);
+/*
+ * Requests are created when streaming starts and reused for the whole session.
+ * The RequestWrap address is used as the request cookie, and the buffers are
+ * stored by pad index to avoid allocating memory for each frame.
+ */
+struct GstLibcameraSrcState;
+
+struct RequestWrap final : public GstLibcameraMetaSource {
+	RequestWrap(GstLibcameraSrcState *state, unsigned int numBuffers);
 	~RequestWrap();
 
-	void attachBuffer(GstBuffer *buffer);
-	GstBuffer *detachBuffer(Stream *stream);
+	void attachBuffer(unsigned int index, GstBuffer *buffer);
+	GstBuffer *detachBuffer(unsigned int index);
+	void reuse();
+
+	const ControlList &metadata() const override { return request_->metadata(); }
+	void ref() override;
+	void unref() override;
 
+	GstLibcameraSrcState *state_;
 	std::unique_ptr<Request> request_;
-	std::map<Stream *, GstBuffer *> buffers_;
+	std::vector<GstBuffer *> buffers_;
+
+	/*
+	 * Number of GstLibcameraMeta referencing the request metadata. The
+	 * request is recycled when the last one is released, or deleted if
+	 * streaming has stopped in the meantime.
+	 */
+	gint refs_;
+	bool orphaned_;
 };
 
-RequestWrap::RequestWrap(std::unique_ptr<Request> request)
-	: request_(std::move(request))
+RequestWrap::RequestWrap(GstLibcameraSrcState *state, unsigned int numBuffers)
+	: state_(state), buffers_(numBuffers, nullptr), refs_(0), orphaned_(false)
 {
 }
 
 RequestWrap::~RequestWrap()
 {
-	for (std::pair<Stream *const, GstBuffer *> &item : buffers_) {
-		if (item.second)
-			gst_buffer_unref(item.second);
+	for (GstBuffer *buffer : buffers_) {
+		if (buffer)
+			gst_buffer_unref(buffer);
 	}
 }
 
-void RequestWrap::attachBuffer(GstBuffer *buffer)
+void RequestWrap::attachBuffer(unsigned int index, GstBuffer *buffer)
 {
 	FrameBuffer *fb = gst_libcamera_buffer_get_frame_buffer(buffer);
 	Stream *stream = gst_libcamera_buffer_get_stream(buffer);
 
 	request_->addBuffer(stream, fb);
 
-	auto item = buffers_.find(stream);
-	if (item != buffers_.end()) {
-		gst_buffer_unref(item->second);
-		item->second = buffer;
-	} else {
-		buffers_[stream] = buffer;
-	}
+	if (buffers_[index])
+		gst_buffer_unref(buffers_[index]);
+	buffers_[index] = buffer;
 }
 
-GstBuffer *RequestWrap::detachBuffer(Stream *stream)
+GstBuffer *RequestWrap::detachBuffer(unsigned int index)
 {
-	GstBuffer *buffer = nullptr;
+	GstBuffer *buffer = buffers_[index];
+	buffers_[index] = nullptr;
+	return buffer;
+}
 
-	auto item = buffers_.find(stream);
-	if (item != buffers_.end()) {
-		buffer = item->second;
-		item->second = nullptr;
+/*
+ * Release the buffers still attached to the request and prepare it to be
+ * queued again. Releasing buffers may notify the pools, this must not be called
+ * with the object lock held.
+ */
+void RequestWrap::reuse()
+{
+	for (GstBuffer *&buffer : buffers_) {
+		if (buffer) {
+			gst_buffer_unref(buffer);
+			buffer = nullptr;
+		}
 	}
 
-	return buffer;
+	request_->reuse();
 }
 
 /* Used for C++ object with destructors. */
 struct GstLibcameraSrcState {
 	GstLibcameraSrc *src_;
 
-	std::unique_ptr<CameraManager> cm_;
+	std::shared_ptr<CameraManager> cm_;
 	std::shared_ptr<Camera> cam_;
 	std::unique_ptr<CameraConfiguration> config_;
 	std::vector<GstPad *> srcpads_;
-	std::queue<std::unique_ptr<RequestWrap>> requests_;
+	std::vector<std::unique_ptr<RequestWrap>> requests_;
+	GstAtomicQueue *freeRequests_ = nullptr;
+	std::vector<GstBufferPool *> importPools_;
+	std::shared_ptr<SyncGroup> syncGroup_;
 
 	void requestCompleted(Request *request);
+	void deliverFrame(std::vector<GstBuffer *> &buffers);
+	void recycleRequest(RequestWrap *wrap);
 };
 
 struct _GstLibcameraSrc {
@@ -124,6 +162,8 @@ struct _GstLibcameraSrc {
 	GstTask *task;
 
 	gchar *camera_name;
+	gchar *sync_group;
+	GstClockTime sync_tolerance;
 
 	GstLibcameraSrcState *state;
 	GstLibcameraAllocator *allocator;
@@ -132,9 +172,13 @@ struct _GstLibcameraSrc {
 
 enum {
 	PROP_0,
-	PROP_CAMERA_NAME
+	PROP_CAMERA_NAME,
+	PROP_SYNC_GROUP,
+	PROP_SYNC_TOLERANCE,
 };
 
+#define DEFAULT_SYNC_TOLERANCE (5 * GST_MSECOND)
+
 G_DEFINE_TYPE_WITH_CODE(GstLibcameraSrc, gst_libcamera_src, GST_TYPE_ELEMENT,
 			GST_DEBUG_CATEGORY_INIT(source_debug, "libcamerasrc", 0,
 						"libcamera Source"))
@@ -154,60 +198,160 @@ GstStaticPadTemplate request_src_template = {
 void
 GstLibcameraSrcState::requestCompleted(Request *request)
 {
-	GLibLocker lock(GST_OBJECT(src_));
-
-	GST_DEBUG_OBJECT(src_, "buffers are ready");
-
-	std::unique_ptr<RequestWrap> wrap = std::move(requests_.front());
-	requests_.pop();
+	auto *wrap = reinterpret_cast<RequestWrap *>(request->cookie());
 
 	g_return_if_fail(wrap->request_.get() == request);
 
+	/* The buffers of cancelled requests are released when stopping. */
 	if ((request->status() == Request::RequestCancelled)) {
 		GST_DEBUG_OBJECT(src_, "Request was cancelled");
 		return;
 	}
 
-	GstBuffer *buffer;
-	for (GstPad *srcpad : srcpads_) {
-		Stream *stream = gst_libcamera_pad_get_stream(srcpad);
-		buffer = wrap->detachBuffer(stream);
+	SyncGroup::Frame frame;
 
-		FrameBuffer *fb = gst_libcamera_buffer_get_frame_buffer(buffer);
+	{
+		GLibLocker lock(GST_OBJECT(src_));
 
-		if (GST_ELEMENT_CLOCK(src_)) {
-			GstClockTime gst_base_time = GST_ELEMENT(src_)->base_time;
-			GstClockTime gst_now = gst_clock_get_time(GST_ELEMENT_CLOCK(src_));
-			/* \todo Need to expose which reference clock the timestamp relates to. */
-			GstClockTime sys_now = g_get_monotonic_time() * 1000;
+		GST_DEBUG_OBJECT(src_, "buffers are ready");
 
-			/* Deduced from: sys_now - sys_base_time == gst_now - gst_base_time */
-			GstClockTime sys_base_time = sys_now - (gst_now - gst_base_time);
-			GST_BUFFER_PTS(buffer) = fb->metadata().timestamp - sys_base_time;
-			gst_libcamera_pad_set_latency(srcpad, sys_now - fb->metadata().timestamp);
-		} else {
-			GST_BUFFER_PTS(buffer) = 0;
-		}
+		/* Released by RequestWrap::unref() once the metas are freed. */
+		gst_object_ref(src_);
+
+		GstBuffer *buffer;
+		for (gsize i = 0; i < srcpads_.size(); i++) {
+			GstPad *srcpad = srcpads_[i];
+			buffer = wrap->detachBuffer(i);
+
+			FrameBuffer *fb = gst_libcamera_buffer_get_frame_buffer(buffer);
+
+			if (GST_ELEMENT_CLOCK(src_)) {
+				GstClockTime gst_base_time = GST_ELEMENT(src_)->base_time;
+				GstClockTime gst_now = gst_clock_get_time(GST_ELEMENT_CLOCK(src_));
+				/* \todo Need to expose which reference clock the timestamp relates to. */
+				GstClockTime sys_now = g_get_monotonic_time() * 1000;
+
+				/* Deduced from: sys_now - sys_base_time == gst_now - gst_base_time */
+				GstClockTime sys_base_time = sys_now - (gst_now - gst_base_time);
+				GST_BUFFER_PTS(buffer) = fb->metadata().timestamp - sys_base_time;
+				gst_libcamera_pad_set_latency(srcpad, sys_now - fb->metadata().timestamp);
+			} else {
+				GST_BUFFER_PTS(buffer) = 0;
+			}
 
-		GST_BUFFER_OFFSET(buffer) = fb->metadata().sequence;
-		GST_BUFFER_OFFSET_END(buffer) = fb->metadata().sequence;
+			GST_BUFFER_OFFSET(buffer) = fb->metadata().sequence;
+			GST_BUFFER_OFFSET_END(buffer) = fb->metadata().sequence;
 
-		gst_libcamera_pad_queue_buffer(srcpad, buffer);
+			/*
+			 * Compressed frames only fill part of the buffer. Video
+			 * frames that aren't key frames depend on the previous
+			 * ones.
+			 */
+			const PixelFormat &format =
+				gst_libcamera_buffer_get_stream(buffer)->configuration().pixelFormat;
+			if (gst_libcamera_pixel_format_is_encoded(format)) {
+				gst_buffer_set_size(buffer, fb->metadata().planes()[0].bytesused);
+
+				if (format != formats::MJPEG &&
+				    !(fb->metadata().flags & FrameMetadata::FlagKeyFrame))
+					GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+			}
+
+			/* The request is recycled when all the metas are released. */
+			gst_buffer_add_libcamera_meta(buffer, wrap);
+
+			if (syncGroup_) {
+				if (frame.buffers.empty())
+					frame.timestamp = fb->metadata().timestamp;
+				frame.buffers.push_back(buffer);
+			} else {
+				gst_libcamera_pad_queue_buffer(srcpad, buffer);
+			}
+		}
+
+		if (!syncGroup_) {
+			gst_libcamera_resume_task(this->src_->task);
+			return;
+		}
 	}
 
+	/*
+	 * Pair frames using the time the sensor started exposing them, the
+	 * buffer timestamps are only used when the pipeline doesn't report it.
+	 */
+	if (request->metadata().contains(controls::SensorTimestamp))
+		frame.timestamp = request->metadata().get(controls::SensorTimestamp);
+
+	/* Frames are queued to the pads when the group delivers them. */
+	syncGroup_->queueFrame(GST_ELEMENT(src_), std::move(frame));
+}
+
+void
+GstLibcameraSrcState::deliverFrame(std::vector<GstBuffer *> &buffers)
+{
+	GLibLocker lock(GST_OBJECT(src_));
+
+	for (gsize i = 0; i < buffers.size() && i < srcpads_.size(); i++)
+		gst_libcamera_pad_queue_buffer(srcpads_[i], buffers[i]);
+
 	gst_libcamera_resume_task(this->src_->task);
 }
 
+/* Must be called with the object lock held. */
+void
+GstLibcameraSrcState::recycleRequest(RequestWrap *wrap)
+{
+	if (wrap->orphaned_) {
+		delete wrap;
+		return;
+	}
+
+	wrap->request_->reuse();
+	gst_atomic_queue_push(freeRequests_, wrap);
+
+	gst_libcamera_resume_task(src_->task);
+}
+
+/*
+ * References are only taken from zero when completing the request, with the
+ * object lock held, or when copying a meta, which requires a reference to be
+ * held already. Taking the lock isn't needed.
+ */
+void RequestWrap::ref()
+{
+	g_atomic_int_inc(&refs_);
+}
+
+/*
+ * Release the last reference with the object lock held, for the stopping
+ * streaming thread to know reliably which requests are still in use.
+ */
+void RequestWrap::unref()
+{
+	GstLibcameraSrc *src = state_->src_;
+
+	{
+		GLibLocker lock(GST_OBJECT(src));
+
+		if (!g_atomic_int_dec_and_test(&refs_))
+			return;
+
+		state_->recycleRequest(this);
+	}
+
+	gst_object_unref(src);
+}
+
 static bool
 gst_libcamera_src_open(GstLibcameraSrc *self)
 {
-	std::unique_ptr<CameraManager> cm = std::make_unique<CameraManager>();
+	std::shared_ptr<CameraManager> cm;
 	std::shared_ptr<Camera> cam;
 	gint ret = 0;
 
 	GST_DEBUG_OBJECT(self, "Opening camera device ...");
 
-	ret = cm->start();
+	cm = gst_libcamera_get_camera_manager(ret);
 	if (ret) {
 		GST_ELEMENT_ERROR(self, LIBRARY, INIT,
 				  ("Failed listing cameras."),
@@ -252,6 +396,23 @@ gst_libcamera_src_open(GstLibcameraSrc *self)
 
 	cam->requestCompleted.connect(self->state, &GstLibcameraSrcState::requestCompleted);
 
+	g_autofree gchar *sync_group = nullptr;
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		if (self->sync_group)
+			sync_group = g_strdup(self->sync_group);
+	}
+
+	if (sync_group) {
+		GstLibcameraSrcState *state = self->state;
+
+		state->syncGroup_ = SyncGroup::get(sync_group);
+		state->syncGroup_->addMember(GST_ELEMENT(self),
+					     [state](std::vector<GstBuffer *> &buffers) {
+						     state->deliverFrame(buffers);
+					     });
+	}
+
 	/* No need to lock here, we didn't start our threads yet. */
 	self->state->cm_ = std::move(cm);
 	self->state->cam_ = cam;
@@ -259,27 +420,21 @@ gst_libcamera_src_open(GstLibcameraSrc *self)
 	return true;
 }
 
-static void
-gst_libcamera_src_task_run(gpointer user_data)
+/*
+ * Queue a free request with a buffer from each pad's pool. Return false when
+ * no request could be queued, because either a request or buffers are missing.
+ */
+static bool
+gst_libcamera_src_queue_request(GstLibcameraSrc *self)
 {
-	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(user_data);
 	GstLibcameraSrcState *state = self->state;
 
-	std::unique_ptr<Request> request = state->cam_->createRequest();
-	if (!request) {
-		GST_ELEMENT_ERROR(self, RESOURCE, NO_SPACE_LEFT,
-				  ("Failed to allocate request for camera '%s'.",
-				   state->cam_->id().c_str()),
-				  ("libcamera::Camera::createRequest() failed"));
-		gst_task_stop(self->task);
-		return;
-	}
-
-	std::unique_ptr<RequestWrap> wrap =
-		std::make_unique<RequestWrap>(std::move(request));
+	auto *wrap = reinterpret_cast<RequestWrap *>(gst_atomic_queue_pop(state->freeRequests_));
+	if (!wrap)
+		return false;
 
-	for (GstPad *srcpad : state->srcpads_) {
-		GstLibcameraPool *pool = gst_libcamera_pad_get_pool(srcpad);
+	for (gsize i = 0; i < state->srcpads_.size(); i++) {
+		GstLibcameraPool *pool = gst_libcamera_pad_get_pool(state->srcpads_[i]);
 		GstBuffer *buffer;
 		GstFlowReturn ret;
 
@@ -287,25 +442,80 @@ gst_libcamera_src_task_run(gpointer user_data)
 						     &buffer, nullptr);
 		if (ret != GST_FLOW_OK) {
 			/*
-			 * RequestWrap has ownership of the rquest, and we
-			 * won't be queueing this one due to lack of buffers.
+			 * Give the buffers back to the pools, the task will be
+			 * resumed when the missing ones are released.
 			 */
-			wrap.release();
-			break;
+			wrap->reuse();
+			gst_atomic_queue_push(state->freeRequests_, wrap);
+			return false;
 		}
 
-		wrap->attachBuffer(buffer);
+		wrap->attachBuffer(i, buffer);
 	}
 
-	if (wrap) {
-		GLibLocker lock(GST_OBJECT(self));
-		GST_TRACE_OBJECT(self, "Requesting buffers");
-		state->cam_->queueRequest(wrap->request_.get());
-		state->requests_.push(std::move(wrap));
+	GST_TRACE_OBJECT(self, "Requesting buffers");
+
+	int ret = state->cam_->queueRequest(wrap->request_.get());
+	if (ret < 0) {
+		GST_WARNING_OBJECT(self, "Failed to queue request: %s", g_strerror(-ret));
+		wrap->reuse();
+		gst_atomic_queue_push(state->freeRequests_, wrap);
+		return false;
+	}
+
+	/* The request is recycled once the metas of its buffers are released. */
+	return true;
+}
+
+/*
+ * Check if a request could be queued. Must be called with the object lock held,
+ * in lock step with the notifications that resume the task.
+ */
+static bool
+gst_libcamera_src_can_queue(GstLibcameraSrc *self)
+{
+	GstLibcameraSrcState *state = self->state;
+
+	if (!gst_atomic_queue_length(state->freeRequests_))
+		return false;
 
-		/* The RequestWrap will be deleted in the completion handler. */
+	for (GstPad *srcpad : state->srcpads_) {
+		if (gst_libcamera_pool_is_empty(gst_libcamera_pad_get_pool(srcpad)))
+			return false;
 	}
 
+	return true;
+}
+
+static void
+gst_libcamera_src_buffer_notify(GstLibcameraSrc *self)
+{
+	GLibLocker lock(GST_OBJECT(self));
+	gst_libcamera_resume_task(self->task);
+}
+
+static bool gst_libcamera_src_renegotiate(GstLibcameraSrc *self);
+
+static void
+gst_libcamera_src_task_run(gpointer user_data)
+{
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(user_data);
+	GstLibcameraSrcState *state = self->state;
+
+	/* Renegotiate when downstream requests it, checking all pads. */
+	bool reconfigure = false;
+	for (GstPad *srcpad : state->srcpads_)
+		reconfigure |= gst_pad_check_reconfigure(srcpad);
+
+	if (reconfigure && !gst_libcamera_src_renegotiate(self)) {
+		gst_task_stop(self->task);
+		return;
+	}
+
+	/* Keep the camera fed with all the requests buffers are available for. */
+	while (gst_libcamera_src_queue_request(self))
+		;
+
 	GstFlowReturn ret = GST_FLOW_OK;
 	gst_flow_combiner_reset(self->flow_combiner);
 	for (GstPad *srcpad : state->srcpads_) {
@@ -314,28 +524,36 @@ gst_libcamera_src_task_run(gpointer user_data)
 							srcpad, ret);
 	}
 
+	if (ret != GST_FLOW_OK) {
+		if (ret == GST_FLOW_EOS) {
+			g_autoptr(GstEvent) eos = gst_event_new_eos();
+			guint32 seqnum = gst_util_seqnum_next();
+			gst_event_set_seqnum(eos, seqnum);
+			for (GstPad *srcpad : state->srcpads_)
+				gst_pad_push_event(srcpad, gst_event_ref(eos));
+		} else if (ret != GST_FLOW_FLUSHING) {
+			GST_ELEMENT_FLOW_ERROR(self, ret);
+		}
+		gst_task_stop(self->task);
+		return;
+	}
+
 	{
 		/*
-		 * Here we need to decide if we want to pause or stop the task. This
-		 * needs to happen in lock step with the callback thread which may want
-		 * to resume the task.
+		 * Here we need to decide if we want to pause the task. This needs
+		 * to happen in lock step with the callback threads which may want
+		 * to resume the task. Downstream may release buffers when
+		 * receiving events, which takes the lock from the buffer-notify
+		 * handler, so no event can be pushed with the lock held.
 		 */
 		GLibLocker lock(GST_OBJECT(self));
-		if (ret != GST_FLOW_OK) {
-			if (ret == GST_FLOW_EOS) {
-				g_autoptr(GstEvent) eos = gst_event_new_eos();
-				guint32 seqnum = gst_util_seqnum_next();
-				gst_event_set_seqnum(eos, seqnum);
-				for (GstPad *srcpad : state->srcpads_)
-					gst_pad_push_event(srcpad, gst_event_ref(eos));
-			} else if (ret != GST_FLOW_FLUSHING) {
-				GST_ELEMENT_FLOW_ERROR(self, ret);
-			}
-			gst_task_stop(self->task);
-			return;
-		}
 
-		bool do_pause = true;
+		/*
+		 * Buffers released by downstream while pushing didn't resume
+		 * the running task, don't pause if they allow queueing a
+		 * request.
+		 */
+		bool do_pause = !gst_libcamera_src_can_queue(self);
 		for (GstPad *srcpad : state->srcpads_) {
 			if (gst_libcamera_pad_has_pending(srcpad)) {
 				do_pause = false;
@@ -348,52 +566,183 @@ gst_libcamera_src_task_run(gpointer user_data)
 	}
 }
 
+/*
+ * Check if a buffer acquired from a downstream pool can be used to capture
+ * frames. The dmabuf must hold the whole frame, with the layout produced by
+ * libcamera.
+ */
+static bool
+gst_libcamera_src_buffer_is_importable(GstBuffer *buffer,
+				       const StreamConfiguration &stream_cfg,
+				       const GstVideoInfo *info)
+{
+	/* \todo Support importing multi-planar buffers. */
+	if (gst_buffer_n_memory(buffer) != 1)
+		return false;
+
+	GstMemory *mem = gst_buffer_peek_memory(buffer, 0);
+	if (!gst_is_dmabuf_memory(mem) || mem->offset != 0 ||
+	    mem->size < stream_cfg.frameSize)
+		return false;
+
+	GstVideoMeta *meta = gst_buffer_get_video_meta(buffer);
+	if (!meta || !info)
+		return true;
+
+	if (meta->n_planes != GST_VIDEO_INFO_N_PLANES(info))
+		return false;
+
+	for (guint i = 0; i < meta->n_planes; i++) {
+		if (meta->stride[i] != GST_VIDEO_INFO_PLANE_STRIDE(info, i) ||
+		    meta->offset[i] != GST_VIDEO_INFO_PLANE_OFFSET(info, i))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Acquire all the buffers needed by the stream from the downstream pool. On
+ * success, the buffers are stored in the buffers vector and the pool is left
+ * active. On failure, the pool is deactivated and the vector is left empty.
+ */
+static bool
+gst_libcamera_src_import_pool(GstLibcameraSrc *self, GstBufferPool *pool,
+			      const StreamConfiguration &stream_cfg, GstCaps *caps,
+			      const GstVideoInfo *info,
+			      std::vector<GstBuffer *> *buffers)
+{
+	GstStructure *config = gst_buffer_pool_get_config(pool);
+	gst_buffer_pool_config_set_params(config, caps, stream_cfg.frameSize,
+					  stream_cfg.bufferCount,
+					  stream_cfg.bufferCount);
+	if (gst_buffer_pool_has_option(pool, GST_BUFFER_POOL_OPTION_VIDEO_META))
+		gst_buffer_pool_config_add_option(config, GST_BUFFER_POOL_OPTION_VIDEO_META);
+
+	if (!gst_buffer_pool_set_config(pool, config)) {
+		GST_DEBUG_OBJECT(self, "Downstream pool rejected the configuration");
+		return false;
+	}
+
+	if (!gst_buffer_pool_set_active(pool, TRUE))
+		return false;
+
+	bool importable = true;
+	for (guint i = 0; i < stream_cfg.bufferCount; i++) {
+		GstBuffer *buffer;
+
+		if (gst_buffer_pool_acquire_buffer(pool, &buffer, nullptr) != GST_FLOW_OK) {
+			importable = false;
+			break;
+		}
+
+		buffers->push_back(buffer);
+
+		if (!gst_libcamera_src_buffer_is_importable(buffer, stream_cfg, info)) {
+			importable = false;
+			break;
+		}
+	}
+
+	if (!importable) {
+		GST_DEBUG_OBJECT(self, "Downstream buffers can't be imported");
+
+		for (GstBuffer *buffer : *buffers)
+			gst_buffer_unref(buffer);
+		buffers->clear();
+
+		gst_buffer_pool_set_active(pool, FALSE);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Run the allocation query for the pad, to find out if downstream supports
+ * GstVideoMeta, and try to capture directly to the downstream buffers when it
+ * provides a dmabuf pool. Buffers are not imported if the buffers vector is
+ * null.
+ */
 static void
-gst_libcamera_src_task_enter(GstTask *task, [[maybe_unused]] GThread *thread,
-			     gpointer user_data)
+gst_libcamera_src_negotiate_allocation(GstLibcameraSrc *self, GstPad *srcpad,
+				       const StreamConfiguration &stream_cfg,
+				       std::vector<GstBuffer *> *buffers)
 {
-	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(user_data);
-	GLibRecLocker lock(&self->stream_lock);
 	GstLibcameraSrcState *state = self->state;
-	GstFlowReturn flow_ret = GST_FLOW_OK;
-	gint ret;
+	g_autoptr(GstCaps) caps = gst_libcamera_stream_configuration_to_caps(stream_cfg);
+	GstVideoInfo info;
+	bool has_info = gst_libcamera_stream_configuration_to_video_info(stream_cfg,
+									 caps, &info);
+
+	g_autoptr(GstQuery) query = gst_query_new_allocation(caps, TRUE);
+	if (!gst_pad_peer_query(srcpad, query))
+		GST_DEBUG_OBJECT(self, "Didn't get downstream ALLOCATION hints");
+
+	bool video_meta = gst_query_find_allocation_meta(query, GST_VIDEO_META_API_TYPE,
+							 nullptr);
+	if (has_info)
+		gst_libcamera_pad_set_video_info(srcpad, &info, video_meta);
+
+	/* Frames copied to the default layout don't benefit from importing. */
+	if (has_info && !video_meta && !gst_libcamera_video_info_has_default_layout(&info))
+		return;
 
-	GST_DEBUG_OBJECT(self, "Streaming thread has started");
+	/* Buffers are only imported when allocating them. */
+	if (!buffers || !gst_query_get_n_allocation_pools(query))
+		return;
 
-	guint group_id = gst_util_group_id_next();
-	StreamRoles roles;
-	for (GstPad *srcpad : state->srcpads_) {
-		/* Create stream-id and push stream-start. */
-		g_autofree gchar *stream_id = gst_pad_create_stream_id(srcpad, GST_ELEMENT(self), nullptr);
-		GstEvent *event = gst_event_new_stream_start(stream_id);
-		gst_event_set_group_id(event, group_id);
-		gst_pad_push_event(srcpad, event);
+	GstBufferPool *pool = nullptr;
+	gst_query_parse_nth_allocation_pool(query, 0, &pool, nullptr, nullptr, nullptr);
+	if (!pool)
+		return;
 
-		/* Collect the streams roles for the next iteration. */
-		roles.push_back(gst_libcamera_pad_get_role(srcpad));
+	if (!gst_libcamera_src_import_pool(self, pool, stream_cfg, caps,
+					   has_info ? &info : nullptr, buffers)) {
+		gst_object_unref(pool);
+		return;
 	}
 
+	GST_INFO_OBJECT(self, "Importing %u buffers from downstream pool %" GST_PTR_FORMAT,
+			stream_cfg.bufferCount, pool);
+	state->importPools_.push_back(pool);
+}
+
+/*
+ * Generate a camera configuration with one stream per pad, configured from the
+ * caps supported downstream. Return nullptr after posting an error message on
+ * failure.
+ */
+static std::unique_ptr<CameraConfiguration>
+gst_libcamera_src_generate_configuration(GstLibcameraSrc *self)
+{
+	GstLibcameraSrcState *state = self->state;
+
+	StreamRoles roles;
+	for (GstPad *srcpad : state->srcpads_)
+		roles.push_back(gst_libcamera_pad_get_role(srcpad));
+
 	/* Generate the stream configurations, there should be one per pad. */
-	state->config_ = state->cam_->generateConfiguration(roles);
-	if (state->config_ == nullptr) {
+	std::unique_ptr<CameraConfiguration> config =
+		state->cam_->generateConfiguration(roles);
+	if (config == nullptr) {
 		GST_ELEMENT_ERROR(self, RESOURCE, SETTINGS,
 				  ("Failed to generate camera configuration from roles"),
 				  ("Camera::generateConfiguration() returned nullptr"));
-		gst_task_stop(task);
-		return;
+		return nullptr;
 	}
-	g_assert(state->config_->size() == state->srcpads_.size());
+	g_assert(config->size() == state->srcpads_.size());
 
 	for (gsize i = 0; i < state->srcpads_.size(); i++) {
 		GstPad *srcpad = state->srcpads_[i];
-		StreamConfiguration &stream_cfg = state->config_->at(i);
+		StreamConfiguration &stream_cfg = config->at(i);
 
 		/* Retrieve the supported caps. */
 		g_autoptr(GstCaps) filter = gst_libcamera_stream_formats_to_caps(stream_cfg.formats());
 		g_autoptr(GstCaps) caps = gst_pad_peer_query_caps(srcpad, filter);
 		if (gst_caps_is_empty(caps)) {
-			flow_ret = GST_FLOW_NOT_NEGOTIATED;
-			break;
+			GST_ELEMENT_FLOW_ERROR(self, GST_FLOW_NOT_NEGOTIATED);
+			return nullptr;
 		}
 
 		/* Fixate caps and configure the stream. */
@@ -401,51 +750,70 @@ gst_libcamera_src_task_enter(GstTask *task, [[maybe_unused]] GThread *thread,
 		gst_libcamera_configure_stream_from_caps(stream_cfg, caps);
 	}
 
-	if (flow_ret != GST_FLOW_OK)
-		goto done;
-
 	/* Validate the configuration. */
-	if (state->config_->validate() == CameraConfiguration::Invalid) {
-		flow_ret = GST_FLOW_NOT_NEGOTIATED;
-		goto done;
+	if (config->validate() == CameraConfiguration::Invalid) {
+		GST_ELEMENT_FLOW_ERROR(self, GST_FLOW_NOT_NEGOTIATED);
+		return nullptr;
 	}
 
-	/*
-	 * Regardless if it has been modified, create clean caps and push the
-	 * caps event. Downstream will decide if the caps are acceptable.
-	 */
+	return config;
+}
+
+/*
+ * Regardless if it has been modified, create clean caps from the current
+ * configuration and push the caps event. Downstream will decide if the caps
+ * are acceptable.
+ */
+static bool
+gst_libcamera_src_push_caps(GstLibcameraSrc *self)
+{
+	GstLibcameraSrcState *state = self->state;
+
 	for (gsize i = 0; i < state->srcpads_.size(); i++) {
 		GstPad *srcpad = state->srcpads_[i];
 		const StreamConfiguration &stream_cfg = state->config_->at(i);
 
 		g_autoptr(GstCaps) caps = gst_libcamera_stream_configuration_to_caps(stream_cfg);
 		if (!gst_pad_push_event(srcpad, gst_event_new_caps(caps))) {
-			flow_ret = GST_FLOW_NOT_NEGOTIATED;
-			break;
+			GST_ELEMENT_FLOW_ERROR(self, GST_FLOW_NOT_NEGOTIATED);
+			return false;
 		}
-
-		/* Send an open segment event with time format. */
-		GstSegment segment;
-		gst_segment_init(&segment, GST_FORMAT_TIME);
-		gst_pad_push_event(srcpad, gst_event_new_segment(&segment));
 	}
 
-	ret = state->cam_->configure(state->config_.get());
-	if (ret) {
-		GST_ELEMENT_ERROR(self, RESOURCE, SETTINGS,
-				  ("Failed to configure camera: %s", g_strerror(-ret)),
-				  ("Camera::configure() failed with error code %i", ret));
-		gst_task_stop(task);
-		return;
+	return true;
+}
+
+/*
+ * Allocate the buffers of all streams, importing them from downstream when
+ * possible, and create the pools and the requests. Return false after posting
+ * an error message on failure.
+ */
+static bool
+gst_libcamera_src_allocate(GstLibcameraSrc *self)
+{
+	GstLibcameraSrcState *state = self->state;
+
+	{
+		std::map<Stream *, std::vector<GstBuffer *>> imported;
+
+		for (gsize i = 0; i < state->srcpads_.size(); i++) {
+			const StreamConfiguration &stream_cfg = state->config_->at(i);
+
+			gst_libcamera_src_negotiate_allocation(self, state->srcpads_[i],
+							       stream_cfg,
+							       &imported[stream_cfg.stream()]);
+		}
+
+		self->allocator = gst_libcamera_allocator_new(state->cam_,
+							      state->config_.get(),
+							      imported);
 	}
 
-	self->allocator = gst_libcamera_allocator_new(state->cam_, state->config_.get());
 	if (!self->allocator) {
 		GST_ELEMENT_ERROR(self, RESOURCE, NO_SPACE_LEFT,
 				  ("Failed to allocate memory"),
 				  ("gst_libcamera_allocator_new() failed."));
-		gst_task_stop(task);
-		return;
+		return false;
 	}
 
 	self->flow_combiner = gst_flow_combiner_new();
@@ -455,30 +823,285 @@ gst_libcamera_src_task_enter(GstTask *task, [[maybe_unused]] GThread *thread,
 		GstLibcameraPool *pool = gst_libcamera_pool_new(self->allocator,
 								stream_cfg.stream());
 		g_signal_connect_swapped(pool, "buffer-notify",
-					 G_CALLBACK(gst_libcamera_resume_task), task);
+					 G_CALLBACK(gst_libcamera_src_buffer_notify), self);
 
 		gst_libcamera_pad_set_pool(srcpad, pool);
 		gst_flow_combiner_add_pad(self->flow_combiner, srcpad);
 	}
 
-	ret = state->cam_->start();
+	/* Create one request per set of buffers, to be reused until stopping. */
+	gsize num_requests = G_MAXSIZE;
+	for (gsize i = 0; i < state->srcpads_.size(); i++) {
+		Stream *stream = state->config_->at(i).stream();
+		num_requests = std::min(num_requests,
+					gst_libcamera_allocator_get_pool_size(self->allocator,
+									      stream));
+	}
+
+	if (num_requests < state->config_->minRequestDepth())
+		GST_WARNING_OBJECT(self, "%" G_GSIZE_FORMAT " requests are not enough to avoid frame drops, %u needed",
+				   num_requests, state->config_->minRequestDepth());
+
+	state->freeRequests_ = gst_atomic_queue_new(num_requests);
+	for (gsize i = 0; i < num_requests; i++) {
+		auto wrap = std::make_unique<RequestWrap>(state, state->srcpads_.size());
+		wrap->request_ = state->cam_->createRequest(reinterpret_cast<uint64_t>(wrap.get()));
+		if (!wrap->request_) {
+			GST_ELEMENT_ERROR(self, RESOURCE, NO_SPACE_LEFT,
+					  ("Failed to allocate request for camera '%s'.",
+					   state->cam_->id().c_str()),
+					  ("libcamera::Camera::createRequest() failed"));
+			return false;
+		}
+
+		gst_atomic_queue_push(state->freeRequests_, wrap.get());
+		state->requests_.push_back(std::move(wrap));
+	}
+
+	return true;
+}
+
+/*
+ * Release the requests, the pools and the buffers. The camera must be stopped.
+ */
+static void
+gst_libcamera_src_free(GstLibcameraSrc *self)
+{
+	GstLibcameraSrcState *state = self->state;
+
+	/*
+	 * Requests whose metadata is still referenced by downstream are
+	 * deleted when released. Delete the other ones and the buffers held by
+	 * cancelled requests without the object lock, as releasing buffers
+	 * notifies the pools.
+	 */
+	std::vector<std::unique_ptr<RequestWrap>> requests;
+	{
+		GLibLocker lock(GST_OBJECT(self));
+
+		for (std::unique_ptr<RequestWrap> &wrap : state->requests_) {
+			if (g_atomic_int_get(&wrap->refs_)) {
+				wrap->orphaned_ = true;
+				wrap.release();
+			} else {
+				requests.push_back(std::move(wrap));
+			}
+		}
+
+		state->requests_.clear();
+	}
+
+	requests.clear();
+	g_clear_pointer(&state->freeRequests_, gst_atomic_queue_unref);
+
+	for (GstPad *srcpad : state->srcpads_) {
+		gst_libcamera_pad_set_pool(srcpad, nullptr);
+		gst_libcamera_pad_set_video_info(srcpad, nullptr, false);
+	}
+
+	g_clear_object(&self->allocator);
+
+	/* Outstanding imported buffers are freed when returned to the pools. */
+	for (GstBufferPool *pool : state->importPools_) {
+		gst_buffer_pool_set_active(pool, FALSE);
+		gst_object_unref(pool);
+	}
+	state->importPools_.clear();
+	g_clear_pointer(&self->flow_combiner,
+			(GDestroyNotify)gst_flow_combiner_free);
+}
+
+/*
+ * Start the camera, along with the other cameras of the sync group. Return
+ * false after posting an error message on failure.
+ */
+static bool
+gst_libcamera_src_start_camera(GstLibcameraSrc *self)
+{
+	GstLibcameraSrcState *state = self->state;
+
+	/* Start all the cameras of the sync group together. */
+	if (state->syncGroup_) {
+		GstClockTime tolerance;
+		{
+			GLibLocker lock(GST_OBJECT(self));
+			tolerance = self->sync_tolerance;
+		}
+
+		/* Keep a request available for capture when a member stalls. */
+		state->syncGroup_->start(GST_ELEMENT(self), tolerance,
+					 state->requests_.size() > 1 ? state->requests_.size() - 1 : 1);
+	}
+
+	int ret = state->cam_->start();
 	if (ret) {
 		GST_ELEMENT_ERROR(self, RESOURCE, SETTINGS,
 				  ("Failed to start the camera: %s", g_strerror(-ret)),
 				  ("Camera.start() failed with error code %i", ret));
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Check if the buffers allocated for the previous configuration of a stream
+ * can hold the frames of its new configuration.
+ */
+static bool
+gst_libcamera_src_can_reuse_buffers(const StreamConfiguration &previous,
+				    const StreamConfiguration &stream_cfg)
+{
+	return stream_cfg.stream() == previous.stream() &&
+	       stream_cfg.pixelFormat == previous.pixelFormat &&
+	       stream_cfg.bufferCount == previous.bufferCount &&
+	       stream_cfg.frameSize && stream_cfg.frameSize <= previous.frameSize;
+}
+
+/*
+ * Reconfigure the streams when downstream requests different caps while
+ * streaming. libcamera can only reconfigure a stopped camera, but the requests
+ * and the buffers are kept when the new frames fit in them, so only the frames
+ * in flight are lost. Buffers imported from downstream are tied to the previous
+ * caps and are always reallocated. Return false after posting an error message
+ * on failure.
+ */
+static bool
+gst_libcamera_src_renegotiate(GstLibcameraSrc *self)
+{
+	GstLibcameraSrcState *state = self->state;
+
+	std::unique_ptr<CameraConfiguration> config =
+		gst_libcamera_src_generate_configuration(self);
+	if (!config)
+		return false;
+
+	bool changed = false;
+	for (gsize i = 0; i < config->size(); i++) {
+		const StreamConfiguration &stream_cfg = config->at(i);
+		const StreamConfiguration &current = state->config_->at(i);
+
+		if (stream_cfg.pixelFormat != current.pixelFormat ||
+		    stream_cfg.size != current.size ||
+		    stream_cfg.bufferCount != current.bufferCount) {
+			changed = true;
+			break;
+		}
+	}
+
+	if (!changed) {
+		GST_DEBUG_OBJECT(self, "Configuration unchanged, keep streaming");
+		return true;
+	}
+
+	GST_INFO_OBJECT(self, "Renegotiating the camera configuration");
+
+	state->cam_->stop();
+
+	if (state->syncGroup_)
+		state->syncGroup_->stop(GST_ELEMENT(self));
+
+	/* Drop the frames captured with the previous configuration. */
+	for (GstPad *srcpad : state->srcpads_)
+		gst_libcamera_pad_drop_pending(srcpad);
+
+	std::vector<StreamConfiguration> previous(state->config_->begin(),
+						  state->config_->end());
+
+	int ret = state->cam_->configure(config.get());
+	if (ret) {
+		GST_ELEMENT_ERROR(self, RESOURCE, SETTINGS,
+				  ("Failed to configure camera: %s", g_strerror(-ret)),
+				  ("Camera::configure() failed with error code %i", ret));
+		return false;
+	}
+
+	state->config_ = std::move(config);
+
+	bool reuse = state->importPools_.empty();
+	for (gsize i = 0; i < state->config_->size() && reuse; i++)
+		reuse = gst_libcamera_src_can_reuse_buffers(previous[i],
+							    state->config_->at(i));
+
+	if (reuse) {
+		GST_DEBUG_OBJECT(self, "Reusing the allocated buffers");
+
+		/* Queue the requests cancelled by stopping the camera again. */
+		for (std::unique_ptr<RequestWrap> &wrap : state->requests_) {
+			if (wrap->request_->status() != Request::RequestCancelled)
+				continue;
+
+			wrap->reuse();
+			gst_atomic_queue_push(state->freeRequests_, wrap.get());
+		}
+	} else {
+		gst_libcamera_src_free(self);
+	}
+
+	if (!gst_libcamera_src_push_caps(self))
+		return false;
+
+	if (reuse) {
+		/* Update the layout of the frames, without importing buffers. */
+		for (gsize i = 0; i < state->srcpads_.size(); i++)
+			gst_libcamera_src_negotiate_allocation(self, state->srcpads_[i],
+							       state->config_->at(i),
+							       nullptr);
+	} else if (!gst_libcamera_src_allocate(self)) {
+		return false;
+	}
+
+	return gst_libcamera_src_start_camera(self);
+}
+
+static void
+gst_libcamera_src_task_enter(GstTask *task, [[maybe_unused]] GThread *thread,
+			     gpointer user_data)
+{
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(user_data);
+	GLibRecLocker lock(&self->stream_lock);
+	GstLibcameraSrcState *state = self->state;
+	gint ret;
+
+	GST_DEBUG_OBJECT(self, "Streaming thread has started");
+
+	guint group_id = gst_util_group_id_next();
+	for (GstPad *srcpad : state->srcpads_) {
+		/* Create stream-id and push stream-start. */
+		g_autofree gchar *stream_id = gst_pad_create_stream_id(srcpad, GST_ELEMENT(self), nullptr);
+		GstEvent *event = gst_event_new_stream_start(stream_id);
+		gst_event_set_group_id(event, group_id);
+		gst_pad_push_event(srcpad, event);
+	}
+
+	state->config_ = gst_libcamera_src_generate_configuration(self);
+	if (!state->config_ || !gst_libcamera_src_push_caps(self)) {
 		gst_task_stop(task);
 		return;
 	}
 
-done:
-	switch (flow_ret) {
-	case GST_FLOW_NOT_NEGOTIATED:
-		GST_ELEMENT_FLOW_ERROR(self, flow_ret);
+	for (GstPad *srcpad : state->srcpads_) {
+		/* Send an open segment event with time format. */
+		GstSegment segment;
+		gst_segment_init(&segment, GST_FORMAT_TIME);
+		gst_pad_push_event(srcpad, gst_event_new_segment(&segment));
+
+		/* Caps have just been negotiated, clear reconfigure requests. */
+		gst_pad_check_reconfigure(srcpad);
+	}
+
+	ret = state->cam_->configure(state->config_.get());
+	if (ret) {
+		GST_ELEMENT_ERROR(self, RESOURCE, SETTINGS,
+				  ("Failed to configure camera: %s", g_strerror(-ret)),
+				  ("Camera::configure() failed with error code %i", ret));
 		gst_task_stop(task);
-		break;
-	default:
-		break;
+		return;
 	}
+
+	if (!gst_libcamera_src_allocate(self) ||
+	    !gst_libcamera_src_start_camera(self))
+		gst_task_stop(task);
 }
 
 static void
@@ -493,12 +1116,15 @@ gst_libcamera_src_task_leave([[maybe_unused]] GstTask *task,
 
 	state->cam_->stop();
 
-	for (GstPad *srcpad : state->srcpads_)
-		gst_libcamera_pad_set_pool(srcpad, nullptr);
+	GST_INFO_OBJECT(self, "Camera counters:\n%s",
+			state->cam_->performance().toString().c_str());
+	GST_INFO_OBJECT(self, "Global counters:\n%s",
+			state->cm_->performance().toString().c_str());
 
-	g_clear_object(&self->allocator);
-	g_clear_pointer(&self->flow_combiner,
-			(GDestroyNotify)gst_flow_combiner_free);
+	if (state->syncGroup_)
+		state->syncGroup_->stop(GST_ELEMENT(self));
+
+	gst_libcamera_src_free(self);
 }
 
 static void
@@ -518,8 +1144,12 @@ gst_libcamera_src_close(GstLibcameraSrc *self)
 				    ("libcamera::Camera.release() failed: %s", g_strerror(-ret)));
 	}
 
+	if (state->syncGroup_) {
+		state->syncGroup_->removeMember(GST_ELEMENT(self));
+		state->syncGroup_.reset();
+	}
+
 	state->cam_.reset();
-	state->cm_->stop();
 	state->cm_.reset();
 }
 
@@ -535,6 +1165,13 @@ gst_libcamera_src_set_property(GObject *object, guint prop_id,
 		g_free(self->camera_name);
 		self->camera_name = g_value_dup_string(value);
 		break;
+	case PROP_SYNC_GROUP:
+		g_free(self->sync_group);
+		self->sync_group = g_value_dup_string(value);
+		break;
+	case PROP_SYNC_TOLERANCE:
+		self->sync_tolerance = g_value_get_uint64(value);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -552,6 +1189,12 @@ gst_libcamera_src_get_property(GObject *object, guint prop_id, GValue *value,
 	case PROP_CAMERA_NAME:
 		g_value_set_string(value, self->camera_name);
 		break;
+	case PROP_SYNC_GROUP:
+		g_value_set_string(value, self->sync_group);
+		break;
+	case PROP_SYNC_TOLERANCE:
+		g_value_set_uint64(value, self->sync_tolerance);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -615,6 +1258,7 @@ gst_libcamera_src_finalize(GObject *object)
 	g_rec_mutex_clear(&self->stream_lock);
 	g_clear_object(&self->task);
 	g_free(self->camera_name);
+	g_free(self->sync_group);
 	delete self->state;
 
 	return klass->finalize(object);
@@ -670,4 +1314,23 @@ gst_libcamera_src_class_init(GstLibcameraSrcClass *klass)
 							     | G_PARAM_READWRITE
 							     | G_PARAM_STATIC_STRINGS));
 	g_object_class_install_property(object_class, PROP_CAMERA_NAME, spec);
+
+	spec = g_param_spec_string("sync-group", "Sync Group",
+				   "Start the cameras of the elements sharing the group name "
+				   "together, and push their frames in aligned sets.", nullptr,
+				   (GParamFlags)(GST_PARAM_MUTABLE_READY
+						 | G_PARAM_CONSTRUCT
+						 | G_PARAM_READWRITE
+						 | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_SYNC_GROUP, spec);
+
+	spec = g_param_spec_uint64("sync-tolerance", "Sync Tolerance",
+				   "Maximum difference between the sensor timestamps of "
+				   "frames pushed together in a sync group, in nanoseconds.",
+				   0, G_MAXUINT64, DEFAULT_SYNC_TOLERANCE,
+				   (GParamFlags)(GST_PARAM_MUTABLE_READY
+						 | G_PARAM_CONSTRUCT
+						 | G_PARAM_READWRITE
+						 | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_SYNC_TOLERANCE, spec);
 }
@@ -0,0 +1,296 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * gstlibcamerasyncgroup.cpp - Synchronise the frames of multiple cameras
+ */
+
+#include "gstlibcamerasyncgroup.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+/* Maximum time to wait for all the members of a group to be ready to start. */
+constexpr auto kStartTimeout = 1000ms;
+
+} /* namespace */
+
+/**
+ * \class SyncGroup
+ * \brief Start cameras together and align their frames
+ *
+ * libcamerasrc elements sharing the same sync-group name register with a
+ * common SyncGroup. When streaming starts, each element waits for the other
+ * members of the group to be configured, to start all the cameras at the same
+ * time.
+ *
+ * Completed frames are then queued to the group with their sensor timestamp
+ * instead of being pushed directly. Once all streaming members have a frame,
+ * frames that can't be paired with the most recent one within the tolerance
+ * are dropped, and a full set of frames is delivered to the members with a
+ * common PTS. The number of frames held per member is bounded to leave buffers
+ * available for capture when a member stalls.
+ */
+
+std::shared_ptr<SyncGroup> SyncGroup::get(const std::string &name)
+{
+	static std::mutex mutex;
+	static std::map<std::string, std::weak_ptr<SyncGroup>> groups;
+
+	std::lock_guard<std::mutex> locker(mutex);
+
+	std::shared_ptr<SyncGroup> group = groups[name].lock();
+	if (!group) {
+		group = std::make_shared<SyncGroup>(name);
+		groups[name] = group;
+	}
+
+	return group;
+}
+
+SyncGroup::SyncGroup(const std::string &name)
+	: name_(name)
+{
+}
+
+void SyncGroup::addMember(GstElement *element, DeliverFunc deliver)
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	members_.push_back({ element, std::move(deliver), false, 0, 1, {}, 0 });
+}
+
+/*
+ * Remove the member from the group. Frames matched for the member but not
+ * delivered yet are dropped, and deliveries in progress in other threads are
+ * waited for, the member isn't called anymore once this function returns.
+ */
+void SyncGroup::removeMember(GstElement *element)
+{
+	stop(element);
+
+	std::unique_lock<std::mutex> locker(mutex_);
+
+	delivered_.wait(locker, [&]() {
+		Member *member = findMember(element);
+		return !member || !member->delivering;
+	});
+
+	members_.erase(std::remove_if(members_.begin(), members_.end(),
+				      [&](const Member &member) {
+					      return member.element == element;
+				      }),
+		       members_.end());
+
+	/* Members waiting for the removed one may now start. */
+	started_.notify_all();
+}
+
+/*
+ * Mark the member as streaming and wait until all members of the group are
+ * ready to start, or until the timeout expires if some of them never start.
+ */
+void SyncGroup::start(GstElement *element, GstClockTime tolerance,
+		      unsigned int maxFrames)
+{
+	std::unique_lock<std::mutex> locker(mutex_);
+
+	Member *member = findMember(element);
+	if (!member)
+		return;
+
+	member->streaming = true;
+	member->tolerance = tolerance;
+	member->maxFrames = std::max(maxFrames, 1u);
+
+	started_.notify_all();
+
+	if (!started_.wait_for(locker, kStartTimeout, [&]() { return allStarted(); }))
+		GST_WARNING_OBJECT(element, "Starting before all members of sync group '%s'",
+				   name_.c_str());
+}
+
+void SyncGroup::stop(GstElement *element)
+{
+	std::vector<Delivery> deliveries;
+	std::vector<Frame> dropped;
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+
+		Member *member = findMember(element);
+		if (!member || !member->streaming)
+			return;
+
+		member->streaming = false;
+		for (Frame &frame : member->frames)
+			dropped.push_back(std::move(frame));
+		member->frames.clear();
+
+		/* The other members don't need to wait for this one anymore. */
+		match(&deliveries, &dropped);
+	}
+
+	complete(deliveries, dropped);
+}
+
+void SyncGroup::queueFrame(GstElement *element, Frame frame)
+{
+	std::vector<Delivery> deliveries;
+	std::vector<Frame> dropped;
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+
+		Member *member = findMember(element);
+		if (!member || !member->streaming) {
+			dropped.push_back(std::move(frame));
+		} else {
+			member->frames.push_back(std::move(frame));
+
+			while (member->frames.size() > member->maxFrames) {
+				dropped.push_back(std::move(member->frames.front()));
+				member->frames.pop_front();
+			}
+
+			match(&deliveries, &dropped);
+		}
+	}
+
+	complete(deliveries, dropped);
+}
+
+SyncGroup::Member *SyncGroup::findMember(GstElement *element)
+{
+	for (Member &member : members_) {
+		if (member.element == element)
+			return &member;
+	}
+
+	return nullptr;
+}
+
+bool SyncGroup::allStarted() const
+{
+	return std::all_of(members_.begin(), members_.end(),
+			   [](const Member &member) { return member.streaming; });
+}
+
+/*
+ * Pair the oldest frames of all streaming members. Must be called with the
+ * mutex held. The buffers are delivered and released by the caller once the
+ * mutex is unlocked, as both operations take the lock of the elements.
+ */
+void SyncGroup::match(std::vector<Delivery> *deliveries,
+		      std::vector<Frame> *dropped)
+{
+	while (true) {
+		guint64 newest = 0;
+		GstClockTime tolerance = 0;
+		bool streaming = false;
+
+		for (const Member &member : members_) {
+			if (!member.streaming)
+				continue;
+
+			if (member.frames.empty())
+				return;
+
+			newest = std::max(newest, member.frames.front().timestamp);
+			tolerance = std::max(tolerance, member.tolerance);
+			streaming = true;
+		}
+
+		if (!streaming)
+			return;
+
+		/* Drop the frames too old to be paired with the newest one. */
+		bool paired = true;
+		for (Member &member : members_) {
+			if (!member.streaming)
+				continue;
+
+			while (!member.frames.empty() &&
+			       member.frames.front().timestamp + tolerance < newest) {
+				dropped->push_back(std::move(member.frames.front()));
+				member.frames.pop_front();
+			}
+
+			if (member.frames.empty())
+				paired = false;
+		}
+
+		if (!paired)
+			return;
+
+		/* All frames are within the tolerance, push them with one PTS. */
+		GstClockTime pts = GST_CLOCK_TIME_NONE;
+		for (const Member &member : members_) {
+			if (!member.streaming)
+				continue;
+
+			for (GstBuffer *buffer : member.frames.front().buffers)
+				pts = std::min(pts, GST_BUFFER_PTS(buffer));
+		}
+
+		for (Member &member : members_) {
+			if (!member.streaming)
+				continue;
+
+			Frame &frame = member.frames.front();
+			for (GstBuffer *buffer : frame.buffers)
+				GST_BUFFER_PTS(buffer) = pts;
+
+			deliveries->push_back({ member.element, std::move(frame.buffers) });
+			member.frames.pop_front();
+		}
+	}
+}
+
+/*
+ * Deliver the matched buffers and release the dropped ones, without holding
+ * the mutex. Members stopped or removed since the buffers have been matched
+ * are skipped, and the deliveries in progress are tracked for removeMember()
+ * to wait for them.
+ */
+void SyncGroup::complete(std::vector<Delivery> &deliveries,
+			 std::vector<Frame> &dropped)
+{
+	for (Frame &frame : dropped) {
+		for (GstBuffer *buffer : frame.buffers)
+			gst_buffer_unref(buffer);
+	}
+
+	for (Delivery &delivery : deliveries) {
+		DeliverFunc deliver;
+
+		{
+			std::lock_guard<std::mutex> locker(mutex_);
+
+			Member *member = findMember(delivery.element);
+			if (member && member->streaming) {
+				member->delivering++;
+				deliver = member->deliver;
+			}
+		}
+
+		if (!deliver) {
+			for (GstBuffer *buffer : delivery.buffers)
+				gst_buffer_unref(buffer);
+			continue;
+		}
+
+		deliver(delivery.buffers);
+
+		std::lock_guard<std::mutex> locker(mutex_);
+
+		Member *member = findMember(delivery.element);
+		member->delivering--;
+		delivered_.notify_all();
+	}
+}
@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * gstlibcamerasyncgroup.h - Synchronise the frames of multiple cameras
+ */
+
+#ifndef __GST_LIBCAMERA_SYNC_GROUP_H__
+#define __GST_LIBCAMERA_SYNC_GROUP_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <gst/gst.h>
+
+class SyncGroup
+{
+public:
+	struct Frame {
+		/* Sensor timestamp, in nanoseconds. */
+		guint64 timestamp;
+		/* One buffer per source pad, owned by the frame. */
+		std::vector<GstBuffer *> buffers;
+	};
+
+	using DeliverFunc = std::function<void(std::vector<GstBuffer *> &buffers)>;
+
+	static std::shared_ptr<SyncGroup> get(const std::string &name);
+
+	SyncGroup(const std::string &name);
+
+	const std::string &name() const { return name_; }
+
+	void addMember(GstElement *element, DeliverFunc deliver);
+	void removeMember(GstElement *element);
+
+	void start(GstElement *element, GstClockTime tolerance,
+		   unsigned int maxFrames);
+	void stop(GstElement *element);
+
+	void queueFrame(GstElement *element, Frame frame);
+
+private:
+	struct Member {
+		GstElement *element;
+		DeliverFunc deliver;
+		bool streaming;
+		GstClockTime tolerance;
+		unsigned int maxFrames;
+		std::deque<Frame> frames;
+		/* Number of deliveries in progress outside of the lock. */
+		unsigned int delivering;
+	};
+
+	struct Delivery {
+		GstElement *element;
+		std::vector<GstBuffer *> buffers;
+	};
+
+	Member *findMember(GstElement *element);
+	bool allStarted() const;
+	void match(std::vector<Delivery> *deliveries,
+		   std::vector<Frame> *dropped);
+	void complete(std::vector<Delivery> &deliveries,
+		      std::vector<Frame> &dropped);
+
+	std::string name_;
+
+	/* Protects the members. */
+	std::mutex mutex_;
+	std::condition_variable started_;
+	std::condition_variable delivered_;
+	std::vector<Member> members_;
+};
+
+#endif /* __GST_LIBCAMERA_SYNC_GROUP_H__ */
@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipa_context.cpp - IPU3 IPA Context
+ */
+
+#include "ipa_context.h"
+
+/**
+ * \file ipa_context.h
+ * \brief Context and state information shared between the algorithms
+ */
+
+namespace libcamera {
+
+namespace ipa::ipu3 {
+
+/**
+ * \struct IPASessionConfiguration
+ * \brief Session configuration for the IPA module
+ *
+ * The session configuration contains all IPA configuration parameters that
+ * remain constant during the capture session, from IPA module start to stop.
+ * It is typically set during the configure() operation of the IPA module, but
+ * may also be updated in the start() operation.
+ *
+ * \var IPASessionConfiguration::grid
+ * \brief Grid configuration of the IPA
+ *
+ * \var IPASessionConfiguration::grid.bdsGrid
+ * \brief Bayer Down Scaler grid plane config used by the algorithms
+ *
+ * \var IPASessionConfiguration::grid.bdsOutputSize
+ * \brief BDS output size configured by the pipeline handler
+ */
+
+/**
+ * \struct IPAActiveState
+ * \brief The active state of the IPA algorithms
+ *
+ * The active state contains the latest results of the algorithms, carried
+ * from one frame to the next. It is updated by the process() operation of
+ * the algorithms, and read by the prepare() operation of the algorithms that
+ * depend on it.
+ *
+ * \var IPAActiveState::sensor
+ * \brief The sensor controls computed by the AGC
+ *
+ * \var IPAActiveState::sensor.exposure
+ * \brief Exposure time, in lines
+ *
+ * \var IPAActiveState::sensor.gain
+ * \brief Analogue gain code
+ *
+ * \var IPAActiveState::agc
+ * \brief The AGC results shared with the other algorithms
+ *
+ * \var IPAActiveState::agc.gamma
+ * \brief The gamma to be applied by the ISP
+ *
+ * \var IPAActiveState::agc.updateControls
+ * \brief Whether the last AGC run updated the sensor controls
+ *
+ * \var IPAActiveState::agc.frameCount
+ * \brief Number of frames processed by the AGC since the camera was started
+ */
+
+/**
+ * \struct IPAFrameContext
+ * \brief Per-frame context for the IPU3 algorithms
+ *
+ * \var IPAFrameContext::agc
+ * \brief The AGC results for the frame
+ *
+ * \var IPAFrameContext::agc.updateControls
+ * \brief Whether the statistics of the frame led to new sensor controls
+ */
+
+/**
+ * \struct IPAContext
+ * \brief Global IPA context data shared between all algorithms
+ *
+ * \var IPAContext::configuration
+ * \brief The IPA session configuration, immutable during the session
+ *
+ * \var IPAContext::activeState
+ * \brief The active state of the algorithms
+ *
+ * \var IPAContext::frameContexts
+ * \brief The contexts of the frames in flight
+ */
+
+} /* namespace ipa::ipu3 */
+
+} /* namespace libcamera */
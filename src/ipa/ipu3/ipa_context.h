@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipa_context.h - IPU3 IPA Context
+ */
+#ifndef __LIBCAMERA_IPU3_IPA_CONTEXT_H__
+#define __LIBCAMERA_IPU3_IPA_CONTEXT_H__
+
+#include <stdint.h>
+
+#include <linux/intel-ipu3.h>
+
+#include <libcamera/geometry.h>
+
+#include "libipa/fc_queue.h"
+
+namespace libcamera {
+
+namespace ipa::ipu3 {
+
+struct IPASessionConfiguration {
+	struct {
+		ipu3_uapi_grid_config bdsGrid;
+		Size bdsOutputSize;
+	} grid;
+};
+
+struct IPAActiveState {
+	struct {
+		uint32_t exposure;
+		uint32_t gain;
+	} sensor;
+
+	struct {
+		double gamma;
+		bool updateControls;
+		uint32_t frameCount;
+	} agc;
+};
+
+struct IPAFrameContext : public FrameContext {
+	struct {
+		bool updateControls;
+	} agc;
+};
+
+struct IPAContext {
+	IPASessionConfiguration configuration;
+	IPAActiveState activeState;
+
+	FCQueue<IPAFrameContext> frameContexts;
+};
+
+} /* namespace ipa::ipu3 */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPU3_IPA_CONTEXT_H__ */
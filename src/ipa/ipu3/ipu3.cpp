@@ -5,8 +5,12 @@
  * ipu3.cpp - IPU3 Image Processing Algorithms
  */
 
+#include <algorithm>
+#include <memory>
 #include <stdint.h>
+#include <string.h>
 #include <sys/mman.h>
+#include <vector>
 
 #include <linux/intel-ipu3.h>
 #include <linux/v4l2-controls.h>
@@ -21,8 +25,11 @@
 #include "libcamera/internal/buffer.h"
 #include "libcamera/internal/log.h"
 
+#include "ipa_context.h"
 #include "ipu3_agc.h"
 #include "ipu3_awb.h"
+#include "ipu3_stats.h"
+#include "module.h"
 
 static constexpr uint32_t kMaxCellWidthPerSet = 160;
 static constexpr uint32_t kMaxCellHeightPerSet = 56;
@@ -41,7 +48,7 @@ public:
 		return 0;
 	}
 	int start() override;
-	void stop() override {}
+	void stop() override;
 
 	void configure(const IPAConfigInfo &configInfo) override;
 
@@ -59,36 +66,56 @@ private:
 	void setControls(unsigned int frame);
 	void calculateBdsGrid(const Size &bdsOutputSize);
 
-	std::map<unsigned int, MappedFrameBuffer> buffers_;
+	/*
+	 * A parameters or statistics buffer, with its mapping viewed as the
+	 * structures it can hold, or null if it is too small.
+	 */
+	struct MappedIPU3Buffer {
+		std::unique_ptr<MappedFrameBuffer> mapping;
+		ipu3_uapi_params *params;
+		const ipu3_uapi_stats_3a *stats;
+	};
+
+	const MappedIPU3Buffer *findBuffer(unsigned int id) const;
+
+	/* Mapped buffers, indexed by the IDs assigned by the pipeline handler. */
+	std::vector<MappedIPU3Buffer> buffers_;
 
 	ControlInfoMap ctrls_;
 
 	/* Camera sensor controls. */
-	uint32_t exposure_;
 	uint32_t minExposure_;
 	uint32_t maxExposure_;
-	uint32_t gain_;
 	uint32_t minGain_;
 	uint32_t maxGain_;
 
-	/* Interface to the AWB algorithm */
-	std::unique_ptr<IPU3Awb> awbAlgo_;
-	/* Interface to the AEC/AGC algorithm */
-	std::unique_ptr<IPU3Agc> agcAlgo_;
+	/* The algorithms, run in order on each frame */
+	Module module_;
+	/* Context shared by the algorithms */
+	IPAContext context_;
 
-	/* Local parameter storage */
-	struct ipu3_uapi_params params_;
-
-	struct ipu3_uapi_grid_config bdsGrid_;
+	/* Statistics of the AWB grid, shared by the algorithms */
+	IPU3GridStats gridStats_;
 };
 
 int IPAIPU3::start()
 {
+	/* Restart the AGC convergence from the current sensor controls. */
+	context_.activeState.agc.frameCount = 0;
+
 	setControls(0);
 
 	return 0;
 }
 
+void IPAIPU3::stop()
+{
+	LOG(IPAIPU3, Debug) << "Algorithm timings:" << std::endl
+			    << module_.timings();
+
+	context_.frameContexts.clear();
+}
+
 /**
  * This method calculates a grid for the AWB algorithm in the IPU3 firmware.
  * Its input is the BDS output size calculated in the ImgU.
@@ -105,7 +132,8 @@ void IPAIPU3::calculateBdsGrid(const Size &bdsOutputSize)
 	uint32_t minError = std::numeric_limits<uint32_t>::max();
 	Size best;
 	Size bestLog2;
-	bdsGrid_ = {};
+	ipu3_uapi_grid_config &bdsGrid = context_.configuration.grid.bdsGrid;
+	bdsGrid = {};
 
 	for (uint32_t widthShift = 3; widthShift <= 7; ++widthShift) {
 		uint32_t width = std::min(kMaxCellWidthPerSet,
@@ -129,14 +157,14 @@ void IPAIPU3::calculateBdsGrid(const Size &bdsOutputSize)
 		}
 	}
 
-	bdsGrid_.width = best.width >> bestLog2.width;
-	bdsGrid_.block_width_log2 = bestLog2.width;
-	bdsGrid_.height = best.height >> bestLog2.height;
-	bdsGrid_.block_height_log2 = bestLog2.height;
+	bdsGrid.width = best.width >> bestLog2.width;
+	bdsGrid.block_width_log2 = bestLog2.width;
+	bdsGrid.height = best.height >> bestLog2.height;
+	bdsGrid.block_height_log2 = bestLog2.height;
 
 	LOG(IPAIPU3, Debug) << "Best grid found is: ("
-			    << (int)bdsGrid_.width << " << " << (int)bdsGrid_.block_width_log2 << ") x ("
-			    << (int)bdsGrid_.height << " << " << (int)bdsGrid_.block_height_log2 << ")";
+			    << (int)bdsGrid.width << " << " << (int)bdsGrid.block_width_log2 << ") x ("
+			    << (int)bdsGrid.height << " << " << (int)bdsGrid.block_height_log2 << ")";
 }
 
 void IPAIPU3::configure(const IPAConfigInfo &configInfo)
@@ -160,43 +188,85 @@ void IPAIPU3::configure(const IPAConfigInfo &configInfo)
 
 	minExposure_ = std::max(itExp->second.min().get<int32_t>(), 1);
 	maxExposure_ = itExp->second.max().get<int32_t>();
-	exposure_ = minExposure_;
 
 	minGain_ = std::max(itGain->second.min().get<int32_t>(), 1);
 	maxGain_ = itGain->second.max().get<int32_t>();
-	gain_ = minGain_;
-
-	params_ = {};
 
+	context_.configuration = {};
+	context_.configuration.grid.bdsOutputSize = configInfo.bdsOutputSize;
 	calculateBdsGrid(configInfo.bdsOutputSize);
 
-	awbAlgo_ = std::make_unique<IPU3Awb>();
-	awbAlgo_->initialise(params_, configInfo.bdsOutputSize, bdsGrid_);
+	context_.activeState = {};
+	context_.activeState.sensor.exposure = minExposure_;
+	context_.activeState.sensor.gain = minGain_;
+	context_.activeState.agc.gamma = 1.0;
+
+	context_.frameContexts.clear();
+
+	/*
+	 * The AGC runs first, the AWB uses its results to compute the gamma
+	 * correction.
+	 */
+	module_.clearAlgorithms();
+	module_.addAlgorithm("agc", std::make_unique<IPU3Agc>());
+	module_.addAlgorithm("awb", std::make_unique<IPU3Awb>());
 
-	agcAlgo_ = std::make_unique<IPU3Agc>();
-	agcAlgo_->initialise(bdsGrid_);
+	if (module_.configure(context_, configInfo))
+		LOG(IPAIPU3, Error) << "Failed to configure the algorithms";
 }
 
 void IPAIPU3::mapBuffers(const std::vector<IPABuffer> &buffers)
 {
+	/*
+	 * Buffer IDs are small consecutive integers, address the buffers
+	 * directly by ID to avoid lookups when processing frames.
+	 */
+	unsigned int maxId = 0;
+	for (const IPABuffer &buffer : buffers)
+		maxId = std::max(maxId, buffer.id);
+
+	if (maxId >= buffers_.size())
+		buffers_.resize(maxId + 1);
+
 	for (const IPABuffer &buffer : buffers) {
 		const FrameBuffer fb(buffer.planes);
-		buffers_.emplace(buffer.id,
-				 MappedFrameBuffer(&fb, PROT_READ | PROT_WRITE));
+		MappedIPU3Buffer &mapped = buffers_[buffer.id];
+
+		mapped.mapping = std::make_unique<MappedFrameBuffer>(&fb, PROT_READ | PROT_WRITE);
+		mapped.params = nullptr;
+		mapped.stats = nullptr;
+
+		if (!mapped.mapping->isValid()) {
+			LOG(IPAIPU3, Error) << "Failed to map buffer " << buffer.id;
+			continue;
+		}
+
+		Span<uint8_t> mem = mapped.mapping->maps()[0];
+		if (mem.size() >= sizeof(ipu3_uapi_params))
+			mapped.params = reinterpret_cast<ipu3_uapi_params *>(mem.data());
+		if (mem.size() >= sizeof(ipu3_uapi_stats_3a))
+			mapped.stats = reinterpret_cast<const ipu3_uapi_stats_3a *>(mem.data());
 	}
 }
 
 void IPAIPU3::unmapBuffers(const std::vector<unsigned int> &ids)
 {
 	for (unsigned int id : ids) {
-		auto it = buffers_.find(id);
-		if (it == buffers_.end())
+		if (id >= buffers_.size())
 			continue;
 
-		buffers_.erase(it);
+		buffers_[id] = {};
 	}
 }
 
+const IPAIPU3::MappedIPU3Buffer *IPAIPU3::findBuffer(unsigned int id) const
+{
+	if (id >= buffers_.size() || !buffers_[id].mapping)
+		return nullptr;
+
+	return &buffers_[id];
+}
+
 void IPAIPU3::processEvent(const IPU3Event &event)
 {
 	switch (event.op) {
@@ -205,31 +275,25 @@ void IPAIPU3::processEvent(const IPU3Event &event)
 		break;
 	}
 	case EventStatReady: {
-		auto it = buffers_.find(event.bufferId);
-		if (it == buffers_.end()) {
+		const MappedIPU3Buffer *buffer = findBuffer(event.bufferId);
+		if (!buffer || !buffer->stats) {
 			LOG(IPAIPU3, Error) << "Could not find stats buffer!";
 			return;
 		}
 
-		Span<uint8_t> mem = it->second.maps()[0];
-		const ipu3_uapi_stats_3a *stats =
-			reinterpret_cast<ipu3_uapi_stats_3a *>(mem.data());
-
-		parseStatistics(event.frame, event.frameTimestamp, stats);
+		MappedBuffer::CpuAccess access(buffer->mapping.get(), PROT_READ);
+		parseStatistics(event.frame, event.frameTimestamp, buffer->stats);
 		break;
 	}
 	case EventFillParams: {
-		auto it = buffers_.find(event.bufferId);
-		if (it == buffers_.end()) {
+		const MappedIPU3Buffer *buffer = findBuffer(event.bufferId);
+		if (!buffer || !buffer->params) {
 			LOG(IPAIPU3, Error) << "Could not find param buffer!";
 			return;
 		}
 
-		Span<uint8_t> mem = it->second.maps()[0];
-		ipu3_uapi_params *params =
-			reinterpret_cast<ipu3_uapi_params *>(mem.data());
-
-		fillParams(event.frame, params);
+		MappedBuffer::CpuAccess access(buffer->mapping.get(), PROT_WRITE);
+		fillParams(event.frame, buffer->params);
 		break;
 	}
 	default:
@@ -238,18 +302,20 @@ void IPAIPU3::processEvent(const IPU3Event &event)
 	}
 }
 
-void IPAIPU3::processControls([[maybe_unused]] unsigned int frame,
+void IPAIPU3::processControls(unsigned int frame,
 			      [[maybe_unused]] const ControlList &controls)
 {
+	context_.frameContexts.init(frame);
+
 	/* \todo Start processing for 'frame' based on 'controls'. */
 }
 
 void IPAIPU3::fillParams(unsigned int frame, ipu3_uapi_params *params)
 {
-	if (agcAlgo_->updateControls())
-		awbAlgo_->updateWbParameters(params_, agcAlgo_->gamma());
+	IPAFrameContext &frameContext = context_.frameContexts.get(frame);
 
-	*params = params_;
+	memset(params, 0, sizeof(*params));
+	module_.prepare(context_, frame, frameContext, params);
 
 	IPU3Action op;
 	op.op = ActionParamFilled;
@@ -263,10 +329,13 @@ void IPAIPU3::parseStatistics(unsigned int frame,
 {
 	ControlList ctrls(controls::controls);
 
-	agcAlgo_->process(stats, exposure_, gain_);
-	awbAlgo_->calculateWBGains(stats);
+	IPAFrameContext &frameContext = context_.frameContexts.get(frame);
+
+	generateGridStats(stats, context_.configuration.grid.bdsGrid, &gridStats_);
+
+	module_.process(context_, frame, frameContext, &gridStats_);
 
-	if (agcAlgo_->updateControls())
+	if (frameContext.agc.updateControls)
 		setControls(frame);
 
 	/* \todo Populate this with real values */
@@ -286,8 +355,10 @@ void IPAIPU3::setControls(unsigned int frame)
 	op.op = ActionSetSensorControls;
 
 	ControlList ctrls(ctrls_);
-	ctrls.set(V4L2_CID_EXPOSURE, static_cast<int32_t>(exposure_));
-	ctrls.set(V4L2_CID_ANALOGUE_GAIN, static_cast<int32_t>(gain_));
+	ctrls.set(V4L2_CID_EXPOSURE,
+		  static_cast<int32_t>(context_.activeState.sensor.exposure));
+	ctrls.set(V4L2_CID_ANALOGUE_GAIN,
+		  static_cast<int32_t>(context_.activeState.sensor.gain));
 	op.controls = ctrls;
 
 	queueFrameAction.emit(frame, op);
@@ -26,6 +26,14 @@ static constexpr uint32_t kInitialFrameMinAECount = 4;
 /* Number of frames to wait between new gain/exposure estimations */
 static constexpr uint32_t kFrameSkipCount = 6;
 
+/*
+ * Number of frames after start during which the AGC converges as fast as
+ * possible, applying its estimates unfiltered as soon as the previous sensor
+ * controls have taken effect.
+ */
+static constexpr uint32_t kNumStartupFrames = 10;
+static constexpr uint32_t kStartupFrameSkipCount = 3;
+
 /* Maximum ISO value for analogue gain */
 static constexpr uint32_t kMinISO = 100;
 static constexpr uint32_t kMaxISO = 1500;
@@ -45,73 +53,30 @@ static constexpr double kLineDuration = 16.8;
 static constexpr double kMaxExposureTime = kMaxExposure * kLineDuration;
 
 /* Histogram constants */
-static constexpr uint32_t knumHistogramBins = 256;
+static constexpr uint32_t knumHistogramBins = kGridHistogramBins;
 static constexpr double kEvGainTarget = 0.5;
 
-/* A cell is 8 bytes and contains averages for RGB values and saturation ratio */
-static constexpr uint8_t kCellSize = 8;
-
 IPU3Agc::IPU3Agc()
-	: frameCount_(0), lastFrame_(0), converged_(false),
+	: lastFrame_(0), converged_(false),
 	  updateControls_(false), iqMean_(0.0), gamma_(1.0),
 	  prevExposure_(0.0), prevExposureNoDg_(0.0),
 	  currentExposure_(0.0), currentExposureNoDg_(0.0)
 {
 }
 
-void IPU3Agc::initialise(struct ipu3_uapi_grid_config &bdsGrid)
+void IPU3Agc::processBrightness(const IPU3GridStats &stats)
 {
-	aeGrid_ = bdsGrid;
-}
-
-void IPU3Agc::processBrightness(const ipu3_uapi_stats_3a *stats)
-{
-	const struct ipu3_uapi_grid_config statsAeGrid = stats->stats_4a_config.awb_config.grid;
-	Rectangle aeRegion = { statsAeGrid.x_start,
-			       statsAeGrid.y_start,
-			       static_cast<unsigned int>(statsAeGrid.x_end - statsAeGrid.x_start) + 1,
-			       static_cast<unsigned int>(statsAeGrid.y_end - statsAeGrid.y_start) + 1 };
-	Point topleft = aeRegion.topLeft();
-	int topleftX = topleft.x >> aeGrid_.block_width_log2;
-	int topleftY = topleft.y >> aeGrid_.block_height_log2;
-
-	/* Align to the grid cell width and height */
-	uint32_t startX = topleftX << aeGrid_.block_width_log2;
-	uint32_t startY = topleftY * aeGrid_.width << aeGrid_.block_width_log2;
-	uint32_t endX = (startX + (aeRegion.size().width >> aeGrid_.block_width_log2)) << aeGrid_.block_width_log2;
-	uint32_t i, j;
-	uint32_t count = 0;
-
-	uint32_t hist[knumHistogramBins] = { 0 };
-	for (j = topleftY;
-	     j < topleftY + (aeRegion.size().height >> aeGrid_.block_height_log2);
-	     j++) {
-		for (i = startX + startY; i < endX + startY; i += kCellSize) {
-			/*
-			 * The grid width (and maybe height) is not reliable.
-			 * We observed a bit shift which makes the value 160 to be 32 in the stats grid.
-			 * Use the one passed at init time.
-			 */
-			if (stats->awb_raw_buffer.meta_data[i + 4 + j * aeGrid_.width] == 0) {
-				uint8_t Gr = stats->awb_raw_buffer.meta_data[i + 0 + j * aeGrid_.width];
-				uint8_t Gb = stats->awb_raw_buffer.meta_data[i + 3 + j * aeGrid_.width];
-				hist[(Gr + Gb) / 2]++;
-				count++;
-			}
-		}
-	}
-
 	/* Limit the gamma effect for now */
 	gamma_ = 1.1;
 
 	/* Estimate the quantile mean of the top 2% of the histogram */
-	iqMean_ = Histogram(Span<uint32_t>(hist)).interQuantileMean(0.98, 1.0);
+	iqMean_ = Histogram(Span<const uint32_t>(stats.histogram)).interQuantileMean(0.98, 1.0);
 }
 
-void IPU3Agc::filterExposure()
+void IPU3Agc::filterExposure(bool startup)
 {
 	double speed = 0.2;
-	if (prevExposure_ == 0.0) {
+	if (prevExposure_ == 0.0 || startup) {
 		/* DG stands for digital gain.*/
 		prevExposure_ = currentExposure_;
 		prevExposureNoDg_ = currentExposureNoDg_;
@@ -142,14 +107,18 @@ void IPU3Agc::filterExposure()
 	LOG(IPU3Agc, Debug) << "After filtering, total_exposure " << prevExposure_;
 }
 
-void IPU3Agc::lockExposureGain(uint32_t &exposure, uint32_t &gain)
+void IPU3Agc::lockExposureGain(uint32_t frameCount, uint32_t &exposure,
+			       uint32_t &gain)
 {
 	updateControls_ = false;
 
+	bool startup = frameCount < kNumStartupFrames;
+	uint32_t skipCount = startup ? kStartupFrameSkipCount : kFrameSkipCount;
+
 	/* Algorithm initialization should wait for first valid frames */
 	/* \todo - have a number of frames given by DelayedControls ?
 	 * - implement a function for IIR */
-	if ((frameCount_ < kInitialFrameMinAECount) || (frameCount_ - lastFrame_ < kFrameSkipCount))
+	if ((frameCount < kInitialFrameMinAECount) || (frameCount - lastFrame_ < skipCount))
 		return;
 
 	/* Are we correctly exposed ? */
@@ -171,7 +140,7 @@ void IPU3Agc::lockExposureGain(uint32_t &exposure, uint32_t &gain)
 		LOG(IPU3Agc, Debug) << "Target total exposure " << currentExposure_;
 
 		/* \todo: estimate if we need to desaturate */
-		filterExposure();
+		filterExposure(startup);
 
 		double newExposure = 0.0;
 		if (currentShutter < kMaxExposureTime) {
@@ -187,14 +156,29 @@ void IPU3Agc::lockExposureGain(uint32_t &exposure, uint32_t &gain)
 		}
 		LOG(IPU3Agc, Debug) << "Adjust exposure " << exposure * kLineDuration << " and gain " << gain;
 	}
-	lastFrame_ = frameCount_;
+	lastFrame_ = frameCount;
 }
 
-void IPU3Agc::process(const ipu3_uapi_stats_3a *stats, uint32_t &exposure, uint32_t &gain)
+void IPU3Agc::process(IPAContext &context, [[maybe_unused]] uint32_t frame,
+		      IPAFrameContext &frameContext, const IPU3GridStats *stats)
 {
-	processBrightness(stats);
-	lockExposureGain(exposure, gain);
-	frameCount_++;
+	uint32_t &frameCount = context.activeState.agc.frameCount;
+
+	/* Forget the previous session when the camera is restarted. */
+	if (frameCount == 0) {
+		lastFrame_ = 0;
+		prevExposure_ = 0.0;
+		prevExposureNoDg_ = 0.0;
+	}
+
+	processBrightness(*stats);
+	lockExposureGain(frameCount, context.activeState.sensor.exposure,
+			 context.activeState.sensor.gain);
+	frameCount++;
+
+	context.activeState.agc.gamma = gamma_;
+	context.activeState.agc.updateControls = updateControls_;
+	frameContext.agc.updateControls = updateControls_;
 }
 
 } /* namespace ipa::ipu3 */
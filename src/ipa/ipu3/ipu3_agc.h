@@ -14,34 +14,29 @@
 
 #include <libcamera/geometry.h>
 
-#include "libipa/algorithm.h"
+#include "module.h"
 
 namespace libcamera {
 
 namespace ipa::ipu3 {
 
-class IPU3Agc : public Algorithm
+class IPU3Agc : public Algorithm<Module>
 {
 public:
 	IPU3Agc();
 	~IPU3Agc() = default;
 
-	void initialise(struct ipu3_uapi_grid_config &bdsGrid);
-	void process(const ipu3_uapi_stats_3a *stats, uint32_t &exposure, uint32_t &gain);
-	bool converged() { return converged_; }
-	bool updateControls() { return updateControls_; }
-	/* \todo Use a metadata exchange between IPAs */
-	double gamma() { return gamma_; }
+	void process(IPAContext &context, uint32_t frame,
+		     IPAFrameContext &frameContext,
+		     const IPU3GridStats *stats) override;
 
 private:
-	void processBrightness(const ipu3_uapi_stats_3a *stats);
-	void filterExposure();
-	void lockExposureGain(uint32_t &exposure, uint32_t &gain);
+	void processBrightness(const IPU3GridStats &stats);
+	void filterExposure(bool startup);
+	void lockExposureGain(uint32_t frameCount, uint32_t &exposure,
+			      uint32_t &gain);
 
-	struct ipu3_uapi_grid_config aeGrid_;
-
-	uint64_t frameCount_;
-	uint64_t lastFrame_;
+	uint32_t lastFrame_;
 
 	bool converged_;
 	bool updateControls_;
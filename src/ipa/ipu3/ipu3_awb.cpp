@@ -7,8 +7,6 @@
 #include "ipu3_awb.h"
 
 #include <cmath>
-#include <numeric>
-#include <unordered_map>
 
 #include "libcamera/internal/log.h"
 
@@ -18,52 +16,6 @@ namespace ipa::ipu3 {
 
 LOG_DEFINE_CATEGORY(IPU3Awb)
 
-static constexpr uint32_t kMinZonesCounted = 16;
-static constexpr uint32_t kMinGreenLevelInZone = 32;
-
-/**
- * \struct IspStatsRegion
- * \brief RGB statistics for a given region
- *
- * The IspStatsRegion structure is intended to abstract the ISP specific
- * statistics and use an agnostic algorithm to compute AWB.
- *
- * \var IspStatsRegion::counted
- * \brief Number of pixels used to calculate the sums
- *
- * \var IspStatsRegion::uncounted
- * \brief Remaining number of pixels in the region
- *
- * \var IspStatsRegion::rSum
- * \brief Sum of the red values in the region
- *
- * \var IspStatsRegion::gSum
- * \brief Sum of the green values in the region
- *
- * \var IspStatsRegion::bSum
- * \brief Sum of the blue values in the region
- */
-
-/**
- * \struct AwbStatus
- * \brief AWB parameters calculated
- *
- * The AwbStatus structure is intended to store the AWB
- * parameters calculated by the algorithm
- *
- * \var AwbStatus::temperatureK
- * \brief Color temperature calculated
- *
- * \var AwbStatus::redGain
- * \brief Gain calculated for the red channel
- *
- * \var AwbStatus::greenGain
- * \brief Gain calculated for the green channel
- *
- * \var AwbStatus::blueGain
- * \brief Gain calculated for the blue channel
- */
-
 /**
  * \struct Ipu3AwbCell
  * \brief Memory layout for each cell in AWB metadata
@@ -162,9 +114,9 @@ const struct ipu3_uapi_gamma_corr_lut imguCssGammaLut = { {
 IPU3Awb::IPU3Awb()
 	: Algorithm()
 {
-	asyncResults_.blueGain = 1.0;
-	asyncResults_.greenGain = 1.0;
-	asyncResults_.redGain = 1.0;
+	asyncResults_.blueGain = 1 << kAwbGainShift;
+	asyncResults_.greenGain = 1 << kAwbGainShift;
+	asyncResults_.redGain = 1 << kAwbGainShift;
 	asyncResults_.temperatureK = 4500;
 }
 
@@ -172,208 +124,103 @@ IPU3Awb::~IPU3Awb()
 {
 }
 
-void IPU3Awb::initialise(ipu3_uapi_params &params, const Size &bdsOutputSize, struct ipu3_uapi_grid_config &bdsGrid)
+int IPU3Awb::configure(IPAContext &context,
+		       [[maybe_unused]] const IPAConfigInfo &configInfo)
 {
-	params.use.acc_awb = 1;
-	params.acc_param.awb.config = imguCssAwbDefaults;
+	const Size &bdsOutputSize = context.configuration.grid.bdsOutputSize;
 
-	awbGrid_ = bdsGrid;
-	params.acc_param.awb.config.grid = awbGrid_;
+	awbGrid_ = context.configuration.grid.bdsGrid;
 
-	params.use.acc_bnr = 1;
-	params.acc_param.bnr = imguCssBnrDefaults;
+	awbConfig_ = imguCssAwbDefaults;
+	awbConfig_.grid = awbGrid_;
+
+	bnr_ = imguCssBnrDefaults;
 	/**
 	 * Optical center is column (respectively row) startminus X (respectively Y) center.
 	 * For the moment use BDS as a first approximation, but it should
 	 * be calculated based on Shading (SHD) parameters.
 	 */
-	params.acc_param.bnr.column_size = bdsOutputSize.width;
-	params.acc_param.bnr.opt_center.x_reset = awbGrid_.x_start - (bdsOutputSize.width / 2);
-	params.acc_param.bnr.opt_center.y_reset = awbGrid_.y_start - (bdsOutputSize.height / 2);
-	params.acc_param.bnr.opt_center_sqr.x_sqr_reset = params.acc_param.bnr.opt_center.x_reset
-							* params.acc_param.bnr.opt_center.x_reset;
-	params.acc_param.bnr.opt_center_sqr.y_sqr_reset = params.acc_param.bnr.opt_center.y_reset
-							* params.acc_param.bnr.opt_center.y_reset;
-
-	params.use.acc_ccm = 1;
-	params.acc_param.ccm = imguCssCcmDefault;
-
-	params.use.acc_gamma = 1;
-	params.acc_param.gamma.gc_lut = imguCssGammaLut;
-	params.acc_param.gamma.gc_ctrl.enable = 1;
-
-	zones_.reserve(kAwbStatsSizeX * kAwbStatsSizeY);
+	bnr_.column_size = bdsOutputSize.width;
+	bnr_.opt_center.x_reset = awbGrid_.x_start - (bdsOutputSize.width / 2);
+	bnr_.opt_center.y_reset = awbGrid_.y_start - (bdsOutputSize.height / 2);
+	bnr_.opt_center_sqr.x_sqr_reset = bnr_.opt_center.x_reset
+					* bnr_.opt_center.x_reset;
+	bnr_.opt_center_sqr.y_sqr_reset = bnr_.opt_center.y_reset
+					* bnr_.opt_center.y_reset;
+
+	gammaLut_ = imguCssGammaLut;
+	gamma_ = 0.0;
+
+	return 0;
 }
 
-/**
- * The function estimates the correlated color temperature using
- * from RGB color space input.
- * In physics and color science, the Planckian locus or black body locus is
- * the path or locus that the color of an incandescent black body would take
- * in a particular chromaticity space as the blackbody temperature changes.
- *
- * If a narrow range of color temperatures is considered (those encapsulating
- * daylight being the most practical case) one can approximate the Planckian
- * locus in order to calculate the CCT in terms of chromaticity coordinates.
- *
- * More detailed information can be found in:
- * https://en.wikipedia.org/wiki/Color_temperature#Approximation
- */
-uint32_t IPU3Awb::estimateCCT(double red, double green, double blue)
+void IPU3Awb::prepare(IPAContext &context, [[maybe_unused]] uint32_t frame,
+		      [[maybe_unused]] IPAFrameContext &frameContext,
+		      ipu3_uapi_params *params)
 {
-	/* Convert the RGB values to CIE tristimulus values (XYZ) */
-	double X = (-0.14282) * (red) + (1.54924) * (green) + (-0.95641) * (blue);
-	double Y = (-0.32466) * (red) + (1.57837) * (green) + (-0.73191) * (blue);
-	double Z = (-0.68202) * (red) + (0.77073) * (green) + (0.56332) * (blue);
-
-	/* Calculate the normalized chromaticity values */
-	double x = X / (X + Y + Z);
-	double y = Y / (X + Y + Z);
-
-	/* Calculate CCT */
-	double n = (x - 0.3320) / (0.1858 - y);
-	return 449 * n * n * n + 3525 * n * n + 6823.3 * n + 5520.33;
-}
+	if (context.activeState.agc.updateControls)
+		updateWbParameters(context.activeState.agc.gamma);
 
-/* Generate an RGB vector with the average values for each region */
-void IPU3Awb::generateZones(std::vector<RGB> &zones)
-{
-	for (unsigned int i = 0; i < kAwbStatsSizeX * kAwbStatsSizeY; i++) {
-		RGB zone;
-		double counted = awbStats_[i].counted;
-		if (counted >= kMinZonesCounted) {
-			zone.G = awbStats_[i].gSum / counted;
-			if (zone.G >= kMinGreenLevelInZone) {
-				zone.R = awbStats_[i].rSum / counted;
-				zone.B = awbStats_[i].bSum / counted;
-				zones.push_back(zone);
-			}
-		}
-	}
-}
+	params->use.acc_awb = 1;
+	params->acc_param.awb.config = awbConfig_;
 
-/* Translate the IPU3 statistics into the default statistics region array */
-void IPU3Awb::generateAwbStats(const ipu3_uapi_stats_3a *stats)
-{
-	uint32_t regionWidth = round(awbGrid_.width / static_cast<double>(kAwbStatsSizeX));
-	uint32_t regionHeight = round(awbGrid_.height / static_cast<double>(kAwbStatsSizeY));
+	params->use.acc_bnr = 1;
+	params->acc_param.bnr = bnr_;
 
-	/*
-	 * Generate a (kAwbStatsSizeX x kAwbStatsSizeY) array from the IPU3 grid which is
-	 * (awbGrid_.width x awbGrid_.height).
-	 */
-	for (unsigned int j = 0; j < kAwbStatsSizeY * regionHeight; j++) {
-		for (unsigned int i = 0; i < kAwbStatsSizeX * regionWidth; i++) {
-			uint32_t cellPosition = j * awbGrid_.width + i;
-			uint32_t cellX = (cellPosition / regionWidth) % kAwbStatsSizeX;
-			uint32_t cellY = ((cellPosition / awbGrid_.width) / regionHeight) % kAwbStatsSizeY;
-
-			uint32_t awbRegionPosition = cellY * kAwbStatsSizeX + cellX;
-			cellPosition *= 8;
-
-			/* Cast the initial IPU3 structure to simplify the reading */
-			Ipu3AwbCell *currentCell = reinterpret_cast<Ipu3AwbCell *>(const_cast<uint8_t *>(&stats->awb_raw_buffer.meta_data[cellPosition]));
-			if (currentCell->satRatio == 0) {
-				/* The cell is not saturated, use the current cell */
-				awbStats_[awbRegionPosition].counted++;
-				uint32_t greenValue = currentCell->greenRedAvg + currentCell->greenBlueAvg;
-				awbStats_[awbRegionPosition].gSum += greenValue / 2;
-				awbStats_[awbRegionPosition].rSum += currentCell->redAvg;
-				awbStats_[awbRegionPosition].bSum += currentCell->blueAvg;
-			}
-		}
-	}
-}
+	/* The CCM matrix may change when color temperature will be used */
+	params->use.acc_ccm = 1;
+	params->acc_param.ccm = imguCssCcmDefault;
 
-void IPU3Awb::clearAwbStats()
-{
-	for (unsigned int i = 0; i < kAwbStatsSizeX * kAwbStatsSizeY; i++) {
-		awbStats_[i].bSum = 0;
-		awbStats_[i].rSum = 0;
-		awbStats_[i].gSum = 0;
-		awbStats_[i].counted = 0;
-		awbStats_[i].uncounted = 0;
-	}
+	params->use.acc_gamma = 1;
+	params->acc_param.gamma.gc_lut = gammaLut_;
+	params->acc_param.gamma.gc_ctrl.enable = 1;
 }
 
-void IPU3Awb::awbGreyWorld()
+void IPU3Awb::process([[maybe_unused]] IPAContext &context,
+		      [[maybe_unused]] uint32_t frame,
+		      [[maybe_unused]] IPAFrameContext &frameContext,
+		      const IPU3GridStats *stats)
 {
-	LOG(IPU3Awb, Debug) << "Grey world AWB";
-	/*
-	 * Make a separate list of the derivatives for each of red and blue, so
-	 * that we can sort them to exclude the extreme gains. We could
-	 * consider some variations, such as normalising all the zones first, or
-	 * doing an L2 average etc.
-	 */
-	std::vector<RGB> &redDerivative(zones_);
-	std::vector<RGB> blueDerivative(redDerivative);
-	std::sort(redDerivative.begin(), redDerivative.end(),
-		  [](RGB const &a, RGB const &b) {
-			  return a.G * b.R < b.G * a.R;
-		  });
-	std::sort(blueDerivative.begin(), blueDerivative.end(),
-		  [](RGB const &a, RGB const &b) {
-			  return a.G * b.B < b.G * a.B;
-		  });
-
-	/* Average the middle half of the values. */
-	int discard = redDerivative.size() / 4;
-
-	RGB sumRed(0, 0, 0);
-	RGB sumBlue(0, 0, 0);
-	for (auto ri = redDerivative.begin() + discard,
-		  bi = blueDerivative.begin() + discard;
-	     ri != redDerivative.end() - discard; ri++, bi++)
-		sumRed += *ri, sumBlue += *bi;
-
-	double redGain = sumRed.G / (sumRed.R + 1),
-	       blueGain = sumBlue.G / (sumBlue.B + 1);
-
-	/* Color temperature is not relevant in Grey world but still useful to estimate it :-) */
-	asyncResults_.temperatureK = estimateCCT(sumRed.R, sumRed.G, sumBlue.B);
-	asyncResults_.redGain = redGain;
-	asyncResults_.greenGain = 1.0;
-	asyncResults_.blueGain = blueGain;
+	calculateWBGains(*stats);
 }
 
-void IPU3Awb::calculateWBGains(const ipu3_uapi_stats_3a *stats)
+void IPU3Awb::calculateWBGains(const IPU3GridStats &stats)
 {
-	ASSERT(stats->stats_3a_status.awb_en);
-	zones_.clear();
-	clearAwbStats();
-	generateAwbStats(stats);
-	generateZones(zones_);
-	LOG(IPU3Awb, Debug) << "Valid zones: " << zones_.size();
-	if (zones_.size() > 10) {
-		awbGreyWorld();
+	unsigned int count = generateAwbZones(stats, zones_);
+	LOG(IPU3Awb, Debug) << "Valid zones: " << count;
+	if (count > 10) {
+		LOG(IPU3Awb, Debug) << "Grey world AWB";
+		awbGreyWorld(zones_, count, &asyncResults_);
 		LOG(IPU3Awb, Debug) << "Gain found for red: " << asyncResults_.redGain
 				    << " and for blue: " << asyncResults_.blueGain;
 	}
 }
 
-void IPU3Awb::updateWbParameters(ipu3_uapi_params &params, double agcGamma)
+void IPU3Awb::updateWbParameters(double agcGamma)
 {
 	/*
 	 * Green gains should not be touched and considered 1.
 	 * Default is 16, so do not change it at all.
-	 * 4096 is the value for a gain of 1.0
 	 */
-	params.acc_param.bnr.wb_gains.gr = 16;
-	params.acc_param.bnr.wb_gains.r = 4096 * asyncResults_.redGain;
-	params.acc_param.bnr.wb_gains.b = 4096 * asyncResults_.blueGain;
-	params.acc_param.bnr.wb_gains.gb = 16;
+	bnr_.wb_gains.gr = 16;
+	bnr_.wb_gains.r = awbGainToBnr(asyncResults_.redGain);
+	bnr_.wb_gains.b = awbGainToBnr(asyncResults_.blueGain);
+	bnr_.wb_gains.gb = 16;
 
 	LOG(IPU3Awb, Debug) << "Color temperature estimated: " << asyncResults_.temperatureK
 			    << " and gamma calculated: " << agcGamma;
 
-	/* The CCM matrix may change when color temperature will be used */
-	params.acc_param.ccm = imguCssCcmDefault;
+	/* The LUT only depends on the gamma, skip the costly recomputation. */
+	if (agcGamma == gamma_)
+		return;
+
+	gamma_ = agcGamma;
 
 	for (uint32_t i = 0; i < 256; i++) {
 		double j = i / 255.0;
 		double gamma = std::pow(j, 1.0 / agcGamma);
 		/* The maximum value 255 is represented on 13 bits in the IPU3 */
-		params.acc_param.gamma.gc_lut.lut[i] = gamma * 8191;
+		gammaLut_.lut[i] = gamma * 8191;
 	}
 }
 
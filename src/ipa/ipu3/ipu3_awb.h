@@ -7,31 +7,30 @@
 #ifndef __LIBCAMERA_IPU3_AWB_H__
 #define __LIBCAMERA_IPU3_AWB_H__
 
-#include <vector>
-
 #include <linux/intel-ipu3.h>
 
 #include <libcamera/geometry.h>
 
-#include "libipa/algorithm.h"
+#include "ipu3_awb_math.h"
+#include "module.h"
 
 namespace libcamera {
 
 namespace ipa::ipu3 {
 
-/* Region size for the statistics generation algorithm */
-static constexpr uint32_t kAwbStatsSizeX = 16;
-static constexpr uint32_t kAwbStatsSizeY = 12;
-
-class IPU3Awb : public Algorithm
+class IPU3Awb : public Algorithm<Module>
 {
 public:
 	IPU3Awb();
 	~IPU3Awb();
 
-	void initialise(ipu3_uapi_params &params, const Size &bdsOutputSize, struct ipu3_uapi_grid_config &bdsGrid);
-	void calculateWBGains(const ipu3_uapi_stats_3a *stats);
-	void updateWbParameters(ipu3_uapi_params &params, double agcGamma);
+	int configure(IPAContext &context, const IPAConfigInfo &configInfo) override;
+	void prepare(IPAContext &context, uint32_t frame,
+		     IPAFrameContext &frameContext,
+		     ipu3_uapi_params *params) override;
+	void process(IPAContext &context, uint32_t frame,
+		     IPAFrameContext &frameContext,
+		     const IPU3GridStats *stats) override;
 
 	struct Ipu3AwbCell {
 		unsigned char greenRedAvg;
@@ -42,46 +41,20 @@ public:
 		unsigned char padding[3];
 	} __attribute__((packed));
 
-	/* \todo Make these three structs available to all the ISPs ? */
-	struct RGB {
-		RGB(double _R = 0, double _G = 0, double _B = 0)
-			: R(_R), G(_G), B(_B)
-		{
-		}
-		double R, G, B;
-		RGB &operator+=(RGB const &other)
-		{
-			R += other.R, G += other.G, B += other.B;
-			return *this;
-		}
-	};
-
-	struct IspStatsRegion {
-		unsigned int counted;
-		unsigned int uncounted;
-		unsigned long long rSum;
-		unsigned long long gSum;
-		unsigned long long bSum;
-	};
-
-	struct AwbStatus {
-		double temperatureK;
-		double redGain;
-		double greenGain;
-		double blueGain;
-	};
-
 private:
-	void generateZones(std::vector<RGB> &zones);
-	void generateAwbStats(const ipu3_uapi_stats_3a *stats);
-	void clearAwbStats();
-	void awbGreyWorld();
-	uint32_t estimateCCT(double red, double green, double blue);
+	void calculateWBGains(const IPU3GridStats &stats);
+	void updateWbParameters(double agcGamma);
 
 	struct ipu3_uapi_grid_config awbGrid_;
 
-	std::vector<RGB> zones_;
-	IspStatsRegion awbStats_[kAwbStatsSizeX * kAwbStatsSizeY];
+	/* ISP parameters owned by the algorithm, applied to every frame */
+	struct ipu3_uapi_awb_config_s awbConfig_;
+	struct ipu3_uapi_bnr_static_config bnr_;
+	struct ipu3_uapi_gamma_corr_lut gammaLut_;
+	/* Gamma the LUT has been computed for, 0 for the default LUT */
+	double gamma_;
+
+	AwbZone zones_[kAwbStatsSizeX * kAwbStatsSizeY];
 	AwbStatus asyncResults_;
 };
 
@@ -0,0 +1,239 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Ideas On Board
+ *
+ * ipu3_awb_math.cpp - IPU3 fixed-point white balance computations
+ */
+#include "ipu3_awb_math.h"
+
+#include <algorithm>
+#include <limits>
+
+/**
+ * \file ipu3_awb_math.h
+ * \brief Fixed-point white balance computations
+ *
+ * The white balance runs on every frame. Its computations are done on
+ * integers, which are cheaper than floating point on the CPUs the IPA runs on,
+ * and produce the same results on all architectures.
+ */
+
+namespace libcamera {
+
+namespace ipa::ipu3 {
+
+static constexpr uint32_t kMinZonesCounted = 16;
+static constexpr uint32_t kMinGreenLevelInZone = 32;
+
+/**
+ * \var kAwbZoneShift
+ * \brief Number of fractional bits of the AwbZone averages
+ */
+
+/**
+ * \var kAwbGainShift
+ * \brief Number of fractional bits of the AwbStatus gains
+ */
+
+/**
+ * \struct AwbZone
+ * \brief Average colour of an AWB region, with kAwbZoneShift fractional bits
+ *
+ * \var AwbZone::R
+ * \brief Red average of the zone
+ *
+ * \var AwbZone::G
+ * \brief Green average of the zone
+ *
+ * \var AwbZone::B
+ * \brief Blue average of the zone
+ */
+
+/**
+ * \struct AwbStatus
+ * \brief AWB parameters calculated
+ *
+ * The AwbStatus structure is intended to store the AWB parameters calculated
+ * by the algorithm. The gains have kAwbGainShift fractional bits.
+ *
+ * \var AwbStatus::temperatureK
+ * \brief Color temperature calculated
+ *
+ * \var AwbStatus::redGain
+ * \brief Gain calculated for the red channel
+ *
+ * \var AwbStatus::greenGain
+ * \brief Gain calculated for the green channel
+ *
+ * \var AwbStatus::blueGain
+ * \brief Gain calculated for the blue channel
+ */
+
+/**
+ * \brief Compute the average colour of the valid AWB regions
+ * \param[in] stats The grid statistics
+ * \param[out] zones The zones, with room for all the regions of the grid
+ *
+ * Regions with too few unsaturated cells, or too dark, are skipped.
+ *
+ * \return The number of zones stored in \a zones
+ */
+unsigned int generateAwbZones(const IPU3GridStats &stats, AwbZone *zones)
+{
+	unsigned int count = 0;
+
+	for (unsigned int i = 0; i < kAwbStatsSizeX * kAwbStatsSizeY; i++) {
+		const IspStatsRegion &region = stats.regions[i];
+		uint64_t counted = region.counted;
+
+		if (counted < kMinZonesCounted)
+			continue;
+
+		/* Average of 8-bit values, this fits in 32 bits. */
+		uint32_t green = (region.gSum << kAwbZoneShift) / counted;
+		if (green < (kMinGreenLevelInZone << kAwbZoneShift))
+			continue;
+
+		AwbZone &zone = zones[count++];
+		zone.R = (region.rSum << kAwbZoneShift) / counted;
+		zone.G = green;
+		zone.B = (region.bSum << kAwbZoneShift) / counted;
+	}
+
+	return count;
+}
+
+/**
+ * \brief Compute the grey world white balance gains
+ * \param[inout] zones The zones, reordered by the function
+ * \param[in] count The number of zones
+ * \param[out] status The white balance gains and colour temperature
+ *
+ * The red and blue gains are computed from the zones whose red (respectively
+ * blue) to green ratios fall in the middle half, discarding the extreme ones.
+ */
+void awbGreyWorld(AwbZone *zones, unsigned int count, AwbStatus *status)
+{
+	/* Average the middle half of the values. */
+	unsigned int discard = count / 4;
+	AwbZone *first = zones + discard;
+	AwbZone *last = zones + count - discard;
+
+	/* The products of two zone components fit in 64 bits. */
+	std::sort(zones, zones + count,
+		  [](const AwbZone &a, const AwbZone &b) {
+			  return static_cast<uint64_t>(a.G) * b.R <
+				 static_cast<uint64_t>(b.G) * a.R;
+		  });
+
+	uint64_t redR = 0, redG = 0;
+	for (const AwbZone *zone = first; zone != last; zone++) {
+		redR += zone->R;
+		redG += zone->G;
+	}
+
+	std::sort(zones, zones + count,
+		  [](const AwbZone &a, const AwbZone &b) {
+			  return static_cast<uint64_t>(a.G) * b.B <
+				 static_cast<uint64_t>(b.G) * a.B;
+		  });
+
+	uint64_t blueB = 0, blueG = 0;
+	for (const AwbZone *zone = first; zone != last; zone++) {
+		blueB += zone->B;
+		blueG += zone->G;
+	}
+
+	/* The gains are G / (R + 1), the sums having kAwbZoneShift fractional bits. */
+	constexpr uint64_t one = 1 << kAwbZoneShift;
+
+	status->redGain = (redG << kAwbGainShift) / (redR + one);
+	status->greenGain = 1 << kAwbGainShift;
+	status->blueGain = (blueG << kAwbGainShift) / (blueB + one);
+
+	/* Color temperature is not relevant in Grey world but still useful to estimate it :-) */
+	status->temperatureK = estimateCCT(redR, redG, blueB);
+}
+
+/**
+ * \brief Estimate the correlated color temperature from RGB values
+ * \param[in] red The red value
+ * \param[in] green The green value
+ * \param[in] blue The blue value
+ *
+ * The RGB values are converted to the CIE XYZ color space, and the
+ * temperature is computed from the chromaticity coordinates with McCamy's
+ * cubic approximation of the Planckian locus, valid in a narrow range of
+ * temperatures around daylight.
+ *
+ * More detailed information can be found in:
+ * https://en.wikipedia.org/wiki/Color_temperature#Approximation
+ *
+ * The computations only depend on the ratios between the values, which can
+ * have any scale.
+ *
+ * \return The estimated color temperature in Kelvin, or 0 if it can't be
+ * estimated
+ */
+uint32_t estimateCCT(uint64_t red, uint64_t green, uint64_t blue)
+{
+	/* Scale the values down to 20 bits to keep the products in range. */
+	uint64_t max = std::max({ red, green, blue });
+	unsigned int shift = 0;
+	while ((max >> shift) >= (1 << 20))
+		shift++;
+
+	int64_t r = red >> shift;
+	int64_t g = green >> shift;
+	int64_t b = blue >> shift;
+
+	/*
+	 * Convert the RGB values to CIE tristimulus values, with 16 fractional
+	 * bits. Products are scaled by multiplications and divisions, which
+	 * are defined for negative values unlike shifts.
+	 */
+	constexpr int64_t one = 1 << 16;
+	int64_t X = -9360 * r + 101531 * g - 62679 * b;
+	int64_t Y = -21277 * r + 103440 * g - 47966 * b;
+	int64_t Z = -44697 * r + 50511 * g + 36918 * b;
+	int64_t S = X + Y + Z;
+
+	/*
+	 * The chromaticity coordinates x = X / S and y = Y / S are folded in
+	 * n = (x - 0.3320) / (0.1858 - y), which avoids dividing twice.
+	 */
+	int64_t num = X * one - 21758 * S;
+	int64_t den = (12177 * S - Y * one) / one;
+	if (!den)
+		return 0;
+
+	/* Beyond this range the approximation is meaningless anyway. */
+	int64_t n = std::clamp<int64_t>(num / den, -2 * one, 2 * one);
+
+	/* 449 n^3 + 3525 n^2 + 6823.3 n + 5520.33, in Horner form. */
+	int64_t cct = 449 * n;
+	cct = (cct + 3525 * one) * n / one;
+	cct = (cct + 447171789) * n / one;
+	cct = (cct + 361780347) / one;
+
+	return std::max<int64_t>(cct, 0);
+}
+
+/**
+ * \brief Convert a white balance gain to the BNR white balance gains format
+ * \param[in] gain The gain, with kAwbGainShift fractional bits
+ *
+ * \todo The IPU3 kernel header documents the gains in the u3.13 format, while
+ * 4096 has so far been used as the unity gain. Confirm the format against the
+ * hardware.
+ *
+ * \return The gain, saturated to the 16 bits of the field
+ */
+uint16_t awbGainToBnr(uint32_t gain)
+{
+	return std::min<uint32_t>(gain, std::numeric_limits<uint16_t>::max());
+}
+
+} /* namespace ipa::ipu3 */
+
+} /* namespace libcamera */
@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Ideas On Board
+ *
+ * ipu3_awb_math.h - IPU3 fixed-point white balance computations
+ */
+#ifndef __LIBCAMERA_IPU3_AWB_MATH_H__
+#define __LIBCAMERA_IPU3_AWB_MATH_H__
+
+#include <stdint.h>
+
+#include "ipu3_stats.h"
+
+namespace libcamera {
+
+namespace ipa::ipu3 {
+
+/* Fractional bits of the zone averages */
+static constexpr unsigned int kAwbZoneShift = 16;
+/* Fractional bits of the white balance gains */
+static constexpr unsigned int kAwbGainShift = 12;
+
+struct AwbZone {
+	uint32_t R;
+	uint32_t G;
+	uint32_t B;
+};
+
+struct AwbStatus {
+	uint32_t temperatureK;
+	uint32_t redGain;
+	uint32_t greenGain;
+	uint32_t blueGain;
+};
+
+unsigned int generateAwbZones(const IPU3GridStats &stats, AwbZone *zones);
+void awbGreyWorld(AwbZone *zones, unsigned int count, AwbStatus *status);
+uint32_t estimateCCT(uint64_t red, uint64_t green, uint64_t blue);
+uint16_t awbGainToBnr(uint32_t gain);
+
+} /* namespace ipa::ipu3 */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPU3_AWB_MATH_H__ */
@@ -0,0 +1,171 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Ideas On Board
+ *
+ * ipu3_stats.cpp - IPU3 AWB grid statistics reduction
+ */
+#include "ipu3_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+#include "libcamera/internal/log.h"
+
+namespace libcamera {
+
+namespace ipa::ipu3 {
+
+/**
+ * \struct IspStatsRegion
+ * \brief RGB statistics for a given region
+ *
+ * The IspStatsRegion structure is intended to abstract the ISP specific
+ * statistics and use an agnostic algorithm to compute AWB.
+ *
+ * \var IspStatsRegion::counted
+ * \brief Number of pixels used to calculate the sums
+ *
+ * \var IspStatsRegion::uncounted
+ * \brief Remaining number of pixels in the region
+ *
+ * \var IspStatsRegion::rSum
+ * \brief Sum of the red values in the region
+ *
+ * \var IspStatsRegion::gSum
+ * \brief Sum of the green values in the region
+ *
+ * \var IspStatsRegion::bSum
+ * \brief Sum of the blue values in the region
+ */
+
+/**
+ * \struct IPU3GridStats
+ * \brief Statistics of the AWB grid shared by the AGC and AWB algorithms
+ *
+ * \var IPU3GridStats::regions
+ * \brief RGB sums of the non-saturated cells of each AWB region
+ *
+ * \var IPU3GridStats::histogram
+ * \brief Histogram of the green level of the non-saturated cells of the grid
+ */
+
+namespace {
+
+/* A cell is 8 bytes and contains averages for RGB values and saturation ratio */
+constexpr unsigned int kCellSize = 8;
+
+/*
+ * The cells are accumulated in 16-bit lanes of a 64-bit word, which can't
+ * overflow for runs of up to 257 cells of 8-bit values.
+ */
+constexpr unsigned int kMaxRunLength = 257;
+constexpr uint64_t kEvenBytes = 0x00ff00ff00ff00ffULL;
+
+struct RunSums {
+	unsigned int counted;
+	unsigned int odd;
+	uint64_t evenLanes;
+	uint64_t oddLanes;
+};
+
+/*
+ * Accumulate a run of consecutive cells. The cell layout, from the first
+ * byte, is green (red lines), red, blue, green (blue lines), saturation ratio
+ * and padding. Read as a little-endian 64-bit word, the even bytes hold the
+ * green (red lines) and blue averages in lanes 0 and 1, and the odd bytes the
+ * red and green (blue lines) averages. Saturated cells are masked out
+ * without branching. The histogram update is a scatter, and stays per cell.
+ */
+RunSums accumulateRun(const uint8_t *cells, unsigned int count,
+		      uint32_t *histogram)
+{
+	RunSums sums = {};
+
+	for (unsigned int i = 0; i < count; i++) {
+		uint64_t cell;
+		memcpy(&cell, cells + i * kCellSize, sizeof(cell));
+
+		uint64_t valid = ((cell >> 32) & 0xff) == 0;
+		cell &= -valid;
+
+		sums.evenLanes += cell & kEvenBytes;
+		sums.oddLanes += (cell >> 8) & kEvenBytes;
+
+		unsigned int greenRed = cell & 0xff;
+		unsigned int greenBlue = (cell >> 24) & 0xff;
+		histogram[(greenRed + greenBlue) / 2] += valid;
+		sums.odd += (greenRed ^ greenBlue) & 1;
+		sums.counted += valid;
+	}
+
+	return sums;
+}
+
+void addRun(const RunSums &sums, IspStatsRegion &region)
+{
+	unsigned int greenRed = sums.evenLanes & 0xffff;
+	unsigned int blue = (sums.evenLanes >> 16) & 0xffff;
+	unsigned int red = sums.oddLanes & 0xffff;
+	unsigned int greenBlue = (sums.oddLanes >> 16) & 0xffff;
+
+	region.counted += sums.counted;
+	/* Sum (greenRed + greenBlue) / 2 of each cell, rounding down. */
+	region.gSum += (greenRed + greenBlue - sums.odd) / 2;
+	region.rSum += red;
+	region.bSum += blue;
+}
+
+} /* namespace */
+
+/**
+ * \brief Reduce the AWB grid statistics in a single pass
+ * \param[in] stats The IPU3 statistics buffer
+ * \param[in] grid The AWB grid configured in the parameters
+ * \param[out] gridStats The statistics of the grid
+ *
+ * The grid is split in kAwbStatsSizeX x kAwbStatsSizeY regions, whose RGB
+ * sums are computed from the non-saturated cells. The green level histogram
+ * of all the non-saturated cells of the grid is computed in the same pass, so
+ * that the statistics buffer is read once per frame for both the AGC and AWB
+ * algorithms.
+ */
+void generateGridStats(const ipu3_uapi_stats_3a *stats,
+		       const ipu3_uapi_grid_config &grid,
+		       IPU3GridStats *gridStats)
+{
+	ASSERT(stats->stats_3a_status.awb_en);
+
+	*gridStats = {};
+
+	uint32_t regionWidth = round(grid.width / static_cast<double>(kAwbStatsSizeX));
+	uint32_t regionHeight = round(grid.height / static_cast<double>(kAwbStatsSizeY));
+	regionWidth = std::clamp<uint32_t>(regionWidth, 1, kMaxRunLength);
+	regionHeight = std::max<uint32_t>(regionHeight, 1);
+
+	for (unsigned int y = 0; y < grid.height; y++) {
+		const uint8_t *row = &stats->awb_raw_buffer.meta_data[y * grid.width * kCellSize];
+		unsigned int regionY = y / regionHeight;
+		unsigned int x = 0;
+
+		while (x < grid.width) {
+			unsigned int regionX = x / regionWidth;
+			unsigned int count = std::min(regionWidth, grid.width - x);
+			if (regionX >= kAwbStatsSizeX)
+				count = std::min(kMaxRunLength, grid.width - x);
+
+			RunSums sums = accumulateRun(row + x * kCellSize, count,
+						     gridStats->histogram);
+
+			/* Cells outside of the regions only feed the histogram. */
+			if (regionX < kAwbStatsSizeX && regionY < kAwbStatsSizeY)
+				addRun(sums, gridStats->regions[regionY * kAwbStatsSizeX + regionX]);
+
+			x += count;
+		}
+	}
+}
+
+} /* namespace ipa::ipu3 */
+
+} /* namespace libcamera */
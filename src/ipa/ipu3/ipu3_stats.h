@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Ideas On Board
+ *
+ * ipu3_stats.h - IPU3 AWB grid statistics reduction
+ */
+#ifndef __LIBCAMERA_IPU3_STATS_H__
+#define __LIBCAMERA_IPU3_STATS_H__
+
+#include <stdint.h>
+
+#include <linux/intel-ipu3.h>
+
+namespace libcamera {
+
+namespace ipa::ipu3 {
+
+/* Region size for the statistics generation algorithm */
+static constexpr uint32_t kAwbStatsSizeX = 16;
+static constexpr uint32_t kAwbStatsSizeY = 12;
+
+/* Number of bins of the green level histogram */
+static constexpr uint32_t kGridHistogramBins = 256;
+
+struct IspStatsRegion {
+	unsigned int counted;
+	unsigned int uncounted;
+	unsigned long long rSum;
+	unsigned long long gSum;
+	unsigned long long bSum;
+};
+
+struct IPU3GridStats {
+	IspStatsRegion regions[kAwbStatsSizeX * kAwbStatsSizeY];
+	uint32_t histogram[kGridHistogramBins];
+};
+
+void generateGridStats(const ipu3_uapi_stats_3a *stats,
+		       const ipu3_uapi_grid_config &grid,
+		       IPU3GridStats *gridStats);
+
+} /* namespace ipa::ipu3 */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPU3_STATS_H__ */
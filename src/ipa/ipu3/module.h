@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * module.h - IPU3 IPA Module
+ */
+#ifndef __LIBCAMERA_IPU3_MODULE_H__
+#define __LIBCAMERA_IPU3_MODULE_H__
+
+#include <linux/intel-ipu3.h>
+
+#include <libcamera/ipa/ipu3_ipa_interface.h>
+
+#include "libipa/module.h"
+
+#include "ipa_context.h"
+#include "ipu3_stats.h"
+
+namespace libcamera {
+
+namespace ipa::ipu3 {
+
+using Module = ipa::Module<IPAContext, IPAFrameContext, IPAConfigInfo,
+			   ipu3_uapi_params, IPU3GridStats>;
+
+} /* namespace ipa::ipu3 */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPU3_MODULE_H__ */
@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * fc_queue.cpp - IPA frame context queue
+ */
+
+#include "fc_queue.h"
+
+/**
+ * \file fc_queue.h
+ * \brief Queue of per-frame contexts
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(FCQueue)
+
+namespace ipa {
+
+/**
+ * \struct FrameContext
+ * \brief Context for a frame
+ *
+ * The frame context stores the data specific to a single frame processed by
+ * the ISP, from the controls of the request it belongs to, to the parameters
+ * computed by the algorithms and the results of the statistics processing.
+ * IPA modules derive their own frame context structure from this one.
+ *
+ * Frame contexts are reset by value initialisation, they shall not own memory
+ * allocated dynamically to keep the per-frame path free of allocations.
+ *
+ * \var FrameContext::frame
+ * \brief The frame number
+ */
+
+/**
+ * \class FCQueue
+ * \brief A ring of frame contexts, indexed by frame number
+ * \tparam FC The IPA-specific frame context type, derived from FrameContext
+ *
+ * The frame context queue stores the contexts of the frames in flight in the
+ * IPA. The contexts are preallocated in a ring of kMaxFrameContexts entries,
+ * and addressed by the frame number modulo the ring size. A context is
+ * initialised with init() when the IPA first hears of a frame, typically when
+ * the request it belongs to is queued, and retrieved with get() by the
+ * following operations on the same frame.
+ *
+ * The ring size bounds the number of frames the IPA can have in flight. A
+ * context is overwritten kMaxFrameContexts frames after being initialised.
+ */
+
+/**
+ * \var FCQueue::kMaxFrameContexts
+ * \brief The number of frame contexts in the ring
+ */
+
+/**
+ * \fn FCQueue::FCQueue()
+ * \brief Construct a frame context queue with all contexts cleared
+ */
+
+/**
+ * \fn FCQueue::clear()
+ * \brief Clear all the frame contexts
+ *
+ * Reset all the contexts of the ring, typically when the camera is
+ * configured or stopped, so that no stale context is used afterwards.
+ */
+
+/**
+ * \fn FCQueue::init(uint32_t frame)
+ * \brief Initialise the context of a frame
+ * \param[in] frame The frame number
+ *
+ * The context previously stored in the ring entry, if any, is overwritten.
+ *
+ * \return A reference to the frame context, reset to its default value
+ */
+
+/**
+ * \fn FCQueue::get(uint32_t frame)
+ * \brief Retrieve the context of a frame
+ * \param[in] frame The frame number
+ *
+ * If the context of \a frame hasn't been initialised, or has been overwritten
+ * by a later frame, a warning is logged and the context is initialised.
+ *
+ * \return A reference to the frame context
+ */
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * fc_queue.h - IPA frame context queue
+ */
+#ifndef __LIBCAMERA_IPA_LIBIPA_FC_QUEUE_H__
+#define __LIBCAMERA_IPA_LIBIPA_FC_QUEUE_H__
+
+#include <array>
+#include <stdint.h>
+
+#include "libcamera/internal/log.h"
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(FCQueue)
+
+namespace ipa {
+
+struct FrameContext {
+	uint32_t frame;
+};
+
+template<typename FC>
+class FCQueue
+{
+public:
+	static constexpr unsigned int kMaxFrameContexts = 16;
+
+	FCQueue()
+	{
+		clear();
+	}
+
+	void clear()
+	{
+		for (FC &frameContext : contexts_) {
+			frameContext = {};
+			frameContext.frame = UINT32_MAX;
+		}
+	}
+
+	FC &init(uint32_t frame)
+	{
+		FC &frameContext = contexts_[frame % kMaxFrameContexts];
+
+		frameContext = {};
+		frameContext.frame = frame;
+
+		return frameContext;
+	}
+
+	FC &get(uint32_t frame)
+	{
+		FC &frameContext = contexts_[frame % kMaxFrameContexts];
+
+		/*
+		 * The frame context was either never initialised, or has been
+		 * reused for a later frame. This happens when the IPA falls
+		 * more than kMaxFrameContexts frames behind, initialise it
+		 * again to get sane defaults.
+		 */
+		if (frameContext.frame != frame) {
+			LOG(FCQueue, Warning)
+				<< "Frame context for frame " << frame
+				<< " not initialised, now holding frame "
+				<< frameContext.frame;
+			return init(frame);
+		}
+
+		return frameContext;
+	}
+
+private:
+	std::array<FC, kMaxFrameContexts> contexts_;
+};
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPA_LIBIPA_FC_QUEUE_H__ */
@@ -6,6 +6,7 @@
  */
 #include "histogram.h"
 
+#include <algorithm>
 #include <cmath>
 
 #include "libcamera/internal/log.h"
@@ -19,6 +20,80 @@ namespace libcamera {
 
 namespace ipa {
 
+/**
+ * \brief Compute the cumulative frequencies of a histogram
+ * \param[in] data The histogram bins
+ * \param[out] cumulative The cumulative frequencies, data.size() + 1 entries
+ *
+ * The cumulative frequency of bin i is stored in \a cumulative[i + 1], the sum
+ * of all the bins before it, with \a cumulative[0] set to 0.
+ *
+ * A prefix sum is inherently serial, each value depending on the previous one,
+ * which limits it to one bin per addition latency. The bins are thus processed
+ * in blocks of four, whose partial sums don't depend on the previous blocks and
+ * can be computed in parallel, leaving only two additions per block on the
+ * critical path.
+ */
+void cumulateHistogram(Span<const uint32_t> data, uint64_t *cumulative)
+{
+	const uint32_t *in = data.data();
+	uint64_t *out = cumulative + 1;
+	uint64_t sum = 0;
+	size_t i = 0;
+
+	cumulative[0] = 0;
+
+	for (; i + 4 <= data.size(); i += 4) {
+		uint64_t sum01 = static_cast<uint64_t>(in[i]) + in[i + 1];
+		uint64_t sum23 = static_cast<uint64_t>(in[i + 2]) + in[i + 3];
+		uint64_t half = sum + sum01;
+
+		out[i] = sum + in[i];
+		out[i + 1] = half;
+		out[i + 2] = half + in[i + 2];
+		sum = half + sum23;
+		out[i + 3] = sum;
+	}
+
+	for (; i < data.size(); i++) {
+		sum += in[i];
+		out[i] = sum;
+	}
+}
+
+/**
+ * \brief Find the (fractional) bin in which a cumulative frequency is reached
+ * \param[in] cumulative The cumulative frequencies of a histogram
+ * \param[in] item The cumulative frequency to look for
+ * \param[in] first The lowest bin to consider
+ * \param[in] last The highest bin to consider
+ *
+ * The \a cumulative array is formatted as computed by cumulateHistogram(), and
+ * must contain at least \a last + 2 entries. The bin is located by a binary
+ * search, and the pixels are assumed to be spread evenly throughout it.
+ *
+ * \return The fractional bin, between \a first and \a last + 1
+ */
+double cumulativeQuantile(const uint64_t *cumulative, uint64_t item,
+			  uint32_t first, uint32_t last)
+{
+	ASSERT(first <= last);
+
+	/* Find the first bin whose upper end exceeds the item. */
+	const uint64_t *upper = std::upper_bound(cumulative + first + 1,
+						 cumulative + last + 1, item);
+	uint32_t bin = upper - cumulative - 1;
+
+	uint64_t low = cumulative[bin];
+	uint64_t high = cumulative[bin + 1];
+	ASSERT(item >= low && item <= cumulative[last + 1]);
+
+	if (high == low)
+		return bin;
+
+	return bin + static_cast<double>(item - low) / (high - low);
+}
+
 /**
  * \class Histogram
  * \brief The base class for creating histograms
@@ -32,12 +107,10 @@ namespace ipa {
  * \brief Create a cumulative histogram
  * \param[in] data A pre-sorted histogram to be passed
  */
-Histogram::Histogram(Span<uint32_t> data)
+Histogram::Histogram(Span<const uint32_t> data)
+	: cumulative_(data.size() + 1)
 {
-	cumulative_.reserve(data.size());
-	cumulative_.push_back(0);
-	for (const uint32_t &value : data)
-		cumulative_.push_back(cumulative_.back() + value);
+	cumulateHistogram(data, cumulative_.data());
 }
 
 /**
@@ -90,26 +163,9 @@ double Histogram::quantile(double q, uint32_t first, uint32_t last) const
 {
 	if (last == UINT_MAX)
 		last = cumulative_.size() - 2;
-	ASSERT(first <= last);
 
 	uint64_t item = q * total();
-	/* Binary search to find the right bin */
-	while (first < last) {
-		int middle = (first + last) / 2;
-		/* Is it between first and middle ? */
-		if (cumulative_[middle + 1] > item)
-			last = middle;
-		else
-			first = middle + 1;
-	}
-	ASSERT(item >= cumulative_[first] && item <= cumulative_[last + 1]);
-
-	double frac;
-	if (cumulative_[first + 1] == cumulative_[first])
-		frac = 0;
-	else
-		frac = (item - cumulative_[first]) / (cumulative_[first + 1] - cumulative_[first]);
-	return first + frac;
+	return cumulativeQuantile(cumulative_.data(), item, first, last);
 }
 
 /**
@@ -19,10 +19,14 @@ namespace libcamera {
 
 namespace ipa {
 
+void cumulateHistogram(Span<const uint32_t> data, uint64_t *cumulative);
+double cumulativeQuantile(const uint64_t *cumulative, uint64_t item,
+			  uint32_t first, uint32_t last);
+
 class Histogram
 {
 public:
-	Histogram(Span<uint32_t> data);
+	Histogram(Span<const uint32_t> data);
 	size_t bins() const { return cumulative_.size() - 1; }
 	uint64_t total() const { return cumulative_[cumulative_.size() - 1]; }
 	uint64_t cumulativeFrequency(double bin) const;
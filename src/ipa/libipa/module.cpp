@@ -0,0 +1,123 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * module.cpp - IPA module algorithm pipeline
+ */
+
+#include "module.h"
+
+/**
+ * \file module.h
+ * \brief IPA module algorithm pipeline
+ */
+
+namespace libcamera {
+
+namespace ipa {
+
+/**
+ * \class Module
+ * \brief The algorithms of an IPA module, run in order on each frame
+ * \tparam _Context The type of the shared IPA context
+ * \tparam _FrameContext The type of the frame context, derived from
+ * FrameContext
+ * \tparam _Config The type of the IPA configuration data
+ * \tparam _Params The type of the ISP specific parameters
+ * \tparam _Stats The type of the IPA statistics and ISP results
+ *
+ * The Module class groups the types that an IPA module exchanges with its
+ * algorithms, and the ordered list of those algorithms. IPA modules define
+ * their module type by instantiating the template, and derive their
+ * algorithms from Algorithm<Module>.
+ *
+ * The configure(), prepare() and process() operations run the corresponding
+ * operation of all algorithms, in the order they have been added to the
+ * module. Algorithms can thus consume the results stored in the context by the
+ * algorithms that precede them. The time spent by each algorithm in prepare()
+ * and process() is recorded, and reported by timings().
+ *
+ * Running the algorithms doesn't allocate memory, IPA modules that store their
+ * frame contexts in an FCQueue get a per-frame path free of allocations.
+ */
+
+/**
+ * \typedef Module::Context
+ * \brief The type of the shared IPA context
+ */
+
+/**
+ * \typedef Module::FrameContext
+ * \brief The type of the frame context
+ */
+
+/**
+ * \typedef Module::Config
+ * \brief The type of the IPA configuration data
+ */
+
+/**
+ * \typedef Module::Params
+ * \brief The type of the ISP specific parameters
+ */
+
+/**
+ * \typedef Module::Stats
+ * \brief The type of the IPA statistics and ISP results
+ */
+
+/**
+ * \fn Module::addAlgorithm()
+ * \brief Add an algorithm at the end of the module
+ * \param[in] name The algorithm name, used to report the timings
+ * \param[in] algorithm The algorithm
+ */
+
+/**
+ * \fn Module::clearAlgorithms()
+ * \brief Remove all algorithms from the module
+ */
+
+/**
+ * \fn Module::configure()
+ * \brief Configure all algorithms
+ * \param[in] context The shared IPA context
+ * \param[in] config The IPA configuration data
+ *
+ * The algorithms are configured in order, and the configuration stops at the
+ * first failure. The timings of the algorithms are reset.
+ *
+ * \return 0 on success, or the error code of the first algorithm that failed
+ */
+
+/**
+ * \fn Module::prepare()
+ * \brief Prepare the ISP parameters of a frame with all algorithms
+ * \param[in] context The shared IPA context
+ * \param[in] frame The frame number
+ * \param[in] frameContext The context of the frame
+ * \param[out] params The ISP specific parameters
+ */
+
+/**
+ * \fn Module::process()
+ * \brief Process the statistics of a frame with all algorithms
+ * \param[in] context The shared IPA context
+ * \param[in] frame The frame number
+ * \param[in] frameContext The context of the frame
+ * \param[in] stats The IPA statistics and ISP results
+ */
+
+/**
+ * \fn Module::timings()
+ * \brief Report the time spent by each algorithm
+ *
+ * The returned string contains one line per algorithm, with the statistics of
+ * the time spent in prepare() and process() over the most recent frames.
+ *
+ * \return A string describing the timings of the algorithms
+ */
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
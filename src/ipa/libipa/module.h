@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * module.h - IPA module algorithm pipeline
+ */
+#ifndef __LIBCAMERA_IPA_LIBIPA_MODULE_H__
+#define __LIBCAMERA_IPA_LIBIPA_MODULE_H__
+
+#include <memory>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <libcamera/performance.h>
+
+#include "libcamera/internal/utils.h"
+
+#include "algorithm.h"
+
+namespace libcamera {
+
+namespace ipa {
+
+template<typename _Context, typename _FrameContext, typename _Config,
+	 typename _Params, typename _Stats>
+class Module
+{
+public:
+	using Context = _Context;
+	using FrameContext = _FrameContext;
+	using Config = _Config;
+	using Params = _Params;
+	using Stats = _Stats;
+
+	void addAlgorithm(const std::string &name,
+			  std::unique_ptr<Algorithm<Module>> algorithm)
+	{
+		algorithms_.push_back({ name, std::move(algorithm), {}, {} });
+	}
+
+	void clearAlgorithms()
+	{
+		algorithms_.clear();
+	}
+
+	int configure(Context &context, const Config &config)
+	{
+		for (Entry &entry : algorithms_) {
+			int ret = entry.algorithm->configure(context, config);
+			if (ret)
+				return ret;
+
+			entry.prepareTime.reset();
+			entry.processTime.reset();
+		}
+
+		return 0;
+	}
+
+	void prepare(Context &context, uint32_t frame,
+		     FrameContext &frameContext, Params *params)
+	{
+		for (Entry &entry : algorithms_) {
+			utils::time_point start = utils::clock::now();
+			entry.algorithm->prepare(context, frame, frameContext, params);
+			entry.prepareTime.add(elapsed(start));
+		}
+	}
+
+	void process(Context &context, uint32_t frame,
+		     FrameContext &frameContext, const Stats *stats)
+	{
+		for (Entry &entry : algorithms_) {
+			utils::time_point start = utils::clock::now();
+			entry.algorithm->process(context, frame, frameContext, stats);
+			entry.processTime.add(elapsed(start));
+		}
+	}
+
+	std::string timings() const
+	{
+		std::ostringstream ss;
+
+		for (const Entry &entry : algorithms_)
+			ss << entry.name << ": prepare " << entry.prepareTime.toString()
+			   << ", process " << entry.processTime.toString() << std::endl;
+
+		return ss.str();
+	}
+
+private:
+	struct Entry {
+		std::string name;
+		std::unique_ptr<Algorithm<Module>> algorithm;
+		PerformanceHistogram prepareTime;
+		PerformanceHistogram processTime;
+	};
+
+	static uint64_t elapsed(const utils::time_point &start)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			utils::clock::now() - start).count();
+	}
+
+	std::vector<Entry> algorithms_;
+};
+
+} /* namespace ipa */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPA_LIBIPA_MODULE_H__ */
@@ -41,7 +41,9 @@ CamHelper *CamHelper::Create(std::string const &cam_name)
 
 CamHelper::CamHelper(MdParser *parser, unsigned int frameIntegrationDiff)
 	: parser_(parser), initialized_(false),
-	  frameIntegrationDiff_(frameIntegrationDiff)
+	  frameIntegrationDiff_(frameIntegrationDiff),
+	  frameDurationsCached_{ -1.0, -1.0 }, frameLengthMin_(0),
+	  frameLengthMax_(0)
 {
 }
 
@@ -76,37 +78,70 @@ double CamHelper::Exposure(uint32_t exposure_lines) const
 uint32_t CamHelper::GetVBlanking(double &exposure, double minFrameDuration,
 				 double maxFrameDuration) const
 {
-	uint32_t frameLengthMin, frameLengthMax, vblank;
+	uint32_t vblank;
 	uint32_t exposureLines = ExposureLines(exposure);
 
 	assert(initialized_);
 
 	/*
 	 * minFrameDuration and maxFrameDuration are clamped by the caller
-	 * based on the limits for the active sensor mode.
+	 * based on the limits for the active sensor mode. They only change
+	 * with the controls, so don't recompute the frame length limits for
+	 * every frame.
 	 */
-	frameLengthMin = 1e3 * minFrameDuration / mode_.line_length;
-	frameLengthMax = 1e3 * maxFrameDuration / mode_.line_length;
+	if (minFrameDuration != frameDurationsCached_[0] ||
+	    maxFrameDuration != frameDurationsCached_[1]) {
+		frameLengthMin_ = 1e3 * minFrameDuration / mode_.line_length;
+		frameLengthMax_ = 1e3 * maxFrameDuration / mode_.line_length;
+		frameDurationsCached_[0] = minFrameDuration;
+		frameDurationsCached_[1] = maxFrameDuration;
+	}
 
 	/*
 	 * Limit the exposure to the maximum frame duration requested, and
 	 * re-calculate if it has been clipped.
 	 */
-	exposureLines = std::min(frameLengthMax - frameIntegrationDiff_, exposureLines);
+	exposureLines = std::min(frameLengthMax_ - frameIntegrationDiff_, exposureLines);
 	exposure = Exposure(exposureLines);
 
 	/* Limit the vblank to the range allowed by the frame length limits. */
 	vblank = std::clamp(exposureLines + frameIntegrationDiff_,
-			    frameLengthMin, frameLengthMax) - mode_.height;
+			    frameLengthMin_, frameLengthMax_) - mode_.height;
 	return vblank;
 }
 
+CamHelper::FrameTiming CamHelper::GetFrameTiming(int64_t frame_start,
+						 double exposure_us,
+						 uint32_t frame_length) const
+{
+	FrameTiming timing;
+
+	assert(initialized_);
+
+	/*
+	 * The receiver timestamps the frame start, after which the sensor
+	 * sends FrameStartLines() lines before the first line of the image.
+	 * Each line ends its exposure when it is read out to be sent, one
+	 * line length after the previous one.
+	 */
+	timing.exposure_end = frame_start + FrameStartLines() * mode_.line_length;
+	timing.exposure_start = timing.exposure_end - exposure_us * 1000.0;
+	timing.rolling_shutter_skew = (mode_.height - 1) * mode_.line_length;
+	timing.frame_duration = frame_length * mode_.line_length;
+
+	return timing;
+}
+
 void CamHelper::SetCameraMode(const CameraMode &mode)
 {
 	mode_ = mode;
+	/* The frame length limits depend on the mode's line length. */
+	frameDurationsCached_[0] = frameDurationsCached_[1] = -1.0;
 	if (parser_) {
 		parser_->SetBitsPerPixel(mode.bitdepth);
 		parser_->SetLineLengthBytes(0); /* We use SetBufferSize. */
+		/* The embedded data layout may differ between modes. */
+		parser_->Reset();
 	}
 	initialized_ = true;
 }
@@ -128,6 +163,15 @@ bool CamHelper::SensorEmbeddedDataPresent() const
 	return false;
 }
 
+unsigned int CamHelper::FrameStartLines() const
+{
+	/*
+	 * The number of lines the sensor sends between the frame start and
+	 * the first line of the image, such as embedded data lines.
+	 */
+	return 0;
+}
+
 unsigned int CamHelper::HideFramesStartup() const
 {
 	/*
@@ -177,7 +221,7 @@ void CamHelper::parseEmbeddedData(Span<const uint8_t> buffer,
 	 */
 	DeviceStatus deviceStatus;
 
-	if (metadata.Get("device.status", deviceStatus) != 0) {
+	if (metadata.Get(tag::device_status, deviceStatus) != 0) {
 		LOG(IPARPI, Error) << "DeviceStatus not found";
 		return;
 	}
@@ -190,7 +234,7 @@ void CamHelper::parseEmbeddedData(Span<const uint8_t> buffer,
 			   << " Gain : "
 			   << deviceStatus.analogue_gain;
 
-	metadata.Set("device.status", deviceStatus);
+	metadata.Set(tag::device_status, deviceStatus);
 }
 
 RegisterCamHelper::RegisterCamHelper(char const *cam_name,
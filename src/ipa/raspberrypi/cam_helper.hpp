@@ -39,6 +39,10 @@ namespace RPiController {
 //
 // A method to query if the sensor outputs embedded data that can be parsed.
 //
+// A model of the frame timing, giving the times at which the lines of a frame
+// start and end their exposure from the time the receiver saw the frame start.
+// The sensors differ by the number of lines they send before the image.
+//
 // A parser to parse the embedded data buffers provided by some sensors (for
 // example, the imx219 does; the ov5647 doesn't). This allows us to know for
 // sure the exposure and gain of the frame we're looking at. CamHelper
@@ -76,11 +80,24 @@ public:
 	double Exposure(uint32_t exposure_lines) const; // in us
 	virtual uint32_t GetVBlanking(double &exposure_us, double minFrameDuration,
 				      double maxFrameDuration) const;
+	// All times in nanoseconds.
+	struct FrameTiming {
+		// exposure start and end of the first line of the image
+		int64_t exposure_start;
+		int64_t exposure_end;
+		// time between the exposure starts of the first and last lines
+		int64_t rolling_shutter_skew;
+		// time between the starts of consecutive frames
+		int64_t frame_duration;
+	};
+	FrameTiming GetFrameTiming(int64_t frame_start, double exposure_us,
+				   uint32_t frame_length) const;
 	virtual uint32_t GainCode(double gain) const = 0;
 	virtual double Gain(uint32_t gain_code) const = 0;
 	virtual void GetDelays(int &exposure_delay, int &gain_delay,
 			       int &vblank_delay) const;
 	virtual bool SensorEmbeddedDataPresent() const;
+	virtual unsigned int FrameStartLines() const;
 	virtual unsigned int HideFramesStartup() const;
 	virtual unsigned int HideFramesModeSwitch() const;
 	virtual unsigned int MistrustFramesStartup() const;
@@ -100,6 +117,13 @@ private:
 	 * in units of lines.
 	 */
 	unsigned int frameIntegrationDiff_;
+	/*
+	 * Frame length limits, in units of lines, for the frame durations
+	 * last passed to GetVBlanking() in the current mode.
+	 */
+	mutable double frameDurationsCached_[2];
+	mutable uint32_t frameLengthMin_;
+	mutable uint32_t frameLengthMax_;
 };
 
 // This is for registering camera helpers with the system, so that the
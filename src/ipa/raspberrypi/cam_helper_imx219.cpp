@@ -29,14 +29,8 @@ class MdParserImx219 : public MdParserSmia
 {
 public:
 	MdParserImx219();
-	Status Parse(libcamera::Span<const uint8_t> buffer) override;
 	Status GetExposureLines(unsigned int &lines) override;
 	Status GetGainCode(unsigned int &gain_code) override;
-private:
-	/* Offset of the register's value in the metadata block. */
-	int reg_offsets_[3];
-	/* Value of the register, once read from the metadata block. */
-	int reg_values_[3];
 };
 
 class CamHelperImx219 : public CamHelper
@@ -47,6 +41,7 @@ public:
 	double Gain(uint32_t gain_code) const override;
 	unsigned int MistrustFramesModeSwitch() const override;
 	bool SensorEmbeddedDataPresent() const override;
+	unsigned int FrameStartLines() const override;
 
 private:
 	/*
@@ -90,6 +85,15 @@ bool CamHelperImx219::SensorEmbeddedDataPresent() const
 	return ENABLE_EMBEDDED_DATA;
 }
 
+unsigned int CamHelperImx219::FrameStartLines() const
+{
+	/*
+	 * The sensor sends two lines of embedded data before the image,
+	 * whether or not we parse them.
+	 */
+	return 2;
+}
+
 static CamHelper *Create()
 {
 	return new CamHelperImx219();
@@ -106,7 +110,7 @@ static RegisterCamHelper reg("imx219", &Create);
 #define EXPLO_REG 0x15B
 
 /*
- * Index of each into the reg_offsets and reg_values arrays. Must be in
+ * Index of each into the list of registers given to MdParserSmia. Must be in
  * register address order.
  */
 #define GAIN_INDEX 0
@@ -114,65 +118,23 @@ static RegisterCamHelper reg("imx219", &Create);
 #define EXPLO_INDEX 2
 
 MdParserImx219::MdParserImx219()
+	: MdParserSmia({ GAIN_REG, EXPHI_REG, EXPLO_REG })
 {
-	reg_offsets_[0] = reg_offsets_[1] = reg_offsets_[2] = -1;
-}
-
-MdParser::Status MdParserImx219::Parse(libcamera::Span<const uint8_t> buffer)
-{
-	bool try_again = false;
-
-	if (reset_) {
-		/*
-		 * Search again through the metadata for the gain and exposure
-		 * registers.
-		 */
-		assert(bits_per_pixel_);
-		assert(num_lines_ || buffer_size_bytes_);
-		/* Need to be ordered */
-		uint32_t regs[3] = { GAIN_REG, EXPHI_REG, EXPLO_REG };
-		reg_offsets_[0] = reg_offsets_[1] = reg_offsets_[2] = -1;
-		int ret = static_cast<int>(findRegs(buffer,
-						    regs, reg_offsets_, 3));
-		/*
-		 * > 0 means "worked partially but parse again next time",
-		 * < 0 means "hard error".
-		 */
-		if (ret > 0)
-			try_again = true;
-		else if (ret < 0)
-			return ERROR;
-	}
-
-	for (int i = 0; i < 3; i++) {
-		if (reg_offsets_[i] == -1)
-			continue;
-
-		reg_values_[i] = buffer[reg_offsets_[i]];
-	}
-
-	/* Re-parse next time if we were unhappy in some way. */
-	reset_ = try_again;
-
-	return OK;
 }
 
 MdParser::Status MdParserImx219::GetExposureLines(unsigned int &lines)
 {
-	if (reg_offsets_[EXPHI_INDEX] == -1 || reg_offsets_[EXPLO_INDEX] == -1)
+	unsigned int hi, lo;
+
+	if (GetRegValue(EXPHI_INDEX, hi) != OK || GetRegValue(EXPLO_INDEX, lo) != OK)
 		return NOTFOUND;
 
-	lines = reg_values_[EXPHI_INDEX] * 256 + reg_values_[EXPLO_INDEX];
+	lines = hi * 256 + lo;
 
 	return OK;
 }
 
 MdParser::Status MdParserImx219::GetGainCode(unsigned int &gain_code)
 {
-	if (reg_offsets_[GAIN_INDEX] == -1)
-		return NOTFOUND;
-
-	gain_code = reg_values_[GAIN_INDEX];
-
-	return OK;
+	return GetRegValue(GAIN_INDEX, gain_code);
 }
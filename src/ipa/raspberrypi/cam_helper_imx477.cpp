@@ -21,14 +21,8 @@ class MdParserImx477 : public MdParserSmia
 {
 public:
 	MdParserImx477();
-	Status Parse(libcamera::Span<const uint8_t> buffer) override;
 	Status GetExposureLines(unsigned int &lines) override;
 	Status GetGainCode(unsigned int &gain_code) override;
-private:
-	/* Offset of the register's value in the metadata block. */
-	int reg_offsets_[4];
-	/* Value of the register, once read from the metadata block. */
-	int reg_values_[4];
 };
 
 class CamHelperImx477 : public CamHelper
@@ -40,6 +34,7 @@ public:
 	void GetDelays(int &exposure_delay, int &gain_delay,
 		       int &vblank_delay) const override;
 	bool SensorEmbeddedDataPresent() const override;
+	unsigned int FrameStartLines() const override;
 
 private:
 	/*
@@ -77,6 +72,12 @@ bool CamHelperImx477::SensorEmbeddedDataPresent() const
 	return true;
 }
 
+unsigned int CamHelperImx477::FrameStartLines() const
+{
+	/* The image follows two lines of embedded data. */
+	return 2;
+}
+
 static CamHelper *Create()
 {
 	return new CamHelperImx477();
@@ -94,8 +95,8 @@ static RegisterCamHelper reg("imx477", &Create);
 #define GAINLO_REG 0x0205
 
 /*
- * Index of each into the reg_offsets and reg_values arrays. Must be in register
- * address order.
+ * Index of each into the list of registers given to MdParserSmia. Must be in
+ * register address order.
  */
 #define EXPHI_INDEX 0
 #define EXPLO_INDEX 1
@@ -103,70 +104,30 @@ static RegisterCamHelper reg("imx477", &Create);
 #define GAINLO_INDEX 3
 
 MdParserImx477::MdParserImx477()
+	: MdParserSmia({ EXPHI_REG, EXPLO_REG, GAINHI_REG, GAINLO_REG })
 {
-	reg_offsets_[0] = reg_offsets_[1] = reg_offsets_[2] = reg_offsets_[3] = -1;
-}
-
-MdParser::Status MdParserImx477::Parse(libcamera::Span<const uint8_t> buffer)
-{
-	bool try_again = false;
-
-	if (reset_) {
-		/*
-		 * Search again through the metadata for the gain and exposure
-		 * registers.
-		 */
-		assert(bits_per_pixel_);
-		assert(num_lines_ || buffer_size_bytes_);
-		/* Need to be ordered */
-		uint32_t regs[4] = {
-			EXPHI_REG,
-			EXPLO_REG,
-			GAINHI_REG,
-			GAINLO_REG
-		};
-		reg_offsets_[0] = reg_offsets_[1] = reg_offsets_[2] = reg_offsets_[3] = -1;
-		int ret = static_cast<int>(findRegs(buffer,
-						    regs, reg_offsets_, 4));
-		/*
-		 * > 0 means "worked partially but parse again next time",
-		 * < 0 means "hard error".
-		 */
-		if (ret > 0)
-			try_again = true;
-		else if (ret < 0)
-			return ERROR;
-	}
-
-	for (int i = 0; i < 4; i++) {
-		if (reg_offsets_[i] == -1)
-			continue;
-
-		reg_values_[i] = buffer[reg_offsets_[i]];
-	}
-
-	/* Re-parse next time if we were unhappy in some way. */
-	reset_ = try_again;
-
-	return OK;
 }
 
 MdParser::Status MdParserImx477::GetExposureLines(unsigned int &lines)
 {
-	if (reg_offsets_[EXPHI_INDEX] == -1 || reg_offsets_[EXPLO_INDEX] == -1)
+	unsigned int hi, lo;
+
+	if (GetRegValue(EXPHI_INDEX, hi) != OK || GetRegValue(EXPLO_INDEX, lo) != OK)
 		return NOTFOUND;
 
-	lines = reg_values_[EXPHI_INDEX] * 256 + reg_values_[EXPLO_INDEX];
+	lines = hi * 256 + lo;
 
 	return OK;
 }
 
 MdParser::Status MdParserImx477::GetGainCode(unsigned int &gain_code)
 {
-	if (reg_offsets_[GAINHI_INDEX] == -1 || reg_offsets_[GAINLO_INDEX] == -1)
+	unsigned int hi, lo;
+
+	if (GetRegValue(GAINHI_INDEX, hi) != OK || GetRegValue(GAINLO_INDEX, lo) != OK)
 		return NOTFOUND;
 
-	gain_code = reg_values_[GAINHI_INDEX] * 256 + reg_values_[GAINLO_INDEX];
+	gain_code = hi * 256 + lo;
 
 	return OK;
 }
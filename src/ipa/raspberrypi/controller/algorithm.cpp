@@ -29,6 +29,28 @@ void Algorithm::Process([[maybe_unused]] StatisticsPtr &stats,
 {
 }
 
+MetadataAccess Algorithm::PrepareAccess() const
+{
+	return { MetadataSet().set(), MetadataSet().set() };
+}
+
+MetadataAccess Algorithm::ProcessAccess() const
+{
+	return { MetadataSet().set(), MetadataSet().set() };
+}
+
+Scheduler::Graph RPiController::BuildAccessGraph(std::vector<MetadataAccess> const &accesses)
+{
+	std::vector<std::vector<unsigned int>> deps(accesses.size());
+	for (unsigned int i = 0; i < accesses.size(); i++) {
+		for (unsigned int j = 0; j < i; j++) {
+			if (accesses[i].ConflictsWith(accesses[j]))
+				deps[i].push_back(j);
+		}
+	}
+	return Scheduler::Graph(deps);
+}
+
 // For registering algorithms with the system:
 
 static std::map<std::string, AlgoCreateFunc> algorithms;
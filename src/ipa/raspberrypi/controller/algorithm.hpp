@@ -9,9 +9,11 @@
 // All algorithms should be derived from this class and made available to the
 // Controller.
 
+#include <algorithm>
 #include <string>
 #include <memory>
 #include <map>
+#include <vector>
 
 #include "controller.hpp"
 
@@ -19,13 +21,34 @@
 
 namespace RPiController {
 
+// The metadata items an algorithm reads and writes in Prepare() or Process(),
+// which the Controller uses to run algorithms that don't conflict in parallel.
+
+struct MetadataAccess {
+	MetadataSet reads;
+	MetadataSet writes;
+
+	bool ConflictsWith(MetadataAccess const &other) const
+	{
+		return (writes & (other.reads | other.writes)).any() ||
+		       (reads & other.writes).any();
+	}
+};
+
+// Build the dependency graph of a list of algorithms from their metadata
+// accesses. An algorithm depends on all the algorithms listed before it whose
+// accesses conflict with its own, which produces the same results as running
+// the algorithms sequentially.
+
+Scheduler::Graph BuildAccessGraph(std::vector<MetadataAccess> const &accesses);
+
 // This defines the basic interface for all control algorithms.
 
 class Algorithm
 {
 public:
 	Algorithm(Controller *controller)
-		: controller_(controller), paused_(false)
+		: controller_(controller), paused_(false), rate_divider_(1)
 	{
 	}
 	virtual ~Algorithm() = default;
@@ -33,11 +56,23 @@ public:
 	virtual bool IsPaused() const { return paused_; }
 	virtual void Pause() { paused_ = true; }
 	virtual void Resume() { paused_ = false; }
+	// Run Process() on one frame out of every divider frames only, to save
+	// CPU when the conditions don't change. Prepare() still runs on every
+	// frame and reports the results of the last Process() call.
+	unsigned int RateDivider() const { return rate_divider_; }
+	void SetRateDivider(unsigned int divider)
+	{
+		rate_divider_ = std::max(divider, 1u);
+	}
 	virtual void Read(boost::property_tree::ptree const &params);
 	virtual void Initialise();
 	virtual void SwitchMode(CameraMode const &camera_mode, Metadata *metadata);
 	virtual void Prepare(Metadata *image_metadata);
 	virtual void Process(StatisticsPtr &stats, Metadata *image_metadata);
+	// Algorithms that don't declare their accesses are assumed to access
+	// all metadata, and are never run in parallel with other algorithms.
+	virtual MetadataAccess PrepareAccess() const;
+	virtual MetadataAccess ProcessAccess() const;
 	Metadata &GetGlobalMetadata() const
 	{
 		return controller_->GetGlobalMetadata();
@@ -46,6 +81,7 @@ public:
 private:
 	Controller *controller_;
 	bool paused_;
+	unsigned int rate_divider_;
 };
 
 // This code is for automatic registration of Front End algorithms with the
@@ -6,8 +6,11 @@
  */
 #pragma once
 
+#include <stdint.h>
+
 // The ALSC algorithm should post the following structure into the image's
-// "alsc.status" metadata.
+// "alsc.status" metadata. The generation counter changes whenever the tables
+// do, so that users can tell new tables apart without comparing them.
 
 #ifdef __cplusplus
 extern "C" {
@@ -20,6 +23,7 @@ struct AlscStatus {
 	double r[ALSC_CELLS_Y][ALSC_CELLS_X];
 	double g[ALSC_CELLS_Y][ALSC_CELLS_X];
 	double b[ALSC_CELLS_Y][ALSC_CELLS_X];
+	uint32_t generation;
 };
 
 #ifdef __cplusplus
@@ -0,0 +1,281 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * async_job.cpp - asynchronous work for control algorithms
+ */
+
+#include <algorithm>
+#include <assert.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "libcamera/internal/log.h"
+
+#include "async_job.hpp"
+
+using namespace RPiController;
+using namespace libcamera;
+
+LOG_DEFINE_CATEGORY(RPiAsync)
+
+// The most threads running jobs. This matches the number of threads there used
+// to be when ALSC and AWB each ran their own.
+static constexpr unsigned int MaxWorkers = 2;
+
+namespace RPiController {
+
+// The pool of threads running jobs, shared by all the jobs, and living for as
+// long as any job does. The pool mutex also protects the state of the jobs
+// that the workers touch.
+class AsyncPool
+{
+public:
+	static std::shared_ptr<AsyncPool> Get();
+
+	explicit AsyncPool(unsigned int num_workers);
+	~AsyncPool();
+
+	void Submit(AsyncJob *job);
+	bool Remove(AsyncJob *job);
+
+	std::mutex mutex_;
+	// Signalled when a job completes.
+	std::condition_variable done_;
+
+private:
+	void workerFunc();
+
+	std::vector<std::thread> workers_;
+	std::condition_variable work_;
+	std::deque<AsyncJob *> queue_;
+	bool abort_;
+};
+
+} // namespace RPiController
+
+std::shared_ptr<AsyncPool> AsyncPool::Get()
+{
+	static std::mutex mutex;
+	static std::weak_ptr<AsyncPool> instance;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	std::shared_ptr<AsyncPool> pool = instance.lock();
+	if (!pool) {
+		unsigned int num_workers = std::clamp(std::thread::hardware_concurrency(),
+						      1u, MaxWorkers);
+		pool = std::make_shared<AsyncPool>(num_workers);
+		instance = pool;
+	}
+	return pool;
+}
+
+AsyncPool::AsyncPool(unsigned int num_workers)
+	: abort_(false)
+{
+	for (unsigned int i = 0; i < num_workers; i++)
+		workers_.emplace_back(&AsyncPool::workerFunc, this);
+}
+
+AsyncPool::~AsyncPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		abort_ = true;
+	}
+	work_.notify_all();
+
+	for (std::thread &worker : workers_)
+		worker.join();
+}
+
+// Queue a job, with the lock held.
+void AsyncPool::Submit(AsyncJob *job)
+{
+	queue_.push_back(job);
+	work_.notify_one();
+}
+
+// Remove a job that no worker has picked yet, with the lock held.
+bool AsyncPool::Remove(AsyncJob *job)
+{
+	auto it = std::find(queue_.begin(), queue_.end(), job);
+	if (it == queue_.end())
+		return false;
+	queue_.erase(it);
+	return true;
+}
+
+void AsyncPool::workerFunc()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	while (true) {
+		work_.wait(lock, [&] { return abort_ || !queue_.empty(); });
+		if (abort_)
+			return;
+
+		AsyncJob *job = queue_.front();
+		queue_.pop_front();
+		job->state_ = AsyncJob::State::Running;
+
+		lock.unlock();
+
+		auto start = std::chrono::steady_clock::now();
+		try {
+			job->func_();
+		} catch (std::exception const &e) {
+			LOG(RPiAsync, Error)
+				<< job->name_ << " job failed: " << e.what();
+		}
+		auto duration = std::chrono::steady_clock::now() - start;
+
+		lock.lock();
+
+		// The job may be destroyed as soon as the lock is released.
+		job->duration_ = duration;
+		job->state_ = AsyncJob::State::Finished;
+		done_.notify_all();
+	}
+}
+
+AsyncJob::AsyncJob(char const *name, std::function<void()> const &func)
+	: name_(name), func_(func), pool_(AsyncPool::Get()),
+	  state_(State::Idle), duration_(0), cancel_(false), frame_period_(1),
+	  startup_frames_(0), max_staleness_(0), started_(false),
+	  frame_phase_(0), frame_count_(0), staleness_(0), statistics_{}
+{
+}
+
+AsyncJob::~AsyncJob()
+{
+	Cancel();
+
+	unsigned int runs = std::max(statistics_.runs, 1u);
+	LOG(RPiAsync, Debug)
+		<< name_ << ": " << statistics_.runs << " runs, "
+		<< statistics_.cancelled << " cancelled, "
+		<< statistics_.forced_waits << " forced waits, average "
+		<< (statistics_.total_time / runs).count() << "us, longest "
+		<< statistics_.max_time.count() << "us, most stale "
+		<< statistics_.max_staleness << " frames";
+}
+
+void AsyncJob::Configure(unsigned int frame_period, unsigned int startup_frames,
+			 unsigned int max_staleness)
+{
+	frame_period_ = frame_period;
+	startup_frames_ = startup_frames;
+	max_staleness_ = max_staleness;
+}
+
+void AsyncJob::Reset()
+{
+	frame_phase_ = frame_count_ = 0;
+}
+
+void AsyncJob::Trigger()
+{
+	frame_phase_ = frame_period_;
+}
+
+bool AsyncJob::Tick()
+{
+	if (frame_phase_ < frame_period_)
+		frame_phase_++;
+	if (frame_count_ < startup_frames_)
+		frame_count_++;
+	LOG(RPiAsync, Debug) << name_ << " frame_phase " << frame_phase_;
+	return !started_ &&
+	       (frame_phase_ >= frame_period_ || frame_count_ < startup_frames_);
+}
+
+void AsyncJob::Start()
+{
+	assert(!started_);
+
+	LOG(RPiAsync, Debug) << "Starting " << name_ << " job";
+
+	frame_phase_ = 0;
+	staleness_ = 0;
+	started_ = true;
+	cancel_ = false;
+
+	std::lock_guard<std::mutex> lock(pool_->mutex_);
+	state_ = State::Queued;
+	pool_->Submit(this);
+}
+
+bool AsyncJob::Fetch()
+{
+	if (!started_)
+		return false;
+
+	staleness_++;
+	bool wait = max_staleness_ && staleness_ >= max_staleness_;
+	return complete(wait);
+}
+
+bool AsyncJob::Wait()
+{
+	if (!started_)
+		return false;
+
+	return complete(true);
+}
+
+void AsyncJob::Cancel()
+{
+	if (!started_)
+		return;
+
+	std::unique_lock<std::mutex> lock(pool_->mutex_);
+
+	if (state_ == State::Queued && pool_->Remove(this)) {
+		statistics_.cancelled++;
+	} else if (state_ != State::Finished) {
+		cancel_ = true;
+		pool_->done_.wait(lock, [&] { return state_ == State::Finished; });
+		statistics_.cancelled++;
+	}
+
+	LOG(RPiAsync, Debug) << "Cancelled " << name_ << " job";
+
+	state_ = State::Idle;
+	started_ = false;
+}
+
+// Collect a started job if it has completed, waiting for it if requested.
+bool AsyncJob::complete(bool wait)
+{
+	std::unique_lock<std::mutex> lock(pool_->mutex_);
+
+	if (wait && state_ != State::Finished) {
+		LOG(RPiAsync, Debug)
+			<< "Waiting for " << name_ << " job, "
+			<< staleness_ << " frames stale";
+		statistics_.forced_waits++;
+		pool_->done_.wait(lock, [&] { return state_ == State::Finished; });
+	}
+
+	if (state_ != State::Finished)
+		return false;
+
+	state_ = State::Idle;
+	started_ = false;
+
+	auto duration = std::chrono::duration_cast<std::chrono::microseconds>(duration_);
+	statistics_.runs++;
+	statistics_.total_time += duration;
+	statistics_.max_time = std::max(statistics_.max_time, duration);
+	statistics_.max_staleness = std::max(statistics_.max_staleness, staleness_);
+
+	LOG(RPiAsync, Debug)
+		<< "Fetch " << name_ << " results, job took "
+		<< duration.count() << "us, " << staleness_ << " frames stale";
+
+	return true;
+}
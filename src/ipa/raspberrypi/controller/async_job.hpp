@@ -0,0 +1,105 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * async_job.hpp - asynchronous work for control algorithms
+ */
+#pragma once
+
+// Some algorithms, such as AWB and ALSC, are too expensive to run on every
+// frame. They run their calculations off the frame-critical path instead,
+// every so many frames, and pick up the results when they are ready. An
+// AsyncJob provides the machinery for this: it decides on which frames the
+// job should be restarted, runs it on a pool of background threads shared by
+// all the jobs, bounds how stale the results may become, allows the job to be
+// cancelled and records how long the job takes.
+//
+// All methods except Cancelled() are to be called from the thread running the
+// algorithm's Prepare() and Process() methods. The job function runs on a
+// pool thread, and data shared with it must only be touched by the algorithm
+// while the job isn't running, that is before Start() or after Fetch() or
+// Wait() have returned true.
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace RPiController {
+
+class AsyncPool;
+
+class AsyncJob
+{
+public:
+	struct Statistics {
+		unsigned int runs; // jobs that ran to completion
+		unsigned int cancelled; // jobs cancelled before completing
+		unsigned int forced_waits; // fetches that had to wait
+		unsigned int max_staleness; // most frames taken by a job
+		std::chrono::microseconds total_time; // time spent in jobs
+		std::chrono::microseconds max_time; // longest job
+	};
+
+	AsyncJob(char const *name, std::function<void()> const &func);
+	~AsyncJob();
+
+	// Restart the job every frame_period frames, and on every frame
+	// during the first startup_frames. If max_staleness is non-zero,
+	// Fetch() waits for jobs still running max_staleness frames after they
+	// were started.
+	void Configure(unsigned int frame_period, unsigned int startup_frames,
+		       unsigned int max_staleness = 0);
+	// Start counting frames from the beginning again.
+	void Reset();
+	// Make the job due to be restarted on the next frame.
+	void Trigger();
+
+	// Count a frame, and return true if the job should be restarted. This
+	// is normally called once per frame from Process().
+	bool Tick();
+	void Start();
+	bool Started() const { return started_; }
+	// Return true if the job has completed since it was last started, in
+	// which case the results may be collected. Normally called once per
+	// frame from Prepare().
+	bool Fetch();
+	// Wait for a started job to complete, and return true if it did.
+	bool Wait();
+	// Cancel a started job. Jobs that haven't begun running are dropped,
+	// running jobs are asked to stop, and return once they have.
+	void Cancel();
+	// The job function may poll this to abandon its calculation early.
+	bool Cancelled() const { return cancel_; }
+
+	Statistics const &GetStatistics() const { return statistics_; }
+
+private:
+	friend class AsyncPool;
+
+	enum class State { Idle, Queued, Running, Finished };
+
+	bool complete(bool wait);
+
+	std::string name_;
+	std::function<void()> func_;
+	std::shared_ptr<AsyncPool> pool_;
+
+	// Protected by the pool lock.
+	State state_;
+	std::chrono::steady_clock::duration duration_;
+	std::atomic<bool> cancel_;
+
+	// Only for the algorithm's thread to use.
+	unsigned int frame_period_;
+	unsigned int startup_frames_;
+	unsigned int max_staleness_;
+	bool started_;
+	unsigned int frame_phase_;
+	unsigned int frame_count_;
+	unsigned int staleness_;
+	Statistics statistics_;
+};
+
+} // namespace RPiController
@@ -9,6 +9,17 @@
 
 #include "algorithm.hpp"
 #include "controller.hpp"
+#include "histogram.hpp"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <stdexcept>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
@@ -18,11 +29,18 @@ using namespace libcamera;
 
 LOG_DEFINE_CATEGORY(RPiController)
 
+// The number of threads running algorithms, including the IPA thread.
+static constexpr unsigned int MaxThreads = 4;
+
 Controller::Controller()
-	: switch_mode_called_(false) {}
+	: switch_mode_called_(false), process_count_(0),
+	  image_metadata_(nullptr), stats_(nullptr)
+{
+}
 
 Controller::Controller(char const *json_filename)
-	: switch_mode_called_(false)
+	: switch_mode_called_(false), process_count_(0),
+	  image_metadata_(nullptr), stats_(nullptr)
 {
 	Read(json_filename);
 	Initialise();
@@ -30,10 +48,208 @@ Controller::Controller(char const *json_filename)
 
 Controller::~Controller() {}
 
+namespace {
+
+// Binary tuning files are compiled from the JSON tuning files by
+// utils/raspberrypi/tuning_compile.py. They store the tree in pre-order with
+// all values as strings, exactly as read_json() would produce it, and are
+// loaded without any parsing. All integers are little-endian.
+
+struct BinaryTuningHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t source_hash;
+	uint32_t source_size;
+	uint32_t num_nodes;
+	uint32_t strings_size;
+	uint32_t reserved;
+};
+
+struct BinaryTuningNode {
+	uint32_t key;
+	uint32_t key_length;
+	uint32_t value;
+	uint32_t value_length;
+	uint32_t num_children;
+};
+
+constexpr uint32_t BinaryTuningVersion = 1;
+constexpr unsigned int BinaryTuningMaxDepth = 32;
+
+uint64_t hash_source(uint8_t const *data, size_t size)
+{
+	// FNV-1a, cheap enough to check that the binary file is up to date.
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+class MappedFile
+{
+public:
+	MappedFile(std::string const &filename)
+		: data_(nullptr), size_(0)
+	{
+		int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			// The files are read in full, populate the
+			// mapping to avoid faulting pages one by one.
+			void *data = mmap(nullptr, st.st_size, PROT_READ,
+					  MAP_PRIVATE | MAP_POPULATE, fd, 0);
+			if (data != MAP_FAILED) {
+				data_ = static_cast<uint8_t const *>(data);
+				size_ = st.st_size;
+			}
+		}
+		close(fd);
+	}
+	~MappedFile()
+	{
+		if (data_)
+			munmap(const_cast<uint8_t *>(data_), size_);
+	}
+	uint8_t const *data() const { return data_; }
+	size_t size() const { return size_; }
+
+private:
+	uint8_t const *data_;
+	size_t size_;
+};
+
+class BinaryTuningReader
+{
+public:
+	BinaryTuningReader(MappedFile const &file)
+		: nodes_(nullptr), num_nodes_(0), next_(0), strings_(nullptr),
+		  strings_size_(0)
+	{
+		size_t size = file.size();
+		if (size < sizeof(BinaryTuningHeader))
+			throw std::runtime_error("Controller: truncated binary tuning file");
+		memcpy(&header_, file.data(), sizeof(header_));
+		size -= sizeof(header_);
+		if (header_.version != BinaryTuningVersion)
+			throw std::runtime_error("Controller: unsupported binary tuning file version");
+		if (header_.num_nodes == 0 ||
+		    header_.num_nodes > size / sizeof(BinaryTuningNode) ||
+		    header_.strings_size != size - header_.num_nodes * sizeof(BinaryTuningNode))
+			throw std::runtime_error("Controller: corrupted binary tuning file");
+		nodes_ = file.data() + sizeof(header_);
+		num_nodes_ = header_.num_nodes;
+		strings_ = reinterpret_cast<char const *>(nodes_) +
+			   num_nodes_ * sizeof(BinaryTuningNode);
+		strings_size_ = header_.strings_size;
+	}
+	BinaryTuningHeader const &Header() const { return header_; }
+	void Read(boost::property_tree::ptree &root)
+	{
+		next_ = 0;
+		BinaryTuningNode node = readNode();
+		readChildren(root, node, 0);
+		if (next_ != num_nodes_)
+			throw std::runtime_error("Controller: corrupted binary tuning file");
+	}
+
+private:
+	BinaryTuningNode readNode()
+	{
+		if (next_ >= num_nodes_)
+			throw std::runtime_error("Controller: corrupted binary tuning file");
+		// The mapped nodes may not be aligned, copy them out.
+		BinaryTuningNode node;
+		memcpy(&node, nodes_ + next_++ * sizeof(node), sizeof(node));
+		if (node.key > strings_size_ ||
+		    node.key_length > strings_size_ - node.key ||
+		    node.value > strings_size_ ||
+		    node.value_length > strings_size_ - node.value)
+			throw std::runtime_error("Controller: corrupted binary tuning file");
+		return node;
+	}
+	void readChildren(boost::property_tree::ptree &tree,
+			  BinaryTuningNode const &node, unsigned int depth)
+	{
+		if (depth > BinaryTuningMaxDepth)
+			throw std::runtime_error("Controller: binary tuning file too deep");
+		tree.data().assign(strings_ + node.value, node.value_length);
+		for (uint32_t i = 0; i < node.num_children; i++) {
+			BinaryTuningNode child = readNode();
+			auto it = tree.push_back(std::make_pair(
+				std::string(strings_ + child.key, child.key_length),
+				boost::property_tree::ptree()));
+			readChildren(it->second, child, depth + 1);
+		}
+	}
+
+	BinaryTuningHeader header_;
+	uint8_t const *nodes_;
+	uint32_t num_nodes_;
+	uint32_t next_;
+	char const *strings_;
+	uint32_t strings_size_;
+};
+
+bool has_suffix(std::string const &str, std::string const &suffix)
+{
+	return str.size() >= suffix.size() &&
+	       str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Load the tuning tree from a binary tuning file. When given a JSON file, the
+// binary file of the same name is used if it has been compiled from the
+// current JSON file contents. Return false if no suitable binary file exists.
+bool read_binary_tuning(std::string const &filename,
+			boost::property_tree::ptree &root)
+{
+	static const char Magic[4] = { 'R', 'P', 'T', 'B' };
+	std::string binary_filename = filename;
+	bool check_source = false;
+
+	if (has_suffix(filename, ".json")) {
+		binary_filename.replace(filename.size() - 5, 5, ".bin");
+		check_source = true;
+	}
+
+	MappedFile binary(binary_filename);
+	if (!binary.data() || binary.size() < sizeof(Magic) ||
+	    memcmp(binary.data(), Magic, sizeof(Magic)))
+		return false;
+
+	BinaryTuningReader reader(binary);
+
+	if (check_source) {
+		MappedFile source(filename);
+		BinaryTuningHeader const &header = reader.Header();
+		if (source.size() != header.source_size ||
+		    (source.data() &&
+		     hash_source(source.data(), source.size()) != header.source_hash)) {
+			LOG(RPiController, Warning)
+				<< "Ignoring out of date binary tuning file "
+				<< binary_filename;
+			return false;
+		}
+	}
+
+	reader.Read(root);
+
+	LOG(RPiController, Debug)
+		<< "Loaded binary tuning file " << binary_filename;
+
+	return true;
+}
+
+} // namespace
+
 void Controller::Read(char const *filename)
 {
 	boost::property_tree::ptree root;
-	boost::property_tree::read_json(filename, root);
+	if (!read_binary_tuning(filename, root))
+		boost::property_tree::read_json(filename, root);
 	for (auto const &key_and_value : root) {
 		Algorithm *algo = CreateAlgorithm(key_and_value.first.c_str());
 		if (algo) {
@@ -55,6 +271,43 @@ void Controller::Initialise()
 {
 	for (auto &algo : algorithms_)
 		algo->Initialise();
+
+	buildGraphs();
+}
+
+void Controller::buildGraphs()
+{
+	auto build = [this](auto access) {
+		std::vector<MetadataAccess> accesses;
+		for (auto &algo : algorithms_)
+			accesses.push_back(access(algo.get()));
+		return BuildAccessGraph(accesses);
+	};
+
+	prepare_graph_ = build([](Algorithm *algo) { return algo->PrepareAccess(); });
+	process_graph_ = build([](Algorithm *algo) { return algo->ProcessAccess(); });
+
+	prepare_task_ = [this](unsigned int i) {
+		Algorithm *algo = algorithms_[i].get();
+		if (!algo->IsPaused())
+			algo->Prepare(image_metadata_);
+	};
+	process_task_ = [this](unsigned int i) {
+		Algorithm *algo = algorithms_[i].get();
+		if (!algo->IsPaused() &&
+		    process_count_ % algo->RateDivider() == 0)
+			algo->Process(*stats_, image_metadata_);
+	};
+
+	if (!scheduler_) {
+		unsigned int num_threads =
+			std::min(std::max(std::thread::hardware_concurrency(), 1u), MaxThreads);
+		scheduler_ = std::make_unique<Scheduler>(num_threads - 1);
+	}
+
+	LOG(RPiController, Debug)
+		<< "Running " << algorithms_.size() << " algorithms on "
+		<< scheduler_->NumWorkers() + 1 << " threads";
 }
 
 void Controller::SwitchMode(CameraMode const &camera_mode, Metadata *metadata)
@@ -67,17 +320,24 @@ void Controller::SwitchMode(CameraMode const &camera_mode, Metadata *metadata)
 void Controller::Prepare(Metadata *image_metadata)
 {
 	assert(switch_mode_called_);
-	for (auto &algo : algorithms_)
-		if (!algo->IsPaused())
-			algo->Prepare(image_metadata);
+	image_metadata_ = image_metadata;
+	scheduler_->Run(prepare_graph_, prepare_task_);
+	image_metadata_ = nullptr;
 }
 
 void Controller::Process(StatisticsPtr stats, Metadata *image_metadata)
 {
 	assert(switch_mode_called_);
-	for (auto &algo : algorithms_)
-		if (!algo->IsPaused())
-			algo->Process(stats, image_metadata);
+	image_metadata_ = image_metadata;
+	stats_ = &stats;
+	// Digest the histogram once for all the algorithms that look at it.
+	HistogramStatus histogram_status;
+	DigestHistogram(stats->hist[0].g_hist, histogram_status);
+	image_metadata->Set(tag::histogram_status, histogram_status);
+	scheduler_->Run(process_graph_, process_task_);
+	process_count_++;
+	stats_ = nullptr;
+	image_metadata_ = nullptr;
 }
 
 Metadata &Controller::GetGlobalMetadata()
@@ -8,8 +8,12 @@
 
 // The Controller is simply a container for a collecting together a number of
 // "control algorithms" (such as AWB etc.) and for running them all in a
-// convenient manner.
+// convenient manner. Algorithms are run in the order in which they are listed
+// in the tuning file, but those that access independent metadata are run in
+// parallel on a pool of worker threads.
 
+#include <functional>
+#include <memory>
 #include <vector>
 #include <string>
 
@@ -18,6 +22,7 @@
 #include "camera_mode.h"
 #include "device_status.h"
 #include "metadata.hpp"
+#include "scheduler.hpp"
 
 namespace RPiController {
 
@@ -49,6 +54,20 @@ protected:
 	Metadata global_metadata_;
 	std::vector<AlgorithmPtr> algorithms_;
 	bool switch_mode_called_;
+
+private:
+	void buildGraphs();
+
+	std::unique_ptr<Scheduler> scheduler_;
+	Scheduler::Graph prepare_graph_;
+	Scheduler::Graph process_graph_;
+	std::function<void(unsigned int)> prepare_task_;
+	std::function<void(unsigned int)> process_task_;
+	// Number of Process() calls, for the algorithms rate dividers.
+	uint64_t process_count_;
+	// Arguments of the current Prepare() or Process() call.
+	Metadata *image_metadata_;
+	StatisticsPtr *stats_;
 };
 
 } // namespace RPiController
@@ -9,6 +9,8 @@
 // Definition of "device metadata" which stores things like shutter time and
 // analogue gain that downstream control algorithms will want to know.
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -23,6 +25,12 @@ struct DeviceStatus {
 	double aperture;
 	// proportional to brightness with 0 = no flash, 1 = maximum flash
 	double flash_intensity;
+	// frame length in lines, or 0 if unknown
+	uint32_t frame_length;
+	// start and end of the exposure of the first line of the image, in
+	// nanoseconds on the SensorTimestamp clock, or 0 if unknown
+	int64_t exposure_start;
+	int64_t exposure_end;
 };
 
 #ifdef __cplusplus
@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * focus_algorithm.hpp - focus control algorithm interface
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "algorithm.hpp"
+
+namespace RPiController {
+
+class FocusAlgorithm : public Algorithm
+{
+public:
+	FocusAlgorithm(Controller *controller) : Algorithm(controller) {}
+	// A focus algorithm must provide the following:
+	virtual void SetLensLimits(int32_t min, int32_t max,
+				   int32_t position) = 0;
+	virtual void TriggerScan() = 0;
+};
+
+} // namespace RPiController
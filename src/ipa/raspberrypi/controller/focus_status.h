@@ -9,16 +9,28 @@
 #include <linux/bcm2835-isp.h>
 
 // The focus algorithm should post the following structure into the image's
-// "focus.status" metadata. Recall that it's only reporting focus (contrast)
-// measurements, it's not driving any kind of auto-focus algorithm!
+// "focus.status" metadata. It always reports the focus (contrast) measurements.
+// When a lens is available, it also reports the state of the autofocus
+// algorithm and the lens position it wants to be applied.
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+enum FocusState {
+	FOCUS_STATE_INACTIVE,
+	FOCUS_STATE_SCANNING,
+	FOCUS_STATE_FOCUSED,
+	FOCUS_STATE_UNFOCUSED,
+};
+
 struct FocusStatus {
 	unsigned int num;
 	uint32_t focus_measures[FOCUS_REGIONS];
+	enum FocusState state;
+	// lens position in lens driver units, to apply when lens_valid is set
+	int32_t lens_position;
+	bool lens_valid;
 };
 
 #ifdef __cplusplus
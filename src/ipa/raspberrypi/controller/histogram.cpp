@@ -4,13 +4,50 @@
  *
  * histogram.cpp - histogram calculations
  */
+#include <assert.h>
 #include <math.h>
 #include <stdio.h>
 
+#include "libipa/histogram.h"
+
 #include "histogram.hpp"
 
 using namespace RPiController;
 
+void RPiController::DigestHistogram(uint32_t const *histogram,
+				    HistogramStatus &status)
+{
+	uint64_t const *cumulative = status.cumulative;
+
+	libcamera::ipa::cumulateHistogram({ histogram, NUM_HISTOGRAM_BINS },
+					  status.cumulative);
+
+	// The sum of i * histogram[i] is also the sum, over the bins above
+	// the first, of the number of pixels from that bin up. Take it from
+	// the cumulative frequencies, which leaves a plain reduction the
+	// compiler vectorises, rather than a widening multiply per bin.
+	uint64_t total = cumulative[NUM_HISTOGRAM_BINS];
+	uint64_t below = 0;
+	for (int i = 1; i < NUM_HISTOGRAM_BINS; i++)
+		below += cumulative[i];
+	status.weighted_sum = total * (NUM_HISTOGRAM_BINS - 1) - below;
+}
+
+// The cumulative frequencies and quantile search are shared with the other
+// IPAs through libipa.
+Histogram::Histogram(uint32_t const *histogram, int num)
+	: storage_(num + 1), cumulative_(storage_.data()), bins_(num)
+{
+	assert(num);
+	libcamera::ipa::cumulateHistogram({ histogram, static_cast<size_t>(num) },
+					  storage_.data());
+}
+
+Histogram::Histogram(HistogramStatus const &status)
+	: cumulative_(status.cumulative), bins_(NUM_HISTOGRAM_BINS)
+{
+}
+
 uint64_t Histogram::CumulativeFreq(double bin) const
 {
 	if (bin <= 0)
@@ -27,22 +64,11 @@ double Histogram::Quantile(double q, int first, int last) const
 	if (first == -1)
 		first = 0;
 	if (last == -1)
-		last = cumulative_.size() - 2;
+		last = bins_ - 1;
 	assert(first <= last);
 	uint64_t items = q * Total();
-	while (first < last) // binary search to find the right bin
-	{
-		int middle = (first + last) / 2;
-		if (cumulative_[middle + 1] > items)
-			last = middle; // between first and middle
-		else
-			first = middle + 1; // after middle
-	}
-	assert(items >= cumulative_[first] && items <= cumulative_[last + 1]);
-	double frac = cumulative_[first + 1] == cumulative_[first] ? 0
-		      : (double)(items - cumulative_[first]) /
-				  (cumulative_[first + 1] - cumulative_[first]);
-	return first + frac;
+	return libcamera::ipa::cumulativeQuantile(cumulative_, items,
+						  first, last);
 }
 
 double Histogram::InterQuantileMean(double q_lo, double q_hi) const
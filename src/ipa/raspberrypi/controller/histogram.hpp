@@ -8,27 +8,28 @@
 
 #include <stdint.h>
 #include <vector>
-#include <cassert>
+
+#include "histogram_status.h"
 
 // A simple histogram class, for use in particular to find "quantiles" and
 // averages between "quantiles".
 
 namespace RPiController {
 
+// Compute the digest of a histogram of NUM_HISTOGRAM_BINS bins.
+void DigestHistogram(uint32_t const *histogram, HistogramStatus &status);
+
 class Histogram
 {
 public:
-	template<typename T> Histogram(T *histogram, int num)
-	{
-		assert(num);
-		cumulative_.reserve(num + 1);
-		cumulative_.push_back(0);
-		for (int i = 0; i < num; i++)
-			cumulative_.push_back(cumulative_.back() +
-					      histogram[i]);
-	}
-	uint32_t Bins() const { return cumulative_.size() - 1; }
-	uint64_t Total() const { return cumulative_[cumulative_.size() - 1]; }
+	Histogram(uint32_t const *histogram, int num);
+	// Use the cumulative frequencies of a histogram digest, without
+	// copying them. The digest must outlive the Histogram.
+	Histogram(HistogramStatus const &status);
+	Histogram(Histogram const &) = delete;
+	Histogram(Histogram &&) = default;
+	uint32_t Bins() const { return bins_; }
+	uint64_t Total() const { return cumulative_[bins_]; }
 	// Cumulative frequency up to a (fractional) point in a bin.
 	uint64_t CumulativeFreq(double bin) const;
 	// Return the (fractional) bin of the point q (0 <= q <= 1) through the
@@ -38,7 +39,9 @@ public:
 	double InterQuantileMean(double q_lo, double q_hi) const;
 
 private:
-	std::vector<uint64_t> cumulative_;
+	std::vector<uint64_t> storage_;
+	uint64_t const *cumulative_;
+	uint32_t bins_;
 };
 
 } // namespace RPiController
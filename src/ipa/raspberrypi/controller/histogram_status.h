@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * histogram_status.h - Histogram digest of the frame statistics
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include <linux/bcm2835-isp.h>
+
+// The Controller digests the green histogram of the statistics once per frame,
+// before running the algorithms, so that those looking at the histogram (AGC,
+// lux and contrast) don't each go through the bins again.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct HistogramStatus {
+	// cumulative[i] is the number of pixels in the bins below bin i
+	uint64_t cumulative[NUM_HISTOGRAM_BINS + 1];
+	// the sum of the bin numbers of all the pixels
+	uint64_t weighted_sum;
+};
+
+#ifdef __cplusplus
+}
+#endif
@@ -6,106 +6,176 @@
  */
 #pragma once
 
-// A simple class for carrying arbitrary metadata, for example about an image.
-
-#include <any>
-#include <map>
+// A class for carrying the metadata that the control algorithms exchange
+// about an image. Each item of metadata is identified by a tag known at
+// compile time, which selects a fixed slot of the corresponding type. Setting
+// and getting metadata thus involves no memory allocation, no string lookup
+// and no type erasure.
+//
+// Metadata is not locked. The Controller may run algorithms concurrently, but
+// only when they access disjoint items, as declared by the algorithms, and
+// distinct items live in distinct slots. Algorithms that run asynchronous work
+// must exchange data with it through their own synchronisation.
+
+#include <bitset>
 #include <memory>
-#include <mutex>
-#include <string>
+#include <optional>
+#include <tuple>
+#include <utility>
+
+#include "agc_status.h"
+#include "alsc_status.h"
+#include "awb_status.h"
+#include "black_level_status.h"
+#include "ccm_status.h"
+#include "contrast_status.h"
+#include "denoise_status.h"
+#include "device_status.h"
+#include "dpc_status.h"
+#include "focus_status.h"
+#include "geq_status.h"
+#include "histogram_status.h"
+#include "lux_status.h"
+#include "noise_status.h"
+#include "sharpen_status.h"
 
 namespace RPiController {
 
+// The types of all metadata items, in tag order.
+using MetadataTypes = std::tuple<DeviceStatus, AgcStatus, AwbStatus, AlscStatus,
+				 BlackLevelStatus, CcmStatus, ContrastStatus,
+				 DenoiseStatus, DpcStatus, FocusStatus, GeqStatus,
+				 LuxStatus, NoiseStatus, SharpenStatus,
+				 HistogramStatus>;
+
+template<std::size_t Index>
+struct MetadataTag {
+	using Type = std::tuple_element_t<Index, MetadataTypes>;
+	static constexpr std::size_t index = Index;
+};
+
+namespace tag {
+
+constexpr MetadataTag<0> device_status{};
+constexpr MetadataTag<1> agc_status{};
+constexpr MetadataTag<2> awb_status{};
+constexpr MetadataTag<3> alsc_status{};
+constexpr MetadataTag<4> black_level_status{};
+constexpr MetadataTag<5> ccm_status{};
+constexpr MetadataTag<6> contrast_status{};
+constexpr MetadataTag<7> denoise_status{};
+constexpr MetadataTag<8> dpc_status{};
+constexpr MetadataTag<9> focus_status{};
+constexpr MetadataTag<10> geq_status{};
+constexpr MetadataTag<11> lux_status{};
+constexpr MetadataTag<12> noise_status{};
+constexpr MetadataTag<13> sharpen_status{};
+constexpr MetadataTag<14> histogram_status{};
+
+} // namespace tag
+
+// A set of metadata tags, used by algorithms to declare the metadata they
+// access.
+using MetadataSet = std::bitset<std::tuple_size_v<MetadataTypes>>;
+
+template<typename... Tags>
+MetadataSet metadata_set(Tags...)
+{
+	MetadataSet set;
+	(set.set(Tags::index), ...);
+	return set;
+}
+
 class Metadata
 {
 public:
 	Metadata() = default;
 
-	Metadata(Metadata const &other)
+	Metadata(Metadata const &other) = default;
+	Metadata &operator=(Metadata const &other) = default;
+
+	Metadata(Metadata &&other)
+		: slots_(std::move(other.slots_))
 	{
-		std::scoped_lock other_lock(other.mutex_);
-		data_ = other.data_;
+		other.Clear();
 	}
 
-	Metadata(Metadata &&other)
+	Metadata &operator=(Metadata &&other)
 	{
-		std::scoped_lock other_lock(other.mutex_);
-		data_ = std::move(other.data_);
-		other.data_.clear();
+		slots_ = std::move(other.slots_);
+		other.Clear();
+		return *this;
 	}
 
-	template<typename T>
-	void Set(std::string const &tag, T const &value)
+	template<typename Tag>
+	void Set(Tag, typename Tag::Type const &value)
 	{
-		std::scoped_lock lock(mutex_);
-		data_[tag] = value;
+		std::get<Tag::index>(slots_) = value;
 	}
 
-	template<typename T>
-	int Get(std::string const &tag, T &value) const
+	template<typename Tag>
+	int Get(Tag, typename Tag::Type &value) const
 	{
-		std::scoped_lock lock(mutex_);
-		auto it = data_.find(tag);
-		if (it == data_.end())
+		auto const &slot = std::get<Tag::index>(slots_);
+		if (!slot)
 			return -1;
-		value = std::any_cast<T>(it->second);
+		value = *slot;
 		return 0;
 	}
 
-	void Clear()
+	// Allow in-place access to the Metadata contents. The pointer is valid
+	// until the item is cleared or overwritten.
+	template<typename Tag>
+	typename Tag::Type *Find(Tag)
 	{
-		std::scoped_lock lock(mutex_);
-		data_.clear();
+		auto &slot = std::get<Tag::index>(slots_);
+		return slot ? &*slot : nullptr;
 	}
 
-	Metadata &operator=(Metadata const &other)
+	template<typename Tag>
+	typename Tag::Type const *Find(Tag) const
 	{
-		std::scoped_lock lock(mutex_, other.mutex_);
-		data_ = other.data_;
-		return *this;
+		auto const &slot = std::get<Tag::index>(slots_);
+		return slot ? &*slot : nullptr;
 	}
 
-	Metadata &operator=(Metadata &&other)
+	void Clear()
 	{
-		std::scoped_lock lock(mutex_, other.mutex_);
-		data_ = std::move(other.data_);
-		other.data_.clear();
-		return *this;
+		std::apply([](auto &...slot) { (slot.reset(), ...); }, slots_);
 	}
 
+	// Move the items of other that are not present in this metadata, the
+	// existing items are kept. This matches std::map::merge().
 	void Merge(Metadata &other)
 	{
-		std::scoped_lock lock(mutex_, other.mutex_);
-		data_.merge(other.data_);
+		merge(other, std::make_index_sequence<std::tuple_size_v<MetadataTypes>>{});
 	}
 
+private:
 	template<typename T>
-	T *GetLocked(std::string const &tag)
+	struct Slots;
+
+	template<typename... Ts>
+	struct Slots<std::tuple<Ts...>> {
+		using type = std::tuple<std::optional<Ts>...>;
+	};
+
+	template<std::size_t... Indices>
+	void merge(Metadata &other, std::index_sequence<Indices...>)
 	{
-		// This allows in-place access to the Metadata contents,
-		// for which you should be holding the lock.
-		auto it = data_.find(tag);
-		if (it == data_.end())
-			return nullptr;
-		return std::any_cast<T>(&it->second);
+		(mergeSlot(std::get<Indices>(slots_), std::get<Indices>(other.slots_)), ...);
 	}
 
 	template<typename T>
-	void SetLocked(std::string const &tag, T const &value)
+	static void mergeSlot(std::optional<T> &slot, std::optional<T> &other)
 	{
-		// Use this only if you're holding the lock yourself.
-		data_[tag] = value;
+		if (slot || !other)
+			return;
+		slot = std::move(other);
+		other.reset();
 	}
 
-	// Note: use of (lowercase) lock and unlock means you can create scoped
-	// locks with the standard lock classes.
-	// e.g. std::lock_guard<RPiController::Metadata> lock(metadata)
-	void lock() { mutex_.lock(); }
-	void unlock() { mutex_.unlock(); }
-
-private:
-	mutable std::mutex mutex_;
-	std::map<std::string, std::any> data_;
+	typename Slots<MetadataTypes>::type slots_;
 };
 
 typedef std::shared_ptr<Metadata> MetadataPtr;
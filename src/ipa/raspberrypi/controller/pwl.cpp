@@ -5,6 +5,7 @@
  * pwl.cpp - piecewise linear functions
  */
 
+#include <algorithm>
 #include <cassert>
 #include <stdexcept>
 
@@ -12,8 +13,12 @@
 
 using namespace RPiController;
 
+// Limit the memory used by lookup tables of Pwls with very uneven spans.
+static constexpr size_t MaxLutSize = 1024;
+
 void Pwl::Read(boost::property_tree::ptree const &params)
 {
+	span_lut_.clear();
 	for (auto it = params.begin(); it != params.end(); it++) {
 		double x = it->second.get_value<double>();
 		assert(it == params.begin() || x > points_.back().x);
@@ -22,18 +27,25 @@ void Pwl::Read(boost::property_tree::ptree const &params)
 		points_.push_back(Point(x, y));
 	}
 	assert(points_.size() >= 2);
+	// Pwls read from the tuning file are evaluated many times but never
+	// modified.
+	BuildLut();
 }
 
 void Pwl::Append(double x, double y, const double eps)
 {
-	if (points_.empty() || points_.back().x + eps < x)
+	if (points_.empty() || points_.back().x + eps < x) {
 		points_.push_back(Point(x, y));
+		span_lut_.clear();
+	}
 }
 
 void Pwl::Prepend(double x, double y, const double eps)
 {
-	if (points_.empty() || points_.front().x - eps > x)
+	if (points_.empty() || points_.front().x - eps > x) {
 		points_.insert(points_.begin(), Point(x, y));
+		span_lut_.clear();
+	}
 }
 
 Pwl::Interval Pwl::Domain() const
@@ -56,9 +68,14 @@ bool Pwl::Empty() const
 
 double Pwl::Eval(double x, int *span_ptr, bool update_span) const
 {
-	int span = findSpan(x, span_ptr && *span_ptr != -1
-				       ? *span_ptr
-				       : points_.size() / 2 - 1);
+	int span;
+	if (span_ptr && *span_ptr != -1)
+		span = *span_ptr;
+	else if (!span_lut_.empty())
+		span = lutSpan(x);
+	else
+		span = points_.size() / 2 - 1;
+	span = findSpan(x, span);
 	if (span_ptr && update_span)
 		*span_ptr = span;
 	return points_[span].y +
@@ -66,6 +83,45 @@ double Pwl::Eval(double x, int *span_ptr, bool update_span) const
 		       (points_[span + 1].x - points_[span].x);
 }
 
+void Pwl::Eval(double const *x, double *y, size_t n) const
+{
+	// Each point starts the search from the span of the previous one,
+	// unless the table gives a better guess.
+	int span = -1;
+	for (size_t i = 0; i < n; i++) {
+		if (!span_lut_.empty())
+			span = -1;
+		y[i] = Eval(x[i], &span);
+	}
+}
+
+void Pwl::BuildLut()
+{
+	span_lut_.clear();
+	if (points_.size() < 2)
+		return;
+	// Make the table entries no further apart than the shortest span, so
+	// that finding a span from the table takes at most one more step.
+	double min_span = Domain().Len();
+	for (size_t i = 0; i + 1 < points_.size(); i++)
+		min_span = std::min(min_span, points_[i + 1].x - points_[i].x);
+	size_t size = std::min<size_t>(MaxLutSize,
+				       ceil(Domain().Len() / min_span) + 1);
+	lut_scale_ = (size - 1) / Domain().Len();
+	int span = 0;
+	for (size_t i = 0; i < size; i++)
+		span_lut_.push_back(span = findSpan(points_[0].x + i / lut_scale_,
+						    span));
+}
+
+int Pwl::lutSpan(double x) const
+{
+	double index = (x - points_[0].x) * lut_scale_;
+	if (index <= 0)
+		return 0;
+	return span_lut_[std::min<size_t>(index, span_lut_.size() - 1)];
+}
+
 int Pwl::findSpan(double x, int span) const
 {
 	// Pwls are generally small, so linear search may well be faster than
@@ -53,8 +53,11 @@ public:
 		double Len2() const { return x * x + y * y; }
 		double Len() const { return sqrt(Len2()); }
 	};
-	Pwl() {}
-	Pwl(std::vector<Point> const &points) : points_(points) {}
+	Pwl() : lut_scale_(0) {}
+	Pwl(std::vector<Point> const &points)
+		: points_(points), lut_scale_(0)
+	{
+	}
 	void Read(boost::property_tree::ptree const &params);
 	void Append(double x, double y, const double eps = 1e-6);
 	void Prepend(double x, double y, const double eps = 1e-6);
@@ -67,6 +70,14 @@ public:
 	// -1.
 	double Eval(double x, int *span_ptr = nullptr,
 		    bool update_span = true) const;
+	// Evaluate Pwl at n points, writing the results to y. This is faster
+	// than evaluating the points one by one when they are ordered.
+	void Eval(double const *x, double *y, size_t n) const;
+	// Build a table of the spans at uniformly spaced points of the domain,
+	// which lets Eval() find the span of any x in constant time rather
+	// than by searching. The results are unchanged. Adding control points
+	// discards the table, so call this once the Pwl is complete.
+	void BuildLut();
 	// Find perpendicular closest to xy, starting from span+1 so you can
 	// call it repeatedly to check for multiple closest points (set span to
 	// -1 on the first call). Also returns "pseudo" perpendiculars; see
@@ -106,7 +117,11 @@ public:
 
 private:
 	int findSpan(double x, int span) const;
+	int lutSpan(double x) const;
 	std::vector<Point> points_;
+	// span containing each uniformly spaced point of the domain
+	std::vector<int> span_lut_;
+	double lut_scale_;
 };
 
 } // namespace RPiController
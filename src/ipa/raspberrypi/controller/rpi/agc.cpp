@@ -154,6 +154,7 @@ void AgcConfig::Read(boost::property_tree::ptree const &params)
 Agc::Agc(Controller *controller)
 	: AgcAlgorithm(controller), metering_mode_(nullptr),
 	  exposure_mode_(nullptr), constraint_mode_(nullptr),
+	  exposure_table_dirty_(true),
 	  frame_count_(0), lock_count_(0),
 	  last_target_exposure_(0.0),
 	  ev_(1.0), flicker_period_(0.0),
@@ -199,12 +200,14 @@ void Agc::Pause()
 {
 	fixed_shutter_ = status_.shutter_time;
 	fixed_analogue_gain_ = status_.analogue_gain;
+	exposure_table_dirty_ = true;
 }
 
 void Agc::Resume()
 {
 	fixed_shutter_ = 0;
 	fixed_analogue_gain_ = 0;
+	exposure_table_dirty_ = true;
 }
 
 unsigned int Agc::GetConvergenceFrames() const
@@ -225,16 +228,19 @@ void Agc::SetEv(double ev)
 void Agc::SetFlickerPeriod(double flicker_period)
 {
 	flicker_period_ = flicker_period;
+	exposure_table_dirty_ = true;
 }
 
 void Agc::SetMaxShutter(double max_shutter)
 {
 	max_shutter_ = max_shutter;
+	exposure_table_dirty_ = true;
 }
 
 void Agc::SetFixedShutter(double fixed_shutter)
 {
 	fixed_shutter_ = fixed_shutter;
+	exposure_table_dirty_ = true;
 	// Set this in case someone calls Pause() straight after.
 	status_.shutter_time = clipShutter(fixed_shutter_);
 }
@@ -242,6 +248,7 @@ void Agc::SetFixedShutter(double fixed_shutter)
 void Agc::SetFixedAnalogueGain(double fixed_analogue_gain)
 {
 	fixed_analogue_gain_ = fixed_analogue_gain;
+	exposure_table_dirty_ = true;
 	// Set this in case someone calls Pause() straight after.
 	status_.analogue_gain = fixed_analogue_gain;
 }
@@ -303,6 +310,20 @@ void Agc::SwitchMode([[maybe_unused]] CameraMode const &camera_mode,
 	writeAndFinish(metadata, false);
 }
 
+MetadataAccess Agc::PrepareAccess() const
+{
+	return { metadata_set(tag::device_status, tag::awb_status),
+		 metadata_set(tag::agc_status) };
+}
+
+MetadataAccess Agc::ProcessAccess() const
+{
+	return { metadata_set(tag::device_status, tag::agc_status,
+			      tag::awb_status, tag::lux_status,
+			      tag::histogram_status),
+		 metadata_set(tag::agc_status) };
+}
+
 void Agc::Prepare(Metadata *image_metadata)
 {
 	status_.digital_gain = 1.0;
@@ -311,7 +332,7 @@ void Agc::Prepare(Metadata *image_metadata)
 	if (status_.total_exposure_value) {
 		// Process has run, so we have meaningful values.
 		DeviceStatus device_status;
-		if (image_metadata->Get("device.status", device_status) == 0) {
+		if (image_metadata->Get(tag::device_status, device_status) == 0) {
 			double actual_exposure = device_status.shutter_speed *
 						 device_status.analogue_gain;
 			if (actual_exposure) {
@@ -332,7 +353,7 @@ void Agc::Prepare(Metadata *image_metadata)
 			}
 		} else
 			LOG(RPiAgc, Warning) << Name() << ": no device metadata";
-		image_metadata->Set("agc.status", status_);
+		image_metadata->Set(tag::agc_status, status_);
 	}
 }
 
@@ -434,6 +455,7 @@ void Agc::housekeepConfig()
 		exposure_mode_ = &it->second;
 		copy_string(exposure_mode_name_, status_.exposure_mode,
 			    sizeof(status_.exposure_mode));
+		exposure_table_dirty_ = true;
 	}
 	if (strcmp(constraint_mode_name_.c_str(), status_.constraint_mode)) {
 		auto it =
@@ -449,19 +471,31 @@ void Agc::housekeepConfig()
 			   << exposure_mode_name_ << " constraint_mode "
 			   << constraint_mode_name_ << " metering_mode "
 			   << metering_mode_name_;
+	updateExposureTable();
+}
+
+void Agc::updateExposureTable()
+{
+	// The division of the exposure into shutter time and analogue gain
+	// only changes along with the settings, not from frame to frame.
+	if (!exposure_table_dirty_)
+		return;
+	exposure_table_.Build(exposure_mode_->shutter, exposure_mode_->gain,
+			      status_.fixed_shutter, status_.fixed_analogue_gain,
+			      max_shutter_, status_.flicker_period);
+	exposure_table_dirty_ = false;
 }
 
 void Agc::fetchCurrentExposure(Metadata *image_metadata)
 {
-	std::unique_lock<Metadata> lock(*image_metadata);
 	DeviceStatus *device_status =
-		image_metadata->GetLocked<DeviceStatus>("device.status");
+		image_metadata->Find(tag::device_status);
 	if (!device_status)
 		throw std::runtime_error("Agc: no device metadata");
 	current_.shutter = device_status->shutter_speed;
 	current_.analogue_gain = device_status->analogue_gain;
 	AgcStatus *agc_status =
-		image_metadata->GetLocked<AgcStatus>("agc.status");
+		image_metadata->Find(tag::agc_status);
 	current_.total_exposure = agc_status ? agc_status->total_exposure_value : 0;
 	current_.total_exposure_no_dg = current_.shutter * current_.analogue_gain;
 }
@@ -471,7 +505,7 @@ void Agc::fetchAwbStatus(Metadata *image_metadata)
 	awb_.gain_r = 1.0; // in case not found in metadata
 	awb_.gain_g = 1.0;
 	awb_.gain_b = 1.0;
-	if (image_metadata->Get("awb.status", awb_) != 0)
+	if (image_metadata->Get(tag::awb_status, awb_) != 0)
 		LOG(RPiAgc, Warning) << "Agc: no AWB status found";
 }
 
@@ -525,9 +559,13 @@ void Agc::computeGain(bcm2835_isp_stats *statistics, Metadata *image_metadata,
 {
 	struct LuxStatus lux = {};
 	lux.lux = 400; // default lux level to 400 in case no metadata found
-	if (image_metadata->Get("lux.status", lux) != 0)
+	if (image_metadata->Get(tag::lux_status, lux) != 0)
 		LOG(RPiAgc, Warning) << "Agc: no lux level found";
-	Histogram h(statistics->hist[0].g_hist, NUM_HISTOGRAM_BINS);
+	// Use the histogram digested by the Controller when there is one.
+	HistogramStatus const *digest =
+		image_metadata->Find(tag::histogram_status);
+	Histogram h = digest ? Histogram(*digest)
+			     : Histogram(statistics->hist[0].g_hist, NUM_HISTOGRAM_BINS);
 	double ev_gain = status_.ev * config_.base_ev;
 	// The initial gain and target_Y come from some of the regions. After
 	// that we consider the histogram constraints.
@@ -588,17 +626,8 @@ void Agc::computeTargetExposure(double gain)
 		target_.total_exposure = current_.total_exposure_no_dg * gain;
 		// The final target exposure is also limited to what the exposure
 		// mode allows.
-		double max_shutter = status_.fixed_shutter != 0.0
-				   ? status_.fixed_shutter
-				   : exposure_mode_->shutter.back();
-		max_shutter = clipShutter(max_shutter);
-		double max_total_exposure =
-			max_shutter *
-			(status_.fixed_analogue_gain != 0.0
-				 ? status_.fixed_analogue_gain
-				 : exposure_mode_->gain.back());
 		target_.total_exposure = std::min(target_.total_exposure,
-						  max_total_exposure);
+						  exposure_table_.MaxExposure());
 	}
 	LOG(RPiAgc, Debug) << "Target total_exposure " << target_.total_exposure;
 }
@@ -673,64 +702,12 @@ void Agc::divideUpExposure()
 {
 	// Sending the fixed shutter/gain cases through the same code may seem
 	// unnecessary, but it will make more sense when extend this to cover
-	// variable aperture.
-	double exposure_value = filtered_.total_exposure_no_dg;
+	// variable aperture. The table also applies flicker avoidance.
 	double shutter_time, analogue_gain;
-	shutter_time = status_.fixed_shutter != 0.0
-			       ? status_.fixed_shutter
-			       : exposure_mode_->shutter[0];
-	shutter_time = clipShutter(shutter_time);
-	analogue_gain = status_.fixed_analogue_gain != 0.0
-				? status_.fixed_analogue_gain
-				: exposure_mode_->gain[0];
-	if (shutter_time * analogue_gain < exposure_value) {
-		for (unsigned int stage = 1;
-		     stage < exposure_mode_->gain.size(); stage++) {
-			if (status_.fixed_shutter == 0.0) {
-				double stage_shutter =
-					clipShutter(exposure_mode_->shutter[stage]);
-				if (stage_shutter * analogue_gain >=
-				    exposure_value) {
-					shutter_time =
-						exposure_value / analogue_gain;
-					break;
-				}
-				shutter_time = stage_shutter;
-			}
-			if (status_.fixed_analogue_gain == 0.0) {
-				if (exposure_mode_->gain[stage] *
-					    shutter_time >=
-				    exposure_value) {
-					analogue_gain =
-						exposure_value / shutter_time;
-					break;
-				}
-				analogue_gain = exposure_mode_->gain[stage];
-			}
-		}
-	}
+	exposure_table_.Divide(filtered_.total_exposure_no_dg, shutter_time,
+			       analogue_gain);
 	LOG(RPiAgc, Debug) << "Divided up shutter and gain are " << shutter_time << " and "
 			   << analogue_gain;
-	// Finally adjust shutter time for flicker avoidance (require both
-	// shutter and gain not to be fixed).
-	if (status_.fixed_shutter == 0.0 &&
-	    status_.fixed_analogue_gain == 0.0 &&
-	    status_.flicker_period != 0.0) {
-		int flicker_periods = shutter_time / status_.flicker_period;
-		if (flicker_periods > 0) {
-			double new_shutter_time = flicker_periods * status_.flicker_period;
-			analogue_gain *= shutter_time / new_shutter_time;
-			// We should still not allow the ag to go over the
-			// largest value in the exposure mode. Note that this
-			// may force more of the total exposure into the digital
-			// gain as a side-effect.
-			analogue_gain = std::min(analogue_gain,
-						 exposure_mode_->gain.back());
-			shutter_time = new_shutter_time;
-		}
-		LOG(RPiAgc, Debug) << "After flicker avoidance, shutter "
-				   << shutter_time << " gain " << analogue_gain;
-	}
 	filtered_.shutter = shutter_time;
 	filtered_.analogue_gain = analogue_gain;
 }
@@ -743,7 +720,7 @@ void Agc::writeAndFinish(Metadata *image_metadata, bool desaturate)
 	status_.analogue_gain = filtered_.analogue_gain;
 	// Write to metadata as well, in case anyone wants to update the camera
 	// immediately.
-	image_metadata->Set("agc.status", status_);
+	image_metadata->Set(tag::agc_status, status_);
 	LOG(RPiAgc, Debug) << "Output written, total exposure requested is "
 			   << filtered_.total_exposure;
 	LOG(RPiAgc, Debug) << "Camera exposure update: shutter time " << filtered_.shutter
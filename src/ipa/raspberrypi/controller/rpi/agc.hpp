@@ -13,6 +13,8 @@
 #include "../agc_status.h"
 #include "../pwl.hpp"
 
+#include "agc_exposure_table.hpp"
+
 // This is our implementation of AGC.
 
 // This is the number actually set up by the firmware, not the maximum possible
@@ -87,6 +89,8 @@ public:
 	void SwitchMode(CameraMode const &camera_mode, Metadata *metadata) override;
 	void Prepare(Metadata *image_metadata) override;
 	void Process(StatisticsPtr &stats, Metadata *image_metadata) override;
+	MetadataAccess PrepareAccess() const override;
+	MetadataAccess ProcessAccess() const override;
 
 private:
 	void updateLockStatus(DeviceStatus const &device_status);
@@ -102,9 +106,12 @@ private:
 	void divideUpExposure();
 	void writeAndFinish(Metadata *image_metadata, bool desaturate);
 	double clipShutter(double shutter);
+	void updateExposureTable();
 	AgcMeteringMode *metering_mode_;
 	AgcExposureMode *exposure_mode_;
 	AgcConstraintMode *constraint_mode_;
+	AgcExposureTable exposure_table_;
+	bool exposure_table_dirty_;
 	uint64_t frame_count_;
 	AwbStatus awb_;
 	struct ExposureValues {
@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * agc_exposure_table.cpp - AGC total exposure division table
+ */
+
+#include <algorithm>
+
+#include "agc_exposure_table.hpp"
+
+using namespace RPiController;
+
+AgcExposureTable::AgcExposureTable()
+	: sorted_(true), flicker_avoidance_(false), flicker_period_(0),
+	  max_analogue_gain_(0)
+{
+	steps_.push_back({ 0.0, 0.0, 0.0, false });
+}
+
+void AgcExposureTable::Build(std::vector<double> const &shutter,
+			     std::vector<double> const &gain,
+			     double fixed_shutter, double fixed_analogue_gain,
+			     double max_shutter, double flicker_period)
+{
+	auto clip = [max_shutter](double s) {
+		return max_shutter ? std::min(s, max_shutter) : s;
+	};
+
+	// The steps are computed with the same operations, in the same order,
+	// as a walk through the stages would use, so that the results don't
+	// depend on whether or not the table is used.
+	double shutter_time = fixed_shutter != 0.0 ? fixed_shutter
+						   : clip(shutter[0]);
+	double analogue_gain = fixed_analogue_gain != 0.0 ? fixed_analogue_gain
+							  : gain[0];
+	steps_.clear();
+	steps_.push_back({ shutter_time * analogue_gain, shutter_time,
+			   analogue_gain, false });
+	for (unsigned int stage = 1; stage < gain.size(); stage++) {
+		if (fixed_shutter == 0.0) {
+			shutter_time = clip(shutter[stage]);
+			steps_.push_back({ shutter_time * analogue_gain,
+					   shutter_time, analogue_gain, true });
+		}
+		if (fixed_analogue_gain == 0.0) {
+			analogue_gain = gain[stage];
+			steps_.push_back({ gain[stage] * shutter_time,
+					   shutter_time, analogue_gain, false });
+		}
+	}
+	sorted_ = std::is_sorted(steps_.begin(), steps_.end(),
+				 [](Step const &a, Step const &b) {
+					 return a.exposure < b.exposure;
+				 });
+
+	// Flicker avoidance requires both shutter and gain not to be fixed.
+	flicker_avoidance_ = fixed_shutter == 0.0 &&
+			     fixed_analogue_gain == 0.0 &&
+			     flicker_period != 0.0;
+	flicker_period_ = flicker_period;
+	max_analogue_gain_ = gain.back();
+}
+
+void AgcExposureTable::Divide(double exposure, double &shutter_time,
+			      double &analogue_gain) const
+{
+	if (steps_[0].exposure >= exposure) {
+		shutter_time = steps_[0].shutter_time;
+		analogue_gain = steps_[0].analogue_gain;
+	} else {
+		// Find the first step that reaches the exposure. Exposure
+		// modes normally never decrease so we can search the table,
+		// but an odd one still gets the results it always did.
+		auto reaches = [exposure](Step const &step) {
+			return step.exposure >= exposure;
+		};
+		auto it = sorted_
+				  ? std::partition_point(steps_.begin() + 1, steps_.end(),
+							 [&](Step const &step) { return !reaches(step); })
+				  : std::find_if(steps_.begin() + 1, steps_.end(), reaches);
+		if (it == steps_.end()) {
+			shutter_time = steps_.back().shutter_time;
+			analogue_gain = steps_.back().analogue_gain;
+		} else if (it->vary_shutter) {
+			analogue_gain = (it - 1)->analogue_gain;
+			shutter_time = exposure / analogue_gain;
+		} else {
+			shutter_time = (it - 1)->shutter_time;
+			analogue_gain = exposure / shutter_time;
+		}
+	}
+
+	if (flicker_avoidance_) {
+		int flicker_periods = shutter_time / flicker_period_;
+		if (flicker_periods > 0) {
+			double new_shutter_time = flicker_periods * flicker_period_;
+			analogue_gain *= shutter_time / new_shutter_time;
+			// We should still not allow the ag to go over the
+			// largest value in the exposure mode. Note that this
+			// may force more of the total exposure into the digital
+			// gain as a side-effect.
+			analogue_gain = std::min(analogue_gain, max_analogue_gain_);
+			shutter_time = new_shutter_time;
+		}
+	}
+}
+
+double AgcExposureTable::MaxExposure() const
+{
+	return steps_.back().shutter_time * steps_.back().analogue_gain;
+}
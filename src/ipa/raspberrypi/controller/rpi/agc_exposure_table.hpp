@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * agc_exposure_table.hpp - AGC total exposure division table
+ */
+#pragma once
+
+#include <vector>
+
+namespace RPiController {
+
+// Table dividing up a total exposure (shutter time multiplied by analogue
+// gain) into a shutter time and an analogue gain, following the stages of an
+// exposure mode. The stages are first filled by increasing the shutter time
+// and then the analogue gain, skipping whichever of the two is fixed.
+//
+// The table holds the exposure at the end of each of these steps, so that it
+// only needs rebuilding when the exposure mode, the fixed values, the shutter
+// time limit or the flicker period change. Dividing up an exposure is then a
+// search in the table and a division.
+
+class AgcExposureTable
+{
+public:
+	AgcExposureTable();
+	// Fixed values and max_shutter are ignored when zero. All times are
+	// in microseconds.
+	void Build(std::vector<double> const &shutter,
+		   std::vector<double> const &gain, double fixed_shutter,
+		   double fixed_analogue_gain, double max_shutter,
+		   double flicker_period);
+	void Divide(double exposure, double &shutter_time,
+		    double &analogue_gain) const;
+	// The largest exposure that doesn't need any digital gain.
+	double MaxExposure() const;
+
+private:
+	struct Step {
+		double exposure;
+		double shutter_time;
+		double analogue_gain;
+		bool vary_shutter;
+	};
+	std::vector<Step> steps_;
+	bool sorted_;
+	bool flicker_avoidance_;
+	double flicker_period_;
+	double max_analogue_gain_;
+};
+
+} // namespace RPiController
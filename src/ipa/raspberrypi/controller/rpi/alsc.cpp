@@ -10,6 +10,7 @@
 
 #include "../awb_status.h"
 #include "alsc.hpp"
+#include "alsc_solver.hpp"
 
 // Raspberry Pi ALSC (Auto Lens Shading Correction) algorithm.
 
@@ -23,23 +24,18 @@ LOG_DEFINE_CATEGORY(RPiAlsc)
 static const int X = ALSC_CELLS_X;
 static const int Y = ALSC_CELLS_Y;
 static const int XY = X * Y;
-static const double INSUFFICIENT_DATA = -1.0;
+static const double INSUFFICIENT_DATA = ALSC_INSUFFICIENT_DATA;
 
 Alsc::Alsc(Controller *controller)
-	: Algorithm(controller)
+	: Algorithm(controller), generation_(0),
+	  job_(NAME, [this] { doAlsc(); })
 {
-	async_abort_ = async_start_ = async_started_ = async_finished_ = false;
-	async_thread_ = std::thread(std::bind(&Alsc::asyncFunc, this));
 }
 
 Alsc::~Alsc()
 {
-	{
-		std::lock_guard<std::mutex> lock(mutex_);
-		async_abort_ = true;
-	}
-	async_signal_.notify_one();
-	async_thread_.join();
+	// Stop the job before any of the data it uses is destroyed.
+	job_.Cancel();
 }
 
 char const *Alsc::Name() const
@@ -125,6 +121,7 @@ void Alsc::Read(boost::property_tree::ptree const &params)
 {
 	config_.frame_period = params.get<uint16_t>("frame_period", 12);
 	config_.startup_frames = params.get<uint16_t>("startup_frames", 10);
+	config_.max_staleness = params.get<uint16_t>("max_staleness", 0);
 	config_.speed = params.get<double>("speed", 0.05);
 	double sigma = params.get<double>("sigma", 0.01);
 	config_.sigma_Cr = params.get<double>("sigma_Cr", sigma);
@@ -149,6 +146,9 @@ void Alsc::Read(boost::property_tree::ptree const &params)
 	read_calibrations(config_.calibrations_Cb, params, "calibrations_Cb");
 	config_.default_ct = params.get<double>("default_ct", 4500.0);
 	config_.threshold = params.get<double>("threshold", 1e-3);
+	config_.single_precision = params.get<int>("single_precision", 0);
+	config_.ct_cache_tolerance =
+		params.get<double>("ct_cache_tolerance", 10.0);
 }
 
 static double get_ct(Metadata *metadata, double default_ct);
@@ -169,24 +169,16 @@ static void add_luminance_to_tables(double results[3][Y][X],
 
 void Alsc::Initialise()
 {
-	frame_count2_ = frame_count_ = frame_phase_ = 0;
+	frame_count_ = 0;
+	job_.Configure(config_.frame_period, config_.startup_frames,
+		       config_.max_staleness);
+	job_.Reset();
 	first_time_ = true;
 	ct_ = config_.default_ct;
+	cal_tables_ct_ = -1;
 	// The lambdas are initialised in the SwitchMode.
 }
 
-void Alsc::waitForAysncThread()
-{
-	if (async_started_) {
-		async_started_ = false;
-		std::unique_lock<std::mutex> lock(mutex_);
-		sync_signal_.wait(lock, [&] {
-			return async_finished_;
-		});
-		async_finished_ = false;
-	}
-}
-
 static bool compare_modes(CameraMode const &cm0, CameraMode const &cm1)
 {
 	// Return true if the modes crop from the sensor significantly differently,
@@ -208,24 +200,71 @@ static bool compare_modes(CameraMode const &cm0, CameraMode const &cm1)
 	       top_diff > threshold_y || bottom_diff > threshold_y;
 }
 
+static bool same_resampling(CameraMode const &cm0, CameraMode const &cm1)
+{
+	// Return true if the calibration tables resample identically for both
+	// modes.
+	return cm0.transform == cm1.transform &&
+	       cm0.sensor_width == cm1.sensor_width &&
+	       cm0.sensor_height == cm1.sensor_height &&
+	       cm0.crop_x == cm1.crop_x && cm0.crop_y == cm1.crop_y &&
+	       cm0.width == cm1.width && cm0.height == cm1.height &&
+	       cm0.scale_x == cm1.scale_x && cm0.scale_y == cm1.scale_y;
+}
+
+void Alsc::resampleCalibrations()
+{
+	// Resampling and interpolation by CT are both linear, so resampling
+	// every calibration once per mode gives the same tables as resampling
+	// the interpolated table every time the algorithm runs.
+	auto resample = [this](std::vector<AlscCalibration> const &calibrations,
+			       std::vector<AlscCalibration> &resampled) {
+		resampled.resize(calibrations.size());
+		for (size_t i = 0; i < calibrations.size(); i++) {
+			resampled[i].ct = calibrations[i].ct;
+			resample_cal_table(calibrations[i].table, camera_mode_,
+					   resampled[i].table);
+		}
+	};
+	resample(config_.calibrations_Cr, resampled_Cr_);
+	resample(config_.calibrations_Cb, resampled_Cb_);
+	// The luminance table is fixed so we can simply do it up front too.
+	resample_cal_table(config_.luminance_lut, camera_mode_, luminance_table_);
+	cal_tables_ct_ = -1;
+}
+
+void Alsc::updateCalTables(double ct)
+{
+	// The tables vary slowly with the CT, keep using them while the CT
+	// stays close to the one they were interpolated for.
+	if (cal_tables_ct_ >= 0 &&
+	    fabs(ct - cal_tables_ct_) <= config_.ct_cache_tolerance)
+		return;
+	get_cal_table(ct, resampled_Cr_, cal_table_r_);
+	get_cal_table(ct, resampled_Cb_, cal_table_b_);
+	cal_tables_ct_ = ct;
+}
+
 void Alsc::SwitchMode(CameraMode const &camera_mode,
 		      [[maybe_unused]] Metadata *metadata)
 {
 	// We're going to start over with the tables if there's any "significant"
 	// change.
 	bool reset_tables = first_time_ || compare_modes(camera_mode_, camera_mode);
+	bool resample = first_time_ || !same_resampling(camera_mode_, camera_mode);
 
 	// Believe the colour temperature from the AWB, if there is one.
 	ct_ = get_ct(metadata, ct_);
 
-	// Ensure the other thread isn't running while we do this.
-	waitForAysncThread();
+	// Ensure the async job isn't running while we do this.
+	job_.Wait();
 
 	camera_mode_ = camera_mode;
 
-	// We must resample the luminance table like we do the others, but it's
-	// fixed so we can simply do it up front here.
-	resample_cal_table(config_.luminance_lut, camera_mode_, luminance_table_);
+	// The calibrations only need resampling when the mode crops or scales
+	// the sensor differently.
+	if (resample)
+		resampleCalibrations();
 
 	if (reset_tables) {
 		// Upon every "table reset", arrange for something sensible to be
@@ -235,21 +274,18 @@ void Alsc::SwitchMode(CameraMode const &camera_mode,
 		// doAlsc, without the adaptive algorithm.
 		for (int i = 0; i < XY; i++)
 			lambda_r_[i] = lambda_b_[i] = 1.0;
-		double cal_table_r[XY], cal_table_b[XY], cal_table_tmp[XY];
-		get_cal_table(ct_, config_.calibrations_Cr, cal_table_tmp);
-		resample_cal_table(cal_table_tmp, camera_mode_, cal_table_r);
-		get_cal_table(ct_, config_.calibrations_Cb, cal_table_tmp);
-		resample_cal_table(cal_table_tmp, camera_mode_, cal_table_b);
-		compensate_lambdas_for_cal(cal_table_r, lambda_r_,
+		updateCalTables(ct_);
+		compensate_lambdas_for_cal(cal_table_r_, lambda_r_,
 					   async_lambda_r_);
-		compensate_lambdas_for_cal(cal_table_b, lambda_b_,
+		compensate_lambdas_for_cal(cal_table_b_, lambda_b_,
 					   async_lambda_b_);
 		add_luminance_to_tables(sync_results_, async_lambda_r_, 1.0,
 					async_lambda_b_, luminance_table_,
 					config_.luminance_strength);
 		memcpy(prev_sync_results_, sync_results_,
 		       sizeof(prev_sync_results_));
-		frame_phase_ = config_.frame_period; // run the algo again asap
+		generation_++;
+		job_.Trigger(); // run the algo again asap
 		first_time_ = false;
 	}
 }
@@ -257,8 +293,6 @@ void Alsc::SwitchMode(CameraMode const &camera_mode,
 void Alsc::fetchAsyncResults()
 {
 	LOG(RPiAlsc, Debug) << "Fetch ALSC results";
-	async_finished_ = false;
-	async_started_ = false;
 	memcpy(sync_results_, async_results_, sizeof(sync_results_));
 }
 
@@ -266,7 +300,7 @@ double get_ct(Metadata *metadata, double default_ct)
 {
 	AwbStatus awb_status;
 	awb_status.temperature_K = default_ct; // in case nothing found
-	if (metadata->Get("awb.status", awb_status) != 0)
+	if (metadata->Get(tag::awb_status, awb_status) != 0)
 		LOG(RPiAlsc, Warning) << "no AWB results found, using "
 				      << awb_status.temperature_K;
 	else
@@ -300,7 +334,7 @@ void Alsc::restartAsync(StatisticsPtr &stats, Metadata *image_metadata)
 	// We have to copy the statistics here, dividing out our best guess of
 	// the LSC table that the pipeline applied to them.
 	AlscStatus alsc_status;
-	if (image_metadata->Get("alsc.status", alsc_status) != 0) {
+	if (image_metadata->Get(tag::alsc_status, alsc_status) != 0) {
 		LOG(RPiAlsc, Warning)
 			<< "No ALSC status found for applied gains!";
 		for (int y = 0; y < Y; y++)
@@ -311,19 +345,23 @@ void Alsc::restartAsync(StatisticsPtr &stats, Metadata *image_metadata)
 			}
 	}
 	copy_stats(statistics_, stats, alsc_status);
-	frame_phase_ = 0;
-	async_started_ = true;
-	{
-		std::lock_guard<std::mutex> lock(mutex_);
-		async_start_ = true;
-	}
-	async_signal_.notify_one();
+	job_.Start();
+}
+
+MetadataAccess Alsc::PrepareAccess() const
+{
+	return { MetadataSet(), metadata_set(tag::alsc_status) };
+}
+
+MetadataAccess Alsc::ProcessAccess() const
+{
+	return { metadata_set(tag::awb_status, tag::alsc_status),
+		 MetadataSet() };
 }
 
 void Alsc::Prepare(Metadata *image_metadata)
 {
-	// Count frames since we started, and since we last poked the async
-	// thread.
+	// Count frames since we started.
 	if (frame_count_ < (int)config_.startup_frames)
 		frame_count_++;
 	double speed = frame_count_ < (int)config_.startup_frames
@@ -331,60 +369,36 @@ void Alsc::Prepare(Metadata *image_metadata)
 			       : config_.speed;
 	LOG(RPiAlsc, Debug)
 		<< "frame_count " << frame_count_ << " speed " << speed;
-	{
-		std::unique_lock<std::mutex> lock(mutex_);
-		if (async_started_ && async_finished_)
-			fetchAsyncResults();
-	}
-	// Apply IIR filter to results and program into the pipeline.
+	if (job_.Fetch())
+		fetchAsyncResults();
+	// Apply IIR filter to results and program into the pipeline. Once the
+	// filter has converged the tables stop changing, which the generation
+	// counter lets the pipeline notice cheaply.
 	double *ptr = (double *)sync_results_,
 	       *pptr = (double *)prev_sync_results_;
+	bool changed = false;
 	for (unsigned int i = 0;
-	     i < sizeof(sync_results_) / sizeof(double); i++)
-		pptr[i] = speed * ptr[i] + (1.0 - speed) * pptr[i];
+	     i < sizeof(sync_results_) / sizeof(double); i++) {
+		double value = speed * ptr[i] + (1.0 - speed) * pptr[i];
+		changed |= value != pptr[i];
+		pptr[i] = value;
+	}
+	if (changed)
+		generation_++;
 	// Put output values into status metadata.
 	AlscStatus status;
 	memcpy(status.r, prev_sync_results_[0], sizeof(status.r));
 	memcpy(status.g, prev_sync_results_[1], sizeof(status.g));
 	memcpy(status.b, prev_sync_results_[2], sizeof(status.b));
-	image_metadata->Set("alsc.status", status);
+	status.generation = generation_;
+	image_metadata->Set(tag::alsc_status, status);
 }
 
 void Alsc::Process(StatisticsPtr &stats, Metadata *image_metadata)
 {
-	// Count frames since we started, and since we last poked the async
-	// thread.
-	if (frame_phase_ < (int)config_.frame_period)
-		frame_phase_++;
-	if (frame_count2_ < (int)config_.startup_frames)
-		frame_count2_++;
-	LOG(RPiAlsc, Debug) << "frame_phase " << frame_phase_;
-	if (frame_phase_ >= (int)config_.frame_period ||
-	    frame_count2_ < (int)config_.startup_frames) {
-		if (async_started_ == false)
-			restartAsync(stats, image_metadata);
-	}
-}
-
-void Alsc::asyncFunc()
-{
-	while (true) {
-		{
-			std::unique_lock<std::mutex> lock(mutex_);
-			async_signal_.wait(lock, [&] {
-				return async_start_ || async_abort_;
-			});
-			async_start_ = false;
-			if (async_abort_)
-				break;
-		}
-		doAlsc();
-		{
-			std::lock_guard<std::mutex> lock(mutex_);
-			async_finished_ = true;
-		}
-		sync_signal_.notify_one();
-	}
+	// Count frames since we last started the async job.
+	if (job_.Tick())
+		restartAsync(stats, image_metadata);
 }
 
 void get_cal_table(double ct, std::vector<AlscCalibration> const &calibrations,
@@ -521,128 +535,6 @@ void compensate_lambdas_for_cal(double const cal_table[XY],
 	printf("]\n");
 }
 
-// Compute weight out of 1.0 which reflects how similar we wish to make the
-// colours of these two regions.
-static double compute_weight(double C_i, double C_j, double sigma)
-{
-	if (C_i == INSUFFICIENT_DATA || C_j == INSUFFICIENT_DATA)
-		return 0;
-	double diff = (C_i - C_j) / sigma;
-	return exp(-diff * diff / 2);
-}
-
-// Compute all weights.
-static void compute_W(double const C[XY], double sigma, double W[XY][4])
-{
-	for (int i = 0; i < XY; i++) {
-		// Start with neighbour above and go clockwise.
-		W[i][0] = i >= X ? compute_weight(C[i], C[i - X], sigma) : 0;
-		W[i][1] = i % X < X - 1 ? compute_weight(C[i], C[i + 1], sigma)
-					: 0;
-		W[i][2] =
-			i < XY - X ? compute_weight(C[i], C[i + X], sigma) : 0;
-		W[i][3] = i % X ? compute_weight(C[i], C[i - 1], sigma) : 0;
-	}
-}
-
-// Compute M, the large but sparse matrix such that M * lambdas = 0.
-static void construct_M(double const C[XY], double const W[XY][4],
-			double M[XY][4])
-{
-	double epsilon = 0.001;
-	for (int i = 0; i < XY; i++) {
-		// Note how, if C[i] == INSUFFICIENT_DATA, the weights will all
-		// be zero so the equation is still set up correctly.
-		int m = !!(i >= X) + !!(i % X < X - 1) + !!(i < XY - X) +
-			!!(i % X); // total number of neighbours
-		// we'll divide the diagonal out straight away
-		double diagonal =
-			(epsilon + W[i][0] + W[i][1] + W[i][2] + W[i][3]) *
-			C[i];
-		M[i][0] = i >= X ? (W[i][0] * C[i - X] + epsilon / m * C[i]) /
-					   diagonal
-				 : 0;
-		M[i][1] = i % X < X - 1
-				  ? (W[i][1] * C[i + 1] + epsilon / m * C[i]) /
-					    diagonal
-				  : 0;
-		M[i][2] = i < XY - X
-				  ? (W[i][2] * C[i + X] + epsilon / m * C[i]) /
-					    diagonal
-				  : 0;
-		M[i][3] = i % X ? (W[i][3] * C[i - 1] + epsilon / m * C[i]) /
-					  diagonal
-				: 0;
-	}
-}
-
-// In the compute_lambda_ functions, note that the matrix coefficients for the
-// left/right neighbours are zero down the left/right edges, so we don't need
-// need to test the i value to exclude them.
-static double compute_lambda_bottom(int i, double const M[XY][4],
-				    double lambda[XY])
-{
-	return M[i][1] * lambda[i + 1] + M[i][2] * lambda[i + X] +
-	       M[i][3] * lambda[i - 1];
-}
-static double compute_lambda_bottom_start(int i, double const M[XY][4],
-					  double lambda[XY])
-{
-	return M[i][1] * lambda[i + 1] + M[i][2] * lambda[i + X];
-}
-static double compute_lambda_interior(int i, double const M[XY][4],
-				      double lambda[XY])
-{
-	return M[i][0] * lambda[i - X] + M[i][1] * lambda[i + 1] +
-	       M[i][2] * lambda[i + X] + M[i][3] * lambda[i - 1];
-}
-static double compute_lambda_top(int i, double const M[XY][4],
-				 double lambda[XY])
-{
-	return M[i][0] * lambda[i - X] + M[i][1] * lambda[i + 1] +
-	       M[i][3] * lambda[i - 1];
-}
-static double compute_lambda_top_end(int i, double const M[XY][4],
-				     double lambda[XY])
-{
-	return M[i][0] * lambda[i - X] + M[i][3] * lambda[i - 1];
-}
-
-// Gauss-Seidel iteration with over-relaxation.
-static double gauss_seidel2_SOR(double const M[XY][4], double omega,
-				double lambda[XY])
-{
-	double old_lambda[XY];
-	int i;
-	for (i = 0; i < XY; i++)
-		old_lambda[i] = lambda[i];
-	lambda[0] = compute_lambda_bottom_start(0, M, lambda);
-	for (i = 1; i < X; i++)
-		lambda[i] = compute_lambda_bottom(i, M, lambda);
-	for (; i < XY - X; i++)
-		lambda[i] = compute_lambda_interior(i, M, lambda);
-	for (; i < XY - 1; i++)
-		lambda[i] = compute_lambda_top(i, M, lambda);
-	lambda[i] = compute_lambda_top_end(i, M, lambda);
-	// Also solve the system from bottom to top, to help spread the updates
-	// better.
-	lambda[i] = compute_lambda_top_end(i, M, lambda);
-	for (i = XY - 2; i >= XY - X; i--)
-		lambda[i] = compute_lambda_top(i, M, lambda);
-	for (; i >= X; i--)
-		lambda[i] = compute_lambda_interior(i, M, lambda);
-	for (; i >= 1; i--)
-		lambda[i] = compute_lambda_bottom(i, M, lambda);
-	lambda[0] = compute_lambda_bottom_start(0, M, lambda);
-	double max_diff = 0;
-	for (i = 0; i < XY; i++) {
-		lambda[i] = old_lambda[i] + (lambda[i] - old_lambda[i]) * omega;
-		if (fabs(lambda[i] - old_lambda[i]) > fabs(max_diff))
-			max_diff = lambda[i] - old_lambda[i];
-	}
-	return max_diff;
-}
-
 // Normalise the values so that the smallest value is 1.
 static void normalise(double *ptr, size_t n)
 {
@@ -653,34 +545,6 @@ static void normalise(double *ptr, size_t n)
 		ptr[i] /= minval;
 }
 
-static void run_matrix_iterations(double const C[XY], double lambda[XY],
-				  double const W[XY][4], double omega,
-				  int n_iter, double threshold)
-{
-	double M[XY][4];
-	construct_M(C, W, M);
-	double last_max_diff = std::numeric_limits<double>::max();
-	for (int i = 0; i < n_iter; i++) {
-		double max_diff = fabs(gauss_seidel2_SOR(M, omega, lambda));
-		if (max_diff < threshold) {
-			LOG(RPiAlsc, Debug)
-				<< "Stop after " << i + 1 << " iterations";
-			break;
-		}
-		// this happens very occasionally (so make a note), though
-		// doesn't seem to matter
-		if (max_diff > last_max_diff)
-			LOG(RPiAlsc, Debug)
-				<< "Iteration " << i << ": max_diff gone up "
-				<< last_max_diff << " to " << max_diff;
-		last_max_diff = max_diff;
-	}
-	// We're going to normalise the lambdas so the smallest is 1. Not sure
-	// this is really necessary as they get renormalised later, but I
-	// suppose it does stop these quantities from wandering off...
-	normalise(lambda, XY);
-}
-
 static void add_luminance_rb(double result[XY], double const lambda[XY],
 			     double const luminance_lut[XY],
 			     double luminance_strength)
@@ -715,36 +579,38 @@ void add_luminance_to_tables(double results[3][Y][X], double const lambda_r[XY],
 
 void Alsc::doAlsc()
 {
-	double Cr[XY], Cb[XY], Wr[XY][4], Wb[XY][4], cal_table_r[XY],
-		cal_table_b[XY], cal_table_tmp[XY];
+	double Cr[XY], Cb[XY];
 	// Calculate our R/B ("Cr"/"Cb") colour statistics, and assess which are
 	// usable.
 	calculate_Cr_Cb(statistics_, Cr, Cb, config_.min_count, config_.min_G);
-	// Fetch the new calibrations (if any) for this CT. Resample them in
-	// case the camera mode is not full-frame.
-	get_cal_table(ct_, config_.calibrations_Cr, cal_table_tmp);
-	resample_cal_table(cal_table_tmp, camera_mode_, cal_table_r);
-	get_cal_table(ct_, config_.calibrations_Cb, cal_table_tmp);
-	resample_cal_table(cal_table_tmp, camera_mode_, cal_table_b);
+	// Fetch the new calibrations (if any) for this CT, already resampled
+	// for the camera mode.
+	updateCalTables(ct_);
 	// You could print out the cal tables for this image here, if you're
 	// tuning the algorithm...
 	// Apply any calibration to the statistics, so the adaptive algorithm
 	// makes only the extra adjustments.
-	apply_cal_table(cal_table_r, Cr);
-	apply_cal_table(cal_table_b, Cb);
-	// Compute weights between zones.
-	compute_W(Cr, config_.sigma_Cr, Wr);
-	compute_W(Cb, config_.sigma_Cb, Wb);
-	// Run Gauss-Seidel iterations over the resulting matrix, for R and B.
-	run_matrix_iterations(Cr, lambda_r_, Wr, config_.omega, config_.n_iter,
-			      config_.threshold);
-	run_matrix_iterations(Cb, lambda_b_, Wb, config_.omega, config_.n_iter,
-			      config_.threshold);
+	apply_cal_table(cal_table_r_, Cr);
+	apply_cal_table(cal_table_b_, Cb);
+	// Compute weights between zones, and run Gauss-Seidel iterations over
+	// the resulting matrix, for R and B.
+	if (job_.Cancelled())
+		return;
+	int iterations = alsc_solve(Cr, config_.sigma_Cr, config_.omega,
+				    config_.n_iter, config_.threshold,
+				    config_.single_precision, lambda_r_);
+	LOG(RPiAlsc, Debug) << "R stopped after " << iterations << " iterations";
+	if (job_.Cancelled())
+		return;
+	iterations = alsc_solve(Cb, config_.sigma_Cb, config_.omega,
+				config_.n_iter, config_.threshold,
+				config_.single_precision, lambda_b_);
+	LOG(RPiAlsc, Debug) << "B stopped after " << iterations << " iterations";
 	// Fold the calibrated gains into our final lambda values. (Note that on
 	// the next run, we re-start with the lambda values that don't have the
 	// calibration gains included.)
-	compensate_lambdas_for_cal(cal_table_r, lambda_r_, async_lambda_r_);
-	compensate_lambdas_for_cal(cal_table_b, lambda_b_, async_lambda_b_);
+	compensate_lambdas_for_cal(cal_table_r_, lambda_r_, async_lambda_r_);
+	compensate_lambdas_for_cal(cal_table_b_, lambda_b_, async_lambda_b_);
 	// Fold in the luminance table at the appropriate strength.
 	add_luminance_to_tables(async_results_, async_lambda_r_, 1.0,
 				async_lambda_b_, luminance_table_,
@@ -6,11 +6,8 @@
  */
 #pragma once
 
-#include <mutex>
-#include <condition_variable>
-#include <thread>
-
 #include "../algorithm.hpp"
+#include "../async_job.hpp"
 #include "../alsc_status.h"
 
 namespace RPiController {
@@ -27,6 +24,8 @@ struct AlscConfig {
 	uint16_t frame_period;
 	// number of initial frames for which speed taken as 1.0 (maximum)
 	uint16_t startup_frames;
+	// most frames to wait for a calculation before blocking (0 = no limit)
+	uint16_t max_staleness;
 	// IIR filter speed applied to algorithm results
 	double speed;
 	double sigma_Cr;
@@ -41,6 +40,9 @@ struct AlscConfig {
 	std::vector<AlscCalibration> calibrations_Cb;
 	double default_ct; // colour temperature if no metadata found
 	double threshold; // iteration termination threshold
+	bool single_precision; // run the iterations in float, not double
+	// reuse the calibration tables while the CT moves by less than this
+	double ct_cache_tolerance;
 };
 
 class Alsc : public Algorithm
@@ -54,43 +56,25 @@ public:
 	void Read(boost::property_tree::ptree const &params) override;
 	void Prepare(Metadata *image_metadata) override;
 	void Process(StatisticsPtr &stats, Metadata *image_metadata) override;
+	MetadataAccess PrepareAccess() const override;
+	MetadataAccess ProcessAccess() const override;
 
 private:
-	// configuration is read-only, and available to both threads
+	// configuration is read-only, and available to the async job
 	AlscConfig config_;
 	bool first_time_;
 	CameraMode camera_mode_;
 	double luminance_table_[ALSC_CELLS_X * ALSC_CELLS_Y];
-	std::thread async_thread_;
-	void asyncFunc(); // asynchronous thread function
-	std::mutex mutex_;
-	// condvar for async thread to wait on
-	std::condition_variable async_signal_;
-	// condvar for synchronous thread to wait on
-	std::condition_variable sync_signal_;
-	// for sync thread to check  if async thread finished (requires mutex)
-	bool async_finished_;
-	// for async thread to check if it's been told to run (requires mutex)
-	bool async_start_;
-	// for async thread to check if it's been told to quit (requires mutex)
-	bool async_abort_;
-
-	// The following are only for the synchronous thread to use:
-	// for sync thread to note its has asked async thread to run
-	bool async_started_;
-	// counts up to frame_period before restarting the async thread
-	int frame_phase_;
 	// counts up to startup_frames
 	int frame_count_;
-	// counts up to startup_frames for Process method
-	int frame_count2_;
 	double sync_results_[3][ALSC_CELLS_Y][ALSC_CELLS_X];
 	double prev_sync_results_[3][ALSC_CELLS_Y][ALSC_CELLS_X];
-	void waitForAysncThread();
-	// The following are for the asynchronous thread to use, though the main
-	// thread can set/reset them if the async thread is known to be idle:
+	// incremented whenever prev_sync_results_ changes
+	uint32_t generation_;
+	// The following are for the asynchronous job to use, though the main
+	// thread can set/reset them if the job is known to be idle:
 	void restartAsync(StatisticsPtr &stats, Metadata *image_metadata);
-	// copy out the results from the async thread so that it can be restarted
+	// copy out the results from the async job so that it can be restarted
 	void fetchAsyncResults();
 	double ct_;
 	bcm2835_isp_stats_region statistics_[ALSC_CELLS_Y * ALSC_CELLS_X];
@@ -100,6 +84,18 @@ private:
 	void doAlsc();
 	double lambda_r_[ALSC_CELLS_X * ALSC_CELLS_Y];
 	double lambda_b_[ALSC_CELLS_X * ALSC_CELLS_Y];
+	// The calibrations resampled for the current camera mode, and the
+	// tables interpolated from them for the last CT, which are only
+	// recomputed when the mode or the CT change. Like the variables above,
+	// they belong to the async job while it runs.
+	void resampleCalibrations();
+	void updateCalTables(double ct);
+	std::vector<AlscCalibration> resampled_Cr_;
+	std::vector<AlscCalibration> resampled_Cb_;
+	double cal_tables_ct_;
+	double cal_table_r_[ALSC_CELLS_X * ALSC_CELLS_Y];
+	double cal_table_b_[ALSC_CELLS_X * ALSC_CELLS_Y];
+	AsyncJob job_;
 };
 
 } // namespace RPiController
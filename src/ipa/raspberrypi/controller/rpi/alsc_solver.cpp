@@ -0,0 +1,249 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * alsc_solver.cpp - ALSC (auto lens shading correction) grid solver
+ */
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#include "alsc_solver.hpp"
+
+using namespace RPiController;
+
+static const int X = ALSC_CELLS_X;
+static const int Y = ALSC_CELLS_Y;
+static const int XY = X * Y;
+
+namespace {
+
+// A vector of T filling a 128-bit NEON or SSE register.
+template<typename T>
+struct Vector {
+	typedef T Type __attribute__((vector_size(16)));
+	static constexpr int Size = 16 / sizeof(T);
+};
+
+static_assert(X % Vector<float>::Size == 0 && X % Vector<double>::Size == 0,
+	      "ALSC grid rows must be a whole number of vectors");
+
+template<typename T>
+typename Vector<T>::Type load(T const *ptr)
+{
+	typename Vector<T>::Type v;
+	memcpy(&v, ptr, sizeof(v));
+	return v;
+}
+
+template<typename T>
+void store(T *ptr, typename Vector<T>::Type v)
+{
+	memcpy(ptr, &v, sizeof(v));
+}
+
+template<typename T>
+class Solver
+{
+public:
+	Solver(double const C[XY], double sigma, double const lambda[XY]);
+
+	T Iterate(T omega);
+	void Result(double lambda[XY]) const;
+
+private:
+	T *lambda() { return padded_ + X; }
+	T const *lambda() const { return padded_ + X; }
+
+	void forwardSweep();
+	void backwardSweep();
+
+	// The lambdas, with a row of zeros above and below the grid, so that
+	// all cells can be processed alike.
+	alignas(16) T padded_[(Y + 2) * X];
+	alignas(16) T old_lambda_[XY];
+	// The off-diagonal coefficients of the sparse matrix M such that
+	// M * lambdas = 0, for the neighbours above, to the right, below and
+	// to the left of each cell, with the diagonal already divided out.
+	// Coefficients of neighbours outside the grid are zero.
+	alignas(16) T up_[XY];
+	alignas(16) T right_[XY];
+	alignas(16) T down_[XY];
+	alignas(16) T left_[XY];
+};
+
+// Compute weight out of 1.0 which reflects how similar we wish to make the
+// colours of these two regions.
+template<typename T>
+T compute_weight(double C_i, double C_j, T sigma)
+{
+	if (C_i == ALSC_INSUFFICIENT_DATA || C_j == ALSC_INSUFFICIENT_DATA)
+		return 0;
+	T diff = (static_cast<T>(C_i) - static_cast<T>(C_j)) / sigma;
+	return std::exp(-diff * diff / 2);
+}
+
+template<typename T>
+Solver<T>::Solver(double const C[XY], double sigma, double const lambda[XY])
+{
+	// Compute the weights between neighbouring cells, starting with the
+	// neighbour above and going clockwise. The weights are symmetric, so
+	// compute each of them once only.
+	T W[XY][4];
+	for (int i = 0; i < XY; i++) {
+		if (i < X)
+			W[i][0] = 0;
+		if (i % X == 0)
+			W[i][3] = 0;
+		if (i % X < X - 1)
+			W[i][1] = W[i + 1][3] = compute_weight<T>(C[i], C[i + 1], sigma);
+		else
+			W[i][1] = 0;
+		if (i < XY - X)
+			W[i][2] = W[i + X][0] = compute_weight<T>(C[i], C[i + X], sigma);
+		else
+			W[i][2] = 0;
+	}
+
+	// Construct M. Note how, if C[i] == INSUFFICIENT_DATA, the weights
+	// will all be zero so the equation is still set up correctly.
+	T epsilon = 0.001;
+	for (int i = 0; i < XY; i++) {
+		T C_i = C[i];
+		int m = !!(i >= X) + !!(i % X < X - 1) + !!(i < XY - X) +
+			!!(i % X); // total number of neighbours
+		T diagonal = (epsilon + W[i][0] + W[i][1] + W[i][2] + W[i][3]) * C_i;
+		up_[i] = i >= X ? (W[i][0] * static_cast<T>(C[i - X]) + epsilon / m * C_i) /
+					  diagonal
+				: 0;
+		right_[i] = i % X < X - 1
+				    ? (W[i][1] * static_cast<T>(C[i + 1]) + epsilon / m * C_i) /
+					      diagonal
+				    : 0;
+		down_[i] = i < XY - X
+				   ? (W[i][2] * static_cast<T>(C[i + X]) + epsilon / m * C_i) /
+					     diagonal
+				   : 0;
+		left_[i] = i % X ? (W[i][3] * static_cast<T>(C[i - 1]) + epsilon / m * C_i) /
+					   diagonal
+				 : 0;
+	}
+
+	std::fill(padded_, padded_ + X, 0);
+	std::fill(padded_ + X + XY, padded_ + 2 * X + XY, 0);
+	std::copy(lambda, lambda + XY, this->lambda());
+}
+
+// Each new lambda is the weighted sum of its four neighbours. Within a row,
+// the neighbours above and below, and the one not yet visited, don't depend on
+// the cells being updated in this row, so their contributions are computed
+// for the whole row with vector instructions. Only the contribution of the
+// neighbour just updated is then added cell by cell.
+template<typename T>
+void Solver<T>::forwardSweep()
+{
+	constexpr int N = Vector<T>::Size;
+	alignas(16) T partial[X];
+
+	for (int row = 0; row < XY; row += X) {
+		T *l = lambda() + row;
+
+		for (int i = 0; i < X; i += N)
+			store(partial + i,
+			      load(up_ + row + i) * load(l + i - X) +
+				      load(right_ + row + i) * load(l + i + 1) +
+				      load(down_ + row + i) * load(l + i + X));
+
+		for (int i = 0; i < X; i++)
+			l[i] = partial[i] + left_[row + i] * l[i - 1];
+	}
+}
+
+// Also solve the system from bottom to top, to help spread the updates better.
+template<typename T>
+void Solver<T>::backwardSweep()
+{
+	constexpr int N = Vector<T>::Size;
+	alignas(16) T partial[X];
+
+	for (int row = XY - X; row >= 0; row -= X) {
+		T *l = lambda() + row;
+
+		for (int i = 0; i < X; i += N)
+			store(partial + i,
+			      load(up_ + row + i) * load(l + i - X) +
+				      load(down_ + row + i) * load(l + i + X) +
+				      load(left_ + row + i) * load(l + i - 1));
+
+		for (int i = X - 1; i >= 0; i--)
+			l[i] = partial[i] + right_[row + i] * l[i + 1];
+	}
+}
+
+// Gauss-Seidel iteration with over-relaxation. Returns the largest change of
+// any lambda.
+template<typename T>
+T Solver<T>::Iterate(T omega)
+{
+	constexpr int N = Vector<T>::Size;
+	T *l = lambda();
+
+	std::copy(l, l + XY, old_lambda_);
+
+	forwardSweep();
+	backwardSweep();
+
+	alignas(16) T diff[XY];
+	for (int i = 0; i < XY; i += N) {
+		typename Vector<T>::Type old = load(old_lambda_ + i);
+		typename Vector<T>::Type relaxed = old + (load(l + i) - old) * omega;
+		store(l + i, relaxed);
+		store(diff + i, relaxed - old);
+	}
+
+	T max_diff = 0;
+	for (int i = 0; i < XY; i++)
+		max_diff = std::max<T>(max_diff, std::abs(diff[i]));
+	return max_diff;
+}
+
+// Return the lambdas, normalised so that the smallest value is 1.
+template<typename T>
+void Solver<T>::Result(double lambda[XY]) const
+{
+	T const *l = this->lambda();
+	T minval = *std::min_element(l, l + XY);
+	for (int i = 0; i < XY; i++)
+		lambda[i] = l[i] / minval;
+}
+
+template<typename T>
+int solve(double const C[XY], double sigma, double omega, int n_iter,
+	  double threshold, double lambda[XY])
+{
+	Solver<T> solver(C, sigma, lambda);
+
+	int iterations = 0;
+	while (iterations < n_iter) {
+		iterations++;
+		if (solver.Iterate(omega) < threshold)
+			break;
+	}
+
+	solver.Result(lambda);
+
+	return iterations;
+}
+
+} // namespace
+
+int RPiController::alsc_solve(double const C[XY], double sigma, double omega,
+			      int n_iter, double threshold,
+			      bool single_precision, double lambda[XY])
+{
+	if (single_precision)
+		return solve<float>(C, sigma, omega, n_iter, threshold, lambda);
+	else
+		return solve<double>(C, sigma, omega, n_iter, threshold, lambda);
+}
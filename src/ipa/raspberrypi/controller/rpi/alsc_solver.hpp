@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * alsc_solver.hpp - ALSC (auto lens shading correction) grid solver
+ */
+#pragma once
+
+#include "../alsc_status.h"
+
+namespace RPiController {
+
+// Value of the colour statistics of cells that don't contain enough data.
+static constexpr double ALSC_INSUFFICIENT_DATA = -1.0;
+
+// Solve for the colour shading gains ("lambdas") of the ALSC grid that make
+// the colour ratios C of neighbouring cells as uniform as possible. The
+// lambdas are refined in place, starting from their current value, by
+// running at most n_iter iterations of Gauss-Seidel with over-relaxation
+// factor omega, stopping early once no lambda changes by more than
+// threshold. They are finally normalised so that the smallest is 1.
+//
+// The grid kernels are written with vector types, which the compiler maps to
+// NEON or SSE instructions when the target supports them, and to scalar code
+// otherwise. Running them in single precision processes twice as many cells
+// per instruction, at the cost of less accurate lambdas.
+//
+// Returns the number of iterations run.
+int alsc_solve(double const C[ALSC_CELLS_X * ALSC_CELLS_Y], double sigma,
+	       double omega, int n_iter, double threshold,
+	       bool single_precision,
+	       double lambda[ALSC_CELLS_X * ALSC_CELLS_Y]);
+
+} // namespace RPiController
@@ -5,6 +5,9 @@
  * awb.cpp - AWB control algorithm
  */
 
+#include <limits>
+#include <math.h>
+
 #include "libcamera/internal/log.h"
 
 #include "../lux_status.h"
@@ -63,6 +66,7 @@ void AwbConfig::Read(boost::property_tree::ptree const &params)
 	bayes = params.get<int>("bayes", 1);
 	frame_period = params.get<uint16_t>("frame_period", 10);
 	startup_frames = params.get<uint16_t>("startup_frames", 10);
+	max_staleness = params.get<uint16_t>("max_staleness", 0);
 	convergence_frames = params.get<unsigned int>("convergence_frames", 3);
 	speed = params.get<double>("speed", 0.05);
 	if (params.get_child_optional("ct_curve"))
@@ -95,6 +99,7 @@ void AwbConfig::Read(boost::property_tree::ptree const &params)
 	min_regions = params.get<uint32_t>("min_regions", 10);
 	delta_limit = params.get<double>("delta_limit", 0.2);
 	coarse_step = params.get<double>("coarse_step", 0.2);
+	full_search_period = params.get<uint16_t>("full_search_period", 10);
 	transverse_pos = params.get<double>("transverse_pos", 0.01);
 	transverse_neg = params.get<double>("transverse_neg", 0.01);
 	if (transverse_pos <= 0 || transverse_neg <= 0)
@@ -120,23 +125,20 @@ void AwbConfig::Read(boost::property_tree::ptree const &params)
 }
 
 Awb::Awb(Controller *controller)
-	: AwbAlgorithm(controller)
+	: AwbAlgorithm(controller), job_(NAME, [this] { doAwb(); })
 {
-	async_abort_ = async_start_ = async_started_ = async_finished_ = false;
 	mode_ = nullptr;
+	coarse_grid_mode_ = nullptr;
+	coarse_seed_ = -1;
+	searches_since_full_ = 0;
 	manual_r_ = manual_b_ = 0.0;
 	first_switch_mode_ = true;
-	async_thread_ = std::thread(std::bind(&Awb::asyncFunc, this));
 }
 
 Awb::~Awb()
 {
-	{
-		std::lock_guard<std::mutex> lock(mutex_);
-		async_abort_ = true;
-	}
-	async_signal_.notify_one();
-	async_thread_.join();
+	// Stop the job before any of the data it uses is destroyed.
+	job_.Cancel();
 }
 
 char const *Awb::Name() const
@@ -151,7 +153,10 @@ void Awb::Read(boost::property_tree::ptree const &params)
 
 void Awb::Initialise()
 {
-	frame_count_ = frame_phase_ = 0;
+	frame_count_ = 0;
+	job_.Configure(config_.frame_period, config_.startup_frames,
+		       config_.max_staleness);
+	job_.Reset();
 	// Put something sane into the status that we are filtering towards,
 	// just in case the first few frames don't have anything meaningful in
 	// them.
@@ -215,7 +220,7 @@ void Awb::SwitchMode([[maybe_unused]] CameraMode const &camera_mode,
 		sync_results_.temperature_K = prev_sync_results_.temperature_K;
 	}
 	// Let other algorithms know the current white balance values.
-	metadata->Set("awb.status", prev_sync_results_);
+	metadata->Set(tag::awb_status, prev_sync_results_);
 	first_switch_mode_ = false;
 }
 
@@ -227,10 +232,8 @@ bool Awb::isAutoEnabled() const
 void Awb::fetchAsyncResults()
 {
 	LOG(RPiAwb, Debug) << "Fetch AWB results";
-	async_finished_ = false;
-	async_started_ = false;
 	// It's possible manual gains could be set even while the async
-	// thread was running, so only copy the results if still in auto mode.
+	// job was running, so only copy the results if still in auto mode.
 	if (isAutoEnabled())
 		sync_results_ = async_results_;
 }
@@ -238,7 +241,7 @@ void Awb::fetchAsyncResults()
 void Awb::restartAsync(StatisticsPtr &stats, double lux)
 {
 	LOG(RPiAwb, Debug) << "Starting AWB calculation";
-	// this makes a new reference which belongs to the asynchronous thread
+	// this makes a new reference which belongs to the asynchronous job
 	statistics_ = stats;
 	// store the mode as it could technically change
 	auto m = config_.modes.find(mode_name_);
@@ -246,16 +249,20 @@ void Awb::restartAsync(StatisticsPtr &stats, double lux)
 			? &m->second
 			: (mode_ == nullptr ? config_.default_mode : mode_);
 	lux_ = lux;
-	frame_phase_ = 0;
-	async_started_ = true;
 	size_t len = mode_name_.copy(async_results_.mode,
 				     sizeof(async_results_.mode) - 1);
 	async_results_.mode[len] = '\0';
-	{
-		std::lock_guard<std::mutex> lock(mutex_);
-		async_start_ = true;
-	}
-	async_signal_.notify_one();
+	job_.Start();
+}
+
+MetadataAccess Awb::PrepareAccess() const
+{
+	return { MetadataSet(), metadata_set(tag::awb_status) };
+}
+
+MetadataAccess Awb::ProcessAccess() const
+{
+	return { metadata_set(tag::lux_status), MetadataSet() };
 }
 
 void Awb::Prepare(Metadata *image_metadata)
@@ -267,11 +274,8 @@ void Awb::Prepare(Metadata *image_metadata)
 			       : config_.speed;
 	LOG(RPiAwb, Debug)
 		<< "frame_count " << frame_count_ << " speed " << speed;
-	{
-		std::unique_lock<std::mutex> lock(mutex_);
-		if (async_started_ && async_finished_)
-			fetchAsyncResults();
-	}
+	if (job_.Fetch())
+		fetchAsyncResults();
 	// Finally apply IIR filter to results and put into metadata.
 	memcpy(prev_sync_results_.mode, sync_results_.mode,
 	       sizeof(prev_sync_results_.mode));
@@ -284,7 +288,7 @@ void Awb::Prepare(Metadata *image_metadata)
 				    (1.0 - speed) * prev_sync_results_.gain_g;
 	prev_sync_results_.gain_b = speed * sync_results_.gain_b +
 				    (1.0 - speed) * prev_sync_results_.gain_b;
-	image_metadata->Set("awb.status", prev_sync_results_);
+	image_metadata->Set(tag::awb_status, prev_sync_results_);
 	LOG(RPiAwb, Debug)
 		<< "Using AWB gains r " << prev_sync_results_.gain_r << " g "
 		<< prev_sync_results_.gain_g << " b "
@@ -293,44 +297,17 @@ void Awb::Prepare(Metadata *image_metadata)
 
 void Awb::Process(StatisticsPtr &stats, Metadata *image_metadata)
 {
-	// Count frames since we last poked the async thread.
-	if (frame_phase_ < (int)config_.frame_period)
-		frame_phase_++;
-	LOG(RPiAwb, Debug) << "frame_phase " << frame_phase_;
-	// We do not restart the async thread if we're not in auto mode.
-	if (isAutoEnabled() &&
-	    (frame_phase_ >= (int)config_.frame_period ||
-	     frame_count_ < (int)config_.startup_frames)) {
+	// Count frames since we last started the async job. We do not restart
+	// it if we're not in auto mode.
+	if (job_.Tick() && isAutoEnabled()) {
 		// Update any settings and any image metadata that we need.
 		struct LuxStatus lux_status = {};
 		lux_status.lux = 400; // in case no metadata
-		if (image_metadata->Get("lux.status", lux_status) != 0)
+		if (image_metadata->Get(tag::lux_status, lux_status) != 0)
 			LOG(RPiAwb, Debug) << "No lux metadata found";
 		LOG(RPiAwb, Debug) << "Awb lux value is " << lux_status.lux;
 
-		if (async_started_ == false)
-			restartAsync(stats, lux_status.lux);
-	}
-}
-
-void Awb::asyncFunc()
-{
-	while (true) {
-		{
-			std::unique_lock<std::mutex> lock(mutex_);
-			async_signal_.wait(lock, [&] {
-				return async_start_ || async_abort_;
-			});
-			async_start_ = false;
-			if (async_abort_)
-				break;
-		}
-		doAwb();
-		{
-			std::lock_guard<std::mutex> lock(mutex_);
-			async_finished_ = true;
-		}
-		sync_signal_.notify_one();
+		restartAsync(stats, lux_status.lux);
 	}
 }
 
@@ -426,45 +403,96 @@ static double interpolate_quadatric(Pwl::Point const &A, Pwl::Point const &B,
 	return A.y < C.y - eps ? A.x : (C.y < A.y - eps ? C.x : B.x);
 }
 
-double Awb::coarseSearch(Pwl const &prior)
+void Awb::buildCoarseGrid()
 {
-	points_.clear(); // assume doesn't deallocate memory
-	size_t best_point = 0;
+	// The CT values visited by the coarse search, and so the points of the
+	// CT curve, only depend on the mode. Evaluate the curve once for all.
+	coarse_grid_.clear();
 	double t = mode_->ct_lo;
 	int span_r = 0, span_b = 0;
-	// Step down the CT curve evaluating log likelihood.
 	while (true) {
 		double r = config_.ct_r.Eval(t, &span_r);
 		double b = config_.ct_b.Eval(t, &span_b);
-		double gain_r = 1 / r, gain_b = 1 / b;
-		double delta2_sum = computeDelta2Sum(gain_r, gain_b);
-		double prior_log_likelihood =
-			prior.Eval(prior.Domain().Clip(t));
-		double final_log_likelihood = delta2_sum - prior_log_likelihood;
-		LOG(RPiAwb, Debug)
-			<< "t: " << t << " gain_r " << gain_r << " gain_b "
-			<< gain_b << " delta2_sum " << delta2_sum
-			<< " prior " << prior_log_likelihood << " final "
-			<< final_log_likelihood;
-		points_.push_back(Pwl::Point(t, final_log_likelihood));
-		if (points_.back().y < points_[best_point].y)
-			best_point = points_.size() - 1;
+		coarse_grid_.push_back({ t, 1 / r, 1 / b });
 		if (t == mode_->ct_hi)
 			break;
 		// for even steps along the r/b curve scale them by the current t
 		t = std::min(t + t / 10 * config_.coarse_step,
 			     mode_->ct_hi);
 	}
-	t = points_[best_point].x;
+	coarse_likelihood_.resize(coarse_grid_.size());
+	coarse_grid_mode_ = mode_;
+	coarse_seed_ = -1;
+	LOG(RPiAwb, Debug)
+		<< "Coarse search grid has " << coarse_grid_.size() << " points";
+}
+
+double Awb::coarseLikelihood(size_t index, Pwl const &prior)
+{
+	double &likelihood = coarse_likelihood_[index];
+	if (!std::isnan(likelihood))
+		return likelihood;
+	CoarsePoint const &point = coarse_grid_[index];
+	double delta2_sum = computeDelta2Sum(point.gain_r, point.gain_b);
+	double prior_log_likelihood =
+		prior.Eval(prior.Domain().Clip(point.t));
+	likelihood = delta2_sum - prior_log_likelihood;
+	LOG(RPiAwb, Debug)
+		<< "t: " << point.t << " gain_r " << point.gain_r << " gain_b "
+		<< point.gain_b << " delta2_sum " << delta2_sum
+		<< " prior " << prior_log_likelihood << " final "
+		<< likelihood;
+	return likelihood;
+}
+
+double Awb::coarseSearch(Pwl const &prior)
+{
+	if (coarse_grid_mode_ != mode_)
+		buildCoarseGrid();
+	std::fill(coarse_likelihood_.begin(), coarse_likelihood_.end(),
+		  std::numeric_limits<double>::quiet_NaN());
+	size_t num_points = coarse_grid_.size();
+	size_t best_point = 0;
+	if (coarse_seed_ < 0 || ++searches_since_full_ >= config_.full_search_period) {
+		// Step down the CT curve evaluating log likelihood.
+		for (size_t i = 0; i < num_points; i++) {
+			if (coarseLikelihood(i, prior) <
+			    coarseLikelihood(best_point, prior))
+				best_point = i;
+		}
+		searches_since_full_ = 0;
+	} else {
+		// Between full searches, the scene usually changes little.
+		// Walk downhill from the previous best point until reaching a
+		// minimum, which only takes a few evaluations in the steady
+		// state, and as many as needed to follow a scene change.
+		best_point = coarse_seed_;
+		while (true) {
+			double best = coarseLikelihood(best_point, prior);
+			if (best_point > 0 &&
+			    coarseLikelihood(best_point - 1, prior) < best)
+				best_point--;
+			else if (best_point + 1 < num_points &&
+				 coarseLikelihood(best_point + 1, prior) < best)
+				best_point++;
+			else
+				break;
+		}
+	}
+	coarse_seed_ = best_point;
+	double t = coarse_grid_[best_point].t;
 	LOG(RPiAwb, Debug) << "Coarse search found CT " << t;
 	// We have the best point of the search, but refine it with a quadratic
 	// interpolation around its neighbours.
-	if (points_.size() > 2) {
-		unsigned long bp = std::min(best_point, points_.size() - 2);
-		best_point = std::max(1UL, bp);
-		t = interpolate_quadatric(points_[best_point - 1],
-					  points_[best_point],
-					  points_[best_point + 1]);
+	if (num_points > 2) {
+		best_point = std::max<size_t>(1, std::min(best_point, num_points - 2));
+		Pwl::Point points[3];
+		for (int i = 0; i < 3; i++) {
+			size_t index = best_point - 1 + i;
+			points[i] = Pwl::Point(coarse_grid_[index].t,
+					       coarseLikelihood(index, prior));
+		}
+		t = interpolate_quadatric(points[0], points[1], points[2]);
 		LOG(RPiAwb, Debug)
 			<< "After quadratic refinement, coarse search has CT "
 			<< t;
@@ -626,7 +654,7 @@ void Awb::doAwb()
 {
 	prepareStats();
 	LOG(RPiAwb, Debug) << "Valid zones: " << zones_.size();
-	if (zones_.size() > config_.min_regions) {
+	if (zones_.size() > config_.min_regions && !job_.Cancelled()) {
 		if (config_.bayes)
 			awbBayes();
 		else
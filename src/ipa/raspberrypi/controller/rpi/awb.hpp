@@ -6,10 +6,7 @@
  */
 #pragma once
 
-#include <mutex>
-#include <condition_variable>
-#include <thread>
-
+#include "../async_job.hpp"
 #include "../awb_algorithm.hpp"
 #include "../pwl.hpp"
 #include "../awb_status.h"
@@ -37,6 +34,8 @@ struct AwbConfig {
 	uint16_t frame_period;
 	// number of initial frames for which speed taken as 1.0 (maximum)
 	uint16_t startup_frames;
+	// most frames to wait for a calculation before blocking (0 = no limit)
+	uint16_t max_staleness;
 	unsigned int convergence_frames; // approx number of frames to converge
 	double speed; // IIR filter speed applied to algorithm results
 	bool fast; // "fast" mode uses a 16x16 rather than 32x32 grid
@@ -59,6 +58,10 @@ struct AwbConfig {
 	double delta_limit;
 	// step size control in coarse search
 	double coarse_step;
+	// search the whole CT curve every "this many" calculations, and only
+	// around the previous result otherwise (1 searches the whole curve on
+	// every calculation)
+	uint16_t full_search_period;
 	// how far to wander off CT curve towards "more purple"
 	double transverse_pos;
 	// how far to wander off CT curve towards "more green"
@@ -89,6 +92,8 @@ public:
 	void SwitchMode(CameraMode const &camera_mode, Metadata *metadata) override;
 	void Prepare(Metadata *image_metadata) override;
 	void Process(StatisticsPtr &stats, Metadata *image_metadata) override;
+	MetadataAccess PrepareAccess() const override;
+	MetadataAccess ProcessAccess() const override;
 	struct RGB {
 		RGB(double _R = 0, double _G = 0, double _B = 0)
 			: R(_R), G(_G), B(_B)
@@ -104,35 +109,16 @@ public:
 
 private:
 	bool isAutoEnabled() const;
-	// configuration is read-only, and available to both threads
+	// configuration is read-only, and available to the async job
 	AwbConfig config_;
-	std::thread async_thread_;
-	void asyncFunc(); // asynchronous thread function
-	std::mutex mutex_;
-	// condvar for async thread to wait on
-	std::condition_variable async_signal_;
-	// condvar for synchronous thread to wait on
-	std::condition_variable sync_signal_;
-	// for sync thread to check  if async thread finished (requires mutex)
-	bool async_finished_;
-	// for async thread to check if it's been told to run (requires mutex)
-	bool async_start_;
-	// for async thread to check if it's been told to quit (requires mutex)
-	bool async_abort_;
-
-	// The following are only for the synchronous thread to use:
-	// for sync thread to note its has asked async thread to run
-	bool async_started_;
-	// counts up to frame_period before restarting the async thread
-	int frame_phase_;
 	int frame_count_; // counts up to startup_frames
 	AwbStatus sync_results_;
 	AwbStatus prev_sync_results_;
 	std::string mode_name_;
-	// The following are for the asynchronous thread to use, though the main
-	// thread can set/reset them if the async thread is known to be idle:
+	// The following are for the asynchronous job to use, though the main
+	// thread can set/reset them if the job is known to be idle:
 	void restartAsync(StatisticsPtr &stats, double lux);
-	// copy out the results from the async thread so that it can be restarted
+	// copy out the results from the async job so that it can be restarted
 	void fetchAsyncResults();
 	StatisticsPtr statistics_;
 	AwbMode *mode_;
@@ -144,15 +130,32 @@ private:
 	void prepareStats();
 	double computeDelta2Sum(double gain_r, double gain_b);
 	Pwl interpolatePrior();
+	void buildCoarseGrid();
+	double coarseLikelihood(size_t index, Pwl const &prior);
 	double coarseSearch(Pwl const &prior);
 	void fineSearch(double &t, double &r, double &b, Pwl const &prior);
 	std::vector<RGB> zones_;
-	std::vector<Pwl::Point> points_;
+	// A point of the coarse search along the CT curve.
+	struct CoarsePoint {
+		double t;
+		double gain_r;
+		double gain_b;
+	};
+	// The coarse search points of coarse_grid_mode_, which only depend on
+	// the AWB mode, with the log likelihood of the current calculation, or
+	// NaN where not evaluated yet.
+	AwbMode *coarse_grid_mode_;
+	std::vector<CoarsePoint> coarse_grid_;
+	std::vector<double> coarse_likelihood_;
+	// index of the best coarse point of the last search, or -1 if none
+	int coarse_seed_;
+	unsigned int searches_since_full_;
 	// manual r setting
 	double manual_r_;
 	// manual b setting
 	double manual_b_;
 	bool first_switch_mode_; // is this the first call to SwitchMode?
+	AsyncJob job_;
 };
 
 static inline Awb::RGB operator+(Awb::RGB const &a, Awb::RGB const &b)
@@ -44,6 +44,16 @@ void BlackLevel::Read(boost::property_tree::ptree const &params)
 		<< " blue " << black_level_b_;
 }
 
+MetadataAccess BlackLevel::PrepareAccess() const
+{
+	return { MetadataSet(), metadata_set(tag::black_level_status) };
+}
+
+MetadataAccess BlackLevel::ProcessAccess() const
+{
+	return {};
+}
+
 void BlackLevel::Prepare(Metadata *image_metadata)
 {
 	// Possibly we should think about doing this in a switch_mode or
@@ -52,7 +62,7 @@ void BlackLevel::Prepare(Metadata *image_metadata)
 	status.black_level_r = black_level_r_;
 	status.black_level_g = black_level_g_;
 	status.black_level_b = black_level_b_;
-	image_metadata->Set("black_level.status", status);
+	image_metadata->Set(tag::black_level_status, status);
 }
 
 // Register algorithm with the system.
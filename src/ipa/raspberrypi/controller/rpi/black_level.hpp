@@ -20,6 +20,8 @@ public:
 	char const *Name() const override;
 	void Read(boost::property_tree::ptree const &params) override;
 	void Prepare(Metadata *image_metadata) override;
+	MetadataAccess PrepareAccess() const override;
+	MetadataAccess ProcessAccess() const override;
 
 private:
 	double black_level_r_;
@@ -83,16 +83,6 @@ void Ccm::SetSaturation(double saturation)
 
 void Ccm::Initialise() {}
 
-template<typename T>
-static bool get_locked(Metadata *metadata, std::string const &tag, T &value)
-{
-	T *ptr = metadata->GetLocked<T>(tag);
-	if (ptr == nullptr)
-		return false;
-	value = *ptr;
-	return true;
-}
-
 Matrix calculate_ccm(std::vector<CtCcm> const &ccms, double ct)
 {
 	if (ct <= ccms.front().ct)
@@ -119,6 +109,17 @@ Matrix apply_saturation(Matrix const &ccm, double saturation)
 	return Y2RGB * S * RGB2Y * ccm;
 }
 
+MetadataAccess Ccm::PrepareAccess() const
+{
+	return { metadata_set(tag::awb_status, tag::lux_status),
+		 metadata_set(tag::ccm_status) };
+}
+
+MetadataAccess Ccm::ProcessAccess() const
+{
+	return {};
+}
+
 void Ccm::Prepare(Metadata *image_metadata)
 {
 	bool awb_ok = false, lux_ok = false;
@@ -126,12 +127,8 @@ void Ccm::Prepare(Metadata *image_metadata)
 	awb.temperature_K = 4000; // in case no metadata
 	struct LuxStatus lux = {};
 	lux.lux = 400; // in case no metadata
-	{
-		// grab mutex just once to get everything
-		std::lock_guard<Metadata> lock(*image_metadata);
-		awb_ok = get_locked(image_metadata, "awb.status", awb);
-		lux_ok = get_locked(image_metadata, "lux.status", lux);
-	}
+	awb_ok = image_metadata->Get(tag::awb_status, awb) == 0;
+	lux_ok = image_metadata->Get(tag::lux_status, lux) == 0;
 	if (!awb_ok)
 		LOG(RPiCcm, Warning) << "no colour temperature found";
 	if (!lux_ok)
@@ -157,7 +154,7 @@ void Ccm::Prepare(Metadata *image_metadata)
 		<< " " << ccm_status.matrix[5] << "     "
 		<< ccm_status.matrix[6] << " " << ccm_status.matrix[7]
 		<< " " << ccm_status.matrix[8];
-	image_metadata->Set("ccm.status", ccm_status);
+	image_metadata->Set(tag::ccm_status, ccm_status);
 }
 
 // Register algorithm with the system.
@@ -66,6 +66,8 @@ public:
 	void SetSaturation(double saturation) override;
 	void Initialise() override;
 	void Prepare(Metadata *image_metadata) override;
+	MetadataAccess PrepareAccess() const override;
+	MetadataAccess ProcessAccess() const override;
 
 private:
 	CcmConfig config_;
@@ -4,6 +4,7 @@
  *
  * contrast.cpp - contrast (gamma) control algorithm
  */
+#include <array>
 #include <stdint.h>
 
 #include "libcamera/internal/log.h"
@@ -27,7 +28,8 @@ LOG_DEFINE_CATEGORY(RPiContrast)
 #define NAME "rpi.contrast"
 
 Contrast::Contrast(Controller *controller)
-	: ContrastAlgorithm(controller), brightness_(0.0), contrast_(1.0)
+	: ContrastAlgorithm(controller), brightness_(0.0), contrast_(1.0),
+	  cache_valid_(false)
 {
 }
 
@@ -64,16 +66,20 @@ void Contrast::SetContrast(double contrast)
 }
 
 static void fill_in_status(ContrastStatus &status, double brightness,
-			   double contrast, Pwl &gamma_curve)
+			   double contrast, Pwl const &gamma_curve)
 {
 	status.brightness = brightness;
 	status.contrast = contrast;
+	double x[CONTRAST_NUM_POINTS - 1], y[CONTRAST_NUM_POINTS - 1];
+	for (int i = 0; i < CONTRAST_NUM_POINTS - 1; i++)
+		x[i] = i < 16 ? i * 1024
+			      : (i < 24 ? (i - 16) * 2048 + 16384
+					: (i - 24) * 4096 + 32768);
+	// The points are in increasing order, so evaluate them in one go.
+	gamma_curve.Eval(x, y, CONTRAST_NUM_POINTS - 1);
 	for (int i = 0; i < CONTRAST_NUM_POINTS - 1; i++) {
-		int x = i < 16 ? i * 1024
-			       : (i < 24 ? (i - 16) * 2048 + 16384
-					 : (i - 24) * 4096 + 32768);
-		status.points[i].x = x;
-		status.points[i].y = std::min(65535.0, gamma_curve.Eval(x));
+		status.points[i].x = x[i];
+		status.points[i].y = std::min(65535.0, y[i]);
 	}
 	status.points[CONTRAST_NUM_POINTS - 1].x = 65535;
 	status.points[CONTRAST_NUM_POINTS - 1].y = 65535;
@@ -84,23 +90,44 @@ void Contrast::Initialise()
 	// Fill in some default values as Prepare will run before Process gets
 	// called.
 	fill_in_status(status_, brightness_, contrast_, config_.gamma_curve);
+	cache_valid_ = false;
+}
+
+MetadataAccess Contrast::PrepareAccess() const
+{
+	return { MetadataSet(), metadata_set(tag::contrast_status) };
+}
+
+MetadataAccess Contrast::ProcessAccess() const
+{
+	return { metadata_set(tag::histogram_status), MetadataSet() };
 }
 
 void Contrast::Prepare(Metadata *image_metadata)
 {
 	std::unique_lock<std::mutex> lock(mutex_);
-	image_metadata->Set("contrast.status", status_);
+	image_metadata->Set(tag::contrast_status, status_);
+}
+
+// The histogram points that the stretch curve moves, in increasing order.
+static std::array<double, 3> stretch_points(Histogram const &histogram,
+					    ContrastConfig const &config)
+{
+	return { histogram.Quantile(config.lo_histogram) *
+			 (65536 / NUM_HISTOGRAM_BINS),
+		 histogram.Quantile(0.5) * (65536 / NUM_HISTOGRAM_BINS),
+		 histogram.Quantile(config.hi_histogram) *
+			 (65536 / NUM_HISTOGRAM_BINS) };
 }
 
-Pwl compute_stretch_curve(Histogram const &histogram,
+Pwl compute_stretch_curve(std::array<double, 3> const &points,
 			  ContrastConfig const &config)
 {
 	Pwl enhance;
 	enhance.Append(0, 0);
 	// If the start of the histogram is rather empty, try to pull it down a
 	// bit.
-	double hist_lo = histogram.Quantile(config.lo_histogram) *
-			 (65536 / NUM_HISTOGRAM_BINS);
+	double hist_lo = points[0];
 	double level_lo = config.lo_level * 65536;
 	LOG(RPiContrast, Debug)
 		<< "Move histogram point " << hist_lo << " to " << level_lo;
@@ -112,13 +139,12 @@ Pwl compute_stretch_curve(Histogram const &histogram,
 	enhance.Append(hist_lo, level_lo);
 	// Keep the mid-point (median) in the same place, though, to limit the
 	// apparent amount of global brightness shift.
-	double mid = histogram.Quantile(0.5) * (65536 / NUM_HISTOGRAM_BINS);
+	double mid = points[1];
 	enhance.Append(mid, mid);
 
 	// If the top to the histogram is empty, try to pull the pixel values
 	// there up.
-	double hist_hi = histogram.Quantile(config.hi_histogram) *
-			 (65536 / NUM_HISTOGRAM_BINS);
+	double hist_hi = points[2];
 	double level_hi = config.hi_level * 65536;
 	LOG(RPiContrast, Debug)
 		<< "Move histogram point " << hist_hi << " to " << level_hi;
@@ -147,17 +173,35 @@ Pwl apply_manual_contrast(Pwl const &gamma_curve, double brightness,
 	return new_gamma_curve;
 }
 
-void Contrast::Process(StatisticsPtr &stats,
-		       [[maybe_unused]] Metadata *image_metadata)
+void Contrast::Process(StatisticsPtr &stats, Metadata *image_metadata)
 {
-	Histogram histogram(stats->hist[0].g_hist, NUM_HISTOGRAM_BINS);
+	// Use the histogram digested by the Controller when there is one.
+	HistogramStatus const *digest =
+		image_metadata->Find(tag::histogram_status);
+	Histogram histogram = digest ? Histogram(*digest)
+				     : Histogram(stats->hist[0].g_hist, NUM_HISTOGRAM_BINS);
+	bool stretch = config_.ce_enable &&
+		       (config_.lo_max != 0 || config_.hi_max != 0);
+	std::array<double, 3> points = {};
+	if (stretch)
+		points = stretch_points(histogram, config_);
+	// The curve only depends on the histogram points and the manual
+	// settings, and it rarely changes in a steady scene. Keep the last
+	// one when they are the same.
+	if (cache_valid_ && points == cached_points_ &&
+	    brightness_ == cached_brightness_ && contrast_ == cached_contrast_)
+		return;
+	cached_points_ = points;
+	cached_brightness_ = brightness_;
+	cached_contrast_ = contrast_;
+	cache_valid_ = true;
 	// We look at the histogram and adjust the gamma curve in the following
 	// ways: 1. Adjust the gamma curve so as to pull the start of the
 	// histogram down, and possibly push the end up.
 	Pwl gamma_curve = config_.gamma_curve;
 	if (config_.ce_enable) {
-		if (config_.lo_max != 0 || config_.hi_max != 0)
-			gamma_curve = compute_stretch_curve(histogram, config_)
+		if (stretch)
+			gamma_curve = compute_stretch_curve(points, config_)
 					      .Compose(gamma_curve);
 		// We could apply other adjustments (e.g. partial equalisation)
 		// based on the histogram...?
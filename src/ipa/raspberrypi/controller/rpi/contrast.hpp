@@ -6,6 +6,7 @@
  */
 #pragma once
 
+#include <array>
 #include <mutex>
 
 #include "../contrast_algorithm.hpp"
@@ -38,6 +39,8 @@ public:
 	void Initialise() override;
 	void Prepare(Metadata *image_metadata) override;
 	void Process(StatisticsPtr &stats, Metadata *image_metadata) override;
+	MetadataAccess PrepareAccess() const override;
+	MetadataAccess ProcessAccess() const override;
 
 private:
 	ContrastConfig config_;
@@ -45,6 +48,11 @@ private:
 	double contrast_;
 	ContrastStatus status_;
 	std::mutex mutex_;
+	// The inputs of the last curve computed.
+	bool cache_valid_;
+	std::array<double, 3> cached_points_;
+	double cached_brightness_;
+	double cached_contrast_;
 };
 
 } // namespace RPiController
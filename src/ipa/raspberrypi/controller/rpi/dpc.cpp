@@ -36,13 +36,23 @@ void Dpc::Read(boost::property_tree::ptree const &params)
 		throw std::runtime_error("Dpc: bad strength value");
 }
 
+MetadataAccess Dpc::PrepareAccess() const
+{
+	return { MetadataSet(), metadata_set(tag::dpc_status) };
+}
+
+MetadataAccess Dpc::ProcessAccess() const
+{
+	return {};
+}
+
 void Dpc::Prepare(Metadata *image_metadata)
 {
 	DpcStatus dpc_status = {};
 	// Should we vary this with lux level or analogue gain? TBD.
 	dpc_status.strength = config_.strength;
 	LOG(RPiDpc, Debug) << "strength " << dpc_status.strength;
-	image_metadata->Set("dpc.status", dpc_status);
+	image_metadata->Set(tag::dpc_status, dpc_status);
 }
 
 // Register algorithm with the system.
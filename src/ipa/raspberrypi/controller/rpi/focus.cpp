@@ -4,6 +4,8 @@
  *
  * focus.cpp - focus algorithm
  */
+#include <algorithm>
+#include <cmath>
 #include <stdint.h>
 
 #include "libcamera/internal/log.h"
@@ -18,8 +20,38 @@ LOG_DEFINE_CATEGORY(RPiFocus)
 
 #define NAME "rpi.focus"
 
+void FocusConfig::Read(boost::property_tree::ptree const &params)
+{
+	// By default only the two central regions count, matching the focus
+	// figure of merit reported by the IPA.
+	std::fill(std::begin(weights), std::end(weights), 0.0);
+	weights[5] = weights[6] = 1.0;
+	if (params.get_child_optional("weights")) {
+		int num = 0;
+		for (auto &p : params.get_child("weights")) {
+			if (num == FOCUS_REGIONS)
+				throw std::runtime_error("FocusConfig: too many weights");
+			weights[num++] = p.second.get_value<double>();
+		}
+		if (num != FOCUS_REGIONS)
+			throw std::runtime_error("FocusConfig: insufficient weights");
+	}
+	step_coarse = params.get<double>("step_coarse", 0.0625);
+	step_fine = params.get<double>("step_fine", 0.005);
+	if (step_coarse <= 0 || step_fine <= 0 || step_fine > step_coarse)
+		throw std::runtime_error("FocusConfig: bad scan steps");
+	settle_frames = params.get<unsigned int>("settle_frames", 2);
+	drop_threshold = params.get<double>("drop_threshold", 0.05);
+	retrigger_ratio = params.get<double>("retrigger_ratio", 0.75);
+	retrigger_frames = params.get<unsigned int>("retrigger_frames", 10);
+	min_fom = params.get<double>("min_fom", 0.0);
+}
+
 Focus::Focus(Controller *controller)
-	: Algorithm(controller)
+	: FocusAlgorithm(controller), lens_valid_(false), lens_min_(0),
+	  lens_max_(0), position_(0), state_(State::Inactive), settle_count_(0),
+	  step_(0), step_fine_(1), best_fom_(0), best_position_(0),
+	  reference_fom_(0), retrigger_count_(0)
 {
 }
 
@@ -28,18 +60,172 @@ char const *Focus::Name() const
 	return NAME;
 }
 
+void Focus::Read(boost::property_tree::ptree const &params)
+{
+	config_.Read(params);
+}
+
+MetadataAccess Focus::PrepareAccess() const
+{
+	return {};
+}
+
+MetadataAccess Focus::ProcessAccess() const
+{
+	return { MetadataSet(), metadata_set(tag::focus_status) };
+}
+
+void Focus::SetLensLimits(int32_t min, int32_t max, int32_t position)
+{
+	if (max <= min) {
+		lens_valid_ = false;
+		state_ = State::Inactive;
+		return;
+	}
+	lens_valid_ = true;
+	lens_min_ = min;
+	lens_max_ = max;
+	position_ = std::clamp(position, min, max);
+	step_fine_ = std::max<int32_t>(1, std::lround(config_.step_fine * (max - min)));
+	LOG(RPiFocus, Debug)
+		<< "Lens range " << min << " to " << max
+		<< ", position " << position_;
+	startScan();
+}
+
+void Focus::TriggerScan()
+{
+	if (lens_valid_)
+		startScan();
+}
+
+void Focus::startScan()
+{
+	state_ = State::Scanning;
+	step_ = std::max<int32_t>(step_fine_,
+				  std::lround(config_.step_coarse * (lens_max_ - lens_min_)));
+	// Head towards the middle of the range first, where there is the most
+	// room to find the peak.
+	if (position_ > (lens_min_ + lens_max_) / 2)
+		step_ = -step_;
+	best_fom_ = -1;
+	best_position_ = position_;
+	retrigger_count_ = 0;
+	settle_count_ = config_.settle_frames;
+}
+
+void Focus::moveTo(int32_t position)
+{
+	position = std::clamp(position, lens_min_, lens_max_);
+	if (position != position_) {
+		position_ = position;
+		settle_count_ = config_.settle_frames;
+	}
+}
+
+void Focus::scan(double fom)
+{
+	bool past_peak = false;
+	if (fom > best_fom_) {
+		best_fom_ = fom;
+		best_position_ = position_;
+	} else if (fom < best_fom_ * (1.0 - config_.drop_threshold))
+		past_peak = true;
+
+	// Hitting the end of the range is the same as seeing the contrast
+	// drop: the peak must lie behind us.
+	int32_t target = std::clamp(position_ + step_, lens_min_, lens_max_);
+	if (target == position_)
+		past_peak = true;
+
+	if (past_peak) {
+		if (std::abs(step_) <= step_fine_) {
+			moveTo(best_position_);
+			state_ = best_fom_ >= config_.min_fom ? State::Focused
+							      : State::Unfocused;
+			reference_fom_ = -1;
+			LOG(RPiFocus, Debug)
+				<< "Scan finished at " << best_position_
+				<< " contrast " << best_fom_;
+			return;
+		}
+		// Turn round and search more finely, starting again from the
+		// best position found so far.
+		step_ = -step_ / 2;
+		if (std::abs(step_) < step_fine_)
+			step_ = step_ < 0 ? -step_fine_ : step_fine_;
+		target = std::clamp(best_position_ + step_, lens_min_, lens_max_);
+	}
+
+	moveTo(target);
+}
+
+void Focus::monitor(double fom)
+{
+	// The first measurement once the lens has settled at the peak becomes
+	// the reference that later frames are compared against.
+	if (reference_fom_ < 0) {
+		reference_fom_ = fom;
+		return;
+	}
+	double ratio = reference_fom_ > 0 ? fom / reference_fom_ : 1.0;
+	if (ratio < config_.retrigger_ratio ||
+	    ratio * config_.retrigger_ratio > 1.0)
+		retrigger_count_++;
+	else
+		retrigger_count_ = 0;
+	if (retrigger_count_ >= config_.retrigger_frames) {
+		LOG(RPiFocus, Debug) << "Scene changed, restarting scan";
+		startScan();
+	}
+}
+
 void Focus::Process(StatisticsPtr &stats, Metadata *image_metadata)
 {
 	FocusStatus status;
 	unsigned int i;
-	for (i = 0; i < FOCUS_REGIONS; i++)
+	double fom = 0, weight_sum = 0;
+	for (i = 0; i < FOCUS_REGIONS; i++) {
 		status.focus_measures[i] = stats->focus_stats[i].contrast_val[1][1] / 1000;
+		fom += config_.weights[i] * status.focus_measures[i];
+		weight_sum += config_.weights[i];
+	}
 	status.num = i;
-	image_metadata->Set("focus.status", status);
+	if (weight_sum > 0)
+		fom /= weight_sum;
+
+	// Each step costs only a few comparisons, the lens itself is moved
+	// by the IPA once we return, so nothing here waits for the lens.
+	if (lens_valid_) {
+		if (settle_count_)
+			settle_count_--;
+		else if (state_ == State::Scanning)
+			scan(fom);
+		else if (state_ == State::Focused || state_ == State::Unfocused)
+			monitor(fom);
+	}
+
+	switch (state_) {
+	case State::Scanning:
+		status.state = FOCUS_STATE_SCANNING;
+		break;
+	case State::Focused:
+		status.state = FOCUS_STATE_FOCUSED;
+		break;
+	case State::Unfocused:
+		status.state = FOCUS_STATE_UNFOCUSED;
+		break;
+	default:
+		status.state = FOCUS_STATE_INACTIVE;
+		break;
+	}
+	status.lens_position = position_;
+	status.lens_valid = lens_valid_;
+	image_metadata->Set(tag::focus_status, status);
 
 	LOG(RPiFocus, Debug)
-		<< "Focus contrast measure: "
-		<< (status.focus_measures[5] + status.focus_measures[6]) / 10;
+		<< "Focus contrast measure: " << fom
+		<< " lens position " << position_;
 }
 
 /* Register algorithm with the system. */
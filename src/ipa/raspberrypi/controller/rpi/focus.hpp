@@ -6,23 +6,67 @@
  */
 #pragma once
 
-#include "../algorithm.hpp"
+#include <stdint.h>
+
+#include <linux/bcm2835-isp.h>
+
+#include "../focus_algorithm.hpp"
 #include "../metadata.hpp"
 
 /*
- * The "focus" algorithm. All it does it print out a version of the
- * focus contrast measure; there is no actual auto-focus mechanism to
- * control.
+ * The "focus" algorithm. It always reports the focus contrast measures. When
+ * the camera has a lens that can be driven, it also runs a contrast detection
+ * auto-focus: a hill-climbing scan of the lens position that looks for the
+ * peak of the weighted contrast measure, followed by continuous monitoring
+ * that restarts the scan when the scene changes.
  */
 
 namespace RPiController {
 
-class Focus : public Algorithm
+struct FocusConfig {
+	void Read(boost::property_tree::ptree const &params);
+	double weights[FOCUS_REGIONS];
+	double step_coarse; // as a fraction of the lens range
+	double step_fine;
+	unsigned int settle_frames;
+	double drop_threshold;
+	double retrigger_ratio;
+	unsigned int retrigger_frames;
+	double min_fom;
+};
+
+class Focus : public FocusAlgorithm
 {
 public:
 	Focus(Controller *controller);
 	char const *Name() const override;
+	void Read(boost::property_tree::ptree const &params) override;
 	void Process(StatisticsPtr &stats, Metadata *image_metadata) override;
+	MetadataAccess PrepareAccess() const override;
+	MetadataAccess ProcessAccess() const override;
+	void SetLensLimits(int32_t min, int32_t max, int32_t position) override;
+	void TriggerScan() override;
+
+private:
+	enum class State { Inactive, Scanning, Focused, Unfocused };
+	void startScan();
+	void scan(double fom);
+	void monitor(double fom);
+	void moveTo(int32_t position);
+	FocusConfig config_;
+	bool lens_valid_;
+	int32_t lens_min_;
+	int32_t lens_max_;
+	int32_t position_;
+	State state_;
+	// number of frames to ignore until the statistics match the lens position
+	unsigned int settle_count_;
+	int32_t step_;
+	int32_t step_fine_;
+	double best_fom_;
+	int32_t best_position_;
+	double reference_fom_;
+	unsigned int retrigger_count_;
 };
 
 } /* namespace RPiController */
@@ -43,15 +43,26 @@ void Geq::Read(boost::property_tree::ptree const &params)
 		config_.strength.Read(params.get_child("strength"));
 }
 
+MetadataAccess Geq::PrepareAccess() const
+{
+	return { metadata_set(tag::lux_status, tag::device_status),
+		 metadata_set(tag::geq_status) };
+}
+
+MetadataAccess Geq::ProcessAccess() const
+{
+	return {};
+}
+
 void Geq::Prepare(Metadata *image_metadata)
 {
 	LuxStatus lux_status = {};
 	lux_status.lux = 400;
-	if (image_metadata->Get("lux.status", lux_status))
+	if (image_metadata->Get(tag::lux_status, lux_status))
 		LOG(RPiGeq, Warning) << "no lux data found";
 	DeviceStatus device_status = {};
 	device_status.analogue_gain = 1.0; // in case not found
-	if (image_metadata->Get("device.status", device_status))
+	if (image_metadata->Get(tag::device_status, device_status))
 		LOG(RPiGeq, Warning)
 			<< "no device metadata - use analogue gain of 1x";
 	GeqStatus geq_status = {};
@@ -70,7 +81,7 @@ void Geq::Prepare(Metadata *image_metadata)
 		<< geq_status.slope << " (analogue gain "
 		<< device_status.analogue_gain << " lux "
 		<< lux_status.lux << ")";
-	image_metadata->Set("geq.status", geq_status);
+	image_metadata->Set(tag::geq_status, geq_status);
 }
 
 // Register algorithm with the system.
@@ -11,6 +11,7 @@
 #include "libcamera/internal/log.h"
 
 #include "../device_status.h"
+#include "../histogram.hpp"
 
 #include "lux.hpp"
 
@@ -51,10 +52,21 @@ void Lux::SetCurrentAperture(double aperture)
 	current_aperture_ = aperture;
 }
 
+MetadataAccess Lux::PrepareAccess() const
+{
+	return { MetadataSet(), metadata_set(tag::lux_status) };
+}
+
+MetadataAccess Lux::ProcessAccess() const
+{
+	return { metadata_set(tag::device_status, tag::histogram_status),
+		 metadata_set(tag::lux_status) };
+}
+
 void Lux::Prepare(Metadata *image_metadata)
 {
 	std::unique_lock<std::mutex> lock(mutex_);
-	image_metadata->Set("lux.status", status_);
+	image_metadata->Set(tag::lux_status, status_);
 }
 
 void Lux::Process(StatisticsPtr &stats, Metadata *image_metadata)
@@ -65,20 +77,27 @@ void Lux::Process(StatisticsPtr &stats, Metadata *image_metadata)
 		  .analogue_gain = 1.0,
 		  .lens_position = 0.0,
 		  .aperture = 0.0,
-		  .flash_intensity = 0.0 };
-	if (image_metadata->Get("device.status", device_status) == 0) {
+		  .flash_intensity = 0.0,
+		  .frame_length = 0,
+		  .exposure_start = 0,
+		  .exposure_end = 0 };
+	// Use the histogram digested by the Controller when there is one.
+	HistogramStatus digest;
+	HistogramStatus const *histogram =
+		image_metadata->Find(tag::histogram_status);
+	if (!histogram) {
+		DigestHistogram(stats->hist[0].g_hist, digest);
+		histogram = &digest;
+	}
+	if (image_metadata->Get(tag::device_status, device_status) == 0) {
 		double current_gain = device_status.analogue_gain;
 		double current_shutter_speed = device_status.shutter_speed;
 		double current_aperture = device_status.aperture;
 		if (current_aperture == 0)
 			current_aperture = current_aperture_;
-		uint64_t sum = 0;
-		uint32_t num = 0;
-		uint32_t *bin = stats->hist[0].g_hist;
-		const int num_bins = sizeof(stats->hist[0].g_hist) /
-				     sizeof(stats->hist[0].g_hist[0]);
-		for (int i = 0; i < num_bins; i++)
-			sum += bin[i] * (uint64_t)i, num += bin[i];
+		uint64_t sum = histogram->weighted_sum;
+		uint64_t num = histogram->cumulative[NUM_HISTOGRAM_BINS];
+		const int num_bins = NUM_HISTOGRAM_BINS;
 		// add .5 to reflect the mid-points of bins
 		double current_Y = sum / (double)num + .5;
 		double gain_ratio = reference_gain_ / current_gain;
@@ -99,7 +118,7 @@ void Lux::Process(StatisticsPtr &stats, Metadata *image_metadata)
 		}
 		// Overwrite the metadata here as well, so that downstream
 		// algorithms get the latest value.
-		image_metadata->Set("lux.status", status);
+		image_metadata->Set(tag::lux_status, status);
 	} else
 		LOG(RPiLux, Warning) << ": no device metadata";
 }
@@ -40,11 +40,22 @@ void Sdn::Read(boost::property_tree::ptree const &params)
 
 void Sdn::Initialise() {}
 
+MetadataAccess Sdn::PrepareAccess() const
+{
+	return { metadata_set(tag::noise_status),
+		 metadata_set(tag::denoise_status) };
+}
+
+MetadataAccess Sdn::ProcessAccess() const
+{
+	return {};
+}
+
 void Sdn::Prepare(Metadata *image_metadata)
 {
 	struct NoiseStatus noise_status = {};
 	noise_status.noise_slope = 3.0; // in case no metadata
-	if (image_metadata->Get("noise.status", noise_status) != 0)
+	if (image_metadata->Get(tag::noise_status, noise_status) != 0)
 		LOG(RPiSdn, Warning) << "no noise profile found";
 	LOG(RPiSdn, Debug)
 		<< "Noise profile: constant " << noise_status.noise_constant
@@ -54,7 +65,7 @@ void Sdn::Prepare(Metadata *image_metadata)
 	status.noise_slope = noise_status.noise_slope * deviation_;
 	status.strength = strength_;
 	status.mode = static_cast<std::underlying_type_t<DenoiseMode>>(mode_);
-	image_metadata->Set("denoise.status", status);
+	image_metadata->Set(tag::denoise_status, status);
 	LOG(RPiSdn, Debug)
 		<< "programmed constant " << status.noise_constant
 		<< " slope " << status.noise_slope
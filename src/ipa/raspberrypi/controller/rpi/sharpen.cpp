@@ -58,6 +58,16 @@ void Sharpen::SetStrength(double strength)
 	user_strength_ = std::max(0.0, strength);
 }
 
+MetadataAccess Sharpen::PrepareAccess() const
+{
+	return { MetadataSet(), metadata_set(tag::sharpen_status) };
+}
+
+MetadataAccess Sharpen::ProcessAccess() const
+{
+	return {};
+}
+
 void Sharpen::Prepare(Metadata *image_metadata)
 {
 	// The user_strength_ affects the algorithm's internal gain directly, but
@@ -74,7 +84,7 @@ void Sharpen::Prepare(Metadata *image_metadata)
 	status.limit = limit_ / mode_factor_ * user_strength_sqrt;
 	// Finally, report any application-supplied parameters that were used.
 	status.user_strength = user_strength_;
-	image_metadata->Set("sharpen.status", status);
+	image_metadata->Set(tag::sharpen_status, status);
 }
 
 // Register algorithm with the system.
@@ -22,6 +22,8 @@ public:
 	void Read(boost::property_tree::ptree const &params) override;
 	void SetStrength(double strength) override;
 	void Prepare(Metadata *image_metadata) override;
+	MetadataAccess PrepareAccess() const override;
+	MetadataAccess ProcessAccess() const override;
 
 private:
 	double threshold_;
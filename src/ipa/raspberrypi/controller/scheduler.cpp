@@ -0,0 +1,135 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * scheduler.cpp - dependency-aware task scheduler for control algorithms
+ */
+
+#include <assert.h>
+
+#include "scheduler.hpp"
+
+using namespace RPiController;
+
+Scheduler::Graph::Graph(std::vector<std::vector<unsigned int>> const &deps)
+	: dependents_(deps.size()), num_deps_(deps.size(), 0)
+{
+	for (unsigned int i = 0; i < deps.size(); i++) {
+		for (unsigned int dep : deps[i]) {
+			assert(dep < i);
+			dependents_[dep].push_back(i);
+			num_deps_[i]++;
+		}
+	}
+}
+
+Scheduler::Scheduler(unsigned int num_workers)
+	: abort_(false), graph_(nullptr), func_(nullptr), remaining_(0)
+{
+	for (unsigned int i = 0; i < num_workers; i++)
+		workers_.emplace_back(&Scheduler::workerFunc, this);
+}
+
+Scheduler::~Scheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		abort_ = true;
+	}
+	cv_.notify_all();
+
+	for (std::thread &worker : workers_)
+		worker.join();
+}
+
+void Scheduler::Run(Graph const &graph,
+		    std::function<void(unsigned int)> const &func)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	// The storage is reused across runs, and allocated only when a graph
+	// bigger than all previous ones is run.
+	graph_ = &graph;
+	func_ = &func;
+	pending_ = graph.num_deps_;
+	ready_.clear();
+	ready_.reserve(graph.Size());
+	remaining_ = graph.Size();
+	exception_ = nullptr;
+
+	// Push the tasks in reverse order, so that the calling thread, which
+	// pops from the back, starts with the first one.
+	for (unsigned int i = graph.Size(); i-- > 0;) {
+		if (!graph.num_deps_[i])
+			ready_.push_back(i);
+	}
+	if (ready_.size() > 1)
+		cv_.notify_all();
+
+	while (remaining_) {
+		if (ready_.empty())
+			cv_.wait(lock);
+		else
+			runTask(lock);
+	}
+
+	graph_ = nullptr;
+	func_ = nullptr;
+
+	if (exception_)
+		std::rethrow_exception(exception_);
+}
+
+void Scheduler::workerFunc()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	while (true) {
+		cv_.wait(lock, [&] { return abort_ || !ready_.empty(); });
+		if (abort_)
+			return;
+
+		runTask(lock);
+	}
+}
+
+// Run the next ready task, with the lock held on entry and on return.
+void Scheduler::runTask(std::unique_lock<std::mutex> &lock)
+{
+	unsigned int task = ready_.back();
+	ready_.pop_back();
+
+	// Once a task has failed, skip the tasks that haven't started yet.
+	bool skip = exception_ != nullptr;
+
+	lock.unlock();
+
+	std::exception_ptr exception;
+	if (!skip) {
+		try {
+			(*func_)(task);
+		} catch (...) {
+			exception = std::current_exception();
+		}
+	}
+
+	lock.lock();
+
+	if (exception && !exception_)
+		exception_ = exception;
+
+	unsigned int num_ready = 0;
+	for (unsigned int dependent : graph_->dependents_[task]) {
+		if (!--pending_[dependent]) {
+			ready_.push_back(dependent);
+			num_ready++;
+		}
+	}
+
+	// Wake up threads to pick the tasks made ready, and the thread in
+	// Run() when the last task completes.
+	if (!--remaining_ || num_ready > 1)
+		cv_.notify_all();
+	else if (num_ready)
+		cv_.notify_one();
+}
@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Limited
+ *
+ * scheduler.hpp - dependency-aware task scheduler for control algorithms
+ */
+#pragma once
+
+// The Scheduler runs graphs of tasks on a pool of worker threads. A task is
+// started only once all the tasks it depends on have completed, and the thread
+// calling Run() takes part in the work. Graphs are built once and run many
+// times, running them allocates no memory.
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace RPiController {
+
+class Scheduler
+{
+public:
+	class Graph
+	{
+	public:
+		Graph() = default;
+
+		// deps[i] lists the tasks that must complete before task i
+		// starts, and shall only refer to tasks with an index lower
+		// than i.
+		explicit Graph(std::vector<std::vector<unsigned int>> const &deps);
+
+		unsigned int Size() const { return num_deps_.size(); }
+
+	private:
+		friend class Scheduler;
+
+		std::vector<std::vector<unsigned int>> dependents_;
+		std::vector<unsigned int> num_deps_;
+	};
+
+	// Create a scheduler with num_workers threads in addition to the
+	// calling thread. Zero workers runs all tasks on the calling thread.
+	explicit Scheduler(unsigned int num_workers);
+	~Scheduler();
+
+	unsigned int NumWorkers() const { return workers_.size(); }
+
+	// Run func(i) for every task i of the graph, and wait for all tasks to
+	// complete. If a task throws, the tasks that haven't started yet are
+	// skipped, and the exception is rethrown once the running tasks have
+	// completed.
+	void Run(Graph const &graph, std::function<void(unsigned int)> const &func);
+
+private:
+	void workerFunc();
+	void runTask(std::unique_lock<std::mutex> &lock);
+
+	std::vector<std::thread> workers_;
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	bool abort_;
+
+	// State of the current run, protected by mutex_.
+	Graph const *graph_;
+	std::function<void(unsigned int)> const *func_;
+	std::vector<unsigned int> pending_;
+	std::vector<unsigned int> ready_;
+	unsigned int remaining_;
+	std::exception_ptr exception_;
+};
+
+} // namespace RPiController
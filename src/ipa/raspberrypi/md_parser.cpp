@@ -5,8 +5,8 @@
  * md_parser.cpp - image sensor metadata parsers
  */
 
+#include <algorithm>
 #include <assert.h>
-#include <map>
 #include <string.h>
 
 #include "md_parser.hpp"
@@ -33,7 +33,7 @@ MdParserSmia::ParseStatus MdParserSmia::findRegs(libcamera::Span<const uint8_t>
 {
 	assert(num_regs > 0);
 
-	if (buffer[0] != LINE_START)
+	if (buffer.empty() || buffer[0] != LINE_START)
 		return NO_LINE_START;
 
 	unsigned int current_offset = 1; // after the LINE_START
@@ -41,14 +41,22 @@ MdParserSmia::ParseStatus MdParserSmia::findRegs(libcamera::Span<const uint8_t>
 	unsigned int reg_num = 0, first_reg = 0;
 	ParseStatus retcode = PARSE_OK;
 	while (1) {
+		// Never read past the end of the buffer, the registers we were
+		// looking for are simply not all there.
+		if (current_offset >= buffer.size())
+			return MISSING_REGS;
 		int tag = buffer[current_offset++];
 		if ((bits_per_pixel_ == 10 &&
 		     (current_offset + 1 - current_line_start) % 5 == 0) ||
 		    (bits_per_pixel_ == 12 &&
 		     (current_offset + 1 - current_line_start) % 3 == 0)) {
+			if (current_offset >= buffer.size())
+				return MISSING_REGS;
 			if (buffer[current_offset++] != REG_SKIP)
 				return BAD_DUMMY;
 		}
+		if (current_offset >= buffer.size())
+			return MISSING_REGS;
 		int data_byte = buffer[current_offset++];
 		//printf("Offset %u, tag 0x%02x data_byte 0x%02x\n", current_offset-1, tag, data_byte);
 		if (tag == LINE_END_TAG) {
@@ -59,17 +67,16 @@ MdParserSmia::ParseStatus MdParserSmia::findRegs(libcamera::Span<const uint8_t>
 			if (line_length_bytes_) {
 				current_offset =
 					current_line_start + line_length_bytes_;
-				// Require whole line to be in the buffer (if buffer size set).
-				if (buffer.size() &&
-				    current_offset + line_length_bytes_ >
-					    buffer.size())
+				// Require whole line to be in the buffer.
+				if (current_offset + line_length_bytes_ >
+				    buffer.size())
 					return MISSING_REGS;
 				if (buffer[current_offset] != LINE_START)
 					return NO_LINE_START;
 			} else {
 				// allow a zero line length to mean "hunt for the next line"
-				while (buffer[current_offset] != LINE_START &&
-				       current_offset < buffer.size())
+				while (current_offset < buffer.size() &&
+				       buffer[current_offset] != LINE_START)
 					current_offset++;
 				if (current_offset == buffer.size())
 					return NO_LINE_START;
@@ -100,3 +107,79 @@ MdParserSmia::ParseStatus MdParserSmia::findRegs(libcamera::Span<const uint8_t>
 		}
 	}
 }
+
+MdParserSmia::MdParserSmia(std::initializer_list<uint32_t> regs)
+	: MdParser(), regs_(regs), offsets_(regs_.size(), -1), end_offset_(0),
+	  values_(regs_.size(), 0)
+{
+	assert(std::is_sorted(regs_.begin(), regs_.end()));
+}
+
+// Check that the offsets found previously still point at register values in
+// this buffer. Each value is preceded by its tag, possibly with a dummy byte
+// in between.
+bool MdParserSmia::offsetsValid(libcamera::Span<const uint8_t> buffer) const
+{
+	if (buffer.size() < end_offset_ || buffer[0] != LINE_START)
+		return false;
+
+	for (int offset : offsets_) {
+		if (offset == -1)
+			continue;
+		if (buffer[offset - 1] != REG_VALUE &&
+		    (buffer[offset - 1] != REG_SKIP || buffer[offset - 2] != REG_VALUE))
+			return false;
+	}
+
+	return true;
+}
+
+MdParser::Status MdParserSmia::Parse(libcamera::Span<const uint8_t> buffer)
+{
+	bool try_again = false;
+
+	if (buffer.empty())
+		return ERROR;
+
+	// If the layout appears to have changed, search for the registers again.
+	if (!reset_ && !offsetsValid(buffer))
+		reset_ = true;
+
+	if (reset_) {
+		assert(bits_per_pixel_);
+		std::fill(offsets_.begin(), offsets_.end(), -1);
+		int ret = static_cast<int>(findRegs(buffer, regs_.data(),
+						    offsets_.data(),
+						    regs_.size()));
+		// > 0 means "worked partially but parse again next time",
+		// < 0 means "hard error".
+		if (ret > 0)
+			try_again = true;
+		else if (ret < 0)
+			return ERROR;
+
+		int last = *std::max_element(offsets_.begin(), offsets_.end());
+		end_offset_ = last + 1;
+	}
+
+	for (unsigned int i = 0; i < offsets_.size(); i++) {
+		if (offsets_[i] != -1)
+			values_[i] = buffer[offsets_[i]];
+	}
+
+	// Re-parse next time if we were unhappy in some way.
+	reset_ = try_again;
+
+	return OK;
+}
+
+MdParser::Status MdParserSmia::GetRegValue(unsigned int index,
+					   unsigned int &value) const
+{
+	if (offsets_[index] == -1)
+		return NOTFOUND;
+
+	value = values_[index];
+
+	return OK;
+}
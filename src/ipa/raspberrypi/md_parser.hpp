@@ -6,7 +6,9 @@
  */
 #pragma once
 
+#include <initializer_list>
 #include <stdint.h>
+#include <vector>
 
 #include <libcamera/span.h>
 
@@ -66,7 +68,11 @@ public:
 		NOTFOUND = 1,
 		ERROR = 2
 	};
-	MdParser() : reset_(true) {}
+	MdParser()
+		: reset_(true), bits_per_pixel_(0), num_lines_(0),
+		  line_length_bytes_(0), buffer_size_bytes_(0)
+	{
+	}
 	virtual ~MdParser() = default;
 	void Reset() { reset_ = true; }
 	void SetBitsPerPixel(int bpp) { bits_per_pixel_ = bpp; }
@@ -91,11 +97,20 @@ protected:
 // however, it does provide the findRegs method which will prove useful and make
 // it easier to implement parsers for other SMIA-like sensors (see
 // md_parser_imx219.cpp for an example).
+//
+// Derived classes list the registers they want, and MdParserSmia::Parse() walks
+// the embedded data to find where their values lie only on the first frame
+// after a Reset(). The offsets are then kept, and subsequent frames just read
+// the values straight out of the buffer, after a quick check that the layout
+// still matches.
 
 class MdParserSmia : public MdParser
 {
 public:
-	MdParserSmia() : MdParser() {}
+	// The registers must be listed in address order.
+	MdParserSmia(std::initializer_list<uint32_t> regs);
+
+	Status Parse(libcamera::Span<const uint8_t> buffer) override;
 
 protected:
 	// Note that error codes > 0 are regarded as non-fatal; codes < 0
@@ -114,6 +129,20 @@ protected:
 	};
 	ParseStatus findRegs(libcamera::Span<const uint8_t> buffer, uint32_t regs[],
 			     int offsets[], unsigned int num_regs);
+	// Fetch the value of the register at the given index in the list
+	// passed to the constructor, as read by the last Parse().
+	Status GetRegValue(unsigned int index, unsigned int &value) const;
+
+private:
+	bool offsetsValid(libcamera::Span<const uint8_t> buffer) const;
+
+	std::vector<uint32_t> regs_;
+	// Offset of each register's value in the metadata block, or -1.
+	std::vector<int> offsets_;
+	// Offset one past the last value we read.
+	unsigned int end_offset_;
+	// Value of each register, once read from the metadata block.
+	std::vector<unsigned int> values_;
 };
 
 } // namespace RPi
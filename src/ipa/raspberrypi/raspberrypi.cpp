@@ -7,9 +7,12 @@
 
 #include <algorithm>
 #include <array>
+#include <deque>
 #include <fcntl.h>
 #include <math.h>
+#include <memory>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 
@@ -26,6 +29,7 @@
 
 #include "libcamera/internal/buffer.h"
 #include "libcamera/internal/log.h"
+#include "libcamera/internal/utils.h"
 
 #include <linux/bcm2835-isp.h>
 
@@ -44,6 +48,7 @@
 #include "denoise_algorithm.hpp"
 #include "denoise_status.h"
 #include "dpc_status.h"
+#include "focus_algorithm.hpp"
 #include "focus_status.h"
 #include "geq_status.h"
 #include "lux_status.h"
@@ -68,6 +73,17 @@ constexpr double defaultMaxFrameDuration = 1e6 / 0.01;
  */
 constexpr double controllerMinFrameDuration = 1e6 / 60.0;
 
+/*
+ * Relative change of the AGC regions luminance above which the scene is
+ * considered to change, and number of frames the scene has to stay static for
+ * before the adaptive frame rate mode lowers the frame rate.
+ */
+constexpr double sceneChangeThreshold = 0.04;
+constexpr unsigned int sceneStaticFrames = 30;
+
+/* Number of significant bits of the ISP statistics pixel values. */
+constexpr unsigned int statisticsPixelBits = 13;
+
 LOG_DEFINE_CATEGORY(IPARPI)
 
 class IPARPi : public ipa::RPi::IPARPiInterface
@@ -75,19 +91,22 @@ class IPARPi : public ipa::RPi::IPARPiInterface
 public:
 	IPARPi()
 		: controller_(), frameCount_(0), checkCount_(0), mistrustCount_(0),
-		  lastRunTimestamp_(0), lsTable_(nullptr), firstStart_(true)
+		  lastRunTimestamp_(0), lsTables_{}, lsTableIndex_(0),
+		  lsGeneration_(0), lsTableValid_(false), firstStart_(true),
+		  fastStartup_(false), adaptiveFrameRate_(false),
+		  frameRateBoost_(false), sceneLuma_{}, staticFrames_(0),
+		  statisticsEnable_(false)
 	{
 	}
 
 	~IPARPi()
 	{
-		if (lsTable_)
-			munmap(lsTable_, ipa::RPi::MaxLsGridSize);
+		unmapLsTables();
 	}
 
 	int init(const IPASettings &settings, ipa::RPi::SensorConfig *sensorConfig) override;
 	void start(const ControlList &controls, ipa::RPi::StartConfig *startConfig) override;
-	void stop() override {}
+	void stop() override;
 
 	int configure(const IPACameraSensorInfo &sensorInfo,
 		      const std::map<unsigned int, IPAStream> &streamConfig,
@@ -105,12 +124,17 @@ private:
 	bool validateSensorControls();
 	bool validateIspControls();
 	void queueRequest(const ControlList &controls);
+	void applyAlgorithmRates(const std::string &rates);
 	void returnEmbeddedBuffer(unsigned int bufferId);
 	void prepareISP(const ipa::RPi::ISPConfig &data);
-	void reportMetadata();
+	void reportMetadata(RPiController::Metadata &metadata);
+	void reportStatistics(unsigned int bufferId);
 	void fillDeviceStatus(const ControlList &sensorControls);
-	void processStats(unsigned int bufferId);
+	void processStats(unsigned int bufferId, RPiController::Metadata &metadata);
 	void applyFrameDurations(double minFrameDuration, double maxFrameDuration);
+	void startFastStartup();
+	void endFastStartup();
+	void updateSceneChange(const bcm2835_isp_stats *stats);
 	void applyAGC(const struct AgcStatus *agcStatus, ControlList &ctrls);
 	void applyAWB(const struct AwbStatus *awbStatus, ControlList &ctrls);
 	void applyDG(const struct AgcStatus *dgStatus, ControlList &ctrls);
@@ -122,12 +146,17 @@ private:
 	void applySharpen(const struct SharpenStatus *sharpenStatus, ControlList &ctrls);
 	void applyDPC(const struct DpcStatus *dpcStatus, ControlList &ctrls);
 	void applyLS(const struct AlscStatus *lsStatus, ControlList &ctrls);
+	void applyFocus(const struct FocusStatus *focusStatus);
 	void resampleTable(uint16_t dest[], double const src[12][16], int destW, int destH);
+	void setIspControl(uint32_t id, Span<const uint8_t> data, ControlList &ctrls);
+	void unmapLsTables();
 
 	std::map<unsigned int, MappedFrameBuffer> buffers_;
 
 	ControlInfoMap sensorCtrls_;
 	ControlInfoMap ispCtrls_;
+	ControlInfoMap lensCtrls_;
+	int32_t lensPosition_;
 	ControlList libcameraMetadata_;
 
 	/* Camera sensor params. */
@@ -159,9 +188,31 @@ private:
 	/* Do we run a Controller::process() for this frame? */
 	bool processPending_;
 
-	/* LS table allocation passed in from the pipeline handler. */
-	FileDescriptor lsTableHandle_;
-	void *lsTable_;
+	/*
+	 * When the pipeline handler processes several frames at a time, frames
+	 * may be prepared before the statistics of the previous ones arrive.
+	 * Keep the metadata of those previous frames until then, oldest first.
+	 */
+	struct PendingFrame {
+		RPiController::Metadata metadata;
+		bool processPending;
+	};
+	std::deque<PendingFrame> pendingFrames_;
+
+	/* LS table allocations passed in from the pipeline handler. */
+	std::array<FileDescriptor, 2> lsTableHandles_;
+	std::array<void *, 2> lsTables_;
+
+	/* ISP parameters last sent to the pipeline handler, by control ID. */
+	std::map<uint32_t, std::vector<uint8_t>> ispParams_;
+
+	/*
+	 * Index of the LS table last sent to the ISP, and generation of the
+	 * ALSC tables written to it.
+	 */
+	unsigned int lsTableIndex_;
+	uint32_t lsGeneration_;
+	bool lsTableValid_;
 
 	/* Distinguish the first camera start from others. */
 	bool firstStart_;
@@ -169,6 +220,27 @@ private:
 	/* Frame duration (1/fps) limits, given in microseconds. */
 	double minFrameDuration_;
 	double maxFrameDuration_;
+
+	/*
+	 * Whether the sensor runs at its highest frame rate during the hidden
+	 * startup frames, and the frame duration limits to restore afterwards.
+	 */
+	bool fastStartup_;
+	double userMinFrameDuration_;
+	double userMaxFrameDuration_;
+
+	/*
+	 * Adaptive frame rate mode state: the application hint, the relative
+	 * luminance of the AGC regions in the previous frame, and the number
+	 * of consecutive frames without scene change.
+	 */
+	bool adaptiveFrameRate_;
+	bool frameRateBoost_;
+	std::array<double, AGC_REGIONS> sceneLuma_;
+	unsigned int staticFrames_;
+
+	/* Report a digest of the ISP statistics in the request metadata. */
+	bool statisticsEnable_;
 };
 
 int IPARPi::init(const IPASettings &settings, ipa::RPi::SensorConfig *sensorConfig)
@@ -217,12 +289,19 @@ void IPARPi::start(const ControlList &controls, ipa::RPi::StartConfig *startConf
 
 	controller_.SwitchMode(mode_, &metadata);
 
+	/*
+	 * The ISP may have been reconfigured since the parameters were last
+	 * sent, send all of them again.
+	 */
+	ispParams_.clear();
+	lsTableValid_ = false;
+
 	/* SwitchMode may supply updated exposure/gain values to use. */
 	AgcStatus agcStatus;
 	agcStatus.shutter_time = 0.0;
 	agcStatus.analogue_gain = 0.0;
 
-	metadata.Get("agc.status", agcStatus);
+	metadata.Get(RPiController::tag::agc_status, agcStatus);
 	if (agcStatus.shutter_time != 0.0 && agcStatus.analogue_gain != 0.0) {
 		ControlList ctrls(sensorCtrls_);
 		applyAGC(&agcStatus, ctrls);
@@ -236,6 +315,7 @@ void IPARPi::start(const ControlList &controls, ipa::RPi::StartConfig *startConf
 	 */
 	frameCount_ = 0;
 	checkCount_ = 0;
+	pendingFrames_.clear();
 	if (firstStart_) {
 		dropFrameCount_ = helper_->HideFramesStartup();
 		mistrustCount_ = helper_->MistrustFramesStartup();
@@ -267,6 +347,9 @@ void IPARPi::start(const ControlList &controls, ipa::RPi::StartConfig *startConf
 
 		dropFrameCount_ = std::max({ dropFrameCount_, agcConvergenceFrames, awbConvergenceFrames });
 		LOG(IPARPI, Debug) << "Drop " << dropFrameCount_ << " frames on startup";
+
+		if (dropFrameCount_)
+			startFastStartup();
 	} else {
 		dropFrameCount_ = helper_->HideFramesModeSwitch();
 		mistrustCount_ = helper_->MistrustFramesModeSwitch();
@@ -276,6 +359,14 @@ void IPARPi::start(const ControlList &controls, ipa::RPi::StartConfig *startConf
 
 	firstStart_ = false;
 	lastRunTimestamp_ = 0;
+	sceneLuma_ = {};
+	staticFrames_ = 0;
+}
+
+void IPARPi::stop()
+{
+	if (fastStartup_)
+		endFastStartup();
 }
 
 void IPARPi::setMode(const IPACameraSensorInfo &sensorInfo)
@@ -329,7 +420,7 @@ int IPARPi::configure(const IPACameraSensorInfo &sensorInfo,
 		      const ipa::RPi::IPAConfig &ipaConfig,
 		      ControlList *controls)
 {
-	if (entityControls.size() != 2) {
+	if (entityControls.size() < 2) {
 		LOG(IPARPI, Error) << "No ISP or sensor controls found.";
 		return -1;
 	}
@@ -337,6 +428,10 @@ int IPARPi::configure(const IPACameraSensorInfo &sensorInfo,
 	sensorCtrls_ = entityControls.at(0);
 	ispCtrls_ = entityControls.at(1);
 
+	/* The lens controls are only present if the sensor has a focus lens. */
+	auto lens = entityControls.find(2);
+	lensCtrls_ = lens != entityControls.end() ? lens->second : ControlInfoMap();
+
 	if (!validateSensorControls()) {
 		LOG(IPARPI, Error) << "Sensor control validation failed.";
 		return -1;
@@ -355,30 +450,46 @@ int IPARPi::configure(const IPACameraSensorInfo &sensorInfo,
 
 	mode_.transform = static_cast<libcamera::Transform>(ipaConfig.transform);
 
-	/* Store the lens shading table pointer and handle if available. */
-	if (ipaConfig.lsTableHandle.isValid()) {
-		/* Remove any previous table, if there was one. */
-		if (lsTable_) {
-			munmap(lsTable_, ipa::RPi::MaxLsGridSize);
-			lsTable_ = nullptr;
-		}
-
-		/* Map the LS table buffer into user space. */
-		lsTableHandle_ = std::move(ipaConfig.lsTableHandle);
-		if (lsTableHandle_.isValid()) {
-			lsTable_ = mmap(nullptr, ipa::RPi::MaxLsGridSize, PROT_READ | PROT_WRITE,
-					MAP_SHARED, lsTableHandle_.fd(), 0);
-
-			if (lsTable_ == MAP_FAILED) {
+	/* Store the lens shading table pointers and handles if available. */
+	if (ipaConfig.lsTableHandle0.isValid() && ipaConfig.lsTableHandle1.isValid()) {
+		/* Remove any previous tables, if there were some. */
+		unmapLsTables();
+
+		/* Map the LS table buffers into user space. */
+		lsTableHandles_ = { ipaConfig.lsTableHandle0, ipaConfig.lsTableHandle1 };
+		for (unsigned int i = 0; i < lsTables_.size(); i++) {
+			void *table = mmap(nullptr, ipa::RPi::MaxLsGridSize,
+					   PROT_READ | PROT_WRITE, MAP_SHARED,
+					   lsTableHandles_[i].fd(), 0);
+			if (table == MAP_FAILED) {
 				LOG(IPARPI, Error) << "dmaHeap mmap failure for LS table.";
-				lsTable_ = nullptr;
+				unmapLsTables();
+				break;
 			}
+
+			lsTables_[i] = table;
 		}
 	}
 
 	/* Pass the camera mode to the CamHelper to setup algorithms. */
 	helper_->SetCameraMode(mode_);
 
+	/*
+	 * Tell the focus algorithm about the lens range. The lens position is
+	 * not known until the algorithm moves it, start from the default.
+	 */
+	RPiController::FocusAlgorithm *focus = dynamic_cast<RPiController::FocusAlgorithm *>(
+		controller_.GetAlgorithm("focus"));
+	auto lensCtrl = lensCtrls_.find(V4L2_CID_FOCUS_ABSOLUTE);
+	lensPosition_ = -1;
+	if (focus && lensCtrl != lensCtrls_.end()) {
+		const ControlInfo &info = lensCtrl->second;
+		focus->SetLensLimits(info.min().get<int32_t>(), info.max().get<int32_t>(),
+				     info.def().get<int32_t>());
+	} else if (focus) {
+		focus->SetLensLimits(0, 0, 0);
+	}
+
 	if (firstStart_) {
 		/* Supply initial values for frame durations. */
 		applyFrameDurations(defaultMinFrameDuration, defaultMaxFrameDuration);
@@ -418,12 +529,27 @@ void IPARPi::unmapBuffers(const std::vector<unsigned int> &ids)
 
 void IPARPi::signalStatReady(uint32_t bufferId)
 {
-	if (++checkCount_ != frameCount_) /* assert here? */
+	if (++checkCount_ + pendingFrames_.size() != frameCount_) /* assert here? */
 		LOG(IPARPI, Error) << "WARNING: Prepare/Process mismatch!!!";
-	if (processPending_ && frameCount_ > mistrustCount_)
-		processStats(bufferId);
 
-	reportMetadata();
+	if (!pendingFrames_.empty()) {
+		/* These statistics are for a frame older than the last prepared. */
+		PendingFrame frame = std::move(pendingFrames_.front());
+		pendingFrames_.pop_front();
+
+		if (frame.processPending && checkCount_ > mistrustCount_)
+			processStats(bufferId, frame.metadata);
+
+		reportMetadata(frame.metadata);
+	} else {
+		if (processPending_ && frameCount_ > mistrustCount_)
+			processStats(bufferId, rpiMetadata_);
+
+		reportMetadata(rpiMetadata_);
+	}
+
+	if (statisticsEnable_)
+		reportStatistics(bufferId);
 
 	statsMetadataComplete.emit(bufferId & ipa::RPi::MaskID, libcameraMetadata_);
 }
@@ -435,6 +561,21 @@ void IPARPi::signalQueueRequest(const ControlList &controls)
 
 void IPARPi::signalIspPrepare(const ipa::RPi::ISPConfig &data)
 {
+	/* The previous frame may still be waiting for its statistics. */
+	if (checkCount_ + pendingFrames_.size() < frameCount_)
+		pendingFrames_.push_back({ rpiMetadata_, processPending_ });
+
+	/*
+	 * Restore the frame duration limits early enough for the new vblank
+	 * to be applied by the end of the hidden startup frames.
+	 */
+	if (fastStartup_) {
+		int exposureDelay, gainDelay, vblankDelay;
+		helper_->GetDelays(exposureDelay, gainDelay, vblankDelay);
+		if (frameCount_ + vblankDelay >= dropFrameCount_)
+			endFastStartup();
+	}
+
 	/*
 	 * At start-up, or after a mode-switch, we may want to
 	 * avoid running the control algos for a few frames in case
@@ -447,39 +588,63 @@ void IPARPi::signalIspPrepare(const ipa::RPi::ISPConfig &data)
 	runIsp.emit(data.bayerBufferId & ipa::RPi::MaskID);
 }
 
-void IPARPi::reportMetadata()
-{
-	std::unique_lock<RPiController::Metadata> lock(rpiMetadata_);
+static const std::map<FocusState, int32_t> FocusStateTable = {
+	{ FOCUS_STATE_INACTIVE, controls::draft::AfStateInactive },
+	{ FOCUS_STATE_SCANNING, controls::draft::AfStatePassiveScan },
+	{ FOCUS_STATE_FOCUSED, controls::draft::AfStatePassiveFocused },
+	{ FOCUS_STATE_UNFOCUSED, controls::draft::AfStatePassiveUnfocused },
+};
 
+void IPARPi::reportMetadata(RPiController::Metadata &metadata)
+{
 	/*
 	 * Certain information about the current frame and how it will be
 	 * processed can be extracted and placed into the libcamera metadata
 	 * buffer, where an application could query it.
 	 */
-	DeviceStatus *deviceStatus = rpiMetadata_.GetLocked<DeviceStatus>("device.status");
+	DeviceStatus *deviceStatus = metadata.Find(RPiController::tag::device_status);
 	if (deviceStatus) {
 		libcameraMetadata_.set(controls::ExposureTime, deviceStatus->shutter_speed);
 		libcameraMetadata_.set(controls::AnalogueGain, deviceStatus->analogue_gain);
+
+		if (deviceStatus->frame_length) {
+			RPiController::CamHelper::FrameTiming timing =
+				helper_->GetFrameTiming(deviceStatus->exposure_end,
+							deviceStatus->shutter_speed,
+							deviceStatus->frame_length);
+			libcameraMetadata_.set(controls::FrameDuration,
+					       timing.frame_duration / 1000);
+			libcameraMetadata_.set(controls::draft::SensorRollingShutterSkew,
+					       timing.rolling_shutter_skew);
+		}
+
+		/*
+		 * Report the start of exposure of the first line of the image
+		 * rather than the frame start seen by the receiver.
+		 */
+		if (deviceStatus->exposure_start)
+			libcameraMetadata_.set(controls::SensorTimestamp,
+					       deviceStatus->exposure_start);
 	}
 
-	AgcStatus *agcStatus = rpiMetadata_.GetLocked<AgcStatus>("agc.status");
+	AgcStatus *agcStatus = metadata.Find(RPiController::tag::agc_status);
 	if (agcStatus) {
 		libcameraMetadata_.set(controls::AeLocked, agcStatus->locked);
 		libcameraMetadata_.set(controls::DigitalGain, agcStatus->digital_gain);
 	}
 
-	LuxStatus *luxStatus = rpiMetadata_.GetLocked<LuxStatus>("lux.status");
+	LuxStatus *luxStatus = metadata.Find(RPiController::tag::lux_status);
 	if (luxStatus)
 		libcameraMetadata_.set(controls::Lux, luxStatus->lux);
 
-	AwbStatus *awbStatus = rpiMetadata_.GetLocked<AwbStatus>("awb.status");
+	AwbStatus *awbStatus = metadata.Find(RPiController::tag::awb_status);
 	if (awbStatus) {
 		libcameraMetadata_.set(controls::ColourGains, { static_cast<float>(awbStatus->gain_r),
 								static_cast<float>(awbStatus->gain_b) });
 		libcameraMetadata_.set(controls::ColourTemperature, awbStatus->temperature_K);
 	}
 
-	BlackLevelStatus *blackLevelStatus = rpiMetadata_.GetLocked<BlackLevelStatus>("black_level.status");
+	BlackLevelStatus *blackLevelStatus = metadata.Find(RPiController::tag::black_level_status);
 	if (blackLevelStatus)
 		libcameraMetadata_.set(controls::SensorBlackLevels,
 				       { static_cast<int32_t>(blackLevelStatus->black_level_r),
@@ -487,7 +652,7 @@ void IPARPi::reportMetadata()
 					 static_cast<int32_t>(blackLevelStatus->black_level_g),
 					 static_cast<int32_t>(blackLevelStatus->black_level_b) });
 
-	FocusStatus *focusStatus = rpiMetadata_.GetLocked<FocusStatus>("focus.status");
+	FocusStatus *focusStatus = metadata.Find(RPiController::tag::focus_status);
 	if (focusStatus && focusStatus->num == 12) {
 		/*
 		 * We get a 4x3 grid of regions by default. Calculate the average
@@ -496,9 +661,13 @@ void IPARPi::reportMetadata()
 		 */
 		int32_t focusFoM = (focusStatus->focus_measures[5] + focusStatus->focus_measures[6]) / 2;
 		libcameraMetadata_.set(controls::FocusFoM, focusFoM);
+
+		if (focusStatus->lens_valid)
+			libcameraMetadata_.set(controls::draft::AfState,
+					       FocusStateTable.at(focusStatus->state));
 	}
 
-	CcmStatus *ccmStatus = rpiMetadata_.GetLocked<CcmStatus>("ccm.status");
+	CcmStatus *ccmStatus = metadata.Find(RPiController::tag::ccm_status);
 	if (ccmStatus) {
 		float m[9];
 		for (unsigned int i = 0; i < 9; i++)
@@ -854,17 +1023,73 @@ void IPARPi::queueRequest(const ControlList &controls)
 			break;
 		}
 
-		case controls::SCALER_CROP: {
-			/* We do nothing with this, but should avoid the warning below. */
+		case controls::SCALER_CROP:
+		case controls::EXPOSURE_BRACKET: {
+			/* Handled by the pipeline handler, avoid the warning below. */
 			break;
 		}
 
 		case controls::FRAME_DURATION_LIMITS: {
 			auto frameDurations = ctrl.second.get<Span<const int64_t>>();
+			if (fastStartup_) {
+				/* Apply the limits at the end of the startup. */
+				userMinFrameDuration_ = frameDurations[0];
+				userMaxFrameDuration_ = frameDurations[1];
+				break;
+			}
+
 			applyFrameDurations(frameDurations[0], frameDurations[1]);
 			break;
 		}
 
+		case controls::ALGORITHM_RATES: {
+			applyAlgorithmRates(ctrl.second.get<std::string>());
+
+			libcameraMetadata_.set(controls::AlgorithmRates,
+					       ctrl.second.get<std::string>());
+			break;
+		}
+
+		case controls::STATISTICS_ENABLE: {
+			statisticsEnable_ = ctrl.second.get<bool>();
+
+			libcameraMetadata_.set(controls::StatisticsEnable,
+					       statisticsEnable_);
+			break;
+		}
+
+		case controls::ADAPTIVE_FRAME_RATE: {
+			adaptiveFrameRate_ = ctrl.second.get<bool>();
+			staticFrames_ = 0;
+
+			libcameraMetadata_.set(controls::AdaptiveFrameRate,
+					       adaptiveFrameRate_);
+			break;
+		}
+
+		case controls::ADAPTIVE_FRAME_RATE_BOOST: {
+			frameRateBoost_ = ctrl.second.get<bool>();
+
+			libcameraMetadata_.set(controls::AdaptiveFrameRateBoost,
+					       frameRateBoost_);
+			break;
+		}
+
+		case controls::AF_TRIGGER: {
+			RPiController::FocusAlgorithm *focus = dynamic_cast<RPiController::FocusAlgorithm *>(
+				controller_.GetAlgorithm("focus"));
+			if (!focus) {
+				LOG(IPARPI, Warning)
+					<< "Could not set AF_TRIGGER - no focus algorithm";
+				break;
+			}
+
+			if (ctrl.second.get<int32_t>() == controls::draft::AfTriggerStart)
+				focus->TriggerScan();
+
+			break;
+		}
+
 		case controls::NOISE_REDUCTION_MODE: {
 			RPiController::DenoiseAlgorithm *sdn = dynamic_cast<RPiController::DenoiseAlgorithm *>(
 				controller_.GetAlgorithm("SDN"));
@@ -901,6 +1126,51 @@ void IPARPi::queueRequest(const ControlList &controls)
 	}
 }
 
+void IPARPi::applyAlgorithmRates(const std::string &rates)
+{
+	for (const std::string &entry : utils::split(rates, ",")) {
+		if (entry.empty())
+			continue;
+
+		size_t pos = entry.find(':');
+		if (pos == std::string::npos) {
+			LOG(IPARPI, Warning)
+				<< "Invalid algorithm rate \"" << entry << "\"";
+			continue;
+		}
+
+		std::string name = entry.substr(0, pos);
+		char *end;
+		unsigned long divider = strtoul(entry.c_str() + pos + 1, &end, 10);
+		if (pos + 1 == entry.size() || *end != '\0') {
+			LOG(IPARPI, Warning)
+				<< "Invalid algorithm rate \"" << entry << "\"";
+			continue;
+		}
+
+		RPiController::Algorithm *algo = controller_.GetAlgorithm(name);
+		if (!algo) {
+			LOG(IPARPI, Warning)
+				<< "Could not set rate of " << name
+				<< " - no such algorithm";
+			continue;
+		}
+
+		if (!divider) {
+			algo->Pause();
+			LOG(IPARPI, Debug) << "Algorithm " << name << " paused";
+			continue;
+		}
+
+		algo->SetRateDivider(divider);
+		algo->Resume();
+
+		LOG(IPARPI, Debug)
+			<< "Algorithm " << name << " running every "
+			<< divider << " frame(s)";
+	}
+}
+
 void IPARPi::returnEmbeddedBuffer(unsigned int bufferId)
 {
 	embeddedComplete.emit(bufferId & ipa::RPi::MaskID);
@@ -910,6 +1180,7 @@ void IPARPi::prepareISP(const ipa::RPi::ISPConfig &data)
 {
 	int64_t frameTimestamp = data.controls.get(controls::SensorTimestamp);
 	RPiController::Metadata lastMetadata;
+	std::unique_ptr<MappedBuffer::CpuAccess> embeddedAccess;
 	Span<uint8_t> embeddedBuffer;
 
 	lastMetadata = std::move(rpiMetadata_);
@@ -922,6 +1193,8 @@ void IPARPi::prepareISP(const ipa::RPi::ISPConfig &data)
 		 */
 		auto it = buffers_.find(data.embeddedBufferId);
 		ASSERT(it != buffers_.end());
+		embeddedAccess = std::make_unique<MappedBuffer::CpuAccess>(&it->second,
+									  PROT_READ);
 		embeddedBuffer = it->second.maps()[0];
 	}
 
@@ -930,6 +1203,20 @@ void IPARPi::prepareISP(const ipa::RPi::ISPConfig &data)
 	 * metadata, and may also do additional custom processing.
 	 */
 	helper_->Prepare(embeddedBuffer, rpiMetadata_);
+	embeddedAccess.reset();
+
+	/*
+	 * Now that the exposure time of the frame is known for sure, time its
+	 * exposure from the frame start timestamp.
+	 */
+	DeviceStatus *deviceStatus = rpiMetadata_.Find(RPiController::tag::device_status);
+	if (deviceStatus && frameTimestamp) {
+		RPiController::CamHelper::FrameTiming timing =
+			helper_->GetFrameTiming(frameTimestamp, deviceStatus->shutter_speed,
+						deviceStatus->frame_length);
+		deviceStatus->exposure_start = timing.exposure_start;
+		deviceStatus->exposure_end = timing.exposure_end;
+	}
 
 	/* Done with embedded data now, return to pipeline handler asap. */
 	if (data.embeddedBufferPresent)
@@ -957,46 +1244,43 @@ void IPARPi::prepareISP(const ipa::RPi::ISPConfig &data)
 
 	controller_.Prepare(&rpiMetadata_);
 
-	/* Lock the metadata buffer to avoid constant locks/unlocks. */
-	std::unique_lock<RPiController::Metadata> lock(rpiMetadata_);
-
-	AwbStatus *awbStatus = rpiMetadata_.GetLocked<AwbStatus>("awb.status");
+	AwbStatus *awbStatus = rpiMetadata_.Find(RPiController::tag::awb_status);
 	if (awbStatus)
 		applyAWB(awbStatus, ctrls);
 
-	CcmStatus *ccmStatus = rpiMetadata_.GetLocked<CcmStatus>("ccm.status");
+	CcmStatus *ccmStatus = rpiMetadata_.Find(RPiController::tag::ccm_status);
 	if (ccmStatus)
 		applyCCM(ccmStatus, ctrls);
 
-	AgcStatus *dgStatus = rpiMetadata_.GetLocked<AgcStatus>("agc.status");
+	AgcStatus *dgStatus = rpiMetadata_.Find(RPiController::tag::agc_status);
 	if (dgStatus)
 		applyDG(dgStatus, ctrls);
 
-	AlscStatus *lsStatus = rpiMetadata_.GetLocked<AlscStatus>("alsc.status");
+	AlscStatus *lsStatus = rpiMetadata_.Find(RPiController::tag::alsc_status);
 	if (lsStatus)
 		applyLS(lsStatus, ctrls);
 
-	ContrastStatus *contrastStatus = rpiMetadata_.GetLocked<ContrastStatus>("contrast.status");
+	ContrastStatus *contrastStatus = rpiMetadata_.Find(RPiController::tag::contrast_status);
 	if (contrastStatus)
 		applyGamma(contrastStatus, ctrls);
 
-	BlackLevelStatus *blackLevelStatus = rpiMetadata_.GetLocked<BlackLevelStatus>("black_level.status");
+	BlackLevelStatus *blackLevelStatus = rpiMetadata_.Find(RPiController::tag::black_level_status);
 	if (blackLevelStatus)
 		applyBlackLevel(blackLevelStatus, ctrls);
 
-	GeqStatus *geqStatus = rpiMetadata_.GetLocked<GeqStatus>("geq.status");
+	GeqStatus *geqStatus = rpiMetadata_.Find(RPiController::tag::geq_status);
 	if (geqStatus)
 		applyGEQ(geqStatus, ctrls);
 
-	DenoiseStatus *denoiseStatus = rpiMetadata_.GetLocked<DenoiseStatus>("denoise.status");
+	DenoiseStatus *denoiseStatus = rpiMetadata_.Find(RPiController::tag::denoise_status);
 	if (denoiseStatus)
 		applyDenoise(denoiseStatus, ctrls);
 
-	SharpenStatus *sharpenStatus = rpiMetadata_.GetLocked<SharpenStatus>("sharpen.status");
+	SharpenStatus *sharpenStatus = rpiMetadata_.Find(RPiController::tag::sharpen_status);
 	if (sharpenStatus)
 		applySharpen(sharpenStatus, ctrls);
 
-	DpcStatus *dpcStatus = rpiMetadata_.GetLocked<DpcStatus>("dpc.status");
+	DpcStatus *dpcStatus = rpiMetadata_.Find(RPiController::tag::dpc_status);
 	if (dpcStatus)
 		applyDPC(dpcStatus, ctrls);
 
@@ -1010,19 +1294,26 @@ void IPARPi::fillDeviceStatus(const ControlList &sensorControls)
 
 	int32_t exposureLines = sensorControls.get(V4L2_CID_EXPOSURE).get<int32_t>();
 	int32_t gainCode = sensorControls.get(V4L2_CID_ANALOGUE_GAIN).get<int32_t>();
+	int32_t vblank = sensorControls.get(V4L2_CID_VBLANK).get<int32_t>();
 
 	deviceStatus.shutter_speed = helper_->Exposure(exposureLines);
 	deviceStatus.analogue_gain = helper_->Gain(gainCode);
+	deviceStatus.frame_length = mode_.height + vblank;
 
 	LOG(IPARPI, Debug) << "Metadata - Exposure : "
 			   << deviceStatus.shutter_speed
 			   << " Gain : "
 			   << deviceStatus.analogue_gain;
 
-	rpiMetadata_.Set("device.status", deviceStatus);
+	rpiMetadata_.Set(RPiController::tag::device_status, deviceStatus);
 }
 
-void IPARPi::processStats(unsigned int bufferId)
+/*
+ * Report a normalised digest of the statistics of the frame, read directly
+ * from the statistics buffer. This is independent of the control algorithms,
+ * and thus runs even on the frames they skip.
+ */
+void IPARPi::reportStatistics(unsigned int bufferId)
 {
 	auto it = buffers_.find(bufferId);
 	if (it == buffers_.end()) {
@@ -1030,19 +1321,89 @@ void IPARPi::processStats(unsigned int bufferId)
 		return;
 	}
 
+	MappedBuffer::CpuAccess access(&it->second, PROT_READ);
 	Span<uint8_t> mem = it->second.maps()[0];
-	bcm2835_isp_stats *stats = reinterpret_cast<bcm2835_isp_stats *>(mem.data());
-	RPiController::StatisticsPtr statistics = std::make_shared<bcm2835_isp_stats>(*stats);
-	helper_->Process(statistics, rpiMetadata_);
-	controller_.Process(statistics, &rpiMetadata_);
+	const bcm2835_isp_stats *stats =
+		reinterpret_cast<const bcm2835_isp_stats *>(mem.data());
+
+	std::array<int32_t, NUM_HISTOGRAM_BINS> histogram;
+	std::copy(std::begin(stats->hist[0].g_hist),
+		  std::end(stats->hist[0].g_hist), histogram.begin());
+	libcameraMetadata_.set(controls::StatisticsHistogram, histogram);
+
+	constexpr float scale = 1.0f / (1 << statisticsPixelBits);
+	std::array<float, AWB_REGIONS * 3> zones;
+	for (unsigned int i = 0; i < AWB_REGIONS; i++) {
+		const bcm2835_isp_stats_region &region = stats->awb_stats[i];
+		float norm = region.counted ? scale / region.counted : 0.0f;
+
+		zones[i * 3] = region.r_sum * norm;
+		zones[i * 3 + 1] = region.g_sum * norm;
+		zones[i * 3 + 2] = region.b_sum * norm;
+	}
+	libcameraMetadata_.set(controls::StatisticsZoneGrid,
+			       Size(DEFAULT_AWB_REGIONS_X, DEFAULT_AWB_REGIONS_Y));
+	libcameraMetadata_.set(controls::StatisticsZoneMeans, zones);
+
+	/* Use the same filter output as the focus algorithm. */
+	std::array<float, FOCUS_REGIONS> focus;
+	for (unsigned int i = 0; i < FOCUS_REGIONS; i++) {
+		const bcm2835_isp_stats_focus &region = stats->focus_stats[i];
+		focus[i] = region.contrast_val_num[1][1]
+			 ? static_cast<float>(region.contrast_val[1][1]) /
+			   region.contrast_val_num[1][1]
+			 : 0.0f;
+	}
+	libcameraMetadata_.set(controls::StatisticsFocus, focus);
+}
+
+void IPARPi::processStats(unsigned int bufferId,
+			  RPiController::Metadata &metadata)
+{
+	auto it = buffers_.find(bufferId);
+	if (it == buffers_.end()) {
+		LOG(IPARPI, Error) << "Could not find stats buffer!";
+		return;
+	}
+
+	RPiController::StatisticsPtr statistics;
+	{
+		MappedBuffer::CpuAccess access(&it->second, PROT_READ);
+		Span<uint8_t> mem = it->second.maps()[0];
+		bcm2835_isp_stats *stats = reinterpret_cast<bcm2835_isp_stats *>(mem.data());
+		statistics = std::make_shared<bcm2835_isp_stats>(*stats);
+	}
+	helper_->Process(statistics, metadata);
+	controller_.Process(statistics, &metadata);
+
+	if (adaptiveFrameRate_)
+		updateSceneChange(statistics.get());
 
 	struct AgcStatus agcStatus;
-	if (rpiMetadata_.Get("agc.status", agcStatus) == 0) {
+	if (metadata.Get(RPiController::tag::agc_status, agcStatus) == 0) {
 		ControlList ctrls(sensorCtrls_);
 		applyAGC(&agcStatus, ctrls);
 
 		setDelayedControls.emit(ctrls);
 	}
+
+	struct FocusStatus focusStatus;
+	if (metadata.Get(RPiController::tag::focus_status, focusStatus) == 0)
+		applyFocus(&focusStatus);
+}
+
+void IPARPi::applyFocus(const struct FocusStatus *focusStatus)
+{
+	if (!focusStatus->lens_valid || focusStatus->lens_position == lensPosition_)
+		return;
+
+	LOG(IPARPI, Debug) << "Applying lens position " << focusStatus->lens_position;
+
+	ControlList ctrls(lensCtrls_);
+	ctrls.set(V4L2_CID_FOCUS_ABSOLUTE, focusStatus->lens_position);
+	setLensControls.emit(ctrls);
+
+	lensPosition_ = focusStatus->lens_position;
 }
 
 void IPARPi::applyAWB(const struct AwbStatus *awbStatus, ControlList &ctrls)
@@ -1091,13 +1452,86 @@ void IPARPi::applyFrameDurations(double minFrameDuration, double maxFrameDuratio
 	agc->SetMaxShutter(maxShutter);
 }
 
+/*
+ * The AGC and AWB converge during the frames hidden at startup. Run the sensor
+ * at the highest frame rate of the mode meanwhile, for the convergence to take
+ * as little time as possible. The AGC total exposure carries over when the
+ * frame duration limits are restored, only its split between the shutter time
+ * and the gain changes.
+ */
+void IPARPi::startFastStartup()
+{
+	const double minSensorFrameDuration = 1e-3 * mode_.min_frame_length * mode_.line_length;
+
+	userMinFrameDuration_ = minFrameDuration_;
+	userMaxFrameDuration_ = maxFrameDuration_;
+	applyFrameDurations(minSensorFrameDuration, minSensorFrameDuration);
+	fastStartup_ = true;
+
+	LOG(IPARPI, Debug) << "Fast startup at frame duration "
+			   << minFrameDuration_ << "us";
+}
+
+void IPARPi::endFastStartup()
+{
+	fastStartup_ = false;
+	applyFrameDurations(userMinFrameDuration_, userMaxFrameDuration_);
+}
+
+/*
+ * Measure how much the scene changes between consecutive frames, for the
+ * adaptive frame rate mode. The luminance of each AGC region is normalised by
+ * the average luminance of the frame, so that exposure and gain changes don't
+ * count as scene changes, and compared with the previous frame.
+ */
+void IPARPi::updateSceneChange(const bcm2835_isp_stats *stats)
+{
+	std::array<double, AGC_REGIONS> luma;
+	double total = 0.0;
+
+	for (unsigned int i = 0; i < AGC_REGIONS; i++) {
+		const bcm2835_isp_stats_region &region = stats->agc_stats[i];
+		luma[i] = region.counted
+			? static_cast<double>(region.g_sum) / region.counted : 0.0;
+		total += luma[i];
+	}
+
+	if (!total)
+		return;
+
+	double change = 0.0;
+	for (unsigned int i = 0; i < AGC_REGIONS; i++) {
+		luma[i] *= AGC_REGIONS / total;
+		change += std::abs(luma[i] - sceneLuma_[i]);
+	}
+	change /= AGC_REGIONS;
+
+	if (change > sceneChangeThreshold)
+		staticFrames_ = 0;
+	else if (staticFrames_ < sceneStaticFrames)
+		staticFrames_++;
+
+	sceneLuma_ = luma;
+}
+
 void IPARPi::applyAGC(const struct AgcStatus *agcStatus, ControlList &ctrls)
 {
 	int32_t gainCode = helper_->GainCode(agcStatus->analogue_gain);
 
+	/*
+	 * In adaptive frame rate mode, lower the frame rate to the maximum
+	 * frame duration while the scene is static, and raise it back at the
+	 * first scene change or when the application asks for it. Longer
+	 * exposures still extend the frame duration up to the maximum.
+	 */
+	double minFrameDuration = minFrameDuration_;
+	if (adaptiveFrameRate_ && !fastStartup_ && !frameRateBoost_ &&
+	    staticFrames_ >= sceneStaticFrames)
+		minFrameDuration = maxFrameDuration_;
+
 	/* GetVBlanking might clip exposure time to the fps limits. */
 	double exposure = agcStatus->shutter_time;
-	int32_t vblanking = helper_->GetVBlanking(exposure, minFrameDuration_,
+	int32_t vblanking = helper_->GetVBlanking(exposure, minFrameDuration,
 						  maxFrameDuration_);
 	int32_t exposureLines = helper_->ExposureLines(exposure);
 
@@ -1125,7 +1559,7 @@ void IPARPi::applyDG(const struct AgcStatus *dgStatus, ControlList &ctrls)
 
 void IPARPi::applyCCM(const struct CcmStatus *ccmStatus, ControlList &ctrls)
 {
-	bcm2835_isp_custom_ccm ccm;
+	bcm2835_isp_custom_ccm ccm = {};
 
 	for (int i = 0; i < 9; i++) {
 		ccm.ccm.ccm[i / 3][i % 3].den = 1000;
@@ -1135,14 +1569,14 @@ void IPARPi::applyCCM(const struct CcmStatus *ccmStatus, ControlList &ctrls)
 	ccm.enabled = 1;
 	ccm.ccm.offsets[0] = ccm.ccm.offsets[1] = ccm.ccm.offsets[2] = 0;
 
-	ControlValue c(Span<const uint8_t>{ reinterpret_cast<uint8_t *>(&ccm),
-					    sizeof(ccm) });
-	ctrls.set(V4L2_CID_USER_BCM2835_ISP_CC_MATRIX, c);
+	setIspControl(V4L2_CID_USER_BCM2835_ISP_CC_MATRIX,
+		      { reinterpret_cast<uint8_t *>(&ccm), sizeof(ccm) },
+		      ctrls);
 }
 
 void IPARPi::applyGamma(const struct ContrastStatus *contrastStatus, ControlList &ctrls)
 {
-	struct bcm2835_isp_gamma gamma;
+	struct bcm2835_isp_gamma gamma = {};
 
 	gamma.enabled = 1;
 	for (int i = 0; i < CONTRAST_NUM_POINTS; i++) {
@@ -1150,44 +1584,44 @@ void IPARPi::applyGamma(const struct ContrastStatus *contrastStatus, ControlList
 		gamma.y[i] = contrastStatus->points[i].y;
 	}
 
-	ControlValue c(Span<const uint8_t>{ reinterpret_cast<uint8_t *>(&gamma),
-					    sizeof(gamma) });
-	ctrls.set(V4L2_CID_USER_BCM2835_ISP_GAMMA, c);
+	setIspControl(V4L2_CID_USER_BCM2835_ISP_GAMMA,
+		      { reinterpret_cast<uint8_t *>(&gamma), sizeof(gamma) },
+		      ctrls);
 }
 
 void IPARPi::applyBlackLevel(const struct BlackLevelStatus *blackLevelStatus, ControlList &ctrls)
 {
-	bcm2835_isp_black_level blackLevel;
+	bcm2835_isp_black_level blackLevel = {};
 
 	blackLevel.enabled = 1;
 	blackLevel.black_level_r = blackLevelStatus->black_level_r;
 	blackLevel.black_level_g = blackLevelStatus->black_level_g;
 	blackLevel.black_level_b = blackLevelStatus->black_level_b;
 
-	ControlValue c(Span<const uint8_t>{ reinterpret_cast<uint8_t *>(&blackLevel),
-					    sizeof(blackLevel) });
-	ctrls.set(V4L2_CID_USER_BCM2835_ISP_BLACK_LEVEL, c);
+	setIspControl(V4L2_CID_USER_BCM2835_ISP_BLACK_LEVEL,
+		      { reinterpret_cast<uint8_t *>(&blackLevel), sizeof(blackLevel) },
+		      ctrls);
 }
 
 void IPARPi::applyGEQ(const struct GeqStatus *geqStatus, ControlList &ctrls)
 {
-	bcm2835_isp_geq geq;
+	bcm2835_isp_geq geq = {};
 
 	geq.enabled = 1;
 	geq.offset = geqStatus->offset;
 	geq.slope.den = 1000;
 	geq.slope.num = 1000 * geqStatus->slope;
 
-	ControlValue c(Span<const uint8_t>{ reinterpret_cast<uint8_t *>(&geq),
-					    sizeof(geq) });
-	ctrls.set(V4L2_CID_USER_BCM2835_ISP_GEQ, c);
+	setIspControl(V4L2_CID_USER_BCM2835_ISP_GEQ,
+		      { reinterpret_cast<uint8_t *>(&geq), sizeof(geq) },
+		      ctrls);
 }
 
 void IPARPi::applyDenoise(const struct DenoiseStatus *denoiseStatus, ControlList &ctrls)
 {
 	using RPiController::DenoiseMode;
 
-	bcm2835_isp_denoise denoise;
+	bcm2835_isp_denoise denoise = {};
 	DenoiseMode mode = static_cast<DenoiseMode>(denoiseStatus->mode);
 
 	denoise.enabled = mode != DenoiseMode::Off;
@@ -1198,7 +1632,7 @@ void IPARPi::applyDenoise(const struct DenoiseStatus *denoiseStatus, ControlList
 	denoise.strength.den = 1000;
 
 	/* Set the CDN mode to match the SDN operating mode. */
-	bcm2835_isp_cdn cdn;
+	bcm2835_isp_cdn cdn = {};
 	switch (mode) {
 	case DenoiseMode::ColourFast:
 		cdn.enabled = 1;
@@ -1212,18 +1646,16 @@ void IPARPi::applyDenoise(const struct DenoiseStatus *denoiseStatus, ControlList
 		cdn.enabled = 0;
 	}
 
-	ControlValue c(Span<const uint8_t>{ reinterpret_cast<uint8_t *>(&denoise),
-					    sizeof(denoise) });
-	ctrls.set(V4L2_CID_USER_BCM2835_ISP_DENOISE, c);
-
-	c = ControlValue(Span<const uint8_t>{ reinterpret_cast<uint8_t *>(&cdn),
-					      sizeof(cdn) });
-	ctrls.set(V4L2_CID_USER_BCM2835_ISP_CDN, c);
+	setIspControl(V4L2_CID_USER_BCM2835_ISP_DENOISE,
+		      { reinterpret_cast<uint8_t *>(&denoise), sizeof(denoise) },
+		      ctrls);
+	setIspControl(V4L2_CID_USER_BCM2835_ISP_CDN,
+		      { reinterpret_cast<uint8_t *>(&cdn), sizeof(cdn) }, ctrls);
 }
 
 void IPARPi::applySharpen(const struct SharpenStatus *sharpenStatus, ControlList &ctrls)
 {
-	bcm2835_isp_sharpen sharpen;
+	bcm2835_isp_sharpen sharpen = {};
 
 	sharpen.enabled = 1;
 	sharpen.threshold.num = 1000 * sharpenStatus->threshold;
@@ -1233,21 +1665,21 @@ void IPARPi::applySharpen(const struct SharpenStatus *sharpenStatus, ControlList
 	sharpen.limit.num = 1000 * sharpenStatus->limit;
 	sharpen.limit.den = 1000;
 
-	ControlValue c(Span<const uint8_t>{ reinterpret_cast<uint8_t *>(&sharpen),
-					    sizeof(sharpen) });
-	ctrls.set(V4L2_CID_USER_BCM2835_ISP_SHARPEN, c);
+	setIspControl(V4L2_CID_USER_BCM2835_ISP_SHARPEN,
+		      { reinterpret_cast<uint8_t *>(&sharpen), sizeof(sharpen) },
+		      ctrls);
 }
 
 void IPARPi::applyDPC(const struct DpcStatus *dpcStatus, ControlList &ctrls)
 {
-	bcm2835_isp_dpc dpc;
+	bcm2835_isp_dpc dpc = {};
 
 	dpc.enabled = 1;
 	dpc.strength = dpcStatus->strength;
 
-	ControlValue c(Span<const uint8_t>{ reinterpret_cast<uint8_t *>(&dpc),
-					    sizeof(dpc) });
-	ctrls.set(V4L2_CID_USER_BCM2835_ISP_DPC, c);
+	setIspControl(V4L2_CID_USER_BCM2835_ISP_DPC,
+		      { reinterpret_cast<uint8_t *>(&dpc), sizeof(dpc) },
+		      ctrls);
 }
 
 void IPARPi::applyLS(const struct AlscStatus *lsStatus, ControlList &ctrls)
@@ -1280,33 +1712,78 @@ void IPARPi::applyLS(const struct AlscStatus *lsStatus, ControlList &ctrls)
 		.grid_width = w,
 		.grid_stride = w,
 		.grid_height = h,
-		/* .dmabuf will be filled in by pipeline handler. */
+		/* .dmabuf is set to the table index below. */
 		.dmabuf = 0,
 		.ref_transform = 0,
 		.corner_sampled = 1,
 		.gain_format = GAIN_FORMAT_U4P10
 	};
 
-	if (!lsTable_ || w * h * 4 * sizeof(uint16_t) > ipa::RPi::MaxLsGridSize) {
+	if (!lsTables_[0] || w * h * 4 * sizeof(uint16_t) > ipa::RPi::MaxLsGridSize) {
 		LOG(IPARPI, Error) << "Do not have a correctly allocate lens shading table!";
 		return;
 	}
 
-	if (lsStatus) {
-		/* Format will be u4.10 */
-		uint16_t *grid = static_cast<uint16_t *>(lsTable_);
+	/*
+	 * The ISP only reads the table when the control is set, so both are
+	 * skipped when ALSC hasn't produced new tables since they were last
+	 * sent.
+	 */
+	if (lsTableValid_ && lsStatus->generation == lsGeneration_)
+		return;
 
-		resampleTable(grid, lsStatus->r, w, h);
-		resampleTable(grid + w * h, lsStatus->g, w, h);
-		std::memcpy(grid + 2 * w * h, grid + w * h, w * h * sizeof(uint16_t));
-		resampleTable(grid + 3 * w * h, lsStatus->b, w, h);
-	}
+	/*
+	 * Write the new tables to the buffer the ISP isn't using, and switch
+	 * the ISP to it with the control. The control carries the index of
+	 * the buffer, which the pipeline handler replaces with its dmabuf.
+	 */
+	unsigned int index = lsTableValid_ ? lsTableIndex_ ^ 1 : 0;
+
+	/* Format will be u4.10 */
+	uint16_t *grid = static_cast<uint16_t *>(lsTables_[index]);
+
+	resampleTable(grid, lsStatus->r, w, h);
+	resampleTable(grid + w * h, lsStatus->g, w, h);
+	std::memcpy(grid + 2 * w * h, grid + w * h, w * h * sizeof(uint16_t));
+	resampleTable(grid + 3 * w * h, lsStatus->b, w, h);
+
+	ls.dmabuf = index;
+	lsTableIndex_ = index;
+	lsGeneration_ = lsStatus->generation;
+	lsTableValid_ = true;
 
 	ControlValue c(Span<const uint8_t>{ reinterpret_cast<uint8_t *>(&ls),
 					    sizeof(ls) });
 	ctrls.set(V4L2_CID_USER_BCM2835_ISP_LENS_SHADING, c);
 }
 
+void IPARPi::unmapLsTables()
+{
+	for (void *&table : lsTables_) {
+		if (table)
+			munmap(table, ipa::RPi::MaxLsGridSize);
+		table = nullptr;
+	}
+
+	lsTableValid_ = false;
+}
+
+void IPARPi::setIspControl(uint32_t id, Span<const uint8_t> data, ControlList &ctrls)
+{
+	/*
+	 * Most ISP blocks keep the same parameters from frame to frame. Only
+	 * send the ones that differ from what the ISP was last given, the
+	 * others stay programmed in the ISP.
+	 */
+	std::vector<uint8_t> &params = ispParams_[id];
+	if (params.size() == data.size() &&
+	    std::equal(data.begin(), data.end(), params.begin()))
+		return;
+
+	params.assign(data.begin(), data.end());
+	ctrls.set(id, ControlValue(data));
+}
+
 /*
  * Resamples a 16x12 table with central sampling to destW x destH with corner
  * sampling.
@@ -0,0 +1,145 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipa_context.cpp - RkISP1 IPA Context
+ */
+
+#include "ipa_context.h"
+
+/**
+ * \file ipa_context.h
+ * \brief Context and state information shared between the algorithms
+ */
+
+namespace libcamera {
+
+namespace ipa::rkisp1 {
+
+/**
+ * \struct IPASessionConfiguration
+ * \brief Session configuration for the IPA module
+ *
+ * The session configuration contains all IPA configuration parameters that
+ * remain constant during the capture session, from IPA module start to stop.
+ *
+ * \var IPASessionConfiguration::sensor
+ * \brief Limits of the camera sensor controls
+ *
+ * \var IPASessionConfiguration::sensor.minExposure
+ * \brief Minimum exposure time, in lines
+ *
+ * \var IPASessionConfiguration::sensor.maxExposure
+ * \brief Maximum exposure time, in lines
+ *
+ * \var IPASessionConfiguration::sensor.minGain
+ * \brief Minimum analogue gain code
+ *
+ * \var IPASessionConfiguration::sensor.maxGain
+ * \brief Maximum analogue gain code
+ *
+ * \var IPASessionConfiguration::sensor.outputSize
+ * \brief Size of the sensor output, used as the statistics measurement window
+ */
+
+/**
+ * \struct IPAActiveState
+ * \brief The active state of the IPA algorithms
+ *
+ * The active state contains the latest results and settings of the
+ * algorithms, carried from one frame to the next.
+ *
+ * \var IPAActiveState::sensor
+ * \brief The sensor controls computed by the AGC
+ *
+ * \var IPAActiveState::sensor.exposure
+ * \brief Exposure time, in lines
+ *
+ * \var IPAActiveState::sensor.gain
+ * \brief Analogue gain code
+ *
+ * \var IPAActiveState::agc
+ * \brief The AGC settings
+ *
+ * \var IPAActiveState::agc.autoEnabled
+ * \brief Whether the automatic exposure control is enabled
+ *
+ * \var IPAActiveState::agc.filteredExposure
+ * \brief The filtered total exposure, in lines multiplied by the analogue
+ * gain relative to the minimum gain code
+ *
+ * \var IPAActiveState::awb
+ * \brief The AWB results
+ *
+ * \var IPAActiveState::awb.gains
+ * \brief The white balance gains to apply to the next frames
+ *
+ * \var IPAActiveState::awb.gains.red
+ * \brief The white balance gain of the red channel
+ *
+ * \var IPAActiveState::awb.gains.blue
+ * \brief The white balance gain of the blue channel
+ */
+
+/**
+ * \struct IPAFrameContext
+ * \brief Per-frame context for the RkISP1 algorithms
+ *
+ * \var IPAFrameContext::sensor
+ * \brief The sensor controls applied to the frame
+ *
+ * The values are reported by the pipeline handler along with the statistics,
+ * and default to the active state ones when unknown.
+ *
+ * \var IPAFrameContext::sensor.exposure
+ * \brief Exposure time, in lines
+ *
+ * \var IPAFrameContext::sensor.gain
+ * \brief Analogue gain code
+ *
+ * \var IPAFrameContext::agc
+ * \brief The AGC controls and results for the frame
+ *
+ * \var IPAFrameContext::agc.autoEnabled
+ * \brief The value of the AeEnable control of the request
+ *
+ * \var IPAFrameContext::agc.updateEnable
+ * \brief Whether the request contains the AeEnable control
+ *
+ * \var IPAFrameContext::agc.updateControls
+ * \brief Whether the statistics of the frame led to new sensor controls
+ *
+ * \var IPAFrameContext::agc.state
+ * \brief The AE state for the frame, 0 if unknown, 1 if converging and 2 if
+ * locked
+ *
+ * \var IPAFrameContext::awb
+ * \brief The AWB settings applied to the frame
+ *
+ * \var IPAFrameContext::awb.gains
+ * \brief The white balance gains programmed in the parameters of the frame
+ *
+ * \var IPAFrameContext::awb.gains.red
+ * \brief The white balance gain of the red channel
+ *
+ * \var IPAFrameContext::awb.gains.blue
+ * \brief The white balance gain of the blue channel
+ */
+
+/**
+ * \struct IPAContext
+ * \brief Global IPA context data shared between all algorithms
+ *
+ * \var IPAContext::configuration
+ * \brief The IPA session configuration, immutable during the session
+ *
+ * \var IPAContext::activeState
+ * \brief The active state of the algorithms
+ *
+ * \var IPAContext::frameContexts
+ * \brief The contexts of the frames in flight
+ */
+
+} /* namespace ipa::rkisp1 */
+
+} /* namespace libcamera */
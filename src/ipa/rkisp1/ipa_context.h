@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipa_context.h - RkISP1 IPA Context
+ */
+#ifndef __LIBCAMERA_RKISP1_IPA_CONTEXT_H__
+#define __LIBCAMERA_RKISP1_IPA_CONTEXT_H__
+
+#include <stdint.h>
+
+#include <libcamera/geometry.h>
+
+#include "libipa/fc_queue.h"
+
+namespace libcamera {
+
+namespace ipa::rkisp1 {
+
+struct IPASessionConfiguration {
+	struct {
+		uint32_t minExposure;
+		uint32_t maxExposure;
+		uint32_t minGain;
+		uint32_t maxGain;
+		Size outputSize;
+	} sensor;
+};
+
+struct IPAActiveState {
+	struct {
+		uint32_t exposure;
+		uint32_t gain;
+	} sensor;
+
+	struct {
+		bool autoEnabled;
+		double filteredExposure;
+	} agc;
+
+	struct {
+		struct {
+			double red;
+			double blue;
+		} gains;
+	} awb;
+};
+
+struct IPAFrameContext : public FrameContext {
+	struct {
+		uint32_t exposure;
+		uint32_t gain;
+	} sensor;
+
+	struct {
+		bool autoEnabled;
+		bool updateEnable;
+		bool updateControls;
+		unsigned int state;
+	} agc;
+
+	struct {
+		struct {
+			double red;
+			double blue;
+		} gains;
+	} awb;
+};
+
+struct IPAContext {
+	IPASessionConfiguration configuration;
+	IPAActiveState activeState;
+
+	FCQueue<IPAFrameContext> frameContexts;
+};
+
+} /* namespace ipa::rkisp1 */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_RKISP1_IPA_CONTEXT_H__ */
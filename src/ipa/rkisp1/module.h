@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * module.h - RkISP1 IPA Module
+ */
+#ifndef __LIBCAMERA_RKISP1_MODULE_H__
+#define __LIBCAMERA_RKISP1_MODULE_H__
+
+#include <linux/rkisp1-config.h>
+
+#include <libcamera/ipa/core_ipa_interface.h>
+
+#include "libipa/module.h"
+
+#include "ipa_context.h"
+
+namespace libcamera {
+
+namespace ipa::rkisp1 {
+
+using Module = ipa::Module<IPAContext, IPAFrameContext, IPACameraSensorInfo,
+			   rkisp1_params_cfg, rkisp1_stat_buffer>;
+
+} /* namespace ipa::rkisp1 */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_RKISP1_MODULE_H__ */
@@ -6,7 +6,6 @@
  */
 
 #include <algorithm>
-#include <math.h>
 #include <queue>
 #include <stdint.h>
 #include <string.h>
@@ -24,6 +23,11 @@
 
 #include "libcamera/internal/log.h"
 
+#include "ipa_context.h"
+#include "module.h"
+#include "rkisp1_agc.h"
+#include "rkisp1_awb.h"
+
 namespace libcamera {
 
 LOG_DEFINE_CATEGORY(IPARkISP1)
@@ -35,7 +39,7 @@ class IPARkISP1 : public IPARkISP1Interface
 public:
 	int init(unsigned int hwRevision) override;
 	int start() override;
-	void stop() override {}
+	void stop() override;
 
 	int configure(const IPACameraSensorInfo &info,
 		      const std::map<uint32_t, IPAStream> &streamConfig,
@@ -48,24 +52,21 @@ private:
 	void queueRequest(unsigned int frame, rkisp1_params_cfg *params,
 			  const ControlList &controls);
 	void updateStatistics(unsigned int frame,
-			      const rkisp1_stat_buffer *stats);
+			      const rkisp1_stat_buffer *stats,
+			      const ControlList &sensorControls);
 
 	void setControls(unsigned int frame);
-	void metadataReady(unsigned int frame, unsigned int aeState);
+	void metadataReady(unsigned int frame, const IPAFrameContext &frameContext);
 
 	std::map<unsigned int, FrameBuffer> buffers_;
 	std::map<unsigned int, void *> buffersMemory_;
 
 	ControlInfoMap ctrls_;
 
-	/* Camera sensor controls. */
-	bool autoExposure_;
-	uint32_t exposure_;
-	uint32_t minExposure_;
-	uint32_t maxExposure_;
-	uint32_t gain_;
-	uint32_t minGain_;
-	uint32_t maxGain_;
+	/* The algorithms, run in order on each frame */
+	Module module_;
+	/* Context shared by the algorithms */
+	IPAContext context_;
 };
 
 int IPARkISP1::init(unsigned int hwRevision)
@@ -89,13 +90,21 @@ int IPARkISP1::start()
 	return 0;
 }
 
+void IPARkISP1::stop()
+{
+	LOG(IPARkISP1, Debug) << "Algorithm timings:" << std::endl
+			      << module_.timings();
+
+	context_.frameContexts.clear();
+}
+
 /**
  * \todo The RkISP1 pipeline currently provides an empty IPACameraSensorInfo
  * if the connected sensor does not provide enough information to properly
  * assemble one. Make sure the reported sensor information are relevant
  * before accessing them.
  */
-int IPARkISP1::configure([[maybe_unused]] const IPACameraSensorInfo &info,
+int IPARkISP1::configure(const IPACameraSensorInfo &info,
 			 [[maybe_unused]] const std::map<uint32_t, IPAStream> &streamConfig,
 			 const std::map<uint32_t, ControlInfoMap> &entityControls)
 {
@@ -116,21 +125,31 @@ int IPARkISP1::configure([[maybe_unused]] const IPACameraSensorInfo &info,
 		return -EINVAL;
 	}
 
-	autoExposure_ = true;
+	IPASessionConfiguration &config = context_.configuration;
+	config.sensor.minExposure = std::max<uint32_t>(itExp->second.min().get<int32_t>(), 1);
+	config.sensor.maxExposure = itExp->second.max().get<int32_t>();
+	config.sensor.minGain = std::max<uint32_t>(itGain->second.min().get<int32_t>(), 1);
+	config.sensor.maxGain = itGain->second.max().get<int32_t>();
+	config.sensor.outputSize = info.outputSize;
 
-	minExposure_ = std::max<uint32_t>(itExp->second.min().get<int32_t>(), 1);
-	maxExposure_ = itExp->second.max().get<int32_t>();
-	exposure_ = minExposure_;
+	context_.activeState = {};
+	context_.activeState.sensor.exposure = config.sensor.minExposure;
+	context_.activeState.sensor.gain = config.sensor.minGain;
+	context_.activeState.agc.autoEnabled = true;
 
-	minGain_ = std::max<uint32_t>(itGain->second.min().get<int32_t>(), 1);
-	maxGain_ = itGain->second.max().get<int32_t>();
-	gain_ = minGain_;
+	context_.frameContexts.clear();
 
 	LOG(IPARkISP1, Info)
-		<< "Exposure: " << minExposure_ << "-" << maxExposure_
-		<< " Gain: " << minGain_ << "-" << maxGain_;
+		<< "Exposure: " << config.sensor.minExposure << "-"
+		<< config.sensor.maxExposure
+		<< " Gain: " << config.sensor.minGain << "-"
+		<< config.sensor.maxGain;
 
-	return 0;
+	module_.clearAlgorithms();
+	module_.addAlgorithm("agc", std::make_unique<RkISP1Agc>());
+	module_.addAlgorithm("awb", std::make_unique<RkISP1Awb>());
+
+	return module_.configure(context_, info);
 }
 
 void IPARkISP1::mapBuffers(const std::vector<IPABuffer> &buffers)
@@ -183,7 +202,7 @@ void IPARkISP1::processEvent(const RkISP1Event &event)
 		const rkisp1_stat_buffer *stats =
 			static_cast<rkisp1_stat_buffer *>(buffersMemory_[bufferId]);
 
-		updateStatistics(frame, stats);
+		updateStatistics(frame, stats, event.controls);
 		break;
 	}
 	case EventQueueRequest: {
@@ -205,18 +224,17 @@ void IPARkISP1::processEvent(const RkISP1Event &event)
 void IPARkISP1::queueRequest(unsigned int frame, rkisp1_params_cfg *params,
 			     const ControlList &controls)
 {
-	/* Prepare parameters buffer. */
-	memset(params, 0, sizeof(*params));
+	IPAFrameContext &frameContext = context_.frameContexts.init(frame);
 
-	/* Auto Exposure on/off. */
 	if (controls.contains(controls::AeEnable)) {
-		autoExposure_ = controls.get(controls::AeEnable);
-		if (autoExposure_)
-			params->module_ens = RKISP1_CIF_ISP_MODULE_AEC;
-
-		params->module_en_update = RKISP1_CIF_ISP_MODULE_AEC;
+		frameContext.agc.autoEnabled = controls.get(controls::AeEnable);
+		frameContext.agc.updateEnable = true;
 	}
 
+	/* Prepare parameters buffer. */
+	memset(params, 0, sizeof(*params));
+	module_.prepare(context_, frame, frameContext, params);
+
 	RkISP1Action op;
 	op.op = ActionParamFilled;
 
@@ -224,48 +242,25 @@ void IPARkISP1::queueRequest(unsigned int frame, rkisp1_params_cfg *params,
 }
 
 void IPARkISP1::updateStatistics(unsigned int frame,
-				 const rkisp1_stat_buffer *stats)
+				 const rkisp1_stat_buffer *stats,
+				 const ControlList &sensorControls)
 {
-	const rkisp1_cif_isp_stat *params = &stats->params;
-	unsigned int aeState = 0;
-
-	if (stats->meas_type & RKISP1_CIF_ISP_STAT_AUTOEXP) {
-		const rkisp1_cif_isp_ae_stat *ae = &params->ae;
-
-		const unsigned int target = 60;
-
-		unsigned int value = 0;
-		unsigned int num = 0;
-		for (int i = 0; i < RKISP1_CIF_ISP_AE_MEAN_MAX_V10; i++) {
-			if (ae->exp_mean[i] <= 15)
-				continue;
-
-			value += ae->exp_mean[i];
-			num++;
-		}
-		value /= num;
+	IPAFrameContext &frameContext = context_.frameContexts.get(frame);
 
-		double factor = (double)target / value;
+	/* Record the sensor controls that the frame was captured with. */
+	frameContext.sensor.exposure = context_.activeState.sensor.exposure;
+	frameContext.sensor.gain = context_.activeState.sensor.gain;
+	if (sensorControls.contains(V4L2_CID_EXPOSURE))
+		frameContext.sensor.exposure = sensorControls.get(V4L2_CID_EXPOSURE).get<int32_t>();
+	if (sensorControls.contains(V4L2_CID_ANALOGUE_GAIN))
+		frameContext.sensor.gain = sensorControls.get(V4L2_CID_ANALOGUE_GAIN).get<int32_t>();
 
-		if (frame % 3 == 0) {
-			double exposure;
+	module_.process(context_, frame, frameContext, stats);
 
-			exposure = factor * exposure_ * gain_ / minGain_;
-			exposure_ = std::clamp<uint64_t>((uint64_t)exposure,
-							 minExposure_,
-							 maxExposure_);
+	if (frameContext.agc.updateControls)
+		setControls(frame + 1);
 
-			exposure = exposure / exposure_ * minGain_;
-			gain_ = std::clamp<uint64_t>((uint64_t)exposure,
-						     minGain_, maxGain_);
-
-			setControls(frame + 1);
-		}
-
-		aeState = fabs(factor - 1.0f) < 0.05f ? 2 : 1;
-	}
-
-	metadataReady(frame, aeState);
+	metadataReady(frame, frameContext);
 }
 
 void IPARkISP1::setControls(unsigned int frame)
@@ -274,19 +269,26 @@ void IPARkISP1::setControls(unsigned int frame)
 	op.op = ActionV4L2Set;
 
 	ControlList ctrls(ctrls_);
-	ctrls.set(V4L2_CID_EXPOSURE, static_cast<int32_t>(exposure_));
-	ctrls.set(V4L2_CID_ANALOGUE_GAIN, static_cast<int32_t>(gain_));
+	ctrls.set(V4L2_CID_EXPOSURE,
+		  static_cast<int32_t>(context_.activeState.sensor.exposure));
+	ctrls.set(V4L2_CID_ANALOGUE_GAIN,
+		  static_cast<int32_t>(context_.activeState.sensor.gain));
 	op.controls = ctrls;
 
 	queueFrameAction.emit(frame, op);
 }
 
-void IPARkISP1::metadataReady(unsigned int frame, unsigned int aeState)
+void IPARkISP1::metadataReady(unsigned int frame,
+			      const IPAFrameContext &frameContext)
 {
 	ControlList ctrls(controls::controls);
 
-	if (aeState)
-		ctrls.set(controls::AeLocked, aeState == 2);
+	if (frameContext.agc.state)
+		ctrls.set(controls::AeLocked, frameContext.agc.state == 2);
+
+	ctrls.set(controls::ColourGains,
+		  { static_cast<float>(frameContext.awb.gains.red),
+		    static_cast<float>(frameContext.awb.gains.blue) });
 
 	RkISP1Action op;
 	op.op = ActionMetadata;
@@ -0,0 +1,199 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * rkisp1_agc.cpp - AGC/AEC control algorithm
+ */
+
+#include "rkisp1_agc.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <libcamera/span.h>
+
+#include "libcamera/internal/log.h"
+
+#include "libipa/histogram.h"
+
+namespace libcamera {
+
+namespace ipa::rkisp1 {
+
+LOG_DEFINE_CATEGORY(RkISP1Agc)
+
+/* Mean relative luminance targeted by the AGC */
+static constexpr double kRelativeLuminanceTarget = 0.16;
+
+/* Quantile of the histogram whose value is constrained to a minimum level */
+static constexpr double kHighlightQuantile = 0.98;
+static constexpr double kHighlightTarget = 0.5;
+
+/*
+ * The statistics are interpreted against the exposure and gain that were
+ * applied to the frame they come from, so each estimate is absolute. The
+ * first frames thus apply it fully to converge within the sensor delays, and
+ * the following ones filter it to avoid visible steps.
+ */
+static constexpr uint32_t kNumStartupFrames = 10;
+static constexpr double kSpeed = 0.2;
+
+/* Tolerance on the exposure error to report the AE as locked */
+static constexpr double kLockTolerance = 0.05;
+
+/**
+ * \class RkISP1Agc
+ * \brief A mean-based AGC with a histogram highlight constraint
+ *
+ * The AGC measures the mean luminance of the frame from the ISP auto-exposure
+ * statistics, and adjusts the total exposure to bring it to a fixed target.
+ * The luminance histogram further raises the exposure when the highlights
+ * would otherwise be too dark. The total exposure is then split into an
+ * exposure time, preferred for its lower noise, and an analogue gain.
+ *
+ * \todo Convert the analogue gain codes to real gains with a sensor helper,
+ * the gain is assumed to be linear in the codes for now.
+ */
+
+int RkISP1Agc::configure(IPAContext &context,
+			 [[maybe_unused]] const IPACameraSensorInfo &info)
+{
+	const IPASessionConfiguration &config = context.configuration;
+
+	context.activeState.agc.filteredExposure =
+		static_cast<double>(context.activeState.sensor.exposure) *
+		context.activeState.sensor.gain / config.sensor.minGain;
+
+	return 0;
+}
+
+void RkISP1Agc::prepare(IPAContext &context, uint32_t frame,
+			IPAFrameContext &frameContext, rkisp1_params_cfg *params)
+{
+	if (frameContext.agc.updateEnable)
+		context.activeState.agc.autoEnabled = frameContext.agc.autoEnabled;
+	frameContext.agc.autoEnabled = context.activeState.agc.autoEnabled;
+
+	if (frame > 0)
+		return;
+
+	/*
+	 * Measure the mean luminance and its histogram on the whole frame. The
+	 * measurements keep running when the AE is disabled, their
+	 * configuration only needs to be set once.
+	 */
+	const Size &size = context.configuration.sensor.outputSize;
+	const rkisp1_cif_isp_window window = {
+		0, 0,
+		static_cast<__u16>(size.width),
+		static_cast<__u16>(size.height),
+	};
+
+	rkisp1_cif_isp_aec_config &aec = params->meas.aec_config;
+	aec.mode = RKISP1_CIF_ISP_EXP_MEASURING_MODE_1;
+	aec.autostop = RKISP1_CIF_ISP_EXP_CTRL_AUTOSTOP_0;
+	aec.meas_window = window;
+
+	/*
+	 * Subsample the frame to keep the number of pixels below 2^16, which
+	 * fits in the integer part of the histogram bins.
+	 */
+	rkisp1_cif_isp_hst_config &hst = params->meas.hst_config;
+	hst.mode = RKISP1_CIF_ISP_HISTOGRAM_MODE_Y_HISTOGRAM;
+	double predivider = std::ceil(std::sqrt(size.width * size.height / 65536.0));
+	hst.histogram_predivider = std::clamp(predivider, 3.0, 127.0);
+	hst.meas_window = window;
+	std::fill_n(hst.hist_weight, RKISP1_CIF_ISP_HISTOGRAM_WEIGHT_GRIDS_SIZE_V10, 1);
+
+	params->module_cfg_update |= RKISP1_CIF_ISP_MODULE_AEC |
+				     RKISP1_CIF_ISP_MODULE_HST;
+	params->module_en_update |= RKISP1_CIF_ISP_MODULE_AEC |
+				    RKISP1_CIF_ISP_MODULE_HST;
+	params->module_ens |= RKISP1_CIF_ISP_MODULE_AEC |
+			      RKISP1_CIF_ISP_MODULE_HST;
+}
+
+/*
+ * Compute the gain to apply to the exposure of the frame for its highlights
+ * to reach the target level, or 0 if the histogram is not available.
+ */
+double RkISP1Agc::highlightGain(const rkisp1_stat_buffer *stats) const
+{
+	if (!(stats->meas_type & RKISP1_CIF_ISP_STAT_HIST))
+		return 0.0;
+
+	constexpr unsigned int numBins = RKISP1_CIF_ISP_HIST_BIN_N_MAX_V10;
+	uint64_t cumulative[numBins + 1];
+
+	cumulateHistogram(Span<const uint32_t>(stats->params.hist.hist_bins, numBins),
+			  cumulative);
+
+	uint64_t total = cumulative[numBins];
+	if (!total)
+		return 0.0;
+
+	double bin = cumulativeQuantile(cumulative, kHighlightQuantile * total,
+					0, numBins - 1);
+	double level = std::max(bin / numBins, 1.0 / numBins);
+
+	return kHighlightTarget / level;
+}
+
+void RkISP1Agc::process(IPAContext &context, uint32_t frame,
+			IPAFrameContext &frameContext,
+			const rkisp1_stat_buffer *stats)
+{
+	const IPASessionConfiguration &config = context.configuration;
+	IPAActiveState &activeState = context.activeState;
+
+	frameContext.agc.state = 0;
+	frameContext.agc.updateControls = false;
+
+	if (!frameContext.agc.autoEnabled ||
+	    !(stats->meas_type & RKISP1_CIF_ISP_STAT_AUTOEXP))
+		return;
+
+	const rkisp1_cif_isp_ae_stat *ae = &stats->params.ae;
+
+	unsigned int sum = 0;
+	for (unsigned int i = 0; i < RKISP1_CIF_ISP_AE_MEAN_MAX_V10; i++)
+		sum += ae->exp_mean[i];
+
+	double luminance = sum / (RKISP1_CIF_ISP_AE_MEAN_MAX_V10 * 255.0);
+	double gain = kRelativeLuminanceTarget / std::max(luminance, 1.0 / 255);
+	gain = std::max(gain, highlightGain(stats));
+
+	/* The total exposure the frame needed, and its filtered value. */
+	double currentExposure = static_cast<double>(frameContext.sensor.exposure) *
+				 frameContext.sensor.gain / config.sensor.minGain;
+	double targetExposure = currentExposure * gain;
+
+	double speed = frame < kNumStartupFrames ? 1.0 : kSpeed;
+	double &filtered = activeState.agc.filteredExposure;
+	filtered = speed * targetExposure + (1.0 - speed) * filtered;
+
+	/* Prefer the exposure time, and make up for the rest with the gain. */
+	uint32_t exposure = std::clamp<double>(filtered,
+					       config.sensor.minExposure,
+					       config.sensor.maxExposure);
+	uint32_t sensorGain = std::clamp<double>(filtered / exposure * config.sensor.minGain,
+						 config.sensor.minGain,
+						 config.sensor.maxGain);
+
+	LOG(RkISP1Agc, Debug)
+		<< "Luminance " << luminance << ", gain " << gain
+		<< ", exposure " << exposure << " lines, gain code " << sensorGain;
+
+	if (exposure != activeState.sensor.exposure ||
+	    sensorGain != activeState.sensor.gain) {
+		activeState.sensor.exposure = exposure;
+		activeState.sensor.gain = sensorGain;
+		frameContext.agc.updateControls = true;
+	}
+
+	frameContext.agc.state = std::abs(gain - 1.0) < kLockTolerance ? 2 : 1;
+}
+
+} /* namespace ipa::rkisp1 */
+
+} /* namespace libcamera */
@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * rkisp1_agc.h - RkISP1 AGC/AEC control algorithm
+ */
+#ifndef __LIBCAMERA_RKISP1_AGC_H__
+#define __LIBCAMERA_RKISP1_AGC_H__
+
+#include <linux/rkisp1-config.h>
+
+#include "module.h"
+
+namespace libcamera {
+
+namespace ipa::rkisp1 {
+
+class RkISP1Agc : public Algorithm<Module>
+{
+public:
+	RkISP1Agc() = default;
+	~RkISP1Agc() = default;
+
+	int configure(IPAContext &context,
+		      const IPACameraSensorInfo &info) override;
+	void prepare(IPAContext &context, uint32_t frame,
+		     IPAFrameContext &frameContext,
+		     rkisp1_params_cfg *params) override;
+	void process(IPAContext &context, uint32_t frame,
+		     IPAFrameContext &frameContext,
+		     const rkisp1_stat_buffer *stats) override;
+
+private:
+	double highlightGain(const rkisp1_stat_buffer *stats) const;
+};
+
+} /* namespace ipa::rkisp1 */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_RKISP1_AGC_H__ */
@@ -0,0 +1,130 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * rkisp1_awb.cpp - AWB control algorithm
+ */
+
+#include "rkisp1_awb.h"
+
+#include <algorithm>
+
+#include "libcamera/internal/log.h"
+
+namespace libcamera {
+
+namespace ipa::rkisp1 {
+
+LOG_DEFINE_CATEGORY(RkISP1Awb)
+
+/* Minimum number of measured pixels, relative to the window size */
+static constexpr double kMinCountRatio = 1.0 / 1000;
+
+/* The gains are programmed on 10 bits with 8 fractional bits */
+static constexpr double kMinGain = 1.0 / 256;
+static constexpr double kMaxGain = 1023.0 / 256;
+
+/* See the RkISP1Agc for the rationale of the convergence speeds. */
+static constexpr uint32_t kNumStartupFrames = 10;
+static constexpr double kSpeed = 0.2;
+
+/**
+ * \class RkISP1Awb
+ * \brief A grey world white balance
+ *
+ * The AWB measures the mean red, green and blue values of the frame, ignoring
+ * the nearly saturated pixels, and computes the red and blue gains that make
+ * them equal. The gains are applied by the ISP AWB gain block.
+ */
+
+int RkISP1Awb::configure(IPAContext &context,
+			 [[maybe_unused]] const IPACameraSensorInfo &info)
+{
+	context.activeState.awb.gains.red = 1.0;
+	context.activeState.awb.gains.blue = 1.0;
+
+	return 0;
+}
+
+void RkISP1Awb::prepare(IPAContext &context, uint32_t frame,
+			IPAFrameContext &frameContext, rkisp1_params_cfg *params)
+{
+	frameContext.awb.gains.red = context.activeState.awb.gains.red;
+	frameContext.awb.gains.blue = context.activeState.awb.gains.blue;
+
+	rkisp1_cif_isp_awb_gain_config &gains = params->others.awb_gain_config;
+	gains.gain_red = std::clamp(frameContext.awb.gains.red, kMinGain, kMaxGain) * 256;
+	gains.gain_green_r = 256;
+	gains.gain_green_b = 256;
+	gains.gain_blue = std::clamp(frameContext.awb.gains.blue, kMinGain, kMaxGain) * 256;
+
+	params->module_cfg_update |= RKISP1_CIF_ISP_MODULE_AWB_GAIN;
+
+	if (frame > 0)
+		return;
+
+	/*
+	 * Measure the means in RGB mode on the whole frame. The pixels are then
+	 * selected by the maximum red, green and blue thresholds, stored in the
+	 * awb_ref_cr, min_y and awb_ref_cb fields respectively, the other
+	 * thresholds are unused.
+	 */
+	const Size &size = context.configuration.sensor.outputSize;
+	rkisp1_cif_isp_awb_meas_config &meas = params->meas.awb_meas_config;
+	meas.awb_wnd = {
+		0, 0,
+		static_cast<__u16>(size.width),
+		static_cast<__u16>(size.height),
+	};
+	meas.awb_mode = RKISP1_CIF_ISP_AWB_MODE_RGB;
+	meas.awb_ref_cr = 250;
+	meas.min_y = 250;
+	meas.awb_ref_cb = 250;
+	meas.frames = 0;
+
+	params->module_cfg_update |= RKISP1_CIF_ISP_MODULE_AWB;
+	params->module_en_update |= RKISP1_CIF_ISP_MODULE_AWB |
+				    RKISP1_CIF_ISP_MODULE_AWB_GAIN;
+	params->module_ens |= RKISP1_CIF_ISP_MODULE_AWB |
+			      RKISP1_CIF_ISP_MODULE_AWB_GAIN;
+}
+
+void RkISP1Awb::process(IPAContext &context, uint32_t frame,
+			IPAFrameContext &frameContext,
+			const rkisp1_stat_buffer *stats)
+{
+	if (!(stats->meas_type & RKISP1_CIF_ISP_STAT_AWB))
+		return;
+
+	const rkisp1_cif_isp_awb_meas &awb = stats->params.awb.awb_mean[0];
+	const Size &size = context.configuration.sensor.outputSize;
+
+	if (awb.cnt < size.width * size.height * kMinCountRatio) {
+		LOG(RkISP1Awb, Debug) << "Not enough pixels measured";
+		return;
+	}
+
+	/*
+	 * The means are measured after the white balance gains, divide them
+	 * by the gains of the frame to get the sensor values.
+	 */
+	double red = awb.mean_cr_or_r / frameContext.awb.gains.red;
+	double green = awb.mean_y_or_g;
+	double blue = awb.mean_cb_or_b / frameContext.awb.gains.blue;
+
+	double redGain = std::clamp(green / std::max(red, 1.0), kMinGain, kMaxGain);
+	double blueGain = std::clamp(green / std::max(blue, 1.0), kMinGain, kMaxGain);
+
+	double speed = frame < kNumStartupFrames ? 1.0 : kSpeed;
+	auto &gains = context.activeState.awb.gains;
+	gains.red = speed * redGain + (1.0 - speed) * gains.red;
+	gains.blue = speed * blueGain + (1.0 - speed) * gains.blue;
+
+	LOG(RkISP1Awb, Debug)
+		<< "Means R " << red << " G " << green << " B " << blue
+		<< ", gains R " << gains.red << " B " << gains.blue;
+}
+
+} /* namespace ipa::rkisp1 */
+
+} /* namespace libcamera */
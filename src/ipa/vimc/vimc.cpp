@@ -8,17 +8,23 @@
 #include <libcamera/ipa/vimc_ipa_interface.h>
 
 #include <fcntl.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <random>
 
 #include <libcamera/ipa/ipa_interface.h>
 #include <libcamera/ipa/ipa_module_info.h>
 
 #include "libcamera/internal/file.h"
 #include "libcamera/internal/log.h"
+#include "libcamera/internal/utils.h"
 
 namespace libcamera {
 
@@ -35,15 +41,25 @@ public:
 	int start() override;
 	void stop() override;
 
+	void processFrame(uint32_t frame) override;
+
 private:
+	int parseConfiguration(const std::string &path);
+
 	void initTrace();
 	void trace(enum ipa::vimc::IPAOperationCode operation);
 
 	int fd_;
+
+	/* Synthetic load, in microseconds. */
+	unsigned int computeTime_;
+	unsigned int computeJitter_;
+	unsigned int seed_;
+	std::mt19937 random_;
 };
 
 IPAVimc::IPAVimc()
-	: fd_(-1)
+	: fd_(-1), computeTime_(0), computeJitter_(0), seed_(1)
 {
 	initTrace();
 }
@@ -68,7 +84,7 @@ int IPAVimc::init(const IPASettings &settings)
 		return -EINVAL;
 	}
 
-	return 0;
+	return parseConfiguration(settings.configurationFile);
 }
 
 int IPAVimc::start()
@@ -77,6 +93,9 @@ int IPAVimc::start()
 
 	LOG(IPAVimc, Debug) << "start vimc IPA!";
 
+	/* Restart the jitter sequence to make every capture session identical. */
+	random_.seed(seed_);
+
 	return 0;
 }
 
@@ -87,6 +106,72 @@ void IPAVimc::stop()
 	LOG(IPAVimc, Debug) << "stop vimc IPA!";
 }
 
+/*
+ * Simulate the processing of a frame by the algorithms. The load is a busy
+ * loop, to consume CPU time like real computations would, with a random but
+ * reproducible jitter.
+ */
+void IPAVimc::processFrame(uint32_t frame)
+{
+	if (computeTime_) {
+		int64_t duration = computeTime_;
+		if (computeJitter_) {
+			std::uniform_int_distribution<int64_t> dist(-static_cast<int64_t>(computeJitter_),
+								    computeJitter_);
+			duration = std::max<int64_t>(0, duration + dist(random_));
+		}
+
+		utils::time_point deadline = utils::clock::now() +
+					     std::chrono::microseconds(duration);
+		while (utils::clock::now() < deadline)
+			;
+	}
+
+	frameProcessed.emit(frame);
+}
+
+int IPAVimc::parseConfiguration(const std::string &path)
+{
+	std::ifstream file(path);
+	std::string line;
+
+	while (std::getline(file, line)) {
+		line = line.substr(0, line.find('#'));
+
+		size_t pos = line.find('=');
+		if (pos == std::string::npos)
+			continue;
+
+		std::string key = line.substr(0, pos);
+		key.erase(std::remove_if(key.begin(), key.end(), ::isspace), key.end());
+
+		std::string value = line.substr(pos + 1);
+		char *end;
+		unsigned long number = strtoul(value.c_str(), &end, 10);
+		if (end == value.c_str()) {
+			LOG(IPAVimc, Error)
+				<< "Invalid value for " << key << ": " << value;
+			return -EINVAL;
+		}
+
+		if (key == "compute_time_us")
+			computeTime_ = number;
+		else if (key == "compute_jitter_us")
+			computeJitter_ = number;
+		else if (key == "seed")
+			seed_ = number;
+		else
+			LOG(IPAVimc, Warning) << "Unknown configuration key " << key;
+	}
+
+	if (computeTime_)
+		LOG(IPAVimc, Info)
+			<< "Simulating a compute time of " << computeTime_
+			<< "us +/- " << computeJitter_ << "us per frame";
+
+	return 0;
+}
+
 void IPAVimc::initTrace()
 {
 	struct stat fifoStat;
@@ -63,6 +63,7 @@ int Harness::exec()
 	std::vector<Results> results;
 
 	results.push_back(testSingleStream(camera_));
+	results.push_back(testPerformance(camera_));
 
 	for (const Results &result : results) {
 		ret = result.summary();
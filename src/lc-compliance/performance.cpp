@@ -0,0 +1,289 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * performance.cpp - Test the camera timing performance
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+
+#include <libcamera/control_ids.h>
+
+#include "performance_capture.h"
+#include "tests.h"
+
+using namespace libcamera;
+
+namespace {
+
+using namespace std::chrono_literals;
+
+/*
+ * The limits are generous on purpose, to catch pathological behaviours
+ * without failing on slow but functional platforms.
+ */
+constexpr std::chrono::milliseconds kMaxConfigureTime = 1000ms;
+constexpr std::chrono::milliseconds kMaxStartupTime = 2000ms;
+
+/* Number of requests captured to compute statistics. */
+constexpr unsigned int kNumRequests = 120;
+/* Number of initial frames ignored while the algorithms converge. */
+constexpr unsigned int kWarmupFrames = 10;
+/* Frame duration requested for the frame rate test, if supported. */
+constexpr int64_t kTargetFrameDuration = 33333;
+constexpr double kFrameRateTolerance = 0.05;
+/* Number of frames of processing latency tolerated above the queue depth. */
+constexpr unsigned int kLatencyMarginFrames = 4;
+
+std::string formatMs(uint64_t us)
+{
+	std::stringstream ss;
+	ss << std::fixed << std::setprecision(1) << us / 1000.0 << "ms";
+	return ss.str();
+}
+
+template<typename Rep, typename Period>
+std::string formatMs(std::chrono::duration<Rep, Period> duration)
+{
+	return formatMs(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+}
+
+} /* namespace */
+
+Results::Result testConfigureTime(std::shared_ptr<Camera> camera,
+				  const std::string &name, StreamRole role)
+{
+	PerformanceCapture capture(camera);
+
+	Results::Result ret = capture.configure({ role });
+	if (ret.first != Results::Pass)
+		return ret;
+
+	std::string message = "Configure " + name + " in " +
+			      formatMs(capture.configureTime());
+
+	if (capture.configureTime() > kMaxConfigureTime)
+		return { Results::Fail, message + ", expected less than " +
+			 formatMs(kMaxConfigureTime) };
+
+	return { Results::Pass, message };
+}
+
+Results::Result testStartupTime(std::shared_ptr<Camera> camera)
+{
+	PerformanceCapture capture(camera);
+
+	Results::Result ret = capture.configure({ Viewfinder });
+	if (ret.first != Results::Pass)
+		return ret;
+
+	ret = capture.capture(kWarmupFrames);
+	if (ret.first != Results::Pass)
+		return ret;
+
+	std::string message = "First frame " + formatMs(capture.startupTime()) +
+			      " after start";
+
+	if (capture.startupTime() > kMaxStartupTime)
+		return { Results::Fail, message + ", expected less than " +
+			 formatMs(kMaxStartupTime) };
+
+	return { Results::Pass, message };
+}
+
+Results::Result testFrameRate(std::shared_ptr<Camera> camera)
+{
+	const ControlInfoMap &info = camera->controls();
+	auto iter = info.find(&controls::FrameDurationLimits);
+	if (iter == info.end())
+		return { Results::Skip, "Frame duration limits not supported" };
+
+	int64_t duration = std::clamp(kTargetFrameDuration,
+				      iter->second.min().get<int64_t>(),
+				      iter->second.max().get<int64_t>());
+
+	ControlList controls(controls::controls);
+	controls.set(controls::FrameDurationLimits,
+		     Span<const int64_t>({ duration, duration }));
+
+	PerformanceCapture capture(camera);
+
+	Results::Result ret = capture.configure({ Viewfinder });
+	if (ret.first != Results::Pass)
+		return ret;
+
+	ret = capture.capture(kNumRequests, controls);
+	if (ret.first != Results::Pass)
+		return ret;
+
+	std::vector<uint64_t> intervals = capture.intervals();
+	if (intervals.size() <= kWarmupFrames)
+		return { Results::Fail, "Not enough frames to measure the frame rate" };
+
+	intervals.erase(intervals.begin(), intervals.begin() + kWarmupFrames);
+	double mean = std::accumulate(intervals.begin(), intervals.end(), 0.0) /
+		      intervals.size();
+
+	std::stringstream ss;
+	ss << std::fixed << std::setprecision(2)
+	   << "Sustained " << 1e9 / mean << " fps for a frame duration limit of "
+	   << 1e6 / duration << " fps";
+
+	if (mean > duration * 1000 * (1 + kFrameRateTolerance))
+		return { Results::Fail, ss.str() };
+
+	return { Results::Pass, ss.str() };
+}
+
+Results::Result testLatency(std::shared_ptr<Camera> camera)
+{
+	PerformanceCapture capture(camera);
+
+	Results::Result ret = capture.configure({ Viewfinder });
+	if (ret.first != Results::Pass)
+		return ret;
+
+	ret = capture.capture(kNumRequests);
+	if (ret.first != Results::Pass)
+		return ret;
+
+	const std::vector<uint64_t> &latencies = capture.latencies();
+	uint64_t interval = PerformanceCapture::percentile(capture.intervals(), 50) / 1000;
+	if (!interval)
+		return { Results::Fail, "Not enough frames to measure the latency" };
+
+	uint64_t p99 = PerformanceCapture::percentile(latencies, 99);
+	uint64_t limit = (capture.depth() + kLatencyMarginFrames) * interval;
+
+	std::string message = "Request latency with " +
+			      std::to_string(capture.depth()) + " requests: p50 " +
+			      formatMs(PerformanceCapture::percentile(latencies, 50)) +
+			      " p90 " +
+			      formatMs(PerformanceCapture::percentile(latencies, 90)) +
+			      " p99 " + formatMs(p99) + " max " +
+			      formatMs(*std::max_element(latencies.begin(), latencies.end()));
+
+	if (p99 > limit)
+		return { Results::Fail, message + ", expected p99 less than " +
+			 formatMs(limit) };
+
+	return { Results::Pass, message };
+}
+
+Results::Result testSequenceGaps(std::shared_ptr<Camera> camera,
+				 const std::string &name,
+				 const StreamRoles &roles, unsigned int depthScale)
+{
+	std::unique_ptr<CameraConfiguration> config =
+		camera->generateConfiguration(roles);
+	if (!config || config->size() != roles.size())
+		return { Results::Skip, "Roles not supported by camera" };
+
+	unsigned int depth = config->at(0).bufferCount * depthScale;
+
+	PerformanceCapture capture(camera);
+
+	Results::Result ret = capture.configure(roles, depth);
+	if (ret.first != Results::Pass)
+		return ret;
+
+	ret = capture.capture(kNumRequests);
+	if (ret.first != Results::Pass)
+		return ret;
+
+	std::string message = "Capture of " + name + " with " +
+			      std::to_string(capture.depth()) + " requests";
+
+	if (capture.sequenceGaps())
+		return { Results::Fail, message + " dropped " +
+			 std::to_string(capture.sequenceGaps()) + " frames" };
+
+	return { Results::Pass, message + " without frame drops" };
+}
+
+Results testPerformance(std::shared_ptr<Camera> camera)
+{
+	static const std::vector<std::pair<std::string, StreamRole>> roles = {
+		{ "raw", Raw },
+		{ "still", StillCapture },
+		{ "video", VideoRecording },
+		{ "viewfinder", Viewfinder },
+	};
+	static const std::vector<unsigned int> depthScales = { 1, 2, 3 };
+	static const std::vector<std::pair<std::string, StreamRoles>> multiStreams = {
+		{ "viewfinder + still", { Viewfinder, StillCapture } },
+		{ "viewfinder + video", { Viewfinder, VideoRecording } },
+		{ "video + raw", { VideoRecording, Raw } },
+	};
+
+	Results results(roles.size() + 3 + depthScales.size() + multiStreams.size());
+
+	/*
+	 * Test configuration time
+	 *
+	 * Makes sure configure() completes in a reasonable time. Example
+	 * failure is a pipeline handler that reprobes the media graph or
+	 * loads tuning data on every configuration.
+	 */
+	std::cout << "* Test configuration time" << std::endl;
+	for (const auto &role : roles)
+		results.add(testConfigureTime(camera, role.first, role.second));
+
+	/*
+	 * Test startup time
+	 *
+	 * Makes sure the first frame completes in a reasonable time after
+	 * start(). Example failure is a sensor power up sequence with
+	 * excessive delays.
+	 */
+	std::cout << "* Test startup time" << std::endl;
+	results.add(testStartupTime(camera));
+
+	/*
+	 * Test sustained frame rate
+	 *
+	 * Makes sure the camera sustains the frame rate set through
+	 * FrameDurationLimits. Example failure is a pipeline that misses
+	 * frames when processing takes longer than a frame interval.
+	 */
+	std::cout << "* Test sustained frame rate" << std::endl;
+	results.add(testFrameRate(camera));
+
+	/*
+	 * Test request latency
+	 *
+	 * Measures the time between queueing and completion of requests.
+	 * Example failure is a pipeline that holds requests for many frames
+	 * before completing them.
+	 */
+	std::cout << "* Test request latency" << std::endl;
+	results.add(testLatency(camera));
+
+	/*
+	 * Test sequence gaps with different request depths
+	 *
+	 * Makes sure no frame is dropped when enough requests are queued.
+	 * Example failure is a pipeline that can't requeue buffers to the
+	 * device fast enough when many requests are in flight.
+	 */
+	std::cout << "* Test sequence gaps with different request depths" << std::endl;
+	for (unsigned int scale : depthScales)
+		results.add(testSequenceGaps(camera, "viewfinder", { Viewfinder }, scale));
+
+	/*
+	 * Test sequence gaps with multiple streams
+	 *
+	 * Makes sure no frame is dropped on any stream when capturing
+	 * multiple streams concurrently.
+	 */
+	std::cout << "* Test sequence gaps with multiple streams" << std::endl;
+	for (const auto &streams : multiStreams)
+		results.add(testSequenceGaps(camera, streams.first, streams.second, 1));
+
+	return results;
+}
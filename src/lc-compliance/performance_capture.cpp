@@ -0,0 +1,223 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * performance_capture.cpp - Capture helper recording timing statistics
+ */
+
+#include "performance_capture.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <limits.h>
+
+using namespace libcamera;
+
+PerformanceCapture::PerformanceCapture(std::shared_ptr<Camera> camera)
+	: camera_(camera),
+	  allocator_(std::make_unique<FrameBufferAllocator>(camera)),
+	  depth_(0), loop_(nullptr), queueCount_(0), captureCount_(0),
+	  captureLimit_(0), lastTimestamp_(0),
+	  configureTime_(Clock::duration::zero()),
+	  startupTime_(Clock::duration::zero()), sequenceGaps_(0)
+{
+}
+
+PerformanceCapture::~PerformanceCapture()
+{
+}
+
+/*
+ * Configure the camera for \a roles, with \a depth buffers per stream, or the
+ * default number of buffers if \a depth is 0. The configure() call is timed.
+ */
+Results::Result PerformanceCapture::configure(const StreamRoles &roles,
+					      unsigned int depth)
+{
+	config_ = camera_->generateConfiguration(roles);
+	if (!config_ || config_->size() != roles.size())
+		return { Results::Skip, "Roles not supported by camera" };
+
+	if (depth) {
+		for (StreamConfiguration &cfg : *config_)
+			cfg.bufferCount = depth;
+	}
+
+	if (config_->validate() == CameraConfiguration::Invalid) {
+		config_.reset();
+		return { Results::Fail, "Configuration not valid" };
+	}
+
+	Clock::time_point start = Clock::now();
+	int ret = camera_->configure(config_.get());
+	configureTime_ = Clock::now() - start;
+
+	if (ret) {
+		config_.reset();
+		return { Results::Fail, "Failed to configure camera" };
+	}
+
+	return { Results::Pass, "Configure camera" };
+}
+
+/*
+ * Capture \a numRequests requests with all the buffers allocated for the
+ * configured streams in flight, setting \a controls in every request.
+ */
+Results::Result PerformanceCapture::capture(unsigned int numRequests,
+					    const ControlList &controls)
+{
+	depth_ = UINT_MAX;
+	for (const StreamConfiguration &cfg : *config_) {
+		if (allocator_->allocate(cfg.stream()) < 0) {
+			freeBuffers();
+			return { Results::Fail, "Failed to allocate buffers" };
+		}
+
+		depth_ = std::min<unsigned int>(depth_, allocator_->buffers(cfg.stream()).size());
+	}
+
+	std::vector<std::unique_ptr<Request>> requests;
+	for (unsigned int i = 0; i < depth_; ++i) {
+		std::unique_ptr<Request> request = camera_->createRequest();
+		if (!request) {
+			freeBuffers();
+			return { Results::Fail, "Can't create request" };
+		}
+
+		for (const StreamConfiguration &cfg : *config_) {
+			Stream *stream = cfg.stream();
+			const std::unique_ptr<FrameBuffer> &buffer =
+				allocator_->buffers(stream)[i];
+
+			if (request->addBuffer(stream, buffer.get())) {
+				freeBuffers();
+				return { Results::Fail, "Can't set buffer for request" };
+			}
+		}
+
+		requests.push_back(std::move(request));
+	}
+
+	controls_ = controls;
+	queueCount_ = 0;
+	captureCount_ = 0;
+	captureLimit_ = numRequests;
+	queueTimes_.clear();
+	lastSequence_.clear();
+	lastTimestamp_ = 0;
+	latencies_.clear();
+	intervals_.clear();
+	sequenceGaps_ = 0;
+
+	loop_ = new EventLoop();
+	camera_->requestCompleted.connect(this, &PerformanceCapture::requestComplete);
+
+	Results::Result result = { Results::Pass, "Capture" };
+
+	startTime_ = Clock::now();
+	if (camera_->start()) {
+		result = { Results::Fail, "Failed to start camera" };
+	} else {
+		for (std::unique_ptr<Request> &request : requests) {
+			if (queueRequest(request.get()) < 0) {
+				result = { Results::Fail, "Failed to queue request" };
+				break;
+			}
+		}
+
+		if (result.first == Results::Pass && loop_->exec())
+			result = { Results::Fail, "Failed to requeue request" };
+
+		camera_->stop();
+	}
+
+	camera_->requestCompleted.disconnect(this, &PerformanceCapture::requestComplete);
+	delete loop_;
+	loop_ = nullptr;
+
+	requests.clear();
+	freeBuffers();
+
+	if (result.first == Results::Pass && captureCount_ != captureLimit_)
+		result = { Results::Fail, "Got " + std::to_string(captureCount_) +
+			   " requests, wanted " + std::to_string(captureLimit_) };
+
+	return result;
+}
+
+/*
+ * Compute the smallest value greater than or equal to \a percent percent of
+ * the \a samples.
+ */
+uint64_t PerformanceCapture::percentile(std::vector<uint64_t> samples,
+					unsigned int percent)
+{
+	if (samples.empty())
+		return 0;
+
+	size_t index = std::min(samples.size() - 1, samples.size() * percent / 100);
+	std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+
+	return samples[index];
+}
+
+void PerformanceCapture::freeBuffers()
+{
+	for (const StreamConfiguration &cfg : *config_)
+		allocator_->free(cfg.stream());
+}
+
+int PerformanceCapture::queueRequest(Request *request)
+{
+	queueCount_++;
+	if (queueCount_ > captureLimit_)
+		return 0;
+
+	if (!controls_.empty())
+		request->controls().merge(controls_);
+
+	queueTimes_[request] = Clock::now();
+
+	return camera_->queueRequest(request);
+}
+
+void PerformanceCapture::requestComplete(Request *request)
+{
+	if (request->status() == Request::RequestCancelled)
+		return;
+
+	Clock::time_point now = Clock::now();
+
+	if (!captureCount_)
+		startupTime_ = now - startTime_;
+
+	latencies_.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+		now - queueTimes_[request]).count());
+
+	for (const auto &[stream, buffer] : request->buffers()) {
+		const FrameMetadata &metadata = buffer->metadata();
+
+		auto iter = lastSequence_.find(stream);
+		if (iter != lastSequence_.end() && metadata.sequence > iter->second + 1)
+			sequenceGaps_ += metadata.sequence - iter->second - 1;
+		lastSequence_[stream] = metadata.sequence;
+
+		if (stream != config_->at(0).stream())
+			continue;
+
+		if (lastTimestamp_ && metadata.timestamp > lastTimestamp_)
+			intervals_.push_back(metadata.timestamp - lastTimestamp_);
+		lastTimestamp_ = metadata.timestamp;
+	}
+
+	captureCount_++;
+	if (captureCount_ >= captureLimit_) {
+		loop_->exit(0);
+		return;
+	}
+
+	request->reuse(Request::ReuseBuffers);
+	if (queueRequest(request))
+		loop_->exit(-EINVAL);
+}
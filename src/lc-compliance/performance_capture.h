@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * performance_capture.h - Capture helper recording timing statistics
+ */
+#ifndef __LC_COMPLIANCE_PERFORMANCE_CAPTURE_H__
+#define __LC_COMPLIANCE_PERFORMANCE_CAPTURE_H__
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "../cam/event_loop.h"
+#include "results.h"
+
+class PerformanceCapture
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	PerformanceCapture(std::shared_ptr<libcamera::Camera> camera);
+	~PerformanceCapture();
+
+	Results::Result configure(const libcamera::StreamRoles &roles,
+				  unsigned int depth = 0);
+	Results::Result capture(unsigned int numRequests,
+				const libcamera::ControlList &controls = {});
+
+	unsigned int depth() const { return depth_; }
+
+	/* Statistics of the last configure() and capture() calls. */
+	Clock::duration configureTime() const { return configureTime_; }
+	Clock::duration startupTime() const { return startupTime_; }
+	const std::vector<uint64_t> &latencies() const { return latencies_; }
+	const std::vector<uint64_t> &intervals() const { return intervals_; }
+	unsigned int sequenceGaps() const { return sequenceGaps_; }
+
+	static uint64_t percentile(std::vector<uint64_t> samples,
+				   unsigned int percent);
+
+private:
+	void freeBuffers();
+	int queueRequest(libcamera::Request *request);
+	void requestComplete(libcamera::Request *request);
+
+	std::shared_ptr<libcamera::Camera> camera_;
+	std::unique_ptr<libcamera::FrameBufferAllocator> allocator_;
+	std::unique_ptr<libcamera::CameraConfiguration> config_;
+	unsigned int depth_;
+
+	EventLoop *loop_;
+	libcamera::ControlList controls_;
+	unsigned int queueCount_;
+	unsigned int captureCount_;
+	unsigned int captureLimit_;
+
+	Clock::time_point startTime_;
+	std::map<const libcamera::Request *, Clock::time_point> queueTimes_;
+	std::map<const libcamera::Stream *, unsigned int> lastSequence_;
+	uint64_t lastTimestamp_;
+
+	Clock::duration configureTime_;
+	Clock::duration startupTime_;
+	/* Time from queueing to completion of each request, in µs. */
+	std::vector<uint64_t> latencies_;
+	/* Interval between sensor timestamps of consecutive frames, in ns. */
+	std::vector<uint64_t> intervals_;
+	unsigned int sequenceGaps_;
+};
+
+#endif /* __LC_COMPLIANCE_PERFORMANCE_CAPTURE_H__ */
@@ -12,5 +12,6 @@
 #include "results.h"
 
 Results testSingleStream(std::shared_ptr<libcamera::Camera> camera);
+Results testPerformance(std::shared_ptr<libcamera::Camera> camera);
 
 #endif /* __LC_COMPLIANCE_TESTS_H__ */
@@ -0,0 +1,368 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * bayer_unpack.cpp - Unpacking of raw Bayer lines
+ */
+
+#include "libcamera/internal/bayer_unpack.h"
+
+#include "libcamera/internal/bayer_format.h"
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define BAYER_UNPACK_NEON
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#define BAYER_UNPACK_SSSE3
+#include <tmmintrin.h>
+#endif
+
+/**
+ * \file bayer_unpack.h
+ * \brief Functions to unpack lines of raw Bayer pixels
+ *
+ * The functions in this file convert a line of raw pixels stored in one of the
+ * packings described by BayerFormat::Packing to one 16-bit value per pixel,
+ * with the pixel value in the least significant bits. They are shared by all
+ * the components that need to process raw images on the CPU.
+ *
+ * The packed layouts are unpacked 8 pixels at a time with NEON instructions on
+ * AArch64, and with SSSE3 instructions on x86 when the CPU supports them. The
+ * pixels that don't fill a complete group, and all pixels on other platforms,
+ * are unpacked with portable C++ code producing identical results.
+ */
+
+namespace libcamera {
+
+namespace bayer {
+
+namespace {
+
+/*
+ * The SIMD kernels unpack 8 pixels from 16 bytes of input. The bytes holding
+ * the most significant bits of each pixel are shuffled to the low byte of a
+ * 16-bit lane, and the bytes holding the least significant bits to a full
+ * 16-bit lane. The latter is then multiplied to move the bits of the pixel to
+ * the top of the lane, discarding the bits of the other pixels, and shifted
+ * right in place. A shuffle index of 0xff produces a zero byte.
+ */
+struct Shuffle {
+	uint8_t msb[16];
+	uint8_t lsb[16];
+	uint16_t multiplier[8];
+};
+
+constexpr uint8_t Z = 0xff;
+
+/* Four pixels in five bytes, the fifth byte holds 2 LSBs per pixel. */
+constexpr Shuffle csi2p10Shuffle = {
+	{ 0, Z, 1, Z, 2, Z, 3, Z, 5, Z, 6, Z, 7, Z, 8, Z },
+	{ 4, Z, 4, Z, 4, Z, 4, Z, 9, Z, 9, Z, 9, Z, 9, Z },
+	{ 1 << 14, 1 << 12, 1 << 10, 1 << 8, 1 << 14, 1 << 12, 1 << 10, 1 << 8 },
+};
+
+/* Two pixels in three bytes, the third byte holds 4 LSBs per pixel. */
+constexpr Shuffle csi2p12Shuffle = {
+	{ 0, Z, 1, Z, 3, Z, 4, Z, 6, Z, 7, Z, 9, Z, 10, Z },
+	{ 2, Z, 2, Z, 5, Z, 5, Z, 8, Z, 8, Z, 11, Z, 11, Z },
+	{ 1 << 12, 1 << 8, 1 << 12, 1 << 8, 1 << 12, 1 << 8, 1 << 12, 1 << 8 },
+};
+
+/* Four pixels in seven bytes, the last three bytes hold 6 LSBs per pixel. */
+constexpr Shuffle csi2p14Shuffle = {
+	{ 0, Z, 1, Z, 2, Z, 3, Z, 7, Z, 8, Z, 9, Z, 10, Z },
+	{ 4, 5, 4, 5, 5, 6, 5, 6, 11, 12, 11, 12, 12, 13, 12, 13 },
+	{ 1 << 10, 1 << 4, 1 << 6, 1 << 0, 1 << 10, 1 << 4, 1 << 6, 1 << 0 },
+};
+
+/*
+ * IPU3 pixels form a little-endian 10-bit stream. Each pixel is extracted
+ * from the two bytes it spans, the tail variant reads the third group of a
+ * 32-byte block from offset 16 to stay within the block.
+ */
+constexpr Shuffle ipu3Shuffle = {
+	{ Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z },
+	{ 0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9 },
+	{ 1 << 6, 1 << 4, 1 << 2, 1 << 0, 1 << 6, 1 << 4, 1 << 2, 1 << 0 },
+};
+
+constexpr Shuffle ipu3TailShuffle = {
+	{ Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z },
+	{ 4, 5, 5, 6, 6, 7, 7, 8, 9, 10, 10, 11, 11, 12, 12, 13 },
+	{ 1 << 6, 1 << 4, 1 << 2, 1 << 0, 1 << 6, 1 << 4, 1 << 2, 1 << 0 },
+};
+
+#if defined(BAYER_UNPACK_NEON)
+
+#define SIMD_TARGET
+
+bool hasSimd()
+{
+	return true;
+}
+
+template<unsigned int MsbShift, unsigned int LsbShift>
+inline void unpack8(uint16_t *dst, const uint8_t *src, const Shuffle &shuffle)
+{
+	uint8x16_t in = vld1q_u8(src);
+	uint16x8_t msb = vreinterpretq_u16_u8(vqtbl1q_u8(in, vld1q_u8(shuffle.msb)));
+	uint16x8_t lsb = vreinterpretq_u16_u8(vqtbl1q_u8(in, vld1q_u8(shuffle.lsb)));
+
+	lsb = vshrq_n_u16(vmulq_u16(lsb, vld1q_u16(shuffle.multiplier)), LsbShift);
+	vst1q_u16(dst, vorrq_u16(vshlq_n_u16(msb, MsbShift), lsb));
+}
+
+#elif defined(BAYER_UNPACK_SSSE3)
+
+#if defined(__SSSE3__)
+#define SIMD_TARGET
+
+bool hasSimd()
+{
+	return true;
+}
+#else
+#define SIMD_TARGET __attribute__((target("ssse3")))
+
+bool hasSimd()
+{
+	static const bool supported = __builtin_cpu_supports("ssse3");
+	return supported;
+}
+#endif
+
+template<unsigned int MsbShift, unsigned int LsbShift>
+SIMD_TARGET inline void unpack8(uint16_t *dst, const uint8_t *src,
+				const Shuffle &shuffle)
+{
+	__m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+	__m128i msb = _mm_shuffle_epi8(in, _mm_loadu_si128(reinterpret_cast<const __m128i *>(shuffle.msb)));
+	__m128i lsb = _mm_shuffle_epi8(in, _mm_loadu_si128(reinterpret_cast<const __m128i *>(shuffle.lsb)));
+	__m128i multiplier = _mm_loadu_si128(reinterpret_cast<const __m128i *>(shuffle.multiplier));
+
+	lsb = _mm_srli_epi16(_mm_mullo_epi16(lsb, multiplier), LsbShift);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+			 _mm_or_si128(_mm_slli_epi16(msb, MsbShift), lsb));
+}
+
+#endif
+
+#if defined(BAYER_UNPACK_NEON) || defined(BAYER_UNPACK_SSSE3)
+
+/*
+ * Unpack groups of 8 pixels consuming \a step bytes each, as long as the 16
+ * bytes loaded for a group are within the \a length bytes of the line. Return
+ * the number of pixels unpacked.
+ */
+template<unsigned int MsbShift, unsigned int LsbShift>
+SIMD_TARGET unsigned int unpackSimd(uint16_t *dst, const uint8_t *src,
+				    unsigned int width, unsigned int length,
+				    unsigned int step, const Shuffle &shuffle)
+{
+	unsigned int x = 0;
+
+	if (!hasSimd())
+		return 0;
+
+	for (unsigned int offset = 0; x + 8 <= width && offset + 16 <= length;
+	     x += 8, offset += step)
+		unpack8<MsbShift, LsbShift>(dst + x, src + offset, shuffle);
+
+	return x;
+}
+
+/* Unpack the first 24 pixels of all the complete 25-pixel blocks. */
+SIMD_TARGET unsigned int unpackIPU3Simd(uint16_t *dst, const uint8_t *src,
+					unsigned int blocks)
+{
+	if (!hasSimd())
+		return 0;
+
+	for (unsigned int i = 0; i < blocks; ++i, dst += 25, src += 32) {
+		unpack8<0, 6>(dst, src, ipu3Shuffle);
+		unpack8<0, 6>(dst + 8, src + 10, ipu3Shuffle);
+		unpack8<0, 6>(dst + 16, src + 16, ipu3TailShuffle);
+	}
+
+	return blocks;
+}
+
+#else
+
+template<unsigned int MsbShift, unsigned int LsbShift>
+unsigned int unpackSimd([[maybe_unused]] uint16_t *dst,
+			[[maybe_unused]] const uint8_t *src,
+			[[maybe_unused]] unsigned int width,
+			[[maybe_unused]] unsigned int length,
+			[[maybe_unused]] unsigned int step,
+			[[maybe_unused]] const Shuffle &shuffle)
+{
+	return 0;
+}
+
+unsigned int unpackIPU3Simd([[maybe_unused]] uint16_t *dst,
+			    [[maybe_unused]] const uint8_t *src,
+			    [[maybe_unused]] unsigned int blocks)
+{
+	return 0;
+}
+
+#endif
+
+} /* namespace */
+
+/**
+ * \typedef UnpackFunction
+ * \brief Function unpacking a line of \a width pixels from \a src to \a dst
+ */
+
+/**
+ * \brief Unpack a line of 8-bit pixels
+ * \param[out] dst The unpacked pixels
+ * \param[in] src The raw line
+ * \param[in] width The number of pixels in the line
+ */
+void unpackRaw8(uint16_t *dst, const uint8_t *src, unsigned int width)
+{
+	for (unsigned int x = 0; x < width; ++x)
+		dst[x] = src[x];
+}
+
+/**
+ * \brief Unpack a line of pixels stored in little-endian 16-bit containers
+ * \param[out] dst The unpacked pixels
+ * \param[in] src The raw line
+ * \param[in] width The number of pixels in the line
+ */
+void unpackRaw16(uint16_t *dst, const uint8_t *src, unsigned int width)
+{
+	for (unsigned int x = 0; x < width; ++x)
+		dst[x] = src[2 * x] | (src[2 * x + 1] << 8);
+}
+
+/**
+ * \brief Unpack a line of MIPI CSI-2 packed 10-bit pixels
+ * \param[out] dst The unpacked pixels
+ * \param[in] src The raw line
+ * \param[in] width The number of pixels in the line
+ */
+void unpackCSI2P10(uint16_t *dst, const uint8_t *src, unsigned int width)
+{
+	unsigned int x = unpackSimd<2, 14>(dst, src, width, width / 4 * 5, 10,
+					   csi2p10Shuffle);
+
+	/* Four pixels are stored in five bytes. */
+	for (src += x / 4 * 5; x < width; x += 4, src += 5) {
+		for (unsigned int i = 0; i < 4 && x + i < width; ++i)
+			dst[x + i] = (src[i] << 2) | ((src[4] >> (2 * i)) & 3);
+	}
+}
+
+/**
+ * \brief Unpack a line of MIPI CSI-2 packed 12-bit pixels
+ * \param[out] dst The unpacked pixels
+ * \param[in] src The raw line
+ * \param[in] width The number of pixels in the line
+ */
+void unpackCSI2P12(uint16_t *dst, const uint8_t *src, unsigned int width)
+{
+	unsigned int x = unpackSimd<4, 12>(dst, src, width, width / 2 * 3, 12,
+					   csi2p12Shuffle);
+
+	/* Two pixels are stored in three bytes. */
+	for (src += x / 2 * 3; x < width; x += 2, src += 3) {
+		dst[x] = (src[0] << 4) | (src[2] & 0xf);
+		if (x + 1 < width)
+			dst[x + 1] = (src[1] << 4) | (src[2] >> 4);
+	}
+}
+
+/**
+ * \brief Unpack a line of MIPI CSI-2 packed 14-bit pixels
+ * \param[out] dst The unpacked pixels
+ * \param[in] src The raw line
+ * \param[in] width The number of pixels in the line
+ */
+void unpackCSI2P14(uint16_t *dst, const uint8_t *src, unsigned int width)
+{
+	unsigned int x = unpackSimd<6, 10>(dst, src, width, width / 4 * 7, 14,
+					   csi2p14Shuffle);
+
+	/* Four pixels are stored in seven bytes. */
+	for (src += x / 4 * 7; x < width; x += 4, src += 7) {
+		uint16_t pixels[4] = {
+			static_cast<uint16_t>((src[0] << 6) | (src[4] & 0x3f)),
+			static_cast<uint16_t>((src[1] << 6) | (src[4] >> 6) | ((src[5] & 0x0f) << 2)),
+			static_cast<uint16_t>((src[2] << 6) | (src[5] >> 4) | ((src[6] & 0x03) << 4)),
+			static_cast<uint16_t>((src[3] << 6) | (src[6] >> 2)),
+		};
+
+		for (unsigned int i = 0; i < 4 && x + i < width; ++i)
+			dst[x + i] = pixels[i];
+	}
+}
+
+/**
+ * \brief Unpack a line of IPU3 packed 10-bit pixels
+ * \param[out] dst The unpacked pixels
+ * \param[in] src The raw line
+ * \param[in] width The number of pixels in the line
+ *
+ * The IPU3 stores 25 pixels in blocks of 32 bytes, as a little-endian stream
+ * of 10-bit values followed by 6 bits of padding.
+ */
+void unpackIPU3(uint16_t *dst, const uint8_t *src, unsigned int width)
+{
+	unsigned int blocks = unpackIPU3Simd(dst, src, width / 25);
+	unsigned int x = blocks * 25;
+
+	/* The SIMD kernel leaves the last pixel of each block. */
+	for (unsigned int i = 0; i < blocks; ++i)
+		dst[i * 25 + 24] = src[i * 32 + 30] | ((src[i * 32 + 31] & 3) << 8);
+
+	for (src += blocks * 32; x < width; x += 25, src += 32) {
+		for (unsigned int i = 0; i < 25 && x + i < width; ++i) {
+			unsigned int bit = i * 10;
+			unsigned int value = src[bit / 8] | (src[bit / 8 + 1] << 8);
+
+			dst[x + i] = (value >> (bit % 8)) & 0x3ff;
+		}
+	}
+}
+
+/**
+ * \brief Retrieve the function to unpack lines of a raw Bayer format
+ * \param[in] format The Bayer format
+ * \return The unpacking function, or nullptr if the format isn't supported
+ */
+UnpackFunction unpackFunction(const BayerFormat &format)
+{
+	switch (format.packing) {
+	case BayerFormat::None:
+		if (format.bitDepth == 8)
+			return unpackRaw8;
+		if (format.bitDepth <= 16)
+			return unpackRaw16;
+		break;
+
+	case BayerFormat::CSI2Packed:
+		if (format.bitDepth == 10)
+			return unpackCSI2P10;
+		if (format.bitDepth == 12)
+			return unpackCSI2P12;
+		if (format.bitDepth == 14)
+			return unpackCSI2P14;
+		break;
+
+	case BayerFormat::IPU3Packed:
+		if (format.bitDepth == 10)
+			return unpackIPU3;
+		break;
+	}
+
+	return nullptr;
+}
+
+} /* namespace bayer */
+
+} /* namespace libcamera */
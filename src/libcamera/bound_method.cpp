@@ -7,6 +7,10 @@
 
 #include <libcamera/bound_method.h>
 
+#include <atomic>
+#include <stdlib.h>
+
+#include "libcamera/internal/bound_method_pool.h"
 #include "libcamera/internal/message.h"
 #include "libcamera/internal/semaphore.h"
 #include "libcamera/internal/thread.h"
@@ -50,6 +54,402 @@ namespace libcamera {
  * blocks until the receiver signals the completion of the invocation.
  */
 
+namespace {
+
+/*
+ * Pool blocks are grouped in size classes of MinBlockSize << n bytes, header
+ * included. Each block is prefixed by a header that records the per-thread
+ * cache it was allocated from, and the cache keeps at most MaxFreeBlocks free
+ * blocks per size class.
+ */
+constexpr unsigned int NumSizeClasses = 5;
+constexpr size_t MinBlockSize = 64;
+constexpr unsigned int MaxFreeBlocks = 256;
+
+class ThreadCache;
+
+struct BlockHeader {
+	ThreadCache *owner;
+	BlockHeader *next;
+	unsigned int sizeClass;
+};
+
+constexpr size_t HeaderSize = (sizeof(BlockHeader) + alignof(max_align_t) - 1)
+			    & ~(alignof(max_align_t) - 1);
+
+void *blockData(BlockHeader *block)
+{
+	return reinterpret_cast<uint8_t *>(block) + HeaderSize;
+}
+
+BlockHeader *blockHeader(void *ptr)
+{
+	return reinterpret_cast<BlockHeader *>(static_cast<uint8_t *>(ptr) - HeaderSize);
+}
+
+class ThreadCache
+{
+public:
+	ThreadCache()
+		: refs_(1), released_(0), allocations_(0), heapAllocations_(0),
+		  peakOutstanding_(0)
+	{
+		for (unsigned int i = 0; i < NumSizeClasses; ++i) {
+			free_[i] = nullptr;
+			freeCount_[i] = 0;
+			remote_[i].store(nullptr, std::memory_order_relaxed);
+		}
+	}
+
+	void *allocate(unsigned int sizeClass);
+	void release(BlockHeader *block);
+	void releaseRemote(BlockHeader *block);
+
+	void ref() { refs_.fetch_add(1, std::memory_order_relaxed); }
+	void unref();
+
+	BoundMethodPoolStatistics statistics() const;
+
+private:
+	~ThreadCache();
+
+	void collect(unsigned int sizeClass);
+
+	std::atomic<unsigned int> refs_;
+
+	BlockHeader *free_[NumSizeClasses];
+	unsigned int freeCount_[NumSizeClasses];
+	std::atomic<BlockHeader *> remote_[NumSizeClasses];
+
+	std::atomic<uint64_t> released_;
+	uint64_t allocations_;
+	uint64_t heapAllocations_;
+	uint64_t peakOutstanding_;
+};
+
+ThreadCache::~ThreadCache()
+{
+	for (unsigned int i = 0; i < NumSizeClasses; ++i) {
+		collect(i);
+
+		while (free_[i]) {
+			BlockHeader *block = free_[i];
+			free_[i] = block->next;
+			::free(block);
+		}
+	}
+}
+
+/* Move the blocks released by other threads to the local free list. */
+void ThreadCache::collect(unsigned int sizeClass)
+{
+	BlockHeader *block = remote_[sizeClass].exchange(nullptr,
+							 std::memory_order_acquire);
+	while (block) {
+		BlockHeader *next = block->next;
+
+		if (freeCount_[sizeClass] < MaxFreeBlocks) {
+			block->next = free_[sizeClass];
+			free_[sizeClass] = block;
+			freeCount_[sizeClass]++;
+		} else {
+			::free(block);
+		}
+
+		block = next;
+	}
+}
+
+void *ThreadCache::allocate(unsigned int sizeClass)
+{
+	if (!free_[sizeClass])
+		collect(sizeClass);
+
+	BlockHeader *block = free_[sizeClass];
+	if (block) {
+		free_[sizeClass] = block->next;
+		freeCount_[sizeClass]--;
+	} else {
+		block = static_cast<BlockHeader *>(::malloc(MinBlockSize << sizeClass));
+		if (!block)
+			throw std::bad_alloc();
+		heapAllocations_++;
+	}
+
+	block->owner = this;
+	block->sizeClass = sizeClass;
+	ref();
+
+	allocations_++;
+	uint64_t outstanding = allocations_ - released_.load(std::memory_order_relaxed);
+	if (outstanding > peakOutstanding_)
+		peakOutstanding_ = outstanding;
+
+	return blockData(block);
+}
+
+/* Release a block from the thread that owns the cache. */
+void ThreadCache::release(BlockHeader *block)
+{
+	unsigned int sizeClass = block->sizeClass;
+
+	released_.fetch_add(1, std::memory_order_relaxed);
+
+	if (freeCount_[sizeClass] < MaxFreeBlocks) {
+		block->next = free_[sizeClass];
+		free_[sizeClass] = block;
+		freeCount_[sizeClass]++;
+	} else {
+		::free(block);
+	}
+
+	unref();
+}
+
+/* Release a block from any thread other than the one that owns the cache. */
+void ThreadCache::releaseRemote(BlockHeader *block)
+{
+	std::atomic<BlockHeader *> &head = remote_[block->sizeClass];
+
+	released_.fetch_add(1, std::memory_order_relaxed);
+
+	block->next = head.load(std::memory_order_relaxed);
+	while (!head.compare_exchange_weak(block->next, block,
+					   std::memory_order_release,
+					   std::memory_order_relaxed))
+		;
+
+	unref();
+}
+
+void ThreadCache::unref()
+{
+	if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		delete this;
+}
+
+BoundMethodPoolStatistics ThreadCache::statistics() const
+{
+	BoundMethodPoolStatistics stats;
+
+	stats.allocations = allocations_;
+	stats.heapAllocations = heapAllocations_;
+	stats.outstanding = allocations_ - released_.load(std::memory_order_relaxed);
+	stats.peakOutstanding = peakOutstanding_;
+
+	return stats;
+}
+
+/*
+ * The cache is reference-counted by the thread and by all the blocks it has
+ * handed out, as blocks can outlive the thread that allocated them. The
+ * cache pointer is a trivially destructible thread-local variable, to remain
+ * accessible after the holder has been destroyed at thread exit, at which
+ * point allocations fall back to the heap.
+ */
+ThreadCache *const DeadCache = reinterpret_cast<ThreadCache *>(-1);
+
+thread_local ThreadCache *currentCache = nullptr;
+
+struct ThreadCacheHolder {
+	~ThreadCacheHolder()
+	{
+		ThreadCache *cache = currentCache;
+		currentCache = DeadCache;
+		if (cache && cache != DeadCache)
+			cache->unref();
+	}
+};
+
+thread_local ThreadCacheHolder cacheHolder;
+
+ThreadCache *threadCache()
+{
+	if (!currentCache) {
+		/* Odr-use the holder to ensure its destructor gets registered. */
+		(void)&cacheHolder;
+		currentCache = new ThreadCache();
+	}
+
+	return currentCache != DeadCache ? currentCache : nullptr;
+}
+
+} /* namespace */
+
+/**
+ * \class BoundMethodPool
+ * \brief Per-thread memory pool for method invocation objects
+ *
+ * Queued and blocking method invocations allocate a BoundMethodPack and an
+ * InvokeMessage for every call, and Object::invokeMethod() additionally
+ * allocates a BoundMethodMember. To avoid heap allocator traffic on the signal
+ * path, those objects are allocated from the BoundMethodPool.
+ *
+ * Each thread has its own cache of fixed-size blocks, organized in a small
+ * number of size classes. Blocks are released to the cache of the thread that
+ * allocated them, regardless of the thread releasing them, in a lock-free way.
+ * Once a producer and consumer reach a steady state, all allocations are thus
+ * served from the pool without involving the heap allocator. Allocations too
+ * large for the pool are forwarded to the heap.
+ *
+ * The pool maintains per-thread statistics, available internally through
+ * BoundMethodPoolStatistics::current(). The number of outstanding blocks
+ * reflects the number of invocations queued by the thread and not processed
+ * yet by their receivers, and its peak value can be used to detect receivers
+ * that can't keep up with their senders.
+ */
+
+/**
+ * \brief Allocate memory from the current thread's pool
+ * \param[in] size The allocation size in bytes
+ *
+ * The returned memory is suitably aligned for any fundamental type. It shall
+ * be released with deallocate(), from any thread.
+ *
+ * \return A pointer to the allocated memory
+ */
+void *BoundMethodPool::allocate(size_t size)
+{
+	size += HeaderSize;
+
+	unsigned int sizeClass = 0;
+	while (sizeClass < NumSizeClasses && (MinBlockSize << sizeClass) < size)
+		sizeClass++;
+
+	ThreadCache *cache = sizeClass < NumSizeClasses ? threadCache() : nullptr;
+	if (cache)
+		return cache->allocate(sizeClass);
+
+	BlockHeader *block = static_cast<BlockHeader *>(::malloc(size));
+	if (!block)
+		throw std::bad_alloc();
+
+	block->owner = nullptr;
+	block->sizeClass = NumSizeClasses;
+
+	return blockData(block);
+}
+
+/**
+ * \brief Release memory allocated with allocate()
+ * \param[in] ptr The memory to release
+ */
+void BoundMethodPool::deallocate(void *ptr) noexcept
+{
+	if (!ptr)
+		return;
+
+	BlockHeader *block = blockHeader(ptr);
+	ThreadCache *owner = block->owner;
+
+	if (!owner)
+		::free(block);
+	else if (owner == currentCache)
+		owner->release(block);
+	else
+		owner->releaseRemote(block);
+}
+
+/**
+ * \file bound_method_pool.h
+ * \brief Method invocation memory pool
+ */
+
+/**
+ * \struct BoundMethodPoolStatistics
+ * \brief Memory pool statistics for the current thread
+ *
+ * The statistics are internal to libcamera, they are used to monitor the
+ * BoundMethodPool and to test it.
+ *
+ * \var BoundMethodPoolStatistics::allocations
+ * \brief The total number of pool allocations performed by the thread
+ *
+ * \var BoundMethodPoolStatistics::heapAllocations
+ * \brief The number of allocations that could not be served from free pool
+ * blocks and required a heap allocation
+ *
+ * \var BoundMethodPoolStatistics::outstanding
+ * \brief The number of blocks allocated by the thread and not released yet
+ *
+ * \var BoundMethodPoolStatistics::peakOutstanding
+ * \brief The maximum number of blocks allocated by the thread and not
+ * released at the same time
+ *
+ * Bound methods of signal connections are allocated from the pool for the
+ * whole lifetime of the connection, and are thus accounted for in the
+ * outstanding and peakOutstanding values.
+ */
+
+/**
+ * \brief Retrieve the pool statistics for the current thread
+ * \return The pool statistics
+ */
+BoundMethodPoolStatistics BoundMethodPoolStatistics::current()
+{
+	ThreadCache *cache = threadCache();
+	if (!cache)
+		return {};
+
+	return cache->statistics();
+}
+
+/**
+ * \brief Allocate memory for a method arguments pack
+ * \param[in] size The allocation size in bytes
+ *
+ * Argument packs are allocated from the BoundMethodPool.
+ *
+ * \return A pointer to the allocated memory
+ */
+void *BoundMethodPackBase::operator new(size_t size)
+{
+	return BoundMethodPool::allocate(size);
+}
+
+/**
+ * \brief Release memory allocated for a method arguments pack
+ * \param[in] ptr The memory to release
+ */
+void BoundMethodPackBase::operator delete(void *ptr) noexcept
+{
+	BoundMethodPool::deallocate(ptr);
+}
+
+/**
+ * \class BoundMethodPoolAllocator
+ * \brief Standard allocator backed by the BoundMethodPool
+ * \tparam T The allocated type
+ *
+ * This allocator is used with std::allocate_shared() to allocate the
+ * BoundMethodPack and its shared pointer control block from the
+ * BoundMethodPool in a single block. As the pool is internal to libcamera, the
+ * allocation is performed through BoundMethodPackBase::operator new(). Types
+ * with extended alignment requirements are allocated from the heap.
+ */
+
+/**
+ * \brief Allocate memory for a bound method
+ * \param[in] size The allocation size in bytes
+ *
+ * Bound methods are allocated from the BoundMethodPool.
+ *
+ * \return A pointer to the allocated memory
+ */
+void *BoundMethodBase::operator new(size_t size)
+{
+	return BoundMethodPool::allocate(size);
+}
+
+/**
+ * \brief Release memory allocated for a bound method
+ * \param[in] ptr The memory to release
+ */
+void BoundMethodBase::operator delete(void *ptr) noexcept
+{
+	BoundMethodPool::deallocate(ptr);
+}
+
 /**
  * \brief Invoke the bound method with packed arguments
  * \param[in] pack Packed arguments
@@ -95,7 +495,13 @@ bool BoundMethodBase::activatePack(std::shared_ptr<BoundMethodPackBase> pack,
 	}
 
 	case ConnectionTypeBlocking: {
-		Semaphore semaphore;
+		/*
+		 * The calling thread is blocked until the invocation completes
+		 * and can thus have a single blocking call in flight. Reuse a
+		 * per-thread semaphore instead of creating one for every call.
+		 * Its count is back to zero when acquire() returns.
+		 */
+		thread_local Semaphore semaphore;
 
 		std::unique_ptr<Message> msg =
 			std::make_unique<InvokeMessage>(this, pack, &semaphore, deleteMethod);
@@ -8,12 +8,19 @@
 #include <libcamera/buffer.h>
 #include "libcamera/internal/buffer.h"
 
+#include <algorithm>
 #include <errno.h>
 #include <string.h>
+#include <linux/dma-buf.h>
+#include <linux/magic.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
 #include <unistd.h>
 
 #include "libcamera/internal/log.h"
+#include "libcamera/internal/performance.h"
 
 /**
  * \file libcamera/buffer.h
@@ -50,6 +57,16 @@ LOG_DEFINE_CATEGORY(Buffer)
  * fields of the FrameMetadata structure but the status field are invalid.
  */
 
+/**
+ * \enum FrameMetadata::Flag
+ * \brief Frame properties reported in the flags field
+ *
+ * \var FrameMetadata::FlagKeyFrame
+ * The frame is a key frame of a compressed video stream, such as an H.264
+ * IDR frame, and can be decoded without referring to any other frame. The
+ * flag isn't set for formats that don't use inter-frame compression.
+ */
+
 /**
  * \struct FrameMetadata::Plane
  * \brief Per-plane frame metadata
@@ -96,8 +113,39 @@ LOG_DEFINE_CATEGORY(Buffer)
  */
 
 /**
- * \var FrameMetadata::planes
- * \brief Array of per-plane metadata
+ * \var FrameMetadata::dequeueTimestamp
+ * \brief Time when the buffer was dequeued from the device
+ *
+ * The timestamp is expressed as a number of nanoseconds of the boot clock
+ * (CLOCK_BOOTTIME). It is 0 for buffers that have not been dequeued from a
+ * device, such as buffers written by software.
+ */
+
+/**
+ * \var FrameMetadata::flags
+ * \brief Properties of the frame, as a bitmask of FrameMetadata::Flag values
+ */
+
+/**
+ * \var FrameMetadata::kMaxPlanes
+ * \brief The maximum number of planes of a FrameBuffer
+ */
+
+/**
+ * \fn FrameMetadata::planes()
+ * \copydoc FrameMetadata::planes() const
+ */
+
+/**
+ * \fn FrameMetadata::planes() const
+ * \brief Retrieve the array of per-plane metadata
+ *
+ * The per-plane metadata is stored inline in the FrameMetadata, and the number
+ * of planes is set when the FrameBuffer is constructed. Producers of frames
+ * update the metadata in place, without any memory allocation, and consumers
+ * can access it from any thread without copies.
+ *
+ * \return The array of per-plane metadata, with one entry per FrameBuffer plane
  */
 
 /**
@@ -159,10 +207,20 @@ LOG_DEFINE_CATEGORY(Buffer)
  * \brief Construct a FrameBuffer with an array of planes
  * \param[in] planes The frame memory planes
  * \param[in] cookie Cookie
+ *
+ * The number of \a planes shall not exceed FrameMetadata::kMaxPlanes.
  */
 FrameBuffer::FrameBuffer(const std::vector<Plane> &planes, unsigned int cookie)
-	: planes_(planes), request_(nullptr), cookie_(cookie)
+	: Extensible(new Private(this)), planes_(planes), request_(nullptr),
+	  cookie_(cookie)
 {
+	ASSERT(planes_.size() <= FrameMetadata::kMaxPlanes);
+
+	FrameMetadata &metadata = _d()->metadata_;
+	metadata.dequeueTimestamp = 0;
+	metadata.flags = 0;
+	metadata.numPlanes_ = planes_.size();
+	metadata.planes_ = {};
 }
 
 /**
@@ -199,10 +257,13 @@ FrameBuffer::FrameBuffer(const std::vector<Plane> &planes, unsigned int cookie)
  */
 
 /**
- * \fn FrameBuffer::metadata()
  * \brief Retrieve the dynamic metadata
  * \return Dynamic metadata for the frame contained in the buffer
  */
+const FrameMetadata &FrameBuffer::metadata() const
+{
+	return _d()->metadata_;
+}
 
 /**
  * \fn FrameBuffer::cookie()
@@ -228,12 +289,79 @@ FrameBuffer::FrameBuffer(const std::vector<Plane> &planes, unsigned int cookie)
  */
 
 /**
- * \fn FrameBuffer::cancel()
  * \brief Marks the buffer as cancelled
  *
  * If a buffer is not used by a request, it shall be marked as cancelled to
  * indicate that the metadata is invalid.
  */
+void FrameBuffer::cancel()
+{
+	_d()->metadata_.status = FrameMetadata::FrameCancelled;
+}
+
+/**
+ * \brief Retrieve and reset the fence associated with the buffer
+ *
+ * A buffer can be associated with an acquire fence when it is added to a
+ * request with Request::addBuffer(). The pipeline handler waits for the fence
+ * to be signalled before using the buffer, without blocking the caller, and
+ * closes the fence once signalled.
+ *
+ * If the fence fails to signal in time, or signals an error, the request is
+ * cancelled and the fence is kept in the buffer. This function then returns
+ * it to the application, which can pass it to the producer of the buffer
+ * contents as a release fence, or wait on it before reusing the buffer. The
+ * fence is reset in the buffer, and closed when the returned FileDescriptor
+ * and all its copies are destroyed.
+ *
+ * \return The fence associated with the buffer, or an invalid FileDescriptor
+ * if the buffer has no fence
+ */
+FileDescriptor FrameBuffer::releaseFence()
+{
+	return std::move(_d()->fence_);
+}
+
+/**
+ * \class FrameBuffer::Private
+ * \brief Internal data of a FrameBuffer
+ *
+ * The FrameBuffer::Private class holds the FrameBuffer data that only the
+ * libcamera core and pipeline handlers may modify. It is not visible to
+ * applications.
+ */
+
+/**
+ * \brief Construct the private data of a FrameBuffer
+ * \param[in] buffer The FrameBuffer the data belongs to
+ */
+FrameBuffer::Private::Private(FrameBuffer *buffer)
+	: Extensible::Private(buffer)
+{
+}
+
+/**
+ * \fn FrameBuffer::Private::metadata()
+ * \brief Retrieve the dynamic metadata for update
+ *
+ * Video devices and pipeline handlers fill the metadata when a frame is
+ * captured or produced into the buffer.
+ *
+ * \return Dynamic metadata for the frame contained in the buffer
+ */
+
+/**
+ * \fn FrameBuffer::Private::fence()
+ * \brief Retrieve the acquire fence associated with the buffer
+ * \return The acquire fence, or an invalid FileDescriptor if the buffer has no
+ * fence
+ */
+
+/**
+ * \fn FrameBuffer::Private::setFence()
+ * \brief Set the acquire fence associated with the buffer
+ * \param[in] fence The fence, or an invalid FileDescriptor to reset it
+ */
 
 /**
  * \class MappedBuffer
@@ -248,6 +376,10 @@ FrameBuffer::FrameBuffer(const std::vector<Plane> &planes, unsigned int cookie)
  * This allows treating CPU accessible memory through a generic interface
  * regardless of whether it originates from a libcamera FrameBuffer or other
  * source.
+ *
+ * Derived classes shall record the size of each plane they map with
+ * PerformanceRecorder::bufferMapped(). The MappedBuffer destructor records the
+ * unmapping of all planes.
  */
 
 /**
@@ -294,6 +426,8 @@ MappedBuffer &MappedBuffer::operator=(MappedBuffer &&other)
 {
 	error_ = other.error_;
 	maps_ = std::move(other.maps_);
+	fds_ = std::move(other.fds_);
+	pageSizes_ = std::move(other.pageSizes_);
 	other.error_ = -ENOENT;
 
 	return *this;
@@ -301,8 +435,18 @@ MappedBuffer &MappedBuffer::operator=(MappedBuffer &&other)
 
 MappedBuffer::~MappedBuffer()
 {
-	for (Plane &map : maps_)
-		munmap(map.data(), map.size());
+	int64_t mapped = 0;
+
+	for (unsigned int i = 0; i < maps_.size(); ++i) {
+		/* Hugepage mappings can only be unmapped in whole pages. */
+		const size_t pageSize = this->pageSize(i);
+		const size_t length = (maps_[i].size() + pageSize - 1) / pageSize * pageSize;
+
+		munmap(maps_[i].data(), length);
+		mapped += maps_[i].size();
+	}
+
+	PerformanceRecorder::instance()->bufferMapped(-mapped);
 }
 
 /**
@@ -332,6 +476,25 @@ MappedBuffer::~MappedBuffer()
  * \return A vector of the mapped planes
  */
 
+/**
+ * \brief Retrieve the size of the pages backing a mapped plane
+ * \param[in] plane The plane index
+ *
+ * Planes backed by explicit hugepages are mapped with pages larger than the
+ * system page size, which reduces the number of TLB misses when the CPU
+ * processes large frames. Transparent hugepages are used opportunistically by
+ * the kernel and are not reflected in the returned value.
+ *
+ * \return The page size of the \a plane mapping in bytes
+ */
+size_t MappedBuffer::pageSize(unsigned int plane) const
+{
+	if (plane < pageSizes_.size())
+		return pageSizes_[plane];
+
+	return sysconf(_SC_PAGESIZE);
+}
+
 /**
  * \var MappedBuffer::error_
  * \brief Stores the error value if present
@@ -349,6 +512,119 @@ MappedBuffer::~MappedBuffer()
  * completed successfully.
  */
 
+/**
+ * \var MappedBuffer::fds_
+ * \brief Stores the dmabuf file descriptors backing the mapped planes
+ *
+ * MappedBuffer derived classes that map dmabufs shall store their file
+ * descriptors in this vector, to allow CpuAccess to synchronize the CPU caches
+ * with the device. The vector may be empty if no synchronization is needed.
+ */
+
+/**
+ * \var MappedBuffer::pageSizes_
+ * \brief Stores the page size of the mapped planes
+ *
+ * MappedBuffer derived classes that map memory with pages larger than the
+ * system page size shall store the page size of each plane in this vector. The
+ * vector may be empty if all planes use the system page size.
+ */
+
+/**
+ * \class MappedBuffer::CpuAccess
+ * \brief Scoped CPU access to the memory of a MappedBuffer
+ *
+ * Buffers allocated from cached memory, such as the dmabuf system heap, need
+ * their CPU caches to be synchronized with the device that produces or
+ * consumes their contents. Without synchronization, the CPU may read stale
+ * data written by a device, or a device may miss data written by the CPU.
+ *
+ * The CpuAccess class brackets CPU accesses to the mapped memory with the
+ * DMA_BUF_IOCTL_SYNC ioctl. The constructor signals the start of the CPU
+ * access, and the destructor its end. Users shall only access the mapped
+ * memory of the buffer within the lifetime of a CpuAccess instance:
+ *
+ * \code{.cpp}
+ * {
+ * 	MappedBuffer::CpuAccess access(&mapped, PROT_READ);
+ * 	process(mapped.maps()[0]);
+ * }
+ * \endcode
+ *
+ * Synchronization is a no-op for memory not backed by a dmabuf. The CpuAccess
+ * instance shall not outlive the MappedBuffer.
+ */
+
+/**
+ * \brief Start CPU access to the memory of a mapped buffer
+ * \param[in] buffer The mapped buffer
+ * \param[in] flags The access direction, as PROT_READ, PROT_WRITE or a
+ * bitwise-or combination of both
+ *
+ * The access direction shall be covered by the protection flags the buffer has
+ * been mapped with. Errors are reported through error().
+ */
+MappedBuffer::CpuAccess::CpuAccess(const MappedBuffer *buffer, int flags)
+	: buffer_(buffer), flags_(0)
+{
+	if (flags & PROT_READ)
+		flags_ |= DMA_BUF_SYNC_READ;
+	if (flags & PROT_WRITE)
+		flags_ |= DMA_BUF_SYNC_WRITE;
+
+	error_ = sync(DMA_BUF_SYNC_START);
+}
+
+/**
+ * \brief End CPU access to the memory of the mapped buffer
+ */
+MappedBuffer::CpuAccess::~CpuAccess()
+{
+	if (!error_)
+		sync(DMA_BUF_SYNC_END);
+}
+
+/**
+ * \fn MappedBuffer::CpuAccess::error()
+ * \brief Retrieve the synchronization error status
+ *
+ * The mapped memory may not be coherent with the device if the start of the
+ * CPU access failed to be signalled.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+
+int MappedBuffer::CpuAccess::sync(uint64_t flags)
+{
+	if (!flags_)
+		return 0;
+
+	struct dma_buf_sync sync = {};
+	sync.flags = flags_ | flags;
+
+	for (const FileDescriptor &fd : buffer_->fds_) {
+		int ret;
+
+		do {
+			ret = ioctl(fd.fd(), DMA_BUF_IOCTL_SYNC, &sync);
+		} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+		if (ret < 0) {
+			ret = -errno;
+
+			/* Memory not backed by a dmabuf needs no synchronization. */
+			if (ret == -ENOTTY)
+				continue;
+
+			LOG(Buffer, Error)
+				<< "Failed to synchronize buffer: " << strerror(-ret);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
 /**
  * \class MappedFrameBuffer
  * \brief Map a FrameBuffer using the MappedBuffer interface
@@ -362,12 +638,22 @@ MappedBuffer::~MappedBuffer()
  * Construct an object to map a frame buffer for CPU access.
  * The flags are passed directly to mmap and should be either PROT_READ,
  * PROT_WRITE, or a bitwise-or combination of both.
+ *
+ * The mapped memory shall only be accessed within the scope of a
+ * MappedBuffer::CpuAccess to ensure coherency with the device. The size of the
+ * pages backing each plane is reported by pageSize().
  */
 MappedFrameBuffer::MappedFrameBuffer(const FrameBuffer *buffer, int flags)
 {
+	const size_t systemPageSize = sysconf(_SC_PAGESIZE);
+
 	maps_.reserve(buffer->planes().size());
 
 	for (const FrameBuffer::Plane &plane : buffer->planes()) {
+		struct statfs fs;
+		if (fstatfs(plane.fd.fd(), &fs) < 0)
+			fs.f_type = 0;
+
 		void *address = mmap(nullptr, plane.length, flags,
 				     MAP_SHARED, plane.fd.fd(), 0);
 		if (address == MAP_FAILED) {
@@ -376,8 +662,134 @@ MappedFrameBuffer::MappedFrameBuffer(const FrameBuffer *buffer, int flags)
 			break;
 		}
 
+		/*
+		 * Memory allocated from hugetlbfs is mapped with hugepages, while
+		 * shared memory can be backed by transparent hugepages if the
+		 * kernel is advised to.
+		 */
+		size_t pageSize = systemPageSize;
+		if (fs.f_type == HUGETLBFS_MAGIC)
+			pageSize = fs.f_bsize;
+		else if (fs.f_type == TMPFS_MAGIC)
+			madvise(address, plane.length, MADV_HUGEPAGE);
+
 		maps_.emplace_back(static_cast<uint8_t *>(address), plane.length);
+		fds_.push_back(plane.fd);
+		pageSizes_.push_back(pageSize);
+
+		PerformanceRecorder::instance()->bufferMapped(plane.length);
+	}
+}
+
+/**
+ * \class MappedBufferCache
+ * \brief Cache memory mappings of FrameBuffer instances
+ *
+ * Mapping a FrameBuffer with MappedFrameBuffer requires one mmap() call per
+ * plane, and unmapping it when the MappedFrameBuffer is destroyed requires
+ * page table and TLB invalidation. Components that access the same buffers
+ * repeatedly, such as post-processors that map a buffer for every frame, can
+ * use a MappedBufferCache to reuse mappings across frames.
+ *
+ * The cache identifies buffers by the dmabufs backing their planes, and not by
+ * the FrameBuffer instances. Mappings are thus reused when a new FrameBuffer is
+ * created for memory that has already been mapped, as commonly happens when
+ * buffers are wrapped in FrameBuffer instances for every request.
+ *
+ * A cached mapping keeps the underlying memory alive. The number of cached
+ * buffers is bounded by the cache capacity, the least recently used mappings
+ * are unmapped when the capacity is exceeded. Users shall call clear() when
+ * the buffers they use are reallocated, for instance when they are
+ * reconfigured.
+ *
+ * The MappedBufferCache class is not thread-safe.
+ */
+
+/**
+ * \brief Construct a MappedBufferCache
+ * \param[in] capacity The maximum number of buffers to keep mapped
+ *
+ * The cache keeps at least one buffer mapped, a zero \a capacity is treated
+ * as one.
+ */
+MappedBufferCache::MappedBufferCache(unsigned int capacity)
+	: capacity_(std::max(capacity, 1u))
+{
+}
+
+/**
+ * \brief Map a FrameBuffer, reusing a cached mapping when available
+ * \param[in] buffer The FrameBuffer to map
+ * \param[in] flags Protection flags to apply to the map
+ *
+ * A cached mapping is reused if it covers the same memory as \a buffer and
+ * has been created with at least the protection \a flags. Otherwise the
+ * \a buffer is mapped with MappedFrameBuffer and the mapping is added to the
+ * cache.
+ *
+ * The returned mapping is valid until the next call to map() or clear(), or
+ * until the cache is destroyed.
+ *
+ * \return The mapped buffer, or nullptr if the buffer can't be mapped
+ */
+const MappedBuffer *MappedBufferCache::map(const FrameBuffer *buffer, int flags)
+{
+	Key key;
+	key.reserve(buffer->planes().size());
+
+	for (const FrameBuffer::Plane &plane : buffer->planes()) {
+		struct stat st;
+		if (fstat(plane.fd.fd(), &st) < 0) {
+			LOG(Buffer, Error)
+				<< "Failed to identify plane: " << strerror(errno);
+			return nullptr;
+		}
+
+		key.emplace_back(st.st_dev, st.st_ino, plane.length);
+	}
+
+	for (auto iter = entries_.begin(); iter != entries_.end(); ++iter) {
+		if (iter->key != key || (iter->flags & flags) != flags)
+			continue;
+
+		/* Move the entry to the front, to evict the oldest first. */
+		entries_.splice(entries_.begin(), entries_, iter);
+		return entries_.front().mapping.get();
+	}
+
+	auto mapping = std::make_unique<MappedFrameBuffer>(buffer, flags);
+	if (!mapping->isValid()) {
+		LOG(Buffer, Error)
+			<< "Failed to map buffer: " << strerror(-mapping->error());
+		return nullptr;
 	}
+
+	entries_.push_front({ std::move(key), flags, std::move(mapping) });
+
+	if (entries_.size() > capacity_)
+		entries_.pop_back();
+
+	return entries_.front().mapping.get();
+}
+
+/**
+ * \brief Unmap all the cached mappings
+ */
+void MappedBufferCache::clear()
+{
+	entries_.clear();
 }
 
+/**
+ * \fn MappedBufferCache::capacity()
+ * \brief Retrieve the maximum number of buffers kept mapped by the cache
+ * \return The cache capacity
+ */
+
+/**
+ * \fn MappedBufferCache::size()
+ * \brief Retrieve the number of buffers currently mapped by the cache
+ * \return The number of cached mappings
+ */
+
 } /* namespace libcamera */
@@ -47,8 +47,15 @@ LOG_DEFINE_CATEGORY(Serialization)
  * advances the internal access location, but allows the carved out memory to
  * be accessed at a later time.
  *
- * All accesses beyond the end of the buffer (read, write, skip or carve out)
- * are blocked. The first of such accesses causes a message to be logged, and
+ * A write buffer can also be created over a std::vector, in which case it
+ * grows the vector as data is written instead of being limited to a fixed
+ * size. This allows serializing data in a single pass without computing its
+ * size beforehand. The vector keeps its capacity between uses, so reusing the
+ * same vector for successive serializations avoids memory allocations once it
+ * has grown large enough.
+ *
+ * All accesses beyond the end of a fixed-size buffer (read, write, skip or
+ * carve out) are blocked. The first of such accesses causes a message to be logged, and
  * the buffer being marked as having overflown. If the buffer has been carved
  * out from a parent buffer, the parent buffer is also marked as having
  * overflown. Any later access on an overflown buffer is blocked. The buffer
@@ -62,8 +69,8 @@ LOG_DEFINE_CATEGORY(Serialization)
  * \param[in] size The size of the memory area to wrap
  */
 ByteStreamBuffer::ByteStreamBuffer(const uint8_t *base, size_t size)
-	: parent_(nullptr), base_(base), size_(size), overflow_(false),
-	  read_(base), write_(nullptr)
+	: parent_(nullptr), storage_(nullptr), base_(base), size_(size),
+	  overflow_(false), read_(base), write_(nullptr)
 {
 }
 
@@ -74,11 +81,40 @@ ByteStreamBuffer::ByteStreamBuffer(const uint8_t *base, size_t size)
  * \param[in] size The size of the memory area to wrap
  */
 ByteStreamBuffer::ByteStreamBuffer(uint8_t *base, size_t size)
-	: parent_(nullptr), base_(base), size_(size), overflow_(false),
-	  read_(nullptr), write_(base)
+	: parent_(nullptr), storage_(nullptr), base_(base), size_(size),
+	  overflow_(false), read_(nullptr), write_(base)
 {
 }
 
+/**
+ * \brief Construct a growable write ByteStreamBuffer over the vector \a storage
+ * \param[in] storage The vector to write to
+ *
+ * The \a storage vector is cleared, and grows as data is written to the buffer.
+ * Its size is always equal to the number of bytes written. The caller shall
+ * ensure that the vector isn't accessed through other means and stays valid
+ * for the lifetime of the buffer.
+ *
+ * Buffers carved out of a growable buffer point to the vector memory, and are
+ * invalidated when the vector needs to be reallocated to grow. Callers that
+ * carve out buffers shall reserve() the space they need first.
+ */
+ByteStreamBuffer::ByteStreamBuffer(std::vector<uint8_t> *storage)
+	: parent_(nullptr), storage_(storage), overflow_(false), read_(nullptr)
+{
+	/*
+	 * Ensure the vector has allocated memory, as a null write pointer
+	 * denotes a read buffer.
+	 */
+	storage_->clear();
+	if (!storage_->capacity())
+		storage_->reserve(256);
+
+	base_ = storage_->data();
+	size_ = 0;
+	write_ = storage_->data();
+}
+
 /**
  * \brief Construct a ByteStreamBuffer from the contents of \a other using move
  * semantics
@@ -103,6 +139,7 @@ ByteStreamBuffer::ByteStreamBuffer(ByteStreamBuffer &&other)
 ByteStreamBuffer &ByteStreamBuffer::operator=(ByteStreamBuffer &&other)
 {
 	parent_ = other.parent_;
+	storage_ = other.storage_;
 	base_ = other.base_;
 	size_ = other.size_;
 	overflow_ = other.overflow_;
@@ -110,6 +147,7 @@ ByteStreamBuffer &ByteStreamBuffer::operator=(ByteStreamBuffer &&other)
 	write_ = other.write_;
 
 	other.parent_ = nullptr;
+	other.storage_ = nullptr;
 	other.base_ = nullptr;
 	other.size_ = 0;
 	other.overflow_ = false;
@@ -134,6 +172,9 @@ ByteStreamBuffer &ByteStreamBuffer::operator=(ByteStreamBuffer &&other)
 /**
  * \fn ByteStreamBuffer::size()
  * \brief Retrieve the size of the managed memory buffer
+ *
+ * For growable buffers, the size is the number of bytes written so far.
+ *
  * \return The size of managed memory buffer
  */
 
@@ -151,6 +192,25 @@ void ByteStreamBuffer::setOverflow()
 	overflow_ = true;
 }
 
+/*
+ * Grow the storage of a growable write buffer to make room for \a size bytes
+ * at the current location. Return false if the buffer can't grow.
+ */
+bool ByteStreamBuffer::grow(size_t size)
+{
+	if (!storage_)
+		return false;
+
+	size_t offset = write_ - base_;
+	storage_->resize(offset + size);
+
+	base_ = storage_->data();
+	size_ = storage_->size();
+	write_ = storage_->data() + offset;
+
+	return true;
+}
+
 /**
  * \brief Carve out an area of \a size bytes into a new ByteStreamBuffer
  * \param[in] size The size of the newly created memory buffer
@@ -165,11 +225,11 @@ void ByteStreamBuffer::setOverflow()
  */
 ByteStreamBuffer ByteStreamBuffer::carveOut(size_t size)
 {
-	if (!size_ || overflow_)
+	if ((!size_ && !storage_) || overflow_)
 		return ByteStreamBuffer(static_cast<const uint8_t *>(nullptr), 0);
 
 	const uint8_t *curr = read_ ? read_ : write_;
-	if (curr + size > base_ + size_) {
+	if (curr + size > base_ + size_ && (read_ || !grow(size))) {
 		LOG(Serialization, Error)
 			<< "Unable to reserve " << size << " bytes";
 		setOverflow();
@@ -205,7 +265,7 @@ int ByteStreamBuffer::skip(size_t size)
 		return -ENOSPC;
 
 	const uint8_t *curr = read_ ? read_ : write_;
-	if (curr + size > base_ + size_) {
+	if (curr + size > base_ + size_ && (read_ || !grow(size))) {
 		LOG(Serialization, Error)
 			<< "Unable to skip " << size << " bytes";
 		setOverflow();
@@ -223,6 +283,26 @@ int ByteStreamBuffer::skip(size_t size)
 	return 0;
 }
 
+/**
+ * \brief Reserve space for \a size bytes in a growable buffer
+ * \param[in] size The number of bytes to reserve
+ *
+ * This method ensures that \a size bytes can be written, skipped or carved out
+ * of a growable buffer from the current location without reallocating its
+ * storage. It has no effect on fixed-size buffers.
+ */
+void ByteStreamBuffer::reserve(size_t size)
+{
+	if (!storage_ || !write_)
+		return;
+
+	size_t offset = write_ - base_;
+	storage_->reserve(offset + size);
+
+	base_ = storage_->data();
+	write_ = storage_->data() + offset;
+}
+
 /**
  * \fn template<typename T> int ByteStreamBuffer::read(T *t)
  * \brief Read data from the managed memory buffer into \a t
@@ -327,7 +407,7 @@ int ByteStreamBuffer::write(const uint8_t *data, size_t size)
 	if (overflow_)
 		return -ENOSPC;
 
-	if (write_ + size > base_ + size_) {
+	if (write_ + size > base_ + size_ && !grow(size)) {
 		LOG(Serialization, Error)
 			<< "Unable to write " << size << " bytes: no space left";
 		setOverflow();
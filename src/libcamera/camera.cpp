@@ -9,15 +9,22 @@
 
 #include <array>
 #include <atomic>
+#include <chrono>
 #include <iomanip>
+#include <vector>
 
+#include <libcamera/buffer.h>
+#include <libcamera/completion_queue.h>
+#include <libcamera/control_ids.h>
 #include <libcamera/framebuffer_allocator.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
+#include "libcamera/internal/formats.h"
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/pipeline_handler.h"
 #include "libcamera/internal/thread.h"
+#include "libcamera/internal/utils.h"
 
 /**
  * \file camera.h
@@ -99,12 +106,43 @@
  * on the crop rectangle and the output stream size. The crop rectangle is
  * expressed relatively to the full pixel array size and indicates how the field
  * of view is affected by the pipeline.
+ *
+ * \section camera-stream-activation Stream Activation
+ *
+ * The streams of a camera configuration are all ready to capture frames once
+ * the camera is started, but each request only captures frames for the
+ * streams it contains a buffer for. Applications that switch between streams,
+ * for instance to capture a still image or to record a video while displaying
+ * a preview, shall configure the camera with all the streams they need up
+ * front. Adding a buffer for a stream to a request activates the stream for
+ * that frame only, without stopping and reconfiguring the camera.
+ *
+ * Pipeline handlers feed the streams missing from a request with internal
+ * buffers or skip them, depending on the hardware. The configuration of all
+ * streams, including their sizes and formats, is however applied for the
+ * whole capture session and may limit the frame rate or increase the memory
+ * bandwidth, even when the streams are not active.
  */
 
 namespace libcamera {
 
 LOG_DECLARE_CATEGORY(Camera)
 
+namespace {
+
+uint64_t frameBuffersSize(const std::vector<std::unique_ptr<FrameBuffer>> &buffers)
+{
+	uint64_t size = 0;
+	for (const std::unique_ptr<FrameBuffer> &buffer : buffers) {
+		for (const FrameBuffer::Plane &plane : buffer->planes())
+			size += plane.length;
+	}
+
+	return size;
+}
+
+} /* namespace */
+
 /**
  * \class CameraConfiguration
  * \brief Hold configuration for streams of the camera
@@ -154,7 +192,8 @@ LOG_DECLARE_CATEGORY(Camera)
  * \brief Create an empty camera configuration
  */
 CameraConfiguration::CameraConfiguration()
-	: transform(Transform::Identity), config_({})
+	: transform(Transform::Identity), maxFrameDuration(0), zslDepth(0),
+	  lowLatency(false), config_({})
 {
 }
 
@@ -311,6 +350,199 @@ std::size_t CameraConfiguration::size() const
 	return config_.size();
 }
 
+/**
+ * \struct CameraConfiguration::Bandwidth
+ * \brief Memory bandwidth consumed by a camera configuration
+ *
+ * The bandwidth is expressed in bytes per second. It is an estimate computed
+ * from the frame sizes, and doesn't take caches, compression or bus overheads
+ * into account.
+ *
+ * \var CameraConfiguration::Bandwidth::streams
+ * \brief Bandwidth written to the buffers of each stream, in the order of the
+ * stream configurations
+ *
+ * Applications that read the buffers, or pass them to other devices, consume
+ * additional bandwidth that is not accounted for.
+ *
+ * \var CameraConfiguration::Bandwidth::internal
+ * \brief Bandwidth consumed by the buffers internal to the pipeline handler
+ *
+ * This includes raw frames written by the receiver and read by the ISP when
+ * they're not captured by an application stream, and the statistics and
+ * parameters buffers of the ISP.
+ */
+
+/**
+ * \brief Compute the total bandwidth of the camera configuration
+ * \return The sum of the streams and internal bandwidth, in bytes per second
+ */
+uint64_t CameraConfiguration::Bandwidth::total() const
+{
+	uint64_t bandwidth = internal;
+
+	for (uint64_t stream : streams)
+		bandwidth += stream;
+
+	return bandwidth;
+}
+
+/**
+ * \brief Estimate the memory bandwidth consumed by the camera configuration
+ * \param[in] frameRate The frame rate, in frames per second
+ *
+ * This function estimates the memory bandwidth that capturing with the camera
+ * configuration will consume at \a frameRate. It lets applications pick a
+ * configuration that fits in the memory bandwidth budget of the platform
+ * before starting the camera, especially when running multiple streams or
+ * multiple cameras concurrently.
+ *
+ * The estimate is only meaningful for a configuration that has been
+ * validated, as it relies on the sizes and formats adjusted by validate().
+ *
+ * \return The estimated bandwidth of the configuration
+ */
+CameraConfiguration::Bandwidth CameraConfiguration::bandwidth(double frameRate) const
+{
+	Bandwidth bandwidth;
+
+	for (const StreamConfiguration &cfg : config_)
+		bandwidth.streams.push_back(static_cast<uint64_t>(frameSize(cfg) * frameRate));
+
+	bandwidth.internal = static_cast<uint64_t>(internalFrameTraffic() * frameRate);
+
+	return bandwidth;
+}
+
+/**
+ * \brief Retrieve the number of requests to keep queued to avoid frame drops
+ *
+ * The pipeline handler can only capture a frame when a request has been
+ * queued for it. This function advises on the number of requests applications
+ * should keep queued to the camera at all times so that every frame produced
+ * by the sensor finds one, accounting for the frames being captured and
+ * processed by the pipeline. Queuing more requests doesn't reduce frame drops
+ * further, but increases memory usage.
+ *
+ * The value is a lower bound: applications that take time to requeue
+ * completed requests shall add the requests they hold on to. The
+ * CameraPerformance::framesDroppedNoRequest counter and the
+ * controls::FrameDropReason metadata tell when frames are lost because no
+ * request was queued.
+ *
+ * The depth is only meaningful for a configuration that has been validated.
+ * The default implementation returns 2, one request being captured while the
+ * next one is ready for the following frame. Pipeline handlers that process
+ * frames in multiple stages override this function.
+ *
+ * \return The minimum number of requests to keep queued
+ */
+unsigned int CameraConfiguration::minRequestDepth() const
+{
+	return 2;
+}
+
+/**
+ * \brief Retrieve the expected capture latency of the camera in frames
+ *
+ * The capture latency is the time between the end of the exposure of a frame
+ * by the camera sensor and the completion of the request it is captured for,
+ * expressed in frame durations. It includes the transfer of the frame from the
+ * sensor and its processing by the pipeline, provided that the application
+ * keeps minRequestDepth() requests queued. Applications add the time they take
+ * to consume the frame, such as the display latency, to compute the glass to
+ * glass latency.
+ *
+ * The latency is only meaningful for a configuration that has been validated,
+ * and depends on the \a lowLatency mode. The default implementation returns 1,
+ * the frame being transferred to memory while the sensor reads it out.
+ * Pipeline handlers that process frames in multiple stages override this
+ * function.
+ *
+ * \return The expected capture latency, in frames
+ */
+unsigned int CameraConfiguration::frameLatency() const
+{
+	return 1;
+}
+
+/**
+ * \brief Retrieve the memory traffic internal to the pipeline for one frame
+ *
+ * Pipeline handlers that use intermediate buffers, such as raw frames
+ * transferred from the receiver to the ISP in memory, or ISP statistics and
+ * parameters, override this function to report how many bytes are written to
+ * and read from those buffers for every frame. Traffic to the buffers of the
+ * streams in the configuration shall not be included.
+ *
+ * The default implementation returns 0, for pipelines that have no internal
+ * buffers.
+ *
+ * \return The number of bytes transferred to and from internal buffers per
+ * frame
+ */
+uint64_t CameraConfiguration::internalFrameTraffic() const
+{
+	return 0;
+}
+
+/**
+ * \brief Compute the size of a frame for a stream configuration
+ * \param[in] cfg The stream configuration
+ *
+ * The frame size is taken from StreamConfiguration::frameSize when set by the
+ * pipeline handler. Otherwise it is computed from the pixel format plane
+ * layout, the stride and the size.
+ *
+ * \return The frame size in bytes, or 0 if the pixel format is unknown
+ */
+uint64_t CameraConfiguration::frameSize(const StreamConfiguration &cfg)
+{
+	if (cfg.frameSize)
+		return cfg.frameSize;
+
+	const PixelFormatInfo &info = PixelFormatInfo::info(cfg.pixelFormat);
+	if (!info.isValid())
+		return 0;
+
+	if (!cfg.stride)
+		return info.frameSize(cfg.size);
+
+	/* Scale the stride of the other planes with the first plane. */
+	std::array<unsigned int, 3> strides = {};
+	unsigned int stride0 = info.stride(cfg.size.width, 0);
+	for (unsigned int i = 0; i < info.numPlanes(); i++)
+		strides[i] = stride0 ? static_cast<uint64_t>(cfg.stride) *
+				       info.stride(cfg.size.width, i) / stride0
+				     : 0;
+
+	return info.frameSize(cfg.size, strides);
+}
+
+/**
+ * \brief Check if the stride of a stream configuration is aligned as requested
+ * \param[in] cfg The stream configuration
+ *
+ * Pipeline handlers call this function from validate() after computing the
+ * stride of \a cfg. If the stride isn't a multiple of the requested
+ * StreamConfiguration::strideAlign, the alignment request can't be honoured
+ * and is reset to 0.
+ *
+ * \return True if \a cfg has been adjusted, false otherwise
+ */
+bool CameraConfiguration::adjustStrideAlign(StreamConfiguration *cfg)
+{
+	if (!cfg->strideAlign || cfg->stride % cfg->strideAlign == 0)
+		return false;
+
+	LOG(Camera, Debug)
+		<< "Stride " << cfg->stride << " not aligned to "
+		<< cfg->strideAlign << " bytes, ignoring alignment";
+
+	cfg->strideAlign = 0;
+	return true;
+}
+
 /**
  * \var CameraConfiguration::transform
  * \brief User-specified transform to be applied to the image
@@ -325,6 +557,46 @@ std::size_t CameraConfiguration::size() const
  * may adjust this field at its discretion if the selection is not supported.
  */
 
+/**
+ * \var CameraConfiguration::maxFrameDuration
+ * \brief The longest frame duration required by the application
+ *
+ * The frame duration is expressed in microseconds, as for the
+ * controls::FrameDurationLimits control, and 0 means that the application has
+ * no frame rate requirement. Pipeline handlers take it into account to select
+ * a camera sensor mode able to reach the corresponding frame rate. When no
+ * mode can, the validate() function raises it to the shortest frame duration
+ * of the selected mode. Pipeline handlers that don't choose between sensor
+ * modes ignore this field.
+ */
+
+/**
+ * \var CameraConfiguration::zslDepth
+ * \brief The number of recent frames to keep for zero shutter lag capture
+ *
+ * When non-zero, the camera keeps a copy of the buffers and metadata of the
+ * last \a zslDepth completed requests, from which requests that set the
+ * controls::ZslTimestamp control are served immediately. The copies are stored
+ * in memory allocated when the camera is configured, for every stream of the
+ * configuration. The default value of 0 disables zero shutter lag capture.
+ */
+
+/**
+ * \var CameraConfiguration::lowLatency
+ * \brief Optimise the configuration for the lowest capture latency
+ *
+ * When set, pipeline handlers that process frames in multiple stages minimise
+ * the number of frames held in the pipeline, at the expense of throughput. The
+ * validate() function lowers the StreamConfiguration::bufferCount of the
+ * streams to minRequestDepth(), fewer frames are processed concurrently, and
+ * frames that queue up behind a busy stage of the pipeline may be dropped in
+ * favour of the newest one. The frameLatency() function reports the resulting
+ * latency.
+ *
+ * Other pipeline handlers ignore this field. The default value of false
+ * favours a steady frame rate over latency.
+ */
+
 /**
  * \var CameraConfiguration::config_
  * \brief The vector of stream configurations
@@ -356,21 +628,53 @@ public:
 	void disconnect();
 	void setState(State state);
 
+	int validateRequest(const Request *request) const;
+
+	void saveConfiguration(const CameraConfiguration *config);
+	bool matchesConfiguration(const CameraConfiguration *config) const;
+
 	std::shared_ptr<PipelineHandler> pipe_;
 	std::string id_;
 	std::set<Stream *> streams_;
 	std::set<const Stream *> activeStreams_;
+	CompletionQueue *completionQueue_;
+
+	/* The last configuration applied, kept in warm standby. */
+	std::vector<StreamConfiguration> config_;
+	Transform transform_;
+	int64_t maxFrameDuration_;
+	unsigned int zslDepth_;
+	bool lowLatency_;
+	bool standby_;
+
+	/* Memory of the buffers allocated with FrameBufferAllocator. */
+	std::atomic<uint64_t> applicationMemory_;
+
+	void recordPerformance(Request *request, uint64_t latency);
+	void resetPerformance();
+	CameraPerformance performance() const;
 
 private:
 	bool disconnected_;
 	std::atomic<State> state_;
+
+	/* Protects the performance counters. */
+	mutable Mutex performanceMutex_;
+	CameraPerformance performance_;
+	bool lastFrameValid_;
+	uint32_t lastSequence_;
+	uint64_t lastTimestamp_;
 };
 
 Camera::Private::Private(Camera *camera, PipelineHandler *pipe,
 			 const std::string &id,
 			 const std::set<Stream *> &streams)
 	: Extensible::Private(camera), pipe_(pipe->shared_from_this()), id_(id),
-	  streams_(streams), disconnected_(false), state_(CameraAvailable)
+	  streams_(streams), completionQueue_(nullptr),
+	  transform_(Transform::Identity), maxFrameDuration_(0), zslDepth_(0),
+	  lowLatency_(false), standby_(false), applicationMemory_(0),
+	  disconnected_(false), state_(CameraAvailable),
+	  lastFrameValid_(false), lastSequence_(0), lastTimestamp_(0)
 {
 }
 
@@ -448,6 +752,125 @@ void Camera::Private::setState(State state)
 	state_.store(state, std::memory_order_release);
 }
 
+int Camera::Private::validateRequest(const Request *request) const
+{
+	if (request->buffers().empty()) {
+		LOG(Camera, Error) << "Request contains no buffers";
+		return -EINVAL;
+	}
+
+	for (auto const &it : request->buffers()) {
+		const Stream *stream = it.first;
+
+		if (activeStreams_.find(stream) == activeStreams_.end()) {
+			LOG(Camera, Error) << "Invalid request";
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+void Camera::Private::saveConfiguration(const CameraConfiguration *config)
+{
+	config_.assign(config->begin(), config->end());
+	transform_ = config->transform;
+	maxFrameDuration_ = config->maxFrameDuration;
+	zslDepth_ = config->zslDepth;
+	lowLatency_ = config->lowLatency;
+}
+
+/*
+ * Check if a validated configuration is identical to the last configuration
+ * applied to the camera, in which case the pipeline handler doesn't need to
+ * apply it again.
+ */
+bool Camera::Private::matchesConfiguration(const CameraConfiguration *config) const
+{
+	if (config->size() != config_.size() ||
+	    config->transform != transform_ ||
+	    config->maxFrameDuration != maxFrameDuration_ ||
+	    config->zslDepth != zslDepth_ ||
+	    config->lowLatency != lowLatency_)
+		return false;
+
+	for (unsigned int i = 0; i < config_.size(); ++i) {
+		const StreamConfiguration &a = config->at(i);
+		const StreamConfiguration &b = config_[i];
+
+		if (a.pixelFormat != b.pixelFormat || a.size != b.size ||
+		    a.crop != b.crop || a.stride != b.stride ||
+		    a.strideAlign != b.strideAlign ||
+		    a.frameSize != b.frameSize ||
+		    a.bufferCount != b.bufferCount)
+			return false;
+	}
+
+	return true;
+}
+
+void Camera::Private::recordPerformance(Request *request, uint64_t latency)
+{
+	MutexLocker locker(performanceMutex_);
+
+	if (request->status() == Request::RequestCancelled) {
+		performance_.requestsCancelled++;
+		return;
+	}
+
+	performance_.requestsCompleted++;
+	performance_.requestLatency.add(latency);
+
+	/*
+	 * Use the first buffer of the request to track the frame timing, the
+	 * buffers of all streams are captured from the same frame.
+	 */
+	if (request->buffers().empty())
+		return;
+
+	const FrameMetadata &metadata =
+		request->buffers().begin()->second->metadata();
+	if (metadata.status != FrameMetadata::FrameSuccess)
+		return;
+
+	/* Frames served from the zero shutter lag ring have been counted. */
+	if (request->metadata().contains(controls::ZslTimestamp))
+		return;
+
+	if (lastFrameValid_ && metadata.sequence > lastSequence_) {
+		uint32_t dropped = metadata.sequence - lastSequence_ - 1;
+
+		performance_.framesDropped += dropped;
+		performance_.frameInterval.add(metadata.timestamp - lastTimestamp_);
+
+		if (dropped && request->metadata().contains(controls::FrameDropReason)) {
+			if (request->metadata().get(controls::FrameDropReason) ==
+			    controls::FrameDropNoRequest)
+				performance_.framesDroppedNoRequest += dropped;
+			else
+				performance_.framesDroppedLate += dropped;
+		}
+	}
+
+	lastFrameValid_ = true;
+	lastSequence_ = metadata.sequence;
+	lastTimestamp_ = metadata.timestamp;
+}
+
+void Camera::Private::resetPerformance()
+{
+	MutexLocker locker(performanceMutex_);
+
+	performance_ = {};
+	lastFrameValid_ = false;
+}
+
+CameraPerformance Camera::Private::performance() const
+{
+	MutexLocker locker(performanceMutex_);
+	return performance_;
+}
+
 /**
  * \class Camera
  * \brief Camera device
@@ -607,9 +1030,43 @@ const std::string &Camera::id() const
  * completed
  */
 
+/**
+ * \var Camera::partialResultAvailable
+ * \brief Signal emitted with the metadata known when a buffer has completed
+ *
+ * Requests are completed in submission order, once all their buffers have
+ * completed and their metadata is final. A buffer of a fast stream can thus
+ * wait for a slower stream of the same request before the requestCompleted
+ * signal is emitted. This signal is emitted as soon as a buffer completes,
+ * along with the buffer, to let latency sensitive applications process it
+ * right away.
+ *
+ * The ControlList argument is a snapshot of the request metadata at the time
+ * the buffer completed. It contains a subset of the final metadata, typically
+ * the controls::SensorTimestamp and the controls applied to the frame such as
+ * controls::ExposureTime, depending on the pipeline handler. The buffer
+ * sequence number and timestamp are available from the FrameBuffer metadata.
+ * The final metadata is delivered with the request when the requestCompleted
+ * signal is emitted.
+ *
+ * Slots shall not access the request metadata directly, as the pipeline
+ * handler may still be updating it, but use the ControlList argument instead.
+ * The status of the buffer shall be checked, as the signal is also emitted for
+ * cancelled buffers.
+ */
+
 /**
  * \var Camera::requestCompleted
  * \brief Signal emitted when a request queued to the camera has completed
+ *
+ * The signal is emitted from the internal thread of the camera. Slots of
+ * objects that don't inherit from Object, and slots connected with
+ * ConnectionTypeDirect, are called directly from that thread, without any
+ * thread handoff. They shall return quickly and shall in particular not block,
+ * as they delay the processing of all subsequent events of the camera.
+ * Applications that process completions in their own thread can use a
+ * CompletionQueue instead of a queued connection to lower the completion
+ * latency, see setCompletionQueue().
  */
 
 /**
@@ -671,9 +1128,21 @@ int Camera::exportFrameBuffers(Stream *stream,
 	if (d->activeStreams_.find(stream) == d->activeStreams_.end())
 		return -EINVAL;
 
-	return d->pipe_->invokeMethod(&PipelineHandler::exportFrameBuffers,
-				      ConnectionTypeBlocking, this, stream,
-				      buffers);
+	ret = d->pipe_->invokeMethod(&PipelineHandler::exportFrameBuffers,
+				     ConnectionTypeBlocking, this, stream,
+				     buffers);
+	if (ret > 0)
+		d->applicationMemory_ += frameBuffersSize(*buffers);
+
+	return ret;
+}
+
+void Camera::releaseFrameBuffers(std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	Private *const d = LIBCAMERA_D_PTR();
+
+	d->applicationMemory_ -= frameBuffersSize(*buffers);
+	d->pipe_->releaseFrameBuffers(buffers);
 }
 
 /**
@@ -712,7 +1181,14 @@ int Camera::acquire()
 	if (ret < 0)
 		return ret == -EACCES ? -EBUSY : ret;
 
-	if (!d->pipe_->lock()) {
+	/*
+	 * A camera resumed from warm standby is still locked, and keeps its
+	 * configuration for configure() to reuse.
+	 */
+	d->standby_ = d->pipe_->invokeMethod(&PipelineHandler::resumeStandby,
+					     ConnectionTypeBlocking, this);
+
+	if (!d->standby_ && !d->pipe_->lock()) {
 		LOG(Camera, Info)
 			<< "Pipeline handler in use by another process";
 		return -EBUSY;
@@ -729,6 +1205,14 @@ int Camera::acquire()
  * Releasing the camera device allows other users to acquire exclusive access
  * with the acquire() function.
  *
+ * When warm standby is enabled with the LIBCAMERA_STANDBY_TIMEOUT environment
+ * variable, a configured camera is put in standby instead of being released
+ * immediately. The pipeline handler keeps the camera configuration, internal
+ * buffers and IPA state until the standby timeout expires, and configuring the
+ * camera again with an identical configuration after acquiring it completes
+ * without reconfiguring the device. Other cameras handled by the same pipeline
+ * handler can still be acquired, which ends the standby.
+ *
  * \context This function may only be called when the camera is in the
  * Available or Configured state as defined in \ref camera_operation, and shall
  * be synchronized by the caller with other functions that affect the camera
@@ -746,8 +1230,22 @@ int Camera::release()
 	if (ret < 0)
 		return ret == -EACCES ? -EBUSY : ret;
 
-	d->pipe_->unlock();
+	d->standby_ = false;
+
+	bool standby = !d->disconnected_ &&
+		       d->state_.load(std::memory_order_acquire) == Private::CameraConfigured &&
+		       d->pipe_->invokeMethod(&PipelineHandler::enterStandby,
+					      ConnectionTypeBlocking, this);
+	if (!standby) {
+		d->pipe_->invokeMethod(&PipelineHandler::releaseZsl,
+				       ConnectionTypeBlocking, this);
+		d->pipe_->invokeMethod(&PipelineHandler::releaseDevice,
+				       ConnectionTypeBlocking, this);
+
+		d->pipe_->unlock();
+	}
 
+	d->completionQueue_ = nullptr;
 	d->setState(Private::CameraAvailable);
 
 	return 0;
@@ -904,6 +1402,25 @@ int Camera::configure(CameraConfiguration *config)
 
 	LOG(Camera, Info) << msg.str();
 
+	/*
+	 * A camera resumed from warm standby is still configured in the
+	 * pipeline handler, reuse its streams if the configuration is
+	 * identical.
+	 */
+	bool standby = d->standby_;
+	d->standby_ = false;
+
+	if (standby && d->matchesConfiguration(config)) {
+		LOG(Camera, Debug) << "Reusing configuration kept in standby";
+
+		for (unsigned int index = 0; index < config->size(); ++index)
+			config->at(index).setStream(d->config_[index].stream());
+
+		d->setState(Private::CameraConfigured);
+
+		return 0;
+	}
+
 	ret = d->pipe_->invokeMethod(&PipelineHandler::configure,
 				     ConnectionTypeBlocking, this, config);
 	if (ret)
@@ -923,6 +1440,14 @@ int Camera::configure(CameraConfiguration *config)
 		d->activeStreams_.insert(stream);
 	}
 
+	ret = d->pipe_->invokeMethod(&PipelineHandler::configureZsl,
+				     ConnectionTypeBlocking, this, config);
+	if (ret) {
+		d->activeStreams_.clear();
+		return ret;
+	}
+
+	d->saveConfiguration(config);
 	d->setState(Private::CameraConfigured);
 
 	return 0;
@@ -969,7 +1494,10 @@ std::unique_ptr<Request> Camera::createRequest(uint64_t cookie)
  *
  * After allocating the request with createRequest(), the application shall
  * fill it with at least one capture buffer before queuing it. Requests that
- * contain no buffers are invalid and are rejected without being queued.
+ * contain no buffers are invalid and are rejected without being queued. The
+ * request may contain buffers for any subset of the configured streams, which
+ * allows switching streams on and off from one request to the next, as
+ * explained in \ref camera-stream-activation.
  *
  * Once the request has been queued, the camera will notify its completion
  * through the \ref requestCompleted signal.
@@ -997,22 +1525,95 @@ int Camera::queueRequest(Request *request)
 	 * this.
 	 */
 
-	if (request->buffers().empty()) {
-		LOG(Camera, Error) << "Request contains no buffers";
-		return -EINVAL;
-	}
+	ret = d->validateRequest(request);
+	if (ret < 0)
+		return ret;
 
-	for (auto const &it : request->buffers()) {
-		const Stream *stream = it.first;
+	d->pipe_->invokeMethod(&PipelineHandler::queueRequest,
+			       ConnectionTypeQueued, request);
 
-		if (d->activeStreams_.find(stream) == d->activeStreams_.end()) {
-			LOG(Camera, Error) << "Invalid request";
-			return -EINVAL;
-		}
+	return 0;
+}
+
+/**
+ * \brief Queue a batch of requests to the camera
+ * \param[in] requests The requests to queue to the camera
+ *
+ * This method queues all the \a requests to the camera for capture, in order.
+ * It behaves as calling queueRequest() for each request, but passes the whole
+ * batch to the pipeline handler in a single cross-thread invocation, which
+ * lowers the overhead of queuing many requests at once, for instance when
+ * priming the camera after starting it.
+ *
+ * All requests are validated before any of them is queued. If one of the
+ * requests is invalid, none of them is queued.
+ *
+ * \context This function is \threadsafe. It may only be called when the camera
+ * is in the Running state as defined in \ref camera_operation.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not running so requests can't be queued
+ * \retval -EINVAL One of the requests is invalid
+ */
+int Camera::queueRequests(Span<Request *const> requests)
+{
+	Private *const d = LIBCAMERA_D_PTR();
+
+	int ret = d->isAccessAllowed(Private::CameraRunning);
+	if (ret < 0)
+		return ret;
+
+	if (requests.empty())
+		return 0;
+
+	for (const Request *request : requests) {
+		ret = d->validateRequest(request);
+		if (ret < 0)
+			return ret;
 	}
 
-	d->pipe_->invokeMethod(&PipelineHandler::queueRequest,
-			       ConnectionTypeQueued, request);
+	std::vector<Request *> batch(requests.begin(), requests.end());
+	d->pipe_->invokeMethod(&PipelineHandler::queueRequests,
+			       ConnectionTypeQueued, batch);
+
+	return 0;
+}
+
+/**
+ * \brief Deliver completed requests through a completion queue
+ * \param[in] queue The completion queue, or nullptr to stop using a queue
+ *
+ * When a completion queue is set, all requests completed by the camera are
+ * pushed to the \a queue after the requestCompleted signal is emitted. The
+ * application then retrieves them with CompletionQueue::pop() from its own
+ * thread when the queue file descriptor becomes readable, without going
+ * through a message posted to the application thread. The \a queue shall stay
+ * valid until it is unset or the camera is released.
+ *
+ * \context This function may only be called when the camera is in the
+ * Acquired or Configured state as defined in \ref camera_operation, and shall
+ * be synchronized by the caller with other functions that affect the camera
+ * state.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not in a state where the queue can be set
+ * \retval -EINVAL The \a queue is not valid
+ */
+int Camera::setCompletionQueue(CompletionQueue *queue)
+{
+	Private *const d = LIBCAMERA_D_PTR();
+
+	int ret = d->isAccessAllowed(Private::CameraAcquired,
+				     Private::CameraConfigured);
+	if (ret < 0)
+		return ret;
+
+	if (queue && !queue->isValid())
+		return -EINVAL;
+
+	d->completionQueue_ = queue;
 
 	return 0;
 }
@@ -1050,6 +1651,7 @@ int Camera::start(const ControlList *controls)
 	if (ret)
 		return ret;
 
+	d->resetPerformance();
 	d->setState(Private::CameraRunning);
 
 	return 0;
@@ -1081,6 +1683,8 @@ int Camera::stop()
 
 	d->setState(Private::CameraStopping);
 
+	d->pipe_->invokeMethod(&PipelineHandler::cancelWaitingRequests,
+			       ConnectionTypeBlocking, this);
 	d->pipe_->invokeMethod(&PipelineHandler::stop, ConnectionTypeBlocking,
 			       this);
 
@@ -1107,7 +1711,57 @@ void Camera::requestComplete(Request *request)
 			       true))
 		LOG(Camera, Fatal) << "Trying to complete a request when stopped";
 
+	uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		utils::clock::now() - request->queueTime_).count();
+	d->recordPerformance(request, latency);
+
 	requestCompleted.emit(request);
+
+	/*
+	 * The application may reuse the request as soon as it is pushed to the
+	 * completion queue, this must be the last access to the request.
+	 */
+	if (d->completionQueue_)
+		d->completionQueue_->push(request);
+}
+
+/**
+ * \brief Retrieve the performance counters of the camera
+ *
+ * The counters are recorded continuously while the camera is running, and
+ * reset when it is started.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return A snapshot of the performance counters
+ */
+CameraPerformance Camera::performance() const
+{
+	const Private *const d = LIBCAMERA_D_PTR();
+	return d->performance();
+}
+
+/**
+ * \brief Retrieve the memory pinned by the camera for its buffers
+ *
+ * The memory usage covers the buffers allocated for the camera with a
+ * FrameBufferAllocator, and the buffers allocated internally by the pipeline
+ * handler for the current configuration. It helps tuning the number of buffers
+ * against the memory budget of the system. The memory of buffers mapped in
+ * the process is reported library-wide by CameraManager::performance().
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return The memory pinned by the camera
+ */
+CameraMemoryUsage Camera::memoryUsage() const
+{
+	const Private *const d = LIBCAMERA_D_PTR();
+
+	CameraMemoryUsage usage = d->pipe_->memoryUsage(this);
+	usage.applicationBuffers = d->applicationMemory_;
+
+	return usage;
 }
 
 } /* namespace libcamera */
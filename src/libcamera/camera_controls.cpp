@@ -23,6 +23,13 @@ namespace libcamera {
  *
  * This ControlValidator specialisation validates that controls exist in the
  * Camera associated with the validator.
+ *
+ * The validator runs for every control set in a request. It keeps a reference
+ * to the ControlInfoMap of the camera, which stays valid for the lifetime of
+ * the camera and is updated in place when the camera is configured, and whose
+ * entries are indexed by numerical ID for the libcamera controls. Validation
+ * is thus an array access, instead of looking up the camera data in the
+ * pipeline handler and the control in hash maps.
  */
 
 /**
@@ -30,7 +37,7 @@ namespace libcamera {
  * \param[in] camera The camera
  */
 CameraControlValidator::CameraControlValidator(Camera *camera)
-	: camera_(camera)
+	: camera_(camera), controls_(&camera->controls())
 {
 }
 
@@ -46,8 +53,7 @@ const std::string &CameraControlValidator::name() const
  */
 bool CameraControlValidator::validate(unsigned int id) const
 {
-	const ControlInfoMap &controls = camera_->controls();
-	return controls.find(id) != controls.end();
+	return controls_->count(id);
 }
 
 } /* namespace libcamera */
@@ -0,0 +1,365 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * camera_group.cpp - Synchronised capture from multiple cameras
+ */
+
+#include <libcamera/camera_group.h>
+
+#include <algorithm>
+#include <deque>
+#include <errno.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/request.h>
+
+#include "libcamera/internal/log.h"
+
+/**
+ * \file camera_group.h
+ * \brief Synchronised capture from multiple cameras
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Camera)
+
+class CameraGroup::Private : public Extensible::Private
+{
+	LIBCAMERA_DECLARE_PUBLIC(CameraGroup)
+
+public:
+	Private(CameraGroup *group,
+		const std::vector<std::shared_ptr<Camera>> &cameras);
+
+	std::vector<int32_t> syncModes(const ControlList *controls) const;
+	void match();
+	void flush();
+
+	std::vector<std::shared_ptr<Camera>> cameras_;
+	std::vector<std::deque<Request *>> completed_;
+	std::chrono::nanoseconds tolerance_;
+};
+
+CameraGroup::Private::Private(CameraGroup *group,
+			      const std::vector<std::shared_ptr<Camera>> &cameras)
+	: Extensible::Private(group), cameras_(cameras),
+	  completed_(cameras.size()), tolerance_(std::chrono::milliseconds(1))
+{
+}
+
+/*
+ * Select the frame synchronisation mode of each camera. An external trigger
+ * requested by the application applies to all cameras. Otherwise the first
+ * camera drives the others when they all support master and slave modes.
+ */
+std::vector<int32_t>
+CameraGroup::Private::syncModes(const ControlList *controls) const
+{
+	std::vector<int32_t> modes(cameras_.size(), controls::SensorSyncOff);
+
+	auto supports = [](const Camera *camera, int32_t mode) {
+		const ControlInfoMap &info = camera->controls();
+		auto it = info.find(&controls::SensorSyncMode);
+		if (it == info.end())
+			return false;
+
+		const std::vector<ControlValue> &values = it->second.values();
+		return std::find(values.begin(), values.end(),
+				 ControlValue(mode)) != values.end();
+	};
+
+	if (controls && controls->contains(controls::SENSOR_SYNC_MODE)) {
+		int32_t mode = controls->get(controls::SensorSyncMode);
+		if (mode != controls::SensorSyncExternalTrigger)
+			return modes;
+
+		for (const std::shared_ptr<Camera> &camera : cameras_) {
+			if (!supports(camera.get(), mode)) {
+				LOG(Camera, Error)
+					<< "Camera " << camera->id()
+					<< " doesn't support external trigger";
+				return {};
+			}
+		}
+
+		std::fill(modes.begin(), modes.end(), mode);
+		return modes;
+	}
+
+	if (cameras_.size() < 2 ||
+	    !supports(cameras_[0].get(), controls::SensorSyncMaster))
+		return modes;
+
+	for (unsigned int i = 1; i < cameras_.size(); ++i) {
+		if (!supports(cameras_[i].get(), controls::SensorSyncSlave)) {
+			LOG(Camera, Debug)
+				<< "Camera " << cameras_[i]->id()
+				<< " can't be synchronised, matching frames by timestamp only";
+			return modes;
+		}
+	}
+
+	modes[0] = controls::SensorSyncMaster;
+	std::fill(modes.begin() + 1, modes.end(), controls::SensorSyncSlave);
+
+	return modes;
+}
+
+/*
+ * Deliver the sets of requests whose sensor timestamps match. The oldest
+ * completed requests that can't be matched anymore, because a later frame has
+ * already been completed by another camera, are reported as unmatched.
+ */
+void CameraGroup::Private::match()
+{
+	CameraGroup *const o = LIBCAMERA_O_PTR();
+
+	while (std::none_of(completed_.begin(), completed_.end(),
+			    [](const std::deque<Request *> &queue) {
+				    return queue.empty();
+			    })) {
+		int64_t latest = 0;
+		for (const std::deque<Request *> &queue : completed_) {
+			Request *request = queue.front();
+			latest = std::max(latest, request->metadata().get(controls::SensorTimestamp));
+		}
+
+		bool matched = true;
+		for (std::deque<Request *> &queue : completed_) {
+			Request *request = queue.front();
+			int64_t timestamp = request->metadata().get(controls::SensorTimestamp);
+			if (latest - timestamp <= tolerance_.count())
+				continue;
+
+			LOG(Camera, Debug)
+				<< "Frame " << timestamp << " not matched within "
+				<< tolerance_.count() << "ns";
+
+			queue.pop_front();
+			o->requestUnmatched.emit(request);
+			matched = false;
+		}
+
+		if (!matched)
+			continue;
+
+		std::vector<Request *> requests;
+		for (std::deque<Request *> &queue : completed_) {
+			requests.push_back(queue.front());
+			queue.pop_front();
+		}
+
+		o->requestsCompleted.emit(requests);
+	}
+}
+
+void CameraGroup::Private::flush()
+{
+	CameraGroup *const o = LIBCAMERA_O_PTR();
+
+	for (std::deque<Request *> &queue : completed_) {
+		while (!queue.empty()) {
+			Request *request = queue.front();
+			queue.pop_front();
+			o->requestUnmatched.emit(request);
+		}
+	}
+}
+
+/**
+ * \class CameraGroup
+ * \brief Start multiple cameras together and deliver their frames in sets
+ *
+ * The CameraGroup class captures frames from multiple cameras at the same
+ * time, for stereo or multi-view use cases. Groups are created by the camera
+ * manager with CameraManager::createGroup().
+ *
+ * The cameras of a group are acquired, configured and fed with requests by the
+ * application as usual. The group takes over starting and stopping them. When
+ * the camera sensors support frame synchronisation, start() configures the
+ * first camera of the group as the master and the other cameras as slaves, or
+ * all cameras in external trigger mode when requested by the application with
+ * the controls::SensorSyncMode control.
+ *
+ * The group connects to the Camera::requestCompleted signal of each camera,
+ * and matches the completed requests by their controls::SensorTimestamp. Each
+ * set of requests captured within tolerance() of each other is delivered
+ * through the requestsCompleted signal, in the order of cameras(). Requests
+ * that can't be matched, including the requests cancelled when stopping the
+ * group, are delivered through the requestUnmatched signal. Applications shall
+ * connect to those signals instead of the signals of the cameras.
+ *
+ * The signals are emitted in the thread the group belongs to.
+ */
+
+CameraGroup::CameraGroup(const std::vector<std::shared_ptr<Camera>> &cameras)
+	: Extensible(new Private(this, cameras))
+{
+	for (const std::shared_ptr<Camera> &camera : cameras)
+		camera->requestCompleted.connect(this, &CameraGroup::requestComplete);
+}
+
+CameraGroup::~CameraGroup()
+{
+	for (const std::shared_ptr<Camera> &camera : cameras())
+		camera->requestCompleted.disconnect(this);
+}
+
+/**
+ * \brief Retrieve the cameras of the group
+ * \return The cameras of the group, in the order of the sets of requests
+ */
+const std::vector<std::shared_ptr<Camera>> &CameraGroup::cameras() const
+{
+	const Private *const d = LIBCAMERA_D_PTR();
+	return d->cameras_;
+}
+
+/**
+ * \brief Set the maximum sensor timestamp difference within a set of requests
+ * \param[in] tolerance The tolerance
+ *
+ * The default tolerance is 1ms, which fits cameras synchronised by hardware.
+ * Cameras that run freely need a tolerance of up to half the frame duration.
+ */
+void CameraGroup::setTolerance(std::chrono::nanoseconds tolerance)
+{
+	Private *const d = LIBCAMERA_D_PTR();
+	d->tolerance_ = tolerance;
+}
+
+/**
+ * \brief Retrieve the maximum sensor timestamp difference within a set
+ * \return The tolerance
+ */
+std::chrono::nanoseconds CameraGroup::tolerance() const
+{
+	const Private *const d = LIBCAMERA_D_PTR();
+	return d->tolerance_;
+}
+
+/**
+ * \brief Start capture from all the cameras of the group
+ * \param[in] controls Controls to be applied to all cameras before starting
+ *
+ * The frame synchronisation mode of each camera is selected as described in
+ * the class documentation, and the slave cameras are started before the
+ * master camera to not miss its first frame. If any camera fails to start, the
+ * cameras already started are stopped.
+ *
+ * \context All the cameras of the group shall be in the Configured state as
+ * defined in \ref camera_operation.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENOTSUP The synchronisation mode requested in \a controls isn't
+ * supported by all cameras
+ */
+int CameraGroup::start(const ControlList *controls)
+{
+	Private *const d = LIBCAMERA_D_PTR();
+
+	std::vector<int32_t> modes = d->syncModes(controls);
+	if (modes.empty())
+		return -ENOTSUP;
+
+	/* Start the master camera, if any, last. */
+	std::vector<unsigned int> order;
+	for (unsigned int i = 0; i < d->cameras_.size(); ++i) {
+		if (modes[i] != controls::SensorSyncMaster)
+			order.push_back(i);
+	}
+	for (unsigned int i = 0; i < d->cameras_.size(); ++i) {
+		if (modes[i] == controls::SensorSyncMaster)
+			order.push_back(i);
+	}
+
+	for (auto it = order.begin(); it != order.end(); ++it) {
+		Camera *camera = d->cameras_[*it].get();
+
+		ControlList ctrls = controls ? *controls : ControlList();
+		if (camera->controls().count(&controls::SensorSyncMode))
+			ctrls.set(controls::SensorSyncMode, modes[*it]);
+
+		int ret = camera->start(&ctrls);
+		if (ret) {
+			LOG(Camera, Error)
+				<< "Failed to start camera " << camera->id()
+				<< " of the group";
+
+			while (it != order.begin())
+				d->cameras_[*--it]->stop();
+
+			d->flush();
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Stop capture from all the cameras of the group
+ *
+ * All the pending requests are cancelled and delivered through the
+ * requestUnmatched signal, as well as the completed requests waiting to be
+ * matched.
+ *
+ * \return 0 on success or the error code returned by the first camera that
+ * failed to stop
+ */
+int CameraGroup::stop()
+{
+	Private *const d = LIBCAMERA_D_PTR();
+	int ret = 0;
+
+	for (const std::shared_ptr<Camera> &camera : d->cameras_) {
+		int err = camera->stop();
+		if (err && !ret)
+			ret = err;
+	}
+
+	d->flush();
+
+	return ret;
+}
+
+/**
+ * \var CameraGroup::requestsCompleted
+ * \brief Signal emitted when a set of matching requests has completed
+ *
+ * The requests are ordered as the cameras returned by cameras().
+ */
+
+/**
+ * \var CameraGroup::requestUnmatched
+ * \brief Signal emitted when a request completes without matching frames
+ *
+ * The request may have been cancelled, or the other cameras may have dropped
+ * the corresponding frames.
+ */
+
+void CameraGroup::requestComplete(Request *request)
+{
+	Private *const d = LIBCAMERA_D_PTR();
+
+	auto it = std::find_if(d->cameras_.begin(), d->cameras_.end(),
+			       [&](const std::shared_ptr<Camera> &camera) {
+				       return camera.get() == request->camera_;
+			       });
+	if (it == d->cameras_.end())
+		return;
+
+	if (request->status() != Request::RequestComplete ||
+	    !request->metadata().contains(controls::SENSOR_TIMESTAMP)) {
+		requestUnmatched.emit(request);
+		return;
+	}
+
+	d->completed_[it - d->cameras_.begin()].push_back(request);
+	d->match();
+}
+
+} /* namespace libcamera */
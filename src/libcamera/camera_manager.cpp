@@ -7,14 +7,20 @@
 
 #include <libcamera/camera_manager.h>
 
+#include <algorithm>
+#include <chrono>
 #include <condition_variable>
 #include <map>
+#include <stdlib.h>
+#include <string.h>
 
 #include <libcamera/camera.h>
+#include <libcamera/camera_group.h>
 
 #include "libcamera/internal/device_enumerator.h"
 #include "libcamera/internal/ipa_manager.h"
 #include "libcamera/internal/log.h"
+#include "libcamera/internal/performance.h"
 #include "libcamera/internal/pipeline_handler.h"
 #include "libcamera/internal/process.h"
 #include "libcamera/internal/thread.h"
@@ -32,6 +38,22 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(Camera)
 
+/*
+ * Thread running the event loop of a pipeline handler. Deferred deletions
+ * still pending when the thread is stopped are processed before it finishes,
+ * to destroy the pipeline handler and its cameras in the thread they belong
+ * to.
+ */
+class PipelineHandlerThread : public Thread
+{
+protected:
+	void run() override
+	{
+		exec();
+		dispatchMessages(Message::Type::DeferredDelete);
+	}
+};
+
 class CameraManager::Private : public Extensible::Private, public Thread
 {
 	LIBCAMERA_DECLARE_PUBLIC(CameraManager)
@@ -39,16 +61,21 @@ class CameraManager::Private : public Extensible::Private, public Thread
 public:
 	Private(CameraManager *cm);
 
-	int start();
+	int start(StartMode mode);
 	void addCamera(std::shared_ptr<Camera> camera,
 		       const std::vector<dev_t> &devnums);
 	void removeCamera(Camera *camera);
+	bool isPipelineThread(Thread *thread) const;
+	std::shared_ptr<Camera> waitForCamera(const std::string &id,
+					      std::chrono::milliseconds timeout);
 
 	/*
 	 * This mutex protects
 	 *
 	 * - initialized_ and status_ during initialization
-	 * - cameras_ and camerasByDevnum_ after initialization
+	 * - matched_ until all pipeline handlers have been matched
+	 * - cameras_, camerasByDevnum_ and pipelineThreads_ after
+	 *   initialization
 	 */
 	mutable Mutex mutex_;
 	std::vector<std::shared_ptr<Camera>> cameras_;
@@ -59,29 +86,56 @@ protected:
 
 private:
 	int init();
+	void match();
+	void parseThreadOptions();
 	void createPipelineHandlers();
+	Thread *createPipelineThread();
+	void destroyPipelineThread(Thread *thread);
 	void cleanup();
 
+	/* Notified on initialization, on camera addition and once matched. */
 	std::condition_variable cv_;
 	bool initialized_;
+	bool matched_;
 	int status_;
+	bool async_;
 
 	std::unique_ptr<DeviceEnumerator> enumerator_;
 
+	bool dedicatedThreads_;
+	std::vector<unsigned int> threadCpus_;
+	int threadPriority_;
+	std::vector<std::unique_ptr<Thread>> pipelineThreads_;
+
 	IPAManager ipaManager_;
 	ProcessManager processManager_;
 };
 
 CameraManager::Private::Private(CameraManager *cm)
-	: Extensible::Private(cm), initialized_(false)
+	: Extensible::Private(cm), initialized_(false), matched_(false),
+	  async_(false), dedicatedThreads_(false), threadPriority_(0)
 {
+	setName("CameraManager");
 }
 
-int CameraManager::Private::start()
+int CameraManager::Private::start(StartMode mode)
 {
 	int status;
 
-	/* Start the thread and wait for initialization to complete. */
+	async_ = mode == StartAsync;
+
+	/*
+	 * Handle the death of child processes in the camera manager thread,
+	 * to detect crashes of isolated IPA modules without depending on the
+	 * application dispatching libcamera events.
+	 */
+	processManager_.moveToThread(this);
+
+	/*
+	 * Start the thread and wait for initialization to complete. In
+	 * asynchronous mode, initialization completes once the devices have
+	 * been enumerated, and the pipeline handlers are matched afterwards.
+	 */
 	Thread::start();
 
 	{
@@ -105,16 +159,27 @@ void CameraManager::Private::run()
 	LOG(Camera, Debug) << "Starting camera manager";
 
 	int ret = init();
+	if (!ret && !async_)
+		match();
 
 	mutex_.lock();
 	status_ = ret;
 	initialized_ = true;
+	if (ret < 0)
+		matched_ = true;
 	mutex_.unlock();
-	cv_.notify_one();
+	cv_.notify_all();
 
 	if (ret < 0)
 		return;
 
+	/*
+	 * Cameras are added, and the cameraAdded signal emitted, as each
+	 * pipeline handler matches.
+	 */
+	if (async_)
+		match();
+
 	/* Now start processing events and messages. */
 	exec();
 
@@ -123,15 +188,65 @@ void CameraManager::Private::run()
 
 int CameraManager::Private::init()
 {
+	utils::time_point start = utils::clock::now();
+
 	enumerator_ = DeviceEnumerator::create();
 	if (!enumerator_ || enumerator_->enumerate())
 		return -ENODEV;
 
-	createPipelineHandlers();
+	utils::duration elapsed = utils::clock::now() - start;
+	LOG(Camera, Debug)
+		<< "Enumeration took "
+		<< std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()
+		<< "us";
+
+	parseThreadOptions();
 
 	return 0;
 }
 
+void CameraManager::Private::match()
+{
+	utils::time_point start = utils::clock::now();
+
+	createPipelineHandlers();
+
+	utils::duration elapsed = utils::clock::now() - start;
+	LOG(Camera, Debug)
+		<< "Pipeline matching took "
+		<< std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()
+		<< "us";
+
+	mutex_.lock();
+	matched_ = true;
+	mutex_.unlock();
+	cv_.notify_all();
+}
+
+void CameraManager::Private::parseThreadOptions()
+{
+	const char *threads = utils::secure_getenv("LIBCAMERA_PIPELINE_THREADS");
+	if (!threads || strcmp(threads, "dedicated"))
+		return;
+
+	dedicatedThreads_ = true;
+
+	const char *cpus = utils::secure_getenv("LIBCAMERA_PIPELINE_THREAD_CPUS");
+	if (cpus) {
+		for (const std::string &cpu : utils::split(cpus, ",")) {
+			if (!cpu.empty())
+				threadCpus_.push_back(strtoul(cpu.c_str(), nullptr, 10));
+		}
+	}
+
+	const char *priority = utils::secure_getenv("LIBCAMERA_PIPELINE_THREAD_PRIORITY");
+	if (priority)
+		threadPriority_ = std::clamp(atoi(priority), 0, 99);
+
+	LOG(Camera, Debug)
+		<< "Running pipeline handlers in dedicated threads";
+}
+
 void CameraManager::Private::createPipelineHandlers()
 {
 	CameraManager *const o = LIBCAMERA_O_PTR();
@@ -152,20 +267,83 @@ void CameraManager::Private::createPipelineHandlers()
 		 * Try each pipeline handler until it exhaust
 		 * all pipelines it can provide.
 		 */
+		utils::time_point start = utils::clock::now();
+
 		while (1) {
 			std::shared_ptr<PipelineHandler> pipe = factory->create(o);
-			if (!pipe->match(enumerator_.get()))
+
+			/*
+			 * Move the pipeline handler to its thread before
+			 * matching, for all the objects it creates to belong to
+			 * that thread.
+			 */
+			Thread *thread = nullptr;
+			if (dedicatedThreads_) {
+				thread = createPipelineThread();
+				pipe->moveToThread(thread);
+			}
+
+			bool matched = pipe->invokeMethod(&PipelineHandler::match,
+							  ConnectionTypeBlocking,
+							  enumerator_.get());
+			if (!matched) {
+				pipe.reset();
+				if (thread)
+					destroyPipelineThread(thread);
 				break;
+			}
 
 			LOG(Camera, Debug)
 				<< "Pipeline handler \"" << factory->name()
 				<< "\" matched";
 		}
+
+		utils::duration elapsed = utils::clock::now() - start;
+		LOG(Camera, Debug)
+			<< "Pipeline handler \"" << factory->name()
+			<< "\" probed in "
+			<< std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()
+			<< "us";
 	}
 
 	enumerator_->devicesAdded.connect(this, &Private::createPipelineHandlers);
 }
 
+Thread *CameraManager::Private::createPipelineThread()
+{
+	std::unique_ptr<Thread> thread = std::make_unique<PipelineHandlerThread>();
+	thread->setName("PipelineHandler");
+	thread->start();
+
+	MutexLocker locker(mutex_);
+
+	/* Spread the pipeline handler threads over the CPUs in turn. */
+	if (!threadCpus_.empty())
+		thread->setAffinity({ threadCpus_[pipelineThreads_.size() % threadCpus_.size()] });
+
+	if (threadPriority_)
+		thread->setRealtimePriority(threadPriority_);
+
+	pipelineThreads_.push_back(std::move(thread));
+
+	return pipelineThreads_.back().get();
+}
+
+void CameraManager::Private::destroyPipelineThread(Thread *thread)
+{
+	thread->exit();
+	thread->wait();
+
+	MutexLocker locker(mutex_);
+
+	auto iter = std::find_if(pipelineThreads_.begin(), pipelineThreads_.end(),
+				 [thread](const std::unique_ptr<Thread> &t) {
+					 return t.get() == thread;
+				 });
+	if (iter != pipelineThreads_.end())
+		pipelineThreads_.erase(iter);
+}
+
 void CameraManager::Private::cleanup()
 {
 	enumerator_->devicesAdded.disconnect(this, &Private::createPipelineHandlers);
@@ -180,6 +358,20 @@ void CameraManager::Private::cleanup()
 	cameras_.clear();
 	dispatchMessages(Message::Type::DeferredDelete);
 
+	/*
+	 * Cameras and pipeline handlers running in dedicated threads are
+	 * destroyed by their thread when it stops.
+	 */
+	for (std::unique_ptr<Thread> &thread : pipelineThreads_) {
+		thread->exit();
+		thread->wait();
+	}
+
+	{
+		MutexLocker locker(mutex_);
+		pipelineThreads_.clear();
+	}
+
 	enumerator_.reset(nullptr);
 }
 
@@ -202,6 +394,8 @@ void CameraManager::Private::addCamera(std::shared_ptr<Camera> camera,
 	unsigned int index = cameras_.size() - 1;
 	for (dev_t devnum : devnums)
 		camerasByDevnum_[devnum] = cameras_[index];
+
+	cv_.notify_all();
 }
 
 void CameraManager::Private::removeCamera(Camera *camera)
@@ -228,6 +422,38 @@ void CameraManager::Private::removeCamera(Camera *camera)
 	cameras_.erase(iter);
 }
 
+bool CameraManager::Private::isPipelineThread(Thread *thread) const
+{
+	MutexLocker locker(mutex_);
+
+	return std::any_of(pipelineThreads_.begin(), pipelineThreads_.end(),
+			   [thread](const std::unique_ptr<Thread> &t) {
+				   return t.get() == thread;
+			   });
+}
+
+std::shared_ptr<Camera>
+CameraManager::Private::waitForCamera(const std::string &id,
+				      std::chrono::milliseconds timeout)
+{
+	std::shared_ptr<Camera> camera;
+
+	MutexLocker locker(mutex_);
+
+	cv_.wait_for(locker, timeout, [&] {
+		auto iter = std::find_if(cameras_.begin(), cameras_.end(),
+					 [&id](const std::shared_ptr<Camera> &c) {
+						 return c->id() == id;
+					 });
+		if (iter != cameras_.end())
+			camera = *iter;
+
+		return camera || matched_;
+	});
+
+	return camera;
+}
+
 /**
  * \class CameraManager
  * \brief Provide access and manage all cameras in the system
@@ -244,13 +470,27 @@ void CameraManager::Private::removeCamera(Camera *camera)
  *
  * The manager is initially stopped, and shall be started with start(). This
  * will enumerate all the cameras present in the system, which can then be
- * listed with list() and retrieved with get().
+ * listed with list() and retrieved with get(). Applications that only need a
+ * specific camera can instead start the manager in the StartAsync mode and wait
+ * for that camera with waitForCamera(), without waiting for all the other
+ * cameras to be initialized.
  *
  * Cameras are shared through std::shared_ptr<>, ensuring that a camera will
  * stay valid until the last reference is released without requiring any special
  * action from the application. Once the application has released all the
  * references it held to cameras, the camera manager can be stopped with
  * stop().
+ *
+ * All pipeline handlers run by default in the CameraManager thread. When the
+ * LIBCAMERA_PIPELINE_THREADS environment variable is set to "dedicated", each
+ * pipeline handler instance runs instead in a thread of its own, along with
+ * the cameras it creates, so that cameras handled by different pipeline
+ * handler instances don't delay each other. The CPU affinity and real-time
+ * priority of those threads can be configured with the
+ * LIBCAMERA_PIPELINE_THREAD_CPUS and LIBCAMERA_PIPELINE_THREAD_PRIORITY
+ * environment variables. The CameraManager and PipelineHandler threads can also
+ * be configured by name through the LIBCAMERA_THREADS environment variable, see
+ * \ref thread-scheduling.
  */
 
 CameraManager *CameraManager::self_ = nullptr;
@@ -277,23 +517,42 @@ CameraManager::~CameraManager()
 	self_ = nullptr;
 }
 
+/**
+ * \enum CameraManager::StartMode
+ * \brief Select whether start() waits for all cameras to be available
+ * \var CameraManager::StartBlocking
+ * \brief Return from start() once all cameras are available
+ * \var CameraManager::StartAsync
+ * \brief Return from start() once devices are enumerated, and make cameras
+ * available as they get initialized
+ */
+
 /**
  * \brief Start the camera manager
+ * \param[in] mode The start mode
  *
  * Start the camera manager and enumerate all devices in the system. Once
  * the start has been confirmed the user is free to list and otherwise
  * interact with cameras in the system until either the camera manager
  * is stopped or the camera is unplugged from the system.
  *
+ * In the StartBlocking mode, all cameras are available from cameras() when this
+ * function returns. In the StartAsync mode, this function returns once the
+ * devices in the system have been enumerated, and the pipeline handlers are
+ * then matched in the CameraManager thread. Each camera is reported through
+ * the cameraAdded signal as soon as it becomes available, and can be waited
+ * for with waitForCamera(). The list returned by cameras() is then incomplete
+ * until all pipeline handlers have been matched.
+ *
  * \return 0 on success or a negative error code otherwise
  */
-int CameraManager::start()
+int CameraManager::start(StartMode mode)
 {
 	Private *const d = LIBCAMERA_D_PTR();
 
 	LOG(Camera, Info) << "libcamera " << version_;
 
-	int ret = d->start();
+	int ret = d->start(mode);
 	if (ret)
 		LOG(Camera, Error) << "Failed to start camera manager: "
 				   << strerror(-ret);
@@ -392,6 +651,60 @@ std::shared_ptr<Camera> CameraManager::get(dev_t devnum)
 	return iter->second.lock();
 }
 
+/**
+ * \brief Wait for a camera to become available
+ * \param[in] id ID of the camera to wait for
+ * \param[in] timeout The maximum time to wait
+ *
+ * This function is mostly useful when the camera manager has been started in
+ * the StartAsync mode. It blocks until the camera identified by \a id has been
+ * added, until all pipeline handlers have been matched without finding it, or
+ * until \a timeout expires, whichever comes first. Cameras hotplugged after
+ * the pipeline handlers have been matched are not waited for.
+ *
+ * Before calling this function the caller is responsible for ensuring that
+ * the camera manager is running. The function shall not be called from the
+ * CameraManager thread or from the pipeline handler threads, for instance
+ * from a cameraAdded signal handler.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return Shared pointer to Camera object or nullptr if camera not found
+ */
+std::shared_ptr<Camera> CameraManager::waitForCamera(const std::string &id,
+						     std::chrono::milliseconds timeout)
+{
+	Private *const d = LIBCAMERA_D_PTR();
+
+	return d->waitForCamera(id, timeout);
+}
+
+/**
+ * \brief Create a group of cameras to capture synchronised frames
+ * \param[in] cameras The cameras of the group
+ *
+ * The first camera of the group drives the frame synchronisation of the other
+ * cameras when their sensors support it. See CameraGroup for more information.
+ *
+ * \return The camera group, or nullptr if \a cameras is empty or contains the
+ * same camera multiple times
+ */
+std::unique_ptr<CameraGroup>
+CameraManager::createGroup(const std::vector<std::shared_ptr<Camera>> &cameras)
+{
+	if (cameras.empty())
+		return nullptr;
+
+	for (auto it = cameras.begin(); it != cameras.end(); ++it) {
+		if (!*it || std::find(it + 1, cameras.end(), *it) != cameras.end()) {
+			LOG(Camera, Error) << "Invalid camera group";
+			return nullptr;
+		}
+	}
+
+	return std::unique_ptr<CameraGroup>(new CameraGroup(cameras));
+}
+
 /**
  * \var CameraManager::cameraAdded
  * \brief Notify of a new camera added to the system
@@ -402,9 +715,10 @@ std::shared_ptr<Camera> CameraManager::get(dev_t devnum)
  * connected to the system. When the signal is emitted the new camera is already
  * available from the list of cameras().
  *
- * The signal is emitted from the CameraManager thread. Applications shall
- * minimize the time spent in the signal handler and shall in particular not
- * perform any blocking operation.
+ * The signal is emitted from the CameraManager thread, or from the thread of
+ * the pipeline handler when pipeline handlers run in dedicated threads.
+ * Applications shall minimize the time spent in the signal handler and shall
+ * in particular not perform any blocking operation.
  */
 
 /**
@@ -415,9 +729,10 @@ std::shared_ptr<Camera> CameraManager::get(dev_t devnum)
  * signal is emitted the camera is not available from the list of cameras()
  * anymore.
  *
- * The signal is emitted from the CameraManager thread. Applications shall
- * minimize the time spent in the signal handler and shall in particular not
- * perform any blocking operation.
+ * The signal is emitted from the CameraManager thread, or from the thread of
+ * the pipeline handler when pipeline handlers run in dedicated threads.
+ * Applications shall minimize the time spent in the signal handler and shall
+ * in particular not perform any blocking operation.
  */
 
 /**
@@ -432,14 +747,15 @@ std::shared_ptr<Camera> CameraManager::get(dev_t devnum)
  * \a devnums are used by the V4L2 compatibility layer to map V4L2 device nodes
  * to Camera instances.
  *
- * \context This function shall be called from the CameraManager thread.
+ * \context This function shall be called from the CameraManager thread or from
+ * the thread of the pipeline handler that handles \a camera.
  */
 void CameraManager::addCamera(std::shared_ptr<Camera> camera,
 			      const std::vector<dev_t> &devnums)
 {
 	Private *const d = LIBCAMERA_D_PTR();
 
-	ASSERT(Thread::current() == d);
+	ASSERT(Thread::current() == d || d->isPipelineThread(Thread::current()));
 
 	d->addCamera(camera, devnums);
 	cameraAdded.emit(camera);
@@ -453,13 +769,14 @@ void CameraManager::addCamera(std::shared_ptr<Camera> camera,
  * camera manager. Unregistered cameras won't be reported anymore by the
  * cameras() and get() calls, but references may still exist in applications.
  *
- * \context This function shall be called from the CameraManager thread.
+ * \context This function shall be called from the CameraManager thread or from
+ * the thread of the pipeline handler that handles \a camera.
  */
 void CameraManager::removeCamera(std::shared_ptr<Camera> camera)
 {
 	Private *const d = LIBCAMERA_D_PTR();
 
-	ASSERT(Thread::current() == d);
+	ASSERT(Thread::current() == d || d->isPipelineThread(Thread::current()));
 
 	d->removeCamera(camera.get());
 	cameraRemoved.emit(camera);
@@ -472,4 +789,21 @@ void CameraManager::removeCamera(std::shared_ptr<Camera> camera)
  * \return The libcamera version string
  */
 
+/**
+ * \brief Retrieve the library-wide performance counters
+ *
+ * The counters cover the components shared by all cameras, such as the V4L2
+ * buffer caches and the IPC with isolated IPA modules. They accumulate for the
+ * lifetime of the process. Per-camera counters are available from
+ * Camera::performance().
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return A snapshot of the performance counters
+ */
+CameraManagerPerformance CameraManager::performance() const
+{
+	return PerformanceRecorder::instance()->snapshot();
+}
+
 } /* namespace libcamera */
@@ -16,6 +16,7 @@
 #include <regex>
 #include <string.h>
 
+#include <libcamera/control_ids.h>
 #include <libcamera/property_ids.h>
 
 #include "libcamera/internal/bayer_format.h"
@@ -33,6 +34,64 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(CameraSensor)
 
+/**
+ * \struct CameraSensorMode
+ * \brief A sensor output mode and its characteristics
+ *
+ * The CameraSensorMode structure describes one of the output formats of a
+ * camera sensor, along with characteristics retrieved from the sensor driver
+ * when the format is applied. Modes are enumerated once by CameraSensor::init()
+ * and can be queried with CameraSensor::findMode().
+ *
+ * \var CameraSensorMode::format
+ * \brief The media bus code and size output by the sensor
+ *
+ * \var CameraSensorMode::analogCrop
+ * \brief The area of the pixel array read out by the sensor
+ *
+ * The rectangle is expressed relatively to the pixel array, as reported by the
+ * V4L2_SEL_TGT_CROP selection target. If the driver doesn't report it, the
+ * active area is used.
+ *
+ * \var CameraSensorMode::binning
+ * \brief The horizontal and vertical scaling factors
+ *
+ * The factors are computed as the ratio between the analogue crop size and the
+ * output size, rounded down. They are at least 1.
+ *
+ * \var CameraSensorMode::minFrameDuration
+ * \brief The minimum frame duration in nanoseconds
+ *
+ * The duration is computed from the pixel rate and the minimum blanking
+ * reported by the sensor driver for the mode. It is 0 if the driver doesn't
+ * support the V4L2_CID_PIXEL_RATE, V4L2_CID_HBLANK and V4L2_CID_VBLANK controls.
+ *
+ * \var CameraSensorMode::fieldOfView
+ * \brief The fraction of the active area covered by the analogue crop
+ */
+
+/**
+ * \brief Compute the number of bits transmitted by the sensor for each frame
+ * \return The number of bits per frame
+ */
+uint64_t CameraSensorMode::frameBits() const
+{
+	return static_cast<uint64_t>(format.size.width) * format.size.height *
+	       format.bitsPerPixel();
+}
+
+/**
+ * \brief Compute the maximum frame rate of the mode
+ * \return The maximum frame rate in frames per second, or 0 if unknown
+ */
+double CameraSensorMode::maxFrameRate() const
+{
+	if (!minFrameDuration)
+		return 0.0;
+
+	return 1e9 / minFrameDuration;
+}
+
 /**
  * \class CameraSensor
  * \brief A camera sensor based on V4L2 subdevices
@@ -54,7 +113,7 @@ LOG_DEFINE_CATEGORY(CameraSensor)
  */
 CameraSensor::CameraSensor(const MediaEntity *entity)
 	: entity_(entity), pad_(UINT_MAX), bayerFormat_(nullptr),
-	  properties_(properties::properties)
+	  properties_(properties::properties), syncControl_(0)
 {
 }
 
@@ -128,6 +187,8 @@ int CameraSensor::init()
 	auto last = std::unique(sizes_.begin(), sizes_.end());
 	sizes_.erase(last, sizes_.end());
 
+	initFocusLens();
+
 	/*
 	 * VIMC is a bit special, as it does not yet support all the mandatory
 	 * requirements regular sensors have to respect.
@@ -140,7 +201,12 @@ int CameraSensor::init()
 	 */
 	if (entity_->device()->driver() == "vimc") {
 		initVimcDefaultProperties();
-		return initProperties();
+		ret = initProperties();
+		if (ret)
+			return ret;
+
+		initModes();
+		return 0;
 	}
 
 	/* Get the color filter array pattern (only for RAW sensors). */
@@ -160,6 +226,8 @@ int CameraSensor::init()
 	if (ret)
 		return ret;
 
+	initModes();
+
 	return 0;
 }
 
@@ -305,6 +373,69 @@ void CameraSensor::initStaticProperties()
 
 	/* Register the properties retrieved from the sensor database. */
 	properties_.set(properties::UnitCellSize, props->unitCellSize);
+
+	/*
+	 * Frame synchronisation is only supported when the driver exposes the
+	 * control listed in the database, which out-of-tree drivers may not.
+	 */
+	if (!props->syncControl || props->syncModes.empty() ||
+	    !props->syncModes.count(controls::SensorSyncOff) ||
+	    controls().find(props->syncControl) == controls().end())
+		return;
+
+	syncControl_ = props->syncControl;
+	syncValues_ = props->syncModes;
+	for (const auto &[mode, value] : syncValues_)
+		syncModes_.emplace_back(mode);
+}
+
+/**
+ * \brief Find and open the lens associated with the sensor
+ *
+ * Lens actuators are exposed as separate subdevices with the MEDIA_ENT_F_LENS
+ * function. As no link ties a lens to its sensor, the lens is associated with
+ * the sensor only when it is the single lens in the media graph. The lens is
+ * optional, failures to find or open it are not fatal.
+ */
+void CameraSensor::initFocusLens()
+{
+	const MediaEntity *lens = nullptr;
+
+	for (const MediaEntity *entity : entity_->device()->entities()) {
+		if (entity->function() != MEDIA_ENT_F_LENS)
+			continue;
+
+		if (lens) {
+			LOG(CameraSensor, Debug)
+				<< "Multiple lenses found, not using any";
+			return;
+		}
+
+		lens = entity;
+	}
+
+	if (!lens)
+		return;
+
+	std::unique_ptr<V4L2Subdevice> subdev = std::make_unique<V4L2Subdevice>(lens);
+	int ret = subdev->open();
+	if (ret < 0) {
+		LOG(CameraSensor, Warning)
+			<< "Failed to open lens " << lens->name();
+		return;
+	}
+
+	if (subdev->controls().find(V4L2_CID_FOCUS_ABSOLUTE) ==
+	    subdev->controls().end()) {
+		LOG(CameraSensor, Warning)
+			<< "Lens " << lens->name()
+			<< " does not support absolute focus control";
+		return;
+	}
+
+	LOG(CameraSensor, Debug) << "Using lens " << lens->name();
+
+	focusLens_ = std::move(subdev);
 }
 
 int CameraSensor::initProperties()
@@ -409,6 +540,87 @@ int CameraSensor::initProperties()
 	return 0;
 }
 
+/*
+ * \brief Build the table of sensor modes
+ *
+ * Apply all the formats supported by the sensor in turn to retrieve the crop
+ * rectangle and frame timings from the driver, and sort the resulting modes
+ * by increasing bandwidth. The format active at init time is restored.
+ */
+void CameraSensor::initModes()
+{
+	V4L2SubdeviceFormat initialFormat{};
+	int ret = subdev_->getFormat(pad_, &initialFormat);
+	if (ret)
+		return;
+
+	const ControlIdMap &controls = subdev_->controls().idmap();
+	bool hasTimings = controls.count(V4L2_CID_PIXEL_RATE) &&
+			  controls.count(V4L2_CID_HBLANK) &&
+			  controls.count(V4L2_CID_VBLANK);
+	uint64_t activeArea = activeArea_.width * activeArea_.height;
+
+	for (const auto &[code, ranges] : formats_) {
+		for (const SizeRange &range : ranges) {
+			CameraSensorMode mode{};
+			mode.format.mbus_code = code;
+			mode.format.size = range.max;
+
+			ret = subdev_->setFormat(pad_, &mode.format);
+			if (ret || mode.format.mbus_code != code ||
+			    mode.format.size != range.max)
+				continue;
+
+			/* Modes can't be ranked without a known bandwidth. */
+			if (!mode.format.bitsPerPixel())
+				continue;
+
+			if (subdev_->getSelection(pad_, V4L2_SEL_TGT_CROP,
+						  &mode.analogCrop))
+				mode.analogCrop = activeArea_;
+
+			mode.binning = {
+				std::max(1U, mode.analogCrop.width / mode.format.size.width),
+				std::max(1U, mode.analogCrop.height / mode.format.size.height),
+			};
+
+			if (activeArea)
+				mode.fieldOfView = static_cast<float>(mode.analogCrop.width) *
+						   mode.analogCrop.height / activeArea;
+
+			if (hasTimings) {
+				subdev_->updateControlInfo();
+				ControlList ctrls = subdev_->getControls({ V4L2_CID_PIXEL_RATE,
+									   V4L2_CID_HBLANK,
+									   V4L2_CID_VBLANK });
+				int64_t pixelRate = ctrls.empty() ? 0
+						  : ctrls.get(V4L2_CID_PIXEL_RATE).get<int64_t>();
+				if (pixelRate) {
+					int32_t hblank = ctrls.get(V4L2_CID_HBLANK).get<int32_t>();
+					const ControlInfo &vblank = ctrls.infoMap()->at(V4L2_CID_VBLANK);
+					uint64_t lineLength = mode.format.size.width + hblank;
+					uint64_t frameLength = mode.format.size.height +
+							       vblank.min().get<int32_t>();
+
+					mode.minFrameDuration = lineLength * frameLength *
+								1000000000ULL / pixelRate;
+				}
+			}
+
+			modes_.push_back(mode);
+		}
+	}
+
+	std::stable_sort(modes_.begin(), modes_.end(),
+			 [](const CameraSensorMode &a, const CameraSensorMode &b) {
+				 if (a.frameBits() != b.frameBits())
+					 return a.frameBits() < b.frameBits();
+				 return a.minFrameDuration < b.minFrameDuration;
+			 });
+
+	setFormat(&initialFormat);
+}
+
 /**
  * \fn CameraSensor::model()
  * \brief Retrieve the sensor model name
@@ -556,6 +768,77 @@ V4L2SubdeviceFormat CameraSensor::getFormat(const std::vector<unsigned int> &mbu
 	return format;
 }
 
+/**
+ * \fn CameraSensor::modes()
+ * \brief Retrieve the sensor output modes
+ * \return The sensor modes sorted by increasing number of bits per frame
+ */
+
+/**
+ * \brief Find the cheapest sensor mode satisfying requirements
+ * \param[in] mbusCodes The list of acceptable media bus codes
+ * \param[in] size The minimum output size
+ * \param[in] frameRate The minimum frame rate, or 0 for any frame rate
+ * \param[in] fieldOfView The minimum fraction of the active area to capture
+ *
+ * Select, among the modes whose media bus code is listed in \a mbusCodes, that
+ * output at least \a size, reach \a frameRate and capture at least
+ * \a fieldOfView of the active area, the mode with the lowest bandwidth on the
+ * sensor output link. Modes whose maximum frame rate is unknown are assumed to
+ * reach any frame rate.
+ *
+ * As the bandwidth at a given frame rate is proportional to the number of bits
+ * per frame, the lookup walks the precomputed mode table in order and stops at
+ * the first match. When multiple media bus codes produce the same number of
+ * bits per frame, the code at the lowest position in \a mbusCodes is selected.
+ *
+ * Unlike getFormat(), this function doesn't try to match the aspect ratio of
+ * \a size. Pipeline handlers that need to preserve the field of view shall set
+ * \a fieldOfView accordingly.
+ *
+ * \return The selected sensor mode, or nullptr if no mode satisfies the
+ * requirements
+ */
+const CameraSensorMode *CameraSensor::findMode(const std::vector<unsigned int> &mbusCodes,
+					       const Size &size, double frameRate,
+					       float fieldOfView) const
+{
+	const CameraSensorMode *best = nullptr;
+	size_t bestRank = SIZE_MAX;
+
+	for (const CameraSensorMode &mode : modes_) {
+		if (best && mode.frameBits() > best->frameBits())
+			break;
+
+		auto iter = std::find(mbusCodes.begin(), mbusCodes.end(),
+				      mode.format.mbus_code);
+		if (iter == mbusCodes.end())
+			continue;
+
+		if (mode.format.size.width < size.width ||
+		    mode.format.size.height < size.height)
+			continue;
+
+		if (frameRate && mode.minFrameDuration &&
+		    mode.maxFrameRate() < frameRate)
+			continue;
+
+		if (mode.fieldOfView < fieldOfView)
+			continue;
+
+		size_t rank = iter - mbusCodes.begin();
+		if (rank < bestRank) {
+			best = &mode;
+			bestRank = rank;
+		}
+	}
+
+	if (!best)
+		LOG(CameraSensor, Debug) << "No sensor mode matches the requirements";
+
+	return best;
+}
+
 /**
  * \brief Set the sensor output format
  * \param[in] format The desired sensor output format
@@ -643,6 +926,50 @@ int CameraSensor::setControls(ControlList *ctrls)
 	return subdev_->setControls(ctrls);
 }
 
+/**
+ * \fn CameraSensor::syncModes()
+ * \brief Retrieve the frame synchronisation modes supported by the sensor
+ *
+ * The modes are listed as controls::SensorSyncModeEnum values, suitable to
+ * construct the ControlInfo of the controls::SensorSyncMode control. They are
+ * taken from the camera sensor properties database, for sensors whose driver
+ * exposes the synchronisation control.
+ *
+ * \return The supported synchronisation modes, or an empty vector if the
+ * sensor doesn't support frame synchronisation
+ */
+
+/**
+ * \brief Select the frame synchronisation mode of the sensor
+ * \param[in] mode The controls::SensorSyncModeEnum mode
+ *
+ * The mode shall be set before starting streaming from the sensor.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENOTSUP The sensor doesn't support frame synchronisation
+ * \retval -EINVAL The \a mode isn't supported by the sensor
+ */
+int CameraSensor::setSyncMode(int32_t mode)
+{
+	if (!syncControl_)
+		return mode == controls::SensorSyncOff ? 0 : -ENOTSUP;
+
+	auto it = syncValues_.find(mode);
+	if (it == syncValues_.end())
+		return -EINVAL;
+
+	ControlList ctrls(controls());
+	ctrls.set(syncControl_, ControlValue(it->second));
+
+	int ret = setControls(&ctrls);
+	if (ret)
+		return ret < 0 ? ret : -EINVAL;
+
+	LOG(CameraSensor, Debug) << "Frame synchronisation mode set to " << mode;
+
+	return 0;
+}
+
 /**
  * \fn CameraSensor::device()
  * \brief Retrieve the camera sensor device
@@ -650,6 +977,17 @@ int CameraSensor::setControls(ControlList *ctrls)
  * \return The camera sensor device
  */
 
+/**
+ * \fn CameraSensor::focusLens()
+ * \brief Retrieve the focus lens controller
+ *
+ * The focus lens controller is the lens actuator subdevice associated with the
+ * sensor. It supports at least the V4L2_CID_FOCUS_ABSOLUTE control.
+ *
+ * \return The focus lens subdevice, or nullptr if the sensor has no lens that
+ * can be controlled
+ */
+
 /**
  * \fn CameraSensor::properties()
  * \brief Retrieve the camera sensor properties
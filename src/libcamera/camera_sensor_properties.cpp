@@ -34,6 +34,14 @@ LOG_DEFINE_CATEGORY(CameraSensorProperties)
  *
  * \var CameraSensorProperties::unitCellSize
  * \brief The physical size of a pixel, including pixel edges, in nanometers.
+ *
+ * \var CameraSensorProperties::syncControl
+ * \brief The numerical ID of the driver control that selects the frame
+ * synchronisation mode, or 0 if the driver has no such control
+ *
+ * \var CameraSensorProperties::syncModes
+ * \brief Map of controls::SensorSyncModeEnum values to the values of the
+ * syncControl driver control that select them
  */
 
 /**
@@ -47,18 +55,28 @@ const CameraSensorProperties *CameraSensorProperties::get(const std::string &sen
 	static const std::map<std::string, const CameraSensorProperties> sensorProps = {
 		{ "imx219", {
 			.unitCellSize = { 1120, 1120 },
+			.syncControl = 0,
+			.syncModes = {},
 		} },
 		{ "imx258", {
 			.unitCellSize = { 1120, 1120 },
+			.syncControl = 0,
+			.syncModes = {},
 		} },
 		{ "ov5670", {
 			.unitCellSize = { 1120, 1120 },
+			.syncControl = 0,
+			.syncModes = {},
 		} },
 		{ "ov13858", {
 			.unitCellSize = { 1120, 1120 },
+			.syncControl = 0,
+			.syncModes = {},
 		} },
 		{ "ov5693", {
 			.unitCellSize = { 1400, 1400 },
+			.syncControl = 0,
+			.syncModes = {},
 		} },
 	};
 
@@ -0,0 +1,165 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * completion_queue.cpp - Request completion queue
+ */
+
+#include <libcamera/completion_queue.h>
+
+#include <deque>
+#include <errno.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "libcamera/internal/log.h"
+#include "libcamera/internal/thread.h"
+
+/**
+ * \file completion_queue.h
+ * \brief Request completion queue
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Camera)
+
+class CompletionQueue::Private : public Extensible::Private
+{
+	LIBCAMERA_DECLARE_PUBLIC(CompletionQueue)
+
+public:
+	Private(CompletionQueue *queue);
+	~Private();
+
+	int fd_;
+
+	/* Protects the requests_ list and the eventfd counter. */
+	Mutex mutex_;
+	std::deque<Request *> requests_;
+};
+
+CompletionQueue::Private::Private(CompletionQueue *queue)
+	: Extensible::Private(queue)
+{
+	fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (fd_ < 0) {
+		int ret = -errno;
+		LOG(Camera, Error)
+			<< "Failed to create eventfd: " << strerror(-ret);
+	}
+}
+
+CompletionQueue::Private::~Private()
+{
+	if (fd_ >= 0)
+		close(fd_);
+}
+
+/**
+ * \class CompletionQueue
+ * \brief Deliver completed requests to an application polled file descriptor
+ *
+ * The Camera::requestCompleted signal is emitted from the internal thread of
+ * the camera. Applications that connect an Object living in a different thread
+ * to the signal receive completions through a message posted to their thread,
+ * which costs a thread handoff for every request on top of the wakeup of the
+ * application event loop.
+ *
+ * A CompletionQueue offers a lower latency alternative. Once set on a camera
+ * with Camera::setCompletionQueue(), completed requests are appended to the
+ * queue from the camera thread, and the queue file descriptor returned by fd()
+ * becomes readable. Applications monitor the file descriptor in their own
+ * event loop, and retrieve completed requests with pop() until it returns
+ * nullptr.
+ *
+ * The queue only holds pointers to requests for the time it takes to hand
+ * them over to the application, and the internal lock is never held while
+ * running application code.
+ *
+ * A completion queue shall be set on a single camera at a time.
+ */
+
+/**
+ * \brief Construct a CompletionQueue
+ */
+CompletionQueue::CompletionQueue()
+	: Extensible(new Private(this))
+{
+}
+
+CompletionQueue::~CompletionQueue()
+{
+}
+
+/**
+ * \brief Check if the completion queue has been created successfully
+ * \return True if the queue is valid, false otherwise
+ */
+bool CompletionQueue::isValid() const
+{
+	const Private *const d = LIBCAMERA_D_PTR();
+	return d->fd_ >= 0;
+}
+
+/**
+ * \brief Retrieve the file descriptor signalling completions
+ *
+ * The file descriptor is readable when completed requests are available from
+ * the queue. It shall not be read from or written to by the application, and
+ * is owned by the queue.
+ *
+ * \return The file descriptor, or -1 if the queue is not valid
+ */
+int CompletionQueue::fd() const
+{
+	const Private *const d = LIBCAMERA_D_PTR();
+	return d->fd_;
+}
+
+/**
+ * \brief Retrieve the oldest completed request
+ *
+ * This function doesn't block. The file descriptor returned by fd() stops
+ * being readable once all completed requests have been retrieved.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return The oldest completed request, or nullptr if no completed request is
+ * available
+ */
+Request *CompletionQueue::pop()
+{
+	Private *const d = LIBCAMERA_D_PTR();
+
+	MutexLocker locker(d->mutex_);
+
+	if (d->requests_.empty())
+		return nullptr;
+
+	Request *request = d->requests_.front();
+	d->requests_.pop_front();
+
+	/* Clear the eventfd counter when the queue becomes empty. */
+	if (d->requests_.empty()) {
+		eventfd_t value;
+		eventfd_read(d->fd_, &value);
+	}
+
+	return request;
+}
+
+void CompletionQueue::push(Request *request)
+{
+	Private *const d = LIBCAMERA_D_PTR();
+
+	MutexLocker locker(d->mutex_);
+
+	d->requests_.push_back(request);
+
+	if (d->requests_.size() == 1)
+		eventfd_write(d->fd_, 1);
+}
+
+} /* namespace libcamera */
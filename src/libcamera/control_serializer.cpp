@@ -7,7 +7,6 @@
 
 #include "libcamera/internal/control_serializer.h"
 
-#include <algorithm>
 #include <memory>
 #include <vector>
 
@@ -66,6 +65,15 @@ LOG_DEFINE_CATEGORY(Serializer)
  * that constraint results in serialization or deserialization failure of the
  * ControlList.
  *
+ * ControlList instances are serialized incrementally. The serializer records
+ * the last ControlList serialized and deserialized for every ControlInfoMap
+ * handle, and only stores the differences with the previous list when this
+ * results in a smaller packet. This considerably reduces the size of lists
+ * exchanged repeatedly, such as per-frame metadata, where most values don't
+ * change from frame to frame. As a consequence, ControlList instances shall be
+ * deserialized in the same order they have been serialized, and every
+ * serialized ControlList shall be deserialized exactly once.
+ *
  * The serializer can be reset() to clear its internal state. This may be
  * performed when reconfiguring an IPA to avoid constant growth of the internal
  * state, especially if the contents of the ControlInfoMap instances change at
@@ -75,7 +83,7 @@ LOG_DEFINE_CATEGORY(Serializer)
  */
 
 ControlSerializer::ControlSerializer()
-	: serial_(0)
+	: serial_(0), failed_(false)
 {
 }
 
@@ -83,12 +91,17 @@ ControlSerializer::ControlSerializer()
  * \brief Reset the serializer
  *
  * Reset the internal state of the serializer. This invalidates all the
- * ControlList and ControlInfoMap that have been previously deserialized.
+ * ControlList and ControlInfoMap that have been previously deserialized, and
+ * clears the failure state.
  */
 void ControlSerializer::reset()
 {
 	serial_ = 0;
+	failed_ = false;
 
+	sentLists_.clear();
+	receivedLists_.clear();
+	handleInfoMaps_.clear();
 	infoMapHandles_.clear();
 	infoMaps_.clear();
 	controlIds_.clear();
@@ -129,9 +142,11 @@ size_t ControlSerializer::binarySize(const ControlInfoMap &infoMap)
  * \param[in] list The control list
  *
  * Compute and return the size in bytes required to store the serialized
- * ControlList.
+ * ControlList. As ControlList instances may be serialized incrementally, the
+ * serialized data may be smaller than the returned size.
  *
- * \return The size in bytes required to store the serialized ControlList
+ * \return The maximum size in bytes required to store the serialized
+ * ControlList
  */
 size_t ControlSerializer::binarySize(const ControlList &list)
 {
@@ -164,8 +179,13 @@ void ControlSerializer::store(const ControlInfo &info, ByteStreamBuffer &buffer)
  * Serialize the \a infoMap into the \a buffer using the serialization format
  * defined by the IPA context interface in ipa_controls.h.
  *
- * The serializer stores a reference to the \a infoMap internally. The caller
- * shall ensure that \a infoMap stays valid until the serializer is reset().
+ * The serializer keeps a copy of the \a infoMap internally, which shares the
+ * immutable data of \a infoMap. All copies of the \a infoMap are thus
+ * identified as cached until the serializer is reset(), and the caller doesn't
+ * need to keep \a infoMap alive.
+ *
+ * The \a buffer may be a fixed-size buffer, sized with binarySize(), or a
+ * growable buffer. The latter avoids computing the size beforehand.
  *
  * \return 0 on success, a negative error code otherwise
  * \retval -ENOSPC Not enough space is available in the buffer
@@ -193,7 +213,15 @@ int ControlSerializer::serialize(const ControlInfoMap &infoMap,
 	hdr.entries = infoMap.size();
 	hdr.size = sizeof(hdr) + entriesSize + valuesSize;
 	hdr.data_offset = sizeof(hdr) + entriesSize;
+	hdr.flags = 0;
+	hdr.sequence = 0;
+	hdr.reserved[0] = 0;
 
+	/*
+	 * Make sure a growable buffer doesn't need to reallocate its storage
+	 * while the entries and values are being written.
+	 */
+	buffer.reserve(hdr.size);
 	buffer.write(&hdr);
 
 	/*
@@ -223,7 +251,8 @@ int ControlSerializer::serialize(const ControlInfoMap &infoMap,
 	 * Store the map to handle association, to be used to serialize and
 	 * deserialize control lists.
 	 */
-	infoMapHandles_[&infoMap] = hdr.handle;
+	infoMapHandles_[infoMap.data_.get()] = hdr.handle;
+	handleInfoMaps_[hdr.handle] = infoMap;
 
 	return 0;
 }
@@ -236,6 +265,14 @@ int ControlSerializer::serialize(const ControlInfoMap &infoMap,
  * Serialize the \a list into the \a buffer using the serialization format
  * defined by the IPA context interface in ipa_controls.h.
  *
+ * If a ControlList has previously been serialized for the same ControlInfoMap,
+ * only the differences with that list are stored in the \a buffer when they
+ * are smaller than the full list. The \a list is recorded as the base for the
+ * next ControlList only if serialization succeeds.
+ *
+ * The \a buffer may be a fixed-size buffer, sized with binarySize(), or a
+ * growable buffer. The latter avoids computing the size beforehand.
+ *
  * \return 0 on success, a negative error code otherwise
  * \retval -ENOENT The ControlList is related to an unknown ControlInfoMap
  * \retval -ENOSPC Not enough space is available in the buffer
@@ -243,13 +280,15 @@ int ControlSerializer::serialize(const ControlInfoMap &infoMap,
 int ControlSerializer::serialize(const ControlList &list,
 				 ByteStreamBuffer &buffer)
 {
+	static const ControlValue removed;
+
 	/*
 	 * Find the ControlInfoMap handle for the ControlList if it has one, or
 	 * use 0 for ControlList without a ControlInfoMap.
 	 */
 	unsigned int infoMapHandle;
 	if (list.infoMap()) {
-		auto iter = infoMapHandles_.find(list.infoMap());
+		auto iter = infoMapHandles_.find(list.infoMap()->data_.get());
 		if (iter == infoMapHandles_.end()) {
 			LOG(Serializer, Error)
 				<< "Can't serialize ControlList: unknown ControlInfoMap";
@@ -266,38 +305,97 @@ int ControlSerializer::serialize(const ControlList &list,
 	for (const auto &ctrl : list)
 		valuesSize += binarySize(ctrl.second);
 
+	/*
+	 * Compute the differences with the previous list for the same handle.
+	 * Both lists are sorted by ID, walk them in parallel.
+	 */
+	ListState &state = sentLists_[infoMapHandle];
+	bool isDelta = false;
+
+	delta_.clear();
+
+	if (state.sequence) {
+		auto prev = state.list.begin();
+		auto next = list.begin();
+		size_t deltaValuesSize = 0;
+
+		while (prev != state.list.end() || next != list.end()) {
+			if (next == list.end() ||
+			    (prev != state.list.end() && prev->first < next->first)) {
+				delta_.emplace_back(prev->first, &removed);
+				++prev;
+				continue;
+			}
+
+			if (prev == state.list.end() || next->first < prev->first ||
+			    !(prev->second == next->second)) {
+				delta_.emplace_back(next->first, &next->second);
+				deltaValuesSize += binarySize(next->second);
+			}
+
+			if (prev != state.list.end() && prev->first == next->first)
+				++prev;
+			++next;
+		}
+
+		size_t deltaEntriesSize = delta_.size()
+					* sizeof(struct ipa_control_value_entry);
+		if (deltaEntriesSize + deltaValuesSize < entriesSize + valuesSize) {
+			isDelta = true;
+			entriesSize = deltaEntriesSize;
+			valuesSize = deltaValuesSize;
+		}
+	}
+
 	/* Prepare the packet header. */
 	struct ipa_controls_header hdr;
 	hdr.version = IPA_CONTROLS_FORMAT_VERSION;
 	hdr.handle = infoMapHandle;
-	hdr.entries = list.size();
+	hdr.entries = isDelta ? delta_.size() : list.size();
 	hdr.size = sizeof(hdr) + entriesSize + valuesSize;
 	hdr.data_offset = sizeof(hdr) + entriesSize;
+	hdr.flags = isDelta ? IPA_CONTROLS_FLAG_DELTA : 0;
+	hdr.sequence = state.sequence + 1;
+	hdr.reserved[0] = 0;
 
+	/*
+	 * Make sure a growable buffer doesn't need to reallocate its storage
+	 * while the entries and values are being written.
+	 */
+	buffer.reserve(hdr.size);
 	buffer.write(&hdr);
 
 	ByteStreamBuffer entries = buffer.carveOut(entriesSize);
 	ByteStreamBuffer values = buffer.carveOut(valuesSize);
 
-	/* Serialize all entries. */
-	for (const auto &ctrl : list) {
-		unsigned int id = ctrl.first;
-		const ControlValue &value = ctrl.second;
-
+	auto storeEntry = [&](unsigned int id, const ControlValue &value) {
 		struct ipa_control_value_entry entry;
 		entry.id = id;
 		entry.type = value.type();
 		entry.is_array = value.isArray();
 		entry.count = value.numElements();
 		entry.offset = values.offset();
+		entry.padding[0] = 0;
 		entries.write(&entry);
 
 		store(value, values);
+	};
+
+	/* Serialize all entries. */
+	if (isDelta) {
+		for (const auto &ctrl : delta_)
+			storeEntry(ctrl.first, *ctrl.second);
+	} else {
+		for (const auto &ctrl : list)
+			storeEntry(ctrl.first, ctrl.second);
 	}
 
 	if (buffer.overflow())
 		return -ENOSPC;
 
+	state.list = list;
+	state.sequence = hdr.sequence;
+
 	return 0;
 }
 
@@ -350,6 +448,7 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 	const struct ipa_controls_header *hdr = buffer.read<decltype(*hdr)>();
 	if (!hdr) {
 		LOG(Serializer, Error) << "Out of data";
+		failed_ = true;
 		return {};
 	}
 
@@ -363,6 +462,7 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 		LOG(Serializer, Error)
 			<< "Unsupported controls format version "
 			<< hdr->version;
+		failed_ = true;
 		return {};
 	}
 
@@ -371,6 +471,7 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 
 	if (buffer.overflow()) {
 		LOG(Serializer, Error) << "Out of data";
+		failed_ = true;
 		return {};
 	}
 
@@ -381,6 +482,7 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 			entries.read<decltype(*entry)>();
 		if (!entry) {
 			LOG(Serializer, Error) << "Out of data";
+			failed_ = true;
 			return {};
 		}
 
@@ -396,6 +498,7 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 			LOG(Serializer, Error)
 				<< "Bad data, entry offset mismatch (entry "
 				<< i << ")";
+			failed_ = true;
 			return {};
 		}
 
@@ -409,7 +512,8 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 	 * association.
 	 */
 	ControlInfoMap &map = infoMaps_[hdr->handle] = std::move(ctrls);
-	infoMapHandles_[&map] = hdr->handle;
+	infoMapHandles_[map.data_.get()] = hdr->handle;
+	handleInfoMaps_[hdr->handle] = map;
 
 	return map;
 }
@@ -421,6 +525,11 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
  * Re-construct a ControlList from a binary \a buffer containing data
  * serialized using the serialize() method.
  *
+ * When the \a buffer stores the differences with the previous ControlList for
+ * the same ControlInfoMap, the ControlList is reconstructed from the previously
+ * deserialized list. Deserialization fails if that list isn't the one the
+ * differences have been computed against.
+ *
  * \return The deserialized ControlList
  */
 template<>
@@ -429,6 +538,7 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
 	const struct ipa_controls_header *hdr = buffer.read<decltype(*hdr)>();
 	if (!hdr) {
 		LOG(Serializer, Error) << "Out of data";
+		failed_ = true;
 		return {};
 	}
 
@@ -436,6 +546,7 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
 		LOG(Serializer, Error)
 			<< "Unsupported controls format version "
 			<< hdr->version;
+		failed_ = true;
 		return {};
 	}
 
@@ -444,6 +555,7 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
 
 	if (buffer.overflow()) {
 		LOG(Serializer, Error) << "Out of data";
+		failed_ = true;
 		return {};
 	}
 
@@ -456,28 +568,44 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
 	 */
 	const ControlInfoMap *infoMap;
 	if (hdr->handle) {
-		auto iter = std::find_if(infoMapHandles_.begin(), infoMapHandles_.end(),
-					 [&](decltype(infoMapHandles_)::value_type &entry) {
-						 return entry.second == hdr->handle;
-					 });
-		if (iter == infoMapHandles_.end()) {
+		auto iter = handleInfoMaps_.find(hdr->handle);
+		if (iter == handleInfoMaps_.end()) {
 			LOG(Serializer, Error)
 				<< "Can't deserialize ControlList: unknown ControlInfoMap";
+			failed_ = true;
 			return {};
 		}
 
-		infoMap = iter->first;
+		infoMap = &iter->second;
 	} else {
 		infoMap = nullptr;
 	}
 
+	bool isDelta = hdr->flags & IPA_CONTROLS_FLAG_DELTA;
+	ListState &state = receivedLists_[hdr->handle];
+
+	if (isDelta && (!state.sequence || hdr->sequence != state.sequence + 1)) {
+		LOG(Serializer, Error)
+			<< "Can't deserialize ControlList: expected sequence "
+			<< state.sequence + 1 << ", got " << hdr->sequence;
+		failed_ = true;
+		return {};
+	}
+
 	ControlList ctrls(infoMap ? infoMap->idmap() : controls::controls);
 
+	/*
+	 * For delta packets, entries are sorted by ID. Merge them with the
+	 * previous list, copying the controls without an entry.
+	 */
+	auto prev = state.list.begin();
+
 	for (unsigned int i = 0; i < hdr->entries; ++i) {
 		const struct ipa_control_value_entry *entry =
 			entries.read<decltype(*entry)>();
 		if (!entry) {
 			LOG(Serializer, Error) << "Out of data";
+			failed_ = true;
 			return {};
 		}
 
@@ -485,15 +613,36 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
 			LOG(Serializer, Error)
 				<< "Bad data, entry offset mismatch (entry "
 				<< i << ")";
+			failed_ = true;
 			return {};
 		}
 
 		ControlType type = static_cast<ControlType>(entry->type);
+
+		if (isDelta) {
+			for (; prev != state.list.end() && prev->first < entry->id; ++prev)
+				ctrls.set(prev->first, prev->second);
+
+			if (prev != state.list.end() && prev->first == entry->id)
+				++prev;
+
+			if (type == ControlTypeNone)
+				continue;
+		}
+
 		ctrls.set(entry->id,
 			  loadControlValue(type, values, entry->is_array,
 					   entry->count));
 	}
 
+	if (isDelta) {
+		for (; prev != state.list.end(); ++prev)
+			ctrls.set(prev->first, prev->second);
+	}
+
+	state.list = ctrls;
+	state.sequence = hdr->sequence;
+
 	return ctrls;
 }
 
@@ -502,13 +651,30 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
  * \param[in] infoMap The ControlInfoMap to check
  *
  * The ControlSerializer caches all ControlInfoMaps that it has (de)serialized.
- * This function checks if \a infoMap is in the cache.
+ * This function checks if \a infoMap is in the cache. As the cache is keyed by
+ * the data shared by copies of a ControlInfoMap, any copy of a cached map is
+ * cached as well.
  *
  * \return True if \a infoMap is in the cache or false otherwise
  */
 bool ControlSerializer::isCached(const ControlInfoMap &infoMap)
 {
-	return infoMapHandles_.count(&infoMap);
+	return infoMapHandles_.count(infoMap.data_.get());
 }
 
+/**
+ * \fn ControlSerializer::failed()
+ * \brief Check if a deserialization has failed
+ *
+ * A failure to deserialize a ControlList or ControlInfoMap leaves the
+ * serializer out of sync with its peer, as the following incremental
+ * ControlList can't be reconstructed. The deserialization functions return an
+ * empty object in that case, which can't be told apart from a valid empty
+ * object. This function reports whether any deserialization has failed since
+ * the serializer has been constructed or reset(). The peers shall then both be
+ * reset before exchanging controls again.
+ *
+ * \return True if a deserialization has failed, false otherwise
+ */
+
 } /* namespace libcamera */
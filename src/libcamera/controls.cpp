@@ -7,6 +7,7 @@
 
 #include <libcamera/controls.h>
 
+#include <algorithm>
 #include <iomanip>
 #include <sstream>
 #include <string>
@@ -86,10 +87,17 @@ static constexpr size_t ControlValueSize[] = {
 /**
  * \class ControlValue
  * \brief Abstract type representing the value of a control
+ *
+ * Values whose size doesn't exceed 40 bytes are stored inline in the
+ * ControlValue instance, larger values are stored in memory allocated
+ * dynamically. This covers all scalar types and the small fixed-size arrays
+ * commonly set in every request, such as ColourGains, SensorBlackLevels,
+ * ColourCorrectionMatrix or a Rectangle, which can thus be set and copied
+ * without any memory allocation.
  */
 
 /** \todo Revisit the ControlValue layout when stabilizing the ABI */
-static_assert(sizeof(ControlValue) == 16, "Invalid size of ControlValue class");
+static_assert(sizeof(ControlValue) == 48, "Invalid size of ControlValue class");
 
 /**
  * \brief Construct an empty ControlValue.
@@ -149,6 +157,51 @@ ControlValue &ControlValue::operator=(const ControlValue &other)
 	return *this;
 }
 
+/**
+ * \brief Construct a ControlValue by moving the content of \a other
+ * \param[in] other The ControlValue to move content from
+ *
+ * The content of \a other is moved to the new instance without any memory
+ * allocation. \a other is left holding no value.
+ */
+ControlValue::ControlValue(ControlValue &&other) noexcept
+	: type_(ControlTypeNone), isArray_(false), numElements_(0)
+{
+	*this = std::move(other);
+}
+
+/**
+ * \brief Replace the content of the ControlValue with the content of \a other
+ * \param[in] other The ControlValue to move content from
+ *
+ * The content of \a other is moved to this instance without any memory
+ * allocation. \a other is left holding no value.
+ *
+ * \return The ControlValue with its content replaced with the one of \a other
+ */
+ControlValue &ControlValue::operator=(ControlValue &&other) noexcept
+{
+	if (this == &other)
+		return *this;
+
+	release();
+
+	type_ = other.type_;
+	isArray_ = other.isArray_;
+	numElements_ = other.numElements_;
+
+	if (numElements_ * ControlValueSize[type_] > sizeof(value_))
+		storage_ = other.storage_;
+	else
+		memcpy(value_, other.value_, sizeof(value_));
+
+	other.type_ = ControlTypeNone;
+	other.isArray_ = false;
+	other.numElements_ = 0;
+
+	return *this;
+}
+
 /**
  * \fn ControlValue::type()
  * \brief Retrieve the data type of the value
@@ -187,7 +240,7 @@ Span<const uint8_t> ControlValue::data() const
 	std::size_t size = numElements_ * ControlValueSize[type_];
 	const uint8_t *data = size > sizeof(value_)
 			    ? reinterpret_cast<const uint8_t *>(storage_)
-			    : reinterpret_cast<const uint8_t *>(&value_);
+			    : value_;
 	return { data, size };
 }
 
@@ -593,22 +646,51 @@ std::string ControlInfo::toString() const
  * unsorted map of ControlId pointers to ControlInfo instances. Unlike the
  * standard std::unsorted_map<> class, it is designed the be immutable once
  * constructed, and thus only exposes the read accessors of the
- * std::unsorted_map<> base class.
+ * std::unsorted_map<> container.
  *
  * In addition to the features of the standard unsorted map, this class also
  * provides access to the mapped elements using numerical ID keys. It maintains
  * an internal map of numerical ID to ControlId for this purpose, and exposes it
  * through the idmap() method to help construction of ControlList instances.
+ * The small numerical IDs of the libcamera controls and properties are further
+ * indexed in a table, making lookups by numerical ID array accesses.
+ *
+ * As the contents never change, copies of a ControlInfoMap share the same
+ * reference-counted storage. Copying a map, to return it from a camera, pass it
+ * to an IPA or cache it in a ControlSerializer, is thus cheap, and all the
+ * copies are identified as the same map. Assigning new contents to a map
+ * detaches it from its copies.
  */
 
 /**
  * \typedef ControlInfoMap::Map
- * \brief The base std::unsorted_map<> container
+ * \brief The underlying std::unsorted_map<> container
  */
 
+/**
+ * \typedef ControlInfoMap::iterator
+ * \brief Iterator type, identical to const_iterator as the map is immutable
+ */
+
+/**
+ * \typedef ControlInfoMap::const_iterator
+ * \brief Const iterator type
+ */
+
+/**
+ * \brief Construct an empty ControlInfoMap
+ */
+ControlInfoMap::ControlInfoMap()
+{
+	/* All empty maps share the same storage. */
+	static const std::shared_ptr<const Data> empty = std::make_shared<Data>();
+	data_ = empty;
+}
+
 /**
  * \fn ControlInfoMap::ControlInfoMap(const ControlInfoMap &other)
- * \brief Copy constructor, construct a ControlInfoMap from a copy of \a other
+ * \brief Copy constructor, construct a ControlInfoMap sharing the storage of
+ * \a other
  * \param[in] other The other ControlInfoMap
  */
 
@@ -617,9 +699,8 @@ std::string ControlInfo::toString() const
  * \param[in] init The initializer list
  */
 ControlInfoMap::ControlInfoMap(std::initializer_list<Map::value_type> init)
-	: Map(init)
+	: data_(createData(Map(init)))
 {
-	generateIdmap();
 }
 
 /**
@@ -630,14 +711,13 @@ ControlInfoMap::ControlInfoMap(std::initializer_list<Map::value_type> init)
  * \a info using move semantics. Upon return the \a info map will be empty.
  */
 ControlInfoMap::ControlInfoMap(Map &&info)
-	: Map(std::move(info))
+	: data_(createData(std::move(info)))
 {
-	generateIdmap();
 }
 
 /**
  * \fn ControlInfoMap &ControlInfoMap::operator=(const ControlInfoMap &other)
- * \brief Copy assignment operator, replace the contents with a copy of \a other
+ * \brief Copy assignment operator, share the storage of \a other
  * \param[in] other The other ControlInfoMap
  * \return A reference to the ControlInfoMap
  */
@@ -649,8 +729,7 @@ ControlInfoMap::ControlInfoMap(Map &&info)
  */
 ControlInfoMap &ControlInfoMap::operator=(std::initializer_list<Map::value_type> init)
 {
-	Map::operator=(init);
-	generateIdmap();
+	data_ = createData(Map(init));
 	return *this;
 }
 
@@ -665,20 +744,67 @@ ControlInfoMap &ControlInfoMap::operator=(std::initializer_list<Map::value_type>
  */
 ControlInfoMap &ControlInfoMap::operator=(Map &&info)
 {
-	Map::operator=(std::move(info));
-	generateIdmap();
+	data_ = createData(std::move(info));
 	return *this;
 }
 
 /**
- * \brief Access specified element by numerical ID
- * \param[in] id The numerical ID
- * \return A reference to the element whose ID is equal to \a id
+ * \fn ControlInfoMap::begin()
+ * \brief Retrieve an iterator to the first element of the map
+ * \return An iterator to the first element
+ */
+
+/**
+ * \fn ControlInfoMap::cbegin()
+ * \brief Retrieve an iterator to the first element of the map
+ * \return An iterator to the first element
+ */
+
+/**
+ * \fn ControlInfoMap::end()
+ * \brief Retrieve an iterator past the last element of the map
+ * \return An iterator past the last element
+ */
+
+/**
+ * \fn ControlInfoMap::cend()
+ * \brief Retrieve an iterator past the last element of the map
+ * \return An iterator past the last element
+ */
+
+/**
+ * \fn ControlInfoMap::empty()
+ * \brief Check if the map is empty
+ * \return True if the map contains no element, false otherwise
+ */
+
+/**
+ * \fn ControlInfoMap::size()
+ * \brief Retrieve the number of elements in the map
+ * \return The number of elements
+ */
+
+/**
+ * \fn ControlInfoMap::at(const key_type &key) const
+ * \brief Access specified element by ControlId
+ * \param[in] key The ControlId
+ * \return A const reference to the element whose key is equal to \a key
+ */
+
+/**
+ * \fn ControlInfoMap::count(const key_type &key) const
+ * \brief Count the number of elements matching a ControlId
+ * \param[in] key The ControlId
+ * \return The number of elements matching \a key
+ */
+
+/**
+ * \fn ControlInfoMap::find(const key_type &key) const
+ * \brief Find the element matching a ControlId
+ * \param[in] key The ControlId
+ * \return A const iterator pointing to the element matching \a key, or end()
+ * if no such element exists
  */
-ControlInfoMap::mapped_type &ControlInfoMap::at(unsigned int id)
-{
-	return at(idmap_.at(id));
-}
 
 /**
  * \brief Access specified element by numerical ID
@@ -687,7 +813,7 @@ ControlInfoMap::mapped_type &ControlInfoMap::at(unsigned int id)
  */
 const ControlInfoMap::mapped_type &ControlInfoMap::at(unsigned int id) const
 {
-	return at(idmap_.at(id));
+	return at(data_->idmap.at(id));
 }
 
 /**
@@ -697,27 +823,16 @@ const ControlInfoMap::mapped_type &ControlInfoMap::at(unsigned int id) const
  */
 ControlInfoMap::size_type ControlInfoMap::count(unsigned int id) const
 {
+	const std::vector<Map::const_iterator> &index = data_->index;
+	if (!index.empty())
+		return id < index.size() && index[id] != end();
+
 	/*
 	 * The ControlInfoMap and its idmap have a 1:1 mapping between their
 	 * entries, we can thus just count the matching entries in idmap to
 	 * avoid an additional lookup.
 	 */
-	return idmap_.count(id);
-}
-
-/**
- * \brief Find the element matching a numerical ID
- * \param[in] id The numerical ID
- * \return An iterator pointing to the element matching the numerical \a id, or
- * end() if no such element exists
- */
-ControlInfoMap::iterator ControlInfoMap::find(unsigned int id)
-{
-	auto iter = idmap_.find(id);
-	if (iter == idmap_.end())
-		return end();
-
-	return find(iter->second);
+	return data_->idmap.count(id);
 }
 
 /**
@@ -728,8 +843,12 @@ ControlInfoMap::iterator ControlInfoMap::find(unsigned int id)
  */
 ControlInfoMap::const_iterator ControlInfoMap::find(unsigned int id) const
 {
-	auto iter = idmap_.find(id);
-	if (iter == idmap_.end())
+	const std::vector<Map::const_iterator> &index = data_->index;
+	if (!index.empty())
+		return id < index.size() ? index[id] : end();
+
+	auto iter = data_->idmap.find(id);
+	if (iter == data_->idmap.end())
 		return end();
 
 	return find(iter->second);
@@ -746,11 +865,21 @@ ControlInfoMap::const_iterator ControlInfoMap::find(unsigned int id) const
  * \return The ControlId map
  */
 
-void ControlInfoMap::generateIdmap()
+/* Largest numerical ID for which the entries are indexed in a table */
+static constexpr unsigned int kMaxIndexedId = 1024;
+
+std::shared_ptr<const ControlInfoMap::Data> ControlInfoMap::createData(Map &&entries)
 {
-	idmap_.clear();
+	std::shared_ptr<Data> data = std::make_shared<Data>();
+	data->map = std::move(entries);
+
+	const Map &map = data->map;
+	ControlIdMap &idmap = data->idmap;
+	idmap.reserve(map.size());
 
-	for (const auto &ctrl : *this) {
+	unsigned int maxId = 0;
+
+	for (const auto &ctrl : map) {
 		/*
 		 * For string controls, min and max define the valid
 		 * range for the string size, not for the individual
@@ -764,13 +893,29 @@ void ControlInfoMap::generateIdmap()
 			LOG(Controls, Error)
 				<< "Control " << utils::hex(ctrl.first->id())
 				<< " type and info type mismatch";
-			idmap_.clear();
-			clear();
-			return;
+			idmap.clear();
+			data->map.clear();
+			return data;
 		}
 
-		idmap_[ctrl.first->id()] = ctrl.first;
+		idmap[ctrl.first->id()] = ctrl.first;
+		maxId = std::max(maxId, ctrl.first->id());
 	}
+
+	/*
+	 * The libcamera controls and properties have small consecutive IDs.
+	 * Index them in a table to turn the lookups by numerical ID, used to
+	 * validate every control set in a request, into array accesses. The
+	 * sparse V4L2 control IDs are looked up in the idmap.
+	 */
+	if (map.empty() || maxId >= kMaxIndexedId)
+		return data;
+
+	data->index.assign(maxId + 1, map.end());
+	for (auto iter = map.begin(); iter != map.end(); ++iter)
+		data->index[iter->first->id()] = iter;
+
+	return data;
 }
 
 /**
@@ -784,6 +929,12 @@ void ControlInfoMap::generateIdmap()
  * Control lists are constructed with a map of all the controls supported by
  * their object, and an optional ControlValidator to further validate the
  * controls.
+ *
+ * Controls are stored in a vector sorted by numerical ID. Iteration thus
+ * produces controls in a deterministic order, lookups don't hash, and clearing
+ * or copy-assigning a list reuses its memory. Lists constructed with a
+ * ControlInfoMap reserve storage for all the controls supported by the object,
+ * so filling them doesn't allocate memory for the list itself.
  */
 
 /**
@@ -819,6 +970,7 @@ ControlList::ControlList(const ControlIdMap &idmap, ControlValidator *validator)
 ControlList::ControlList(const ControlInfoMap &infoMap, ControlValidator *validator)
 	: validator_(validator), idmap_(&infoMap.idmap()), infoMap_(&infoMap)
 {
+	controls_.reserve(infoMap.size());
 }
 
 /**
@@ -872,6 +1024,9 @@ ControlList::ControlList(const ControlInfoMap &infoMap, ControlValidator *valida
 /**
  * \fn ControlList::clear()
  * \brief Removes all controls from the list
+ *
+ * The memory used to store the controls is retained, to be reused when
+ * controls are added to the list again.
  */
 
 /**
@@ -884,9 +1039,6 @@ ControlList::ControlList(const ControlInfoMap &infoMap, ControlValidator *valida
  *
  * Only control lists created from the same ControlIdMap or ControlInfoMap may
  * be merged. Attempting to do otherwise results in undefined behaviour.
- *
- * \todo Reimplement or implement an overloaded version which internally uses
- * std::unordered_map::merge() and accepts a non-const argument.
  */
 void ControlList::merge(const ControlList &source)
 {
@@ -904,7 +1056,12 @@ void ControlList::merge(const ControlList &source)
 
 	for (const auto &ctrl : source) {
 		if (contains(ctrl.first)) {
-			const ControlId *id = idmap_->at(ctrl.first);
+			/*
+			 * Look the ID up in the info map when available, as
+			 * assigning new contents to the map replaces its idmap.
+			 */
+			const ControlIdMap &idmap = infoMap_ ? infoMap_->idmap() : *idmap_;
+			const ControlId *id = idmap.at(ctrl.first);
 			LOG(Controls, Warning)
 				<< "Control " << id->name() << " not overwritten";
 			continue;
@@ -922,7 +1079,7 @@ void ControlList::merge(const ControlList &source)
  */
 bool ControlList::contains(const ControlId &id) const
 {
-	return controls_.find(id.id()) != controls_.end();
+	return contains(id.id());
 }
 
 /**
@@ -933,7 +1090,8 @@ bool ControlList::contains(const ControlId &id) const
  */
 bool ControlList::contains(unsigned int id) const
 {
-	return controls_.find(id) != controls_.end();
+	auto iter = lowerBound(id);
+	return iter != controls_.end() && iter->first == id;
 }
 
 /**
@@ -1025,8 +1183,8 @@ void ControlList::set(unsigned int id, const ControlValue &value)
 
 const ControlValue *ControlList::find(unsigned int id) const
 {
-	const auto iter = controls_.find(id);
-	if (iter == controls_.end()) {
+	const auto iter = lowerBound(id);
+	if (iter == controls_.end() || iter->first != id) {
 		LOG(Controls, Error)
 			<< "Control " << utils::hex(id) << " not found";
 
@@ -1045,7 +1203,27 @@ ControlValue *ControlList::find(unsigned int id)
 		return nullptr;
 	}
 
-	return &controls_[id];
+	auto iter = lowerBound(id);
+	if (iter == controls_.end() || iter->first != id)
+		iter = controls_.emplace(iter, id, ControlValue{});
+
+	return &iter->second;
+}
+
+ControlList::ControlListMap::const_iterator ControlList::lowerBound(unsigned int id) const
+{
+	return std::lower_bound(controls_.begin(), controls_.end(), id,
+				[](const ControlListMap::value_type &ctrl, unsigned int key) {
+					return ctrl.first < key;
+				});
+}
+
+ControlList::ControlListMap::iterator ControlList::lowerBound(unsigned int id)
+{
+	return std::lower_bound(controls_.begin(), controls_.end(), id,
+				[](const ControlListMap::value_type &ctrl, unsigned int key) {
+					return ctrl.first < key;
+				});
 }
 
 } /* namespace libcamera */
@@ -7,9 +7,13 @@
 
 #include "libcamera/internal/delayed_controls.h"
 
+#include <cmath>
+#include <errno.h>
+
 #include <libcamera/controls.h>
 
 #include "libcamera/internal/log.h"
+#include "libcamera/internal/tracepoints.h"
 #include "libcamera/internal/v4l2_device.h"
 
 /**
@@ -72,7 +76,8 @@ LOG_DEFINE_CATEGORY(DelayedControls)
  */
 DelayedControls::DelayedControls(V4L2Device *device,
 				 const std::unordered_map<uint32_t, ControlParams> &controlParams)
-	: device_(device), maxDelay_(0)
+	: device_(device), maxDelay_(0), bracketControl_(nullptr),
+	  bracketPosition_(0)
 {
 	const ControlInfoMap &controls = device_->controls();
 
@@ -93,16 +98,26 @@ DelayedControls::DelayedControls(V4L2Device *device,
 
 		const ControlId *id = it->first;
 
-		controlParams_[id] = param.second;
+		if (id->type() != ControlTypeInteger32 &&
+		    id->type() != ControlTypeInteger64) {
+			LOG(DelayedControls, Error)
+				<< "Delay request for non-integer control "
+				<< id->name();
+			continue;
+		}
+
+		controls_.push_back({ id, param.second, {} });
 
 		LOG(DelayedControls, Debug)
-			<< "Set a delay of " << controlParams_[id].delay
-			<< " and priority write flag " << controlParams_[id].priorityWrite
+			<< "Set a delay of " << param.second.delay
+			<< " and priority write flag " << param.second.priorityWrite
 			<< " for " << id->name();
 
-		maxDelay_ = std::max(maxDelay_, controlParams_[id].delay);
+		maxDelay_ = std::max(maxDelay_, param.second.delay);
 	}
 
+	batch_.resize(controls_.size());
+
 	reset();
 }
 
@@ -118,23 +133,31 @@ void DelayedControls::reset()
 	firstSequence_ = 0;
 	queueCount_ = 1;
 	writeCount_ = 0;
+	bracketPosition_ = 0;
 
 	/* Retrieve control as reported by the device. */
 	std::vector<uint32_t> ids;
-	for (auto const &param : controlParams_)
-		ids.push_back(param.first->id());
+	for (const Control &ctrl : controls_)
+		ids.push_back(ctrl.id->id());
 
 	ControlList controls = device_->getControls(ids);
 
 	/* Seed the control queue with the controls reported by the device. */
-	values_.clear();
-	for (const auto &ctrl : controls) {
-		const ControlId *id = device_->controls().idmap().at(ctrl.first);
+	for (Control &ctrl : controls_) {
+		ctrl.values.fill({ 0, 0, -1, false });
+
+		if (!controls.contains(ctrl.id->id()))
+			continue;
+
+		const ControlValue &value = controls.get(ctrl.id->id());
+
 		/*
 		 * Do not mark this control value as updated, it does not need
 		 * to be written to to device on startup.
 		 */
-		values_[id][0] = Info(ctrl.second, false);
+		ctrl.values[0].value = ctrl.id->type() == ControlTypeInteger64
+				     ? value.get<int64_t>() : value.get<int32_t>();
+		ctrl.values[0].requested = ctrl.values[0].value;
 	}
 }
 
@@ -145,39 +168,64 @@ void DelayedControls::reset()
  * Push a set of controls to the control queue. This increases the control queue
  * depth by one.
  *
+ * Only the controls whose value differs from the previously queued value are
+ * marked for update, controls pushed with an unchanged value are not written
+ * to the device again.
+ *
+ * When a bracket is set with setBracket(), the value queued for the bracketed
+ * control is scaled by the next gain of the bracket.
+ *
  * \returns true if \a controls are accepted, or false otherwise
  */
 bool DelayedControls::push(const ControlList &controls)
 {
 	/* Copy state from previous frame. */
-	for (auto &ctrl : values_) {
-		Info &info = ctrl.second[queueCount_];
-		info = values_[ctrl.first][queueCount_ - 1];
+	for (Control &ctrl : controls_) {
+		Info &info = ctrl.values[queueCount_];
+		const Info &previous = ctrl.values[queueCount_ - 1];
+		info.value = previous.value;
+		info.requested = previous.requested;
 		info.updated = false;
 	}
 
 	/* Update with new controls. */
-	const ControlIdMap &idmap = device_->controls().idmap();
 	for (const auto &control : controls) {
-		const auto &it = idmap.find(control.first);
-		if (it == idmap.end()) {
+		Control *ctrl = findControl(control.first);
+		if (!ctrl) {
 			LOG(DelayedControls, Warning)
 				<< "Unknown control " << control.first;
 			return false;
 		}
 
-		const ControlId *id = it->second;
+		Info &info = ctrl->values[queueCount_];
+		info.requested = ctrl->id->type() == ControlTypeInteger64
+			       ? control.second.get<int64_t>()
+			       : control.second.get<int32_t>();
+	}
 
-		if (controlParams_.find(id) == controlParams_.end())
-			return false;
+	int bracket = -1;
+	if (bracketControl_) {
+		bracket = bracketPosition_;
+		bracketPosition_ = (bracketPosition_ + 1) % bracketGains_.size();
+	}
 
-		Info &info = values_[id][queueCount_];
+	for (Control &ctrl : controls_) {
+		Info &info = ctrl.values[queueCount_];
+		int64_t value = info.requested;
 
-		info = Info(control.second);
+		info.bracket = bracket;
+		if (&ctrl == bracketControl_)
+			value = std::llround(value * bracketGains_[bracket]);
+
+		if (value == info.value)
+			continue;
+
+		info.value = value;
+		info.updated = true;
 
 		LOG(DelayedControls, Debug)
-			<< "Queuing " << id->name()
-			<< " to " << info.toString()
+			<< "Queuing " << ctrl.id->name()
+			<< " to " << info.value
 			<< " at index " << queueCount_;
 	}
 
@@ -207,21 +255,76 @@ ControlList DelayedControls::get(uint32_t sequence)
 	unsigned int index = std::max<int>(0, adjustedSeq - maxDelay_);
 
 	ControlList out(device_->controls());
-	for (const auto &ctrl : values_) {
-		const ControlId *id = ctrl.first;
-		const Info &info = ctrl.second[index];
+	for (const Control &ctrl : controls_) {
+		const Info &info = ctrl.values[index];
 
-		out.set(id->id(), info);
+		out.set(ctrl.id->id(), controlValue(ctrl, info));
 
 		LOG(DelayedControls, Debug)
-			<< "Reading " << id->name()
-			<< " to " << info.toString()
+			<< "Reading " << ctrl.id->name()
+			<< " to " << info.value
 			<< " at index " << index;
 	}
 
 	return out;
 }
 
+/**
+ * \brief Cycle the values of a control through a bracket of gains
+ * \param[in] id The numerical V4L2 id of the control
+ * \param[in] gains The gains to apply in turn, or an empty vector to stop
+ * bracketing
+ *
+ * Starting with the next call to push(), the value queued for control \a id
+ * for each frame is the value pushed by the caller, or carried over from the
+ * previous frame, multiplied by the next entry of \a gains, cycling through
+ * the entries. As values are queued frame by frame, the sequence of gains is
+ * applied frame-accurately, and bracketIndex() tells which entry has been
+ * applied to a frame. This is typically used to alternate exposure times for
+ * high dynamic range capture. Only one control can be bracketed at a time.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The control \a id is not handled by this instance
+ */
+int DelayedControls::setBracket(uint32_t id, const std::vector<double> &gains)
+{
+	bracketControl_ = nullptr;
+	bracketGains_ = gains;
+	bracketPosition_ = 0;
+
+	if (gains.empty())
+		return 0;
+
+	bracketControl_ = findControl(id);
+	if (!bracketControl_) {
+		LOG(DelayedControls, Error)
+			<< "Can't bracket unknown control " << utils::hex(id);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Retrieve the bracket entry applied at a sequence number
+ * \param[in] sequence The sequence number
+ *
+ * The same history constraints as for get() apply.
+ *
+ * \return The index in the gains passed to setBracket() of the gain applied at
+ * \a sequence, or -1 if the frame wasn't bracketed
+ */
+int DelayedControls::bracketIndex(uint32_t sequence) const
+{
+	if (controls_.empty())
+		return -1;
+
+	uint32_t adjustedSeq = sequence - firstSequence_;
+	unsigned int index = std::max<int>(0, adjustedSeq - maxDelay_);
+
+	return controls_[0].values[index].bracket;
+}
+
 /**
  * \brief Inform DelayedControls of the start of a new frame
  * \param[in] sequence Sequence number of the frame that started
@@ -230,6 +333,11 @@ ControlList DelayedControls::get(uint32_t sequence)
  * number. Any user of these helpers is responsible to inform the helper about
  * the start of any frame. This can be connected with ease to the start of a
  * exposure (SOE) V4L2 event.
+ *
+ * All the updated controls are written to the device with a single
+ * VIDIOC_S_EXT_CTRLS ioctl from a preallocated array, except for the controls
+ * with the priority write flag that are written ahead of them. No ioctl is
+ * issued when no control needs to be updated.
  */
 void DelayedControls::applyControls(uint32_t sequence)
 {
@@ -241,41 +349,41 @@ void DelayedControls::applyControls(uint32_t sequence)
 	}
 
 	/*
-	 * Create control list peeking ahead in the value queue to ensure
-	 * values are set in time to satisfy the sensor delay.
+	 * Fill the batch of controls peeking ahead in the value queue to
+	 * ensure values are set in time to satisfy the sensor delay.
 	 */
-	ControlList out(device_->controls());
-	for (auto &ctrl : values_) {
-		const ControlId *id = ctrl.first;
-		unsigned int delayDiff = maxDelay_ - controlParams_[id].delay;
+	unsigned int count = 0;
+	for (Control &ctrl : controls_) {
+		unsigned int delayDiff = maxDelay_ - ctrl.params.delay;
 		unsigned int index = std::max<int>(0, writeCount_ - delayDiff);
-		Info &info = ctrl.second[index];
-
-		if (info.updated) {
-			if (controlParams_[id].priorityWrite) {
-				/*
-				 * This control must be written now, it could
-				 * affect validity of the other controls.
-				 */
-				ControlList priority(device_->controls());
-				priority.set(id->id(), info);
-				device_->setControls(&priority);
-			} else {
-				/*
-				 * Batch up the list of controls and write them
-				 * at the end of the function.
-				 */
-				out.set(id->id(), info);
-			}
-
-			LOG(DelayedControls, Debug)
-				<< "Setting " << id->name()
-				<< " to " << info.toString()
-				<< " at index " << index;
-
-			/* Done with this update, so mark as completed. */
-			info.updated = false;
+		Info &info = ctrl.values[index];
+
+		if (!info.updated)
+			continue;
+
+		if (ctrl.params.priorityWrite) {
+			/*
+			 * This control must be written now, it could affect
+			 * validity of the other controls.
+			 */
+			struct v4l2_ext_control priority;
+			fillControl(&priority, ctrl, info);
+			device_->setControls(Span<v4l2_ext_control>(&priority, 1));
+		} else {
+			/*
+			 * Batch up the list of controls and write them at the
+			 * end of the function.
+			 */
+			fillControl(&batch_[count++], ctrl, info);
 		}
+
+		LOG(DelayedControls, Debug)
+			<< "Setting " << ctrl.id->name()
+			<< " to " << info.value
+			<< " at index " << index;
+
+		/* Done with this update, so mark as completed. */
+		info.updated = false;
 	}
 
 	writeCount_++;
@@ -286,7 +394,40 @@ void DelayedControls::applyControls(uint32_t sequence)
 		push({});
 	}
 
-	device_->setControls(&out);
+	LIBCAMERA_TRACEPOINT(delayed_controls_apply, sequence, count);
+
+	device_->setControls(Span<v4l2_ext_control>(batch_.data(), count));
+}
+
+DelayedControls::Control *DelayedControls::findControl(unsigned int id)
+{
+	for (Control &ctrl : controls_) {
+		if (ctrl.id->id() == id)
+			return &ctrl;
+	}
+
+	return nullptr;
+}
+
+ControlValue DelayedControls::controlValue(const Control &ctrl,
+					   const Info &info) const
+{
+	if (ctrl.id->type() == ControlTypeInteger64)
+		return ControlValue(info.value);
+
+	return ControlValue(static_cast<int32_t>(info.value));
+}
+
+void DelayedControls::fillControl(struct v4l2_ext_control *v4l2Ctrl,
+				  const Control &ctrl, const Info &info) const
+{
+	*v4l2Ctrl = {};
+	v4l2Ctrl->id = ctrl.id->id();
+
+	if (ctrl.id->type() == ControlTypeInteger64)
+		v4l2Ctrl->value64 = info.value;
+	else
+		v4l2Ctrl->value = info.value;
 }
 
 } /* namespace libcamera */
@@ -9,10 +9,14 @@
 #include "libcamera/internal/device_enumerator_sysfs.h"
 #include "libcamera/internal/device_enumerator_udev.h"
 
+#include <algorithm>
+#include <atomic>
 #include <string.h>
+#include <thread>
 
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/media_device.h"
+#include "libcamera/internal/utils.h"
 
 /**
  * \file device_enumerator.h
@@ -227,6 +231,65 @@ std::unique_ptr<MediaDevice> DeviceEnumerator::createDevice(const std::string &d
 	return media;
 }
 
+/**
+ * \brief Create media device instances for multiple device nodes
+ * \param[in] deviceNodes paths to the media devices to create
+ *
+ * Populating a media device requires one ioctl to retrieve the media graph
+ * topology and one ioctl per entity. Device enumerators that find multiple
+ * media devices at once shall use this method to create them instead of
+ * calling createDevice() for each device node, as the media devices are
+ * created and populated concurrently on worker threads.
+ *
+ * The device enumerator shall then populate the media devices and add them to
+ * the system as explained in createDevice(), from the thread it runs in.
+ *
+ * \return A vector of created media device instances, in the same order as
+ * \a deviceNodes, with a nullptr entry for each device that failed to be
+ * created
+ */
+std::vector<std::unique_ptr<MediaDevice>>
+DeviceEnumerator::createDevices(const std::vector<std::string> &deviceNodes)
+{
+	std::vector<std::unique_ptr<MediaDevice>> devices(deviceNodes.size());
+	utils::time_point start = utils::clock::now();
+
+	/*
+	 * Media devices are independent of each other and MediaDevice::populate()
+	 * only touches the instance it is called on, each worker thread can thus
+	 * pick the next device node without any locking beyond the index.
+	 */
+	std::atomic<unsigned int> next{ 0 };
+	auto worker = [&]() {
+		unsigned int index;
+		while ((index = next++) < deviceNodes.size())
+			devices[index] = createDevice(deviceNodes[index]);
+	};
+
+	unsigned int numWorkers =
+		std::min<unsigned int>(std::max(std::thread::hardware_concurrency(), 1u),
+				       deviceNodes.size());
+
+	std::vector<std::thread> workers;
+	for (unsigned int i = 1; i < numWorkers; ++i)
+		workers.emplace_back(worker);
+
+	/* Take part in the work instead of waiting idly. */
+	worker();
+
+	for (std::thread &thread : workers)
+		thread.join();
+
+	utils::duration elapsed = utils::clock::now() - start;
+	LOG(DeviceEnumerator, Debug)
+		<< "Created " << deviceNodes.size() << " media devices with "
+		<< std::max(numWorkers, 1u) << " threads in "
+		<< std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()
+		<< "us";
+
+	return devices;
+}
+
 /**
 * \var DeviceEnumerator::devicesAdded
 * \brief Notify of new media devices being found
@@ -245,6 +308,10 @@ std::unique_ptr<MediaDevice> DeviceEnumerator::createDevice(const std::string &d
  * pipeline handlers. \a media shall be created with createDevice() first.
  * This method shall be called after all members of the entities of the
  * media graph have been confirmed to be initialized.
+ *
+ * The devicesAdded signal isn't emitted by this function. Enumerators that
+ * support hotplug shall emit it once they have added a batch of devices, to
+ * avoid matching pipeline handlers for every device.
  */
 void DeviceEnumerator::addDevice(std::unique_ptr<MediaDevice> media)
 {
@@ -252,9 +319,6 @@ void DeviceEnumerator::addDevice(std::unique_ptr<MediaDevice> media)
 		<< "Added device " << media->deviceNode() << ": " << media->driver();
 
 	devices_.push_back(std::move(media));
-
-	/* \todo To batch multiple additions, emit with a small delay here. */
-	devicesAdded.emit();
 }
 
 /**
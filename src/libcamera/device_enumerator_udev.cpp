@@ -16,6 +16,7 @@
 #include <sys/ioctl.h>
 #include <sys/sysmacros.h>
 #include <unistd.h>
+#include <vector>
 
 #include "libcamera/internal/event_notifier.h"
 #include "libcamera/internal/log.h"
@@ -25,15 +26,26 @@ namespace libcamera {
 
 LOG_DECLARE_CATEGORY(DeviceEnumerator)
 
+/*
+ * Time to wait after the last hotplug add event before processing the queued
+ * devices. A single media device shows up as a burst of media and video4linux
+ * events, which are all handled in one batch.
+ */
+static constexpr std::chrono::milliseconds kHotplugDebounce{ 100 };
+
 DeviceEnumeratorUdev::DeviceEnumeratorUdev()
-	: udev_(nullptr), monitor_(nullptr), notifier_(nullptr)
+	: udev_(nullptr), monitor_(nullptr), notifier_(nullptr), added_(false)
 {
+	hotplugTimer_.timeout.connect(this, &DeviceEnumeratorUdev::hotplugTimeout);
 }
 
 DeviceEnumeratorUdev::~DeviceEnumeratorUdev()
 {
 	delete notifier_;
 
+	for (struct udev_device *dev : hotplugDevices_)
+		udev_device_unref(dev);
+
 	if (monitor_)
 		udev_monitor_unref(monitor_);
 	if (udev_)
@@ -68,6 +80,45 @@ int DeviceEnumeratorUdev::init()
 	return 0;
 }
 
+/**
+ * \brief Add a batch of udev devices
+ * \param[in] devices The udev devices
+ *
+ * Create the media devices concurrently, and then add all devices in the order
+ * of \a devices. A reference to each device is released.
+ */
+void DeviceEnumeratorUdev::addUdevDevices(const std::vector<struct udev_device *> &devices)
+{
+	std::vector<std::string> mediaNodes;
+
+	for (struct udev_device *dev : devices) {
+		const char *subsystem = udev_device_get_subsystem(dev);
+		if (subsystem && !strcmp(subsystem, "media"))
+			mediaNodes.push_back(udev_device_get_devnode(dev));
+	}
+
+	std::vector<std::unique_ptr<MediaDevice>> media = createDevices(mediaNodes);
+	auto nextMedia = media.begin();
+
+	for (struct udev_device *dev : devices) {
+		const char *subsystem = udev_device_get_subsystem(dev);
+		int err;
+
+		if (subsystem && !strcmp(subsystem, "media"))
+			err = addMediaDevice(std::move(*nextMedia++));
+		else
+			err = addUdevDevice(dev);
+
+		if (err < 0)
+			LOG(DeviceEnumerator, Warning)
+				<< "Failed to add device for '"
+				<< udev_device_get_syspath(dev)
+				<< "', skipping";
+
+		udev_device_unref(dev);
+	}
+}
+
 int DeviceEnumeratorUdev::addUdevDevice(struct udev_device *dev)
 {
 	const char *subsystem = udev_device_get_subsystem(dev);
@@ -77,49 +128,56 @@ int DeviceEnumeratorUdev::addUdevDevice(struct udev_device *dev)
 	if (!strcmp(subsystem, "media")) {
 		std::unique_ptr<MediaDevice> media =
 			createDevice(udev_device_get_devnode(dev));
-		if (!media)
-			return -ENODEV;
-
-		DependencyMap deps;
-		int ret = populateMediaDevice(media.get(), &deps);
-		if (ret < 0) {
-			LOG(DeviceEnumerator, Warning)
-				<< "Failed to populate media device "
-				<< media->deviceNode()
-				<< " (" << media->driver() << "), skipping";
-			return ret;
-		}
+		return addMediaDevice(std::move(media));
+	}
 
-		if (!deps.empty()) {
-			LOG(DeviceEnumerator, Debug)
-				<< "Defer media device " << media->deviceNode()
-				<< " due to " << deps.size()
-				<< " missing dependencies";
+	if (!strcmp(subsystem, "video4linux")) {
+		addV4L2Device(udev_device_get_devnum(dev));
+		return 0;
+	}
 
-			pending_.emplace_back(std::move(media), std::move(deps));
-			MediaDeviceDeps *mediaDeps = &pending_.back();
-			for (const auto &dep : mediaDeps->deps_)
-				devMap_[dep.first] = mediaDeps;
+	return -ENODEV;
+}
 
-			return 0;
-		}
+int DeviceEnumeratorUdev::addMediaDevice(std::unique_ptr<MediaDevice> media)
+{
+	if (!media)
+		return -ENODEV;
 
-		addDevice(std::move(media));
-		return 0;
+	DependencyMap deps;
+	int ret = populateMediaDevice(media.get(), &deps);
+	if (ret < 0) {
+		LOG(DeviceEnumerator, Warning)
+			<< "Failed to populate media device "
+			<< media->deviceNode()
+			<< " (" << media->driver() << "), skipping";
+		return ret;
 	}
 
-	if (!strcmp(subsystem, "video4linux")) {
-		addV4L2Device(udev_device_get_devnum(dev));
+	if (!deps.empty()) {
+		LOG(DeviceEnumerator, Debug)
+			<< "Defer media device " << media->deviceNode()
+			<< " due to " << deps.size()
+			<< " missing dependencies";
+
+		pending_.emplace_back(std::move(media), std::move(deps));
+		MediaDeviceDeps *mediaDeps = &pending_.back();
+		for (const auto &dep : mediaDeps->deps_)
+			devMap_[dep.first] = mediaDeps;
+
 		return 0;
 	}
 
-	return -ENODEV;
+	addDevice(std::move(media));
+	added_ = true;
+	return 0;
 }
 
 int DeviceEnumeratorUdev::enumerate()
 {
 	struct udev_enumerate *udev_enum = nullptr;
 	struct udev_list_entry *ents, *ent;
+	std::vector<struct udev_device *> devices;
 	int ret;
 
 	udev_enum = udev_enumerate_new(udev_);
@@ -168,14 +226,12 @@ int DeviceEnumeratorUdev::enumerate()
 			continue;
 		}
 
-		if (addUdevDevice(dev) < 0)
-			LOG(DeviceEnumerator, Warning)
-				<< "Failed to add device for '"
-				<< syspath << "', skipping";
-
-		udev_device_unref(dev);
+		devices.push_back(dev);
 	}
 
+	addUdevDevices(devices);
+	added_ = false;
+
 done:
 	udev_enumerate_unref(udev_enum);
 	if (ret < 0)
@@ -321,6 +377,7 @@ int DeviceEnumeratorUdev::addV4L2Device(dev_t devnum)
 			<< deps->media_->deviceNode() << " found";
 		addDevice(std::move(deps->media_));
 		pending_.remove(*deps);
+		added_ = true;
 	}
 
 	return 0;
@@ -328,22 +385,63 @@ int DeviceEnumeratorUdev::addV4L2Device(dev_t devnum)
 
 void DeviceEnumeratorUdev::udevNotify([[maybe_unused]] EventNotifier *notifier)
 {
-	struct udev_device *dev = udev_monitor_receive_device(monitor_);
-	std::string action(udev_device_get_action(dev));
-	std::string deviceNode(udev_device_get_devnode(dev));
+	/*
+	 * Drain all pending events. Additions are queued and processed in a
+	 * batch once no new event has been received for kHotplugDebounce, while
+	 * removals flush the queue first to preserve ordering.
+	 */
+	struct udev_device *dev;
+	while ((dev = udev_monitor_receive_device(monitor_))) {
+		const char *action = udev_device_get_action(dev);
+		const char *devnode = udev_device_get_devnode(dev);
+
+		if (!action || !devnode) {
+			udev_device_unref(dev);
+			continue;
+		}
+
+		LOG(DeviceEnumerator, Debug) << action << " device " << devnode;
+
+		if (!strcmp(action, "add")) {
+			hotplugDevices_.push_back(dev);
+			hotplugTimer_.start(kHotplugDebounce);
+			continue;
+		}
+
+		if (!strcmp(action, "remove")) {
+			const char *subsystem = udev_device_get_subsystem(dev);
+			if (subsystem && !strcmp(subsystem, "media")) {
+				flushHotplug();
+				removeDevice(devnode);
+			}
+		}
+
+		udev_device_unref(dev);
+	}
+}
+
+void DeviceEnumeratorUdev::flushHotplug()
+{
+	hotplugTimer_.stop();
 
-	LOG(DeviceEnumerator, Debug)
-		<< action << " device " << udev_device_get_devnode(dev);
+	if (hotplugDevices_.empty())
+		return;
 
-	if (action == "add") {
-		addUdevDevice(dev);
-	} else if (action == "remove") {
-		const char *subsystem = udev_device_get_subsystem(dev);
-		if (subsystem && !strcmp(subsystem, "media"))
-			removeDevice(deviceNode);
+	std::vector<struct udev_device *> devices = std::move(hotplugDevices_);
+	hotplugDevices_.clear();
+
+	addUdevDevices(devices);
+
+	/* Match pipeline handlers once for the whole batch. */
+	if (added_) {
+		added_ = false;
+		devicesAdded.emit();
 	}
+}
 
-	udev_device_unref(dev);
+void DeviceEnumeratorUdev::hotplugTimeout([[maybe_unused]] Timer *timer)
+{
+	flushHotplug();
 }
 
 } /* namespace libcamera */
@@ -0,0 +1,213 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * dma_buffer_allocator.cpp - Frame buffer allocator based on dma-heaps
+ */
+
+#include "libcamera/internal/dma_buffer_allocator.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libcamera/buffer.h>
+
+#include "libcamera/internal/log.h"
+
+/**
+ * \file dma_buffer_allocator.h
+ * \brief Frame buffer allocator based on dma-heaps
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(DmaBufferAllocator)
+
+namespace {
+
+ino_t inode(const FileDescriptor &fd)
+{
+	struct stat st;
+	if (fstat(fd.fd(), &st) < 0)
+		return 0;
+
+	return st.st_ino;
+}
+
+} /* namespace */
+
+/**
+ * \class DmaBufferAllocator
+ * \brief Allocate FrameBuffer instances from a dma-heap and pool them
+ *
+ * The DmaBufferAllocator allocates FrameBuffer memory from the kernel
+ * dma-heap allocators, independently of any video device. Unlike buffers
+ * exported with V4L2VideoDevice::exportBuffers(), the buffer memory isn't tied
+ * to the configuration of a device, and can be reused after the device is
+ * reconfigured.
+ *
+ * Buffers that are not needed anymore are returned to the allocator with
+ * recycle(). Their memory is then kept in a pool, and reused by subsequent
+ * calls to exportBuffers() that request planes of a similar size. This avoids
+ * the cost of freeing and allocating memory when a camera is reconfigured or
+ * restarted. The pool is emptied with clear().
+ *
+ * The memory is allocated from a physically contiguous heap when available,
+ * as it can be imported by any device. The system heap is used as a fallback,
+ * which requires devices to be able to handle scattered memory. The heap types
+ * that the allocator may use are selected at construction time.
+ */
+
+/**
+ * \brief Construct a DmaBufferAllocator
+ * \param[in] heapTypes The dma-heap types that may be used, as a bitmask of
+ * DmaHeap::Type values
+ */
+DmaBufferAllocator::DmaBufferAllocator(unsigned int heapTypes)
+	: heap_(heapTypes)
+{
+}
+
+/**
+ * \fn DmaBufferAllocator::isValid()
+ * \brief Check if the allocator can allocate memory
+ * \return True if a dma-heap is available, false otherwise
+ */
+
+/**
+ * \brief Allocate FrameBuffer instances
+ * \param[in] count The number of buffers to allocate
+ * \param[in] planeSizes The size of each plane of the buffers, in bytes
+ * \param[out] buffers Vector to store the allocated buffers
+ *
+ * Allocate \a count buffers made of one dmabuf per plane, reusing memory from
+ * the pool when possible, and append them to \a buffers. Pooled memory is
+ * reused when it is at least as large as the requested plane size but not
+ * more than twice as large, to avoid wasting memory when the frame size
+ * shrinks.
+ *
+ * \return The number of allocated buffers on success or a negative error code
+ * otherwise
+ * \retval -ENODEV No dma-heap is available
+ * \retval -EINVAL The plane sizes are invalid
+ * \retval -ENOMEM Memory allocation failed
+ */
+int DmaBufferAllocator::exportBuffers(unsigned int count,
+				      const std::vector<unsigned int> &planeSizes,
+				      std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	if (!isValid())
+		return -ENODEV;
+
+	if (planeSizes.empty())
+		return -EINVAL;
+
+	for (unsigned int size : planeSizes) {
+		if (!size)
+			return -EINVAL;
+	}
+
+	std::vector<std::unique_ptr<FrameBuffer>> allocated;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		std::vector<FrameBuffer::Plane> planes;
+
+		for (unsigned int size : planeSizes) {
+			FrameBuffer::Plane plane;
+			plane.fd = get(size);
+			plane.length = size;
+
+			if (!plane.fd.isValid()) {
+				/* Return the memory allocated so far to the pool. */
+				if (!planes.empty())
+					allocated.push_back(std::make_unique<FrameBuffer>(planes));
+				recycle(&allocated);
+				return -ENOMEM;
+			}
+
+			planes.push_back(std::move(plane));
+		}
+
+		allocated.push_back(std::make_unique<FrameBuffer>(planes));
+	}
+
+	for (std::unique_ptr<FrameBuffer> &buffer : allocated)
+		buffers->push_back(std::move(buffer));
+
+	return count;
+}
+
+/**
+ * \brief Return buffers to the pool
+ * \param[inout] buffers The buffers to recycle
+ *
+ * The memory of the \a buffers allocated by this allocator is added to the
+ * pool, and the \a buffers vector is cleared. Buffers that have not been
+ * allocated by this allocator are deleted without being recycled.
+ *
+ * The caller shall ensure that the buffers are not in use anymore, neither by
+ * a device nor by the application.
+ */
+void DmaBufferAllocator::recycle(std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	for (const std::unique_ptr<FrameBuffer> &buffer : *buffers) {
+		for (const FrameBuffer::Plane &plane : buffer->planes()) {
+			auto iter = allocations_.find(inode(plane.fd));
+			if (iter == allocations_.end())
+				continue;
+
+			pool_.emplace(iter->second, plane.fd);
+			allocations_.erase(iter);
+		}
+	}
+
+	buffers->clear();
+
+	LOG(DmaBufferAllocator, Debug) << pool_.size() << " buffers in pool";
+}
+
+/**
+ * \brief Free all the memory in the pool
+ *
+ * Buffers that are still in use when the pool is cleared are not affected,
+ * but will not be recycled anymore.
+ */
+void DmaBufferAllocator::clear()
+{
+	pool_.clear();
+	allocations_.clear();
+}
+
+/**
+ * \fn DmaBufferAllocator::pooled()
+ * \brief Retrieve the number of dmabufs in the pool
+ * \return The number of dmabufs available for reuse
+ */
+
+FileDescriptor DmaBufferAllocator::get(size_t size)
+{
+	const size_t pageSize = sysconf(_SC_PAGESIZE);
+	size = (size + pageSize - 1) / pageSize * pageSize;
+
+	FileDescriptor fd;
+	size_t allocSize;
+
+	auto iter = pool_.lower_bound(size);
+	if (iter != pool_.end() && iter->first <= size * 2) {
+		allocSize = iter->first;
+		fd = std::move(iter->second);
+		pool_.erase(iter);
+	} else {
+		allocSize = size;
+		fd = heap_.alloc("libcamera-frame", allocSize);
+		if (!fd.isValid())
+			return fd;
+	}
+
+	allocations_[inode(fd)] = allocSize;
+
+	return fd;
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,254 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Raspberry Pi (Trading) Limited
+ *
+ * dma_heaps.cpp - Helper class for dma-heap allocations.
+ */
+
+#include "libcamera/internal/dma_heaps.h"
+
+#include <array>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+
+#include "libcamera/internal/log.h"
+
+/**
+ * \file dma_heaps.h
+ * \brief dma-heap memory allocator
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(DmaHeap)
+
+namespace {
+
+struct DmaHeapInfo {
+	DmaHeap::Type type;
+	const char *name;
+};
+
+/*
+ * /dev/dma_heap/linux,cma is the CMA dma-heap allocator, which allows dmaheap-cma
+ * to only have to worry about importing.
+ *
+ * Annoyingly, should the cma heap size be specified on the kernel command line
+ * instead of DT, the heap gets named "reserved" instead.
+ *
+ * The heaps are listed in order of preference. Contiguous memory can be
+ * imported by any device, while the system heap requires the device to be
+ * behind an IOMMU or to use vmalloc-based buffers. Memfd memory has no device
+ * node and can't be imported by devices, it is the last resort.
+ */
+static constexpr std::array<DmaHeapInfo, 4> heapInfos = { {
+	{ DmaHeap::Contiguous, "/dev/dma_heap/linux,cma" },
+	{ DmaHeap::Contiguous, "/dev/dma_heap/reserved" },
+	{ DmaHeap::System, "/dev/dma_heap/system" },
+	{ DmaHeap::Memfd, nullptr },
+} };
+
+} /* namespace */
+
+/**
+ * \class DmaHeap
+ * \brief Allocate memory from the kernel dma-heap allocators
+ *
+ * The DmaHeap class wraps a kernel dma-heap device, and allocates dmabuf
+ * memory from it. The memory can then be imported by V4L2 video devices, or
+ * shared with other processes.
+ *
+ * The dma-heap providers available on a system vary. The DmaHeap class picks
+ * the first available heap among the types requested at construction time,
+ * preferring physically contiguous memory over system memory.
+ *
+ * Buffers that are only accessed by the CPU, such as the intermediate buffers
+ * of software processing, can instead be allocated from anonymous shared
+ * memory with the Memfd type. The memory is backed by hugepages when possible,
+ * which reduces the TLB misses caused by processing large frames.
+ */
+
+/**
+ * \enum DmaHeap::Type
+ * \brief Type of dma-heap
+ * \var DmaHeap::Contiguous
+ * \brief Physically contiguous memory allocated from a CMA heap
+ * \var DmaHeap::System
+ * \brief Physically scattered memory allocated from the system heap
+ * \var DmaHeap::Memfd
+ * \brief Memory allocated with memfd_create(), only accessible by the CPU
+ *
+ * Memfd memory is backed by explicit hugepages when the system has reserved
+ * enough of them, and by shared memory otherwise. In the latter case, the
+ * kernel may still use transparent hugepages when the shmem_enabled setting
+ * allows it, as MappedFrameBuffer advises the kernel to do so.
+ */
+
+/**
+ * \brief Open a dma-heap device
+ * \param[in] types The heap types that may be used, as a bitmask of Type values
+ *
+ * The first available heap whose type is included in \a types is opened.
+ * Contiguous heaps are preferred over the system heap, and memfd memory is only
+ * used when no dma-heap is available. Whether a heap has been
+ * successfully opened can be checked with isValid().
+ */
+DmaHeap::DmaHeap(unsigned int types)
+	: dmaHeapHandle_(-1), type_(Contiguous)
+{
+	for (const DmaHeapInfo &info : heapInfos) {
+		if (!(types & info.type))
+			continue;
+
+		if (info.type == Memfd) {
+			LOG(DmaHeap, Debug) << "Using memfd";
+			type_ = Memfd;
+			break;
+		}
+
+		int ret = ::open(info.name, O_RDWR | O_CLOEXEC, 0);
+		if (ret < 0) {
+			ret = errno;
+			LOG(DmaHeap, Debug) << "Failed to open " << info.name << ": "
+					    << strerror(ret);
+			continue;
+		}
+
+		LOG(DmaHeap, Debug) << "Using " << info.name;
+
+		dmaHeapHandle_ = ret;
+		type_ = info.type;
+		break;
+	}
+
+	if (dmaHeapHandle_ < 0)
+		LOG(DmaHeap, Debug) << "Could not open any dmaHeap device";
+}
+
+DmaHeap::~DmaHeap()
+{
+	if (dmaHeapHandle_ > -1)
+		::close(dmaHeapHandle_);
+}
+
+/**
+ * \fn DmaHeap::isValid()
+ * \brief Check if a dma-heap device has been opened
+ * \return True if a dma-heap device is available, false otherwise
+ */
+
+/**
+ * \fn DmaHeap::type()
+ * \brief Retrieve the type of the dma-heap in use
+ *
+ * The returned value is only meaningful if the heap is valid.
+ *
+ * \return The type of the dma-heap
+ */
+
+/**
+ * \brief Allocate a dmabuf from the heap
+ * \param[in] name The name to set for the dmabuf
+ * \param[in] size The size of the buffer in bytes
+ * \return A FileDescriptor for the allocated dmabuf, or an invalid
+ * FileDescriptor on error
+ */
+FileDescriptor DmaHeap::alloc(const char *name, std::size_t size)
+{
+	int ret;
+
+	if (!name || !isValid())
+		return FileDescriptor();
+
+	if (type_ == Memfd)
+		return allocMemfd(name, size);
+
+	struct dma_heap_allocation_data alloc = {};
+
+	alloc.len = size;
+	alloc.fd_flags = O_CLOEXEC | O_RDWR;
+
+	ret = ::ioctl(dmaHeapHandle_, DMA_HEAP_IOCTL_ALLOC, &alloc);
+	if (ret < 0) {
+		LOG(DmaHeap, Error) << "dmaHeap allocation failure for "
+				    << name;
+		return FileDescriptor();
+	}
+
+	ret = ::ioctl(alloc.fd, DMA_BUF_SET_NAME, name);
+	if (ret < 0) {
+		LOG(DmaHeap, Error) << "dmaHeap naming failure for "
+				    << name;
+		::close(alloc.fd);
+		return FileDescriptor();
+	}
+
+	return FileDescriptor(std::move(alloc.fd));
+}
+
+FileDescriptor DmaHeap::allocMemfd(const char *name, std::size_t size)
+{
+	int ret;
+
+	/*
+	 * Try explicit hugepages first. They have to be reserved by the system
+	 * administrator, allocate them upfront to avoid a SIGBUS at fault time
+	 * when the reserved pool is exhausted.
+	 */
+	int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING | MFD_HUGETLB);
+	if (fd >= 0) {
+		struct statfs fs;
+
+		ret = fstatfs(fd, &fs);
+		if (!ret) {
+			std::size_t hugeSize = fs.f_bsize;
+			std::size_t length = (size + hugeSize - 1) / hugeSize * hugeSize;
+
+			ret = ftruncate(fd, length);
+			if (!ret)
+				ret = fallocate(fd, 0, 0, length);
+		}
+
+		if (!ret) {
+			fcntl(fd, F_ADD_SEALS,
+			      F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+			LOG(DmaHeap, Debug)
+				<< "Allocated " << name << " from hugetlb pages";
+			return FileDescriptor(std::move(fd));
+		}
+
+		::close(fd);
+	}
+
+	fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		ret = errno;
+		LOG(DmaHeap, Error) << "memfd allocation failure for " << name
+				    << ": " << strerror(ret);
+		return FileDescriptor();
+	}
+
+	ret = ftruncate(fd, size);
+	if (ret < 0) {
+		ret = errno;
+		LOG(DmaHeap, Error) << "memfd allocation failure for " << name
+				    << ": " << strerror(ret);
+		::close(fd);
+		return FileDescriptor();
+	}
+
+	/* Prevent resizing, which would cause a SIGBUS on access. */
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+	return FileDescriptor(std::move(fd));
+}
+
+} /* namespace libcamera */
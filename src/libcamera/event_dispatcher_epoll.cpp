@@ -0,0 +1,331 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * event_dispatcher_epoll.cpp - Epoll-based event dispatcher
+ */
+
+#include "libcamera/internal/event_dispatcher_epoll.h"
+
+#include <chrono>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "libcamera/internal/event_notifier.h"
+#include "libcamera/internal/log.h"
+#include "libcamera/internal/thread.h"
+#include "libcamera/internal/timer.h"
+#include "libcamera/internal/utils.h"
+
+/**
+ * \file event_dispatcher_epoll.h
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Event)
+
+/* Maximum number of events retrieved from the kernel in one epoll_wait(). */
+static constexpr int MaxEvents = 32;
+
+static const char *notifierType(EventNotifier::Type type)
+{
+	if (type == EventNotifier::Read)
+		return "read";
+	if (type == EventNotifier::Write)
+		return "write";
+	if (type == EventNotifier::Exception)
+		return "exception";
+
+	return "";
+}
+
+/**
+ * \class EventDispatcherEpoll
+ * \brief An epoll-based event dispatcher
+ *
+ * The EventDispatcherEpoll registers file descriptors with the kernel once,
+ * when the first event notifier for a file descriptor is registered, and
+ * updates the registration only when the set of monitored events changes.
+ * Processing events is then proportional to the number of ready file
+ * descriptors, not to the number of registered notifiers.
+ *
+ * Unlike poll(), epoll doesn't support regular files. Event notifiers for file
+ * descriptors that can't be monitored with epoll are rejected with a warning.
+ * The EventDispatcherPoll can be selected through the
+ * LIBCAMERA_EVENT_DISPATCHER environment variable if this is an issue.
+ */
+
+EventDispatcherEpoll::EventDispatcherEpoll()
+{
+	/*
+	 * Create the epoll and event fds. Failures are fatal as we can't
+	 * implement an interruptible dispatcher without them.
+	 */
+	epollfd_ = epoll_create1(EPOLL_CLOEXEC);
+	if (epollfd_ < 0)
+		LOG(Event, Fatal) << "Unable to create epoll fd";
+
+	eventfd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (eventfd_ < 0)
+		LOG(Event, Fatal) << "Unable to create eventfd";
+
+	if (update(eventfd_, 0, EPOLLIN) < 0)
+		LOG(Event, Fatal) << "Unable to monitor eventfd";
+}
+
+EventDispatcherEpoll::~EventDispatcherEpoll()
+{
+	close(eventfd_);
+	close(epollfd_);
+}
+
+void EventDispatcherEpoll::registerEventNotifier(EventNotifier *notifier)
+{
+	EventNotifierSetEpoll &set = notifiers_[notifier->fd()];
+	EventNotifier::Type type = notifier->type();
+
+	if (set.notifiers[type] && set.notifiers[type] != notifier) {
+		LOG(Event, Warning)
+			<< "Ignoring duplicate " << notifierType(type)
+			<< " notifier for fd " << notifier->fd();
+		return;
+	}
+
+	uint32_t oldEvents = set.events();
+	set.notifiers[type] = notifier;
+
+	int ret = update(notifier->fd(), oldEvents, set.events());
+	if (ret < 0) {
+		LOG(Event, Warning)
+			<< "Unable to monitor fd " << notifier->fd()
+			<< " for " << notifierType(type) << " events: "
+			<< strerror(-ret);
+
+		set.notifiers[type] = nullptr;
+		if (!oldEvents)
+			notifiers_.erase(notifier->fd());
+	}
+}
+
+void EventDispatcherEpoll::unregisterEventNotifier(EventNotifier *notifier)
+{
+	auto iter = notifiers_.find(notifier->fd());
+	if (iter == notifiers_.end())
+		return;
+
+	EventNotifierSetEpoll &set = iter->second;
+	EventNotifier::Type type = notifier->type();
+
+	if (!set.notifiers[type])
+		return;
+
+	if (set.notifiers[type] != notifier) {
+		LOG(Event, Warning)
+			<< notifierType(type) << " notifier for fd "
+			<< notifier->fd() << " is not registered";
+		return;
+	}
+
+	uint32_t oldEvents = set.events();
+	set.notifiers[type] = nullptr;
+
+	/*
+	 * The file descriptor may already have been closed, in which case the
+	 * kernel has removed it from the epoll set already. Errors are thus
+	 * ignored.
+	 */
+	update(notifier->fd(), oldEvents, set.events());
+
+	/*
+	 * Event processing looks notifiers up for every event, the entry can
+	 * thus be erased right away, even when called from an event notifier.
+	 */
+	if (!set.events())
+		notifiers_.erase(iter);
+}
+
+void EventDispatcherEpoll::registerTimer(Timer *timer)
+{
+	timers_.insert(timer);
+}
+
+void EventDispatcherEpoll::unregisterTimer(Timer *timer)
+{
+	timers_.remove(timer);
+}
+
+void EventDispatcherEpoll::processEvents()
+{
+	struct epoll_event events[MaxEvents];
+	int ret;
+
+	Thread::current()->dispatchMessages();
+
+	/* Wait for events and process notifiers and timers. */
+	do {
+		ret = wait(events, MaxEvents);
+	} while (ret == -1 && errno == EINTR);
+
+	if (ret < 0) {
+		ret = -errno;
+		LOG(Event, Warning) << "epoll_wait() failed with " << strerror(-ret);
+	}
+
+	for (int i = 0; i < ret; ++i) {
+		if (events[i].data.fd == eventfd_)
+			processInterrupt();
+		else
+			processNotifier(events[i]);
+	}
+
+	processTimers();
+}
+
+void EventDispatcherEpoll::interrupt()
+{
+	uint64_t value = 1;
+	ssize_t ret = write(eventfd_, &value, sizeof(value));
+	if (ret != sizeof(value)) {
+		if (ret < 0)
+			ret = -errno;
+		LOG(Event, Error)
+			<< "Failed to interrupt event dispatcher ("
+			<< ret << ")";
+	}
+}
+
+uint32_t EventDispatcherEpoll::EventNotifierSetEpoll::events() const
+{
+	uint32_t events = 0;
+
+	if (notifiers[EventNotifier::Read])
+		events |= EPOLLIN;
+	if (notifiers[EventNotifier::Write])
+		events |= EPOLLOUT;
+	if (notifiers[EventNotifier::Exception])
+		events |= EPOLLPRI;
+
+	return events;
+}
+
+int EventDispatcherEpoll::wait(struct epoll_event *events, int maxEvents)
+{
+	/*
+	 * Compute the timeout. epoll_wait() has a millisecond resolution,
+	 * round the timeout up to avoid waking up before the next deadline.
+	 */
+	Timer *nextTimer = timers_.next();
+	int timeout = -1;
+
+	if (nextTimer) {
+		utils::time_point now = utils::clock::now();
+
+		if (nextTimer->deadline() > now) {
+			auto duration = nextTimer->deadline() - now;
+			auto msecs = std::chrono::ceil<std::chrono::milliseconds>(duration);
+			timeout = msecs.count();
+		} else {
+			timeout = 0;
+		}
+
+		LOG(Event, Debug) << "timeout " << timeout << "ms";
+	}
+
+	return epoll_wait(epollfd_, events, maxEvents, timeout);
+}
+
+int EventDispatcherEpoll::update(int fd, uint32_t oldEvents, uint32_t newEvents)
+{
+	struct epoll_event event = {};
+	int op;
+
+	if (oldEvents == newEvents)
+		return 0;
+
+	if (!oldEvents)
+		op = EPOLL_CTL_ADD;
+	else if (!newEvents)
+		op = EPOLL_CTL_DEL;
+	else
+		op = EPOLL_CTL_MOD;
+
+	event.events = newEvents;
+	event.data.fd = fd;
+
+	int ret = epoll_ctl(epollfd_, op, fd, &event);
+	if (ret < 0)
+		return -errno;
+
+	return 0;
+}
+
+void EventDispatcherEpoll::processInterrupt()
+{
+	uint64_t value;
+	ssize_t ret = read(eventfd_, &value, sizeof(value));
+	if (ret != sizeof(value)) {
+		if (ret < 0)
+			ret = -errno;
+		LOG(Event, Error)
+			<< "Failed to process interrupt (" << ret << ")";
+	}
+}
+
+void EventDispatcherEpoll::processNotifier(const struct epoll_event &event)
+{
+	static const struct {
+		EventNotifier::Type type;
+		uint32_t events;
+	} types[] = {
+		/*
+		 * Hang ups and errors are always reported by epoll, whether
+		 * requested or not. Report them to the notifiers that can
+		 * observe them, in order for the handlers to see the end of
+		 * file or the error when accessing the file descriptor, instead
+		 * of having epoll wake up repeatedly without any notifier being
+		 * activated.
+		 */
+		{ EventNotifier::Read, EPOLLIN | EPOLLHUP | EPOLLERR },
+		{ EventNotifier::Write, EPOLLOUT | EPOLLERR },
+		{ EventNotifier::Exception, EPOLLPRI | EPOLLHUP | EPOLLERR },
+	};
+
+	int fd = event.data.fd;
+
+	for (const auto &type : types) {
+		if (!(event.events & type.events))
+			continue;
+
+		/*
+		 * Look the notifier up for every event type, as the notifiers
+		 * may be unregistered by the handlers of the previous events.
+		 */
+		auto iter = notifiers_.find(fd);
+		if (iter == notifiers_.end())
+			return;
+
+		EventNotifier *notifier = iter->second.notifiers[type.type];
+		if (notifier)
+			notifier->activated.emit(notifier);
+	}
+}
+
+void EventDispatcherEpoll::processTimers()
+{
+	utils::time_point now = utils::clock::now();
+
+	while (Timer *timer = timers_.next()) {
+		if (timer->deadline() > now)
+			break;
+
+		timers_.pop();
+		timer->stop();
+		timer->timeout.emit(timer);
+	}
+}
+
+} /* namespace libcamera */
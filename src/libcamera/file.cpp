@@ -50,6 +50,12 @@ LOG_DEFINE_CATEGORY(File)
  * \var File::MapPrivate
  * \brief The memory region is mapped as private, changes are not reflected in
  * the file constents
+ * \var File::MapPopulate
+ * \brief The memory region is populated when mapped, reading the whole region
+ * from storage at once instead of faulting pages in one by one on access
+ * \var File::MapWillNeed
+ * \brief The kernel is advised that the memory region will be accessed soon,
+ * and starts reading it ahead asynchronously
  */
 
 /**
@@ -367,6 +373,14 @@ ssize_t File::write(const Span<const uint8_t> &data)
  * flags contains MapPrivate in which case the region is mapped in read/write
  * mode.
  *
+ * Accessing a mapped region faults pages in one by one, which is slow on
+ * storage with a high access latency. The MapPopulate flag reads the whole
+ * region when mapping it, and is best suited for regions that are accessed in
+ * full right away. The MapWillNeed flag starts reading the region in the
+ * background, and is best suited for regions that are only partly accessed,
+ * or that will be read again through other means, such as dlopen() for a
+ * shared object. Failure to apply MapWillNeed is not fatal.
+ *
  * The error() status is updated.
  *
  * \return The mapped memory on success, or an empty span otherwise
@@ -389,6 +403,8 @@ Span<uint8_t> File::map(off_t offset, ssize_t size, enum File::MapFlag flags)
 	}
 
 	int mmapFlags = flags & MapPrivate ? MAP_PRIVATE : MAP_SHARED;
+	if (flags & MapPopulate)
+		mmapFlags |= MAP_POPULATE;
 
 	int prot = 0;
 	if (mode_ & ReadOnly)
@@ -404,6 +420,9 @@ Span<uint8_t> File::map(off_t offset, ssize_t size, enum File::MapFlag flags)
 		return {};
 	}
 
+	if (flags & MapWillNeed)
+		madvise(map, size, MADV_WILLNEED);
+
 	maps_.emplace(map, size);
 
 	error_ = 0;
@@ -46,6 +46,12 @@ LOG_DEFINE_CATEGORY(FileDescriptor)
  *   original file descriptor once the function returns, and the value returned
  *   by fd() will be identical to the value passed to the constructor.
  *
+ * - The borrow() function references the numerical file descriptor without
+ *   duplicating it or taking ownership of it. The caller remains responsible
+ *   for closing the file descriptor, and shall keep it open as long as any
+ *   FileDescriptor instance references it. This avoids a dup() and close()
+ *   pair when wrapping a file descriptor for a short period of time.
+ *
  * The copy constructor and assignment operator create copies that share the
  * Descriptor, while the move versions of those methods additionally make the
  * other FileDescriptor invalid. When the last FileDescriptor that references a
@@ -75,7 +81,7 @@ FileDescriptor::FileDescriptor(const int &fd)
 	if (fd < 0)
 		return;
 
-	fd_ = std::make_shared<Descriptor>(fd, true);
+	fd_ = std::make_shared<Descriptor>(fd, Descriptor::Duplicate);
 	if (fd_->fd() < 0)
 		fd_.reset();
 }
@@ -99,7 +105,7 @@ FileDescriptor::FileDescriptor(int &&fd)
 	if (fd < 0)
 		return;
 
-	fd_ = std::make_shared<Descriptor>(fd, false);
+	fd_ = std::make_shared<Descriptor>(fd, Descriptor::Adopt);
 	/*
 	 * The Descriptor constructor can't have failed here, as it took over
 	 * the fd without duplicating it. Just set the original fd to -1 to
@@ -221,9 +227,36 @@ FileDescriptor FileDescriptor::dup() const
 	return FileDescriptor(fd());
 }
 
-FileDescriptor::Descriptor::Descriptor(int fd, bool duplicate)
+/**
+ * \brief Create a FileDescriptor referencing a given \a fd without owning it
+ * \param[in] fd File descriptor
+ *
+ * Construct a FileDescriptor that references the numerical file descriptor
+ * \a fd without duplicating it. The \a fd is not closed when the last
+ * FileDescriptor instance that references it is destroyed. The caller retains
+ * ownership of \a fd, and shall ensure that it stays open for the whole
+ * lifetime of the returned FileDescriptor and all its copies. A FileDescriptor
+ * that needs to outlive \a fd shall be duplicated with dup().
+ *
+ * If the \a fd is negative, the FileDescriptor is constructed as invalid and
+ * the fd() method will return -1.
+ *
+ * \return A FileDescriptor referencing \a fd
+ */
+FileDescriptor FileDescriptor::borrow(int fd)
+{
+	FileDescriptor descriptor;
+
+	if (fd >= 0)
+		descriptor.fd_ = std::make_shared<Descriptor>(fd, Descriptor::Borrow);
+
+	return descriptor;
+}
+
+FileDescriptor::Descriptor::Descriptor(int fd, Mode mode)
+	: owned_(mode != Borrow)
 {
-	if (!duplicate) {
+	if (mode != Duplicate) {
 		fd_ = fd;
 		return;
 	}
@@ -239,7 +272,7 @@ FileDescriptor::Descriptor::Descriptor(int fd, bool duplicate)
 
 FileDescriptor::Descriptor::~Descriptor()
 {
-	if (fd_ != -1)
+	if (fd_ != -1 && owned_)
 		close(fd_);
 }
 
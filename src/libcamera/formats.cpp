@@ -7,8 +7,8 @@
 
 #include "libcamera/internal/formats.h"
 
-#include <algorithm>
 #include <errno.h>
+#include <unordered_map>
 
 #include <libcamera/formats.h>
 
@@ -686,8 +686,58 @@ const std::map<PixelFormat, PixelFormatInfo> pixelFormatInfo{
 		.pixelsPerGroup = 1,
 		.planes = {{ { 1, 1 }, { 0, 0 }, { 0, 0 } }},
 	} },
+	{ formats::H264, {
+		.name = "H264",
+		.format = formats::H264,
+		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_H264),
+		.bitsPerPixel = 0,
+		.colourEncoding = PixelFormatInfo::ColourEncodingYUV,
+		.packed = false,
+		.pixelsPerGroup = 1,
+		.planes = {{ { 1, 1 }, { 0, 0 }, { 0, 0 } }},
+	} },
+	{ formats::HEVC, {
+		.name = "HEVC",
+		.format = formats::HEVC,
+		.v4l2Format = V4L2PixelFormat(V4L2_PIX_FMT_HEVC),
+		.bitsPerPixel = 0,
+		.colourEncoding = PixelFormatInfo::ColourEncodingYUV,
+		.packed = false,
+		.pixelsPerGroup = 1,
+		.planes = {{ { 1, 1 }, { 0, 0 }, { 0, 0 } }},
+	} },
 };
 
+/*
+ * Index the pixelFormatInfo table by V4L2 pixel format and by name, for
+ * constant-time lookups. The indexes are built on first use. When multiple
+ * entries share the same V4L2 pixel format, the first one in the table order
+ * is indexed.
+ */
+const std::unordered_map<uint32_t, const PixelFormatInfo *> &v4l2PixelFormatInfo()
+{
+	static const std::unordered_map<uint32_t, const PixelFormatInfo *> index = [] {
+		std::unordered_map<uint32_t, const PixelFormatInfo *> map;
+		for (const auto &[format, info] : pixelFormatInfo)
+			map.emplace(info.v4l2Format, &info);
+		return map;
+	}();
+
+	return index;
+}
+
+const std::unordered_map<std::string, const PixelFormatInfo *> &namedPixelFormatInfo()
+{
+	static const std::unordered_map<std::string, const PixelFormatInfo *> index = [] {
+		std::unordered_map<std::string, const PixelFormatInfo *> map;
+		for (const auto &[format, info] : pixelFormatInfo)
+			map.emplace(info.name, &info);
+		return map;
+	}();
+
+	return index;
+}
+
 } /* namespace */
 
 /**
@@ -723,14 +773,12 @@ const PixelFormatInfo &PixelFormatInfo::info(const PixelFormat &format)
  */
 const PixelFormatInfo &PixelFormatInfo::info(const V4L2PixelFormat &format)
 {
-	const auto &info = std::find_if(pixelFormatInfo.begin(), pixelFormatInfo.end(),
-					[format](auto pair) {
-						return pair.second.v4l2Format == format;
-					});
-	if (info == pixelFormatInfo.end())
+	const auto &index = v4l2PixelFormatInfo();
+	const auto iter = index.find(format);
+	if (iter == index.end())
 		return pixelFormatInfoInvalid;
 
-	return info->second;
+	return *iter->second;
 }
 
 /**
@@ -741,12 +789,12 @@ const PixelFormatInfo &PixelFormatInfo::info(const V4L2PixelFormat &format)
  */
 const PixelFormatInfo &PixelFormatInfo::info(const std::string &name)
 {
-	for (const auto &info : pixelFormatInfo) {
-		if (info.second.name == name)
-			return info.second;
-	}
+	const auto &index = namedPixelFormatInfo();
+	const auto iter = index.find(name);
+	if (iter == index.end())
+		return pixelFormatInfoInvalid;
 
-	return pixelFormatInfoInvalid;
+	return *iter->second;
 }
 
 /**
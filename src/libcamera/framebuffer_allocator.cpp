@@ -64,6 +64,9 @@ FrameBufferAllocator::FrameBufferAllocator(std::shared_ptr<Camera> camera)
 
 FrameBufferAllocator::~FrameBufferAllocator()
 {
+	for (auto &iter : buffers_)
+		camera_->releaseFrameBuffers(&iter.second);
+
 	buffers_.clear();
 }
 
@@ -106,7 +109,10 @@ int FrameBufferAllocator::allocate(Stream *stream)
  *
  * Free buffers allocated with allocate().
  *
- * This invalidates the buffers returned by buffers().
+ * This invalidates the buffers returned by buffers(). The memory of the buffers
+ * may be kept by the camera and reused for subsequent allocations until the
+ * camera is released, applications shall thus not access the memory of freed
+ * buffers, even through file descriptors they have duplicated.
  *
  * \return 0 on success or a negative error code otherwise
  * \retval -EACCES The camera is not in a state where buffers can be freed
@@ -119,7 +125,7 @@ int FrameBufferAllocator::free(Stream *stream)
 		return -EINVAL;
 
 	std::vector<std::unique_ptr<FrameBuffer>> &buffers = iter->second;
-	buffers.clear();
+	camera_->releaseFrameBuffers(&buffers);
 	buffers_.erase(iter);
 
 	return 0;
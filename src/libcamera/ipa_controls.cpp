@@ -71,6 +71,18 @@
  * data section, and after the data section. They shall be ignored when parsing
  * the packet.
  *
+ * ControlList packets are numbered per ControlInfoMap handle in the
+ * ipa_controls_header::sequence field, starting at 1 after the packets of the
+ * handle are reset. When the IPA_CONTROLS_FLAG_DELTA flag is set in the
+ * ipa_controls_header::flags field, the packet only stores the differences
+ * with the ControlList transmitted in the previous packet for the same handle,
+ * whose sequence number shall be one less than the delta packet's. Entries for
+ * controls that have been added or whose value has changed store the new
+ * value. Entries for controls that have been removed have their type set to
+ * ControlTypeNone, their count set to 0, and have no value data. Controls that
+ * have no entry keep the value from the previous ControlList. Entries in a
+ * delta packet shall be sorted by ascending numerical ID.
+ *
  * The following diagram describes the layout of the ControlInfoMap packet.
  *
  * ~~~~
@@ -134,6 +146,11 @@
  * \brief The current control serialization format version
  */
 
+/**
+ * \def IPA_CONTROLS_FLAG_DELTA
+ * \brief The ControlList packet stores differences with the previous packet
+ */
+
 /**
  * \struct ipa_controls_header
  * \brief Serialized control packet header
@@ -149,6 +166,12 @@
  * The total packet size in bytes
  * \var ipa_controls_header::data_offset
  * Offset in bytes from the beginning of the packet of the data section start
+ * \var ipa_controls_header::flags
+ * For ControlList packets, a bitmask of IPA_CONTROLS_FLAG_* flags. Shall be
+ * set to 0 for ControlInfoMap packets.
+ * \var ipa_controls_header::sequence
+ * For ControlList packets, the sequence number of the packet for its
+ * ControlInfoMap handle. Shall be set to 0 for ControlInfoMap packets.
  * \var ipa_controls_header::reserved
  * Reserved for future extensions
  */
@@ -82,6 +82,18 @@ namespace {
  * \return The POD read from \a vec at index \a pos
  */
 
+/**
+ * \fn template<typename T> bool isPackedType()
+ * \brief Tell if arrays of type \a T are serialized as packed elements
+ * \tparam T Type of the array elements
+ *
+ * Arrays of arithmetic types, with the exception of bool, are serialized as
+ * a contiguous block of elements. This allows deserializing them with a single
+ * copy.
+ *
+ * \return True if arrays of \a T are serialized as packed elements
+ */
+
 } /* namespace */
 
 /**
@@ -312,29 +324,32 @@ IPADataSerializer<ControlList>::serialize(const ControlList &data, ControlSerial
 		LOG(IPADataSerializer, Fatal)
 			<< "ControlSerializer not provided for serialization of ControlList";
 
-	size_t size;
-	std::vector<uint8_t> infoData;
+	/*
+	 * Serialize directly in the output vector, in a single pass. The sizes
+	 * are filled once the data has been serialized.
+	 */
+	std::vector<uint8_t> dataVec;
+	ByteStreamBuffer buffer(&dataVec);
+	uint32_t infoDataSize = 0;
 	int ret;
 
+	buffer.skip(8);
+
 	/*
 	 * \todo Revisit this opportunistic serialization of the
 	 * ControlInfoMap, as it could be fragile
 	 */
 	if (data.infoMap() && !cs->isCached(*data.infoMap())) {
-		size = cs->binarySize(*data.infoMap());
-		infoData.resize(size);
-		ByteStreamBuffer buffer(infoData.data(), infoData.size());
 		ret = cs->serialize(*data.infoMap(), buffer);
 
 		if (ret < 0 || buffer.overflow()) {
 			LOG(IPADataSerializer, Error) << "Failed to serialize ControlList's ControlInfoMap";
 			return { {}, {} };
 		}
+
+		infoDataSize = buffer.offset() - 8;
 	}
 
-	size = cs->binarySize(data);
-	std::vector<uint8_t> listData(size);
-	ByteStreamBuffer buffer(listData.data(), listData.size());
 	ret = cs->serialize(data, buffer);
 
 	if (ret < 0 || buffer.overflow()) {
@@ -342,12 +357,9 @@ IPADataSerializer<ControlList>::serialize(const ControlList &data, ControlSerial
 		return { {}, {} };
 	}
 
-	std::vector<uint8_t> dataVec;
-	dataVec.reserve(8 + infoData.size() + listData.size());
-	appendPOD<uint32_t>(dataVec, infoData.size());
-	appendPOD<uint32_t>(dataVec, listData.size());
-	dataVec.insert(dataVec.end(), infoData.begin(), infoData.end());
-	dataVec.insert(dataVec.end(), listData.begin(), listData.end());
+	uint32_t listDataSize = buffer.offset() - 8 - infoDataSize;
+	memcpy(&dataVec[0], &infoDataSize, sizeof(infoDataSize));
+	memcpy(&dataVec[4], &listDataSize, sizeof(listDataSize));
 
 	return { dataVec, {} };
 }
@@ -437,9 +449,10 @@ IPADataSerializer<ControlInfoMap>::serialize(const ControlInfoMap &map,
 		LOG(IPADataSerializer, Fatal)
 			<< "ControlSerializer not provided for serialization of ControlInfoMap";
 
-	size_t size = cs->binarySize(map);
-	std::vector<uint8_t> infoData(size);
-	ByteStreamBuffer buffer(infoData.data(), infoData.size());
+	std::vector<uint8_t> dataVec;
+	ByteStreamBuffer buffer(&dataVec);
+
+	buffer.skip(4);
 	int ret = cs->serialize(map, buffer);
 
 	if (ret < 0 || buffer.overflow()) {
@@ -447,9 +460,8 @@ IPADataSerializer<ControlInfoMap>::serialize(const ControlInfoMap &map,
 		return { {}, {} };
 	}
 
-	std::vector<uint8_t> dataVec;
-	appendPOD<uint32_t>(dataVec, infoData.size());
-	dataVec.insert(dataVec.end(), infoData.begin(), infoData.end());
+	uint32_t infoDataSize = buffer.offset() - 4;
+	memcpy(&dataVec[0], &infoDataSize, sizeof(infoDataSize));
 
 	return { dataVec, {} };
 }
@@ -518,6 +530,10 @@ IPADataSerializer<ControlInfoMap>::deserialize(std::vector<uint8_t>::const_itera
  * also allows us to simply send the entire fd vector into the deserializer
  * and it will be recursively consumed as necessary.
  *
+ * The fds received through IPC are owned by the receiver. The deserialized
+ * FileDescriptor takes them over instead of duplicating them, which would
+ * cost a dup() and leak the received fd for every plane of every buffer.
+ *
  * \todo Consider serializing the FileDescriptor in 4 bytes to ensure
  * 32-bit alignment of all serialized data
  */
@@ -547,7 +563,11 @@ FileDescriptor IPADataSerializer<FileDescriptor>::deserialize(std::vector<uint8_
 
 	ASSERT(!(valid && std::distance(fdsBegin, fdsEnd) < 1));
 
-	return valid ? FileDescriptor(*fdsBegin) : FileDescriptor();
+	if (!valid)
+		return FileDescriptor();
+
+	int fd = *fdsBegin;
+	return FileDescriptor(std::move(fd));
 }
 
 template<>
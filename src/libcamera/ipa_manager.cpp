@@ -10,11 +10,13 @@
 #include <algorithm>
 #include <dirent.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
 #include "libcamera/internal/file.h"
 #include "libcamera/internal/ipa_module.h"
 #include "libcamera/internal/ipa_proxy.h"
+#include "libcamera/internal/ipc_pipe_ring.h"
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/pipeline_handler.h"
 #include "libcamera/internal/utils.h"
@@ -91,6 +93,19 @@ LOG_DEFINE_CATEGORY(IPAManager)
  * In all cases the data passed to the IPAInterface methods is serialized to
  * Plain Old Data, either for the purpose of passing it to the IPA context
  * plain C API, or to transmit the data to the isolated process through IPC.
+ *
+ * IPA modules are discovered lazily. The module search path is only scanned
+ * when the first IPA is created, and modules are then loaded one by one until
+ * one matches the pipeline handler. Modules that are never needed are thus
+ * not parsed. Similarly, the result of the signature verification of a module
+ * is cached, and only verified again if the module file or its signature has
+ * changed.
+ *
+ * Starting the proxy worker of an isolated IPA module, and loading the module
+ * in the worker process, is costly. To hide that latency, the manager keeps a
+ * spare worker for every isolated module in use. The spare is started as soon
+ * as a worker is handed to a proxy, and thus has the IPA module loaded by the
+ * time the next proxy for the same module is created.
  */
 
 IPAManager *IPAManager::self_ = nullptr;
@@ -102,56 +117,19 @@ IPAManager *IPAManager::self_ = nullptr;
  * CameraManager.
  */
 IPAManager::IPAManager()
+	: discovered_(false), filesLoaded_(0)
 {
 	if (self_)
 		LOG(IPAManager, Fatal)
 			<< "Multiple IPAManager objects are not allowed";
 
-	unsigned int ipaCount = 0;
-
-	/* User-specified paths take precedence. */
-	const char *modulePaths = utils::secure_getenv("LIBCAMERA_IPA_MODULE_PATH");
-	if (modulePaths) {
-		for (const auto &dir : utils::split(modulePaths, ":")) {
-			if (dir.empty())
-				continue;
-
-			ipaCount += addDir(dir.c_str());
-		}
-
-		if (!ipaCount)
-			LOG(IPAManager, Warning)
-				<< "No IPA found in '" << modulePaths << "'";
-	}
-
-	/*
-	 * When libcamera is used before it is installed, load IPAs from the
-	 * same build directory as the libcamera library itself.
-	 */
-	std::string root = utils::libcameraBuildPath();
-	if (!root.empty()) {
-		std::string ipaBuildPath = root + "src/ipa";
-		constexpr int maxDepth = 1;
-
-		LOG(IPAManager, Info)
-			<< "libcamera is not installed. Adding '"
-			<< ipaBuildPath << "' to the IPA search path";
-
-		ipaCount += addDir(ipaBuildPath.c_str(), maxDepth);
-	}
-
-	/* Finally try to load IPAs from the installed system path. */
-	ipaCount += addDir(IPA_MODULE_DIR);
-
-	if (!ipaCount)
-		LOG(IPAManager, Warning)
-			<< "No IPA found in '" IPA_MODULE_DIR "'";
-
 	self_ = this;
 }
 
 IPAManager::~IPAManager()
 {
+	workers_.clear();
+
 	for (IPAModule *module : modules_)
 		delete module;
 
@@ -206,17 +184,17 @@ void IPAManager::parseDir(const char *libDir, unsigned int maxDepth,
 }
 
 /**
- * \brief Load IPA modules from a directory
+ * \brief Add the IPA module candidates from a directory
  * \param[in] libDir The directory to search for IPA modules
  * \param[in] maxDepth The maximum depth of sub-directories to search
  *
- * This method tries to create an IPAModule instance for every shared object
- * found in \a libDir, and skips invalid IPA modules.
+ * This method adds every shared object found in \a libDir to the list of IPA
+ * module candidates. The candidates are loaded on demand by module().
  *
  * Sub-directories are searched up to a depth of \a maxDepth. A \a maxDepth
  * value of 0 only searches the directory specified in \a libDir.
  *
- * \return Number of modules loaded by this call
+ * \return Number of candidates added by this call
  */
 unsigned int IPAManager::addDir(const char *libDir, unsigned int maxDepth)
 {
@@ -227,8 +205,88 @@ unsigned int IPAManager::addDir(const char *libDir, unsigned int maxDepth)
 	/* Ensure a stable ordering of modules. */
 	std::sort(files.begin(), files.end());
 
-	unsigned int count = 0;
-	for (const std::string &file : files) {
+	files_.insert(files_.end(), files.begin(), files.end());
+
+	return files.size();
+}
+
+/**
+ * \brief Scan the IPA module search path
+ *
+ * Build the list of IPA module candidates from the search path, in priority
+ * order. This is performed once, the first time an IPA module is needed.
+ */
+void IPAManager::discover()
+{
+	unsigned int ipaCount = 0;
+
+	discovered_ = true;
+
+	/* User-specified paths take precedence. */
+	const char *modulePaths = utils::secure_getenv("LIBCAMERA_IPA_MODULE_PATH");
+	if (modulePaths) {
+		for (const auto &dir : utils::split(modulePaths, ":")) {
+			if (dir.empty())
+				continue;
+
+			ipaCount += addDir(dir.c_str());
+		}
+
+		if (!ipaCount)
+			LOG(IPAManager, Warning)
+				<< "No IPA found in '" << modulePaths << "'";
+	}
+
+	/*
+	 * When libcamera is used before it is installed, load IPAs from the
+	 * same build directory as the libcamera library itself.
+	 */
+	std::string root = utils::libcameraBuildPath();
+	if (!root.empty()) {
+		std::string ipaBuildPath = root + "src/ipa";
+		constexpr int maxDepth = 1;
+
+		LOG(IPAManager, Info)
+			<< "libcamera is not installed. Adding '"
+			<< ipaBuildPath << "' to the IPA search path";
+
+		ipaCount += addDir(ipaBuildPath.c_str(), maxDepth);
+	}
+
+	/* Finally try to load IPAs from the installed system path. */
+	ipaCount += addDir(IPA_MODULE_DIR);
+
+	if (!ipaCount)
+		LOG(IPAManager, Warning)
+			<< "No IPA found in '" IPA_MODULE_DIR "'";
+}
+
+/**
+ * \brief Retrieve the first IPA module that matches a pipeline handler
+ * \param[in] pipe The pipeline handler
+ * \param[in] minVersion Minimum acceptable version of IPA module
+ * \param[in] maxVersion Maximum acceptable version of IPA module
+ *
+ * Modules already loaded are searched first. If none of them match, the
+ * remaining candidates are loaded in priority order until a matching module
+ * is found, leaving the next candidates untouched.
+ *
+ * \return The matching IPA module, or nullptr if no module matches
+ */
+IPAModule *IPAManager::module(PipelineHandler *pipe, uint32_t minVersion,
+			      uint32_t maxVersion)
+{
+	if (!discovered_)
+		discover();
+
+	for (IPAModule *module : modules_) {
+		if (module->match(pipe, minVersion, maxVersion))
+			return module;
+	}
+
+	while (filesLoaded_ < files_.size()) {
+		const std::string &file = files_[filesLoaded_++];
+
 		IPAModule *ipaModule = new IPAModule(file);
 		if (!ipaModule->isValid()) {
 			delete ipaModule;
@@ -238,10 +296,12 @@ unsigned int IPAManager::addDir(const char *libDir, unsigned int maxDepth)
 		LOG(IPAManager, Debug) << "Loaded IPA module '" << file << "'";
 
 		modules_.push_back(ipaModule);
-		count++;
+
+		if (ipaModule->match(pipe, minVersion, maxVersion))
+			return ipaModule;
 	}
 
-	return count;
+	return nullptr;
 }
 
 /**
@@ -255,23 +315,80 @@ unsigned int IPAManager::addDir(const char *libDir, unsigned int maxDepth)
  * found or if the IPA proxy fails to initialize
  */
 
-bool IPAManager::isSignatureValid([[maybe_unused]] IPAModule *ipa) const
+/**
+ * \brief Create an IPC pipe to a proxy worker for an isolated IPA module
+ * \param[in] ipam The IPA module
+ * \param[in] workerPath The path to the proxy worker executable
+ *
+ * This function hands the spare proxy worker for \a ipam to the caller if one
+ * has been started, or starts a new worker otherwise. It then starts a new
+ * spare worker for the next call for the same module.
+ *
+ * Callers shall check that the returned pipe is connected before using it.
+ *
+ * \return The IPC pipe to the proxy worker
+ */
+std::unique_ptr<IPCPipeRing> IPAManager::createWorker(const IPAModule *ipam,
+						      const std::string &workerPath)
+{
+	std::unique_ptr<IPCPipeRing> &spare =
+		self_->workers_[{ ipam->path(), workerPath }];
+
+	std::unique_ptr<IPCPipeRing> worker = std::move(spare);
+	if (!worker || !worker->isConnected()) {
+		worker = std::make_unique<IPCPipeRing>(ipam->path().c_str(),
+						       workerPath.c_str());
+		if (!worker->isConnected())
+			return worker;
+	}
+
+	spare = std::make_unique<IPCPipeRing>(ipam->path().c_str(),
+					      workerPath.c_str());
+
+	return worker;
+}
+
+bool IPAManager::isSignatureValid([[maybe_unused]] IPAModule *ipa)
 {
 #if HAVE_IPA_PUBKEY
+	struct stat st;
+	if (stat(ipa->path().c_str(), &st))
+		return false;
+
+	/*
+	 * Skip the verification if the module file and its signature haven't
+	 * changed since the last time they were verified.
+	 */
+	const std::vector<uint8_t> signature = ipa->signature();
+	auto iter = verifiedModules_.find(ipa->path());
+	if (iter != verifiedModules_.end()) {
+		const VerifiedModule &verified = iter->second;
+
+		if (verified.dev == st.st_dev && verified.ino == st.st_ino &&
+		    verified.size == st.st_size &&
+		    verified.mtime.tv_sec == st.st_mtim.tv_sec &&
+		    verified.mtime.tv_nsec == st.st_mtim.tv_nsec &&
+		    verified.signature == signature)
+			return verified.valid;
+	}
+
 	File file{ ipa->path() };
 	if (!file.open(File::ReadOnly))
 		return false;
 
-	Span<uint8_t> data = file.map();
+	Span<uint8_t> data = file.map(0, -1, File::MapPopulate);
 	if (data.empty())
 		return false;
 
-	bool valid = pubKey_.verify(data, ipa->signature());
+	bool valid = pubKey_.verify(data, signature);
 
 	LOG(IPAManager, Debug)
 		<< "IPA module " << ipa->path() << " signature is "
 		<< (valid ? "valid" : "not valid");
 
+	verifiedModules_[ipa->path()] = { st.st_dev, st.st_ino, st.st_size,
+					  st.st_mtim, signature, valid };
+
 	return valid;
 #else
 	return false;
@@ -281,7 +281,11 @@ int IPAModule::loadIPAModuleInfo()
 		return file.error();
 	}
 
-	Span<const uint8_t> data = file.map();
+	/*
+	 * Only the ELF headers and symbol table are accessed here, but the
+	 * whole module is read by dlopen() when loading it. Read it ahead.
+	 */
+	Span<const uint8_t> data = file.map(0, -1, File::MapWillNeed);
 	int ret = elfVerifyIdent(data);
 	if (ret) {
 		LOG(IPAModule, Error) << "IPA module is not an ELF file";
@@ -237,4 +237,12 @@ std::string IPAProxy::resolvePath(const std::string &file) const
  * while still enabling events to complete when the IPAProxy is stopping.
  */
 
+/**
+ * \var IPAProxy::ipam_
+ * \brief The IPA module
+ *
+ * Proxies of isolated IPAs use the module to start a new proxy worker when the
+ * previous one terminates unexpectedly.
+ */
+
 } /* namespace libcamera */
@@ -86,6 +86,24 @@ IPCMessage::IPCMessage(const IPCUnixSocket::Payload &payload)
 	fds_ = payload.fds;
 }
 
+/**
+ * \brief Construct an IPCMessage instance by consuming an IPC payload
+ * \param[in] payload The IPCUnixSocket payload to construct from
+ *
+ * This function behaves as the IPCMessage(const IPCUnixSocket::Payload &)
+ * constructor, but takes over the data and file descriptors storage of the
+ * \a payload instead of copying them. The header is removed from the data in
+ * place, without any memory allocation. The \a payload is left empty.
+ */
+IPCMessage::IPCMessage(IPCUnixSocket::Payload &&payload)
+{
+	memcpy(&header_, payload.data.data(), sizeof(header_));
+	payload.data.erase(payload.data.begin(),
+			   payload.data.begin() + sizeof(header_));
+	data_ = std::move(payload.data);
+	fds_ = std::move(payload.fds);
+}
+
 /**
  * \brief Create an IPCUnixSocket payload from the IPCMessage
  *
@@ -203,6 +221,16 @@ IPCPipe::~IPCPipe()
  * connect to this to receive messages.
  */
 
+/**
+ * \var IPCPipe::disconnected
+ * \brief Signal emitted when the IPCPipe instance loses its connection
+ *
+ * Implementations shall emit this signal when the peer terminates, for
+ * instance when the process hosting an isolated IPA crashes. The pipe is not
+ * connected anymore when the signal is emitted, and all pending and subsequent
+ * calls fail with -ENOTCONN.
+ */
+
 /**
  * \var IPCPipe::connected_
  * \brief Flag to indicate if the IPCPipe instance is connected
@@ -0,0 +1,237 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipc_pipe_process.cpp - Image Processing Algorithm IPC module for proxy workers
+ */
+
+#include "libcamera/internal/ipc_pipe_process.h"
+
+#include <errno.h>
+#include <string.h>
+#include <vector>
+
+#include "libcamera/internal/event_dispatcher.h"
+#include "libcamera/internal/ipc_pipe.h"
+#include "libcamera/internal/ipc_ring.h"
+#include "libcamera/internal/ipc_unixsocket.h"
+#include "libcamera/internal/log.h"
+#include "libcamera/internal/performance.h"
+#include "libcamera/internal/process.h"
+#include "libcamera/internal/thread.h"
+#include "libcamera/internal/timer.h"
+#include "libcamera/internal/utils.h"
+
+/**
+ * \file ipc_pipe_process.h
+ * \brief IPC message pipe to a proxy worker process
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(IPCPipe)
+
+/**
+ * \class IPCPipeProcess
+ * \brief IPC message pipe to a proxy worker process
+ * \tparam Transport The IPC transport, either IPCUnixSocket or IPCRing
+ *
+ * The IPCPipeProcess implements the parts of the IPC pipes that are common to
+ * all transports. It starts the IPA proxy worker process, matches the replies
+ * to synchronous calls, and forwards the other messages through the
+ * IPCPipe::recv signal.
+ *
+ * Derived classes create the transport, store it in \a transport_, and call
+ * start() with the file descriptors of the remote side of the transport.
+ */
+
+template<typename Transport>
+IPCPipeProcess<Transport>::IPCPipeProcess()
+	: IPCPipe()
+{
+}
+
+template<typename Transport>
+IPCPipeProcess<Transport>::~IPCPipeProcess()
+{
+}
+
+/**
+ * \brief Start the proxy worker process
+ * \param[in] ipaModulePath Path to the IPA module shared object
+ * \param[in] ipaProxyWorkerPath Path to the IPA proxy worker executable
+ * \param[in] fds The file descriptors of the remote side of the transport
+ *
+ * The proxy worker is started with the path to the IPA module followed by the
+ * file descriptors \a fds as arguments. The pipe is connected on success.
+ */
+template<typename Transport>
+void IPCPipeProcess<Transport>::start(const char *ipaModulePath,
+				      const char *ipaProxyWorkerPath,
+				      const std::vector<int> &fds)
+{
+	std::vector<std::string> args;
+	args.push_back(ipaModulePath);
+
+	transport_->readyRead.connect(this, &IPCPipeProcess::readyRead);
+
+	for (int fd : fds)
+		args.push_back(std::to_string(fd));
+
+	proc_ = std::make_unique<Process>();
+	int ret = proc_->start(ipaProxyWorkerPath, args, fds);
+	if (ret) {
+		LOG(IPCPipe, Error)
+			<< "Failed to start proxy worker process";
+		return;
+	}
+	proc_->finished.connect(this, &IPCPipeProcess::processFinished);
+
+	connected_ = true;
+}
+
+/**
+ * \brief Mark the pipe as disconnected
+ *
+ * The IPCPipe::disconnected signal is emitted the first time the pipe gets
+ * disconnected only.
+ */
+template<typename Transport>
+void IPCPipeProcess<Transport>::disconnect()
+{
+	if (!connected_)
+		return;
+
+	connected_ = false;
+	disconnected.emit();
+}
+
+template<typename Transport>
+int IPCPipeProcess<Transport>::sendSync(const IPCMessage &in, IPCMessage *out)
+{
+	if (!connected_)
+		return -ENOTCONN;
+
+	Payload response;
+
+	int ret = call(in.payload(), &response, in.header().cookie);
+	if (ret) {
+		LOG(IPCPipe, Error) << "Failed to call sync";
+		return ret;
+	}
+
+	if (out)
+		*out = IPCMessage(std::move(response));
+
+	return 0;
+}
+
+template<typename Transport>
+int IPCPipeProcess<Transport>::sendAsync(const IPCMessage &data)
+{
+	if (!connected_)
+		return -ENOTCONN;
+
+	int ret = transport_->send(data.payload());
+	if (ret) {
+		LOG(IPCPipe, Error) << "Failed to call async";
+		return ret;
+	}
+
+	return 0;
+}
+
+template<typename Transport>
+void IPCPipeProcess<Transport>::processFinished([[maybe_unused]] Process *process,
+						enum Process::ExitStatus exitStatus,
+						int exitCode)
+{
+	if (exitStatus == Process::NormalExit)
+		LOG(IPCPipe, Error)
+			<< "Proxy worker exited with code " << exitCode;
+	else
+		LOG(IPCPipe, Error) << "Proxy worker crashed";
+
+	disconnect();
+}
+
+template<typename Transport>
+void IPCPipeProcess<Transport>::readyRead(Transport *transport)
+{
+	Payload payload;
+	int ret = transport->receive(&payload);
+	if (ret) {
+		LOG(IPCPipe, Error) << "Receive message failed" << ret;
+		return;
+	}
+
+	/* \todo Use span to avoid the double copy when callData is found. */
+	if (payload.data.size() < sizeof(IPCMessage::Header)) {
+		LOG(IPCPipe, Error) << "Not enough data received";
+		return;
+	}
+
+	IPCMessage::Header header;
+	memcpy(&header, payload.data.data(), sizeof(header));
+
+	auto callData = callData_.find(header.cookie);
+	if (callData != callData_.end()) {
+		*callData->second.response = std::move(payload);
+		callData->second.done = true;
+		return;
+	}
+
+	/* Received unexpected data, this means it's a call from the IPA. */
+	IPCMessage ipcMessage(std::move(payload));
+	recv.emit(ipcMessage);
+}
+
+template<typename Transport>
+int IPCPipeProcess<Transport>::call(const Payload &message, Payload *response,
+				    uint32_t cookie)
+{
+	Timer timeout;
+	int ret;
+
+	utils::time_point start = utils::clock::now();
+
+	const auto result = callData_.insert({ cookie, { response, false } });
+	const auto &iter = result.first;
+
+	ret = transport_->send(message);
+	if (ret) {
+		callData_.erase(iter);
+		return ret;
+	}
+
+	/* \todo Make this less dangerous, see IPCPipe::sendSync() */
+	timeout.start(2000);
+	while (!iter->second.done) {
+		/* Fail immediately if the worker dies instead of timing out. */
+		if (!connected_) {
+			callData_.erase(iter);
+			return -ENOTCONN;
+		}
+
+		if (!timeout.isRunning()) {
+			LOG_RATELIMITED(IPCPipe, Error) << "Call timeout!";
+			callData_.erase(iter);
+			return -ETIMEDOUT;
+		}
+
+		Thread::current()->eventDispatcher()->processEvents();
+	}
+
+	callData_.erase(iter);
+
+	PerformanceRecorder::instance()->ipcRoundTrip(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(
+			utils::clock::now() - start).count());
+
+	return 0;
+}
+
+template class IPCPipeProcess<IPCUnixSocket>;
+template class IPCPipeProcess<IPCRing>;
+
+} /* namespace libcamera */
@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipc_pipe_ring.cpp - Image Processing Algorithm IPC module using shared memory rings
+ */
+
+#include "libcamera/internal/ipc_pipe_ring.h"
+
+#include <vector>
+
+#include "libcamera/internal/ipc_ring.h"
+#include "libcamera/internal/log.h"
+
+/**
+ * \file ipc_pipe_ring.h
+ * \brief IPC message pipe using shared memory rings
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(IPCPipe)
+
+/**
+ * \class IPCPipeRing
+ * \brief IPC message pipe using shared memory rings
+ *
+ * The IPCPipeRing starts the IPA proxy worker process and communicates with it
+ * through an IPCRing. The proxy worker is started with the path to the IPA
+ * module followed by the four IPCRing file descriptors as arguments.
+ *
+ * Compared to the IPCPipeUnixSocket, message data is exchanged through shared
+ * memory, which lowers the cost of per-frame calls to isolated IPAs. The
+ * worker process is killed if it corrupts the shared memory.
+ */
+
+/**
+ * \brief Construct an IPCPipeRing and start the proxy worker
+ * \param[in] ipaModulePath Path to the IPA module shared object
+ * \param[in] ipaProxyWorkerPath Path to the IPA proxy worker executable
+ */
+IPCPipeRing::IPCPipeRing(const char *ipaModulePath,
+			 const char *ipaProxyWorkerPath)
+{
+	transport_ = std::make_unique<IPCRing>();
+	std::vector<int> fds = transport_->create();
+	if (fds.empty()) {
+		LOG(IPCPipe, Error) << "Failed to create shared memory ring";
+		return;
+	}
+	transport_->disconnected.connect(this, &IPCPipeRing::ringDisconnected);
+
+	start(ipaModulePath, ipaProxyWorkerPath, fds);
+}
+
+void IPCPipeRing::ringDisconnected([[maybe_unused]] IPCRing *ring)
+{
+	/* Don't let a worker that corrupted the ring run any longer. */
+	if (proc_)
+		proc_->kill();
+
+	disconnect();
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,676 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipc_ring.cpp - IPC mechanism based on shared memory rings
+ */
+
+#include "libcamera/internal/ipc_ring.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "libcamera/internal/event_notifier.h"
+#include "libcamera/internal/log.h"
+#include "libcamera/internal/utils.h"
+
+/**
+ * \file ipc_ring.h
+ * \brief IPC mechanism based on shared memory rings
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IPCRing)
+
+/*
+ * The ring control block is shared between the two processes. The head is
+ * only written by the producer and the tail by the consumer, both are free
+ * running counters and are stored in separate cache lines. Each side keeps a
+ * private copy of the index it writes, and validates the index written by the
+ * peer, as a crashing or compromised peer may write anything to the shared
+ * memory.
+ *
+ * The waiting flag is set by the producer when it waits for the consumer to
+ * free space in the ring, and requests the consumer to ring the producer's
+ * doorbell when it advances the tail.
+ */
+struct IPCRing::Control {
+	alignas(64) std::atomic<uint32_t> head;
+	alignas(64) std::atomic<uint32_t> tail;
+	alignas(64) std::atomic<uint32_t> waiting;
+};
+
+/*
+ * Messages are stored in the ring as records, made of a header followed by
+ * the message data and padded to a multiple of 8 bytes. Records never wrap
+ * around the end of the ring, a padding record fills the end of the ring when
+ * a record doesn't fit.
+ */
+struct IPCRing::Record {
+	enum Type : uint32_t {
+		Data,
+		Socket,
+		Padding,
+	};
+
+	uint32_t size;
+	Type type;
+};
+
+namespace {
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+	      "Shared memory rings require lock-free atomics");
+static_assert((IPCRing::RingSize & (IPCRing::RingSize - 1)) == 0,
+	      "The ring size must be a power of two");
+
+constexpr size_t RecordAlign = 8;
+
+/* Messages larger than this are transported through the Unix socket. */
+constexpr size_t MaxInlineSize = IPCRing::RingSize / 4;
+
+/* Maximum time to wait for the peer to free space in the transmit ring. */
+constexpr std::chrono::milliseconds SendTimeout{ 1000 };
+
+constexpr size_t alignRecord(size_t size)
+{
+	return (size + RecordAlign - 1) & ~(RecordAlign - 1);
+}
+
+void closeFds(const std::vector<int> &fds)
+{
+	for (int fd : fds) {
+		if (fd >= 0)
+			::close(fd);
+	}
+}
+
+} /* namespace */
+
+/**
+ * \class IPCRing
+ * \brief IPC mechanism based on shared memory rings
+ *
+ * The IPCRing provides the same bidirectional, message-based and ordered
+ * communication as the IPCUnixSocket, with an identical API, but transports
+ * message data through two single-producer single-consumer rings stored in a
+ * memfd shared between the two processes, one for each direction.
+ *
+ * Sending a message copies its data to the transmit ring and rings an eventfd
+ * doorbell to wake up the peer, which copies the data out of the ring when
+ * receiving the message. Compared to the IPCUnixSocket, this avoids the
+ * copies of the data to and from the kernel, and the per-message socket
+ * buffer allocations.
+ *
+ * File descriptors can't be transferred through shared memory. Messages that
+ * carry file descriptors, as well as messages too large to be stored in the
+ * ring, are sent through a Unix socket instead. A small record is then stored
+ * in the ring at the message position, to preserve ordering with the messages
+ * transported in the ring.
+ *
+ * Establishment of an IPC channel is asymmetrical, in the same way as for the
+ * IPCUnixSocket. The side that initiates communication creates the channel
+ * with create(), which returns the file descriptors for the remote side. They
+ * are passed to the remote process through an out-of-band communication
+ * method, and the remote side binds to the channel by passing them to bind().
+ *
+ * The peer process is not trusted. Record headers are copied out of the shared
+ * memory and validated before use, and the connection is dropped if the peer
+ * corrupts the ring, in which case the \ref disconnected signal is emitted.
+ *
+ * \context This class is \threadbound.
+ */
+
+/**
+ * \var IPCRing::RingSize
+ * \brief The size in bytes of each of the two rings
+ */
+
+IPCRing::IPCRing()
+	: memfd_(-1), mem_(MAP_FAILED), tx_(nullptr), txData_(nullptr),
+	  rx_(nullptr), rxData_(nullptr), txHead_(0), rxHead_(0), rxTail_(0),
+	  txDoorbell_(-1), rxDoorbell_(-1), notifier_(nullptr)
+{
+	socket_.readyRead.connect(this, &IPCRing::socketReadyRead);
+}
+
+IPCRing::~IPCRing()
+{
+	close();
+}
+
+/**
+ * \brief Create a new IPC channel
+ *
+ * This method creates a new IPC channel. The channel is immediately usable to
+ * send and receive messages.
+ *
+ * \return The file descriptors for the remote side of the channel, in the
+ * order expected by bind(), or an empty vector on error
+ */
+std::vector<int> IPCRing::create()
+{
+	if (isBound())
+		return {};
+
+	int socketFd = socket_.create();
+	if (socketFd < 0)
+		return {};
+
+	/*
+	 * The file descriptors are inherited by the remote process and must
+	 * thus not be created with the close-on-exec flag.
+	 */
+	int memfd = memfd_create("libcamera-ipc-ring", 0);
+	if (memfd < 0) {
+		int ret = -errno;
+		LOG(IPCRing, Error)
+			<< "Failed to create shared memory: " << strerror(-ret);
+		::close(socketFd);
+		close();
+		return {};
+	}
+
+	if (ftruncate(memfd, 2 * (sizeof(Control) + RingSize)) < 0) {
+		int ret = -errno;
+		LOG(IPCRing, Error)
+			<< "Failed to size shared memory: " << strerror(-ret);
+		::close(memfd);
+		::close(socketFd);
+		close();
+		return {};
+	}
+
+	txDoorbell_ = eventfd(0, EFD_NONBLOCK);
+	rxDoorbell_ = eventfd(0, EFD_NONBLOCK);
+	if (txDoorbell_ < 0 || rxDoorbell_ < 0) {
+		int ret = -errno;
+		LOG(IPCRing, Error)
+			<< "Failed to create doorbells: " << strerror(-ret);
+		::close(memfd);
+		::close(socketFd);
+		close();
+		return {};
+	}
+
+	if (map(memfd, 0) < 0) {
+		::close(socketFd);
+		close();
+		return {};
+	}
+
+	new (tx_) Control{};
+	new (rx_) Control{};
+	txHead_ = 0;
+	rxHead_ = 0;
+	rxTail_ = 0;
+
+	return { socketFd, memfd, txDoorbell_, rxDoorbell_ };
+}
+
+/**
+ * \brief Bind to an existing IPC channel
+ * \param[in] fds File descriptors
+ *
+ * This method binds the instance to an existing IPC channel identified by the
+ * file descriptors \a fds, obtained from the IPCRing::create() method. The
+ * instance takes ownership of the file descriptors, and closes them if an
+ * error occurs.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPCRing::bind(const std::vector<int> &fds)
+{
+	if (isBound() || fds.size() != 4) {
+		closeFds(fds);
+		return -EINVAL;
+	}
+
+	int ret = socket_.bind(fds[0]);
+	if (ret) {
+		closeFds(fds);
+		return ret;
+	}
+
+	rxDoorbell_ = fds[2];
+	txDoorbell_ = fds[3];
+
+	ret = map(fds[1], 1);
+	if (ret < 0) {
+		close();
+		return ret;
+	}
+
+	return 0;
+}
+
+int IPCRing::map(int memfd, unsigned int txIndex)
+{
+	size_t size = 2 * (sizeof(Control) + RingSize);
+
+	memfd_ = memfd;
+	mem_ = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd_, 0);
+	if (mem_ == MAP_FAILED) {
+		int ret = -errno;
+		LOG(IPCRing, Error)
+			<< "Failed to map shared memory: " << strerror(-ret);
+		return ret;
+	}
+
+	uint8_t *rings[2];
+	rings[0] = static_cast<uint8_t *>(mem_);
+	rings[1] = rings[0] + sizeof(Control) + RingSize;
+
+	tx_ = reinterpret_cast<Control *>(rings[txIndex]);
+	txData_ = rings[txIndex] + sizeof(Control);
+	rx_ = reinterpret_cast<Control *>(rings[txIndex ^ 1]);
+	rxData_ = rings[txIndex ^ 1] + sizeof(Control);
+
+	txHead_ = tx_->head.load(std::memory_order_relaxed);
+	rxTail_ = rx_->tail.load(std::memory_order_relaxed);
+	rxHead_ = rxTail_;
+
+	notifier_ = new EventNotifier(rxDoorbell_, EventNotifier::Read);
+	notifier_->activated.connect(this, &IPCRing::doorbellNotifier);
+
+	return 0;
+}
+
+/**
+ * \brief Close the IPC channel
+ *
+ * No communication is possible after close() has been called.
+ */
+void IPCRing::close()
+{
+	delete notifier_;
+	notifier_ = nullptr;
+
+	if (mem_ != MAP_FAILED) {
+		munmap(mem_, 2 * (sizeof(Control) + RingSize));
+		mem_ = MAP_FAILED;
+	}
+
+	tx_ = nullptr;
+	txData_ = nullptr;
+	rx_ = nullptr;
+	rxData_ = nullptr;
+
+	for (int *fd : { &memfd_, &txDoorbell_, &rxDoorbell_ }) {
+		if (*fd != -1)
+			::close(*fd);
+		*fd = -1;
+	}
+
+	socket_.close();
+	socketPayloads_.clear();
+}
+
+/**
+ * \brief Check if the IPC channel is bound
+ * \return True if the IPC channel is bound, false otherwise
+ */
+bool IPCRing::isBound() const
+{
+	return tx_ != nullptr;
+}
+
+/**
+ * \brief Send a message payload
+ * \param[in] payload Message payload to send
+ *
+ * This method queues the message payload for transmission to the other end of
+ * the IPC channel. It returns as soon as the message is stored in the transmit
+ * ring, before the message is delivered to the remote side.
+ *
+ * If the transmit ring is full, the method blocks until the remote side
+ * receives enough messages to free space in the ring, for up to one second.
+ *
+ * \return 0 on success, -ENOBUFS if the transmit ring is still full when the
+ * timeout expires, -ECONNRESET if the connection has been dropped because the
+ * peer corrupted the ring, or another negative error code otherwise
+ */
+int IPCRing::send(const Payload &payload)
+{
+	if (!isBound())
+		return -ENOTCONN;
+
+	if (payload.data.empty() && payload.fds.empty())
+		return -EINVAL;
+
+	bool inlined = payload.fds.empty() &&
+		       payload.data.size() <= MaxInlineSize;
+	size_t dataSize = inlined ? payload.data.size() : 0;
+	size_t size = alignRecord(sizeof(Record) + dataSize);
+
+	uint32_t head = txHead_;
+	size_t offset = head & (RingSize - 1);
+	size_t contiguous = RingSize - offset;
+	size_t padding = size > contiguous ? contiguous : 0;
+
+	int ret = waitForSpace(size + padding);
+	if (ret)
+		return ret;
+
+	if (!inlined) {
+		ret = socket_.send(payload);
+		if (ret)
+			return ret;
+	}
+
+	if (padding) {
+		Record *record = reinterpret_cast<Record *>(txData_ + offset);
+		record->size = 0;
+		record->type = Record::Padding;
+		offset = 0;
+	}
+
+	Record *record = reinterpret_cast<Record *>(txData_ + offset);
+	record->size = dataSize;
+	record->type = inlined ? Record::Data : Record::Socket;
+	memcpy(record + 1, payload.data.data(), dataSize);
+
+	txHead_ = head + padding + size;
+	tx_->head.store(txHead_, std::memory_order_release);
+
+	uint64_t value = 1;
+	if (::write(txDoorbell_, &value, sizeof(value)) < 0) {
+		ret = -errno;
+		LOG(IPCRing, Error)
+			<< "Failed to ring doorbell: " << strerror(-ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Wait until \a size bytes are available in the transmit ring, for up to
+ * SendTimeout. The waiting flag requests the consumer to ring our receive
+ * doorbell when it frees space. As the same doorbell signals the messages sent
+ * by the peer, a doorbell consumed while waiting is rung again before
+ * returning, for the event notifier to dispatch those messages.
+ *
+ * Return 0 on success, -ENOBUFS on timeout or -ECONNRESET if the connection
+ * has been dropped.
+ */
+int IPCRing::waitForSpace(size_t size)
+{
+	utils::time_point deadline = utils::clock::now() + SendTimeout;
+	bool doorbell = false;
+	int ret = 0;
+
+	while (true) {
+		/*
+		 * Pairs with the tail store and waiting flag load in
+		 * advanceTail(), to ensure the consumer either observes the
+		 * flag or we observe the new tail.
+		 */
+		uint32_t tail = tx_->tail.load(std::memory_order_seq_cst);
+
+		/* The tail may only move forward, and never past the head. */
+		if (txHead_ - tail > RingSize) {
+			drop("Invalid transmit ring tail");
+			return -ECONNRESET;
+		}
+
+		if (RingSize - (txHead_ - tail) >= size)
+			break;
+
+		if (!tx_->waiting.load(std::memory_order_relaxed)) {
+			/* Check the tail again after setting the flag. */
+			tx_->waiting.store(1, std::memory_order_seq_cst);
+			continue;
+		}
+
+		auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+			deadline - utils::clock::now());
+		if (timeout.count() <= 0) {
+			LOG(IPCRing, Error) << "Transmit ring full";
+			ret = -ENOBUFS;
+			break;
+		}
+
+		struct pollfd pfd = { rxDoorbell_, POLLIN, 0 };
+		if (::poll(&pfd, 1, timeout.count()) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			ret = -errno;
+			LOG(IPCRing, Error)
+				<< "Failed to wait for doorbell: " << strerror(-ret);
+			break;
+		}
+
+		uint64_t value;
+		if (pfd.revents & POLLIN &&
+		    ::read(rxDoorbell_, &value, sizeof(value)) > 0)
+			doorbell = true;
+	}
+
+	tx_->waiting.store(0, std::memory_order_relaxed);
+
+	if (doorbell) {
+		uint64_t value = 1;
+		if (::write(rxDoorbell_, &value, sizeof(value)) < 0)
+			LOG(IPCRing, Error)
+				<< "Failed to ring doorbell: " << strerror(errno);
+	}
+
+	return ret;
+}
+
+/**
+ * \brief Receive a message payload
+ * \param[out] payload Payload where to write the received message
+ *
+ * This method receives the message payload from the IPC channel and writes it
+ * to the \a payload. If no message payload is available, it returns
+ * immediately with -EAGAIN. The \ref readyRead signal shall be used to receive
+ * notification of message availability.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EAGAIN No message payload is available
+ * \retval -ECONNRESET The connection has been dropped because the peer
+ * corrupted the ring
+ * \retval -ENOTCONN The socket is not connected (neither create() nor bind()
+ * has been called)
+ */
+int IPCRing::receive(Payload *payload)
+{
+	if (!isBound())
+		return -ENOTCONN;
+
+	Record record;
+	int ret = peek(&record);
+	if (ret)
+		return ret;
+
+	if (record.type == Record::Socket) {
+		if (socketPayloads_.empty())
+			return -EAGAIN;
+
+		*payload = std::move(socketPayloads_.front());
+		socketPayloads_.pop_front();
+	} else {
+		/* The size has been validated by peek(), don't read it again. */
+		const uint8_t *data = rxData_ + (rxTail_ & (RingSize - 1)) + sizeof(Record);
+		payload->data.assign(data, data + record.size);
+		payload->fds.clear();
+	}
+
+	consume(record);
+
+	return 0;
+}
+
+/**
+ * \var IPCRing::readyRead
+ * \brief A Signal emitted when a message is ready to be read
+ */
+
+/**
+ * \var IPCRing::disconnected
+ * \brief A Signal emitted when the connection is dropped because the peer
+ * corrupted the ring
+ *
+ * The channel is closed when the signal is emitted.
+ */
+
+/*
+ * Copy the header of the next record to \a record, skipping padding. The
+ * header is validated against the ring occupancy and size, and the connection
+ * is dropped if it is invalid.
+ *
+ * Return 0 on success, -EAGAIN if the ring is empty or -ECONNRESET if the
+ * connection has been dropped.
+ */
+int IPCRing::peek(Record *record)
+{
+	while (true) {
+		uint32_t head = rx_->head.load(std::memory_order_acquire);
+		uint32_t used = head - rxTail_;
+
+		/* The head may only move forward, and never past the tail. */
+		if (used > RingSize || used < rxHead_ - rxTail_) {
+			drop("Invalid receive ring head");
+			return -ECONNRESET;
+		}
+
+		rxHead_ = head;
+
+		if (!used)
+			return -EAGAIN;
+
+		size_t offset = rxTail_ & (RingSize - 1);
+		size_t contiguous = RingSize - offset;
+
+		if (used < sizeof(Record)) {
+			drop("Truncated record header");
+			return -ECONNRESET;
+		}
+
+		memcpy(record, rxData_ + offset, sizeof(*record));
+
+		if (record->type == Record::Padding) {
+			if (contiguous > used) {
+				drop("Invalid padding record");
+				return -ECONNRESET;
+			}
+
+			advanceTail(contiguous);
+			continue;
+		}
+
+		if (record->type != Record::Data && record->type != Record::Socket) {
+			drop("Invalid record type");
+			return -ECONNRESET;
+		}
+
+		/* Records never wrap around the end of the ring. */
+		if (record->size > RingSize - sizeof(Record) ||
+		    alignRecord(sizeof(Record) + record->size) > std::min<size_t>(used, contiguous) ||
+		    (record->type == Record::Socket && record->size)) {
+			drop("Invalid record size");
+			return -ECONNRESET;
+		}
+
+		return 0;
+	}
+}
+
+void IPCRing::consume(const Record &record)
+{
+	advanceTail(alignRecord(sizeof(Record) + record.size));
+}
+
+/*
+ * Free \a size bytes in the receive ring, and wake up the peer if it waits for
+ * space to send a message.
+ */
+void IPCRing::advanceTail(size_t size)
+{
+	rxTail_ += size;
+	rx_->tail.store(rxTail_, std::memory_order_seq_cst);
+
+	if (!rx_->waiting.load(std::memory_order_seq_cst))
+		return;
+
+	uint64_t value = 1;
+	if (::write(txDoorbell_, &value, sizeof(value)) < 0)
+		LOG(IPCRing, Error)
+			<< "Failed to ring doorbell: " << strerror(errno);
+}
+
+/* Drop the connection when the peer has corrupted the shared memory. */
+void IPCRing::drop(const char *reason)
+{
+	LOG(IPCRing, Error) << reason << ", dropping connection";
+
+	close();
+	disconnected.emit(this);
+}
+
+/*
+ * Emit the readyRead signal for all messages available in the ring. Delivery
+ * stops when the next message is transported through the Unix socket and
+ * hasn't been received yet, and resumes when it arrives. Handlers may process
+ * events recursively, in which case the nested dispatch delivers the following
+ * messages.
+ */
+void IPCRing::dispatch()
+{
+	while (isBound()) {
+		Record record;
+		if (peek(&record))
+			break;
+
+		if (record.type == Record::Socket && socketPayloads_.empty())
+			break;
+
+		uint32_t tail = rxTail_;
+
+		readyRead.emit(this);
+
+		/* Stop if the handler didn't consume the message. */
+		if (!isBound() || rxTail_ == tail)
+			break;
+	}
+}
+
+void IPCRing::doorbellNotifier([[maybe_unused]] EventNotifier *notifier)
+{
+	uint64_t value;
+	if (::read(rxDoorbell_, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+		int ret = -errno;
+		LOG(IPCRing, Error)
+			<< "Failed to read doorbell: " << strerror(-ret);
+		return;
+	}
+
+	dispatch();
+}
+
+void IPCRing::socketReadyRead(IPCUnixSocket *socket)
+{
+	Payload payload;
+	int ret = socket->receive(&payload);
+	if (ret) {
+		LOG(IPCRing, Error) << "Failed to receive message: " << ret;
+		return;
+	}
+
+	socketPayloads_.push_back(std::move(payload));
+
+	dispatch();
+}
+
+} /* namespace libcamera */
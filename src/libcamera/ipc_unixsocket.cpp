@@ -7,7 +7,7 @@
 
 #include "libcamera/internal/ipc_unixsocket.h"
 
-#include <poll.h>
+#include <limits>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -40,6 +40,10 @@ LOG_DEFINE_CATEGORY(IPCUnixSocket)
 /**
  * \var IPCUnixSocket::Payload::fds
  * \brief Array of file descriptors to cross IPC boundary
+ *
+ * The file descriptors of a sent payload are not affected by the transfer. The
+ * file descriptors of a received payload are new file descriptors owned by the
+ * receiver, which is responsible for closing them.
  */
 
 /**
@@ -52,7 +56,9 @@ LOG_DEFINE_CATEGORY(IPCUnixSocket)
  *
  * The IPC design is asynchronous, a message is queued to a receiver which gets
  * notified that a message is ready to be consumed by the \ref readyRead
- * signal. The sender of the message gets no notification when a message is
+ * signal. Each message is transported in a single datagram, and all messages
+ * pending on the socket are read when the receiver is woken up, the
+ * \ref readyRead signal is then emitted once per message. The sender of the message gets no notification when a message is
  * delivered nor processed. If such interactions are needed a protocol specific
  * to the users use-case should be implemented on top of the IPC objects.
  *
@@ -68,7 +74,7 @@ LOG_DEFINE_CATEGORY(IPCUnixSocket)
  */
 
 IPCUnixSocket::IPCUnixSocket()
-	: fd_(-1), headerReceived_(false), notifier_(nullptr)
+	: fd_(-1), notifier_(nullptr)
 {
 }
 
@@ -146,7 +152,7 @@ void IPCUnixSocket::close()
 	::close(fd_);
 
 	fd_ = -1;
-	headerReceived_ = false;
+	payloads_.clear();
 }
 
 /**
@@ -170,8 +176,6 @@ bool IPCUnixSocket::isBound() const
  */
 int IPCUnixSocket::send(const Payload &payload)
 {
-	int ret;
-
 	if (!isBound())
 		return -ENOTCONN;
 
@@ -182,28 +186,20 @@ int IPCUnixSocket::send(const Payload &payload)
 	if (!hdr.data && !hdr.fds)
 		return -EINVAL;
 
-	ret = ::send(fd_, &hdr, sizeof(hdr), 0);
-	if (ret < 0) {
-		ret = -errno;
-		LOG(IPCUnixSocket, Error)
-			<< "Failed to send: " << strerror(-ret);
-		return ret;
-	}
+	if (payload.fds.size() > std::numeric_limits<decltype(hdr.fds)>::max())
+		return -EINVAL;
 
-	return sendData(payload.data.data(), hdr.data, payload.fds.data(), hdr.fds);
+	return sendData(hdr, payload.data.data(), payload.fds.data());
 }
 
 /**
  * \brief Receive a message payload
  * \param[out] payload Payload where to write the received message
  *
- * This method receives the message payload from the IPC channel and writes it
- * to the \a payload. If no message payload is available, it returns
- * immediately with -EAGAIN. The \ref readyRead signal shall be used to receive
- * notification of message availability.
- *
- * \todo Add state machine to make sure we don't block forever and that
- * a header is always followed by a payload.
+ * This method retrieves the oldest message payload received from the IPC
+ * channel and writes it to the \a payload. If no message payload is available,
+ * it returns immediately with -EAGAIN. The \ref readyRead signal shall be used
+ * to receive notification of message availability.
  *
  * \return 0 on success or a negative error code otherwise
  * \retval -EAGAIN No message payload is available
@@ -215,19 +211,11 @@ int IPCUnixSocket::receive(Payload *payload)
 	if (!isBound())
 		return -ENOTCONN;
 
-	if (!headerReceived_)
+	if (payloads_.empty())
 		return -EAGAIN;
 
-	payload->data.resize(header_.data);
-	payload->fds.resize(header_.fds);
-
-	int ret = recvData(payload->data.data(), header_.data,
-			   payload->fds.data(), header_.fds);
-	if (ret < 0)
-		return ret;
-
-	headerReceived_ = false;
-	notifier_->setEnabled(true);
+	*payload = std::move(payloads_.front());
+	payloads_.pop_front();
 
 	return 0;
 }
@@ -237,18 +225,21 @@ int IPCUnixSocket::receive(Payload *payload)
  * \brief A Signal emitted when a message is ready to be read
  */
 
-int IPCUnixSocket::sendData(const void *buffer, size_t length,
-			    const int32_t *fds, unsigned int num)
+int IPCUnixSocket::sendData(const Header &header, const void *buffer,
+			    const int32_t *fds)
 {
-	struct iovec iov[1];
-	iov[0].iov_base = const_cast<void *>(buffer);
-	iov[0].iov_len = length;
-
-	char buf[CMSG_SPACE(num * sizeof(uint32_t))];
+	/* Send the header and the data in a single datagram. */
+	struct iovec iov[2];
+	iov[0].iov_base = const_cast<Header *>(&header);
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = const_cast<void *>(buffer);
+	iov[1].iov_len = header.data;
+
+	char buf[CMSG_SPACE(header.fds * sizeof(uint32_t))];
 	memset(buf, 0, sizeof(buf));
 
 	struct cmsghdr *cmsg = (struct cmsghdr *)buf;
-	cmsg->cmsg_len = CMSG_LEN(num * sizeof(uint32_t));
+	cmsg->cmsg_len = CMSG_LEN(header.fds * sizeof(uint32_t));
 	cmsg->cmsg_level = SOL_SOCKET;
 	cmsg->cmsg_type = SCM_RIGHTS;
 
@@ -256,11 +247,11 @@ int IPCUnixSocket::sendData(const void *buffer, size_t length,
 	msg.msg_name = nullptr;
 	msg.msg_namelen = 0;
 	msg.msg_iov = iov;
-	msg.msg_iovlen = 1;
-	msg.msg_control = cmsg;
-	msg.msg_controllen = cmsg->cmsg_len;
+	msg.msg_iovlen = 2;
+	msg.msg_control = header.fds ? cmsg : nullptr;
+	msg.msg_controllen = header.fds ? cmsg->cmsg_len : 0;
 	msg.msg_flags = 0;
-	memcpy(CMSG_DATA(cmsg), fds, num * sizeof(uint32_t));
+	memcpy(CMSG_DATA(cmsg), fds, header.fds * sizeof(uint32_t));
 
 	if (sendmsg(fd_, &msg, 0) < 0) {
 		int ret = -errno;
@@ -272,75 +263,102 @@ int IPCUnixSocket::sendData(const void *buffer, size_t length,
 	return 0;
 }
 
-int IPCUnixSocket::recvData(void *buffer, size_t length,
-			    int32_t *fds, unsigned int num)
+int IPCUnixSocket::recvData(Payload *payload)
 {
-	struct iovec iov[1];
-	iov[0].iov_base = buffer;
-	iov[0].iov_len = length;
+	/* Retrieve the size of the next datagram without dequeuing it. */
+	ssize_t size = ::recv(fd_, nullptr, 0, MSG_PEEK | MSG_TRUNC);
+	if (size < 0) {
+		int ret = -errno;
+		if (ret != -EAGAIN)
+			LOG(IPCUnixSocket, Error)
+				<< "Failed to receive: " << strerror(-ret);
+		return ret;
+	}
 
-	char buf[CMSG_SPACE(num * sizeof(uint32_t))];
-	memset(buf, 0, sizeof(buf));
+	Header header = {};
+	size_t length = static_cast<size_t>(size) > sizeof(header)
+		      ? size - sizeof(header) : 0;
 
-	struct cmsghdr *cmsg = (struct cmsghdr *)buf;
-	cmsg->cmsg_len = CMSG_LEN(num * sizeof(uint32_t));
-	cmsg->cmsg_level = SOL_SOCKET;
-	cmsg->cmsg_type = SCM_RIGHTS;
+	payload->data.resize(length);
+
+	struct iovec iov[2];
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = payload->data.data();
+	iov[1].iov_len = length;
+
+	constexpr size_t maxFds = std::numeric_limits<decltype(header.fds)>::max();
+	char buf[CMSG_SPACE(maxFds * sizeof(uint32_t))];
+	memset(buf, 0, sizeof(buf));
 
 	struct msghdr msg;
 	msg.msg_name = nullptr;
 	msg.msg_namelen = 0;
 	msg.msg_iov = iov;
-	msg.msg_iovlen = 1;
-	msg.msg_control = cmsg;
-	msg.msg_controllen = cmsg->cmsg_len;
+	msg.msg_iovlen = 2;
+	msg.msg_control = buf;
+	msg.msg_controllen = sizeof(buf);
 	msg.msg_flags = 0;
 
-	if (recvmsg(fd_, &msg, 0) < 0) {
+	ssize_t received = recvmsg(fd_, &msg, 0);
+	if (received < 0) {
 		int ret = -errno;
-		if (ret != -EAGAIN)
-			LOG(IPCUnixSocket, Error)
-				<< "Failed to recvmsg: " << strerror(-ret);
+		LOG(IPCUnixSocket, Error)
+			<< "Failed to recvmsg: " << strerror(-ret);
 		return ret;
 	}
 
-	memcpy(fds, CMSG_DATA(cmsg), num * sizeof(uint32_t));
+	/* Messages are never empty, a zero size means the peer is gone. */
+	if (!received)
+		return -ECONNRESET;
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	unsigned int num = 0;
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+	    cmsg->cmsg_type == SCM_RIGHTS)
+		num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(uint32_t);
+
+	payload->fds.resize(num);
+	if (num)
+		memcpy(payload->fds.data(), CMSG_DATA(cmsg), num * sizeof(uint32_t));
+
+	if (static_cast<size_t>(size) < sizeof(header) ||
+	    header.data != length || header.fds != num) {
+		LOG(IPCUnixSocket, Error) << "Received malformed message";
+		for (int32_t fd : payload->fds)
+			::close(fd);
+		return -EBADMSG;
+	}
 
 	return 0;
 }
 
 void IPCUnixSocket::dataNotifier([[maybe_unused]] EventNotifier *notifier)
 {
-	int ret;
-
-	if (!headerReceived_) {
-		/* Receive the header. */
-		ret = ::recv(fd_, &header_, sizeof(header_), 0);
-		if (ret < 0) {
-			ret = -errno;
-			LOG(IPCUnixSocket, Error)
-				<< "Failed to receive header: " << strerror(-ret);
-			return;
-		}
-
-		headerReceived_ = true;
-	}
-
 	/*
-	 * If the payload has arrived, disable the notifier and emit the
-	 * readyRead signal. The notifier will be reenabled by the receive()
-	 * method.
+	 * Drain all pending messages, and emit the readyRead signal once per
+	 * message. Stop emitting if a receiver doesn't consume the message, it
+	 * will be retrieved by the next call to receive().
 	 */
-	struct pollfd fds = { fd_, POLLIN, 0 };
-	ret = poll(&fds, 1, 0);
-	if (ret < 0)
-		return;
+	while (true) {
+		Payload payload;
+		int ret = recvData(&payload);
+		if (ret == -EBADMSG)
+			continue;
+		if (ret < 0)
+			break;
+
+		payloads_.push_back(std::move(payload));
+	}
 
-	if (!(fds.revents & POLLIN))
-		return;
+	while (!payloads_.empty()) {
+		size_t count = payloads_.size();
 
-	notifier_->setEnabled(false);
-	readyRead.emit(this);
+		readyRead.emit(this);
+
+		if (payloads_.size() >= count)
+			break;
+	}
 }
 
 } /* namespace libcamera */
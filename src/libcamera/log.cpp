@@ -8,17 +8,25 @@
 #include "libcamera/internal/log.h"
 
 #include <array>
+#include <atomic>
+#include <condition_variable>
 #if HAVE_BACKTRACE
 #include <execinfo.h>
 #endif
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
 #include <list>
+#include <memory>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <syslog.h>
+#include <thread>
 #include <time.h>
+#include <unistd.h>
+#include <unordered_map>
 #include <unordered_set>
 
 #include <libcamera/logging.h>
@@ -52,7 +60,15 @@
  * file by setting the LIBCAMERA_LOG_FILE environment variable to the name of
  * the file. The file must be writable and is truncated if it exists. If any
  * error occurs when opening the file, the file is ignored and the log is output
- * to stderr.
+ * to stderr. If the variable value starts with "binary:", the remainder of the
+ * value is the name of a file to which messages are written in a compact binary
+ * format, see logSetBinaryFile().
+ *
+ * Log messages are written synchronously by default, from the thread that logs
+ * them. Setting the LIBCAMERA_LOG_ASYNC environment variable moves writing to a
+ * dedicated thread, see logSetAsync(). The variable selects the policy applied
+ * when the log can't keep up, and is one of "block" (LoggingDropNone), "drop"
+ * (LoggingDropNewest) or "drop-low" (LoggingDropBelowWarning).
  */
 
 /**
@@ -98,6 +114,342 @@ static const char *log_severity_name(LogSeverity severity)
 		return "UNKWN";
 }
 
+/**
+ * \brief Binary log file
+ *
+ * The LogBinaryFile class writes log messages to a memory-mapped file in a
+ * compact binary format. Messages are not formatted as text. Each message is
+ * stored as a record that references its category and its location in the
+ * source code (the log site) by numerical IDs, along with the raw timestamp,
+ * thread ID, severity and message text. Categories and sites are described
+ * once, by definition records emitted along with the first message that uses
+ * them. Messages logged concurrently from different threads may be written
+ * out of order, a message can thus precede the definitions it references.
+ *
+ * The file starts with a 8 bytes header:
+ *
+ * - 4 bytes: uint32_t magic number 0x4c43424c, in host byte order
+ * - 2 bytes: uint16_t format version (currently 1)
+ * - 2 bytes: reserved
+ *
+ * Each record starts with a 8 bytes header:
+ *
+ * - 4 bytes: uint32_t size of the record payload, in bytes
+ * - 2 bytes: uint16_t record type
+ * - 2 bytes: reserved
+ *
+ * The payload of a category record (type 1) is a uint32_t category ID followed
+ * by the category name. The payload of a site record (type 2) is a uint32_t
+ * site ID, a uint32_t line number and the file name. The payload of a message
+ * record (type 3) is:
+ *
+ * - 4 bytes: uint32_t category ID
+ * - 4 bytes: uint32_t site ID, 0 if the message has no site
+ * - 8 bytes: uint64_t timestamp, in nanoseconds
+ * - 4 bytes: uint32_t thread ID
+ * - 1 byte: uint8_t severity
+ * - 3 bytes: reserved
+ * - Remaining bytes: message text
+ *
+ * All integers are stored in host byte order, and strings are not
+ * nul-terminated. The file is extended in chunks as needed, and truncated to
+ * the size of the written records when closed. A record with a zero size and
+ * type marks the end of the log in files that have not been closed properly.
+ *
+ * The utils/decode-binary-log.py script converts binary log files to text.
+ */
+class LogBinaryFile
+{
+public:
+	LogBinaryFile(const char *path);
+	~LogBinaryFile();
+
+	bool isValid() const { return fd_ >= 0; }
+
+	std::string encode(const LogMessage &msg);
+	std::string encode(const std::string &str);
+	void write(const std::string &record);
+
+private:
+	static constexpr uint32_t Magic = 0x4c43424c;
+	static constexpr uint16_t Version = 1;
+	static constexpr size_t ChunkSize = 1024 * 1024;
+
+	enum RecordType : uint16_t {
+		RecordCategory = 1,
+		RecordSite = 2,
+		RecordMessage = 3,
+	};
+
+	struct Category {
+		const char *name;
+		uint32_t id;
+	};
+
+	struct SiteKey {
+		const char *fileName;
+		unsigned int line;
+
+		bool operator==(const SiteKey &other) const
+		{
+			return fileName == other.fileName && line == other.line;
+		}
+	};
+
+	struct SiteKeyHash {
+		size_t operator()(const SiteKey &key) const
+		{
+			return std::hash<const char *>()(key.fileName) ^ key.line;
+		}
+	};
+
+	template<typename T>
+	static void append(std::string &buffer, T value)
+	{
+		buffer.append(reinterpret_cast<const char *>(&value), sizeof(value));
+	}
+
+	static void appendHeader(std::string &buffer, RecordType type, size_t size);
+
+	uint32_t categoryId(const LogCategory &category, std::string &buffer);
+	uint32_t siteId(const char *fileName, unsigned int line, std::string &buffer);
+	static std::string encode(uint32_t category, uint32_t site,
+				  LogSeverity severity,
+				  const utils::time_point &timestamp,
+				  const std::string &text, std::string &&buffer);
+	bool reserve(size_t size);
+
+	Mutex mutex_;
+
+	std::unordered_map<const LogCategory *, Category> categories_;
+	std::unordered_map<SiteKey, uint32_t, SiteKeyHash> sites_;
+	uint32_t nextCategoryId_;
+
+	int fd_;
+	uint8_t *mem_;
+	off_t windowOffset_;
+	size_t windowSize_;
+	off_t offset_;
+};
+
+/**
+ * \brief Create a binary log file
+ * \param[in] path Full path to the log file
+ *
+ * The file is created if it doesn't exist, and truncated otherwise. Use
+ * isValid() to check if the file has been opened successfully.
+ */
+LogBinaryFile::LogBinaryFile(const char *path)
+	: nextCategoryId_(1), mem_(nullptr), windowOffset_(0), windowSize_(0),
+	  offset_(0)
+{
+	fd_ = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd_ < 0)
+		return;
+
+	std::string header;
+	append<uint32_t>(header, Magic);
+	append<uint16_t>(header, Version);
+	append<uint16_t>(header, 0);
+	write(header);
+
+	if (!mem_) {
+		::close(fd_);
+		fd_ = -1;
+	}
+}
+
+LogBinaryFile::~LogBinaryFile()
+{
+	if (fd_ < 0)
+		return;
+
+	if (mem_)
+		munmap(mem_, windowSize_);
+
+	/* Drop the unused part of the last chunk. */
+	if (ftruncate(fd_, offset_) < 0) {
+		/* Nothing can be done, the decoder handles the padding. */
+	}
+
+	::close(fd_);
+}
+
+void LogBinaryFile::appendHeader(std::string &buffer, RecordType type, size_t size)
+{
+	append<uint32_t>(buffer, size);
+	append<uint16_t>(buffer, type);
+	append<uint16_t>(buffer, 0);
+}
+
+/*
+ * Retrieve the ID of a category, and append a definition record to the buffer
+ * if the category hasn't been seen before. A category destroyed and replaced
+ * by another one at the same address is detected by its name pointer, and
+ * receives a new ID. IDs are thus allocated from a counter instead of being
+ * derived from the number of categories. The caller must hold mutex_.
+ */
+uint32_t LogBinaryFile::categoryId(const LogCategory &category, std::string &buffer)
+{
+	auto it = categories_.find(&category);
+	if (it != categories_.end() && it->second.name == category.name())
+		return it->second.id;
+
+	uint32_t id = nextCategoryId_++;
+	categories_[&category] = { category.name(), id };
+
+	size_t length = strlen(category.name());
+	appendHeader(buffer, RecordCategory, sizeof(uint32_t) + length);
+	append<uint32_t>(buffer, id);
+	buffer.append(category.name(), length);
+
+	return id;
+}
+
+/*
+ * Retrieve the ID of a log site, and append a definition record to the buffer
+ * if the site hasn't been seen before.
+ */
+uint32_t LogBinaryFile::siteId(const char *fileName, unsigned int line,
+			       std::string &buffer)
+{
+	SiteKey key{ fileName, line };
+
+	auto it = sites_.find(key);
+	if (it != sites_.end())
+		return it->second;
+
+	uint32_t id = sites_.size() + 1;
+	sites_[key] = id;
+
+	size_t length = strlen(fileName);
+	appendHeader(buffer, RecordSite, 2 * sizeof(uint32_t) + length);
+	append<uint32_t>(buffer, id);
+	append<uint32_t>(buffer, line);
+	buffer.append(fileName, length);
+
+	return id;
+}
+
+/**
+ * \brief Encode a log message
+ * \param[in] msg The message
+ *
+ * The records that define the message category and site are included in the
+ * returned data when they haven't been encoded previously. The returned
+ * records must thus be written to the file in the order they are encoded.
+ *
+ * \return The binary records for the message
+ */
+std::string LogBinaryFile::encode(const LogMessage &msg)
+{
+	std::string buffer;
+	uint32_t category;
+	uint32_t site;
+
+	{
+		MutexLocker locker(mutex_);
+		category = categoryId(msg.category(), buffer);
+		site = siteId(msg.fileName(), msg.line(), buffer);
+	}
+
+	std::string text = msg.msg();
+	if (!text.empty() && text.back() == '\n')
+		text.pop_back();
+
+	return encode(category, site, msg.severity(), msg.timestamp(), text,
+		      std::move(buffer));
+}
+
+/**
+ * \brief Encode a free-form string as a log message
+ * \param[in] str The string
+ *
+ * The string is encoded as a debug message in the default category, without
+ * a site.
+ *
+ * \return The binary records for the string
+ */
+std::string LogBinaryFile::encode(const std::string &str)
+{
+	std::string buffer;
+	uint32_t category;
+
+	{
+		MutexLocker locker(mutex_);
+		category = categoryId(LogCategory::defaultCategory(), buffer);
+	}
+
+	return encode(category, 0, LogDebug, utils::clock::now(), str,
+		      std::move(buffer));
+}
+
+std::string LogBinaryFile::encode(uint32_t category, uint32_t site,
+				  LogSeverity severity,
+				  const utils::time_point &timestamp,
+				  const std::string &text, std::string &&buffer)
+{
+	uint64_t nsecs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		timestamp.time_since_epoch()).count();
+
+	appendHeader(buffer, RecordMessage, 24 + text.size());
+	append<uint32_t>(buffer, category);
+	append<uint32_t>(buffer, site);
+	append<uint64_t>(buffer, nsecs);
+	append<uint32_t>(buffer, Thread::currentId());
+	append<uint8_t>(buffer, severity);
+	buffer.append(3, '\0');
+	buffer.append(text);
+
+	return std::move(buffer);
+}
+
+/**
+ * \brief Write encoded records to the file
+ * \param[in] record The records, as returned by encode()
+ */
+void LogBinaryFile::write(const std::string &record)
+{
+	MutexLocker locker(mutex_);
+
+	if (!reserve(record.size()))
+		return;
+
+	memcpy(mem_ + (offset_ - windowOffset_), record.data(), record.size());
+	offset_ += record.size();
+}
+
+/*
+ * Ensure that the mapped window has room for size bytes at the current offset,
+ * extending the file and moving the window if needed.
+ */
+bool LogBinaryFile::reserve(size_t size)
+{
+	if (mem_ && offset_ + size <= windowOffset_ + windowSize_)
+		return true;
+
+	if (mem_) {
+		munmap(mem_, windowSize_);
+		mem_ = nullptr;
+	}
+
+	off_t pageSize = sysconf(_SC_PAGESIZE);
+	windowOffset_ = offset_ / pageSize * pageSize;
+	windowSize_ = offset_ - windowOffset_ + size;
+	windowSize_ = (windowSize_ + ChunkSize - 1) / ChunkSize * ChunkSize;
+
+	if (ftruncate(fd_, windowOffset_ + windowSize_) < 0)
+		return false;
+
+	void *mem = mmap(nullptr, windowSize_, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, fd_, windowOffset_);
+	if (mem == MAP_FAILED)
+		return false;
+
+	mem_ = static_cast<uint8_t *>(mem);
+	return true;
+}
+
 /**
  * \brief Log output
  *
@@ -106,31 +458,38 @@ static const char *log_severity_name(LogSeverity severity)
 class LogOutput
 {
 public:
-	LogOutput(const char *path);
+	LogOutput(const char *path, LoggingTarget target = LoggingTargetFile);
 	LogOutput(std::ostream *stream);
 	LogOutput();
 	~LogOutput();
 
 	bool isValid() const;
+	std::string format(const LogMessage &msg) const;
 	void write(const LogMessage &msg);
 	void write(const std::string &msg);
+	void write(LogSeverity severity, const std::string &msg);
 
 private:
 	void writeSyslog(LogSeverity severity, const std::string &msg);
 	void writeStream(const std::string &msg);
 
 	std::ostream *stream_;
+	std::unique_ptr<LogBinaryFile> binary_;
 	LoggingTarget target_;
 };
 
 /**
  * \brief Construct a log output based on a file
  * \param[in] path Full path to log file
+ * \param[in] target Log file type, LoggingTargetFile or LoggingTargetBinaryFile
  */
-LogOutput::LogOutput(const char *path)
-	: target_(LoggingTargetFile)
+LogOutput::LogOutput(const char *path, LoggingTarget target)
+	: stream_(nullptr), target_(target)
 {
-	stream_ = new std::ofstream(path);
+	if (target_ == LoggingTargetBinaryFile)
+		binary_ = std::make_unique<LogBinaryFile>(path);
+	else
+		stream_ = new std::ofstream(path);
 }
 
 /**
@@ -174,6 +533,8 @@ bool LogOutput::isValid() const
 	switch (target_) {
 	case LoggingTargetFile:
 		return stream_->good();
+	case LoggingTargetBinaryFile:
+		return binary_->isValid();
 	case LoggingTargetStream:
 		return stream_ != nullptr;
 	default:
@@ -182,48 +543,75 @@ bool LogOutput::isValid() const
 }
 
 /**
- * \brief Write message to log output
- * \param[in] msg Message to write
+ * \brief Format a message for the log output
+ * \param[in] msg Message to format
+ *
+ * The message is formatted according to the log output target. The thread ID
+ * included in the stream and file formats is the ID of the calling thread,
+ * this function shall thus be called from the thread that logs the message.
+ *
+ * \return The formatted message
  */
-void LogOutput::write(const LogMessage &msg)
+std::string LogOutput::format(const LogMessage &msg) const
 {
-	std::string str;
-
 	switch (target_) {
 	case LoggingTargetSyslog:
-		str = std::string(log_severity_name(msg.severity())) + " "
-		    + msg.category().name() + " " + msg.fileInfo() + " "
-		    + msg.msg();
-		writeSyslog(msg.severity(), str);
-		break;
+		return std::string(log_severity_name(msg.severity())) + " "
+		     + msg.category().name() + " " + msg.fileInfo() + " "
+		     + msg.msg();
 	case LoggingTargetStream:
 	case LoggingTargetFile:
-		str = "[" + utils::time_point_to_string(msg.timestamp()) + "] ["
-		    + std::to_string(Thread::currentId()) + "] "
-		    + log_severity_name(msg.severity()) + " "
-		    + msg.category().name() + " " + msg.fileInfo() + " "
-		    + msg.msg();
-		writeStream(str);
-		break;
+		return "[" + utils::time_point_to_string(msg.timestamp()) + "] ["
+		     + std::to_string(Thread::currentId()) + "] "
+		     + log_severity_name(msg.severity()) + " "
+		     + msg.category().name() + " " + msg.fileInfo() + " "
+		     + msg.msg();
+	case LoggingTargetBinaryFile:
+		return binary_->encode(msg);
 	default:
-		break;
+		return {};
 	}
 }
 
+/**
+ * \brief Write message to log output
+ * \param[in] msg Message to write
+ */
+void LogOutput::write(const LogMessage &msg)
+{
+	write(msg.severity(), format(msg));
+}
+
 /**
  * \brief Write string to log output
  * \param[in] str String to write
  */
 void LogOutput::write(const std::string &str)
+{
+	if (target_ == LoggingTargetBinaryFile)
+		write(LogDebug, binary_->encode(str));
+	else
+		write(LogDebug, str);
+}
+
+/**
+ * \brief Write a formatted message to log output
+ * \param[in] severity Severity of the message
+ * \param[in] str Formatted message to write
+ */
+void LogOutput::write(LogSeverity severity, const std::string &str)
 {
 	switch (target_) {
 	case LoggingTargetSyslog:
-		writeSyslog(LogDebug, str);
+		writeSyslog(severity, str);
 		break;
 	case LoggingTargetStream:
 	case LoggingTargetFile:
 		writeStream(str);
 		break;
+	case LoggingTargetBinaryFile:
+		binary_->write(str);
+		break;
 	default:
 		break;
 	}
@@ -240,6 +628,281 @@ void LogOutput::writeStream(const std::string &str)
 	stream_->flush();
 }
 
+/**
+ * \brief Asynchronous log writer
+ *
+ * The AsyncLogWriter class moves writing log messages out of the threads that
+ * log them. Messages are formatted by the producer, and pushed to a bounded
+ * ring of records that a dedicated thread drains to the log output.
+ *
+ * Pushing a record is lock-free. Producers claim a record with a
+ * compare-and-swap on the ring head, and publish it by updating the record
+ * sequence number, in the fashion of Dmitry Vyukov's bounded MPMC queue. The
+ * writer thread is the only consumer. It sleeps on a condition variable when
+ * the ring is empty, and producers only take the mutex to wake it up when it
+ * is sleeping.
+ *
+ * When the ring is full, the drop policy selects whether the record is
+ * discarded or whether the producer waits for space to become available.
+ * Discarded records are counted.
+ */
+class AsyncLogWriter
+{
+public:
+	static constexpr size_t Capacity = 1024;
+
+	AsyncLogWriter();
+	~AsyncLogWriter();
+
+	void start(LoggingDropPolicy policy);
+	void stop();
+	bool isRunning() const { return running_.load(std::memory_order_relaxed); }
+
+	void write(const std::shared_ptr<LogOutput> &output,
+		   LogSeverity severity, std::string &&msg);
+	void flush();
+
+	uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+	static_assert((Capacity & (Capacity - 1)) == 0,
+		      "Capacity must be a power of two");
+
+	struct Record {
+		std::atomic<size_t> sequence;
+		std::shared_ptr<LogOutput> output;
+		LogSeverity severity;
+		std::string msg;
+	};
+
+	bool push(const std::shared_ptr<LogOutput> &output,
+		  LogSeverity severity, std::string &&msg);
+	bool empty() const;
+	void drain();
+	void run();
+
+	std::array<Record, Capacity> records_;
+
+	alignas(64) std::atomic<size_t> head_;
+	alignas(64) std::atomic<size_t> tail_;
+	std::atomic<uint64_t> dropped_;
+
+	std::atomic<bool> running_;
+	std::atomic<bool> waiting_;
+	std::atomic<LoggingDropPolicy> policy_;
+
+	Mutex mutex_;
+	std::condition_variable cv_;
+	bool stop_;
+
+	Mutex controlMutex_;
+	std::thread thread_;
+};
+
+AsyncLogWriter::AsyncLogWriter()
+	: head_(0), tail_(0), dropped_(0), running_(false), waiting_(false),
+	  policy_(LoggingDropNewest), stop_(false)
+{
+	for (size_t i = 0; i < Capacity; ++i)
+		records_[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+AsyncLogWriter::~AsyncLogWriter()
+{
+	stop();
+}
+
+/**
+ * \brief Start the writer thread
+ * \param[in] policy The policy applied when the ring is full
+ *
+ * If the writer is already running, only the drop policy is updated.
+ */
+void AsyncLogWriter::start(LoggingDropPolicy policy)
+{
+	MutexLocker locker(controlMutex_);
+
+	policy_ = policy;
+
+	if (running_)
+		return;
+
+	stop_ = false;
+	thread_ = std::thread(&AsyncLogWriter::run, this);
+	running_.store(true, std::memory_order_release);
+}
+
+/**
+ * \brief Stop the writer thread
+ *
+ * All records pushed to the ring before this function is called are written
+ * to the log output before it returns.
+ */
+void AsyncLogWriter::stop()
+{
+	MutexLocker controlLocker(controlMutex_);
+
+	if (!running_)
+		return;
+
+	running_.store(false, std::memory_order_release);
+
+	{
+		MutexLocker locker(mutex_);
+		stop_ = true;
+	}
+	cv_.notify_one();
+
+	thread_.join();
+
+	/* Write the records pushed while the thread was stopping. */
+	drain();
+}
+
+/**
+ * \brief Queue a formatted message for writing
+ * \param[in] output The log output to write the message to
+ * \param[in] severity The message severity
+ * \param[in] msg The formatted message
+ */
+void AsyncLogWriter::write(const std::shared_ptr<LogOutput> &output,
+			   LogSeverity severity, std::string &&msg)
+{
+	if (push(output, severity, std::move(msg)))
+		return;
+
+	LoggingDropPolicy policy = policy_.load(std::memory_order_relaxed);
+	if (policy == LoggingDropNewest ||
+	    (policy == LoggingDropBelowWarning && severity < LogWarning)) {
+		dropped_.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	/* Wait for the writer thread to free space in the ring. */
+	do {
+		if (!running_.load(std::memory_order_acquire)) {
+			output->write(severity, msg);
+			return;
+		}
+
+		std::this_thread::yield();
+	} while (!push(output, severity, std::move(msg)));
+}
+
+/**
+ * \brief Wait until all queued messages have been written
+ */
+void AsyncLogWriter::flush()
+{
+	size_t head = head_.load(std::memory_order_acquire);
+
+	while (tail_.load(std::memory_order_acquire) < head) {
+		if (!running_.load(std::memory_order_acquire)) {
+			MutexLocker locker(controlMutex_);
+			if (!running_)
+				drain();
+			return;
+		}
+
+		std::this_thread::yield();
+	}
+}
+
+bool AsyncLogWriter::push(const std::shared_ptr<LogOutput> &output,
+			  LogSeverity severity, std::string &&msg)
+{
+	size_t pos = head_.load(std::memory_order_relaxed);
+	Record *record;
+
+	while (true) {
+		record = &records_[pos & (Capacity - 1)];
+		size_t sequence = record->sequence.load(std::memory_order_acquire);
+		intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+		if (diff == 0) {
+			if (head_.compare_exchange_weak(pos, pos + 1,
+							std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = head_.load(std::memory_order_relaxed);
+		}
+	}
+
+	record->output = output;
+	record->severity = severity;
+	record->msg = std::move(msg);
+
+	/*
+	 * Publish the record and check if the writer thread sleeps. The
+	 * sequentially consistent operations pair with the ones in run() to
+	 * guarantee that either the writer sees the record, or the producer
+	 * sees the writer waiting.
+	 */
+	record->sequence.store(pos + 1, std::memory_order_seq_cst);
+
+	if (waiting_.load(std::memory_order_seq_cst)) {
+		{
+			MutexLocker locker(mutex_);
+		}
+		cv_.notify_one();
+	}
+
+	return true;
+}
+
+bool AsyncLogWriter::empty() const
+{
+	size_t tail = tail_.load(std::memory_order_relaxed);
+	const Record &record = records_[tail & (Capacity - 1)];
+
+	return record.sequence.load(std::memory_order_seq_cst) != tail + 1;
+}
+
+/*
+ * Write all published records to their log output. Only one thread at a time
+ * may drain the ring.
+ */
+void AsyncLogWriter::drain()
+{
+	size_t tail = tail_.load(std::memory_order_relaxed);
+
+	while (true) {
+		Record &record = records_[tail & (Capacity - 1)];
+		if (record.sequence.load(std::memory_order_acquire) != tail + 1)
+			break;
+
+		std::shared_ptr<LogOutput> output = std::move(record.output);
+		std::string msg = std::move(record.msg);
+		LogSeverity severity = record.severity;
+
+		record.sequence.store(tail + Capacity, std::memory_order_release);
+		tail_.store(++tail, std::memory_order_release);
+
+		output->write(severity, msg);
+	}
+}
+
+void AsyncLogWriter::run()
+{
+	MutexLocker locker(mutex_);
+
+	while (!stop_) {
+		locker.unlock();
+		drain();
+		locker.lock();
+
+		waiting_.store(true, std::memory_order_seq_cst);
+		if (!stop_ && empty())
+			cv_.wait(locker);
+		waiting_.store(false, std::memory_order_relaxed);
+	}
+
+	locker.unlock();
+	drain();
+}
+
 /**
  * \brief Message logger
  *
@@ -253,15 +916,18 @@ public:
 	void write(const LogMessage &msg);
 	void backtrace();
 
-	int logSetFile(const char *path);
+	int logSetFile(const char *path, LoggingTarget target);
 	int logSetStream(std::ostream *stream);
 	int logSetTarget(LoggingTarget target);
 	void logSetLevel(const char *category, const char *level);
+	int logSetAsync(bool enable, LoggingDropPolicy policy);
+	uint64_t logDroppedMessages() const;
 
 private:
 	Logger();
 
 	void parseLogFile();
+	void parseLogAsync();
 	void parseLogLevels();
 	static LogSeverity parseLogLevel(const std::string &level);
 
@@ -273,8 +939,22 @@ private:
 	std::list<std::pair<std::string, LogSeverity>> levels_;
 
 	std::shared_ptr<LogOutput> output_;
+	AsyncLogWriter asyncWriter_;
 };
 
+/**
+ * \enum LoggingDropPolicy
+ * \brief Policy for messages logged when the asynchronous log is full
+ * \var LoggingDropNone
+ * \brief Never drop messages, wait for space to become available
+ * \var LoggingDropNewest
+ * \brief Drop the message being logged
+ * \var LoggingDropBelowWarning
+ * \brief Drop the message being logged if its severity is lower than
+ * LogWarning, wait for space to become available otherwise
+ * \sa logSetAsync()
+ */
+
 /**
  * \enum LoggingTarget
  * \brief Log destination type
@@ -290,6 +970,9 @@ private:
  * \var LoggingTargetStream
  * \brief Log to stream
  * \sa Logger::logSetStream
+ * \var LoggingTargetBinaryFile
+ * \brief Log to file in binary format
+ * \sa Logger::logSetBinaryFile
  */
 
 /**
@@ -306,7 +989,30 @@ private:
  */
 int logSetFile(const char *path)
 {
-	return Logger::instance()->logSetFile(path);
+	return Logger::instance()->logSetFile(path, LoggingTargetFile);
+}
+
+/**
+ * \brief Direct logging to a binary file
+ * \param[in] path Full path to the log file
+ *
+ * This function directs the log output to the file identified by \a path, in
+ * a compact binary format. Messages are not formatted to text. The category,
+ * severity, timestamp, thread ID, source location and message text are instead
+ * stored in binary records, with categories and source locations referenced by
+ * numerical IDs. The file is memory-mapped, and messages are written without
+ * system calls in most cases. This significantly reduces the logging overhead.
+ *
+ * Binary log files can be converted to text with the
+ * utils/decode-binary-log.py script.
+ *
+ * If the function returns an error, the log target is not changed.
+ *
+ * \return Zero on success, or a negative error code otherwise
+ */
+int logSetBinaryFile(const char *path)
+{
+	return Logger::instance()->logSetFile(path, LoggingTargetBinaryFile);
 }
 
 /**
@@ -337,8 +1043,9 @@ int logSetStream(std::ostream *stream)
  * log target, if any, is closed, and all new log messages will be written to
  * the new log destination.
  *
- * LoggingTargetFile and LoggingTargetStream are not valid values for \a target.
- * Use logSetFile() and logSetStream() instead, respectively.
+ * LoggingTargetFile, LoggingTargetStream and LoggingTargetBinaryFile are not
+ * valid values for \a target. Use logSetFile(), logSetStream() and
+ * logSetBinaryFile() instead, respectively.
  *
  * If the function returns an error, the log file is not changed.
  *
@@ -369,6 +1076,48 @@ void logSetLevel(const char *category, const char *level)
 	Logger::instance()->logSetLevel(category, level);
 }
 
+/**
+ * \brief Enable or disable asynchronous logging
+ * \param[in] enable True to enable asynchronous logging, false to disable it
+ * \param[in] policy The policy applied when the log can't keep up
+ *
+ * By default, log messages are written to the log output by the thread that
+ * logs them. Writing to a file, a stream or syslog can block the logging
+ * thread for a long time, which disturbs the timing of time-sensitive threads
+ * such as the ones handling buffer completion.
+ *
+ * When asynchronous logging is enabled, messages are still formatted by the
+ * logging thread, but are then queued in a bounded lock-free ring, and written
+ * to the log output by a dedicated thread. If messages are logged faster than
+ * they can be written, the ring fills up, and the \a policy selects whether
+ * new messages are dropped or whether the logging thread waits. The number of
+ * dropped messages can be retrieved with logDroppedMessages().
+ *
+ * Fatal messages are always written synchronously, after all queued messages.
+ *
+ * Disabling asynchronous logging writes all queued messages before returning.
+ * Calling this function when asynchronous logging is already enabled only
+ * updates the \a policy.
+ *
+ * \return Zero on success, or a negative error code otherwise
+ */
+int logSetAsync(bool enable, LoggingDropPolicy policy)
+{
+	return Logger::instance()->logSetAsync(enable, policy);
+}
+
+/**
+ * \brief Retrieve the number of messages dropped by the asynchronous log
+ *
+ * \sa logSetAsync()
+ *
+ * \return The number of messages dropped since the logger was created
+ */
+uint64_t logDroppedMessages()
+{
+	return Logger::instance()->logDroppedMessages();
+}
+
 /**
  * \brief Retrieve the logger instance
  *
@@ -393,6 +1142,16 @@ void Logger::write(const LogMessage &msg)
 	if (!output)
 		return;
 
+	if (asyncWriter_.isRunning()) {
+		if (msg.severity() != LogFatal) {
+			asyncWriter_.write(output, msg.severity(), output->format(msg));
+			return;
+		}
+
+		/* Write fatal messages after all queued messages. */
+		asyncWriter_.flush();
+	}
+
 	output->write(msg);
 }
 
@@ -412,6 +1171,8 @@ void Logger::backtrace()
 	if (!strings)
 		return;
 
+	asyncWriter_.flush();
+
 	std::ostringstream msg;
 	msg << "Backtrace:" << std::endl;
 
@@ -431,14 +1192,15 @@ void Logger::backtrace()
 /**
  * \brief Set the log file
  * \param[in] path Full path to the log file
+ * \param[in] target Log file type, LoggingTargetFile or LoggingTargetBinaryFile
  *
- * \sa libcamera::logSetFile()
+ * \sa libcamera::logSetFile(), libcamera::logSetBinaryFile()
  *
  * \return Zero on success, or a negative error code otherwise.
  */
-int Logger::logSetFile(const char *path)
+int Logger::logSetFile(const char *path, LoggingTarget target)
 {
-	std::shared_ptr<LogOutput> output = std::make_shared<LogOutput>(path);
+	std::shared_ptr<LogOutput> output = std::make_shared<LogOutput>(path, target);
 	if (!output->isValid())
 		return -EINVAL;
 
@@ -510,12 +1272,53 @@ void Logger::logSetLevel(const char *category, const char *level)
 	}
 }
 
+/**
+ * \brief Enable or disable asynchronous logging
+ * \param[in] enable True to enable asynchronous logging, false to disable it
+ * \param[in] policy The policy applied when the log can't keep up
+ *
+ * \sa libcamera::logSetAsync()
+ *
+ * \return Zero on success, or a negative error code otherwise
+ */
+int Logger::logSetAsync(bool enable, LoggingDropPolicy policy)
+{
+	switch (policy) {
+	case LoggingDropNone:
+	case LoggingDropNewest:
+	case LoggingDropBelowWarning:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (enable)
+		asyncWriter_.start(policy);
+	else
+		asyncWriter_.stop();
+
+	return 0;
+}
+
+/**
+ * \brief Retrieve the number of messages dropped by the asynchronous log
+ *
+ * \sa libcamera::logDroppedMessages()
+ *
+ * \return The number of dropped messages
+ */
+uint64_t Logger::logDroppedMessages() const
+{
+	return asyncWriter_.dropped();
+}
+
 /**
  * \brief Construct a logger
  */
 Logger::Logger()
 {
 	parseLogFile();
+	parseLogAsync();
 	parseLogLevels();
 }
 
@@ -524,7 +1327,9 @@ Logger::Logger()
  *
  * If the LIBCAMERA_LOG_FILE environment variable is set, open the file it
  * points to and redirect the logger output to it. If the environment variable
- * is set to "syslog", then the logger output will be directed to syslog. Errors
+ * is set to "syslog", then the logger output will be directed to syslog. If it
+ * starts with "binary:", the logger output will be directed to the file named
+ * by the rest of the variable, in binary format. Errors
  * are silently ignored and don't affect the logger output (set to stderr).
  */
 void Logger::parseLogFile()
@@ -540,7 +1345,33 @@ void Logger::parseLogFile()
 		return;
 	}
 
-	logSetFile(file);
+	if (!strncmp(file, "binary:", 7)) {
+		logSetFile(file + 7, LoggingTargetBinaryFile);
+		return;
+	}
+
+	logSetFile(file, LoggingTargetFile);
+}
+
+/**
+ * \brief Parse the asynchronous logging mode from the environment
+ *
+ * If the LIBCAMERA_LOG_ASYNC environment variable is set to a valid drop
+ * policy name, enable asynchronous logging with that policy. Invalid values
+ * are silently ignored.
+ */
+void Logger::parseLogAsync()
+{
+	const char *mode = utils::secure_getenv("LIBCAMERA_LOG_ASYNC");
+	if (!mode)
+		return;
+
+	if (!strcmp(mode, "block"))
+		logSetAsync(true, LoggingDropNone);
+	else if (!strcmp(mode, "drop"))
+		logSetAsync(true, LoggingDropNewest);
+	else if (!strcmp(mode, "drop-low"))
+		logSetAsync(true, LoggingDropBelowWarning);
 }
 
 /**
@@ -692,6 +1523,16 @@ void Logger::unregisterCategory(LogCategory *category)
  * Fatal message, signals an unrecoverable issue and aborts execution
  */
 
+/**
+ * \var LogMinSeverity
+ * \brief The minimum severity of messages compiled in libcamera
+ *
+ * Log messages with a severity lower than LogMinSeverity are removed at compile
+ * time, and can't be enabled at runtime. Fatal messages are never removed.
+ * The minimum severity is selected with the log_min_severity build option, and
+ * defaults to LogDebug.
+ */
+
 /**
  * \class LogCategory
  * \brief A category of log message
@@ -754,6 +1595,95 @@ const LogCategory &LogCategory::defaultCategory()
 	return category;
 }
 
+/**
+ * \class LogRateLimit
+ * \brief Rate limiter and repeat filter for a log call site
+ *
+ * The LogRateLimit class throttles the messages logged from a single call site
+ * with the LOG_RATELIMITED() macro, which instantiates one LogRateLimit per
+ * call site. It must never be used directly.
+ *
+ * A burst of at most 10 messages is output per interval of 5 seconds, the
+ * other messages are dropped before being formatted. Messages identical to
+ * the previous message output from the call site within the interval are
+ * dropped too. The number of dropped messages is reported in a summary message
+ * logged before the next message output from the call site.
+ */
+
+namespace {
+
+constexpr std::chrono::seconds kRateLimitInterval{ 5 };
+constexpr unsigned int kRateLimitBurst = 10;
+
+} /* namespace */
+
+LogRateLimit::LogRateLimit()
+	: count_(0), suppressed_(0), repeated_(0)
+{
+}
+
+/**
+ * \brief Check if a message fits in the rate limit
+ * \param[in] time The message timestamp
+ *
+ * Account for a message logged at \a time in the current interval.
+ *
+ * \return True if the message shall be output, false if it exceeds the rate
+ * limit and shall be dropped
+ */
+bool LogRateLimit::admit(const utils::time_point &time)
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	if (time - windowStart_ >= kRateLimitInterval) {
+		windowStart_ = time;
+		count_ = 0;
+	}
+
+	if (count_ >= kRateLimitBurst) {
+		suppressed_++;
+		return false;
+	}
+
+	count_++;
+	return true;
+}
+
+/**
+ * \brief Filter out a repeated message
+ * \param[in] msg The formatted message
+ * \param[out] summary The summary of the messages dropped since the last output
+ *
+ * \return True if the message shall be output, preceded by the \a summary if
+ * not empty, or false if it repeats the previous message and shall be dropped
+ */
+bool LogRateLimit::filter(const LogMessage &msg, std::string *summary)
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	std::string text = msg.msg();
+	if (text == last_ && msg.timestamp() - lastTime_ < kRateLimitInterval) {
+		repeated_++;
+		return false;
+	}
+
+	std::stringstream ss;
+	if (repeated_)
+		ss << "Previous message repeated " << repeated_ << " times";
+	if (suppressed_)
+		ss << (repeated_ ? ", " : "") << suppressed_
+		   << " messages suppressed by rate limit";
+
+	*summary = ss.str();
+
+	last_ = std::move(text);
+	lastTime_ = msg.timestamp();
+	repeated_ = 0;
+	suppressed_ = 0;
+
+	return true;
+}
+
 /**
  * \class LogMessage
  * \brief Internal log message representation.
@@ -771,16 +1701,28 @@ const LogCategory &LogCategory::defaultCategory()
  * will be displayed
  * \param[in] severity The log message severity, controlling how the message
  * will be displayed
+ * \param[in] rateLimit The rate limiter of the call site, if any
  *
  * Create a log message pertaining to line \a line of file \a fileName. The
  * \a severity argument sets the message severity to control whether it will be
- * output or dropped.
+ * output or dropped. When a \a rateLimit is given, the message is additionally
+ * dropped if it exceeds the rate limit or repeats the previous message.
  */
 LogMessage::LogMessage(const char *fileName, unsigned int line,
-		       const LogCategory &category, LogSeverity severity)
-	: category_(category), severity_(severity)
+		       const LogCategory &category, LogSeverity severity,
+		       LogRateLimit *rateLimit)
+	: category_(category), severity_(severity), rateLimit_(rateLimit)
 {
 	init(fileName, line);
+
+	/*
+	 * Drop messages over the rate limit before they get formatted. Fatal
+	 * messages are never dropped.
+	 */
+	if (rateLimit_ && severity_ != LogFatal && !rateLimit_->admit(timestamp_)) {
+		severity_ = LogInvalid;
+		msgStream_.setstate(std::ios::badbit);
+	}
 }
 
 /**
@@ -797,19 +1739,22 @@ LogMessage::LogMessage(const char *fileName, unsigned int line,
  */
 LogMessage::LogMessage(LogMessage &&other)
 	: msgStream_(std::move(other.msgStream_)), category_(other.category_),
-	  severity_(other.severity_)
+	  severity_(other.severity_), timestamp_(other.timestamp_),
+	  fileName_(other.fileName_), line_(other.line_),
+	  rateLimit_(other.rateLimit_)
 {
 	other.severity_ = LogInvalid;
 }
 
 void LogMessage::init(const char *fileName, unsigned int line)
 {
-	/* Log the timestamp, severity and file information. */
+	/*
+	 * Record the timestamp and file information. Formatting is deferred
+	 * to the log output, which may not need it.
+	 */
 	timestamp_ = utils::clock::now();
-
-	std::ostringstream ossFileInfo;
-	ossFileInfo << utils::basename(fileName) << ":" << line;
-	fileInfo_ = ossFileInfo.str();
+	fileName_ = utils::basename(fileName);
+	line_ = line;
 }
 
 LogMessage::~LogMessage()
@@ -820,8 +1765,20 @@ LogMessage::~LogMessage()
 
 	msgStream_ << std::endl;
 
-	if (severity_ >= category_.severity())
+	if (severity_ >= category_.severity()) {
+		if (rateLimit_ && severity_ != LogFatal) {
+			std::string summary;
+			if (!rateLimit_->filter(*this, &summary))
+				return;
+
+			if (!summary.empty()) {
+				LogMessage msg(fileName_, line_, category_, severity_);
+				msg.stream() << summary;
+			}
+		}
+
 		Logger::instance()->write(*this);
+	}
 
 	if (severity_ == LogSeverity::LogFatal) {
 		Logger::instance()->backtrace();
@@ -858,10 +1815,28 @@ LogMessage::~LogMessage()
  */
 
 /**
- * \fn LogMessage::fileInfo()
+ * \fn LogMessage::fileName()
+ * \brief Retrieve the name of the file the message is logged from
+ *
+ * The file name doesn't contain any leading directory components.
+ *
+ * \return The file name
+ */
+
+/**
+ * \fn LogMessage::line()
+ * \brief Retrieve the line number the message is logged from
+ * \return The line number
+ */
+
+/**
  * \brief Retrieve the file info of the log message
- * \return The file info of the message
+ * \return The file info of the message, as a "file:line" string
  */
+std::string LogMessage::fileInfo() const
+{
+	return std::string(fileName_) + ":" + std::to_string(line_);
+}
 
 /**
  * \fn LogMessage::msg()
@@ -918,6 +1893,31 @@ LogMessage Loggable::_log(const LogCategory *category, LogSeverity severity,
 	return msg;
 }
 
+/**
+ * \brief Create a temporary rate-limited LogMessage object to log a message
+ * \param[in] category The log message category
+ * \param[in] severity The log message severity
+ * \param[in] rateLimit The rate limiter of the call site
+ * \param[in] fileName The file name where the message is logged from
+ * \param[in] line The line number where the message is logged from
+ *
+ * This method is used as a backend by the LOG_RATELIMITED() macro to create a
+ * log message for locations inheriting from the Loggable class.
+ *
+ * \return A log message
+ */
+LogMessage Loggable::_log(const LogCategory *category, LogSeverity severity,
+			  LogRateLimit *rateLimit, const char *fileName,
+			  unsigned int line) const
+{
+	LogMessage msg(fileName, line,
+		       category ? *category : LogCategory::defaultCategory(),
+		       severity, rateLimit);
+
+	msg.stream() << logPrefix() << ": ";
+	return msg;
+}
+
 /**
  * \brief Create a temporary LogMessage object to log a message
  * \param[in] category The log message category
@@ -938,6 +1938,27 @@ LogMessage _log(const LogCategory *category, LogSeverity severity,
 			  severity);
 }
 
+/**
+ * \brief Create a temporary rate-limited LogMessage object to log a message
+ * \param[in] category The log message category
+ * \param[in] severity The log message severity
+ * \param[in] rateLimit The rate limiter of the call site
+ * \param[in] fileName The file name where the message is logged from
+ * \param[in] line The line number where the message is logged from
+ *
+ * This function is used as a backend by the LOG_RATELIMITED() macro to create
+ * a log message for locations not inheriting from the Loggable class.
+ *
+ * \return A log message
+ */
+LogMessage _log(const LogCategory *category, LogSeverity severity,
+		LogRateLimit *rateLimit, const char *fileName, unsigned int line)
+{
+	return LogMessage(fileName, line,
+			  category ? *category : LogCategory::defaultCategory(),
+			  severity, rateLimit);
+}
+
 /**
  * \def LOG_DECLARE_CATEGORY(name)
  * \hideinitializer
@@ -981,6 +2002,12 @@ LogMessage _log(const LogCategory *category, LogSeverity severity,
  * If the severity is set to Fatal, execution is aborted and the program
  * terminates immediately after printing the message.
  *
+ * The expressions streamed to the message are only evaluated if the message is
+ * output. Messages with a severity lower than the log level of their category
+ * are discarded before formatting, and messages with a severity lower than
+ * LogMinSeverity are removed at compile time. Expressions with side effects
+ * shall thus not be logged.
+ *
  * \warning Logging from the destructor of a global object, either directly or
  * indirectly, results in undefined behaviour.
  *
@@ -988,6 +2015,21 @@ LogMessage _log(const LogCategory *category, LogSeverity severity,
  * possible extent
  */
 
+/**
+ * \def LOG_RATELIMITED(category, severity)
+ * \hideinitializer
+ * \brief Log a message with rate limiting and repeat suppression
+ * \param[in] category Category
+ * \param[in] severity Severity
+ *
+ * This macro behaves as LOG(), but throttles the messages logged from the call
+ * site as described in the LogRateLimit class documentation. It shall be used
+ * for messages that can be logged at frame rate when operation degrades, such
+ * as dropped frames or timeouts, to avoid flooding the log.
+ *
+ * Fatal messages are never rate-limited.
+ */
+
 /**
  * \def ASSERT(condition)
  * \hideinitializer
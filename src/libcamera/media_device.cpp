@@ -7,6 +7,7 @@
 
 #include "libcamera/internal/media_device.h"
 
+#include <algorithm>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdint.h>
@@ -64,7 +65,8 @@ LOG_DEFINE_CATEGORY(MediaDevice)
  */
 MediaDevice::MediaDevice(const std::string &deviceNode)
 	: deviceNode_(deviceNode), fd_(-1), valid_(false), acquired_(false),
-	  lockOwner_(false)
+	  lockOwner_(false), linkFlagsValid_(false), linkSequence_(0),
+	  formatSequence_(0)
 {
 }
 
@@ -134,6 +136,11 @@ void MediaDevice::release()
  * they provide at all times, while still allowing an instance to lock a
  * resource while it prepares to actively use a camera from the resource.
  *
+ * Other users may have changed the media graph links while the device was
+ * unlocked. Locking the device thus retrieves the state of all links from the
+ * kernel, which then allows skipping link setup operations that wouldn't
+ * change the state of a link until the device is unlocked.
+ *
  * This method shall not be called from a pipeline handler implementation
  * directly, as the base PipelineHandler implementation handles this on the
  * behalf of the specified implementation.
@@ -154,6 +161,10 @@ bool MediaDevice::lock()
 		return false;
 
 	lockOwner_ = true;
+	linkFlagsValid_ = !updateLinkFlags();
+
+	/* Cached information that depends on the links may be stale. */
+	linkSequence_++;
 
 	return true;
 }
@@ -176,6 +187,7 @@ void MediaDevice::unlock()
 		return;
 
 	lockOwner_ = false;
+	linkFlagsValid_ = false;
 
 	lockf(fd_, F_ULOCK, 0);
 }
@@ -205,12 +217,10 @@ void MediaDevice::unlock()
  */
 int MediaDevice::populate()
 {
-	struct media_v2_topology topology = {};
-	struct media_v2_entity *ents = nullptr;
-	struct media_v2_interface *interfaces = nullptr;
-	struct media_v2_link *links = nullptr;
-	struct media_v2_pad *pads = nullptr;
-	__u64 version = -1;
+	MediaTopologyCache cache;
+	MediaTopologyCache::Topology topo;
+	std::string cacheKey;
+	bool cached = false;
 	int ret;
 
 	clear();
@@ -234,55 +244,42 @@ int MediaDevice::populate()
 	hwRevision_ = info.hw_revision;
 
 	/*
-	 * Keep calling G_TOPOLOGY until the version number stays stable.
+	 * Reuse the cached topology if the kernel reports the same version and
+	 * number of objects, otherwise retrieve it and update the cache. If the
+	 * cached topology can't be used, fall back to retrieving it from the
+	 * kernel, and replace the cache entry.
 	 */
-	while (true) {
-		topology.topology_version = 0;
-		topology.ptr_entities = reinterpret_cast<uintptr_t>(ents);
-		topology.ptr_interfaces = reinterpret_cast<uintptr_t>(interfaces);
-		topology.ptr_links = reinterpret_cast<uintptr_t>(links);
-		topology.ptr_pads = reinterpret_cast<uintptr_t>(pads);
+	if (cache.isEnabled()) {
+		cacheKey = MediaTopologyCache::key(info);
+		cached = !cache.load(cacheKey, &topo) && refreshTopology(&topo);
+	}
 
-		ret = ioctl(fd_, MEDIA_IOC_G_TOPOLOGY, &topology);
-		if (ret < 0) {
-			ret = -errno;
-			LOG(MediaDevice, Error)
-				<< "Failed to enumerate topology: "
-				<< strerror(-ret);
-			goto done;
-		}
+	if (cached) {
+		LOG(MediaDevice, Debug) << "Using cached topology";
 
-		if (version == topology.topology_version)
-			break;
+		valid_ = populateTopology(topo);
+		if (!valid_) {
+			LOG(MediaDevice, Warning)
+				<< "Cached topology is invalid, ignoring it";
+			clear();
+		}
+	}
 
-		delete[] ents;
-		delete[] interfaces;
-		delete[] pads;
-		delete[] links;
+	if (!valid_) {
+		ret = fetchTopology(&topo);
+		if (ret)
+			goto done;
 
-		ents = new struct media_v2_entity[topology.num_entities]();
-		interfaces = new struct media_v2_interface[topology.num_interfaces]();
-		links = new struct media_v2_link[topology.num_links]();
-		pads = new struct media_v2_pad[topology.num_pads]();
+		if (cache.isEnabled())
+			cache.store(cacheKey, topo);
 
-		version = topology.topology_version;
+		valid_ = populateTopology(topo);
 	}
 
-	/* Populate entities, pads and links. */
-	if (populateEntities(topology) &&
-	    populatePads(topology) &&
-	    populateLinks(topology))
-		valid_ = true;
-
 	ret = 0;
 done:
 	close();
 
-	delete[] ents;
-	delete[] interfaces;
-	delete[] pads;
-	delete[] links;
-
 	if (!valid_) {
 		clear();
 		return -EINVAL;
@@ -442,6 +439,27 @@ MediaLink *MediaDevice::link(const MediaPad *source, const MediaPad *sink)
  * \return 0 on success or a negative error code otherwise
  */
 int MediaDevice::disableLinks()
+{
+	return setupLinks({});
+}
+
+/**
+ * \brief Enable a set of links and disable all other links in the media device
+ * \param[in] links The links to enable
+ *
+ * Enable all the \a links and disable all the other links of the media device
+ * which are not flagged as IMMUTABLE. All links are disabled before enabling
+ * any link, as some entities don't allow multiple sink links to be enabled at
+ * the same time.
+ *
+ * Compared to disableLinks() followed by enabling the \a links one by one, this
+ * function doesn't disable and re-enable the links that stay enabled. When the
+ * device is locked, links that are already in the requested state are not
+ * touched at all, see MediaLink::setEnabled().
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int MediaDevice::setupLinks(const std::vector<MediaLink *> &links)
 {
 	for (MediaEntity *entity : entities_) {
 		for (MediaPad *pad : entity->pads()) {
@@ -452,6 +470,9 @@ int MediaDevice::disableLinks()
 				if (link->flags() & MEDIA_LNK_FL_IMMUTABLE)
 					continue;
 
+				if (std::find(links.begin(), links.end(), link) != links.end())
+					continue;
+
 				int ret = link->setEnabled(false);
 				if (ret)
 					return ret;
@@ -459,9 +480,87 @@ int MediaDevice::disableLinks()
 		}
 	}
 
+	for (MediaLink *link : links) {
+		int ret = link->setEnabled(true);
+		if (ret)
+			return ret;
+	}
+
 	return 0;
 }
 
+/**
+ * \fn MediaDevice::linkSequence()
+ * \brief Retrieve the link configuration sequence number
+ *
+ * The sequence number is incremented every time a link of the media device is
+ * successfully enabled or disabled, and every time the device is locked as
+ * other users may have modified the media graph while it was unlocked. Users
+ * that cache information depending on the link configuration or on the state
+ * of the media graph, such as the formats enumerated or set on video devices
+ * and subdevices, can compare the sequence number to detect changes.
+ *
+ * \return The link configuration sequence number
+ */
+
+/**
+ * \fn MediaDevice::formatSequence()
+ * \brief Retrieve the format configuration sequence number
+ *
+ * The sequence number is incremented by formatChanged() every time an active
+ * format is set on a video device or subdevice of the media device, or a
+ * selection rectangle on a subdevice. As formats propagate along the pipeline, in the kernel or in
+ * the pipeline handlers, the formats enumerated on a device may depend on the
+ * formats of the devices upstream. Users that cache format enumerations can
+ * compare the sequence number to detect such changes.
+ *
+ * \return The format configuration sequence number
+ */
+
+/**
+ * \fn MediaDevice::formatChanged()
+ * \brief Signal that a format has been set on a device of the media device
+ *
+ * This function increments the sequence number returned by formatSequence().
+ * It is called by the video devices and subdevices when an active format or a
+ * subdevice selection rectangle is applied.
+ */
+
+/**
+ * \brief Allocate a request of the Media Controller Request API
+ *
+ * Requests bind V4L2 controls to buffers, and are applied atomically by the
+ * kernel when the buffers are processed. The request API is only supported
+ * by some drivers, this method returns nullptr if the media device doesn't
+ * support requests.
+ *
+ * The media device must be acquired before requests can be allocated.
+ *
+ * \return A newly allocated request, or nullptr on error
+ */
+std::unique_ptr<MediaRequest> MediaDevice::allocateRequest()
+{
+	if (fd_ == -1) {
+		LOG(MediaDevice, Error)
+			<< "Media device must be acquired to allocate requests";
+		return nullptr;
+	}
+
+	int fd;
+	int ret = ioctl(fd_, MEDIA_IOC_REQUEST_ALLOC, &fd);
+	if (ret < 0) {
+		ret = -errno;
+		if (ret == -ENOTTY)
+			LOG(MediaDevice, Debug) << "Requests are not supported";
+		else
+			LOG(MediaDevice, Error)
+				<< "Failed to allocate request: " << strerror(-ret);
+		return nullptr;
+	}
+
+	return std::make_unique<MediaRequest>(fd);
+}
+
 /**
  * \var MediaDevice::disconnected
  * \brief Signal emitted when the media device is disconnected from the system
@@ -627,6 +726,161 @@ struct media_v2_interface *MediaDevice::findInterface(const struct media_v2_topo
 	return nullptr;
 }
 
+/*
+ * Retrieve the media graph topology from the kernel. Entity flags are fixed up
+ * for kernels that don't report them through MEDIA_IOC_G_TOPOLOGY.
+ */
+int MediaDevice::fetchTopology(MediaTopologyCache::Topology *topo)
+{
+	struct media_v2_topology topology = {};
+	__u64 version = -1;
+
+	/*
+	 * Keep calling G_TOPOLOGY until the version number stays stable.
+	 */
+	while (true) {
+		topology.topology_version = 0;
+		topology.ptr_entities = topo->entities.empty() ? 0
+				      : reinterpret_cast<uintptr_t>(topo->entities.data());
+		topology.ptr_interfaces = topo->interfaces.empty() ? 0
+					: reinterpret_cast<uintptr_t>(topo->interfaces.data());
+		topology.ptr_links = topo->links.empty() ? 0
+				   : reinterpret_cast<uintptr_t>(topo->links.data());
+		topology.ptr_pads = topo->pads.empty() ? 0
+				  : reinterpret_cast<uintptr_t>(topo->pads.data());
+
+		int ret = ioctl(fd_, MEDIA_IOC_G_TOPOLOGY, &topology);
+		if (ret < 0) {
+			ret = -errno;
+			LOG(MediaDevice, Error)
+				<< "Failed to enumerate topology: "
+				<< strerror(-ret);
+			return ret;
+		}
+
+		if (version == topology.topology_version)
+			break;
+
+		topo->entities = std::vector<struct media_v2_entity>(topology.num_entities);
+		topo->interfaces = std::vector<struct media_v2_interface>(topology.num_interfaces);
+		topo->links = std::vector<struct media_v2_link>(topology.num_links);
+		topo->pads = std::vector<struct media_v2_pad>(topology.num_pads);
+
+		version = topology.topology_version;
+	}
+
+	topo->version = version;
+
+	/*
+	 * The media_v2_entity structure was missing the flag field before
+	 * v4.19.
+	 */
+	if (!MEDIA_V2_ENTITY_HAS_FLAGS(version_)) {
+		for (struct media_v2_entity &entity : topo->entities)
+			fixupEntityFlags(&entity);
+	}
+
+	return 0;
+}
+
+/*
+ * Validate a cached topology against the kernel and update its interfaces and
+ * links. The link flags change at runtime and can't be cached, and the device
+ * node numbers of the interfaces depend on the order in which devices are
+ * registered. Retrieving them is however cheaper than retrieving the whole
+ * topology.
+ */
+bool MediaDevice::refreshTopology(MediaTopologyCache::Topology *topo)
+{
+	std::vector<struct media_v2_interface> interfaces(topo->interfaces.size());
+	std::vector<struct media_v2_link> links(topo->links.size());
+	struct media_v2_topology topology = {};
+
+	topology.num_interfaces = interfaces.size();
+	topology.ptr_interfaces = interfaces.empty() ? 0
+				: reinterpret_cast<uintptr_t>(interfaces.data());
+	topology.num_links = links.size();
+	topology.ptr_links = links.empty() ? 0
+			   : reinterpret_cast<uintptr_t>(links.data());
+
+	int ret = ioctl(fd_, MEDIA_IOC_G_TOPOLOGY, &topology);
+	if (ret < 0)
+		return false;
+
+	if (topology.topology_version != topo->version ||
+	    topology.num_entities != topo->entities.size() ||
+	    topology.num_interfaces != topo->interfaces.size() ||
+	    topology.num_pads != topo->pads.size() ||
+	    topology.num_links != links.size())
+		return false;
+
+	topo->interfaces = std::move(interfaces);
+	topo->links = std::move(links);
+
+	return true;
+}
+
+/*
+ * Create the media objects for the entities, pads and links of a topology.
+ */
+bool MediaDevice::populateTopology(const MediaTopologyCache::Topology &topo)
+{
+	struct media_v2_topology topology = {};
+	topology.topology_version = topo.version;
+	topology.num_entities = topo.entities.size();
+	topology.ptr_entities = reinterpret_cast<uintptr_t>(topo.entities.data());
+	topology.num_interfaces = topo.interfaces.size();
+	topology.ptr_interfaces = reinterpret_cast<uintptr_t>(topo.interfaces.data());
+	topology.num_pads = topo.pads.size();
+	topology.ptr_pads = reinterpret_cast<uintptr_t>(topo.pads.data());
+	topology.num_links = topo.links.size();
+	topology.ptr_links = reinterpret_cast<uintptr_t>(topo.links.data());
+
+	return populateEntities(topology) &&
+	       populatePads(topology) &&
+	       populateLinks(topology);
+}
+
+/*
+ * Retrieve the flags of all links from the kernel, to pick up the changes made
+ * by other users of the media device.
+ */
+int MediaDevice::updateLinkFlags()
+{
+	struct media_v2_topology topology = {};
+
+	int ret = ioctl(fd_, MEDIA_IOC_G_TOPOLOGY, &topology);
+	if (ret < 0)
+		return -errno;
+
+	std::vector<struct media_v2_link> links(topology.num_links);
+	topology = {};
+	topology.num_links = links.size();
+	topology.ptr_links = links.empty() ? 0
+			   : reinterpret_cast<uintptr_t>(links.data());
+
+	ret = ioctl(fd_, MEDIA_IOC_G_TOPOLOGY, &topology);
+	if (ret < 0)
+		return -errno;
+
+	for (const struct media_v2_link &mediaLink : links) {
+		if ((mediaLink.flags & MEDIA_LNK_FL_LINK_TYPE) ==
+		    MEDIA_LNK_FL_INTERFACE_LINK)
+			continue;
+
+		MediaLink *link = dynamic_cast<MediaLink *>(object(mediaLink.id));
+		if (!link) {
+			LOG(MediaDevice, Debug)
+				<< "Media graph changed, link flags not updated";
+			return -ENODEV;
+		}
+
+		link->flags_ = mediaLink.flags;
+	}
+
+	return 0;
+}
+
 /*
  * For each entity in the media graph create a MediaEntity and store a
  * reference in the media device objects map and entities list.
@@ -639,13 +893,6 @@ bool MediaDevice::populateEntities(const struct media_v2_topology &topology)
 	for (unsigned int i = 0; i < topology.num_entities; ++i) {
 		struct media_v2_entity *ent = &mediaEntities[i];
 
-		/*
-		 * The media_v2_entity structure was missing the flag field before
-		 * v4.19.
-		 */
-		if (!MEDIA_V2_ENTITY_HAS_FLAGS(version_))
-			fixupEntityFlags(ent);
-
 		/*
 		 * Find the interface linked to this entity to get the device
 		 * node major and minor numbers.
@@ -815,6 +1062,8 @@ int MediaDevice::setupLink(const MediaLink *link, unsigned int flags)
 		return ret;
 	}
 
+	linkSequence_++;
+
 	LOG(MediaDevice, Debug)
 		<< source->entity()->name() << "["
 		<< source->index() << "] -> "
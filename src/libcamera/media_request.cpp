@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * media_request.cpp - Media Controller request
+ */
+
+#include "libcamera/internal/media_request.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/media.h>
+
+#include "libcamera/internal/event_notifier.h"
+#include "libcamera/internal/log.h"
+
+/**
+ * \file media_request.h
+ * \brief Media Controller request
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(MediaRequest)
+
+/**
+ * \class MediaRequest
+ * \brief A request of the Media Controller Request API
+ *
+ * The Media Controller Request API allows binding device parameters, such as
+ * V4L2 controls, to buffers. A request groups controls set with
+ * V4L2Device::setControls() and buffers queued with
+ * V4L2VideoDevice::queueBuffer() for the devices of a media device. When the
+ * request is queued, the kernel applies the controls atomically when it
+ * processes the buffers, without any timing-critical operation in userspace.
+ *
+ * Requests are allocated with MediaDevice::allocateRequest(). Once populated,
+ * a request is queued with queue(), and the completed signal is emitted when
+ * the kernel has completed processing the request. The request can then be
+ * reinitialized with reinit() and reused.
+ *
+ * Support for requests depends on the drivers. The V4L2 drivers that support
+ * requests report the V4L2_BUF_CAP_SUPPORTS_REQUESTS capability.
+ */
+
+/**
+ * \enum MediaRequest::Status
+ * \brief The request status
+ * \var MediaRequest::Idle
+ * \brief The request is being populated and hasn't been queued
+ * \var MediaRequest::Queued
+ * \brief The request has been queued and is processed by the kernel
+ * \var MediaRequest::Complete
+ * \brief The request has been completed by the kernel
+ */
+
+/**
+ * \brief Construct a MediaRequest from a request file descriptor
+ * \param[in] fd The request file descriptor
+ *
+ * The MediaRequest takes ownership of the file descriptor \a fd, which must
+ * have been allocated with MEDIA_IOC_REQUEST_ALLOC. Use
+ * MediaDevice::allocateRequest() to create requests.
+ */
+MediaRequest::MediaRequest(int fd)
+	: fd_(fd), status_(Idle)
+{
+	/* Request completion is signalled by an exception on the fd. */
+	notifier_ = new EventNotifier(fd_, EventNotifier::Exception);
+	notifier_->setEnabled(false);
+	notifier_->activated.connect(this, &MediaRequest::requestComplete);
+}
+
+MediaRequest::~MediaRequest()
+{
+	delete notifier_;
+	::close(fd_);
+}
+
+/**
+ * \fn MediaRequest::fd()
+ * \brief Retrieve the request file descriptor
+ * \return The request file descriptor
+ */
+
+/**
+ * \fn MediaRequest::status()
+ * \brief Retrieve the request status
+ * \return The request status
+ */
+
+/**
+ * \brief Queue the request to the kernel
+ *
+ * All controls and buffers must have been added to the request before it is
+ * queued. The completed signal is emitted when the request completes.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY The request has already been queued
+ */
+int MediaRequest::queue()
+{
+	if (status_ != Idle)
+		return -EBUSY;
+
+	if (::ioctl(fd_, MEDIA_REQUEST_IOC_QUEUE) < 0) {
+		int ret = -errno;
+		LOG(MediaRequest, Error)
+			<< "Failed to queue request: " << strerror(-ret);
+		return ret;
+	}
+
+	status_ = Queued;
+	notifier_->setEnabled(true);
+
+	return 0;
+}
+
+/**
+ * \brief Reinitialize the request for reuse
+ *
+ * Reinitializing a request clears all the controls and buffers it contains.
+ * Requests can't be reinitialized while they are queued.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY The request is queued
+ */
+int MediaRequest::reinit()
+{
+	if (status_ == Queued)
+		return -EBUSY;
+
+	if (::ioctl(fd_, MEDIA_REQUEST_IOC_REINIT) < 0) {
+		int ret = -errno;
+		LOG(MediaRequest, Error)
+			<< "Failed to reinitialize request: " << strerror(-ret);
+		return ret;
+	}
+
+	status_ = Idle;
+
+	return 0;
+}
+
+/**
+ * \var MediaRequest::completed
+ * \brief Signal emitted when the request has been completed by the kernel
+ */
+
+void MediaRequest::requestComplete([[maybe_unused]] EventNotifier *notifier)
+{
+	notifier_->setEnabled(false);
+	status_ = Complete;
+
+	completed.emit(this);
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,351 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * media_topology_cache.cpp - On-disk cache of media graph topologies
+ */
+
+#include "libcamera/internal/media_topology_cache.h"
+
+#include <array>
+#include <errno.h>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include <libcamera/span.h>
+
+#include "libcamera/internal/file.h"
+#include "libcamera/internal/log.h"
+#include "libcamera/internal/utils.h"
+
+/**
+ * \file media_topology_cache.h
+ * \brief On-disk cache of media graph topologies
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(MediaTopologyCache)
+
+namespace {
+
+constexpr uint32_t CacheMagic = 0x544d434c; /* "LCMT" */
+constexpr uint16_t CacheFormatVersion = 1;
+
+/*
+ * The cache file starts with a header, followed by the key and the entities,
+ * interfaces, pads and links arrays, in that order, without padding. The
+ * structure sizes are recorded to reject caches written with a different
+ * version of the media controller UAPI.
+ */
+struct CacheHeader {
+	uint32_t magic;
+	uint16_t formatVersion;
+	uint16_t keySize;
+	uint64_t topologyVersion;
+	uint32_t numEntities;
+	uint32_t numInterfaces;
+	uint32_t numPads;
+	uint32_t numLinks;
+	uint16_t entitySize;
+	uint16_t interfaceSize;
+	uint16_t padSize;
+	uint16_t linkSize;
+};
+
+template<typename T>
+bool readArray(Span<const uint8_t> *data, uint32_t count, std::vector<T> *array)
+{
+	size_t size = count * sizeof(T);
+	if (data->size() < size)
+		return false;
+
+	array->resize(count);
+	memcpy(array->data(), data->data(), size);
+	*data = data->subspan(size);
+
+	return true;
+}
+
+template<typename T>
+bool writeData(File *file, const T *data, size_t size)
+{
+	Span<const uint8_t> buffer(reinterpret_cast<const uint8_t *>(data), size);
+	return file->write(buffer) == static_cast<ssize_t>(size);
+}
+
+/*
+ * Retrieve the random identifier generated by the kernel at boot time, or an
+ * empty string if it isn't available.
+ */
+std::string bootId()
+{
+	File file("/proc/sys/kernel/random/boot_id");
+	if (!file.open(File::ReadOnly))
+		return {};
+
+	std::array<uint8_t, 64> data;
+	ssize_t size = file.read(data);
+	if (size <= 0)
+		return {};
+
+	std::string id(reinterpret_cast<const char *>(data.data()), size);
+	return id.substr(0, id.find('\n'));
+}
+
+} /* namespace */
+
+/**
+ * \class MediaTopologyCache
+ * \brief Store media graph topologies on disk for reuse across processes
+ *
+ * Populating a MediaDevice retrieves the full media graph from the kernel.
+ * Processes that run for a short time, such as command line tools, repeat
+ * this for every media device in the system every time they start. The
+ * MediaTopologyCache stores the entities, interfaces, pads and links
+ * retrieved by the MEDIA_IOC_G_TOPOLOGY ioctl in a file, to skip most of the
+ * topology retrieval process when the topology hasn't changed.
+ *
+ * Topologies are identified by a key generated by key() from the media device
+ * information, the kernel version and the boot ID. Users of the cache shall
+ * verify that the topology version reported by the kernel matches the cached
+ * topology before using it. The link flags and the interface device nodes may
+ * change at runtime and shall always be retrieved from the kernel.
+ *
+ * The cache is disabled by default. It is enabled by setting the
+ * LIBCAMERA_MEDIA_TOPOLOGY_CACHE environment variable to the path of an
+ * existing directory where cache files will be stored.
+ */
+
+/**
+ * \struct MediaTopologyCache::Topology
+ * \brief A media graph topology as reported by MEDIA_IOC_G_TOPOLOGY
+ *
+ * \var MediaTopologyCache::Topology::version
+ * \brief The topology version
+ *
+ * \var MediaTopologyCache::Topology::entities
+ * \brief The media graph entities
+ *
+ * \var MediaTopologyCache::Topology::interfaces
+ * \brief The media graph interfaces
+ *
+ * \var MediaTopologyCache::Topology::pads
+ * \brief The media graph pads
+ *
+ * \var MediaTopologyCache::Topology::links
+ * \brief The media graph links, including interface links
+ */
+
+/**
+ * \brief Construct a MediaTopologyCache configured from the environment
+ *
+ * The cache directory is taken from the LIBCAMERA_MEDIA_TOPOLOGY_CACHE
+ * environment variable. The cache is disabled if the variable isn't set.
+ */
+MediaTopologyCache::MediaTopologyCache()
+{
+	const char *directory = utils::secure_getenv("LIBCAMERA_MEDIA_TOPOLOGY_CACHE");
+	if (directory)
+		directory_ = directory;
+}
+
+/**
+ * \brief Construct a MediaTopologyCache storing files in \a directory
+ * \param[in] directory The cache directory, or an empty string to disable the
+ * cache
+ */
+MediaTopologyCache::MediaTopologyCache(const std::string &directory)
+	: directory_(directory)
+{
+}
+
+/**
+ * \fn MediaTopologyCache::isEnabled()
+ * \brief Check if the cache is enabled
+ * \return True if a cache directory is set, false otherwise
+ */
+
+/**
+ * \fn MediaTopologyCache::directory()
+ * \brief Retrieve the cache directory
+ * \return The cache directory, or an empty string if the cache is disabled
+ */
+
+/**
+ * \brief Load a topology from the cache
+ * \param[in] key The topology key
+ * \param[out] topology The cached topology
+ *
+ * \return 0 on success, -ENOENT if the cache contains no valid topology for
+ * \a key, or another negative error code otherwise
+ */
+int MediaTopologyCache::load(const std::string &key, Topology *topology) const
+{
+	if (!isEnabled())
+		return -ENOENT;
+
+	File file(path(key));
+	if (!file.exists())
+		return -ENOENT;
+
+	if (!file.open(File::ReadOnly))
+		return file.error();
+
+	Span<const uint8_t> data = file.map(0, -1, File::MapPrivate);
+	if (data.empty())
+		return file.error() ? file.error() : -ENOENT;
+
+	CacheHeader header;
+	if (data.size() < sizeof(header))
+		return -ENOENT;
+
+	memcpy(&header, data.data(), sizeof(header));
+	data = data.subspan(sizeof(header));
+
+	if (header.magic != CacheMagic ||
+	    header.formatVersion != CacheFormatVersion ||
+	    header.entitySize != sizeof(struct media_v2_entity) ||
+	    header.interfaceSize != sizeof(struct media_v2_interface) ||
+	    header.padSize != sizeof(struct media_v2_pad) ||
+	    header.linkSize != sizeof(struct media_v2_link) ||
+	    header.keySize != key.size() || data.size() < key.size() ||
+	    memcmp(data.data(), key.data(), key.size())) {
+		LOG(MediaTopologyCache, Debug)
+			<< "Ignoring stale cache " << file.fileName();
+		return -ENOENT;
+	}
+
+	data = data.subspan(key.size());
+
+	Topology result;
+	result.version = header.topologyVersion;
+	if (!readArray(&data, header.numEntities, &result.entities) ||
+	    !readArray(&data, header.numInterfaces, &result.interfaces) ||
+	    !readArray(&data, header.numPads, &result.pads) ||
+	    !readArray(&data, header.numLinks, &result.links) ||
+	    !data.empty()) {
+		LOG(MediaTopologyCache, Warning)
+			<< "Ignoring corrupted cache " << file.fileName();
+		return -ENOENT;
+	}
+
+	*topology = std::move(result);
+
+	return 0;
+}
+
+/**
+ * \brief Store a topology in the cache
+ * \param[in] key The topology key
+ * \param[in] topology The topology to store
+ *
+ * The cache file is replaced atomically, concurrent processes loading the
+ * same topology see either the previous or the new cache content.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int MediaTopologyCache::store(const std::string &key, const Topology &topology) const
+{
+	if (!isEnabled())
+		return -ENOENT;
+
+	if (key.size() > UINT16_MAX)
+		return -EINVAL;
+
+	CacheHeader header = {};
+	header.magic = CacheMagic;
+	header.formatVersion = CacheFormatVersion;
+	header.keySize = key.size();
+	header.topologyVersion = topology.version;
+	header.numEntities = topology.entities.size();
+	header.numInterfaces = topology.interfaces.size();
+	header.numPads = topology.pads.size();
+	header.numLinks = topology.links.size();
+	header.entitySize = sizeof(struct media_v2_entity);
+	header.interfaceSize = sizeof(struct media_v2_interface);
+	header.padSize = sizeof(struct media_v2_pad);
+	header.linkSize = sizeof(struct media_v2_link);
+
+	std::string target = path(key);
+	std::string temporary = target + "." + std::to_string(getpid());
+
+	unlink(temporary.c_str());
+
+	File file(temporary);
+	if (!file.open(File::WriteOnly)) {
+		LOG(MediaTopologyCache, Debug)
+			<< "Failed to create " << temporary << ": "
+			<< strerror(-file.error());
+		return file.error();
+	}
+
+	bool success =
+		writeData(&file, &header, sizeof(header)) &&
+		writeData(&file, key.data(), key.size()) &&
+		writeData(&file, topology.entities.data(),
+			  topology.entities.size() * sizeof(struct media_v2_entity)) &&
+		writeData(&file, topology.interfaces.data(),
+			  topology.interfaces.size() * sizeof(struct media_v2_interface)) &&
+		writeData(&file, topology.pads.data(),
+			  topology.pads.size() * sizeof(struct media_v2_pad)) &&
+		writeData(&file, topology.links.data(),
+			  topology.links.size() * sizeof(struct media_v2_link));
+
+	file.close();
+
+	if (!success || rename(temporary.c_str(), target.c_str()) < 0) {
+		int ret = success ? -errno : -EIO;
+		LOG(MediaTopologyCache, Debug)
+			<< "Failed to write " << target << ": " << strerror(-ret);
+		unlink(temporary.c_str());
+		return ret;
+	}
+
+	LOG(MediaTopologyCache, Debug) << "Stored topology in " << target;
+
+	return 0;
+}
+
+/**
+ * \brief Generate the cache key for a media device
+ * \param[in] info The media device information
+ *
+ * The key identifies the device by its driver, model, serial number and bus
+ * information, and includes the driver, hardware and kernel versions, causing
+ * the cache to be invalidated when any of them changes. The kernel boot ID is
+ * included as well, as the media graph object IDs and the device nodes of the
+ * interfaces depend on the order in which devices are probed, which may change
+ * from boot to boot.
+ *
+ * \return The cache key
+ */
+std::string MediaTopologyCache::key(const struct media_device_info &info)
+{
+	struct utsname uts = {};
+	uname(&uts);
+
+	std::ostringstream ss;
+	ss << info.driver << "\n" << info.model << "\n" << info.serial << "\n"
+	   << info.bus_info << "\n" << info.hw_revision << "\n"
+	   << info.driver_version << "\n" << info.media_version << "\n"
+	   << uts.release << "\n" << bootId();
+
+	return ss.str();
+}
+
+std::string MediaTopologyCache::path(const std::string &key) const
+{
+	std::ostringstream ss;
+	ss << directory_ << "/media-" << std::hex << std::setw(16)
+	   << std::setfill('0') << std::hash<std::string>{}(key) << ".topology";
+
+	return ss.str();
+}
+
+} /* namespace libcamera */
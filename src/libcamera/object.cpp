@@ -112,6 +112,10 @@ Object::~Object()
  * If this function is called before the thread's event loop is started, the
  * object will be deleted when the event loop starts.
  *
+ * Objects scheduled for deletion are queued on a per-thread list, and are all
+ * deleted at the next iteration of the event loop. This doesn't allocate any
+ * message, and wakes up the event loop once for the whole batch.
+ *
  * Deferred deletion can be used to control the destruction context with shared
  * pointers. An object managed with shared pointers is deleted when the last
  * reference is destroyed, which makes difficult to ensure through software
@@ -139,7 +143,7 @@ Object::~Object()
  */
 void Object::deleteLater()
 {
-	postMessage(std::make_unique<Message>(Message::DeferredDelete));
+	thread()->postDeferredDelete(this);
 }
 
 /**
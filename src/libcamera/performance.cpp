@@ -0,0 +1,513 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * performance.cpp - Performance counters
+ */
+
+#include <libcamera/performance.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#include "libcamera/internal/performance.h"
+
+/**
+ * \file libcamera/performance.h
+ * \brief Lightweight performance counters
+ *
+ * libcamera continuously records a small set of performance counters, for
+ * each camera and for the whole library. They can be retrieved at any time
+ * with Camera::performance() and CameraManager::performance(), without a
+ * tracing build or external tooling. Recording them costs a few atomic
+ * operations or an uncontended lock per event.
+ */
+
+/**
+ * \internal
+ * \file libcamera/internal/performance.h
+ * \brief Recording of the library-wide performance counters
+ */
+
+namespace libcamera {
+
+/**
+ * \class PerformanceHistogram
+ * \brief Statistics over a sliding window of duration samples
+ *
+ * The histogram stores the last kWindowSize samples in a ring buffer. The
+ * minimum, maximum, mean and percentiles are computed over those samples, to
+ * reflect the current behaviour of the system, while count() reports the
+ * total number of samples recorded. All values are expressed in nanoseconds.
+ */
+
+/**
+ * \var PerformanceHistogram::kWindowSize
+ * \brief The number of most recent samples the statistics are computed on
+ */
+
+PerformanceHistogram::PerformanceHistogram()
+	: count_(0)
+{
+}
+
+/**
+ * \brief Add a sample to the histogram
+ * \param[in] value The sample value, in nanoseconds
+ */
+void PerformanceHistogram::add(uint64_t value)
+{
+	samples_[count_ % kWindowSize] = value;
+	count_++;
+}
+
+/**
+ * \brief Remove all samples from the histogram
+ */
+void PerformanceHistogram::reset()
+{
+	count_ = 0;
+}
+
+/**
+ * \fn PerformanceHistogram::count()
+ * \brief Retrieve the total number of samples added to the histogram
+ * \return The number of samples, including the ones out of the window
+ */
+
+/**
+ * \brief Retrieve the smallest sample in the window
+ * \return The smallest sample, or 0 if the histogram is empty
+ */
+uint64_t PerformanceHistogram::min() const
+{
+	unsigned int n = size();
+	if (!n)
+		return 0;
+
+	return *std::min_element(samples_.begin(), samples_.begin() + n);
+}
+
+/**
+ * \brief Retrieve the largest sample in the window
+ * \return The largest sample, or 0 if the histogram is empty
+ */
+uint64_t PerformanceHistogram::max() const
+{
+	unsigned int n = size();
+	if (!n)
+		return 0;
+
+	return *std::max_element(samples_.begin(), samples_.begin() + n);
+}
+
+/**
+ * \brief Compute the mean of the samples in the window
+ * \return The mean value, or 0 if the histogram is empty
+ */
+uint64_t PerformanceHistogram::mean() const
+{
+	unsigned int n = size();
+	if (!n)
+		return 0;
+
+	uint64_t sum = 0;
+	for (unsigned int i = 0; i < n; ++i)
+		sum += samples_[i];
+
+	return sum / n;
+}
+
+/**
+ * \brief Compute a percentile of the samples in the window
+ * \param[in] percent The percentile, between 0 and 100
+ * \return The smallest sample greater than or equal to \a percent percent of
+ * the samples, or 0 if the histogram is empty
+ */
+uint64_t PerformanceHistogram::percentile(unsigned int percent) const
+{
+	unsigned int n = size();
+	if (!n)
+		return 0;
+
+	std::vector<uint64_t> sorted(samples_.begin(), samples_.begin() + n);
+	unsigned int index = std::min(n - 1, n * std::min(percent, 100U) / 100);
+	std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+
+	return sorted[index];
+}
+
+/**
+ * \brief Assemble and return a string describing the histogram
+ *
+ * The statistics are expressed in microseconds.
+ *
+ * \return A string describing the histogram
+ */
+std::string PerformanceHistogram::toString() const
+{
+	std::stringstream ss;
+
+	auto us = [](uint64_t value) { return value / 1000.0; };
+
+	ss << std::fixed << std::setprecision(1)
+	   << "count " << count_
+	   << " min " << us(min())
+	   << " mean " << us(mean())
+	   << " p50 " << us(percentile(50))
+	   << " p99 " << us(percentile(99))
+	   << " max " << us(max()) << " us";
+
+	return ss.str();
+}
+
+unsigned int PerformanceHistogram::size() const
+{
+	return std::min<uint64_t>(count_, kWindowSize);
+}
+
+/**
+ * \struct CameraPerformance
+ * \brief Performance counters of a camera
+ *
+ * The counters are reset when the camera is started.
+ *
+ * \var CameraPerformance::frameInterval
+ * \brief Interval between the sensor timestamps of consecutive completed
+ * requests
+ *
+ * \var CameraPerformance::requestLatency
+ * \brief Time between the queuing of requests to the pipeline handler and
+ * their completion
+ *
+ * \var CameraPerformance::requestsCompleted
+ * \brief Number of requests completed successfully
+ *
+ * \var CameraPerformance::requestsCancelled
+ * \brief Number of requests cancelled
+ *
+ * \var CameraPerformance::framesDropped
+ * \brief Number of frames missing from the frame sequence numbers of the
+ * completed buffers
+ *
+ * \var CameraPerformance::framesDroppedNoRequest
+ * \brief Number of the dropped frames that were lost because no request was
+ * queued to capture them
+ *
+ * A steadily increasing value indicates that the application doesn't queue
+ * enough requests, see CameraConfiguration::minRequestDepth().
+ *
+ * \var CameraPerformance::framesDroppedLate
+ * \brief Number of the dropped frames that were lost because the pipeline
+ * fell behind
+ *
+ * The stage of the pipeline that fell behind is reported for each gap in the
+ * controls::FrameDropReason metadata of the requests.
+ */
+
+/**
+ * \brief Assemble and return a string describing the counters
+ * \return A string describing the counters
+ */
+std::string CameraPerformance::toString() const
+{
+	std::stringstream ss;
+
+	ss << "requests: " << requestsCompleted << " completed, "
+	   << requestsCancelled << " cancelled, frames dropped: "
+	   << framesDropped << " (" << framesDroppedNoRequest
+	   << " no request, " << framesDroppedLate << " late)" << std::endl
+	   << "frame interval: " << frameInterval.toString() << std::endl
+	   << "request latency: " << requestLatency.toString();
+
+	return ss.str();
+}
+
+/**
+ * \struct CameraMemoryUsage
+ * \brief Memory pinned by a camera for its buffers
+ *
+ * The sizes are expressed in bytes, and sum the length of all planes of the
+ * buffers.
+ *
+ * \var CameraMemoryUsage::applicationBuffers
+ * \brief Memory of the buffers allocated for the application with a
+ * FrameBufferAllocator
+ *
+ * \var CameraMemoryUsage::internalBuffers
+ * \brief Memory of the buffers allocated internally by the pipeline handler,
+ * such as raw, ISP parameters and statistics buffers
+ *
+ * \var CameraMemoryUsage::zslBuffers
+ * \brief Memory of the buffers of the zero shutter lag ring
+ */
+
+/**
+ * \fn CameraMemoryUsage::total()
+ * \brief Compute the total memory pinned by the camera
+ * \return The total memory pinned by the camera, in bytes
+ */
+
+/**
+ * \brief Assemble and return a string describing the memory usage
+ * \return A string describing the memory usage
+ */
+std::string CameraMemoryUsage::toString() const
+{
+	std::stringstream ss;
+
+	auto kib = [](uint64_t value) { return value / 1024; };
+
+	ss << "memory: " << kib(total()) << " KiB ("
+	   << kib(applicationBuffers) << " KiB application, "
+	   << kib(internalBuffers) << " KiB internal, "
+	   << kib(zslBuffers) << " KiB zero shutter lag)";
+
+	return ss.str();
+}
+
+/**
+ * \struct IPAMethodPerformance
+ * \brief Performance counters of a method of an IPA interface
+ *
+ * The counters are recorded by the IPA proxies on the pipeline handler side,
+ * and split the cost of the calls between the serialization of their
+ * arguments, the transfer to isolated IPA modules and the execution in IPA
+ * modules that run in the libcamera process. The execution of methods in
+ * isolated IPA modules takes place in another process, and is thus accounted
+ * for in the transit time of synchronous calls.
+ *
+ * \var IPAMethodPerformance::calls
+ * \brief Number of calls to the method
+ *
+ * \var IPAMethodPerformance::serialization
+ * \brief Time spent serializing the arguments and deserializing the results
+ * of calls to isolated IPA modules
+ *
+ * \var IPAMethodPerformance::transit
+ * \brief Time spent sending calls to isolated IPA modules, and waiting for
+ * the results of synchronous calls
+ *
+ * \var IPAMethodPerformance::execution
+ * \brief Time spent executing calls in IPA modules that are not isolated
+ */
+
+/**
+ * \brief Assemble and return a string describing the counters
+ * \return A string describing the counters
+ */
+std::string IPAMethodPerformance::toString() const
+{
+	std::stringstream ss;
+
+	ss << calls << " calls";
+
+	if (serialization.count())
+		ss << std::endl << "  serialization: " << serialization.toString();
+	if (transit.count())
+		ss << std::endl << "  transit: " << transit.toString();
+	if (execution.count())
+		ss << std::endl << "  execution: " << execution.toString();
+
+	return ss.str();
+}
+
+/**
+ * \struct CameraManagerPerformance
+ * \brief Performance counters of the whole library
+ *
+ * \var CameraManagerPerformance::ipcRoundTrip
+ * \brief Duration of the synchronous calls to isolated IPA modules
+ *
+ * \var CameraManagerPerformance::ipaMethods
+ * \brief Performance counters of the IPA interface methods, indexed by
+ * "module.method" name
+ *
+ * The counters of all the instances of an IPA module are accumulated.
+ *
+ * \var CameraManagerPerformance::bufferCacheHits
+ * \brief Number of buffers queued to V4L2 video devices that reused the
+ * V4L2 buffer used by the same FrameBuffer previously
+ *
+ * \var CameraManagerPerformance::bufferCacheMisses
+ * \brief Number of buffers queued to V4L2 video devices that required a new
+ * V4L2 buffer, causing a new dmabuf import in the kernel
+ *
+ * \var CameraManagerPerformance::mappedBufferMemory
+ * \brief Memory of the buffers currently mapped in the process memory with
+ * MappedFrameBuffer, in bytes
+ *
+ * This includes the mappings of pipeline handlers, of IPA modules that are not
+ * isolated, and of the Android camera HAL.
+ */
+
+/**
+ * \brief Assemble and return a string describing the counters
+ * \return A string describing the counters
+ */
+std::string CameraManagerPerformance::toString() const
+{
+	std::stringstream ss;
+
+	ss << "buffer cache: " << bufferCacheHits << " hits, "
+	   << bufferCacheMisses << " misses" << std::endl
+	   << "mapped buffers: " << mappedBufferMemory / 1024 << " KiB"
+	   << std::endl
+	   << "IPC round trip: " << ipcRoundTrip.toString();
+
+	for (const auto &[method, counters] : ipaMethods)
+		ss << std::endl << "IPA " << method << ": " << counters.toString();
+
+	return ss.str();
+}
+
+/**
+ * \class PerformanceRecorder
+ * \brief Record the library-wide performance counters
+ *
+ * The recorder is a process-wide singleton, as the components it collects
+ * counters from are not tied to a camera. It can be used from any thread.
+ */
+
+/**
+ * \brief Retrieve the performance recorder
+ * \return The performance recorder instance
+ */
+PerformanceRecorder *PerformanceRecorder::instance()
+{
+	static PerformanceRecorder recorder;
+	return &recorder;
+}
+
+/**
+ * \fn PerformanceRecorder::bufferCacheAccess()
+ * \brief Record a V4L2 buffer cache lookup
+ * \param[in] hit True if the lookup found a matching entry
+ */
+
+/**
+ * \fn PerformanceRecorder::bufferMapped()
+ * \brief Record the mapping or unmapping of buffer memory
+ * \param[in] size The size of the memory, positive when it is mapped and
+ * negative when it is unmapped
+ */
+
+/**
+ * \brief Record the duration of a synchronous IPC call
+ * \param[in] duration The duration of the call, in nanoseconds
+ */
+void PerformanceRecorder::ipcRoundTrip(uint64_t duration)
+{
+	MutexLocker locker(mutex_);
+	ipcRoundTrip_.add(duration);
+}
+
+/**
+ * \brief Record the cost of a call to an IPA interface method
+ * \param[in] call The profiler of the call
+ */
+void PerformanceRecorder::ipaCall(const IPACallProfiler &call)
+{
+	MutexLocker locker(mutex_);
+
+	auto iter = ipaMethods_.find(call.method_);
+	if (iter == ipaMethods_.end())
+		iter = ipaMethods_.emplace(call.method_, IPAMethodPerformance{}).first;
+
+	IPAMethodPerformance &counters = iter->second;
+	PerformanceHistogram *histograms[] = {
+		&counters.serialization,
+		&counters.transit,
+		&counters.execution,
+	};
+
+	counters.calls++;
+
+	for (unsigned int i = 0; i < IPACallProfiler::kNumPhases; ++i) {
+		if (call.entered_[i])
+			histograms[i]->add(call.durations_[i]);
+	}
+}
+
+/**
+ * \brief Retrieve a snapshot of the counters
+ * \return The library-wide performance counters
+ */
+CameraManagerPerformance PerformanceRecorder::snapshot() const
+{
+	CameraManagerPerformance performance;
+
+	performance.bufferCacheHits = bufferCacheHits_.load(std::memory_order_relaxed);
+	performance.bufferCacheMisses = bufferCacheMisses_.load(std::memory_order_relaxed);
+	performance.mappedBufferMemory = mappedBufferMemory_.load(std::memory_order_relaxed);
+
+	MutexLocker locker(mutex_);
+	performance.ipcRoundTrip = ipcRoundTrip_;
+	performance.ipaMethods = { ipaMethods_.begin(), ipaMethods_.end() };
+
+	return performance;
+}
+
+/**
+ * \class IPACallProfiler
+ * \brief Measure the cost of a call to an IPA interface method
+ *
+ * The IPA proxies create a profiler at the beginning of each call to the IPA
+ * interface methods. The duration of the call is split in phases, the profiler
+ * accumulates the time spent in each phase until it is destroyed, and then
+ * records the call with the PerformanceRecorder.
+ */
+
+/**
+ * \enum IPACallProfiler::Phase
+ * \brief Phases of a call to an IPA interface method
+ * \var IPACallProfiler::Serialization
+ * \brief Serialization of the arguments and deserialization of the results
+ * \var IPACallProfiler::Transit
+ * \brief Transfer of the call to an isolated IPA module
+ * \var IPACallProfiler::Execution
+ * \brief Execution of the call in an IPA module that is not isolated
+ */
+
+/**
+ * \brief Start profiling a call to an IPA interface method
+ * \param[in] method The name of the method, in the "module.method" form
+ * \param[in] phase The phase the call starts with
+ *
+ * The \a method string shall stay valid for the lifetime of the profiler.
+ */
+IPACallProfiler::IPACallProfiler(const char *method, Phase phase)
+	: method_(method), phase_(phase), last_(utils::clock::now()),
+	  durations_{}, entered_{}
+{
+	entered_[phase] = true;
+}
+
+IPACallProfiler::~IPACallProfiler()
+{
+	update();
+	PerformanceRecorder::instance()->ipaCall(*this);
+}
+
+/**
+ * \brief Switch the call to a new phase
+ * \param[in] phase The new phase
+ */
+void IPACallProfiler::enter(Phase phase)
+{
+	update();
+	phase_ = phase;
+	entered_[phase] = true;
+}
+
+void IPACallProfiler::update()
+{
+	utils::time_point now = utils::clock::now();
+	durations_[phase_] +=
+		std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_).count();
+	last_ = now;
+}
+
+} /* namespace libcamera */
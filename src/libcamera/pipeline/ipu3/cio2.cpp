@@ -226,14 +226,20 @@ int CIO2Device::exportBuffers(unsigned int count,
 
 int CIO2Device::start()
 {
-	int ret = output_->exportBuffers(CIO2_BUFFER_COUNT, &buffers_);
-	if (ret < 0)
-		return ret;
+	int ret;
 
-	ret = output_->importBuffers(CIO2_BUFFER_COUNT);
-	if (ret)
-		LOG(IPU3, Error) << "Failed to import CIO2 buffers";
+	/* Buffers are kept across stop() and start(), allocate them once. */
+	if (buffers_.empty()) {
+		ret = output_->exportBuffers(CIO2_BUFFER_COUNT, &buffers_);
+		if (ret < 0)
+			return ret;
+
+		ret = output_->importBuffers(CIO2_BUFFER_COUNT);
+		if (ret)
+			LOG(IPU3, Error) << "Failed to import CIO2 buffers";
+	}
 
+	availableBuffers_ = {};
 	for (std::unique_ptr<FrameBuffer> &buffer : buffers_)
 		availableBuffers_.push(buffer.get());
 
@@ -254,15 +260,9 @@ int CIO2Device::start()
 
 int CIO2Device::stop()
 {
-	int ret;
-
 	csi2_->setFrameStartEnabled(false);
 
-	ret = output_->streamOff();
-
-	freeBuffers();
-
-	return ret;
+	return output_->streamOff();
 }
 
 FrameBuffer *CIO2Device::queueBuffer(Request *request, FrameBuffer *rawBuffer)
@@ -47,20 +47,21 @@ public:
 
 	int start();
 	int stop();
+	void freeBuffers();
+	const std::vector<std::unique_ptr<FrameBuffer>> &buffers() const { return buffers_; }
 
 	CameraSensor *sensor() { return sensor_.get(); }
 	const CameraSensor *sensor() const { return sensor_.get(); }
 
 	FrameBuffer *queueBuffer(Request *request, FrameBuffer *rawBuffer);
 	void tryReturnBuffer(FrameBuffer *buffer);
+	void setCpuAccess(bool cpuAccess) { output_->setCpuAccess(cpuAccess); }
 	Signal<FrameBuffer *> &bufferReady() { return output_->bufferReady; }
 	Signal<uint32_t> &frameStart() { return csi2_->frameStart; }
 
 	Signal<> bufferAvailable;
 
 private:
-	void freeBuffers();
-
 	void cio2BufferReady(FrameBuffer *buffer);
 
 	std::unique_ptr<CameraSensor> sensor_;
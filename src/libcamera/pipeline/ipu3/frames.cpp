@@ -70,6 +70,9 @@ IPU3Frames::Info *IPU3Frames::create(Request *request)
 	info->rawBuffer = nullptr;
 	info->paramBuffer = paramBuffer;
 	info->statBuffer = statBuffer;
+	info->rawDequeued = false;
+	info->paramRequested = false;
+	info->paramFilled = false;
 	info->paramDequeued = false;
 	info->metadataProcessed = false;
 
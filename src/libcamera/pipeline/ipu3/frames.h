@@ -34,6 +34,9 @@ public:
 		FrameBuffer *paramBuffer;
 		FrameBuffer *statBuffer;
 
+		bool rawDequeued;
+		bool paramRequested;
+		bool paramFilled;
 		bool paramDequeued;
 		bool metadataProcessed;
 	};
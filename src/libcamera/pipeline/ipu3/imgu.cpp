@@ -68,7 +68,12 @@ const std::vector<float> gdcScalingFactors = {
 	14.25, 14.5, 14.75, 15, 15.25, 15.5, 15.75, 16,
 };
 
-std::vector<ImgUDevice::PipeConfig> pipeConfigs;
+/*
+ * The maximum number of pipe configurations cached by each ImgU. Applications
+ * validate a handful of configurations, this only bounds the memory used when
+ * they iterate over many sizes.
+ */
+static constexpr unsigned int PIPE_CONFIG_CACHE_SIZE = 32;
 
 struct FOV {
 	float w;
@@ -121,7 +126,8 @@ bool isSameRatio(const Size &in, const Size &out)
 }
 
 void calculateBDSHeight(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc,
-			unsigned int bdsWidth, float bdsSF)
+			unsigned int bdsWidth, float bdsSF,
+			std::vector<ImgUDevice::PipeConfig> &pipeConfigs)
 {
 	unsigned int minIFHeight = iif.height - IF_CROP_MAX_H;
 	unsigned int minBDSHeight = gdc.height + FILTER_H * 2;
@@ -197,7 +203,8 @@ void calculateBDSHeight(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc
 	}
 }
 
-void calculateBDS(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc, float bdsSF)
+void calculateBDS(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc, float bdsSF,
+		  std::vector<ImgUDevice::PipeConfig> &pipeConfigs)
 {
 	unsigned int minBDSWidth = gdc.width + FILTER_W * 2;
 	unsigned int minBDSHeight = gdc.height + FILTER_H * 2;
@@ -213,7 +220,8 @@ void calculateBDS(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc, floa
 			unsigned int bdsIntHeight = static_cast<unsigned int>(bdsHeight);
 			if (!(bdsIntWidth % BDS_ALIGN_W) && bdsWidth >= minBDSWidth &&
 			    !(bdsIntHeight % BDS_ALIGN_H) && bdsHeight >= minBDSHeight)
-				calculateBDSHeight(pipe, iif, gdc, bdsIntWidth, sf);
+				calculateBDSHeight(pipe, iif, gdc, bdsIntWidth, sf,
+						   pipeConfigs);
 		}
 
 		sf += BDS_SF_STEP;
@@ -230,7 +238,8 @@ void calculateBDS(ImgUDevice::Pipe *pipe, const Size &iif, const Size &gdc, floa
 			unsigned int bdsIntHeight = static_cast<unsigned int>(bdsHeight);
 			if (!(bdsIntWidth % BDS_ALIGN_W) && bdsWidth >= minBDSWidth &&
 			    !(bdsIntHeight % BDS_ALIGN_H) && bdsHeight >= minBDSHeight)
-				calculateBDSHeight(pipe, iif, gdc, bdsIntWidth, sf);
+				calculateBDSHeight(pipe, iif, gdc, bdsIntWidth, sf,
+						   pipeConfigs);
 		}
 
 		sf -= BDS_SF_STEP;
@@ -393,12 +402,50 @@ int ImgUDevice::init(MediaDevice *media, unsigned int index)
 /**
  * \brief Calculate the ImgU pipe configuration parameters
  * \param[in] pipe The requested ImgU configuration
+ *
+ * The search for the pipe configuration is costly, while applications
+ * typically validate the same configurations repeatedly. The results are thus
+ * cached for each combination of input, main and viewfinder sizes, including
+ * the combinations for which no configuration exists. The cache is bounded,
+ * and an entry is evicted to make room for new ones when it is full.
+ *
+ * \context This function is \threadsafe.
+ *
  * \return An ImgUDevice::PipeConfig instance on success, an empty configuration
  * otherwise
  */
 ImgUDevice::PipeConfig ImgUDevice::calculatePipeConfig(Pipe *pipe)
 {
-	pipeConfigs.clear();
+	std::lock_guard<std::mutex> locker(pipeConfigLock_);
+
+	auto key = std::make_tuple(pipe->input, pipe->main, pipe->viewfinder);
+	auto it = pipeConfigCache_.find(key);
+	if (it != pipeConfigCache_.end()) {
+		LOG(IPU3, Debug) << "Using cached pipe configuration for input "
+				 << pipe->input.toString() << ", main "
+				 << pipe->main.toString() << ", vf "
+				 << pipe->viewfinder.toString();
+		return it->second;
+	}
+
+	PipeConfig pipeConfig = computePipeConfig(pipe);
+
+	if (pipeConfigCache_.size() >= PIPE_CONFIG_CACHE_SIZE)
+		pipeConfigCache_.erase(pipeConfigCache_.begin());
+	pipeConfigCache_.emplace(key, pipeConfig);
+
+	return pipeConfig;
+}
+
+/**
+ * \brief Search for the ImgU pipe configuration parameters
+ * \param[in] pipe The requested ImgU configuration
+ * \return An ImgUDevice::PipeConfig instance on success, an empty configuration
+ * otherwise
+ */
+ImgUDevice::PipeConfig ImgUDevice::computePipeConfig(Pipe *pipe)
+{
+	std::vector<PipeConfig> pipeConfigs;
 
 	LOG(IPU3, Debug) << "Calculating pipe configuration for: ";
 	LOG(IPU3, Debug) << "input: " << pipe->input.toString();
@@ -430,7 +477,7 @@ ImgUDevice::PipeConfig ImgUDevice::calculatePipeConfig(Pipe *pipe)
 	while (ifWidth >= minIfWidth) {
 		while (ifHeight >= minIfHeight) {
 			Size iif{ ifWidth, ifHeight };
-			calculateBDS(pipe, iif, gdc, sf);
+			calculateBDS(pipe, iif, gdc, sf, pipeConfigs);
 			ifHeight -= IF_ALIGN_H;
 		}
 
@@ -449,7 +496,7 @@ ImgUDevice::PipeConfig ImgUDevice::calculatePipeConfig(Pipe *pipe)
 		 */
 		while (ifWidth >= minIfWidth) {
 			Size iif{ ifWidth, ifHeight };
-			calculateBDS(pipe, iif, gdc, sf);
+			calculateBDS(pipe, iif, gdc, sf, pipeConfigs);
 			ifWidth -= IF_ALIGN_W;
 		}
 
@@ -721,63 +768,41 @@ int ImgUDevice::stop()
 }
 
 /**
- * \brief Enable or disable a single link on the ImgU instance
- *
- * This method assumes the media device associated with the ImgU instance
- * is open.
- *
- * \return 0 on success or a negative error code otherwise
- */
-int ImgUDevice::linkSetup(const std::string &source, unsigned int sourcePad,
-			  const std::string &sink, unsigned int sinkPad,
-			  bool enable)
-{
-	MediaLink *link = media_->link(source, sourcePad, sink, sinkPad);
-	if (!link) {
-		LOG(IPU3, Error)
-			<< "Failed to get link: '" << source << "':"
-			<< sourcePad << " -> '" << sink << "':" << sinkPad;
-		return -ENODEV;
-	}
-
-	return link->setEnabled(enable);
-}
-
-/**
- * \brief Enable or disable all media links in the ImgU instance to prepare
- * for capture operations
+ * \brief Retrieve the media links of the ImgU instance used for capture
  *
- * \todo This method will probably be removed or changed once links will be
- * enabled or disabled selectively.
- *
- * \return 0 on success or a negative error code otherwise
+ * \return The media links, or an empty vector if any link can't be found
  */
-int ImgUDevice::enableLinks(bool enable)
+std::vector<MediaLink *> ImgUDevice::links() const
 {
 	std::string viewfinderName = name_ + " viewfinder";
 	std::string paramName = name_ + " parameters";
 	std::string outputName = name_ + " output";
 	std::string statName = name_ + " 3a stat";
 	std::string inputName = name_ + " input";
-	int ret;
 
-	ret = linkSetup(inputName, 0, name_, PAD_INPUT, enable);
-	if (ret)
-		return ret;
-
-	ret = linkSetup(name_, PAD_OUTPUT, outputName, 0, enable);
-	if (ret)
-		return ret;
-
-	ret = linkSetup(name_, PAD_VF, viewfinderName, 0, enable);
-	if (ret)
-		return ret;
+	const std::tuple<std::string, unsigned int, std::string, unsigned int> descs[] = {
+		{ inputName, 0, name_, PAD_INPUT },
+		{ name_, PAD_OUTPUT, outputName, 0 },
+		{ name_, PAD_VF, viewfinderName, 0 },
+		{ paramName, 0, name_, PAD_PARAM },
+		{ name_, PAD_STAT, statName, 0 },
+	};
+
+	std::vector<MediaLink *> links;
+
+	for (const auto &[source, sourcePad, sink, sinkPad] : descs) {
+		MediaLink *link = media_->link(source, sourcePad, sink, sinkPad);
+		if (!link) {
+			LOG(IPU3, Error)
+				<< "Failed to get link: '" << source << "':"
+				<< sourcePad << " -> '" << sink << "':" << sinkPad;
+			return {};
+		}
 
-	ret = linkSetup(paramName, 0, name_, PAD_PARAM, enable);
-	if (ret)
-		return ret;
+		links.push_back(link);
+	}
 
-	return linkSetup(name_, PAD_STAT, statName, 0, enable);
+	return links;
 }
 
 } /* namespace libcamera */
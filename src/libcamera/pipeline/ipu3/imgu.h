@@ -7,8 +7,13 @@
 #ifndef __LIBCAMERA_PIPELINE_IPU3_IMGU_H__
 #define __LIBCAMERA_PIPELINE_IPU3_IMGU_H__
 
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <tuple>
+
+#include <libcamera/geometry.h>
 
 #include "libcamera/internal/v4l2_subdevice.h"
 #include "libcamera/internal/v4l2_videodevice.h"
@@ -17,7 +22,6 @@ namespace libcamera {
 
 class FrameBuffer;
 class MediaDevice;
-class Size;
 struct StreamConfiguration;
 
 class ImgUDevice
@@ -67,7 +71,7 @@ public:
 	int start();
 	int stop();
 
-	int enableLinks(bool enable);
+	std::vector<MediaLink *> links() const;
 
 	std::unique_ptr<V4L2Subdevice> imgu_;
 	std::unique_ptr<V4L2VideoDevice> input_;
@@ -86,16 +90,18 @@ private:
 	static constexpr unsigned int PAD_VF = 3;
 	static constexpr unsigned int PAD_STAT = 4;
 
-	int linkSetup(const std::string &source, unsigned int sourcePad,
-		      const std::string &sink, unsigned int sinkPad,
-		      bool enable);
-
 	int configureVideoDevice(V4L2VideoDevice *dev, unsigned int pad,
 				 const StreamConfiguration &cfg,
 				 V4L2DeviceFormat *outputFormat);
 
+	PipeConfig computePipeConfig(Pipe *pipe);
+
 	std::string name_;
 	MediaDevice *media_;
+
+	/* Bounded cache of pipe configurations, keyed by input, main and vf. */
+	std::mutex pipeConfigLock_;
+	std::map<std::tuple<Size, Size, Size>, PipeConfig> pipeConfigCache_;
 };
 
 } /* namespace libcamera */
@@ -6,11 +6,19 @@
  */
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
 #include <iomanip>
 #include <memory>
 #include <queue>
+#include <set>
+#include <stdlib.h>
+#include <utility>
 #include <vector>
 
+#include <linux/intel-ipu3.h>
+
 #include <libcamera/camera.h>
 #include <libcamera/control_ids.h>
 #include <libcamera/formats.h>
@@ -27,6 +35,7 @@
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/pipeline_handler.h"
+#include "libcamera/internal/timer.h"
 #include "libcamera/internal/utils.h"
 
 #include "cio2.h"
@@ -47,7 +56,21 @@ static constexpr unsigned int IMGU_OUTPUT_WIDTH_MARGIN = 64;
 static constexpr unsigned int IMGU_OUTPUT_HEIGHT_MARGIN = 32;
 static constexpr Size IPU3ViewfinderSize(1280, 720);
 
+/* The largest number of frames the pipeline may process at the same time. */
+static constexpr unsigned int IPU3_MAX_PIPELINE_DEPTH = 3;
+
+static unsigned int ipu3PipelineDepth()
+{
+	const char *depth = utils::secure_getenv("LIBCAMERA_IPU3_PIPELINE_DEPTH");
+	if (!depth)
+		return 1;
+
+	return std::clamp<unsigned long>(strtoul(depth, nullptr, 10), 1,
+					 IPU3_MAX_PIPELINE_DEPTH);
+}
+
 static const ControlInfoMap::Map IPU3Controls = {
+	{ &controls::ExposureBracket, ControlInfo(-8.0f, 8.0f) },
 	{ &controls::draft::PipelineDepth, ControlInfo(2, 3) },
 };
 
@@ -55,8 +78,11 @@ class IPU3CameraData : public CameraData
 {
 public:
 	IPU3CameraData(PipelineHandler *pipe)
-		: CameraData(pipe), exposureTime_(0), supportsFlips_(false)
+		: CameraData(pipe), exposureTime_(0), supportsFlips_(false),
+		  pipelineDepth_(ipu3PipelineDepth()), paramsAhead_(0),
+		  ipaLateFrames_(0), lastSequence_(0), lastTimestamp_(0)
 	{
+		paramsTimer_.timeout.connect(this, &IPU3CameraData::paramsTimeout);
 	}
 
 	int loadIPA();
@@ -74,6 +100,8 @@ public:
 	Stream outStream_;
 	Stream vfStream_;
 	Stream rawStream_;
+	/* Formats of the raw stream, enumerated on demand. */
+	StreamFormats rawFormats_;
 
 	uint32_t exposureTime_;
 	Rectangle cropRegion_;
@@ -87,9 +115,42 @@ public:
 
 	std::queue<Request *> pendingRequests_;
 
+	/*
+	 * The number of frames whose parameters may be filled while the ImgU
+	 * processes the previous frame. With a depth of 1 the parameters of a
+	 * frame are only requested once the CIO2 has captured it.
+	 */
+	unsigned int pipelineDepth_;
+	/* The frames queued to the CIO2 whose parameters haven't been requested. */
+	std::deque<IPU3Frames::Info *> waitingParams_;
+	/* The number of frames whose parameters have been requested in advance. */
+	unsigned int paramsAhead_;
+
+	/*
+	 * The IPA has one frame interval to fill the parameters of a frame once
+	 * the CIO2 has captured it. A frame whose parameters are late is
+	 * processed by the ImgU without a parameters buffer, reusing the
+	 * parameters of the previous frame, and the parameters filled late are
+	 * discarded.
+	 */
+	Timer paramsTimer_;
+	std::deque<std::pair<unsigned int, utils::time_point>> paramsDeadlines_;
+	std::set<unsigned int> lateParams_;
+	int32_t ipaLateFrames_;
+
+	/* The frame interval measured between consecutive CIO2 frames. */
+	std::chrono::nanoseconds frameInterval_;
+	uint32_t lastSequence_;
+	uint64_t lastTimestamp_;
+
 private:
 	void queueFrameAction(unsigned int id,
 			      const ipa::ipu3::IPU3Action &action);
+	void fillParams(IPU3Frames::Info *info);
+	void fillParamsAhead();
+	void queueToImgU(IPU3Frames::Info *info);
+	void paramsTimeout(Timer *timer);
+	void startParamsTimer();
 };
 
 class IPU3CameraConfiguration : public CameraConfiguration
@@ -98,6 +159,8 @@ public:
 	IPU3CameraConfiguration(IPU3CameraData *data);
 
 	Status validate() override;
+	unsigned int minRequestDepth() const override;
+	unsigned int frameLatency() const override;
 
 	const StreamConfiguration &cio2Format() const { return cio2Configuration_; }
 	const ImgUDevice::PipeConfig imguConfig() const { return pipeConfig_; }
@@ -105,6 +168,9 @@ public:
 	/* Cache the combinedTransform_ that will be applied to the sensor */
 	Transform combinedTransform_;
 
+protected:
+	uint64_t internalFrameTraffic() const override;
+
 private:
 	/*
 	 * The IPU3CameraData instance is guaranteed to be valid as long as the
@@ -143,6 +209,8 @@ public:
 
 	bool match(DeviceEnumerator *enumerator) override;
 
+	void releaseDevice(Camera *camera) override;
+
 private:
 	IPU3CameraData *cameraData(const Camera *camera)
 	{
@@ -290,6 +358,15 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 
 		LOG(IPU3, Debug) << "Validating stream: " << config_[i].toString();
 
+		/*
+		 * The ImgU outputs are scaled from the same cropped image,
+		 * per-stream cropping isn't supported.
+		 */
+		if (!cfg->crop.isNull()) {
+			cfg->crop = {};
+			status = Adjusted;
+		}
+
 		if (info.colourEncoding == PixelFormatInfo::ColourEncodingRAW) {
 			/* Initialize the RAW stream with the CIO2 configuration. */
 			cfg->size = cio2Configuration_.size;
@@ -297,6 +374,8 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 			cfg->bufferCount = cio2Configuration_.bufferCount;
 			cfg->stride = info.stride(cfg->size.width, 0, 64);
 			cfg->frameSize = info.frameSize(cfg->size, 64);
+			if (adjustStrideAlign(cfg))
+				status = Adjusted;
 			cfg->setStream(const_cast<Stream *>(&data_->rawStream_));
 
 			LOG(IPU3, Debug) << "Assigned " << cfg->toString()
@@ -341,6 +420,8 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 			cfg->bufferCount = IPU3_BUFFER_COUNT;
 			cfg->stride = info.stride(cfg->size.width, 0, 1);
 			cfg->frameSize = info.frameSize(cfg->size, 1);
+			if (adjustStrideAlign(cfg))
+				status = Adjusted;
 
 			/*
 			 * Use the main output stream in case only one stream is
@@ -376,6 +457,12 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 		}
 	}
 
+	/* Don't keep more frames around than needed in low latency mode. */
+	if (lowLatency) {
+		for (StreamConfiguration &cfg : config_)
+			cfg.bufferCount = std::min(cfg.bufferCount, minRequestDepth());
+	}
+
 	/* Only compute the ImgU configuration if a YUV stream has been requested. */
 	if (yuvCount) {
 		pipeConfig_ = data_->imgu_->calculatePipeConfig(&pipe);
@@ -389,6 +476,50 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 	return status;
 }
 
+unsigned int IPU3CameraConfiguration::minRequestDepth() const
+{
+	/*
+	 * Each request is captured by the CIO2 and then processed by the ImgU,
+	 * keep one more ready for the next frame.
+	 */
+	return 3;
+}
+
+unsigned int IPU3CameraConfiguration::frameLatency() const
+{
+	/*
+	 * The CIO2 writes the frame to memory during its readout, and the ImgU
+	 * processes it in the next frame period. Filling the parameters ahead
+	 * doesn't delay the frames, the latency is the same in low latency
+	 * mode.
+	 */
+	return 2;
+}
+
+uint64_t IPU3CameraConfiguration::internalFrameTraffic() const
+{
+	uint64_t rawSize = frameSize(cio2Configuration_);
+
+	/*
+	 * The ImgU reads every raw frame from memory. The CIO2 writes it to an
+	 * internal buffer, unless it is captured by the raw stream.
+	 */
+	bool rawStream = std::any_of(config_.begin(), config_.end(),
+				     [&](const StreamConfiguration &cfg) {
+					     return cfg.stream() == &data_->rawStream_;
+				     });
+	uint64_t traffic = rawStream ? rawSize : 2 * rawSize;
+
+	/*
+	 * The IPA writes the parameters and reads the statistics, the ImgU
+	 * does the opposite.
+	 */
+	traffic += 2 * sizeof(struct ipu3_uapi_params);
+	traffic += 2 * sizeof(struct ipu3_uapi_stats_3a);
+
+	return traffic;
+}
+
 PipelineHandlerIPU3::PipelineHandlerIPU3(CameraManager *manager)
 	: PipelineHandler(manager), cio2MediaDev_(nullptr), imguMediaDev_(nullptr)
 {
@@ -405,7 +536,7 @@ CameraConfiguration *PipelineHandlerIPU3::generateConfiguration(Camera *camera,
 
 	Size sensorResolution = data->cio2_.sensor()->resolution();
 	for (const StreamRole role : roles) {
-		std::map<PixelFormat, std::vector<SizeRange>> streamFormats;
+		StreamFormats formats;
 		unsigned int bufferCount;
 		PixelFormat pixelFormat;
 		Size size;
@@ -428,7 +559,7 @@ CameraConfiguration *PipelineHandlerIPU3::generateConfiguration(Camera *camera,
 						       IMGU_OUTPUT_HEIGHT_MARGIN);
 			pixelFormat = formats::NV12;
 			bufferCount = IPU3_BUFFER_COUNT;
-			streamFormats[pixelFormat] = { { IMGU_OUTPUT_MIN_SIZE, size } };
+			formats = StreamFormats({ { pixelFormat, { { IMGU_OUTPUT_MIN_SIZE, size } } } });
 
 			break;
 
@@ -438,9 +569,7 @@ CameraConfiguration *PipelineHandlerIPU3::generateConfiguration(Camera *camera,
 			pixelFormat = cio2Config.pixelFormat;
 			size = cio2Config.size;
 			bufferCount = cio2Config.bufferCount;
-
-			for (const PixelFormat &format : data->cio2_.formats())
-				streamFormats[format] = data->cio2_.sizes();
+			formats = data->rawFormats_;
 
 			break;
 		}
@@ -457,7 +586,7 @@ CameraConfiguration *PipelineHandlerIPU3::generateConfiguration(Camera *camera,
 							      IMGU_OUTPUT_HEIGHT_ALIGN);
 			pixelFormat = formats::NV12;
 			bufferCount = IPU3_BUFFER_COUNT;
-			streamFormats[pixelFormat] = { { IMGU_OUTPUT_MIN_SIZE, size } };
+			formats = StreamFormats({ { pixelFormat, { { IMGU_OUTPUT_MIN_SIZE, size } } } });
 
 			break;
 		}
@@ -469,7 +598,6 @@ CameraConfiguration *PipelineHandlerIPU3::generateConfiguration(Camera *camera,
 			return nullptr;
 		}
 
-		StreamFormats formats(streamFormats);
 		StreamConfiguration cfg(formats);
 		cfg.size = size;
 		cfg.pixelFormat = pixelFormat;
@@ -495,6 +623,13 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	V4L2DeviceFormat outputFormat;
 	int ret;
 
+	/*
+	 * Internal buffers are kept across stop() and start() but depend on
+	 * the configuration of the video devices, free them before changing
+	 * formats.
+	 */
+	freeBuffers(camera);
+
 	/*
 	 * FIXME: enabled links in one ImgU pipe interfere with capture
 	 * operations on the other one. This can be easily triggered by
@@ -512,28 +647,29 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	 * would be 'stop()', but the Camera class state machine allows
 	 * start()<->stop() sequences without any configure() in between.
 	 *
-	 * As of now, disable all links in the ImgU media graph before
-	 * configuring the device, to allow alternate the usage of the two
-	 * ImgU pipes.
+	 * As of now, enable the links of the ImgU used by the camera and
+	 * disable all other links in the ImgU media graph before configuring
+	 * the device, to allow alternate the usage of the two ImgU pipes.
+	 * Links that are already in the right state, as when reconfiguring
+	 * the same camera, are left untouched.
 	 *
 	 * As a consequence, a Camera using an ImgU shall be configured before
 	 * any start()/stop() sequence. An application that wants to
 	 * pre-configure all the camera and then start/stop them alternatively
 	 * without going through any re-configuration (a sequence that is
 	 * allowed by the Camera state machine) would now fail on the IPU3.
-	 */
-	ret = imguMediaDev_->disableLinks();
-	if (ret)
-		return ret;
-
-	/*
+	 *
 	 * \todo: Enable links selectively based on the requested streams.
 	 * As of now, enable all links unconditionally.
 	 * \todo Don't configure the ImgU at all if we only have a single
 	 * stream which is for raw capture, in which case no buffers will
 	 * ever be queued to the ImgU.
 	 */
-	ret = data->imgu_->enableLinks(true);
+	std::vector<MediaLink *> links = data->imgu_->links();
+	if (links.empty())
+		return -ENODEV;
+
+	ret = imguMediaDev_->setupLinks(links);
 	if (ret)
 		return ret;
 
@@ -547,6 +683,17 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	if (ret)
 		return ret;
 
+	/*
+	 * The CPU only accesses the raw frames captured for the application,
+	 * the ImgU input reads them from the device.
+	 */
+	bool rawStream = std::any_of(config->begin(), config->end(),
+				     [&](const StreamConfiguration &cfg) {
+					     return cfg.stream() == &data->rawStream_;
+				     });
+	cio2->setCpuAccess(rawStream);
+	imgu->input_->setCpuAccess(false);
+
 	IPACameraSensorInfo sensorInfo;
 	cio2->sensor()->sensorInfo(&sensorInfo);
 	data->cropRegion_ = sensorInfo.analogCrop;
@@ -653,6 +800,9 @@ int PipelineHandlerIPU3::exportFrameBuffers(Camera *camera, Stream *stream,
 	IPU3CameraData *data = cameraData(camera);
 	unsigned int count = stream->configuration().bufferCount;
 
+	/* Buffers can only be exported from devices without buffers. */
+	freeBuffers(camera);
+
 	if (stream == &data->outStream_)
 		return data->imgu_->output_->exportBuffers(count, buffers);
 	else if (stream == &data->vfStream_)
@@ -670,6 +820,10 @@ int PipelineHandlerIPU3::exportFrameBuffers(Camera *camera, Stream *stream,
  *
  * In order to be able to start the 'viewfinder' and 'stat' nodes, we need
  * memory to be reserved.
+ *
+ * The buffers and their IPA mappings are kept across stop() and start() to
+ * speed up restarting the camera, and are only freed when the camera is
+ * reconfigured or released, or when buffers are exported.
  */
 int PipelineHandlerIPU3::allocateBuffers(Camera *camera)
 {
@@ -678,13 +832,21 @@ int PipelineHandlerIPU3::allocateBuffers(Camera *camera)
 	unsigned int bufferCount;
 	int ret;
 
+	if (!ipaBuffers_.empty())
+		return 0;
+
 	bufferCount = std::max({
 		data->outStream_.configuration().bufferCount,
 		data->vfStream_.configuration().bufferCount,
 		data->rawStream_.configuration().bufferCount,
 	});
 
-	ret = imgu->allocateBuffers(bufferCount);
+	/*
+	 * Frames whose parameters are filled in advance hold their parameters
+	 * and statistics buffers longer, allocate spare ones to avoid stalling
+	 * the requests queued behind them.
+	 */
+	ret = imgu->allocateBuffers(bufferCount + data->pipelineDepth_ - 1);
 	if (ret < 0)
 		return ret;
 
@@ -703,10 +865,6 @@ int PipelineHandlerIPU3::allocateBuffers(Camera *camera)
 
 	data->ipa_->mapBuffers(ipaBuffers_);
 
-	data->frameInfos_.init(imgu->paramBuffers_, imgu->statBuffers_);
-	data->frameInfos_.bufferAvailable.connect(
-		data, &IPU3CameraData::queuePendingRequests);
-
 	return 0;
 }
 
@@ -714,6 +872,9 @@ int PipelineHandlerIPU3::freeBuffers(Camera *camera)
 {
 	IPU3CameraData *data = cameraData(camera);
 
+	if (ipaBuffers_.empty())
+		return 0;
+
 	data->frameInfos_.clear();
 
 	std::vector<unsigned int> ids;
@@ -724,15 +885,23 @@ int PipelineHandlerIPU3::freeBuffers(Camera *camera)
 	ipaBuffers_.clear();
 
 	data->imgu_->freeBuffers();
+	data->cio2_.freeBuffers();
+	data->clearInternalBuffers();
 
 	return 0;
 }
 
-int PipelineHandlerIPU3::start(Camera *camera, [[maybe_unused]] const ControlList *controls)
+void PipelineHandlerIPU3::releaseDevice(Camera *camera)
+{
+	freeBuffers(camera);
+}
+
+int PipelineHandlerIPU3::start(Camera *camera, const ControlList *controls)
 {
 	IPU3CameraData *data = cameraData(camera);
 	CIO2Device *cio2 = &data->cio2_;
 	ImgUDevice *imgu = data->imgu_;
+	int32_t syncMode;
 	int ret;
 
 	/* Allocate buffers for internal pipeline usage. */
@@ -740,6 +909,25 @@ int PipelineHandlerIPU3::start(Camera *camera, [[maybe_unused]] const ControlLis
 	if (ret)
 		return ret;
 
+	data->frameInfos_.init(imgu->paramBuffers_, imgu->statBuffers_);
+	data->waitingParams_.clear();
+	data->paramsAhead_ = 0;
+	data->lateParams_.clear();
+	data->ipaLateFrames_ = 0;
+	data->frameInterval_ = std::chrono::nanoseconds(0);
+	data->lastTimestamp_ = 0;
+
+	/* Select the frame synchronisation mode before streaming starts. */
+	syncMode = controls::SensorSyncOff;
+	if (controls && controls->contains(controls::SENSOR_SYNC_MODE))
+		syncMode = controls->get(controls::SensorSyncMode);
+
+	ret = cio2->sensor()->setSyncMode(syncMode);
+	if (ret) {
+		LOG(IPU3, Error) << "Failed to set the frame synchronisation mode";
+		goto error;
+	}
+
 	ret = data->ipa_->start();
 	if (ret)
 		goto error;
@@ -752,6 +940,15 @@ int PipelineHandlerIPU3::start(Camera *camera, [[maybe_unused]] const ControlLis
 	if (ret)
 		goto error;
 
+	/* The CIO2 buffers are allocated on the first start. */
+	data->clearInternalBuffers();
+	for (const std::unique_ptr<FrameBuffer> &buffer : cio2->buffers())
+		data->accountInternalBuffer(buffer.get());
+	for (const std::unique_ptr<FrameBuffer> &buffer : imgu->paramBuffers_)
+		data->accountInternalBuffer(buffer.get());
+	for (const std::unique_ptr<FrameBuffer> &buffer : imgu->statBuffers_)
+		data->accountInternalBuffer(buffer.get());
+
 	ret = imgu->start();
 	if (ret)
 		goto error;
@@ -782,7 +979,12 @@ void PipelineHandlerIPU3::stop(Camera *camera)
 	if (ret)
 		LOG(IPU3, Warning) << "Failed to stop camera " << camera->id();
 
-	freeBuffers(camera);
+	/* Keep the buffers allocated for the next start(). */
+	data->frameInfos_.clear();
+	data->waitingParams_.clear();
+	data->paramsAhead_ = 0;
+	data->paramsTimer_.stop();
+	data->paramsDeadlines_.clear();
 }
 
 void IPU3CameraData::cancelPendingRequests()
@@ -829,14 +1031,133 @@ void IPU3CameraData::queuePendingRequests()
 
 		info->rawBuffer = rawBuffer;
 
+		/*
+		 * Alternate the exposure time frame by frame on top of the
+		 * exposure computed by the IPA.
+		 */
+		if (request->controls().contains(controls::ExposureBracket)) {
+			std::vector<double> gains;
+			for (float ev : request->controls().get(controls::ExposureBracket))
+				gains.push_back(std::exp2(ev));
+
+			delayedCtrls_->setBracket(V4L2_CID_EXPOSURE, gains);
+		}
+
 		ipa::ipu3::IPU3Event ev;
 		ev.op = ipa::ipu3::EventProcessControls;
 		ev.frame = info->id;
 		ev.controls = request->controls();
 		ipa_->processEvent(ev);
 
+		waitingParams_.push_back(info);
+
 		pendingRequests_.pop();
 	}
+
+	fillParamsAhead();
+}
+
+/**
+ * \brief Ask the IPA to fill the parameters buffer of a frame
+ * \param[in] info The frame information
+ *
+ * Parameters are requested in the frame capture order, the IPA signals
+ * completion with an ActionParamFilled action.
+ */
+void IPU3CameraData::fillParams(IPU3Frames::Info *info)
+{
+	info->paramRequested = true;
+
+	ipa::ipu3::IPU3Event ev;
+	ev.op = ipa::ipu3::EventFillParams;
+	ev.frame = info->id;
+	ev.bufferId = info->paramBuffer->cookie();
+	ipa_->processEvent(ev);
+}
+
+/**
+ * \brief Request the parameters of the next frames ahead of their capture
+ *
+ * Up to pipelineDepth_ - 1 frames get their parameters filled before the
+ * CIO2 completes them, so that they can be queued to the ImgU as soon as
+ * their raw buffer is available.
+ */
+void IPU3CameraData::fillParamsAhead()
+{
+	while (paramsAhead_ + 1 < pipelineDepth_ && !waitingParams_.empty()) {
+		IPU3Frames::Info *info = waitingParams_.front();
+		waitingParams_.pop_front();
+
+		fillParams(info);
+		paramsAhead_++;
+	}
+}
+
+/**
+ * \brief Queue a frame to the ImgU
+ * \param[in] info The frame information
+ *
+ * The frame must have both its raw buffer captured and its parameters filled.
+ */
+void IPU3CameraData::queueToImgU(IPU3Frames::Info *info)
+{
+	/* Queue all buffers from the request aimed for the ImgU. */
+	for (auto it : info->request->buffers()) {
+		const Stream *stream = it.first;
+		FrameBuffer *outbuffer = it.second;
+
+		if (stream == &outStream_)
+			imgu_->output_->queueBuffer(outbuffer);
+		else if (stream == &vfStream_)
+			imgu_->viewfinder_->queueBuffer(outbuffer);
+	}
+
+	/* Without a parameters buffer the ImgU keeps the previous parameters. */
+	if (!lateParams_.count(info->id))
+		imgu_->param_->queueBuffer(info->paramBuffer);
+	imgu_->stat_->queueBuffer(info->statBuffer);
+	imgu_->input_->queueBuffer(info->rawBuffer);
+}
+
+/**
+ * \brief Process the frames whose parameters missed their deadline
+ *
+ * The frames are queued to the ImgU with the parameters of the previous frame,
+ * the parameters buffer is released when the IPA catches up.
+ */
+void IPU3CameraData::paramsTimeout([[maybe_unused]] Timer *timer)
+{
+	utils::time_point now = utils::clock::now();
+
+	while (!paramsDeadlines_.empty() && paramsDeadlines_.front().second <= now) {
+		IPU3Frames::Info *info = frameInfos_.find(paramsDeadlines_.front().first);
+		paramsDeadlines_.pop_front();
+		if (!info)
+			continue;
+
+		LOG(IPU3, Debug) << "IPA late filling the parameters of frame "
+				 << info->id << ", using the previous parameters";
+
+		Request *request = info->request;
+		request->metadata().set(controls::IpaLate, true);
+		request->metadata().set(controls::IpaLateFrames, ++ipaLateFrames_);
+
+		/* The parameters buffer is never queued to the ImgU. */
+		info->paramDequeued = true;
+		lateParams_.insert(info->id);
+
+		queueToImgU(info);
+	}
+
+	startParamsTimer();
+}
+
+void IPU3CameraData::startParamsTimer()
+{
+	if (paramsDeadlines_.empty())
+		paramsTimer_.stop();
+	else
+		paramsTimer_.start(paramsDeadlines_.front().second);
 }
 
 int PipelineHandlerIPU3::queueRequestDevice(Camera *camera, Request *request)
@@ -1041,6 +1362,9 @@ int PipelineHandlerIPU3::initControls(IPU3CameraData *data)
 
 	controls[&controls::ScalerCrop] = ControlInfo(minCrop, maxCrop, maxCrop);
 
+	if (!sensor->syncModes().empty())
+		controls[&controls::SensorSyncMode] = ControlInfo(sensor->syncModes());
+
 	data->controlInfo_ = std::move(controls);
 
 	return 0;
@@ -1095,6 +1419,13 @@ int PipelineHandlerIPU3::registerCameras()
 		/* Initialize the camera properties. */
 		data->properties_ = cio2->sensor()->properties();
 
+		data->rawFormats_ = StreamFormats([cio2]() {
+			StreamFormats::FormatsMap formats;
+			for (const PixelFormat &format : cio2->formats())
+				formats[format] = cio2->sizes();
+			return formats;
+		});
+
 		ret = initControls(data.get());
 		if (ret)
 			continue;
@@ -1155,6 +1486,8 @@ int PipelineHandlerIPU3::registerCameras()
 					&IPU3CameraData::cio2BufferReady);
 		data->cio2_.bufferAvailable.connect(
 			data.get(), &IPU3CameraData::queuePendingRequests);
+		data->frameInfos_.bufferAvailable.connect(
+			data.get(), &IPU3CameraData::queuePendingRequests);
 		data->imgu_->input_->bufferReady.connect(&data->cio2_,
 					&CIO2Device::tryReturnBuffer);
 		data->imgu_->output_->bufferReady.connect(data.get(),
@@ -1212,24 +1545,33 @@ void IPU3CameraData::queueFrameAction(unsigned int id,
 		break;
 	}
 	case ipa::ipu3::ActionParamFilled: {
+		/* The frame has been processed with the previous parameters. */
+		if (lateParams_.erase(id))
+			break;
+
 		IPU3Frames::Info *info = frameInfos_.find(id);
 		if (!info)
 			break;
 
-		/* Queue all buffers from the request aimed for the ImgU. */
-		for (auto it : info->request->buffers()) {
-			const Stream *stream = it.first;
-			FrameBuffer *outbuffer = it.second;
-
-			if (stream == &outStream_)
-				imgu_->output_->queueBuffer(outbuffer);
-			else if (stream == &vfStream_)
-				imgu_->viewfinder_->queueBuffer(outbuffer);
+		auto deadline = std::find_if(paramsDeadlines_.begin(),
+					     paramsDeadlines_.end(),
+					     [id](const auto &entry) {
+						     return entry.first == id;
+					     });
+		if (deadline != paramsDeadlines_.end()) {
+			bool first = deadline == paramsDeadlines_.begin();
+			paramsDeadlines_.erase(deadline);
+			if (first)
+				startParamsTimer();
 		}
 
-		imgu_->param_->queueBuffer(info->paramBuffer);
-		imgu_->stat_->queueBuffer(info->statBuffer);
-		imgu_->input_->queueBuffer(info->rawBuffer);
+		/*
+		 * Parameters filled ahead of the capture wait for the CIO2 to
+		 * complete the raw buffer.
+		 */
+		info->paramFilled = true;
+		if (info->rawDequeued)
+			queueToImgU(info);
 
 		break;
 	}
@@ -1240,6 +1582,8 @@ void IPU3CameraData::queueFrameAction(unsigned int id,
 
 		Request *request = info->request;
 		request->metadata().merge(action.controls);
+		request->metadata().set(controls::IpaDoneTimestamp,
+					static_cast<int64_t>(utils::boottime()));
 
 		info->metadataProcessed = true;
 		if (frameInfos_.tryComplete(info))
@@ -1271,8 +1615,6 @@ void IPU3CameraData::imguOutputBufferReady(FrameBuffer *buffer)
 
 	Request *request = info->request;
 
-	pipe_->completeBuffer(request, buffer);
-
 	request->metadata().set(controls::draft::PipelineDepth, 3);
 	/* \todo Move the ExposureTime control to the IPA. */
 	request->metadata().set(controls::ExposureTime, exposureTime_);
@@ -1280,6 +1622,10 @@ void IPU3CameraData::imguOutputBufferReady(FrameBuffer *buffer)
 	if (request->controls().contains(controls::ScalerCrop))
 		cropRegion_ = request->controls().get(controls::ScalerCrop);
 	request->metadata().set(controls::ScalerCrop, cropRegion_);
+	request->metadata().set(controls::IspDoneTimestamp,
+				static_cast<int64_t>(buffer->metadata().dequeueTimestamp));
+
+	pipe_->completeBuffer(request, buffer);
 
 	if (frameInfos_.tryComplete(info))
 		pipe_->completeRequest(request);
@@ -1308,6 +1654,14 @@ void IPU3CameraData::cio2BufferReady(FrameBuffer *buffer)
 	 */
 	request->metadata().set(controls::SensorTimestamp,
 				buffer->metadata().timestamp);
+	request->metadata().set(controls::FrameDequeueTimestamp,
+				static_cast<int64_t>(buffer->metadata().dequeueTimestamp));
+	request->metadata().set(controls::IpaLate, false);
+	request->metadata().set(controls::IpaLateFrames, ipaLateFrames_);
+
+	int bracket = delayedCtrls_->bracketIndex(buffer->metadata().sequence);
+	if (bracket >= 0)
+		request->metadata().set(controls::ExposureBracketIndex, bracket);
 
 	/* If the buffer is cancelled force a complete of the whole request. */
 	if (buffer->metadata().status == FrameMetadata::FrameCancelled) {
@@ -1317,6 +1671,13 @@ void IPU3CameraData::cio2BufferReady(FrameBuffer *buffer)
 			pipe_->completeBuffer(request, b);
 		}
 
+		if (info->paramRequested)
+			paramsAhead_--;
+		else
+			waitingParams_.erase(std::find(waitingParams_.begin(),
+						       waitingParams_.end(),
+						       info));
+
 		frameInfos_.remove(info);
 		pipe_->completeRequest(request);
 		return;
@@ -1325,11 +1686,36 @@ void IPU3CameraData::cio2BufferReady(FrameBuffer *buffer)
 	if (request->findBuffer(&rawStream_))
 		pipe_->completeBuffer(request, buffer);
 
-	ipa::ipu3::IPU3Event ev;
-	ev.op = ipa::ipu3::EventFillParams;
-	ev.frame = info->id;
-	ev.bufferId = info->paramBuffer->cookie();
-	ipa_->processEvent(ev);
+	info->rawDequeued = true;
+
+	/* Measure the frame interval to derive the IPA deadlines. */
+	const FrameMetadata &metadata = buffer->metadata();
+	if (lastTimestamp_ && metadata.sequence == lastSequence_ + 1 &&
+	    metadata.timestamp > lastTimestamp_)
+		frameInterval_ = std::chrono::nanoseconds(metadata.timestamp - lastTimestamp_);
+	lastSequence_ = metadata.sequence;
+	lastTimestamp_ = metadata.timestamp;
+
+	/*
+	 * Frames are captured in order, so a frame whose parameters haven't
+	 * been requested yet is at the front of the waiting queue.
+	 */
+	if (info->paramRequested) {
+		paramsAhead_--;
+		if (info->paramFilled)
+			queueToImgU(info);
+	} else {
+		waitingParams_.pop_front();
+		fillParams(info);
+	}
+
+	if (!info->paramFilled && frameInterval_.count()) {
+		paramsDeadlines_.emplace_back(info->id, utils::clock::now() + frameInterval_);
+		if (paramsDeadlines_.size() == 1)
+			startParamsTimer();
+	}
+
+	fillParamsAhead();
 }
 
 void IPU3CameraData::paramBufferReady(FrameBuffer *buffer)
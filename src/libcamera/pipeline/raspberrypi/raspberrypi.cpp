@@ -5,11 +5,16 @@
  * raspberrypi.cpp - Pipeline handler for Raspberry Pi devices
  */
 #include <algorithm>
+#include <array>
 #include <assert.h>
+#include <chrono>
+#include <cmath>
+#include <deque>
 #include <fcntl.h>
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <stdlib.h>
 #include <sys/mman.h>
 #include <unordered_set>
 
@@ -32,13 +37,15 @@
 #include "libcamera/internal/camera_sensor.h"
 #include "libcamera/internal/delayed_controls.h"
 #include "libcamera/internal/device_enumerator.h"
+#include "libcamera/internal/dma_heaps.h"
 #include "libcamera/internal/ipa_manager.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/pipeline_handler.h"
+#include "libcamera/internal/timer.h"
 #include "libcamera/internal/utils.h"
 #include "libcamera/internal/v4l2_videodevice.h"
 
-#include "dma_heaps.h"
+#include "rpi_buffer_matcher.h"
 #include "rpi_stream.h"
 
 namespace libcamera {
@@ -47,7 +54,41 @@ LOG_DEFINE_CATEGORY(RPI)
 
 namespace {
 
-bool isRaw(PixelFormat &pixFmt)
+/* The largest number of frames the pipeline may process at the same time. */
+constexpr unsigned int MaxPipelineDepth = 3;
+
+/*
+ * The smallest number of Unicam image buffers to capture to, and the smallest
+ * number of them to allocate internally when the application supplies raw
+ * buffers.
+ */
+constexpr unsigned int MinUnicamBuffers = MaxPipelineDepth + 1;
+constexpr unsigned int MinInternalRawBuffers = 2;
+
+unsigned int pipelineDepth()
+{
+	const char *depth = utils::secure_getenv("LIBCAMERA_RPI_PIPELINE_DEPTH");
+	if (!depth)
+		return 1;
+
+	return std::clamp<unsigned long>(strtoul(depth, nullptr, 10), 1,
+					 MaxPipelineDepth);
+}
+
+StreamFormats::FormatsMap toFormatsMap(const V4L2VideoDevice::Formats &fmts)
+{
+	/* Translate the V4L2PixelFormat to PixelFormat. */
+	StreamFormats::FormatsMap formats;
+	for (const auto &format : fmts) {
+		PixelFormat pf = format.first.toPixelFormat();
+		if (pf.isValid())
+			formats[pf] = format.second;
+	}
+
+	return formats;
+}
+
+bool isRaw(const PixelFormat &pixFmt)
 {
 	/*
 	 * The isRaw test might be redundant right now the pipeline handler only
@@ -73,8 +114,29 @@ double scoreFormat(double desired, double actual)
 	return score;
 }
 
+/*
+ * Find the sensor mode that outputs a Unicam format. The formats only differ
+ * from the sensor media bus codes by their packing in memory, so match the
+ * size and bit depth.
+ */
+const CameraSensorMode *findSensorMode(const CameraSensor *sensor,
+				       const V4L2PixelFormat &v4l2Format,
+				       const Size &size)
+{
+	const PixelFormatInfo &info = PixelFormatInfo::info(v4l2Format);
+
+	for (const CameraSensorMode &mode : sensor->modes()) {
+		if (mode.format.size == size &&
+		    mode.format.bitsPerPixel() == info.bitsPerPixel)
+			return &mode;
+	}
+
+	return nullptr;
+}
+
 V4L2DeviceFormat findBestMode(V4L2VideoDevice::Formats &formatsMap,
-			      const Size &req)
+			      const Size &req, const CameraSensor *sensor,
+			      uint64_t maxFrameDuration = 0)
 {
 	double bestScore = std::numeric_limits<double>::max(), score;
 	V4L2DeviceFormat bestMode;
@@ -84,6 +146,7 @@ V4L2DeviceFormat findBestMode(V4L2VideoDevice::Formats &formatsMap,
 #define PENALTY_10BIT		1000.0
 #define PENALTY_12BIT		   0.0
 #define PENALTY_UNPACKED	 500.0
+#define PENALTY_FRAME_RATE	1.0e6
 
 	/* Calculate the closest/best mode from the user requested size. */
 	for (const auto &iter : formatsMap) {
@@ -112,6 +175,21 @@ V4L2DeviceFormat findBestMode(V4L2VideoDevice::Formats &formatsMap,
 			else if (info.bitsPerPixel == 8)
 				score += PENALTY_8BIT;
 
+			/*
+			 * Modes too slow for the requested frame duration are
+			 * only selected when no mode is fast enough, in which
+			 * case the fastest one wins. The minimum frame duration
+			 * of the modes accounts for their binning or skipping,
+			 * and for the CSI-2 link, from which the sensor drivers
+			 * derive their pixel rate and blanking limits.
+			 */
+			const CameraSensorMode *mode =
+				findSensorMode(sensor, v4l2Format, Size(modeWidth, modeHeight));
+			uint64_t minFrameDuration = mode ? mode->minFrameDuration : 0;
+			if (maxFrameDuration && minFrameDuration > maxFrameDuration)
+				score += PENALTY_FRAME_RATE +
+					 (minFrameDuration - maxFrameDuration) / 1000.0;
+
 			if (score <= bestScore) {
 				bestScore = score;
 				bestMode.fourcc = v4l2Format;
@@ -120,6 +198,7 @@ V4L2DeviceFormat findBestMode(V4L2VideoDevice::Formats &formatsMap,
 
 			LOG(RPI, Info) << "Mode: " << modeWidth << "x" << modeHeight
 				       << " fmt " << v4l2Format.toString()
+				       << " max fps " << (mode ? mode->maxFrameRate() : 0.0)
 				       << " Score: " << score
 				       << " (best " << bestScore << ")";
 		}
@@ -133,14 +212,60 @@ enum class Isp : unsigned int { Input, Output0, Output1, Stats };
 
 } /* namespace */
 
+class RPiCameraData;
+
+/*
+ * Compute Modules have two CSI-2 receivers, but a single ISP. The ISP is then
+ * time-multiplexed between the cameras: it processes one frame at a time, and
+ * the cameras take turns in the order their frames become ready, so that each
+ * gets an equal share of the ISP. The ISP only has a single set of formats,
+ * controls and buffers, the ones of a camera are applied to the device when
+ * the ISP switches to it.
+ */
+class IspScheduler
+{
+public:
+	IspScheduler(const Size &minCropSize)
+		: minCropSize_(minCropSize), active_(nullptr), running_(false)
+	{
+	}
+
+	const Size &minCropSize() const { return minCropSize_; }
+
+	void queueJob(RPiCameraData *data);
+	void jobDone(RPiCameraData *data);
+	void stop(RPiCameraData *data);
+
+private:
+	void schedule();
+
+	Size minCropSize_;
+
+	/* The cameras with a frame waiting for the ISP, in arrival order. */
+	std::deque<RPiCameraData *> jobs_;
+	/* The camera the ISP is configured for, and whether it is busy. */
+	RPiCameraData *active_;
+	bool running_;
+};
+
 class RPiCameraData : public CameraData
 {
 public:
 	RPiCameraData(PipelineHandler *pipe)
-		: CameraData(pipe), state_(State::Stopped),
+		: CameraData(pipe), dmaHeap_(DmaHeap::Contiguous),
+		  state_(State::Stopped), pipelineDepth_(pipelineDepth()),
+		  lowLatency_(false), framesInFlight_(0), framesIpaComplete_(0),
+		  ipaPreparing_(false), ispBusy_(false),
+		  matcher_([this](FrameBuffer *buffer) { unicam_[Unicam::Image].queueBuffer(buffer); },
+			   [this](FrameBuffer *buffer) { unicam_[Unicam::Embedded].queueBuffer(buffer); }),
 		  supportsFlips_(false), flipsAlterBayerOrder_(false),
-		  dropFrameCount_(0), ispOutputCount_(0)
+		  ispScheduler_(nullptr), ispCropChanged_(false), ispJobBuffers_(0),
+		  dropFrameCount_(0), preparingBuffer_(nullptr), latePrepares_(0),
+		  lateStats_(0), ipaLateFrames_(0), lastSequence_(0),
+		  lastTimestamp_(0), ispOutputCount_(0)
 	{
+		prepareTimer_.timeout.connect(this, &RPiCameraData::prepareTimeout);
+		statsTimer_.timeout.connect(this, &RPiCameraData::statsTimeout);
 	}
 
 	void frameStarted(uint32_t sequence);
@@ -151,11 +276,15 @@ public:
 	void statsMetadataComplete(uint32_t bufferId, const ControlList &controls);
 	void runIsp(uint32_t bufferId);
 	void embeddedComplete(uint32_t bufferId);
+	void prepareTimeout(Timer *timer);
+	void statsTimeout(Timer *timer);
 	void setIspControls(const ControlList &controls);
 	void setDelayedControls(const ControlList &controls);
+	void setLensControls(const ControlList &controls);
 
 	/* bufferComplete signal handlers. */
 	void unicamBufferDequeue(FrameBuffer *buffer);
+	void unicamBatchDequeued();
 	void ispInputDequeue(FrameBuffer *buffer);
 	void ispOutputDequeue(FrameBuffer *buffer);
 
@@ -164,6 +293,16 @@ public:
 	void handleExternalBuffer(FrameBuffer *buffer, RPi::Stream *stream);
 	void handleState();
 	void applyScalerCrop(const ControlList &controls);
+	void applyExposureBracket(const ControlList &controls);
+
+	/* Sharing the ISP with other cameras. */
+	void setIspScheduler(IspScheduler *scheduler);
+	int setIspFormat(Isp isp, V4L2DeviceFormat *format);
+	int allocateIspBuffers(RPi::Stream *stream, unsigned int count,
+			       std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+	int ispAttach();
+	void ispDetach();
+	void ispRunJob(bool switched);
 
 	std::unique_ptr<ipa::RPi::IPAProxyRPi> ipa_;
 
@@ -171,14 +310,20 @@ public:
 	/* Array of Unicam and ISP device streams and associated buffers/streams. */
 	RPi::Device<Unicam, 2> unicam_;
 	RPi::Device<Isp, 4> isp_;
+	/* Stream formats of the ISP outputs, enumerated on demand. */
+	StreamFormats ispStreamFormats_;
 	/* The vector below is just for convenience when iterating over all streams. */
 	std::vector<RPi::Stream *> streams_;
 	/* Stores the ids of the buffers mapped in the IPA. */
 	std::unordered_set<unsigned int> ipaBuffers_;
 
 	/* DMAHEAP allocation helper. */
-	RPi::DmaHeap dmaHeap_;
-	FileDescriptor lsTable_;
+	DmaHeap dmaHeap_;
+	/*
+	 * The lens shading tables are double-buffered: the IPA writes new
+	 * tables to the one the ISP isn't using.
+	 */
+	std::array<FileDescriptor, 2> lsTables_;
 
 	std::unique_ptr<DelayedControls> delayedCtrls_;
 	bool sensorMetadata_;
@@ -187,17 +332,36 @@ public:
 	 * All the functions in this class are called from a single calling
 	 * thread. So, we do not need to have any mutex to protect access to any
 	 * of the variables below.
+	 *
+	 * The state is the one of the oldest frame being processed: Idle when
+	 * there is none, Busy while the IPA hasn't returned its metadata, and
+	 * IpaComplete once it has.
 	 */
 	enum class State { Stopped, Idle, Busy, IpaComplete };
 	State state_;
 
-	struct BayerFrame {
-		FrameBuffer *buffer;
-		ControlList controls;
-	};
+	/*
+	 * With a pipeline depth larger than one, the IPA may prepare the next
+	 * frame once the ISP has finished with the previous one, while the
+	 * previous frame's statistics are still being processed and its
+	 * request completed. The requests of the frames being processed are
+	 * at the front of requestQueue_, oldest first.
+	 */
+	unsigned int pipelineDepth_;
+
+	/*
+	 * In low latency mode, a single frame goes through the pipeline at a
+	 * time, and frames queued behind it are skipped for the newest one.
+	 */
+	bool lowLatency_;
+
+	unsigned int framesInFlight_;
+	unsigned int framesIpaComplete_;
+	bool ipaPreparing_;
+	bool ispBusy_;
 
-	std::queue<BayerFrame> bayerQueue_;
-	std::queue<FrameBuffer *> embeddedQueue_;
+	/* Buffers dequeued from Unicam and waiting to be paired. */
+	RPi::BufferMatcher matcher_;
 	std::deque<Request *> requestQueue_;
 
 	/*
@@ -215,14 +379,53 @@ public:
 	Rectangle scalerCrop_; /* crop in sensor native pixels */
 	Size ispMinCropSize_;
 
+	/*
+	 * The ISP context of the camera when the ISP is shared, applied to the
+	 * device when the ISP switches to the camera. The ISP controls are
+	 * accumulated, as the IPA only sends the ones that change.
+	 */
+	IspScheduler *ispScheduler_;
+	std::array<V4L2DeviceFormat, 4> ispFormats_;
+	ControlList ispControls_;
+	ControlList pendingIspControls_;
+	bool ispCropChanged_;
+	unsigned int ispJobBuffers_;
+
 	unsigned int dropFrameCount_;
 
+	/*
+	 * The IPA has one frame interval to prepare the ISP parameters and to
+	 * process the statistics of a frame. A frame whose parameters are late
+	 * is processed with the parameters of the previous frame, and a frame
+	 * whose statistics are late completes without the IPA metadata. The
+	 * IPA handles its events in order, its late results are the next ones
+	 * to arrive and are discarded.
+	 */
+	Timer prepareTimer_;
+	Timer statsTimer_;
+	std::deque<utils::time_point> statsDeadlines_;
+	FrameBuffer *preparingBuffer_;
+	unsigned int latePrepares_;
+	unsigned int lateStats_;
+	int32_t ipaLateFrames_;
+
+	/*
+	 * The frame interval measured between consecutive frames, initialised
+	 * to the longest frame duration of the sensor mode.
+	 */
+	std::chrono::nanoseconds frameInterval_;
+	uint32_t lastSequence_;
+	uint64_t lastTimestamp_;
+
 private:
 	void checkRequestCompleted();
 	void fillRequestMetadata(const ControlList &bufferControls,
 				 Request *request);
 	void tryRunPipeline();
-	bool findMatchingBuffers(BayerFrame &bayerFrame, FrameBuffer *&embeddedBuffer);
+	bool findMatchingBuffers(RPi::BufferMatcher::BayerFrame &bayerFrame,
+				 FrameBuffer *&embeddedBuffer);
+	void queueIspInput(FrameBuffer *buffer);
+	void startStatsTimer();
 
 	unsigned int ispOutputCount_;
 };
@@ -233,12 +436,22 @@ public:
 	RPiCameraConfiguration(const RPiCameraData *data);
 
 	Status validate() override;
+	unsigned int minRequestDepth() const override;
+	unsigned int frameLatency() const override;
 
 	/* Cache the combinedTransform_ that will be applied to the sensor */
 	Transform combinedTransform_;
 
+protected:
+	uint64_t internalFrameTraffic() const override;
+
 private:
+	unsigned int pipelineDepth() const;
+
 	const RPiCameraData *data_;
+
+	/* Size of the raw frames written by Unicam */
+	uint64_t rawFrameSize_;
 };
 
 class PipelineHandlerRPi : public PipelineHandler
@@ -259,23 +472,26 @@ public:
 
 	bool match(DeviceEnumerator *enumerator) override;
 
+	void releaseDevice(Camera *camera) override;
+
 private:
 	RPiCameraData *cameraData(const Camera *camera)
 	{
 		return static_cast<RPiCameraData *>(PipelineHandler::cameraData(camera));
 	}
 
+	RPiCameraData *createCamera(MediaDevice *unicam);
 	int queueAllBuffers(Camera *camera);
 	int prepareBuffers(Camera *camera);
 	void freeBuffers(Camera *camera);
 	void mapBuffers(Camera *camera, const RPi::BufferMap &buffers, unsigned int mask);
 
-	MediaDevice *unicam_;
 	MediaDevice *isp_;
+	std::unique_ptr<IspScheduler> ispScheduler_;
 };
 
 RPiCameraConfiguration::RPiCameraConfiguration(const RPiCameraData *data)
-	: CameraConfiguration(), data_(data)
+	: CameraConfiguration(), data_(data), rawFrameSize_(0)
 {
 }
 
@@ -341,21 +557,41 @@ CameraConfiguration::Status RPiCameraConfiguration::validate()
 	 */
 	combinedTransform_ = combined;
 
+	if (maxFrameDuration < 0) {
+		maxFrameDuration = 0;
+		status = Adjusted;
+	}
+
+	const CameraSensor *sensor = data_->sensor_.get();
+	const CameraSensorMode *sensorMode = nullptr;
 	unsigned int rawCount = 0, outCount = 0, count = 0, maxIndex = 0;
 	std::pair<int, Size> outSize[2];
 	Size maxSize;
 	for (StreamConfiguration &cfg : config_) {
+		/*
+		 * The ISP crops its input, which is shared by both outputs,
+		 * per-stream cropping isn't supported.
+		 */
+		if (!cfg.crop.isNull()) {
+			cfg.crop = {};
+			status = Adjusted;
+		}
+
 		if (isRaw(cfg.pixelFormat)) {
 			/*
 			 * Calculate the best sensor mode we can use based on
 			 * the user request.
 			 */
 			V4L2VideoDevice::Formats fmts = data_->unicam_[Unicam::Image].dev()->formats();
-			V4L2DeviceFormat sensorFormat = findBestMode(fmts, cfg.size);
+			V4L2DeviceFormat sensorFormat = findBestMode(fmts, cfg.size, sensor,
+								     maxFrameDuration * 1000);
 			int ret = data_->unicam_[Unicam::Image].dev()->tryFormat(&sensorFormat);
 			if (ret)
 				return Invalid;
 
+			sensorMode = findSensorMode(sensor, sensorFormat.fourcc,
+						    sensorFormat.size);
+
 			/*
 			 * Some sensors change their Bayer order when they are
 			 * h-flipped or v-flipped, according to the transform.
@@ -382,6 +618,10 @@ CameraConfiguration::Status RPiCameraConfiguration::validate()
 
 			cfg.stride = sensorFormat.planes[0].bpl;
 			cfg.frameSize = sensorFormat.planes[0].size;
+			rawFrameSize_ = cfg.frameSize;
+
+			if (adjustStrideAlign(&cfg))
+				status = Adjusted;
 
 			rawCount++;
 		} else {
@@ -403,6 +643,27 @@ CameraConfiguration::Status RPiCameraConfiguration::validate()
 		}
 	}
 
+	/*
+	 * Without a RAW stream, configure() picks the sensor mode from the
+	 * largest output. If the sensor mode can't reach the requested frame
+	 * duration, report the shortest one it can.
+	 */
+	if (!rawCount) {
+		V4L2VideoDevice::Formats fmts = data_->unicam_[Unicam::Image].dev()->formats();
+		V4L2DeviceFormat sensorFormat = findBestMode(fmts, maxSize, sensor,
+							     maxFrameDuration * 1000);
+		sensorMode = findSensorMode(sensor, sensorFormat.fourcc,
+					    sensorFormat.size);
+		rawFrameSize_ = PixelFormatInfo::info(sensorFormat.fourcc)
+					.frameSize(sensorFormat.size);
+	}
+
+	if (maxFrameDuration && sensorMode &&
+	    sensorMode->minFrameDuration > static_cast<uint64_t>(maxFrameDuration) * 1000) {
+		maxFrameDuration = (sensorMode->minFrameDuration + 999) / 1000;
+		status = Adjusted;
+	}
+
 	/*
 	 * Now do any fixups needed. For the two ISP outputs, one stream must be
 	 * equal or smaller than the other in all dimensions.
@@ -447,6 +708,7 @@ CameraConfiguration::Status RPiCameraConfiguration::validate()
 		V4L2DeviceFormat format;
 		format.fourcc = dev->toV4L2PixelFormat(cfg.pixelFormat);
 		format.size = cfg.size;
+		format.alignStride(cfg.strideAlign);
 
 		int ret = dev->tryFormat(&format);
 		if (ret)
@@ -455,13 +717,63 @@ CameraConfiguration::Status RPiCameraConfiguration::validate()
 		cfg.stride = format.planes[0].bpl;
 		cfg.frameSize = format.planes[0].size;
 
+		if (adjustStrideAlign(&cfg))
+			status = Adjusted;
+
+	}
+
+	/* Don't keep more frames around than needed in low latency mode. */
+	if (lowLatency) {
+		for (StreamConfiguration &cfg : config_)
+			cfg.bufferCount = std::min(cfg.bufferCount, minRequestDepth());
 	}
 
 	return status;
 }
 
+unsigned int RPiCameraConfiguration::minRequestDepth() const
+{
+	/*
+	 * Up to pipelineDepth_ frames go through the IPA and ISP concurrently,
+	 * each with its request. Keep one more ready for the next frame.
+	 */
+	return pipelineDepth() + 1;
+}
+
+unsigned int RPiCameraConfiguration::frameLatency() const
+{
+	/*
+	 * Unicam writes the frame to memory during its readout, and the IPA and
+	 * ISP process it along with up to pipelineDepth_ - 1 earlier frames.
+	 */
+	return pipelineDepth() + 1;
+}
+
+unsigned int RPiCameraConfiguration::pipelineDepth() const
+{
+	return lowLatency ? 1 : data_->pipelineDepth_;
+}
+
+uint64_t RPiCameraConfiguration::internalFrameTraffic() const
+{
+	/*
+	 * The ISP reads every raw frame from memory. Unicam writes it to an
+	 * internal buffer, unless it is captured by the raw stream.
+	 */
+	bool rawStream = std::any_of(config_.begin(), config_.end(),
+				     [](const StreamConfiguration &cfg) {
+					     return isRaw(cfg.pixelFormat);
+				     });
+	uint64_t traffic = rawStream ? rawFrameSize_ : 2 * rawFrameSize_;
+
+	/* The ISP writes the statistics, read back by the IPA. */
+	traffic += 2 * sizeof(struct bcm2835_isp_stats);
+
+	return traffic;
+}
+
 PipelineHandlerRPi::PipelineHandlerRPi(CameraManager *manager)
-	: PipelineHandler(manager), unicam_(nullptr), isp_(nullptr)
+	: PipelineHandler(manager), isp_(nullptr)
 {
 }
 
@@ -474,6 +786,7 @@ CameraConfiguration *PipelineHandlerRPi::generateConfiguration(Camera *camera,
 	unsigned int bufferCount;
 	PixelFormat pixelFormat;
 	V4L2VideoDevice::Formats fmts;
+	StreamFormats formats;
 	Size size;
 
 	if (roles.empty())
@@ -486,15 +799,16 @@ CameraConfiguration *PipelineHandlerRPi::generateConfiguration(Camera *camera,
 		case StreamRole::Raw:
 			size = data->sensor_->resolution();
 			fmts = data->unicam_[Unicam::Image].dev()->formats();
-			sensorFormat = findBestMode(fmts, size);
+			sensorFormat = findBestMode(fmts, size, data->sensor_.get());
 			pixelFormat = sensorFormat.fourcc.toPixelFormat();
 			ASSERT(pixelFormat.isValid());
+			formats = StreamFormats(toFormatsMap(fmts));
 			bufferCount = 2;
 			rawCount++;
 			break;
 
 		case StreamRole::StillCapture:
-			fmts = data->isp_[Isp::Output0].dev()->formats();
+			formats = data->ispStreamFormats_;
 			pixelFormat = formats::NV12;
 			/* Return the largest sensor resolution. */
 			size = data->sensor_->resolution();
@@ -511,7 +825,7 @@ CameraConfiguration *PipelineHandlerRPi::generateConfiguration(Camera *camera,
 			 * applications and enable usage of the colour denoise
 			 * algorithm.
 			 */
-			fmts = data->isp_[Isp::Output0].dev()->formats();
+			formats = data->ispStreamFormats_;
 			pixelFormat = formats::YUV420;
 			size = { 1920, 1080 };
 			bufferCount = 4;
@@ -519,7 +833,7 @@ CameraConfiguration *PipelineHandlerRPi::generateConfiguration(Camera *camera,
 			break;
 
 		case StreamRole::Viewfinder:
-			fmts = data->isp_[Isp::Output0].dev()->formats();
+			formats = data->ispStreamFormats_;
 			pixelFormat = formats::ARGB8888;
 			size = { 800, 600 };
 			bufferCount = 4;
@@ -539,16 +853,7 @@ CameraConfiguration *PipelineHandlerRPi::generateConfiguration(Camera *camera,
 			return nullptr;
 		}
 
-		/* Translate the V4L2PixelFormat to PixelFormat. */
-		std::map<PixelFormat, std::vector<SizeRange>> deviceFormats;
-		for (const auto &format : fmts) {
-			PixelFormat pf = format.first.toPixelFormat();
-			if (pf.isValid())
-				deviceFormats[pf] = format.second;
-		}
-
 		/* Add the stream format based on the device node used for the use case. */
-		StreamFormats formats(deviceFormats);
 		StreamConfiguration cfg(formats);
 		cfg.size = size;
 		cfg.pixelFormat = pixelFormat;
@@ -566,6 +871,14 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 	RPiCameraData *data = cameraData(camera);
 	int ret;
 
+	/*
+	 * Internal buffers are kept across stop() and start(), free them as
+	 * they depend on the configuration.
+	 */
+	freeBuffers(camera);
+
+	data->lowLatency_ = config->lowLatency;
+
 	/* Start by resetting the Unicam and ISP stream states. */
 	for (auto const stream : data->streams_)
 		stream->reset();
@@ -598,7 +911,9 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 
 	/* First calculate the best sensor mode we can use based on the user request. */
 	V4L2VideoDevice::Formats fmts = data->unicam_[Unicam::Image].dev()->formats();
-	V4L2DeviceFormat sensorFormat = findBestMode(fmts, rawStream ? sensorSize : maxSize);
+	V4L2DeviceFormat sensorFormat = findBestMode(fmts, rawStream ? sensorSize : maxSize,
+						     data->sensor_.get(),
+						     config->maxFrameDuration * 1000);
 
 	/*
 	 * Unicam image output format. The ISP input format gets set at start,
@@ -622,7 +937,7 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 	 * This format may be reset on start() if the bayer order has changed
 	 * because of flips in the sensor.
 	 */
-	ret = data->isp_[Isp::Input].dev()->setFormat(&sensorFormat);
+	ret = data->setIspFormat(Isp::Input, &sensorFormat);
 	if (ret)
 		return ret;
 
@@ -642,17 +957,19 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 		}
 
 		/* The largest resolution gets routed to the ISP Output 0 node. */
-		RPi::Stream *stream = i == maxIndex ? &data->isp_[Isp::Output0]
-						    : &data->isp_[Isp::Output1];
+		Isp output = i == maxIndex ? Isp::Output0 : Isp::Output1;
+		RPi::Stream *stream = &data->isp_[output];
 
 		V4L2PixelFormat fourcc = stream->dev()->toV4L2PixelFormat(cfg.pixelFormat);
+		format = {};
 		format.size = cfg.size;
 		format.fourcc = fourcc;
+		format.alignStride(cfg.strideAlign);
 
 		LOG(RPI, Debug) << "Setting " << stream->name() << " to "
 				<< format.toString();
 
-		ret = stream->dev()->setFormat(&format);
+		ret = data->setIspFormat(output, &format);
 		if (ret)
 			return -EINVAL;
 
@@ -687,7 +1004,7 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 		format = {};
 		format.size = maxSize;
 		format.fourcc = V4L2PixelFormat::fromPixelFormat(formats::YUV420, false);
-		ret = data->isp_[Isp::Output0].dev()->setFormat(&format);
+		ret = data->setIspFormat(Isp::Output0, &format);
 		if (ret) {
 			LOG(RPI, Error)
 				<< "Failed to set default format on ISP Output0: "
@@ -720,7 +1037,7 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 		LOG(RPI, Debug) << "Setting ISP Output1 (internal) to "
 				<< output1Format.toString();
 
-		ret = data->isp_[Isp::Output1].dev()->setFormat(&output1Format);
+		ret = data->setIspFormat(Isp::Output1, &output1Format);
 		if (ret) {
 			LOG(RPI, Error) << "Failed to set format on ISP Output1: "
 					<< ret;
@@ -731,24 +1048,32 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 	/* ISP statistics output format. */
 	format = {};
 	format.fourcc = V4L2PixelFormat(V4L2_META_FMT_BCM2835_ISP_STATS);
-	ret = data->isp_[Isp::Stats].dev()->setFormat(&format);
+	ret = data->setIspFormat(Isp::Stats, &format);
 	if (ret) {
 		LOG(RPI, Error) << "Failed to set format on ISP stats stream: "
 				<< format.toString();
 		return ret;
 	}
 
-	/* Figure out the smallest selection the ISP will allow. */
-	Rectangle testCrop(0, 0, 1, 1);
-	data->isp_[Isp::Input].dev()->setSelection(V4L2_SEL_TGT_CROP, &testCrop);
-	data->ispMinCropSize_ = testCrop.size();
+	/*
+	 * Figure out the smallest selection the ISP will allow. A shared ISP
+	 * may be busy with another camera, it has been probed at match time.
+	 */
+	if (!data->ispScheduler_) {
+		Rectangle testCrop(0, 0, 1, 1);
+		data->isp_[Isp::Input].dev()->setSelection(V4L2_SEL_TGT_CROP, &testCrop);
+		data->ispMinCropSize_ = testCrop.size();
+	} else {
+		data->ispMinCropSize_ = data->ispScheduler_->minCropSize();
+	}
 
 	/* Adjust aspect ratio by providing crops on the input image. */
 	Size size = sensorFormat.size.boundedToAspectRatio(maxSize);
 	Rectangle crop = size.centeredTo(Rectangle(sensorFormat.size).center());
 	data->ispCrop_ = crop;
 
-	data->isp_[Isp::Input].dev()->setSelection(V4L2_SEL_TGT_CROP, &crop);
+	if (!data->ispScheduler_)
+		data->isp_[Isp::Input].dev()->setSelection(V4L2_SEL_TGT_CROP, &crop);
 
 	ret = data->configureIPA(config);
 	if (ret)
@@ -780,6 +1105,13 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 			data->unicam_[Unicam::Embedded].setExternal(true);
 	}
 
+	/*
+	 * The Bayer frames are only accessed by the CPU when captured for the
+	 * application, the ISP input reads them from the device.
+	 */
+	data->unicam_[Unicam::Image].dev()->setCpuAccess(rawStream);
+	data->isp_[Isp::Input].dev()->setCpuAccess(false);
+
 	/*
 	 * Update the ScalerCropMaximum to the correct value for this camera mode.
 	 * For us, it's the same as the "analogue crop".
@@ -792,12 +1124,21 @@ int PipelineHandlerRPi::configure(Camera *camera, CameraConfiguration *config)
 	return ret;
 }
 
-int PipelineHandlerRPi::exportFrameBuffers([[maybe_unused]] Camera *camera, Stream *stream,
+int PipelineHandlerRPi::exportFrameBuffers(Camera *camera, Stream *stream,
 					   std::vector<std::unique_ptr<FrameBuffer>> *buffers)
 {
+	RPiCameraData *data = cameraData(camera);
 	RPi::Stream *s = static_cast<RPi::Stream *>(stream);
 	unsigned int count = stream->configuration().bufferCount;
-	int ret = s->dev()->exportBuffers(count, buffers);
+
+	/*
+	 * Buffers can't be exported from a device that has buffers allocated,
+	 * free the internal buffers kept from the previous start().
+	 */
+	if (!data->ipaBuffers_.empty())
+		freeBuffers(camera);
+
+	int ret = s->exportBuffers(count, buffers);
 
 	s->setExportedBuffers(buffers);
 
@@ -814,12 +1155,28 @@ int PipelineHandlerRPi::start(Camera *camera, const ControlList *controls)
 	if (ret) {
 		LOG(RPI, Error) << "Failed to allocate buffers";
 		stop(camera);
+		freeBuffers(camera);
 		return ret;
 	}
 
-	/* Check if a ScalerCrop control was specified. */
-	if (controls)
+	/* Check if a ScalerCrop or ExposureBracket control was specified. */
+	if (controls) {
 		data->applyScalerCrop(*controls);
+		data->applyExposureBracket(*controls);
+	}
+
+	/* Select the frame synchronisation mode before streaming starts. */
+	int32_t syncMode = controls::SensorSyncOff;
+	if (controls && controls->contains(controls::SENSOR_SYNC_MODE))
+		syncMode = controls->get(controls::SensorSyncMode);
+
+	ret = data->sensor_->setSyncMode(syncMode);
+	if (ret) {
+		LOG(RPI, Error) << "Failed to set the frame synchronisation mode";
+		stop(camera);
+		freeBuffers(camera);
+		return ret;
+	}
 
 	/* Start the IPA. */
 	ipa::RPi::StartConfig startConfig;
@@ -846,7 +1203,7 @@ int PipelineHandlerRPi::start(Camera *camera, const ControlList *controls)
 	 */
 	V4L2DeviceFormat sensorFormat;
 	data->unicam_[Unicam::Image].dev()->getFormat(&sensorFormat);
-	ret = data->isp_[Isp::Input].dev()->setFormat(&sensorFormat);
+	ret = data->setIspFormat(Isp::Input, &sensorFormat);
 	if (ret) {
 		stop(camera);
 		return ret;
@@ -861,10 +1218,35 @@ int PipelineHandlerRPi::start(Camera *camera, const ControlList *controls)
 	 */
 	data->delayedCtrls_->reset();
 
+	data->matcher_.configure(data->sensorMetadata_,
+				 data->unicam_[Unicam::Embedded].isExternal(),
+				 data->unicam_[Unicam::Image].getBuffers().size(),
+				 data->unicam_[Unicam::Embedded].getBuffers().size());
+	data->framesInFlight_ = 0;
+	data->framesIpaComplete_ = 0;
+	data->ipaPreparing_ = false;
+	data->ispBusy_ = false;
+	data->statsDeadlines_.clear();
+	data->latePrepares_ = 0;
+	data->lateStats_ = 0;
+	data->ipaLateFrames_ = 0;
+	data->lastTimestamp_ = 0;
+	data->frameInterval_ = std::chrono::seconds(1);
+	if (data->sensorInfo_.pixelRate)
+		data->frameInterval_ = std::chrono::nanoseconds(
+			static_cast<uint64_t>(data->sensorInfo_.maxFrameLength) *
+			data->sensorInfo_.lineLength * 1000000000ULL /
+			data->sensorInfo_.pixelRate);
 	data->state_ = RPiCameraData::State::Idle;
 
-	/* Start all streams. */
+	/*
+	 * Start all streams. The streams of a shared ISP get started when the
+	 * ISP switches to the camera.
+	 */
 	for (auto const stream : data->streams_) {
+		if (stream->isShared())
+			continue;
+
 		ret = stream->dev()->streamOn();
 		if (ret) {
 			stop(camera);
@@ -880,18 +1262,31 @@ void PipelineHandlerRPi::stop(Camera *camera)
 	RPiCameraData *data = cameraData(camera);
 
 	data->state_ = RPiCameraData::State::Stopped;
+	data->prepareTimer_.stop();
+	data->statsTimer_.stop();
 
 	/* Disable SOF event generation. */
 	data->unicam_[Unicam::Image].dev()->setFrameStartEnabled(false);
 
 	/* This also stops the streams. */
 	data->clearIncompleteRequests();
-	data->bayerQueue_ = {};
-	data->embeddedQueue_ = {};
+	data->matcher_.clear();
+
+	/* Hand a shared ISP over to the other cameras. */
+	if (data->ispScheduler_)
+		data->ispScheduler_->stop(data);
 
 	/* Stop the IPA. */
 	data->ipa_->stop();
 
+	/*
+	 * Keep the internal buffers and their IPA mappings for the next
+	 * start(), they are freed when the camera is reconfigured or released.
+	 */
+}
+
+void PipelineHandlerRPi::releaseDevice(Camera *camera)
+{
 	freeBuffers(camera);
 }
 
@@ -954,21 +1349,59 @@ bool PipelineHandlerRPi::match(DeviceEnumerator *enumerator)
 	isp.add("bcm2835-isp0-capture2"); /* Output 1 */
 	isp.add("bcm2835-isp0-capture3"); /* Stats */
 
-	unicam_ = acquireMediaDevice(enumerator, unicam);
-	if (!unicam_)
+	MediaDevice *unicamDevice = acquireMediaDevice(enumerator, unicam);
+	if (!unicamDevice)
 		return false;
 
 	isp_ = acquireMediaDevice(enumerator, isp);
 	if (!isp_)
 		return false;
 
-	std::unique_ptr<RPiCameraData> data = std::make_unique<RPiCameraData>(this);
-	if (!data->dmaHeap_.isValid())
+	/*
+	 * Compute Modules have a Unicam instance for each of their two CSI-2
+	 * receivers, all of them feed the single ISP. Create a camera for each.
+	 */
+	std::vector<RPiCameraData *> cameras;
+	do {
+		RPiCameraData *data = createCamera(unicamDevice);
+		if (data)
+			cameras.push_back(data);
+	} while ((unicamDevice = acquireMediaDevice(enumerator, unicam)));
+
+	if (cameras.empty())
 		return false;
 
+	if (cameras.size() > 1) {
+		/*
+		 * Figure out the smallest selection the ISP will allow now,
+		 * as it can't be changed when the ISP is in use by another
+		 * camera.
+		 */
+		Rectangle testCrop(0, 0, 1, 1);
+		cameras[0]->isp_[Isp::Input].dev()->setSelection(V4L2_SEL_TGT_CROP, &testCrop);
+
+		ispScheduler_ = std::make_unique<IspScheduler>(testCrop.size());
+		for (RPiCameraData *data : cameras)
+			data->setIspScheduler(ispScheduler_.get());
+
+		LOG(RPI, Info) << "Sharing the ISP between " << cameras.size()
+			       << " cameras";
+	}
+
+	return true;
+}
+
+RPiCameraData *PipelineHandlerRPi::createCamera(MediaDevice *unicam)
+{
+	std::unique_ptr<RPiCameraData> data = std::make_unique<RPiCameraData>(this);
+	if (!data->dmaHeap_.isValid()) {
+		LOG(RPI, Error) << "Could not open any dmaHeap device";
+		return nullptr;
+	}
+
 	/* Locate and open the unicam video streams. */
-	data->unicam_[Unicam::Embedded] = RPi::Stream("Unicam Embedded", unicam_->getEntityByName("unicam-embedded"));
-	data->unicam_[Unicam::Image] = RPi::Stream("Unicam Image", unicam_->getEntityByName("unicam-image"));
+	data->unicam_[Unicam::Embedded] = RPi::Stream("Unicam Embedded", unicam->getEntityByName("unicam-embedded"));
+	data->unicam_[Unicam::Image] = RPi::Stream("Unicam Image", unicam->getEntityByName("unicam-image"));
 
 	/* Tag the ISP input stream as an import stream. */
 	data->isp_[Isp::Input] = RPi::Stream("ISP Input", isp_->getEntityByName("bcm2835-isp0-output0"), true);
@@ -976,17 +1409,28 @@ bool PipelineHandlerRPi::match(DeviceEnumerator *enumerator)
 	data->isp_[Isp::Output1] = RPi::Stream("ISP Output1", isp_->getEntityByName("bcm2835-isp0-capture2"));
 	data->isp_[Isp::Stats] = RPi::Stream("ISP Stats", isp_->getEntityByName("bcm2835-isp0-capture3"));
 
+	/*
+	 * The ISP outputs support the same formats for all use cases. Enumerate
+	 * them only when an application inspects them, once per camera.
+	 */
+	V4L2VideoDevice *ispOutput = data->isp_[Isp::Output0].dev();
+	data->ispStreamFormats_ = StreamFormats([ispOutput]() {
+		return toFormatsMap(ispOutput->formats());
+	});
+
 	/* Wire up all the buffer connections. */
 	data->unicam_[Unicam::Image].dev()->frameStart.connect(data.get(), &RPiCameraData::frameStarted);
 	data->unicam_[Unicam::Image].dev()->bufferReady.connect(data.get(), &RPiCameraData::unicamBufferDequeue);
+	data->unicam_[Unicam::Image].dev()->bufferBatchReady.connect(data.get(), &RPiCameraData::unicamBatchDequeued);
 	data->unicam_[Unicam::Embedded].dev()->bufferReady.connect(data.get(), &RPiCameraData::unicamBufferDequeue);
+	data->unicam_[Unicam::Embedded].dev()->bufferBatchReady.connect(data.get(), &RPiCameraData::unicamBatchDequeued);
 	data->isp_[Isp::Input].dev()->bufferReady.connect(data.get(), &RPiCameraData::ispInputDequeue);
 	data->isp_[Isp::Output0].dev()->bufferReady.connect(data.get(), &RPiCameraData::ispOutputDequeue);
 	data->isp_[Isp::Output1].dev()->bufferReady.connect(data.get(), &RPiCameraData::ispOutputDequeue);
 	data->isp_[Isp::Stats].dev()->bufferReady.connect(data.get(), &RPiCameraData::ispOutputDequeue);
 
 	/* Identify the sensor. */
-	for (MediaEntity *entity : unicam_->entities()) {
+	for (MediaEntity *entity : unicam->entities()) {
 		if (entity->function() == MEDIA_ENT_F_CAM_SENSOR) {
 			data->sensor_ = std::make_unique<CameraSensor>(entity);
 			break;
@@ -994,15 +1438,15 @@ bool PipelineHandlerRPi::match(DeviceEnumerator *enumerator)
 	}
 
 	if (!data->sensor_)
-		return false;
+		return nullptr;
 
 	if (data->sensor_->init())
-		return false;
+		return nullptr;
 
 	ipa::RPi::SensorConfig sensorConfig;
 	if (data->loadIPA(&sensorConfig)) {
 		LOG(RPI, Error) << "Failed to load a suitable IPA library";
-		return false;
+		return nullptr;
 	}
 
 	/*
@@ -1022,7 +1466,7 @@ bool PipelineHandlerRPi::match(DeviceEnumerator *enumerator)
 
 	for (auto stream : data->streams_) {
 		if (stream->dev()->open())
-			return false;
+			return nullptr;
 	}
 
 	/*
@@ -1037,8 +1481,15 @@ bool PipelineHandlerRPi::match(DeviceEnumerator *enumerator)
 	data->delayedCtrls_ = std::make_unique<DelayedControls>(data->unicam_[Unicam::Image].dev(), params);
 	data->sensorMetadata_ = sensorConfig.sensorMetadata;
 
-	/* Register the controls that the Raspberry Pi IPA can handle. */
-	data->controlInfo_ = RPi::Controls;
+	/*
+	 * Register the controls that the Raspberry Pi IPA can handle, and the
+	 * frame synchronisation modes if the sensor supports them.
+	 */
+	ControlInfoMap::Map ctrlMap(RPi::Controls.begin(), RPi::Controls.end());
+	if (!data->sensor_->syncModes().empty())
+		ctrlMap[&controls::SensorSyncMode] = ControlInfo(data->sensor_->syncModes());
+	data->controlInfo_ = ControlInfoMap(std::move(ctrlMap));
+
 	/* Initialize the camera properties. */
 	data->properties_ = data->sensor_->properties();
 
@@ -1086,7 +1537,7 @@ bool PipelineHandlerRPi::match(DeviceEnumerator *enumerator)
 
 	if (!bayerFormat.isValid()) {
 		LOG(RPI, Error) << "No Bayer format found";
-		return false;
+		return nullptr;
 	}
 	data->nativeBayerOrder_ = bayerFormat.order;
 
@@ -1101,11 +1552,12 @@ bool PipelineHandlerRPi::match(DeviceEnumerator *enumerator)
 	streams.insert(&data->isp_[Isp::Output1]);
 
 	/* Create and register the camera. */
+	RPiCameraData *cameraData = data.get();
 	std::shared_ptr<Camera> camera =
 		Camera::create(this, data->sensor_->id(), streams);
 	registerCamera(std::move(camera), std::move(data));
 
-	return true;
+	return cameraData;
 }
 
 int PipelineHandlerRPi::queueAllBuffers(Camera *camera)
@@ -1146,21 +1598,56 @@ int PipelineHandlerRPi::prepareBuffers(Camera *camera)
 	RPiCameraData *data = cameraData(camera);
 	int ret;
 
+	/*
+	 * If the buffers from the previous start() are still mapped to the
+	 * IPA, the configuration hasn't changed. Reuse them.
+	 */
+	if (!data->ipaBuffers_.empty()) {
+		for (auto const stream : data->streams_)
+			stream->recycleBuffers();
+		return 0;
+	}
+
 	/*
 	 * Decide how many internal buffers to allocate. For now, simply look
 	 * at how many external buffers will be provided. We'll need to improve
-	 * this logic. However, we really must have all streams allocate the same
-	 * number of buffers to simplify error handling in queueRequestDevice().
+	 * this logic. Streams running out of internal buffers hold the
+	 * requests back until a buffer gets returned, see queueRequestDevice().
 	 */
 	unsigned int maxBuffers = 0;
 	for (const Stream *s : camera->streams())
 		if (static_cast<const RPi::Stream *>(s)->isExternal())
 			maxBuffers = std::max(maxBuffers, s->configuration().bufferCount);
 
+	/*
+	 * The raw buffers supplied by the application are captured to by
+	 * Unicam and fed to the ISP input as they are, before being completed,
+	 * so they need no internal counterpart. Internal Unicam buffers are
+	 * only used for the frames captured without an application buffer,
+	 * dropped frames included: top them up to the minimum the pipeline
+	 * needs instead of duplicating the application's buffers. Both Unicam
+	 * and the ISP input must have room to import all of them.
+	 */
+	RPi::Stream &unicamImage = data->unicam_[Unicam::Image];
+	unsigned int rawBuffers = unicamImage.isExternal()
+				? unicamImage.configuration().bufferCount : 0;
+	unsigned int unicamBuffers = maxBuffers;
+	if (rawBuffers)
+		unicamBuffers = std::max(MinInternalRawBuffers,
+					 MinUnicamBuffers - std::min(MinUnicamBuffers, rawBuffers));
+
 	for (auto const stream : data->streams_) {
-		ret = stream->prepareBuffers(maxBuffers);
+		if (stream == &unicamImage)
+			ret = stream->prepareBuffers(unicamBuffers, rawBuffers);
+		else if (stream == &data->isp_[Isp::Input])
+			ret = stream->prepareBuffers(unicamBuffers + rawBuffers);
+		else
+			ret = stream->prepareBuffers(maxBuffers);
 		if (ret < 0)
 			return ret;
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : stream->getInternalBuffers())
+			data->accountInternalBuffer(buffer.get());
 	}
 
 	/*
@@ -1206,6 +1693,8 @@ void PipelineHandlerRPi::freeBuffers(Camera *camera)
 
 	for (auto const stream : data->streams_)
 		stream->releaseBuffers();
+
+	data->clearInternalBuffers();
 }
 
 void RPiCameraData::frameStarted(uint32_t sequence)
@@ -1228,6 +1717,7 @@ int RPiCameraData::loadIPA(ipa::RPi::SensorConfig *sensorConfig)
 	ipa_->embeddedComplete.connect(this, &RPiCameraData::embeddedComplete);
 	ipa_->setIspControls.connect(this, &RPiCameraData::setIspControls);
 	ipa_->setDelayedControls.connect(this, &RPiCameraData::setDelayedControls);
+	ipa_->setLensControls.connect(this, &RPiCameraData::setLensControls);
 
 	IPASettings settings(ipa_->configurationFile(sensor_->model() + ".json"),
 			     sensor_->model());
@@ -1257,22 +1747,27 @@ int RPiCameraData::configureIPA(const CameraConfiguration *config)
 
 	entityControls.emplace(0, unicam_[Unicam::Image].dev()->controls());
 	entityControls.emplace(1, isp_[Isp::Input].dev()->controls());
+	if (sensor_->focusLens())
+		entityControls.emplace(2, sensor_->focusLens()->controls());
 
 	/* Always send the user transform to the IPA. */
 	ipaConfig.transform = static_cast<unsigned int>(config->transform);
 
-	/* Allocate the lens shading table via dmaHeap and pass to the IPA. */
-	if (!lsTable_.isValid()) {
-		lsTable_ = dmaHeap_.alloc("ls_grid", ipa::RPi::MaxLsGridSize);
-		if (!lsTable_.isValid())
-			return -ENOMEM;
+	/* Allocate the lens shading tables via dmaHeap and pass to the IPA. */
+	if (!lsTables_[0].isValid()) {
+		for (FileDescriptor &lsTable : lsTables_) {
+			lsTable = dmaHeap_.alloc("ls_grid", ipa::RPi::MaxLsGridSize);
+			if (!lsTable.isValid())
+				return -ENOMEM;
+		}
 
-		/* Allow the IPA to mmap the LS table via the file descriptor. */
+		/* Allow the IPA to mmap the LS tables via the file descriptors. */
 		/*
-		 * \todo Investigate if mapping the lens shading table buffer
+		 * \todo Investigate if mapping the lens shading table buffers
 		 * could be handled with mapBuffers().
 		 */
-		ipaConfig.lsTableHandle = lsTable_;
+		ipaConfig.lsTableHandle0 = lsTables_[0];
+		ipaConfig.lsTableHandle1 = lsTables_[1];
 	}
 
 	/* We store the IPACameraSensorInfo for digital zoom calculations. */
@@ -1319,10 +1814,31 @@ void RPiCameraData::statsMetadataComplete(uint32_t bufferId, const ControlList &
 
 	handleStreamBuffer(buffer, &isp_[Isp::Stats]);
 
+	/* The request has completed without the metadata already. */
+	if (lateStats_) {
+		lateStats_--;
+		return;
+	}
+
+	statsDeadlines_.pop_front();
+	startStatsTimer();
+
 	/* Add to the Request metadata buffer what the IPA has provided. */
-	Request *request = requestQueue_.front();
+	Request *request = requestQueue_[framesIpaComplete_];
+
+	/*
+	 * The IPA times the start of exposure from the frame start timestamp,
+	 * let it replace the frame start we have reported so far.
+	 */
+	if (controls.contains(controls::SensorTimestamp))
+		request->metadata().set(controls::SensorTimestamp,
+					controls.get(controls::SensorTimestamp));
+
 	request->metadata().merge(controls);
+	request->metadata().set(controls::IpaDoneTimestamp,
+				static_cast<int64_t>(utils::boottime()));
 
+	framesIpaComplete_++;
 	state_ = State::IpaComplete;
 	handleState();
 }
@@ -1332,16 +1848,84 @@ void RPiCameraData::runIsp(uint32_t bufferId)
 	if (state_ == State::Stopped)
 		return;
 
+	/* The frame has been processed with the previous parameters already. */
+	if (latePrepares_) {
+		latePrepares_--;
+		return;
+	}
+
+	prepareTimer_.stop();
+
 	FrameBuffer *buffer = unicam_[Unicam::Image].getBuffers().at(bufferId);
 
 	LOG(RPI, Debug) << "Input re-queue to ISP, buffer id " << bufferId
 			<< ", timestamp: " << buffer->metadata().timestamp;
 
+	queueIspInput(buffer);
+}
+
+void RPiCameraData::queueIspInput(FrameBuffer *buffer)
+{
 	isp_[Isp::Input].queueBuffer(buffer);
+	ipaPreparing_ = false;
+	ispBusy_ = true;
 	ispOutputCount_ = 0;
+
+	/* A shared ISP processes the frame when it's the camera's turn. */
+	if (ispScheduler_)
+		ispScheduler_->queueJob(this);
+
 	handleState();
 }
 
+void RPiCameraData::prepareTimeout([[maybe_unused]] Timer *timer)
+{
+	if (state_ == State::Stopped || !ipaPreparing_)
+		return;
+
+	Request *request = requestQueue_[framesInFlight_ - 1];
+
+	LOG(RPI, Debug) << "IPA late preparing the ISP for request "
+			<< request->sequence() << ", using the previous parameters";
+
+	request->metadata().set(controls::IpaLate, true);
+	request->metadata().set(controls::IpaLateFrames, ++ipaLateFrames_);
+	latePrepares_++;
+
+	queueIspInput(preparingBuffer_);
+}
+
+void RPiCameraData::statsTimeout([[maybe_unused]] Timer *timer)
+{
+	if (state_ == State::Stopped)
+		return;
+
+	statsDeadlines_.pop_front();
+	startStatsTimer();
+
+	Request *request = requestQueue_[framesIpaComplete_];
+
+	LOG(RPI, Debug) << "IPA late processing the statistics for request "
+			<< request->sequence() << ", completing without metadata";
+
+	if (!request->metadata().get(controls::IpaLate))
+		request->metadata().set(controls::IpaLateFrames, ++ipaLateFrames_);
+	request->metadata().set(controls::IpaLate, true);
+	lateStats_++;
+
+	framesIpaComplete_++;
+	state_ = State::IpaComplete;
+	handleState();
+}
+
+void RPiCameraData::startStatsTimer()
+{
+	if (statsDeadlines_.empty())
+		statsTimer_.stop();
+	else
+		statsTimer_.start(statsDeadlines_.front());
+}
+
 void RPiCameraData::embeddedComplete(uint32_t bufferId)
 {
 	if (state_ == State::Stopped)
@@ -1362,10 +1946,24 @@ void RPiCameraData::setIspControls(const ControlList &controls)
 		Span<uint8_t> s = value.data();
 		bcm2835_isp_lens_shading *ls =
 			reinterpret_cast<bcm2835_isp_lens_shading *>(s.data());
-		ls->dmabuf = lsTable_.fd();
+		/* The IPA passes the index of the table it has written. */
+		ASSERT(static_cast<size_t>(ls->dmabuf) < lsTables_.size());
+		ls->dmabuf = lsTables_[ls->dmabuf].fd();
+	}
+
+	/*
+	 * A shared ISP may be processing a frame of another camera, the
+	 * controls are applied when the next frame of this camera starts.
+	 */
+	if (ispScheduler_) {
+		for (const auto &ctrl : ctrls) {
+			ispControls_.set(ctrl.first, ctrl.second);
+			pendingIspControls_.set(ctrl.first, ctrl.second);
+		}
+	} else {
+		isp_[Isp::Input].dev()->setControls(&ctrls);
 	}
 
-	isp_[Isp::Input].dev()->setControls(&ctrls);
 	handleState();
 }
 
@@ -1376,6 +1974,21 @@ void RPiCameraData::setDelayedControls(const ControlList &controls)
 	handleState();
 }
 
+void RPiCameraData::setLensControls(const ControlList &controls)
+{
+	V4L2Subdevice *lens = sensor_->focusLens();
+	if (!lens)
+		return;
+
+	/*
+	 * The lens is not synchronised with the sensor frames, the focus
+	 * algorithm allows for the time the lens takes to move and settle.
+	 */
+	ControlList ctrls = controls;
+	if (lens->setControls(&ctrls))
+		LOG(RPI, Error) << "Failed to set lens controls";
+}
+
 void RPiCameraData::unicamBufferDequeue(FrameBuffer *buffer)
 {
 	RPi::Stream *stream = nullptr;
@@ -1410,11 +2023,34 @@ void RPiCameraData::unicamBufferDequeue(FrameBuffer *buffer)
 		 * as it does not receive the FrameBuffer object.
 		 */
 		ctrl.set(controls::SensorTimestamp, buffer->metadata().timestamp);
-		bayerQueue_.push({ buffer, std::move(ctrl) });
+
+		/* Measure the frame interval to derive the IPA deadlines. */
+		const FrameMetadata &metadata = buffer->metadata();
+		if (lastTimestamp_ && metadata.sequence == lastSequence_ + 1 &&
+		    metadata.timestamp > lastTimestamp_)
+			frameInterval_ = std::chrono::nanoseconds(metadata.timestamp - lastTimestamp_);
+		lastSequence_ = metadata.sequence;
+		lastTimestamp_ = metadata.timestamp;
+
+		int bracket = delayedCtrls_->bracketIndex(buffer->metadata().sequence);
+		if (bracket >= 0)
+			ctrl.set(controls::ExposureBracketIndex, bracket);
+
+		matcher_.queueBayer(buffer, std::move(ctrl));
 	} else {
-		embeddedQueue_.push(buffer);
+		matcher_.queueEmbedded(buffer);
 	}
+}
 
+void RPiCameraData::unicamBatchDequeued()
+{
+	if (state_ == State::Stopped)
+		return;
+
+	/*
+	 * Process all the buffers dequeued in the batch together, once they
+	 * have all been added to the bayer and embedded data queues.
+	 */
 	handleState();
 }
 
@@ -1427,8 +2063,15 @@ void RPiCameraData::ispInputDequeue(FrameBuffer *buffer)
 			<< ", buffer id " << unicam_[Unicam::Image].getBufferId(buffer)
 			<< ", timestamp: " << buffer->metadata().timestamp;
 
+	ispBusy_ = false;
+
 	/* The ISP input buffer gets re-queued into Unicam. */
 	handleStreamBuffer(buffer, &unicam_[Unicam::Image]);
+
+	/* Let the other cameras use a shared ISP once the frame is done. */
+	if (ispScheduler_ && !--ispJobBuffers_)
+		ispScheduler_->jobDone(this);
+
 	handleState();
 }
 
@@ -1461,6 +2104,10 @@ void RPiCameraData::ispOutputDequeue(FrameBuffer *buffer)
 	 */
 	if (stream == &isp_[Isp::Stats]) {
 		ipa_->signalStatReady(ipa::RPi::MaskStats | static_cast<unsigned int>(index));
+
+		statsDeadlines_.push_back(utils::clock::now() + frameInterval_);
+		if (statsDeadlines_.size() == 1)
+			startStatsTimer();
 	} else {
 		/* Any other ISP output can be handed back to the application now. */
 		handleStreamBuffer(buffer, stream);
@@ -1472,6 +2119,9 @@ void RPiCameraData::ispOutputDequeue(FrameBuffer *buffer)
 	 */
 	ispOutputCount_++;
 
+	if (ispScheduler_ && !--ispJobBuffers_)
+		ispScheduler_->jobDone(this);
+
 	handleState();
 }
 
@@ -1533,15 +2183,30 @@ void RPiCameraData::handleStreamBuffer(FrameBuffer *buffer, RPi::Stream *stream)
 		/*
 		 * It is possible to be here without a pending request, so check
 		 * that we actually have one to action, otherwise we just return
-		 * buffer back to the stream.
+		 * buffer back to the stream. The buffer belongs to one of the
+		 * frames being processed, look for its request.
 		 */
-		Request *request = requestQueue_.empty() ? nullptr : requestQueue_.front();
-		if (!dropFrameCount_ && request && request->findBuffer(stream) == buffer) {
+		Request *request = nullptr;
+		unsigned int frames = std::min<size_t>(std::max(framesInFlight_, 1u),
+						       requestQueue_.size());
+		for (unsigned int i = 0; i < frames; i++) {
+			if (requestQueue_[i]->findBuffer(stream) == buffer) {
+				request = requestQueue_[i];
+				break;
+			}
+		}
+
+		if (!dropFrameCount_ && request) {
 			/*
 			 * Check if this is an externally provided buffer, and if
 			 * so, we must stop tracking it in the pipeline handler.
 			 */
 			handleExternalBuffer(buffer, stream);
+			/* The last ISP output completes the ISP processing. */
+			if (stream != &unicam_[Unicam::Image] &&
+			    stream != &unicam_[Unicam::Embedded])
+				request->metadata().set(controls::IspDoneTimestamp,
+							static_cast<int64_t>(buffer->metadata().dequeueTimestamp));
 			/*
 			 * Tag the buffer as completed, returning it to the
 			 * application.
@@ -1575,7 +2240,6 @@ void RPiCameraData::handleState()
 {
 	switch (state_) {
 	case State::Stopped:
-	case State::Busy:
 		break;
 
 	case State::IpaComplete:
@@ -1587,6 +2251,7 @@ void RPiCameraData::handleState()
 		 */
 		[[fallthrough]];
 
+	case State::Busy:
 	case State::Idle:
 		tryRunPipeline();
 		break;
@@ -1595,37 +2260,42 @@ void RPiCameraData::handleState()
 
 void RPiCameraData::checkRequestCompleted()
 {
-	bool requestCompleted = false;
-	/*
-	 * If we are dropping this frame, do not touch the request, simply
-	 * change the state to IDLE when ready.
-	 */
-	if (!dropFrameCount_) {
-		Request *request = requestQueue_.front();
-		if (request->hasPendingBuffers())
-			return;
+	while (state_ == State::IpaComplete) {
+		bool requestCompleted = false;
+		/*
+		 * If we are dropping this frame, do not touch the request, simply
+		 * change the state to IDLE when ready.
+		 */
+		if (!dropFrameCount_) {
+			Request *request = requestQueue_.front();
+			if (request->hasPendingBuffers())
+				return;
+
+			pipe_->completeRequest(request);
+			requestQueue_.pop_front();
+			requestCompleted = true;
+		}
 
-		/* Must wait for metadata to be filled in before completing. */
-		if (state_ != State::IpaComplete)
+		/*
+		 * Make sure we have three outputs completed in the case of a dropped
+		 * frame.
+		 */
+		if (!((ispOutputCount_ == 3 && dropFrameCount_) || requestCompleted))
 			return;
 
-		pipe_->completeRequest(request);
-		requestQueue_.pop_front();
-		requestCompleted = true;
-	}
-
-	/*
-	 * Make sure we have three outputs completed in the case of a dropped
-	 * frame.
-	 */
-	if (state_ == State::IpaComplete &&
-	    ((ispOutputCount_ == 3 && dropFrameCount_) || requestCompleted)) {
-		state_ = State::Idle;
 		if (dropFrameCount_) {
 			dropFrameCount_--;
 			LOG(RPI, Info) << "Dropping frame at the request of the IPA ("
 				       << dropFrameCount_ << " left)";
 		}
+
+		/* Move on to the next frame being processed, if any. */
+		framesInFlight_--;
+		framesIpaComplete_--;
+		if (!framesInFlight_)
+			state_ = State::Idle;
+		else if (!framesIpaComplete_)
+			state_ = State::Busy;
 	}
 }
 
@@ -1653,7 +2323,11 @@ void RPiCameraData::applyScalerCrop(const ControlList &controls)
 		ispCrop = size.centeredTo(ispCrop.center()).enclosedIn(Rectangle(sensorInfo_.outputSize));
 
 		if (ispCrop != ispCrop_) {
-			isp_[Isp::Input].dev()->setSelection(V4L2_SEL_TGT_CROP, &ispCrop);
+			/* A shared ISP gets the crop when the next frame starts. */
+			if (!ispScheduler_)
+				isp_[Isp::Input].dev()->setSelection(V4L2_SEL_TGT_CROP, &ispCrop);
+			else
+				ispCropChanged_ = true;
 			ispCrop_ = ispCrop;
 
 			/*
@@ -1668,6 +2342,203 @@ void RPiCameraData::applyScalerCrop(const ControlList &controls)
 	}
 }
 
+/*
+ * Alternate the exposure time frame by frame through DelayedControls, which
+ * scales the exposure computed by the IPA for each frame queued to the sensor.
+ * The IPA sees the exposure actually used in the sensor controls of each
+ * frame, which keeps the AGC consistent.
+ */
+void RPiCameraData::applyExposureBracket(const ControlList &controls)
+{
+	if (!controls.contains(controls::ExposureBracket))
+		return;
+
+	std::vector<double> gains;
+	for (float ev : controls.get(controls::ExposureBracket))
+		gains.push_back(std::exp2(ev));
+
+	delayedCtrls_->setBracket(V4L2_CID_EXPOSURE, gains);
+}
+
+void RPiCameraData::setIspScheduler(IspScheduler *scheduler)
+{
+	ispScheduler_ = scheduler;
+	ispControls_ = ControlList(isp_[Isp::Input].dev()->controls());
+	pendingIspControls_ = ControlList(isp_[Isp::Input].dev()->controls());
+
+	/*
+	 * The ISP can't export buffers while it is in use by another camera,
+	 * allocate them from the dmaHeap instead.
+	 */
+	for (RPi::Stream &stream : isp_) {
+		stream.setShared([this](RPi::Stream *s, unsigned int count,
+					std::vector<std::unique_ptr<FrameBuffer>> *buffers) {
+			return allocateIspBuffers(s, count, buffers);
+		});
+	}
+}
+
+int RPiCameraData::setIspFormat(Isp isp, V4L2DeviceFormat *format)
+{
+	RPi::Stream &stream = isp_[isp];
+	int ret;
+
+	/*
+	 * The format of a shared ISP is set when the ISP switches to the
+	 * camera, only check that it is supported here.
+	 */
+	if (stream.isShared())
+		ret = stream.dev()->tryFormat(format);
+	else
+		ret = stream.dev()->setFormat(format);
+	if (ret)
+		return ret;
+
+	ispFormats_[static_cast<unsigned int>(isp)] = *format;
+
+	return 0;
+}
+
+int RPiCameraData::allocateIspBuffers(RPi::Stream *stream, unsigned int count,
+				      std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	const V4L2DeviceFormat &format = ispFormats_[stream - isp_.data()];
+
+	for (unsigned int i = 0; i < count; i++) {
+		std::vector<FrameBuffer::Plane> planes;
+
+		for (unsigned int p = 0; p < format.planesCount; p++) {
+			FrameBuffer::Plane plane;
+			plane.fd = dmaHeap_.alloc(stream->name().c_str(),
+						  format.planes[p].size);
+			if (!plane.fd.isValid()) {
+				buffers->clear();
+				return -ENOMEM;
+			}
+
+			plane.length = format.planes[p].size;
+			planes.push_back(std::move(plane));
+		}
+
+		buffers->push_back(std::make_unique<FrameBuffer>(planes));
+	}
+
+	return count;
+}
+
+int RPiCameraData::ispAttach()
+{
+	unsigned int i = 0;
+	int ret;
+
+	for (RPi::Stream &stream : isp_) {
+		V4L2DeviceFormat format = ispFormats_[i++];
+
+		ret = stream.dev()->setFormat(&format);
+		if (ret)
+			return ret;
+	}
+
+	for (RPi::Stream &stream : isp_) {
+		ret = stream.attach();
+		if (ret) {
+			ispDetach();
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+void RPiCameraData::ispDetach()
+{
+	for (RPi::Stream &stream : isp_)
+		stream.detach();
+}
+
+void RPiCameraData::ispRunJob(bool switched)
+{
+	/*
+	 * After a switch, the ISP has the crop and controls of the camera it
+	 * last processed a frame for. Restore all of ours.
+	 */
+	if (switched || ispCropChanged_)
+		isp_[Isp::Input].dev()->setSelection(V4L2_SEL_TGT_CROP, &ispCrop_);
+	ispCropChanged_ = false;
+
+	ControlList &ctrls = switched ? ispControls_ : pendingIspControls_;
+	if (!ctrls.empty()) {
+		ControlList ispCtrls = ctrls;
+		isp_[Isp::Input].dev()->setControls(&ispCtrls);
+	}
+	pendingIspControls_.clear();
+
+	/*
+	 * Queue a buffer to each output, and then the frame to the input. The
+	 * frame is done when all of them have been dequeued.
+	 */
+	ispJobBuffers_ = isp_.size();
+	isp_[Isp::Output0].arm();
+	isp_[Isp::Output1].arm();
+	isp_[Isp::Stats].arm();
+	isp_[Isp::Input].arm();
+}
+
+void IspScheduler::queueJob(RPiCameraData *data)
+{
+	jobs_.push_back(data);
+	schedule();
+}
+
+void IspScheduler::jobDone(RPiCameraData *data)
+{
+	ASSERT(running_ && active_ == data);
+
+	running_ = false;
+	schedule();
+}
+
+void IspScheduler::stop(RPiCameraData *data)
+{
+	jobs_.erase(std::remove(jobs_.begin(), jobs_.end(), data), jobs_.end());
+
+	if (active_ == data) {
+		data->ispDetach();
+		active_ = nullptr;
+		running_ = false;
+	}
+
+	schedule();
+}
+
+void IspScheduler::schedule()
+{
+	while (!running_ && !jobs_.empty()) {
+		RPiCameraData *data = jobs_.front();
+		jobs_.pop_front();
+
+		bool switched = active_ != data;
+		if (switched) {
+			if (active_)
+				active_->ispDetach();
+			active_ = nullptr;
+
+			int ret = data->ispAttach();
+			if (ret) {
+				LOG(RPI, Error)
+					<< "Failed to switch the ISP to camera "
+					<< data->sensor_->id() << ": " << ret;
+				continue;
+			}
+
+			active_ = data;
+		}
+
+		running_ = true;
+		data->ispRunJob(switched);
+	}
+}
+
 void RPiCameraData::fillRequestMetadata(const ControlList &bufferControls,
 					Request *request)
 {
@@ -1675,26 +2546,68 @@ void RPiCameraData::fillRequestMetadata(const ControlList &bufferControls,
 				bufferControls.get(controls::SensorTimestamp));
 
 	request->metadata().set(controls::ScalerCrop, scalerCrop_);
+
+	if (bufferControls.contains(controls::ExposureBracketIndex))
+		request->metadata().set(controls::ExposureBracketIndex,
+					bufferControls.get(controls::ExposureBracketIndex));
+
+	request->metadata().set(controls::IpaLate, false);
+	request->metadata().set(controls::IpaLateFrames, ipaLateFrames_);
+
+	if (sensorMetadata_) {
+		request->metadata().set(controls::SensorFrameMismatches,
+					static_cast<int32_t>(matcher_.mismatches()));
+		request->metadata().set(controls::SensorFramesDropped,
+					static_cast<int32_t>(matcher_.dropped()));
+	}
 }
 
 void RPiCameraData::tryRunPipeline()
 {
 	FrameBuffer *embeddedBuffer;
-	BayerFrame bayerFrame;
+	RPi::BufferMatcher::BayerFrame bayerFrame;
 
-	/* If any of our request or buffer queues are empty, we cannot proceed. */
-	if (state_ != State::Idle || requestQueue_.empty() ||
-	    bayerQueue_.empty() || (embeddedQueue_.empty() && sensorMetadata_))
+	if (state_ == State::Stopped)
+		return;
+
+	/*
+	 * Only start a frame when the pipeline isn't full. The IPA prepares
+	 * one frame at a time, and the ISP parameters (including the shared
+	 * lens shading table) must not change while the ISP processes a
+	 * frame. Dropped frames don't own a request, so the pipeline is
+	 * limited to one of them at a time.
+	 */
+	unsigned int depth = dropFrameCount_ || lowLatency_ ? 1 : pipelineDepth_;
+	if (framesInFlight_ >= depth ||
+	    (framesInFlight_ && (ipaPreparing_ || ispBusy_))) {
+		/*
+		 * A frame is held back while a request is ready for it. Blame
+		 * the stage it waits for if Unicam runs out of buffers and
+		 * frames get dropped.
+		 */
+		if (matcher_.hasBayer() && requestQueue_.size() > framesInFlight_)
+			frameDropReason_ = ispBusy_ ? controls::FrameDropIspLate
+						    : controls::FrameDropIpaLate;
+		return;
+	}
+
+	/*
+	 * If the request or Bayer queues are empty, we cannot proceed. The
+	 * embedded data queue is checked when matching buffers, which also
+	 * drops the Bayer frames whose embedded data got lost.
+	 */
+	if (requestQueue_.size() <= framesInFlight_ || !matcher_.hasBayer())
 		return;
 
 	if (!findMatchingBuffers(bayerFrame, embeddedBuffer))
 		return;
 
-	/* Take the first request from the queue and action the IPA. */
-	Request *request = requestQueue_.front();
+	/* Take the next request from the queue and action the IPA. */
+	Request *request = requestQueue_[framesInFlight_];
 
-	/* See if a new ScalerCrop value needs to be applied. */
+	/* See if a new ScalerCrop value or exposure bracket needs to be applied. */
 	applyScalerCrop(request->controls());
+	applyExposureBracket(request->controls());
 
 	/*
 	 * Clear the request metadata and fill it with some initial non-IPA
@@ -1703,6 +2616,8 @@ void RPiCameraData::tryRunPipeline()
 	 */
 	request->metadata().clear();
 	fillRequestMetadata(bayerFrame.controls, request);
+	request->metadata().set(controls::FrameDequeueTimestamp,
+				static_cast<int64_t>(bayerFrame.buffer->metadata().dequeueTimestamp));
 
 	/*
 	 * Process all the user controls by the IPA. Once this is complete, we
@@ -1712,13 +2627,19 @@ void RPiCameraData::tryRunPipeline()
 	ipa_->signalQueueRequest(request->controls());
 
 	/* Set our state to say the pipeline is active. */
-	state_ = State::Busy;
+	if (state_ == State::Idle)
+		state_ = State::Busy;
+	framesInFlight_++;
+	ipaPreparing_ = true;
 
 	unsigned int bayerId = unicam_[Unicam::Image].getBufferId(bayerFrame.buffer);
 
 	LOG(RPI, Debug) << "Signalling signalIspPrepare:"
 			<< " Bayer buffer id: " << bayerId;
 
+	preparingBuffer_ = bayerFrame.buffer;
+	prepareTimer_.start(utils::clock::now() + frameInterval_);
+
 	ipa::RPi::ISPConfig ispPrepare;
 	ispPrepare.bayerBufferId = ipa::RPi::MaskBayerData | bayerId;
 	ispPrepare.controls = std::move(bayerFrame.controls);
@@ -1736,124 +2657,20 @@ void RPiCameraData::tryRunPipeline()
 	ipa_->signalIspPrepare(ispPrepare);
 }
 
-bool RPiCameraData::findMatchingBuffers(BayerFrame &bayerFrame, FrameBuffer *&embeddedBuffer)
+bool RPiCameraData::findMatchingBuffers(RPi::BufferMatcher::BayerFrame &bayerFrame,
+					FrameBuffer *&embeddedBuffer)
 {
-	unsigned int embeddedRequeueCount = 0, bayerRequeueCount = 0;
-
-	/* Loop until we find a matching bayer and embedded data buffer. */
-	while (!bayerQueue_.empty()) {
-		/* Start with the front of the bayer queue. */
-		FrameBuffer *bayerBuffer = bayerQueue_.front().buffer;
-
-		/*
-		 * Find the embedded data buffer with a matching timestamp to pass to
-		 * the IPA. Any embedded buffers with a timestamp lower than the
-		 * current bayer buffer will be removed and re-queued to the driver.
-		 */
-		uint64_t ts = bayerBuffer->metadata().timestamp;
-		embeddedBuffer = nullptr;
-		while (!embeddedQueue_.empty()) {
-			FrameBuffer *b = embeddedQueue_.front();
-			if (!unicam_[Unicam::Embedded].isExternal() && b->metadata().timestamp < ts) {
-				embeddedQueue_.pop();
-				unicam_[Unicam::Embedded].queueBuffer(b);
-				embeddedRequeueCount++;
-				LOG(RPI, Warning) << "Dropping unmatched input frame in stream "
-						  << unicam_[Unicam::Embedded].name();
-			} else if (unicam_[Unicam::Embedded].isExternal() || b->metadata().timestamp == ts) {
-				/* We pop the item from the queue lower down. */
-				embeddedBuffer = b;
-				break;
-			} else {
-				break; /* Only higher timestamps from here. */
-			}
-		}
-
-		if (!embeddedBuffer) {
-			bool flushedBuffers = false;
-
-			LOG(RPI, Debug) << "Could not find matching embedded buffer";
-
-			if (!sensorMetadata_) {
-				/*
-				 * If there is no sensor metadata, simply return the
-				 * first bayer frame in the queue.
-				 */
-				LOG(RPI, Debug) << "Returning bayer frame without a match";
-				bayerFrame = std::move(bayerQueue_.front());
-				bayerQueue_.pop();
-				embeddedBuffer = nullptr;
-				return true;
-			}
-
-			if (!embeddedQueue_.empty()) {
-				/*
-				 * Not found a matching embedded buffer for the bayer buffer in
-				 * the front of the queue. This buffer is now orphaned, so requeue
-				 * it back to the device.
-				 */
-				unicam_[Unicam::Image].queueBuffer(bayerQueue_.front().buffer);
-				bayerQueue_.pop();
-				bayerRequeueCount++;
-				LOG(RPI, Warning) << "Dropping unmatched input frame in stream "
-						  << unicam_[Unicam::Image].name();
-			}
-
-			/*
-			 * If we have requeued all available embedded data buffers in this loop,
-			 * then we are fully out of sync, so might as well requeue all the pending
-			 * bayer buffers.
-			 */
-			if (embeddedRequeueCount == unicam_[Unicam::Embedded].getBuffers().size()) {
-				/* The embedded queue must be empty at this point! */
-				ASSERT(embeddedQueue_.empty());
-
-				LOG(RPI, Warning) << "Flushing bayer stream!";
-				while (!bayerQueue_.empty()) {
-					unicam_[Unicam::Image].queueBuffer(bayerQueue_.front().buffer);
-					bayerQueue_.pop();
-				}
-				flushedBuffers = true;
-			}
-
-			/*
-			 * Similar to the above, if we have requeued all available bayer buffers in
-			 * the loop, then we are fully out of sync, so might as well requeue all the
-			 * pending embedded data buffers.
-			 */
-			if (bayerRequeueCount == unicam_[Unicam::Image].getBuffers().size()) {
-				/* The bayer queue must be empty at this point! */
-				ASSERT(bayerQueue_.empty());
-
-				LOG(RPI, Warning) << "Flushing embedded data stream!";
-				while (!embeddedQueue_.empty()) {
-					unicam_[Unicam::Embedded].queueBuffer(embeddedQueue_.front());
-					embeddedQueue_.pop();
-				}
-				flushedBuffers = true;
-			}
-
-			/*
-			 * If the embedded queue has become empty, we cannot do any more.
-			 * Similarly, if we have flushed any one of our queues, we cannot do
-			 * any more. Return from here without a buffer pair.
-			 */
-			if (embeddedQueue_.empty() || flushedBuffers)
-				return false;
-		} else {
-			/*
-			 * We have found a matching bayer and embedded data buffer, so
-			 * nothing more to do apart from assigning the bayer frame and
-			 * popping the buffers from the queue.
-			 */
-			bayerFrame = std::move(bayerQueue_.front());
-			bayerQueue_.pop();
-			embeddedQueue_.pop();
-			return true;
-		}
-	}
+	/*
+	 * In low latency mode, skip the frames that queued up while the
+	 * pipeline was busy in favour of the newest one, along with their
+	 * embedded data. Raw frames captured to application buffers can't be
+	 * skipped.
+	 */
+	if (lowLatency_ && !unicam_[Unicam::Image].isExternal() &&
+	    matcher_.skipToNewest())
+		frameDropReason_ = controls::FrameDropPipelineLate;
 
-	return false;
+	return matcher_.match(&bayerFrame, &embeddedBuffer);
 }
 
 REGISTER_PIPELINE_HANDLER(PipelineHandlerRPi)
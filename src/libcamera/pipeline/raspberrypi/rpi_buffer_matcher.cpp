@@ -0,0 +1,171 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Ltd.
+ *
+ * rpi_buffer_matcher.cpp - Pairing of Unicam image and embedded data buffers
+ */
+#include "rpi_buffer_matcher.h"
+
+#include <algorithm>
+
+#include <libcamera/buffer.h>
+
+#include "libcamera/internal/log.h"
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(RPI)
+
+namespace RPi {
+
+BufferMatcher::BufferMatcher(ReturnBuffer returnBayer, ReturnBuffer returnEmbedded)
+	: returnBayer_(std::move(returnBayer)),
+	  returnEmbedded_(std::move(returnEmbedded)), sensorMetadata_(false),
+	  embeddedExternal_(false), maxPending_(0), mismatches_(0), dropped_(0)
+{
+}
+
+/*
+ * Configure the matcher when the camera starts, and reset the statistics.
+ *
+ * The embedded data of the Bayer frames waiting for their counterpart can only
+ * be in the embedded buffers owned by the device, and at least one Bayer
+ * buffer must stay queued to the device for capture to continue. Bayer frames
+ * pending beyond either limit can't be matched anymore.
+ */
+void BufferMatcher::configure(bool sensorMetadata, bool embeddedExternal,
+			      size_t bayerBuffers, size_t embeddedBuffers)
+{
+	sensorMetadata_ = sensorMetadata;
+	embeddedExternal_ = embeddedExternal;
+	maxPending_ = std::min(bayerBuffers ? bayerBuffers - 1 : 0,
+			       embeddedBuffers);
+	mismatches_ = 0;
+	dropped_ = 0;
+}
+
+/* Forget about all the queued buffers, when the device has been stopped. */
+void BufferMatcher::clear()
+{
+	bayerQueue_ = {};
+	embeddedQueue_ = {};
+}
+
+void BufferMatcher::queueBayer(FrameBuffer *buffer, ControlList controls)
+{
+	bayerQueue_.push({ buffer, std::move(controls) });
+}
+
+void BufferMatcher::queueEmbedded(FrameBuffer *buffer)
+{
+	embeddedQueue_.push(buffer);
+}
+
+/*
+ * Skip the Bayer frames that queued up while the pipeline was busy in favour
+ * of the newest one, along with their embedded data. Return true if frames
+ * have been skipped.
+ */
+bool BufferMatcher::skipToNewest()
+{
+	if (bayerQueue_.size() <= 1)
+		return false;
+
+	while (bayerQueue_.size() > 1) {
+		returnBayer_(bayerQueue_.front().buffer);
+		bayerQueue_.pop();
+	}
+
+	uint64_t ts = bayerQueue_.front().buffer->metadata().timestamp;
+	while (sensorMetadata_ && !embeddedExternal_ && !embeddedQueue_.empty() &&
+	       embeddedQueue_.front()->metadata().timestamp < ts) {
+		returnEmbedded_(embeddedQueue_.front());
+		embeddedQueue_.pop();
+	}
+
+	return true;
+}
+
+/*
+ * Retrieve the next Bayer frame and its embedded data buffer. The embedded
+ * buffer is set to null when the sensor doesn't produce metadata. Return false
+ * if no pair is available yet.
+ */
+bool BufferMatcher::match(BayerFrame *bayerFrame, FrameBuffer **embeddedBuffer)
+{
+	*embeddedBuffer = nullptr;
+
+	if (bayerQueue_.empty())
+		return false;
+
+	if (!sensorMetadata_) {
+		*bayerFrame = std::move(bayerQueue_.front());
+		bayerQueue_.pop();
+		return true;
+	}
+
+	/*
+	 * Both queues are in timestamp order, as Unicam returns the buffers of
+	 * each stream in capture order. The buffers at the front of the queues
+	 * are thus either a pair, or the older one has lost its counterpart:
+	 * the partner of a buffer can only come after it, and anything the
+	 * other stream captures later has a larger timestamp. Discard the
+	 * orphans until a pair is found or a queue runs empty, in which case
+	 * we wait for more buffers. Every buffer is looked at once.
+	 */
+	while (!bayerQueue_.empty() && !embeddedQueue_.empty()) {
+		FrameBuffer *bayerBuffer = bayerQueue_.front().buffer;
+		FrameBuffer *b = embeddedQueue_.front();
+		uint64_t ts = bayerBuffer->metadata().timestamp;
+
+		if (embeddedExternal_ || b->metadata().timestamp == ts) {
+			*bayerFrame = std::move(bayerQueue_.front());
+			bayerQueue_.pop();
+			*embeddedBuffer = b;
+			embeddedQueue_.pop();
+			return true;
+		}
+
+		if (b->metadata().timestamp < ts)
+			dropEmbedded();
+		else
+			dropBayer();
+	}
+
+	/*
+	 * If embedded data stopped arriving, the Bayer frames would hold on to
+	 * all the Bayer buffers and stall capture. Drop the oldest ones beyond
+	 * the number that can still be matched.
+	 */
+	while (embeddedQueue_.empty() && bayerQueue_.size() > maxPending_)
+		dropBayer();
+
+	LOG(RPI, Debug) << "Could not find matching embedded buffer";
+
+	return false;
+}
+
+void BufferMatcher::dropBayer()
+{
+	LOG_RATELIMITED(RPI, Warning)
+		<< "Dropping unmatched input frame in stream Unicam Image";
+
+	returnBayer_(bayerQueue_.front().buffer);
+	bayerQueue_.pop();
+	mismatches_++;
+	dropped_++;
+}
+
+void BufferMatcher::dropEmbedded()
+{
+	LOG_RATELIMITED(RPI, Warning)
+		<< "Dropping unmatched input frame in stream Unicam Embedded";
+
+	returnEmbedded_(embeddedQueue_.front());
+	embeddedQueue_.pop();
+	mismatches_++;
+}
+
+} /* namespace RPi */
+
+} /* namespace libcamera */
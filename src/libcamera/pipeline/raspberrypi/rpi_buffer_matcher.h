@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Raspberry Pi (Trading) Ltd.
+ *
+ * rpi_buffer_matcher.h - Pairing of Unicam image and embedded data buffers
+ */
+#ifndef __LIBCAMERA_PIPELINE_RPI_BUFFER_MATCHER_H__
+#define __LIBCAMERA_PIPELINE_RPI_BUFFER_MATCHER_H__
+
+#include <functional>
+#include <queue>
+#include <stddef.h>
+
+#include <libcamera/controls.h>
+
+namespace libcamera {
+
+class FrameBuffer;
+
+namespace RPi {
+
+class BufferMatcher
+{
+public:
+	struct BayerFrame {
+		FrameBuffer *buffer;
+		ControlList controls;
+	};
+
+	/* Return a buffer that won't be used to the device it came from. */
+	using ReturnBuffer = std::function<void(FrameBuffer *buffer)>;
+
+	BufferMatcher(ReturnBuffer returnBayer, ReturnBuffer returnEmbedded);
+
+	void configure(bool sensorMetadata, bool embeddedExternal,
+		       size_t bayerBuffers, size_t embeddedBuffers);
+	void clear();
+
+	void queueBayer(FrameBuffer *buffer, ControlList controls);
+	void queueEmbedded(FrameBuffer *buffer);
+
+	bool hasBayer() const { return !bayerQueue_.empty(); }
+
+	bool skipToNewest();
+	bool match(BayerFrame *bayerFrame, FrameBuffer **embeddedBuffer);
+
+	unsigned int mismatches() const { return mismatches_; }
+	unsigned int dropped() const { return dropped_; }
+
+private:
+	void dropBayer();
+	void dropEmbedded();
+
+	ReturnBuffer returnBayer_;
+	ReturnBuffer returnEmbedded_;
+
+	bool sensorMetadata_;
+	bool embeddedExternal_;
+	size_t maxPending_;
+
+	/*
+	 * Buffers dequeued from Unicam and waiting to be paired, in capture
+	 * order. The two streams are captured in step, so their buffers are
+	 * paired by walking the queues in timestamp order.
+	 */
+	std::queue<BayerFrame> bayerQueue_;
+	std::queue<FrameBuffer *> embeddedQueue_;
+
+	unsigned int mismatches_;
+	unsigned int dropped_;
+};
+
+} /* namespace RPi */
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_PIPELINE_RPI_BUFFER_MATCHER_H__ */
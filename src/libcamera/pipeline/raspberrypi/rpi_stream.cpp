@@ -55,6 +55,11 @@ const BufferMap &Stream::getBuffers() const
 	return bufferMap_;
 }
 
+const std::vector<std::unique_ptr<FrameBuffer>> &Stream::getInternalBuffers() const
+{
+	return internalBuffers_;
+}
+
 int Stream::getBufferId(FrameBuffer *buffer) const
 {
 	if (importOnly_)
@@ -84,14 +89,24 @@ void Stream::removeExternalBuffer(FrameBuffer *buffer)
 	bufferMap_.erase(id);
 }
 
-int Stream::prepareBuffers(unsigned int count)
+int Stream::exportBuffers(unsigned int count,
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	/* A shared device can't allocate buffers while another camera uses it. */
+	if (allocator_)
+		return allocator_(this, count, buffers);
+
+	return dev_->exportBuffers(count, buffers);
+}
+
+int Stream::prepareBuffers(unsigned int count, unsigned int externalCount)
 {
 	int ret;
 
 	if (!importOnly_) {
 		if (count) {
 			/* Export some frame buffers for internal use. */
-			ret = dev_->exportBuffers(count, &internalBuffers_);
+			ret = exportBuffers(count, &internalBuffers_);
 			if (ret < 0)
 				return ret;
 
@@ -103,10 +118,18 @@ int Stream::prepareBuffers(unsigned int count)
 				availableBuffers_.push(buffer.get());
 		}
 
-		/* We must import all internal/external exported buffers. */
-		count = bufferMap_.size();
+		/*
+		 * We must import all internal/external exported buffers, and
+		 * leave room for the external buffers to come with requests.
+		 */
+		count = bufferMap_.size() + externalCount;
 	}
 
+	/* A shared device imports the buffers when it gets attached. */
+	importCount_ = count;
+	if (allocator_)
+		return 0;
+
 	return dev_->importBuffers(count);
 }
 
@@ -206,16 +229,109 @@ int Stream::queueAllBuffers()
 	return 0;
 }
 
+void Stream::recycleBuffers()
+{
+	/*
+	 * Make all the internal buffers available again, and drop the external
+	 * buffers, which will be added again by the next requests.
+	 */
+	availableBuffers_ = std::queue<FrameBuffer *>{};
+	requestBuffers_ = std::queue<FrameBuffer *>{};
+	sharedBuffers_ = std::queue<FrameBuffer *>{};
+
+	for (auto const &buffer : internalBuffers_)
+		availableBuffers_.push(buffer.get());
+
+	for (auto it = bufferMap_.begin(); it != bufferMap_.end();) {
+		if (it->first & ipa::RPi::MaskExternalBuffer) {
+			id_.release(it->first & ipa::RPi::MaskID);
+			it = bufferMap_.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
 void Stream::releaseBuffers()
 {
-	dev_->releaseBuffers();
+	/* A detached shared device is owned by another camera, leave it be. */
+	if (!allocator_ || attached_)
+		dev_->releaseBuffers();
 	clearBuffers();
 }
 
+void Stream::setShared(BufferAllocator allocator)
+{
+	allocator_ = std::move(allocator);
+}
+
+bool Stream::isShared() const
+{
+	return !!allocator_;
+}
+
+int Stream::attach()
+{
+	int ret;
+
+	ASSERT(allocator_ && !attached_);
+
+	ret = dev_->importBuffers(importCount_);
+	if (ret)
+		return ret;
+
+	ret = dev_->streamOn();
+	if (ret) {
+		dev_->releaseBuffers();
+		return ret;
+	}
+
+	attached_ = true;
+	armed_ = false;
+
+	return 0;
+}
+
+void Stream::detach()
+{
+	if (!attached_)
+		return;
+
+	/*
+	 * The device gets detached between frames, when none of our buffers
+	 * are queued to it, so nothing gets cancelled here.
+	 */
+	dev_->streamOff();
+	dev_->releaseBuffers();
+
+	attached_ = false;
+	armed_ = false;
+}
+
+void Stream::arm()
+{
+	ASSERT(attached_);
+
+	/*
+	 * Queue the next buffer to the device for the frame about to be
+	 * processed. If there is none yet, the next buffer to arrive goes
+	 * straight to the device.
+	 */
+	armed_ = true;
+	if (sharedBuffers_.empty())
+		return;
+
+	FrameBuffer *buffer = sharedBuffers_.front();
+	sharedBuffers_.pop();
+
+	queueToDevice(buffer);
+}
+
 void Stream::clearBuffers()
 {
 	availableBuffers_ = std::queue<FrameBuffer *>{};
 	requestBuffers_ = std::queue<FrameBuffer *>{};
+	sharedBuffers_ = std::queue<FrameBuffer *>{};
 	internalBuffers_.clear();
 	bufferMap_.clear();
 	id_.reset();
@@ -223,6 +339,15 @@ void Stream::clearBuffers()
 
 int Stream::queueToDevice(FrameBuffer *buffer)
 {
+	if (allocator_) {
+		if (!armed_) {
+			sharedBuffers_.push(buffer);
+			return 0;
+		}
+
+		armed_ = false;
+	}
+
 	LOG(RPISTREAM, Debug) << "Queuing buffer " << getBufferId(buffer)
 			      << " for " << name_;
 
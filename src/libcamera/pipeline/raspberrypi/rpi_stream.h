@@ -7,6 +7,7 @@
 #ifndef __LIBCAMERA_PIPELINE_RPI_STREAM_H__
 #define __LIBCAMERA_PIPELINE_RPI_STREAM_H__
 
+#include <functional>
 #include <queue>
 #include <string>
 #include <unordered_map>
@@ -24,6 +25,15 @@ namespace RPi {
 
 using BufferMap = std::unordered_map<unsigned int, FrameBuffer *>;
 
+class Stream;
+
+/*
+ * Allocates frame buffers for a stream whose device is shared with other
+ * cameras, and thus can't export buffers.
+ */
+using BufferAllocator = std::function<int(Stream *stream, unsigned int count,
+					  std::vector<std::unique_ptr<FrameBuffer>> *buffers)>;
+
 /*
  * Device stream abstraction for either an internal or external stream.
  * Used for both Unicam and the ISP.
@@ -38,7 +48,8 @@ public:
 
 	Stream(const char *name, MediaEntity *dev, bool importOnly = false)
 		: external_(false), importOnly_(importOnly), name_(name),
-		  dev_(std::make_unique<V4L2VideoDevice>(dev)), id_(ipa::RPi::MaskID)
+		  dev_(std::make_unique<V4L2VideoDevice>(dev)), id_(ipa::RPi::MaskID),
+		  importCount_(0), attached_(false), armed_(false)
 	{
 	}
 
@@ -52,18 +63,28 @@ public:
 
 	void setExportedBuffers(std::vector<std::unique_ptr<FrameBuffer>> *buffers);
 	const BufferMap &getBuffers() const;
+	const std::vector<std::unique_ptr<FrameBuffer>> &getInternalBuffers() const;
 	int getBufferId(FrameBuffer *buffer) const;
 
 	void setExternalBuffer(FrameBuffer *buffer);
 	void removeExternalBuffer(FrameBuffer *buffer);
 
-	int prepareBuffers(unsigned int count);
+	int exportBuffers(unsigned int count,
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+	int prepareBuffers(unsigned int count, unsigned int externalCount = 0);
 	int queueBuffer(FrameBuffer *buffer);
 	void returnBuffer(FrameBuffer *buffer);
 
 	int queueAllBuffers();
+	void recycleBuffers();
 	void releaseBuffers();
 
+	void setShared(BufferAllocator allocator);
+	bool isShared() const;
+	int attach();
+	void detach();
+	void arm();
+
 private:
 	class IdGenerator
 	{
@@ -149,6 +170,17 @@ private:
 	 * as the stream needs to maintain ownership of these buffers.
 	 */
 	std::vector<std::unique_ptr<FrameBuffer>> internalBuffers_;
+
+	/*
+	 * A shared device is only attached to the stream while the stream's
+	 * camera owns it. Buffers are then held back in sharedBuffers_, and
+	 * handed to the device one at a time when the stream is armed.
+	 */
+	BufferAllocator allocator_;
+	unsigned int importCount_;
+	bool attached_;
+	bool armed_;
+	std::queue<FrameBuffer *> sharedBuffers_;
 };
 
 /*
@@ -8,11 +8,14 @@
 #include <algorithm>
 #include <array>
 #include <iomanip>
+#include <map>
 #include <memory>
-#include <numeric>
+#include <optional>
 #include <queue>
+#include <tuple>
 
 #include <linux/media-bus-format.h>
+#include <linux/rkisp1-config.h>
 
 #include <libcamera/buffer.h>
 #include <libcamera/camera.h>
@@ -60,8 +63,8 @@ struct RkISP1FrameInfo {
 class RkISP1Frames
 {
 public:
-	RkISP1Frames(PipelineHandler *pipe);
-
+	void init(const std::vector<std::unique_ptr<FrameBuffer>> &paramBuffers,
+		  const std::vector<std::unique_ptr<FrameBuffer>> &statBuffers);
 	RkISP1FrameInfo *create(const RkISP1CameraData *data, Request *request);
 	int destroy(unsigned int frame);
 	void clear();
@@ -71,8 +74,19 @@ public:
 	RkISP1FrameInfo *find(Request *request);
 
 private:
-	PipelineHandlerRkISP1 *pipe_;
-	std::map<unsigned int, RkISP1FrameInfo *> frameInfo_;
+	/*
+	 * Each slot owns a parameters and a statistics buffer, and tracks the
+	 * frame using them, if any. The slots are addressed by the cookies of
+	 * their buffers.
+	 */
+	std::vector<RkISP1FrameInfo> slots_;
+	std::vector<unsigned int> cookieSlots_;
+	std::queue<unsigned int> freeSlots_;
+
+	/* Slots of the frames in flight, by sequence, request and buffer. */
+	std::map<unsigned int, unsigned int> frameSlots_;
+	std::map<const Request *, unsigned int> requestSlots_;
+	std::map<const FrameBuffer *, unsigned int> bufferSlots_;
 };
 
 class RkISP1CameraData : public CameraData
@@ -80,12 +94,14 @@ class RkISP1CameraData : public CameraData
 public:
 	RkISP1CameraData(PipelineHandler *pipe, RkISP1MainPath *mainPath,
 			 RkISP1SelfPath *selfPath)
-		: CameraData(pipe), frame_(0), frameInfo_(pipe),
+		: CameraData(pipe), frame_(0),
 		  mainPath_(mainPath), selfPath_(selfPath)
 	{
 	}
 
 	int loadIPA(unsigned int hwRevision);
+	void queuePendingRequests();
+	void cancelPendingRequests();
 
 	Stream mainPathStream_;
 	Stream selfPathStream_;
@@ -95,6 +111,9 @@ public:
 	std::vector<IPABuffer> ipaBuffers_;
 	RkISP1Frames frameInfo_;
 
+	/* Requests waiting for parameters and statistics buffers. */
+	std::queue<Request *> pendingRequests_;
+
 	RkISP1MainPath *mainPath_;
 	RkISP1SelfPath *selfPath_;
 
@@ -113,11 +132,16 @@ public:
 	RkISP1CameraConfiguration(Camera *camera, RkISP1CameraData *data);
 
 	Status validate() override;
+	unsigned int minRequestDepth() const override;
 
 	const V4L2SubdeviceFormat &sensorFormat() { return sensorFormat_; }
 
+protected:
+	uint64_t internalFrameTraffic() const override;
+
 private:
-	bool fitsAllPaths(const StreamConfiguration &cfg);
+	static uint64_t adjustmentCost(const StreamConfiguration &requested,
+				       const StreamConfiguration &adjusted);
 
 	/*
 	 * The RkISP1CameraData instance is guaranteed to be valid as long as the
@@ -157,7 +181,6 @@ private:
 	}
 
 	friend RkISP1CameraData;
-	friend RkISP1Frames;
 
 	int initLinks(const Camera *camera, const CameraSensor *sensor,
 		      const RkISP1CameraConfiguration &config);
@@ -181,51 +204,65 @@ private:
 
 	std::vector<std::unique_ptr<FrameBuffer>> paramBuffers_;
 	std::vector<std::unique_ptr<FrameBuffer>> statBuffers_;
-	std::queue<FrameBuffer *> availableParamBuffers_;
-	std::queue<FrameBuffer *> availableStatBuffers_;
 
 	Camera *activeCamera_;
 };
 
-RkISP1Frames::RkISP1Frames(PipelineHandler *pipe)
-	: pipe_(static_cast<PipelineHandlerRkISP1 *>(pipe))
+void RkISP1Frames::init(const std::vector<std::unique_ptr<FrameBuffer>> &paramBuffers,
+			const std::vector<std::unique_ptr<FrameBuffer>> &statBuffers)
 {
+	clear();
+
+	unsigned int count = std::min(paramBuffers.size(), statBuffers.size());
+	unsigned int maxCookie = 0;
+
+	slots_.resize(count);
+
+	for (unsigned int i = 0; i < count; i++) {
+		RkISP1FrameInfo &info = slots_[i];
+
+		info = {};
+		info.paramBuffer = paramBuffers[i].get();
+		info.statBuffer = statBuffers[i].get();
+
+		maxCookie = std::max({ maxCookie, info.paramBuffer->cookie(),
+				       info.statBuffer->cookie() });
+		freeSlots_.push(i);
+	}
+
+	cookieSlots_.assign(maxCookie + 1, count);
+	for (unsigned int i = 0; i < count; i++) {
+		cookieSlots_[slots_[i].paramBuffer->cookie()] = i;
+		cookieSlots_[slots_[i].statBuffer->cookie()] = i;
+	}
 }
 
 RkISP1FrameInfo *RkISP1Frames::create(const RkISP1CameraData *data, Request *request)
 {
 	unsigned int frame = data->frame_;
 
-	if (pipe_->availableParamBuffers_.empty()) {
-		LOG(RkISP1, Error) << "Parameters buffer underrun";
+	if (freeSlots_.empty()) {
+		LOG(RkISP1, Debug) << "Parameters and statistics buffers underrun";
 		return nullptr;
 	}
-	FrameBuffer *paramBuffer = pipe_->availableParamBuffers_.front();
 
-	if (pipe_->availableStatBuffers_.empty()) {
-		LOG(RkISP1, Error) << "Statisitc buffer underrun";
-		return nullptr;
-	}
-	FrameBuffer *statBuffer = pipe_->availableStatBuffers_.front();
-
-	FrameBuffer *mainPathBuffer = request->findBuffer(&data->mainPathStream_);
-	FrameBuffer *selfPathBuffer = request->findBuffer(&data->selfPathStream_);
-
-	pipe_->availableParamBuffers_.pop();
-	pipe_->availableStatBuffers_.pop();
-
-	RkISP1FrameInfo *info = new RkISP1FrameInfo;
+	unsigned int slot = freeSlots_.front();
+	RkISP1FrameInfo *info = &slots_[slot];
+	freeSlots_.pop();
 
 	info->frame = frame;
 	info->request = request;
-	info->paramBuffer = paramBuffer;
-	info->mainPathBuffer = mainPathBuffer;
-	info->selfPathBuffer = selfPathBuffer;
-	info->statBuffer = statBuffer;
+	info->mainPathBuffer = request->findBuffer(&data->mainPathStream_);
+	info->selfPathBuffer = request->findBuffer(&data->selfPathStream_);
 	info->paramDequeued = false;
 	info->metadataProcessed = false;
 
-	frameInfo_[frame] = info;
+	frameSlots_[frame] = slot;
+	requestSlots_[request] = slot;
+	if (info->mainPathBuffer)
+		bufferSlots_[info->mainPathBuffer] = slot;
+	if (info->selfPathBuffer)
+		bufferSlots_[info->selfPathBuffer] = slot;
 
 	return info;
 }
@@ -236,36 +273,33 @@ int RkISP1Frames::destroy(unsigned int frame)
 	if (!info)
 		return -ENOENT;
 
-	pipe_->availableParamBuffers_.push(info->paramBuffer);
-	pipe_->availableStatBuffers_.push(info->statBuffer);
+	frameSlots_.erase(info->frame);
+	requestSlots_.erase(info->request);
+	bufferSlots_.erase(info->mainPathBuffer);
+	bufferSlots_.erase(info->selfPathBuffer);
 
-	frameInfo_.erase(info->frame);
-
-	delete info;
+	info->request = nullptr;
+	freeSlots_.push(info - slots_.data());
 
 	return 0;
 }
 
 void RkISP1Frames::clear()
 {
-	for (const auto &entry : frameInfo_) {
-		RkISP1FrameInfo *info = entry.second;
-
-		pipe_->availableParamBuffers_.push(info->paramBuffer);
-		pipe_->availableStatBuffers_.push(info->statBuffer);
+	slots_.clear();
+	cookieSlots_.clear();
+	freeSlots_ = {};
 
-		delete info;
-	}
-
-	frameInfo_.clear();
+	frameSlots_.clear();
+	requestSlots_.clear();
+	bufferSlots_.clear();
 }
 
 RkISP1FrameInfo *RkISP1Frames::find(unsigned int frame)
 {
-	auto itInfo = frameInfo_.find(frame);
-
-	if (itInfo != frameInfo_.end())
-		return itInfo->second;
+	auto it = frameSlots_.find(frame);
+	if (it != frameSlots_.end())
+		return &slots_[it->second];
 
 	LOG(RkISP1, Fatal) << "Can't locate info from frame";
 
@@ -274,16 +308,20 @@ RkISP1FrameInfo *RkISP1Frames::find(unsigned int frame)
 
 RkISP1FrameInfo *RkISP1Frames::find(FrameBuffer *buffer)
 {
-	for (auto &itInfo : frameInfo_) {
-		RkISP1FrameInfo *info = itInfo.second;
+	/* Parameters and statistics buffers map directly to their slot. */
+	unsigned int cookie = buffer->cookie();
+	if (cookie < cookieSlots_.size() && cookieSlots_[cookie] < slots_.size()) {
+		RkISP1FrameInfo *info = &slots_[cookieSlots_[cookie]];
 
-		if (info->paramBuffer == buffer ||
-		    info->statBuffer == buffer ||
-		    info->mainPathBuffer == buffer ||
-		    info->selfPathBuffer == buffer)
+		if (info->request &&
+		    (info->paramBuffer == buffer || info->statBuffer == buffer))
 			return info;
 	}
 
+	auto it = bufferSlots_.find(buffer);
+	if (it != bufferSlots_.end())
+		return &slots_[it->second];
+
 	LOG(RkISP1, Fatal) << "Can't locate info from buffer";
 
 	return nullptr;
@@ -291,12 +329,9 @@ RkISP1FrameInfo *RkISP1Frames::find(FrameBuffer *buffer)
 
 RkISP1FrameInfo *RkISP1Frames::find(Request *request)
 {
-	for (auto &itInfo : frameInfo_) {
-		RkISP1FrameInfo *info = itInfo.second;
-
-		if (info->request == request)
-			return info;
-	}
+	auto it = requestSlots_.find(request);
+	if (it != requestSlots_.end())
+		return &slots_[it->second];
 
 	LOG(RkISP1, Fatal) << "Can't locate info from request";
 
@@ -366,11 +401,56 @@ void RkISP1CameraData::metadataReady(unsigned int frame, const ControlList &meta
 		return;
 
 	info->request->metadata().merge(metadata);
+	info->request->metadata().set(controls::IpaDoneTimestamp,
+				      static_cast<int64_t>(utils::boottime()));
 	info->metadataProcessed = true;
 
 	pipe->tryCompleteRequest(info->request);
 }
 
+/*
+ * Requests are queued to the IPA, which fills their parameters right away,
+ * as long as parameters and statistics buffers are available. The other
+ * requests wait for the completion of the previous frames.
+ */
+void RkISP1CameraData::queuePendingRequests()
+{
+	while (!pendingRequests_.empty()) {
+		Request *request = pendingRequests_.front();
+
+		RkISP1FrameInfo *info = frameInfo_.create(this, request);
+		if (!info)
+			break;
+
+		ipa::rkisp1::RkISP1Event ev;
+		ev.op = ipa::rkisp1::EventQueueRequest;
+		ev.frame = frame_;
+		ev.bufferId = info->paramBuffer->cookie();
+		ev.controls = request->controls();
+		ipa_->processEvent(ev);
+
+		frame_++;
+
+		pendingRequests_.pop();
+	}
+}
+
+void RkISP1CameraData::cancelPendingRequests()
+{
+	while (!pendingRequests_.empty()) {
+		Request *request = pendingRequests_.front();
+
+		for (auto it : request->buffers()) {
+			FrameBuffer *buffer = it.second;
+			buffer->cancel();
+			pipe_->completeBuffer(request, buffer);
+		}
+
+		pipe_->completeRequest(request);
+		pendingRequests_.pop();
+	}
+}
+
 RkISP1CameraConfiguration::RkISP1CameraConfiguration(Camera *camera,
 						     RkISP1CameraData *data)
 	: CameraConfiguration()
@@ -379,19 +459,24 @@ RkISP1CameraConfiguration::RkISP1CameraConfiguration(Camera *camera,
 	data_ = data;
 }
 
-bool RkISP1CameraConfiguration::fitsAllPaths(const StreamConfiguration &cfg)
+/*
+ * Measure how far a path moved a stream configuration from the requested one.
+ * A change of pixel format outweighs any change of size.
+ */
+uint64_t RkISP1CameraConfiguration::adjustmentCost(const StreamConfiguration &requested,
+						   const StreamConfiguration &adjusted)
 {
-	StreamConfiguration config;
-
-	config = cfg;
-	if (data_->mainPath_->validate(&config) != Valid)
-		return false;
+	uint64_t requestedArea = static_cast<uint64_t>(requested.size.width) *
+				 requested.size.height;
+	uint64_t adjustedArea = static_cast<uint64_t>(adjusted.size.width) *
+				adjusted.size.height;
+	uint64_t cost = requestedArea > adjustedArea ? requestedArea - adjustedArea
+						     : adjustedArea - requestedArea;
 
-	config = cfg;
-	if (data_->selfPath_->validate(&config) != Valid)
-		return false;
+	if (adjusted.pixelFormat != requested.pixelFormat)
+		cost += 1ULL << 48;
 
-	return true;
+	return cost;
 }
 
 CameraConfiguration::Status RkISP1CameraConfiguration::validate()
@@ -414,72 +499,83 @@ CameraConfiguration::Status RkISP1CameraConfiguration::validate()
 	}
 
 	/*
-	 * If there are more than one stream in the configuration figure out the
-	 * order to evaluate the streams. The first stream has the highest
-	 * priority but if both main path and self path can satisfy it evaluate
-	 * the second stream first as the first stream is guaranteed to work
-	 * with whichever path is not used by the second one.
+	 * Plan the assignment of the streams to the paths jointly. Each stream
+	 * is validated once on each path, and the possible assignments are
+	 * then ranked. The first stream has the highest priority and should
+	 * preferably be satisfied without adjustment, then the second one.
+	 * Adjustments are kept as small as possible, and the remaining ties are
+	 * broken by writing the fewest bytes per frame to memory, then by using
+	 * the main path for the first stream.
 	 */
-	std::vector<unsigned int> order(config_.size());
-	std::iota(order.begin(), order.end(), 0);
-	if (config_.size() == 2 && fitsAllPaths(config_[0]))
-		std::reverse(order.begin(), order.end());
-
-	bool mainPathAvailable = true;
-	bool selfPathAvailable = true;
-	for (unsigned int index : order) {
-		StreamConfiguration &cfg = config_[index];
-
-		/* Try to match stream without adjusting configuration. */
-		if (mainPathAvailable) {
-			StreamConfiguration tryCfg = cfg;
-			if (data_->mainPath_->validate(&tryCfg) == Valid) {
-				mainPathAvailable = false;
-				cfg = tryCfg;
-				cfg.setStream(const_cast<Stream *>(&data_->mainPathStream_));
-				continue;
-			}
+	RkISP1Path *paths[] = { data_->mainPath_, data_->selfPath_ };
+	const Stream *streams[] = { &data_->mainPathStream_,
+				    &data_->selfPathStream_ };
+
+	StreamConfiguration tryCfgs[2][2];
+	Status tryStatus[2][2];
+	for (unsigned int i = 0; i < config_.size(); i++) {
+		for (unsigned int p = 0; p < 2; p++) {
+			tryCfgs[i][p] = config_[i];
+			tryStatus[i][p] = paths[p]->validate(&tryCfgs[i][p]);
 		}
+	}
 
-		if (selfPathAvailable) {
-			StreamConfiguration tryCfg = cfg;
-			if (data_->selfPath_->validate(&tryCfg) == Valid) {
-				selfPathAvailable = false;
-				cfg = tryCfg;
-				cfg.setStream(const_cast<Stream *>(&data_->selfPathStream_));
-				continue;
-			}
-		}
+	std::optional<std::tuple<Status, Status, uint64_t, uint64_t>> bestRank;
+	unsigned int bestPath = 0;
+
+	for (unsigned int p = 0; p < 2; p++) {
+		Status firstStatus = tryStatus[0][p];
+		Status secondStatus = Valid;
+		uint64_t adjustment = adjustmentCost(config_[0], tryCfgs[0][p]);
+		uint64_t bytes = tryCfgs[0][p].frameSize;
 
-		/* Try to match stream allowing adjusting configuration. */
-		if (mainPathAvailable) {
-			StreamConfiguration tryCfg = cfg;
-			if (data_->mainPath_->validate(&tryCfg) == Adjusted) {
-				mainPathAvailable = false;
-				cfg = tryCfg;
-				cfg.setStream(const_cast<Stream *>(&data_->mainPathStream_));
-				status = Adjusted;
-				continue;
-			}
+		if (config_.size() == 2) {
+			secondStatus = tryStatus[1][1 - p];
+			adjustment += adjustmentCost(config_[1], tryCfgs[1][1 - p]);
+			bytes += tryCfgs[1][1 - p].frameSize;
 		}
 
-		if (selfPathAvailable) {
-			StreamConfiguration tryCfg = cfg;
-			if (data_->selfPath_->validate(&tryCfg) == Adjusted) {
-				selfPathAvailable = false;
-				cfg = tryCfg;
-				cfg.setStream(const_cast<Stream *>(&data_->selfPathStream_));
-				status = Adjusted;
-				continue;
-			}
+		if (firstStatus == Invalid || secondStatus == Invalid)
+			continue;
+
+		auto rank = std::make_tuple(firstStatus, secondStatus,
+					    adjustment, bytes);
+		if (!bestRank || rank < *bestRank) {
+			bestRank = rank;
+			bestPath = p;
 		}
+	}
 
-		/* All paths rejected configuraiton. */
-		LOG(RkISP1, Debug) << "Camera configuration not supported "
-				   << cfg.toString();
+	if (!bestRank) {
+		for (const StreamConfiguration &cfg : config_)
+			LOG(RkISP1, Debug) << "Camera configuration not supported "
+					   << cfg.toString();
 		return Invalid;
 	}
 
+	for (unsigned int i = 0; i < config_.size(); i++) {
+		unsigned int p = i == 0 ? bestPath : 1 - bestPath;
+		StreamConfiguration &cfg = config_[i];
+
+		if (tryStatus[i][p] == Adjusted)
+			status = Adjusted;
+
+		cfg = tryCfgs[i][p];
+		cfg.setStream(const_cast<Stream *>(streams[p]));
+
+		/*
+		 * The paths crop the same ISP output, per-stream cropping
+		 * isn't supported.
+		 */
+		if (!cfg.crop.isNull()) {
+			cfg.crop = {};
+			status = Adjusted;
+		}
+
+		if (adjustStrideAlign(&cfg))
+			status = Adjusted;
+	}
+
 	/* Select the sensor format. */
 	Size maxSize;
 	for (const StreamConfiguration &cfg : config_)
@@ -504,6 +600,27 @@ CameraConfiguration::Status RkISP1CameraConfiguration::validate()
 	return status;
 }
 
+unsigned int RkISP1CameraConfiguration::minRequestDepth() const
+{
+	/*
+	 * The IPA fills the parameters of each request before its buffers are
+	 * queued to the ISP, keep one more request being prepared on top of
+	 * the frame being captured and the next one.
+	 */
+	return 3;
+}
+
+uint64_t RkISP1CameraConfiguration::internalFrameTraffic() const
+{
+	/*
+	 * The ISP processes frames inline from the sensor, only the parameters
+	 * and statistics go through memory. The IPA writes the parameters and
+	 * reads the statistics, the ISP does the opposite.
+	 */
+	return 2 * (sizeof(struct rkisp1_params_cfg) +
+		    sizeof(struct rkisp1_stat_buffer));
+}
+
 PipelineHandlerRkISP1::PipelineHandlerRkISP1(CameraManager *manager)
 	: PipelineHandler(manager)
 {
@@ -672,14 +789,19 @@ int PipelineHandlerRkISP1::exportFrameBuffers([[maybe_unused]] Camera *camera, S
 					      std::vector<std::unique_ptr<FrameBuffer>> *buffers)
 {
 	RkISP1CameraData *data = cameraData(camera);
-	unsigned int count = stream->configuration().bufferCount;
+	const StreamConfiguration &cfg = stream->configuration();
 
-	if (stream == &data->mainPathStream_)
-		return mainPath_.exportBuffers(count, buffers);
-	else if (stream == &data->selfPathStream_)
-		return selfPath_.exportBuffers(count, buffers);
+	if (stream != &data->mainPathStream_ && stream != &data->selfPathStream_)
+		return -EINVAL;
+
+	int ret = allocateFrameBuffers(cfg.bufferCount, { cfg.frameSize }, buffers);
+	if (ret != -ENODEV)
+		return ret;
 
-	return -EINVAL;
+	if (stream == &data->mainPathStream_)
+		return mainPath_.exportBuffers(cfg.bufferCount, buffers);
+	else
+		return selfPath_.exportBuffers(cfg.bufferCount, buffers);
 }
 
 int PipelineHandlerRkISP1::allocateBuffers(Camera *camera)
@@ -705,16 +827,16 @@ int PipelineHandlerRkISP1::allocateBuffers(Camera *camera)
 		buffer->setCookie(ipaBufferId++);
 		data->ipaBuffers_.emplace_back(buffer->cookie(),
 					       buffer->planes());
-		availableParamBuffers_.push(buffer.get());
 	}
 
 	for (std::unique_ptr<FrameBuffer> &buffer : statBuffers_) {
 		buffer->setCookie(ipaBufferId++);
 		data->ipaBuffers_.emplace_back(buffer->cookie(),
 					       buffer->planes());
-		availableStatBuffers_.push(buffer.get());
 	}
 
+	data->frameInfo_.init(paramBuffers_, statBuffers_);
+
 	data->ipa_->mapBuffers(data->ipaBuffers_);
 
 	return 0;
@@ -730,11 +852,7 @@ int PipelineHandlerRkISP1::freeBuffers(Camera *camera)
 {
 	RkISP1CameraData *data = cameraData(camera);
 
-	while (!availableStatBuffers_.empty())
-		availableStatBuffers_.pop();
-
-	while (!availableParamBuffers_.empty())
-		availableParamBuffers_.pop();
+	data->frameInfo_.clear();
 
 	paramBuffers_.clear();
 	statBuffers_.clear();
@@ -830,6 +948,8 @@ void PipelineHandlerRkISP1::stop(Camera *camera)
 
 	isp_->setFrameStartEnabled(false);
 
+	data->cancelPendingRequests();
+
 	data->ipa_->stop();
 
 	selfPath_.stop();
@@ -846,7 +966,6 @@ void PipelineHandlerRkISP1::stop(Camera *camera)
 			<< "Failed to stop parameters for " << camera->id();
 
 	ASSERT(data->queuedRequests_.empty());
-	data->frameInfo_.clear();
 
 	freeBuffers(camera);
 
@@ -857,18 +976,8 @@ int PipelineHandlerRkISP1::queueRequestDevice(Camera *camera, Request *request)
 {
 	RkISP1CameraData *data = cameraData(camera);
 
-	RkISP1FrameInfo *info = data->frameInfo_.create(data, request);
-	if (!info)
-		return -ENOENT;
-
-	ipa::rkisp1::RkISP1Event ev;
-	ev.op = ipa::rkisp1::EventQueueRequest;
-	ev.frame = data->frame_;
-	ev.bufferId = info->paramBuffer->cookie();
-	ev.controls = request->controls();
-	data->ipa_->processEvent(ev);
-
-	data->frame_++;
+	data->pendingRequests_.push(request);
+	data->queuePendingRequests();
 
 	return 0;
 }
@@ -882,11 +991,7 @@ int PipelineHandlerRkISP1::initLinks(const Camera *camera,
 				     const RkISP1CameraConfiguration &config)
 {
 	RkISP1CameraData *data = cameraData(camera);
-	int ret;
-
-	ret = media_->disableLinks();
-	if (ret < 0)
-		return ret;
+	std::vector<MediaLink *> links;
 
 	/*
 	 * Configure the sensor links: enable the link corresponding to this
@@ -902,24 +1007,24 @@ int PipelineHandlerRkISP1::initLinks(const Camera *camera,
 			<< link->source()->entity()->name()
 			<< "' to ISP";
 
-		ret = link->setEnabled(true);
-		if (ret < 0)
-			return ret;
+		links.push_back(link);
 	}
 
 	for (const StreamConfiguration &cfg : config) {
 		if (cfg.stream() == &data->mainPathStream_)
-			ret = data->mainPath_->setEnabled(true);
+			links.push_back(data->mainPath_->link());
 		else if (cfg.stream() == &data->selfPathStream_)
-			ret = data->selfPath_->setEnabled(true);
+			links.push_back(data->selfPath_->link());
 		else
 			return -EINVAL;
-
-		if (ret < 0)
-			return ret;
 	}
 
-	return 0;
+	/*
+	 * Disable all other links. The links that are already in the right
+	 * state, as when reconfiguring the camera with the same streams, are
+	 * left untouched.
+	 */
+	return media_->setupLinks(links);
 }
 
 int PipelineHandlerRkISP1::createCamera(MediaEntity *sensor)
@@ -1064,6 +1169,8 @@ void PipelineHandlerRkISP1::tryCompleteRequest(Request *request)
 	data->frameInfo_.destroy(info->frame);
 
 	completeRequest(request);
+
+	data->queuePendingRequests();
 }
 
 void PipelineHandlerRkISP1::bufferReady(FrameBuffer *buffer)
@@ -1118,6 +1225,11 @@ void PipelineHandlerRkISP1::statReady(FrameBuffer *buffer)
 	ev.op = ipa::rkisp1::EventSignalStatBuffer;
 	ev.frame = info->frame;
 	ev.bufferId = info->statBuffer->cookie();
+	/*
+	 * Pass the sensor controls that were applied to this frame, for the
+	 * algorithms to interpret the statistics against the actual exposure.
+	 */
+	ev.controls = data->delayedCtrls_->get(buffer->metadata().sequence);
 	data->ipa_->processEvent(ev);
 }
 
@@ -53,11 +53,17 @@ StreamConfiguration RkISP1Path::generateConfiguration(const Size &resolution)
 	Size maxResolution = resolution;
 	maxResolution.boundTo(maxResolution_);
 
-	std::map<PixelFormat, std::vector<SizeRange>> streamFormats;
-	for (const PixelFormat &format : formats_)
-		streamFormats[format] = { { minResolution_, maxResolution } };
-
-	StreamFormats formats(streamFormats);
+	/*
+	 * Generate the formats on demand only. The supported formats are
+	 * stored in static tables, which outlive the stream formats.
+	 */
+	StreamFormats formats([pixelFormats = formats_, minResolution = minResolution_,
+			       maxResolution]() {
+		StreamFormats::FormatsMap streamFormats;
+		for (const PixelFormat &format : pixelFormats)
+			streamFormats[format] = { { minResolution, maxResolution } };
+		return streamFormats;
+	});
 	StreamConfiguration cfg(formats);
 	cfg.pixelFormat = formats::NV12;
 	cfg.size = maxResolution;
@@ -79,16 +85,13 @@ CameraConfiguration::Status RkISP1Path::validate(StreamConfiguration *cfg)
 	cfg->size.expandTo(minResolution_);
 	cfg->bufferCount = RKISP1_BUFFER_COUNT;
 
-	V4L2DeviceFormat format;
-	format.fourcc = video_->toV4L2PixelFormat(cfg->pixelFormat);
-	format.size = cfg->size;
-
-	int ret = video_->tryFormat(&format);
-	if (ret)
+	TryFormatResult result = tryFormat(cfg->pixelFormat, cfg->size,
+					   cfg->strideAlign);
+	if (result.ret)
 		return CameraConfiguration::Invalid;
 
-	cfg->stride = format.planes[0].bpl;
-	cfg->frameSize = format.planes[0].size;
+	cfg->stride = result.stride;
+	cfg->frameSize = result.frameSize;
 
 	if (cfg->pixelFormat != reqCfg.pixelFormat || cfg->size != reqCfg.size) {
 		LOG(RkISP1, Debug)
@@ -100,6 +103,34 @@ CameraConfiguration::Status RkISP1Path::validate(StreamConfiguration *cfg)
 	return status;
 }
 
+RkISP1Path::TryFormatResult RkISP1Path::tryFormat(const PixelFormat &pixelFormat,
+						  const Size &size,
+						  unsigned int strideAlign)
+{
+	std::lock_guard<std::mutex> locker(tryFormatLock_);
+
+	auto key = std::make_tuple(pixelFormat, size, strideAlign);
+	auto it = tryFormatCache_.find(key);
+	if (it != tryFormatCache_.end())
+		return it->second;
+
+	V4L2DeviceFormat format;
+	format.fourcc = video_->toV4L2PixelFormat(pixelFormat);
+	format.size = size;
+	format.alignStride(strideAlign);
+
+	TryFormatResult result = {};
+	result.ret = video_->tryFormat(&format);
+	if (!result.ret) {
+		result.stride = format.planes[0].bpl;
+		result.frameSize = format.planes[0].size;
+	}
+
+	tryFormatCache_[key] = result;
+
+	return result;
+}
+
 int RkISP1Path::configure(const StreamConfiguration &config,
 			  const V4L2SubdeviceFormat &inputFormat)
 {
@@ -149,6 +180,7 @@ int RkISP1Path::configure(const StreamConfiguration &config,
 	outputFormat.fourcc = video_->toV4L2PixelFormat(config.pixelFormat);
 	outputFormat.size = config.size;
 	outputFormat.planesCount = info.numPlanes();
+	outputFormat.alignStride(config.strideAlign);
 
 	ret = video_->setFormat(&outputFormat);
 	if (ret)
@@ -7,7 +7,11 @@
 #ifndef __LIBCAMERA_PIPELINE_RKISP1_PATH_H__
 #define __LIBCAMERA_PIPELINE_RKISP1_PATH_H__
 
+#include <map>
 #include <memory>
+#include <mutex>
+#include <tuple>
+#include <utility>
 #include <vector>
 
 #include <libcamera/camera.h>
@@ -34,7 +38,7 @@ public:
 
 	bool init(MediaDevice *media);
 
-	int setEnabled(bool enable) { return link_->setEnabled(enable); }
+	MediaLink *link() const { return link_; }
 	bool isEnabled() const { return link_->flags() & MEDIA_LNK_FL_ENABLED; }
 
 	StreamConfiguration generateConfiguration(const Size &resolution);
@@ -58,6 +62,15 @@ public:
 private:
 	static constexpr unsigned int RKISP1_BUFFER_COUNT = 4;
 
+	struct TryFormatResult {
+		int ret;
+		unsigned int stride;
+		unsigned int frameSize;
+	};
+
+	TryFormatResult tryFormat(const PixelFormat &pixelFormat, const Size &size,
+				  unsigned int strideAlign);
+
 	const char *name_;
 	bool running_;
 
@@ -68,6 +81,13 @@ private:
 	std::unique_ptr<V4L2Subdevice> resizer_;
 	std::unique_ptr<V4L2VideoDevice> video_;
 	MediaLink *link_;
+
+	/*
+	 * The formats supported by the video device don't change, cache the
+	 * result of the format tries to keep validating configurations cheap.
+	 */
+	std::mutex tryFormatLock_;
+	std::map<std::tuple<PixelFormat, Size, unsigned int>, TryFormatResult> tryFormatCache_;
 };
 
 class RkISP1MainPath : public RkISP1Path
@@ -10,7 +10,10 @@
 #include <algorithm>
 #include <limits.h>
 
+#include <linux/v4l2-controls.h>
+
 #include <libcamera/buffer.h>
+#include <libcamera/controls.h>
 #include <libcamera/geometry.h>
 #include <libcamera/signal.h>
 #include <libcamera/stream.h>
@@ -36,13 +39,17 @@ SimpleConverter::Stream::Stream(SimpleConverter *converter, unsigned int index)
 	m2m_->output()->bufferReady.connect(this, &Stream::outputBufferReady);
 	m2m_->capture()->bufferReady.connect(this, &Stream::captureBufferReady);
 
+	/* The input frames come straight from the capture device. */
+	m2m_->output()->setCpuAccess(false);
+
 	int ret = m2m_->open();
 	if (ret < 0)
 		m2m_.reset();
 }
 
 int SimpleConverter::Stream::configure(const StreamConfiguration &inputCfg,
-				       const StreamConfiguration &outputCfg)
+				       const StreamConfiguration &outputCfg,
+				       Transform transform)
 {
 	V4L2PixelFormat videoFormat =
 		m2m_->output()->toV4L2PixelFormat(inputCfg.pixelFormat);
@@ -67,6 +74,26 @@ int SimpleConverter::Stream::configure(const StreamConfiguration &inputCfg,
 		return -EINVAL;
 	}
 
+	/*
+	 * Crop the input, including to reset the crop rectangle when no crop
+	 * is requested, as the selection is persistent.
+	 */
+	Rectangle crop = outputCfg.crop.isNull() ? Rectangle(inputCfg.size)
+						 : outputCfg.crop;
+	Rectangle requestedCrop = crop;
+
+	ret = m2m_->output()->setSelection(V4L2_SEL_TGT_CROP, &crop);
+	if (ret < 0 && !outputCfg.crop.isNull()) {
+		LOG(SimplePipeline, Error)
+			<< "Failed to set crop: " << strerror(-ret);
+		return ret;
+	}
+
+	if (!ret && crop != requestedCrop)
+		LOG(SimplePipeline, Warning)
+			<< "Crop adjusted from " << requestedCrop.toString()
+			<< " to " << crop.toString();
+
 	/* Set the pixel format and size on the output. */
 	videoFormat = m2m_->capture()->toV4L2PixelFormat(outputCfg.pixelFormat);
 	format = {};
@@ -86,6 +113,29 @@ int SimpleConverter::Stream::configure(const StreamConfiguration &inputCfg,
 		return -EINVAL;
 	}
 
+	/*
+	 * Program the flips supported by the converter, including to reset
+	 * them when no transform is requested, as controls are persistent.
+	 */
+	Transform transforms = converter_->transforms();
+	if (!!transforms) {
+		ControlList ctrls(m2m_->capture()->controls());
+
+		if (!!(transforms & Transform::HFlip))
+			ctrls.set(V4L2_CID_HFLIP,
+				  static_cast<int32_t>(!!(transform & Transform::HFlip)));
+		if (!!(transforms & Transform::VFlip))
+			ctrls.set(V4L2_CID_VFLIP,
+				  static_cast<int32_t>(!!(transform & Transform::VFlip)));
+
+		ret = m2m_->capture()->setControls(&ctrls);
+		if (ret < 0) {
+			LOG(SimplePipeline, Error)
+				<< "Failed to set flips: " << strerror(-ret);
+			return ret;
+		}
+	}
+
 	inputBufferCount_ = inputCfg.bufferCount;
 	outputBufferCount_ = outputCfg.bufferCount;
 
@@ -161,6 +211,7 @@ void SimpleConverter::Stream::outputBufferReady(FrameBuffer *buffer)
 	if (!--it->second) {
 		converter_->inputBufferReady.emit(buffer);
 		converter_->queue_.erase(it);
+		converter_->scheduler_->jobDone();
 	}
 }
 
@@ -170,10 +221,46 @@ void SimpleConverter::Stream::captureBufferReady(FrameBuffer *buffer)
 }
 
 /* -----------------------------------------------------------------------------
- * SimpleConverter
+ * SimpleConverterScheduler
+ *
+ * A mem2mem device can be shared by the cameras of several pipeline handler
+ * instances, for instance on boards with two sensors connected to separate
+ * capture devices and a single scaler. Each camera uses its own converter,
+ * whose streams open separate contexts on the device, and the kernel switches
+ * between the contexts for every job.
+ *
+ * The kernel processes the jobs in the order they are queued, which lets a
+ * camera that queues several frames at once starve the others. The scheduler
+ * thus holds the jobs of the converters sharing a device in per-converter
+ * queues, and hands them to the device in round-robin order, with at most
+ * kMaxSharedJobs jobs in flight. A converter running alone on the device
+ * queues its jobs directly.
+ *
+ * All pipeline handlers run in the camera manager thread, the scheduler
+ * doesn't need locking.
  */
 
-SimpleConverter::SimpleConverter(MediaDevice *media)
+namespace {
+
+std::map<std::string, std::weak_ptr<SimpleConverterScheduler>> &schedulers()
+{
+	static std::map<std::string, std::weak_ptr<SimpleConverterScheduler>> schedulers;
+	return schedulers;
+}
+
+} /* namespace */
+
+SimpleConverterScheduler::SimpleConverterScheduler(const std::string &deviceNode)
+	: deviceNode_(deviceNode), inFlight_(0)
+{
+}
+
+/*
+ * Create the scheduler for a mem2mem device acquired by a pipeline handler,
+ * and register it for other pipeline handler instances to share the device.
+ */
+std::shared_ptr<SimpleConverterScheduler>
+SimpleConverterScheduler::create(MediaDevice *media)
 {
 	/*
 	 * Locate the video node. There's no need to validate the pipeline
@@ -185,9 +272,117 @@ SimpleConverter::SimpleConverter(MediaDevice *media)
 				       return entity->function() == MEDIA_ENT_F_IO_V4L;
 			       });
 	if (it == entities.end())
+		return nullptr;
+
+	auto scheduler = std::make_shared<SimpleConverterScheduler>((*it)->deviceNode());
+	schedulers()[media->driver()] = scheduler;
+
+	return scheduler;
+}
+
+/*
+ * Find the scheduler of a mem2mem device already acquired by another pipeline
+ * handler instance.
+ */
+std::shared_ptr<SimpleConverterScheduler>
+SimpleConverterScheduler::find(const std::string &driver)
+{
+	auto iter = schedulers().find(driver);
+	if (iter == schedulers().end())
+		return nullptr;
+
+	return iter->second.lock();
+}
+
+void SimpleConverterScheduler::start(SimpleConverter *converter)
+{
+	clients_.push_back({ converter, {} });
+}
+
+void SimpleConverterScheduler::stop(SimpleConverter *converter)
+{
+	auto iter = std::find_if(clients_.begin(), clients_.end(),
+				 [converter](const Client &client) {
+					 return client.converter == converter;
+				 });
+	if (iter == clients_.end())
 		return;
 
-	deviceNode_ = (*it)->deviceNode();
+	/* Cancel the jobs that haven't been handed to the device. */
+	std::queue<Job> jobs = std::move(iter->jobs);
+	clients_.erase(iter);
+
+	while (!jobs.empty()) {
+		converter->cancel(jobs.front().input, jobs.front().outputs);
+		jobs.pop();
+	}
+
+	schedule();
+}
+
+void SimpleConverterScheduler::queue(SimpleConverter *converter, FrameBuffer *input,
+				     const std::map<unsigned int, FrameBuffer *> &outputs)
+{
+	auto iter = std::find_if(clients_.begin(), clients_.end(),
+				 [converter](const Client &client) {
+					 return client.converter == converter;
+				 });
+	if (iter == clients_.end()) {
+		converter->cancel(input, outputs);
+		return;
+	}
+
+	iter->jobs.push({ input, outputs });
+	schedule();
+}
+
+/* Release the slot of a job completed or cancelled by the device. */
+void SimpleConverterScheduler::jobDone()
+{
+	if (inFlight_)
+		inFlight_--;
+
+	schedule();
+}
+
+void SimpleConverterScheduler::schedule()
+{
+	while (clients_.size() == 1 || inFlight_ < kMaxSharedJobs) {
+		/*
+		 * Serve the first converter with pending jobs, and move it to
+		 * the back of the list to give the others their turn.
+		 */
+		auto iter = std::find_if(clients_.begin(), clients_.end(),
+					 [](const Client &client) {
+						 return !client.jobs.empty();
+					 });
+		if (iter == clients_.end())
+			return;
+
+		Job job = std::move(iter->jobs.front());
+		iter->jobs.pop();
+		clients_.splice(clients_.end(), clients_, iter);
+
+		int ret = iter->converter->process(job.input, job.outputs);
+		if (ret < 0) {
+			LOG(SimplePipeline, Error)
+				<< "Failed to queue buffers to the converter: "
+				<< strerror(-ret);
+			continue;
+		}
+
+		inFlight_++;
+	}
+}
+
+/* -----------------------------------------------------------------------------
+ * SimpleConverter
+ */
+
+SimpleConverter::SimpleConverter(std::shared_ptr<SimpleConverterScheduler> scheduler)
+	: scheduler_(std::move(scheduler)), transforms_(Transform::Identity)
+{
+	deviceNode_ = scheduler_->deviceNode();
 
 	m2m_ = std::make_unique<V4L2M2MDevice>(deviceNode_);
 	int ret = m2m_->open();
@@ -195,6 +390,16 @@ SimpleConverter::SimpleConverter(MediaDevice *media)
 		m2m_.reset();
 		return;
 	}
+
+	/*
+	 * Many scalers can flip the image while converting it, which spares
+	 * applications from flipping frames in software.
+	 */
+	const ControlInfoMap &controls = m2m_->capture()->controls();
+	if (controls.find(V4L2_CID_HFLIP) != controls.end())
+		transforms_ |= Transform::HFlip;
+	if (controls.find(V4L2_CID_VFLIP) != controls.end())
+		transforms_ |= Transform::VFlip;
 }
 
 std::vector<PixelFormat> SimpleConverter::formats(PixelFormat input)
@@ -289,7 +494,8 @@ SimpleConverter::strideAndFrameSize(const PixelFormat &pixelFormat,
 }
 
 int SimpleConverter::configure(const StreamConfiguration &inputCfg,
-			       const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfgs)
+			       const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfgs,
+			       Transform transform)
 {
 	int ret = 0;
 
@@ -306,7 +512,7 @@ int SimpleConverter::configure(const StreamConfiguration &inputCfg,
 			break;
 		}
 
-		ret = stream.configure(inputCfg, outputCfgs[i]);
+		ret = stream.configure(inputCfg, outputCfgs[i], transform);
 		if (ret < 0)
 			break;
 	}
@@ -340,11 +546,15 @@ int SimpleConverter::start()
 		}
 	}
 
+	scheduler_->start(this);
+
 	return 0;
 }
 
 void SimpleConverter::stop()
 {
+	scheduler_->stop(this);
+
 	for (Stream &stream : utils::reverse(streams_))
 		stream.stop();
 }
@@ -353,7 +563,6 @@ int SimpleConverter::queueBuffers(FrameBuffer *input,
 				  const std::map<unsigned int, FrameBuffer *> &outputs)
 {
 	unsigned int mask = 0;
-	int ret;
 
 	/*
 	 * Validate the outputs as a sanity check: at least one output is
@@ -374,6 +583,17 @@ int SimpleConverter::queueBuffers(FrameBuffer *input,
 		mask |= 1 << index;
 	}
 
+	scheduler_->queue(this, input, outputs);
+
+	return 0;
+}
+
+/* Queue a job scheduled by the scheduler to the device. */
+int SimpleConverter::process(FrameBuffer *input,
+			     const std::map<unsigned int, FrameBuffer *> &outputs)
+{
+	int ret;
+
 	/* Queue the input and output buffers to all the streams. */
 	for (auto [index, buffer] : outputs) {
 		ret = streams_[index].queueBuffers(input, buffer);
@@ -393,4 +613,16 @@ int SimpleConverter::queueBuffers(FrameBuffer *input,
 	return 0;
 }
 
+/* Return the buffers of a job that will never be handed to the device. */
+void SimpleConverter::cancel(FrameBuffer *input,
+			     const std::map<unsigned int, FrameBuffer *> &outputs)
+{
+	for (auto [index, buffer] : outputs) {
+		buffer->cancel();
+		outputBufferReady.emit(buffer);
+	}
+
+	inputBufferReady.emit(input);
+}
+
 } /* namespace libcamera */
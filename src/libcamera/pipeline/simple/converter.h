@@ -9,14 +9,17 @@
 #define __LIBCAMERA_PIPELINE_SIMPLE_CONVERTER_H__
 
 #include <functional>
+#include <list>
 #include <map>
 #include <memory>
+#include <queue>
 #include <string>
 #include <tuple>
 #include <vector>
 
 #include <libcamera/pixel_format.h>
 #include <libcamera/signal.h>
+#include <libcamera/transform.h>
 
 #include "libcamera/internal/log.h"
 
@@ -29,10 +32,49 @@ class SizeRange;
 struct StreamConfiguration;
 class V4L2M2MDevice;
 
+class SimpleConverter;
+
+class SimpleConverterScheduler
+{
+public:
+	static std::shared_ptr<SimpleConverterScheduler> create(MediaDevice *media);
+	static std::shared_ptr<SimpleConverterScheduler> find(const std::string &driver);
+
+	SimpleConverterScheduler(const std::string &deviceNode);
+
+	const std::string &deviceNode() const { return deviceNode_; }
+
+	void start(SimpleConverter *converter);
+	void stop(SimpleConverter *converter);
+
+	void queue(SimpleConverter *converter, FrameBuffer *input,
+		   const std::map<unsigned int, FrameBuffer *> &outputs);
+	void jobDone();
+
+private:
+	static constexpr unsigned int kMaxSharedJobs = 2;
+
+	struct Job {
+		FrameBuffer *input;
+		std::map<unsigned int, FrameBuffer *> outputs;
+	};
+
+	struct Client {
+		SimpleConverter *converter;
+		std::queue<Job> jobs;
+	};
+
+	void schedule();
+
+	std::string deviceNode_;
+	std::list<Client> clients_;
+	unsigned int inFlight_;
+};
+
 class SimpleConverter
 {
 public:
-	SimpleConverter(MediaDevice *media);
+	SimpleConverter(std::shared_ptr<SimpleConverterScheduler> scheduler);
 
 	bool isValid() const { return m2m_ != nullptr; }
 
@@ -42,8 +84,11 @@ public:
 	std::tuple<unsigned int, unsigned int>
 	strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size);
 
+	Transform transforms() const { return transforms_; }
+
 	int configure(const StreamConfiguration &inputCfg,
-		      const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfg);
+		      const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfg,
+		      Transform transform = Transform::Identity);
 	int exportBuffers(unsigned int ouput, unsigned int count,
 			  std::vector<std::unique_ptr<FrameBuffer>> *buffers);
 
@@ -57,6 +102,8 @@ public:
 	Signal<FrameBuffer *> outputBufferReady;
 
 private:
+	friend class SimpleConverterScheduler;
+
 	class Stream : protected Loggable
 	{
 	public:
@@ -65,7 +112,8 @@ private:
 		bool isValid() const { return m2m_ != nullptr; }
 
 		int configure(const StreamConfiguration &inputCfg,
-			      const StreamConfiguration &outputCfg);
+			      const StreamConfiguration &outputCfg,
+			      Transform transform);
 		int exportBuffers(unsigned int count,
 				  std::vector<std::unique_ptr<FrameBuffer>> *buffers);
 
@@ -89,8 +137,15 @@ private:
 		unsigned int outputBufferCount_;
 	};
 
+	int process(FrameBuffer *input,
+		    const std::map<unsigned int, FrameBuffer *> &outputs);
+	void cancel(FrameBuffer *input,
+		    const std::map<unsigned int, FrameBuffer *> &outputs);
+
+	std::shared_ptr<SimpleConverterScheduler> scheduler_;
 	std::string deviceNode_;
 	std::unique_ptr<V4L2M2MDevice> m2m_;
+	Transform transforms_;
 
 	std::vector<Stream> streams_;
 	std::map<FrameBuffer *, unsigned int> queue_;
@@ -13,9 +13,11 @@
 #include <memory>
 #include <queue>
 #include <set>
+#include <stdlib.h>
 #include <string>
 #include <string.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -23,18 +25,22 @@
 
 #include <libcamera/camera.h>
 #include <libcamera/control_ids.h>
+#include <libcamera/property_ids.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
+#include <libcamera/transform.h>
 
 #include "libcamera/internal/camera_sensor.h"
 #include "libcamera/internal/device_enumerator.h"
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/pipeline_handler.h"
+#include "libcamera/internal/utils.h"
 #include "libcamera/internal/v4l2_subdevice.h"
 #include "libcamera/internal/v4l2_videodevice.h"
 
 #include "converter.h"
+#include "software_isp.h"
 
 namespace libcamera {
 
@@ -122,6 +128,28 @@ LOG_DEFINE_CATEGORY(SimplePipeline)
  * the pixel formats and sizes that the converter can produce for the output of
  * the capture video node, and stores the information in the outputFormats and
  * outputSizes of the SimpleCameraData::Configuration structure.
+ *
+ * Pipelines without a converter that capture raw Bayer frames can instead
+ * process them on the CPU with the SoftwareIsp, which produces NV12 and
+ * XRGB8888 images of the capture size. The raw formats remain available. The
+ * SoftwareIsp is controlled by the LIBCAMERA_SIMPLE_SOFT_ISP environment
+ * variable.
+ *
+ * When the converter is used, frames are captured to internal buffers and
+ * queued to the converter along with the buffers of all the streams of the
+ * request, which are produced from the same input in a single pass. The
+ * converter can process several frames at the same time, the maximum number
+ * being set by the LIBCAMERA_SIMPLE_CONVERTER_DEPTH environment variable. The
+ * number of internal buffers and of stream buffers are increased accordingly,
+ * to keep enough buffers queued for capture while frames are being converted.
+ * Frames captured while the converter is processing the maximum number of
+ * frames are dropped, and their internal buffer requeued for capture.
+ *
+ * A converter can be shared by the cameras of several pipeline handler
+ * instances, when multiple capture devices are connected to a single
+ * memory-to-memory device. The first pipeline handler acquires the converter
+ * media device, and the others share it through the SimpleConverterScheduler,
+ * which queues the frames of all cameras fairly to the device.
  */
 
 class SimplePipelineHandler;
@@ -137,6 +165,33 @@ struct SimplePipelineInfo {
 
 namespace {
 
+static constexpr unsigned int kMaxConverterDepth = 4;
+
+static unsigned int converterDepth()
+{
+	const char *depth = utils::secure_getenv("LIBCAMERA_SIMPLE_CONVERTER_DEPTH");
+	if (!depth)
+		return 1;
+
+	return std::clamp<unsigned long>(strtoul(depth, nullptr, 10), 1,
+					 kMaxConverterDepth);
+}
+
+static std::unique_ptr<SoftwareIsp> createSoftwareIsp()
+{
+	const char *mode = utils::secure_getenv("LIBCAMERA_SIMPLE_SOFT_ISP");
+	SoftwareIsp::Debayer debayer = SoftwareIsp::Debayer::Bilinear;
+
+	if (mode) {
+		if (!strcmp(mode, "edge"))
+			debayer = SoftwareIsp::Debayer::EdgeAware;
+		else if (strcmp(mode, "bilinear"))
+			return nullptr;
+	}
+
+	return std::make_unique<SoftwareIsp>(debayer);
+}
+
 static const SimplePipelineInfo supportedDevices[] = {
 	{ "imx7-csi", { { "pxp", 1 } } },
 	{ "qcom-camss", {} },
@@ -184,10 +239,15 @@ public:
 
 	std::vector<Configuration> configs_;
 	std::map<PixelFormat, const Configuration *> formats_;
+	StreamFormats streamFormats_;
+
+	Transform rotationTransform_;
 
 	std::vector<std::unique_ptr<FrameBuffer>> converterBuffers_;
 	bool useConverter_;
 	std::queue<std::map<unsigned int, FrameBuffer *>> converterQueue_;
+	/* Number of frames queued to the converter and not released yet. */
+	unsigned int converterInFlight_;
 };
 
 class SimpleCameraConfiguration : public CameraConfiguration
@@ -196,6 +256,7 @@ public:
 	SimpleCameraConfiguration(Camera *camera, SimpleCameraData *data);
 
 	Status validate() override;
+	unsigned int minRequestDepth() const override;
 
 	const SimpleCameraData::Configuration *pipeConfig() const
 	{
@@ -203,6 +264,10 @@ public:
 	}
 
 	bool needConversion() const { return needConversion_; }
+	Transform combinedTransform() const { return combinedTransform_; }
+
+protected:
+	uint64_t internalFrameTraffic() const override;
 
 private:
 	/*
@@ -215,6 +280,7 @@ private:
 
 	const SimpleCameraData::Configuration *pipeConfig_;
 	bool needConversion_;
+	Transform combinedTransform_;
 };
 
 class SimplePipelineHandler : public PipelineHandler
@@ -237,6 +303,9 @@ public:
 	V4L2VideoDevice *video(const MediaEntity *entity);
 	V4L2Subdevice *subdev(const MediaEntity *entity);
 	SimpleConverter *converter() { return converter_.get(); }
+	SoftwareIsp *softwareIsp() { return swIsp_.get(); }
+	unsigned int bufferCount() const;
+	unsigned int conversionDepth() const { return converterDepth_; }
 
 protected:
 	int queueRequestDevice(Camera *camera, Request *request) override;
@@ -261,6 +330,8 @@ private:
 	std::map<const MediaEntity *, V4L2Subdevice> subdevs_;
 
 	std::unique_ptr<SimpleConverter> converter_;
+	std::unique_ptr<SoftwareIsp> swIsp_;
+	unsigned int converterDepth_;
 
 	Camera *activeCamera_;
 };
@@ -272,7 +343,8 @@ private:
 SimpleCameraData::SimpleCameraData(SimplePipelineHandler *pipe,
 				   unsigned int numStreams,
 				   MediaEntity *sensor)
-	: CameraData(pipe), streams_(numStreams)
+	: CameraData(pipe), streams_(numStreams),
+	  rotationTransform_(Transform::Identity), converterInFlight_(0)
 {
 	int ret;
 
@@ -348,6 +420,7 @@ int SimpleCameraData::init()
 {
 	SimplePipelineHandler *pipe = static_cast<SimplePipelineHandler *>(pipe_);
 	SimpleConverter *converter = pipe->converter();
+	SoftwareIsp *swIsp = pipe->softwareIsp();
 	int ret;
 
 	/*
@@ -398,12 +471,17 @@ int SimpleCameraData::init()
 			config.captureFormat = pixelFormat;
 			config.captureSize = format.size;
 
-			if (!converter) {
-				config.outputFormats = { pixelFormat };
-				config.outputSizes = config.captureSize;
-			} else {
+			if (converter) {
 				config.outputFormats = converter->formats(pixelFormat);
 				config.outputSizes = converter->sizes(format.size);
+			} else if (swIsp) {
+				config.outputFormats = swIsp->formats(pixelFormat);
+				config.outputFormats.insert(config.outputFormats.begin(),
+							    pixelFormat);
+				config.outputSizes = swIsp->sizes(format.size);
+			} else {
+				config.outputFormats = { pixelFormat };
+				config.outputSizes = config.captureSize;
 			}
 
 			configs_.push_back(config);
@@ -427,8 +505,28 @@ int SimpleCameraData::init()
 			formats_[fmt] = &config;
 	}
 
+	/* Create the stream formats once, they're shared by all streams. */
+	StreamFormats::FormatsMap streamFormats;
+	for (const auto &[pixelFormat, config] : formats_)
+		streamFormats[pixelFormat] = { config->captureSize };
+	streamFormats_ = StreamFormats(streamFormats);
+
 	properties_ = sensor_->properties();
 
+	/* Convert the sensor rotation to a transformation. */
+	int32_t rotation = 0;
+	if (properties_.contains(properties::Rotation))
+		rotation = properties_.get(properties::Rotation);
+
+	bool success;
+	rotationTransform_ = transformFromRotation(rotation, &success);
+	if (!success) {
+		LOG(SimplePipeline, Warning)
+			<< "Invalid rotation of " << rotation
+			<< " degrees, flips will be ignored";
+		rotationTransform_ = Transform::Identity;
+	}
+
 	return 0;
 }
 
@@ -533,7 +631,8 @@ int SimpleCameraData::setupFormats(V4L2SubdeviceFormat *format,
 SimpleCameraConfiguration::SimpleCameraConfiguration(Camera *camera,
 						     SimpleCameraData *data)
 	: CameraConfiguration(), camera_(camera->shared_from_this()),
-	  data_(data), pipeConfig_(nullptr)
+	  data_(data), pipeConfig_(nullptr), needConversion_(false),
+	  combinedTransform_(Transform::Identity)
 {
 }
 
@@ -544,8 +643,15 @@ CameraConfiguration::Status SimpleCameraConfiguration::validate()
 	if (config_.empty())
 		return Invalid;
 
-	if (transform != Transform::Identity) {
-		transform = Transform::Identity;
+	Transform combined = transform * data_->rotationTransform_;
+
+	/*
+	 * Neither the converter nor the software ISP can transpose images,
+	 * adjust away any transposition as the other pipeline handlers do.
+	 */
+	if (!!(combined & Transform::Transpose)) {
+		transform ^= Transform::Transpose;
+		combined &= ~Transform::Transpose;
 		status = Adjusted;
 	}
 
@@ -574,6 +680,7 @@ CameraConfiguration::Status SimpleCameraConfiguration::validate()
 	/* Adjust the requested streams. */
 	SimplePipelineHandler *pipe = static_cast<SimplePipelineHandler *>(data_->pipe_);
 	SimpleConverter *converter = pipe->converter();
+	SoftwareIsp *swIsp = pipe->softwareIsp();
 
 	/*
 	 * Enable usage of the converter when producing multiple streams, as
@@ -588,6 +695,16 @@ CameraConfiguration::Status SimpleCameraConfiguration::validate()
 	 */
 	needConversion_ = config_.size() > 1;
 
+	/*
+	 * Flips are applied by the converter or the software ISP, when they
+	 * support them. Streams are then routed through them even when no
+	 * format conversion is needed, sparing applications from flipping
+	 * frames in software.
+	 */
+	Transform transforms = converter ? converter->transforms()
+			     : swIsp ? swIsp->transforms() : Transform::Identity;
+	bool convertFlips = !!combined && !(combined & ~transforms);
+
 	for (unsigned int i = 0; i < config_.size(); ++i) {
 		StreamConfiguration &cfg = config_[i];
 
@@ -618,16 +735,51 @@ CameraConfiguration::Status SimpleCameraConfiguration::validate()
 		    cfg.size != pipeConfig_->captureSize)
 			needConversion_ = true;
 
+		/*
+		 * The converter processes each stream independently from the
+		 * captured frames, and can thus crop them separately.
+		 */
+		if (!cfg.crop.isNull()) {
+			const Rectangle bounds(pipeConfig_->captureSize);
+			Rectangle crop;
+
+			if (converter)
+				crop = cfg.crop.boundedTo(bounds);
+			if (!crop.width || !crop.height)
+				crop = {};
+
+			if (crop != cfg.crop) {
+				LOG(SimplePipeline, Debug)
+					<< "Adjusting crop from " << cfg.crop.toString()
+					<< " to " << crop.toString();
+				cfg.crop = crop;
+				status = Adjusted;
+			}
+
+			if (!cfg.crop.isNull() && cfg.crop != bounds)
+				needConversion_ = true;
+		}
+
+		if (convertFlips && !needConversion_) {
+			unsigned int stride;
+			std::tie(stride, std::ignore) = converter
+				? converter->strideAndFrameSize(cfg.pixelFormat, cfg.size)
+				: swIsp->strideAndFrameSize(cfg.pixelFormat, cfg.size);
+			needConversion_ = stride != 0;
+		}
+
 		/* Set the stride, frameSize and bufferCount. */
 		if (needConversion_) {
-			std::tie(cfg.stride, cfg.frameSize) =
-				converter->strideAndFrameSize(cfg.pixelFormat, cfg.size);
+			std::tie(cfg.stride, cfg.frameSize) = converter
+				? converter->strideAndFrameSize(cfg.pixelFormat, cfg.size)
+				: swIsp->strideAndFrameSize(cfg.pixelFormat, cfg.size);
 			if (cfg.stride == 0)
 				return Invalid;
 		} else {
 			V4L2DeviceFormat format;
 			format.fourcc = data_->video_->toV4L2PixelFormat(cfg.pixelFormat);
 			format.size = cfg.size;
+			format.alignStride(cfg.strideAlign);
 
 			int ret = data_->video_->tryFormat(&format);
 			if (ret < 0)
@@ -637,9 +789,24 @@ CameraConfiguration::Status SimpleCameraConfiguration::validate()
 			cfg.frameSize = format.planes[0].size;
 		}
 
-		cfg.bufferCount = 3;
+		if (adjustStrideAlign(&cfg))
+			status = Adjusted;
+
+		cfg.bufferCount = needConversion_ ? pipe->bufferCount() : 3;
 	}
 
+	/*
+	 * If the flips can't be applied, the only user transform that can be
+	 * honoured is the inverse of the sensor rotation.
+	 */
+	if (!!combined && (!needConversion_ || !convertFlips)) {
+		transform = -data_->rotationTransform_;
+		combined = Transform::Identity;
+		status = Adjusted;
+	}
+
+	combinedTransform_ = combined;
+
 	return status;
 }
 
@@ -647,9 +814,50 @@ CameraConfiguration::Status SimpleCameraConfiguration::validate()
  * Pipeline Handler
  */
 
+unsigned int SimpleCameraConfiguration::minRequestDepth() const
+{
+	if (!needConversion_)
+		return CameraConfiguration::minRequestDepth();
+
+	/*
+	 * Frames are captured to internal buffers, and converted to the
+	 * buffers of the requests up to conversionDepth() at a time. Keep one
+	 * more request ready for the next captured frame.
+	 */
+	const SimplePipelineHandler *pipe =
+		static_cast<const SimplePipelineHandler *>(data_->pipe_);
+	return pipe->conversionDepth() + 1;
+}
+
+uint64_t SimpleCameraConfiguration::internalFrameTraffic() const
+{
+	if (!needConversion_ || !pipeConfig_)
+		return 0;
+
+	/*
+	 * The video device writes the frames to an internal buffer, read by
+	 * the converter once for each output stream.
+	 */
+	StreamConfiguration capture;
+	capture.pixelFormat = pipeConfig_->captureFormat;
+	capture.size = pipeConfig_->captureSize;
+
+	return frameSize(capture) * (1 + config_.size());
+}
+
 SimplePipelineHandler::SimplePipelineHandler(CameraManager *manager)
-	: PipelineHandler(manager)
+	: PipelineHandler(manager), converterDepth_(converterDepth())
+{
+}
+
+/*
+ * Number of internal buffers, and of buffers per stream when the converter is
+ * used, enough to keep frames queued for capture while up to converterDepth_
+ * frames are being converted.
+ */
+unsigned int SimplePipelineHandler::bufferCount() const
 {
+	return kNumInternalBuffers + converterDepth_ - 1;
 }
 
 CameraConfiguration *SimplePipelineHandler::generateConfiguration(Camera *camera,
@@ -662,16 +870,6 @@ CameraConfiguration *SimplePipelineHandler::generateConfiguration(Camera *camera
 	if (roles.empty())
 		return config;
 
-	/* Create the formats map. */
-	std::map<PixelFormat, std::vector<SizeRange>> formats;
-	std::transform(data->formats_.begin(), data->formats_.end(),
-		       std::inserter(formats, formats.end()),
-		       [](const auto &format) -> decltype(formats)::value_type {
-			       const PixelFormat &pixelFormat = format.first;
-			       const Size &size = format.second->captureSize;
-			       return { pixelFormat, { size } };
-		       });
-
 	/*
 	 * Create the stream configurations. Take the first entry in the formats
 	 * map as the default, for lack of a better option.
@@ -679,9 +877,9 @@ CameraConfiguration *SimplePipelineHandler::generateConfiguration(Camera *camera
 	 * \todo Implement a better way to pick the default format
 	 */
 	for ([[maybe_unused]] StreamRole role : roles) {
-		StreamConfiguration cfg{ StreamFormats{ formats } };
-		cfg.pixelFormat = formats.begin()->first;
-		cfg.size = formats.begin()->second[0].max;
+		StreamConfiguration cfg{ data->streamFormats_ };
+		cfg.pixelFormat = data->formats_.begin()->first;
+		cfg.size = data->formats_.begin()->second->captureSize;
 
 		config->addConfiguration(cfg);
 	}
@@ -721,6 +919,10 @@ int SimplePipelineHandler::configure(Camera *camera, CameraConfiguration *c)
 	captureFormat.fourcc = videoFormat;
 	captureFormat.size = pipeConfig->captureSize;
 
+	/* Without conversion, the application captures the frames directly. */
+	if (!config->needConversion())
+		captureFormat.alignStride(config->at(0).strideAlign);
+
 	ret = video->setFormat(&captureFormat);
 	if (ret)
 		return ret;
@@ -744,6 +946,13 @@ int SimplePipelineHandler::configure(Camera *camera, CameraConfiguration *c)
 	std::vector<std::reference_wrapper<StreamConfiguration>> outputCfgs;
 	data->useConverter_ = config->needConversion();
 
+	/*
+	 * The frames captured for the hardware converter are never accessed
+	 * by the CPU, unlike the ones processed by the software ISP or
+	 * captured for the application.
+	 */
+	video->setCpuAccess(!data->useConverter_ || !converter_);
+
 	for (unsigned int i = 0; i < config->size(); ++i) {
 		StreamConfiguration &cfg = config->at(i);
 
@@ -760,9 +969,14 @@ int SimplePipelineHandler::configure(Camera *camera, CameraConfiguration *c)
 	inputCfg.pixelFormat = pipeConfig->captureFormat;
 	inputCfg.size = pipeConfig->captureSize;
 	inputCfg.stride = captureFormat.planes[0].bpl;
-	inputCfg.bufferCount = kNumInternalBuffers;
+	inputCfg.bufferCount = bufferCount();
 
-	return converter_->configure(inputCfg, outputCfgs);
+	if (converter_)
+		return converter_->configure(inputCfg, outputCfgs,
+					     config->combinedTransform());
+	else
+		return swIsp_->configure(inputCfg, outputCfgs,
+					 config->combinedTransform());
 }
 
 int SimplePipelineHandler::exportFrameBuffers(Camera *camera, Stream *stream,
@@ -775,11 +989,14 @@ int SimplePipelineHandler::exportFrameBuffers(Camera *camera, Stream *stream,
 	 * Export buffers on the converter or capture video node, depending on
 	 * whether the converter is used or not.
 	 */
-	if (data->useConverter_)
+	if (!data->useConverter_)
+		return data->video_->exportBuffers(count, buffers);
+	else if (converter_)
 		return converter_->exportBuffers(data->streamIndex(stream),
 						 count, buffers);
 	else
-		return data->video_->exportBuffers(count, buffers);
+		return swIsp_->exportBuffers(data->streamIndex(stream),
+					     count, buffers);
 }
 
 int SimplePipelineHandler::start(Camera *camera, [[maybe_unused]] const ControlList *controls)
@@ -790,10 +1007,10 @@ int SimplePipelineHandler::start(Camera *camera, [[maybe_unused]] const ControlL
 
 	if (data->useConverter_) {
 		/*
-		 * When using the converter allocate a fixed number of internal
-		 * buffers.
+		 * When using the converter allocate enough internal buffers
+		 * for the configured converter depth.
 		 */
-		ret = video->allocateBuffers(kNumInternalBuffers,
+		ret = video->allocateBuffers(bufferCount(),
 					     &data->converterBuffers_);
 	} else {
 		/* Otherwise, prepare for using buffers from the only stream. */
@@ -810,13 +1027,14 @@ int SimplePipelineHandler::start(Camera *camera, [[maybe_unused]] const ControlL
 	}
 
 	if (data->useConverter_) {
-		ret = converter_->start();
+		ret = converter_ ? converter_->start() : swIsp_->start();
 		if (ret < 0) {
 			stop(camera);
 			return ret;
 		}
 
 		/* Queue all internal buffers for capture. */
+		data->converterInFlight_ = 0;
 		for (std::unique_ptr<FrameBuffer> &buffer : data->converterBuffers_)
 			video->queueBuffer(buffer.get());
 	}
@@ -831,8 +1049,12 @@ void SimplePipelineHandler::stop(Camera *camera)
 	SimpleCameraData *data = cameraData(camera);
 	V4L2VideoDevice *video = data->video_;
 
-	if (data->useConverter_)
-		converter_->stop();
+	if (data->useConverter_) {
+		if (converter_)
+			converter_->stop();
+		else
+			swIsp_->stop();
+	}
 
 	video->streamOff();
 	video->releaseBuffers();
@@ -937,7 +1159,7 @@ std::vector<MediaEntity *> SimplePipelineHandler::locateSensors()
 bool SimplePipelineHandler::match(DeviceEnumerator *enumerator)
 {
 	const SimplePipelineInfo *info = nullptr;
-	MediaDevice *converter = nullptr;
+	std::shared_ptr<SimpleConverterScheduler> converter;
 	unsigned int numStreams = 1;
 
 	for (const SimplePipelineInfo &inf : supportedDevices) {
@@ -952,9 +1174,18 @@ bool SimplePipelineHandler::match(DeviceEnumerator *enumerator)
 	if (!media_)
 		return false;
 
+	/*
+	 * Acquire a converter, or share the converter acquired by another
+	 * pipeline handler instance.
+	 */
 	for (const auto &[name, streams] : info->converters) {
 		DeviceMatch converterMatch(name);
-		converter = acquireMediaDevice(enumerator, converterMatch);
+		MediaDevice *media = acquireMediaDevice(enumerator, converterMatch);
+		if (media)
+			converter = SimpleConverterScheduler::create(media);
+		else
+			converter = SimpleConverterScheduler::find(name);
+
 		if (converter) {
 			numStreams = streams;
 			break;
@@ -981,6 +1212,21 @@ bool SimplePipelineHandler::match(DeviceEnumerator *enumerator)
 		}
 	}
 
+	/* Fall back to the software ISP when no converter is available. */
+	if (!converter_) {
+		swIsp_ = createSoftwareIsp();
+		if (swIsp_ && !swIsp_->isValid()) {
+			LOG(SimplePipeline, Warning)
+				<< "No dma-heap available, disabling software ISP";
+			swIsp_.reset();
+		}
+
+		if (swIsp_) {
+			swIsp_->inputBufferReady.connect(this, &SimplePipelineHandler::converterInputDone);
+			swIsp_->outputBufferReady.connect(this, &SimplePipelineHandler::converterOutputDone);
+		}
+	}
+
 	/*
 	 * Create one camera data instance for each sensor and gather all
 	 * entities in all pipelines.
@@ -1137,8 +1383,9 @@ void SimplePipelineHandler::bufferReady(FrameBuffer *buffer)
 
 	/*
 	 * Queue the captured and the request buffer to the converter if format
-	 * conversion is needed. If there's no queued request, just requeue the
-	 * captured buffer for capture.
+	 * conversion is needed. If there's no queued request, or if the
+	 * converter is already processing converterDepth_ frames, drop the
+	 * frame and requeue the captured buffer for capture.
 	 */
 	if (data->useConverter_) {
 		if (data->converterQueue_.empty()) {
@@ -1146,7 +1393,19 @@ void SimplePipelineHandler::bufferReady(FrameBuffer *buffer)
 			return;
 		}
 
-		converter_->queueBuffers(buffer, data->converterQueue_.front());
+		if (data->converterInFlight_ >= converterDepth_) {
+			LOG(SimplePipeline, Debug)
+				<< "Converter busy, dropping frame "
+				<< buffer->metadata().sequence;
+			data->video_->queueBuffer(buffer);
+			return;
+		}
+
+		data->converterInFlight_++;
+		if (converter_)
+			converter_->queueBuffers(buffer, data->converterQueue_.front());
+		else
+			swIsp_->queueBuffers(buffer, data->converterQueue_.front());
 		data->converterQueue_.pop();
 		return;
 	}
@@ -1161,6 +1420,8 @@ void SimplePipelineHandler::converterInputDone(FrameBuffer *buffer)
 	ASSERT(activeCamera_);
 	SimpleCameraData *data = cameraData(activeCamera_);
 
+	data->converterInFlight_--;
+
 	/* Queue the input buffer back for capture. */
 	data->video_->queueBuffer(buffer);
 }
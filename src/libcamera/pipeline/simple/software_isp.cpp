@@ -0,0 +1,705 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Linaro Ltd
+ *
+ * software_isp.cpp - CPU-based image processing for the simple pipeline handler
+ */
+
+#include "software_isp.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <libcamera/formats.h>
+#include <libcamera/stream.h>
+
+#include "libcamera/internal/bayer_unpack.h"
+#include "libcamera/internal/formats.h"
+#include "libcamera/internal/log.h"
+#include "libcamera/internal/v4l2_pixelformat.h"
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(SimplePipeline)
+
+namespace {
+
+/* Maximum number of worker threads processing stripes of frames. */
+constexpr unsigned int kMaxWorkers = 4;
+
+/* Number of stripes per worker, to balance the load at the end of frames. */
+constexpr unsigned int kStripesPerWorker = 2;
+
+/* Number of mirrored pixels on each side of the unpacked lines. */
+constexpr unsigned int kPadding = 2;
+
+/* Number of unpacked lines kept around the row being interpolated. */
+constexpr unsigned int kNumLines = 5;
+
+/* Only one every kStatsInterval rows is accumulated for white balance. */
+constexpr unsigned int kStatsInterval = 4;
+
+/* White balance gains are stored in Q8 fixed point, within [1/4, 8]. */
+constexpr unsigned int kGainShift = 8;
+constexpr unsigned int kUnityGain = 1 << kGainShift;
+constexpr unsigned int kMinGain = kUnityGain / 4;
+constexpr unsigned int kMaxGain = kUnityGain * 8;
+
+constexpr double kGamma = 2.2;
+
+enum Channel {
+	Red = 0,
+	Green = 1,
+	Blue = 2,
+};
+
+/* The lines surrounding the row being interpolated, offset by the padding. */
+struct Lines {
+	const uint16_t *m2;
+	const uint16_t *m1;
+	const uint16_t *c;
+	const uint16_t *p1;
+	const uint16_t *p2;
+};
+
+template<bool edgeAware>
+inline uint16_t interpolateGreen(const Lines &l, int x, int maxValue)
+{
+	int left = l.c[x - 1];
+	int right = l.c[x + 1];
+	int up = l.m1[x];
+	int down = l.p1[x];
+
+	if (!edgeAware)
+		return (left + right + up + down + 2) >> 2;
+
+	/*
+	 * Interpolate along the direction of the smallest gradient, corrected
+	 * by the Laplacian of the colour of the current pixel, as described
+	 * by Hamilton and Adams.
+	 */
+	int centre = 2 * l.c[x];
+	int lapH = centre - l.c[x - 2] - l.c[x + 2];
+	int lapV = centre - l.m2[x] - l.p2[x];
+	int gradH = abs(left - right) + abs(lapH);
+	int gradV = abs(up - down) + abs(lapV);
+	int green;
+
+	if (gradH < gradV)
+		green = (2 * (left + right) + lapH) / 4;
+	else if (gradV < gradH)
+		green = (2 * (up + down) + lapV) / 4;
+	else
+		green = (2 * (left + right + up + down) + lapH + lapV) / 8;
+
+	return std::clamp(green, 0, maxValue);
+}
+
+/*
+ * Interpolate a row of Bayer pixels. The row contains green pixels and pixels
+ * of another colour, stored in \a same, while \a other receives the colour
+ * of the rows above and below. Pixels are processed by pairs to avoid
+ * branching on the colour of each pixel.
+ */
+template<bool firstGreen, bool edgeAware>
+void demosaicRow(const Lines &l, int width, int maxValue,
+		 uint16_t *same, uint16_t *green, uint16_t *other)
+{
+	for (int x = 0; x < width; x += 2) {
+		int g = firstGreen ? x : x + 1;
+		int c = firstGreen ? x + 1 : x;
+
+		green[g] = l.c[g];
+		same[g] = (l.c[g - 1] + l.c[g + 1] + 1) >> 1;
+		other[g] = (l.m1[g] + l.p1[g] + 1) >> 1;
+
+		same[c] = l.c[c];
+		green[c] = interpolateGreen<edgeAware>(l, c, maxValue);
+		other[c] = (l.m1[c - 1] + l.m1[c + 1] +
+			    l.p1[c - 1] + l.p1[c + 1] + 2) >> 2;
+	}
+}
+
+} /* namespace */
+
+/*
+ * Per-worker scratch memory: the unpacked input lines, and the interpolated
+ * and gamma-corrected RGB values of a pair of rows.
+ */
+struct SoftwareIsp::Scratch {
+	std::array<std::vector<uint16_t>, kNumLines> lines;
+	std::array<std::array<std::vector<uint16_t>, 3>, 2> rgb;
+	std::array<std::array<std::vector<uint8_t>, 3>, 2> rgb8;
+};
+
+/*
+ * The SoftwareIsp produces processed images from the raw Bayer frames
+ * captured by pipelines that have no memory-to-memory converter. It exposes
+ * the same interface as the SimpleConverter, and is used in its place by the
+ * simple pipeline handler.
+ *
+ * Frames are interpolated with a bilinear or edge-aware algorithm, white
+ * balanced with gains computed from the previous frames using a grey world
+ * assumption, gamma corrected, optionally flipped horizontally and vertically,
+ * and converted to NV12 or XRGB8888. Each frame
+ * is split in stripes of rows processed in parallel by worker threads, and
+ * several frames can be queued at the same time.
+ *
+ * Output buffers are allocated from a dma-heap and written to in place, they
+ * can thus be shared with other devices without copies. When no dma-heap is
+ * available, they are allocated from memfd memory backed by hugepages when
+ * possible, and can then only be accessed by the CPU.
+ *
+ * \todo Subtract the black level of the sensor
+ */
+
+SoftwareIsp::SoftwareIsp(Debayer debayer)
+	: debayer_(debayer),
+	  allocator_(DmaHeap::Contiguous | DmaHeap::System | DmaHeap::Memfd),
+	  unpack_(nullptr), inputStride_(0), outputStride_(0),
+	  outputFrameSize_(0), hflip_(false), vflip_(false), numStripes_(0), stripeHeight_(0),
+	  inputMaps_(16), outputMaps_(16), stopping_(false),
+	  gains_({ kUnityGain, kUnityGain, kUnityGain })
+{
+}
+
+SoftwareIsp::~SoftwareIsp()
+{
+	stop();
+}
+
+BayerFormat SoftwareIsp::bayerFormat(const PixelFormat &pixelFormat)
+{
+	BayerFormat bayer =
+		BayerFormat::fromV4L2PixelFormat(V4L2PixelFormat::fromPixelFormat(pixelFormat, false));
+
+	switch (bayer.packing) {
+	case BayerFormat::None:
+		if (bayer.bitDepth == 8 || bayer.bitDepth == 10 ||
+		    bayer.bitDepth == 12)
+			return bayer;
+		break;
+
+	case BayerFormat::CSI2Packed:
+		if (bayer.bitDepth == 10 || bayer.bitDepth == 12)
+			return bayer;
+		break;
+
+	default:
+		break;
+	}
+
+	return {};
+}
+
+std::vector<PixelFormat> SoftwareIsp::formats(PixelFormat input)
+{
+	if (!bayerFormat(input).isValid())
+		return {};
+
+	return { formats::NV12, formats::XRGB8888 };
+}
+
+SizeRange SoftwareIsp::sizes(const Size &input)
+{
+	return SizeRange(input);
+}
+
+std::tuple<unsigned int, unsigned int>
+SoftwareIsp::strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size)
+{
+	if (pixelFormat != formats::NV12 && pixelFormat != formats::XRGB8888)
+		return std::make_tuple(0, 0);
+
+	const PixelFormatInfo &info = PixelFormatInfo::info(pixelFormat);
+
+	return std::make_tuple(info.stride(size.width, 0, 1),
+			       info.frameSize(size, 1));
+}
+
+int SoftwareIsp::configure(const StreamConfiguration &inputCfg,
+			   const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfgs,
+			   Transform transform)
+{
+	if (outputCfgs.size() != 1) {
+		LOG(SimplePipeline, Error)
+			<< "Software ISP supports a single output";
+		return -EINVAL;
+	}
+
+	const StreamConfiguration &outputCfg = outputCfgs[0];
+
+	BayerFormat bayer = bayerFormat(inputCfg.pixelFormat);
+	if (!bayer.isValid()) {
+		LOG(SimplePipeline, Error)
+			<< "Unsupported input format " << inputCfg.pixelFormat.toString();
+		return -EINVAL;
+	}
+
+	if (!!(transform & ~transforms())) {
+		LOG(SimplePipeline, Error)
+			<< "Unsupported transform " << transformToString(transform);
+		return -EINVAL;
+	}
+
+	if (outputCfg.size != inputCfg.size || inputCfg.size.width % 2 ||
+	    inputCfg.size.height % 2 || inputCfg.size.width < 4 ||
+	    inputCfg.size.height < 4) {
+		LOG(SimplePipeline, Error)
+			<< "Unsupported size " << outputCfg.size.toString();
+		return -EINVAL;
+	}
+
+	unsigned int stride;
+	unsigned int frameSize;
+	std::tie(stride, frameSize) =
+		strideAndFrameSize(outputCfg.pixelFormat, outputCfg.size);
+	if (!stride) {
+		LOG(SimplePipeline, Error)
+			<< "Unsupported output format "
+			<< outputCfg.pixelFormat.toString();
+		return -EINVAL;
+	}
+
+	inputFormat_ = bayer;
+	unpack_ = bayer::unpackFunction(bayer);
+	size_ = inputCfg.size;
+	inputStride_ = inputCfg.stride;
+	outputFormat_ = outputCfg.pixelFormat;
+	outputStride_ = stride;
+	outputFrameSize_ = frameSize;
+	hflip_ = !!(transform & Transform::HFlip);
+	vflip_ = !!(transform & Transform::VFlip);
+
+	/* Split the frames in stripes of an even number of rows. */
+	unsigned int numWorkers =
+		std::min(std::max(std::thread::hardware_concurrency(), 1u),
+			 kMaxWorkers);
+	stripeHeight_ = (size_.height + numWorkers * kStripesPerWorker - 1)
+		      / (numWorkers * kStripesPerWorker);
+	stripeHeight_ = (stripeHeight_ + 1) & ~1;
+	numStripes_ = (size_.height + stripeHeight_ - 1) / stripeHeight_;
+	workers_.resize(std::min(numWorkers, numStripes_));
+
+	unsigned int maxValue = (1 << bayer.bitDepth) - 1;
+	gamma_.resize(maxValue + 1);
+	for (unsigned int i = 0; i <= maxValue; ++i)
+		gamma_[i] = lround(255.0 * pow(static_cast<double>(i) / maxValue,
+					       1.0 / kGamma));
+
+	gains_ = { kUnityGain, kUnityGain, kUnityGain };
+	updateTables({});
+
+	inputMaps_.clear();
+	outputMaps_.clear();
+
+	return 0;
+}
+
+int SoftwareIsp::exportBuffers(unsigned int output, unsigned int count,
+			       std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	if (output != 0 || !outputFrameSize_)
+		return -EINVAL;
+
+	return allocator_.exportBuffers(count, { outputFrameSize_ }, buffers);
+}
+
+int SoftwareIsp::start()
+{
+	if (!numStripes_)
+		return -EINVAL;
+
+	stopping_ = false;
+
+	for (std::thread &thread : workers_)
+		thread = std::thread(&SoftwareIsp::worker, this);
+
+	return 0;
+}
+
+/*
+ * Frames whose processing hasn't started are cancelled, the other ones are
+ * completed. All buffers are signalled as ready before this function returns.
+ */
+void SoftwareIsp::stop()
+{
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+
+		for (auto it = frames_.begin(); it != frames_.end();) {
+			Frame *frame = it->get();
+			if (frame->nextStripe) {
+				++it;
+				continue;
+			}
+
+			frame->cancelled = true;
+			frame->output->cancel();
+
+			auto next = std::next(it);
+			completed_.splice(completed_.end(), frames_, it);
+			it = next;
+		}
+
+		stopping_ = true;
+	}
+
+	cond_.notify_all();
+
+	for (std::thread &thread : workers_) {
+		if (thread.joinable())
+			thread.join();
+	}
+
+	dispatchCompleted();
+}
+
+int SoftwareIsp::queueBuffers(FrameBuffer *input,
+			      const std::map<unsigned int, FrameBuffer *> &outputs)
+{
+	if (outputs.size() != 1 || outputs.begin()->first != 0 ||
+	    !outputs.begin()->second)
+		return -EINVAL;
+
+	/*
+	 * Map the buffers here, as the mapping caches are not thread-safe.
+	 * Mappings of frames being processed are never evicted, as the caches
+	 * are larger than the number of buffers queued at any time.
+	 */
+	const MappedBuffer *inputMap = inputMaps_.map(input, PROT_READ);
+	const MappedBuffer *outputMap = outputMaps_.map(outputs.begin()->second,
+							PROT_WRITE);
+	if (!inputMap || !outputMap)
+		return -ENOMEM;
+
+	auto frame = std::make_unique<Frame>();
+	frame->input = input;
+	frame->output = outputs.begin()->second;
+	frame->inputMap = inputMap;
+	frame->outputMap = outputMap;
+	frame->nextStripe = 0;
+	frame->pendingStripes = numStripes_;
+	frame->sums = {};
+	frame->cancelled = false;
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		frames_.push_back(std::move(frame));
+	}
+
+	cond_.notify_one();
+
+	return 0;
+}
+
+void SoftwareIsp::worker()
+{
+	Scratch scratch;
+	for (std::vector<uint16_t> &line : scratch.lines)
+		line.resize(size_.width + 2 * kPadding);
+	for (unsigned int row = 0; row < 2; ++row) {
+		for (unsigned int i = 0; i < 3; ++i) {
+			scratch.rgb[row][i].resize(size_.width);
+			scratch.rgb8[row][i].resize(size_.width);
+		}
+	}
+
+	std::unique_lock<std::mutex> locker(mutex_);
+
+	while (true) {
+		auto it = frames_.end();
+
+		cond_.wait(locker, [&]() {
+			it = std::find_if(frames_.begin(), frames_.end(),
+					  [&](const std::unique_ptr<Frame> &f) {
+						  return f->nextStripe < numStripes_;
+					  });
+			return it != frames_.end() || stopping_;
+		});
+
+		if (it == frames_.end())
+			break;
+
+		Frame *frame = it->get();
+		unsigned int stripe = frame->nextStripe++;
+
+		/*
+		 * Prepare the frame when processing its first stripe, with the
+		 * tables computed from the latest statistics.
+		 */
+		if (!stripe) {
+			frame->tables = tables_;
+			frame->inputAccess =
+				std::make_unique<MappedBuffer::CpuAccess>(frame->inputMap, PROT_READ);
+			frame->outputAccess =
+				std::make_unique<MappedBuffer::CpuAccess>(frame->outputMap, PROT_WRITE);
+		}
+
+		/* Let other workers pick the next stripes. */
+		if (frame->nextStripe < numStripes_)
+			cond_.notify_one();
+
+		locker.unlock();
+
+		std::array<uint64_t, 3> sums = {};
+		processStripe(frame, stripe, &scratch, &sums);
+
+		locker.lock();
+
+		for (unsigned int i = 0; i < 3; ++i)
+			frame->sums[i] += sums[i];
+
+		if (!--frame->pendingStripes)
+			finishFrame(frame);
+	}
+}
+
+void SoftwareIsp::unpackRow(const uint8_t *src, uint16_t *dst) const
+{
+	unsigned int width = size_.width;
+
+	unpack_(dst, src, width);
+
+	/* Mirror the pixels around the edges, preserving the colour pattern. */
+	dst[-1] = dst[1];
+	dst[-2] = dst[2];
+	dst[width] = dst[width - 2];
+	dst[width + 1] = dst[width - 3];
+}
+
+void SoftwareIsp::processStripe(Frame *frame, unsigned int stripe,
+				Scratch *scratch, std::array<uint64_t, 3> *sums)
+{
+	const uint8_t *input = frame->inputMap->maps()[0].data();
+	const std::vector<MappedBuffer::Plane> &outputPlanes = frame->outputMap->maps();
+	uint8_t *output = outputPlanes[0].data();
+	uint8_t *outputUV = outputPlanes.size() > 1
+			  ? outputPlanes[1].data()
+			  : output + outputStride_ * size_.height;
+	const Tables &tables = *frame->tables;
+
+	unsigned int width = size_.width;
+	int height = size_.height;
+	int maxValue = (1 << inputFormat_.bitDepth) - 1;
+	int y0 = stripe * stripeHeight_;
+	int y1 = std::min<int>(y0 + stripeHeight_, height);
+
+	/* Rows above and below the frame are mirrored as well. */
+	auto mirror = [height](int y) {
+		return y < 0 ? -y : y >= height ? 2 * (height - 1) - y : y;
+	};
+	auto line = [&](int y) {
+		return scratch->lines[(y + kNumLines) % kNumLines].data() + kPadding;
+	};
+	auto outputRow = [&](int y) {
+		return vflip_ ? height - 1 - y : y;
+	};
+
+	for (int y = y0 - 2; y < y0 + 2; ++y)
+		unpackRow(input + mirror(y) * inputStride_, line(y));
+
+	/*
+	 * The colour of the pixels at the beginning of even rows, the colours
+	 * of odd rows are the other two of the 2x2 pattern.
+	 */
+	bool evenFirstGreen = inputFormat_.order == BayerFormat::GBRG ||
+			      inputFormat_.order == BayerFormat::GRBG;
+	bool evenRed = inputFormat_.order == BayerFormat::RGGB ||
+		       inputFormat_.order == BayerFormat::GRBG;
+
+	for (int y = y0; y < y1; y += 2) {
+		for (unsigned int row = 0; row < 2; ++row) {
+			int yr = y + row;
+
+			unpackRow(input + mirror(yr + 2) * inputStride_, line(yr + 2));
+
+			Lines l{ line(yr - 2), line(yr - 1), line(yr),
+				 line(yr + 1), line(yr + 2) };
+
+			bool firstGreen = evenFirstGreen != static_cast<bool>(row);
+			bool red = evenRed != static_cast<bool>(row);
+			std::array<std::vector<uint16_t>, 3> &rgb = scratch->rgb[row];
+			uint16_t *same = rgb[red ? Red : Blue].data();
+			uint16_t *other = rgb[red ? Blue : Red].data();
+			uint16_t *green = rgb[Green].data();
+
+			if (debayer_ == Debayer::EdgeAware) {
+				if (firstGreen)
+					demosaicRow<true, true>(l, width, maxValue, same, green, other);
+				else
+					demosaicRow<false, true>(l, width, maxValue, same, green, other);
+			} else {
+				if (firstGreen)
+					demosaicRow<true, false>(l, width, maxValue, same, green, other);
+				else
+					demosaicRow<false, false>(l, width, maxValue, same, green, other);
+			}
+
+			if (yr % kStatsInterval == 0) {
+				for (unsigned int i = 0; i < 3; ++i) {
+					uint64_t sum = 0;
+					for (unsigned int x = 0; x < width; ++x)
+						sum += rgb[i][x];
+					(*sums)[i] += sum;
+				}
+			}
+
+			/*
+			 * Flip horizontally while applying the tables, the
+			 * statistics and the interpolation are not affected
+			 * by the order of the pixels in the output.
+			 */
+			for (unsigned int i = 0; i < 3; ++i) {
+				const uint8_t *lut = tables.lut[i].data();
+				const uint16_t *src = rgb[i].data();
+				uint8_t *dst = scratch->rgb8[row][i].data();
+
+				if (hflip_) {
+					for (unsigned int x = 0; x < width; ++x)
+						dst[width - 1 - x] = lut[src[x]];
+				} else {
+					for (unsigned int x = 0; x < width; ++x)
+						dst[x] = lut[src[x]];
+				}
+			}
+		}
+
+		const std::array<std::array<std::vector<uint8_t>, 3>, 2> &rgb8 = scratch->rgb8;
+
+		if (outputFormat_ == formats::XRGB8888) {
+			for (unsigned int row = 0; row < 2; ++row) {
+				uint8_t *dst = output + outputRow(y + row) * outputStride_;
+				const uint8_t *r = rgb8[row][Red].data();
+				const uint8_t *g = rgb8[row][Green].data();
+				const uint8_t *b = rgb8[row][Blue].data();
+
+				for (unsigned int x = 0; x < width; ++x) {
+					dst[4 * x] = b[x];
+					dst[4 * x + 1] = g[x];
+					dst[4 * x + 2] = r[x];
+					dst[4 * x + 3] = 0xff;
+				}
+			}
+			continue;
+		}
+
+		/* Convert to NV12 with the BT.601 limited range encoding. */
+		for (unsigned int row = 0; row < 2; ++row) {
+			uint8_t *dst = output + outputRow(y + row) * outputStride_;
+			const uint8_t *r = rgb8[row][Red].data();
+			const uint8_t *g = rgb8[row][Green].data();
+			const uint8_t *b = rgb8[row][Blue].data();
+
+			for (unsigned int x = 0; x < width; ++x)
+				dst[x] = ((66 * r[x] + 129 * g[x] + 25 * b[x] + 128) >> 8) + 16;
+		}
+
+		/* Both rows of the pair share the same chroma row when flipped. */
+		uint8_t *dst = outputUV + std::min(outputRow(y), outputRow(y + 1)) / 2
+					* outputStride_;
+		const uint8_t *r0 = rgb8[0][Red].data();
+		const uint8_t *r1 = rgb8[1][Red].data();
+		const uint8_t *g0 = rgb8[0][Green].data();
+		const uint8_t *g1 = rgb8[1][Green].data();
+		const uint8_t *b0 = rgb8[0][Blue].data();
+		const uint8_t *b1 = rgb8[1][Blue].data();
+
+		for (unsigned int x = 0; x < width; x += 2) {
+			int r = r0[x] + r0[x + 1] + r1[x] + r1[x + 1];
+			int g = g0[x] + g0[x + 1] + g1[x] + g1[x + 1];
+			int b = b0[x] + b0[x + 1] + b1[x] + b1[x + 1];
+
+			dst[x] = ((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128;
+			dst[x + 1] = ((112 * r - 94 * g - 18 * b + 512) >> 10) + 128;
+		}
+	}
+}
+
+/*
+ * Complete the processing of a frame, with the lock held. The statistics
+ * update the tables used by the next frames.
+ */
+void SoftwareIsp::finishFrame(Frame *frame)
+{
+	frame->inputAccess.reset();
+	frame->outputAccess.reset();
+
+	if (!frame->cancelled) {
+		FrameMetadata &metadata = frame->output->_d()->metadata();
+		const FrameMetadata &inputMetadata = frame->input->metadata();
+
+		metadata.status = FrameMetadata::FrameSuccess;
+		metadata.sequence = inputMetadata.sequence;
+		metadata.timestamp = inputMetadata.timestamp;
+		Span<FrameMetadata::Plane> planes = metadata.planes();
+		for (unsigned int i = 0; i < planes.size(); ++i)
+			planes[i].bytesused = frame->output->planes()[i].length;
+
+		updateTables(frame->sums);
+	}
+
+	auto it = std::find_if(frames_.begin(), frames_.end(),
+			       [&](const std::unique_ptr<Frame> &f) {
+				       return f.get() == frame;
+			       });
+	completed_.splice(completed_.end(), frames_, it);
+
+	/*
+	 * Signal completion from the thread the SoftwareIsp belongs to. The
+	 * workers are not libcamera threads, the call must thus be queued
+	 * explicitly.
+	 */
+	invokeMethod(&SoftwareIsp::dispatchCompleted, ConnectionTypeQueued);
+}
+
+/*
+ * Compute the white balance gains from the channel sums with a grey world
+ * assumption, smoothed over frames, and regenerate the lookup tables.
+ */
+void SoftwareIsp::updateTables(const std::array<uint64_t, 3> &sums)
+{
+	for (Channel channel : { Red, Blue }) {
+		if (!sums[channel] || !sums[Green])
+			continue;
+
+		uint64_t target = (sums[Green] << kGainShift) / sums[channel];
+		target = std::clamp<uint64_t>(target, kMinGain, kMaxGain);
+		gains_[channel] = (gains_[channel] + target + 1) / 2;
+	}
+
+	auto tables = std::make_shared<Tables>();
+	unsigned int maxValue = gamma_.size() - 1;
+
+	for (unsigned int i = 0; i < 3; ++i) {
+		std::vector<uint8_t> &lut = tables->lut[i];
+		lut.resize(gamma_.size());
+
+		for (unsigned int value = 0; value <= maxValue; ++value) {
+			unsigned int corrected = (value * gains_[i]) >> kGainShift;
+			lut[value] = gamma_[std::min(corrected, maxValue)];
+		}
+	}
+
+	tables_ = std::move(tables);
+}
+
+void SoftwareIsp::dispatchCompleted()
+{
+	std::list<std::unique_ptr<Frame>> completed;
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		completed.swap(completed_);
+	}
+
+	for (std::unique_ptr<Frame> &frame : completed) {
+		outputBufferReady.emit(frame->output);
+		inputBufferReady.emit(frame->input);
+	}
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Linaro Ltd
+ *
+ * software_isp.h - CPU-based image processing for the simple pipeline handler
+ */
+
+#ifndef __LIBCAMERA_PIPELINE_SIMPLE_SOFTWARE_ISP_H__
+#define __LIBCAMERA_PIPELINE_SIMPLE_SOFTWARE_ISP_H__
+
+#include <array>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <libcamera/buffer.h>
+#include <libcamera/geometry.h>
+#include <libcamera/object.h>
+#include <libcamera/pixel_format.h>
+#include <libcamera/signal.h>
+#include <libcamera/transform.h>
+
+#include "libcamera/internal/bayer_format.h"
+#include "libcamera/internal/bayer_unpack.h"
+#include "libcamera/internal/buffer.h"
+#include "libcamera/internal/dma_buffer_allocator.h"
+
+namespace libcamera {
+
+struct StreamConfiguration;
+
+class SoftwareIsp : public Object
+{
+public:
+	enum class Debayer {
+		Bilinear,
+		EdgeAware,
+	};
+
+	SoftwareIsp(Debayer debayer);
+	~SoftwareIsp();
+
+	bool isValid() const { return allocator_.isValid(); }
+
+	std::vector<PixelFormat> formats(PixelFormat input);
+	SizeRange sizes(const Size &input);
+
+	std::tuple<unsigned int, unsigned int>
+	strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size);
+
+	Transform transforms() const { return Transform::HVFlip; }
+
+	int configure(const StreamConfiguration &inputCfg,
+		      const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfg,
+		      Transform transform = Transform::Identity);
+	int exportBuffers(unsigned int output, unsigned int count,
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+
+	int start();
+	void stop();
+
+	int queueBuffers(FrameBuffer *input,
+			 const std::map<unsigned int, FrameBuffer *> &outputs);
+
+	Signal<FrameBuffer *> inputBufferReady;
+	Signal<FrameBuffer *> outputBufferReady;
+
+private:
+	/* Per-channel lookup tables applying the white balance and gamma. */
+	struct Tables {
+		std::array<std::vector<uint8_t>, 3> lut;
+	};
+
+	struct Frame {
+		FrameBuffer *input;
+		FrameBuffer *output;
+		const MappedBuffer *inputMap;
+		const MappedBuffer *outputMap;
+		std::unique_ptr<MappedBuffer::CpuAccess> inputAccess;
+		std::unique_ptr<MappedBuffer::CpuAccess> outputAccess;
+		std::shared_ptr<const Tables> tables;
+
+		unsigned int nextStripe;
+		unsigned int pendingStripes;
+		std::array<uint64_t, 3> sums;
+		bool cancelled;
+	};
+
+	struct Scratch;
+
+	static BayerFormat bayerFormat(const PixelFormat &pixelFormat);
+
+	void worker();
+	void processStripe(Frame *frame, unsigned int stripe, Scratch *scratch,
+			   std::array<uint64_t, 3> *sums);
+	void unpackRow(const uint8_t *src, uint16_t *dst) const;
+	void finishFrame(Frame *frame);
+	void updateTables(const std::array<uint64_t, 3> &sums);
+	void dispatchCompleted();
+
+	Debayer debayer_;
+	DmaBufferAllocator allocator_;
+
+	BayerFormat inputFormat_;
+	bayer::UnpackFunction unpack_;
+	Size size_;
+	unsigned int inputStride_;
+	PixelFormat outputFormat_;
+	unsigned int outputStride_;
+	unsigned int outputFrameSize_;
+	bool hflip_;
+	bool vflip_;
+
+	std::vector<uint8_t> gamma_;
+
+	unsigned int numStripes_;
+	unsigned int stripeHeight_;
+
+	MappedBufferCache inputMaps_;
+	MappedBufferCache outputMaps_;
+
+	std::vector<std::thread> workers_;
+
+	/* Protects all the members below. */
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	bool stopping_;
+	std::array<unsigned int, 3> gains_;
+	std::shared_ptr<const Tables> tables_;
+	std::list<std::unique_ptr<Frame>> frames_;
+	std::list<std::unique_ptr<Frame>> completed_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_PIPELINE_SIMPLE_SOFTWARE_ISP_H__ */
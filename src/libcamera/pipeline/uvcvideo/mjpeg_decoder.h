@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * mjpeg_decoder.h - MJPEG decoder interface for the UVC pipeline handler
+ */
+
+#ifndef __LIBCAMERA_PIPELINE_UVCVIDEO_MJPEG_DECODER_H__
+#define __LIBCAMERA_PIPELINE_UVCVIDEO_MJPEG_DECODER_H__
+
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include <libcamera/buffer.h>
+#include <libcamera/geometry.h>
+#include <libcamera/object.h>
+#include <libcamera/pixel_format.h>
+#include <libcamera/signal.h>
+
+#include "libcamera/internal/buffer.h"
+
+namespace libcamera {
+
+/*
+ * Decoders process MJPEG frames captured in internal buffers to the buffers
+ * of the stream. Decoding is asynchronous, completion of the input and output
+ * buffers is signalled in the thread the decoder belongs to.
+ *
+ * The input buffer passed to queueBuffers() is always returned through
+ * inputBufferReady, including when queueing fails, possibly before
+ * queueBuffers() returns. The output buffer isn't queued on failure.
+ */
+class MjpegDecoder : public Object
+{
+public:
+	virtual ~MjpegDecoder() = default;
+
+	virtual bool isValid() const = 0;
+
+	virtual std::vector<PixelFormat> formats() const = 0;
+	virtual std::tuple<unsigned int, unsigned int>
+	strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size) = 0;
+
+	virtual int configure(const PixelFormat &pixelFormat, const Size &size,
+			      unsigned int inputBufferCount,
+			      unsigned int outputBufferCount) = 0;
+	virtual int exportBuffers(unsigned int count,
+				  std::vector<std::unique_ptr<FrameBuffer>> *buffers) = 0;
+
+	/* The maximum number of frames being decoded at the same time. */
+	virtual unsigned int depth() const = 0;
+
+	virtual int start() = 0;
+	virtual void stop() = 0;
+
+	virtual int queueBuffers(FrameBuffer *input, FrameBuffer *output) = 0;
+
+	Signal<FrameBuffer *> inputBufferReady;
+	Signal<FrameBuffer *> outputBufferReady;
+
+protected:
+	static FrameMetadata &metadata(FrameBuffer *buffer)
+	{
+		return buffer->_d()->metadata();
+	}
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_PIPELINE_UVCVIDEO_MJPEG_DECODER_H__ */
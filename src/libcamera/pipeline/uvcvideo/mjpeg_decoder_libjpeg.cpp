@@ -0,0 +1,547 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * mjpeg_decoder_libjpeg.cpp - MJPEG decoding with libjpeg on a thread pool
+ */
+
+#include "mjpeg_decoder_libjpeg.h"
+
+#include <algorithm>
+#include <array>
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <jpeglib.h>
+
+#include <libcamera/formats.h>
+
+#include "libcamera/internal/formats.h"
+#include "libcamera/internal/log.h"
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(UVC)
+
+namespace {
+
+/* Maximum number of worker threads, each decoding a whole frame. */
+constexpr unsigned int kMaxWorkers = 4;
+
+/*
+ * Size of the mapping caches, larger than the number of buffers queued at any
+ * time to ensure mappings of frames being decoded are never evicted.
+ */
+constexpr unsigned int kMappingCacheSize = 16;
+
+struct ErrorManager {
+	struct jpeg_error_mgr pub;
+	jmp_buf jump;
+};
+
+void errorExit(j_common_ptr cinfo)
+{
+	ErrorManager *error = reinterpret_cast<ErrorManager *>(cinfo->err);
+
+	{
+		char message[JMSG_LENGTH_MAX];
+		(*cinfo->err->format_message)(cinfo, message);
+		LOG(UVC, Debug) << "Failed to decode frame: " << message;
+	}
+
+	longjmp(error->jump, 1);
+}
+
+void outputMessage(j_common_ptr cinfo)
+{
+	char message[JMSG_LENGTH_MAX];
+	(*cinfo->err->format_message)(cinfo, message);
+	LOG(UVC, Debug) << message;
+}
+
+/*
+ * Frames in the YCbCr 4:2:2 and 4:2:0 subsamplings, used by the vast majority
+ * of UVC cameras, are decoded as raw planes without any colour conversion or
+ * upsampling.
+ */
+bool isRawDecodable(const jpeg_decompress_struct *cinfo)
+{
+	if (cinfo->num_components != 3 ||
+	    cinfo->jpeg_color_space != JCS_YCbCr)
+		return false;
+
+	const jpeg_component_info *comp = cinfo->comp_info;
+	if (comp[0].h_samp_factor != 2 ||
+	    (comp[0].v_samp_factor != 1 && comp[0].v_samp_factor != 2))
+		return false;
+
+	for (unsigned int i = 1; i < 3; ++i) {
+		if (comp[i].h_samp_factor != 1 || comp[i].v_samp_factor != 1)
+			return false;
+	}
+
+	return true;
+}
+
+} /* namespace */
+
+/*
+ * Decompression context of a worker thread. All the resources used during
+ * decoding are allocated here, as the libjpeg error handler unwinds the stack
+ * with longjmp() and would skip the destructors of local objects.
+ */
+struct MjpegDecoderLibjpeg::Worker {
+	ErrorManager error;
+	struct jpeg_decompress_struct cinfo;
+
+	/* Rows of one iMCU row of the Y, Cb and Cr planes. */
+	std::array<std::vector<uint8_t>, 3> planes;
+	std::array<std::vector<JSAMPROW>, 3> rows;
+
+	/* Two interleaved YCbCr 4:4:4 lines, for the scanline fallback. */
+	std::array<std::vector<uint8_t>, 2> lines;
+};
+
+MjpegDecoderLibjpeg::MjpegDecoderLibjpeg()
+	: stride_(0), frameSize_(0), numWorkers_(0),
+	  inputMaps_(kMappingCacheSize), outputMaps_(kMappingCacheSize),
+	  stopping_(false)
+{
+}
+
+MjpegDecoderLibjpeg::~MjpegDecoderLibjpeg()
+{
+	stop();
+}
+
+std::vector<PixelFormat> MjpegDecoderLibjpeg::formats() const
+{
+	return { formats::NV12, formats::YUYV };
+}
+
+std::tuple<unsigned int, unsigned int>
+MjpegDecoderLibjpeg::strideAndFrameSize(const PixelFormat &pixelFormat,
+					const Size &size)
+{
+	if (pixelFormat != formats::NV12 && pixelFormat != formats::YUYV)
+		return std::make_tuple(0, 0);
+
+	const PixelFormatInfo &info = PixelFormatInfo::info(pixelFormat);
+
+	return std::make_tuple(info.stride(size.width, 0, 1),
+			       info.frameSize(size, 1));
+}
+
+int MjpegDecoderLibjpeg::configure(const PixelFormat &pixelFormat,
+				   const Size &size,
+				   [[maybe_unused]] unsigned int inputBufferCount,
+				   [[maybe_unused]] unsigned int outputBufferCount)
+{
+	if (size.width % 2 || size.height % 2 || size.isNull()) {
+		LOG(UVC, Error) << "Unsupported size " << size.toString();
+		return -EINVAL;
+	}
+
+	unsigned int stride;
+	unsigned int frameSize;
+	std::tie(stride, frameSize) = strideAndFrameSize(pixelFormat, size);
+	if (!stride) {
+		LOG(UVC, Error)
+			<< "Unsupported output format " << pixelFormat.toString();
+		return -EINVAL;
+	}
+
+	pixelFormat_ = pixelFormat;
+	size_ = size;
+	stride_ = stride;
+	frameSize_ = frameSize;
+	numWorkers_ = std::min(std::max(std::thread::hardware_concurrency(), 1u),
+			       kMaxWorkers);
+
+	inputMaps_.clear();
+	outputMaps_.clear();
+
+	return 0;
+}
+
+int MjpegDecoderLibjpeg::exportBuffers(unsigned int count,
+				       std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	if (!frameSize_)
+		return -EINVAL;
+
+	return allocator_.exportBuffers(count, { frameSize_ }, buffers);
+}
+
+int MjpegDecoderLibjpeg::start()
+{
+	if (!numWorkers_)
+		return -EINVAL;
+
+	stopping_ = false;
+
+	workers_.resize(numWorkers_);
+	for (std::thread &thread : workers_)
+		thread = std::thread(&MjpegDecoderLibjpeg::worker, this);
+
+	return 0;
+}
+
+/*
+ * Frames whose decoding hasn't started are cancelled, the other ones are
+ * completed. All buffers are signalled as ready before this function returns.
+ */
+void MjpegDecoderLibjpeg::stop()
+{
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+
+		for (auto it = frames_.begin(); it != frames_.end();) {
+			Frame *frame = it->get();
+			if (frame->started) {
+				++it;
+				continue;
+			}
+
+			frame->cancelled = true;
+			frame->output->cancel();
+
+			auto next = std::next(it);
+			completed_.splice(completed_.end(), frames_, it);
+			it = next;
+		}
+
+		stopping_ = true;
+	}
+
+	cond_.notify_all();
+
+	for (std::thread &thread : workers_) {
+		if (thread.joinable())
+			thread.join();
+	}
+
+	workers_.clear();
+
+	dispatchCompleted();
+}
+
+int MjpegDecoderLibjpeg::queueBuffers(FrameBuffer *input, FrameBuffer *output)
+{
+	/* Map the buffers here, as the mapping caches are not thread-safe. */
+	const MappedBuffer *inputMap = inputMaps_.map(input, PROT_READ);
+	const MappedBuffer *outputMap = outputMaps_.map(output, PROT_WRITE);
+	if (!inputMap || !outputMap) {
+		inputBufferReady.emit(input);
+		return -ENOMEM;
+	}
+
+	auto frame = std::make_unique<Frame>();
+	frame->input = input;
+	frame->output = output;
+	frame->inputMap = inputMap;
+	frame->outputMap = outputMap;
+	frame->started = false;
+	frame->cancelled = false;
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		frames_.push_back(std::move(frame));
+	}
+
+	cond_.notify_one();
+
+	return 0;
+}
+
+void MjpegDecoderLibjpeg::worker()
+{
+	Worker worker;
+
+	worker.cinfo.err = jpeg_std_error(&worker.error.pub);
+	worker.error.pub.error_exit = errorExit;
+	worker.error.pub.output_message = outputMessage;
+	jpeg_create_decompress(&worker.cinfo);
+
+	/*
+	 * Size the scratch planes for the largest iMCU row, made of 16 luma
+	 * and 8 chroma rows padded to a multiple of the 16 pixels MCU width.
+	 */
+	unsigned int lumaWidth = (size_.width + 15) & ~15;
+	for (unsigned int i = 0; i < 3; ++i) {
+		unsigned int width = i ? lumaWidth / 2 : lumaWidth;
+		unsigned int height = i ? DCTSIZE : 2 * DCTSIZE;
+
+		worker.planes[i].resize(width * height);
+		for (unsigned int y = 0; y < height; ++y)
+			worker.rows[i].push_back(&worker.planes[i][y * width]);
+	}
+
+	for (std::vector<uint8_t> &line : worker.lines)
+		line.resize(size_.width * 3);
+
+	std::unique_lock<std::mutex> locker(mutex_);
+
+	while (true) {
+		auto it = frames_.end();
+
+		cond_.wait(locker, [&]() {
+			it = std::find_if(frames_.begin(), frames_.end(),
+					  [](const std::unique_ptr<Frame> &f) {
+						  return !f->started;
+					  });
+			return it != frames_.end() || stopping_;
+		});
+
+		if (it == frames_.end())
+			break;
+
+		Frame *frame = it->get();
+		frame->started = true;
+
+		locker.unlock();
+
+		bool success;
+		{
+			MappedBuffer::CpuAccess inputAccess(frame->inputMap, PROT_READ);
+			MappedBuffer::CpuAccess outputAccess(frame->outputMap, PROT_WRITE);
+
+			success = decode(&worker, frame);
+		}
+
+		locker.lock();
+
+		finishFrame(frame, success);
+	}
+
+	locker.unlock();
+
+	jpeg_destroy_decompress(&worker.cinfo);
+}
+
+bool MjpegDecoderLibjpeg::decode(Worker *worker, Frame *frame)
+{
+	jpeg_decompress_struct *cinfo = &worker->cinfo;
+
+	const Span<uint8_t> &input = frame->inputMap->maps()[0];
+	unsigned int bytesused = frame->input->metadata().planes()[0].bytesused;
+	bytesused = std::min<unsigned int>(bytesused, input.size());
+
+	/*
+	 * The NV12 chroma plane follows the luma plane, unless the buffer has
+	 * a separate memory plane for it.
+	 */
+	const std::vector<Span<uint8_t>> &maps = frame->outputMap->maps();
+	uint8_t *luma = maps[0].data();
+	uint8_t *chroma = maps.size() > 1 ? maps[1].data()
+			: luma + stride_ * size_.height;
+
+	if (setjmp(worker->error.jump)) {
+		jpeg_abort_decompress(cinfo);
+		return false;
+	}
+
+	jpeg_mem_src(cinfo, input.data(), bytesused);
+	jpeg_read_header(cinfo, TRUE);
+
+	if (cinfo->image_width != size_.width ||
+	    cinfo->image_height != size_.height) {
+		jpeg_abort_decompress(cinfo);
+		return false;
+	}
+
+	/*
+	 * The Huffman tables are commonly omitted from MJPEG frames, libjpeg
+	 * then uses the default tables defined in the JPEG specification.
+	 */
+	bool raw = isRawDecodable(cinfo);
+	if (raw) {
+		cinfo->raw_data_out = TRUE;
+	} else {
+		cinfo->out_color_space = JCS_YCbCr;
+		cinfo->do_fancy_upsampling = FALSE;
+	}
+
+	jpeg_start_decompress(cinfo);
+
+	if (raw)
+		decodeRaw(worker, luma, chroma);
+	else
+		decodeScanlines(worker, luma, chroma);
+
+	jpeg_finish_decompress(cinfo);
+
+	return true;
+}
+
+/*
+ * Decode the frame one iMCU row at a time to the Y, Cb and Cr scratch planes,
+ * and interleave the chroma planes to the output format.
+ */
+void MjpegDecoderLibjpeg::decodeRaw(Worker *worker, uint8_t *luma,
+				    uint8_t *chroma)
+{
+	jpeg_decompress_struct *cinfo = &worker->cinfo;
+	bool subsampled = cinfo->comp_info[0].v_samp_factor == 2;
+	unsigned int numRows = cinfo->comp_info[0].v_samp_factor * DCTSIZE;
+	unsigned int width = size_.width;
+
+	JSAMPARRAY planes[3] = {
+		worker->rows[0].data(),
+		worker->rows[1].data(),
+		worker->rows[2].data(),
+	};
+
+	while (cinfo->output_scanline < size_.height) {
+		unsigned int top = cinfo->output_scanline;
+		jpeg_read_raw_data(cinfo, planes, numRows);
+
+		unsigned int rows = std::min(numRows, size_.height - top);
+
+		for (unsigned int i = 0; i < rows; ++i) {
+			const uint8_t *y = planes[0][i];
+			const uint8_t *cb = planes[1][subsampled ? i / 2 : i];
+			const uint8_t *cr = planes[2][subsampled ? i / 2 : i];
+
+			if (pixelFormat_ == formats::YUYV) {
+				uint8_t *dst = luma + (top + i) * stride_;
+
+				for (unsigned int x = 0; x < width / 2; ++x) {
+					dst[4 * x + 0] = y[2 * x];
+					dst[4 * x + 1] = cb[x];
+					dst[4 * x + 2] = y[2 * x + 1];
+					dst[4 * x + 3] = cr[x];
+				}
+
+				continue;
+			}
+
+			memcpy(luma + (top + i) * stride_, y, width);
+
+			if (i % 2)
+				continue;
+
+			/* Average the 4:2:2 chroma rows pairwise for NV12. */
+			uint8_t *dst = chroma + (top + i) / 2 * stride_;
+
+			if (subsampled) {
+				for (unsigned int x = 0; x < width / 2; ++x) {
+					dst[2 * x] = cb[x];
+					dst[2 * x + 1] = cr[x];
+				}
+			} else {
+				const uint8_t *cb1 = planes[1][i + 1];
+				const uint8_t *cr1 = planes[2][i + 1];
+
+				for (unsigned int x = 0; x < width / 2; ++x) {
+					dst[2 * x] = (cb[x] + cb1[x] + 1) / 2;
+					dst[2 * x + 1] = (cr[x] + cr1[x] + 1) / 2;
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Decode the frame two lines at a time to interleaved YCbCr, and subsample the
+ * chroma to the output format. This handles all the subsamplings supported by
+ * libjpeg, at the cost of upsampling the chroma first.
+ */
+void MjpegDecoderLibjpeg::decodeScanlines(Worker *worker, uint8_t *luma,
+					  uint8_t *chroma)
+{
+	jpeg_decompress_struct *cinfo = &worker->cinfo;
+	unsigned int width = size_.width;
+
+	JSAMPROW lines[2] = {
+		worker->lines[0].data(),
+		worker->lines[1].data(),
+	};
+
+	while (cinfo->output_scanline < size_.height) {
+		unsigned int top = cinfo->output_scanline;
+		unsigned int count = 0;
+
+		while (count < 2)
+			count += jpeg_read_scanlines(cinfo, &lines[count], 2 - count);
+
+		for (unsigned int i = 0; i < 2; ++i) {
+			const uint8_t *src = lines[i];
+			uint8_t *dst = luma + (top + i) * stride_;
+
+			if (pixelFormat_ == formats::YUYV) {
+				for (unsigned int x = 0; x < width / 2; ++x) {
+					const uint8_t *p = &src[6 * x];
+
+					dst[4 * x + 0] = p[0];
+					dst[4 * x + 1] = (p[1] + p[4] + 1) / 2;
+					dst[4 * x + 2] = p[3];
+					dst[4 * x + 3] = (p[2] + p[5] + 1) / 2;
+				}
+			} else {
+				for (unsigned int x = 0; x < width; ++x)
+					dst[x] = src[3 * x];
+			}
+		}
+
+		if (pixelFormat_ != formats::NV12)
+			continue;
+
+		uint8_t *dst = chroma + top / 2 * stride_;
+
+		for (unsigned int x = 0; x < width / 2; ++x) {
+			const uint8_t *p0 = &lines[0][6 * x];
+			const uint8_t *p1 = &lines[1][6 * x];
+
+			dst[2 * x] = (p0[1] + p0[4] + p1[1] + p1[4] + 2) / 4;
+			dst[2 * x + 1] = (p0[2] + p0[5] + p1[2] + p1[5] + 2) / 4;
+		}
+	}
+}
+
+void MjpegDecoderLibjpeg::finishFrame(Frame *frame, bool success)
+{
+	FrameMetadata &outputMetadata = metadata(frame->output);
+	const FrameMetadata &inputMetadata = frame->input->metadata();
+
+	outputMetadata.status = success ? FrameMetadata::FrameSuccess
+			      : FrameMetadata::FrameError;
+	outputMetadata.sequence = inputMetadata.sequence;
+	outputMetadata.timestamp = inputMetadata.timestamp;
+	Span<FrameMetadata::Plane> planes = outputMetadata.planes();
+	for (unsigned int i = 0; i < planes.size(); ++i)
+		planes[i].bytesused = frame->output->planes()[i].length;
+
+	auto it = std::find_if(frames_.begin(), frames_.end(),
+			       [&](const std::unique_ptr<Frame> &f) {
+				       return f.get() == frame;
+			       });
+	completed_.splice(completed_.end(), frames_, it);
+
+	/*
+	 * Signal completion from the thread the decoder belongs to. The
+	 * workers are not libcamera threads, the call must thus be queued
+	 * explicitly.
+	 */
+	invokeMethod(&MjpegDecoderLibjpeg::dispatchCompleted,
+		     ConnectionTypeQueued);
+}
+
+void MjpegDecoderLibjpeg::dispatchCompleted()
+{
+	std::list<std::unique_ptr<Frame>> completed;
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		completed.swap(completed_);
+	}
+
+	for (std::unique_ptr<Frame> &frame : completed) {
+		outputBufferReady.emit(frame->output);
+		inputBufferReady.emit(frame->input);
+	}
+}
+
+} /* namespace libcamera */
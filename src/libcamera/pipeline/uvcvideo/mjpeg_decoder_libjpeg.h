@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * mjpeg_decoder_libjpeg.h - MJPEG decoding with libjpeg on a thread pool
+ */
+
+#ifndef __LIBCAMERA_PIPELINE_UVCVIDEO_MJPEG_DECODER_LIBJPEG_H__
+#define __LIBCAMERA_PIPELINE_UVCVIDEO_MJPEG_DECODER_LIBJPEG_H__
+
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "libcamera/internal/buffer.h"
+#include "libcamera/internal/dma_buffer_allocator.h"
+
+#include "mjpeg_decoder.h"
+
+namespace libcamera {
+
+class MjpegDecoderLibjpeg : public MjpegDecoder
+{
+public:
+	MjpegDecoderLibjpeg();
+	~MjpegDecoderLibjpeg();
+
+	bool isValid() const override { return allocator_.isValid(); }
+
+	std::vector<PixelFormat> formats() const override;
+	std::tuple<unsigned int, unsigned int>
+	strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size) override;
+
+	int configure(const PixelFormat &pixelFormat, const Size &size,
+		      unsigned int inputBufferCount,
+		      unsigned int outputBufferCount) override;
+	int exportBuffers(unsigned int count,
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
+
+	unsigned int depth() const override { return numWorkers_; }
+
+	int start() override;
+	void stop() override;
+
+	int queueBuffers(FrameBuffer *input, FrameBuffer *output) override;
+
+private:
+	struct Frame {
+		FrameBuffer *input;
+		FrameBuffer *output;
+		const MappedBuffer *inputMap;
+		const MappedBuffer *outputMap;
+		bool started;
+		bool cancelled;
+	};
+
+	struct Worker;
+
+	void worker();
+	bool decode(Worker *worker, Frame *frame);
+	void decodeRaw(Worker *worker, uint8_t *luma, uint8_t *chroma);
+	void decodeScanlines(Worker *worker, uint8_t *luma, uint8_t *chroma);
+	void finishFrame(Frame *frame, bool success);
+	void dispatchCompleted();
+
+	DmaBufferAllocator allocator_;
+
+	PixelFormat pixelFormat_;
+	Size size_;
+	unsigned int stride_;
+	unsigned int frameSize_;
+	unsigned int numWorkers_;
+
+	MappedBufferCache inputMaps_;
+	MappedBufferCache outputMaps_;
+
+	std::vector<std::thread> workers_;
+
+	/* Protects all the members below. */
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	bool stopping_;
+	std::list<std::unique_ptr<Frame>> frames_;
+	std::list<std::unique_ptr<Frame>> completed_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_PIPELINE_UVCVIDEO_MJPEG_DECODER_LIBJPEG_H__ */
@@ -0,0 +1,241 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * mjpeg_decoder_v4l2.cpp - MJPEG decoding with a V4L2 memory-to-memory decoder
+ */
+
+#include "mjpeg_decoder_v4l2.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include <libcamera/formats.h>
+
+#include "libcamera/internal/log.h"
+#include "libcamera/internal/media_device.h"
+#include "libcamera/internal/v4l2_videodevice.h"
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(UVC)
+
+namespace {
+
+/*
+ * Number of frames queued to the decoder at the same time, to overlap the
+ * decoding of a frame with the transfer of the next one.
+ */
+constexpr unsigned int kDecoderDepth = 2;
+
+} /* namespace */
+
+MjpegDecoderV4L2::MjpegDecoderV4L2(MediaDevice *media)
+	: inputBufferCount_(0), outputBufferCount_(0)
+{
+	/* The caller guarantees that this is a V4L2 mem2mem JPEG decoder. */
+	const std::vector<MediaEntity *> &entities = media->entities();
+	auto it = std::find_if(entities.begin(), entities.end(),
+			       [](MediaEntity *entity) {
+				       return entity->function() == MEDIA_ENT_F_IO_V4L;
+			       });
+	if (it == entities.end())
+		return;
+
+	m2m_ = std::make_unique<V4L2M2MDevice>((*it)->deviceNode());
+
+	m2m_->output()->bufferReady.connect(this, &MjpegDecoderV4L2::decoderInputDone);
+	m2m_->capture()->bufferReady.connect(this, &MjpegDecoderV4L2::decoderOutputDone);
+
+	int ret = m2m_->open();
+	if (ret < 0) {
+		m2m_.reset();
+		return;
+	}
+
+	/* Decoders accept either of the JPEG and Motion-JPEG 4CCs. */
+	V4L2VideoDevice::Formats inputFormats = m2m_->output()->formats();
+	for (uint32_t fourcc : { V4L2_PIX_FMT_JPEG, V4L2_PIX_FMT_MJPEG }) {
+		if (inputFormats.count(V4L2PixelFormat(fourcc))) {
+			inputFormat_ = V4L2PixelFormat(fourcc);
+			break;
+		}
+	}
+
+	if (!inputFormat_.isValid()) {
+		LOG(UVC, Debug) << "Decoder doesn't support JPEG input";
+		m2m_.reset();
+		return;
+	}
+
+	/*
+	 * Set the format on the input side (V4L2 output) of the decoder to
+	 * enumerate the formats it can produce on its output (V4L2 capture).
+	 */
+	V4L2DeviceFormat format;
+	format.fourcc = inputFormat_;
+	format.size = { 640, 480 };
+
+	ret = m2m_->output()->setFormat(&format);
+	if (ret < 0) {
+		LOG(UVC, Error) << "Failed to set format: " << strerror(-ret);
+		m2m_.reset();
+		return;
+	}
+
+	for (const auto &fmt : m2m_->capture()->formats()) {
+		PixelFormat pixelFormat = fmt.first.toPixelFormat();
+		if (pixelFormat == formats::NV12 || pixelFormat == formats::YUYV)
+			formats_.push_back(pixelFormat);
+	}
+
+	if (formats_.empty()) {
+		LOG(UVC, Debug) << "Decoder doesn't support NV12 or YUYV output";
+		m2m_.reset();
+	}
+}
+
+MjpegDecoderV4L2::~MjpegDecoderV4L2()
+{
+}
+
+std::vector<PixelFormat> MjpegDecoderV4L2::formats() const
+{
+	return formats_;
+}
+
+std::tuple<unsigned int, unsigned int>
+MjpegDecoderV4L2::strideAndFrameSize(const PixelFormat &pixelFormat,
+				     const Size &size)
+{
+	V4L2DeviceFormat format;
+	format.fourcc = m2m_->capture()->toV4L2PixelFormat(pixelFormat);
+	format.size = size;
+
+	int ret = m2m_->capture()->tryFormat(&format);
+	if (ret < 0)
+		return std::make_tuple(0, 0);
+
+	return std::make_tuple(format.planes[0].bpl, format.planes[0].size);
+}
+
+int MjpegDecoderV4L2::configure(const PixelFormat &pixelFormat,
+				const Size &size,
+				unsigned int inputBufferCount,
+				unsigned int outputBufferCount)
+{
+	V4L2DeviceFormat format;
+	format.fourcc = inputFormat_;
+	format.size = size;
+
+	int ret = m2m_->output()->setFormat(&format);
+	if (ret < 0) {
+		LOG(UVC, Error)
+			<< "Failed to set decoder input format: " << strerror(-ret);
+		return ret;
+	}
+
+	if (format.fourcc != inputFormat_ || format.size != size) {
+		LOG(UVC, Error) << "Decoder input format not supported";
+		return -EINVAL;
+	}
+
+	V4L2PixelFormat videoFormat = m2m_->capture()->toV4L2PixelFormat(pixelFormat);
+	format = {};
+	format.fourcc = videoFormat;
+	format.size = size;
+
+	ret = m2m_->capture()->setFormat(&format);
+	if (ret < 0) {
+		LOG(UVC, Error)
+			<< "Failed to set decoder output format: " << strerror(-ret);
+		return ret;
+	}
+
+	if (format.fourcc != videoFormat || format.size != size) {
+		LOG(UVC, Error) << "Decoder output format not supported";
+		return -EINVAL;
+	}
+
+	inputBufferCount_ = inputBufferCount;
+	outputBufferCount_ = outputBufferCount;
+
+	return 0;
+}
+
+int MjpegDecoderV4L2::exportBuffers(unsigned int count,
+				    std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	return m2m_->capture()->exportBuffers(count, buffers);
+}
+
+unsigned int MjpegDecoderV4L2::depth() const
+{
+	return kDecoderDepth;
+}
+
+int MjpegDecoderV4L2::start()
+{
+	int ret = m2m_->output()->importBuffers(inputBufferCount_);
+	if (ret < 0)
+		return ret;
+
+	ret = m2m_->capture()->importBuffers(outputBufferCount_);
+	if (ret < 0) {
+		stop();
+		return ret;
+	}
+
+	ret = m2m_->output()->streamOn();
+	if (ret < 0) {
+		stop();
+		return ret;
+	}
+
+	ret = m2m_->capture()->streamOn();
+	if (ret < 0) {
+		stop();
+		return ret;
+	}
+
+	return 0;
+}
+
+void MjpegDecoderV4L2::stop()
+{
+	m2m_->capture()->streamOff();
+	m2m_->output()->streamOff();
+	m2m_->capture()->releaseBuffers();
+	m2m_->output()->releaseBuffers();
+}
+
+int MjpegDecoderV4L2::queueBuffers(FrameBuffer *input, FrameBuffer *output)
+{
+	int ret = m2m_->output()->queueBuffer(input);
+	if (ret < 0) {
+		inputBufferReady.emit(input);
+		return ret;
+	}
+
+	/*
+	 * The input buffer can't be taken back from the decoder once queued,
+	 * it will be released once decoded to the next output buffer.
+	 */
+	ret = m2m_->capture()->queueBuffer(output);
+	if (ret < 0)
+		return ret;
+
+	return 0;
+}
+
+void MjpegDecoderV4L2::decoderInputDone(FrameBuffer *buffer)
+{
+	inputBufferReady.emit(buffer);
+}
+
+void MjpegDecoderV4L2::decoderOutputDone(FrameBuffer *buffer)
+{
+	outputBufferReady.emit(buffer);
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * mjpeg_decoder_v4l2.h - MJPEG decoding with a V4L2 memory-to-memory decoder
+ */
+
+#ifndef __LIBCAMERA_PIPELINE_UVCVIDEO_MJPEG_DECODER_V4L2_H__
+#define __LIBCAMERA_PIPELINE_UVCVIDEO_MJPEG_DECODER_V4L2_H__
+
+#include <memory>
+#include <vector>
+
+#include "libcamera/internal/v4l2_pixelformat.h"
+
+#include "mjpeg_decoder.h"
+
+namespace libcamera {
+
+class MediaDevice;
+class V4L2M2MDevice;
+
+class MjpegDecoderV4L2 : public MjpegDecoder
+{
+public:
+	MjpegDecoderV4L2(MediaDevice *media);
+	~MjpegDecoderV4L2();
+
+	bool isValid() const override { return m2m_ != nullptr; }
+
+	std::vector<PixelFormat> formats() const override;
+	std::tuple<unsigned int, unsigned int>
+	strideAndFrameSize(const PixelFormat &pixelFormat, const Size &size) override;
+
+	int configure(const PixelFormat &pixelFormat, const Size &size,
+		      unsigned int inputBufferCount,
+		      unsigned int outputBufferCount) override;
+	int exportBuffers(unsigned int count,
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
+
+	unsigned int depth() const override;
+
+	int start() override;
+	void stop() override;
+
+	int queueBuffers(FrameBuffer *input, FrameBuffer *output) override;
+
+private:
+	void decoderInputDone(FrameBuffer *buffer);
+	void decoderOutputDone(FrameBuffer *buffer);
+
+	std::unique_ptr<V4L2M2MDevice> m2m_;
+
+	V4L2PixelFormat inputFormat_;
+	std::vector<PixelFormat> formats_;
+
+	unsigned int inputBufferCount_;
+	unsigned int outputBufferCount_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_PIPELINE_UVCVIDEO_MJPEG_DECODER_V4L2_H__ */
@@ -0,0 +1,267 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * uvc_clock.cpp - UVC device clock recovery
+ */
+
+#include "uvc_clock.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace libcamera {
+
+namespace {
+
+/*
+ * Layout of the V4L2_META_FMT_UVC blocks. Each block stores the system
+ * timestamp and USB frame number at which a payload was received, followed by
+ * the payload header.
+ */
+constexpr unsigned int kMetaNsOffset = 0;
+constexpr unsigned int kMetaSofOffset = 8;
+constexpr unsigned int kMetaLengthOffset = 10;
+constexpr unsigned int kMetaHeaderOffset = 12;
+
+/* Payload header flags. */
+constexpr uint8_t kHeaderPts = 1 << 2;
+constexpr uint8_t kHeaderScr = 1 << 3;
+
+/* USB frames are 1ms long, and numbered with an 11-bit counter. */
+constexpr uint64_t kSofPeriod = 1000000;
+constexpr uint16_t kSofMask = 0x7ff;
+
+/*
+ * Maximum delay between the SOF sampled in the SCR and the reception of the
+ * payload. Larger values come from devices that don't report the bus SOF
+ * number, their samples are used without correction.
+ */
+constexpr unsigned int kMaxSofDelay = 32;
+
+/* Samples older than the window are dropped, and the fit needs a minimum. */
+constexpr int64_t kWindow = 2000000000;
+constexpr int64_t kMinSpan = 250000000;
+constexpr unsigned int kMinSamples = 8;
+constexpr unsigned int kMaxSamples = 512;
+
+uint16_t read16(const uint8_t *data)
+{
+	return data[0] | (data[1] << 8);
+}
+
+uint32_t read32(const uint8_t *data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) |
+	       (static_cast<uint32_t>(data[3]) << 24);
+}
+
+uint64_t read64(const uint8_t *data)
+{
+	return read32(data) | (static_cast<uint64_t>(read32(data + 4)) << 32);
+}
+
+} /* namespace */
+
+/*
+ * UVC devices timestamp frames with the Presentation Time Stamp (PTS), the
+ * value of their clock when capture of the frame started. They also sample
+ * their clock in the Source Clock Reference (SCR) of payload headers, along
+ * with the number of the USB frame during which the sample was taken. The
+ * uvcvideo driver records the headers with the time and USB frame number of
+ * their reception in the metadata buffers.
+ *
+ * The UVCClock fits a linear mapping from the device clock to the system clock
+ * on the SCR samples of the last two seconds. Each sample is moved back to the
+ * start of the USB frame in which the device sampled its clock. The slope is
+ * computed by least squares, and the offset from the sample received with the
+ * shortest delay, as the USB scheduling can only delay reception. The PTS of
+ * each frame is then converted to a start of exposure timestamp.
+ */
+
+UVCClock::UVCClock()
+{
+	reset();
+}
+
+void UVCClock::reset()
+{
+	samples_.clear();
+	lastStc_ = 0;
+	valid_ = false;
+	stcRef_ = 0;
+	nsRef_ = 0;
+	offset_ = 0.0;
+	slope_ = 0.0;
+}
+
+/*
+ * Process the contents of a metadata buffer and return the start of exposure
+ * timestamp of the corresponding frame, or 0 if it can't be computed.
+ */
+uint64_t UVCClock::processMetadata(Span<const uint8_t> data)
+{
+	bool hasPts = false;
+	uint32_t pts = 0;
+
+	for (std::size_t pos = 0; pos + kMetaHeaderOffset < data.size();) {
+		const uint8_t *block = &data[pos];
+		unsigned int length = block[kMetaLengthOffset];
+
+		pos += kMetaHeaderOffset + length;
+		if (pos > data.size() || length < 2)
+			break;
+
+		uint64_t ns = read64(block + kMetaNsOffset);
+		uint16_t sof = read16(block + kMetaSofOffset) & kSofMask;
+		const uint8_t *header = block + kMetaHeaderOffset;
+		uint8_t flags = header[1];
+		unsigned int offset = 2;
+
+		if (flags & kHeaderPts) {
+			if (length < offset + 4)
+				continue;
+
+			if (!hasPts) {
+				pts = read32(header + offset);
+				hasPts = true;
+			}
+
+			offset += 4;
+		}
+
+		if (flags & kHeaderScr) {
+			if (length < offset + 6)
+				continue;
+
+			uint32_t stc = read32(header + offset);
+			uint16_t scrSof = read16(header + offset + 4) & kSofMask;
+			unsigned int delay = (sof - scrSof) & kSofMask;
+
+			if (delay <= kMaxSofDelay && ns > delay * kSofPeriod)
+				ns -= delay * kSofPeriod;
+
+			addSample(stc, ns);
+		}
+	}
+
+	update();
+
+	if (!hasPts)
+		return 0;
+
+	return timestamp(pts);
+}
+
+void UVCClock::addSample(uint32_t stc, uint64_t ns)
+{
+	if (samples_.empty()) {
+		samples_.push_back({ stc, ns });
+		lastStc_ = stc;
+		return;
+	}
+
+	/*
+	 * Consecutive payloads often carry the same SCR. A clock going
+	 * backward indicates that the device has been reset.
+	 */
+	const Sample &last = samples_.back();
+	int32_t delta = static_cast<int32_t>(stc - lastStc_);
+	if (delta == 0)
+		return;
+
+	if (delta < 0) {
+		reset();
+		samples_.push_back({ stc, ns });
+		lastStc_ = stc;
+		return;
+	}
+
+	samples_.push_back({ last.stc + delta, ns });
+	lastStc_ = stc;
+
+	while (samples_.size() > kMaxSamples ||
+	       static_cast<int64_t>(ns - samples_.front().ns) > kWindow)
+		samples_.pop_front();
+}
+
+void UVCClock::update()
+{
+	valid_ = false;
+
+	if (samples_.size() < kMinSamples ||
+	    static_cast<int64_t>(samples_.back().ns - samples_.front().ns) < kMinSpan)
+		return;
+
+	/*
+	 * Compute the fit relative to the first sample to preserve precision.
+	 * The system timestamps of the samples are not strictly increasing, as
+	 * the correction of the reception delay is coarse.
+	 */
+	const Sample &ref = samples_.front();
+	double meanX = 0.0;
+	double meanY = 0.0;
+
+	for (const Sample &sample : samples_) {
+		meanX += sample.stc - ref.stc;
+		meanY += static_cast<int64_t>(sample.ns - ref.ns);
+	}
+
+	meanX /= samples_.size();
+	meanY /= samples_.size();
+
+	double covXY = 0.0;
+	double varX = 0.0;
+
+	for (const Sample &sample : samples_) {
+		double x = (sample.stc - ref.stc) - meanX;
+		double y = static_cast<int64_t>(sample.ns - ref.ns) - meanY;
+
+		covXY += x * y;
+		varX += x * x;
+	}
+
+	if (varX <= 0.0 || covXY <= 0.0)
+		return;
+
+	double slope = covXY / varX;
+	double offset = std::numeric_limits<double>::max();
+
+	for (const Sample &sample : samples_) {
+		double x = sample.stc - ref.stc;
+		double y = static_cast<int64_t>(sample.ns - ref.ns);
+
+		offset = std::min(offset, y - slope * x);
+	}
+
+	stcRef_ = ref.stc;
+	nsRef_ = ref.ns;
+	offset_ = offset;
+	slope_ = slope;
+	valid_ = true;
+}
+
+/*
+ * Convert a device clock value, close to the last SCR sample, to a system
+ * timestamp in nanoseconds. Return 0 if the clock hasn't been recovered yet.
+ */
+uint64_t UVCClock::timestamp(uint32_t pts) const
+{
+	if (!valid_)
+		return 0;
+
+	double x = static_cast<double>(extend(pts)) - static_cast<double>(stcRef_);
+	double ns = static_cast<double>(nsRef_) + offset_ + slope_ * x;
+	if (ns <= 0.0)
+		return 0;
+
+	return static_cast<uint64_t>(ns);
+}
+
+int64_t UVCClock::extend(uint32_t stc) const
+{
+	int32_t delta = static_cast<int32_t>(stc - lastStc_);
+	return static_cast<int64_t>(samples_.back().stc) + delta;
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * uvc_clock.h - UVC device clock recovery
+ */
+
+#ifndef __LIBCAMERA_PIPELINE_UVCVIDEO_UVC_CLOCK_H__
+#define __LIBCAMERA_PIPELINE_UVCVIDEO_UVC_CLOCK_H__
+
+#include <deque>
+#include <stdint.h>
+
+#include <libcamera/span.h>
+
+namespace libcamera {
+
+class UVCClock
+{
+public:
+	UVCClock();
+
+	void reset();
+
+	uint64_t processMetadata(Span<const uint8_t> data);
+
+	void addSample(uint32_t stc, uint64_t ns);
+	void update();
+	uint64_t timestamp(uint32_t pts) const;
+
+private:
+	struct Sample {
+		uint64_t stc;
+		uint64_t ns;
+	};
+
+	int64_t extend(uint32_t stc) const;
+
+	std::deque<Sample> samples_;
+	uint32_t lastStc_;
+
+	/* Mapping from the device clock to the system clock. */
+	bool valid_;
+	uint64_t stcRef_;
+	uint64_t nsRef_;
+	double offset_;
+	double slope_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_PIPELINE_UVCVIDEO_UVC_CLOCK_H__ */
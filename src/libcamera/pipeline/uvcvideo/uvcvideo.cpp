@@ -8,17 +8,23 @@
 #include <algorithm>
 #include <fstream>
 #include <iomanip>
+#include <map>
 #include <math.h>
 #include <memory>
+#include <queue>
+#include <string.h>
+#include <sys/mman.h>
 #include <tuple>
 
 #include <libcamera/camera.h>
 #include <libcamera/control_ids.h>
 #include <libcamera/controls.h>
+#include <libcamera/formats.h>
 #include <libcamera/property_ids.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
+#include "libcamera/internal/buffer.h"
 #include "libcamera/internal/device_enumerator.h"
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/media_device.h"
@@ -27,25 +33,89 @@
 #include "libcamera/internal/utils.h"
 #include "libcamera/internal/v4l2_videodevice.h"
 
+#include "mjpeg_decoder.h"
+#ifdef HAVE_LIBJPEG
+#include "mjpeg_decoder_libjpeg.h"
+#endif
+#include "mjpeg_decoder_v4l2.h"
+#include "uvc_clock.h"
+
 namespace libcamera {
 
 LOG_DEFINE_CATEGORY(UVC)
 
+/*
+ * Most UVC cameras reach their highest frame rates at large resolutions in
+ * MJPEG only. When a camera supports MJPEG, the pipeline handler can decode
+ * the frames to NV12 and YUYV, and exposes those formats at all the MJPEG
+ * sizes in addition to the formats captured natively. Formats and sizes
+ * supported natively by the camera are captured directly.
+ *
+ * Compressed video formats, such as H.264, are passed through to the
+ * application as captured. The size of each compressed frame and whether it is
+ * a key frame are reported in the FrameMetadata of the buffer.
+ *
+ * Frames are decoded with a V4L2 memory-to-memory JPEG decoder when one is
+ * available, and with libjpeg on a pool of worker threads otherwise. The
+ * decoder is selected by the LIBCAMERA_UVC_MJPEG_DECODER environment
+ * variable, set to "v4l2" or "libjpeg" to use a single implementation, or to
+ * "none" to disable decoding.
+ *
+ * When the driver exposes the UVC metadata video node, the payload headers
+ * recorded there are used to recover the device clock, and to timestamp each
+ * frame with the start of its exposure (see UVCClock). Video buffers are
+ * completed once the metadata of the same frame has been received. Frames
+ * without metadata, or captured before the clock is recovered, are
+ * timestamped with the buffer timestamp.
+ */
+
 class UVCCameraData : public CameraData
 {
 public:
 	UVCCameraData(PipelineHandler *pipe)
-		: CameraData(pipe)
+		: CameraData(pipe), useDecoder_(false), useMetadata_(false)
 	{
 	}
 
 	int init(MediaDevice *media);
+	void initDecoder(std::unique_ptr<MjpegDecoder> decoder);
 	void addControl(uint32_t cid, const ControlInfo &v4l2info,
 			ControlInfoMap::Map *ctrls);
+	bool needDecoding(const PixelFormat &pixelFormat, const Size &size) const;
+	void startMetadata(unsigned int count);
+	void stopMetadata();
 	void bufferReady(FrameBuffer *buffer);
+	void metadataReady(FrameBuffer *buffer);
+	void frameReady(FrameBuffer *buffer, uint64_t timestamp);
+	void decoderInputDone(FrameBuffer *buffer);
+	void decoderOutputDone(FrameBuffer *buffer);
 
 	std::unique_ptr<V4L2VideoDevice> video_;
+	std::unique_ptr<MjpegDecoder> decoder_;
 	Stream stream_;
+
+	/* Formats captured by the device, and exposed to applications. */
+	std::map<PixelFormat, std::vector<SizeRange>> deviceFormats_;
+	std::map<PixelFormat, std::vector<SizeRange>> formats_;
+	/* The exposed formats, shared by all generated configurations. */
+	StreamFormats streamFormats_;
+
+	bool useDecoder_;
+	std::vector<std::unique_ptr<FrameBuffer>> mjpegBuffers_;
+	std::queue<FrameBuffer *> decoderQueue_;
+
+	std::unique_ptr<V4L2VideoDevice> metadata_;
+	bool useMetadata_;
+	std::vector<std::unique_ptr<FrameBuffer>> metadataBuffers_;
+	std::map<const FrameBuffer *, MappedFrameBuffer> metadataMaps_;
+	UVCClock clock_;
+
+	/* Video buffers waiting for metadata, and timestamps waiting for video. */
+	std::queue<FrameBuffer *> pendingBuffers_;
+	std::map<uint32_t, uint64_t> timestamps_;
+
+private:
+	static constexpr unsigned int kMaxTimestamps = 8;
 };
 
 class UVCCameraConfiguration : public CameraConfiguration
@@ -80,6 +150,7 @@ public:
 
 private:
 	std::string generateId(const UVCCameraData *data);
+	std::unique_ptr<MjpegDecoder> createDecoder(DeviceEnumerator *enumerator);
 
 	int processControl(ControlList *controls, unsigned int id,
 			   const ControlValue &value);
@@ -117,6 +188,13 @@ CameraConfiguration::Status UVCCameraConfiguration::validate()
 
 	StreamConfiguration &cfg = config_[0];
 	const StreamFormats &formats = cfg.formats();
+
+	/* Per-stream cropping isn't supported. */
+	if (!cfg.crop.isNull()) {
+		cfg.crop = {};
+		status = Adjusted;
+	}
+
 	const PixelFormat pixelFormat = cfg.pixelFormat;
 	const Size size = cfg.size;
 
@@ -147,11 +225,31 @@ CameraConfiguration::Status UVCCameraConfiguration::validate()
 		status = Adjusted;
 	}
 
+	/*
+	 * When decoding, add buffers to keep enough of them queued to the
+	 * device while frames are being decoded.
+	 */
+	if (data_->needDecoding(cfg.pixelFormat, cfg.size)) {
+		cfg.bufferCount = 4 + data_->decoder_->depth() - 1;
+
+		std::tie(cfg.stride, cfg.frameSize) =
+			data_->decoder_->strideAndFrameSize(cfg.pixelFormat,
+							    cfg.size);
+		if (!cfg.stride)
+			return Invalid;
+
+		if (adjustStrideAlign(&cfg))
+			status = Adjusted;
+
+		return status;
+	}
+
 	cfg.bufferCount = 4;
 
 	V4L2DeviceFormat format;
 	format.fourcc = data_->video_->toV4L2PixelFormat(cfg.pixelFormat);
 	format.size = cfg.size;
+	format.alignStride(cfg.strideAlign);
 
 	int ret = data_->video_->tryFormat(&format);
 	if (ret)
@@ -160,6 +258,9 @@ CameraConfiguration::Status UVCCameraConfiguration::validate()
 	cfg.stride = format.planes[0].bpl;
 	cfg.frameSize = format.planes[0].size;
 
+	if (adjustStrideAlign(&cfg))
+		status = Adjusted;
+
 	return status;
 }
 
@@ -177,15 +278,7 @@ CameraConfiguration *PipelineHandlerUVC::generateConfiguration(Camera *camera,
 	if (roles.empty())
 		return config;
 
-	V4L2VideoDevice::Formats v4l2Formats = data->video_->formats();
-	std::map<PixelFormat, std::vector<SizeRange>> deviceFormats;
-	for (const auto &format : v4l2Formats) {
-		PixelFormat pixelFormat = format.first.toPixelFormat();
-		if (pixelFormat.isValid())
-			deviceFormats[pixelFormat] = format.second;
-	}
-
-	StreamFormats formats(deviceFormats);
+	const StreamFormats &formats = data->streamFormats_;
 	StreamConfiguration cfg(formats);
 
 	cfg.pixelFormat = formats.pixelformats().front();
@@ -205,18 +298,32 @@ int PipelineHandlerUVC::configure(Camera *camera, CameraConfiguration *config)
 	StreamConfiguration &cfg = config->at(0);
 	int ret;
 
+	/* Capture MJPEG frames if they need to be decoded. */
+	data->useDecoder_ = data->needDecoding(cfg.pixelFormat, cfg.size);
+	PixelFormat videoFormat = data->useDecoder_ ? formats::MJPEG
+				: cfg.pixelFormat;
+
 	V4L2DeviceFormat format;
-	format.fourcc = data->video_->toV4L2PixelFormat(cfg.pixelFormat);
+	format.fourcc = data->video_->toV4L2PixelFormat(videoFormat);
 	format.size = cfg.size;
+	if (!data->useDecoder_)
+		format.alignStride(cfg.strideAlign);
 
 	ret = data->video_->setFormat(&format);
 	if (ret)
 		return ret;
 
 	if (format.size != cfg.size ||
-	    format.fourcc != data->video_->toV4L2PixelFormat(cfg.pixelFormat))
+	    format.fourcc != data->video_->toV4L2PixelFormat(videoFormat))
 		return -EINVAL;
 
+	if (data->useDecoder_) {
+		ret = data->decoder_->configure(cfg.pixelFormat, cfg.size,
+						cfg.bufferCount, cfg.bufferCount);
+		if (ret)
+			return ret;
+	}
+
 	cfg.setStream(&data->stream_);
 
 	return 0;
@@ -226,34 +333,88 @@ int PipelineHandlerUVC::exportFrameBuffers(Camera *camera, Stream *stream,
 					   std::vector<std::unique_ptr<FrameBuffer>> *buffers)
 {
 	UVCCameraData *data = cameraData(camera);
-	unsigned int count = stream->configuration().bufferCount;
+	const StreamConfiguration &cfg = stream->configuration();
+
+	if (data->useDecoder_)
+		return data->decoder_->exportBuffers(cfg.bufferCount, buffers);
 
-	return data->video_->exportBuffers(count, buffers);
+	int ret = allocateFrameBuffers(cfg.bufferCount, { cfg.frameSize }, buffers);
+	if (ret != -ENODEV)
+		return ret;
+
+	return data->video_->exportBuffers(cfg.bufferCount, buffers);
 }
 
 int PipelineHandlerUVC::start(Camera *camera, [[maybe_unused]] const ControlList *controls)
 {
 	UVCCameraData *data = cameraData(camera);
 	unsigned int count = data->stream_.configuration().bufferCount;
+	int ret;
 
-	int ret = data->video_->importBuffers(count);
+	/*
+	 * When decoding, capture to internal buffers that are handed to the
+	 * decoder. Otherwise, capture to the buffers of the stream.
+	 */
+	if (data->useDecoder_)
+		ret = data->video_->allocateBuffers(count, &data->mjpegBuffers_);
+	else
+		ret = data->video_->importBuffers(count);
 	if (ret < 0)
 		return ret;
 
+	data->startMetadata(count);
+
 	ret = data->video_->streamOn();
 	if (ret < 0) {
-		data->video_->releaseBuffers();
+		stop(camera);
 		return ret;
 	}
 
+	if (data->useDecoder_) {
+		ret = data->decoder_->start();
+		if (ret < 0) {
+			stop(camera);
+			return ret;
+		}
+
+		for (std::unique_ptr<FrameBuffer> &buffer : data->mjpegBuffers_)
+			data->video_->queueBuffer(buffer.get());
+	}
+
 	return 0;
 }
 
 void PipelineHandlerUVC::stop(Camera *camera)
 {
 	UVCCameraData *data = cameraData(camera);
+
+	/* Complete the frames still waiting for metadata. */
+	while (!data->pendingBuffers_.empty()) {
+		FrameBuffer *buffer = data->pendingBuffers_.front();
+		data->pendingBuffers_.pop();
+		data->frameReady(buffer, 0);
+	}
+
+	if (data->useDecoder_)
+		data->decoder_->stop();
+
 	data->video_->streamOff();
 	data->video_->releaseBuffers();
+
+	data->stopMetadata();
+
+	/* Cancel the buffers of requests that have no frame to decode. */
+	while (!data->decoderQueue_.empty()) {
+		FrameBuffer *buffer = data->decoderQueue_.front();
+		data->decoderQueue_.pop();
+
+		Request *request = buffer->request();
+		buffer->cancel();
+		completeBuffer(request, buffer);
+		completeRequest(request);
+	}
+
+	data->mjpegBuffers_.clear();
 }
 
 int PipelineHandlerUVC::processControl(ControlList *controls, unsigned int id,
@@ -377,6 +538,15 @@ int PipelineHandlerUVC::queueRequestDevice(Camera *camera, Request *request)
 	if (ret < 0)
 		return ret;
 
+	/*
+	 * When decoding, the buffer is handed to the decoder along with the
+	 * next captured frame.
+	 */
+	if (data->useDecoder_) {
+		data->decoderQueue_.push(buffer);
+		return 0;
+	}
+
 	ret = data->video_->queueBuffer(buffer);
 	if (ret < 0)
 		return ret;
@@ -447,6 +617,46 @@ std::string PipelineHandlerUVC::generateId(const UVCCameraData *data)
 	return controllerId + "-" + usbId + "-" + deviceId;
 }
 
+std::unique_ptr<MjpegDecoder>
+PipelineHandlerUVC::createDecoder(DeviceEnumerator *enumerator)
+{
+	static const char *const v4l2Decoders[] = {
+		"mtk-jpeg",
+		"mxc-jpeg",
+		"s5p-jpeg",
+	};
+
+	const char *mode = utils::secure_getenv("LIBCAMERA_UVC_MJPEG_DECODER");
+	bool useV4L2 = !mode || !strcmp(mode, "v4l2");
+	[[maybe_unused]] bool useLibjpeg = !mode || !strcmp(mode, "libjpeg");
+
+	if (useV4L2) {
+		for (const char *name : v4l2Decoders) {
+			DeviceMatch dm(name);
+			MediaDevice *media = acquireMediaDevice(enumerator, dm);
+			if (!media)
+				continue;
+
+			auto decoder = std::make_unique<MjpegDecoderV4L2>(media);
+			if (decoder->isValid())
+				return decoder;
+		}
+	}
+
+#ifdef HAVE_LIBJPEG
+	if (useLibjpeg) {
+		auto decoder = std::make_unique<MjpegDecoderLibjpeg>();
+		if (decoder->isValid())
+			return decoder;
+
+		LOG(UVC, Warning)
+			<< "No dma-heap available, disabling libjpeg decoder";
+	}
+#endif
+
+	return nullptr;
+}
+
 bool PipelineHandlerUVC::match(DeviceEnumerator *enumerator)
 {
 	MediaDevice *media;
@@ -461,6 +671,14 @@ bool PipelineHandlerUVC::match(DeviceEnumerator *enumerator)
 	if (data->init(media))
 		return false;
 
+	if (data->deviceFormats_.count(formats::MJPEG)) {
+		std::unique_ptr<MjpegDecoder> decoder = createDecoder(enumerator);
+		if (decoder)
+			data->initDecoder(std::move(decoder));
+	}
+
+	data->streamFormats_ = StreamFormats(data->formats_);
+
 	/* Create and register the camera. */
 	std::string id = generateId(data.get());
 	if (id.empty()) {
@@ -501,6 +719,35 @@ int UVCCameraData::init(MediaDevice *media)
 
 	video_->bufferReady.connect(this, &UVCCameraData::bufferReady);
 
+	/* Open the metadata video node, if any, to recover the device clock. */
+	for (MediaEntity *e : entities) {
+		if (e == *entity || e->function() != MEDIA_ENT_F_IO_V4L)
+			continue;
+
+		auto metadata = std::make_unique<V4L2VideoDevice>(e);
+		if (metadata->open() || !metadata->caps().isMetaCapture())
+			continue;
+
+		V4L2DeviceFormat format;
+		format.fourcc = V4L2PixelFormat(V4L2_META_FMT_UVC);
+
+		ret = metadata->setFormat(&format);
+		if (ret || format.fourcc != V4L2PixelFormat(V4L2_META_FMT_UVC))
+			continue;
+
+		metadata_ = std::move(metadata);
+		metadata_->bufferReady.connect(this, &UVCCameraData::metadataReady);
+		break;
+	}
+
+	for (const auto &format : video_->formats()) {
+		PixelFormat pixelFormat = format.first.toPixelFormat();
+		if (pixelFormat.isValid())
+			deviceFormats_[pixelFormat] = format.second;
+	}
+
+	formats_ = deviceFormats_;
+
 	/*
 	 * \todo Find a way to tell internal and external UVC cameras apart.
 	 * Until then, treat all UVC cameras as external.
@@ -513,7 +760,7 @@ int UVCCameraData::init(MediaDevice *media)
 	 * properties.
 	 */
 	Size resolution;
-	for (const auto &it : video_->formats()) {
+	for (const auto &it : deviceFormats_) {
 		const std::vector<SizeRange> &sizeRanges = it.second;
 		for (const SizeRange &sizeRange : sizeRanges) {
 			if (sizeRange.max > resolution)
@@ -539,6 +786,71 @@ int UVCCameraData::init(MediaDevice *media)
 	return 0;
 }
 
+/*
+ * Expose the formats produced by the decoder at all the discrete MJPEG sizes
+ * the decoder can handle. Formats also captured natively are extended only
+ * when the device reports them as discrete sizes, as StreamFormats can't mix
+ * discrete sizes and ranges.
+ */
+void UVCCameraData::initDecoder(std::unique_ptr<MjpegDecoder> decoder)
+{
+	const std::vector<SizeRange> &mjpegSizes = deviceFormats_[formats::MJPEG];
+
+	for (const PixelFormat &pixelFormat : decoder->formats()) {
+		std::vector<SizeRange> sizes = formats_[pixelFormat];
+
+		bool discrete = std::all_of(sizes.begin(), sizes.end(),
+					    [](const SizeRange &range) {
+						    return range.min == range.max;
+					    });
+		if (!discrete)
+			continue;
+
+		for (const SizeRange &range : mjpegSizes) {
+			const Size &size = range.min;
+
+			if (range.min != range.max || size.width % 2 ||
+			    size.height % 2)
+				continue;
+
+			unsigned int stride;
+			std::tie(stride, std::ignore) =
+				decoder->strideAndFrameSize(pixelFormat, size);
+			if (!stride)
+				continue;
+
+			if (std::find(sizes.begin(), sizes.end(), range) == sizes.end())
+				sizes.push_back(range);
+		}
+
+		if (sizes.empty())
+			formats_.erase(pixelFormat);
+		else
+			formats_[pixelFormat] = std::move(sizes);
+	}
+
+	decoder->inputBufferReady.connect(this, &UVCCameraData::decoderInputDone);
+	decoder->outputBufferReady.connect(this, &UVCCameraData::decoderOutputDone);
+
+	decoder_ = std::move(decoder);
+}
+
+bool UVCCameraData::needDecoding(const PixelFormat &pixelFormat,
+				 const Size &size) const
+{
+	if (!decoder_)
+		return false;
+
+	auto it = deviceFormats_.find(pixelFormat);
+	if (it == deviceFormats_.end())
+		return true;
+
+	return std::none_of(it->second.begin(), it->second.end(),
+			    [&](const SizeRange &range) {
+				    return range.contains(size);
+			    });
+}
+
 void UVCCameraData::addControl(uint32_t cid, const ControlInfo &v4l2Info,
 			       ControlInfoMap::Map *ctrls)
 {
@@ -657,13 +969,216 @@ void UVCCameraData::addControl(uint32_t cid, const ControlInfo &v4l2Info,
 	ctrls->emplace(id, info);
 }
 
+/*
+ * Capture metadata for clock recovery. Failures are not fatal, frames are then
+ * timestamped with the buffer timestamps.
+ */
+void UVCCameraData::startMetadata(unsigned int count)
+{
+	if (!metadata_)
+		return;
+
+	clock_.reset();
+
+	int ret = metadata_->allocateBuffers(count, &metadataBuffers_);
+	if (ret < 0) {
+		LOG(UVC, Warning) << "Failed to allocate metadata buffers";
+		return;
+	}
+
+	for (const std::unique_ptr<FrameBuffer> &buffer : metadataBuffers_) {
+		MappedFrameBuffer map(buffer.get(), PROT_READ);
+		if (!map.isValid()) {
+			LOG(UVC, Warning) << "Failed to map metadata buffers";
+			stopMetadata();
+			return;
+		}
+
+		metadataMaps_.emplace(buffer.get(), std::move(map));
+	}
+
+	ret = metadata_->streamOn();
+	if (ret < 0) {
+		LOG(UVC, Warning) << "Failed to start metadata capture";
+		stopMetadata();
+		return;
+	}
+
+	for (const std::unique_ptr<FrameBuffer> &buffer : metadataBuffers_)
+		metadata_->queueBuffer(buffer.get());
+
+	useMetadata_ = true;
+}
+
+void UVCCameraData::stopMetadata()
+{
+	if (!metadata_)
+		return;
+
+	useMetadata_ = false;
+
+	metadata_->streamOff();
+	metadata_->releaseBuffers();
+
+	metadataMaps_.clear();
+	metadataBuffers_.clear();
+	timestamps_.clear();
+}
+
 void UVCCameraData::bufferReady(FrameBuffer *buffer)
 {
-	Request *request = buffer->request();
+	const FrameMetadata &metadata = buffer->metadata();
+
+	/*
+	 * Frames captured successfully are completed with the timestamp
+	 * computed from their metadata. Wait for it if it hasn't been received
+	 * yet, unless metadata has already been received for a later frame.
+	 */
+	if (useMetadata_ && metadata.status == FrameMetadata::FrameSuccess) {
+		auto it = timestamps_.find(metadata.sequence);
+		if (it != timestamps_.end()) {
+			uint64_t timestamp = it->second;
+			timestamps_.erase(timestamps_.begin(), std::next(it));
+			frameReady(buffer, timestamp);
+			return;
+		}
+
+		if (timestamps_.empty() ||
+		    timestamps_.rbegin()->first < metadata.sequence) {
+			pendingBuffers_.push(buffer);
+			return;
+		}
+	}
+
+	frameReady(buffer, 0);
+}
+
+void UVCCameraData::metadataReady(FrameBuffer *buffer)
+{
+	const FrameMetadata &metadata = buffer->metadata();
+
+	if (metadata.status != FrameMetadata::FrameSuccess) {
+		if (metadata.status != FrameMetadata::FrameCancelled)
+			metadata_->queueBuffer(buffer);
+		return;
+	}
 
-	/* \todo Use the UVC metadata to calculate a more precise timestamp */
+	uint32_t sequence = metadata.sequence;
+	uint64_t timestamp;
+
+	{
+		const MappedBuffer &map = metadataMaps_.at(buffer);
+		MappedBuffer::CpuAccess access(&map, PROT_READ);
+
+		const Span<uint8_t> &plane = map.maps()[0];
+		size_t size = std::min<size_t>(metadata.planes()[0].bytesused,
+					       plane.size());
+		timestamp = clock_.processMetadata({ plane.data(), size });
+	}
+
+	metadata_->queueBuffer(buffer);
+
+	/*
+	 * Complete the frame waiting for this metadata, and the older ones
+	 * whose metadata has been lost. If the frame hasn't been received yet,
+	 * store the timestamp until it is.
+	 */
+	bool completed = false;
+
+	while (!pendingBuffers_.empty()) {
+		FrameBuffer *frame = pendingBuffers_.front();
+		uint32_t frameSequence = frame->metadata().sequence;
+		if (frameSequence > sequence)
+			break;
+
+		pendingBuffers_.pop();
+
+		if (frameSequence == sequence) {
+			frameReady(frame, timestamp);
+			completed = true;
+		} else {
+			frameReady(frame, 0);
+		}
+	}
+
+	if (completed)
+		return;
+
+	timestamps_[sequence] = timestamp;
+	while (timestamps_.size() > kMaxTimestamps)
+		timestamps_.erase(timestamps_.begin());
+}
+
+/*
+ * Complete a captured frame, with a start of exposure timestamp computed from
+ * the metadata, or 0 to use the buffer timestamp.
+ */
+void UVCCameraData::frameReady(FrameBuffer *buffer, uint64_t timestamp)
+{
+	/*
+	 * Discard estimates too far from the buffer timestamp, they come from
+	 * a clock recovery that has gone astray.
+	 */
+	uint64_t bufferTimestamp = buffer->metadata().timestamp;
+	uint64_t distance = timestamp > bufferTimestamp
+			  ? timestamp - bufferTimestamp
+			  : bufferTimestamp - timestamp;
+	if (!timestamp || distance > 1000000000)
+		timestamp = bufferTimestamp;
+
+	if (!useDecoder_) {
+		Request *request = buffer->request();
+
+		request->metadata().set(controls::SensorTimestamp,
+					static_cast<int64_t>(timestamp));
+
+		pipe_->completeBuffer(request, buffer);
+		pipe_->completeRequest(request);
+		return;
+	}
+
+	/*
+	 * Requeue internal buffers that can't be decoded for capture, unless
+	 * the stream is being stopped, and frames captured when no request is
+	 * queued.
+	 */
+	const FrameMetadata::Status status = buffer->metadata().status;
+	if (status != FrameMetadata::FrameSuccess || decoderQueue_.empty()) {
+		if (status != FrameMetadata::FrameCancelled)
+			video_->queueBuffer(buffer);
+		return;
+	}
+
+	FrameBuffer *output = decoderQueue_.front();
+	decoderQueue_.pop();
+
+	Request *request = output->request();
 	request->metadata().set(controls::SensorTimestamp,
-				buffer->metadata().timestamp);
+				static_cast<int64_t>(timestamp));
+
+	/*
+	 * The decoder returns the MJPEG buffer through decoderInputDone() even
+	 * on failure, once it doesn't use it anymore.
+	 */
+	int ret = decoder_->queueBuffers(buffer, output);
+	if (ret < 0) {
+		LOG(UVC, Error) << "Failed to queue frame for decoding";
+
+		output->cancel();
+		pipe_->completeBuffer(request, output);
+		pipe_->completeRequest(request);
+	}
+}
+
+void UVCCameraData::decoderInputDone(FrameBuffer *buffer)
+{
+	/* Queue the MJPEG buffer back for capture. */
+	video_->queueBuffer(buffer);
+}
+
+void UVCCameraData::decoderOutputDone(FrameBuffer *buffer)
+{
+	Request *request = buffer->request();
 
 	pipe_->completeBuffer(request, buffer);
 	pipe_->completeRequest(request);
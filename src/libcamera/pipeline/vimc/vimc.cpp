@@ -50,6 +50,7 @@ public:
 
 	int init();
 	void bufferReady(FrameBuffer *buffer);
+	void frameProcessed(uint32_t frame);
 
 	MediaDevice *media_;
 	std::unique_ptr<CameraSensor> sensor_;
@@ -60,6 +61,9 @@ public:
 	Stream stream_;
 
 	std::unique_ptr<ipa::vimc::IPAProxyVimc> ipa_;
+
+	/* Buffers being processed by the IPA, indexed by frame sequence. */
+	std::map<uint32_t, FrameBuffer *> processingBuffers_;
 };
 
 class VimcCameraConfiguration : public CameraConfiguration
@@ -136,6 +140,12 @@ CameraConfiguration::Status VimcCameraConfiguration::validate()
 
 	StreamConfiguration &cfg = config_[0];
 
+	/* Per-stream cropping isn't supported. */
+	if (!cfg.crop.isNull()) {
+		cfg.crop = {};
+		status = Adjusted;
+	}
+
 	/* Adjust the pixel format. */
 	const std::vector<libcamera::PixelFormat> formats = cfg.formats().pixelformats();
 	if (std::find(formats.begin(), formats.end(), cfg.pixelFormat) == formats.end()) {
@@ -168,6 +178,7 @@ CameraConfiguration::Status VimcCameraConfiguration::validate()
 	V4L2DeviceFormat format;
 	format.fourcc = data_->video_->toV4L2PixelFormat(cfg.pixelFormat);
 	format.size = cfg.size;
+	format.alignStride(cfg.strideAlign);
 
 	int ret = data_->video_->tryFormat(&format);
 	if (ret)
@@ -176,6 +187,9 @@ CameraConfiguration::Status VimcCameraConfiguration::validate()
 	cfg.stride = format.planes[0].bpl;
 	cfg.frameSize = format.planes[0].size;
 
+	if (adjustStrideAlign(&cfg))
+		status = Adjusted;
+
 	return status;
 }
 
@@ -272,6 +286,7 @@ int PipelineHandlerVimc::configure(Camera *camera, CameraConfiguration *config)
 	V4L2DeviceFormat format;
 	format.fourcc = data->video_->toV4L2PixelFormat(cfg.pixelFormat);
 	format.size = cfg.size;
+	format.alignStride(cfg.strideAlign);
 
 	ret = data->video_->setFormat(&format);
 	if (ret)
@@ -285,6 +300,7 @@ int PipelineHandlerVimc::configure(Camera *camera, CameraConfiguration *config)
 	 * Format has to be set on the raw capture video node, otherwise the
 	 * vimc driver will fail pipeline validation.
 	 */
+	format = {};
 	format.fourcc = V4L2PixelFormat(V4L2_PIX_FMT_SGRBG8);
 	format.size = { cfg.size.width / 3, cfg.size.height / 3 };
 
@@ -301,9 +317,13 @@ int PipelineHandlerVimc::exportFrameBuffers(Camera *camera, Stream *stream,
 					    std::vector<std::unique_ptr<FrameBuffer>> *buffers)
 {
 	VimcCameraData *data = cameraData(camera);
-	unsigned int count = stream->configuration().bufferCount;
+	const StreamConfiguration &cfg = stream->configuration();
 
-	return data->video_->exportBuffers(count, buffers);
+	int ret = allocateFrameBuffers(cfg.bufferCount, { cfg.frameSize }, buffers);
+	if (ret != -ENODEV)
+		return ret;
+
+	return data->video_->exportBuffers(cfg.bufferCount, buffers);
 }
 
 int PipelineHandlerVimc::start(Camera *camera, [[maybe_unused]] const ControlList *controls)
@@ -336,6 +356,15 @@ void PipelineHandlerVimc::stop(Camera *camera)
 	VimcCameraData *data = cameraData(camera);
 	data->video_->streamOff();
 	data->ipa_->stop();
+
+	/* Complete the frames that the IPA didn't return before stopping. */
+	for (const auto &[frame, buffer] : data->processingBuffers_) {
+		Request *request = buffer->request();
+		completeBuffer(request, buffer);
+		completeRequest(request);
+	}
+	data->processingBuffers_.clear();
+
 	data->video_->releaseBuffers();
 }
 
@@ -429,6 +458,8 @@ bool PipelineHandlerVimc::match(DeviceEnumerator *enumerator)
 	if (data->ipa_ != nullptr) {
 		std::string conf = data->ipa_->configurationFile("vimc.conf");
 		data->ipa_->init(IPASettings{ conf, data->sensor_->model() });
+		data->ipa_->frameProcessed.connect(data.get(),
+						   &VimcCameraData::frameProcessed);
 	} else {
 		LOG(VIMC, Warning) << "no matching IPA found";
 	}
@@ -526,6 +557,33 @@ void VimcCameraData::bufferReady(FrameBuffer *buffer)
 	request->metadata().set(controls::SensorTimestamp,
 				buffer->metadata().timestamp);
 
+	/*
+	 * Pass the frame through the IPA before completing the request, as
+	 * pipelines with real algorithms do. Cancelled buffers are completed
+	 * immediately. processFrame() is a direct call, frameProcessed() may
+	 * thus be called before it returns.
+	 */
+	if (ipa_ && buffer->metadata().status == FrameMetadata::FrameSuccess) {
+		uint32_t frame = buffer->metadata().sequence;
+		processingBuffers_[frame] = buffer;
+		ipa_->processFrame(frame);
+		return;
+	}
+
+	pipe_->completeBuffer(request, buffer);
+	pipe_->completeRequest(request);
+}
+
+void VimcCameraData::frameProcessed(uint32_t frame)
+{
+	auto iter = processingBuffers_.find(frame);
+	if (iter == processingBuffers_.end())
+		return;
+
+	FrameBuffer *buffer = iter->second;
+	processingBuffers_.erase(iter);
+
+	Request *request = buffer->request();
 	pipe_->completeBuffer(request, buffer);
 	pipe_->completeRequest(request);
 }
@@ -7,15 +7,25 @@
 
 #include "libcamera/internal/pipeline_handler.h"
 
+#include <algorithm>
+#include <limits>
+#include <stdlib.h>
+#include <sys/poll.h>
 #include <sys/sysmacros.h>
 
 #include <libcamera/buffer.h>
 #include <libcamera/camera.h>
 #include <libcamera/camera_manager.h>
+#include <libcamera/request.h>
 
+#include "libcamera/internal/buffer.h"
 #include "libcamera/internal/device_enumerator.h"
+#include "libcamera/internal/dma_buffer_allocator.h"
+#include "libcamera/internal/event_notifier.h"
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/media_device.h"
+#include "libcamera/internal/thread.h"
+#include "libcamera/internal/timer.h"
 #include "libcamera/internal/tracepoints.h"
 #include "libcamera/internal/utils.h"
 
@@ -37,6 +47,25 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(Pipeline)
 
+namespace {
+
+/*
+ * \todo Better characterize the timeout. Currently equal to the one used by
+ * the Rockchip Camera HAL on ChromeOS.
+ */
+constexpr unsigned int kFenceTimeoutMs = 300;
+
+uint64_t frameBufferSize(const FrameBuffer *buffer)
+{
+	uint64_t size = 0;
+	for (const FrameBuffer::Plane &plane : buffer->planes())
+		size += plane.length;
+
+	return size;
+}
+
+} /* namespace */
+
 /**
  * \class CameraData
  * \brief Base class for platform-specific data associated with a camera
@@ -108,6 +137,49 @@ LOG_DEFINE_CATEGORY(Pipeline)
  * over its lifetime.
  */
 
+/**
+ * \var CameraData::frameDropReason_
+ * \brief The reason to report for the next frames dropped by the pipeline
+ *
+ * When the frame sequence numbers of completed requests reveal dropped
+ * frames, the reason is reported to the application in the
+ * controls::FrameDropReason metadata. Frames dropped while no request was
+ * queued are reported as controls::FrameDropNoRequest automatically. Others
+ * are reported with the value of this field, which pipeline handlers set to
+ * the controls::FrameDropReasonEnum value of the stage that held frames back
+ * when they can tell. It is reset to controls::FrameDropPipelineLate every
+ * time a drop is reported.
+ */
+
+/**
+ * \brief Account for the memory of a buffer allocated internally
+ * \param[in] buffer The buffer
+ *
+ * Pipeline handlers shall call this function for every buffer they allocate
+ * for their internal usage, such as raw, ISP parameters and statistics
+ * buffers, to report the memory pinned by the camera through
+ * Camera::memoryUsage().
+ *
+ * \context This function shall be called from the CameraManager thread.
+ */
+void CameraData::accountInternalBuffer(const FrameBuffer *buffer)
+{
+	internalMemory_ += frameBufferSize(buffer);
+}
+
+/**
+ * \brief Reset the accounting of the buffers allocated internally
+ *
+ * Pipeline handlers shall call this function when they free their internal
+ * buffers.
+ *
+ * \context This function shall be called from the CameraManager thread.
+ */
+void CameraData::clearInternalBuffers()
+{
+	internalMemory_ = 0;
+}
+
 /**
  * \class PipelineHandler
  * \brief Create and manage cameras based on a set of media devices
@@ -131,7 +203,7 @@ LOG_DEFINE_CATEGORY(Pipeline)
  * respective factories.
  */
 PipelineHandler::PipelineHandler(CameraManager *manager)
-	: manager_(manager)
+	: manager_(manager), locked_(false), standby_(false)
 {
 }
 
@@ -226,6 +298,9 @@ bool PipelineHandler::lock()
 		}
 	}
 
+	MutexLocker locker(allocatorLock_);
+	locked_ = true;
+
 	return true;
 }
 
@@ -243,6 +318,135 @@ void PipelineHandler::unlock()
 {
 	for (std::shared_ptr<MediaDevice> &media : mediaDevices_)
 		media->unlock();
+
+	/*
+	 * Free the buffers pooled for the camera that was in use, buffers
+	 * released from now on are freed immediately.
+	 */
+	MutexLocker locker(allocatorLock_);
+	locked_ = false;
+	if (allocator_)
+		allocator_->clear();
+}
+
+/**
+ * \brief Release resources associated with a camera
+ * \param[in] camera The camera being released
+ *
+ * This method is called when the application releases the \a camera. Pipeline
+ * handlers that keep resources allocated across stop() and start(), such as
+ * internal buffers, shall override this method to free them. The default
+ * implementation does nothing.
+ *
+ * The only intended caller is Camera::release().
+ *
+ * \context This function is called from the CameraManager thread.
+ */
+void PipelineHandler::releaseDevice([[maybe_unused]] Camera *camera)
+{
+}
+
+/**
+ * \brief Keep a released camera configured for a later acquisition
+ * \param[in] camera The camera being released
+ *
+ * When warm standby is enabled with the LIBCAMERA_STANDBY_TIMEOUT environment
+ * variable, the release of a configured camera is deferred by the standby
+ * timeout. The media devices stay locked, and the pipeline handler keeps the
+ * configuration of the \a camera along with its internal buffers and IPA state,
+ * allowing a subsequent acquisition of the same camera to skip configuration
+ * if the configuration is identical. The camera is released for good with
+ * releaseZsl() and releaseDevice() when the timeout expires, or when another
+ * camera of the pipeline handler is acquired.
+ *
+ * The only intended caller is Camera::release().
+ *
+ * \context This function is called from the CameraManager thread.
+ *
+ * \return True if the \a camera has entered standby, false if warm standby is
+ * disabled and the camera shall be released immediately
+ */
+bool PipelineHandler::enterStandby(Camera *camera)
+{
+	const char *timeout = utils::secure_getenv("LIBCAMERA_STANDBY_TIMEOUT");
+	unsigned int standbyTimeout = timeout ? strtoul(timeout, nullptr, 10) : 0;
+	if (!standbyTimeout)
+		return false;
+
+	endStandby();
+
+	if (!standbyTimer_) {
+		standbyTimer_ = std::make_unique<Timer>();
+		standbyTimer_->timeout.connect(this, &PipelineHandler::standbyTimeout);
+	}
+
+	standby_ = true;
+	standbyCamera_ = camera->shared_from_this();
+	standbyTimer_->start(standbyTimeout);
+
+	LOG(Pipeline, Debug)
+		<< "Camera " << camera->id() << " in standby for "
+		<< standbyTimeout << "ms";
+
+	return true;
+}
+
+/**
+ * \brief Resume a camera from standby when it is acquired
+ * \param[in] camera The camera being acquired
+ *
+ * If the \a camera is in standby, it is resumed with the media devices still
+ * locked and its configuration preserved. Otherwise, any other camera in
+ * standby is released, and the caller shall lock the media devices with
+ * lock().
+ *
+ * The only intended caller is Camera::acquire().
+ *
+ * \context This function is called from the CameraManager thread.
+ *
+ * \return True if the \a camera has been resumed from standby, false otherwise
+ */
+bool PipelineHandler::resumeStandby(Camera *camera)
+{
+	if (!standby_ || standbyCamera_.lock().get() != camera) {
+		endStandby();
+		return false;
+	}
+
+	standby_ = false;
+	standbyTimer_->stop();
+	standbyCamera_.reset();
+
+	LOG(Pipeline, Debug) << "Camera " << camera->id() << " resumed from standby";
+
+	return true;
+}
+
+void PipelineHandler::endStandby()
+{
+	if (!standby_)
+		return;
+
+	standby_ = false;
+	standbyTimer_->stop();
+
+	/* The camera may have been destroyed in the meantime. */
+	std::shared_ptr<Camera> camera = standbyCamera_.lock();
+	standbyCamera_.reset();
+
+	if (camera) {
+		LOG(Pipeline, Debug) << "Releasing camera " << camera->id();
+
+		releaseZsl(camera.get());
+		releaseDevice(camera.get());
+	}
+
+	unlock();
+}
+
+void PipelineHandler::standbyTimeout([[maybe_unused]] Timer *timer)
+{
+	endStandby();
 }
 
 /**
@@ -268,6 +472,30 @@ const ControlList &PipelineHandler::properties(const Camera *camera) const
 	return data->properties_;
 }
 
+/**
+ * \brief Retrieve the memory pinned by the pipeline handler for a camera
+ * \param[in] camera The camera
+ *
+ * The CameraMemoryUsage::applicationBuffers field isn't filled by this
+ * function, as the buffers allocated for the application are accounted by the
+ * Camera.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return The memory pinned by the internal and zero shutter lag buffers of
+ * \a camera
+ */
+CameraMemoryUsage PipelineHandler::memoryUsage(const Camera *camera) const
+{
+	const CameraData *data = cameraData(camera);
+	CameraMemoryUsage usage;
+
+	usage.internalBuffers = data->internalMemory_;
+	usage.zslBuffers = data->zslMemory_;
+
+	return usage;
+}
+
 /**
  * \fn PipelineHandler::generateConfiguration()
  * \brief Generate a camera configuration for a specified camera
@@ -317,6 +545,83 @@ const ControlList &PipelineHandler::properties(const Camera *camera) const
  * \return 0 on success or a negative error code otherwise
  */
 
+/**
+ * \brief Configure zero shutter lag capture for a camera
+ * \param[in] camera The camera
+ * \param[in] config The camera configuration applied with configure()
+ *
+ * This method sets up the ring of frames used to serve the requests that set
+ * the controls::ZslTimestamp control, with CameraConfiguration::zslDepth slots
+ * for each stream of the \a config. The ring buffers are allocated with
+ * allocateFrameBuffers(), and the buffers of the previous configuration are
+ * recycled.
+ *
+ * The only intended caller is Camera::configure().
+ *
+ * \context This function is called from the CameraManager thread.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV No dma-heap is available to allocate the ring buffers
+ */
+int PipelineHandler::configureZsl(Camera *camera,
+				  const CameraConfiguration *config)
+{
+	CameraData *data = cameraData(camera);
+
+	releaseZsl(camera);
+
+	if (!config->zslDepth)
+		return 0;
+
+	data->zslRing_.configure(config->zslDepth);
+
+	for (const StreamConfiguration &cfg : *config) {
+		std::vector<std::unique_ptr<FrameBuffer>> buffers;
+		int ret = allocateFrameBuffers(config->zslDepth, { cfg.frameSize },
+					       &buffers);
+		if (ret >= 0) {
+			for (const std::unique_ptr<FrameBuffer> &buffer : buffers)
+				data->zslMemory_ += frameBufferSize(buffer.get());
+
+			ret = data->zslRing_.addStream(cfg.stream(),
+						       std::move(buffers));
+		}
+		if (ret < 0) {
+			LOG(Pipeline, Error)
+				<< "Failed to allocate zero shutter lag buffers";
+			releaseFrameBuffers(&buffers);
+			releaseZsl(camera);
+			return ret;
+		}
+	}
+
+	LOG(Pipeline, Debug)
+		<< "Keeping " << config->zslDepth
+		<< " frames for zero shutter lag capture";
+
+	return 0;
+}
+
+/**
+ * \brief Release the zero shutter lag ring of a camera
+ * \param[in] camera The camera
+ *
+ * The buffers of the ring are recycled, and zero shutter lag capture is
+ * disabled until the camera is configured again.
+ *
+ * The only intended caller is Camera::release().
+ *
+ * \context This function is called from the CameraManager thread.
+ */
+void PipelineHandler::releaseZsl(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+
+	std::vector<std::unique_ptr<FrameBuffer>> buffers = data->zslRing_.release();
+	releaseFrameBuffers(&buffers);
+	data->zslMemory_ = 0;
+}
+
 /**
  * \fn PipelineHandler::exportFrameBuffers()
  * \brief Allocate and export buffers for \a stream
@@ -333,6 +638,11 @@ const ControlList &PipelineHandler::properties(const Camera *camera) const
  * it gets started, or after it gets stopped. It shall be called only for
  * streams that are part of the active camera configuration.
  *
+ * Pipeline handlers whose devices can import any dmabuf should allocate the
+ * buffers with allocateFrameBuffers(), which pools memory across camera
+ * reconfigurations, and fall back to exporting buffers from the devices when
+ * no dma-heap is available.
+ *
  * The only intended caller is Camera::exportFrameBuffers().
  *
  * \context This function is called from the CameraManager thread.
@@ -341,6 +651,30 @@ const ControlList &PipelineHandler::properties(const Camera *camera) const
  * otherwise
  */
 
+/**
+ * \brief Release buffers previously allocated with exportFrameBuffers()
+ * \param[inout] buffers The buffers to release
+ *
+ * This method deletes the \a buffers. The memory of the buffers allocated by
+ * allocateFrameBuffers() is kept in a pool for reuse by subsequent
+ * allocations, until the camera is released. Buffers released after the
+ * camera, for instance when the FrameBufferAllocator outlives the acquisition,
+ * are freed immediately, as the pool is only drained when unlocking.
+ *
+ * The only intended caller is Camera::releaseFrameBuffers().
+ *
+ * \context This function is \threadsafe.
+ */
+void PipelineHandler::releaseFrameBuffers(std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	MutexLocker locker(allocatorLock_);
+
+	if (allocator_ && locked_)
+		allocator_->recycle(buffers);
+	else
+		buffers->clear();
+}
+
 /**
  * \fn PipelineHandler::start()
  * \brief Start capturing from a group of streams
@@ -396,6 +730,18 @@ bool PipelineHandler::hasPendingRequests(const Camera *camera) const
  * when the pipeline handler is stopped with stop(). Request completion shall be
  * signalled by the pipeline handler using the completeRequest() method.
  *
+ * If the buffers of the request have acquire fences, the request is held until
+ * all fences have been signalled, and passed to queueRequestDevice() only then.
+ * The fences are monitored from the event loop of the pipeline handler, so that
+ * a fence slow to signal doesn't delay waiting for the fences of the following
+ * requests. Requests are still passed to queueRequestDevice() in queueing
+ * order. If a fence signals an error or fails to signal in time, the request
+ * is cancelled.
+ *
+ * Requests that set the controls::ZslTimestamp control are completed with a
+ * frame stored in the zero shutter lag ring, without being passed to
+ * queueRequestDevice(), when the ring holds a suitable frame.
+ *
  * \context This function is called from the CameraManager thread.
  */
 void PipelineHandler::queueRequest(Request *request)
@@ -407,10 +753,86 @@ void PipelineHandler::queueRequest(Request *request)
 	data->queuedRequests_.push_back(request);
 
 	request->sequence_ = data->requestSequence_++;
+	request->queueTime_ = utils::clock::now();
 
-	int ret = queueRequestDevice(camera, request);
-	if (ret)
-		data->queuedRequests_.remove(request);
+	bool hasFences = std::any_of(request->buffers().begin(),
+				     request->buffers().end(),
+				     [](const auto &pair) {
+					     return pair.second->_d()->fence().isValid();
+				     });
+
+	/* Skip the waiting list when no fence needs to be waited for. */
+	if (!hasFences && data->waitingRequests_.empty()) {
+		doQueueRequest(request);
+		return;
+	}
+
+	CameraData::WaitingRequest &waiting = data->waitingRequests_.emplace_back();
+	waiting.request = request;
+	waiting.timer = nullptr;
+	waiting.pendingFences = 0;
+	waiting.failed = false;
+
+	for (const auto &[stream, buffer] : request->buffers()) {
+		if (!buffer->_d()->fence().isValid())
+			continue;
+
+		EventNotifier *notifier = new EventNotifier(buffer->_d()->fence().fd(),
+							    EventNotifier::Read);
+		notifier->activated.connect(this, &PipelineHandler::fenceSignalled);
+		waiting.notifiers.push_back(notifier);
+		waiting.pendingFences++;
+	}
+
+	if (waiting.pendingFences) {
+		waiting.timer = new Timer();
+		waiting.timer->timeout.connect(this, &PipelineHandler::fenceTimeout);
+		waiting.timer->start(kFenceTimeoutMs);
+	}
+
+	doQueueRequests(data);
+}
+
+/**
+ * \brief Queue a batch of requests
+ * \param[in] requests The requests to queue
+ *
+ * This method queues all the \a requests in order, as if queueRequest() was
+ * called for each of them. It allows Camera::queueRequests() to hand a batch
+ * of requests to the pipeline handler with a single cross-thread invocation.
+ *
+ * \context This function is called from the CameraManager thread.
+ */
+void PipelineHandler::queueRequests(const std::vector<Request *> &requests)
+{
+	for (Request *request : requests)
+		queueRequest(request);
+}
+
+/**
+ * \brief Cancel the requests waiting for their acquire fences
+ * \param[in] camera The camera whose requests to cancel
+ *
+ * Requests waiting for their acquire fences haven't been passed to the pipeline
+ * handler with queueRequestDevice() yet, and are thus not cancelled by stop().
+ * This function cancels them, and shall be called when stopping the camera.
+ * The cancelled requests complete after all the requests queued before them.
+ *
+ * \context This function is called from the CameraManager thread.
+ */
+void PipelineHandler::cancelWaitingRequests(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+
+	while (!data->waitingRequests_.empty()) {
+		CameraData::WaitingRequest &waiting = data->waitingRequests_.front();
+		Request *request = waiting.request;
+
+		releaseWaitingRequest(waiting, false);
+		data->waitingRequests_.pop_front();
+
+		cancelRequest(request);
+	}
 }
 
 /**
@@ -425,11 +847,172 @@ void PipelineHandler::queueRequest(Request *request)
  * parameters will be applied to the frames captured in the buffers provided in
  * the request.
  *
+ * The request may contain buffers for any subset of the streams of the
+ * configuration. The pipeline handler shall keep the streams missing from the
+ * request running, with internal buffers if the hardware requires all its
+ * outputs to be fed, without delaying the request.
+ *
  * \context This function is called from the CameraManager thread.
  *
  * \return 0 on success or a negative error code otherwise
  */
 
+void PipelineHandler::doQueueRequest(Request *request)
+{
+	Camera *camera = request->camera_;
+	CameraData *data = cameraData(camera);
+
+	/* Serve zero shutter lag requests from the ring when possible. */
+	const ControlList &controls = request->controls();
+	if (controls.contains(controls::ZslTimestamp) &&
+	    data->zslRing_.claim(request, controls.get(controls::ZslTimestamp))) {
+		for (const auto &[stream, buffer] : request->buffers())
+			completeBuffer(request, buffer);
+
+		completeRequest(request);
+		return;
+	}
+
+	int ret = queueRequestDevice(camera, request);
+	if (ret)
+		data->queuedRequests_.remove(request);
+}
+
+/*
+ * Queue the requests at the head of the waiting list whose fences have all
+ * signalled, and cancel the ones whose fences failed.
+ */
+void PipelineHandler::doQueueRequests(CameraData *data)
+{
+	while (!data->waitingRequests_.empty()) {
+		CameraData::WaitingRequest &waiting = data->waitingRequests_.front();
+		if (!waiting.failed && waiting.pendingFences)
+			break;
+
+		Request *request = waiting.request;
+		bool failed = waiting.failed;
+
+		/*
+		 * This is called from the signal handlers of the notifiers and
+		 * timer, defer their deletion.
+		 */
+		releaseWaitingRequest(waiting, true);
+		data->waitingRequests_.pop_front();
+
+		if (failed) {
+			cancelRequest(request);
+			continue;
+		}
+
+		/* The fences have signalled, close them. */
+		for (const auto &[stream, buffer] : request->buffers())
+			buffer->_d()->setFence(FileDescriptor());
+
+		doQueueRequest(request);
+	}
+}
+
+/*
+ * Complete a request that hasn't been queued to the device with all its
+ * buffers cancelled. The fences are kept in the buffers to be returned to the
+ * application.
+ */
+void PipelineHandler::cancelRequest(Request *request)
+{
+	for (const auto &[stream, buffer] : request->buffers()) {
+		buffer->cancel();
+		completeBuffer(request, buffer);
+	}
+
+	completeRequest(request);
+}
+
+void PipelineHandler::fenceSignalled(EventNotifier *notifier)
+{
+	notifier->setEnabled(false);
+
+	for (auto &[camera, data] : cameraData_) {
+		auto it = std::find_if(data->waitingRequests_.begin(),
+				       data->waitingRequests_.end(),
+				       [&](const CameraData::WaitingRequest &waiting) {
+					       const auto &notifiers = waiting.notifiers;
+					       return std::find(notifiers.begin(), notifiers.end(),
+								notifier) != notifiers.end();
+				       });
+		if (it == data->waitingRequests_.end())
+			continue;
+
+		CameraData::WaitingRequest &waiting = *it;
+		waiting.pendingFences--;
+
+		/* The notifier only reports readability, check for errors. */
+		struct pollfd fds = { notifier->fd(), POLLIN, 0 };
+		if (poll(&fds, 1, 0) < 0 || fds.revents & (POLLERR | POLLNVAL)) {
+			LOG(Pipeline, Error)
+				<< "Fence " << notifier->fd() << " signalled an error";
+			waiting.failed = true;
+		}
+
+		if (!waiting.pendingFences || waiting.failed)
+			waiting.timer->stop();
+
+		doQueueRequests(data.get());
+		return;
+	}
+}
+
+void PipelineHandler::fenceTimeout(Timer *timer)
+{
+	for (auto &[camera, data] : cameraData_) {
+		auto it = std::find_if(data->waitingRequests_.begin(),
+				       data->waitingRequests_.end(),
+				       [&](const CameraData::WaitingRequest &waiting) {
+					       return waiting.timer == timer;
+				       });
+		if (it == data->waitingRequests_.end())
+			continue;
+
+		for (EventNotifier *notifier : it->notifiers) {
+			if (!notifier->enabled())
+				continue;
+
+			LOG(Pipeline, Error)
+				<< "Timeout waiting for fence " << notifier->fd();
+		}
+
+		it->failed = true;
+
+		doQueueRequests(data.get());
+		return;
+	}
+}
+
+/*
+ * Delete the notifiers and timer of a waiting request. The fences are owned by
+ * the buffers and are not closed here.
+ */
+void PipelineHandler::releaseWaitingRequest(CameraData::WaitingRequest &waiting,
+					    bool deferred)
+{
+	for (EventNotifier *notifier : waiting.notifiers) {
+		notifier->setEnabled(false);
+
+		if (deferred)
+			notifier->deleteLater();
+		else
+			delete notifier;
+	}
+
+	if (waiting.timer) {
+		waiting.timer->stop();
+
+		if (deferred)
+			waiting.timer->deleteLater();
+		else
+			delete waiting.timer;
+	}
+}
+
 /**
  * \brief Complete a buffer for a request
  * \param[in] request The request the buffer belongs to
@@ -442,6 +1025,12 @@ void PipelineHandler::queueRequest(Request *request)
  * pipeline handlers a chance to perform any operation that may still be
  * needed. They shall complete requests explicitly with completeRequest().
  *
+ * The request metadata known when the \a buffer completes is reported to
+ * applications as a partial result along with the buffer. Pipeline handlers
+ * should thus store in the request metadata all the controls that apply to the
+ * \a buffer, such as the sensor timestamp and the exposure time, before
+ * calling this function.
+ *
  * \context This function shall be called from the CameraManager thread.
  *
  * \return True if all buffers contained in the request have completed, false
@@ -451,6 +1040,7 @@ bool PipelineHandler::completeBuffer(Request *request, FrameBuffer *buffer)
 {
 	Camera *camera = request->camera_;
 	camera->bufferCompleted.emit(request, buffer);
+	camera->partialResultAvailable.emit(request, buffer, request->metadata());
 	return request->completeBuffer(buffer);
 }
 
@@ -483,10 +1073,83 @@ void PipelineHandler::completeRequest(Request *request)
 
 		ASSERT(!req->hasPendingBuffers());
 		data->queuedRequests_.pop_front();
+		reportFrameDrop(data, req);
+		reportTimestamps(req);
+		data->zslRing_.store(req);
+		LIBCAMERA_TRACEPOINT(request_complete_signal, req);
 		camera->requestComplete(req);
 	}
 }
 
+/*
+ * Report the reason of the frames dropped before the frame captured by the
+ * request, if any, in the request metadata. The frame sequence numbers of the
+ * completed requests reveal the dropped frames. Frames are dropped for lack
+ * of a request when the last request got completed before the application
+ * queued the next one.
+ */
+void PipelineHandler::reportFrameDrop(CameraData *data, Request *request)
+{
+	if (request->status() == Request::RequestCancelled) {
+		data->sequenceValid_ = false;
+		data->starved_ = false;
+		return;
+	}
+
+	/* Frames served from the zero shutter lag ring have been reported. */
+	if (request->metadata().contains(controls::ZslTimestamp))
+		return;
+
+	if (!request->buffers().empty()) {
+		const FrameMetadata &metadata =
+			request->buffers().begin()->second->metadata();
+
+		if (metadata.status == FrameMetadata::FrameSuccess) {
+			if (data->sequenceValid_ &&
+			    metadata.sequence > data->lastSequence_ + 1) {
+				int32_t reason = data->starved_
+					       ? controls::FrameDropNoRequest
+					       : data->frameDropReason_;
+				request->metadata().set(controls::FrameDropReason, reason);
+				data->frameDropReason_ = controls::FrameDropPipelineLate;
+			}
+
+			data->sequenceValid_ = true;
+			data->lastSequence_ = metadata.sequence;
+		}
+	}
+
+	data->starved_ = data->queuedRequests_.empty();
+}
+
+/*
+ * Report the time when the request completes in its metadata, along with the
+ * time when its frame was dequeued if the pipeline handler hasn't reported it.
+ * The frame is then considered dequeued with the first buffer of the request.
+ */
+void PipelineHandler::reportTimestamps(Request *request)
+{
+	ControlList &metadata = request->metadata();
+
+	if (request->status() == Request::RequestComplete &&
+	    !metadata.contains(controls::FrameDequeueTimestamp)) {
+		uint64_t dequeued = UINT64_MAX;
+
+		for (const auto &[stream, buffer] : request->buffers()) {
+			uint64_t timestamp = buffer->metadata().dequeueTimestamp;
+			if (timestamp)
+				dequeued = std::min(dequeued, timestamp);
+		}
+
+		if (dequeued != UINT64_MAX)
+			metadata.set(controls::FrameDequeueTimestamp,
+				     static_cast<int64_t>(dequeued));
+	}
+
+	metadata.set(controls::RequestCompletedTimestamp,
+		     static_cast<int64_t>(utils::boottime()));
+}
+
 /**
  * \brief Register a camera to the camera manager and pipeline handler
  * \param[in] camera The camera to be added
@@ -497,11 +1160,22 @@ void PipelineHandler::completeRequest(Request *request)
  * with the camera, for later retrieval with cameraData(). Ownership of \a data
  * is transferred to the PipelineHandler.
  *
+ * The controls::ZslTimestamp control is added to the controls of the camera, as
+ * zero shutter lag capture is handled by the PipelineHandler base class.
+ *
  * \context This function shall be called from the CameraManager thread.
  */
 void PipelineHandler::registerCamera(std::shared_ptr<Camera> camera,
 				     std::unique_ptr<CameraData> data)
 {
+	/* Zero shutter lag capture is implemented here for all cameras. */
+	ControlInfoMap::Map controls(data->controlInfo_.begin(),
+				     data->controlInfo_.end());
+	controls.emplace(&controls::ZslTimestamp,
+			 ControlInfo(static_cast<int64_t>(0),
+				     std::numeric_limits<int64_t>::max()));
+	data->controlInfo_ = std::move(controls);
+
 	cameraData_[camera.get()] = std::move(data);
 	cameras_.push_back(camera);
 
@@ -572,6 +1246,8 @@ void PipelineHandler::mediaDeviceDisconnected(MediaDevice *media)
  */
 void PipelineHandler::disconnect()
 {
+	endStandby();
+
 	/*
 	 * Each camera holds a reference to its associated pipeline handler
 	 * instance. Hence, when the last camera is dropped, the pipeline
@@ -623,6 +1299,42 @@ const CameraData *PipelineHandler::cameraData(const Camera *camera) const
 	return cameraData_.at(camera).get();
 }
 
+/**
+ * \brief Allocate frame buffers from a dma-heap
+ * \param[in] count The number of buffers to allocate
+ * \param[in] planeSizes The size of each plane of the buffers, in bytes
+ * \param[out] buffers Vector to store the allocated buffers
+ *
+ * This method allocates buffers from a dma-heap with a DmaBufferAllocator
+ * shared by all cameras of the pipeline handler. Unlike buffers exported by
+ * V4L2 video devices, the memory isn't tied to a device configuration. Buffers
+ * released with releaseFrameBuffers() are pooled and reused by subsequent
+ * allocations of similar sizes, which avoids reallocating memory when a camera
+ * is reconfigured or restarted.
+ *
+ * It is meant to be used by exportFrameBuffers() implementations for streams
+ * whose devices can import any dmabuf. The allocator uses contiguous memory
+ * when a CMA heap is available and falls back to the system heap otherwise.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return The number of allocated buffers on success or a negative error code
+ * otherwise
+ * \retval -ENODEV No dma-heap is available, the pipeline handler shall fall
+ * back to exporting buffers from its devices
+ */
+int PipelineHandler::allocateFrameBuffers(unsigned int count,
+					  const std::vector<unsigned int> &planeSizes,
+					  std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	MutexLocker locker(allocatorLock_);
+
+	if (!allocator_)
+		allocator_ = std::make_unique<DmaBufferAllocator>();
+
+	return allocator_->exportBuffers(count, planeSizes, buffers);
+}
+
 /**
  * \var PipelineHandler::manager_
  * \brief The Camera manager associated with the pipeline handler
@@ -670,14 +1382,28 @@ PipelineHandlerFactory::PipelineHandlerFactory(const char *name)
  * \brief Create an instance of the PipelineHandler corresponding to the factory
  * \param[in] manager The camera manager
  *
+ * The pipeline handler is deleted in the thread it belongs to when the last
+ * reference is released, as pipeline handlers may be moved to a dedicated
+ * thread by the camera manager.
+ *
  * \return A shared pointer to a new instance of the PipelineHandler subclass
  * corresponding to the factory
  */
 std::shared_ptr<PipelineHandler> PipelineHandlerFactory::create(CameraManager *manager)
 {
+	struct Deleter : std::default_delete<PipelineHandler> {
+		void operator()(PipelineHandler *handler)
+		{
+			if (Thread::current() == handler->thread())
+				delete handler;
+			else
+				handler->deleteLater();
+		}
+	};
+
 	PipelineHandler *handler = createInstance(manager);
 	handler->name_ = name_.c_str();
-	return std::shared_ptr<PipelineHandler>(handler);
+	return std::shared_ptr<PipelineHandler>(handler, Deleter());
 }
 
 /**
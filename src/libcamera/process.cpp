@@ -104,6 +104,27 @@ void ProcessManager::registerProcess(Process *proc)
 	processes_.push_back(proc);
 }
 
+/**
+ * \brief Move the SIGCHLD handling to a thread
+ * \param[in] thread The thread that shall handle the SIGCHLD signals
+ *
+ * The death of child processes is signalled through an event notifier, which
+ * is handled by the event dispatcher of the thread it is bound to. By default
+ * this is the thread that has constructed the ProcessManager, which may never
+ * dispatch libcamera events. This function moves the notifier to \a thread, so
+ * that Process::finished is emitted as soon as a child process terminates.
+ *
+ * This function shall be called from the thread the ProcessManager has been
+ * constructed in, before \a thread is started.
+ */
+void ProcessManager::moveToThread(Thread *thread)
+{
+	if (sigEvent_->thread() == thread)
+		return;
+
+	sigEvent_->moveToThread(thread);
+}
+
 ProcessManager *ProcessManager::self_ = nullptr;
 
 /**
@@ -7,7 +7,7 @@
 
 #include <libcamera/request.h>
 
-#include <map>
+#include <algorithm>
 #include <sstream>
 
 #include <libcamera/buffer.h>
@@ -15,6 +15,7 @@
 #include <libcamera/control_ids.h>
 #include <libcamera/stream.h>
 
+#include "libcamera/internal/buffer.h"
 #include "libcamera/internal/camera_controls.h"
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/tracepoints.h"
@@ -49,10 +50,105 @@ LOG_DEFINE_CATEGORY(Request)
  */
 
 /**
- * \typedef Request::BufferMap
+ * \class Request::BufferMap
  * \brief A map of Stream to FrameBuffer pointers
+ *
+ * The BufferMap stores the buffers of a request sorted by stream, in a vector
+ * whose capacity is reserved for all the streams of the camera when the
+ * request is created. Unlike a node-based map, reusing a request and adding
+ * buffers to it thus doesn't allocate memory.
+ *
+ * The map exposes a read-only subset of the std::map interface. Its elements
+ * are pairs of Stream and FrameBuffer pointers.
+ */
+
+/**
+ * \typedef Request::BufferMap::value_type
+ * \brief The type of the map elements
+ */
+
+/**
+ * \typedef Request::BufferMap::const_iterator
+ * \brief Const iterator over the map elements
+ */
+
+/**
+ * \fn Request::BufferMap::begin()
+ * \brief Retrieve an iterator to the first element of the map
+ * \return An iterator to the first element
  */
 
+/**
+ * \fn Request::BufferMap::end()
+ * \brief Retrieve an iterator pointing to the past-the-end element of the map
+ * \return An iterator to the element following the last element
+ */
+
+/**
+ * \fn Request::BufferMap::empty()
+ * \brief Check if the map is empty
+ * \return True if the map contains no element, false otherwise
+ */
+
+/**
+ * \fn Request::BufferMap::size()
+ * \brief Retrieve the number of elements in the map
+ * \return The number of elements in the map
+ */
+
+/**
+ * \brief Find the element for a stream
+ * \param[in] stream The stream
+ * \return An iterator to the element for \a stream, or end() if the map
+ * contains no buffer for \a stream
+ */
+Request::BufferMap::const_iterator Request::BufferMap::find(const Stream *stream) const
+{
+	auto it = std::lower_bound(entries_.begin(), entries_.end(), stream,
+				   [](const value_type &entry, const Stream *s) {
+					   return entry.first < s;
+				   });
+	if (it == entries_.end() || it->first != stream)
+		return entries_.end();
+
+	return it;
+}
+
+/**
+ * \brief Count the elements for a stream
+ * \param[in] stream The stream
+ * \return 1 if the map contains a buffer for \a stream, 0 otherwise
+ */
+std::size_t Request::BufferMap::count(const Stream *stream) const
+{
+	return find(stream) != end() ? 1 : 0;
+}
+
+/**
+ * \brief Retrieve the buffer for a stream
+ * \param[in] stream The stream
+ *
+ * The map shall contain a buffer for \a stream.
+ *
+ * \return The buffer for \a stream
+ */
+FrameBuffer *Request::BufferMap::at(const Stream *stream) const
+{
+	auto it = find(stream);
+	ASSERT(it != end());
+
+	return it->second;
+}
+
+void Request::BufferMap::insert(const Stream *stream, FrameBuffer *buffer)
+{
+	auto it = std::lower_bound(entries_.begin(), entries_.end(), stream,
+				   [](const value_type &entry, const Stream *s) {
+					   return entry.first < s;
+				   });
+	entries_.emplace(it, stream, buffer);
+}
+
 /**
  * \class Request
  * \brief A frame capture request
@@ -88,6 +184,11 @@ Request::Request(Camera *camera, uint64_t cookie)
 	 */
 	metadata_ = new ControlList(controls::controls);
 
+	/* Size the buffer containers to avoid allocations when reusing. */
+	std::size_t streams = camera_ ? camera_->streams().size() : 0;
+	bufferMap_.reserve(streams);
+	pending_.reserve(streams);
+
 	LIBCAMERA_TRACEPOINT(request_construct, this);
 
 	LOG(Request, Debug) << "Created request - cookie: " << cookie_;
@@ -116,12 +217,16 @@ void Request::reuse(ReuseFlag flags)
 {
 	LIBCAMERA_TRACEPOINT(request_reuse, this);
 
+	/* Fences are only valid for a single capture. */
+	for (auto pair : bufferMap_)
+		pair.second->_d()->setFence(FileDescriptor());
+
 	pending_.clear();
 	if (flags & ReuseBuffers) {
 		for (auto pair : bufferMap_) {
 			FrameBuffer *buffer = pair.second;
 			buffer->setRequest(this);
-			pending_.insert(buffer);
+			pending_.push_back(buffer);
 		}
 	} else {
 		bufferMap_.clear();
@@ -165,11 +270,20 @@ void Request::reuse(ReuseFlag flags)
  * \brief Add a FrameBuffer with its associated Stream to the Request
  * \param[in] stream The stream the buffer belongs to
  * \param[in] buffer The FrameBuffer to add to the request
+ * \param[in] fence The acquire fence for the buffer, if any
  *
  * A reference to the buffer is stored in the request. The caller is responsible
  * for ensuring that the buffer will remain valid until the request complete
  * callback is called.
  *
+ * The optional \a fence is a sync file that signals when the buffer is ready
+ * to be written to, typically when a GPU or encoder has finished reading from
+ * it. When a request containing fences is queued, the pipeline handler waits
+ * for all of them to be signalled from its event loop before queueing the
+ * buffers to the device, without blocking the caller. If a fence fails to
+ * signal, the request is cancelled and the fence can be retrieved with
+ * FrameBuffer::releaseFence(). Fences are reset when the request is reused.
+ *
  * A request can only contain one buffer per stream. If a buffer has already
  * been added to the request for the same stream, this method returns -EEXIST.
  *
@@ -177,7 +291,8 @@ void Request::reuse(ReuseFlag flags)
  * \retval -EEXIST The request already contains a buffer for the stream
  * \retval -EINVAL The buffer does not reference a valid Stream
  */
-int Request::addBuffer(const Stream *stream, FrameBuffer *buffer)
+int Request::addBuffer(const Stream *stream, FrameBuffer *buffer,
+			  const FileDescriptor &fence)
 {
 	if (!stream) {
 		LOG(Request, Error) << "Invalid stream reference";
@@ -191,8 +306,9 @@ int Request::addBuffer(const Stream *stream, FrameBuffer *buffer)
 	}
 
 	buffer->setRequest(this);
-	pending_.insert(buffer);
-	bufferMap_[stream] = buffer;
+	buffer->_d()->setFence(fence);
+	pending_.push_back(buffer);
+	bufferMap_.insert(stream, buffer);
 
 	return 0;
 }
@@ -309,8 +425,9 @@ bool Request::completeBuffer(FrameBuffer *buffer)
 {
 	LIBCAMERA_TRACEPOINT(request_complete_buffer, this, buffer);
 
-	int ret = pending_.erase(buffer);
-	ASSERT(ret == 1);
+	auto it = std::find(pending_.begin(), pending_.end(), buffer);
+	ASSERT(it != pending_.end());
+	pending_.erase(it);
 
 	buffer->setRequest(nullptr);
 
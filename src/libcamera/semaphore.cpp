@@ -6,7 +6,11 @@
  */
 
 #include "libcamera/internal/semaphore.h"
-#include "libcamera/internal/thread.h"
+
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 /**
  * \file semaphore.h
@@ -15,6 +19,26 @@
 
 namespace libcamera {
 
+static_assert(sizeof(std::atomic<unsigned int>) == sizeof(int) &&
+	      std::atomic<unsigned int>::is_always_lock_free,
+	      "The futex word must be a lock-free 32-bit integer");
+
+namespace {
+
+void futexWait(std::atomic<unsigned int> *word, unsigned int value)
+{
+	syscall(SYS_futex, reinterpret_cast<int *>(word), FUTEX_WAIT_PRIVATE,
+		value, nullptr, nullptr, 0);
+}
+
+void futexWakeAll(std::atomic<unsigned int> *word)
+{
+	syscall(SYS_futex, reinterpret_cast<int *>(word), FUTEX_WAKE_PRIVATE,
+		INT_MAX, nullptr, nullptr, 0);
+}
+
+} /* namespace */
+
 /**
  * \class Semaphore
  * \brief General-purpose counting semaphore
@@ -25,6 +49,10 @@ namespace libcamera {
  * acquire a number of resources, and blocks if not enough resources are
  * available until they get released. The release() method releases a number of
  * resources, waking up any consumer blocked on an acquire() call.
+ *
+ * The resource count is an atomic variable, and the semaphore sleeps on it
+ * with a futex. Acquiring available resources and releasing resources when no
+ * consumer is blocked thus don't involve any system call.
  */
 
 /**
@@ -32,7 +60,7 @@ namespace libcamera {
  * \param[in] n The resource count
  */
 Semaphore::Semaphore(unsigned int n)
-	: available_(n)
+	: available_(n), waiters_(0)
 {
 }
 
@@ -42,8 +70,7 @@ Semaphore::Semaphore(unsigned int n)
  */
 unsigned int Semaphore::available()
 {
-	MutexLocker locker(mutex_);
-	return available_;
+	return available_.load(std::memory_order_acquire);
 }
 
 /**
@@ -56,9 +83,22 @@ unsigned int Semaphore::available()
  */
 void Semaphore::acquire(unsigned int n)
 {
-	MutexLocker locker(mutex_);
-	cv_.wait(locker, [&] { return available_ >= n; });
-	available_ -= n;
+	while (!tryAcquire(n)) {
+		/*
+		 * Register as a waiter before checking the resource count
+		 * again, to guarantee that a concurrent release() either
+		 * makes the resources visible here or wakes us up. The futex
+		 * wait returns immediately if the count has changed since it
+		 * was read.
+		 */
+		waiters_.fetch_add(1, std::memory_order_seq_cst);
+
+		unsigned int value = available_.load(std::memory_order_seq_cst);
+		if (value < n)
+			futexWait(&available_, value);
+
+		waiters_.fetch_sub(1, std::memory_order_relaxed);
+	}
 }
 
 /**
@@ -74,11 +114,15 @@ void Semaphore::acquire(unsigned int n)
  */
 bool Semaphore::tryAcquire(unsigned int n)
 {
-	MutexLocker locker(mutex_);
-	if (available_ < n)
-		return false;
+	unsigned int value = available_.load(std::memory_order_relaxed);
+
+	do {
+		if (value < n)
+			return false;
+	} while (!available_.compare_exchange_weak(value, value - n,
+						   std::memory_order_acquire,
+						   std::memory_order_relaxed));
 
-	available_ -= n;
 	return true;
 }
 
@@ -92,12 +136,14 @@ bool Semaphore::tryAcquire(unsigned int n)
  */
 void Semaphore::release(unsigned int n)
 {
-	{
-		MutexLocker locker(mutex_);
-		available_ += n;
-	}
+	available_.fetch_add(n, std::memory_order_seq_cst);
 
-	cv_.notify_all();
+	/*
+	 * Consumers may wait for different resource counts, wake them all up
+	 * and let them check if their request can be satisfied.
+	 */
+	if (waiters_.load(std::memory_order_seq_cst))
+		futexWakeAll(&available_);
 }
 
 } /* namespace libcamera */
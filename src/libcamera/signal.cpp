@@ -27,6 +27,13 @@ Mutex signalsLock;
 
 } /* namespace */
 
+/*
+ * The slots list is copied on write. Connecting and disconnecting slots, which
+ * are rare operations, create a new list, while emitting a signal only takes a
+ * reference to the current list. This keeps emission free of memory
+ * allocation, and lets slots connect or disconnect the signal they are called
+ * from without invalidating the list being iterated.
+ */
 void SignalBase::connect(BoundMethodBase *slot)
 {
 	MutexLocker locker(signalsLock);
@@ -34,35 +41,66 @@ void SignalBase::connect(BoundMethodBase *slot)
 	Object *object = slot->object();
 	if (object)
 		object->connect(this);
-	slots_.push_back(slot);
+
+	std::shared_ptr<SlotList> slots = std::make_shared<SlotList>();
+	if (slots_) {
+		slots->reserve(slots_->size() + 1);
+		*slots = *slots_;
+	}
+
+	slots->push_back(slot);
+	slots_ = std::move(slots);
 }
 
 void SignalBase::disconnect(Object *object)
 {
-	disconnect([object](SlotList::iterator &iter) {
-		return (*iter)->match(object);
+	disconnect([object](BoundMethodBase *slot) {
+		return slot->match(object);
 	});
 }
 
-void SignalBase::disconnect(std::function<bool(SlotList::iterator &)> match)
+void SignalBase::disconnect(std::function<bool(BoundMethodBase *)> match)
 {
 	MutexLocker locker(signalsLock);
 
-	for (auto iter = slots_.begin(); iter != slots_.end(); ) {
-		if (match(iter)) {
-			Object *object = (*iter)->object();
-			if (object)
-				object->disconnect(this);
+	if (!slots_)
+		return;
+
+	std::shared_ptr<SlotList> slots;
+
+	for (auto iter = slots_->begin(); iter != slots_->end(); ++iter) {
+		BoundMethodBase *slot = *iter;
 
-			delete *iter;
-			iter = slots_.erase(iter);
-		} else {
-			++iter;
+		if (!match(slot)) {
+			if (slots)
+				slots->push_back(slot);
+			continue;
 		}
+
+		/* Copy the slots preceding the first match. */
+		if (!slots) {
+			slots = std::make_shared<SlotList>();
+			slots->reserve(slots_->size() - 1);
+			slots->insert(slots->end(), slots_->begin(), iter);
+		}
+
+		Object *object = slot->object();
+		if (object)
+			object->disconnect(this);
+
+		delete slot;
 	}
+
+	if (!slots)
+		return;
+
+	if (slots->empty())
+		slots_.reset();
+	else
+		slots_ = std::move(slots);
 }
 
-SignalBase::SlotList SignalBase::slots()
+std::shared_ptr<const SignalBase::SlotList> SignalBase::slots()
 {
 	MutexLocker locker(signalsLock);
 	return slots_;
@@ -11,6 +11,7 @@
 #include <array>
 #include <iomanip>
 #include <limits.h>
+#include <mutex>
 #include <sstream>
 
 #include <libcamera/request.h>
@@ -82,10 +83,29 @@ LOG_DEFINE_CATEGORY(Stream)
  * size shall be considered to be supported until it has been verified using
  * CameraConfiguration::validate().
  *
+ * Enumerating the formats supported by a device can be costly, while most
+ * applications never inspect them. Pipeline handlers can thus construct a
+ * StreamFormats with a generator function, called the first time the formats
+ * are accessed only. Copies of a StreamFormats share the formats, which are
+ * generated once for all of them. Pipeline handlers can then cache the
+ * StreamFormats of their cameras, and hand copies of them to the stream
+ * configurations they generate at no cost.
+ *
  * \todo Review the usage patterns of this class, and cache the computed
  * pixelformats(), sizes() and range() if this would improve performances.
  */
 
+struct StreamFormats::Data {
+	std::once_flag once;
+	std::function<FormatsMap()> generator;
+	FormatsMap formats;
+};
+
+/**
+ * \typedef StreamFormats::FormatsMap
+ * \brief A map of pixel formats to a sizes description
+ */
+
 StreamFormats::StreamFormats()
 {
 }
@@ -94,9 +114,43 @@ StreamFormats::StreamFormats()
  * \brief Construct a StreamFormats object with a map of image formats
  * \param[in] formats A map of pixel formats to a sizes description
  */
-StreamFormats::StreamFormats(const std::map<PixelFormat, std::vector<SizeRange>> &formats)
-	: formats_(formats)
+StreamFormats::StreamFormats(const FormatsMap &formats)
+	: data_(std::make_shared<Data>())
+{
+	data_->formats = formats;
+}
+
+/**
+ * \brief Construct a StreamFormats object populated on demand
+ * \param[in] generator A function returning the map of image formats
+ *
+ * The \a generator is called once, the first time the formats are accessed
+ * through this StreamFormats or any of its copies, possibly from a different
+ * thread. It shall thus remain valid as long as the StreamFormats exists, and
+ * shall only capture data that outlives it.
+ */
+StreamFormats::StreamFormats(std::function<FormatsMap()> generator)
+	: data_(std::make_shared<Data>())
+{
+	data_->generator = std::move(generator);
+}
+
+const StreamFormats::FormatsMap &StreamFormats::formats() const
 {
+	static const FormatsMap empty;
+
+	if (!data_)
+		return empty;
+
+	std::call_once(data_->once, [this]() {
+		if (!data_->generator)
+			return;
+
+		data_->formats = data_->generator();
+		data_->generator = nullptr;
+	});
+
+	return data_->formats;
 }
 
 /**
@@ -107,7 +161,7 @@ std::vector<PixelFormat> StreamFormats::pixelformats() const
 {
 	std::vector<PixelFormat> formats;
 
-	for (auto const &it : formats_)
+	for (auto const &it : this->formats())
 		formats.push_back(it.first);
 
 	return formats;
@@ -193,8 +247,9 @@ std::vector<Size> StreamFormats::sizes(const PixelFormat &pixelformat) const
 	std::vector<Size> sizes;
 
 	/* Make sure pixel format exists. */
-	auto const &it = formats_.find(pixelformat);
-	if (it == formats_.end())
+	const FormatsMap &formats = this->formats();
+	auto const &it = formats.find(pixelformat);
+	if (it == formats.end())
 		return {};
 
 	/* Try creating a list of discrete sizes. */
@@ -242,8 +297,9 @@ std::vector<Size> StreamFormats::sizes(const PixelFormat &pixelformat) const
  */
 SizeRange StreamFormats::range(const PixelFormat &pixelformat) const
 {
-	auto const it = formats_.find(pixelformat);
-	if (it == formats_.end())
+	const FormatsMap &formats = this->formats();
+	auto const it = formats.find(pixelformat);
+	if (it == formats.end())
 		return {};
 
 	const std::vector<SizeRange> &ranges = it->second;
@@ -279,7 +335,7 @@ SizeRange StreamFormats::range(const PixelFormat &pixelformat) const
  * handlers provide StreamFormats.
  */
 StreamConfiguration::StreamConfiguration()
-	: pixelFormat(0), stride(0), frameSize(0), bufferCount(0),
+	: pixelFormat(0), stride(0), strideAlign(0), frameSize(0), bufferCount(0),
 	  stream_(nullptr)
 {
 }
@@ -288,7 +344,7 @@ StreamConfiguration::StreamConfiguration()
  * \brief Construct a configuration with stream formats
  */
 StreamConfiguration::StreamConfiguration(const StreamFormats &formats)
-	: pixelFormat(0), stride(0), frameSize(0), bufferCount(0),
+	: pixelFormat(0), stride(0), strideAlign(0), frameSize(0), bufferCount(0),
 	  stream_(nullptr), formats_(formats)
 {
 }
@@ -303,6 +359,26 @@ StreamConfiguration::StreamConfiguration(const StreamFormats &formats)
  * \brief Stream pixel format
  */
 
+/**
+ * \var StreamConfiguration::crop
+ * \brief Region of the field of view captured in the stream
+ *
+ * The crop rectangle selects the region of the image produced by the camera
+ * sensor that is scaled to the stream size. It is expressed in the coordinate
+ * system of the sensor output image, and defaults to a null rectangle that
+ * captures the full field of view.
+ *
+ * Unlike the controls::ScalerCrop control, which applies to all streams, the
+ * crop rectangle is set for each stream independently. This allows, for
+ * instance, capturing a low-resolution stream of the full field of view for
+ * analytics along with a high-resolution stream of a region of interest.
+ *
+ * Only pipeline handlers that can crop streams independently support this
+ * field. The CameraConfiguration::validate() function bounds the rectangle to
+ * the sensor output, or resets it to a null rectangle if per-stream cropping
+ * isn't supported, and adjusts the configuration accordingly.
+ */
+
 /**
  * \var StreamConfiguration::stride
  * \brief Image stride for the stream, in bytes
@@ -313,6 +389,21 @@ StreamConfiguration::StreamConfiguration(const StreamFormats &formats)
  * CameraConfiguration::validate().
  */
 
+/**
+ * \var StreamConfiguration::strideAlign
+ * \brief Requested alignment of the image stride, in bytes
+ *
+ * Consumers of the frame buffers, such as GPUs or hardware video encoders,
+ * often require the stride to be aligned to a multiple of 64 or 256 bytes.
+ * Applications set the strideAlign value to request the pipeline handler to
+ * align the stride of all image planes accordingly, avoiding the need to
+ * copy the frames. A value of 0 (the default) doesn't constrain the stride.
+ *
+ * The alignment shall be a power of two. When the pipeline handler can't
+ * honour the requested alignment, the CameraConfiguration::validate()
+ * function resets the strideAlign value to 0 and adjusts the configuration.
+ */
+
 /**
  * \var StreamConfiguration::frameSize
  * \brief Frame size for the stream, in bytes
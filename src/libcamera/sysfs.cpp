@@ -8,12 +8,14 @@
 #include "libcamera/internal/sysfs.h"
 
 #include <fstream>
+#include <map>
 #include <sstream>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 
 #include "libcamera/internal/file.h"
 #include "libcamera/internal/log.h"
+#include "libcamera/internal/thread.h"
 
 /**
  * \file sysfs.h
@@ -26,6 +28,49 @@ LOG_DEFINE_CATEGORY(SysFs)
 
 namespace sysfs {
 
+namespace {
+
+std::string lookupFirmwareNodePath(const std::string &device)
+{
+	std::string fwPath, node;
+	struct stat st;
+
+	/* Lookup for DT-based systems */
+	node = device + "/of_node";
+	if (!stat(node.c_str(), &st)) {
+		char *ofPath = realpath(node.c_str(), nullptr);
+		if (!ofPath)
+			return {};
+
+		static const char prefix[] = "/sys/firmware/devicetree";
+		if (strncmp(ofPath, prefix, strlen(prefix)) == 0)
+			fwPath = ofPath + strlen(prefix);
+		else
+			fwPath = ofPath;
+
+		free(ofPath);
+
+		return fwPath;
+	}
+
+	/* Lookup for ACPI-based systems */
+	node = device + "/firmware_node/path";
+	if (File::exists(node)) {
+		std::ifstream file(node);
+		if (!file.is_open())
+			return {};
+
+		std::getline(file, fwPath);
+		file.close();
+
+		return fwPath;
+	}
+
+	return {};
+}
+
+} /* namespace */
+
 /**
  * \brief Retrieve the sysfs path for a character device
  * \param[in] deviceNode Path to character device node
@@ -65,45 +110,27 @@ std::string charDevPath(const std::string &deviceNode)
  * the path is guaranteed to be unique and persistent as long as the system
  * firmware is not modified.
  *
+ * As the firmware node of a device doesn't change, lookups are cached, which
+ * speeds up pipeline handlers that walk the device hierarchy of multiple
+ * cameras up to their controller.
+ *
  * \return The firmware node path on success or an empty string on failure
  */
 std::string firmwareNodePath(const std::string &device)
 {
-	std::string fwPath, node;
-	struct stat st;
-
-	/* Lookup for DT-based systems */
-	node = device + "/of_node";
-	if (!stat(node.c_str(), &st)) {
-		char *ofPath = realpath(node.c_str(), nullptr);
-		if (!ofPath)
-			return {};
-
-		static const char prefix[] = "/sys/firmware/devicetree";
-		if (strncmp(ofPath, prefix, strlen(prefix)) == 0)
-			fwPath = ofPath + strlen(prefix);
-		else
-			fwPath = ofPath;
+	static Mutex mutex;
+	static std::map<std::string, std::string> cache;
 
-		free(ofPath);
-
-		return fwPath;
-	}
-
-	/* Lookup for ACPI-based systems */
-	node = device + "/firmware_node/path";
-	if (File::exists(node)) {
-		std::ifstream file(node);
-		if (!file.is_open())
-			return {};
+	MutexLocker locker(mutex);
 
-		std::getline(file, fwPath);
-		file.close();
+	auto it = cache.find(device);
+	if (it != cache.end())
+		return it->second;
 
-		return fwPath;
-	}
+	std::string fwPath = lookupFirmwareNodePath(device);
+	cache[device] = fwPath;
 
-	return {};
+	return fwPath;
 }
 
 } /* namespace sysfs */
@@ -7,17 +7,27 @@
 
 #include "libcamera/internal/thread.h"
 
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <errno.h>
 #include <list>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "libcamera/internal/event_dispatcher.h"
+#include "libcamera/internal/event_dispatcher_epoll.h"
 #include "libcamera/internal/event_dispatcher_poll.h"
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/message.h"
+#include "libcamera/internal/tracepoints.h"
+#include "libcamera/internal/utils.h"
 
 /**
  * \page thread Thread Support
@@ -114,18 +124,95 @@ class ThreadMain;
 
 /**
  * \brief A queue of posted messages
+ *
+ * Messages are posted to the queue without locking, by pushing them to a
+ * lock-free list of posted messages with push(). The posted messages are
+ * then moved to the \ref list_ by collect(), with the \ref mutex_ held, before
+ * being dispatched, removed or moved to a different queue.
+ *
+ * Objects scheduled for deletion with Object::deleteLater() are stored in the
+ * separate \ref deleteList_, without allocating a message for each of them.
  */
 class MessageQueue
 {
 public:
+	MessageQueue()
+		: posted_(nullptr)
+	{
+	}
+
+	~MessageQueue()
+	{
+		Message *msg = posted_.exchange(nullptr, std::memory_order_acquire);
+		while (msg) {
+			Message *next = msg->next_;
+			delete msg;
+			msg = next;
+		}
+	}
+
+	/**
+	 * \brief Post a message to the queue
+	 * \param[in] msg The message
+	 *
+	 * This function is lock-free and may be called from any thread.
+	 *
+	 * \return True if no other message was waiting to be collected, false
+	 * otherwise
+	 */
+	bool push(std::unique_ptr<Message> msg)
+	{
+		Message *message = msg.release();
+		Message *head = posted_.load(std::memory_order_relaxed);
+
+		do {
+			message->next_ = head;
+		} while (!posted_.compare_exchange_weak(head, message,
+							std::memory_order_release,
+							std::memory_order_relaxed));
+
+		return !head;
+	}
+
+	/**
+	 * \brief Move all posted messages to the \ref list_
+	 *
+	 * The \ref mutex_ shall be held by the caller.
+	 */
+	void collect()
+	{
+		Message *msg = posted_.exchange(nullptr, std::memory_order_acquire);
+		if (!msg)
+			return;
+
+		/*
+		 * The posted messages are stored in reverse order, insert them
+		 * in front of each other to restore the posting order.
+		 */
+		auto pos = list_.end();
+		while (msg) {
+			Message *next = msg->next_;
+			msg->next_ = nullptr;
+			pos = list_.emplace(pos, msg);
+			msg = next;
+		}
+	}
+
 	/**
 	 * \brief List of queued Message instances
 	 */
 	std::list<std::unique_ptr<Message>> list_;
 	/**
-	 * \brief Protects the \ref list_
+	 * \brief List of objects scheduled for deferred deletion
+	 */
+	std::deque<Object *> deleteList_;
+	/**
+	 * \brief Protects the \ref list_ and \ref deleteList_
 	 */
 	Mutex mutex_;
+
+private:
+	std::atomic<Message *> posted_;
 };
 
 /**
@@ -148,6 +235,7 @@ private:
 	Thread *thread_;
 	bool running_;
 	pid_t tid_;
+	std::string name_;
 
 	Mutex mutex_;
 
@@ -200,6 +288,129 @@ ThreadData *ThreadData::current()
 	return data;
 }
 
+namespace {
+
+/*
+ * Scheduling policy for the threads whose name matches a pattern, as
+ * configured through the LIBCAMERA_THREADS environment variable.
+ */
+struct ThreadPolicy {
+	std::string pattern;
+	std::vector<unsigned int> cpus;
+	int priority;
+
+	bool matches(const std::string &name) const
+	{
+		if (!pattern.empty() && pattern.back() == '*')
+			return !name.compare(0, pattern.size() - 1, pattern, 0,
+					     pattern.size() - 1);
+
+		return name == pattern;
+	}
+};
+
+std::vector<ThreadPolicy> parseThreadPolicies()
+{
+	std::vector<ThreadPolicy> policies;
+
+	const char *threads = utils::secure_getenv("LIBCAMERA_THREADS");
+	if (!threads)
+		return policies;
+
+	for (const std::string &entry : utils::split(threads, ";")) {
+		if (entry.empty())
+			continue;
+
+		std::vector<std::string> fields;
+		for (const std::string &field : utils::split(entry, ":"))
+			fields.push_back(field);
+
+		if (fields.size() < 2 || fields.size() > 3 || fields[0].empty()) {
+			LOG(Thread, Warning)
+				<< "Ignoring invalid thread policy '" << entry << "'";
+			continue;
+		}
+
+		ThreadPolicy policy{ fields[0], {}, 0 };
+
+		for (const std::string &cpu : utils::split(fields[1], ",")) {
+			if (!cpu.empty())
+				policy.cpus.push_back(strtoul(cpu.c_str(), nullptr, 10));
+		}
+
+		if (fields.size() == 3)
+			policy.priority = std::clamp(atoi(fields[2].c_str()), 0, 99);
+
+		policies.push_back(std::move(policy));
+	}
+
+	return policies;
+}
+
+const ThreadPolicy *findThreadPolicy(const std::string &name)
+{
+	static const std::vector<ThreadPolicy> policies = parseThreadPolicies();
+
+	for (const ThreadPolicy &policy : policies) {
+		if (policy.matches(name))
+			return &policy;
+	}
+
+	return nullptr;
+}
+
+int setThreadName(pthread_t thread, const std::string &name)
+{
+	/* Thread names are limited to 16 bytes including the terminator. */
+	int ret = pthread_setname_np(thread, name.substr(0, 15).c_str());
+	if (ret) {
+		LOG(Thread, Error)
+			<< "Failed to set thread name: " << strerror(ret);
+		return -ret;
+	}
+
+	return 0;
+}
+
+int setThreadAffinity(pthread_t thread, const std::vector<unsigned int> &cpus)
+{
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+
+	for (unsigned int cpu : cpus) {
+		if (cpu >= CPU_SETSIZE)
+			return -EINVAL;
+		CPU_SET(cpu, &cpuset);
+	}
+
+	int ret = pthread_setaffinity_np(thread, sizeof(cpuset), &cpuset);
+	if (ret) {
+		LOG(Thread, Error)
+			<< "Failed to set thread affinity: " << strerror(ret);
+		return -ret;
+	}
+
+	return 0;
+}
+
+int setThreadRealtimePriority(pthread_t thread, int priority)
+{
+	struct sched_param param = {};
+	param.sched_priority = priority;
+
+	int ret = pthread_setschedparam(thread, SCHED_FIFO, &param);
+	if (ret) {
+		LOG(Thread, Error)
+			<< "Failed to set real-time priority " << priority
+			<< ": " << strerror(ret);
+		return -ret;
+	}
+
+	return 0;
+}
+
+} /* namespace */
+
 /**
  * \typedef Mutex
  * \brief An alias for std::mutex
@@ -222,6 +433,27 @@ ThreadData *ThreadData::current()
  * sent to the objects living in the thread. This behaviour can be modified by
  * overriding the run() function.
  *
+ * \section thread-scheduling Thread Scheduling
+ *
+ * Threads inherit the CPU affinity and scheduling policy of the thread that
+ * starts them. Deployments that need to isolate the camera threads from the
+ * rest of the system can configure them per thread name with the
+ * LIBCAMERA_THREADS environment variable. The variable contains a
+ * semicolon-separated list of entries formatted as
+ * "name:cpus[:priority]", where cpus is a comma-separated list of CPU indices
+ * (possibly empty) and priority a SCHED_FIFO real-time priority between 1 and
+ * 99. A name ending with a '*' matches all threads whose name starts with the
+ * preceding characters. For instance,
+ *
+ * \code
+ * LIBCAMERA_THREADS="CameraManager:2;IPAProxy*:3:10"
+ * \endcode
+ *
+ * runs the camera manager thread on CPU 2, and the IPA proxy threads on CPU 3
+ * with a real-time priority of 10. The first matching entry is applied when a
+ * named thread is started, see setName(). Explicit calls to setAffinity() or
+ * setRealtimePriority() override the configured policy.
+ *
  * \section thread-stop Stopping Threads
  *
  * Threads can't be forcibly stopped. Instead, a thread user first requests the
@@ -294,6 +526,34 @@ void Thread::start()
 	data_->exit_.store(false, std::memory_order_relaxed);
 
 	thread_ = std::thread(&Thread::startThread, this);
+
+	applyPolicy();
+}
+
+/*
+ * Apply the name and the scheduling policy configured for the thread. This is
+ * called with the thread data mutex held, right after the thread is created.
+ */
+void Thread::applyPolicy()
+{
+	if (data_->name_.empty())
+		return;
+
+	setThreadName(thread_.native_handle(), data_->name_);
+
+	const ThreadPolicy *policy = findThreadPolicy(data_->name_);
+	if (!policy)
+		return;
+
+	LOG(Thread, Debug)
+		<< "Applying policy '" << policy->pattern << "' to thread "
+		<< data_->name_;
+
+	if (!policy->cpus.empty())
+		setThreadAffinity(thread_.native_handle(), policy->cpus);
+
+	if (policy->priority)
+		setThreadRealtimePriority(thread_.native_handle(), policy->priority);
 }
 
 void Thread::startThread()
@@ -318,6 +578,14 @@ void Thread::startThread()
 	 */
 	thread_local ThreadCleaner cleaner(this, &Thread::finishThread);
 
+	/*
+	 * Wait for start() to apply the thread name and scheduling policy
+	 * before running, as they are set with the thread data mutex held.
+	 */
+	{
+		MutexLocker locker(data_->mutex_);
+	}
+
 	data_->tid_ = syscall(SYS_gettid);
 	currentThreadData = data_;
 
@@ -457,6 +725,81 @@ bool Thread::isRunning()
 	return data_->running_;
 }
 
+/**
+ * \brief Set the thread name
+ * \param[in] name The thread name
+ *
+ * The name identifies the thread in system tools (it is truncated to 15
+ * characters when passed to the system), and selects the scheduling policy
+ * applied when the thread starts, as configured by the LIBCAMERA_THREADS
+ * environment variable (see \ref thread-scheduling). The name should thus be
+ * set before starting the thread. Setting it on a running thread only renames
+ * the thread.
+ *
+ * \context This function is \threadsafe.
+ */
+void Thread::setName(const std::string &name)
+{
+	MutexLocker locker(data_->mutex_);
+
+	data_->name_ = name;
+
+	if (data_->running_ && thread_.joinable())
+		setThreadName(thread_.native_handle(), name);
+}
+
+/**
+ * \brief Retrieve the thread name
+ * \return The thread name, or an empty string if no name has been set
+ */
+const std::string &Thread::name() const
+{
+	return data_->name_;
+}
+
+/**
+ * \brief Restrict the thread to run on a set of CPUs
+ * \param[in] cpus The indices of the CPUs the thread is allowed to run on
+ *
+ * This function shall be called after the thread has been started. The
+ * affinity is lost when the thread is stopped.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int Thread::setAffinity(const std::vector<unsigned int> &cpus)
+{
+	MutexLocker locker(data_->mutex_);
+
+	if (!data_->running_ || !thread_.joinable())
+		return -EINVAL;
+
+	return setThreadAffinity(thread_.native_handle(), cpus);
+}
+
+/**
+ * \brief Run the thread with the SCHED_FIFO real-time scheduling policy
+ * \param[in] priority The real-time priority, between 1 and 99
+ *
+ * Real-time scheduling requires the CAP_SYS_NICE capability or a suitable
+ * RLIMIT_RTPRIO resource limit. This function shall be called after the thread
+ * has been started.
+ *
+ * \context This function is \threadsafe.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int Thread::setRealtimePriority(int priority)
+{
+	MutexLocker locker(data_->mutex_);
+
+	if (!data_->running_ || !thread_.joinable())
+		return -EINVAL;
+
+	return setThreadRealtimePriority(thread_.native_handle(), priority);
+}
+
 /**
  * \var Thread::finished
  * \brief Signal the end of thread execution
@@ -495,15 +838,32 @@ pid_t Thread::currentId()
  * This function retrieves the internal event dispatcher for the thread. The
  * returned event dispatcher is valid until the thread is destroyed.
  *
+ * The event dispatcher is created the first time this function is called. An
+ * EventDispatcherEpoll is used by default, the EventDispatcherPoll can be
+ * selected instead by setting the LIBCAMERA_EVENT_DISPATCHER environment
+ * variable to "poll".
+ *
  * \context This function is \threadsafe.
  *
  * \return Pointer to the event dispatcher
  */
 EventDispatcher *Thread::eventDispatcher()
 {
-	if (!data_->dispatcher_.load(std::memory_order_relaxed))
-		data_->dispatcher_.store(new EventDispatcherPoll(),
-					 std::memory_order_release);
+	static const bool usePoll = [] {
+		const char *type = utils::secure_getenv("LIBCAMERA_EVENT_DISPATCHER");
+		return type && !strcmp(type, "poll");
+	}();
+
+	if (!data_->dispatcher_.load(std::memory_order_relaxed)) {
+		EventDispatcher *dispatcher;
+
+		if (usePoll)
+			dispatcher = new EventDispatcherPoll();
+		else
+			dispatcher = new EventDispatcherEpoll();
+
+		data_->dispatcher_.store(dispatcher, std::memory_order_release);
+	}
 
 	return data_->dispatcher_.load(std::memory_order_relaxed);
 }
@@ -534,11 +894,53 @@ void Thread::postMessage(std::unique_ptr<Message> msg, Object *receiver)
 
 	ASSERT(data_ == receiver->thread()->data_);
 
+	receiver->pendingMessages_.fetch_add(1, std::memory_order_relaxed);
+
+	LIBCAMERA_TRACEPOINT(message_post, msg.get());
+
+	/*
+	 * Only wake up the event loop for the first message of a batch. If
+	 * messages are already waiting to be collected, the thread has been
+	 * interrupted already and will dispatch this message along with them.
+	 */
+	if (!data_->messages_.push(std::move(msg)))
+		return;
+
+	EventDispatcher *dispatcher =
+		data_->dispatcher_.load(std::memory_order_acquire);
+	if (dispatcher)
+		dispatcher->interrupt();
+}
+
+/**
+ * \brief Schedule deletion of an \a object
+ * \param[in] object The object
+ *
+ * The object is added to the thread's list of objects to delete, which is
+ * drained by dispatchMessages() along with the Message::DeferredDelete
+ * messages. The deferred deletion is accounted as a pending message of the
+ * \a object, to be cancelled by removeMessages() if the object is deleted
+ * directly. As for posted messages, the event loop is only woken up for the
+ * first object of a batch.
+ *
+ * If the \a object is not bound to this thread the behaviour is undefined.
+ */
+void Thread::postDeferredDelete(Object *object)
+{
+	ASSERT(data_ == object->thread()->data_);
+
 	MutexLocker locker(data_->messages_.mutex_);
-	data_->messages_.list_.push_back(std::move(msg));
-	receiver->pendingMessages_++;
+
+	object->pendingMessages_.fetch_add(1, std::memory_order_relaxed);
+
+	bool first = data_->messages_.deleteList_.empty();
+	data_->messages_.deleteList_.push_back(object);
+
 	locker.unlock();
 
+	if (!first)
+		return;
+
 	EventDispatcher *dispatcher =
 		data_->dispatcher_.load(std::memory_order_acquire);
 	if (dispatcher)
@@ -559,6 +961,8 @@ void Thread::removeMessages(Object *receiver)
 	if (!receiver->pendingMessages_)
 		return;
 
+	data_->messages_.collect();
+
 	std::vector<std::unique_ptr<Message>> toDelete;
 	for (std::unique_ptr<Message> &msg : data_->messages_.list_) {
 		if (!msg)
@@ -576,6 +980,17 @@ void Thread::removeMessages(Object *receiver)
 		receiver->pendingMessages_--;
 	}
 
+	std::deque<Object *> &deleteList = data_->messages_.deleteList_;
+	for (auto it = deleteList.begin(); it != deleteList.end(); ) {
+		if (*it != receiver) {
+			++it;
+			continue;
+		}
+
+		it = deleteList.erase(it);
+		receiver->pendingMessages_--;
+	}
+
 	ASSERT(!receiver->pendingMessages_);
 	locker.unlock();
 
@@ -600,6 +1015,8 @@ void Thread::dispatchMessages(Message::Type type)
 
 	MutexLocker locker(data_->messages_.mutex_);
 
+	data_->messages_.collect();
+
 	std::list<std::unique_ptr<Message>> &messages = data_->messages_.list_;
 
 	for (auto iter = messages.begin(); iter != messages.end(); ) {
@@ -623,9 +1040,34 @@ void Thread::dispatchMessages(Message::Type type)
 		receiver->pendingMessages_--;
 
 		locker.unlock();
+		LIBCAMERA_TRACEPOINT(message_dispatch_begin, message.get());
 		receiver->message(message.get());
+		LIBCAMERA_TRACEPOINT(message_dispatch_end, message.get());
 		message.reset();
 		locker.lock();
+
+		/* Pick up the messages posted during delivery. */
+		data_->messages_.collect();
+	}
+
+	if (type != Message::Type::None && type != Message::Type::DeferredDelete)
+		return;
+
+	/*
+	 * Delete the objects one at a time, as the destructor of an object may
+	 * delete other objects from the list, removing them from the list.
+	 */
+	std::deque<Object *> &deleteList = data_->messages_.deleteList_;
+	while (!deleteList.empty()) {
+		Object *object = deleteList.front();
+		deleteList.pop_front();
+
+		ASSERT(data_ == object->thread()->data_);
+		object->pendingMessages_--;
+
+		locker.unlock();
+		delete object;
+		locker.lock();
 	}
 }
 
@@ -652,6 +1094,9 @@ void Thread::moveObject(Object *object, ThreadData *currentData,
 	if (object->pendingMessages_) {
 		unsigned int movedMessages = 0;
 
+		currentData->messages_.collect();
+		targetData->messages_.collect();
+
 		for (std::unique_ptr<Message> &msg : currentData->messages_.list_) {
 			if (!msg)
 				continue;
@@ -662,6 +1107,14 @@ void Thread::moveObject(Object *object, ThreadData *currentData,
 			movedMessages++;
 		}
 
+		std::deque<Object *> &deleteList = currentData->messages_.deleteList_;
+		auto it = std::find(deleteList.begin(), deleteList.end(), object);
+		if (it != deleteList.end()) {
+			deleteList.erase(it);
+			targetData->messages_.deleteList_.push_back(object);
+			movedMessages++;
+		}
+
 		if (movedMessages) {
 			EventDispatcher *dispatcher =
 				targetData->dispatcher_.load(std::memory_order_acquire);
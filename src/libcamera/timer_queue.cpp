@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * timer_queue.cpp - Deadline-ordered queue of timers
+ */
+
+#include "libcamera/internal/timer_queue.h"
+
+#include <algorithm>
+#include <functional>
+
+#include "libcamera/internal/timer.h"
+
+/**
+ * \file timer_queue.h
+ * \brief Deadline-ordered queue of timers
+ */
+
+namespace libcamera {
+
+/**
+ * \class TimerQueue
+ * \brief Deadline-ordered queue of running timers for event dispatchers
+ *
+ * The TimerQueue class stores the timers registered with an event dispatcher,
+ * ordered by their deadline. It is implemented as a binary min-heap, offering
+ * O(log n) insertion and retrieval of the timer with the earliest deadline.
+ *
+ * Removal of a timer is O(1): the timer is marked as removed, and its heap
+ * entry is discarded lazily when it reaches the top of the heap. To bound the
+ * memory usage when timers are frequently started and stopped before they
+ * expire, the queue is compacted when removed entries outnumber the running
+ * timers.
+ *
+ * The TimerQueue never dereferences pointers to removed timers, timers can thus
+ * be destroyed as soon as they have been removed from the queue.
+ */
+
+TimerQueue::TimerQueue()
+	: sequence_(0), size_(0)
+{
+}
+
+/**
+ * \brief Insert a \a timer in the queue
+ * \param[in] timer The timer
+ *
+ * The \a timer is inserted according to its current deadline. If the timer is
+ * already present in the queue, it is moved to the position corresponding to
+ * its current deadline.
+ */
+void TimerQueue::insert(Timer *timer)
+{
+	uint64_t &sequence = sequences_[timer];
+	if (!sequence)
+		size_++;
+
+	sequence = ++sequence_;
+
+	heap_.push_back({ timer->deadline(), sequence, timer });
+	std::push_heap(heap_.begin(), heap_.end(), std::greater<Entry>());
+
+	if (heap_.size() > 2 * size_ + 16 ||
+	    sequences_.size() > 2 * size_ + 16)
+		compact();
+}
+
+/**
+ * \brief Remove a \a timer from the queue
+ * \param[in] timer The timer
+ *
+ * If the \a timer isn't present in the queue, this function performs no
+ * operation.
+ */
+void TimerQueue::remove(Timer *timer)
+{
+	auto iter = sequences_.find(timer);
+	if (iter == sequences_.end() || !iter->second)
+		return;
+
+	/*
+	 * Keep the entry in the sequences map to avoid reallocating it when
+	 * the timer is restarted. It will be dropped by compact().
+	 */
+	iter->second = 0;
+	size_--;
+}
+
+/**
+ * \brief Retrieve the timer with the earliest deadline
+ * \return The timer with the earliest deadline, or nullptr if the queue is
+ * empty
+ */
+Timer *TimerQueue::next()
+{
+	while (!heap_.empty() && !isLive(heap_.front())) {
+		std::pop_heap(heap_.begin(), heap_.end(), std::greater<Entry>());
+		heap_.pop_back();
+	}
+
+	return heap_.empty() ? nullptr : heap_.front().timer;
+}
+
+/**
+ * \brief Remove the timer with the earliest deadline from the queue
+ *
+ * If the queue is empty, this function performs no operation.
+ */
+void TimerQueue::pop()
+{
+	Timer *timer = next();
+	if (timer)
+		remove(timer);
+}
+
+/**
+ * \fn TimerQueue::size()
+ * \brief Retrieve the number of timers in the queue
+ * \return The number of timers in the queue
+ */
+
+/**
+ * \fn TimerQueue::empty()
+ * \brief Check if the queue is empty
+ * \return True if the queue contains no timer, false otherwise
+ */
+
+bool TimerQueue::isLive(const Entry &entry) const
+{
+	auto iter = sequences_.find(entry.timer);
+	return iter != sequences_.end() && iter->second == entry.sequence;
+}
+
+void TimerQueue::compact()
+{
+	heap_.erase(std::remove_if(heap_.begin(), heap_.end(),
+				   [this](const Entry &entry) {
+					   return !isLive(entry);
+				   }),
+		    heap_.end());
+	std::make_heap(heap_.begin(), heap_.end(), std::greater<Entry>());
+
+	for (auto iter = sequences_.begin(); iter != sequences_.end();) {
+		if (!iter->second)
+			iter = sequences_.erase(iter);
+		else
+			++iter;
+	}
+}
+
+} /* namespace libcamera */
@@ -17,6 +17,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 /**
@@ -189,6 +190,23 @@ std::string time_point_to_string(const time_point &time)
 	return ossTimestamp.str();
 }
 
+/**
+ * \brief Retrieve the current time of the boot clock
+ *
+ * The boot clock (CLOCK_BOOTTIME) is monotonic and keeps counting while the
+ * system is suspended. It is used to timestamp events reported to
+ * applications, which can compare them with their own readings of the clock.
+ *
+ * \return The current time of the boot clock, in nanoseconds
+ */
+uint64_t boottime()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 std::basic_ostream<char, std::char_traits<char>> &
 operator<<(std::basic_ostream<char, std::char_traits<char>> &stream, const _hex &h)
 {
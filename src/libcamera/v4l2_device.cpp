@@ -18,6 +18,7 @@
 
 #include "libcamera/internal/event_notifier.h"
 #include "libcamera/internal/log.h"
+#include "libcamera/internal/media_request.h"
 #include "libcamera/internal/sysfs.h"
 #include "libcamera/internal/utils.h"
 
@@ -119,8 +120,8 @@ ControlInfo v4l2ControlInfo(const v4l2_query_ext_ctrl &ctrl)
  * at open() time, and the \a logTag to prefix log messages with.
  */
 V4L2Device::V4L2Device(const std::string &deviceNode)
-	: deviceNode_(deviceNode), fd_(-1), fdEventNotifier_(nullptr),
-	  frameStartEnabled_(false)
+	: deviceNode_(deviceNode), fd_(-1), layoutSequence_(0),
+	  fdEventNotifier_(nullptr), frameStartEnabled_(false)
 {
 }
 
@@ -255,8 +256,7 @@ ControlList V4L2Device::getControls(const std::vector<uint32_t> &ids)
 		ctrls.set(id, {});
 	}
 
-	std::vector<v4l2_ext_control> v4l2Ctrls(ids.size());
-	memset(v4l2Ctrls.data(), 0, sizeof(v4l2_ext_control) * ctrls.size());
+	Span<v4l2_ext_control> v4l2Ctrls = prepareControls(ctrls.size());
 
 	unsigned int i = 0;
 	for (auto &ctrl : ctrls) {
@@ -310,7 +310,7 @@ ControlList V4L2Device::getControls(const std::vector<uint32_t> &ids)
 		LOG(V4L2, Error) << "Unable to read control " << errorIdx
 				 << ": " << strerror(-ret);
 
-		v4l2Ctrls.resize(errorIdx);
+		v4l2Ctrls = v4l2Ctrls.first(errorIdx);
 	}
 
 	updateControls(&ctrls, v4l2Ctrls);
@@ -321,11 +321,17 @@ ControlList V4L2Device::getControls(const std::vector<uint32_t> &ids)
 /**
  * \brief Write controls to the device
  * \param[in] ctrls The list of controls to write
+ * \param[in] request The media request to store the controls in (optional)
  *
  * This method writes the value of all controls contained in \a ctrls, and
  * stores the values actually applied to the device in the corresponding
  * \a ctrls entry.
  *
+ * If a \a request is given, the controls are not applied immediately but
+ * stored in the request, and applied by the kernel when the request is
+ * processed, synchronously with the buffers queued in the same request. The
+ * \a ctrls values are then not updated.
+ *
  * If any control in \a ctrls is not supported by the device, is disabled (i.e.
  * has the V4L2_CTRL_FLAG_DISABLED flag set), is read-only, if any other error
  * occurs during validation of the requested controls, no control is written and
@@ -340,13 +346,12 @@ ControlList V4L2Device::getControls(const std::vector<uint32_t> &ids)
  * \retval -EINVAL One of the control is not supported or not accessible
  * \retval i The index of the control that failed
  */
-int V4L2Device::setControls(ControlList *ctrls)
+int V4L2Device::setControls(ControlList *ctrls, MediaRequest *request)
 {
 	if (ctrls->empty())
 		return 0;
 
-	std::vector<v4l2_ext_control> v4l2Ctrls(ctrls->size());
-	memset(v4l2Ctrls.data(), 0, sizeof(v4l2_ext_control) * ctrls->size());
+	Span<v4l2_ext_control> v4l2Ctrls = prepareControls(ctrls->size());
 
 	for (auto [ctrl, i] = std::pair(ctrls->begin(), 0u); i < ctrls->size(); ctrl++, i++) {
 		const unsigned int id = ctrl->first;
@@ -388,11 +393,55 @@ int V4L2Device::setControls(ControlList *ctrls)
 		}
 	}
 
+	int ret = setControls(v4l2Ctrls, request);
+	if (ret < 0)
+		return ret;
+
+	if (ret)
+		v4l2Ctrls = v4l2Ctrls.first(ret);
+
+	/* Controls stored in a request haven't been applied yet. */
+	if (!request)
+		updateControls(ctrls, v4l2Ctrls);
+
+	return ret;
+}
+
+/**
+ * \brief Write V4L2 extended controls to the device
+ * \param[in] v4l2Ctrls The V4L2 extended controls to write
+ * \param[in] request The media request to store the controls in (optional)
+ *
+ * This method writes the controls in \a v4l2Ctrls with a single
+ * VIDIOC_S_EXT_CTRLS ioctl. It is a lower-level version of
+ * setControls(ControlList *, MediaRequest *) for callers that write the same
+ * set of controls repeatedly, such as once per frame, and fill a preallocated
+ * array of controls instead of building a ControlList. The caller is
+ * responsible for the validity of the control ids and values. The values
+ * actually applied by the driver are stored in \a v4l2Ctrls.
+ *
+ * Errors are reported as for setControls(ControlList *, MediaRequest *).
+ *
+ * \return 0 on success or an error code otherwise
+ * \retval -EINVAL One of the control is not supported or not accessible
+ * \retval i The index of the control that failed
+ */
+int V4L2Device::setControls(Span<struct v4l2_ext_control> v4l2Ctrls,
+			    MediaRequest *request)
+{
+	if (v4l2Ctrls.empty())
+		return 0;
+
 	struct v4l2_ext_controls v4l2ExtCtrls = {};
 	v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
 	v4l2ExtCtrls.controls = v4l2Ctrls.data();
 	v4l2ExtCtrls.count = v4l2Ctrls.size();
 
+	if (request) {
+		v4l2ExtCtrls.which = V4L2_CTRL_WHICH_REQUEST_VAL;
+		v4l2ExtCtrls.request_fd = request->fd();
+	}
+
 	int ret = ioctl(VIDIOC_S_EXT_CTRLS, &v4l2ExtCtrls);
 	if (ret) {
 		unsigned int errorIdx = v4l2ExtCtrls.error_idx;
@@ -408,11 +457,22 @@ int V4L2Device::setControls(ControlList *ctrls)
 		LOG(V4L2, Error) << "Unable to set control " << errorIdx
 				 << ": " << strerror(-ret);
 
-		v4l2Ctrls.resize(errorIdx);
 		ret = errorIdx;
 	}
 
-	updateControls(ctrls, v4l2Ctrls);
+	/*
+	 * Controls that modify the buffer layout may change the formats of the
+	 * device. Treat the sensor flips as such unconditionally, as not all
+	 * drivers flag them even when they change the Bayer order.
+	 */
+	for (const struct v4l2_ext_control &ctrl : ret ? v4l2Ctrls.first(ret) : v4l2Ctrls) {
+		const struct v4l2_query_ext_ctrl *info = controlInfo(ctrl.id);
+		if (ctrl.id == V4L2_CID_HFLIP || ctrl.id == V4L2_CID_VFLIP ||
+		    (info && info->flags & V4L2_CTRL_FLAG_MODIFY_LAYOUT)) {
+			layoutSequence_++;
+			break;
+		}
+	}
 
 	return ret;
 }
@@ -524,6 +584,19 @@ int V4L2Device::ioctl(unsigned long request, void *argp)
  * \return The V4L2 device file descriptor, -1 if the device node is not open
  */
 
+/**
+ * \fn V4L2Device::layoutSequence()
+ * \brief Retrieve the layout change sequence number
+ *
+ * The sequence number is incremented every time a control flagged with
+ * V4L2_CTRL_FLAG_MODIFY_LAYOUT, or one of the V4L2_CID_HFLIP and
+ * V4L2_CID_VFLIP controls, is written to the device, as those controls may
+ * change the formats of the device. Derived classes that cache format
+ * information can compare the sequence number to detect such changes.
+ *
+ * \return The layout change sequence number
+ */
+
 /*
  * \brief List and store information about all controls supported by the
  * V4L2 device
@@ -588,8 +661,15 @@ void V4L2Device::listControls()
  */
 void V4L2Device::updateControlInfo()
 {
-	for (auto &[controlId, info] : controls_) {
+	/*
+	 * The ControlInfoMap is immutable and may be shared with its users.
+	 * Build a new map with the refreshed information.
+	 */
+	ControlInfoMap::Map ctrls;
+
+	for (const auto &[controlId, info] : controls_) {
 		unsigned int id = controlId->id();
+		ControlInfo &ctrlInfo = ctrls.emplace(controlId, info).first->second;
 
 		/*
 		 * Assume controlInfo_ has a corresponding entry, as it has been
@@ -604,8 +684,31 @@ void V4L2Device::updateControlInfo()
 			continue;
 		}
 
-		info = v4l2ControlInfo(ctrl);
+		ctrlInfo = v4l2ControlInfo(ctrl);
 	}
+
+	controls_ = ControlInfoMap(std::move(ctrls));
+}
+
+/*
+ * \brief Prepare the array of V4L2 extended controls for a read or write
+ * \param[in] count The number of controls
+ *
+ * The array is stored in the device and reused across calls, to avoid
+ * allocating memory for every read or write of controls. Its capacity only
+ * grows when more controls than ever before are accessed at once.
+ *
+ * \return A span over \a count zeroed V4L2 extended controls, valid until the
+ * next call to this function
+ */
+Span<v4l2_ext_control> V4L2Device::prepareControls(std::size_t count)
+{
+	if (v4l2Ctrls_.size() < count)
+		v4l2Ctrls_.resize(count);
+
+	memset(v4l2Ctrls_.data(), 0, sizeof(v4l2_ext_control) * count);
+
+	return { v4l2Ctrls_.data(), count };
 }
 
 /*
@@ -613,16 +716,21 @@ void V4L2Device::updateControlInfo()
  * values in \a v4l2Ctrls
  * \param[inout] ctrls List of V4L2 controls to update
  * \param[in] v4l2Ctrls List of V4L2 extended controls as returned by the driver
+ *
+ * The \a v4l2Ctrls shall be stored in the iteration order of \a ctrls, the
+ * values are then updated in place without looking them up in \a ctrls.
  */
 void V4L2Device::updateControls(ControlList *ctrls,
 				Span<const v4l2_ext_control> v4l2Ctrls)
 {
+	auto ctrl = ctrls->begin();
+
 	for (const v4l2_ext_control &v4l2Ctrl : v4l2Ctrls) {
-		const unsigned int id = v4l2Ctrl.id;
+		ASSERT(ctrl->first == v4l2Ctrl.id);
 
-		ControlValue value = ctrls->get(id);
+		ControlValue &value = (ctrl++)->second;
 
-		const auto iter = controls_.find(id);
+		const auto iter = controls_.find(v4l2Ctrl.id);
 		ASSERT(iter != controls_.end());
 
 		switch (iter->first->type()) {
@@ -645,8 +753,6 @@ void V4L2Device::updateControls(ControlList *ctrls,
 			value.set<int32_t>(v4l2Ctrl.value);
 			break;
 		}
-
-		ctrls->set(id, value);
 	}
 }
 
@@ -9,8 +9,8 @@
 #include "libcamera/internal/v4l2_pixelformat.h"
 
 #include <ctype.h>
-#include <map>
 #include <string.h>
+#include <unordered_map>
 
 #include <libcamera/formats.h>
 #include <libcamera/pixel_format.h>
@@ -44,7 +44,7 @@ LOG_DECLARE_CATEGORY(V4L2)
 
 namespace {
 
-const std::map<V4L2PixelFormat, PixelFormat> vpf2pf{
+const std::unordered_map<uint32_t, PixelFormat> vpf2pf{
 	/* RGB formats. */
 	{ V4L2PixelFormat(V4L2_PIX_FMT_RGB565), formats::RGB565 },
 	{ V4L2PixelFormat(V4L2_PIX_FMT_RGB565X), formats::RGB565_BE },
@@ -103,6 +103,8 @@ const std::map<V4L2PixelFormat, PixelFormat> vpf2pf{
 
 	/* Compressed formats. */
 	{ V4L2PixelFormat(V4L2_PIX_FMT_MJPEG), formats::MJPEG },
+	{ V4L2PixelFormat(V4L2_PIX_FMT_H264), formats::H264 },
+	{ V4L2PixelFormat(V4L2_PIX_FMT_HEVC), formats::HEVC },
 };
 
 } /* namespace */
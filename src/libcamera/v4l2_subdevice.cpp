@@ -236,7 +236,10 @@ uint8_t V4L2SubdeviceFormat::bitsPerPixel() const
  * path
  */
 V4L2Subdevice::V4L2Subdevice(const MediaEntity *entity)
-	: V4L2Device(entity->deviceNode()), entity_(entity)
+	: V4L2Device(entity->deviceNode()), entity_(entity),
+	  formatsLinkSequence_(0), formatsFormatSequence_(0),
+	  formatsLayoutSequence_(0), activeLinkSequence_(0),
+	  activeLayoutSequence_(0)
 {
 }
 
@@ -251,6 +254,8 @@ V4L2Subdevice::~V4L2Subdevice()
  */
 int V4L2Subdevice::open()
 {
+	formats_.clear();
+
 	return V4L2Device::open(O_RDWR);
 }
 
@@ -321,6 +326,9 @@ int V4L2Subdevice::setSelection(unsigned int pad, unsigned int target,
 	sel.r.width = rect->width;
 	sel.r.height = rect->height;
 
+	/* Selection rectangles may be propagated to the pad formats. */
+	activeFormats_.clear();
+
 	int ret = ioctl(VIDIOC_SUBDEV_S_SELECTION, &sel);
 	if (ret < 0) {
 		LOG(V4L2, Error)
@@ -334,8 +342,11 @@ int V4L2Subdevice::setSelection(unsigned int pad, unsigned int target,
 	rect->width = sel.r.width;
 	rect->height = sel.r.height;
 
+	entity_->device()->formatChanged();
+
 	return 0;
 }
+
 /**
  * \brief Enumerate all media bus codes and frame sizes on a \a pad
  * \param[in] pad The 0-indexed pad number to enumerate formats on
@@ -343,6 +354,13 @@ int V4L2Subdevice::setSelection(unsigned int pad, unsigned int target,
  * Enumerate all media bus codes and frame sizes supported by the subdevice on
  * a \a pad.
  *
+ * The enumeration results are cached, and only queried from the device again
+ * after an active format or selection rectangle has been set on any device of
+ * the media device, after a control modifying the layout, such as the sensor
+ * flips, has been set on the subdevice, or after the links of the media device
+ * have been reconfigured, as all of them may affect the formats supported by
+ * the pads.
+ *
  * \return A list of the supported device formats
  */
 V4L2Subdevice::Formats V4L2Subdevice::formats(unsigned int pad)
@@ -354,6 +372,20 @@ V4L2Subdevice::Formats V4L2Subdevice::formats(unsigned int pad)
 		return {};
 	}
 
+	const MediaDevice *media = entity_->device();
+	if (media->linkSequence() != formatsLinkSequence_ ||
+	    media->formatSequence() != formatsFormatSequence_ ||
+	    layoutSequence() != formatsLayoutSequence_) {
+		formats_.clear();
+		formatsLinkSequence_ = media->linkSequence();
+		formatsFormatSequence_ = media->formatSequence();
+		formatsLayoutSequence_ = layoutSequence();
+	}
+
+	const auto iter = formats_.find(pad);
+	if (iter != formats_.end())
+		return iter->second;
+
 	for (unsigned int code : enumPadCodes(pad)) {
 		std::vector<SizeRange> sizes = enumPadSizes(pad, code);
 		if (sizes.empty())
@@ -368,6 +400,10 @@ V4L2Subdevice::Formats V4L2Subdevice::formats(unsigned int pad)
 		}
 	}
 
+	/* Don't cache failed enumerations. */
+	if (!formats.empty())
+		formats_[pad] = formats;
+
 	return formats;
 }
 
@@ -412,11 +448,35 @@ int V4L2Subdevice::getFormat(unsigned int pad, V4L2SubdeviceFormat *format,
  * Apply the requested image format to the desired media pad and return the
  * actually applied format parameters, as getFormat() would do.
  *
+ * Setting the same active format as the last one set on the \a pad is skipped,
+ * and the previously applied format is returned, unless anything that may
+ * have changed the format of the pad happened in the meantime: a format or
+ * selection set on another pad, a control modifying the layout, or a change
+ * to the media graph.
+ *
  * \return 0 on success or a negative error code otherwise
  */
 int V4L2Subdevice::setFormat(unsigned int pad, V4L2SubdeviceFormat *format,
 			     Whence whence)
 {
+	if (whence == ActiveFormat) {
+		unsigned int linkSequence = entity_->device()->linkSequence();
+		if (linkSequence != activeLinkSequence_ ||
+		    layoutSequence() != activeLayoutSequence_) {
+			activeFormats_.clear();
+			activeLinkSequence_ = linkSequence;
+			activeLayoutSequence_ = layoutSequence();
+		}
+
+		auto it = activeFormats_.find(pad);
+		if (it != activeFormats_.end() &&
+		    it->second.first.mbus_code == format->mbus_code &&
+		    it->second.first.size == format->size) {
+			*format = it->second.second;
+			return 0;
+		}
+	}
+
 	struct v4l2_subdev_format subdevFmt = {};
 	subdevFmt.which = whence == ActiveFormat ? V4L2_SUBDEV_FORMAT_ACTIVE
 			: V4L2_SUBDEV_FORMAT_TRY;
@@ -425,11 +485,15 @@ int V4L2Subdevice::setFormat(unsigned int pad, V4L2SubdeviceFormat *format,
 	subdevFmt.format.height = format->size.height;
 	subdevFmt.format.code = format->mbus_code;
 
+	V4L2SubdeviceFormat requested = *format;
+
 	int ret = ioctl(VIDIOC_SUBDEV_S_FMT, &subdevFmt);
 	if (ret) {
 		LOG(V4L2, Error)
 			<< "Unable to set format on pad " << pad
 			<< ": " << strerror(-ret);
+		if (whence == ActiveFormat)
+			activeFormats_.clear();
 		return ret;
 	}
 
@@ -437,6 +501,14 @@ int V4L2Subdevice::setFormat(unsigned int pad, V4L2SubdeviceFormat *format,
 	format->size.height = subdevFmt.format.height;
 	format->mbus_code = subdevFmt.format.code;
 
+	if (whence == ActiveFormat) {
+		entity_->device()->formatChanged();
+
+		/* The format may have been propagated to the other pads. */
+		activeFormats_.clear();
+		activeFormats_[pad] = { requested, *format };
+	}
+
 	return 0;
 }
 
@@ -7,6 +7,7 @@
 
 #include "libcamera/internal/v4l2_videodevice.h"
 
+#include <algorithm>
 #include <array>
 #include <fcntl.h>
 #include <iomanip>
@@ -23,10 +24,16 @@
 
 #include <libcamera/file_descriptor.h>
 
+#include "libcamera/internal/buffer.h"
 #include "libcamera/internal/event_notifier.h"
+#include "libcamera/internal/formats.h"
 #include "libcamera/internal/log.h"
 #include "libcamera/internal/media_device.h"
 #include "libcamera/internal/media_object.h"
+#include "libcamera/internal/media_request.h"
+#include "libcamera/internal/performance.h"
+#include "libcamera/internal/tracepoints.h"
+#include "libcamera/internal/utils.h"
 
 /**
  * \file v4l2_videodevice.h
@@ -152,6 +159,11 @@ LOG_DECLARE_CATEGORY(V4L2)
  * index associations to help selecting V4L2 buffers. It tracks, for every
  * entry, if the V4L2 buffer is in use, and offers lookup of the best free V4L2
  * buffer for a set of dmabufs.
+ *
+ * Entries are additionally indexed by the dmabuf file descriptor of their first
+ * plane, which allows the common case of a cache hit to be resolved in constant
+ * time. The cache falls back to a full scan of the entries when the index
+ * doesn't provide a match.
  */
 
 /**
@@ -163,7 +175,7 @@ LOG_DECLARE_CATEGORY(V4L2)
  * buffer import, with buffers added to the cache as they are queued.
  */
 V4L2BufferCache::V4L2BufferCache(unsigned int numEntries)
-	: lastUsedCounter_(1), missCounter_(0)
+	: lastUsedCounter_(1), hitCounter_(0), missCounter_(0)
 {
 	cache_.resize(numEntries);
 }
@@ -177,18 +189,22 @@ V4L2BufferCache::V4L2BufferCache(unsigned int numEntries)
  * allocated.
  */
 V4L2BufferCache::V4L2BufferCache(const std::vector<std::unique_ptr<FrameBuffer>> &buffers)
-	: lastUsedCounter_(1), missCounter_(0)
+	: lastUsedCounter_(1), hitCounter_(0), missCounter_(0)
 {
-	for (const std::unique_ptr<FrameBuffer> &buffer : buffers)
+	for (const std::unique_ptr<FrameBuffer> &buffer : buffers) {
 		cache_.emplace_back(true,
 				    lastUsedCounter_.fetch_add(1, std::memory_order_acq_rel),
-				    buffer->planes());
+				    *buffer);
+		index_[key(*buffer)] = cache_.size() - 1;
+	}
 }
 
 V4L2BufferCache::~V4L2BufferCache()
 {
 	if (missCounter_ > cache_.size())
-		LOG(V4L2, Debug) << "Cache misses: " << missCounter_;
+		LOG(V4L2, Debug)
+			<< "Cache hits: " << hitCounter_
+			<< ", misses: " << missCounter_;
 }
 
 /**
@@ -198,8 +214,9 @@ V4L2BufferCache::~V4L2BufferCache()
  * Find the best V4L2 buffer index to be used for the FrameBuffer \a buffer
  * based on previous mappings of frame buffers to V4L2 buffers. If a free V4L2
  * buffer previously used with the same dmabufs as \a buffer is found in the
- * cache, return its index. Otherwise return the index of the first free V4L2
- * buffer and record its association with the dmabufs of \a buffer.
+ * cache, return its index. Otherwise return the index of the least recently
+ * used free V4L2 buffer and record its association with the dmabufs of
+ * \a buffer.
  *
  * \return The index of the best V4L2 buffer, or -ENOENT if no free V4L2 buffer
  * is available
@@ -208,36 +225,51 @@ int V4L2BufferCache::get(const FrameBuffer &buffer)
 {
 	bool hit = false;
 	int use = -1;
-	uint64_t oldest = UINT64_MAX;
-
-	for (unsigned int index = 0; index < cache_.size(); index++) {
-		const Entry &entry = cache_[index];
 
-		if (!entry.free_)
-			continue;
-
-		/* Try to find a cache hit by comparing the planes. */
-		if (entry == buffer) {
+	/* Look up the index first, the entry must still match the buffer. */
+	auto it = index_.find(key(buffer));
+	if (it != index_.end()) {
+		const Entry &entry = cache_[it->second];
+		if (entry.free_ && entry == buffer) {
 			hit = true;
-			use = index;
-			break;
+			use = it->second;
 		}
+	}
+
+	if (!hit) {
+		uint64_t oldest = UINT64_MAX;
+
+		for (unsigned int index = 0; index < cache_.size(); index++) {
+			const Entry &entry = cache_[index];
+
+			if (!entry.free_)
+				continue;
+
+			/* Try to find a cache hit by comparing the planes. */
+			if (entry == buffer) {
+				hit = true;
+				use = index;
+				break;
+			}
 
-		if (entry.lastUsed_ < oldest) {
-			use = index;
-			oldest = entry.lastUsed_;
+			if (entry.lastUsed_ < oldest) {
+				use = index;
+				oldest = entry.lastUsed_;
+			}
 		}
 	}
 
-	if (!hit)
+	if (hit)
+		hitCounter_++;
+	else
 		missCounter_++;
 
+	PerformanceRecorder::instance()->bufferCacheAccess(hit);
+
 	if (use < 0)
 		return -ENOENT;
 
-	cache_[use] = Entry(false,
-			    lastUsedCounter_.fetch_add(1, std::memory_order_acq_rel),
-			    buffer);
+	update(use, buffer);
 
 	return use;
 }
@@ -252,6 +284,50 @@ void V4L2BufferCache::put(unsigned int index)
 	cache_[index].free_ = true;
 }
 
+/**
+ * \fn V4L2BufferCache::hits()
+ * \brief Retrieve the number of cache hits
+ *
+ * A cache hit occurs when get() finds a free V4L2 buffer that was last used
+ * with the same dmabufs as the requested FrameBuffer.
+ *
+ * \return The number of cache hits since the cache was created
+ */
+
+/**
+ * \fn V4L2BufferCache::misses()
+ * \brief Retrieve the number of cache misses
+ *
+ * A cache miss occurs when get() has to associate the requested FrameBuffer
+ * with a V4L2 buffer previously used with different dmabufs, or when no free
+ * V4L2 buffer is available. A steadily increasing miss counter indicates that
+ * the application keeps queueing new dmabufs instead of reusing its buffers.
+ *
+ * \return The number of cache misses since the cache was created
+ */
+
+int V4L2BufferCache::key(const FrameBuffer &buffer)
+{
+	const std::vector<FrameBuffer::Plane> &planes = buffer.planes();
+	return planes.empty() ? -1 : planes[0].fd.fd();
+}
+
+void V4L2BufferCache::update(unsigned int index, const FrameBuffer &buffer)
+{
+	Entry &entry = cache_[index];
+
+	/* Drop the index record of the previous association, if any. */
+	auto it = index_.find(entry.key());
+	if (it != index_.end() && it->second == index)
+		index_.erase(it);
+
+	entry = Entry(false,
+		      lastUsedCounter_.fetch_add(1, std::memory_order_acq_rel),
+		      buffer);
+
+	index_[entry.key()] = index;
+}
+
 V4L2BufferCache::Entry::Entry()
 	: free_(true), lastUsed_(0)
 {
@@ -388,6 +464,32 @@ bool V4L2BufferCache::Entry::operator==(const FrameBuffer &buffer) const
  * \brief The number of valid data planes
  */
 
+/**
+ * \brief Request the line stride to be aligned
+ * \param[in] align The stride alignment in bytes
+ *
+ * Set the bytes per line of the data planes to the smallest stride for the
+ * format fourcc and size that is a multiple of \a align, to request it from
+ * the driver with V4L2VideoDevice::tryFormat() or V4L2VideoDevice::setFormat().
+ * Drivers are free to adjust the stride, the caller shall check the returned
+ * value. If \a align is 0 the format is left untouched.
+ */
+void V4L2DeviceFormat::alignStride(unsigned int align)
+{
+	if (!align)
+		return;
+
+	const PixelFormatInfo &info = PixelFormatInfo::info(fourcc);
+	if (!info.isValid())
+		return;
+
+	if (!planesCount)
+		planesCount = 1;
+
+	for (unsigned int i = 0; i < planesCount; i++)
+		planes[i].bpl = info.stride(size.width, i, align);
+}
+
 /**
  * \brief Assemble and return a string describing the format
  * \return A string describing the V4L2DeviceFormat
@@ -481,8 +583,9 @@ const std::string V4L2DeviceFormat::toString() const
  * \param[in] deviceNode The file-system path to the video device node
  */
 V4L2VideoDevice::V4L2VideoDevice(const std::string &deviceNode)
-	: V4L2Device(deviceNode), cache_(nullptr), fdBufferNotifier_(nullptr),
-	  streaming_(false)
+	: V4L2Device(deviceNode), media_(nullptr), formatsLinkSequence_(0),
+	  formatsFormatSequence_(0), formatsLayoutSequence_(0), cache_(nullptr), cpuAccess_(true), cacheHints_(false),
+	  fdBufferNotifier_(nullptr), streaming_(false)
 {
 	/*
 	 * We default to an MMAP based CAPTURE video device, however this will
@@ -501,6 +604,7 @@ V4L2VideoDevice::V4L2VideoDevice(const std::string &deviceNode)
 V4L2VideoDevice::V4L2VideoDevice(const MediaEntity *entity)
 	: V4L2VideoDevice(entity->deviceNode())
 {
+	media_ = entity->device();
 }
 
 V4L2VideoDevice::~V4L2VideoDevice()
@@ -682,6 +786,8 @@ void V4L2VideoDevice::close()
 	releaseBuffers();
 	delete fdBufferNotifier_;
 
+	formats_.clear();
+
 	V4L2Device::close();
 }
 
@@ -761,12 +867,22 @@ int V4L2VideoDevice::tryFormat(V4L2DeviceFormat *format)
  */
 int V4L2VideoDevice::setFormat(V4L2DeviceFormat *format)
 {
+	int ret;
+
 	if (caps_.isMeta())
-		return trySetFormatMeta(format, true);
+		ret = trySetFormatMeta(format, true);
 	else if (caps_.isMultiplanar())
-		return trySetFormatMultiplane(format, true);
+		ret = trySetFormatMultiplane(format, true);
 	else
-		return trySetFormatSingleplane(format, true);
+		ret = trySetFormatSingleplane(format, true);
+
+	if (!ret) {
+		formats_.clear();
+		if (media_)
+			media_->formatChanged();
+	}
+
+	return ret;
 }
 
 int V4L2VideoDevice::getFormatMeta(V4L2DeviceFormat *format)
@@ -958,12 +1074,34 @@ int V4L2VideoDevice::trySetFormatSingleplane(V4L2DeviceFormat *format, bool set)
  * If the \a code argument is not zero, only formats compatible with that media
  * bus code will be enumerated.
  *
+ * The enumeration results are cached per media bus code, and only queried from
+ * the device again after a format has been set on the device or on another
+ * device of the media device, after a control modifying the layout has been
+ * set on the device, or after the links of the media device, if any, have been
+ * reconfigured.
+ *
  * \return A list of the supported video device formats
  */
 V4L2VideoDevice::Formats V4L2VideoDevice::formats(uint32_t code)
 {
 	Formats formats;
 
+	if (layoutSequence() != formatsLayoutSequence_) {
+		formats_.clear();
+		formatsLayoutSequence_ = layoutSequence();
+	}
+
+	if (media_ && (media_->linkSequence() != formatsLinkSequence_ ||
+		       media_->formatSequence() != formatsFormatSequence_)) {
+		formats_.clear();
+		formatsLinkSequence_ = media_->linkSequence();
+		formatsFormatSequence_ = media_->formatSequence();
+	}
+
+	const auto iter = formats_.find(code);
+	if (iter != formats_.end())
+		return iter->second;
+
 	for (V4L2PixelFormat pixelFormat : enumPixelformats(code)) {
 		std::vector<SizeRange> sizes = enumSizes(pixelFormat);
 		if (sizes.empty())
@@ -979,6 +1117,10 @@ V4L2VideoDevice::Formats V4L2VideoDevice::formats(uint32_t code)
 		formats.emplace(pixelFormat, sizes);
 	}
 
+	/* Don't cache failed enumerations. */
+	if (!formats.empty())
+		formats_[code] = formats;
+
 	return formats;
 }
 
@@ -1129,6 +1271,8 @@ int V4L2VideoDevice::requestBuffers(unsigned int count,
 		return ret;
 	}
 
+	cacheHints_ = rb.capabilities & V4L2_BUF_CAP_SUPPORTS_MMAP_CACHE_HINTS;
+
 	if (rb.count < count) {
 		LOG(V4L2, Error)
 			<< "Not enough buffers provided by V4L2VideoDevice";
@@ -1371,21 +1515,49 @@ int V4L2VideoDevice::releaseBuffers()
 	return requestBuffers(0, memoryType_);
 }
 
+/**
+ * \brief Declare whether the CPU accesses the buffers queued to the device
+ * \param[in] cpuAccess True if the CPU reads or writes the buffers
+ *
+ * Buffers that are only exchanged between devices, such as raw frames captured
+ * by a receiver and processed by an ISP, don't need the cache maintenance
+ * operations that the kernel performs on every buffer queued and dequeued.
+ * Pipeline handlers call this function with \a cpuAccess set to false for the
+ * video devices whose buffers are never accessed by the CPU, neither by
+ * libcamera, the IPA nor the application. The buffers are then queued with
+ * the V4L2_BUF_FLAG_NO_CACHE_INVALIDATE and V4L2_BUF_FLAG_NO_CACHE_CLEAN flags
+ * when the device supports cache hints, which the kernel only honours for
+ * buffers allocated with allocateBuffers().
+ *
+ * Devices default to CPU access. The setting applies to the buffers queued
+ * after this function is called.
+ */
+void V4L2VideoDevice::setCpuAccess(bool cpuAccess)
+{
+	cpuAccess_ = cpuAccess;
+}
+
 /**
  * \brief Queue a buffer to the video device
  * \param[in] buffer The buffer to be queued
+ * \param[in] request The media request to queue the buffer to (optional)
  *
  * For capture video devices the \a buffer will be filled with data by the
  * device. For output video devices the \a buffer shall contain valid data and
  * will be processed by the device. Once the device has finished processing the
  * buffer, it will be available for dequeue.
  *
+ * If a \a request is given, the buffer is bound to the request and will only
+ * be processed by the device once the request is queued with
+ * MediaRequest::queue(). Controls stored in the same request are applied
+ * synchronously with the buffer.
+ *
  * The best available V4L2 buffer is picked for \a buffer using the V4L2 buffer
  * cache.
  *
  * \return 0 on success or a negative error code otherwise
  */
-int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
+int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer, MediaRequest *request)
 {
 	struct v4l2_plane v4l2Planes[VIDEO_MAX_PLANES] = {};
 	struct v4l2_buffer buf = {};
@@ -1410,6 +1582,15 @@ int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
 	buf.memory = memoryType_;
 	buf.field = V4L2_FIELD_NONE;
 
+	if (request) {
+		buf.flags |= V4L2_BUF_FLAG_REQUEST_FD;
+		buf.request_fd = request->fd();
+	}
+
+	if (!cpuAccess_ && cacheHints_)
+		buf.flags |= V4L2_BUF_FLAG_NO_CACHE_INVALIDATE |
+			     V4L2_BUF_FLAG_NO_CACHE_CLEAN;
+
 	bool multiPlanar = V4L2_TYPE_IS_MULTIPLANAR(buf.type);
 	const std::vector<FrameBuffer::Plane> &planes = buffer->planes();
 
@@ -1432,14 +1613,14 @@ int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
 
 		if (multiPlanar) {
 			unsigned int nplane = 0;
-			for (const FrameMetadata::Plane &plane : metadata.planes) {
+			for (const FrameMetadata::Plane &plane : metadata.planes()) {
 				v4l2Planes[nplane].bytesused = plane.bytesused;
 				v4l2Planes[nplane].length = buffer->planes()[nplane].length;
 				nplane++;
 			}
 		} else {
-			if (metadata.planes.size())
-				buf.bytesused = metadata.planes[0].bytesused;
+			if (!metadata.planes().empty())
+				buf.bytesused = metadata.planes()[0].bytesused;
 		}
 
 		buf.sequence = metadata.sequence;
@@ -1449,6 +1630,9 @@ int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
 
 	LOG(V4L2, Debug) << "Queueing buffer " << buf.index;
 
+	LIBCAMERA_TRACEPOINT(v4l2_video_device_queue_buffer,
+			     deviceNode().c_str(), buffer, buf.index);
+
 	ret = ioctl(VIDIOC_QBUF, &buf);
 	if (ret < 0) {
 		LOG(V4L2, Error)
@@ -1477,12 +1661,26 @@ int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
  */
 void V4L2VideoDevice::bufferAvailable([[maybe_unused]] EventNotifier *notifier)
 {
-	FrameBuffer *buffer = dequeueBuffer();
-	if (!buffer)
-		return;
+	unsigned int count = 0;
 
-	/* Notify anyone listening to the device. */
-	bufferReady.emit(buffer);
+	/*
+	 * Dequeue all the buffers that are ready, to avoid a round trip
+	 * through the event loop for each of them when several buffers
+	 * complete before the notifier is handled. The bufferReady signal
+	 * handlers may stop streaming, which empties the queue.
+	 */
+	while (!queuedBuffers_.empty()) {
+		FrameBuffer *buffer = dequeueBuffer();
+		if (!buffer)
+			break;
+
+		/* Notify anyone listening to the device. */
+		bufferReady.emit(buffer);
+		count++;
+	}
+
+	if (count)
+		bufferBatchReady.emit();
 }
 
 /**
@@ -1511,8 +1709,9 @@ FrameBuffer *V4L2VideoDevice::dequeueBuffer()
 
 	ret = ioctl(VIDIOC_DQBUF, &buf);
 	if (ret < 0) {
-		LOG(V4L2, Error)
-			<< "Failed to dequeue buffer: " << strerror(-ret);
+		if (ret != -EAGAIN)
+			LOG(V4L2, Error)
+				<< "Failed to dequeue buffer: " << strerror(-ret);
 		return nullptr;
 	}
 
@@ -1527,21 +1726,30 @@ FrameBuffer *V4L2VideoDevice::dequeueBuffer()
 	if (queuedBuffers_.empty())
 		fdBufferNotifier_->setEnabled(false);
 
-	buffer->metadata_.status = buf.flags & V4L2_BUF_FLAG_ERROR
-				 ? FrameMetadata::FrameError
-				 : FrameMetadata::FrameSuccess;
-	buffer->metadata_.sequence = buf.sequence;
-	buffer->metadata_.timestamp = buf.timestamp.tv_sec * 1000000000ULL
-				    + buf.timestamp.tv_usec * 1000ULL;
-
-	buffer->metadata_.planes.clear();
+	FrameMetadata &metadata = buffer->_d()->metadata();
+	metadata.status = buf.flags & V4L2_BUF_FLAG_ERROR
+			? FrameMetadata::FrameError
+			: FrameMetadata::FrameSuccess;
+	metadata.sequence = buf.sequence;
+	metadata.timestamp = buf.timestamp.tv_sec * 1000000000ULL
+			   + buf.timestamp.tv_usec * 1000ULL;
+	metadata.dequeueTimestamp = utils::boottime();
+	metadata.flags = buf.flags & V4L2_BUF_FLAG_KEYFRAME
+		       ? FrameMetadata::FlagKeyFrame : 0;
+
+	Span<FrameMetadata::Plane> metadataPlanes = metadata.planes();
 	if (multiPlanar) {
-		for (unsigned int nplane = 0; nplane < buf.length; nplane++)
-			buffer->metadata_.planes.push_back({ planes[nplane].bytesused });
-	} else {
-		buffer->metadata_.planes.push_back({ buf.bytesused });
+		unsigned int count = std::min<unsigned int>(buf.length,
+							    metadataPlanes.size());
+		for (unsigned int nplane = 0; nplane < count; nplane++)
+			metadataPlanes[nplane].bytesused = planes[nplane].bytesused;
+	} else if (!metadataPlanes.empty()) {
+		metadataPlanes[0].bytesused = buf.bytesused;
 	}
 
+	LIBCAMERA_TRACEPOINT(v4l2_video_device_dequeue_buffer,
+			     deviceNode().c_str(), buffer, buf.index);
+
 	return buffer;
 }
 
@@ -1550,6 +1758,18 @@ FrameBuffer *V4L2VideoDevice::dequeueBuffer()
  * \brief A Signal emitted when a framebuffer completes
  */
 
+/**
+ * \var V4L2VideoDevice::bufferBatchReady
+ * \brief A Signal emitted after a batch of framebuffers has completed
+ *
+ * When the device signals that buffers are ready, all completed buffers are
+ * dequeued in one go, and the bufferReady signal is emitted for each of them.
+ * The bufferBatchReady signal is then emitted once. Users that need to process
+ * completed buffers together, for instance to only act on the most recent
+ * one, can collect them in their bufferReady handler and process them in
+ * their bufferBatchReady handler.
+ */
+
 /**
  * \brief Start the video stream
  * \return 0 on success or a negative error code otherwise
@@ -1601,7 +1821,7 @@ int V4L2VideoDevice::streamOff()
 	for (auto it : queuedBuffers_) {
 		FrameBuffer *buffer = it.second;
 
-		buffer->metadata_.status = FrameMetadata::FrameCancelled;
+		buffer->_d()->metadata().status = FrameMetadata::FrameCancelled;
 		bufferReady.emit(buffer);
 	}
 
@@ -0,0 +1,337 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * zsl_ring.cpp - Ring of recently captured frames for zero shutter lag capture
+ */
+
+#include "libcamera/internal/zsl_ring.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/request.h>
+
+#include "libcamera/internal/log.h"
+
+/**
+ * \file zsl_ring.h
+ * \brief Ring of recently captured frames for zero shutter lag capture
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(ZslRing)
+
+/**
+ * \class ZslRing
+ * \brief Keep copies of the most recent frames to serve still captures
+ *
+ * The ZslRing class implements zero shutter lag capture independently of the
+ * pipeline handlers. It keeps a copy of the buffers and metadata of the most
+ * recently completed requests in a bounded ring of slots. A later request can
+ * then claim one of those frames by timestamp, and be completed immediately
+ * with the contents of the frame instead of waiting for a new exposure.
+ *
+ * The ring holds one buffer per slot for each stream added with addStream().
+ * Only the streams captured by completed requests can be stored, applications
+ * thus need to include all the streams they want to claim frames from, such as
+ * a raw stream, in their repeating requests.
+ *
+ * The frames are copied to and from the application buffers, as the buffers
+ * belong to the application and are reused as soon as their request completes.
+ *
+ * The ZslRing class is not thread-safe.
+ */
+
+ZslRing::ZslRing()
+	: next_(0)
+{
+}
+
+ZslRing::~ZslRing() = default;
+
+/**
+ * \brief Reset the ring to hold \a depth slots
+ * \param[in] depth The number of frames to keep
+ *
+ * All the frames and buffers stored in the ring are dropped. Callers that need
+ * to recycle the buffers shall retrieve them with release() first. A zero
+ * \a depth disables the ring.
+ */
+void ZslRing::configure(unsigned int depth)
+{
+	slots_.clear();
+	cache_.clear();
+	next_ = 0;
+
+	slots_.reserve(depth);
+	for (unsigned int i = 0; i < depth; ++i)
+		slots_.push_back({ 0, ControlList(controls::controls), {} });
+}
+
+/**
+ * \brief Add the buffers to store the frames of a stream in the ring
+ * \param[in] stream The stream
+ * \param[in] buffers The buffers, one per slot
+ *
+ * The buffers shall have a single plane large enough to hold all the planes of
+ * the frames of the \a stream. Frames that don't fit are not stored.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The number of \a buffers doesn't match the ring depth
+ */
+int ZslRing::addStream(const Stream *stream,
+		       std::vector<std::unique_ptr<FrameBuffer>> &&buffers)
+{
+	if (buffers.size() != slots_.size())
+		return -EINVAL;
+
+	for (unsigned int i = 0; i < slots_.size(); ++i) {
+		Frame &frame = slots_[i].frames[stream];
+
+		frame.map = std::make_unique<MappedFrameBuffer>(buffers[i].get(),
+								PROT_READ | PROT_WRITE);
+		if (!frame.map->isValid()) {
+			LOG(ZslRing, Error) << "Failed to map ring buffer";
+			return frame.map->error();
+		}
+
+		frame.buffer = std::move(buffers[i]);
+		frame.valid = false;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Release the buffers of the ring
+ *
+ * All the frames stored in the ring are dropped and the ring is disabled.
+ *
+ * \return The buffers that were added to the ring with addStream()
+ */
+std::vector<std::unique_ptr<FrameBuffer>> ZslRing::release()
+{
+	std::vector<std::unique_ptr<FrameBuffer>> buffers;
+
+	for (Slot &slot : slots_) {
+		for (auto &[stream, frame] : slot.frames) {
+			frame.map.reset();
+			if (frame.buffer)
+				buffers.push_back(std::move(frame.buffer));
+		}
+	}
+
+	configure(0);
+
+	return buffers;
+}
+
+/**
+ * \fn ZslRing::depth()
+ * \brief Retrieve the number of frames the ring can hold
+ * \return The ring depth, 0 if the ring is disabled
+ */
+
+/**
+ * \brief Store the frame captured by a completed request in the ring
+ * \param[in] request The completed request
+ *
+ * The buffers of the \a request are copied to the oldest slot of the ring,
+ * along with the request metadata. Requests that haven't completed
+ * successfully and requests served from the ring are ignored.
+ */
+void ZslRing::store(Request *request)
+{
+	if (slots_.empty() || request->status() != Request::RequestComplete)
+		return;
+
+	const ControlList &metadata = request->metadata();
+	if (metadata.contains(controls::ZslTimestamp))
+		return;
+
+	int64_t timestamp = metadata.get(controls::SensorTimestamp);
+	if (!timestamp && !request->buffers().empty())
+		timestamp = request->buffers().begin()->second->metadata().timestamp;
+	if (!timestamp)
+		return;
+
+	Slot &slot = slots_[next_];
+	bool stored = false;
+
+	for (auto &[stream, frame] : slot.frames)
+		frame.valid = false;
+
+	for (const auto &[stream, buffer] : request->buffers()) {
+		auto it = slot.frames.find(stream);
+		if (it == slot.frames.end())
+			continue;
+
+		stored |= storeFrame(&it->second, buffer);
+	}
+
+	if (!stored) {
+		slot.timestamp = 0;
+		return;
+	}
+
+	/*
+	 * Drop the metadata that describes the completion of the request, it
+	 * will be reported anew for the request that claims the frame.
+	 */
+	slot.timestamp = timestamp;
+	slot.metadata.clear();
+	for (const auto &[id, value] : metadata) {
+		if (id == controls::FRAME_DROP_REASON ||
+		    id == controls::REQUEST_COMPLETED_TIMESTAMP)
+			continue;
+
+		slot.metadata.set(id, value);
+	}
+
+	next_ = (next_ + 1) % slots_.size();
+}
+
+/**
+ * \brief Complete a request with a frame stored in the ring
+ * \param[in] request The request to fill
+ * \param[in] timestamp The sensor timestamp of the frame to claim
+ *
+ * The frame claimed is the most recent frame captured at or before
+ * \a timestamp for which the ring holds all the streams of the \a request. Its
+ * contents and metadata are copied to the buffers of the \a request, and its
+ * metadata to the \a request metadata, with the controls::ZslTimestamp
+ * control set to the sensor timestamp of the frame. The frame is kept in the
+ * ring and can be claimed again.
+ *
+ * \return True if the \a request has been filled, false if no frame can be
+ * claimed
+ */
+bool ZslRing::claim(Request *request, int64_t timestamp)
+{
+	const Slot *best = nullptr;
+
+	for (const Slot &slot : slots_) {
+		if (!slot.timestamp || slot.timestamp > timestamp)
+			continue;
+		if (best && slot.timestamp <= best->timestamp)
+			continue;
+
+		bool complete = true;
+		for (const auto &[stream, buffer] : request->buffers()) {
+			auto it = slot.frames.find(stream);
+			if (it == slot.frames.end() || !it->second.valid) {
+				complete = false;
+				break;
+			}
+		}
+
+		if (complete)
+			best = &slot;
+	}
+
+	if (!best)
+		return false;
+
+	for (const auto &[stream, buffer] : request->buffers()) {
+		if (!loadFrame(best->frames.at(stream), buffer)) {
+			LOG(ZslRing, Warning)
+				<< "Can't copy frame " << best->timestamp
+				<< " to the request buffers";
+			return false;
+		}
+	}
+
+	request->metadata().merge(best->metadata);
+	request->metadata().set(controls::ZslTimestamp, best->timestamp);
+
+	LOG(ZslRing, Debug)
+		<< "Request " << request->sequence() << " served with frame "
+		<< best->timestamp;
+
+	return true;
+}
+
+bool ZslRing::storeFrame(Frame *frame, const FrameBuffer *buffer)
+{
+	const FrameMetadata &metadata = buffer->metadata();
+	if (metadata.status != FrameMetadata::FrameSuccess)
+		return false;
+
+	const MappedBuffer *src = cache_.map(buffer, PROT_READ);
+	if (!src)
+		return false;
+
+	/*
+	 * Copy the bytes used in each plane, or the whole plane when the
+	 * driver doesn't report the bytes used, one plane after the other.
+	 */
+	Span<uint8_t> dst = frame->map->maps()[0];
+	std::vector<size_t> lengths;
+	size_t offset = 0;
+
+	for (unsigned int i = 0; i < src->maps().size(); ++i) {
+		size_t length = src->maps()[i].size();
+		if (i < metadata.planes().size() && metadata.planes()[i].bytesused)
+			length = std::min<size_t>(length, metadata.planes()[i].bytesused);
+
+		lengths.push_back(length);
+		offset += length;
+	}
+
+	if (offset > dst.size()) {
+		LOG(ZslRing, Debug)
+			<< "Frame of " << offset << " bytes doesn't fit in "
+			<< dst.size() << " bytes";
+		return false;
+	}
+
+	MappedBuffer::CpuAccess srcAccess(src, PROT_READ);
+	MappedBuffer::CpuAccess dstAccess(frame->map.get(), PROT_WRITE);
+
+	offset = 0;
+	for (unsigned int i = 0; i < lengths.size(); ++i) {
+		memcpy(dst.data() + offset, src->maps()[i].data(), lengths[i]);
+		offset += lengths[i];
+	}
+
+	frame->metadata = metadata;
+	frame->lengths = std::move(lengths);
+	frame->valid = true;
+
+	return true;
+}
+
+bool ZslRing::loadFrame(const Frame &frame, FrameBuffer *buffer)
+{
+	if (buffer->planes().size() != frame.lengths.size())
+		return false;
+
+	const MappedBuffer *dst = cache_.map(buffer, PROT_WRITE);
+	if (!dst)
+		return false;
+
+	for (unsigned int i = 0; i < frame.lengths.size(); ++i) {
+		if (frame.lengths[i] > dst->maps()[i].size())
+			return false;
+	}
+
+	MappedBuffer::CpuAccess srcAccess(frame.map.get(), PROT_READ);
+	MappedBuffer::CpuAccess dstAccess(dst, PROT_WRITE);
+
+	const uint8_t *src = frame.map->maps()[0].data();
+	for (unsigned int i = 0; i < frame.lengths.size(); ++i) {
+		memcpy(dst->maps()[i].data(), src, frame.lengths[i]);
+		src += frame.lengths[i];
+	}
+
+	buffer->_d()->metadata() = frame.metadata;
+
+	return true;
+}
+
+} /* namespace libcamera */
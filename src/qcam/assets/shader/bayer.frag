@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * bayer.frag - Fragment shader code for raw Bayer formats
+ */
+
+#ifdef GL_ES
+precision highp float;
+#endif
+
+varying vec2 textureOut;
+
+/* The raw data, one byte per texel, with the stride as the texture width. */
+uniform sampler2D tex_y;
+/* Image size in pixels. */
+uniform vec2 tex_size;
+/* Line stride in bytes. */
+uniform float tex_stride;
+/* Coordinates of the red pixel in the top-left 2x2 pattern. */
+uniform vec2 tex_bayer_first_red;
+
+float fetch(float x, float y)
+{
+	/* Mirror the pixels at the edges to preserve the Bayer pattern. */
+	x = x < 0.0 ? x + 2.0 : (x >= tex_size.x ? x - 2.0 : x);
+	y = y < 0.0 ? y + 2.0 : (y >= tex_size.y ? y - 2.0 : y);
+
+#if defined(RAW_PACKED_GROUP)
+	/*
+	 * CSI-2 packed formats store the most significant bits of a group of
+	 * pixels in consecutive bytes, followed by one byte with the least
+	 * significant bits, which are ignored.
+	 */
+	x = floor(x / RAW_PACKED_GROUP) * (RAW_PACKED_GROUP + 1.0) +
+	    mod(x, RAW_PACKED_GROUP);
+#endif
+
+	return texture2D(tex_y, vec2((x + 0.5) / tex_stride,
+				     (y + 0.5) / tex_size.y)).r;
+}
+
+void main(void)
+{
+	vec2 pos = floor(textureOut * tex_size);
+
+	/*
+	 * Position in the 2x2 pattern relative to the red pixel, (0, 0) for
+	 * red, (1, 1) for blue and (1, 0) or (0, 1) for green.
+	 */
+	vec2 alt = mod(pos + tex_bayer_first_red, 2.0);
+
+	/* Bilinear interpolation of the missing components. */
+	float c = fetch(pos.x, pos.y);
+	float h = (fetch(pos.x - 1.0, pos.y) + fetch(pos.x + 1.0, pos.y)) / 2.0;
+	float v = (fetch(pos.x, pos.y - 1.0) + fetch(pos.x, pos.y + 1.0)) / 2.0;
+	float d = (fetch(pos.x - 1.0, pos.y - 1.0) + fetch(pos.x + 1.0, pos.y - 1.0) +
+		   fetch(pos.x - 1.0, pos.y + 1.0) + fetch(pos.x + 1.0, pos.y + 1.0)) / 4.0;
+	float cross = (h + v) / 2.0;
+
+	vec3 rgb;
+	if (alt.y == 0.0) {
+		if (alt.x == 0.0)
+			rgb = vec3(c, cross, d);
+		else
+			rgb = vec3(h, c, v);
+	} else {
+		if (alt.x == 0.0)
+			rgb = vec3(v, c, h);
+		else
+			rgb = vec3(d, cross, c);
+	}
+
+	gl_FragColor = vec4(rgb, 1.0);
+}
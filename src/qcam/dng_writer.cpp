@@ -17,6 +17,8 @@
 #include <libcamera/formats.h>
 #include <libcamera/property_ids.h>
 
+#include "libcamera/internal/bayer_unpack.h"
+
 using namespace libcamera;
 
 enum CFAPatternColour : uint8_t {
@@ -28,8 +30,7 @@ enum CFAPatternColour : uint8_t {
 struct FormatInfo {
 	uint8_t bitsPerSample;
 	CFAPatternColour pattern[4];
-	void (*packScanline)(void *output, const void *input,
-			     unsigned int width);
+	bayer::UnpackFunction unpackScanline;
 	void (*thumbScanline)(const FormatInfo &info, void *output,
 			      const void *input, unsigned int width,
 			      unsigned int stride);
@@ -126,34 +127,20 @@ struct Matrix3d {
 	float m[9];
 };
 
-void packScanlineSBGGR10P(void *output, const void *input, unsigned int width)
+/*
+ * Store the raw pixels as 16-bit samples, scaled to the full 16-bit range. The
+ * packed formats can't be copied to the DNG as-is, and unpacking them with the
+ * shared SIMD kernels is faster than repacking them bit by bit.
+ */
+void packScanline(const FormatInfo &info, uint16_t *output, const void *input,
+		  unsigned int width)
 {
-	const uint8_t *in = static_cast<const uint8_t *>(input);
-	uint8_t *out = static_cast<uint8_t *>(output);
+	unsigned int shift = 16 - info.bitsPerSample;
 
-	/* \todo Can this be made more efficient? */
-	for (unsigned int x = 0; x < width; x += 4) {
-		*out++ = in[0];
-		*out++ = (in[4] & 0x03) << 6 | in[1] >> 2;
-		*out++ = (in[1] & 0x03) << 6 | (in[4] & 0x0c) << 2 | in[2] >> 4;
-		*out++ = (in[2] & 0x0f) << 4 | (in[4] & 0x30) >> 2 | in[3] >> 6;
-		*out++ = (in[3] & 0x3f) << 2 | (in[4] & 0xc0) >> 6;
-		in += 5;
-	}
-}
-
-void packScanlineSBGGR12P(void *output, const void *input, unsigned int width)
-{
-	const uint8_t *in = static_cast<const uint8_t *>(input);
-	uint8_t *out = static_cast<uint8_t *>(output);
+	info.unpackScanline(output, static_cast<const uint8_t *>(input), width);
 
-	/* \todo Can this be made more efficient? */
-	for (unsigned int i = 0; i < width; i += 2) {
-		*out++ = in[0];
-		*out++ = (in[2] & 0x0f) << 4 | in[1] >> 4;
-		*out++ = (in[1] & 0x0f) << 4 | in[2] >> 4;
-		in += 3;
-	}
+	for (unsigned int x = 0; x < width; x++)
+		output[x] <<= shift;
 }
 
 void thumbScanlineSBGGRxxP(const FormatInfo &info, void *output,
@@ -175,47 +162,6 @@ void thumbScanlineSBGGRxxP(const FormatInfo &info, void *output,
 	}
 }
 
-void packScanlineIPU3(void *output, const void *input, unsigned int width)
-{
-	const uint8_t *in = static_cast<const uint8_t *>(input);
-	uint16_t *out = static_cast<uint16_t *>(output);
-
-	/*
-	 * Upscale the 10-bit format to 16-bit as it's not trivial to pack it
-	 * as 10-bit without gaps.
-	 *
-	 * \todo Improve packing to keep the 10-bit sample size.
-	 */
-	unsigned int x = 0;
-	while (true) {
-		for (unsigned int i = 0; i < 6; i++) {
-			*out++ = (in[1] & 0x03) << 14 | (in[0] & 0xff) << 6;
-			if (++x >= width)
-				return;
-
-			*out++ = (in[2] & 0x0f) << 12 | (in[1] & 0xfc) << 4;
-			if (++x >= width)
-				return;
-
-			*out++ = (in[3] & 0x3f) << 10 | (in[2] & 0xf0) << 2;
-			if (++x >= width)
-				return;
-
-			*out++ = (in[4] & 0xff) <<  8 | (in[3] & 0xc0) << 0;
-			if (++x >= width)
-				return;
-
-			in += 5;
-		}
-
-		*out++ = (in[1] & 0x03) << 14 | (in[0] & 0xff) << 6;
-		if (++x >= width)
-			return;
-
-		in += 2;
-	}
-}
-
 void thumbScanlineIPU3([[maybe_unused]] const FormatInfo &info, void *output,
 		       const void *input, unsigned int width,
 		       unsigned int stride)
@@ -277,73 +223,73 @@ static const std::map<PixelFormat, FormatInfo> formatInfo = {
 	{ formats::SBGGR10_CSI2P, {
 		.bitsPerSample = 10,
 		.pattern = { CFAPatternBlue, CFAPatternGreen, CFAPatternGreen, CFAPatternRed },
-		.packScanline = packScanlineSBGGR10P,
+		.unpackScanline = bayer::unpackCSI2P10,
 		.thumbScanline = thumbScanlineSBGGRxxP,
 	} },
 	{ formats::SGBRG10_CSI2P, {
 		.bitsPerSample = 10,
 		.pattern = { CFAPatternGreen, CFAPatternBlue, CFAPatternRed, CFAPatternGreen },
-		.packScanline = packScanlineSBGGR10P,
+		.unpackScanline = bayer::unpackCSI2P10,
 		.thumbScanline = thumbScanlineSBGGRxxP,
 	} },
 	{ formats::SGRBG10_CSI2P, {
 		.bitsPerSample = 10,
 		.pattern = { CFAPatternGreen, CFAPatternRed, CFAPatternBlue, CFAPatternGreen },
-		.packScanline = packScanlineSBGGR10P,
+		.unpackScanline = bayer::unpackCSI2P10,
 		.thumbScanline = thumbScanlineSBGGRxxP,
 	} },
 	{ formats::SRGGB10_CSI2P, {
 		.bitsPerSample = 10,
 		.pattern = { CFAPatternRed, CFAPatternGreen, CFAPatternGreen, CFAPatternBlue },
-		.packScanline = packScanlineSBGGR10P,
+		.unpackScanline = bayer::unpackCSI2P10,
 		.thumbScanline = thumbScanlineSBGGRxxP,
 	} },
 	{ formats::SBGGR12_CSI2P, {
 		.bitsPerSample = 12,
 		.pattern = { CFAPatternBlue, CFAPatternGreen, CFAPatternGreen, CFAPatternRed },
-		.packScanline = packScanlineSBGGR12P,
+		.unpackScanline = bayer::unpackCSI2P12,
 		.thumbScanline = thumbScanlineSBGGRxxP,
 	} },
 	{ formats::SGBRG12_CSI2P, {
 		.bitsPerSample = 12,
 		.pattern = { CFAPatternGreen, CFAPatternBlue, CFAPatternRed, CFAPatternGreen },
-		.packScanline = packScanlineSBGGR12P,
+		.unpackScanline = bayer::unpackCSI2P12,
 		.thumbScanline = thumbScanlineSBGGRxxP,
 	} },
 	{ formats::SGRBG12_CSI2P, {
 		.bitsPerSample = 12,
 		.pattern = { CFAPatternGreen, CFAPatternRed, CFAPatternBlue, CFAPatternGreen },
-		.packScanline = packScanlineSBGGR12P,
+		.unpackScanline = bayer::unpackCSI2P12,
 		.thumbScanline = thumbScanlineSBGGRxxP,
 	} },
 	{ formats::SRGGB12_CSI2P, {
 		.bitsPerSample = 12,
 		.pattern = { CFAPatternRed, CFAPatternGreen, CFAPatternGreen, CFAPatternBlue },
-		.packScanline = packScanlineSBGGR12P,
+		.unpackScanline = bayer::unpackCSI2P12,
 		.thumbScanline = thumbScanlineSBGGRxxP,
 	} },
 	{ formats::SBGGR10_IPU3, {
-		.bitsPerSample = 16,
+		.bitsPerSample = 10,
 		.pattern = { CFAPatternBlue, CFAPatternGreen, CFAPatternGreen, CFAPatternRed },
-		.packScanline = packScanlineIPU3,
+		.unpackScanline = bayer::unpackIPU3,
 		.thumbScanline = thumbScanlineIPU3,
 	} },
 	{ formats::SGBRG10_IPU3, {
-		.bitsPerSample = 16,
+		.bitsPerSample = 10,
 		.pattern = { CFAPatternGreen, CFAPatternBlue, CFAPatternRed, CFAPatternGreen },
-		.packScanline = packScanlineIPU3,
+		.unpackScanline = bayer::unpackIPU3,
 		.thumbScanline = thumbScanlineIPU3,
 	} },
 	{ formats::SGRBG10_IPU3, {
-		.bitsPerSample = 16,
+		.bitsPerSample = 10,
 		.pattern = { CFAPatternGreen, CFAPatternRed, CFAPatternBlue, CFAPatternGreen },
-		.packScanline = packScanlineIPU3,
+		.unpackScanline = bayer::unpackIPU3,
 		.thumbScanline = thumbScanlineIPU3,
 	} },
 	{ formats::SRGGB10_IPU3, {
-		.bitsPerSample = 16,
+		.bitsPerSample = 10,
 		.pattern = { CFAPatternRed, CFAPatternGreen, CFAPatternGreen, CFAPatternBlue },
-		.packScanline = packScanlineIPU3,
+		.unpackScanline = bayer::unpackIPU3,
 		.thumbScanline = thumbScanlineIPU3,
 	} },
 };
@@ -371,10 +317,10 @@ int DNGWriter::write(const char *filename, const Camera *camera,
 
 	/*
 	 * Scanline buffer, has to be large enough to store both a RAW scanline
-	 * or a thumbnail scanline. The latter will always be much smaller than
-	 * the former as we downscale by 16 in both directions.
+	 * of 16-bit samples or a thumbnail scanline. The latter will always be
+	 * much smaller than the former as we downscale by 16 in both directions.
 	 */
-	uint8_t scanline[(config.size.width * info->bitsPerSample + 7) / 8];
+	uint16_t scanline[config.size.width];
 
 	toff_t rawIFDOffset = 0;
 	toff_t exifIFDOffset = 0;
@@ -499,7 +445,7 @@ int DNGWriter::write(const char *filename, const Camera *camera,
 	TIFFSetField(tif, TIFFTAG_SUBFILETYPE, 0);
 	TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, config.size.width);
 	TIFFSetField(tif, TIFFTAG_IMAGELENGTH, config.size.height);
-	TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, info->bitsPerSample);
+	TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 16);
 	TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
 	TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_CFA);
 	TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1);
@@ -512,7 +458,8 @@ int DNGWriter::write(const char *filename, const Camera *camera,
 
 	const uint16_t blackLevelRepeatDim[] = { 2, 2 };
 	float blackLevel[] = { 0.0f, 0.0f, 0.0f, 0.0f };
-	uint32_t whiteLevel = (1 << info->bitsPerSample) - 1;
+	uint32_t whiteLevel = ((1 << info->bitsPerSample) - 1)
+			    << (16 - info->bitsPerSample);
 
 	if (metadata.contains(controls::SensorBlackLevels)) {
 		Span<const int32_t> levels = metadata.get(controls::SensorBlackLevels);
@@ -543,8 +490,8 @@ int DNGWriter::write(const char *filename, const Camera *camera,
 				break;
 			}
 
-			/* Map the 16-bit value to the bits per sample range. */
-			blackLevel[i] = level >> (16 - info->bitsPerSample);
+			/* The samples are stored as 16-bit values. */
+			blackLevel[i] = level;
 		}
 	}
 
@@ -555,9 +502,9 @@ int DNGWriter::write(const char *filename, const Camera *camera,
 	/* Write RAW content. */
 	row = static_cast<const uint8_t *>(data);
 	for (unsigned int y = 0; y < config.size.height; y++) {
-		info->packScanline(&scanline, row, config.size.width);
+		packScanline(*info, scanline, row, config.size.width);
 
-		if (TIFFWriteScanline(tif, &scanline, y, 0) != 1) {
+		if (TIFFWriteScanline(tif, scanline, y, 0) != 1) {
 			std::cerr << "Failed to write RAW scanline"
 				  << std::endl;
 			TIFFClose(tif);
@@ -615,3 +562,88 @@ int DNGWriter::write(const char *filename, const Camera *camera,
 
 	return 0;
 }
+
+/*
+ * Writing a DNG file takes long enough to stall the viewfinder when done in
+ * the GUI thread. The DNGWorker writes files from a pool of threads, and calls
+ * the done function from the worker thread once a buffer isn't needed anymore.
+ */
+DNGWorker::DNGWorker(DoneFunc done)
+	: done_(std::move(done)), active_(0), stopping_(false)
+{
+	/* Use a few threads to sustain bursts, leaving CPUs for the capture. */
+	unsigned int numThreads =
+		std::clamp(std::thread::hardware_concurrency() / 2, 1U, 4U);
+
+	for (unsigned int i = 0; i < numThreads; i++)
+		threads_.emplace_back(&DNGWorker::run, this);
+}
+
+DNGWorker::~DNGWorker()
+{
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		stopping_ = true;
+	}
+
+	cond_.notify_all();
+
+	for (std::thread &thread : threads_)
+		thread.join();
+}
+
+void DNGWorker::write(const std::string &filename,
+		      std::shared_ptr<Camera> camera,
+		      const StreamConfiguration &config,
+		      const ControlList &metadata, FrameBuffer *buffer,
+		      const void *data)
+{
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		jobs_.push({ filename, std::move(camera), config, metadata,
+			     buffer, data });
+	}
+
+	cond_.notify_one();
+}
+
+/* Wait until all the queued files have been written. */
+void DNGWorker::flush()
+{
+	std::unique_lock<std::mutex> locker(mutex_);
+	idle_.wait(locker, [&] { return jobs_.empty() && !active_; });
+}
+
+void DNGWorker::run()
+{
+	std::unique_lock<std::mutex> locker(mutex_);
+
+	while (true) {
+		cond_.wait(locker, [&] { return stopping_ || !jobs_.empty(); });
+
+		/* Finish writing the queued files before stopping. */
+		if (jobs_.empty())
+			return;
+
+		Job job = std::move(jobs_.front());
+		jobs_.pop();
+		active_++;
+
+		locker.unlock();
+
+		int ret = DNGWriter::write(job.filename.c_str(), job.camera.get(),
+					   job.config, job.metadata, job.buffer,
+					   job.data);
+		if (ret < 0)
+			std::cerr << "Failed to write " << job.filename
+				  << std::endl;
+
+		done_(job.buffer, ret);
+
+		locker.lock();
+
+		active_--;
+		if (jobs_.empty() && !active_)
+			idle_.notify_all();
+	}
+}
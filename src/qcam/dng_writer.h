@@ -10,6 +10,15 @@
 #ifdef HAVE_TIFF
 #define HAVE_DNG
 
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include <libcamera/buffer.h>
 #include <libcamera/camera.h>
 #include <libcamera/controls.h>
@@ -26,6 +35,44 @@ public:
 			 const FrameBuffer *buffer, const void *data);
 };
 
+class DNGWorker
+{
+public:
+	using DoneFunc = std::function<void(FrameBuffer *buffer, int ret)>;
+
+	DNGWorker(DoneFunc done);
+	~DNGWorker();
+
+	void write(const std::string &filename, std::shared_ptr<Camera> camera,
+		   const StreamConfiguration &config,
+		   const ControlList &metadata, FrameBuffer *buffer,
+		   const void *data);
+	void flush();
+
+private:
+	struct Job {
+		std::string filename;
+		std::shared_ptr<Camera> camera;
+		StreamConfiguration config;
+		ControlList metadata;
+		FrameBuffer *buffer;
+		const void *data;
+	};
+
+	void run();
+
+	DoneFunc done_;
+	std::vector<std::thread> threads_;
+
+	/* Protects the jobs queue and the worker state. */
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	std::condition_variable idle_;
+	std::queue<Job> jobs_;
+	unsigned int active_;
+	bool stopping_;
+};
+
 #endif /* HAVE_TIFF */
 
 #endif /* __QCAM_DNG_WRITER_H__ */
@@ -7,7 +7,13 @@
 
 #include "format_converter.h"
 
+#include <algorithm>
 #include <errno.h>
+#include <utility>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <QImage>
 
@@ -27,8 +33,44 @@
 #define CLIP(x)			CLAMP(x,0,255)
 #endif
 
+/*
+ * Converting large frames on the GUI thread limits the frame rate of the Qt
+ * viewfinder. Rows are converted independently, split in bands that are
+ * processed concurrently by the calling thread and a small pool of workers.
+ */
+FormatConverter::FormatConverter()
+	: width_(0), height_(0), downscale_(1), outWidth_(0), outHeight_(0),
+	  src_(nullptr), dst_(nullptr), sequence_(0), pending_(0),
+	  stopping_(false)
+{
+	/* Leave CPUs for the capture and the rest of the GUI. */
+	unsigned int numBands =
+		std::clamp(std::thread::hardware_concurrency() / 2, 1U, 4U);
+
+	for (unsigned int band = 1; band < numBands; band++)
+		threads_.emplace_back(&FormatConverter::run, this, band);
+}
+
+FormatConverter::~FormatConverter()
+{
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		stopping_ = true;
+	}
+
+	cond_.notify_all();
+
+	for (std::thread &thread : threads_)
+		thread.join();
+}
+
+/*
+ * The downscale factor skips source pixels in both directions, to convert only
+ * the resolution that will be displayed. The resulting image size is reported
+ * by outputSize().
+ */
 int FormatConverter::configure(const libcamera::PixelFormat &format,
-			       const QSize &size)
+			       const QSize &size, unsigned int downscale)
 {
 	switch (format) {
 	case libcamera::formats::NV12:
@@ -151,28 +193,83 @@ int FormatConverter::configure(const libcamera::PixelFormat &format,
 	width_ = size.width();
 	height_ = size.height();
 
+	/* Compressed formats are decoded at full resolution. */
+	downscale_ = formatFamily_ == MJPEG ? 1 : std::max(downscale, 1U);
+	outWidth_ = width_ / downscale_;
+	outHeight_ = height_ / downscale_;
+
 	return 0;
 }
 
 void FormatConverter::convert(const unsigned char *src, size_t size,
 			      QImage *dst)
 {
-	switch (formatFamily_) {
-	case MJPEG:
+	if (formatFamily_ == MJPEG) {
 		dst->loadFromData(src, size, "JPEG");
-		break;
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		src_ = src;
+		dst_ = dst->bits();
+		pending_ = threads_.size();
+		sequence_++;
+	}
+
+	cond_.notify_all();
+
+	convertBand(0);
+
+	std::unique_lock<std::mutex> locker(mutex_);
+	done_.wait(locker, [&] { return !pending_; });
+}
+
+void FormatConverter::convertBand(unsigned int band)
+{
+	unsigned int numBands = threads_.size() + 1;
+	unsigned int first = outHeight_ * band / numBands;
+	unsigned int last = outHeight_ * (band + 1) / numBands;
+
+	switch (formatFamily_) {
 	case YUV:
-		convertYUV(src, dst->bits());
+		convertYUV(src_, dst_, first, last);
 		break;
 	case RGB:
-		convertRGB(src, dst->bits());
+		convertRGB(src_, dst_, first, last);
 		break;
 	case NV:
-		convertNV(src, dst->bits());
+		convertNV(src_, dst_, first, last);
+		break;
+	default:
 		break;
 	};
 }
 
+void FormatConverter::run(unsigned int band)
+{
+	std::unique_lock<std::mutex> locker(mutex_);
+	unsigned int sequence = 0;
+
+	while (true) {
+		cond_.wait(locker, [&] {
+			return stopping_ || sequence != sequence_;
+		});
+
+		if (stopping_)
+			return;
+
+		sequence = sequence_;
+
+		locker.unlock();
+		convertBand(band);
+		locker.lock();
+
+		if (!--pending_)
+			done_.notify_one();
+	}
+}
+
 static void yuv_to_rgb(int y, int u, int v, int *r, int *g, int *b)
 {
 	int c = y - 16;
@@ -183,102 +280,188 @@ static void yuv_to_rgb(int y, int u, int v, int *r, int *g, int *b)
 	*b = CLIP(( 298 * c + 516 * d           + 128) >> RGBSHIFT);
 }
 
-void FormatConverter::convertNV(const unsigned char *src, unsigned char *dst)
+#ifdef __SSE2__
+/*
+ * Convert 8 pixels from 16-bit Y, U and V components to BGRA, with the same
+ * fixed-point arithmetic as yuv_to_rgb().
+ */
+static inline void yuv_to_rgb_x8(__m128i y, __m128i u, __m128i v,
+				 unsigned char *dst)
+{
+	__m128i c = _mm_sub_epi16(y, _mm_set1_epi16(16));
+	__m128i d = _mm_sub_epi16(u, _mm_set1_epi16(128));
+	__m128i e = _mm_sub_epi16(v, _mm_set1_epi16(128));
+
+	/* Pair the operands to compute each sum with 32-bit madd. */
+	__m128i cdLo = _mm_unpacklo_epi16(c, d);
+	__m128i cdHi = _mm_unpackhi_epi16(c, d);
+	__m128i e1Lo = _mm_unpacklo_epi16(e, _mm_set1_epi16(1));
+	__m128i e1Hi = _mm_unpackhi_epi16(e, _mm_set1_epi16(1));
+
+	auto channel = [&](int cy, int cu, int cv) {
+		__m128i cd = _mm_set1_epi32((cu << 16) | (cy & 0xffff));
+		__m128i e1 = _mm_set1_epi32((128 << 16) | (cv & 0xffff));
+
+		__m128i lo = _mm_add_epi32(_mm_madd_epi16(cdLo, cd),
+					   _mm_madd_epi16(e1Lo, e1));
+		__m128i hi = _mm_add_epi32(_mm_madd_epi16(cdHi, cd),
+					   _mm_madd_epi16(e1Hi, e1));
+
+		lo = _mm_srai_epi32(lo, RGBSHIFT);
+		hi = _mm_srai_epi32(hi, RGBSHIFT);
+
+		__m128i val = _mm_packs_epi32(lo, hi);
+		return _mm_packus_epi16(val, val);
+	};
+
+	__m128i r = channel(298, 0, 409);
+	__m128i g = channel(298, -100, -208);
+	__m128i b = channel(298, 516, 0);
+
+	__m128i bg = _mm_unpacklo_epi8(b, g);
+	__m128i ra = _mm_unpacklo_epi8(r, _mm_set1_epi8(-1));
+
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+			 _mm_unpacklo_epi16(bg, ra));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16),
+			 _mm_unpackhi_epi16(bg, ra));
+}
+
+/* Duplicate the low 16 bits of each 32-bit lane into the high 16 bits. */
+static inline __m128i dup_lo16(__m128i x)
+{
+	x = _mm_and_si128(x, _mm_set1_epi32(0xffff));
+	return _mm_or_si128(x, _mm_slli_epi32(x, 16));
+}
+#endif /* __SSE2__ */
+
+void FormatConverter::convertNV(const unsigned char *src, unsigned char *dst,
+				unsigned int first, unsigned int last)
 {
 	unsigned int c_stride = width_ * (2 / horzSubSample_);
-	unsigned int c_inc = horzSubSample_ == 1 ? 2 : 0;
 	unsigned int cb_pos = nvSwap_ ? 1 : 0;
 	unsigned int cr_pos = nvSwap_ ? 0 : 1;
 	const unsigned char *src_c = src + width_ * height_;
 	int r, g, b;
 
-	for (unsigned int y = 0; y < height_; y++) {
-		const unsigned char *src_y = src + y * width_;
-		const unsigned char *src_cb = src_c + (y / vertSubSample_) *
-					      c_stride + cb_pos;
-		const unsigned char *src_cr = src_c + (y / vertSubSample_) *
-					      c_stride + cr_pos;
-
-		for (unsigned int x = 0; x < width_; x += 2) {
-			yuv_to_rgb(*src_y, *src_cb, *src_cr, &r, &g, &b);
-			dst[0] = b;
-			dst[1] = g;
-			dst[2] = r;
-			dst[3] = 0xff;
-			src_y++;
-			src_cb += c_inc;
-			src_cr += c_inc;
-			dst += 4;
-
-			yuv_to_rgb(*src_y, *src_cb, *src_cr, &r, &g, &b);
-			dst[0] = b;
-			dst[1] = g;
-			dst[2] = r;
-			dst[3] = 0xff;
-			src_y++;
-			src_cb += 2;
-			src_cr += 2;
-			dst += 4;
+	for (unsigned int y = first; y < last; y++) {
+		unsigned int sy = y * downscale_;
+		const unsigned char *src_y = src + sy * width_;
+		const unsigned char *src_cbcr = src_c + (sy / vertSubSample_) *
+						c_stride;
+		unsigned char *dst_y = dst + y * outWidth_ * 4;
+		unsigned int x = 0;
+
+#ifdef __SSE2__
+		for (; downscale_ == 1 && x + 8 <= outWidth_; x += 8) {
+			__m128i zero = _mm_setzero_si128();
+			__m128i luma = _mm_unpacklo_epi8(
+				_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src_y + x)),
+				zero);
+			__m128i cb, cr;
+
+			if (horzSubSample_ == 2) {
+				/* 4 CbCr pairs, one per 2 pixels. */
+				__m128i c = _mm_unpacklo_epi8(
+					_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src_cbcr + x)),
+					zero);
+				cb = dup_lo16(c);
+				cr = dup_lo16(_mm_srli_epi32(c, 16));
+			} else {
+				/* 8 CbCr pairs, one per pixel. */
+				__m128i c = _mm_loadu_si128(
+					reinterpret_cast<const __m128i *>(src_cbcr + x * 2));
+				cb = _mm_and_si128(c, _mm_set1_epi16(0xff));
+				cr = _mm_srli_epi16(c, 8);
+			}
+
+			if (nvSwap_)
+				std::swap(cb, cr);
+
+			yuv_to_rgb_x8(luma, cb, cr, dst_y + x * 4);
+		}
+#endif
+
+		for (; x < outWidth_; x++) {
+			unsigned int sx = x * downscale_;
+			unsigned int cx = sx / horzSubSample_ * 2;
+
+			yuv_to_rgb(src_y[sx], src_cbcr[cx + cb_pos],
+				   src_cbcr[cx + cr_pos], &r, &g, &b);
+			dst_y[4 * x + 0] = b;
+			dst_y[4 * x + 1] = g;
+			dst_y[4 * x + 2] = r;
+			dst_y[4 * x + 3] = 0xff;
 		}
 	}
 }
 
-void FormatConverter::convertRGB(const unsigned char *src, unsigned char *dst)
+void FormatConverter::convertRGB(const unsigned char *src, unsigned char *dst,
+				 unsigned int first, unsigned int last)
 {
 	unsigned int x, y;
 	int r, g, b;
 
-	for (y = 0; y < height_; y++) {
-		for (x = 0; x < width_; x++) {
-			r = src[bpp_ * x + r_pos_];
-			g = src[bpp_ * x + g_pos_];
-			b = src[bpp_ * x + b_pos_];
+	for (y = first; y < last; y++) {
+		const unsigned char *src_y = src + y * downscale_ * width_ * bpp_;
+		unsigned char *dst_y = dst + y * outWidth_ * 4;
 
-			dst[4 * x + 0] = b;
-			dst[4 * x + 1] = g;
-			dst[4 * x + 2] = r;
-			dst[4 * x + 3] = 0xff;
-		}
+		for (x = 0; x < outWidth_; x++) {
+			const unsigned char *pixel = src_y + bpp_ * x * downscale_;
+
+			r = pixel[r_pos_];
+			g = pixel[g_pos_];
+			b = pixel[b_pos_];
 
-		src += width_ * bpp_;
-		dst += width_ * 4;
+			dst_y[4 * x + 0] = b;
+			dst_y[4 * x + 1] = g;
+			dst_y[4 * x + 2] = r;
+			dst_y[4 * x + 3] = 0xff;
+		}
 	}
 }
 
-void FormatConverter::convertYUV(const unsigned char *src, unsigned char *dst)
+void FormatConverter::convertYUV(const unsigned char *src, unsigned char *dst,
+				 unsigned int first, unsigned int last)
 {
-	unsigned int src_x, src_y, dst_x, dst_y;
-	unsigned int src_stride;
-	unsigned int dst_stride;
-	unsigned int cr_pos;
-	int r, g, b, y, cr, cb;
-
-	cr_pos = (cb_pos_ + 2) % 4;
-	src_stride = width_ * 2;
-	dst_stride = width_ * 4;
-
-	for (src_y = 0, dst_y = 0; dst_y < height_; src_y++, dst_y++) {
-		for (src_x = 0, dst_x = 0; dst_x < width_; ) {
-			cb = src[src_y * src_stride + src_x * 4 + cb_pos_];
-			cr = src[src_y * src_stride + src_x * 4 + cr_pos];
-
-			y = src[src_y * src_stride + src_x * 4 + y_pos_];
-			yuv_to_rgb(y, cb, cr, &r, &g, &b);
-			dst[dst_y * dst_stride + 4 * dst_x + 0] = b;
-			dst[dst_y * dst_stride + 4 * dst_x + 1] = g;
-			dst[dst_y * dst_stride + 4 * dst_x + 2] = r;
-			dst[dst_y * dst_stride + 4 * dst_x + 3] = 0xff;
-			dst_x++;
-
-			y = src[src_y * src_stride + src_x * 4 + y_pos_ + 2];
-			yuv_to_rgb(y, cb, cr, &r, &g, &b);
-			dst[dst_y * dst_stride + 4 * dst_x + 0] = b;
-			dst[dst_y * dst_stride + 4 * dst_x + 1] = g;
-			dst[dst_y * dst_stride + 4 * dst_x + 2] = r;
-			dst[dst_y * dst_stride + 4 * dst_x + 3] = 0xff;
-			dst_x++;
-
-			src_x++;
+	unsigned int src_stride = width_ * 2;
+	unsigned int cr_pos = (cb_pos_ + 2) % 4;
+	int r, g, b;
+
+	for (unsigned int y = first; y < last; y++) {
+		const unsigned char *src_y = src + y * downscale_ * src_stride;
+		unsigned char *dst_y = dst + y * outWidth_ * 4;
+		unsigned int x = 0;
+
+#ifdef __SSE2__
+		for (; downscale_ == 1 && x + 8 <= outWidth_; x += 8) {
+			/* 4 macropixels of 2 luma and 2 chroma samples. */
+			__m128i pixels = _mm_loadu_si128(
+				reinterpret_cast<const __m128i *>(src_y + x * 2));
+			__m128i luma = y_pos_ ? _mm_srli_epi16(pixels, 8)
+					      : _mm_and_si128(pixels, _mm_set1_epi16(0xff));
+			__m128i cb = dup_lo16(_mm_and_si128(
+				_mm_srl_epi32(pixels, _mm_cvtsi32_si128(cb_pos_ * 8)),
+				_mm_set1_epi32(0xff)));
+			__m128i cr = dup_lo16(_mm_and_si128(
+				_mm_srl_epi32(pixels, _mm_cvtsi32_si128(cr_pos * 8)),
+				_mm_set1_epi32(0xff)));
+
+			yuv_to_rgb_x8(luma, cb, cr, dst_y + x * 4);
+		}
+#endif
+
+		for (; x < outWidth_; x++) {
+			unsigned int sx = x * downscale_;
+			const unsigned char *macropixel = src_y + sx / 2 * 4;
+
+			yuv_to_rgb(macropixel[y_pos_ + (sx & 1) * 2],
+				   macropixel[cb_pos_], macropixel[cr_pos],
+				   &r, &g, &b);
+			dst_y[4 * x + 0] = b;
+			dst_y[4 * x + 1] = g;
+			dst_y[4 * x + 2] = r;
+			dst_y[4 * x + 3] = 0xff;
 		}
 	}
 }
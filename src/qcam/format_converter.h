@@ -7,7 +7,11 @@
 #ifndef __QCAM_FORMAT_CONVERTER_H__
 #define __QCAM_FORMAT_CONVERTER_H__
 
+#include <condition_variable>
+#include <mutex>
 #include <stddef.h>
+#include <thread>
+#include <vector>
 
 #include <QSize>
 
@@ -18,7 +22,12 @@ class QImage;
 class FormatConverter
 {
 public:
-	int configure(const libcamera::PixelFormat &format, const QSize &size);
+	FormatConverter();
+	~FormatConverter();
+
+	int configure(const libcamera::PixelFormat &format, const QSize &size,
+		      unsigned int downscale = 1);
+	QSize outputSize() const { return QSize(outWidth_, outHeight_); }
 
 	void convert(const unsigned char *src, size_t size, QImage *dst);
 
@@ -30,13 +39,22 @@ private:
 		YUV,
 	};
 
-	void convertNV(const unsigned char *src, unsigned char *dst);
-	void convertRGB(const unsigned char *src, unsigned char *dst);
-	void convertYUV(const unsigned char *src, unsigned char *dst);
+	void convertBand(unsigned int band);
+	void convertNV(const unsigned char *src, unsigned char *dst,
+		       unsigned int first, unsigned int last);
+	void convertRGB(const unsigned char *src, unsigned char *dst,
+			unsigned int first, unsigned int last);
+	void convertYUV(const unsigned char *src, unsigned char *dst,
+			unsigned int first, unsigned int last);
+
+	void run(unsigned int band);
 
 	libcamera::PixelFormat format_;
 	unsigned int width_;
 	unsigned int height_;
+	unsigned int downscale_;
+	unsigned int outWidth_;
+	unsigned int outHeight_;
 
 	enum FormatFamily formatFamily_;
 
@@ -54,6 +72,17 @@ private:
 	/* YUV parameters */
 	unsigned int y_pos_;
 	unsigned int cb_pos_;
+
+	/* Worker threads, each converting one band of rows */
+	std::vector<std::thread> threads_;
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	std::condition_variable done_;
+	const unsigned char *src_;
+	unsigned char *dst_;
+	unsigned int sequence_;
+	unsigned int pending_;
+	bool stopping_;
 };
 
 #endif /* __QCAM_FORMAT_CONVERTER_H__ */
@@ -7,6 +7,7 @@
 
 #include "main_window.h"
 
+#include <chrono>
 #include <iomanip>
 #include <string>
 #include <sys/mman.h>
@@ -14,6 +15,7 @@
 #include <QComboBox>
 #include <QCoreApplication>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QImage>
 #include <QImageWriter>
 #include <QInputDialog>
@@ -94,11 +96,24 @@ private:
 };
 
 MainWindow::MainWindow(CameraManager *cm, const OptionsParser::Options &options)
-	: saveRaw_(nullptr), options_(options), cm_(cm), allocator_(nullptr),
-	  isCapturing_(false), captureRaw_(false)
+	: saveRaw_(nullptr), saveRawBurst_(nullptr), options_(options), cm_(cm),
+	  allocator_(nullptr), isCapturing_(false), captureRaw_(0), rawCount_(0),
+	  rawIndex_(0)
 {
 	int ret;
 
+#ifdef HAVE_DNG
+	/*
+	 * Raw frames are written to disk in the background, return the buffers
+	 * for capture when done.
+	 */
+	dngWorker_ = std::make_unique<DNGWorker>(
+		[this](FrameBuffer *buffer, [[maybe_unused]] int ret) {
+			QMutexLocker locker(&mutex_);
+			freeBuffers_[rawStream_].enqueue(buffer);
+		});
+#endif
+
 	/*
 	 * Initialize the UI: Create the toolbar, set the window title and
 	 * create the viewfinder widget.
@@ -116,6 +131,7 @@ MainWindow::MainWindow(CameraManager *cm, const OptionsParser::Options &options)
 
 	if (renderType == "qt") {
 		ViewFinderQt *viewfinder = new ViewFinderQt(this);
+		viewfinder->setDownscale(options_.isSet(OptDownscale));
 		connect(viewfinder, &ViewFinderQt::renderComplete,
 			this, &MainWindow::queueRequest);
 		viewfinder_ = viewfinder;
@@ -228,6 +244,12 @@ int MainWindow::createToolbars()
 	action->setEnabled(false);
 	connect(action, &QAction::triggered, this, &MainWindow::captureRaw);
 	saveRaw_ = action;
+
+	/* Save Raw Burst action. */
+	action = toolbar_->addAction(QIcon(":layers.svg"), "Save Raw Burst");
+	action->setEnabled(false);
+	connect(action, &QAction::triggered, this, &MainWindow::captureRawBurst);
+	saveRawBurst_ = action;
 #endif
 
 	return 0;
@@ -446,7 +468,8 @@ int MainWindow::startCapture()
 
 	/* Configure the viewfinder. */
 	ret = viewfinder_->setFormat(vfConfig.pixelFormat,
-				     QSize(vfConfig.size.width, vfConfig.size.height));
+				     QSize(vfConfig.size.width, vfConfig.size.height),
+				     vfConfig.stride);
 	if (ret < 0) {
 		qInfo() << "Failed to set viewfinder format";
 		return ret;
@@ -457,6 +480,8 @@ int MainWindow::startCapture()
 	/* Configure the raw capture button. */
 	if (saveRaw_)
 		saveRaw_->setEnabled(config_->size() == 2);
+	if (saveRawBurst_)
+		saveRawBurst_->setEnabled(config_->size() == 2);
 
 	/* Allocate and map buffers. */
 	allocator_ = new FrameBufferAllocator(camera_);
@@ -507,6 +532,7 @@ int MainWindow::startCapture()
 	previousFrames_ = 0;
 	framesCaptured_ = 0;
 	lastBufferTime_ = 0;
+	lastSequence_ = 0;
 
 	ret = camera_->start();
 	if (ret) {
@@ -517,12 +543,16 @@ int MainWindow::startCapture()
 	camera_->requestCompleted.connect(this, &MainWindow::requestComplete);
 
 	/* Queue all requests. */
-	for (std::unique_ptr<Request> &request : requests_) {
-		ret = camera_->queueRequest(request.get());
-		if (ret < 0) {
-			qWarning() << "Can't queue request";
-			goto error_disconnect;
-		}
+	{
+		std::vector<Request *> requests;
+		for (std::unique_ptr<Request> &request : requests_)
+			requests.push_back(request.get());
+
+		ret = camera_->queueRequests(requests);
+	}
+	if (ret < 0) {
+		qWarning() << "Can't queue requests";
+		goto error_disconnect;
 	}
 
 	isCapturing_ = true;
@@ -564,14 +594,28 @@ void MainWindow::stopCapture()
 	viewfinder_->stop();
 	if (saveRaw_)
 		saveRaw_->setEnabled(false);
-	captureRaw_ = false;
+	if (saveRawBurst_)
+		saveRawBurst_->setEnabled(false);
+	captureRaw_ = 0;
 
 	int ret = camera_->stop();
 	if (ret)
 		qInfo() << "Failed to stop capture";
 
+	qInfo().noquote()
+		<< QString::fromStdString("Camera counters:\n" +
+					  camera_->performance().toString());
+	qInfo().noquote()
+		<< QString::fromStdString("Global counters:\n" +
+					  cm_->performance().toString());
+
 	camera_->requestCompleted.disconnect(this, &MainWindow::requestComplete);
 
+#ifdef HAVE_DNG
+	/* Wait for the raw frames to be written before unmapping the buffers. */
+	dngWorker_->flush();
+#endif
+
 	for (auto &iter : mappedBuffers_) {
 		const MappedBuffer &buffer = iter.second;
 		munmap(buffer.memory, buffer.size);
@@ -661,29 +705,67 @@ void MainWindow::saveImageAs()
 
 void MainWindow::captureRaw()
 {
-	captureRaw_ = true;
+	startRawCapture(1);
 }
 
-void MainWindow::processRaw(FrameBuffer *buffer,
-			    [[maybe_unused]] const ControlList &metadata)
+void MainWindow::captureRawBurst()
+{
+	bool ok;
+	int count = QInputDialog::getInt(this, "Save Raw Burst",
+					 "Number of frames:", 10, 2, 1000, 1,
+					 &ok);
+	if (!ok)
+		return;
+
+	startRawCapture(count);
+}
+
+/*
+ * Select the file name before capturing, to let the raw frames be written in
+ * the background as soon as they're captured. The frames of a burst are saved
+ * to separate files, numbered after the selected name.
+ */
+void MainWindow::startRawCapture(unsigned int count)
 {
-#ifdef HAVE_DNG
 	QString defaultPath = QStandardPaths::writableLocation(QStandardPaths::PicturesLocation);
 	QString filename = QFileDialog::getSaveFileName(this, "Save DNG", defaultPath,
 							"DNG Files (*.dng)");
 
-	if (!filename.isEmpty()) {
-		const MappedBuffer &mapped = mappedBuffers_[buffer];
-		DNGWriter::write(filename.toStdString().c_str(), camera_.get(),
-				 rawStream_->configuration(), metadata, buffer,
-				 mapped.memory);
-	}
-#endif
+	/* Capture may have been stopped while the dialog was open. */
+	if (filename.isEmpty() || !isCapturing_)
+		return;
 
-	{
-		QMutexLocker locker(&mutex_);
-		freeBuffers_[rawStream_].enqueue(buffer);
+	rawFilename_ = filename;
+	rawCount_ = count;
+	rawIndex_ = 0;
+	captureRaw_ = count;
+}
+
+void MainWindow::processRaw(FrameBuffer *buffer,
+			    [[maybe_unused]] const ControlList &metadata)
+{
+#ifdef HAVE_DNG
+	QString filename = rawFilename_;
+
+	if (rawCount_ > 1) {
+		QFileInfo info(rawFilename_);
+		QString suffix = info.suffix().isEmpty() ? "" : "." + info.suffix();
+
+		filename = info.path() + "/" + info.completeBaseName()
+			 + QString("-%1").arg(rawIndex_, 4, 10, QLatin1Char('0'))
+			 + suffix;
 	}
+
+	rawIndex_++;
+
+	const MappedBuffer &mapped = mappedBuffers_[buffer];
+	dngWorker_->write(filename.toStdString(), camera_,
+			  rawStream_->configuration(), metadata, buffer,
+			  mapped.memory);
+#else
+	QMutexLocker locker(&mutex_);
+	freeBuffers_[rawStream_].enqueue(buffer);
+#endif
 }
 
 /* -----------------------------------------------------------------------------
@@ -695,16 +777,37 @@ void MainWindow::requestComplete(Request *request)
 	if (request->status() == Request::RequestCancelled)
 		return;
 
+	framesCaptured_++;
+
 	/*
 	 * We're running in the libcamera thread context, expensive operations
 	 * are not allowed. Add the buffer to the done queue and post a
 	 * CaptureEvent for the application thread to handle.
+	 *
+	 * Only the most recent frame is worth displaying. If the previous
+	 * request hasn't been processed by the application thread yet, the
+	 * viewfinder is falling behind: replace that request in the done queue
+	 * and give its buffer back to the camera immediately, so that capture
+	 * keeps running at the sensor rate. Requests carrying a raw buffer are
+	 * kept, as their frame needs to be saved.
 	 */
+	Request *dropped = nullptr;
 	{
 		QMutexLocker locker(&mutex_);
+		if (!doneQueue_.isEmpty() &&
+		    !doneQueue_.last()->buffers().count(rawStream_))
+			dropped = doneQueue_.takeLast();
+
 		doneQueue_.enqueue(request);
 	}
 
+	/* The CaptureEvent posted for the dropped request covers this one. */
+	if (dropped) {
+		dropped->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(dropped);
+		return;
+	}
+
 	QCoreApplication::postEvent(this, new CaptureEvent);
 }
 
@@ -738,19 +841,33 @@ void MainWindow::processCapture()
 
 void MainWindow::processViewfinder(FrameBuffer *buffer)
 {
-	framesCaptured_++;
-
 	const FrameMetadata &metadata = buffer->metadata();
 
+	/*
+	 * Frames may have been dropped since the last displayed frame, compute
+	 * the frame rate from the sequence numbers to report the capture rate.
+	 */
+	unsigned int frames = lastBufferTime_ ? metadata.sequence - lastSequence_ : 0;
 	double fps = metadata.timestamp - lastBufferTime_;
-	fps = lastBufferTime_ && fps ? 1000000000.0 / fps : 0.0;
+	fps = frames && fps ? 1000000000.0 * frames / fps : 0.0;
 	lastBufferTime_ = metadata.timestamp;
+	lastSequence_ = metadata.sequence;
+
+	/*
+	 * The buffer timestamps are sampled from the monotonic clock, report
+	 * the latency from capture to rendering.
+	 */
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	double latency = (std::chrono::duration_cast<std::chrono::nanoseconds>(now).count()
+			  - static_cast<int64_t>(metadata.timestamp)) / 1000000.0;
 
 	qDebug().noquote()
 		<< QString("seq: %1").arg(metadata.sequence, 6, 10, QLatin1Char('0'))
-		<< "bytesused:" << metadata.planes[0].bytesused
+		<< "bytesused:" << metadata.planes()[0].bytesused
 		<< "timestamp:" << metadata.timestamp
-		<< "fps:" << Qt::fixed << qSetRealNumberPrecision(2) << fps;
+		<< "fps:" << Qt::fixed << qSetRealNumberPrecision(2) << fps
+		<< "latency:" << latency << "ms"
+		<< "dropped:" << (frames ? frames - 1 : 0);
 
 	/* Render the frame on the viewfinder. */
 	viewfinder_->render(buffer, &mappedBuffers_[buffer]);
@@ -778,9 +895,13 @@ void MainWindow::queueRequest(FrameBuffer *buffer)
 				rawBuffer = freeBuffers_[rawStream_].dequeue();
 		}
 
+		/*
+		 * Capture the raw frame with a later request when all buffers
+		 * are being written, instead of stalling the viewfinder.
+		 */
 		if (rawBuffer) {
 			request->addBuffer(rawStream_, rawBuffer);
-			captureRaw_ = false;
+			captureRaw_--;
 		} else {
 			qWarning() << "No free buffer available for RAW capture";
 		}
@@ -7,6 +7,7 @@
 #ifndef __QCAM_MAIN_WINDOW_H__
 #define __QCAM_MAIN_WINDOW_H__
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
@@ -27,6 +28,7 @@
 #include <libcamera/stream.h>
 
 #include "../cam/stream_options.h"
+#include "dng_writer.h"
 #include "viewfinder.h"
 
 using namespace libcamera;
@@ -42,6 +44,7 @@ enum {
 	OptRenderer = 'r',
 	OptStream = 's',
 	OptVerbose = 'v',
+	OptDownscale = 256,
 };
 
 class MainWindow : public QMainWindow
@@ -63,6 +66,7 @@ private Q_SLOTS:
 
 	void saveImageAs();
 	void captureRaw();
+	void captureRawBurst();
 	void processRaw(FrameBuffer *buffer, const ControlList &metadata);
 
 	void queueRequest(FrameBuffer *buffer);
@@ -76,6 +80,8 @@ private:
 	int startCapture();
 	void stopCapture();
 
+	void startRawCapture(unsigned int count);
+
 	void addCamera(std::shared_ptr<Camera> camera);
 	void removeCamera(std::shared_ptr<Camera> camera);
 
@@ -89,6 +95,7 @@ private:
 	QAction *startStopAction_;
 	QComboBox *cameraCombo_;
 	QAction *saveRaw_;
+	QAction *saveRawBurst_;
 	ViewFinder *viewfinder_;
 
 	QIcon iconPlay_;
@@ -110,7 +117,7 @@ private:
 
 	/* Capture state, buffers queue and statistics */
 	bool isCapturing_;
-	bool captureRaw_;
+	unsigned int captureRaw_;
 	Stream *vfStream_;
 	Stream *rawStream_;
 	std::map<const Stream *, QQueue<FrameBuffer *>> freeBuffers_;
@@ -118,10 +125,19 @@ private:
 	QQueue<Request *> freeQueue_;
 	QMutex mutex_; /* Protects freeBuffers_, doneQueue_, and freeQueue_ */
 
+	/* Raw capture file name, burst size and index of the next frame */
+	QString rawFilename_;
+	unsigned int rawCount_;
+	unsigned int rawIndex_;
+#ifdef HAVE_DNG
+	std::unique_ptr<DNGWorker> dngWorker_;
+#endif
+
 	uint64_t lastBufferTime_;
+	uint32_t lastSequence_;
 	QElapsedTimer frameRateInterval_;
 	uint32_t previousFrames_;
-	uint32_t framesCaptured_;
+	std::atomic<uint32_t> framesCaptured_;
 
 	std::vector<std::unique_ptr<Request>> requests_;
 };
@@ -26,7 +26,8 @@ public:
 
 	virtual const QList<libcamera::PixelFormat> &nativeFormats() const = 0;
 
-	virtual int setFormat(const libcamera::PixelFormat &format, const QSize &size) = 0;
+	virtual int setFormat(const libcamera::PixelFormat &format, const QSize &size,
+			      unsigned int stride) = 0;
 	virtual void render(libcamera::FrameBuffer *buffer, MappedBuffer *map) = 0;
 	virtual void stop() = 0;
 
@@ -11,6 +11,15 @@
 #include <QFile>
 #include <QImage>
 
+#ifdef HAVE_EGL
+#define EGL_NO_X11
+#define MESA_EGL_NO_X11_HEADERS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <stdint.h>
+#include <string.h>
+#endif
+
 #include <libcamera/formats.h>
 
 static const QList<libcamera::PixelFormat> supportedFormats{
@@ -36,16 +45,59 @@ static const QList<libcamera::PixelFormat> supportedFormats{
 	libcamera::formats::RGBA8888,
 	libcamera::formats::BGR888,
 	libcamera::formats::RGB888,
+	/* Raw Bayer 8-bit */
+	libcamera::formats::SBGGR8,
+	libcamera::formats::SGBRG8,
+	libcamera::formats::SGRBG8,
+	libcamera::formats::SRGGB8,
+	/* Raw Bayer 10-bit packed */
+	libcamera::formats::SBGGR10_CSI2P,
+	libcamera::formats::SGBRG10_CSI2P,
+	libcamera::formats::SGRBG10_CSI2P,
+	libcamera::formats::SRGGB10_CSI2P,
+	/* Raw Bayer 12-bit packed */
+	libcamera::formats::SBGGR12_CSI2P,
+	libcamera::formats::SGBRG12_CSI2P,
+	libcamera::formats::SGRBG12_CSI2P,
+	libcamera::formats::SRGGB12_CSI2P,
 };
 
+#ifdef HAVE_EGL
+namespace {
+
+/* EGL functions used to import dmabufs, resolved in initializeGL() */
+struct EGLFunctions {
+	EGLDisplay display = EGL_NO_DISPLAY;
+	PFNEGLCREATEIMAGEKHRPROC createImage = nullptr;
+	PFNEGLDESTROYIMAGEKHRPROC destroyImage = nullptr;
+	void (*imageTargetTexture2D)(GLenum target, void *image) = nullptr;
+
+	bool valid() const
+	{
+		return createImage && destroyImage && imageTargetTexture2D;
+	}
+};
+
+EGLFunctions eglFunctions;
+
+constexpr uint32_t drmFourcc(char a, char b, char c, char d)
+{
+	return static_cast<uint32_t>(a) | (static_cast<uint32_t>(b) << 8) |
+	       (static_cast<uint32_t>(c) << 16) | (static_cast<uint32_t>(d) << 24);
+}
+
+} /* namespace */
+#endif
+
 ViewFinderGL::ViewFinderGL(QWidget *parent)
-	: QOpenGLWidget(parent), buffer_(nullptr), data_(nullptr),
-	  vertexBuffer_(QOpenGLBuffer::VertexBuffer)
+	: QOpenGLWidget(parent), buffer_(nullptr), stride_(0), data_(nullptr),
+	  vertexBuffer_(QOpenGLBuffer::VertexBuffer), dmabufImport_(false)
 {
 }
 
 ViewFinderGL::~ViewFinderGL()
 {
+	releaseImages();
 	removeShader();
 }
 
@@ -55,7 +107,7 @@ const QList<libcamera::PixelFormat> &ViewFinderGL::nativeFormats() const
 }
 
 int ViewFinderGL::setFormat(const libcamera::PixelFormat &format,
-			    const QSize &size)
+			    const QSize &size, unsigned int stride)
 {
 	if (format != format_) {
 		/*
@@ -75,6 +127,13 @@ int ViewFinderGL::setFormat(const libcamera::PixelFormat &format,
 	}
 
 	size_ = size;
+	stride_ = stride;
+
+	/* Retry importing dmabufs with the new format. */
+	releaseImages();
+#ifdef HAVE_EGL
+	dmabufImport_ = eglFunctions.valid();
+#endif
 
 	updateGeometry();
 	return 0;
@@ -86,6 +145,8 @@ void ViewFinderGL::stop()
 		renderComplete(buffer_);
 		buffer_ = nullptr;
 	}
+
+	releaseImages();
 }
 
 QImage ViewFinderGL::getCurrentImage()
@@ -105,6 +166,10 @@ void ViewFinderGL::render(libcamera::FrameBuffer *buffer, MappedBuffer *map)
 	if (buffer_)
 		renderComplete(buffer_);
 
+	/* Not all pipeline handlers report the stride, compute it if needed. */
+	if (!stride_)
+		stride_ = buffer->metadata().planes()[0].bytesused / size_.height();
+
 	data_ = static_cast<unsigned char *>(map->memory);
 	update();
 	buffer_ = buffer;
@@ -203,6 +268,74 @@ bool ViewFinderGL::selectFormat(const libcamera::PixelFormat &format)
 		fragmentShaderDefines_.append("#define RGB_PATTERN bgr");
 		fragmentShaderFile_ = ":RGB.frag";
 		break;
+	case libcamera::formats::SBGGR8:
+		firstRed_.setX(1.0);
+		firstRed_.setY(1.0);
+		fragmentShaderFile_ = ":bayer.frag";
+		break;
+	case libcamera::formats::SGBRG8:
+		firstRed_.setX(0.0);
+		firstRed_.setY(1.0);
+		fragmentShaderFile_ = ":bayer.frag";
+		break;
+	case libcamera::formats::SGRBG8:
+		firstRed_.setX(1.0);
+		firstRed_.setY(0.0);
+		fragmentShaderFile_ = ":bayer.frag";
+		break;
+	case libcamera::formats::SRGGB8:
+		firstRed_.setX(0.0);
+		firstRed_.setY(0.0);
+		fragmentShaderFile_ = ":bayer.frag";
+		break;
+	case libcamera::formats::SBGGR10_CSI2P:
+		firstRed_.setX(1.0);
+		firstRed_.setY(1.0);
+		fragmentShaderDefines_.append("#define RAW_PACKED_GROUP 4.0");
+		fragmentShaderFile_ = ":bayer.frag";
+		break;
+	case libcamera::formats::SGBRG10_CSI2P:
+		firstRed_.setX(0.0);
+		firstRed_.setY(1.0);
+		fragmentShaderDefines_.append("#define RAW_PACKED_GROUP 4.0");
+		fragmentShaderFile_ = ":bayer.frag";
+		break;
+	case libcamera::formats::SGRBG10_CSI2P:
+		firstRed_.setX(1.0);
+		firstRed_.setY(0.0);
+		fragmentShaderDefines_.append("#define RAW_PACKED_GROUP 4.0");
+		fragmentShaderFile_ = ":bayer.frag";
+		break;
+	case libcamera::formats::SRGGB10_CSI2P:
+		firstRed_.setX(0.0);
+		firstRed_.setY(0.0);
+		fragmentShaderDefines_.append("#define RAW_PACKED_GROUP 4.0");
+		fragmentShaderFile_ = ":bayer.frag";
+		break;
+	case libcamera::formats::SBGGR12_CSI2P:
+		firstRed_.setX(1.0);
+		firstRed_.setY(1.0);
+		fragmentShaderDefines_.append("#define RAW_PACKED_GROUP 2.0");
+		fragmentShaderFile_ = ":bayer.frag";
+		break;
+	case libcamera::formats::SGBRG12_CSI2P:
+		firstRed_.setX(0.0);
+		firstRed_.setY(1.0);
+		fragmentShaderDefines_.append("#define RAW_PACKED_GROUP 2.0");
+		fragmentShaderFile_ = ":bayer.frag";
+		break;
+	case libcamera::formats::SGRBG12_CSI2P:
+		firstRed_.setX(1.0);
+		firstRed_.setY(0.0);
+		fragmentShaderDefines_.append("#define RAW_PACKED_GROUP 2.0");
+		fragmentShaderFile_ = ":bayer.frag";
+		break;
+	case libcamera::formats::SRGGB12_CSI2P:
+		firstRed_.setX(0.0);
+		firstRed_.setY(0.0);
+		fragmentShaderDefines_.append("#define RAW_PACKED_GROUP 2.0");
+		fragmentShaderFile_ = ":bayer.frag";
+		break;
 	default:
 		ret = false;
 		qWarning() << "[ViewFinderGL]:"
@@ -290,6 +423,9 @@ bool ViewFinderGL::createFragmentShader()
 	textureUniformU_ = shaderProgram_.uniformLocation("tex_u");
 	textureUniformV_ = shaderProgram_.uniformLocation("tex_v");
 	textureUniformStepX_ = shaderProgram_.uniformLocation("tex_stepx");
+	textureUniformSize_ = shaderProgram_.uniformLocation("tex_size");
+	textureUniformStride_ = shaderProgram_.uniformLocation("tex_stride");
+	textureUniformBayerFirstRed_ = shaderProgram_.uniformLocation("tex_bayer_first_red");
 
 	/* Create the textures. */
 	for (std::unique_ptr<QOpenGLTexture> &texture : textures_) {
@@ -303,15 +439,127 @@ bool ViewFinderGL::createFragmentShader()
 	return true;
 }
 
-void ViewFinderGL::configureTexture(QOpenGLTexture &texture)
+void ViewFinderGL::configureTexture(QOpenGLTexture &texture, GLint filter)
 {
 	glBindTexture(GL_TEXTURE_2D, texture.textureId());
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 }
 
+/*
+ * Fill the texture \a index with a plane of the current buffer, located at
+ * \a offset bytes from the start of the buffer. The plane lines are tightly
+ * packed, with \a format giving the number of bytes per texel. The dmabuf is
+ * bound to the texture directly when possible, and the plane is otherwise
+ * copied from the CPU mapping of the buffer.
+ */
+void ViewFinderGL::uploadTexture(unsigned int index, GLenum format,
+				 unsigned int width, unsigned int height,
+				 unsigned int offset, GLint filter)
+{
+	glActiveTexture(GL_TEXTURE0 + index);
+	configureTexture(*textures_[index], filter);
+
+#ifdef HAVE_EGL
+	if (dmabufImport_) {
+		void *&image = images_[buffer_][index];
+		if (!image)
+			image = importPlane(format, width, height, offset);
+
+		if (image) {
+			eglFunctions.imageTargetTexture2D(GL_TEXTURE_2D, image);
+			return;
+		}
+
+		qWarning() << "[ViewFinderGL]:"
+			   << "dmabuf import failed, uploading textures";
+		dmabufImport_ = false;
+	}
+#endif
+
+	glTexImage2D(GL_TEXTURE_2D,
+		     0,
+		     format,
+		     width,
+		     height,
+		     0,
+		     format,
+		     GL_UNSIGNED_BYTE,
+		     data_ + offset);
+}
+
+/*
+ * Create an EGL image for a plane of the current buffer, with the same layout
+ * as the plane uploaded by uploadTexture().
+ */
+void *ViewFinderGL::importPlane([[maybe_unused]] GLenum format,
+				[[maybe_unused]] unsigned int width,
+				[[maybe_unused]] unsigned int height,
+				[[maybe_unused]] unsigned int offset)
+{
+#ifdef HAVE_EGL
+	/* DRM formats matching the memory layout of the texture formats. */
+	uint32_t fourcc;
+	unsigned int bpp;
+
+	switch (format) {
+	case GL_RED:
+		fourcc = drmFourcc('R', '8', ' ', ' ');
+		bpp = 1;
+		break;
+	case GL_RG:
+		fourcc = drmFourcc('G', 'R', '8', '8');
+		bpp = 2;
+		break;
+	case GL_RGB:
+		fourcc = drmFourcc('B', 'G', '2', '4');
+		bpp = 3;
+		break;
+	case GL_RGBA:
+		fourcc = drmFourcc('A', 'B', '2', '4');
+		bpp = 4;
+		break;
+	default:
+		return nullptr;
+	}
+
+	const EGLint attribs[] = {
+		EGL_WIDTH, static_cast<EGLint>(width),
+		EGL_HEIGHT, static_cast<EGLint>(height),
+		EGL_LINUX_DRM_FOURCC_EXT, static_cast<EGLint>(fourcc),
+		EGL_DMA_BUF_PLANE0_FD_EXT, buffer_->planes()[0].fd.fd(),
+		EGL_DMA_BUF_PLANE0_OFFSET_EXT, static_cast<EGLint>(offset),
+		EGL_DMA_BUF_PLANE0_PITCH_EXT, static_cast<EGLint>(width * bpp),
+		EGL_NONE,
+	};
+
+	EGLImageKHR image = eglFunctions.createImage(eglFunctions.display,
+						     EGL_NO_CONTEXT,
+						     EGL_LINUX_DMA_BUF_EXT,
+						     nullptr, attribs);
+	if (image != EGL_NO_IMAGE_KHR)
+		return image;
+#endif
+
+	return nullptr;
+}
+
+void ViewFinderGL::releaseImages()
+{
+#ifdef HAVE_EGL
+	for (const auto &[buffer, images] : images_) {
+		for (void *image : images) {
+			if (image)
+				eglFunctions.destroyImage(eglFunctions.display, image);
+		}
+	}
+#endif
+
+	images_.clear();
+}
+
 void ViewFinderGL::removeShader()
 {
 	if (shaderProgram_.isLinked()) {
@@ -351,6 +599,30 @@ void ViewFinderGL::initializeGL()
 	if (!createVertexShader())
 		qWarning() << "[ViewFinderGL]: create vertex shader failed.";
 
+#ifdef HAVE_EGL
+	/*
+	 * When the widget renders through EGL, bind the frame buffers to the
+	 * textures directly instead of uploading them on every frame.
+	 */
+	eglFunctions.display = eglGetCurrentDisplay();
+	const char *extensions = eglFunctions.display != EGL_NO_DISPLAY
+			       ? eglQueryString(eglFunctions.display, EGL_EXTENSIONS)
+			       : nullptr;
+	if (extensions && strstr(extensions, "EGL_EXT_image_dma_buf_import")) {
+		eglFunctions.createImage = reinterpret_cast<PFNEGLCREATEIMAGEKHRPROC>(
+			eglGetProcAddress("eglCreateImageKHR"));
+		eglFunctions.destroyImage = reinterpret_cast<PFNEGLDESTROYIMAGEKHRPROC>(
+			eglGetProcAddress("eglDestroyImageKHR"));
+		eglFunctions.imageTargetTexture2D =
+			reinterpret_cast<void (*)(GLenum, void *)>(
+				eglGetProcAddress("glEGLImageTargetTexture2DOES"));
+	}
+
+	dmabufImport_ = eglFunctions.valid();
+	if (dmabufImport_)
+		qDebug() << "[ViewFinderGL]: Importing frame buffers with EGL";
+#endif
+
 	glClearColor(1.0f, 1.0f, 1.0f, 0.0f);
 }
 
@@ -364,119 +636,54 @@ void ViewFinderGL::doRender()
 	case libcamera::formats::NV24:
 	case libcamera::formats::NV42:
 		/* Activate texture Y */
-		glActiveTexture(GL_TEXTURE0);
-		configureTexture(*textures_[0]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_RED,
-			     size_.width(),
-			     size_.height(),
-			     0,
-			     GL_RED,
-			     GL_UNSIGNED_BYTE,
-			     data_);
+		uploadTexture(0, GL_RED, size_.width(), size_.height(), 0);
 		shaderProgram_.setUniformValue(textureUniformY_, 0);
 
 		/* Activate texture UV/VU */
-		glActiveTexture(GL_TEXTURE1);
-		configureTexture(*textures_[1]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_RG,
-			     size_.width() / horzSubSample_,
-			     size_.height() / vertSubSample_,
-			     0,
-			     GL_RG,
-			     GL_UNSIGNED_BYTE,
-			     data_ + size_.width() * size_.height());
+		uploadTexture(1, GL_RG,
+			      size_.width() / horzSubSample_,
+			      size_.height() / vertSubSample_,
+			      size_.width() * size_.height());
 		shaderProgram_.setUniformValue(textureUniformU_, 1);
 		break;
 
 	case libcamera::formats::YUV420:
 		/* Activate texture Y */
-		glActiveTexture(GL_TEXTURE0);
-		configureTexture(*textures_[0]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_RED,
-			     size_.width(),
-			     size_.height(),
-			     0,
-			     GL_RED,
-			     GL_UNSIGNED_BYTE,
-			     data_);
+		uploadTexture(0, GL_RED, size_.width(), size_.height(), 0);
 		shaderProgram_.setUniformValue(textureUniformY_, 0);
 
 		/* Activate texture U */
-		glActiveTexture(GL_TEXTURE1);
-		configureTexture(*textures_[1]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_RED,
-			     size_.width() / horzSubSample_,
-			     size_.height() / vertSubSample_,
-			     0,
-			     GL_RED,
-			     GL_UNSIGNED_BYTE,
-			     data_ + size_.width() * size_.height());
+		uploadTexture(1, GL_RED,
+			      size_.width() / horzSubSample_,
+			      size_.height() / vertSubSample_,
+			      size_.width() * size_.height());
 		shaderProgram_.setUniformValue(textureUniformU_, 1);
 
 		/* Activate texture V */
-		glActiveTexture(GL_TEXTURE2);
-		configureTexture(*textures_[2]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_RED,
-			     size_.width() / horzSubSample_,
-			     size_.height() / vertSubSample_,
-			     0,
-			     GL_RED,
-			     GL_UNSIGNED_BYTE,
-			     data_ + size_.width() * size_.height() * 5 / 4);
+		uploadTexture(2, GL_RED,
+			      size_.width() / horzSubSample_,
+			      size_.height() / vertSubSample_,
+			      size_.width() * size_.height() * 5 / 4);
 		shaderProgram_.setUniformValue(textureUniformV_, 2);
 		break;
 
 	case libcamera::formats::YVU420:
 		/* Activate texture Y */
-		glActiveTexture(GL_TEXTURE0);
-		configureTexture(*textures_[0]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_RED,
-			     size_.width(),
-			     size_.height(),
-			     0,
-			     GL_RED,
-			     GL_UNSIGNED_BYTE,
-			     data_);
+		uploadTexture(0, GL_RED, size_.width(), size_.height(), 0);
 		shaderProgram_.setUniformValue(textureUniformY_, 0);
 
 		/* Activate texture V */
-		glActiveTexture(GL_TEXTURE2);
-		configureTexture(*textures_[2]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_RED,
-			     size_.width() / horzSubSample_,
-			     size_.height() / vertSubSample_,
-			     0,
-			     GL_RED,
-			     GL_UNSIGNED_BYTE,
-			     data_ + size_.width() * size_.height());
+		uploadTexture(2, GL_RED,
+			      size_.width() / horzSubSample_,
+			      size_.height() / vertSubSample_,
+			      size_.width() * size_.height());
 		shaderProgram_.setUniformValue(textureUniformV_, 2);
 
 		/* Activate texture U */
-		glActiveTexture(GL_TEXTURE1);
-		configureTexture(*textures_[1]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_RED,
-			     size_.width() / horzSubSample_,
-			     size_.height() / vertSubSample_,
-			     0,
-			     GL_RED,
-			     GL_UNSIGNED_BYTE,
-			     data_ + size_.width() * size_.height() * 5 / 4);
+		uploadTexture(1, GL_RED,
+			      size_.width() / horzSubSample_,
+			      size_.height() / vertSubSample_,
+			      size_.width() * size_.height() * 5 / 4);
 		shaderProgram_.setUniformValue(textureUniformU_, 1);
 		break;
 
@@ -489,17 +696,7 @@ void ViewFinderGL::doRender()
 		 * OpenGL texel size with the 4 bytes repeating pattern in YUV.
 		 * The texture width is thus half of the image with.
 		 */
-		glActiveTexture(GL_TEXTURE0);
-		configureTexture(*textures_[0]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_RGBA,
-			     size_.width() / 2,
-			     size_.height(),
-			     0,
-			     GL_RGBA,
-			     GL_UNSIGNED_BYTE,
-			     data_);
+		uploadTexture(0, GL_RGBA, size_.width() / 2, size_.height(), 0);
 		shaderProgram_.setUniformValue(textureUniformY_, 0);
 
 		/*
@@ -516,34 +713,43 @@ void ViewFinderGL::doRender()
 	case libcamera::formats::ARGB8888:
 	case libcamera::formats::BGRA8888:
 	case libcamera::formats::RGBA8888:
-		glActiveTexture(GL_TEXTURE0);
-		configureTexture(*textures_[0]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_RGBA,
-			     size_.width(),
-			     size_.height(),
-			     0,
-			     GL_RGBA,
-			     GL_UNSIGNED_BYTE,
-			     data_);
+		uploadTexture(0, GL_RGBA, size_.width(), size_.height(), 0);
 		shaderProgram_.setUniformValue(textureUniformY_, 0);
 		break;
 
 	case libcamera::formats::BGR888:
 	case libcamera::formats::RGB888:
-		glActiveTexture(GL_TEXTURE0);
-		configureTexture(*textures_[0]);
-		glTexImage2D(GL_TEXTURE_2D,
-			     0,
-			     GL_RGB,
-			     size_.width(),
-			     size_.height(),
-			     0,
-			     GL_RGB,
-			     GL_UNSIGNED_BYTE,
-			     data_);
+		uploadTexture(0, GL_RGB, size_.width(), size_.height(), 0);
+		shaderProgram_.setUniformValue(textureUniformY_, 0);
+		break;
+
+	case libcamera::formats::SBGGR8:
+	case libcamera::formats::SGBRG8:
+	case libcamera::formats::SGRBG8:
+	case libcamera::formats::SRGGB8:
+	case libcamera::formats::SBGGR10_CSI2P:
+	case libcamera::formats::SGBRG10_CSI2P:
+	case libcamera::formats::SGRBG10_CSI2P:
+	case libcamera::formats::SRGGB10_CSI2P:
+	case libcamera::formats::SBGGR12_CSI2P:
+	case libcamera::formats::SGBRG12_CSI2P:
+	case libcamera::formats::SGRBG12_CSI2P:
+	case libcamera::formats::SRGGB12_CSI2P:
+		/*
+		 * The raw data is uploaded as is, one byte per texel, with the
+		 * line stride as the texture width. The shader unpacks and
+		 * demosaics the pixels, which must not be interpolated by the
+		 * sampler.
+		 */
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		uploadTexture(0, GL_RED, stride_, size_.height(), 0, GL_NEAREST);
 		shaderProgram_.setUniformValue(textureUniformY_, 0);
+		shaderProgram_.setUniformValue(textureUniformSize_,
+					       QSizeF(size_));
+		shaderProgram_.setUniformValue(textureUniformStride_,
+					       static_cast<float>(stride_));
+		shaderProgram_.setUniformValue(textureUniformBayerFirstRed_,
+					       firstRed_);
 		break;
 
 	default:
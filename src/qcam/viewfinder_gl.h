@@ -9,6 +9,7 @@
 #define __VIEWFINDER_GL_H__
 
 #include <array>
+#include <map>
 #include <memory>
 
 #include <QImage>
@@ -19,6 +20,7 @@
 #include <QOpenGLShaderProgram>
 #include <QOpenGLTexture>
 #include <QOpenGLWidget>
+#include <QPointF>
 #include <QSize>
 
 #include <libcamera/buffer.h>
@@ -38,7 +40,8 @@ public:
 
 	const QList<libcamera::PixelFormat> &nativeFormats() const override;
 
-	int setFormat(const libcamera::PixelFormat &format, const QSize &size) override;
+	int setFormat(const libcamera::PixelFormat &format, const QSize &size,
+		      unsigned int stride) override;
 	void render(libcamera::FrameBuffer *buffer, MappedBuffer *map) override;
 	void stop() override;
 
@@ -56,7 +59,13 @@ protected:
 private:
 	bool selectFormat(const libcamera::PixelFormat &format);
 
-	void configureTexture(QOpenGLTexture &texture);
+	void configureTexture(QOpenGLTexture &texture, GLint filter = GL_LINEAR);
+	void uploadTexture(unsigned int index, GLenum format, unsigned int width,
+			   unsigned int height, unsigned int offset,
+			   GLint filter = GL_LINEAR);
+	void *importPlane(GLenum format, unsigned int width, unsigned int height,
+			  unsigned int offset);
+	void releaseImages();
 	bool createFragmentShader();
 	bool createVertexShader();
 	void removeShader();
@@ -66,6 +75,7 @@ private:
 	libcamera::FrameBuffer *buffer_;
 	libcamera::PixelFormat format_;
 	QSize size_;
+	unsigned int stride_;
 	unsigned char *data_;
 
 	/* Shaders */
@@ -81,6 +91,10 @@ private:
 	/* Textures */
 	std::array<std::unique_ptr<QOpenGLTexture>, 3> textures_;
 
+	/* EGL images of the imported dmabufs, indexed by texture */
+	bool dmabufImport_;
+	std::map<libcamera::FrameBuffer *, std::array<void *, 3>> images_;
+
 	/* YUV texture parameters */
 	GLuint textureUniformU_;
 	GLuint textureUniformV_;
@@ -89,6 +103,12 @@ private:
 	unsigned int horzSubSample_;
 	unsigned int vertSubSample_;
 
+	/* Raw Bayer texture parameters */
+	GLuint textureUniformSize_;
+	GLuint textureUniformStride_;
+	GLuint textureUniformBayerFirstRed_;
+	QPointF firstRed_;
+
 	QMutex mutex_; /* Prevent concurrent access to image_ */
 };
 
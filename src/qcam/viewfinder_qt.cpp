@@ -7,6 +7,7 @@
 
 #include "viewfinder_qt.h"
 
+#include <algorithm>
 #include <stdint.h>
 #include <utility>
 
@@ -34,7 +35,7 @@ static const QMap<libcamera::PixelFormat, QImage::Format> nativeFormats
 };
 
 ViewFinderQt::ViewFinderQt(QWidget *parent)
-	: QWidget(parent), buffer_(nullptr)
+	: QWidget(parent), downscale_(false), scale_(1), buffer_(nullptr)
 {
 	icon_ = QIcon(":camera-off.svg");
 }
@@ -50,7 +51,8 @@ const QList<libcamera::PixelFormat> &ViewFinderQt::nativeFormats() const
 }
 
 int ViewFinderQt::setFormat(const libcamera::PixelFormat &format,
-			    const QSize &size)
+			    const QSize &size,
+			    [[maybe_unused]] unsigned int stride)
 {
 	image_ = QImage();
 
@@ -64,6 +66,7 @@ int ViewFinderQt::setFormat(const libcamera::PixelFormat &format,
 			return ret;
 
 		image_ = QImage(size, QImage::Format_RGB32);
+		scale_ = 1;
 
 		qInfo() << "Using software format conversion from"
 			<< format.toString().c_str();
@@ -86,7 +89,7 @@ void ViewFinderQt::render(libcamera::FrameBuffer *buffer, MappedBuffer *map)
 	}
 
 	unsigned char *memory = static_cast<unsigned char *>(map->memory);
-	size_t size = buffer->metadata().planes[0].bytesused;
+	size_t size = buffer->metadata().planes()[0].bytesused;
 
 	{
 		QMutexLocker locker(&mutex_);
@@ -109,8 +112,18 @@ void ViewFinderQt::render(libcamera::FrameBuffer *buffer, MappedBuffer *map)
 		} else {
 			/*
 			 * Otherwise, convert the format and release the frame
-			 * buffer immediately.
+			 * buffer immediately. When downscaling, only convert
+			 * the resolution that fits in the widget, as the rest
+			 * would be discarded by the painter anyway.
 			 */
+			unsigned int scale = downscale_ ? displayScale() : 1;
+			if (scale != scale_) {
+				converter_.configure(format_, size_, scale);
+				image_ = QImage(converter_.outputSize(),
+						QImage::Format_RGB32);
+				scale_ = scale;
+			}
+
 			converter_.convert(memory, size, &image_);
 		}
 	}
@@ -175,6 +188,15 @@ void ViewFinderQt::paintEvent(QPaintEvent *)
 	painter.drawPixmap(point, pixmap_);
 }
 
+/* Compute the largest integer downscale factor that still fills the widget. */
+unsigned int ViewFinderQt::displayScale() const
+{
+	int scale = std::min(size_.width() / std::max(width(), 1),
+			     size_.height() / std::max(height(), 1));
+
+	return std::max(scale, 1);
+}
+
 QSize ViewFinderQt::sizeHint() const
 {
 	return size_.isValid() ? size_ : QSize(640, 480);
@@ -31,12 +31,15 @@ public:
 
 	const QList<libcamera::PixelFormat> &nativeFormats() const override;
 
-	int setFormat(const libcamera::PixelFormat &format, const QSize &size) override;
+	int setFormat(const libcamera::PixelFormat &format, const QSize &size,
+		      unsigned int stride) override;
 	void render(libcamera::FrameBuffer *buffer, MappedBuffer *map) override;
 	void stop() override;
 
 	QImage getCurrentImage() override;
 
+	void setDownscale(bool enable) { downscale_ = enable; }
+
 Q_SIGNALS:
 	void renderComplete(libcamera::FrameBuffer *buffer);
 
@@ -45,7 +48,11 @@ protected:
 	QSize sizeHint() const override;
 
 private:
+	unsigned int displayScale() const;
+
 	FormatConverter converter_;
+	bool downscale_;
+	unsigned int scale_;
 
 	libcamera::PixelFormat format_;
 	QSize size_;
@@ -8,6 +8,7 @@
 #include "v4l2_camera.h"
 
 #include <errno.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "libcamera/internal/log.h"
@@ -18,7 +19,7 @@ LOG_DECLARE_CATEGORY(V4L2Compat)
 
 V4L2Camera::V4L2Camera(std::shared_ptr<Camera> camera)
 	: camera_(camera), isRunning_(false), bufferAllocator_(nullptr),
-	  efd_(-1), bufferAvailableCount_(0)
+	  importing_(false), efd_(-1), bufferAvailableCount_(0)
 {
 	camera_->requestCompleted.connect(this, &V4L2Camera::requestComplete);
 }
@@ -50,6 +51,7 @@ int V4L2Camera::open(StreamConfiguration *streamConfig)
 void V4L2Camera::close()
 {
 	requestPool_.clear();
+	importedBuffers_.clear();
 
 	delete bufferAllocator_;
 	bufferAllocator_ = nullptr;
@@ -64,9 +66,34 @@ void V4L2Camera::bind(int efd)
 
 void V4L2Camera::unbind()
 {
+	clearAvailableBuffers();
 	efd_ = -1;
 }
 
+/*
+ * Forget about the completed buffers that haven't been dequeued, and consume
+ * their eventfd notifications, for the file not to be woken up by poll() for
+ * buffers it can't dequeue anymore.
+ */
+void V4L2Camera::clearAvailableBuffers()
+{
+	{
+		std::lock_guard<std::mutex> locker(bufferLock_);
+		completedBuffers_.clear();
+	}
+
+	MutexLocker locker(bufferMutex_);
+	for (; bufferAvailableCount_; bufferAvailableCount_--) {
+		uint64_t data;
+		if (efd_ < 0)
+			continue;
+
+		int ret = ::read(efd_, &data, sizeof(data));
+		if (ret != sizeof(data))
+			LOG(V4L2Compat, Error) << "Failed to clear eventfd POLLIN";
+	}
+}
+
 std::vector<V4L2Camera::Buffer> V4L2Camera::completedBuffers()
 {
 	std::vector<Buffer> v;
@@ -93,17 +120,26 @@ void V4L2Camera::requestComplete(Request *request)
 	completedBuffers_.push_back(std::move(metadata));
 	bufferLock_.unlock();
 
-	uint64_t data = 1;
-	int ret = ::write(efd_, &data, sizeof(data));
-	if (ret != sizeof(data))
-		LOG(V4L2Compat, Error) << "Failed to signal eventfd POLLIN";
-
 	request->reuse();
-	{
-		MutexLocker locker(bufferMutex_);
-		bufferAvailableCount_++;
+
+	/*
+	 * Make the buffer available before signalling the eventfd, otherwise
+	 * an application woken up by poll() could fail to dequeue it. Only the
+	 * file that owns the camera is bound to the eventfd, and a single
+	 * buffer can only satisfy a single blocked dequeue.
+	 */
+	MutexLocker locker(bufferMutex_);
+	bufferAvailableCount_++;
+
+	if (efd_ >= 0) {
+		uint64_t data = 1;
+		int ret = ::write(efd_, &data, sizeof(data));
+		if (ret != sizeof(data))
+			LOG(V4L2Compat, Error) << "Failed to signal eventfd POLLIN";
 	}
-	bufferCV_.notify_all();
+
+	locker.unlock();
+	bufferCV_.notify_one();
 }
 
 int V4L2Camera::configure(StreamConfiguration *streamConfigOut,
@@ -157,14 +193,8 @@ int V4L2Camera::validateConfiguration(const PixelFormat &pixelFormat,
 	return 0;
 }
 
-int V4L2Camera::allocBuffers(unsigned int count)
+int V4L2Camera::createRequests(unsigned int count)
 {
-	Stream *stream = config_->at(0).stream();
-
-	int ret = bufferAllocator_->allocate(stream);
-	if (ret < 0)
-		return ret;
-
 	for (unsigned int i = 0; i < count; i++) {
 		std::unique_ptr<Request> request = camera_->createRequest(i);
 		if (!request) {
@@ -174,13 +204,81 @@ int V4L2Camera::allocBuffers(unsigned int count)
 		requestPool_.push_back(std::move(request));
 	}
 
+	return 0;
+}
+
+int V4L2Camera::allocBuffers(unsigned int count)
+{
+	Stream *stream = config_->at(0).stream();
+
+	int ret = bufferAllocator_->allocate(stream);
+	if (ret < 0)
+		return ret;
+
+	importing_ = false;
+
+	int err = createRequests(count);
+	if (err < 0)
+		return err;
+
 	return ret;
 }
 
+/*
+ * Prepare the requests to capture to dmabufs provided by the application with
+ * importBuffer() when queueing them.
+ */
+int V4L2Camera::importBuffers(unsigned int count)
+{
+	importing_ = true;
+	importedBuffers_.resize(count);
+
+	return createRequests(count);
+}
+
+/*
+ * Wrap the dmabuf in a FrameBuffer for the buffer index. Applications usually
+ * queue the same dmabuf at a given index, the FrameBuffer is then reused to
+ * avoid importing the dmabuf again in the pipeline handler.
+ */
+int V4L2Camera::importBuffer(unsigned int index, int fd, unsigned int length)
+{
+	if (!importing_ || index >= importedBuffers_.size())
+		return -EINVAL;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		return -errno;
+
+	ImportedBuffer &imported = importedBuffers_[index];
+	if (imported.buffer && imported.dev == st.st_dev &&
+	    imported.ino == st.st_ino &&
+	    imported.buffer->planes()[0].length == length)
+		return 0;
+
+	FrameBuffer::Plane plane;
+	plane.fd = FileDescriptor(fd);
+	plane.length = length;
+	if (!plane.fd.isValid())
+		return -EBADF;
+
+	imported.buffer = std::make_unique<FrameBuffer>(std::vector<FrameBuffer::Plane>{ plane });
+	imported.dev = st.st_dev;
+	imported.ino = st.st_ino;
+
+	return 0;
+}
+
 void V4L2Camera::freeBuffers()
 {
 	pendingRequests_.clear();
 	requestPool_.clear();
+	importedBuffers_.clear();
+
+	if (importing_) {
+		importing_ = false;
+		return;
+	}
 
 	Stream *stream = config_->at(0).stream();
 	bufferAllocator_->free(stream);
@@ -192,7 +290,7 @@ FileDescriptor V4L2Camera::getBufferFd(unsigned int index)
 	const std::vector<std::unique_ptr<FrameBuffer>> &buffers =
 		bufferAllocator_->buffers(stream);
 
-	if (buffers.size() <= index)
+	if (importing_ || buffers.size() <= index)
 		return FileDescriptor();
 
 	return buffers[index]->planes()[0].fd;
@@ -209,12 +307,12 @@ int V4L2Camera::streamOn()
 
 	isRunning_ = true;
 
-	for (Request *req : pendingRequests_) {
-		/* \todo What should we do if this returns -EINVAL? */
-		ret = camera_->queueRequest(req);
-		if (ret < 0)
-			return ret == -EACCES ? -EBUSY : ret;
-	}
+	/* \todo What should we do if this returns -EINVAL? */
+	std::vector<Request *> requests(pendingRequests_.begin(),
+					pendingRequests_.end());
+	ret = camera_->queueRequests(requests);
+	if (ret < 0)
+		return ret == -EACCES ? -EBUSY : ret;
 
 	pendingRequests_.clear();
 
@@ -242,6 +340,8 @@ int V4L2Camera::streamOff()
 	}
 	bufferCV_.notify_all();
 
+	clearAvailableBuffers();
+
 	return 0;
 }
 
@@ -254,7 +354,13 @@ int V4L2Camera::qbuf(unsigned int index)
 	Request *request = requestPool_[index].get();
 
 	Stream *stream = config_->at(0).stream();
-	FrameBuffer *buffer = bufferAllocator_->buffers(stream)[index].get();
+	FrameBuffer *buffer = importing_ ? importedBuffers_[index].buffer.get()
+					 : bufferAllocator_->buffers(stream)[index].get();
+	if (!buffer) {
+		LOG(V4L2Compat, Error) << "No buffer to queue";
+		return -EINVAL;
+	}
+
 	int ret = request->addBuffer(stream, buffer);
 	if (ret < 0) {
 		LOG(V4L2Compat, Error) << "Can't set buffer for request";
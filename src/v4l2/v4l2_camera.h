@@ -8,9 +8,12 @@
 #ifndef __V4L2_CAMERA_H__
 #define __V4L2_CAMERA_H__
 
+#include <condition_variable>
 #include <deque>
 #include <mutex>
+#include <sys/types.h>
 #include <utility>
+#include <vector>
 
 #include <libcamera/buffer.h>
 #include <libcamera/camera.h>
@@ -18,6 +21,7 @@
 #include <libcamera/framebuffer_allocator.h>
 
 #include "libcamera/internal/semaphore.h"
+#include "libcamera/internal/thread.h"
 
 using namespace libcamera;
 
@@ -52,6 +56,8 @@ public:
 				  StreamConfiguration *streamConfigOut);
 
 	int allocBuffers(unsigned int count);
+	int importBuffers(unsigned int count);
+	int importBuffer(unsigned int index, int fd, unsigned int length);
 	void freeBuffers();
 	FileDescriptor getBufferFd(unsigned int index);
 
@@ -66,7 +72,16 @@ public:
 	bool isRunning();
 
 private:
+	/* A FrameBuffer wrapping a dmabuf imported from the application. */
+	struct ImportedBuffer {
+		std::unique_ptr<FrameBuffer> buffer;
+		dev_t dev;
+		ino_t ino;
+	};
+
+	int createRequests(unsigned int count);
 	void requestComplete(Request *request);
+	void clearAvailableBuffers();
 
 	std::shared_ptr<Camera> camera_;
 	std::unique_ptr<CameraConfiguration> config_;
@@ -77,6 +92,8 @@ private:
 	FrameBufferAllocator *bufferAllocator_;
 
 	std::vector<std::unique_ptr<Request>> requestPool_;
+	std::vector<ImportedBuffer> importedBuffers_;
+	bool importing_;
 
 	std::deque<Request *> pendingRequests_;
 	std::deque<std::unique_ptr<Buffer>> completedBuffers_;
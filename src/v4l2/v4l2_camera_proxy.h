@@ -61,6 +61,7 @@ private:
 	int vidioc_querybuf(V4L2CameraFile *file, struct v4l2_buffer *arg);
 	int vidioc_qbuf(V4L2CameraFile *file, struct v4l2_buffer *arg);
 	int vidioc_dqbuf(V4L2CameraFile *file, struct v4l2_buffer *arg, MutexLocker *locker);
+	int vidioc_expbuf(V4L2CameraFile *file, struct v4l2_exportbuffer *arg);
 	int vidioc_streamon(V4L2CameraFile *file, int *arg);
 	int vidioc_streamoff(V4L2CameraFile *file, int *arg);
 
@@ -76,6 +77,7 @@ private:
 	StreamConfiguration streamConfig_;
 	unsigned int bufferCount_;
 	unsigned int currentBuf_;
+	uint32_t memory_;
 	unsigned int sizeimage_;
 
 	struct v4l2_capability capabilities_;
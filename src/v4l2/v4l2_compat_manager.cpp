@@ -40,7 +40,7 @@ void get_symbol(T &func, const char *name)
 } /* namespace */
 
 V4L2CompatManager::V4L2CompatManager()
-	: cm_(nullptr)
+	: cm_(nullptr), fileTable_{}
 {
 	get_symbol(fops_.openat, "openat64");
 	get_symbol(fops_.dup, "dup");
@@ -52,6 +52,8 @@ V4L2CompatManager::V4L2CompatManager()
 
 V4L2CompatManager::~V4L2CompatManager()
 {
+	for (std::atomic<V4L2CameraFile *> &entry : fileTable_)
+		entry.store(nullptr, std::memory_order_relaxed);
 	files_.clear();
 	mmaps_.clear();
 
@@ -97,13 +99,40 @@ V4L2CompatManager *V4L2CompatManager::instance()
 	return &instance;
 }
 
-std::shared_ptr<V4L2CameraFile> V4L2CompatManager::cameraFile(int fd)
+/*
+ * Look up the camera file for a file descriptor. This is called for every
+ * ioctl() and mmap() of the process, most of which don't target a camera, and
+ * is lock-free for the file descriptors covered by the file table.
+ *
+ * The returned file stays valid until the file descriptor is closed. As with
+ * the kernel, closing a file descriptor concurrently with other operations on
+ * it is an application bug.
+ */
+V4L2CameraFile *V4L2CompatManager::cameraFile(int fd)
 {
+	if (fd < 0)
+		return nullptr;
+
+	if (static_cast<unsigned int>(fd) < kFileTableSize)
+		return fileTable_[fd].load(std::memory_order_acquire);
+
+	MutexLocker locker(filesMutex_);
+
 	auto file = files_.find(fd);
 	if (file == files_.end())
 		return nullptr;
 
-	return file->second;
+	return file->second.get();
+}
+
+void V4L2CompatManager::addFile(int fd, std::shared_ptr<V4L2CameraFile> file)
+{
+	MutexLocker locker(filesMutex_);
+
+	if (static_cast<unsigned int>(fd) < kFileTableSize)
+		fileTable_[fd].store(file.get(), std::memory_order_release);
+
+	files_[fd] = std::move(file);
 }
 
 int V4L2CompatManager::getCameraIndex(int fd)
@@ -156,7 +185,7 @@ int V4L2CompatManager::openat(int dirfd, const char *path, int oflag, mode_t mod
 		return efd;
 
 	V4L2CameraProxy *proxy = proxies_[ret].get();
-	files_.emplace(efd, std::make_shared<V4L2CameraFile>(efd, oflag & O_NONBLOCK, proxy));
+	addFile(efd, std::make_shared<V4L2CameraFile>(efd, oflag & O_NONBLOCK, proxy));
 
 	return efd;
 }
@@ -167,18 +196,31 @@ int V4L2CompatManager::dup(int oldfd)
 	if (newfd < 0)
 		return newfd;
 
-	auto file = files_.find(oldfd);
-	if (file != files_.end())
-		files_[newfd] = file->second;
+	std::shared_ptr<V4L2CameraFile> file;
+	{
+		MutexLocker locker(filesMutex_);
+
+		auto iter = files_.find(oldfd);
+		if (iter != files_.end())
+			file = iter->second;
+	}
+
+	if (file)
+		addFile(newfd, std::move(file));
 
 	return newfd;
 }
 
 int V4L2CompatManager::close(int fd)
 {
-	auto file = files_.find(fd);
-	if (file != files_.end())
-		files_.erase(file);
+	if (cameraFile(fd)) {
+		MutexLocker locker(filesMutex_);
+
+		if (static_cast<unsigned int>(fd) < kFileTableSize)
+			fileTable_[fd].store(nullptr, std::memory_order_release);
+
+		files_.erase(fd);
+	}
 
 	/* We still need to close the eventfd. */
 	return fops_.close(fd);
@@ -187,7 +229,7 @@ int V4L2CompatManager::close(int fd)
 void *V4L2CompatManager::mmap(void *addr, size_t length, int prot, int flags,
 			      int fd, off64_t offset)
 {
-	std::shared_ptr<V4L2CameraFile> file = cameraFile(fd);
+	V4L2CameraFile *file = cameraFile(fd);
 	if (!file)
 		return fops_.mmap(addr, length, prot, flags, fd, offset);
 
@@ -222,9 +264,9 @@ int V4L2CompatManager::munmap(void *addr, size_t length)
 
 int V4L2CompatManager::ioctl(int fd, unsigned long request, void *arg)
 {
-	std::shared_ptr<V4L2CameraFile> file = cameraFile(fd);
+	V4L2CameraFile *file = cameraFile(fd);
 	if (!file)
 		return fops_.ioctl(fd, request, arg);
 
-	return file->proxy()->ioctl(file.get(), request, arg);
+	return file->proxy()->ioctl(file, request, arg);
 }
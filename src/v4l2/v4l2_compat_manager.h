@@ -8,6 +8,8 @@
 #ifndef __V4L2_COMPAT_MANAGER_H__
 #define __V4L2_COMPAT_MANAGER_H__
 
+#include <array>
+#include <atomic>
 #include <fcntl.h>
 #include <map>
 #include <memory>
@@ -17,6 +19,8 @@
 
 #include <libcamera/camera_manager.h>
 
+#include "libcamera/internal/thread.h"
+
 #include "v4l2_camera_proxy.h"
 
 using namespace libcamera;
@@ -56,19 +60,33 @@ public:
 	int ioctl(int fd, unsigned long request, void *arg);
 
 private:
+	/* Number of file descriptors looked up without locking. */
+	static constexpr unsigned int kFileTableSize = 1024;
+
 	V4L2CompatManager();
 	~V4L2CompatManager();
 
 	int start();
 	int getCameraIndex(int fd);
-	std::shared_ptr<V4L2CameraFile> cameraFile(int fd);
+	V4L2CameraFile *cameraFile(int fd);
+	void addFile(int fd, std::shared_ptr<V4L2CameraFile> file);
 
 	FileOperations fops_;
 
 	CameraManager *cm_;
 
 	std::vector<std::unique_ptr<V4L2CameraProxy>> proxies_;
+
+	/* Protects files_ when files are opened, duplicated and closed. */
+	Mutex filesMutex_;
 	std::map<int, std::shared_ptr<V4L2CameraFile>> files_;
+
+	/*
+	 * Files indexed by file descriptor, to look them up without locking
+	 * in the ioctl() and mmap() hot paths. The entries don't hold a
+	 * reference, files_ does.
+	 */
+	std::array<std::atomic<V4L2CameraFile *>, kFileTableSize> fileTable_;
 	std::map<void *, V4L2CameraProxy *> mmaps_;
 };
 
@@ -0,0 +1,181 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * bayer-unpack.cpp - Raw Bayer unpacking tests
+ */
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "libcamera/internal/bayer_format.h"
+#include "libcamera/internal/bayer_unpack.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+/*
+ * Reference packers, writing the pixels one bit at a time to keep them
+ * independent from the unpacking code. The MSBs of the CSI-2 formats are
+ * stored one byte per pixel, followed by the LSBs of the group.
+ */
+vector<uint8_t> packCSI2P(const vector<uint16_t> &pixels, unsigned int bits)
+{
+	unsigned int groupPixels = bits == 12 ? 2 : 4;
+	unsigned int lsbBits = bits - 8;
+	unsigned int groups = (pixels.size() + groupPixels - 1) / groupPixels;
+	unsigned int groupBytes = groupPixels * bits / 8;
+	vector<uint8_t> line(groups * groupBytes, 0);
+
+	for (unsigned int x = 0; x < pixels.size(); ++x) {
+		unsigned int group = x / groupPixels;
+		unsigned int index = x % groupPixels;
+		uint8_t *data = &line[group * groupBytes];
+
+		data[index] = pixels[x] >> lsbBits;
+
+		unsigned int bit = groupPixels * 8 + index * lsbBits;
+		for (unsigned int i = 0; i < lsbBits; ++i, ++bit) {
+			if (pixels[x] & (1 << i))
+				data[bit / 8] |= 1 << (bit % 8);
+		}
+	}
+
+	return line;
+}
+
+vector<uint8_t> packIPU3(const vector<uint16_t> &pixels)
+{
+	unsigned int blocks = (pixels.size() + 24) / 25;
+	vector<uint8_t> line(blocks * 32, 0);
+
+	for (unsigned int x = 0; x < pixels.size(); ++x) {
+		uint8_t *data = &line[x / 25 * 32];
+		unsigned int bit = x % 25 * 10;
+
+		for (unsigned int i = 0; i < 10; ++i, ++bit) {
+			if (pixels[x] & (1 << i))
+				data[bit / 8] |= 1 << (bit % 8);
+		}
+	}
+
+	return line;
+}
+
+vector<uint8_t> packRaw(const vector<uint16_t> &pixels, unsigned int bits)
+{
+	vector<uint8_t> line;
+
+	for (uint16_t pixel : pixels) {
+		line.push_back(pixel & 0xff);
+		if (bits > 8)
+			line.push_back(pixel >> 8);
+	}
+
+	return line;
+}
+
+} /* namespace */
+
+class BayerUnpackTest : public Test
+{
+protected:
+	int testFormat(const BayerFormat &format, unsigned int width)
+	{
+		bayer::UnpackFunction unpack = bayer::unpackFunction(format);
+		if (!unpack) {
+			cerr << "No unpacking function for " << format.toString()
+			     << endl;
+			return TestFail;
+		}
+
+		vector<uint16_t> pixels(width);
+		uniform_int_distribution<unsigned int> dist(0, (1 << format.bitDepth) - 1);
+		for (uint16_t &pixel : pixels)
+			pixel = dist(random_);
+
+		vector<uint8_t> line;
+		switch (format.packing) {
+		case BayerFormat::CSI2Packed:
+			line = packCSI2P(pixels, format.bitDepth);
+			break;
+		case BayerFormat::IPU3Packed:
+			line = packIPU3(pixels);
+			break;
+		default:
+			line = packRaw(pixels, format.bitDepth);
+			break;
+		}
+
+		/* Guard values around the output catch out of bounds writes. */
+		vector<uint16_t> output(width + 2, 0xdead);
+		unpack(&output[1], line.data(), width);
+
+		if (output[0] != 0xdead || output[width + 1] != 0xdead) {
+			cerr << format.toString() << " width " << width
+			     << ": write out of bounds" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int x = 0; x < width; ++x) {
+			if (output[x + 1] != pixels[x]) {
+				cerr << format.toString() << " width " << width
+				     << ": pixel " << x << " is " << output[x + 1]
+				     << ", expected " << pixels[x] << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		const BayerFormat formats[] = {
+			{ BayerFormat::BGGR, 8, BayerFormat::None },
+			{ BayerFormat::BGGR, 10, BayerFormat::None },
+			{ BayerFormat::BGGR, 16, BayerFormat::None },
+			{ BayerFormat::BGGR, 10, BayerFormat::CSI2Packed },
+			{ BayerFormat::BGGR, 12, BayerFormat::CSI2Packed },
+			{ BayerFormat::BGGR, 14, BayerFormat::CSI2Packed },
+			{ BayerFormat::BGGR, 10, BayerFormat::IPU3Packed },
+		};
+
+		/*
+		 * Test line widths around the sizes of the SIMD groups and IPU3
+		 * blocks, as well as typical sensor widths.
+		 */
+		const unsigned int widths[] = {
+			1, 2, 3, 4, 7, 8, 9, 15, 16, 17, 24, 25, 26, 49, 50,
+			51, 64, 75, 100, 101, 640, 1920, 4056, 4208,
+		};
+
+		for (const BayerFormat &format : formats) {
+			for (unsigned int width : widths) {
+				int ret = testFormat(format, width);
+				if (ret != TestPass)
+					return ret;
+			}
+		}
+
+		/* Unsupported formats have no unpacking function. */
+		if (bayer::unpackFunction({ BayerFormat::BGGR, 12, BayerFormat::IPU3Packed })) {
+			cerr << "Unexpected unpacking function for 12-bit IPU3"
+			     << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	mt19937 random_;
+};
+
+TEST_REGISTER(BayerUnpackTest)
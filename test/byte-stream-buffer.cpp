@@ -7,6 +7,7 @@
 
 #include <array>
 #include <iostream>
+#include <vector>
 
 #include "libcamera/internal/byte_stream_buffer.h"
 
@@ -171,6 +172,44 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Growable write mode.
+		 */
+		std::vector<uint8_t> storage = { 1, 2, 3 };
+		ByteStreamBuffer gbuf(&storage);
+
+		if (gbuf.size() != 0 || gbuf.offset() != 0 || !storage.empty()) {
+			cerr << "Growable buffer incorrectly constructed" << endl;
+			return TestFail;
+		}
+
+		/* Test writes beyond the initial capacity. */
+		for (i = 0; i < 1000; ++i) {
+			ret = gbuf.write(&i);
+			if (ret) {
+				cerr << "Write failed on growable buffer" << endl;
+				return TestFail;
+			}
+		}
+
+		if (gbuf.overflow() || gbuf.offset() != 4000 ||
+		    storage.size() != 4000 || gbuf.base() != storage.data() ||
+		    reinterpret_cast<uint32_t *>(storage.data())[999] != 999) {
+			cerr << "Growable buffer contents incorrect" << endl;
+			return TestFail;
+		}
+
+		/* Test carve out after reserving space. */
+		gbuf.reserve(8);
+		ByteStreamBuffer gco = gbuf.carveOut(4);
+		ret = gbuf.write(&value);
+		ret |= gco.write(&value);
+		if (ret || gbuf.overflow() || storage.size() != 4008 ||
+		    *reinterpret_cast<uint32_t *>(storage.data() + 4000) != value) {
+			cerr << "Carving out growable buffer failed" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
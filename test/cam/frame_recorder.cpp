@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * frame_recorder.cpp - FrameRecorder tests
+ */
+
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/buffer.h>
+#include <libcamera/file_descriptor.h>
+
+#include "frame_recorder.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class FrameRecorderTest : public Test
+{
+protected:
+	static constexpr unsigned int BufferCount = 3;
+	static constexpr unsigned int PlaneCount = 3;
+	static constexpr unsigned int PlaneSize = 65536;
+	static constexpr unsigned int BytesUsed = PlaneSize - 16;
+	static constexpr unsigned int FrameCount = 20;
+
+	int init()
+	{
+		for (unsigned int i = 0; i < BufferCount; ++i) {
+			vector<FrameBuffer::Plane> planes(PlaneCount);
+
+			for (unsigned int j = 0; j < PlaneCount; ++j) {
+				int fd = memfd_create("frame-recorder", MFD_CLOEXEC);
+				if (fd < 0 || ftruncate(fd, PlaneSize) < 0) {
+					cerr << "Failed to create memfd" << endl;
+					return TestFail;
+				}
+
+				void *mem = mmap(nullptr, PlaneSize, PROT_WRITE,
+						 MAP_SHARED, fd, 0);
+				if (mem == MAP_FAILED) {
+					cerr << "Failed to map memfd" << endl;
+					return TestFail;
+				}
+
+				memset(mem, pattern(i, j), PlaneSize);
+				munmap(mem, PlaneSize);
+
+				planes[j].fd = FileDescriptor(std::move(fd));
+				planes[j].length = PlaneSize;
+			}
+
+			unique_ptr<FrameBuffer> buffer = make_unique<FrameBuffer>(planes);
+
+			/* Simulate a completed capture with a partial payload. */
+			FrameMetadata &metadata =
+				const_cast<FrameMetadata &>(buffer->metadata());
+			for (FrameMetadata::Plane &plane : metadata.planes())
+				plane.bytesused = BytesUsed;
+
+			buffers_.push_back(std::move(buffer));
+		}
+
+		fd_ = memfd_create("frame-recorder-output", MFD_CLOEXEC);
+		if (fd_ < 0) {
+			cerr << "Failed to create output file" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	static uint8_t pattern(unsigned int buffer, unsigned int plane)
+	{
+		return 'a' + buffer * PlaneCount + plane;
+	}
+
+	int run()
+	{
+		/* Use a small ring to exercise the full ring code path. */
+		FrameRecorder recorder(4);
+
+		cout << "Recorder uses "
+		     << (recorder.isAsync() ? "io_uring" : "synchronous writes")
+		     << endl;
+
+		for (const unique_ptr<FrameBuffer> &buffer : buffers_) {
+			if (recorder.addBuffer(buffer.get()) < 0) {
+				cerr << "Failed to add buffer" << endl;
+				return TestFail;
+			}
+		}
+
+		unsigned int completed = 0;
+		unsigned int failed = 0;
+		off_t offset = 0;
+
+		for (unsigned int i = 0; i < FrameCount; ++i) {
+			FrameBuffer *buffer = buffers_[i % BufferCount].get();
+
+			int ret = recorder.write(buffer, fd_, offset, [&](int status) {
+				completed++;
+				if (status)
+					failed++;
+			});
+			if (ret != BytesUsed * PlaneCount) {
+				cerr << "Failed to queue write: " << ret << endl;
+				return TestFail;
+			}
+
+			offset += ret;
+
+			/* Submit writes in batches of a few frames. */
+			if (i % 5 == 4)
+				recorder.complete(false);
+		}
+
+		while (recorder.pending())
+			recorder.complete(true);
+
+		if (completed != FrameCount || failed) {
+			cerr << "Writes failed to complete: " << completed
+			     << " completed, " << failed << " failed" << endl;
+			return TestFail;
+		}
+
+		if (lseek(fd_, 0, SEEK_END) != offset) {
+			cerr << "Invalid output file size" << endl;
+			return TestFail;
+		}
+
+		/* Verify the contents of the output file. */
+		vector<uint8_t> data(BytesUsed);
+
+		for (unsigned int i = 0; i < FrameCount; ++i) {
+			for (unsigned int j = 0; j < PlaneCount; ++j) {
+				off_t pos = (i * PlaneCount + j) * BytesUsed;
+
+				if (pread(fd_, data.data(), data.size(), pos) != BytesUsed) {
+					cerr << "Failed to read output file" << endl;
+					return TestFail;
+				}
+
+				uint8_t expected = pattern(i % BufferCount, j);
+				for (uint8_t value : data) {
+					if (value != expected) {
+						cerr << "Invalid data for frame " << i
+						     << " plane " << j << endl;
+						return TestFail;
+					}
+				}
+			}
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		if (fd_ >= 0)
+			close(fd_);
+	}
+
+private:
+	vector<unique_ptr<FrameBuffer>> buffers_;
+	int fd_ = -1;
+};
+
+TEST_REGISTER(FrameRecorderTest)
@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * camera-manager-async.cpp - Test asynchronous start of the CameraManager
+ */
+
+#include <atomic>
+#include <iostream>
+
+#include <libcamera/camera.h>
+#include <libcamera/camera_manager.h>
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std::chrono_literals;
+
+class CameraManagerAsyncTest : public Test
+{
+protected:
+	void cameraAddedHandler([[maybe_unused]] std::shared_ptr<Camera> camera)
+	{
+		camerasAdded_++;
+	}
+
+	int init() override
+	{
+		cm_ = new CameraManager();
+		cm_->cameraAdded.connect(this, &CameraManagerAsyncTest::cameraAddedHandler);
+		camerasAdded_ = 0;
+
+		if (cm_->start(CameraManager::StartAsync)) {
+			std::cout << "Failed to start camera manager" << std::endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		std::shared_ptr<Camera> camera =
+			cm_->waitForCamera("platform/vimc.0 Sensor B", 5s);
+		if (!camera) {
+			std::cout << "vimc camera not found, skipping" << std::endl;
+			return TestSkip;
+		}
+
+		/* Unknown cameras are reported once all pipelines are matched. */
+		if (cm_->waitForCamera("unknown camera", 5s)) {
+			std::cout << "Unknown camera found" << std::endl;
+			return TestFail;
+		}
+
+		unsigned int count = cm_->cameras().size();
+		if (camerasAdded_ != count) {
+			std::cout << "Expected " << count << " cameraAdded signals, got "
+				  << camerasAdded_ << std::endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		cm_->stop();
+		delete cm_;
+	}
+
+private:
+	CameraManager *cm_;
+	std::atomic<unsigned int> camerasAdded_;
+};
+
+TEST_REGISTER(CameraManagerAsyncTest)
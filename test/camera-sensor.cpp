@@ -103,6 +103,23 @@ protected:
 			return TestFail;
 		}
 
+		/* The cheapest mode is selected from the precomputed mode table. */
+		const CameraSensorMode *mode = sensor_->findMode({ 0xdeadbeef,
+								   MEDIA_BUS_FMT_ARGB8888_1X32,
+								   MEDIA_BUS_FMT_SBGGR10_1X10 },
+								 Size(1024, 768), 0.0, 1.0f);
+		if (!mode || mode->format.mbus_code != MEDIA_BUS_FMT_SBGGR10_1X10 ||
+		    mode->format.size != Size(4096, 2160)) {
+			cerr << "Failed to find a suitable mode, expected 4096x2160-0x"
+			     << utils::hex(MEDIA_BUS_FMT_SBGGR10_1X10) << endl;
+			return TestFail;
+		}
+
+		if (sensor_->findMode({ MEDIA_BUS_FMT_SBGGR10_1X10 }, Size(8192, 4320))) {
+			cerr << "Found a mode larger than the sensor resolution" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
@@ -0,0 +1,171 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * libcamera camera group tests
+ */
+
+#include <iostream>
+
+#include <libcamera/camera_group.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/framebuffer_allocator.h>
+
+#include "libcamera/internal/event_dispatcher.h"
+#include "libcamera/internal/thread.h"
+#include "libcamera/internal/timer.h"
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class CameraGroupTest : public CameraTest, public Test
+{
+public:
+	CameraGroupTest()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	void requestsComplete(const std::vector<Request *> &requests)
+	{
+		if (requests.size() != 1)
+			return;
+
+		completeSetsCount_++;
+
+		Request *request = requests[0];
+		request->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(request);
+	}
+
+	void requestUnmatched(Request *request)
+	{
+		if (request->status() != Request::RequestCancelled)
+			unmatchedCount_++;
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		if (cm_->createGroup({})) {
+			cout << "Empty camera group created" << endl;
+			return TestFail;
+		}
+
+		if (cm_->createGroup({ camera_, camera_ })) {
+			cout << "Camera group with duplicate cameras created" << endl;
+			return TestFail;
+		}
+
+		group_ = cm_->createGroup({ camera_ });
+		if (!group_ || group_->cameras().size() != 1) {
+			cout << "Failed to create camera group" << endl;
+			return TestFail;
+		}
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = new FrameBufferAllocator(camera_);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		delete allocator_;
+		group_.reset();
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to configure the camera" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		if (allocator_->allocate(stream) < 0)
+			return TestFail;
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			if (!request || request->addBuffer(stream, buffer.get())) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			requests_.push_back(std::move(request));
+		}
+
+		group_->requestsCompleted.connect(this, &CameraGroupTest::requestsComplete);
+		group_->requestUnmatched.connect(this, &CameraGroupTest::requestUnmatched);
+
+		completeSetsCount_ = 0;
+		unmatchedCount_ = 0;
+
+		if (group_->start()) {
+			cout << "Failed to start camera group" << endl;
+			return TestFail;
+		}
+
+		for (std::unique_ptr<Request> &request : requests_) {
+			if (camera_->queueRequest(request.get())) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (completeSetsCount_ < requests_.size() * 2) {
+			cout << "Failed to capture enough frame sets" << endl;
+			return TestFail;
+		}
+
+		if (unmatchedCount_) {
+			cout << "Unmatched frames in a single camera group" << endl;
+			return TestFail;
+		}
+
+		if (group_->stop()) {
+			cout << "Failed to stop camera group" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	unsigned int completeSetsCount_;
+	unsigned int unmatchedCount_;
+
+	std::vector<std::unique_ptr<Request>> requests_;
+
+	std::unique_ptr<CameraGroup> group_;
+	std::unique_ptr<CameraConfiguration> config_;
+	FrameBufferAllocator *allocator_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(CameraGroupTest)
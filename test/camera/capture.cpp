@@ -7,6 +7,7 @@
 
 #include <iostream>
 
+#include <libcamera/control_ids.h>
 #include <libcamera/framebuffer_allocator.h>
 
 #include "libcamera/internal/event_dispatcher.h"
@@ -31,6 +32,7 @@ public:
 protected:
 	unsigned int completeBuffersCount_;
 	unsigned int completeRequestsCount_;
+	unsigned int partialResultsCount_;
 
 	void bufferComplete([[maybe_unused]] Request *request,
 			    FrameBuffer *buffer)
@@ -41,6 +43,20 @@ protected:
 		completeBuffersCount_++;
 	}
 
+	void partialResult([[maybe_unused]] Request *request, FrameBuffer *buffer,
+			   const ControlList &metadata)
+	{
+		if (buffer->metadata().status != FrameMetadata::FrameSuccess)
+			return;
+
+		/* vimc records the sensor timestamp before completing buffers. */
+		if (metadata.get(controls::SensorTimestamp) !=
+		    static_cast<int64_t>(buffer->metadata().timestamp))
+			return;
+
+		partialResultsCount_++;
+	}
+
 	void requestComplete(Request *request)
 	{
 		if (request->status() != Request::RequestComplete)
@@ -117,8 +133,10 @@ protected:
 
 		completeRequestsCount_ = 0;
 		completeBuffersCount_ = 0;
+		partialResultsCount_ = 0;
 
 		camera_->bufferCompleted.connect(this, &Capture::bufferComplete);
+		camera_->partialResultAvailable.connect(this, &Capture::partialResult);
 		camera_->requestCompleted.connect(this, &Capture::requestComplete);
 
 		if (camera_->start()) {
@@ -154,6 +172,11 @@ protected:
 			return TestFail;
 		}
 
+		if (partialResultsCount_ != completeBuffersCount_) {
+			cout << "Partial results don't match completed buffers" << endl;
+			return TestFail;
+		}
+
 		if (camera_->stop()) {
 			cout << "Failed to stop camera" << endl;
 			return TestFail;
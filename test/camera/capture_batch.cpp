@@ -0,0 +1,172 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * libcamera batched request submission tests
+ */
+
+#include <iostream>
+#include <vector>
+
+#include <libcamera/framebuffer_allocator.h>
+
+#include "libcamera/internal/event_dispatcher.h"
+#include "libcamera/internal/thread.h"
+#include "libcamera/internal/timer.h"
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class CaptureBatch : public CameraTest, public Test
+{
+public:
+	CaptureBatch()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	std::vector<Request *> completed_;
+
+	void requestComplete(Request *request)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completed_.push_back(request);
+	}
+
+	void processEvents(unsigned int timeout)
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		Timer timer;
+		timer.start(timeout);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = new FrameBufferAllocator(camera_);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		delete allocator_;
+	}
+
+	int run() override
+	{
+		StreamConfiguration &cfg = config_->at(0);
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = cfg.stream();
+
+		int ret = allocator_->allocate(stream);
+		if (ret < 0)
+			return TestFail;
+
+		std::vector<Request *> requests;
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			if (!request) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			if (request->addBuffer(stream, buffer.get())) {
+				cout << "Failed to associate buffer with request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(request.get());
+			requests_.push_back(std::move(request));
+		}
+
+		camera_->requestCompleted.connect(this, &CaptureBatch::requestComplete);
+
+		/* Batches can only be queued to a running camera. */
+		if (camera_->queueRequests(requests) != -EACCES) {
+			cout << "Batch queued to a stopped camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		/* A batch containing an invalid request must be rejected whole. */
+		std::unique_ptr<Request> empty = camera_->createRequest();
+		std::vector<Request *> invalid = requests;
+		invalid.push_back(empty.get());
+
+		if (camera_->queueRequests(invalid) != -EINVAL) {
+			cout << "Batch with an invalid request accepted" << endl;
+			return TestFail;
+		}
+
+		processEvents(100);
+
+		if (!completed_.empty()) {
+			cout << "Requests from a rejected batch completed" << endl;
+			return TestFail;
+		}
+
+		/* A valid batch completes in order. */
+		if (camera_->queueRequests(requests)) {
+			cout << "Failed to queue requests" << endl;
+			return TestFail;
+		}
+
+		processEvents(1000);
+
+		if (completed_ != requests) {
+			cout << "Batch didn't complete in order (got "
+			     << completed_.size() << " of " << requests.size()
+			     << " requests)" << endl;
+			return TestFail;
+		}
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::vector<std::unique_ptr<Request>> requests_;
+
+	std::unique_ptr<CameraConfiguration> config_;
+	FrameBufferAllocator *allocator_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(CaptureBatch)
@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * libcamera camera configuration bandwidth estimation test
+ */
+
+#include <iostream>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class ConfigurationBandwidth : public CameraTest, public Test
+{
+public:
+	ConfigurationBandwidth()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		if (config_->validate() == CameraConfiguration::Invalid) {
+			cout << "Failed to validate configuration" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		const StreamConfiguration &cfg = config_->at(0);
+
+		CameraConfiguration::Bandwidth bandwidth = config_->bandwidth(30);
+		if (bandwidth.streams.size() != 1) {
+			cout << "Invalid number of streams in bandwidth" << endl;
+			return TestFail;
+		}
+
+		/* Vimc outputs RGB formats of at least 3 bytes per pixel. */
+		uint64_t minimum = cfg.size.width * cfg.size.height * 3 * 30;
+		if (bandwidth.streams[0] < minimum) {
+			cout << "Stream bandwidth " << bandwidth.streams[0]
+			     << " smaller than " << minimum << endl;
+			return TestFail;
+		}
+
+		/* The vimc pipeline has no internal buffers. */
+		if (bandwidth.internal) {
+			cout << "Unexpected internal bandwidth "
+			     << bandwidth.internal << endl;
+			return TestFail;
+		}
+
+		if (bandwidth.total() != bandwidth.streams[0]) {
+			cout << "Invalid total bandwidth" << endl;
+			return TestFail;
+		}
+
+		/* The bandwidth scales with the frame rate. */
+		CameraConfiguration::Bandwidth doubled = config_->bandwidth(60);
+		if (doubled.total() != 2 * bandwidth.total()) {
+			cout << "Bandwidth doesn't scale with the frame rate" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	std::unique_ptr<CameraConfiguration> config_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(ConfigurationBandwidth)
@@ -0,0 +1,233 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * libcamera Camera buffer fences tests
+ */
+
+#include <iostream>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <libcamera/framebuffer_allocator.h>
+
+#include "libcamera/internal/event_dispatcher.h"
+#include "libcamera/internal/thread.h"
+#include "libcamera/internal/timer.h"
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class FenceTest : public CameraTest, public Test
+{
+public:
+	FenceTest()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	void requestComplete(Request *request)
+	{
+		if (request->status() != Request::RequestComplete) {
+			cancelledRequestsCount_++;
+			cancelledRequest_ = request;
+			return;
+		}
+
+		completeRequestsCount_++;
+
+		if (!requeue_)
+			return;
+
+		request->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(request);
+	}
+
+	void runFor(unsigned int ms)
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		Timer timer;
+		timer.start(ms);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = new FrameBufferAllocator(camera_);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		delete allocator_;
+	}
+
+	int run() override
+	{
+		StreamConfiguration &cfg = config_->at(0);
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = cfg.stream();
+
+		int ret = allocator_->allocate(stream);
+		if (ret < 0)
+			return TestFail;
+
+		/* Use an eventfd as a fence, it's readable once written to. */
+		int efd = eventfd(0, EFD_CLOEXEC);
+		if (efd < 0) {
+			cout << "Failed to create eventfd" << endl;
+			return TestFail;
+		}
+
+		FileDescriptor fence(std::move(efd));
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			if (!request) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			/* Only the first request waits for the fence. */
+			if (request->addBuffer(stream, buffer.get(),
+					       requests_.empty() ? fence : FileDescriptor())) {
+				cout << "Failed to associating buffer with request" << endl;
+				return TestFail;
+			}
+
+			requests_.push_back(std::move(request));
+		}
+
+		completeRequestsCount_ = 0;
+		cancelledRequestsCount_ = 0;
+		cancelledRequest_ = nullptr;
+		requeue_ = true;
+
+		camera_->requestCompleted.connect(this, &FenceTest::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (std::unique_ptr<Request> &request : requests_) {
+			if (camera_->queueRequest(request.get())) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		/* The following requests are held until the fence signals. */
+		runFor(100);
+
+		if (completeRequestsCount_ || cancelledRequestsCount_) {
+			cout << "Request completed before its fence signalled" << endl;
+			return TestFail;
+		}
+
+		eventfd_write(fence.fd(), 1);
+
+		runFor(1000);
+
+		unsigned int nbuffers = allocator_->buffers(stream).size();
+
+		if (completeRequestsCount_ < nbuffers * 2 || cancelledRequestsCount_) {
+			cout << "Failed to capture enough frames after the fence signalled"
+			     << endl;
+			return TestFail;
+		}
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		/* A fence that never signals cancels the request. */
+		int efd2 = eventfd(0, EFD_CLOEXEC);
+		if (efd2 < 0) {
+			cout << "Failed to create eventfd" << endl;
+			return TestFail;
+		}
+
+		FileDescriptor stuckFence(std::move(efd2));
+
+		Request *request = requests_.front().get();
+		FrameBuffer *buffer = request->buffers().begin()->second;
+		request->reuse();
+		request->addBuffer(stream, buffer, stuckFence);
+
+		completeRequestsCount_ = 0;
+		cancelledRequestsCount_ = 0;
+		requeue_ = false;
+
+		if (camera_->start()) {
+			cout << "Failed to restart camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->queueRequest(request)) {
+			cout << "Failed to queue request" << endl;
+			return TestFail;
+		}
+
+		runFor(1000);
+
+		if (cancelledRequestsCount_ != 1 || cancelledRequest_ != request) {
+			cout << "Request not cancelled on fence timeout" << endl;
+			return TestFail;
+		}
+
+		if (buffer->releaseFence().fd() != stuckFence.fd()) {
+			cout << "Fence not returned with the cancelled buffer" << endl;
+			return TestFail;
+		}
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	unsigned int completeRequestsCount_;
+	unsigned int cancelledRequestsCount_;
+	Request *cancelledRequest_;
+	bool requeue_;
+
+	std::vector<std::unique_ptr<Request>> requests_;
+
+	std::unique_ptr<CameraConfiguration> config_;
+	FrameBufferAllocator *allocator_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(FenceTest)
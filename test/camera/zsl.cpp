@@ -0,0 +1,202 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * libcamera Camera zero shutter lag capture tests
+ */
+
+#include <iostream>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/framebuffer_allocator.h>
+
+#include "libcamera/internal/event_dispatcher.h"
+#include "libcamera/internal/thread.h"
+#include "libcamera/internal/timer.h"
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class ZslTest : public CameraTest, public Test
+{
+public:
+	ZslTest()
+		: CameraTest("platform/vimc.0 Sensor B")
+	{
+	}
+
+protected:
+	void requestComplete(Request *request)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		if (request == stillRequest_.get()) {
+			stillCompleted_ = true;
+			return;
+		}
+
+		lastTimestamp_ = request->metadata().get(controls::SensorTimestamp);
+		completeRequestsCount_++;
+
+		request->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(request);
+	}
+
+	bool waitFor(const bool &done)
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning() && !done)
+			dispatcher->processEvents();
+
+		return done;
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = new FrameBufferAllocator(camera_);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		delete allocator_;
+	}
+
+	int run() override
+	{
+		config_->zslDepth = 4;
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to configure the camera with a ZSL ring" << endl;
+			return TestFail;
+		}
+
+		if (!camera_->controls().count(&controls::ZslTimestamp)) {
+			cout << "ZslTimestamp control not supported" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+
+		int ret = allocator_->allocate(stream);
+		if (ret < 2)
+			return TestFail;
+
+		/* Keep the last buffer for the still capture request. */
+		const std::vector<std::unique_ptr<FrameBuffer>> &buffers =
+			allocator_->buffers(stream);
+
+		for (unsigned int i = 0; i < buffers.size() - 1; ++i) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			if (!request || request->addBuffer(stream, buffers[i].get())) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			requests_.push_back(std::move(request));
+		}
+
+		stillRequest_ = camera_->createRequest();
+		if (!stillRequest_ ||
+		    stillRequest_->addBuffer(stream, buffers.back().get())) {
+			cout << "Failed to create still request" << endl;
+			return TestFail;
+		}
+
+		camera_->requestCompleted.connect(this, &ZslTest::requestComplete);
+
+		completeRequestsCount_ = 0;
+		stillCompleted_ = false;
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (std::unique_ptr<Request> &request : requests_) {
+			if (camera_->queueRequest(request.get())) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		bool captured = false;
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning() && !captured) {
+			dispatcher->processEvents();
+			captured = completeRequestsCount_ >= 4;
+		}
+
+		if (!captured) {
+			cout << "Failed to capture enough frames" << endl;
+			return TestFail;
+		}
+
+		/* Claim the last completed frame, it must be served from the ring. */
+		int64_t timestamp = lastTimestamp_;
+		stillRequest_->controls().set(controls::ZslTimestamp, timestamp);
+
+		if (camera_->queueRequest(stillRequest_.get())) {
+			cout << "Failed to queue still request" << endl;
+			return TestFail;
+		}
+
+		if (!waitFor(stillCompleted_)) {
+			cout << "Still request not completed" << endl;
+			return TestFail;
+		}
+
+		const ControlList &metadata = stillRequest_->metadata();
+		if (metadata.get(controls::ZslTimestamp) != timestamp ||
+		    metadata.get(controls::SensorTimestamp) != timestamp) {
+			cout << "Still request not served from the ZSL ring" << endl;
+			return TestFail;
+		}
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	unsigned int completeRequestsCount_;
+	int64_t lastTimestamp_;
+	bool stillCompleted_;
+
+	std::vector<std::unique_ptr<Request>> requests_;
+	std::unique_ptr<Request> stillRequest_;
+
+	std::unique_ptr<CameraConfiguration> config_;
+	FrameBufferAllocator *allocator_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(ZslTest)
@@ -196,6 +196,30 @@ protected:
 			return TestFail;
 		}
 
+		/* Verify that iteration produces controls sorted by ID. */
+		unsigned int prevId = 0;
+		for (const auto &ctrl : mergeList) {
+			if (ctrl.first <= prevId) {
+				cout << "List iteration not sorted by control ID"
+				     << endl;
+				return TestFail;
+			}
+
+			prevId = ctrl.first;
+		}
+
+		/*
+		 * Verify that copying a list to an existing list preserves the
+		 * values.
+		 */
+		list = mergeList;
+		if (list.size() != 3 ||
+		    list.get(controls::Brightness) != 0.7f ||
+		    list.get(controls::Saturation) != 0.4f) {
+			cout << "Copied list differs from its source" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * control_value_alloc.cpp - ControlValue memory allocation benchmark
+ */
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <stdlib.h>
+#include <string>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Count all heap allocations performed by the process, including the ones
+ * performed by libcamera.
+ */
+static atomic<unsigned long> allocations{ 0 };
+
+void *operator new(size_t size)
+{
+	allocations++;
+
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw bad_alloc();
+
+	return ptr;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, [[maybe_unused]] size_t size) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void *ptr, [[maybe_unused]] size_t size) noexcept
+{
+	free(ptr);
+}
+
+class ControlValueAllocTest : public Test
+{
+protected:
+	/*
+	 * Set the control \a ctrl to \a value and copy it repeatedly, and
+	 * report the number of heap allocations per iteration. The number of
+	 * allocations that the previous 8-byte inline storage would have
+	 * required is reported for comparison.
+	 */
+	template<typename T, typename V>
+	int measure(const Control<T> &ctrl, const V &value, bool inlined)
+	{
+		static constexpr unsigned int NumIterations = 100000;
+
+		ControlList list(controls::controls);
+		ControlList copy(controls::controls);
+
+		/* Warm up the lists to exclude their own allocations. */
+		list.set(ctrl, value);
+		copy = list;
+
+		unsigned long start = allocations;
+		auto begin = chrono::steady_clock::now();
+
+		for (unsigned int i = 0; i < NumIterations; ++i) {
+			list.set(ctrl, value);
+			copy = list;
+		}
+
+		auto end = chrono::steady_clock::now();
+		unsigned long count = allocations - start;
+
+		size_t size = list.get(ctrl.id()).data().size();
+		double duration = chrono::duration<double, nano>(end - begin).count();
+
+		cout << setw(24) << left << ctrl.name() << " " << setw(3) << right
+		     << size << " bytes: " << static_cast<double>(count) / NumIterations
+		     << " allocations per set and copy (was "
+		     << (size > sizeof(uint64_t) ? 2 : 0) << "), "
+		     << duration / NumIterations << " ns" << endl;
+
+		if (inlined && count) {
+			cerr << "Control " << ctrl.name()
+			     << " unexpectedly allocated memory" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		std::array<float, 9> ccm = { 1.0f, 0.0f, 0.0f,
+					     0.0f, 1.0f, 0.0f,
+					     0.0f, 0.0f, 1.0f };
+		std::array<int32_t, 4> blackLevels = { 4096, 4096, 4096, 4096 };
+		std::array<float, 2> gains = { 1.5f, 2.0f };
+
+		if (measure(controls::ExposureTime, 10000, true) != TestPass)
+			return TestFail;
+
+		if (measure(controls::ColourGains, Span<const float>(gains), true) != TestPass)
+			return TestFail;
+
+		if (measure(controls::SensorBlackLevels,
+			    Span<const int32_t>(blackLevels), true) != TestPass)
+			return TestFail;
+
+		if (measure(controls::ScalerCrop, Rectangle(0, 0, 1920, 1080), true) != TestPass)
+			return TestFail;
+
+		if (measure(controls::ColourCorrectionMatrix,
+			    Span<const float>(ccm), true) != TestPass)
+			return TestFail;
+
+		/* Strings that don't fit the inline storage allocate memory. */
+		std::string name(64, 'x');
+		ControlValue value;
+		unsigned long start = allocations;
+		value.set(name);
+		if (allocations == start) {
+			cerr << "Large value didn't allocate memory" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ControlValueAllocTest)
@@ -155,6 +155,55 @@ protected:
 		return TestPass;
 	}
 
+	int singleControlUnchanged()
+	{
+		std::unordered_map<uint32_t, DelayedControls::ControlParams> delays = {
+			{ V4L2_CID_BRIGHTNESS, { 0, false } },
+		};
+		std::unique_ptr<DelayedControls> delayed =
+			std::make_unique<DelayedControls>(dev_.get(), delays);
+		ControlList ctrls;
+
+		ctrls.set(V4L2_CID_BRIGHTNESS, 1);
+		dev_->setControls(&ctrls);
+		delayed->reset();
+
+		delayed->applyControls(0);
+
+		ctrls.set(V4L2_CID_BRIGHTNESS, 42);
+		delayed->push(ctrls);
+		delayed->applyControls(1);
+
+		/*
+		 * Modify the control behind the back of DelayedControls, and
+		 * push the same value again. It shall not be written.
+		 */
+		ControlList external;
+		external.set(V4L2_CID_BRIGHTNESS, 7);
+		dev_->setControls(&external);
+
+		delayed->push(ctrls);
+		delayed->applyControls(2);
+
+		ControlList result = dev_->getControls({ V4L2_CID_BRIGHTNESS });
+		int32_t brightness = result.get(V4L2_CID_BRIGHTNESS).get<int32_t>();
+		if (brightness != 7) {
+			cerr << "Unchanged control written to the device" << endl;
+			return TestFail;
+		}
+
+		/* The value in effect is still reported. */
+		result = delayed->get(2);
+		brightness = result.get(V4L2_CID_BRIGHTNESS).get<int32_t>();
+		if (brightness != 42) {
+			cerr << "Failed unchanged control, expected 42 got "
+			     << brightness << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
 	int dualControlsWithDelay(uint32_t startOffset)
 	{
 		static const unsigned int maxDelay = 2;
@@ -268,6 +317,70 @@ protected:
 		return TestPass;
 	}
 
+	int bracketedControl()
+	{
+		std::unordered_map<uint32_t, DelayedControls::ControlParams> delays = {
+			{ V4L2_CID_BRIGHTNESS, { 0, false } },
+		};
+		std::unique_ptr<DelayedControls> delayed =
+			std::make_unique<DelayedControls>(dev_.get(), delays);
+		const std::vector<double> gains = { 1.0, 2.0, 0.5 };
+		ControlList ctrls;
+
+		/* Reset control to value not used in test. */
+		ctrls.set(V4L2_CID_BRIGHTNESS, 1);
+		dev_->setControls(&ctrls);
+		delayed->reset();
+
+		if (delayed->setBracket(V4L2_CID_BRIGHTNESS, gains)) {
+			cerr << "Failed to set bracket" << endl;
+			return TestFail;
+		}
+
+		/* Trigger the first frame start event */
+		delayed->applyControls(0);
+
+		/* Test the gains are applied in turn, frame by frame. */
+		for (unsigned int i = 1; i < 100; i++) {
+			ctrls.set(V4L2_CID_BRIGHTNESS, 60);
+			delayed->push(ctrls);
+
+			delayed->applyControls(i);
+
+			int index = (i - 1) % gains.size();
+			int32_t expected = 60 * gains[index];
+
+			ControlList result = delayed->get(i);
+			int32_t brightness = result.get(V4L2_CID_BRIGHTNESS).get<int32_t>();
+			if (brightness != expected ||
+			    delayed->bracketIndex(i) != index) {
+				cerr << "Failed bracketed control"
+				     << " frame " << i
+				     << " expected " << expected
+				     << " (index " << index << ")"
+				     << " got " << brightness
+				     << " (index " << delayed->bracketIndex(i) << ")"
+				     << endl;
+				return TestFail;
+			}
+		}
+
+		/* Test the requested value is restored when bracketing stops. */
+		delayed->setBracket(V4L2_CID_BRIGHTNESS, {});
+		delayed->push({});
+		delayed->applyControls(100);
+
+		ControlList result = delayed->get(100);
+		int32_t brightness = result.get(V4L2_CID_BRIGHTNESS).get<int32_t>();
+		if (brightness != 60 || delayed->bracketIndex(100) != -1) {
+			cerr << "Failed to stop bracketing, got " << brightness
+			     << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
 	int run() override
 	{
 		int ret;
@@ -282,6 +395,11 @@ protected:
 		if (ret)
 			return ret;
 
+		/* Test unchanged values are not written again. */
+		ret = singleControlUnchanged();
+		if (ret)
+			return ret;
+
 		/* Test dual controls with different delays. */
 		ret = dualControlsWithDelay(0);
 		if (ret)
@@ -302,6 +420,11 @@ protected:
 		if (ret)
 			return ret;
 
+		/* Test bracketed control values. */
+		ret = bracketedControl();
+		if (ret)
+			return ret;
+
 		return TestPass;
 	}
 
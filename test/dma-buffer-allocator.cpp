@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * dma-buffer-allocator.cpp - DmaBufferAllocator test
+ */
+
+#include <errno.h>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/buffer.h>
+
+#include "libcamera/internal/buffer.h"
+#include "libcamera/internal/dma_buffer_allocator.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class DmaBufferAllocatorTest : public Test
+{
+protected:
+	static set<ino_t> inodes(const vector<unique_ptr<FrameBuffer>> &buffers)
+	{
+		set<ino_t> result;
+
+		for (const unique_ptr<FrameBuffer> &buffer : buffers) {
+			for (const FrameBuffer::Plane &plane : buffer->planes()) {
+				struct stat st;
+				if (fstat(plane.fd.fd(), &st) == 0)
+					result.insert(st.st_ino);
+			}
+		}
+
+		return result;
+	}
+
+	int testMemfd()
+	{
+		DmaBufferAllocator allocator(DmaHeap::Memfd);
+		if (!allocator.isValid()) {
+			cerr << "Memfd allocator not available" << endl;
+			return TestFail;
+		}
+
+		/* Allocate a buffer large enough to be backed by hugepages. */
+		const unsigned int size = 4000 * 3000 * 3 / 2;
+		vector<unique_ptr<FrameBuffer>> buffers;
+
+		int ret = allocator.exportBuffers(1, { size }, &buffers);
+		if (ret != 1) {
+			cerr << "Failed to allocate memfd buffers" << endl;
+			return TestFail;
+		}
+
+		MappedFrameBuffer map(buffers[0].get(), PROT_READ | PROT_WRITE);
+		if (!map.isValid() || map.maps()[0].size() != size) {
+			cerr << "Failed to map memfd buffer" << endl;
+			return TestFail;
+		}
+
+		if (map.pageSize(0) < static_cast<size_t>(sysconf(_SC_PAGESIZE))) {
+			cerr << "Invalid page size " << map.pageSize(0) << endl;
+			return TestFail;
+		}
+
+		memset(map.maps()[0].data(), 0xa5, size);
+		if (map.maps()[0][size - 1] != 0xa5) {
+			cerr << "Failed to access memfd buffer" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int init()
+	{
+		allocator_ = make_unique<DmaBufferAllocator>();
+		return TestPass;
+	}
+
+	int run()
+	{
+		int ret = testMemfd();
+		if (ret != TestPass)
+			return ret;
+
+		if (!allocator_->isValid()) {
+			cout << "No dma-heap available" << endl;
+			return TestSkip;
+		}
+
+		vector<unique_ptr<FrameBuffer>> buffers;
+
+		ret = allocator_->exportBuffers(4, { 640 * 480, 640 * 240 }, &buffers);
+		if (ret != 4 || buffers.size() != 4) {
+			cerr << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		for (const unique_ptr<FrameBuffer> &buffer : buffers) {
+			if (buffer->planes().size() != 2 ||
+			    buffer->planes()[0].length != 640 * 480 ||
+			    buffer->planes()[1].length != 640 * 240) {
+				cerr << "Invalid buffer planes" << endl;
+				return TestFail;
+			}
+		}
+
+		set<ino_t> allocated = inodes(buffers);
+
+		/* Recycled memory must be reused for similar sizes. */
+		allocator_->recycle(&buffers);
+		if (!buffers.empty() || allocator_->pooled() != 8) {
+			cerr << "Buffers not recycled" << endl;
+			return TestFail;
+		}
+
+		ret = allocator_->exportBuffers(8, { 600 * 400 }, &buffers);
+		if (ret != 8) {
+			cerr << "Failed to allocate buffers from the pool" << endl;
+			return TestFail;
+		}
+
+		set<ino_t> reused = inodes(buffers);
+		unsigned int count = 0;
+		for (ino_t ino : reused)
+			count += allocated.count(ino);
+
+		if (count != 4 || allocator_->pooled() != 4) {
+			cerr << "Pooled memory not reused as expected" << endl;
+			return TestFail;
+		}
+
+		/* Buffers allocated after clearing the pool are not recycled. */
+		allocator_->clear();
+		allocator_->recycle(&buffers);
+		if (allocator_->pooled() != 0) {
+			cerr << "Buffers recycled after clearing the pool" << endl;
+			return TestFail;
+		}
+
+		if (allocator_->exportBuffers(1, { 0 }, &buffers) != -EINVAL) {
+			cerr << "Invalid plane size accepted" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	unique_ptr<DmaBufferAllocator> allocator_;
+};
+
+TEST_REGISTER(DmaBufferAllocatorTest)
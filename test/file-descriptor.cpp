@@ -213,6 +213,27 @@ protected:
 		delete desc2_;
 		desc2_ = nullptr;
 
+		/* Test creating FileDescriptor by borrowing numerical fd. */
+		desc1_ = new FileDescriptor(FileDescriptor::borrow(fd_));
+		desc2_ = new FileDescriptor(*desc1_);
+
+		if (desc1_->fd() != fd_ || desc2_->fd() != fd_) {
+			std::cout << "Failed fd numerical check (borrow)"
+				  << std::endl;
+			return TestFail;
+		}
+
+		delete desc1_;
+		desc1_ = nullptr;
+		delete desc2_;
+		desc2_ = nullptr;
+
+		if (!isValidFd(fd_)) {
+			std::cout << "Failed fd validity after destruction (borrow)"
+				  << std::endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
@@ -368,6 +368,24 @@ protected:
 			return TestFail;
 		}
 
+		/* Test populated and read ahead mappings. */
+		for (File::MapFlag flag : { File::MapPopulate, File::MapWillNeed }) {
+			data = file.map(0, -1, flag);
+
+			str = { reinterpret_cast<char *>(data.data()), data.size() };
+			if (str != "LIBCAMERA") {
+				cerr << "Invalid contents of mapping with flag "
+				     << flag << endl;
+				return TestFail;
+			}
+
+			if (!file.unmap(data.data())) {
+				cerr << "Unmapping with flag " << flag
+				     << " failed" << endl;
+				return TestFail;
+			}
+		}
+
 		return TestPass;
 	}
 
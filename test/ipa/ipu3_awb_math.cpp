@@ -0,0 +1,228 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipu3_awb_math.cpp - IPU3 fixed-point white balance test and benchmark
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <stdlib.h>
+#include <vector>
+
+#include "ipu3_awb_math.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace libcamera::ipa::ipu3;
+
+/*
+ * Floating point reference implementation, as the AWB computed the gains
+ * before switching to fixed-point.
+ */
+namespace reference {
+
+struct RGB {
+	double R, G, B;
+};
+
+struct Result {
+	unsigned int zones;
+	uint16_t redGain;
+	uint16_t blueGain;
+	uint32_t temperatureK;
+};
+
+static double estimateCCT(double red, double green, double blue)
+{
+	double X = (-0.14282) * (red) + (1.54924) * (green) + (-0.95641) * (blue);
+	double Y = (-0.32466) * (red) + (1.57837) * (green) + (-0.73191) * (blue);
+	double Z = (-0.68202) * (red) + (0.77073) * (green) + (0.56332) * (blue);
+
+	double x = X / (X + Y + Z);
+	double y = Y / (X + Y + Z);
+
+	double n = (x - 0.3320) / (0.1858 - y);
+	return 449 * n * n * n + 3525 * n * n + 6823.3 * n + 5520.33;
+}
+
+static Result greyWorld(const IPU3GridStats &stats, double *cctN)
+{
+	vector<RGB> zones;
+
+	for (unsigned int i = 0; i < kAwbStatsSizeX * kAwbStatsSizeY; i++) {
+		const IspStatsRegion &region = stats.regions[i];
+		double counted = region.counted;
+		if (counted < 16)
+			continue;
+
+		RGB zone = { 0, region.gSum / counted, 0 };
+		if (zone.G < 32)
+			continue;
+
+		zone.R = region.rSum / counted;
+		zone.B = region.bSum / counted;
+		zones.push_back(zone);
+	}
+
+	Result result = { static_cast<unsigned int>(zones.size()), 0, 0, 0 };
+
+	vector<RGB> redDerivative(zones);
+	vector<RGB> blueDerivative(zones);
+	sort(redDerivative.begin(), redDerivative.end(),
+	     [](RGB const &a, RGB const &b) { return a.G * b.R < b.G * a.R; });
+	sort(blueDerivative.begin(), blueDerivative.end(),
+	     [](RGB const &a, RGB const &b) { return a.G * b.B < b.G * a.B; });
+
+	int discard = redDerivative.size() / 4;
+
+	RGB sumRed = { 0, 0, 0 };
+	RGB sumBlue = { 0, 0, 0 };
+	for (auto ri = redDerivative.begin() + discard,
+		  bi = blueDerivative.begin() + discard;
+	     ri != redDerivative.end() - discard; ri++, bi++) {
+		sumRed.R += ri->R, sumRed.G += ri->G;
+		sumBlue.B += bi->B, sumBlue.G += bi->G;
+	}
+
+	result.redGain = 4096 * (sumRed.G / (sumRed.R + 1));
+	result.blueGain = 4096 * (sumBlue.G / (sumBlue.B + 1));
+
+	double X = -0.14282 * sumRed.R + 1.54924 * sumRed.G - 0.95641 * sumBlue.B;
+	double Y = -0.32466 * sumRed.R + 1.57837 * sumRed.G - 0.73191 * sumBlue.B;
+	double Z = -0.68202 * sumRed.R + 0.77073 * sumRed.G + 0.56332 * sumBlue.B;
+	*cctN = (X / (X + Y + Z) - 0.3320) / (0.1858 - Y / (X + Y + Z));
+	result.temperatureK = estimateCCT(sumRed.R, sumRed.G, sumBlue.B);
+
+	return result;
+}
+
+} /* namespace reference */
+
+class AwbMathTest : public Test
+{
+protected:
+	template<typename Func>
+	double benchmark(Func func)
+	{
+		static constexpr unsigned int NumRuns = 1000;
+
+		auto begin = chrono::steady_clock::now();
+		for (unsigned int i = 0; i < NumRuns; i++)
+			func();
+		auto end = chrono::steady_clock::now();
+
+		return chrono::duration<double, micro>(end - begin).count() / NumRuns;
+	}
+
+	/* Fill the regions with a colour cast and random variations. */
+	void generateStats(mt19937 &gen, double redRatio, double blueRatio)
+	{
+		uniform_int_distribution<unsigned int> counted(0, 200);
+		uniform_real_distribution<double> level(10.0, 200.0);
+		uniform_real_distribution<double> variation(0.8, 1.2);
+
+		for (unsigned int i = 0; i < kAwbStatsSizeX * kAwbStatsSizeY; i++) {
+			IspStatsRegion &region = stats_.regions[i];
+			double green = level(gen);
+
+			region.counted = counted(gen);
+			region.uncounted = 0;
+			region.gSum = green * region.counted;
+			region.rSum = min(green * redRatio * variation(gen), 255.0) * region.counted;
+			region.bSum = min(green * blueRatio * variation(gen), 255.0) * region.counted;
+		}
+	}
+
+	int testScene(mt19937 &gen, double redRatio, double blueRatio)
+	{
+		generateStats(gen, redRatio, blueRatio);
+
+		double n;
+		reference::Result expected = reference::greyWorld(stats_, &n);
+
+		AwbZone zones[kAwbStatsSizeX * kAwbStatsSizeY];
+		unsigned int count = generateAwbZones(stats_, zones);
+		if (count != expected.zones) {
+			cerr << "Expected " << expected.zones << " zones, got "
+			     << count << endl;
+			return TestFail;
+		}
+
+		AwbStatus status;
+		awbGreyWorld(zones, count, &status);
+
+		/* Only the rounding of the last bit may differ. */
+		int redGain = awbGainToBnr(status.redGain);
+		int blueGain = awbGainToBnr(status.blueGain);
+		if (abs(redGain - expected.redGain) > 1 ||
+		    abs(blueGain - expected.blueGain) > 1) {
+			cerr << "Expected gains " << expected.redGain << "/"
+			     << expected.blueGain << ", got " << redGain << "/"
+			     << blueGain << endl;
+			return TestFail;
+		}
+
+		/* The approximation is only computed in its range of validity. */
+		int temperature = status.temperatureK;
+		int expectedTemperature = expected.temperatureK;
+		if (n > -2.0 && n < 2.0 &&
+		    abs(temperature - expectedTemperature) > 2) {
+			cerr << "Expected temperature " << expectedTemperature
+			     << "K, got " << temperature << "K" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		mt19937 gen(42);
+
+		for (double redRatio : { 0.4, 0.7, 1.0, 1.3 }) {
+			for (double blueRatio : { 0.4, 0.7, 1.0, 1.3 }) {
+				if (testScene(gen, redRatio, blueRatio) != TestPass)
+					return TestFail;
+			}
+		}
+
+		/* The gains saturate to the BNR field. */
+		if (awbGainToBnr(16 << kAwbGainShift) != 65535) {
+			cerr << "Gain not saturated" << endl;
+			return TestFail;
+		}
+
+		/* The results only depend on the ratios between the values. */
+		if (estimateCCT(100, 200, 150) != estimateCCT(100ULL << 30, 200ULL << 30, 150ULL << 30)) {
+			cerr << "Temperature depends on the scale" << endl;
+			return TestFail;
+		}
+
+		generateStats(gen, 0.6, 0.8);
+
+		double n;
+		double referenceTime = benchmark([&]() {
+			reference::greyWorld(stats_, &n);
+		});
+		double time = benchmark([&]() {
+			AwbZone zones[kAwbStatsSizeX * kAwbStatsSizeY];
+			AwbStatus status;
+			awbGreyWorld(zones, generateAwbZones(stats_, zones), &status);
+		});
+
+		cout << "Grey world: floating point " << referenceTime
+		     << " us, fixed-point " << time << " us" << endl;
+
+		return TestPass;
+	}
+
+private:
+	IPU3GridStats stats_;
+};
+
+TEST_REGISTER(AwbMathTest)
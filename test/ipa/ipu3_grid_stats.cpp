@@ -0,0 +1,184 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ipu3_grid_stats.cpp - IPU3 AWB grid statistics reduction test and benchmark
+ */
+
+#include <chrono>
+#include <iostream>
+#include <math.h>
+#include <memory>
+#include <random>
+#include <string.h>
+
+#include "ipu3_stats.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace libcamera::ipa::ipu3;
+
+/*
+ * Scalar reference implementation, walking the grid cell by cell once for the
+ * AWB regions and once for the green level histogram, as the AWB and AGC
+ * algorithms did before sharing the reduction.
+ */
+namespace reference {
+
+static void regions(const ipu3_uapi_stats_3a *stats,
+		    const ipu3_uapi_grid_config &grid,
+		    IspStatsRegion *regions)
+{
+	uint32_t regionWidth = round(grid.width / static_cast<double>(kAwbStatsSizeX));
+	uint32_t regionHeight = round(grid.height / static_cast<double>(kAwbStatsSizeY));
+
+	memset(regions, 0, sizeof(*regions) * kAwbStatsSizeX * kAwbStatsSizeY);
+
+	for (unsigned int j = 0; j < kAwbStatsSizeY * regionHeight; j++) {
+		for (unsigned int i = 0; i < kAwbStatsSizeX * regionWidth; i++) {
+			uint32_t cellPosition = j * grid.width + i;
+			uint32_t cellX = (cellPosition / regionWidth) % kAwbStatsSizeX;
+			uint32_t cellY = ((cellPosition / grid.width) / regionHeight) % kAwbStatsSizeY;
+			const uint8_t *cell = &stats->awb_raw_buffer.meta_data[cellPosition * 8];
+
+			if (cell[4] != 0)
+				continue;
+
+			IspStatsRegion &region = regions[cellY * kAwbStatsSizeX + cellX];
+			region.counted++;
+			region.gSum += (cell[0] + cell[3]) / 2;
+			region.rSum += cell[1];
+			region.bSum += cell[2];
+		}
+	}
+}
+
+static void histogram(const ipu3_uapi_stats_3a *stats,
+		      const ipu3_uapi_grid_config &grid, uint32_t *hist)
+{
+	memset(hist, 0, sizeof(*hist) * kGridHistogramBins);
+
+	for (unsigned int j = 0; j < grid.height; j++) {
+		for (unsigned int i = 0; i < grid.width; i++) {
+			const uint8_t *cell =
+				&stats->awb_raw_buffer.meta_data[(j * grid.width + i) * 8];
+			if (cell[4] == 0)
+				hist[(cell[0] + cell[3]) / 2]++;
+		}
+	}
+}
+
+} /* namespace reference */
+
+class GridStatsTest : public Test
+{
+protected:
+	template<typename Func>
+	double benchmark(Func func)
+	{
+		static constexpr unsigned int NumRuns = 1000;
+
+		auto begin = chrono::steady_clock::now();
+		for (unsigned int i = 0; i < NumRuns; i++)
+			func();
+		auto end = chrono::steady_clock::now();
+
+		return chrono::duration<double, micro>(end - begin).count() / NumRuns;
+	}
+
+	int testGrid(uint8_t width, uint8_t height)
+	{
+		ipu3_uapi_grid_config grid = {};
+		grid.width = width;
+		grid.height = height;
+
+		/* Fill the cells with random averages, a tenth of them saturated. */
+		mt19937 gen(width * height);
+		uniform_int_distribution<unsigned int> value(0, 255);
+		uniform_int_distribution<unsigned int> saturation(0, 9);
+
+		memset(stats_.get(), 0, sizeof(*stats_));
+		stats_->stats_3a_status.awb_en = 1;
+		for (unsigned int i = 0; i < width * height; i++) {
+			uint8_t *cell = &stats_->awb_raw_buffer.meta_data[i * 8];
+			for (unsigned int c = 0; c < 4; c++)
+				cell[c] = value(gen);
+			cell[4] = saturation(gen) ? 0 : value(gen) | 1;
+			cell[5] = cell[6] = cell[7] = value(gen);
+		}
+
+		IspStatsRegion regions[kAwbStatsSizeX * kAwbStatsSizeY];
+		uint32_t histogram[kGridHistogramBins];
+		reference::regions(stats_.get(), grid, regions);
+		reference::histogram(stats_.get(), grid, histogram);
+
+		IPU3GridStats gridStats;
+		generateGridStats(stats_.get(), grid, &gridStats);
+
+		for (unsigned int i = 0; i < kAwbStatsSizeX * kAwbStatsSizeY; i++) {
+			const IspStatsRegion &expected = regions[i];
+			const IspStatsRegion &region = gridStats.regions[i];
+
+			if (region.counted != expected.counted ||
+			    region.rSum != expected.rSum ||
+			    region.gSum != expected.gSum ||
+			    region.bSum != expected.bSum) {
+				cerr << "Incorrect statistics for region " << i
+				     << " of a " << static_cast<unsigned int>(width)
+				     << "x" << static_cast<unsigned int>(height)
+				     << " grid" << endl;
+				return TestFail;
+			}
+		}
+
+		if (memcmp(histogram, gridStats.histogram, sizeof(histogram))) {
+			cerr << "Incorrect histogram for a "
+			     << static_cast<unsigned int>(width) << "x"
+			     << static_cast<unsigned int>(height) << " grid" << endl;
+			return TestFail;
+		}
+
+		double referenceTime = benchmark([&]() {
+			reference::regions(stats_.get(), grid, regions);
+			reference::histogram(stats_.get(), grid, histogram);
+		});
+		double time = benchmark([&]() {
+			generateGridStats(stats_.get(), grid, &gridStats);
+		});
+
+		cout << static_cast<unsigned int>(width) << "x"
+		     << static_cast<unsigned int>(height) << " grid: reference "
+		     << referenceTime << " us, single pass " << time << " us"
+		     << endl;
+
+		return TestPass;
+	}
+
+	int init()
+	{
+		stats_ = make_unique<ipu3_uapi_stats_3a>();
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		/*
+		 * The reference matches the single pass reduction for grids made
+		 * of whole regions only.
+		 */
+		if (testGrid(160, 36) != TestPass ||
+		    testGrid(80, 48) != TestPass ||
+		    testGrid(16, 12) != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+
+private:
+	unique_ptr<ipu3_uapi_stats_3a> stats_;
+};
+
+TEST_REGISTER(GridStatsTest)
@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * libipa_histogram.cpp - libipa histogram test and benchmark
+ */
+
+#include <chrono>
+#include <iostream>
+#include <math.h>
+#include <random>
+#include <vector>
+
+#include "libipa/histogram.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace libcamera::ipa;
+
+/*
+ * Scalar reference implementations, a serial prefix sum and a linear scan for
+ * the quantile.
+ */
+namespace reference {
+
+static void cumulate(const vector<uint32_t> &data, vector<uint64_t> &cumulative)
+{
+	cumulative.clear();
+	cumulative.push_back(0);
+	for (uint32_t value : data)
+		cumulative.push_back(cumulative.back() + value);
+}
+
+static double quantile(const vector<uint64_t> &cumulative, uint64_t item)
+{
+	uint32_t bin = 0;
+	while (bin < cumulative.size() - 2 && cumulative[bin + 1] <= item)
+		bin++;
+
+	uint64_t low = cumulative[bin];
+	uint64_t high = cumulative[bin + 1];
+	if (high == low)
+		return bin;
+
+	return bin + static_cast<double>(item - low) / (high - low);
+}
+
+} /* namespace reference */
+
+class HistogramTest : public Test
+{
+protected:
+	template<typename Func>
+	double benchmark(Func func)
+	{
+		static constexpr unsigned int NumRuns = 10000;
+
+		auto begin = chrono::steady_clock::now();
+		for (unsigned int i = 0; i < NumRuns; i++)
+			func();
+		auto end = chrono::steady_clock::now();
+
+		return chrono::duration<double, nano>(end - begin).count() / NumRuns;
+	}
+
+	int testSize(size_t size)
+	{
+		mt19937 gen(size);
+		uniform_int_distribution<uint32_t> dist(0, 1000);
+
+		vector<uint32_t> data(size);
+		for (uint32_t &value : data)
+			value = dist(gen);
+
+		/* Leave a few empty bins, including the first and last ones. */
+		data[0] = data[size - 1] = data[size / 2] = 0;
+
+		vector<uint64_t> expected;
+		reference::cumulate(data, expected);
+
+		vector<uint64_t> cumulative(size + 1);
+		cumulateHistogram(data, cumulative.data());
+
+		if (cumulative != expected) {
+			cerr << "Incorrect cumulative frequencies for "
+			     << size << " bins" << endl;
+			return TestFail;
+		}
+
+		Histogram histogram(data);
+		for (unsigned int i = 0; i <= 100; i++) {
+			double q = i / 100.0;
+			uint64_t item = q * histogram.total();
+			double value = histogram.quantile(q);
+			double reference = reference::quantile(expected, item);
+
+			if (fabs(value - reference) > 1e-9) {
+				cerr << "Quantile " << q << " of " << size
+				     << " bins is " << value << ", expected "
+				     << reference << endl;
+				return TestFail;
+			}
+		}
+
+		if (size < 128)
+			return TestPass;
+
+		double referenceTime = benchmark([&]() {
+			reference::cumulate(data, expected);
+			for (unsigned int i = 1; i < 10; i++)
+				reference::quantile(expected, i * expected.back() / 10);
+		});
+		double time = benchmark([&]() {
+			Histogram h(data);
+			for (unsigned int i = 1; i < 10; i++)
+				h.quantile(i / 10.0);
+		});
+
+		cout << size << " bins: reference " << referenceTime
+		     << " ns, libipa " << time << " ns" << endl;
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		for (size_t size : { 1, 2, 3, 5, 127, 128, 256, 1023, 1024 }) {
+			int ret = testSize(size);
+			if (ret != TestPass)
+				return ret;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(HistogramTest)
@@ -0,0 +1,188 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * libipa_module.cpp - libipa algorithm module and frame context queue test
+ */
+
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "libipa/fc_queue.h"
+#include "libipa/module.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+using namespace libcamera::ipa;
+
+namespace {
+
+struct TestFrameContext : public FrameContext {
+	unsigned int prepared;
+	unsigned int processed;
+};
+
+struct TestContext {
+	vector<unsigned int> calls;
+	FCQueue<TestFrameContext> frameContexts;
+};
+
+struct TestConfig {
+	int result;
+};
+
+struct TestParams {
+	unsigned int value;
+};
+
+struct TestStats {
+	unsigned int value;
+};
+
+using TestModule = Module<TestContext, TestFrameContext, TestConfig,
+			  TestParams, TestStats>;
+
+class TestAlgorithm : public Algorithm<TestModule>
+{
+public:
+	TestAlgorithm(unsigned int id)
+		: id_(id)
+	{
+	}
+
+	int configure(TestContext &context, const TestConfig &config) override
+	{
+		context.calls.push_back(id_);
+		return config.result;
+	}
+
+	void prepare(TestContext &context, [[maybe_unused]] uint32_t frame,
+		     TestFrameContext &frameContext, TestParams *params) override
+	{
+		context.calls.push_back(id_);
+		frameContext.prepared++;
+		params->value = params->value * 10 + id_;
+	}
+
+	void process(TestContext &context, [[maybe_unused]] uint32_t frame,
+		     TestFrameContext &frameContext, const TestStats *stats) override
+	{
+		context.calls.push_back(id_);
+		frameContext.processed += stats->value;
+	}
+
+private:
+	unsigned int id_;
+};
+
+} /* namespace */
+
+class ModuleTest : public Test
+{
+protected:
+	int testFCQueue()
+	{
+		FCQueue<TestFrameContext> queue;
+
+		TestFrameContext &fc = queue.init(3);
+		if (fc.frame != 3 || fc.prepared || fc.processed) {
+			cout << "Frame context not initialised" << endl;
+			return TestFail;
+		}
+
+		fc.prepared = 1;
+		if (&queue.get(3) != &fc || queue.get(3).prepared != 1) {
+			cout << "Frame context lookup failed" << endl;
+			return TestFail;
+		}
+
+		/* A later frame that wraps around the ring reuses the context. */
+		uint32_t later = 3 + FCQueue<TestFrameContext>::kMaxFrameContexts;
+		TestFrameContext &reused = queue.init(later);
+		if (&reused != &fc || reused.prepared) {
+			cout << "Frame context not reused on wrap around" << endl;
+			return TestFail;
+		}
+
+		/* Looking up an overwritten frame initialises its context again. */
+		TestFrameContext &stale = queue.get(3);
+		if (stale.frame != 3 || stale.prepared) {
+			cout << "Stale frame context not initialised" << endl;
+			return TestFail;
+		}
+
+		queue.clear();
+		if (queue.get(5).frame != 5) {
+			cout << "Cleared frame context not initialised" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testModule()
+	{
+		TestModule module;
+		TestContext context;
+
+		module.addAlgorithm("first", std::make_unique<TestAlgorithm>(1));
+		module.addAlgorithm("second", std::make_unique<TestAlgorithm>(2));
+
+		/* Configuration stops at the first failure. */
+		if (module.configure(context, { -22 }) != -22 ||
+		    context.calls != vector<unsigned int>{ 1 }) {
+			cout << "Configuration failure not reported" << endl;
+			return TestFail;
+		}
+
+		context.calls.clear();
+		if (module.configure(context, { 0 }) ||
+		    context.calls != vector<unsigned int>{ 1, 2 }) {
+			cout << "Configuration failed" << endl;
+			return TestFail;
+		}
+
+		/* The algorithms run in the order they have been added. */
+		TestFrameContext &frameContext = context.frameContexts.init(0);
+		TestParams params = { 0 };
+		TestStats stats = { 4 };
+
+		context.calls.clear();
+		module.prepare(context, 0, frameContext, &params);
+		module.process(context, 0, frameContext, &stats);
+
+		if (params.value != 12 ||
+		    context.calls != vector<unsigned int>{ 1, 2, 1, 2 }) {
+			cout << "Algorithms not run in order" << endl;
+			return TestFail;
+		}
+
+		if (frameContext.prepared != 2 || frameContext.processed != 8) {
+			cout << "Frame context not updated" << endl;
+			return TestFail;
+		}
+
+		string timings = module.timings();
+		if (timings.find("first") == string::npos ||
+		    timings.find("second") == string::npos) {
+			cout << "Algorithm timings not reported" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		int ret = testFCQueue();
+		if (ret != TestPass)
+			return ret;
+
+		return testModule();
+	}
+};
+
+TEST_REGISTER(ModuleTest)
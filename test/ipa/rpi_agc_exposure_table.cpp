@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * rpi_agc_exposure_table.cpp - Raspberry Pi AGC exposure division table test
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "rpi/agc_exposure_table.hpp"
+
+#include "test.h"
+
+using namespace std;
+using namespace RPiController;
+
+/*
+ * Reference implementation, walking through the exposure mode stages as the
+ * AGC algorithm did before the division was precomputed.
+ */
+namespace reference {
+
+static void divide(const vector<double> &shutter, const vector<double> &gain,
+		   double fixed_shutter, double fixed_analogue_gain,
+		   double max_shutter, double flicker_period,
+		   double exposure_value, double &shutter_time,
+		   double &analogue_gain)
+{
+	auto clipShutter = [&](double s) {
+		return max_shutter ? min(s, max_shutter) : s;
+	};
+
+	shutter_time = fixed_shutter != 0.0 ? fixed_shutter : shutter[0];
+	shutter_time = clipShutter(shutter_time);
+	analogue_gain = fixed_analogue_gain != 0.0 ? fixed_analogue_gain : gain[0];
+	if (shutter_time * analogue_gain < exposure_value) {
+		for (unsigned int stage = 1; stage < gain.size(); stage++) {
+			if (fixed_shutter == 0.0) {
+				double stage_shutter = clipShutter(shutter[stage]);
+				if (stage_shutter * analogue_gain >= exposure_value) {
+					shutter_time = exposure_value / analogue_gain;
+					break;
+				}
+				shutter_time = stage_shutter;
+			}
+			if (fixed_analogue_gain == 0.0) {
+				if (gain[stage] * shutter_time >= exposure_value) {
+					analogue_gain = exposure_value / shutter_time;
+					break;
+				}
+				analogue_gain = gain[stage];
+			}
+		}
+	}
+
+	if (fixed_shutter == 0.0 && fixed_analogue_gain == 0.0 &&
+	    flicker_period != 0.0) {
+		int flicker_periods = shutter_time / flicker_period;
+		if (flicker_periods > 0) {
+			double new_shutter_time = flicker_periods * flicker_period;
+			analogue_gain *= shutter_time / new_shutter_time;
+			analogue_gain = min(analogue_gain, gain.back());
+			shutter_time = new_shutter_time;
+		}
+	}
+}
+
+} /* namespace reference */
+
+class AgcExposureTableTest : public Test
+{
+protected:
+	struct Mode {
+		vector<double> shutter;
+		vector<double> gain;
+	};
+
+	int check(const Mode &mode, double fixed_shutter,
+		  double fixed_analogue_gain, double max_shutter,
+		  double flicker_period)
+	{
+		AgcExposureTable table;
+		table.Build(mode.shutter, mode.gain, fixed_shutter,
+			    fixed_analogue_gain, max_shutter, flicker_period);
+
+		double max_exposure = (fixed_shutter != 0.0 ? fixed_shutter
+				       : max_shutter ? min(mode.shutter.back(), max_shutter)
+				       : mode.shutter.back()) *
+				      (fixed_analogue_gain != 0.0 ? fixed_analogue_gain
+								  : mode.gain.back());
+		if (table.MaxExposure() != max_exposure) {
+			cerr << "Maximum exposure " << table.MaxExposure()
+			     << " differs from " << max_exposure << endl;
+			return TestFail;
+		}
+
+		uniform_real_distribution<double> exposures(1.0, 2.0 * max_exposure);
+
+		for (unsigned int i = 0; i < 1000; i++) {
+			double exposure = exposures(gen_);
+			double ref_shutter, ref_gain, shutter, gain;
+
+			reference::divide(mode.shutter, mode.gain, fixed_shutter,
+					  fixed_analogue_gain, max_shutter,
+					  flicker_period, exposure, ref_shutter,
+					  ref_gain);
+			table.Divide(exposure, shutter, gain);
+
+			/* The table must give exactly the same results. */
+			if (shutter != ref_shutter || gain != ref_gain) {
+				cerr << "Exposure " << exposure << " divided into "
+				     << shutter << " x " << gain << ", expected "
+				     << ref_shutter << " x " << ref_gain
+				     << " (fixed " << fixed_shutter << " x "
+				     << fixed_analogue_gain << ", max shutter "
+				     << max_shutter << ", flicker "
+				     << flicker_period << ")" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		/* The default exposure modes of the tuning files. */
+		const vector<Mode> modes = {
+			{ { 100, 10000, 30000, 60000, 66666 }, { 1.0, 2.0, 4.0, 6.0, 8.0 } },
+			{ { 100, 5000, 10000, 20000, 33333 }, { 1.0, 2.0, 4.0, 6.0, 8.0 } },
+			{ { 100, 10000, 30000, 60000, 120000 }, { 1.0, 2.0, 4.0, 6.0, 6.0 } },
+			{ { 1000 }, { 1.0 } },
+			/* A mode that doesn't always increase. */
+			{ { 100, 20000, 10000, 30000 }, { 1.0, 4.0, 2.0, 8.0 } },
+		};
+
+		for (const Mode &mode : modes) {
+			for (double fixed_shutter : { 0.0, 15000.0 }) {
+				for (double fixed_gain : { 0.0, 3.0 }) {
+					for (double max_shutter : { 0.0, 25000.0 }) {
+						for (double flicker : { 0.0, 10000.0, 8333.33 }) {
+							if (check(mode, fixed_shutter, fixed_gain,
+								  max_shutter, flicker) != TestPass)
+								return TestFail;
+						}
+					}
+				}
+			}
+		}
+
+		return TestPass;
+	}
+
+private:
+	mt19937 gen_{ 42 };
+};
+
+TEST_REGISTER(AgcExposureTableTest)
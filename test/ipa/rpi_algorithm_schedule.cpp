@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * rpi_algorithm_schedule.cpp - Raspberry Pi algorithms scheduling test
+ */
+
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#include "algorithm.hpp"
+#include "rpi/agc.hpp"
+#include "rpi/awb.hpp"
+
+#include "test.h"
+
+using namespace std;
+using namespace RPiController;
+
+class AlgorithmScheduleTest : public Test
+{
+protected:
+	/*
+	 * Run the graph and check that task \a after only starts once task
+	 * \a before has completed.
+	 */
+	int checkOrder(const Scheduler::Graph &graph, unsigned int before,
+		       unsigned int after)
+	{
+		Scheduler scheduler(3);
+
+		for (unsigned int run = 0; run < 100; run++) {
+			std::mutex mutex;
+			bool done = false;
+			bool ordered = true;
+
+			scheduler.Run(graph, [&](unsigned int i) {
+				std::lock_guard<std::mutex> locker(mutex);
+				if (i == after)
+					ordered = done;
+				else if (i == before)
+					done = true;
+			});
+
+			if (!ordered)
+				return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		/*
+		 * The algorithms are listed in the order of the tuning files.
+		 * AGC reads the AWB status written by AWB in Prepare(), and
+		 * must thus be scheduled after it.
+		 */
+		Awb awb(nullptr);
+		Agc agc(nullptr);
+
+		if (!agc.PrepareAccess().ConflictsWith(awb.PrepareAccess())) {
+			cerr << "AGC and AWB prepare accesses don't conflict" << endl;
+			return TestFail;
+		}
+
+		Scheduler::Graph prepare = BuildAccessGraph({ awb.PrepareAccess(),
+							      agc.PrepareAccess() });
+		if (checkOrder(prepare, 0, 1) != TestPass) {
+			cerr << "AGC prepared before AWB" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(AlgorithmScheduleTest)
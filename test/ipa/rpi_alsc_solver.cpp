@@ -0,0 +1,231 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * rpi_alsc_solver.cpp - Raspberry Pi ALSC grid solver test and benchmark
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <math.h>
+#include <random>
+
+#include "rpi/alsc_solver.hpp"
+
+#include "test.h"
+
+using namespace std;
+using namespace RPiController;
+
+static const int X = ALSC_CELLS_X;
+static const int Y = ALSC_CELLS_Y;
+static const int XY = X * Y;
+
+/*
+ * Scalar reference implementation, computing the same operations in the same
+ * order as the ALSC algorithm did before the solver was vectorised.
+ */
+namespace reference {
+
+static double compute_weight(double C_i, double C_j, double sigma)
+{
+	if (C_i == ALSC_INSUFFICIENT_DATA || C_j == ALSC_INSUFFICIENT_DATA)
+		return 0;
+	double diff = (C_i - C_j) / sigma;
+	return exp(-diff * diff / 2);
+}
+
+static void compute_W(double const C[XY], double sigma, double W[XY][4])
+{
+	for (int i = 0; i < XY; i++) {
+		W[i][0] = i >= X ? compute_weight(C[i], C[i - X], sigma) : 0;
+		W[i][1] = i % X < X - 1 ? compute_weight(C[i], C[i + 1], sigma)
+					: 0;
+		W[i][2] =
+			i < XY - X ? compute_weight(C[i], C[i + X], sigma) : 0;
+		W[i][3] = i % X ? compute_weight(C[i], C[i - 1], sigma) : 0;
+	}
+}
+
+static void construct_M(double const C[XY], double const W[XY][4],
+			double M[XY][4])
+{
+	double epsilon = 0.001;
+	for (int i = 0; i < XY; i++) {
+		int m = !!(i >= X) + !!(i % X < X - 1) + !!(i < XY - X) +
+			!!(i % X);
+		double diagonal =
+			(epsilon + W[i][0] + W[i][1] + W[i][2] + W[i][3]) *
+			C[i];
+		M[i][0] = i >= X ? (W[i][0] * C[i - X] + epsilon / m * C[i]) /
+					   diagonal
+				 : 0;
+		M[i][1] = i % X < X - 1
+				  ? (W[i][1] * C[i + 1] + epsilon / m * C[i]) /
+					    diagonal
+				  : 0;
+		M[i][2] = i < XY - X
+				  ? (W[i][2] * C[i + X] + epsilon / m * C[i]) /
+					    diagonal
+				  : 0;
+		M[i][3] = i % X ? (W[i][3] * C[i - 1] + epsilon / m * C[i]) /
+					  diagonal
+				: 0;
+	}
+}
+
+static double compute_lambda(int i, double const M[XY][4], double lambda[XY])
+{
+	double sum = 0;
+	sum += i >= X ? M[i][0] * lambda[i - X] : 0;
+	sum += i % X < X - 1 ? M[i][1] * lambda[i + 1] : 0;
+	sum += i < XY - X ? M[i][2] * lambda[i + X] : 0;
+	sum += i % X ? M[i][3] * lambda[i - 1] : 0;
+	return sum;
+}
+
+static double gauss_seidel2_SOR(double const M[XY][4], double omega,
+				double lambda[XY])
+{
+	double old_lambda[XY];
+	int i;
+	for (i = 0; i < XY; i++)
+		old_lambda[i] = lambda[i];
+	for (i = 0; i < XY; i++)
+		lambda[i] = compute_lambda(i, M, lambda);
+	for (i = XY - 1; i >= 0; i--)
+		lambda[i] = compute_lambda(i, M, lambda);
+	double max_diff = 0;
+	for (i = 0; i < XY; i++) {
+		lambda[i] = old_lambda[i] + (lambda[i] - old_lambda[i]) * omega;
+		if (fabs(lambda[i] - old_lambda[i]) > fabs(max_diff))
+			max_diff = lambda[i] - old_lambda[i];
+	}
+	return max_diff;
+}
+
+static int solve(double const C[XY], double sigma, double omega, int n_iter,
+		 double threshold, double lambda[XY])
+{
+	double W[XY][4], M[XY][4];
+	compute_W(C, sigma, W);
+	construct_M(C, W, M);
+
+	int i;
+	for (i = 0; i < n_iter; i++) {
+		if (fabs(gauss_seidel2_SOR(M, omega, lambda)) < threshold) {
+			i++;
+			break;
+		}
+	}
+
+	double minval = *min_element(lambda, lambda + XY);
+	for (i = 0; i < XY; i++)
+		lambda[i] /= minval;
+
+	return i;
+}
+
+} /* namespace reference */
+
+class AlscSolverTest : public Test
+{
+protected:
+	static constexpr double Sigma = 0.01;
+	static constexpr double Omega = 1.3;
+	static constexpr int NumIterations = 100;
+	static constexpr double Threshold = 1e-3;
+
+	int init()
+	{
+		/*
+		 * Simulate colour shading increasing towards the corners of
+		 * the image, with noise and a few cells lacking data.
+		 */
+		mt19937 gen(42);
+		normal_distribution<double> noise(0.0, 0.002);
+
+		for (int y = 0; y < Y; y++) {
+			for (int x = 0; x < X; x++) {
+				double dx = (x - (X - 1) / 2.0) / X;
+				double dy = (y - (Y - 1) / 2.0) / Y;
+				C_[y * X + x] = 0.8 + 0.3 * (dx * dx + dy * dy) +
+						noise(gen);
+			}
+		}
+
+		C_[0] = C_[X + 5] = C_[XY - 1] = ALSC_INSUFFICIENT_DATA;
+
+		return TestPass;
+	}
+
+	template<typename Func>
+	double benchmark(Func func, double lambda[XY])
+	{
+		static constexpr unsigned int NumRuns = 200;
+
+		auto begin = chrono::steady_clock::now();
+		for (unsigned int i = 0; i < NumRuns; i++) {
+			fill(lambda, lambda + XY, 1.0);
+			func(lambda);
+		}
+		auto end = chrono::steady_clock::now();
+
+		return chrono::duration<double, micro>(end - begin).count() / NumRuns;
+	}
+
+	int compare(const double reference[XY], const double lambda[XY],
+		    double tolerance, const char *name)
+	{
+		double max_error = 0;
+		for (int i = 0; i < XY; i++)
+			max_error = max(max_error,
+					fabs(lambda[i] - reference[i]) / reference[i]);
+
+		if (max_error > tolerance) {
+			cerr << name << " solver error " << max_error
+			     << " exceeds " << tolerance << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		double reference[XY], lambda_double[XY], lambda_float[XY];
+
+		double reference_time = benchmark([&](double lambda[XY]) {
+			reference::solve(C_, Sigma, Omega, NumIterations,
+					 Threshold, lambda);
+		}, reference);
+		double double_time = benchmark([&](double lambda[XY]) {
+			alsc_solve(C_, Sigma, Omega, NumIterations, Threshold,
+				   false, lambda);
+		}, lambda_double);
+		double float_time = benchmark([&](double lambda[XY]) {
+			alsc_solve(C_, Sigma, Omega, NumIterations, Threshold,
+				   true, lambda);
+		}, lambda_float);
+
+		cout << "Reference: " << reference_time << " us, double: "
+		     << double_time << " us, float: " << float_time << " us"
+		     << endl;
+
+		/*
+		 * The double precision solver only differs from the reference
+		 * in the order of the additions of the backward sweep.
+		 */
+		if (compare(reference, lambda_double, 1e-9, "Double") != TestPass ||
+		    compare(reference, lambda_float, 1e-3, "Float") != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+
+private:
+	double C_[XY];
+};
+
+TEST_REGISTER(AlscSolverTest)
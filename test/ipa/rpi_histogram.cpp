@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * rpi_histogram.cpp - Raspberry Pi histogram digest test
+ */
+
+#include <iostream>
+#include <random>
+
+#include "histogram.hpp"
+
+#include "test.h"
+
+using namespace std;
+using namespace RPiController;
+
+class HistogramDigestTest : public Test
+{
+protected:
+	int check(const uint32_t *bins)
+	{
+		HistogramStatus status;
+		DigestHistogram(bins, status);
+
+		uint64_t weightedSum = 0;
+		for (unsigned int i = 0; i < NUM_HISTOGRAM_BINS; i++)
+			weightedSum += static_cast<uint64_t>(bins[i]) * i;
+
+		if (status.weighted_sum != weightedSum) {
+			cerr << "Weighted sum " << status.weighted_sum
+			     << ", expected " << weightedSum << endl;
+			return TestFail;
+		}
+
+		/* The digest must answer exactly as a Histogram of the bins. */
+		Histogram reference(bins, NUM_HISTOGRAM_BINS);
+		Histogram digest(status);
+
+		if (digest.Bins() != reference.Bins() ||
+		    digest.Total() != reference.Total()) {
+			cerr << "Digest size mismatch" << endl;
+			return TestFail;
+		}
+
+		if (!reference.Total())
+			return TestPass;
+
+		for (double q : { 0.01, 0.2, 0.5, 0.95, 0.98 }) {
+			if (digest.Quantile(q) != reference.Quantile(q)) {
+				cerr << "Quantile " << q << " mismatch" << endl;
+				return TestFail;
+			}
+		}
+
+		if (digest.InterQuantileMean(0.2, 0.8) !=
+		    reference.InterQuantileMean(0.2, 0.8)) {
+			cerr << "Inter-quantile mean mismatch" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		uint32_t bins[NUM_HISTOGRAM_BINS] = {};
+
+		if (check(bins) != TestPass)
+			return TestFail;
+
+		/* A single bin, at both ends. */
+		bins[0] = 1000;
+		if (check(bins) != TestPass)
+			return TestFail;
+
+		bins[0] = 0;
+		bins[NUM_HISTOGRAM_BINS - 1] = 1000;
+		if (check(bins) != TestPass)
+			return TestFail;
+
+		/* Random histograms, up to the full sensor pixel counts. */
+		mt19937 gen(42);
+		uniform_int_distribution<uint32_t> dist(0, 1 << 20);
+
+		for (unsigned int n = 0; n < 100; n++) {
+			for (uint32_t &bin : bins)
+				bin = dist(gen);
+
+			if (check(bins) != TestPass)
+				return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(HistogramDigestTest)
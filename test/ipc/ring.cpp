@@ -0,0 +1,393 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * ring.cpp - Shared memory ring IPC test
+ */
+
+#include <chrono>
+#include <iostream>
+#include <string.h>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "libcamera/internal/event_dispatcher.h"
+#include "libcamera/internal/ipc_ring.h"
+#include "libcamera/internal/ipc_unixsocket.h"
+#include "libcamera/internal/thread.h"
+#include "libcamera/internal/timer.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Receive all messages from an IPC channel and record them. The template
+ * parameter is the transport, either IPCRing or IPCUnixSocket.
+ */
+template<typename T>
+class Receiver
+{
+public:
+	Receiver(T *ipc)
+		: ipc_(ipc)
+	{
+		ipc_->readyRead.connect(this, &Receiver::readyRead);
+	}
+
+	~Receiver()
+	{
+		ipc_->readyRead.disconnect(this);
+	}
+
+	vector<typename T::Payload> payloads;
+
+private:
+	void readyRead(T *ipc)
+	{
+		typename T::Payload payload;
+		if (ipc->receive(&payload))
+			return;
+
+		payloads.push_back(std::move(payload));
+	}
+
+	T *ipc_;
+};
+
+class IPCRingTest : public Test
+{
+protected:
+	/*
+	 * Layout of the shared memory, the control block of each ring stores
+	 * the head and tail indices and the waiting flag in three cache lines.
+	 */
+	static constexpr size_t ControlSize = 192;
+	static constexpr size_t SharedSize = 2 * (ControlSize + IPCRing::RingSize);
+
+	int init()
+	{
+		vector<int> fds = host_.create();
+		if (fds.size() != 4) {
+			cerr << "Failed to create IPC ring" << endl;
+			return TestFail;
+		}
+
+		/* Map the shared memory to corrupt it from the test. */
+		void *mem = mmap(nullptr, SharedSize, PROT_READ | PROT_WRITE,
+				 MAP_SHARED, fds[1], 0);
+		if (mem == MAP_FAILED) {
+			cerr << "Failed to map the shared memory" << endl;
+			return TestFail;
+		}
+
+		shared_ = static_cast<uint8_t *>(mem);
+
+		/*
+		 * The remote side takes ownership of its file descriptors,
+		 * duplicate them to bind in the same process.
+		 */
+		for (int &fd : fds)
+			fd = dup(fd);
+
+		if (remote_.bind(fds)) {
+			cerr << "Failed to bind IPC ring" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	template<typename T>
+	int waitFor(Receiver<T> &receiver, size_t count)
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		Timer timeout;
+
+		timeout.start(1000);
+		while (receiver.payloads.size() < count && timeout.isRunning())
+			dispatcher->processEvents();
+
+		return receiver.payloads.size() == count ? TestPass : TestFail;
+	}
+
+	static IPCRing::Payload message(unsigned int index, size_t size)
+	{
+		IPCRing::Payload payload;
+
+		payload.data.resize(size);
+		for (size_t i = 0; i < size; ++i)
+			payload.data[i] = index + i;
+
+		return payload;
+	}
+
+	static bool check(const IPCRing::Payload &payload, unsigned int index,
+			  size_t size)
+	{
+		return payload.data == message(index, size).data;
+	}
+
+	int testOrdering()
+	{
+		Receiver<IPCRing> receiver(&remote_);
+
+		/*
+		 * Interleave small messages transported in the ring with
+		 * messages carrying a file descriptor and large messages, both
+		 * transported through the socket, and verify that ordering is
+		 * preserved.
+		 */
+		static const size_t sizes[] = { 16, 100, IPCRing::RingSize / 4 + 8, 7, 4096 };
+		static constexpr unsigned int NumMessages = 50;
+
+		for (unsigned int i = 0; i < NumMessages; ++i) {
+			size_t size = sizes[i % 5];
+			IPCRing::Payload payload = message(i, size);
+			if (i % 5 == 1)
+				payload.fds.push_back(STDOUT_FILENO);
+
+			int ret = host_.send(payload);
+			if (ret) {
+				cerr << "Failed to send message " << i << ": "
+				     << ret << endl;
+				return TestFail;
+			}
+
+			/* Keep the ring from filling up with large messages. */
+			if (i % 5 == 4 && waitFor(receiver, i + 1) != TestPass) {
+				cerr << "Messages not received" << endl;
+				return TestFail;
+			}
+		}
+
+		for (unsigned int i = 0; i < NumMessages; ++i) {
+			const IPCRing::Payload &payload = receiver.payloads[i];
+
+			if (!check(payload, i, sizes[i % 5])) {
+				cerr << "Message " << i << " corrupted or out of order"
+				     << endl;
+				return TestFail;
+			}
+
+			if (payload.fds.size() != (i % 5 == 1 ? 1 : 0)) {
+				cerr << "Message " << i << " has invalid fds" << endl;
+				return TestFail;
+			}
+
+			for (int fd : payload.fds)
+				close(fd);
+		}
+
+		return TestPass;
+	}
+
+	int testReply()
+	{
+		Receiver<IPCRing> receiver(&host_);
+
+		if (remote_.send(message(42, 32))) {
+			cerr << "Failed to send reply" << endl;
+			return TestFail;
+		}
+
+		if (waitFor(receiver, 1) != TestPass ||
+		    !check(receiver.payloads[0], 42, 32)) {
+			cerr << "Reply not received" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testBackpressure()
+	{
+		Receiver<IPCRing> receiver(&remote_);
+		IPCRing::Payload payload = message(0, 4096);
+
+		/*
+		 * Fill the ring without dispatching events on the remote side,
+		 * while a separate thread receives a single message after a
+		 * delay. The send that finds the ring full shall block until
+		 * the message is received, and then succeed.
+		 */
+		std::thread consumer([this] {
+			this_thread::sleep_for(chrono::milliseconds(200));
+
+			IPCRing::Payload received;
+			remote_.receive(&received);
+		});
+
+		unsigned int sent = 0;
+		bool blocked = false;
+
+		while (!blocked && sent < 2 * IPCRing::RingSize / 4096) {
+			auto begin = chrono::steady_clock::now();
+
+			int ret = host_.send(payload);
+			if (ret) {
+				cerr << "Failed to send message " << sent << ": "
+				     << ret << endl;
+				consumer.join();
+				return TestFail;
+			}
+
+			auto end = chrono::steady_clock::now();
+			blocked = end - begin > chrono::milliseconds(100);
+			sent++;
+		}
+
+		consumer.join();
+
+		if (!blocked) {
+			cerr << "Send didn't block on full ring" << endl;
+			return TestFail;
+		}
+
+		/* Without a consumer, sending shall time out. */
+		if (host_.send(payload) != -ENOBUFS) {
+			cerr << "Send to full ring didn't time out" << endl;
+			return TestFail;
+		}
+
+		if (waitFor(receiver, sent - 1) != TestPass) {
+			cerr << "Messages not received after blocking" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void disconnected([[maybe_unused]] IPCRing *ring)
+	{
+		disconnected_ = true;
+	}
+
+	int testCorruption()
+	{
+		Receiver<IPCRing> receiver(&remote_);
+		remote_.disconnected.connect(this, &IPCRingTest::disconnected);
+		disconnected_ = false;
+
+		/*
+		 * Locate the record of the next message in the host ring. The
+		 * 8 bytes record header and the 16 bytes of data are moved to
+		 * the start of the ring if they don't fit at the end.
+		 */
+		static constexpr size_t RecordSize = 8 + 16;
+
+		uint32_t head;
+		memcpy(&head, shared_, sizeof(head));
+
+		size_t offset = head & (IPCRing::RingSize - 1);
+		if (IPCRing::RingSize - offset < RecordSize)
+			offset = 0;
+
+		if (host_.send(message(0, 16))) {
+			cerr << "Failed to send message" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Make the record size point past the ring before the remote
+		 * side receives it, the message shall be rejected and the
+		 * connection dropped.
+		 */
+		uint32_t size = IPCRing::RingSize;
+		memcpy(shared_ + ControlSize + offset, &size, sizeof(size));
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		Timer timeout;
+
+		timeout.start(1000);
+		while (!disconnected_ && timeout.isRunning())
+			dispatcher->processEvents();
+
+		if (!disconnected_ || remote_.isBound()) {
+			cerr << "Corrupted ring not detected" << endl;
+			return TestFail;
+		}
+
+		if (!receiver.payloads.empty()) {
+			cerr << "Corrupted message received" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	template<typename T>
+	double benchmark(T *tx, T *rx)
+	{
+		static constexpr unsigned int NumMessages = 2000;
+		static constexpr unsigned int BatchSize = 20;
+
+		Receiver<T> receiver(rx);
+		IPCRing::Payload payload = message(0, 4096);
+
+		auto begin = chrono::steady_clock::now();
+
+		for (unsigned int i = 0; i < NumMessages; i += BatchSize) {
+			for (unsigned int j = 0; j < BatchSize; ++j)
+				tx->send(payload);
+
+			if (waitFor(receiver, i + BatchSize) != TestPass)
+				return -1.0;
+		}
+
+		auto end = chrono::steady_clock::now();
+
+		return chrono::duration<double, micro>(end - begin).count() / NumMessages;
+	}
+
+	int run()
+	{
+		if (testOrdering() != TestPass)
+			return TestFail;
+
+		if (testReply() != TestPass)
+			return TestFail;
+
+		if (testBackpressure() != TestPass)
+			return TestFail;
+
+		/* Compare the cost of a 4kB message with the Unix socket IPC. */
+		IPCUnixSocket socketTx, socketRx;
+		if (socketRx.bind(socketTx.create())) {
+			cerr << "Failed to create socket" << endl;
+			return TestFail;
+		}
+
+		double ringTime = benchmark(&host_, &remote_);
+		double socketTime = benchmark(&socketTx, &socketRx);
+		if (ringTime < 0 || socketTime < 0) {
+			cerr << "Benchmark messages not received" << endl;
+			return TestFail;
+		}
+
+		cout << "Ring: " << ringTime << " us/message, socket: "
+		     << socketTime << " us/message" << endl;
+
+		if (testCorruption() != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		munmap(shared_, SharedSize);
+	}
+
+private:
+	IPCRing host_;
+	IPCRing remote_;
+
+	uint8_t *shared_;
+	bool disconnected_;
+};
+
+TEST_REGISTER(IPCRingTest)
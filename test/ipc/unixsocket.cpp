@@ -252,6 +252,50 @@ protected:
 		return 0;
 	}
 
+	int testBurst()
+	{
+		constexpr uint8_t count = 8;
+		Timer timeout;
+		int ret;
+
+		/*
+		 * Send messages back to back, the responses shall all be
+		 * received, in order.
+		 */
+		responses_.clear();
+		burst_ = true;
+
+		for (uint8_t i = 0; i < count; i++) {
+			IPCUnixSocket::Payload message;
+			message.data = { CMD_REVERSE, i, 1, 2, 3 };
+
+			ret = ipc_.send(message);
+			if (ret)
+				return ret;
+		}
+
+		timeout.start(200);
+		while (responses_.size() < count) {
+			if (!timeout.isRunning()) {
+				cerr << "Burst timeout!" << endl;
+				burst_ = false;
+				return -ETIMEDOUT;
+			}
+
+			Thread::current()->eventDispatcher()->processEvents();
+		}
+
+		burst_ = false;
+
+		for (uint8_t i = 0; i < count; i++) {
+			const std::vector<uint8_t> expected = { CMD_REVERSE, 3, 2, 1, i };
+			if (responses_[i].data != expected)
+				return TestFail;
+		}
+
+		return 0;
+	}
+
 	int testEmptyFail()
 	{
 		IPCUnixSocket::Payload message;
@@ -354,6 +398,7 @@ protected:
 	int init()
 	{
 		callResponse_ = nullptr;
+		burst_ = false;
 		return 0;
 	}
 
@@ -376,6 +421,12 @@ protected:
 			return TestFail;
 		}
 
+		/* Test sending multiple messages without waiting. */
+		if (testBurst()) {
+			cerr << "Burst test failed" << endl;
+			return TestFail;
+		}
+
 		/* Test that an empty message fails. */
 		if (testEmptyFail()) {
 			cerr << "Empty message test failed" << endl;
@@ -448,6 +499,17 @@ private:
 
 	void readyRead(IPCUnixSocket *ipc)
 	{
+		if (burst_) {
+			IPCUnixSocket::Payload response;
+			if (ipc->receive(&response)) {
+				cerr << "Receive message failed" << endl;
+				return;
+			}
+
+			responses_.push_back(std::move(response));
+			return;
+		}
+
 		if (!callResponse_) {
 			cerr << "Read ready without expecting data, fail." << endl;
 			return;
@@ -486,6 +548,8 @@ private:
 	IPCUnixSocket ipc_;
 	bool callDone_;
 	IPCUnixSocket::Payload *callResponse_;
+	bool burst_;
+	std::vector<IPCUnixSocket::Payload> responses_;
 };
 
 /*
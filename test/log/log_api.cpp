@@ -6,6 +6,7 @@
  */
 
 #include <algorithm>
+#include <chrono>
 #include <fcntl.h>
 #include <iostream>
 #include <list>
@@ -14,7 +15,9 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <thread>
 #include <unistd.h>
+#include <vector>
 
 #include <libcamera/logging.h>
 
@@ -27,6 +30,27 @@ using namespace libcamera;
 
 LOG_DEFINE_CATEGORY(LogAPITest)
 
+/*
+ * A stream buffer that stalls the first write, to fill the asynchronous log
+ * ring deterministically.
+ */
+class SlowBuffer : public stringbuf
+{
+protected:
+	streamsize xsputn(const char *s, streamsize n) override
+	{
+		if (!stalled_) {
+			this_thread::sleep_for(chrono::milliseconds(100));
+			stalled_ = true;
+		}
+
+		return stringbuf::xsputn(s, n);
+	}
+
+private:
+	bool stalled_ = false;
+};
+
 class LogAPITest : public Test
 {
 protected:
@@ -107,6 +131,62 @@ protected:
 		return verifyOutput(iss);
 	}
 
+	int testBinaryFile()
+	{
+		char path[] = "/tmp/libcamera.log.XXXXXX";
+		int fd = mkstemp(path);
+		if (fd < 0) {
+			cerr << "Failed to create tmp log file" << endl;
+			return TestFail;
+		}
+
+		if (logSetBinaryFile(path) < 0) {
+			cerr << "Failed to set binary log file" << endl;
+			close(fd);
+			unlink(path);
+			return TestFail;
+		}
+
+		doLogging();
+
+		/* Close the log file to flush it. */
+		logSetTarget(LoggingTargetNone);
+
+		vector<char> data(lseek(fd, 0, SEEK_END));
+		lseek(fd, 0, SEEK_SET);
+		ssize_t ret = read(fd, data.data(), data.size());
+		close(fd);
+		unlink(path);
+
+		if (ret != static_cast<ssize_t>(data.size()) || data.size() < 8) {
+			cerr << "Failed to read binary log file" << endl;
+			return TestFail;
+		}
+
+		/* Extract the text of the message records. */
+		stringstream log;
+		size_t offset = 8;
+		while (offset + 8 <= data.size()) {
+			uint32_t size;
+			uint16_t type;
+			memcpy(&size, &data[offset], sizeof(size));
+			memcpy(&type, &data[offset + 4], sizeof(type));
+			offset += 8;
+
+			if (offset + size > data.size()) {
+				cerr << "Truncated binary log record" << endl;
+				return TestFail;
+			}
+
+			if (type == 3 && size >= 24)
+				log << string(&data[offset + 24], size - 24) << endl;
+
+			offset += size;
+		}
+
+		return verifyOutput(log);
+	}
+
 	int testStream()
 	{
 		stringstream log;
@@ -118,6 +198,141 @@ protected:
 		return verifyOutput(log);
 	}
 
+	int testAsync()
+	{
+		stringstream log;
+		logSetStream(&log);
+
+		if (logSetAsync(true, LoggingDropNone) < 0) {
+			cerr << "Failed to enable asynchronous logging" << endl;
+			return TestFail;
+		}
+
+		doLogging();
+
+		/* Disabling asynchronous logging flushes the log. */
+		logSetAsync(false);
+
+		return verifyOutput(log);
+	}
+
+	int testAsyncDrop(LoggingDropPolicy policy)
+	{
+		static constexpr unsigned int NumMessages = 2000;
+
+		SlowBuffer buffer;
+		ostream log(&buffer);
+		logSetStream(&log);
+		logSetLevel("LogAPITest", "DEBUG");
+
+		uint64_t dropped = logDroppedMessages();
+		logSetAsync(true, policy);
+
+		for (unsigned int i = 0; i < NumMessages; ++i)
+			LOG(LogAPITest, Info) << "message " << i;
+		LOG(LogAPITest, Warning) << "last";
+
+		logSetAsync(false);
+		dropped = logDroppedMessages() - dropped;
+
+		string output = buffer.str();
+		unsigned int lines = count(output.begin(), output.end(), '\n');
+		if (lines + dropped != NumMessages + 1) {
+			cerr << "Lost " << NumMessages + 1 - lines - dropped
+			     << " log messages" << endl;
+			return TestFail;
+		}
+
+		if (output.find("last") == string::npos) {
+			cerr << "Warning message not logged" << endl;
+			return TestFail;
+		}
+
+		if (policy == LoggingDropNone && dropped) {
+			cerr << "Messages dropped in blocking mode" << endl;
+			return TestFail;
+		}
+
+		if (policy != LoggingDropNone && !dropped) {
+			cerr << "No message dropped with a full log" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testEvaluation()
+	{
+		unsigned int evaluations = 0;
+		auto message = [&evaluations]() {
+			evaluations++;
+			return "message";
+		};
+
+		stringstream log;
+		logSetStream(&log);
+
+		/* Disabled messages must not evaluate their stream expression. */
+		logSetLevel("LogAPITest", "WARN");
+		LOG(LogAPITest, Info) << message();
+		if (evaluations) {
+			cerr << "Disabled message evaluated" << endl;
+			return TestFail;
+		}
+
+		LOG(LogAPITest, Warning) << message();
+		if (evaluations != 1) {
+			cerr << "Enabled message not evaluated" << endl;
+			return TestFail;
+		}
+
+		/* Messages below the compiled-in severity are always disabled. */
+		logSetLevel("LogAPITest", "DEBUG");
+		LOG(LogAPITest, Debug) << message();
+		if (evaluations != (LogMinSeverity <= LogDebug ? 2 : 1)) {
+			cerr << "Invalid debug message evaluation" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testRateLimit()
+	{
+		stringstream log;
+		logSetStream(&log);
+		logSetLevel("LogAPITest", "DEBUG");
+
+		/*
+		 * The first 5 messages are identical and get deduplicated, and
+		 * the messages over the burst of 10 get suppressed.
+		 */
+		for (unsigned int i = 0; i < 30; ++i)
+			LOG_RATELIMITED(LogAPITest, Warning)
+				<< (i < 5 ? "repeated" : "message " + to_string(i));
+
+		string output = log.str();
+		unsigned int lines = count(output.begin(), output.end(), '\n');
+		if (lines != 7) {
+			cerr << "Invalid number of rate-limited messages: "
+			     << lines << endl;
+			return TestFail;
+		}
+
+		if (output.find("Previous message repeated 4 times") == string::npos) {
+			cerr << "Repeated messages not summarized" << endl;
+			return TestFail;
+		}
+
+		if (output.find("message 9") == string::npos ||
+		    output.find("message 10") != string::npos) {
+			cerr << "Invalid rate limit burst" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
 	int testTarget()
 	{
 		logSetTarget(LoggingTargetNone);
@@ -133,16 +348,50 @@ protected:
 		return TestPass;
 	}
 
+	int init() override
+	{
+		if (LogMinSeverity > LogInfo) {
+			cout << "Info messages not compiled in" << endl;
+			return TestSkip;
+		}
+
+		return TestPass;
+	}
+
 	int run() override
 	{
 		int ret = testFile();
 		if (ret != TestPass)
 			return TestFail;
 
+		ret = testBinaryFile();
+		if (ret != TestPass)
+			return TestFail;
+
 		ret = testStream();
 		if (ret != TestPass)
 			return TestFail;
 
+		ret = testAsync();
+		if (ret != TestPass)
+			return TestFail;
+
+		ret = testAsyncDrop(LoggingDropNone);
+		if (ret != TestPass)
+			return TestFail;
+
+		ret = testAsyncDrop(LoggingDropBelowWarning);
+		if (ret != TestPass)
+			return TestFail;
+
+		ret = testEvaluation();
+		if (ret != TestPass)
+			return TestFail;
+
+		ret = testRateLimit();
+		if (ret != TestPass)
+			return TestFail;
+
 		ret = testTarget();
 		if (ret != TestPass)
 			return TestFail;
@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * mapped-buffer-cache.cpp - MappedBufferCache tests
+ */
+
+#include <iostream>
+#include <memory>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/buffer.h>
+#include <libcamera/file_descriptor.h>
+
+#include "libcamera/internal/buffer.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class MappedBufferCacheTest : public Test
+{
+protected:
+	static constexpr unsigned int BufferSize = 4096;
+
+	int init()
+	{
+		for (unsigned int i = 0; i < 4; ++i) {
+			int fd = memfd_create("mapped-buffer-cache", MFD_CLOEXEC);
+			if (fd < 0 || ftruncate(fd, BufferSize) < 0) {
+				cerr << "Failed to create memfd" << endl;
+				return TestFail;
+			}
+
+			fds_.emplace_back(std::move(fd));
+		}
+
+		return TestPass;
+	}
+
+	/* Wrap the memory \a index in a new FrameBuffer, with two planes. */
+	unique_ptr<FrameBuffer> wrap(unsigned int index)
+	{
+		vector<FrameBuffer::Plane> planes(2);
+		for (FrameBuffer::Plane &plane : planes) {
+			plane.fd = fds_[index];
+			plane.length = BufferSize;
+		}
+
+		return make_unique<FrameBuffer>(planes);
+	}
+
+	int run()
+	{
+		MappedBufferCache cache(2);
+
+		unique_ptr<FrameBuffer> buffer = wrap(0);
+		const MappedBuffer *map = cache.map(buffer.get(), PROT_READ | PROT_WRITE);
+		if (!map || map->maps().size() != 2) {
+			cerr << "Failed to map buffer" << endl;
+			return TestFail;
+		}
+
+		/* CPU access to memory not backed by a dmabuf needs no sync. */
+		{
+			MappedBuffer::CpuAccess access(map, PROT_WRITE);
+			if (access.error()) {
+				cerr << "Failed to start CPU access" << endl;
+				return TestFail;
+			}
+
+			map->maps()[0][0] = 0x42;
+		}
+
+		/*
+		 * A new FrameBuffer wrapping the same memory, mapped with a
+		 * subset of the protection flags, must reuse the mapping.
+		 */
+		unique_ptr<FrameBuffer> other = wrap(0);
+		const MappedBuffer *otherMap = cache.map(other.get(), PROT_READ);
+		if (otherMap != map || cache.size() != 1) {
+			cerr << "Mapping not reused" << endl;
+			return TestFail;
+		}
+
+		/* Different memory gets a different mapping. */
+		unique_ptr<FrameBuffer> second = wrap(1);
+		const MappedBuffer *secondMap = cache.map(second.get(), PROT_READ);
+		if (!secondMap || secondMap == map || cache.size() != 2) {
+			cerr << "Mapping incorrectly reused" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * The first buffer is the most recently used, mapping a third
+		 * buffer must evict the second one.
+		 */
+		cache.map(buffer.get(), PROT_READ);
+
+		unique_ptr<FrameBuffer> third = wrap(2);
+		if (!cache.map(third.get(), PROT_READ) || cache.size() != 2) {
+			cerr << "Failed to map third buffer" << endl;
+			return TestFail;
+		}
+
+		otherMap = cache.map(other.get(), PROT_READ);
+		if (otherMap != map || otherMap->maps()[1][0] != 0x42) {
+			cerr << "Most recently used mapping evicted" << endl;
+			return TestFail;
+		}
+
+		cache.clear();
+		if (cache.size() != 0) {
+			cerr << "Cache not cleared" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	vector<FileDescriptor> fds_;
+};
+
+TEST_REGISTER(MappedBufferCacheTest)
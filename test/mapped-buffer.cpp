@@ -102,6 +102,13 @@ protected:
 			return TestFail;
 		}
 
+		/* Synchronize the CPU caches for read and write access. */
+		MappedBuffer::CpuAccess access(&rw_map, PROT_READ | PROT_WRITE);
+		if (access.error()) {
+			cout << "Failed to start CPU access" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
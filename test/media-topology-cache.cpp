@@ -0,0 +1,140 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * media-topology-cache.cpp - MediaTopologyCache tests
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+
+#include "libcamera/internal/media_topology_cache.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class MediaTopologyCacheTest : public Test
+{
+protected:
+	int init()
+	{
+		char directory[] = "/tmp/libcamera.test.XXXXXX";
+		if (!mkdtemp(directory)) {
+			cerr << "Failed to create cache directory" << endl;
+			return TestFail;
+		}
+
+		directory_ = directory;
+
+		return TestPass;
+	}
+
+	static MediaTopologyCache::Topology topology()
+	{
+		MediaTopologyCache::Topology topo;
+		topo.version = 42;
+
+		topo.entities.resize(2);
+		topo.entities[0].id = 1;
+		strcpy(topo.entities[0].name, "sensor");
+		topo.entities[1].id = 2;
+		strcpy(topo.entities[1].name, "receiver");
+
+		topo.interfaces.resize(1);
+		topo.interfaces[0].id = 3;
+		topo.interfaces[0].devnode.major = 81;
+
+		topo.pads.resize(2);
+		topo.pads[0].id = 4;
+		topo.pads[0].entity_id = 1;
+		topo.pads[1].id = 5;
+		topo.pads[1].entity_id = 2;
+
+		topo.links.resize(1);
+		topo.links[0].source_id = 4;
+		topo.links[0].sink_id = 5;
+
+		return topo;
+	}
+
+	int run()
+	{
+		struct media_device_info info = {};
+		strcpy(info.driver, "test");
+		strcpy(info.model, "Test device");
+		info.hw_revision = 1;
+
+		string key = MediaTopologyCache::key(info);
+
+		/* A disabled cache stores nothing. */
+		MediaTopologyCache disabled("");
+		if (disabled.isEnabled() || !disabled.store(key, topology())) {
+			cerr << "Disabled cache accepts topologies" << endl;
+			return TestFail;
+		}
+
+		MediaTopologyCache cache(directory_);
+		MediaTopologyCache::Topology topo;
+
+		if (cache.load(key, &topo) != -ENOENT) {
+			cerr << "Empty cache returns a topology" << endl;
+			return TestFail;
+		}
+
+		if (cache.store(key, topology())) {
+			cerr << "Failed to store topology" << endl;
+			return TestFail;
+		}
+
+		if (cache.load(key, &topo)) {
+			cerr << "Failed to load topology" << endl;
+			return TestFail;
+		}
+
+		if (topo.version != 42 || topo.entities.size() != 2 ||
+		    strcmp(topo.entities[1].name, "receiver") ||
+		    topo.interfaces.size() != 1 ||
+		    topo.interfaces[0].devnode.major != 81 ||
+		    topo.pads.size() != 2 || topo.pads[1].entity_id != 2 ||
+		    topo.links.size() != 1 || topo.links[0].sink_id != 5) {
+			cerr << "Loaded topology doesn't match" << endl;
+			return TestFail;
+		}
+
+		/* A different hardware revision invalidates the cache. */
+		info.hw_revision = 2;
+		if (cache.load(MediaTopologyCache::key(info), &topo) != -ENOENT) {
+			cerr << "Topology loaded for a different device" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		DIR *dir = opendir(directory_.c_str());
+		if (dir) {
+			struct dirent *ent;
+			while ((ent = readdir(dir)) != nullptr) {
+				if (ent->d_name[0] != '.')
+					unlink((directory_ + "/" + ent->d_name).c_str());
+			}
+			closedir(dir);
+		}
+
+		rmdir(directory_.c_str());
+	}
+
+private:
+	string directory_;
+};
+
+TEST_REGISTER(MediaTopologyCacheTest)
@@ -210,6 +210,47 @@ class MediaDeviceLinkTest : public MediaDeviceTest
 			return TestFail;
 		}
 
+		/*
+		 * When the media device is locked, links that are already in
+		 * the requested state shall not be set up again.
+		 */
+		if (!media_->lock()) {
+			cerr << "Failed to lock media device" << endl;
+			return TestFail;
+		}
+
+		unsigned int sequence = media_->linkSequence();
+
+		if (link->setEnabled(false) || media_->disableLinks()) {
+			cerr << "Failed to disable disabled links" << endl;
+			return TestFail;
+		}
+
+		if (media_->linkSequence() != sequence) {
+			cerr << "Disabled links have been set up again" << endl;
+			return TestFail;
+		}
+
+		if (media_->setupLinks({ link })) {
+			cerr << "Failed to set up links" << endl;
+			return TestFail;
+		}
+
+		if (!(link->flags() & MEDIA_LNK_FL_ENABLED) ||
+		    media_->linkSequence() != sequence + 1) {
+			cerr << "Link " << linkName
+			     << " not enabled by setupLinks()" << endl;
+			return TestFail;
+		}
+
+		if (media_->setupLinks({ link }) ||
+		    media_->linkSequence() != sequence + 1) {
+			cerr << "Unchanged links have been set up again" << endl;
+			return TestFail;
+		}
+
+		media_->unlock();
+
 		return 0;
 	}
 
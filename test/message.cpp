@@ -5,9 +5,11 @@
  * message.cpp - Messages test
  */
 
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <thread>
+#include <vector>
 
 #include "libcamera/internal/message.h"
 #include "libcamera/internal/thread.h"
@@ -71,6 +73,53 @@ protected:
 	}
 };
 
+class SequenceMessage : public Message
+{
+public:
+	SequenceMessage(Message::Type type, unsigned int producer,
+			unsigned int sequence)
+		: Message(type), producer_(producer), sequence_(sequence)
+	{
+	}
+
+	unsigned int producer_;
+	unsigned int sequence_;
+};
+
+class SequenceReceiver : public Object
+{
+public:
+	SequenceReceiver(Message::Type type, unsigned int producers)
+		: type_(type), sequences_(producers, 0), received_(0),
+		  outOfOrder_(false)
+	{
+	}
+
+	unsigned int received() const { return received_; }
+	bool outOfOrder() const { return outOfOrder_; }
+
+protected:
+	void message(Message *msg)
+	{
+		if (msg->type() != type_) {
+			Object::message(msg);
+			return;
+		}
+
+		SequenceMessage *seqMsg = static_cast<SequenceMessage *>(msg);
+		if (seqMsg->sequence_ != sequences_[seqMsg->producer_]++)
+			outOfOrder_ = true;
+
+		received_.fetch_add(1, std::memory_order_release);
+	}
+
+private:
+	Message::Type type_;
+	std::vector<unsigned int> sequences_;
+	std::atomic<unsigned int> received_;
+	bool outOfOrder_;
+};
+
 class MessageTest : public Test
 {
 protected:
@@ -120,6 +169,45 @@ protected:
 
 		delete slowReceiver;
 
+		/*
+		 * Post messages from multiple threads concurrently, and verify
+		 * that they are all delivered in posting order for each
+		 * producer.
+		 */
+		const unsigned int numProducers = 4;
+		const unsigned int numMessages = 10000;
+
+		SequenceReceiver seqReceiver(msgType[0], numProducers);
+		seqReceiver.moveToThread(&thread_);
+
+		std::vector<std::thread> producers;
+		for (unsigned int i = 0; i < numProducers; ++i) {
+			producers.emplace_back([&, i]() {
+				for (unsigned int j = 0; j < numMessages; ++j)
+					seqReceiver.postMessage(std::make_unique<SequenceMessage>(msgType[0], i, j));
+			});
+		}
+
+		for (std::thread &producer : producers)
+			producer.join();
+
+		for (unsigned int i = 0; i < 100; ++i) {
+			if (seqReceiver.received() == numProducers * numMessages)
+				break;
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+
+		if (seqReceiver.received() != numProducers * numMessages) {
+			cout << "Received " << seqReceiver.received() << " of "
+			     << numProducers * numMessages << " messages" << endl;
+			return TestFail;
+		}
+
+		if (seqReceiver.outOfOrder()) {
+			cout << "Messages received out of order" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
@@ -90,6 +90,35 @@ protected:
 			return TestFail;
 		}
 
+		/* Test that a batch of deferred deletions is fully executed. */
+		count = 0;
+		for (unsigned int i = 0; i < 100; ++i) {
+			obj = new TestObject(&count);
+			obj->deleteLater();
+		}
+
+		Thread::current()->dispatchMessages(Message::Type::DeferredDelete);
+		if (count != 100) {
+			cout << "Batched deleteLater() failed (" << count << ")" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Test that deleting an object directly cancels its deferred
+		 * deletion.
+		 */
+		count = 0;
+		obj = new TestObject(&count);
+		obj->deleteLater();
+		delete obj;
+
+		Thread::current()->dispatchMessages(Message::Type::DeferredDelete);
+		if (count != 1) {
+			cout << "Direct deletion after deleteLater() failed ("
+			     << count << ")" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
@@ -10,6 +10,7 @@
 
 #include <libcamera/object.h>
 
+#include "libcamera/internal/bound_method_pool.h"
 #include "libcamera/internal/event_dispatcher.h"
 #include "libcamera/internal/thread.h"
 
@@ -187,6 +188,81 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Test that queued invocations reuse the memory pool blocks
+		 * once they have been released by the receiver thread.
+		 */
+		if (testPool() != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+
+	int testPool()
+	{
+		static constexpr unsigned int NumRounds = 10;
+		static constexpr unsigned int NumInvocations = 100;
+
+		/*
+		 * Each invocation allocates a BoundMethodMember, an
+		 * InvokeMessage and a BoundMethodPack with its control block.
+		 * The warm-up burst fills the pool with the blocks of
+		 * NumInvocations invocations.
+		 */
+		static constexpr unsigned int BlocksPerInvocation = 3;
+		static constexpr unsigned int PoolSize = NumInvocations * BlocksPerInvocation;
+
+		/*
+		 * The blocking invocation that ends a round may not have been
+		 * released yet when the next round starts. Allow heap
+		 * allocations for the blocks of a few of them on top of the
+		 * pool.
+		 */
+		static constexpr unsigned int MaxPendingBlocking = 3;
+		static constexpr unsigned int MaxHeapAllocations =
+			(NumInvocations + MaxPendingBlocking) * BlocksPerInvocation - PoolSize;
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		/*
+		 * Warm up the pool with a full burst of invocations delivered
+		 * in the main thread, the pool then holds enough free blocks
+		 * for all the following rounds.
+		 */
+		InvokedObject local;
+
+		for (unsigned int i = 0; i < NumInvocations; ++i)
+			local.invokeMethod(&InvokedObject::method,
+					   ConnectionTypeQueued, i);
+
+		dispatcher->processEvents();
+
+		BoundMethodPoolStatistics first = BoundMethodPoolStatistics::current();
+
+		for (unsigned int round = 0; round < NumRounds; ++round) {
+			for (unsigned int i = 0; i < NumInvocations; ++i)
+				object_.invokeMethod(&InvokedObject::method,
+						     ConnectionTypeQueued, i);
+
+			object_.invokeMethod(&InvokedObject::method,
+					     ConnectionTypeBlocking, 42);
+		}
+
+		BoundMethodPoolStatistics stats = BoundMethodPoolStatistics::current();
+		uint64_t allocations = stats.allocations - first.allocations;
+		uint64_t heapAllocations = stats.heapAllocations - first.heapAllocations;
+
+		if (allocations < NumRounds * (NumInvocations + 1)) {
+			cout << "Invocations not allocated from the pool" << endl;
+			return TestFail;
+		}
+
+		if (heapAllocations > MaxHeapAllocations) {
+			cout << "Pool blocks not reused (" << heapAllocations
+			     << " heap allocations)" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
@@ -0,0 +1,95 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * performance.cpp - Performance counters tests
+ */
+
+#include <iostream>
+
+#include <libcamera/performance.h>
+
+#include "libcamera/internal/performance.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class PerformanceTest : public Test
+{
+protected:
+	int run()
+	{
+		PerformanceHistogram histogram;
+
+		if (histogram.count() || histogram.min() || histogram.max() ||
+		    histogram.mean() || histogram.percentile(50)) {
+			cerr << "Empty histogram reports samples" << endl;
+			return TestFail;
+		}
+
+		for (uint64_t i = 1; i <= 100; ++i)
+			histogram.add(i);
+
+		if (histogram.count() != 100 || histogram.min() != 1 ||
+		    histogram.max() != 100 || histogram.mean() != 50) {
+			cerr << "Invalid statistics: " << histogram.toString()
+			     << endl;
+			return TestFail;
+		}
+
+		if (histogram.percentile(0) != 1 ||
+		    histogram.percentile(50) != 51 ||
+		    histogram.percentile(99) != 100 ||
+		    histogram.percentile(100) != 100) {
+			cerr << "Invalid percentiles: " << histogram.toString()
+			     << endl;
+			return TestFail;
+		}
+
+		/* Only the most recent samples are kept in the window. */
+		for (uint64_t i = 0; i < PerformanceHistogram::kWindowSize; ++i)
+			histogram.add(1000);
+
+		if (histogram.count() != 100 + PerformanceHistogram::kWindowSize ||
+		    histogram.min() != 1000 || histogram.max() != 1000) {
+			cerr << "Samples out of the window are used: "
+			     << histogram.toString() << endl;
+			return TestFail;
+		}
+
+		histogram.reset();
+		if (histogram.count() || histogram.max()) {
+			cerr << "Reset histogram reports samples" << endl;
+			return TestFail;
+		}
+
+		/* Profile a call to an isolated IPA module. */
+		{
+			IPACallProfiler profiler("test.call", IPACallProfiler::Serialization);
+			profiler.enter(IPACallProfiler::Transit);
+			profiler.enter(IPACallProfiler::Serialization);
+		}
+
+		CameraManagerPerformance performance =
+			PerformanceRecorder::instance()->snapshot();
+		auto iter = performance.ipaMethods.find("test.call");
+		if (iter == performance.ipaMethods.end()) {
+			cerr << "IPA call not recorded" << endl;
+			return TestFail;
+		}
+
+		const IPAMethodPerformance &call = iter->second;
+		if (call.calls != 1 || call.serialization.count() != 1 ||
+		    call.transit.count() != 1 || call.execution.count()) {
+			cerr << "Invalid IPA call counters: " << call.toString()
+			     << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(PerformanceTest)
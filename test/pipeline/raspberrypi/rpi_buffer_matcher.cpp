@@ -0,0 +1,137 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * rpi_buffer_matcher.cpp - Raspberry Pi Unicam buffer pairing test
+ */
+
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "libcamera/internal/buffer.h"
+
+#include "rpi_buffer_matcher.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+/* The number of Bayer and embedded buffers, equal as by default. */
+constexpr unsigned int kNumBuffers = 4;
+
+} /* namespace */
+
+class BufferMatcherTest : public Test
+{
+protected:
+	int init() override
+	{
+		for (unsigned int i = 0; i < 2 * kNumBuffers; ++i)
+			buffers_.push_back(make_unique<FrameBuffer>(vector<FrameBuffer::Plane>{}));
+
+		return TestPass;
+	}
+
+	FrameBuffer *capture(unsigned int index, uint64_t timestamp)
+	{
+		FrameBuffer *buffer = buffers_[index].get();
+		buffer->_d()->metadata().timestamp = timestamp;
+		return buffer;
+	}
+
+	int testPairing()
+	{
+		vector<FrameBuffer *> returned;
+		RPi::BufferMatcher matcher([&](FrameBuffer *b) { returned.push_back(b); },
+					   [&](FrameBuffer *b) { returned.push_back(b); });
+		matcher.configure(true, false, kNumBuffers, kNumBuffers);
+
+		RPi::BufferMatcher::BayerFrame frame;
+		FrameBuffer *embedded;
+
+		/* The embedded data of the first frame is lost. */
+		matcher.queueBayer(capture(0, 1000), {});
+		matcher.queueBayer(capture(1, 2000), {});
+		matcher.queueEmbedded(capture(kNumBuffers + 1, 2000));
+
+		if (!matcher.match(&frame, &embedded) ||
+		    frame.buffer != buffers_[1].get() ||
+		    embedded != buffers_[kNumBuffers + 1].get()) {
+			cerr << "Buffers not paired" << endl;
+			return TestFail;
+		}
+
+		if (returned != vector<FrameBuffer *>{ buffers_[0].get() } ||
+		    matcher.mismatches() != 1 || matcher.dropped() != 1) {
+			cerr << "Orphan Bayer frame not dropped" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testLostEmbedded()
+	{
+		vector<FrameBuffer *> returned;
+		RPi::BufferMatcher matcher([&](FrameBuffer *b) { returned.push_back(b); },
+					   [](FrameBuffer *) {});
+		matcher.configure(true, false, kNumBuffers, kNumBuffers);
+
+		RPi::BufferMatcher::BayerFrame frame;
+		FrameBuffer *embedded;
+
+		/*
+		 * Embedded data stops arriving. The Bayer frames waiting for it
+		 * must not hold on to all the Bayer buffers, the oldest one is
+		 * returned to the device when the last buffer is dequeued.
+		 */
+		for (unsigned int i = 0; i < kNumBuffers; ++i) {
+			matcher.queueBayer(capture(i, (i + 1) * 1000), {});
+
+			if (matcher.match(&frame, &embedded)) {
+				cerr << "Bayer frame matched without embedded data"
+				     << endl;
+				return TestFail;
+			}
+		}
+
+		if (returned != vector<FrameBuffer *>{ buffers_[0].get() } ||
+		    matcher.dropped() != 1) {
+			cerr << "Bayer frames without embedded data not dropped"
+			     << endl;
+			return TestFail;
+		}
+
+		/* Capture recovers when embedded data arrives again. */
+		matcher.queueEmbedded(capture(kNumBuffers, 2000));
+
+		if (!matcher.match(&frame, &embedded) ||
+		    frame.buffer != buffers_[1].get() ||
+		    embedded != buffers_[kNumBuffers].get()) {
+			cerr << "Buffers not paired after recovery" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (testPairing() != TestPass)
+			return TestFail;
+
+		if (testLostEmbedded() != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+
+private:
+	vector<unique_ptr<FrameBuffer>> buffers_;
+};
+
+TEST_REGISTER(BufferMatcherTest)
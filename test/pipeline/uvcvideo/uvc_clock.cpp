@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * uvc_clock.cpp - UVC clock recovery test
+ */
+
+#include <iostream>
+#include <random>
+#include <stdint.h>
+#include <vector>
+
+#include "uvc_clock.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+/* A 48MHz device clock running 50ppm fast, close to wrapping around. */
+constexpr double kClockRate = 48e6 * (1.0 + 50e-6) / 1e9;
+constexpr uint32_t kClockStart = 0xfff00000;
+
+constexpr uint64_t kHostStart = 1000000000000;
+constexpr uint64_t kFrameInterval = 33333333;
+constexpr uint64_t kSofPeriod = 1000000;
+
+void write(vector<uint8_t> &data, uint64_t value, unsigned int size)
+{
+	for (unsigned int i = 0; i < size; ++i)
+		data.push_back(value >> (8 * i));
+}
+
+} /* namespace */
+
+class UVCClockTest : public Test
+{
+protected:
+	uint32_t stc(uint64_t ns)
+	{
+		return kClockStart + static_cast<uint64_t>((ns - kHostStart) * kClockRate);
+	}
+
+	/*
+	 * Generate the metadata of a frame whose exposure started at time ns.
+	 * Payloads are received with a random delay within the USB frame, and
+	 * carry an SCR sampled up to two USB frames earlier, in order.
+	 */
+	vector<uint8_t> metadata(uint64_t ns)
+	{
+		vector<uint8_t> data;
+
+		for (unsigned int i = 0; i < 8; ++i) {
+			uint64_t received = ns + 5000000 + i * 2000000 +
+					    jitter_(random_);
+			uint64_t hostSof = (received - kHostStart) / kSofPeriod;
+			uint64_t scrSof = max(hostSof - delay_(random_), lastSof_);
+			lastSof_ = scrSof;
+
+			write(data, received, 8);
+			write(data, hostSof & 0x7ff, 2);
+			write(data, 12, 1);
+			write(data, 0, 1);
+
+			/* Header length, flags (EOH, SCR, PTS), PTS and SCR. */
+			write(data, 12, 1);
+			write(data, 0x80 | 0x08 | 0x04, 1);
+			write(data, stc(ns), 4);
+			write(data, stc(kHostStart + scrSof * kSofPeriod), 4);
+			write(data, scrSof & 0x7ff, 2);
+		}
+
+		return data;
+	}
+
+	int run() override
+	{
+		UVCClock clock;
+		int64_t maxError = 0;
+
+		for (unsigned int frame = 0; frame < 150; ++frame) {
+			uint64_t ns = kHostStart + frame * kFrameInterval;
+			vector<uint8_t> data = metadata(ns);
+
+			uint64_t timestamp = clock.processMetadata(data);
+
+			/* The clock needs a quarter of a second of samples. */
+			if (frame < 6) {
+				if (timestamp) {
+					cerr << "Frame " << frame
+					     << " timestamped before recovery" << endl;
+					return TestFail;
+				}
+				continue;
+			}
+
+			if (frame < 15)
+				continue;
+
+			if (!timestamp) {
+				cerr << "Frame " << frame << " not timestamped" << endl;
+				return TestFail;
+			}
+
+			int64_t error = static_cast<int64_t>(timestamp - ns);
+			maxError = max(maxError, error < 0 ? -error : error);
+		}
+
+		if (maxError > 100000) {
+			cerr << "Timestamp error " << maxError << "ns too large"
+			     << endl;
+			return TestFail;
+		}
+
+		/* Truncated and malformed buffers must be ignored. */
+		vector<uint8_t> data = metadata(kHostStart + 150 * kFrameInterval);
+		for (size_t size = 0; size < data.size(); ++size)
+			clock.processMetadata({ data.data(), size });
+
+		data[10] = 1;
+		clock.processMetadata(data);
+
+		/* A clock going backward resets the recovery. */
+		clock.addSample(0, kHostStart + 200 * kFrameInterval);
+		clock.update();
+		if (clock.timestamp(0)) {
+			cerr << "Clock not reset" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	mt19937 random_{ 42 };
+	uniform_int_distribution<uint64_t> jitter_{ 0, 900000 };
+	uniform_int_distribution<uint64_t> delay_{ 0, 2 };
+	uint64_t lastSof_ = 0;
+};
+
+TEST_REGISTER(UVCClockTest)
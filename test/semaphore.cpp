@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * semaphore.cpp - Semaphore test
+ */
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include "libcamera/internal/semaphore.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class SemaphoreTest : public Test
+{
+protected:
+	int run()
+	{
+		Semaphore semaphore(2);
+
+		/* Test non-blocking acquisition. */
+		if (!semaphore.tryAcquire(2) || semaphore.available() != 0) {
+			cout << "Failed to acquire available resources" << endl;
+			return TestFail;
+		}
+
+		if (semaphore.tryAcquire()) {
+			cout << "Acquired unavailable resource" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Test a blocking acquisition of multiple resources released
+		 * one at a time from a different thread.
+		 */
+		std::atomic<bool> acquired = false;
+		std::thread consumer([&]() {
+			semaphore.acquire(3);
+			acquired = true;
+		});
+
+		for (unsigned int i = 0; i < 3; ++i) {
+			this_thread::sleep_for(chrono::milliseconds(10));
+			if (acquired) {
+				cout << "Acquired resources too early" << endl;
+				consumer.join();
+				return TestFail;
+			}
+
+			semaphore.release();
+		}
+
+		consumer.join();
+
+		if (!acquired || semaphore.available() != 0) {
+			cout << "Failed to acquire released resources" << endl;
+			return TestFail;
+		}
+
+		/* Stress the acquire/release handshake between two threads. */
+		Semaphore ping, pong;
+		constexpr unsigned int kIterations = 100000;
+
+		std::thread peer([&]() {
+			for (unsigned int i = 0; i < kIterations; ++i) {
+				ping.acquire();
+				pong.release();
+			}
+		});
+
+		for (unsigned int i = 0; i < kIterations; ++i) {
+			ping.release();
+			pong.acquire();
+		}
+
+		peer.join();
+
+		if (ping.available() || pong.available()) {
+			cout << "Unbalanced resource count after handshake" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(SemaphoreTest)
@@ -140,6 +140,14 @@ protected:
 			return TestFail;
 		}
 
+		/* Copies of the maps share their data and are cached too. */
+		ControlInfoMap infoMapCopy = infoMap;
+		if (!serializer.isCached(infoMapCopy) ||
+		    !deserializer.isCached(newInfoMap)) {
+			cerr << "Copy of ControlInfoMap not cached" << endl;
+			return TestFail;
+		}
+
 		/* Deserialize the control list and verify the contents. */
 		buffer = ByteStreamBuffer(const_cast<const uint8_t *>(listData.data()),
 					  listData.size());
@@ -160,6 +168,67 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Change one control and remove another one, the list should
+		 * now be serialized incrementally.
+		 */
+		ControlList nextList(infoMap);
+		nextList.set(controls::Brightness, 0.5f);
+		nextList.set(controls::Contrast, 1.3f);
+
+		size = serializer.binarySize(nextList);
+		listData.resize(size);
+		buffer = ByteStreamBuffer(listData.data(), listData.size());
+
+		ret = serializer.serialize(nextList, buffer);
+		if (ret) {
+			cerr << "Failed to serialize incremental ControlList" << endl;
+			return TestFail;
+		}
+
+		if (buffer.offset() >= size) {
+			cerr << "ControlList not serialized incrementally" << endl;
+			return TestFail;
+		}
+
+		listData.resize(buffer.offset());
+
+		buffer = ByteStreamBuffer(const_cast<const uint8_t *>(listData.data()),
+					  listData.size());
+
+		newList = deserializer.deserialize<ControlList>(buffer);
+		if (!equals(nextList, newList)) {
+			cerr << "Deserialized incremental list doesn't match original"
+			     << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Deserializing the same incremental list twice should fail, as
+		 * it doesn't apply to the last deserialized list anymore.
+		 */
+		buffer = ByteStreamBuffer(const_cast<const uint8_t *>(listData.data()),
+					  listData.size());
+
+		if (deserializer.failed()) {
+			cerr << "Deserializer failed before the out of sequence list"
+			     << endl;
+			return TestFail;
+		}
+
+		newList = deserializer.deserialize<ControlList>(buffer);
+		if (!newList.empty() || !deserializer.failed()) {
+			cerr << "Out of sequence incremental list should have failed"
+			     << endl;
+			return TestFail;
+		}
+
+		deserializer.reset();
+		if (deserializer.failed()) {
+			cerr << "Reset didn't clear the deserializer failure" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
@@ -86,6 +86,34 @@ int testVectorSerdes(const std::vector<T> &in,
 	return TestFail;
 }
 
+template<typename T>
+int testVectorUnaligned(const std::vector<T> &in)
+{
+	std::vector<uint8_t> buf;
+
+	/*
+	 * Serialize the vector after a byte to verify that packed elements at
+	 * unaligned offsets are deserialized correctly.
+	 */
+	buf.push_back(0xff);
+	std::vector<uint8_t> vecBuf;
+	std::tie(vecBuf, std::ignore) = IPADataSerializer<std::vector<T>>::serialize(in);
+	buf.insert(buf.end(), vecBuf.begin(), vecBuf.end());
+
+	std::vector<T> out =
+		IPADataSerializer<std::vector<T>>::deserialize(buf.cbegin() + 1,
+							       buf.cend());
+	if (in == out)
+		return TestPass;
+
+	char *name = abi::__cxa_demangle(typeid(T).name(), nullptr,
+					 nullptr, nullptr);
+	cerr << "Unaligned std::vector<" << name
+	     << "> doesn't match original" << endl;
+	free(name);
+	return TestFail;
+}
+
 template<typename K, typename V>
 int testMapSerdes(const std::map<K, V> &in,
 		  ControlSerializer *cs = nullptr)
@@ -259,6 +287,18 @@ private:
 		if (testVectorSerdes(vecControlInfoMap, &cs) != TestPass)
 			return TestFail;
 
+		if (testVectorUnaligned(vecUint8) != TestPass)
+			return TestFail;
+
+		if (testVectorUnaligned(vecInt32) != TestPass)
+			return TestFail;
+
+		if (testVectorUnaligned(vecDouble) != TestPass)
+			return TestFail;
+
+		if (testVectorUnaligned(std::vector<float>{}) != TestPass)
+			return TestFail;
+
 		return TestPass;
 	}
 
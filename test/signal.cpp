@@ -74,6 +74,12 @@ protected:
 		signalVoid_.disconnect(this, &SignalTest::slotDisconnect);
 	}
 
+	void slotConnect()
+	{
+		signalVoid_.disconnect(this, &SignalTest::slotConnect);
+		signalVoid_.connect(this, &SignalTest::slotVoid);
+	}
+
 	void slotInteger1(int value)
 	{
 		values_[0] = value;
@@ -184,6 +190,29 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Test connection from slot. The new slot shall only be called
+		 * by the next emission.
+		 */
+		signalVoid_.connect(this, &SignalTest::slotConnect);
+
+		called_ = false;
+		signalVoid_.emit();
+
+		if (called_) {
+			cout << "Signal connection from slot test failed" << endl;
+			return TestFail;
+		}
+
+		signalVoid_.emit();
+
+		if (!called_) {
+			cout << "Signal connection from slot test failed" << endl;
+			return TestFail;
+		}
+
+		signalVoid_.disconnect();
+
 		/*
 		 * Test connecting to slots that return a value. This targets
 		 * compilation, there's no need to check runtime results.
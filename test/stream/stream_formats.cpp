@@ -94,6 +94,28 @@ protected:
 			      Size(2560, 2048), Size(3200, 2048), }))
 			return TestFail;
 
+		/* Test formats generated on demand, once for all copies */
+		unsigned int generated = 0;
+		StreamFormats lazy([&generated]() -> StreamFormats::FormatsMap {
+			generated++;
+			return { { PixelFormat(1), { SizeRange({ 100, 100 }) } } };
+		});
+		StreamFormats copy = lazy;
+
+		if (generated != 0) {
+			cout << "Formats generated before being accessed" << endl;
+			return TestFail;
+		}
+
+		if (testSizes("lazy", copy.sizes(PixelFormat(1)), { Size(100, 100) }) ||
+		    lazy.pixelformats() != std::vector<PixelFormat>{ PixelFormat(1) })
+			return TestFail;
+
+		if (generated != 1) {
+			cout << "Formats generated " << generated << " times" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
@@ -118,6 +118,22 @@ protected:
 			return TestFail;
 		}
 
+		/* Test setting the CPU affinity of running and stopped threads. */
+		if (!thread->setAffinity({ 0 })) {
+			cout << "Setting the affinity of a stopped thread succeeded" << endl;
+			return TestFail;
+		}
+
+		thread->start();
+
+		if (thread->setAffinity({ 0 })) {
+			cout << "Failed to set the thread affinity" << endl;
+			return TestFail;
+		}
+
+		thread->exit(0);
+		thread->wait();
+
 		return TestPass;
 	}
 
@@ -0,0 +1,150 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * timer-churn.cpp - Timer arm/cancel throughput test
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "libcamera/internal/event_dispatcher.h"
+#include "libcamera/internal/thread.h"
+#include "libcamera/internal/timer.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class ChurnTimer : public Timer
+{
+public:
+	ChurnTimer(unsigned int id, vector<unsigned int> *expired)
+		: id_(id), expired_(expired)
+	{
+		timeout.connect(this, &ChurnTimer::timeoutHandler);
+	}
+
+private:
+	void timeoutHandler([[maybe_unused]] Timer *timer)
+	{
+		expired_->push_back(id_);
+	}
+
+	unsigned int id_;
+	vector<unsigned int> *expired_;
+};
+
+class TimerChurnTest : public Test
+{
+protected:
+	int init()
+	{
+		std::random_device rd;
+		unsigned int seed = rd();
+
+		cout << "Random seed is " << seed << endl;
+
+		generator_.seed(seed);
+
+		for (unsigned int i = 0; i < NumTimers; ++i) {
+			timers_.emplace_back(make_unique<ChurnTimer>(i, &expired_));
+			order_.push_back(i);
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		std::uniform_int_distribution<> dist(0, 999);
+
+		/*
+		 * Measure the arm/cancel throughput with timers that never
+		 * expire during the measurement, as done by timeout watchdogs.
+		 */
+		auto start = chrono::steady_clock::now();
+
+		for (unsigned int iter = 0; iter < Iterations; ++iter) {
+			for (auto &timer : timers_)
+				timer->start(chrono::milliseconds(10000 + dist(generator_)));
+
+			std::shuffle(order_.begin(), order_.end(), generator_);
+
+			for (unsigned int index : order_)
+				timers_[index]->stop();
+		}
+
+		auto duration = chrono::steady_clock::now() - start;
+		double seconds = chrono::duration<double>(duration).count();
+		unsigned int operations = 2 * NumTimers * Iterations;
+
+		cout << operations << " arm/cancel operations in "
+		     << seconds * 1000 << " ms ("
+		     << static_cast<unsigned int>(operations / seconds)
+		     << " op/s)" << endl;
+
+		/*
+		 * Arm all timers with random deadlines, cancel half of them,
+		 * and verify that the other half expire in deadline order.
+		 */
+		auto now = chrono::steady_clock::now();
+		vector<ChurnTimer *> running;
+
+		for (auto &timer : timers_) {
+			timer->start(now + chrono::milliseconds(50 + dist(generator_) / 10));
+			running.push_back(timer.get());
+		}
+
+		std::shuffle(running.begin(), running.end(), generator_);
+
+		for (unsigned int i = 0; i < NumTimers / 2; ++i) {
+			running.back()->stop();
+			running.pop_back();
+		}
+
+		auto timeout = chrono::steady_clock::now() + chrono::seconds(2);
+		while (expired_.size() < running.size() &&
+		       chrono::steady_clock::now() < timeout)
+			dispatcher->processEvents();
+
+		if (expired_.size() != running.size()) {
+			cout << "Expected " << running.size() << " expired timers, got "
+			     << expired_.size() << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < expired_.size(); ++i) {
+			const ChurnTimer *timer = timers_[expired_[i]].get();
+
+			if (std::find(running.begin(), running.end(), timer) == running.end()) {
+				cout << "Stopped timer " << expired_[i] << " expired" << endl;
+				return TestFail;
+			}
+
+			if (i && timer->deadline() < timers_[expired_[i - 1]]->deadline()) {
+				cout << "Timers expired out of order" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+private:
+	static constexpr unsigned int NumTimers = 1024;
+	static constexpr unsigned int Iterations = 100;
+
+	std::mt19937 generator_;
+	vector<unique_ptr<ChurnTimer>> timers_;
+	vector<unsigned int> order_;
+	vector<unsigned int> expired_;
+};
+
+TEST_REGISTER(TimerChurnTest)
@@ -236,6 +236,14 @@ protected:
 		if (testEnumerate() != TestPass)
 			return TestFail;
 
+		/* utils::boottime() test. */
+		uint64_t before = utils::boottime();
+		uint64_t after = utils::boottime();
+		if (!before || after < before) {
+			cerr << "utils::boottime() test failed" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
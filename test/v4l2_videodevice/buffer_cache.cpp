@@ -33,6 +33,8 @@ public:
 	int testSequential(V4L2BufferCache *cache,
 			   const std::vector<std::unique_ptr<FrameBuffer>> &buffers)
 	{
+		unsigned int misses = cache->misses();
+
 		for (unsigned int i = 0; i < buffers.size() * 100; i++) {
 			int nBuffer = i % buffers.size();
 			int index = cache->get(*buffers[nBuffer].get());
@@ -46,6 +48,17 @@ public:
 			cache->put(index);
 		}
 
+		/*
+		 * Only the first run over the buffers can miss, all subsequent
+		 * lookups must hit the cache.
+		 */
+		misses = cache->misses() - misses;
+		if (misses > buffers.size()) {
+			std::cout << "Expected at most " << buffers.size()
+				  << " misses, got " << misses << std::endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
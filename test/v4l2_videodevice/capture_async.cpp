@@ -19,7 +19,8 @@ class CaptureAsyncTest : public V4L2VideoDeviceTest
 {
 public:
 	CaptureAsyncTest()
-		: V4L2VideoDeviceTest("vimc", "Raw Capture 0"), frames(0) {}
+		: V4L2VideoDeviceTest("vimc", "Raw Capture 0"), frames(0),
+		  batches(0) {}
 
 	void receiveBuffer(FrameBuffer *buffer)
 	{
@@ -30,6 +31,11 @@ public:
 		capture_->queueBuffer(buffer);
 	}
 
+	void receiveBatch()
+	{
+		batches++;
+	}
+
 protected:
 	int run()
 	{
@@ -46,6 +52,7 @@ protected:
 		}
 
 		capture_->bufferReady.connect(this, &CaptureAsyncTest::receiveBuffer);
+		capture_->bufferBatchReady.connect(this, &CaptureAsyncTest::receiveBatch);
 
 		for (const std::unique_ptr<FrameBuffer> &buffer : buffers_) {
 			if (capture_->queueBuffer(buffer.get())) {
@@ -75,7 +82,14 @@ protected:
 			return TestFail;
 		}
 
-		std::cout << "Processed " << frames << " frames" << std::endl;
+		if (batches < 1 || batches > frames) {
+			std::cout << "Invalid number of batches " << batches
+				  << " for " << frames << " frames" << std::endl;
+			return TestFail;
+		}
+
+		std::cout << "Processed " << frames << " frames in " << batches
+			  << " batches" << std::endl;
 
 		ret = capture_->streamOff();
 		if (ret)
@@ -86,6 +100,7 @@ protected:
 
 private:
 	unsigned int frames;
+	unsigned int batches;
 };
 
 TEST_REGISTER(CaptureAsyncTest)
@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021, Google Inc.
+ *
+ * request.cpp - V4L2 video device capture with media requests test
+ */
+
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <libcamera/buffer.h>
+
+#include "libcamera/internal/event_dispatcher.h"
+#include "libcamera/internal/media_request.h"
+#include "libcamera/internal/thread.h"
+#include "libcamera/internal/timer.h"
+
+#include "v4l2_videodevice_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class RequestTest : public V4L2VideoDeviceTest
+{
+public:
+	RequestTest()
+		: V4L2VideoDeviceTest("vivid", "vivid-000-vid-cap"), frames_(0),
+		  completed_(0)
+	{
+	}
+
+protected:
+	void receiveBuffer([[maybe_unused]] FrameBuffer *buffer)
+	{
+		frames_++;
+	}
+
+	void requestComplete([[maybe_unused]] MediaRequest *request)
+	{
+		completed_++;
+	}
+
+	int run()
+	{
+		const unsigned int bufferCount = 4;
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		Timer timeout;
+		int ret;
+
+		if (!media_->acquire())
+			return TestFail;
+
+		/* Skip the test if the driver doesn't support requests. */
+		std::unique_ptr<MediaRequest> probe = media_->allocateRequest();
+		if (!probe) {
+			cout << "Requests not supported" << endl;
+			media_->release();
+			return TestSkip;
+		}
+
+		ret = capture_->allocateBuffers(bufferCount, &buffers_);
+		if (ret < 0) {
+			cerr << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		capture_->bufferReady.connect(this, &RequestTest::receiveBuffer);
+
+		const ControlInfoMap &infoMap = capture_->controls();
+		const ControlInfo &brightness = infoMap.find(V4L2_CID_BRIGHTNESS)->second;
+
+		/* Bind a different brightness value to each buffer. */
+		vector<unique_ptr<MediaRequest>> requests;
+		for (unsigned int i = 0; i < bufferCount; ++i) {
+			unique_ptr<MediaRequest> request = media_->allocateRequest();
+			if (!request) {
+				cerr << "Failed to allocate request" << endl;
+				return TestFail;
+			}
+
+			request->completed.connect(this, &RequestTest::requestComplete);
+
+			ControlList ctrls(infoMap);
+			ctrls.set(V4L2_CID_BRIGHTNESS,
+				  brightness.min().get<int32_t>() + static_cast<int32_t>(i));
+			if (capture_->setControls(&ctrls, request.get())) {
+				cerr << "Failed to set controls in request" << endl;
+				return TestFail;
+			}
+
+			if (capture_->queueBuffer(buffers_[i].get(), request.get())) {
+				cerr << "Failed to queue buffer in request" << endl;
+				return TestFail;
+			}
+
+			if (request->queue()) {
+				cerr << "Failed to queue request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(std::move(request));
+		}
+
+		ret = capture_->streamOn();
+		if (ret)
+			return TestFail;
+
+		timeout.start(5000);
+		while (timeout.isRunning() &&
+		       (frames_ < bufferCount || completed_ < bufferCount))
+			dispatcher->processEvents();
+
+		capture_->streamOff();
+
+		if (frames_ != bufferCount || completed_ != bufferCount) {
+			cerr << "Captured " << frames_ << " frames and completed "
+			     << completed_ << " requests, expected " << bufferCount
+			     << endl;
+			return TestFail;
+		}
+
+		for (const unique_ptr<MediaRequest> &request : requests) {
+			if (request->status() != MediaRequest::Complete) {
+				cerr << "Request not complete" << endl;
+				return TestFail;
+			}
+
+			if (request->reinit()) {
+				cerr << "Failed to reinitialize request" << endl;
+				return TestFail;
+			}
+		}
+
+		/* The last request's brightness value must have been applied. */
+		ControlList ctrls = capture_->getControls({ V4L2_CID_BRIGHTNESS });
+		if (ctrls.get(V4L2_CID_BRIGHTNESS).get<int32_t>() !=
+		    brightness.min().get<int32_t>() + static_cast<int32_t>(bufferCount - 1)) {
+			cerr << "Request controls not applied" << endl;
+			return TestFail;
+		}
+
+		requests.clear();
+		probe.reset();
+		media_->release();
+
+		return TestPass;
+	}
+
+private:
+	unsigned int frames_;
+	unsigned int completed_;
+};
+
+TEST_REGISTER(RequestTest)
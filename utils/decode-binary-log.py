@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-or-later
+# Copyright (C) 2021, Google Inc.
+#
+# decode-binary-log.py - Convert a libcamera binary log file to text
+#
+# The binary log format is documented in src/libcamera/log.cpp. The output
+# matches the format of the libcamera text log.
+
+import argparse
+import struct
+import sys
+
+
+MAGIC = 0x4c43424c
+VERSION = 1
+
+RECORD_CATEGORY = 1
+RECORD_SITE = 2
+RECORD_MESSAGE = 3
+
+SEVERITIES = ['DEBUG', ' INFO', ' WARN', 'ERROR', 'FATAL']
+
+
+class LogDecoder(object):
+    def __init__(self, data):
+        self.data = data
+        self.categories = {}
+        self.sites = {}
+        self.messages = []
+
+        magic, version = struct.unpack_from('<IH', data, 0)
+        if magic == MAGIC:
+            self.endian = '<'
+        elif struct.unpack_from('>I', data, 0)[0] == MAGIC:
+            self.endian = '>'
+            version = struct.unpack_from('>H', data, 4)[0]
+        else:
+            raise RuntimeError('Not a libcamera binary log file')
+
+        if version != VERSION:
+            raise RuntimeError(f'Unsupported binary log version {version}')
+
+    def records(self):
+        offset = 8
+        while offset + 8 <= len(self.data):
+            size, type = struct.unpack_from(self.endian + 'IH', self.data, offset)
+            offset += 8
+
+            # A zero header marks the end of a file that hasn't been closed.
+            if not size and not type:
+                break
+
+            if offset + size > len(self.data):
+                print('Truncated record at offset %u' % (offset - 8), file=sys.stderr)
+                break
+
+            yield type, self.data[offset:offset + size]
+            offset += size
+
+    def parse(self):
+        # Definitions may follow the messages that reference them, parse
+        # them all first.
+        for type, payload in self.records():
+            if type == RECORD_CATEGORY:
+                id, = struct.unpack_from(self.endian + 'I', payload, 0)
+                self.categories[id] = payload[4:].decode(errors='replace')
+            elif type == RECORD_SITE:
+                id, line = struct.unpack_from(self.endian + 'II', payload, 0)
+                self.sites[id] = '%s:%u' % (payload[8:].decode(errors='replace'), line)
+            elif type == RECORD_MESSAGE:
+                self.messages.append(payload)
+
+    def format(self, payload):
+        category, site, timestamp, thread, severity = \
+            struct.unpack_from(self.endian + 'IIQIB', payload, 0)
+        text = payload[24:].decode(errors='replace')
+
+        secs, nsecs = divmod(timestamp, 1000000000)
+        time = '%u:%02u:%02u.%09u' % (secs // 3600, secs // 60 % 60, secs % 60, nsecs)
+
+        if severity < len(SEVERITIES):
+            severity = SEVERITIES[severity]
+        else:
+            severity = 'UNKWN'
+
+        category = self.categories.get(category, '<unknown>')
+        site = self.sites.get(site, '')
+
+        return f'[{time}] [{thread}] {severity} {category} {site} {text}'
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description='Convert a libcamera binary log file to text')
+    parser.add_argument('-o', dest='output', metavar='file', type=str,
+                        help='Output file name. Defaults to standard output if not specified.')
+    parser.add_argument('input', type=str,
+                        help='Input binary log file name.')
+    args = parser.parse_args(argv[1:])
+
+    with open(args.input, 'rb') as f:
+        data = f.read()
+
+    try:
+        decoder = LogDecoder(data)
+    except RuntimeError as e:
+        print(f'{args.input}: {e}', file=sys.stderr)
+        return 1
+
+    decoder.parse()
+
+    if args.output:
+        output = open(args.output, 'w', encoding='utf-8')
+    else:
+        output = sys.stdout
+
+    for payload in decoder.messages:
+        output.write(decoder.format(payload) + '\n')
+
+    if args.output:
+        output.close()
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
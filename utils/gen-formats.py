@@ -14,6 +14,7 @@ import yaml
 
 
 class DRMFourCC(object):
+    fourcc_regex = re.compile(r"[A-Z0-9]{4}")
     format_regex = re.compile(r"#define (DRM_FORMAT_[A-Z0-9_]+)[ \t]+fourcc_code\(('.', '.', '.', '.')\)")
     mod_vendor_regex = re.compile(r"#define DRM_FORMAT_MOD_VENDOR_([A-Z0-9_]+)[ \t]+([0-9a-fA-Fx]+)")
     mod_regex = re.compile(r"#define ([A-Za-z0-9_]+)[ \t]+fourcc_mod_code\(([A-Z0-9_]+), ([0-9a-fA-Fx]+)\)")
@@ -45,6 +46,11 @@ class DRMFourCC(object):
                 continue
 
     def fourcc(self, name):
+        # Formats unknown to DRM, such as compressed video formats, are
+        # specified with a literal four character code.
+        if name not in self.formats and DRMFourCC.fourcc_regex.fullmatch(name):
+            return ', '.join("'%s'" % c for c in name)
+
         return self.formats[name]
 
     def mod(self, name):
@@ -210,6 +210,15 @@ def IsAsync(method):
             return True
     return False
 
+def IsDirect(method):
+    if not re.match("^IPA.*Interface$", method.interface.mojom_name):
+        return False
+    if re.match("^IPA.*EventInterface$", method.interface.mojom_name):
+        return False
+    if method.attributes is None:
+        return False
+    return 'direct' in method.attributes and method.attributes['direct']
+
 def IsArray(element):
     return mojom.IsArrayKind(element.kind)
 
@@ -235,6 +244,18 @@ def IsPod(element):
 def IsStr(element):
     return element.kind.spec == 's'
 
+# A struct is POD if all its fields are of fixed-size scalar or enum types, in
+# which case it is serialized with a fixed layout.
+def IsPodStruct(element):
+    kind = element if mojom.IsStructKind(element) else element.kind
+    if not mojom.IsStructKind(kind) or not kind.fields:
+        return False
+    return all(IsPod(field) or IsEnum(field) for field in kind.fields)
+
+def PodStructSize(element):
+    kind = element if mojom.IsStructKind(element) else element.kind
+    return sum(int(BitWidth(field)) // 8 for field in kind.fields)
+
 def BitWidth(element):
     if element.kind in _bit_widths:
         return _bit_widths[element.kind]
@@ -387,6 +408,12 @@ def ValidateInterfaces(interfaces):
         ValidateZeroLength(method.response_parameters,
                            f'{method.mojom_name} response parameters', False)
 
+    # Validate that all direct methods are async
+    intf_methods_direct = [x for x in intf.methods if IsDirect(x)]
+    for method in intf_methods_direct:
+        if not IsAsync(method):
+            raise Exception(f'{method.mojom_name} must be [async] to be [direct]')
+
 class Generator(generator.Generator):
     @staticmethod
     def GetTemplatePrefix():
@@ -404,6 +431,7 @@ class Generator(generator.Generator):
             'has_default_fields': HasDefaultFields,
             'has_fd': HasFd,
             'is_async': IsAsync,
+            'is_direct': IsDirect,
             'is_array': IsArray,
             'is_controls': IsControls,
             'is_enum': IsEnum,
@@ -411,6 +439,7 @@ class Generator(generator.Generator):
             'is_map': IsMap,
             'is_plain_struct': IsPlainStruct,
             'is_pod': IsPod,
+            'is_pod_struct': IsPodStruct,
             'is_str': IsStr,
             'method_input_has_fd': MethodInputHasFd,
             'method_output_has_fd': MethodOutputHasFd,
@@ -423,6 +452,7 @@ class Generator(generator.Generator):
             'name_full': GetFullNameForElement,
             'needs_control_serializer': NeedsControlSerializer,
             'params_comma_sep': ParamsCommaSep,
+            'pod_struct_size': PodStructSize,
             'with_default_values': WithDefaultValues,
             'with_fds': WithFds,
         }
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# Copyright (C) 2021, Raspberry Pi (Trading) Limited
+#
+# tuning_compile.py - Compile a JSON tuning file to the binary tuning format
+#
+# The binary format stores the tuning tree exactly as the IPA reads it from the
+# JSON file, in pre-order, so that it can be loaded without any parsing. All
+# values are stored as the strings found in the JSON file. The layout is, with
+# all integers in little-endian order:
+#
+#   header:
+#     char[4]  magic ("RPTB")
+#     uint32   version (1)
+#     uint64   FNV-1a hash of the JSON source file
+#     uint32   size of the JSON source file
+#     uint32   number of nodes
+#     uint32   size of the string table
+#     uint32   reserved (0)
+#   nodes, in pre-order:
+#     uint32   key offset in the string table
+#     uint32   key length
+#     uint32   value offset in the string table
+#     uint32   value length
+#     uint32   number of children
+#   string table
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = b'RPTB'
+VERSION = 1
+
+
+def fnv1a(data):
+    h = 0xcbf29ce484222325
+    for b in data:
+        h ^= b
+        h = (h * 0x100000001b3) & 0xffffffffffffffff
+    return h
+
+
+class JSONObject(list):
+    pass
+
+
+class Compiler(object):
+    def __init__(self):
+        self.nodes = []
+        self.strings = bytearray()
+        self.offsets = {}
+
+    def string(self, s):
+        data = s.encode('utf-8')
+        if data not in self.offsets:
+            self.offsets[data] = len(self.strings)
+            self.strings += data
+        return self.offsets[data], len(data)
+
+    def value(self, v):
+        # Match the string representation of boost::property_tree's JSON
+        # parser. Numbers are kept as found in the source file.
+        if v is True:
+            return 'true'
+        if v is False:
+            return 'false'
+        if v is None:
+            return 'null'
+        return v
+
+    def add(self, key, v):
+        node = len(self.nodes)
+        self.nodes.append(None)
+
+        if isinstance(v, JSONObject):
+            children = v
+            data = ''
+        elif isinstance(v, list):
+            children = [('', e) for e in v]
+            data = ''
+        else:
+            children = []
+            data = self.value(v)
+
+        self.nodes[node] = self.string(key) + self.string(data) + (len(children),)
+
+        for k, c in children:
+            self.add(k, c)
+
+    def output(self, source):
+        header = struct.pack('<4sIQIIII', MAGIC, VERSION, fnv1a(source),
+                             len(source), len(self.nodes), len(self.strings), 0)
+        nodes = b''.join(struct.pack('<IIIII', *n) for n in self.nodes)
+        return header + nodes + bytes(self.strings)
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description='Compile a Raspberry Pi JSON tuning file')
+    parser.add_argument('input', type=str, help='Input JSON tuning file')
+    parser.add_argument('output', type=str, help='Output binary tuning file')
+    args = parser.parse_args(argv[1:])
+
+    with open(args.input, 'rb') as f:
+        source = f.read()
+
+    # Keep the numbers as strings, and the objects as ordered lists of
+    # key-value pairs to preserve duplicate keys.
+    decoder = json.JSONDecoder(object_pairs_hook=JSONObject,
+                               parse_float=str, parse_int=str,
+                               parse_constant=str)
+    tree = decoder.decode(source.decode('utf-8'))
+
+    compiler = Compiler()
+    compiler.add('', tree)
+
+    with open(args.output, 'wb') as f:
+        f.write(compiler.output(source))
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))